@@ -0,0 +1,120 @@
+#include <cos_component.h>
+#include <cos_types.h>
+#include <cos_debug.h>
+#include <llprint.h>
+#include <string.h>
+#include <memmgr.h>
+#include <blkdev.h>
+
+/***
+ * A block device in memory, that the clients read and write with a
+ * single copy between its memory and theirs. Its pages are only
+ * allocated as they are first touched, so its size costs nothing
+ * until it is used. The same interface is meant to be served by an
+ * NVMe driver (with lib/pci), that DMAs to and from the clients'
+ * memory, whose physical addresses the memmgr gives.
+ */
+
+#ifndef BLKDEV_RAMDISK_MB
+#define BLKDEV_RAMDISK_MB 256
+#endif
+
+#define RAMDISK_SZ ((u64_t)BLKDEV_RAMDISK_MB * 1024 * 1024)
+
+struct ramdisk_client {
+	char               *mem;
+	unsigned long       mem_sz;
+	struct blkdev_reqs *reqs;
+};
+
+static char                 *ramdisk;
+static struct ramdisk_client ramdisk_clients[MAX_NUM_COMPS];
+
+u64_t
+blkdev_capacity(void)
+{
+	return RAMDISK_SZ / BLKDEV_SECTOR_SZ;
+}
+
+int
+blkdev_mem_map(cbuf_t mem, cbuf_t reqs)
+{
+	compid_t               id = (compid_t)cos_inv_token();
+	struct ramdisk_client *c;
+	vaddr_t                mem_addr = 0, reqs_addr = 0;
+	unsigned long          npages;
+
+	if (id >= MAX_NUM_COMPS) return -EINVAL;
+	c = &ramdisk_clients[id];
+	if (c->mem) return -EEXIST;
+
+	/* Aligned as the memory of a VM, that is mapped with superpages */
+	npages = memmgr_shared_page_map_aligned(mem, SUPER_PAGE_SIZE, &mem_addr);
+	if (!npages) return -ENOMEM;
+	if (memmgr_shared_page_map(reqs, &reqs_addr) * PAGE_SIZE < sizeof(struct blkdev_reqs)) return -EINVAL;
+
+	c->reqs   = (struct blkdev_reqs *)reqs_addr;
+	c->mem_sz = npages * PAGE_SIZE;
+	__atomic_store_n(&c->mem, (char *)mem_addr, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+static int
+ramdisk_req(struct ramdisk_client *c, struct blkdev_req *r)
+{
+	u64_t start;
+
+	/* The writes are in memory as soon as they are done */
+	if (r->op == BLKDEV_OP_FLUSH) return 0;
+
+	if (r->sector >= blkdev_capacity() || r->len % BLKDEV_SECTOR_SZ) return -EINVAL;
+	start = r->sector * BLKDEV_SECTOR_SZ;
+	if (r->len > RAMDISK_SZ - start) return -EINVAL;
+	if (r->off > c->mem_sz || r->len > c->mem_sz - r->off) return -EINVAL;
+
+	switch (r->op) {
+	case BLKDEV_OP_READ:
+		memcpy(c->mem + r->off, ramdisk + start, r->len);
+		break;
+	case BLKDEV_OP_WRITE:
+		memcpy(ramdisk + start, c->mem + r->off, r->len);
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+int
+blkdev_submit(int queue, int n)
+{
+	compid_t               id = (compid_t)cos_inv_token();
+	struct ramdisk_client *c;
+	struct blkdev_req     *reqs, r;
+	int                    i, nfail = 0;
+
+	if (id >= MAX_NUM_COMPS) return -EINVAL;
+	c = &ramdisk_clients[id];
+	if (!__atomic_load_n(&c->mem, __ATOMIC_ACQUIRE)) return -EINVAL;
+	if (queue < 0 || queue >= BLKDEV_QUEUES_MAX || n < 0 || n > BLKDEV_BATCH_MAX) return -EINVAL;
+
+	reqs = c->reqs->reqs[queue];
+	for (i = 0; i < n; i++) {
+		/* The client can still write the table, so each request is checked in a copy of its own */
+		r = reqs[i];
+		reqs[i].status = ramdisk_req(c, &r);
+		if (reqs[i].status) nfail++;
+	}
+
+	return nfail;
+}
+
+void
+cos_init(void)
+{
+	ramdisk = (char *)memmgr_heap_page_allocn_lazy(RAMDISK_SZ / PAGE_SIZE);
+	assert(ramdisk);
+	printc("ramdisk: %dMB, of %llu sectors\n", BLKDEV_RAMDISK_MB, blkdev_capacity());
+}
@@ -13,20 +13,37 @@
 #include <cos_component.h>
 #include <cos_kernel_api.h>
 #include <cos_defkernel_api.h>
+#include <cos_thd_init.h>
 #include <initargs.h>
 #include <addr.h>
 #include <contigmem.h>
+#include <memmgr.h>
+#include <pmu.h>
 
 struct cm_rcv {
-	struct crt_rcv  rcv;
-	struct cm_comp *sched;
-	arcvcap_t       aliased_cap;
+	struct crt_rcv   rcv;
+	struct cm_comp  *sched;
+	arcvcap_t        aliased_cap;
+	/* The key of the aep (or 0), and the IPI rate limit of the asnds to it */
+	cos_channelkey_t key;
+	microsec_t       ipiwin;
+	u32_t            ipimax;
 };
 
+/* Maximum number of threads pre-created for a component on each core */
+#define CM_THD_POOL_MAX 16
+
 struct cm_comp {
 	struct crt_comp comp;
 	struct cm_rcv *sched_rcv[NUM_CPU];    /* rcv cap for this scheduler or NULL if not a scheduler */
 	struct cm_rcv *sched_parent; /* rcv cap for this scheduler's scheduler, or NULL */
+	/* Pre-created threads (thd_pool), and where they're aliased */
+	struct cm_thd  *thd_pool[NUM_CPU][CM_THD_POOL_MAX];
+	unsigned long   thd_pool_sz;
+	struct cm_comp *thd_pool_sched;
+	/* Restarted on a fault (cm_restart), and the end of its image */
+	int             restart;
+	vaddr_t         img_end;
 };
 
 struct cm_thd {
@@ -35,6 +52,7 @@ struct cm_thd {
 	struct cm_comp *client; /* component thread begins execution in */
 	struct cm_comp *sched;	/* The scheduler that has the alias */
 	thdcap_t aliased_cap;	/* location thread is aliased into the scheduler. */
+	unsigned long pool_state; /* CM_THD_POOL_* if pre-created in a pool */
 };
 
 struct cm_asnd {
@@ -63,6 +81,7 @@ struct mm_page {
 struct mm_span {
 	unsigned int page_off;
 	unsigned int n_pages;
+	unsigned int superpages; /* are its pages superpages, mapped as such? */
 };
 
 SS_STATIC_SLAB(comp, struct cm_comp, MAX_NUM_COMPS);
@@ -74,11 +93,23 @@ SS_STATIC_SLAB(asnd, struct cm_asnd, MAX_NUM_THREADS);
 /* 64 MiB */
 #define MB2PAGES(mb) (round_up_to_page(mb * 1024 * 1024) / PAGE_SIZE)
 #define MM_NPAGES (MB2PAGES(512))
-SS_STATIC_SLAB(page, struct mm_page, MM_NPAGES);
-SS_STATIC_SLAB(span, struct mm_span, MM_NPAGES);
+
+static struct cm_comp *cm_self(void);
+
+/* The chunks of the page and span tables, from our own memory */
+static vaddr_t
+mm_slab_chunk_alloc(unsigned long npages, unsigned long align)
+{
+	return (vaddr_t)cos_page_bump_allocn_aligned(cos_compinfo_get(cm_self()->comp.comp_res), npages * PAGE_SIZE, align);
+}
+
+SS_DYNAMIC_SLAB_ALLOC(page, struct mm_page, MM_NPAGES, 1, mm_slab_chunk_alloc);
+SS_DYNAMIC_SLAB_ALLOC(span, struct mm_span, MM_NPAGES, 1, mm_slab_chunk_alloc);
 
 #define CONTIG_PHY_PAGES 70000
 static void * contig_phy_pages = 0;
+/* The pages of the pool already allocated */
+static unsigned long contig_phy_off = 0;
 
 static struct cm_comp *
 cm_self(void)
@@ -90,6 +121,48 @@ cm_self(void)
 	return c;
 }
 
+/***
+ * The memory of each component is accounted in `mm_stats`, a page that
+ * the components can map read-only (`memmgr_stats_map`): the frames it
+ * holds are charged to it when they are allocated, and against its
+ * quota (`memquota` in the composition, in MiB), and the pages of the
+ * others' allocations it maps are counted as shared.
+ */
+static struct memmgr_stats *mm_stats;
+/* The processor topology, read from the kernel at initialization */
+static struct cos_topology *mm_topology;
+
+static inline struct memmgr_comp_stats *
+mm_stats_of(struct cm_comp *c)
+{
+	return &mm_stats->comps[ss_comp_id(c)];
+}
+
+/* Charge `n` frames to `c`: 0, or -ENOMEM if they exceed its quota */
+static int
+mm_charge(struct cm_comp *c, unsigned long n)
+{
+	struct memmgr_comp_stats *st = mm_stats_of(c);
+	unsigned long             quota = ps_load(&st->quota);
+
+	ps_faa(&st->allocs, 1);
+	if (quota && ps_faa(&st->frames, n) + n > quota) {
+		ps_faa(&st->frames, -(long)n);
+		ps_faa(&st->denied, 1);
+
+		return -ENOMEM;
+	}
+	if (!quota) ps_faa(&st->frames, n);
+
+	return 0;
+}
+
+static inline void
+mm_uncharge(struct cm_comp *c, unsigned long n)
+{
+	ps_faa(&mm_stats_of(c)->frames, -(long)n);
+}
+
 static struct cm_comp *
 cm_comp_self_alloc(char *name)
 {
@@ -112,6 +185,7 @@ cm_comp_alloc_with(char *name, compid_t id, struct crt_comp_resources *resources
 		ss_comp_free(c);
 		return NULL;
 	}
+	crt_comp_placement_init(&c->comp);
 	ss_comp_activate(c);
 
 	return c;
@@ -131,6 +205,9 @@ cm_rcv_alloc_in(struct crt_comp *c, struct crt_rcv *sched, thdclosure_index_t cl
 		ss_rcv_free(r);
 		return NULL;
 	}
+	r->key    = 0;
+	r->ipiwin = 0;
+	r->ipimax = 0;
 	ss_rcv_activate(r);
 
 	if (crt_rcv_alias_in(&r->rcv, c, &res, CRT_RCV_ALIAS_THD | CRT_RCV_ALIAS_RCV | CRT_RCV_ALIAS_TCAP)) {
@@ -146,14 +223,15 @@ cm_rcv_alloc_in(struct crt_comp *c, struct crt_rcv *sched, thdclosure_index_t cl
 	return r;
 }
 
+/* An asnd to the rcv, aliased in c, with the IPI rate limit of the rcv */
 struct cm_asnd *
-cm_asnd_alloc_in(struct crt_comp *c, struct crt_rcv *rcv)
+cm_asnd_alloc_in(struct crt_comp *c, struct cm_rcv *rcv)
 {
 	struct cm_asnd *s = ss_asnd_alloc();
 	struct crt_asnd_resources res = { 0 };
 
 	if (!s) return NULL;
-	if (crt_asnd_create(&s->asnd, rcv)) {
+	if (crt_asnd_create_ipilimit(&s->asnd, &rcv->rcv, rcv->ipiwin, rcv->ipimax)) {
 		ss_asnd_free(s);
 		return NULL;
 	}
@@ -195,59 +273,832 @@ cm_thd_alloc_in(struct cm_comp *c, struct cm_comp *sched, thdclosure_index_t clo
 	return t;
 }
 
+/***
+ * The threads pre-created for a component (`thd_pool` in the
+ * composition) begin execution in the COS_THD_POOL_CLOSURE, and are
+ * aliased into its scheduler, or into itself if it is a scheduler.
+ * Creating a thread then takes no kernel operations: the component
+ * reserves a pooled thread, sets its closure, and its creation hands
+ * out the reserved thread (see cos_thd_init.h).
+ *
+ * Each core has its own pool, as threads execute on the core they
+ * were created on. The slots and the threads' states are updated with
+ * `cas`, as the threads of the core can preempt each other here. A
+ * slot being filled holds CM_THD_POOL_FILLING.
+ */
+#define CM_THD_POOL_FILLING ((struct cm_thd *)1)
+
+enum {
+	CM_THD_POOL_NONE = 0,
+	CM_THD_POOL_FREE,
+	CM_THD_POOL_RESERVED,
+};
+
+static int
+cm_thd_pool_fill(struct cm_comp *c)
+{
+	struct cm_thd **pool = c->thd_pool[cos_cpuid()];
+	struct cm_thd  *t;
+	unsigned long   i;
+	int             n = 0;
+
+	for (i = 0; i < c->thd_pool_sz; i++) {
+		if (!ps_cas((unsigned long *)&pool[i], 0, (unsigned long)CM_THD_POOL_FILLING)) continue;
+		t = cm_thd_alloc_in(c, c->thd_pool_sched, COS_THD_POOL_CLOSURE);
+		if (!t) {
+			pool[i] = NULL;
+			break;
+		}
+		t->pool_state = CM_THD_POOL_FREE;
+		pool[i]       = t;
+		n++;
+	}
+
+	return n;
+}
+
+static thdid_t
+cm_thd_pool_reserve(struct cm_comp *c)
+{
+	struct cm_thd **pool = c->thd_pool[cos_cpuid()];
+	struct cm_thd  *t;
+	unsigned long   i;
+
+	for (i = 0; i < c->thd_pool_sz; i++) {
+		t = pool[i];
+		if (!t || t == CM_THD_POOL_FILLING) continue;
+		if (ps_cas(&t->pool_state, CM_THD_POOL_FREE, CM_THD_POOL_RESERVED)) return t->thd.tid;
+	}
+
+	return 0;
+}
+
+/* Take the reserved thread tid out of the pool, if it's aliased in sched */
+static struct cm_thd *
+cm_thd_pool_take(struct cm_comp *c, struct cm_comp *sched, thdid_t tid)
+{
+	struct cm_thd **pool = c->thd_pool[cos_cpuid()];
+	struct cm_thd  *t;
+	unsigned long   i;
+
+	for (i = 0; i < c->thd_pool_sz; i++) {
+		t = pool[i];
+		if (!t || t == CM_THD_POOL_FILLING || t->thd.tid != tid) continue;
+		if (t->sched != sched || !ps_cas(&t->pool_state, CM_THD_POOL_RESERVED, CM_THD_POOL_NONE)) return NULL;
+		pool[i] = NULL;
+
+		return t;
+	}
+
+	return NULL;
+}
+
+/***
+ * The frames of the heaps are carved out of per-core caches of runs
+ * of MM_RUN_PAGES pages, contiguous in our address space, so that
+ * allocating `n` pages takes one alias of the whole run into the
+ * client, rather than an allocation and an alias per page. A cache
+ * is refilled with a single bump allocation, and the larger requests
+ * (or those of another NUMA node) bypass it.
+ *
+ * The next free page of a cache is a single word, carved with `cas`,
+ * as the threads of the core can preempt each other here. Its run is
+ * aligned on its size, so the word also identifies the run, and the
+ * last page of a run is never carved, so that a full run isn't
+ * mistaken for the next one. A thread preempted while refilling the
+ * cache can lose its run to another refill (it then serves only its
+ * own request).
+ */
+#define MM_RUN_PAGES   512
+#define MM_RUN_SZ      (MM_RUN_PAGES * PAGE_SIZE)
+#define MM_RUN_MAX_REQ (MM_RUN_PAGES / 4)
+
+struct mm_frame_cache {
+	word_t next; /* the next free page of the run, 0 if none */
+} CACHE_ALIGNED;
+
+static struct mm_frame_cache mm_frame_caches[NUM_CPU];
+
+/* The descriptors of the pages are allocated in ranges, so spans can be indexed */
+static unsigned long mm_page_frontier;
+
+static void *
+mm_frames_refill(struct mm_frame_cache *fc, word_t old, unsigned long npages)
+{
+	word_t run;
+
+	run = (word_t)cos_page_bump_allocn_aligned(cos_compinfo_get(cm_self()->comp.comp_res), MM_RUN_SZ, MM_RUN_SZ);
+	if (!run) return NULL;
+	/* If another thread refilled the cache meanwhile, keep its run */
+	ps_cas(&fc->next, old, run + npages * PAGE_SIZE);
+
+	return (void *)run;
+}
+
+/*
+ * Allocate `npages` frames, contiguous in our address space.
+ *
+ * - @node - The NUMA node to prefer, or `COS_NUMA_NODE_LOCAL`.
+ * - @return - the first frame, or `NULL` if no memory is available.
+ */
+static void *
+mm_frames_alloc(unsigned long npages, int node)
+{
+	struct mm_frame_cache *fc = &mm_frame_caches[cos_cpuid()];
+	word_t next, off;
+
+	if (npages > MM_RUN_MAX_REQ || node != COS_NUMA_NODE_LOCAL) {
+		return crt_page_allocn_node(&cm_self()->comp, npages, node);
+	}
+
+	do {
+		next = ps_load(&fc->next);
+		off  = next & (MM_RUN_SZ - 1);
+		if (!next || off + npages * PAGE_SIZE >= MM_RUN_SZ) return mm_frames_refill(fc, next, npages);
+	} while (!ps_cas(&fc->next, next, next + npages * PAGE_SIZE));
+
+	return (void *)next;
+}
+
+/*
+ * Track the `npages` pages at `pages`, mapped at `vaddr` into `c`,
+ * with descriptors of consecutive ids. If `vaddr` is 0, the pages
+ * aren't mapped yet.
+ *
+ * - @return - the descriptor of the first page, or `NULL` if there
+ *   are no more descriptors.
+ */
+static struct mm_page *
+mm_pages_track(struct cm_comp *c, void *pages, vaddr_t vaddr, unsigned long npages)
+{
+	struct mm_mapping *m;
+	struct mm_page    *p, *initial = NULL;
+	unsigned long      first, i;
+
+	first = ps_faa(&mm_page_frontier, npages);
+	if (first + npages > MM_NPAGES) return NULL;
+
+	for (i = 0; i < npages; i++) {
+		/* The ids start at 1 */
+		p = ss_page_alloc_at_id(first + i + 1);
+		assert(p);
+		if (i == 0) initial = p;
+
+		p->page = pages + i * PAGE_SIZE;
+		if (vaddr) {
+			m = &p->mappings[0];
+			if (ss_state_alloc(&m->comp)) BUG();
+			m->addr = vaddr + i * PAGE_SIZE;
+			ss_state_activate_with(&m->comp, (word_t)c);
+		}
+		ss_page_activate(p);
+	}
+
+	return initial;
+}
+
+/**
+ * Allocate `num_pages` pages from the pool of physical memory into a
+ * component, at a virtual address aligned on `align`.
+ *
+ * - @c - The component to allocate into.
+ * - @node - The NUMA node to prefer, or `COS_NUMA_NODE_LOCAL`.
+ * - @return - the first of the allocated and initialized pages, whose
+ *   descriptors are consecutive, or `NULL` if no page is available.
+ */
+static struct mm_page *
+mm_page_allocn(struct cm_comp *c, unsigned long num_pages, unsigned long align, int node)
+{
+	void   *pages;
+	vaddr_t vaddr;
+
+	pages = mm_frames_alloc(num_pages, node);
+	if (!pages) return NULL;
+	if (crt_page_aliasn_aligned_in(pages, align, num_pages, &cm_self()->comp, &c->comp, &vaddr)) BUG();
+
+	return mm_pages_track(c, pages, vaddr, num_pages);
+}
+
 /**
- * Allocate a page from the pool of physical memory into a component.
+ * Allocate `n_superpages` physically contiguous superpages, and map
+ * them into component `c` with superpage mappings.  Each of the
+ * constituent pages is tracked as a separate `struct mm_page` so
+ * that the rest of the page management works unchanged.
  *
  * - @c - The component to allocate into.
- * - @return - the allocated and initialized page, or `NULL` if no
- *   page is available.
+ * - @return - the first of the pages, or `NULL` if the memory isn't
+ *   available.
  */
 static struct mm_page *
-mm_page_alloc(struct cm_comp *c, unsigned long align)
+mm_superpage_allocn(struct cm_comp *c, unsigned long n_superpages)
+{
+	void   *pages;
+	vaddr_t vaddr;
+
+	if (mm_charge(c, n_superpages * (SUPER_PAGE_SIZE / PAGE_SIZE))) return NULL;
+	pages = crt_superpage_allocn(&cm_self()->comp, n_superpages);
+	if (!pages) {
+		mm_uncharge(c, n_superpages * (SUPER_PAGE_SIZE / PAGE_SIZE));
+		return NULL;
+	}
+	if (crt_superpage_aliasn_in(pages, n_superpages, &cm_self()->comp, &c->comp, &vaddr)) BUG();
+
+	return mm_pages_track(c, pages, vaddr, n_superpages * (SUPER_PAGE_SIZE / PAGE_SIZE));
+}
+
+/***
+ * The heap pages can be released (`memmgr_heap_page_release`), and
+ * mapped at an address of the client's choice below its frontier
+ * (`memmgr_heap_page_allocn_at`), so that the clients can manage
+ * their address space (e.g. for `munmap` and `mremap`).
+ *
+ * The heap pages are found from their client's address in `mm_vmaps`,
+ * an open-addressing table of the pages each client mapped, keyed by
+ * its id and the page number. An entry removed keeps its key, so the
+ * probes continue past it, with a page id of 0.
+ *
+ * The frames released are kept, in runs of contiguous frames (of
+ * consecutive descriptors), to be reused by the next allocations. The
+ * client's TLBs are flushed lazily, so it can still access the frames
+ * until the TLBs are quiescent: only the client that released a run
+ * can reuse it before then. The frames are zeroed when reused.
+ */
+#define MM_VMAP_SZ       (MM_NPAGES * 2)
+#define MM_FREE_RUNS_MAX 1024
+
+struct mm_vmap {
+	u64_t        key;     /* 0 if the entry was never used */
+	unsigned int page_id; /* 0 if the entry was removed */
+};
+
+struct mm_free_run {
+	unsigned int page_id; /* the descriptor of the first page */
+	unsigned int n_pages;
+	compid_t     comp;    /* the component that released the pages */
+	cycles_t     released;
+};
+
+static struct mm_vmap     mm_vmaps[MM_VMAP_SZ];
+static struct mm_free_run mm_free_runs[MM_FREE_RUNS_MAX];
+static unsigned long      mm_free_runs_n;
+/* Protects both the vmaps and the free runs */
+static struct ps_lock     mm_heap_lock;
+
+static inline u64_t
+mm_vmap_key(struct cm_comp *c, vaddr_t addr)
+{
+	return ((u64_t)ss_comp_id(c) << 48) | (addr / PAGE_SIZE);
+}
+
+/* The entry of `key`, or if there is none, the entry to add it at, or `NULL` */
+static struct mm_vmap *
+mm_vmap_probe(u64_t key, struct mm_vmap **add)
+{
+	struct mm_vmap *e;
+	unsigned long   h = (key * 0x9E3779B97F4A7C15ULL) >> 32, i;
+
+	*add = NULL;
+	for (i = 0; i < MM_VMAP_SZ; i++) {
+		e = &mm_vmaps[(h + i) & (MM_VMAP_SZ - 1)];
+		if (e->key == key) return e;
+		if (!*add && !e->page_id) *add = e;
+		if (!e->key) return NULL;
+	}
+
+	return NULL;
+}
+
+static struct mm_page *
+mm_vmap_lookup(struct cm_comp *c, vaddr_t addr)
+{
+	struct mm_vmap *e, *add;
+
+	e = mm_vmap_probe(mm_vmap_key(c, addr), &add);
+	if (!e || !e->page_id) return NULL;
+
+	return ss_page_get(e->page_id);
+}
+
+/*
+ * The lazy ranges of the heaps (`memmgr_heap_page_allocn_lazy`): their
+ * virtual addresses are reserved, but their pages are only mapped on
+ * the first access to them, by the page fault handler of the core
+ * (`mm_pgflt_handler`), `MM_LAZY_BATCH` at a time, around the address
+ * of the fault. The ranges are only added, under the heap lock, and
+ * looked up without it: a range is published by the count.
+ */
+#define MM_LAZY_MAX   64
+#define MM_LAZY_BATCH 8
+/* The bit of a fault's error code set if the page was present */
+#define MM_PGFLT_PRESENT 0x1
+
+struct mm_lazy {
+	struct cm_comp *comp;
+	unsigned long   pgtbl; /* the id of its page-table, as the faults report it */
+	vaddr_t         start, end;
+};
+
+static struct mm_lazy mm_lazies[MM_LAZY_MAX];
+static unsigned long  mm_lazies_n;
+/* The number of cores whose handler is attached, of `mm_ncores` */
+static unsigned long  mm_pgflt_ncores, mm_ncores;
+
+static struct mm_lazy *
+mm_lazy_find(struct cm_comp *c, unsigned long pgtbl, vaddr_t addr)
+{
+	unsigned long i, n = ps_load(&mm_lazies_n);
+
+	for (i = 0; i < n; i++) {
+		struct mm_lazy *l = &mm_lazies[i];
+
+		if ((c ? l->comp == c : l->pgtbl == pgtbl) && addr >= l->start && addr < l->end) return l;
+	}
+
+	return NULL;
+}
+
+/*
+ * Map the `n_pages` descriptors from `p` at `addr` in `c`, and add
+ * them to the vmaps, under the heap lock.
+ */
+static int
+mm_heap_track(struct cm_comp *c, struct mm_page *p, vaddr_t addr, unsigned long n_pages)
 {
 	struct mm_mapping *m;
-	struct mm_page    *ret = NULL, *p;
-	int    i;
+	struct mm_vmap    *e, *add;
+	unsigned long      i;
+	u64_t              key;
+
+	for (i = 0; i < n_pages; i++, addr += PAGE_SIZE) {
+		if (i) p = ss_page_get(ss_page_id(p) + 1);
+		key = mm_vmap_key(c, addr);
+		e   = mm_vmap_probe(key, &add);
+		if (!e) e = add;
+		if (!e) return -ENOMEM;
+		e->key     = key;
+		e->page_id = ss_page_id(p);
 
-	p = ss_page_alloc();
-	if (!p) return NULL;
+		m = &p->mappings[0];
+		if (!ss_state_is_allocated(m->comp)) {
+			if (ss_state_alloc(&m->comp)) BUG();
+			ss_state_activate_with(&m->comp, (word_t)c);
+		}
+		m->addr = addr;
+	}
 
-	m = &p->mappings[0];
-	if (ss_state_alloc(&m->comp)) BUG();
+	return 0;
+}
 
-	/* Allocate page, map page */
-	p->page = crt_page_allocn(&cm_self()->comp, 1);
-	if (!p->page) ERR_THROW(NULL, free_p);
-	if (crt_page_aliasn_aligned_in(p->page, align, 1, &cm_self()->comp, &c->comp, &m->addr)) BUG();
+/*
+ * Take the first `n_pages` of the first free run `c` can reuse, under
+ * the heap lock.
+ */
+static struct mm_page *
+mm_free_take(struct cm_comp *c, unsigned long n_pages)
+{
+	struct mm_free_run *r;
+	unsigned long       i;
+	cycles_t            now = ps_tsc();
+	unsigned int        id;
+
+	for (i = 0; i < mm_free_runs_n; i++) {
+		r = &mm_free_runs[i];
+		if (r->n_pages < n_pages) continue;
+		if (r->comp != ss_comp_id(c) && !QUIESCENCE_CHECK(now, r->released, TLB_QUIESCENCE_CYCLES)) continue;
+
+		id          = r->page_id;
+		r->page_id += n_pages;
+		r->n_pages -= n_pages;
+		if (!r->n_pages) *r = mm_free_runs[--mm_free_runs_n];
+
+		return ss_page_get(id);
+	}
 
-	ss_state_activate_with(&m->comp, (word_t)c);
-	ss_page_activate(p);
-	ret = p;
-done:
-	return ret;
-free_p:
-	ss_page_free(p);
-	goto done;
+	return NULL;
+}
+
+/* Keep the `n_pages` unmapped pages from `p`, released by `c`, under the heap lock */
+static void
+mm_free_push(struct cm_comp *c, struct mm_page *p, unsigned long n_pages)
+{
+	/* The releases check there is room, so only a failed map can lose its pages */
+	if (mm_free_runs_n == MM_FREE_RUNS_MAX) return;
+
+	mm_free_runs[mm_free_runs_n++] = (struct mm_free_run) {
+		.page_id  = ss_page_id(p),
+		.n_pages  = n_pages,
+		.comp     = ss_comp_id(c),
+		.released = ps_tsc(),
+	};
+}
+
+/* Can `p` extend the run of pages that ends with `prev`? */
+static inline int
+mm_page_follows(struct mm_page *prev, struct mm_page *p)
+{
+	return ss_page_id(p) == ss_page_id(prev) + 1 && p->page == prev->page + PAGE_SIZE;
 }
 
+/*
+ * Unmap and keep the `n_pages` heap pages at `addr` of `c`, under the
+ * heap lock. Either all of the pages are released, or none.
+ *
+ * - @return - 0 on success, `-EINVAL` if a page isn't a heap page of
+ *   `c`, or `-ENOMEM` if the runs of the pages can't be kept.
+ */
+static int
+mm_heap_release(struct cm_comp *c, vaddr_t addr, unsigned long n_pages)
+{
+	struct cos_compinfo *ci = cos_compinfo_get(c->comp.comp_res);
+	struct mm_vmap      *e, *add;
+	struct mm_page      *p, *prev = NULL, *first = NULL;
+	unsigned long        i, n_runs = 0, run = 0;
+	vaddr_t              a;
+
+	if (!n_pages || addr % PAGE_SIZE) return -EINVAL;
+	for (i = 0, a = addr; i < n_pages; i++, a += PAGE_SIZE) {
+		p = mm_vmap_lookup(c, a);
+		/* The pages of a lazy range that were never accessed have nothing to release */
+		if (!p && mm_lazy_find(c, 0, a)) {
+			prev = NULL;
+			continue;
+		}
+		if (!p) return -EINVAL;
+		if (!prev || !mm_page_follows(prev, p)) n_runs++;
+		prev = p;
+	}
+	if (mm_free_runs_n + n_runs > MM_FREE_RUNS_MAX) return -ENOMEM;
+
+	for (i = 0, a = addr, prev = NULL; i < n_pages; i++, a += PAGE_SIZE) {
+		e = mm_vmap_probe(mm_vmap_key(c, a), &add);
+		if (!e || !e->page_id) {
+			if (run) mm_free_push(c, first, run);
+			run  = 0;
+			prev = NULL;
+			continue;
+		}
+		p = ss_page_get(e->page_id);
+		if (cos_mem_remove(ci->pgtbl_cap, a)) BUG();
+		e->page_id = 0;
+		ss_state_free(&p->mappings[0].comp);
+		mm_uncharge(c, 1);
+
+		if (prev && !mm_page_follows(prev, p)) {
+			mm_free_push(c, first, run);
+			run = 0;
+		}
+		if (!run) first = p;
+		run++;
+		prev = p;
+	}
+	if (run) mm_free_push(c, first, run);
+
+	return 0;
+}
+
+/**
+ * Allocate `num_pages` heap pages into a component, reusing the
+ * frames released where possible, at a virtual address aligned on
+ * `align`.
+ *
+ * - @return - the first page, or `NULL` if no page is available.
+ */
 static struct mm_page *
-mm_page_allocn(struct cm_comp *c, unsigned long num_pages, unsigned long align)
+mm_heap_allocn(struct cm_comp *c, unsigned long num_pages, unsigned long align, int node)
 {
-	struct mm_page *p, *prev, *initial;
-	unsigned long i;
+	struct mm_page *p = NULL;
+	vaddr_t         vaddr;
+
+	if (mm_charge(c, num_pages)) return NULL;
+	if (node == COS_NUMA_NODE_LOCAL) {
+		ps_lock_take(&mm_heap_lock);
+		p = mm_free_take(c, num_pages);
+		ps_lock_release(&mm_heap_lock);
+	}
+	if (p) {
+		memset(p->page, 0, num_pages * PAGE_SIZE);
+		if (crt_page_aliasn_aligned_in(p->page, align, num_pages, &cm_self()->comp, &c->comp, &vaddr)) BUG();
+	} else {
+		p = mm_page_allocn(c, num_pages, align, node);
+		if (!p) {
+			mm_uncharge(c, num_pages);
+			return NULL;
+		}
+		vaddr = p->mappings[0].addr;
+	}
+
+	ps_lock_take(&mm_heap_lock);
+	if (mm_heap_track(c, p, vaddr, num_pages)) BUG();
+	ps_lock_release(&mm_heap_lock);
+
+	return p;
+}
+
+/*
+ * Allocate `num_pages` heap pages at `addr` in `c`: either at its
+ * frontier, or in a range below it that isn't mapped (and that is
+ * quiescent, if it was).
+ */
+static struct mm_page *
+mm_heap_allocn_at(struct cm_comp *c, vaddr_t addr, unsigned long num_pages)
+{
+	struct cos_compinfo *ci   = cos_compinfo_get(c->comp.comp_res);
+	struct cos_compinfo *self = cos_compinfo_get(cm_self()->comp.comp_res);
+	struct mm_page      *p = NULL;
+	unsigned long        i, j;
+	void                *pages;
+
+	if (addr % PAGE_SIZE || !num_pages) return NULL;
+	if (addr == ps_load(&ci->vas_frontier)) {
+		p = mm_heap_allocn(c, num_pages, PAGE_SIZE, COS_NUMA_NODE_LOCAL);
+		if (!p || p->mappings[0].addr == addr) return p;
+		/* Another allocation moved the frontier first */
+		ps_lock_take(&mm_heap_lock);
+		mm_heap_release(c, p->mappings[0].addr, num_pages);
+		ps_lock_release(&mm_heap_lock);
+
+		return NULL;
+	}
+	if (addr + num_pages * PAGE_SIZE > ps_load(&ci->vas_frontier) || addr + num_pages * PAGE_SIZE < addr) return NULL;
+	if (mm_charge(c, num_pages)) return NULL;
+
+	ps_lock_take(&mm_heap_lock);
+	p = mm_free_take(c, num_pages);
+	ps_lock_release(&mm_heap_lock);
+	if (p) {
+		memset(p->page, 0, num_pages * PAGE_SIZE);
+	} else {
+		pages = mm_frames_alloc(num_pages, COS_NUMA_NODE_LOCAL);
+		if (pages) p = mm_pages_track(c, pages, 0, num_pages);
+		if (!p) {
+			mm_uncharge(c, num_pages);
+			return NULL;
+		}
+	}
+
+	/* The kernel refuses to map over a mapping, or before the quiescence of a removed one */
+	for (i = 0; i < num_pages; i++) {
+		if (call_cap_op(self->pgtbl_cap, CAPTBL_OP_CPY, (vaddr_t)p->page + i * PAGE_SIZE, ci->pgtbl_cap,
+		                addr + i * PAGE_SIZE, COS_PAGE_READABLE | COS_PAGE_WRITABLE)) break;
+	}
+	if (i < num_pages) {
+		for (j = 0; j < i; j++) {
+			if (cos_mem_remove(ci->pgtbl_cap, addr + j * PAGE_SIZE)) BUG();
+		}
+		ps_lock_take(&mm_heap_lock);
+		mm_free_push(c, p, num_pages);
+		ps_lock_release(&mm_heap_lock);
+		mm_uncharge(c, num_pages);
+
+		return NULL;
+	}
 
-	initial = prev = p = mm_page_alloc(c, align);
+	ps_lock_take(&mm_heap_lock);
+	if (mm_heap_track(c, p, addr, num_pages)) BUG();
+	ps_lock_release(&mm_heap_lock);
+
+	return p;
+}
+
+/*
+ * Reserve `num_pages` of address space in `c`, mapped on their first
+ * access, or allocate them now if the faults can't be handled.
+ */
+static vaddr_t
+mm_heap_allocn_lazy(struct cm_comp *c, unsigned long num_pages)
+{
+	struct cos_compinfo *ci = cos_compinfo_get(c->comp.comp_res);
+	struct mm_page      *p;
+	unsigned long        pgtbl;
+	vaddr_t              addr;
+
+	if (!num_pages) return 0;
+	if (!mm_ncores || ps_load(&mm_pgflt_ncores) < mm_ncores) goto eager;
+	pgtbl = cos_hw_pgflt_pgtbl_id(BOOT_CAPTBL_SELF_INITHW_BASE, ci->pgtbl_cap);
+	if (!pgtbl) goto eager;
+
+	ps_lock_take(&mm_heap_lock);
+	if (mm_lazies_n == MM_LAZY_MAX) {
+		ps_lock_release(&mm_heap_lock);
+		goto eager;
+	}
+	addr = cos_page_bump_valloc(ci, num_pages * PAGE_SIZE, PAGE_SIZE);
+	if (!addr) {
+		ps_lock_release(&mm_heap_lock);
+		return 0;
+	}
+	mm_lazies[mm_lazies_n] = (struct mm_lazy) {
+		.comp  = c,
+		.pgtbl = pgtbl,
+		.start = addr,
+		.end   = addr + num_pages * PAGE_SIZE,
+	};
+	ps_mem_fence();
+	mm_lazies_n++;
+	ps_lock_release(&mm_heap_lock);
+
+	return addr;
+eager:
+	p = mm_heap_allocn(c, num_pages, PAGE_SIZE, COS_NUMA_NODE_LOCAL);
 	if (!p) return 0;
-	for (i = 1; i < num_pages; i++) {
-		p = mm_page_alloc(c, PAGE_SIZE);
-		if (!p) return NULL;
-		if ((prev->page + 4096) != p->page) {
-			BUG(); /* FIXME: handle concurrency */
+
+	return p->mappings[0].addr;
+}
+
+/*
+ * Map the pages around the fault `f`, in a lazy range: the batch of
+ * `MM_LAZY_BATCH` pages (aligned, and within the range) that holds
+ * it, or if some of the batch is already mapped, its page alone.
+ *
+ * - @return - 0 if the page is mapped, or -1 if the fault isn't one
+ *   of a lazy range.
+ */
+static int
+mm_lazy_populate(struct cos_pgflt *f)
+{
+	struct mm_lazy *l;
+	vaddr_t         page = round_to_page(f->addr), start, end;
+
+	/* Only the faults on pages that aren't present */
+	if (f->errcode & MM_PGFLT_PRESENT) return -1;
+	l = mm_lazy_find(NULL, f->pgtbl, f->addr);
+	if (!l) return -1;
+
+	start = page - (page - l->start) % (MM_LAZY_BATCH * PAGE_SIZE);
+	end   = start + MM_LAZY_BATCH * PAGE_SIZE;
+	if (end > l->end) end = l->end;
+
+	if (mm_heap_allocn_at(l->comp, start, (end - start) / PAGE_SIZE)) return 0;
+	if (mm_heap_allocn_at(l->comp, page, 1)) return 0;
+	/* Another core's handler mapped it first */
+	if (mm_vmap_lookup(l->comp, page)) return 0;
+
+	return -1;
+}
+
+/***
+ * Component restarts. The components with `restart = true` in the
+ * composition that are passive (only executing their clients'
+ * invocations) are checkpointed once their scheduler has initialized
+ * them (`capmgr_restart_checkpoint`): we alias their data, BSS, and
+ * the heap pages they were allocated, and keep a copy of them. When
+ * one of them faults on a page that can't be mapped, the handler of
+ * the core restarts it (`cm_restart`) rather than halting:
+ *
+ * - the pages that differ from the checkpoint are copied back from it,
+ *   including the stacks, so its threads (blocked since their
+ *   initialization) are those of the checkpoint as well;
+ * - the faulting invocation returns `-EAGAIN` to its client, which
+ *   can retry it.
+ *
+ * Its sinv capabilities, entry points, and page-table are unchanged,
+ * so its clients' capabilities stay valid. The pages are copied into
+ * place rather than remapped, as the kernel can't replace a present
+ * mapping before its TLB quiescence. The invocations in the component
+ * on other cores at the time of the fault aren't unwound, and the
+ * pages it was allocated since the checkpoint, or shares, are left as
+ * they are.
+ */
+#define CM_RESTART_MAX 16
+
+struct cm_restart {
+	struct cm_comp *comp;
+	unsigned long   pgtbl;  /* the id of its page-table, as the faults report it */
+	unsigned long   npgs;
+	vaddr_t        *addrs;  /* the address of each page in the component */
+	char           *live;   /* our alias of its pages */
+	char           *saved;  /* their copy at the checkpoint */
+	unsigned long   nrestarts;
+	struct ps_lock  lock;
+};
+
+static struct cm_restart cm_restarts[CM_RESTART_MAX];
+static unsigned long     cm_restarts_n;
+/* Serializes the checkpoints, which are published by the count */
+static struct ps_lock    cm_restart_lock;
+
+/* Is the heap page at `addr` in `c` its own, and not shared? */
+static int
+cm_restart_page_owned(struct cm_comp *c, vaddr_t addr)
+{
+	struct mm_page *p;
+	int             i;
+
+	ps_lock_take(&mm_heap_lock);
+	p = mm_vmap_lookup(c, addr);
+	for (i = 1; p && i < MM_MAPPINGS_MAX; i++) {
+		if (ss_state_is_allocated(p->mappings[i].comp)) p = NULL;
+	}
+	ps_lock_release(&mm_heap_lock);
+
+	return p != NULL;
+}
+
+static int
+cm_restart_checkpoint(struct cm_comp *c)
+{
+	struct cos_compinfo *ci      = cos_compinfo_get(c->comp.comp_res);
+	struct cos_compinfo *self_ci = cos_compinfo_get(cm_self()->comp.comp_res);
+	struct cm_restart   *r;
+	vaddr_t              start, end, addr;
+	unsigned long        max_pgs, n = 0;
+	int                  ret = -ENOMEM;
+
+	start = round_to_page(addr_get(c->comp.id, ADDR_RW_BASE));
+	end   = ci->vas_frontier;
+	if (!start || start >= end) return -EINVAL;
+	max_pgs = (end - start) / PAGE_SIZE;
+
+	ps_lock_take(&cm_restart_lock);
+	if (cm_restarts_n == CM_RESTART_MAX) goto done;
+	r = &cm_restarts[cm_restarts_n];
+
+	r->live  = (char *)cos_page_bump_valloc(self_ci, max_pgs * PAGE_SIZE, PAGE_SIZE);
+	r->addrs = crt_page_allocn(&cm_self()->comp, round_up_to_page(max_pgs * sizeof(vaddr_t)) / PAGE_SIZE);
+	if (!r->live || !r->addrs) goto done;
+	for (addr = start; addr < end; addr += PAGE_SIZE) {
+		if (addr >= c->img_end && !cm_restart_page_owned(c, addr)) continue;
+		if (cos_mem_alias_at(self_ci, (vaddr_t)r->live + n * PAGE_SIZE, ci, addr, COS_PAGE_READABLE | COS_PAGE_WRITABLE)) continue;
+		r->addrs[n++] = addr;
+	}
+	if (n == 0) goto done;
+	r->saved = crt_page_allocn(&cm_self()->comp, n);
+	if (!r->saved) goto done;
+	memcpy(r->saved, r->live, n * PAGE_SIZE);
+
+	r->comp  = c;
+	r->npgs  = n;
+	r->pgtbl = cos_hw_pgflt_pgtbl_id(BOOT_CAPTBL_SELF_INITHW_BASE, ci->pgtbl_cap);
+	ps_lock_init(&r->lock);
+	ps_store(&cm_restarts_n, cm_restarts_n + 1);
+	ret = 0;
+done:
+	ps_lock_release(&cm_restart_lock);
+	if (!ret) printc("capmgr: checkpointed component %lu (%lu pages) for its restart.\n", c->comp.id, n);
+
+	return ret;
+}
+
+/*
+ * Restart the component of the fault `f`, if it has a checkpoint, and
+ * return the faulting thread to its client.
+ *
+ * - @return - 0 if the thread was returned (or left to its scheduler),
+ *   -1 if the fault can't be handled by a restart.
+ */
+static int
+cm_restart(struct cos_pgflt *f)
+{
+	struct cm_restart *r = NULL;
+	unsigned long      i, n = ps_load(&cm_restarts_n), gen;
+	cycles_t           start = ps_tsc();
+	char              *live, *saved;
+	int                ret;
+
+	for (i = 0; i < n && !r; i++) {
+		if (cm_restarts[i].pgtbl == f->pgtbl) r = &cm_restarts[i];
+	}
+	if (!r) return -1;
+
+	gen = ps_load(&r->nrestarts);
+	ps_lock_take(&r->lock);
+	/* A fault on another core might have restarted it while we waited */
+	if (r->nrestarts == gen) {
+		for (i = 0; i < r->npgs; i++) {
+			live  = r->live + i * PAGE_SIZE;
+			saved = r->saved + i * PAGE_SIZE;
+			if (memcmp(live, saved, PAGE_SIZE)) memcpy(live, saved, PAGE_SIZE);
 		}
-		prev = p;
+		ps_store(&r->nrestarts, gen + 1);
 	}
+	ps_lock_release(&r->lock);
+	printc("capmgr: restarted component %lu after the fault of thread %lu at %lx (ip %lx), in %llu cycles.\n",
+	       r->comp->comp.id, (unsigned long)f->tid, f->addr, f->ip, (unsigned long long)(ps_tsc() - start));
 
-	return initial;
+	/* We're only switched back to on the next fault */
+	ret = cos_hw_pgflt_abort(BOOT_CAPTBL_SELF_INITHW_BASE, -EAGAIN);
+	/* Dispatched by its scheduler since, it executes on the restored state */
+	if (ret == -EAGAIN) cos_hw_pgflt_resume(BOOT_CAPTBL_SELF_INITHW_BASE);
+
+	return ret == -ENOENT || ret == -EINVAL ? -1 : 0;
+}
+
+static void
+mm_pgflt_handler(void *d)
+{
+	struct cos_pgflt f;
+
+	/* We only run when a fault switches to us */
+	while (1) {
+		if (cos_hw_pgflt_info(BOOT_CAPTBL_SELF_INITHW_BASE, &f)) BUG();
+		if (!mm_lazy_populate(&f)) {
+			cos_hw_pgflt_resume(BOOT_CAPTBL_SELF_INITHW_BASE);
+		} else if (cm_restart(&f)) {
+			printc("capmgr: unhandled page fault of thread %lu at %lx (ip %lx, errcode %lx)\n",
+			       (unsigned long)f.tid, f.addr, f.ip, f.errcode);
+			BUG();
+		}
+	}
 }
 
 static vaddr_t
@@ -267,116 +1118,141 @@ memmgr_virt_to_phys(vaddr_t vaddr)
 	return __memmgr_virt_to_phys(cos_inv_token(), vaddr);
 }
 
+/* Check the `npages` mappings, of `pgsz` bytes each, at `vaddr` are physically contiguous */
 static void
-contigmem_check(compid_t id, vaddr_t vaddr, int npages)
+contigmem_check(compid_t id, vaddr_t vaddr, int npages, unsigned long pgsz)
 {
 	vaddr_t paddr_pre = 0, paddr_next = 0;
 
 	paddr_pre = __memmgr_virt_to_phys(id, vaddr);
 
 	for (int i = 1; i < npages; i++) {
-		paddr_next = __memmgr_virt_to_phys(id, vaddr + i * PAGE_SIZE);
-		assert(paddr_next - paddr_pre == PAGE_SIZE);
+		paddr_next = __memmgr_virt_to_phys(id, vaddr + i * pgsz);
+		assert(paddr_next - paddr_pre == pgsz);
 
 		paddr_pre = paddr_next;
 	}
 }
 
+/*
+ * Take `npages` of the physically contiguous pool, shared by the
+ * cores, or `NULL` if it doesn't have as many left.
+ */
+static void *
+contigmem_pages_take(unsigned long npages)
+{
+	unsigned long off = ps_faa(&contig_phy_off, npages);
+
+	if (off + npages > CONTIG_PHY_PAGES) return NULL;
+
+	return contig_phy_pages + off * PAGE_SIZE;
+}
+
 vaddr_t
 contigmem_alloc(unsigned long npages)
 {
 	struct cm_comp *c;
-	struct mm_page *p;
-
-	struct mm_mapping *m;
-
-	vaddr_t vaddr;
-	unsigned long i;
+	vaddr_t         vaddr;
+	void           *page;
 
 	c = ss_comp_get(cos_inv_token());
 	if (!c) return 0;
-
-	void *page = contig_phy_pages;
+	if (mm_charge(c, npages)) return 0;
+	page = contigmem_pages_take(npages);
+	if (!page) {
+		mm_uncharge(c, npages);
+		return 0;
+	}
 
 	if (crt_page_aliasn_aligned_in(page, PAGE_SIZE, npages, &cm_self()->comp, &c->comp, &vaddr)) BUG();
+	if (!mm_pages_track(c, page, vaddr, npages)) BUG();
 
-	for (i = 0; i < npages; i++) {
-		p = ss_page_alloc();
-		assert(p);
+	contigmem_check(cos_inv_token(), (vaddr_t)vaddr, npages, PAGE_SIZE);
 
-		m = &p->mappings[0];
-		if (ss_state_alloc(&m->comp)) BUG();
+	return vaddr;
+}
 
-		p->page = page + i * PAGE_SIZE;
-		m->addr = vaddr + i * PAGE_SIZE;
+/* Superpages are physically contiguous, so they don't need the contig_phy_pages pool */
+vaddr_t
+contigmem_superpage_alloc(unsigned long nsuperpages)
+{
+	struct cm_comp *c;
+	struct mm_page *p;
 
-		ss_state_activate_with(&m->comp, (word_t)c);
-		ss_page_activate(p);
-	}
+	c = ss_comp_get(cos_inv_token());
+	if (!c) return 0;
+	p = mm_superpage_allocn(c, nsuperpages);
+	if (!p) return 0;
 
-	contigmem_check(cos_inv_token(), (vaddr_t)vaddr, npages);
-	contig_phy_pages += npages * PAGE_SIZE;
-	assert((word_t)contig_phy_pages < CONTIG_PHY_PAGES * PAGE_SIZE);
-	return vaddr;
+	contigmem_check(cos_inv_token(), p->mappings[0].addr, nsuperpages, SUPER_PAGE_SIZE);
+
+	return p->mappings[0].addr;
 }
 
 cbuf_t
 contigmem_shared_alloc_aligned(unsigned long npages, unsigned long align, vaddr_t *pgaddr)
 {
 	struct cm_comp *c;
-	struct mm_page *p, *initial = NULL;
+	struct mm_page *initial;
 	struct mm_span *s;
-
-	struct mm_mapping *m;
-
-	vaddr_t vaddr;
-
-	unsigned long i;
-	int ret;
+	vaddr_t         vaddr;
+	void           *page;
 
 	c = ss_comp_get(cos_inv_token());
 	if (!c) return 0;
+	if (mm_charge(c, npages)) return 0;
+	s = ss_span_alloc();
+	if (!s) {
+		mm_uncharge(c, npages);
+		return 0;
+	}
 
-	void * page = contig_phy_pages;
+	/*
+	 * Regions of whole, aligned superpages are mapped as superpages,
+	 * here and wherever they are shared, so they take few TLB
+	 * entries, and a single translation gives their physical base.
+	 */
+	if (npages % (SUPER_PAGE_SIZE / PAGE_SIZE) == 0 && align % SUPER_PAGE_SIZE == 0) {
+		unsigned long nsuper = npages / (SUPER_PAGE_SIZE / PAGE_SIZE);
 
-	if (crt_page_aliasn_aligned_in(page, align, npages, &cm_self()->comp, &c->comp, &vaddr)) BUG();
+		page = crt_superpage_allocn(&cm_self()->comp, nsuper);
+		if (page) {
+			if (crt_superpage_aliasn_aligned_in(page, align, nsuper, &cm_self()->comp, &c->comp, &vaddr)) BUG();
+			initial = mm_pages_track(c, page, vaddr, npages);
+			if (!initial) BUG();
 
-	s = ss_span_alloc();
-	if (!s) return 0;
-	for (i = 0; i < npages; i++) {
-		p = ss_page_alloc();
-		assert(p);
+			s->page_off   = ss_page_id(initial);
+			s->n_pages    = npages;
+			s->superpages = 1;
+			ss_span_activate(s);
 
-		if (unlikely(i == 0)) {
-			initial = p;
-		}
-
-		m = &p->mappings[0];
-		if (ss_state_alloc(&m->comp)) BUG();
+			*pgaddr = vaddr;
+			contigmem_check(cos_inv_token(), vaddr, nsuper, SUPER_PAGE_SIZE);
 
-		p->page = page + i * PAGE_SIZE;
-		m->addr = vaddr + i * PAGE_SIZE;
+			return ss_span_id(s);
+		}
+	}
 
-		ss_state_activate_with(&m->comp, (word_t)c);
-		ss_page_activate(p);
+	page = contigmem_pages_take(npages);
+	if (!page) {
+		ss_span_free(s);
+		mm_uncharge(c, npages);
+		return 0;
 	}
 
-	/**
-	 * FIXME: Need to reslove concurrent issue here,
-	 * this is not multi-thread safe
-	 */
-	s->page_off = ss_page_id(initial);
-	s->n_pages  = npages;
-	ss_span_activate(s);
+	if (crt_page_aliasn_aligned_in(page, align, npages, &cm_self()->comp, &c->comp, &vaddr)) BUG();
+	initial = mm_pages_track(c, page, vaddr, npages);
+	if (!initial) BUG();
 
-	ret = ss_span_id(s);
+	s->page_off   = ss_page_id(initial);
+	s->n_pages    = npages;
+	s->superpages = 0;
+	ss_span_activate(s);
 
 	*pgaddr = initial->mappings[0].addr;
+	contigmem_check(cos_inv_token(), (vaddr_t)vaddr, npages, PAGE_SIZE);
 
-	contigmem_check(cos_inv_token(), (vaddr_t)vaddr, npages);
-	contig_phy_pages += npages * PAGE_SIZE;
-	assert((word_t)contig_phy_pages < CONTIG_PHY_PAGES * PAGE_SIZE);
-	return ret;
+	return ss_span_id(s);
 }
 
 vaddr_t
@@ -387,7 +1263,36 @@ memmgr_heap_page_allocn_aligned(unsigned long num_pages, unsigned long align)
 
 	c = ss_comp_get(cos_inv_token());
 	if (!c) return 0;
-	p = mm_page_allocn(c, num_pages, align);
+	p = mm_heap_allocn(c, num_pages, align, COS_NUMA_NODE_LOCAL);
+	if (!p) return 0;
+
+	return (vaddr_t)p->mappings[0].addr;
+}
+
+vaddr_t
+memmgr_heap_page_allocn_node(unsigned long num_pages, int node)
+{
+	struct cm_comp *c;
+	struct mm_page *p;
+
+	if (node != COS_NUMA_NODE_LOCAL && (node < 0 || node >= NUMA_NODES_MAX)) return 0;
+	c = ss_comp_get(cos_inv_token());
+	if (!c) return 0;
+	p = mm_heap_allocn(c, num_pages, PAGE_SIZE, node);
+	if (!p) return 0;
+
+	return (vaddr_t)p->mappings[0].addr;
+}
+
+vaddr_t
+memmgr_heap_superpage_allocn(unsigned long num_superpages)
+{
+	struct cm_comp *c;
+	struct mm_page *p;
+
+	c = ss_comp_get(cos_inv_token());
+	if (!c) return 0;
+	p = mm_superpage_allocn(c, num_superpages);
 	if (!p) return 0;
 
 	return (vaddr_t)p->mappings[0].addr;
@@ -410,6 +1315,47 @@ memmgr_heap_page_allocn(unsigned long num_pages)
 	return memmgr_heap_page_allocn_aligned(num_pages, PAGE_SIZE);
 }
 
+vaddr_t
+memmgr_heap_page_allocn_at(vaddr_t addr, unsigned long num_pages)
+{
+	struct cm_comp *c;
+	struct mm_page *p;
+
+	c = ss_comp_get(cos_inv_token());
+	if (!c) return 0;
+	p = mm_heap_allocn_at(c, addr, num_pages);
+	if (!p) return 0;
+
+	return addr;
+}
+
+vaddr_t
+memmgr_heap_page_allocn_lazy(unsigned long num_pages)
+{
+	struct cm_comp *c;
+
+	c = ss_comp_get(cos_inv_token());
+	if (!c) return 0;
+
+	return mm_heap_allocn_lazy(c, num_pages);
+}
+
+int
+memmgr_heap_page_release(vaddr_t addr, unsigned long num_pages)
+{
+	struct cm_comp *c;
+	int ret;
+
+	c = ss_comp_get(cos_inv_token());
+	if (!c) return -EINVAL;
+
+	ps_lock_take(&mm_heap_lock);
+	ret = mm_heap_release(c, addr, num_pages);
+	ps_lock_release(&mm_heap_lock);
+
+	return ret;
+}
+
 cbuf_t
 memmgr_shared_page_allocn_aligned(unsigned long num_pages, unsigned long align, vaddr_t *pgaddr)
 {
@@ -420,13 +1366,15 @@ memmgr_shared_page_allocn_aligned(unsigned long num_pages, unsigned long align,
 
 	c = ss_comp_get(cos_inv_token());
 	if (!c) return 0;
+	if (mm_charge(c, num_pages)) return 0;
 	s = ss_span_alloc();
-	if (!s) return 0;
-	p = mm_page_allocn(c, num_pages, align);
+	if (!s) ERR_THROW(0, uncharge);
+	p = mm_page_allocn(c, num_pages, align, COS_NUMA_NODE_LOCAL);
 	if (!p) ERR_THROW(0, cleanup);
 
-	s->page_off = ss_page_id(p);
-	s->n_pages  = num_pages;
+	s->page_off   = ss_page_id(p);
+	s->n_pages    = num_pages;
+	s->superpages = 0;
 	ss_span_activate(s);
 
 	ret = ss_span_id(s);
@@ -436,6 +1384,8 @@ done:
 	return ret;
 cleanup:
 	ss_span_free(s);
+uncharge:
+	mm_uncharge(c, num_pages);
 	goto done;
 }
 
@@ -459,23 +1409,94 @@ static int
 mm_page_alias(struct mm_page *p, struct cm_comp *c, vaddr_t *addr, unsigned long align)
 {
 	struct mm_mapping *m;
-	int i;
+	int i;
+
+	*addr = 0;
+	for (i = 1; i < MM_MAPPINGS_MAX; i++) {
+		m = &p->mappings[i];
+
+		if (ss_state_alloc(&m->comp)) continue;
+		if (crt_page_aliasn_aligned_in(p->page, align, 1, &cm_self()->comp, &c->comp, &m->addr)) BUG();
+		assert(m->addr);
+		*addr = m->addr;
+		ss_state_activate_with(&m->comp, (word_t)c);
+
+		return 0;
+	}
+	assert(i == MM_MAPPINGS_MAX);
+
+	return -ENOMEM;
+}
+
+/*
+ * Record the mappings of the span's pages, contiguous at `addr` in
+ * `c`.
+ */
+static void
+mm_span_track(struct mm_span *s, struct cm_comp *c, vaddr_t addr)
+{
+	struct mm_mapping *m;
+	struct mm_page    *p;
+	unsigned int       i, j;
 
-	*addr = 0;
-	for (i = 1; i < MM_MAPPINGS_MAX; i++) {
-		m = &p->mappings[i];
+	for (i = 0; i < s->n_pages; i++) {
+		p = ss_page_get(s->page_off + i);
+		for (j = 1; j < MM_MAPPINGS_MAX; j++) {
+			m = &p->mappings[j];
+			if (!ss_state_alloc(&m->comp)) break;
+		}
+		if (j == MM_MAPPINGS_MAX) BUG();
 
-		if (ss_state_alloc(&m->comp)) continue;
-		if (crt_page_aliasn_aligned_in(p->page, align, 1, &cm_self()->comp, &c->comp, &m->addr)) BUG();
-		assert(m->addr);
-		*addr = m->addr;
+		m->addr = addr + i * PAGE_SIZE;
 		ss_state_activate_with(&m->comp, (word_t)c);
+	}
+	ps_faa(&mm_stats_of(c)->shared, s->n_pages);
+}
 
-		return 0;
+/*
+ * Alias the pages of the span into `c`, at an address aligned on
+ * `align`. The pages allocated together are contiguous in our address
+ * space, so they take a single alias, rather than one per page.
+ *
+ * - @return - the number of pages mapped, `0` on error
+ */
+static unsigned long
+mm_span_alias(struct mm_span *s, struct cm_comp *c, unsigned long align, vaddr_t *pgaddr)
+{
+	struct mm_page    *p, *first;
+	unsigned int       i;
+	vaddr_t            addr;
+
+	first = ss_page_get(s->page_off);
+	if (!first) return 0;
+	if (s->superpages) {
+		if (crt_superpage_aliasn_aligned_in(first->page, align, s->n_pages / (SUPER_PAGE_SIZE / PAGE_SIZE),
+		                                    &cm_self()->comp, &c->comp, pgaddr)) BUG();
+		goto track;
+	}
+	for (i = 1; i < s->n_pages; i++) {
+		p = ss_page_get(s->page_off + i);
+		if (!p) return 0;
+		if (p->page != first->page + i * PAGE_SIZE) break;
 	}
-	assert(i == MM_MAPPINGS_MAX);
 
-	return -ENOMEM;
+	if (i < s->n_pages) {
+		for (i = 0; i < s->n_pages; i++) {
+			p = ss_page_get(s->page_off + i);
+			if (mm_page_alias(p, c, &addr, align)) BUG();
+			if (*pgaddr == 0) *pgaddr = addr;
+			align = PAGE_SIZE; /* only the first page can have special alignment */
+		}
+		ps_faa(&mm_stats_of(c)->shared, s->n_pages);
+
+		return s->n_pages;
+	}
+
+	if (crt_page_aliasn_aligned_in(first->page, align, s->n_pages, &cm_self()->comp, &c->comp, pgaddr)) BUG();
+track:
+	mm_span_track(s, c, *pgaddr);
+
+	return s->n_pages;
 }
 
 unsigned long
@@ -483,9 +1504,6 @@ memmgr_shared_page_map_aligned_in_vm(cbuf_t id, unsigned long align, vaddr_t *pg
 {
 	struct cm_comp *c;
 	struct mm_span *s;
-	struct mm_page *p;
-	unsigned int i;
-	vaddr_t addr;
 	compid_t vmm = (compid_t)cos_inv_token();
 
 	*pgaddr = 0;
@@ -497,18 +1515,7 @@ memmgr_shared_page_map_aligned_in_vm(cbuf_t id, unsigned long align, vaddr_t *pg
 	/* Only the vmm of this VM is allowed to call this interface */
 	assert(vmm == c->comp.vm_comp_info.vmm_comp_id);
 
-	for (i = 0; i < s->n_pages; i++) {
-		struct mm_page *p;
-
-		p = ss_page_get(s->page_off + i);
-		if (!p) return 0;
-
-		if (mm_page_alias(p, c, &addr, align)) BUG();
-		if (*pgaddr == 0) *pgaddr = addr;
-		align = PAGE_SIZE_4K;
-	}
-
-	return s->n_pages;
+	return mm_span_alias(s, c, align, pgaddr);
 }
 
 unsigned long
@@ -516,9 +1523,6 @@ memmgr_shared_page_map_aligned(cbuf_t id, unsigned long align, vaddr_t *pgaddr)
 {
 	struct cm_comp *c;
 	struct mm_span *s;
-	struct mm_page *p;
-	unsigned int i;
-	vaddr_t addr;
 
 	*pgaddr = 0;
 	s = ss_span_get(id);
@@ -526,18 +1530,7 @@ memmgr_shared_page_map_aligned(cbuf_t id, unsigned long align, vaddr_t *pgaddr)
 	c = ss_comp_get(cos_inv_token());
 	if (!c) return 0;
 
-	for (i = 0; i < s->n_pages; i++) {
-		struct mm_page *p;
-
-		p = ss_page_get(s->page_off + i);
-		if (!p) return 0;
-
-		if (mm_page_alias(p, c, &addr, align)) BUG();
-		if (*pgaddr == 0) *pgaddr = addr;
-		align = PAGE_SIZE; // only the first page can have special alignment
-	}
-
-	return s->n_pages;
+	return mm_span_alias(s, c, align, pgaddr);
 }
 
 unsigned long
@@ -546,6 +1539,73 @@ memmgr_shared_page_map(cbuf_t id, vaddr_t *pgaddr)
 	return memmgr_shared_page_map_aligned(id, PAGE_SIZE, pgaddr);
 }
 
+vaddr_t
+memmgr_stats_map(void)
+{
+	struct cm_comp *c;
+
+	c = ss_comp_get(cos_inv_token());
+	if (!c) return 0;
+
+	return cos_mem_aliasn(cos_compinfo_get(c->comp.comp_res), cos_compinfo_get(cm_self()->comp.comp_res), (vaddr_t)mm_stats,
+	                      round_up_to_page(sizeof(struct memmgr_stats)), COS_PAGE_READABLE);
+}
+
+/*
+ * The kernel's clock page and thread accounting table, mapped into
+ * the capmgr on their first request, and aliased read-only into the
+ * requesters.
+ */
+static struct cos_time_page *mm_time;
+static struct cos_thd_acct  *mm_thd_acct;
+
+vaddr_t
+memmgr_time_map(void)
+{
+	struct cm_comp      *c;
+	struct cos_compinfo *self = cos_compinfo_get(cm_self()->comp.comp_res);
+
+	c = ss_comp_get(cos_inv_token());
+	if (!c) return 0;
+
+	ps_lock_take(&mm_heap_lock);
+	if (!mm_time) mm_time = cos_hw_time_map(self, BOOT_CAPTBL_SELF_INITHW_BASE);
+	ps_lock_release(&mm_heap_lock);
+	if (!mm_time) return 0;
+
+	return cos_mem_aliasn(cos_compinfo_get(c->comp.comp_res), self, (vaddr_t)mm_time, PAGE_SIZE, COS_PAGE_READABLE);
+}
+
+vaddr_t
+memmgr_thd_acct_map(void)
+{
+	struct cm_comp      *c;
+	struct cos_compinfo *self = cos_compinfo_get(cm_self()->comp.comp_res);
+
+	c = ss_comp_get(cos_inv_token());
+	if (!c) return 0;
+
+	ps_lock_take(&mm_heap_lock);
+	if (!mm_thd_acct) mm_thd_acct = cos_hw_thd_acct_map(self, BOOT_CAPTBL_SELF_INITHW_BASE);
+	ps_lock_release(&mm_heap_lock);
+	if (!mm_thd_acct) return 0;
+
+	return cos_mem_aliasn(cos_compinfo_get(c->comp.comp_res), self, (vaddr_t)mm_thd_acct,
+	                      COS_THD_ACCT_PAGES * PAGE_SIZE, COS_PAGE_READABLE);
+}
+
+vaddr_t
+memmgr_topology_map(void)
+{
+	struct cm_comp *c;
+
+	c = ss_comp_get(cos_inv_token());
+	if (!c) return 0;
+
+	return cos_mem_aliasn(cos_compinfo_get(c->comp.comp_res), cos_compinfo_get(cm_self()->comp.comp_res),
+	                      (vaddr_t)mm_topology, round_up_to_page(sizeof(struct cos_topology)), COS_PAGE_READABLE);
+}
+
 static compid_t
 capmgr_comp_sched_hier_get(compid_t cid)
 {
@@ -601,7 +1661,9 @@ capmgr_execution_init(int is_init_core)
 		assert(cmc);
 		comp = &cmc->comp;
 
-		if (!strcmp(exec_type, "sched")) {
+		if (!crt_placement_oncore(id, cos_cpuid())) {
+			/* Only its cores have a thread in it */
+		} else if (!strcmp(exec_type, "sched")) {
 			struct cm_rcv *r = ss_rcv_alloc();
 
 			assert(r);
@@ -625,6 +1687,25 @@ capmgr_execution_init(int is_init_core)
 	return;
 }
 
+/* Pre-create the thread pools on this core */
+static void
+capmgr_thd_pool_init(void)
+{
+	struct initargs pools, curr;
+	struct initargs_iter i;
+	int cont, keylen;
+
+	if (args_get_entry("thd_pool", &pools)) return;
+	for (cont = args_iter(&pools, &i, &curr) ; cont ; cont = args_iter_next(&i, &curr)) {
+		compid_t        id  = atoi(args_key(&curr, &keylen));
+		struct cm_comp *cmc = ss_comp_get(id);
+
+		assert(cmc);
+		if (cmc->thd_pool_sz == 0 || !crt_placement_oncore(id, cos_cpuid())) continue;
+		if (cm_thd_pool_fill(cmc) == 0) printc("capmgr: couldn't pre-create the thread pool of %ld.\n", id);
+	}
+}
+
 static void
 capmgr_comp_init(void)
 {
@@ -650,7 +1731,7 @@ capmgr_comp_init(void)
 		int keylen;
 		int j;
 		char id_serialized[16]; 	/* serialization of the id number */
-		char *name;
+		char *name, *quota, *pool, *exec;
 
 		for (j = 0 ; j < 3 ; j++, cont = args_iter_next(&i, &curr)) {
 			capid_t capid = atoi(args_key(&curr, &keylen));
@@ -689,6 +1770,33 @@ capmgr_comp_init(void)
 		       comp_res.ctc, comp_res.ptc, comp_res.compc, comp_res.captbl_frontier, comp_res.heap_ptr, sched_id);
 		comp = cm_comp_alloc_with(name, id, &comp_res);
 		assert(comp);
+
+		snprintf(id_serialized, 20, "mem_quota/%ld", id);
+		quota = args_get(id_serialized);
+		if (quota) {
+			mm_stats_of(comp)->quota = MB2PAGES(atol(quota));
+			printc("\t\tmemory quota: %s MiB\n", quota);
+		}
+
+		comp->img_end = comp_res.heap_ptr;
+		snprintf(id_serialized, 20, "restart/%ld", id);
+		if (args_get(id_serialized)) {
+			comp->restart = 1;
+			printc("\t\trestarted on a fault\n");
+		}
+
+		snprintf(id_serialized, 20, "thd_pool/%ld", id);
+		pool = args_get(id_serialized);
+		if (pool) {
+			snprintf(id_serialized, 20, "execute/%ld", id);
+			exec = args_get(id_serialized);
+			comp->thd_pool_sz = atol(pool);
+			if (comp->thd_pool_sz > CM_THD_POOL_MAX) comp->thd_pool_sz = CM_THD_POOL_MAX;
+			/* Schedulers create their own threads, others' are created by their scheduler */
+			comp->thd_pool_sched = (exec && !strcmp(exec, "sched")) ? comp : ss_comp_get(sched_id);
+			if (!comp->thd_pool_sched) comp->thd_pool_sz = 0;
+			printc("\t\tthread pool: %ld threads per core\n", comp->thd_pool_sz);
+		}
 	}
 
 	/* Create ULK memory region for UL sinvs and map it into comps that need it */
@@ -702,6 +1810,8 @@ capmgr_comp_init(void)
 
 		/* if this fails, we already aliased the ICB memory into this shared pt */
 		crt_ulk_map_in(&cmc->comp);
+		/* Its address space holds the others' memory as well */
+		cmc->restart = 0;
 	}
 
 	return;
@@ -756,6 +1866,17 @@ init_exit(int retval)
 	while (1) ;
 }
 
+int
+capmgr_restart_checkpoint(compid_t id)
+{
+	struct cm_comp *c = ss_comp_get(id);
+
+	if (!c || capmgr_comp_sched_get(id) != (compid_t)cos_inv_token()) return -EINVAL;
+	if (!c->restart) return 0;
+
+	return cm_restart_checkpoint(c);
+}
+
 thdcap_t
 capmgr_thd_create_ext(spdid_t client, thdclosure_index_t idx, thdid_t *tid)
 {
@@ -778,7 +1899,11 @@ capmgr_thd_create_ext(spdid_t client, thdclosure_index_t idx, thdid_t *tid)
 
 	s = ss_comp_get(schedid);
 	if (!c || !s) return 0;
-	t = cm_thd_alloc_in(c, s, idx);
+	if (COS_THD_POOL_RESERVED_TID(idx)) {
+		t = cm_thd_pool_take(c, s, COS_THD_POOL_RESERVED_TID(idx));
+	} else {
+		t = cm_thd_alloc_in(c, s, idx);
+	}
 	if (!t) {
 		/* TODO: release resources */
 		return 0;
@@ -794,7 +1919,89 @@ capmgr_initthd_create(spdid_t client, thdid_t *tid)
 	return capmgr_thd_create_ext(client, 0, tid);
 }
 
-thdcap_t  capmgr_initaep_create(spdid_t child, struct cos_aep_info *aep, int owntc, cos_channelkey_t key, microsec_t ipiwin, u32_t ipimax, asndcap_t *sndret) { BUG(); return 0; }
+/* The rcv of the aep with the key, or NULL */
+static struct cm_rcv *
+cm_rcv_key_get(cos_channelkey_t key)
+{
+	struct cm_rcv *r;
+	int i;
+
+	for (i = 1; i <= MAX_NUM_THREADS; i++) {
+		r = ss_rcv_get(i);
+		if (r && r->key == key) return r;
+	}
+
+	return NULL;
+}
+
+/*
+ * Set the key and the IPI rate limit of the aep of rcv r, if the key
+ * isn't already another aep's.
+ */
+static int
+cm_rcv_aep_init(struct cm_rcv *r, cos_channelkey_t key, microsec_t ipiwin, u32_t ipimax)
+{
+	struct cm_rcv *k;
+
+	if (key) {
+		k = cm_rcv_key_get(key);
+		if (k && k != r) return -1;
+	}
+	r->key    = key;
+	r->ipiwin = ipiwin;
+	r->ipimax = ipimax;
+
+	return 0;
+}
+
+/*
+ * Alias the aep of rcv r into its scheduler s. The asnds to r are
+ * created with the rcv capability in r's own component, so this
+ * alias doesn't replace it.
+ */
+static void
+cm_rcv_aep_alias_in(struct cm_rcv *r, struct cm_comp *s, struct cos_aep_info *aep)
+{
+	struct crt_rcv_resources res = { 0 };
+	arcvcap_t child_rcv = r->rcv.child_rcv;
+
+	if (crt_rcv_alias_in(&r->rcv, &s->comp, &res, CRT_RCV_ALIAS_ALL)) BUG();
+	if (child_rcv) r->rcv.child_rcv = child_rcv;
+
+	*aep = (struct cos_aep_info) {
+		.tc  = res.tc,
+		.thd = res.thd,
+		.tid = cos_introspect(cos_compinfo_get(s->comp.comp_res), res.thd, THD_GET_TID),
+		.rcv = res.rcv,
+	};
+}
+
+/*
+ * The aep of the initial (scheduling) thread of the child scheduler
+ * on this core, for its parent scheduler, with an asnd to it.
+ */
+thdcap_t
+capmgr_initaep_create(spdid_t child, struct cos_aep_info *aep, int owntc, cos_channelkey_t key, microsec_t ipiwin, u32_t ipimax, asndcap_t *sndret)
+{
+	compid_t schedid = (compid_t)cos_inv_token();
+	struct cm_comp *s, *c;
+	struct cm_rcv  *r;
+	struct cm_asnd *snd;
+
+	if (schedid != capmgr_comp_sched_get(child)) return 0;
+	c = ss_comp_get(child);
+	s = ss_comp_get(schedid);
+	if (!c || !s) return 0;
+	r = c->sched_rcv[cos_cpuid()];
+	if (!r || cm_rcv_aep_init(r, key, ipiwin, ipimax)) return 0;
+
+	snd = cm_asnd_alloc_in(&s->comp, r);
+	if (!snd) return 0;
+	cm_rcv_aep_alias_in(r, s, aep);
+	*sndret = snd->aliased_cap;
+
+	return aep->thd;
+}
 
 thdcap_t
 capmgr_thd_create_thunk(thdclosure_index_t idx, thdid_t *tid)
@@ -805,7 +2012,11 @@ capmgr_thd_create_thunk(thdclosure_index_t idx, thdid_t *tid)
 
 	assert(client > 0 && client <= MAX_NUM_COMPS);
 	c = ss_comp_get(client);
-	t = cm_thd_alloc_in(c, c, idx);
+	if (COS_THD_POOL_RESERVED_TID(idx)) {
+		t = cm_thd_pool_take(c, c, COS_THD_POOL_RESERVED_TID(idx));
+	} else {
+		t = cm_thd_alloc_in(c, c, idx);
+	}
 	if (!t) {
 		/* TODO: release resources */
 		return 0;
@@ -830,7 +2041,7 @@ capmgr_rcv_create(thdclosure_index_t idx, crt_rcv_flags_t flags, asndcap_t *asnd
 
 	r = cm_rcv_alloc_in(&c->comp, &c->sched_rcv[cos_cpuid()]->rcv, idx, flags, thdcap, tid);
 
-	s = cm_asnd_alloc_in(&c->comp, &r->rcv);
+	s = cm_asnd_alloc_in(&c->comp, r);
 	*asnd = s->aliased_cap;
 
 	return r->aliased_cap;
@@ -869,6 +2080,72 @@ capmgr_vm_comp_create(u64_t mem_sz)
 	return id;
 }
 
+/*
+ * Map the shared memory `id` of the vmm into the VM `vm_id` as its
+ * guest memory, at guest-physical address 0, in a single operation.
+ * Memory allocated as superpages (contigmem_shared_alloc_aligned at
+ * SUPER_PAGE_SIZE alignment) is mapped with 2MB EPT entries.
+ *
+ * - @return - `0` on success, `-EINVAL` if the VM or the memory don't
+ *   exist, `-EPERM` if the caller isn't the VM's vmm, and `-ENOMEM` if
+ *   the EPT can't be expanded.
+ */
+int
+capmgr_vm_mem_map(compid_t vm_id, cbuf_t id)
+{
+	struct cm_comp *vmm = ss_comp_get(cos_inv_token());
+	struct cm_comp *vm  = ss_comp_get(vm_id);
+	struct mm_span *s   = ss_span_get(id);
+	struct mm_page *p, *run;
+	unsigned int    i, start;
+	int             ret;
+
+	if (!vmm || !vm || !s) return -EINVAL;
+	if (vm->comp.vm_comp_info.vmm_comp_id != vmm->comp.id) return -EPERM;
+
+	/* Each run of pages contiguous in our address space is mapped at once */
+	for (start = 0; start < s->n_pages; start = i) {
+		run = ss_page_get(s->page_off + start);
+		if (!run) return -EINVAL;
+		for (i = start + 1; i < s->n_pages; i++) {
+			p = ss_page_get(s->page_off + i);
+			if (!p) return -EINVAL;
+			if (p->page != run->page + (i - start) * PAGE_SIZE) break;
+		}
+		ret = crt_comp_vm_mem_map(&vm->comp, start * PAGE_SIZE, run->page, (i - start) * PAGE_SIZE, &cm_self()->comp);
+		if (ret) return ret;
+	}
+	mm_span_track(s, vm, 0);
+
+	return 0;
+}
+
+/*
+ * Collect the pages of the VM `vm_id` written since the last
+ * collection, a bit for each of the `npages` guest-physical pages at
+ * `gpa` in the shared memory `bitmap` of the vmm (a page, thus at
+ * most COS_EPT_DIRTY_MAX pages), and clear their dirty bits.
+ *
+ * - @return - the number of dirty pages, `-EINVAL` if the VM or the
+ *   bitmap don't exist, and `-EPERM` if the caller isn't the VM's vmm.
+ */
+int
+capmgr_vm_mem_dirty(compid_t vm_id, cbuf_t bitmap, vaddr_t gpa, unsigned long npages)
+{
+	struct cm_comp *vmm = ss_comp_get(cos_inv_token());
+	struct cm_comp *vm  = ss_comp_get(vm_id);
+	struct mm_span *s   = ss_span_get(bitmap);
+	struct mm_page *p;
+
+	if (!vmm || !vm || !s) return -EINVAL;
+	if (vm->comp.vm_comp_info.vmm_comp_id != vmm->comp.id) return -EPERM;
+	if (npages == 0 || npages > COS_EPT_DIRTY_MAX) return -EINVAL;
+	p = ss_page_get(s->page_off);
+	if (!p) return -EINVAL;
+
+	return crt_comp_vm_mem_dirty(&vm->comp, gpa, npages, p->page);
+}
+
 vaddr_t
 capmgr_vm_shared_kernel_page_create_at(compid_t comp_id, vaddr_t addr)
 {
@@ -960,14 +2237,191 @@ capmgr_vm_vcpu_create(compid_t vm_comp, vm_vmcb_t vmcb_cap, thdid_t *tid)
 	return capmgr_thd_create_ext(vm_comp, vmcb_cap, tid);
 }
 
-thdcap_t  capmgr_aep_create_thunk(struct cos_aep_info *a, thdclosure_index_t idx, int owntc, cos_channelkey_t key, microsec_t ipiwin, u32_t ipimax) { BUG(); return 0; }
-thdcap_t  capmgr_aep_create_ext(spdid_t child, struct cos_aep_info *a, thdclosure_index_t idx, int owntc, cos_channelkey_t key, microsec_t ipiwin, u32_t ipimax, arcvcap_t *extrcv) { BUG(); return 0; }
+/*
+ * An aep, executing closure idx in component c, scheduled by the
+ * scheduler s (with its aep aliased there), whose asnds send at most
+ * ipimax IPIs per ipiwin microseconds.
+ */
+static struct cm_rcv *
+cm_aep_alloc_in(struct cm_comp *c, struct cm_comp *s, thdclosure_index_t idx, int owntc, cos_channelkey_t key,
+                microsec_t ipiwin, u32_t ipimax, struct cos_aep_info *aep, arcvcap_t *extrcv)
+{
+	struct crt_rcv_resources res = { 0 };
+	struct cm_rcv *r;
+
+	if (!s->sched_rcv[cos_cpuid()]) return NULL;
+	if (key && cm_rcv_key_get(key)) return NULL;
+
+	r = ss_rcv_alloc();
+	if (!r) return NULL;
+	if (crt_rcv_create_in(&r->rcv, &c->comp, &s->sched_rcv[cos_cpuid()]->rcv, idx, owntc ? 0 : CRT_RCV_TCAP_INHERIT)) {
+		ss_rcv_free(r);
+		return NULL;
+	}
+	r->sched = s;
+	cm_rcv_aep_init(r, key, ipiwin, ipimax);
+	ss_rcv_activate(r);
+
+	/* The rcv capability in c first, for the asnds to it */
+	if (c != s) {
+		if (crt_rcv_alias_in(&r->rcv, &c->comp, &res, CRT_RCV_ALIAS_RCV)) BUG();
+		*extrcv = res.rcv;
+	}
+	cm_rcv_aep_alias_in(r, s, aep);
+	r->aliased_cap = aep->rcv;
+
+	return r;
+}
+
+thdcap_t
+capmgr_aep_create_thunk(struct cos_aep_info *a, thdclosure_index_t idx, int owntc, cos_channelkey_t key, microsec_t ipiwin, u32_t ipimax)
+{
+	compid_t client = (compid_t)cos_inv_token();
+	struct cm_comp *c;
+
+	c = ss_comp_get(client);
+	if (!c || !cm_aep_alloc_in(c, c, idx, owntc, key, ipiwin, ipimax, a, NULL)) return 0;
+
+	return a->thd;
+}
+
+thdcap_t
+capmgr_aep_create_ext(spdid_t child, struct cos_aep_info *a, thdclosure_index_t idx, int owntc, cos_channelkey_t key, microsec_t ipiwin, u32_t ipimax, arcvcap_t *extrcv)
+{
+	compid_t schedid = (compid_t)cos_inv_token();
+	struct cm_comp *s, *c;
+
+	if (schedid != capmgr_comp_sched_get(child)) return 0;
+	c = ss_comp_get(child);
+	s = ss_comp_get(schedid);
+	if (!c || !s || c == s) return 0;
+	if (!cm_aep_alloc_in(c, s, idx, owntc, key, ipiwin, ipimax, a, extrcv)) return 0;
+
+	return a->thd;
+}
+
 asndcap_t capmgr_asnd_create(spdid_t child, thdid_t t) { BUG(); return 0; }
 asndcap_t capmgr_asnd_rcv_create(arcvcap_t rcv) { BUG(); return 0; }
-asndcap_t capmgr_asnd_key_create(cos_channelkey_t key) { BUG(); return 0; }
+
+/* An asnd to the aep created with the key, with its IPI rate limit */
+asndcap_t
+capmgr_asnd_key_create(cos_channelkey_t key)
+{
+	compid_t client = (compid_t)cos_inv_token();
+	struct cm_comp *c;
+	struct cm_rcv  *r;
+	struct cm_asnd *s;
+
+	c = ss_comp_get(client);
+	if (!c || !key) return 0;
+	r = cm_rcv_key_get(key);
+	if (!r) return 0;
+	s = cm_asnd_alloc_in(&c->comp, r);
+	if (!s) return 0;
+
+	return s->aliased_cap;
+}
 
 void capmgr_create_noop(void) { return; }
 
+thdid_t
+capmgr_create_thd_reserve(void)
+{
+	struct cm_comp *c = ss_comp_get(cos_inv_token());
+
+	if (!c) return 0;
+
+	return cm_thd_pool_reserve(c);
+}
+
+int
+capmgr_create_thd_pool_fill(void)
+{
+	struct cm_comp *c = ss_comp_get(cos_inv_token());
+
+	if (!c) return 0;
+
+	return cm_thd_pool_fill(c);
+}
+
+/*
+ * The counters are those of the invoking thread, so the kernel
+ * programs them for the client's thread executing here.
+ */
+int
+pmu_ncounters(void)
+{
+	return cos_hw_pmu_ncounters(BOOT_CAPTBL_SELF_INITHW_BASE);
+}
+
+int
+pmu_program(unsigned long ctr, unsigned long evt)
+{
+	return cos_hw_pmu_program(BOOT_CAPTBL_SELF_INITHW_BASE, ctr, evt);
+}
+
+int
+pmu_disable(void)
+{
+	return cos_hw_pmu_disable(BOOT_CAPTBL_SELF_INITHW_BASE);
+}
+
+int
+pmu_sample(unsigned long period)
+{
+	return cos_hw_pmu_sample(BOOT_CAPTBL_SELF_INITHW_BASE, period);
+}
+
+vaddr_t
+pmu_sample_ring(coreid_t core)
+{
+	struct cm_comp        *c = ss_comp_get(cos_inv_token());
+	struct cos_trace_ring *r;
+
+	if (!c || core >= NUM_CPU) return 0;
+
+	/* The kernel maps each core's ring only once */
+	ps_lock_take(&mm_heap_lock);
+	r = cos_hw_trace_ring_map(cos_compinfo_get(c->comp.comp_res), BOOT_CAPTBL_SELF_INITHW_BASE, core);
+	ps_lock_release(&mm_heap_lock);
+
+	return (vaddr_t)r;
+}
+
+compid_t
+pmu_sample_comp(unsigned long pgtbl, int nth)
+{
+	struct cm_comp *c;
+	pgtblcap_t      pt;
+	compid_t        id;
+
+	for (id = 1; id <= MAX_NUM_COMPS; id++) {
+		c = ss_comp_get(id);
+		if (!c) continue;
+		pt = cos_compinfo_get(c->comp.comp_res)->pgtbl_cap;
+		if (cos_hw_pgflt_pgtbl_id(BOOT_CAPTBL_SELF_INITHW_BASE, pt) != pgtbl) continue;
+		if (nth-- == 0) return id;
+	}
+
+	return 0;
+}
+
+/* Split our untyped memory between the NUMA nodes, and report what each has */
+static void
+capmgr_numa_init(struct cos_compinfo *ci)
+{
+	int npools, nnodes, i;
+
+	npools = cos_meminfo_numa_init(ci, BOOT_CAPTBL_SELF_INITHW_BASE);
+	nnodes = cos_hw_numa_introspect(BOOT_CAPTBL_SELF_INITHW_BASE, NUMA_GET_NNODES, 0, 0);
+	printc("NUMA: %d nodes, untyped memory in %d pools\n", nnodes, npools);
+	for (i = 0; i < nnodes; i++) {
+		printc("\tnode %d: %d pages free, %d used\n", i,
+		       cos_hw_numa_introspect(BOOT_CAPTBL_SELF_INITHW_BASE, NUMA_GET_NODE_FREE, i, 0),
+		       cos_hw_numa_introspect(BOOT_CAPTBL_SELF_INITHW_BASE, NUMA_GET_NODE_USED, i, 0));
+	}
+}
+
 void
 cos_init(void)
 {
@@ -1005,6 +2459,9 @@ cos_init(void)
 
 	/* Get our house in order. Initialize ourself and our data-structures */
 	cos_meminfo_init(&(ci->mi), BOOT_MEM_KM_BASE, COS_MEM_KERN_PA_SZ, BOOT_CAPTBL_SELF_UNTYPED_PT);
+	capmgr_numa_init(ci);
+	/* The cores allocate the kernel and user memory from their own parts of it */
+	if (cos_meminfo_partition(ci)) BUG();
 	cos_defcompinfo_init();
 
 	/*
@@ -1016,12 +2473,18 @@ cos_init(void)
 	 */
 	cos_comp_capfrontier_update(ci, addr_get(cos_compid(), ADDR_CAPTBL_FRONTIER), 0);
 	if (!cm_comp_self_alloc("capmgr")) BUG();
+	/* The stats are zeroed, as all of the pages we allocate */
+	mm_stats = crt_page_allocn(&cm_self()->comp, round_up_to_page(sizeof(struct memmgr_stats)) / PAGE_SIZE);
+	assert(mm_stats);
+	mm_topology = crt_page_allocn(&cm_self()->comp, round_up_to_page(sizeof(struct cos_topology)) / PAGE_SIZE);
+	assert(mm_topology);
+	if (cos_hw_topology(BOOT_CAPTBL_SELF_INITHW_BASE, mm_topology, sizeof(struct cos_topology))) BUG();
 	/* Initialize the other component's for which we're responsible */
 	capmgr_comp_init();
 
 	/* Reserve some continuous pages */
 	contig_phy_pages = crt_page_allocn(&cm_self()->comp, CONTIG_PHY_PAGES);
-	contigmem_check(cos_compid(), (vaddr_t)contig_phy_pages, CONTIG_PHY_PAGES);
+	contigmem_check(cos_compid(), (vaddr_t)contig_phy_pages, CONTIG_PHY_PAGES, PAGE_SIZE);
 
 	return;
 }
@@ -1029,8 +2492,16 @@ cos_init(void)
 void
 cos_parallel_init(coreid_t cid, int init_core, int ncores)
 {
+	static struct crt_thd pgflt_thds[NUM_CPU];
+
 	cos_defcompinfo_sched_init();
+	mm_ncores = ncores;
+	/* The handler of the faults on the lazy heap ranges of this core */
+	if (crt_thd_create(&pgflt_thds[cid], &cm_self()->comp, mm_pgflt_handler, NULL)) BUG();
+	if (cos_hw_pgflt_attach(BOOT_CAPTBL_SELF_INITHW_BASE, pgflt_thds[cid].cap)) BUG();
+	ps_faa(&mm_pgflt_ncores, 1);
 	capmgr_execution_init(init_core);
+	capmgr_thd_pool_init();
 }
 
 void
@@ -4,25 +4,148 @@
 #include <chanmgr.h>
 #include <chan.h>
 #include <static_slab.h>
+#include <sync_lock.h>
+#include <string.h>
+#include <errno.h>
 
 #define MAX_NUM_CHAN 32
-struct chan_info {
-	struct __chan_meta info;
-	unsigned int npages;
+
+/*
+ * The channels' memory is allocated in size classes of 1, 2, 4, ...
+ * pages, and, with the channel's blockpoints, recycled in the pool of
+ * its class when the channel is deleted. The pools of the smallest
+ * classes are filled at boot, so that the creation of channels
+ * doesn't allocate any resource in the common case.
+ */
+#ifndef CHANMGR_POOL_CLASSES
+#define CHANMGR_POOL_CLASSES 8
+#endif
+#ifndef CHANMGR_POOL_PREWARM_CLASSES
+#define CHANMGR_POOL_PREWARM_CLASSES 2
+#endif
+#ifndef CHANMGR_POOL_PREWARM
+#define CHANMGR_POOL_PREWARM 4
+#endif
+#define CHANMGR_POOL_SZ (MAX_NUM_CHAN + CHANMGR_POOL_PREWARM)
+
+/* The resources of a channel, that outlive it */
+struct chan_res {
 	cbuf_t buf_id;
 	vaddr_t mem;
+	unsigned int npages;
+	sched_blkpt_id_t empty, full;
+};
+
+struct chan_pool {
+	unsigned int n;
+	struct chan_res res[CHANMGR_POOL_SZ];
+};
+
+struct chan_info {
+	struct __chan_meta info;
+	struct chan_res res;
+	compid_t owner;
 	evt_res_id_t evt_id;
 };
 
 SS_STATIC_SLAB(channel, struct chan_info, MAX_NUM_CHAN);
 
+static struct chan_pool chan_pools[CHANMGR_POOL_CLASSES];
+static struct sync_lock chan_pools_lock;
+
+/* The class of channels of `npages` pages, or `-1` if they are too large to be pooled */
+static int
+__chan_pool_class(unsigned int npages)
+{
+	int class = 0;
+
+	while ((1U << class) < npages) class++;
+
+	return class < CHANMGR_POOL_CLASSES ? class : -1;
+}
+
+static int
+__chan_res_create(struct chan_res *r, unsigned int npages)
+{
+	struct sync_blkpt empty, full;
+	int ret = 0;
+
+	if (sync_blkpt_init(&empty)) return -1;
+	if (sync_blkpt_init(&full))  ERR_THROW(-1, dealloc_empty_blkpt);
+	r->buf_id = memmgr_shared_page_allocn(npages, &r->mem);
+	if (r->buf_id == 0) ERR_THROW(-1, dealloc_full_blkpt);
+	r->npages = npages;
+	r->empty  = empty.id;
+	r->full   = full.id;
+
+	return 0;
+
+dealloc_full_blkpt:
+	sync_blkpt_teardown(&full);
+dealloc_empty_blkpt:
+	sync_blkpt_teardown(&empty);
+
+	return ret;
+}
+
+/* Take the resources for a channel of `npages` pages from its pool, or create them */
+static int
+__chan_res_alloc(struct chan_res *r, unsigned int npages)
+{
+	int class = __chan_pool_class(npages);
+	struct chan_pool *p;
+
+	if (class < 0) return __chan_res_create(r, npages);
+
+	p = &chan_pools[class];
+	sync_lock_take(&chan_pools_lock);
+	if (p->n > 0) {
+		*r = p->res[--p->n];
+		sync_lock_release(&chan_pools_lock);
+
+		return 0;
+	}
+	sync_lock_release(&chan_pools_lock);
+
+	return __chan_res_create(r, 1U << class);
+}
+
+/* Put the resources of a deleted channel back in their pool */
+static void
+__chan_res_release(struct chan_res *r)
+{
+	int class = __chan_pool_class(r->npages);
+	struct chan_pool *p;
+
+	/*
+	 * Clear the memory, so that the next channel (re)initializes
+	 * it, and, for broadcast channels, starts without published
+	 * items or registered consumers.
+	 */
+	memset((void *)r->mem, 0, r->npages * PAGE_SIZE);
+
+	if (class >= 0 && (1U << class) == r->npages) {
+		p = &chan_pools[class];
+		sync_lock_take(&chan_pools_lock);
+		if (p->n < CHANMGR_POOL_SZ) {
+			p->res[p->n++] = *r;
+			sync_lock_release(&chan_pools_lock);
+
+			return;
+		}
+		sync_lock_release(&chan_pools_lock);
+	}
+
+	sched_blkpt_free(r->empty);
+	sched_blkpt_free(r->full);
+	/* The memmgr doesn't free shared memory: it is lost */
+}
+
 static chan_id_t
-__chanmgr_create(unsigned int item_sz, unsigned int slots, chan_flags_t flags, chan_id_t chanid)
+__chanmgr_create(unsigned int item_sz, unsigned int slots, chan_flags_t flags, chan_id_t chanid, compid_t owner)
 {
-	chan_id_t id, ret;
+	chan_id_t id;
 	struct chan_info *c;
-	struct sync_blkpt empty, full;
-	unsigned int mem_pages;
 
 	if (chanid == 0) {
 		c = ss_channel_alloc();
@@ -30,41 +153,58 @@ __chanmgr_create(unsigned int item_sz, unsigned int slots, chan_flags_t flags, c
 		c = ss_channel_alloc_at_id(chanid);
 	}
 	if (!c) return 0;
-	ret = id = ss_channel_id(c);
+	id = ss_channel_id(c);
+
+	if (__chan_res_alloc(&c->res, round_up_to_page(chan_mem_sz(item_sz, slots, flags)) / PAGE_SIZE)) {
+		ss_channel_free(c);
 
+		return 0;
+	}
 	c->info = (struct __chan_meta) {
-		.nslots  = slots,
-		.item_sz = item_sz,
-		.flags   = flags,
-		.id      = id,
-		.evt_id  = 0
+		.mem            = (struct __chan_mem *)c->res.mem,
+		.blkpt_empty_id = c->res.empty,
+		.blkpt_full_id  = c->res.full,
+		.nslots         = slots,
+		.item_sz        = item_sz,
+		.flags          = flags,
+		.id             = id,
+		.cbuf_id        = c->res.buf_id,
+		.evt_id         = 0
 	};
-	if (sync_blkpt_init(&empty)) ERR_THROW(0, free_chan);
-	if (sync_blkpt_init(&full))  ERR_THROW(0, dealloc_empty_blkpt);
-	c->info.blkpt_empty_id = empty.id;
-	c->info.blkpt_full_id  = full.id;
-	mem_pages = round_up_to_page(chan_mem_sz(item_sz, slots)) / PAGE_SIZE;
-	c->buf_id = memmgr_shared_page_allocn(mem_pages, (vaddr_t *)&c->info.mem);
-	if (c->buf_id == 0) ERR_THROW(0, dealloc_full_blkpt);
+	c->owner  = owner;
+	c->evt_id = 0;
 
 	ss_channel_activate(c);
 
-	return ret;
-
-dealloc_full_blkpt:
-	sync_blkpt_teardown(&full);
-dealloc_empty_blkpt:
-	sync_blkpt_teardown(&empty);
-free_chan:
-	ss_channel_free(c);
-
-	return ret;
+	return id;
 }
 
 chan_id_t
 chanmgr_create(unsigned int item_sz, unsigned int slots, chan_flags_t flags)
 {
-	return __chanmgr_create(item_sz, slots, flags, 0);
+	return __chanmgr_create(item_sz, slots, flags, 0, (compid_t)cos_inv_token());
+}
+
+chan_id_t
+chanmgr_create_resources(unsigned int item_sz, unsigned int slots, chan_flags_t flags, cbuf_t *cb, void **mem, sched_blkpt_id_t *full, sched_blkpt_id_t *empty)
+{
+	struct chan_info *c;
+	chan_id_t id;
+
+	*cb   = 0;
+	*mem  = NULL;
+	*full = *empty = 0;
+	id = __chanmgr_create(item_sz, slots, flags, 0, (compid_t)cos_inv_token());
+	if (id == 0) return 0;
+	c = ss_channel_get(id);
+	assert(c);
+
+	*cb    = c->res.buf_id;
+	*mem   = (void *)c->res.mem;
+	*full  = c->res.full;
+	*empty = c->res.empty;
+
+	return id;
 }
 
 int
@@ -77,8 +217,8 @@ chanmgr_sync_resources(chan_id_t id, sched_blkpt_id_t *full, sched_blkpt_id_t *e
 	chinfo = ss_channel_get(id);
 	if (!chinfo) return -1;
 
-	*full  = chinfo->info.blkpt_full_id;
-	*empty = chinfo->info.blkpt_empty_id;
+	*full  = chinfo->res.full;
+	*empty = chinfo->res.empty;
 
 	return 0;
 }
@@ -94,8 +234,8 @@ chanmgr_mem_resources(chan_id_t id, cbuf_t *cb_id, void **mem)
 	chinfo = ss_channel_get(id);
 	if (!chinfo) return -1;
 
-	*mem   = (void *)chinfo->mem;
-	*cb_id = chinfo->buf_id;
+	if (mem) *mem = (void *)chinfo->res.mem;
+	*cb_id = chinfo->res.buf_id;
 
 	return 0;
 }
@@ -134,8 +274,21 @@ chanmgr_evt_get(chan_id_t id, int sender_to_reciever)
 int
 chanmgr_delete(chan_id_t id)
 {
-	/* TODO */
-	return -1;
+	struct chan_info *c;
+
+	c = ss_channel_get(id);
+	if (!c) return -EINVAL;
+	/*
+	 * Only the creator deletes the channel; the other components'
+	 * deletes are their teardown of an endpoint. The initial
+	 * channels are never deleted.
+	 */
+	if (c->owner != (compid_t)cos_inv_token()) return -EPERM;
+
+	__chan_res_release(&c->res);
+	ss_channel_free(c);
+
+	return 0;
 }
 
 struct init_info {
@@ -156,6 +309,8 @@ struct init_info init_chan[] = {
 	CHAN_INIT(2, 128, sizeof(u64_t)),
 	CHAN_INIT(3, 2, sizeof(u32_t)),
 	CHAN_INIT(4, 2, sizeof(u32_t)),
+	CHAN_INIT(5, 16, sizeof(u32_t)),
+	CHAN_INIT(6, 16, sizeof(u32_t)),
 	CHAN_INIT(0, 0, 0),
 };
 
@@ -166,11 +321,21 @@ cos_init(void)
 
 	printc("Chanmgr (%ld): creating static, initial channels.\n", cos_compid());
 
+	if (sync_lock_init(&chan_pools_lock)) BUG();
+
 	for (i = 0; init_chan[i].id > 0; i++) {
 		struct init_info *ch = &init_chan[i];
 		chan_id_t id;
 
-		id = __chanmgr_create(ch->itemsz, ch->nitems, 0, ch->id);
+		id = __chanmgr_create(ch->itemsz, ch->nitems, 0, ch->id, 0);
 		if (id != ch->id) BUG();
 	}
+
+	for (i = 0; i < CHANMGR_POOL_PREWARM_CLASSES; i++) {
+		struct chan_pool *p = &chan_pools[i];
+
+		for (p->n = 0; p->n < CHANMGR_POOL_PREWARM; p->n++) {
+			if (__chan_res_create(&p->res[p->n], 1U << i)) BUG();
+		}
+	}
 }
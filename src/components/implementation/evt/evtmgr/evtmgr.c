@@ -2,90 +2,93 @@
 #include <llprint.h>
 #include <static_slab.h>
 #include <evt.h>
-#include <crt_blkpt.h>
+#include <evt_shm.h>
 #include <ps_refcnt.h>
-
-#define MAX_NUM_EVT 8
-
-
-struct ring {
-	int producer, consumer;
-	evt_res_id_t mem[MAX_NUM_EVT];
-};
+#include <memmgr.h>
+
+/***
+ * Each event aggregate has its own resources and ring of pending
+ * events, both sized by the `max_evts` of `evt_init`, in memory
+ * (`evt_shm.h`) that is shared with the client, and with the
+ * components that trigger its resources. Those only invoke the
+ * manager to set up their access (`__evt_shm_map`), and then
+ * trigger and wait for events directly in the shared memory; the
+ * other clients invoke the manager to do the same for them.
+ */
 
 struct evt_agg {
-	compid_t client;
-	struct ring ring;
-	struct ps_refcnt refcnt;
-	struct crt_blkpt blkpt;
+	compid_t          client;
+	struct ps_refcnt  refcnt;
+	struct evt_shm   *shm;
+	cbuf_t            shm_id;
+	/* Our own copies of the shared parameters, as the memory can be corrupted */
+	sched_blkpt_id_t  blkpt_id;
+	unsigned long     nslots, max;
+	unsigned long     alloc_hint; /* where to start searching for a free resource */
+	/* The client's buffer for `evt_get_n` */
+	cbuf_t            buf_id;
+	struct evt_event *buf;
+	unsigned long     buf_n;
 };
 
-SS_STATIC_SLAB(evt, struct evt_agg, MAX_NUM_THREADS);
-
-struct evt_res {
-	evt_res_id_t *evt_entry; /* -1 = not resident */
-	evt_res_id_t me;
-	evt_res_type_t type;
-	evt_res_data_t data;
-	compid_t client;
-	struct evt_agg *evt;
+SS_DYNAMIC_SLAB(evt, struct evt_agg, MAX_NUM_THREADS);
+
+/*
+ * The memory of the aggregates, by slab id. Memory isn't returned to
+ * the memmgr, so we reuse it when allocating an aggregate in the same
+ * slot that is no larger.
+ */
+struct evt_mem {
+	struct evt_shm *shm;
+	cbuf_t          id;
+	unsigned long   npages;
 };
-
-SS_STATIC_SLAB(evtres, struct evt_res, MAX_NUM_EVT);
-
-static int
-ring_empty(struct ring *r)
-{
-	return r->producer == r->consumer;
-}
-
-static int
-ring_full(struct ring *r)
-{
-	return r->producer + 1 == r->consumer;
-}
-
-static int
-ring_dequeue(struct ring *r, evt_res_id_t *id)
-{
-	evt_res_id_t *tmp;
-
-	if (ring_empty(r)) return 1;
-
-	tmp  = &r->mem[r->consumer % MAX_NUM_EVT];
-	*id  = *tmp;
-	*tmp = 0;
-	r->consumer++;
-
-	return 0;
-}
-
-static evt_res_id_t *
-ring_enqueue(struct ring *r, evt_res_id_t id)
-{
-	evt_res_id_t *evtres;
-
-	if (ring_full(r)) return NULL;
-
-	evtres  = &r->mem[r->producer % MAX_NUM_EVT];
-	*evtres = id;
-	r->producer++;
-
-	return evtres;
-}
+static struct evt_mem evt_mems[MAX_NUM_THREADS + 1];
 
 evt_id_t
 __evt_alloc(unsigned long max_evts)
 {
-	struct evt_agg *em = ss_evt_alloc();
+	struct evt_agg *em;
+	struct evt_mem *m;
+	unsigned long   nslots = 1, npages;
+	evt_id_t        id;
+
+	if (max_evts == 0 || max_evts > EVT_RES_MAX) return 0;
+	while (nslots < max_evts) nslots <<= 1;
+	npages = round_up_to_page(evt_shm_size(nslots, max_evts)) / PAGE_SIZE;
 
+	em = ss_evt_alloc();
 	if (!em) return 0;
+	id = ss_evt_id(em);
+
+	m = &evt_mems[id];
+	if (m->npages < npages) {
+		struct evt_shm *shm;
+		cbuf_t          cb;
+
+		cb = memmgr_shared_page_allocn(npages, (vaddr_t *)&shm);
+		if (cb == 0) {
+			ss_evt_free(em);
+			return 0;
+		}
+		*m = (struct evt_mem) { .shm = shm, .id = cb, .npages = npages };
+	}
+	memset(m->shm, 0, evt_shm_size(nslots, max_evts));
+	evt_shm_init(m->shm, nslots);
+	if (sync_blkpt_init(&m->shm->blkpt)) {
+		ss_evt_free(em);
+		return 0;
+	}
 
-	memset(em, 0, sizeof(struct evt));
-	crt_blkpt_init(&em->blkpt);
+	em->client   = cos_inv_token();
+	em->shm      = m->shm;
+	em->shm_id   = m->id;
+	em->blkpt_id = m->shm->blkpt.id;
+	em->nslots   = nslots;
+	em->max      = max_evts;
 	ss_evt_activate(em);
 
-	return ss_evt_id(em);
+	return id;
 }
 
 int
@@ -94,7 +97,7 @@ __evt_free(evt_id_t id)
 	struct evt_agg *em = ss_evt_get(id);
 
 	if (!em || ps_refcnt_get(&em->refcnt) != 0) return -1;
-	crt_blkpt_teardown(&em->blkpt);
+	sched_blkpt_free(em->blkpt_id);
 	ss_evt_free(em);
 
 	return 0;
@@ -103,68 +106,104 @@ __evt_free(evt_id_t id)
 int
 __evt_get(evt_id_t id, evt_wait_flags_t flags, evt_res_type_t *src, evt_res_data_t *ret_data)
 {
-	struct crt_blkpt_checkpoint chkpt;
-	struct evt_agg *e = ss_evt_get(id);
-	struct evt_res *res;
-	evt_res_id_t rid;
+	struct evt_agg  *e = ss_evt_get(id);
+	struct evt_event evt;
+	int ret;
 
 	if (!e) return -1;
 
-	while (1) {
-		crt_blkpt_checkpoint(&e->blkpt, &chkpt);
+	ret = evt_shm_wait(e->shm, e->blkpt_id, e->nslots, e->max, flags, &evt);
+	if (ret) return ret;
+	*src      = evt.type;
+	*ret_data = evt.data;
 
-		if (!ring_dequeue(&e->ring, &rid)) break;
-		if (flags & EVT_WAIT_NONBLOCKING) return 1;
+	return 0;
+}
 
-		if (crt_blkpt_blocking(&e->blkpt, 0, &chkpt)) continue;
-		if (!ring_empty(&e->ring)) continue;
-		crt_blkpt_wait(&e->blkpt, 0, &chkpt);
-	}
+int
+__evt_buf_set(evt_id_t id, cbuf_t buf)
+{
+	struct evt_agg *e = ss_evt_get(id);
+	vaddr_t addr;
+	unsigned long npages;
+
+	if (!e || e->buf) return -EINVAL;
+	npages = memmgr_shared_page_map(buf, &addr);
+	if (npages == 0) return -EINVAL;
 
-	res   = ss_evtres_get(rid);
-	assert(res);
-	res->evt_entry = NULL;
-	*src      = res->type;
-	*ret_data = res->data;
+	e->buf_n  = npages * PAGE_SIZE / sizeof(struct evt_event);
+	e->buf_id = buf;
+	e->buf    = (struct evt_event *)addr;
 
 	return 0;
 }
 
+int
+__evt_get_n(evt_id_t id, evt_wait_flags_t flags, unsigned long max)
+{
+	struct evt_agg *e = ss_evt_get(id);
+	unsigned long n;
+
+	if (!e || !e->buf) return -EINVAL;
+	if (max > e->buf_n) max = e->buf_n;
+	if (max == 0) return -EINVAL;
+
+	/* Wait for the first event, then take all that are pending */
+	if (evt_shm_wait(e->shm, e->blkpt_id, e->nslots, e->max, flags, &e->buf[0])) return 0;
+	for (n = 1; n < max; n++) {
+		if (evt_shm_next(e->shm, e->nslots, e->max, &e->buf[n])) break;
+	}
+
+	return n;
+}
+
 evt_res_id_t
 __evt_add(evt_id_t id, evt_res_type_t srctype, evt_res_data_t retdata)
 {
 	struct evt_agg *e = ss_evt_get(id);
-	struct evt_res *res;
-	evt_res_id_t rid;
+	struct evt_shm_res *res;
+	unsigned long i, idx;
 
 	if (!e)  return 0;
-	res = ss_evtres_alloc();
-	if (!res) return 0;
 
-	rid = ss_evtres_id(res);
+	for (i = 0; i < e->max; i++) {
+		idx = (ps_load(&e->alloc_hint) + i) % e->max;
+		res = &evt_shm_res(e->shm, e->nslots)[idx];
+		if (ps_load(&res->state) == EVT_RES_FREE && ps_cas(&res->state, EVT_RES_FREE, EVT_RES_ACTIVE)) break;
+	}
+	if (i == e->max) return 0;
+	e->alloc_hint = idx + 1;
+
 	ps_refcnt_take(&e->refcnt);
-	*res = (struct evt_res) {
-		.client    = cos_inv_token(),
-		.type      = srctype,
-		.data      = retdata,
-		.evt_entry = NULL,
-		.me        = rid,
-		.evt       = e,
-	};
-	ss_evtres_activate(res);
-
-	return rid;
+	/*
+	 * `pending` is left as is: if the previous resource at this
+	 * index is still in the ring, it reports an event for us.
+	 */
+	res->type = srctype;
+	res->data = retdata;
+
+	return EVT_RES_ID(id, idx);
+}
+
+static struct evt_agg *
+evt_res_agg(evt_res_id_t rid)
+{
+	struct evt_agg *e = ss_evt_get(EVT_RES_AGG(rid));
+
+	if (!e || (rid & EVT_RES_MAX) == 0 || EVT_RES_IDX(rid) >= e->max) return NULL;
+
+	return e;
 }
 
 int
 __evt_rem(evt_id_t id, evt_res_id_t rid)
 {
-	struct evt_agg *e = ss_evt_get(id);
-	struct evt_res *res;
+	struct evt_agg *e = evt_res_agg(rid);
+	struct evt_shm_res *res;
 
-	if (!e) return -1;
-	res = ss_evtres_get(rid);
-	if (!res || res->evt != e) return -1;
+	if (!e || e != ss_evt_get(id)) return -1;
+	res = &evt_shm_res(e->shm, e->nslots)[EVT_RES_IDX(rid)];
+	if (!ps_cas(&res->state, EVT_RES_ACTIVE, EVT_RES_FREE)) return -1;
 	ps_refcnt_release(&e->refcnt);
 
 	return 0;
@@ -173,21 +212,33 @@ __evt_rem(evt_id_t id, evt_res_id_t rid)
 int
 __evt_trigger(evt_res_id_t rid)
 {
-	struct evt_agg *e;
-	struct evt_res  *res;
-	evt_res_id_t   *evt_entry;
+	struct evt_agg *e = evt_res_agg(rid);
+
+	if (!e) return -1;
+
+	return evt_shm_trigger(e->shm, e->blkpt_id, e->nslots, EVT_RES_IDX(rid));
+}
 
-	res = ss_evtres_get(rid);
-	if (!res) return -1;
-	e = res->evt;
-	assert(e);
-	if (res->evt != e) return -1;
+/*
+ * The control plane of the shared memory: the client can map its
+ * aggregate `id` (with `rid == 0`) to wait for events, and any
+ * component with an active resource id `rid` can map the aggregate
+ * to trigger it.
+ */
+int
+__evt_shm_map(evt_id_t id, evt_res_id_t rid, cbuf_t *shm, word_t *blkpt)
+{
+	struct evt_agg *e;
 
-	if (res->evt_entry != NULL) return 0; /* already triggered! */
-	evt_entry = ring_enqueue(&e->ring, rid);
-	assert(evt_entry);	/* ring should be large enough for all evts */
-	res->evt_entry = evt_entry;
-	crt_blkpt_trigger(&e->blkpt, 0);
+	if (rid == 0) {
+		e = ss_evt_get(id);
+		if (!e || e->client != cos_inv_token()) return -EPERM;
+	} else {
+		e = evt_res_agg(rid);
+		if (!e || ps_load(&evt_shm_res(e->shm, e->nslots)[EVT_RES_IDX(rid)].state) != EVT_RES_ACTIVE) return -EINVAL;
+	}
+	*shm   = e->shm_id;
+	*blkpt = e->blkpt_id;
 
-	return 0;
+	return e->nslots;
 }
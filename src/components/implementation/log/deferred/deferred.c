@@ -0,0 +1,203 @@
+/***
+ * The log manager: it only sets up the memory it shares with each
+ * client (`log_shm.h`), then each core's drain thread formats and
+ * prints the records the clients' threads on that core logged. The
+ * drain threads have a low priority, so the serial line's output
+ * is only paid for when the cores are otherwise idle.
+ *
+ * The records are formatted here, from the copies of the clients'
+ * formats in their shared memory, so the memory is never trusted: the
+ * formats are bounded, and the records' fields are checked.
+ */
+
+#include <cos_component.h>
+#include <llprint.h>
+#include <log.h>
+#include <memmgr.h>
+#include <sched.h>
+#include <cos_time.h>
+#include <ps.h>
+
+#include <string.h>
+
+#define LOG_DRAIN_PRIO  250   /* below the applications' threads */
+#define LOG_DRAIN_USEC  10000 /* to wait when there are no records */
+#define LOG_DRAIN_BATCH 64    /* records of a client, before the next's */
+#define LOG_MSG_MAX     144   /* the prefix and message fit printc's buffer */
+
+struct log_client {
+	struct log_shm *shm;
+	cbuf_t          id;
+	unsigned long   dropped[NUM_CPU]; /* the drops reported */
+};
+
+static struct log_client clients[MAX_NUM_COMPS + 1];
+static struct ps_lock    lock;
+
+cbuf_t
+__log_shm_get(void)
+{
+	compid_t           client = (compid_t)cos_inv_token();
+	struct log_client *c;
+	struct log_shm    *shm;
+	cbuf_t             id;
+
+	if (client == 0 || client > MAX_NUM_COMPS) return 0;
+	c = &clients[client];
+
+	ps_lock_take(&lock);
+	if (!c->id) {
+		id = memmgr_shared_page_allocn(LOG_SHM_PAGES, (vaddr_t *)&shm);
+		if (id) {
+			log_shm_init(shm, LOG_INFO);
+			c->id = id;
+			/* the drain threads find the client once its memory is initialized */
+			ps_mem_fence();
+			c->shm = shm;
+		}
+	}
+	id = c->id;
+	ps_lock_release(&lock);
+
+	return id;
+}
+
+/*
+ * Format the record's arguments with the format. Each conversion's
+ * length modifiers are ignored, as each argument is a word.
+ */
+static void
+log_format(char *out, int sz, const char *fmt, struct log_rec *rec)
+{
+	const char *conv;
+	char        spec[16];
+	word_t      a;
+	int         len = 0, arg = 0, s, n;
+
+	while (*fmt && len < sz - 1) {
+		if (*fmt != '%') {
+			out[len++] = *fmt++;
+			continue;
+		}
+		conv = fmt++;
+		if (*fmt == '%') {
+			out[len++] = *fmt++;
+			continue;
+		}
+
+		s         = 0;
+		spec[s++] = '%';
+		while (*fmt && strchr("-+ #0123456789.", *fmt) && s < (int)sizeof(spec) - 3) spec[s++] = *fmt++;
+		while (*fmt && strchr("hljzt", *fmt)) fmt++;
+		if (!*fmt) break;
+
+		a = arg < rec->nargs ? rec->args[arg] : 0;
+		arg++;
+		switch (*fmt) {
+		case 'd': case 'i':
+			spec[s++] = 'l';
+			spec[s++] = *fmt;
+			spec[s]   = '\0';
+			n = snprintf(&out[len], sz - len, spec, (long)a);
+			break;
+		case 'u': case 'x': case 'X': case 'o':
+			spec[s++] = 'l';
+			spec[s++] = *fmt;
+			spec[s]   = '\0';
+			n = snprintf(&out[len], sz - len, spec, (unsigned long)a);
+			break;
+		case 'c': case 'p':
+			spec[s++] = *fmt;
+			spec[s]   = '\0';
+			if (*fmt == 'c') n = snprintf(&out[len], sz - len, spec, (int)a);
+			else             n = snprintf(&out[len], sz - len, spec, (void *)a);
+			break;
+		case 's':
+			n = snprintf(&out[len], sz - len, "(str)");
+			break;
+		default:
+			/* not a conversion we know, so print it as is */
+			n = snprintf(&out[len], sz - len, "%.*s", (int)(fmt + 1 - conv), conv);
+			arg--;
+			break;
+		}
+		fmt++;
+		if (n < 0) break;
+		len += n;
+	}
+	if (len > sz - 1) len = sz - 1;
+	out[len] = '\0';
+}
+
+static void
+log_print(compid_t client, struct log_shm *shm, coreid_t core, struct log_rec *rec)
+{
+	char fmt[LOG_MSG_MAX], msg[LOG_MSG_MAX];
+	int  n;
+
+	if (rec->nargs > LOG_NARGS) rec->nargs = LOG_NARGS;
+	if (rec->fmt == 0 || rec->fmt >= LOG_FMT_SZ) {
+		strcpy(fmt, "(format table full)\n");
+	} else {
+		n = LOG_FMT_SZ - rec->fmt < LOG_MSG_MAX - 1 ? LOG_FMT_SZ - rec->fmt : LOG_MSG_MAX - 1;
+		memcpy(fmt, &shm->fmts[rec->fmt], n);
+		fmt[n] = '\0';
+	}
+	log_format(msg, LOG_MSG_MAX, fmt, rec);
+	printc("[%u %u %lu] %c %s", core, rec->thd, client, rec->level <= LOG_DEBUG ? "EWID"[rec->level] : '?', msg);
+}
+
+/* Print the records logged on the core; returns the number printed */
+static int
+log_drain(coreid_t core)
+{
+	struct log_client *c;
+	struct log_shm    *shm;
+	struct log_ring   *r;
+	struct log_rec    *rec, copy;
+	unsigned long      dropped;
+	compid_t           client;
+	int                n, total = 0;
+
+	for (client = 1; client <= MAX_NUM_COMPS; client++) {
+		c   = &clients[client];
+		shm = ps_load(&c->shm);
+		if (!shm) continue;
+		r = &shm->rings[core];
+
+		for (n = 0; n < LOG_DRAIN_BATCH && (rec = log_ring_peek(r)); n++) {
+			/* format our copy, as the client can reuse the record */
+			copy = *rec;
+			log_ring_release(r, rec);
+			log_print(client, shm, core, &copy);
+		}
+		total += n;
+
+		dropped = ps_load(&r->dropped);
+		if (dropped != c->dropped[core]) {
+			printc("[%u - %lu] log: %lu records dropped\n", core, client, dropped - c->dropped[core]);
+			c->dropped[core] = dropped;
+		}
+	}
+
+	return total;
+}
+
+void
+cos_init(void)
+{
+	ps_lock_init(&lock);
+}
+
+void
+parallel_main(coreid_t cid)
+{
+	if (sched_thd_param_set(cos_thdid(), sched_param_pack(SCHEDP_PRIO, LOG_DRAIN_PRIO))) {
+		printc("log: cannot lower the priority of core %u's drain thread\n", cid);
+	}
+
+	while (1) {
+		if (log_drain(cid)) continue;
+		sched_thd_block_timeout(0, time_now() + time_usec2cyc(LOG_DRAIN_USEC));
+	}
+}
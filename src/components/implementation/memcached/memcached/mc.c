@@ -1,11 +1,68 @@
 
 #include <cos_types.h>
 #include <string.h>
+#include <errno.h>
 #include <arpa/inet.h>
 #include <netmgr.h>
 #include <netshmem.h>
+#include <memmgr.h>
 #include <mc.h>
 #include <cos_memcached.h>
+#include <cos_time.h>
+#include <stkpool.h>
+#include <sched.h>
+#include <pgo.h>
+
+/*
+ * The requests processed on each core, reported with the GET hits
+ * and misses of the core's last worker every MC_STATS_INTERVAL us.
+ * The servers are pinned one per core, so the per-core numbers show
+ * the imbalance, and the contention, between them.
+ */
+#define MC_STATS_INTERVAL 1000000
+
+struct mc_core_stats {
+	u64_t    ops, last_ops;
+	cycles_t last;
+} CACHE_ALIGNED;
+
+static struct mc_core_stats mc_stats[NUM_CPU];
+
+/*
+ * Each core's evicting thread moves the CLOCK hand over a batch of
+ * the items stored on the core every MC_EVICT_USEC us, and at once
+ * while there's more to evict. Its batches are bounded, so it can run
+ * at the priority of the network's threads, and keep memcached from
+ * evicting inline, under its LRU locks, on the requests' path.
+ */
+#define MC_EVICT_PRIO  10
+#define MC_EVICT_USEC  1000
+#define MC_EVICT_HIGH  80 /* percent of a core's share of the memory limit */
+#define MC_EVICT_LOW   75
+
+/* memcached's threads recurse deeper than the default stacks allow */
+const stkpool_cls_t stkpool_default_cls = STKPOOL_LARGE;
+
+static void
+mc_stats_update(int ops)
+{
+	struct mc_core_stats *s = &mc_stats[cos_coreid()];
+	cycles_t              now;
+	microsec_t            elapsed;
+	u64_t                 gets, misses;
+
+	s->ops += ops;
+	now     = time_now();
+	if (unlikely(s->last == 0)) s->last = now;
+	elapsed = time_cyc2usec(now - s->last);
+	if (likely(elapsed < MC_STATS_INTERVAL)) return;
+
+	cos_mc_thd_stats(&gets, &misses);
+	printc("mc core %d: %llu ops/s, %llu hits, %llu misses\n", cos_coreid(),
+	       (s->ops - s->last_ops) * 1000000 / elapsed, gets - misses, misses);
+	s->last_ops = s->ops;
+	s->last     = now;
+}
 
 void
 mc_map_shmem(cbuf_t shm_id)
@@ -26,9 +83,158 @@ mc_process_command(int fd, shm_bm_objid_t objid, u16_t data_offset, u16_t data_l
 	struct netshmem_pkt_buf *pkt_buf = shm_bm_borrow_net_pkt_buf(shm, objid);
 	char *r_buf = (char *)pkt_buf + data_offset;
 	char *w_buf = netshmem_get_data_buf(pkt_buf);
+	u16_t ret;
 
 	/* after this call, memcached should have data written into w_buf */
-	return cos_mc_process_command(fd, r_buf, data_len, w_buf, netshmem_get_max_data_buf_sz());
+	netshmem_trace_stamp(pkt_buf, NETSHMEM_TRACE_APP);
+	ret = cos_mc_process_command(fd, r_buf, data_len, w_buf, netshmem_get_max_data_buf_sz());
+	netshmem_trace_stamp(pkt_buf, NETSHMEM_TRACE_APP_DONE);
+	mc_stats_update(1);
+
+	return ret;
+}
+
+int
+mc_process_commands(int fd, shm_bm_objid_t descs, int n)
+{
+	shm_bm_t shm = netshmem_get_shm();
+	struct netshmem_pkt_buf *bufs[MC_BATCH_MAX];
+	struct mc_req_desc *d;
+	int i;
+
+	if (n <= 0 || n > MC_BATCH_MAX) return -EINVAL;
+	d = shm_bm_borrow_net_pkt_buf(shm, descs);
+	if (!d) return -EINVAL;
+
+	/* Bring all of the requests in the cache first, so their misses overlap */
+	for (i = 0; i < n; i++) {
+		bufs[i] = shm_bm_borrow_net_pkt_buf(shm, d[i].objid);
+		if (bufs[i] && d[i].data_offset + d[i].data_len <= PKT_BUF_SIZE) {
+			__builtin_prefetch((char *)bufs[i] + d[i].data_offset);
+		} else {
+			bufs[i] = NULL;
+		}
+	}
+
+	for (i = 0; i < n; i++) {
+		if (!bufs[i]) {
+			d[i].data_len = 0;
+			continue;
+		}
+		netshmem_trace_stamp(bufs[i], NETSHMEM_TRACE_APP);
+		d[i].data_len    = cos_mc_process_command(fd, (char *)bufs[i] + d[i].data_offset, d[i].data_len,
+		                                          netshmem_get_data_buf(bufs[i]), netshmem_get_max_data_buf_sz());
+		netshmem_trace_stamp(bufs[i], NETSHMEM_TRACE_APP_DONE);
+		d[i].data_offset = netshmem_get_data_offset();
+	}
+	mc_stats_update(n);
+
+	return n;
+}
+
+/* The reply of a TCP request, whose buffers are written by batches */
+struct mc_tcp_reply {
+	struct cos_mc_wbuf       w;
+	struct netshmem_pkt_buf *obj;  /* of w.buf, NULL for the request's own buffer */
+	shm_bm_objid_t           objid;
+	struct netmgr_buf       *bufs;
+	shm_bm_objid_t           bufs_id;
+	struct netshmem_pkt_buf *objs[NETMGR_WRITE_MAX];
+	int                      nbufs;
+	int                      written;
+	int                      err;
+};
+
+/* The data of the buffers, without the tailroom that the netmgr leaves to the nic */
+#define MC_TCP_BUF_SZ (netshmem_get_max_data_buf_sz() - NETSHMEM_TAILROOM)
+
+/* Write the queued buffers (unless the reply failed), and release them */
+static void
+mc_tcp_flush(struct mc_tcp_reply *r)
+{
+	int i, len = 0, ret;
+
+	if (!r->err && r->nbufs > 0) {
+		for (i = 0; i < r->nbufs; i++) len += r->bufs[i].data_len;
+		ret = netmgr_tcp_shmem_writev(r->bufs_id, r->nbufs);
+		if (ret == len) r->written += ret;
+		else            r->err = -EIO;
+	}
+
+	/* The netmgr holds its own references until the data is acknowledged */
+	for (i = 0; i < r->nbufs; i++) {
+		if (r->objs[i]) netshmem_pkt_buf_free(r->objs[i]);
+	}
+	r->nbufs = 0;
+}
+
+static void
+mc_tcp_queue(struct mc_tcp_reply *r)
+{
+	r->bufs[r->nbufs] = (struct netmgr_buf) {
+		.objid = r->objid, .data_offset = netshmem_get_data_offset(), .data_len = r->w.len
+	};
+	r->objs[r->nbufs++] = r->obj;
+	r->obj = NULL;
+	if (r->nbufs == NETMGR_WRITE_MAX) mc_tcp_flush(r);
+}
+
+/* Queue the full buffer for writing, and give memcached the next one */
+static int
+mc_tcp_next(struct cos_mc_wbuf *w)
+{
+	struct mc_tcp_reply *r = (struct mc_tcp_reply *)w;
+
+	if (r->err) return -1;
+	mc_tcp_queue(r);
+	if (r->err) return -1;
+
+	r->obj = netshmem_pkt_buf_alloc(&r->objid);
+	if (!r->obj) {
+		r->err = -ENOMEM;
+		return -1;
+	}
+	w->buf = netshmem_get_data_buf(r->obj);
+	w->len = 0;
+
+	return 0;
+}
+
+int
+mc_tcp_process_command(int fd, shm_bm_objid_t objid, u16_t data_offset, u16_t data_len)
+{
+	shm_bm_t                 shm = netshmem_get_shm();
+	struct netshmem_pkt_buf *pkt_buf = shm_bm_borrow_net_pkt_buf(shm, objid);
+	struct mc_tcp_reply      r = { 0 };
+
+	if (!pkt_buf || data_offset + data_len > PKT_BUF_SIZE) return -EINVAL;
+	r.bufs = (struct netmgr_buf *)netshmem_pkt_buf_alloc(&r.bufs_id);
+	if (!r.bufs) return -ENOMEM;
+
+	/* The reply starts in the request's buffer, as memcached copies the request first */
+	r.w     = (struct cos_mc_wbuf) { .buf = netshmem_get_data_buf(pkt_buf), .sz = MC_TCP_BUF_SZ, .next = mc_tcp_next };
+	r.objid = objid;
+	cos_mc_process_command_v(fd, (char *)pkt_buf + data_offset, data_len, &r.w);
+	mc_stats_update(1);
+
+	if (!r.err && r.w.len > 0) mc_tcp_queue(&r);
+	if (r.obj) netshmem_pkt_buf_free(r.obj);
+	mc_tcp_flush(&r);
+	netshmem_pkt_buf_free((struct netshmem_pkt_buf *)r.bufs);
+
+	return r.err ? r.err : r.written;
+}
+
+int
+mc_snapshot_load(int fd, cbuf_t shm_id)
+{
+	unsigned long npages;
+	vaddr_t       snap;
+
+	npages = memmgr_shared_page_map(shm_id, &snap);
+	if (npages == 0) return -EINVAL;
+
+	return cos_mc_snap_load(fd, (const char *)snap, npages * PAGE_SIZE);
 }
 
 void
@@ -52,6 +258,21 @@ cos_init(void)
 	/* 1. do initialization of memcached */
 	ret = cos_mc_init(argc, argv);
 	printc("memcached init done, ret: %d\n", ret);
+	cos_mc_clock_init(MC_EVICT_HIGH, MC_EVICT_LOW);
+}
+
+void
+parallel_main(coreid_t cid)
+{
+	if (sched_thd_param_set(cos_thdid(), sched_param_pack(SCHEDP_PRIO, MC_EVICT_PRIO))) {
+		printc("mc: cannot set the priority of core %u's evicting thread\n", cid);
+	}
+
+	while (1) {
+		pgo_dump_once(time_now(), time_usec2cyc(PGO_DUMP_DELAY_USEC));
+		if (cos_mc_clock_evict(cid)) continue;
+		sched_thd_block_timeout(0, time_now() + time_usec2cyc(MC_EVICT_USEC));
+	}
 }
 
 int main()
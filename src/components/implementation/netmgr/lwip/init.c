@@ -17,6 +17,10 @@
 static struct ip4_addr ip, mask, gw, client;
 struct netif net_interface;
 
+void netmgr_lwip_lock_init(void);
+void netmgr_lwip_tx(const struct nic_pkt_desc *d, int n);
+void netmgr_lwip_timers(void);
+
 struct ether_addr {
 	uint8_t addr_bytes[6];
 } __attribute__((__packed__));
@@ -27,49 +31,99 @@ struct ether_hdr {
 	uint16_t          ether_type;
 } __attribute__((__packed__));
 
-static err_t
-cos_interface_output(struct netif *ni, struct pbuf *p)
-{
-	char *data = p->payload;	
-	struct netshmem_pkt_buf *obj = NULL;
-
-	shm_bm_objid_t objid;
-
-	u16_t pkt_offset, pkt_len;
+/* The most descriptors of a packet sent without copying its payload pbufs */
+#define LWIP_TX_SEGS_MAX 8
 
-	/* 
-	 * We assume that lwip always produces either a contiguous packet, 
-	 * or a packet of headers followed by a single packet with payload.
-	 */
-	assert(p->next == NULL || p->next->next == NULL);
-	if (p->type_internal & PBUF_RAM) {
-		if (p->next != NULL && p->next->type_internal & PBUF_ROM) {
-			/* shemem case, pbuf is chained with a header pbuf and a data pbuf that points to shemem */
-			obj   = (struct netshmem_pkt_buf*)(p->next->payload - netshmem_get_data_offset());
-			objid = shm_bm_get_objid_net_pkt_buf(obj);
-			data  = netshmem_get_data_buf(obj) ;
+/* The nic_send_packets flags the nic supports */
+static int nic_flags;
 
-			memcpy(data - p->len, p->payload, p->len);
+/*
+ * If a payload pbuf of tcp_write points into the region of the current
+ * thread, that the nic resolves its descriptors in. The timer thread
+ * retransmits the data of all tenants, from its own region.
+ */
+static inline int
+lwip_pbuf_local(struct pbuf *q)
+{
+	return ((word_t)q->payload & ~(SHM_BM_ALIGN - 1)) == (word_t)netshmem_get_shm();
+}
 
-			pkt_offset = netshmem_get_data_offset() - p->len;
+/* The object of the tenant's shmem a payload pbuf of tcp_write points into, and the offset of its data */
+static inline struct netshmem_pkt_buf *
+lwip_pbuf_obj(struct pbuf *q, shm_bm_objid_t *objid, u16_t *offset)
+{
+	struct netshmem_pkt_buf *obj;
 
-			pkt_len  = p->len;
-			pkt_len += p->next->len;
+	*objid  = shm_bm_get_objid_net_pkt_buf(q->payload);
+	obj     = shm_bm_borrow_net_pkt_buf(netshmem_get_shm(), *objid);
+	*offset = (char *)q->payload - obj->data;
 
-			nic_send_packet(objid, pkt_offset, pkt_len);
-		} else {
-			/* other cases that don't use shmem */
-			obj = shm_bm_alloc_net_pkt_buf(netshmem_get_shm(), &objid);
-			assert(obj);
+	return obj;
+}
 
-			memcpy(obj->data, data, p->len);
-			pkt_offset = 0;
-			pkt_len = p->len;
+/*
+ * Send a packet, given to the nic as the descriptors of its pbufs: lwip
+ * produces the headers in one pbuf, followed by the payload pbufs that
+ * point into the tenant's buffers (a segment can span several of them).
+ * With a single payload pbuf at the start of a buffer's data, the
+ * headers are copied into its headroom. Otherwise, the headers are in
+ * their own object, chained to the payload's, if the nic can chain
+ * buffers, or the whole packet is copied into one object.
+ */
+static err_t
+cos_interface_output(struct netif *ni, struct pbuf *p)
+{
+	struct nic_pkt_desc      d[LWIP_TX_SEGS_MAX];
+	struct netshmem_pkt_buf *obj;
+	shm_bm_objid_t           objid;
+	struct pbuf             *q;
+	u16_t                    offset;
+	int                      n = 0, nsegs = 0, rom = 1;
+
+	for (q = p->next; q != NULL; q = q->next) {
+		rom &= (q->type_internal & PBUF_ROM) != 0 && lwip_pbuf_local(q);
+		nsegs++;
+	}
+	rom &= (p->type_internal & PBUF_RAM) && nsegs > 0;
+
+	if (rom && nsegs == 1) {
+		obj = lwip_pbuf_obj(p->next, &objid, &offset);
+		if (offset == netshmem_get_data_offset() && p->len <= offset) {
+			/* The shmem case, the headers go in front of the data */
+			memcpy(obj->data + offset - p->len, p->payload, p->len);
+			shm_bm_take_net_pkt_buf(netshmem_get_shm(), objid);
+			d[n++] = (struct nic_pkt_desc) { .objid = objid, .pkt_offset = offset - p->len, .pkt_len = p->tot_len };
+		}
+	}
 
-			nic_send_packet(objid, pkt_offset, pkt_len);
-			shm_bm_free_net_pkt_buf(obj);
+	if (n == 0 && rom && nsegs < LWIP_TX_SEGS_MAX && (nic_flags & NIC_PKT_MORE)) {
+		obj = netshmem_pkt_buf_alloc(&objid);
+		if (!obj) return ERR_MEM;
+		memcpy(obj->data, p->payload, p->len);
+		d[n++] = (struct nic_pkt_desc) { .objid = objid, .pkt_len = p->len, .flags = NIC_PKT_MORE };
+
+		for (q = p->next; q != NULL; q = q->next) {
+			lwip_pbuf_obj(q, &objid, &offset);
+			shm_bm_take_net_pkt_buf(netshmem_get_shm(), objid);
+			d[n++] = (struct nic_pkt_desc) {
+				.objid = objid, .pkt_offset = offset, .pkt_len = q->len, .flags = NIC_PKT_MORE
+			};
 		}
+		d[n - 1].flags = 0;
 	}
+
+	if (n == 0) {
+		/* The other cases, that don't use shmem, or that can't be chained */
+		if (p->tot_len > PKT_BUF_SIZE - NETSHMEM_TAILROOM) return ERR_BUF;
+		obj = netshmem_pkt_buf_alloc(&objid);
+		if (!obj) return ERR_MEM;
+		pbuf_copy_partial(p, obj->data, p->tot_len, 0);
+		d[n++] = (struct nic_pkt_desc) { .objid = objid, .pkt_len = p->tot_len };
+	}
+
+	/* The nic frees the objects once they are sent */
+	netmgr_lwip_tx(d, n);
+
 	return ERR_OK;
 }
 
@@ -79,9 +133,11 @@ cos_interface_init(struct netif *ni)
 	uint64_t mac_addr = nic_get_port_mac_address(0);
 	char *mac_addr_arr = (char *)&mac_addr;
 
+	nic_flags = nic_tx_flags();
+
 	ni->name[0] = 'u';
 	ni->name[1] = 's';
-	ni->mtu     = 1500;
+	ni->mtu     = NETSHMEM_MTU;
 	ni->output  = etharp_output;
 
 	ni->linkoutput = cos_interface_output;
@@ -128,6 +184,7 @@ cos_init(void)
 	IP4_ADDR(&mask, 255,255,255,0);
 	IP4_ADDR(&gw, 10,10,1,10);
 
+	netmgr_lwip_lock_init();
 	lwip_init();
 	netif_add(&net_interface, &ip, &mask, &gw, NULL, cos_interface_init, ethernet_input);
 	netif_set_default(&net_interface);
@@ -147,7 +204,11 @@ cos_init(void)
 	printc("netmgr init done\n");
 }
 
-int main()
+int
+parallel_main(coreid_t cid)
 {
+	/* The rx threads are created as the tenants bind; core 0's thread runs the timers */
+	if (cid == 0) netmgr_lwip_timers();
+
 	return 0;
 }
\ No newline at end of file
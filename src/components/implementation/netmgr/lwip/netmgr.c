@@ -3,8 +3,14 @@
 #include <netshmem.h>
 #include <shm_bm.h>
 #include <string.h>
+#include <errno.h>
 #include <nic.h>
 #include <contigmem.h>
+#include <sync_lock.h>
+#include <sync_cond.h>
+#include <sched.h>
+#include <cos_time.h>
+#include <pgo.h>
 
 #include <lwip/init.h>
 #include <lwip/netif.h>
@@ -14,77 +20,581 @@
 #include <lwip/prot/tcp.h>
 #include <netif/ethernet.h>
 #include <lwip/etharp.h>
+#include <lwip/timeouts.h>
 
 #include <netmgr.h>
 
-/* This is used to indicate whether the packet is a data packet to application or a state packet to lwip */
-static int back_to_app = 0;
+/***
+ * lwip is a single instance, with its state in globals, so all of its
+ * calls are made holding `lwip_lock`. Each port a tenant thread binds
+ * has a netmgr thread (on the tenant's core) that receives the
+ * packets of its flows from the nic (the nicmgr spreads the flows of
+ * a port across the threads bound to it), and inputs them into lwip,
+ * a burst at a time: the lock is taken, and the timers checked, once
+ * per burst rather than once per packet. The acks and the data of all
+ * connections are thus processed as they arrive, whatever the tenant
+ * does. The data received for a connection is queued on it, and its
+ * tenant thread, that waits on a condition variable, is woken to read
+ * it. The packets aren't copied on the way: the rx thread receives in
+ * the tenant's shmem, lwip's pbufs point into its objects, and each
+ * pbuf, and each data queued, holds a reference to its object.
+ * Another thread runs lwip's timers when they are due.
+ *
+ * The packets lwip outputs while a thread writes, or inputs a burst,
+ * are sent to the nic in bursts too. The tenant's buffers written are
+ * referenced by lwip's segments (they aren't copied), so the netmgr
+ * holds a reference to each of them until its data is acknowledged.
+ *
+ * The `netmgr_tcp_*` API has one connection per thread (the first
+ * `LWIP_MAX_THDS` connections). The `netmgr_conn_*` API has any
+ * number of connections per thread: a connection belongs to the
+ * tenant thread whose rx thread receives its packets, i.e. that
+ * received the SYN for an accepted connection. The events of a thread's
+ * connections are queued on the thread, once per connection, until
+ * it calls `netmgr_poll`.
+ */
+
+#define LWIP_MAX_THDS    (64)
+#define LWIP_MAX_CONNS   (MEMP_NUM_TCP_PCB)
+#define LWIP_BACKLOG_MAX (64)
+#define LWIP_RX_MAX      (2 * NIC_BATCH_MAX)
+#define LWIP_TX_MAX      PKT_BUF_NUM
+#define LWIP_RX_PBUF_MAX PKT_BUF_NUM
+/* The priority of the rx and timer threads, above the tenants' threads */
+#define LWIP_RX_PRIO     (10)
+/* The timer thread checks for timeouts added by other threads at least this often */
+#define LWIP_TMR_MAX_MS  (250) /* lwip's TCP_TMR_INTERVAL */
 
-static shm_bm_objid_t g_objid;
-
-static u16_t g_data_offset, g_data_len;
-
-static ip_addr_t g_remote_addr;
-static u16_t g_remote_port;
+extern struct netif net_interface;
+extern u32_t lwip_sys_now;
 
-static struct pbuf *g_pbuf = NULL;
+/* A buffer written by the tenant, until lwip acknowledged its data */
+struct lwip_tx {
+	struct netshmem_pkt_buf *obj;
+	u16_t                    len;
+};
 
-#define LWIP_MAX_CONNS (16)
+/* Data for the tenant, in the object `objid` of its shmem, holding a reference for it */
+struct lwip_rx {
+	shm_bm_objid_t objid;
+	u16_t          offset, len;
+	ip_addr_t      addr;
+	u16_t          port;
+};
 
-extern struct netif net_interface;
+/*
+ * A packet received, input into lwip without copying it: the pbuf
+ * points into the object, and holds the netmgr's reference to it
+ * until lwip frees the pbuf, wherever lwip keeps it (queued out of
+ * order, refused by a full connection, or reused for a reply).
+ */
+struct lwip_rx_pbuf {
+	struct pbuf_custom       pc;
+	struct netshmem_pkt_buf *obj;
+	shm_bm_objid_t           objid;
+};
 
-struct lwip_pcb
+struct lwip_conn
 {
 	struct tcp_pcb *tp;
 	struct udp_pcb *up;
+	int             accepted;
+	/* The tenant thread the connection belongs to */
+	thdid_t         thd;
+
+	/* For netmgr_conn_*: allocated, closed by the tenant, or the peer, listening, and not accepted yet */
+	int             used, closing, closed, listening, accepting;
+	/* The events not yet polled, and if the connection is on its thread's ready queue */
+	u16_t           events;
+	int             ready;
+	/* A write was short, so the tenant awaits NETMGR_EV_OUT */
+	int             tx_full;
+
+	struct lwip_rx  rx[LWIP_RX_MAX];
+	unsigned int    rx_head, rx_tail;
+
+	/* The buffers written, and the bytes acknowledged of the first */
+	struct lwip_tx  tx[LWIP_TX_MAX];
+	unsigned int    tx_head, tx_tail;
+	u32_t           tx_acked;
 };
 
-static struct lwip_pcb lwip_connections[LWIP_MAX_CONNS];
+/* A connection accepted by a listening connection, until the tenant accepts it */
+struct lwip_backlog {
+	int lconn, conn;
+};
+
+struct lwip_thd
+{
+	/* For an rx thread, the tenant thread it receives for */
+	thdid_t              app;
+	/* A tenant thread waits for data and events on it, and is bound to the nic for tx */
+	struct sync_cond     cond;
+	int                  cond_init, tx_bound;
+
+	/* The descriptors of the bursts, in the tenant's shmem */
+	shm_bm_objid_t       descs_id;
+	struct nic_pkt_desc *descs;
+
+	/* The packets output, sent as a burst at the end of a write or input if `tx_batch` */
+	shm_bm_objid_t       tx_descs_id;
+	struct nic_pkt_desc *tx_descs;
+	int                  tx_n, tx_batch;
+
+	/* The connections with events, and the connections accepted */
+	u16_t               ready[LWIP_MAX_CONNS];
+	unsigned int        ready_head, ready_tail;
+	struct lwip_backlog backlog[LWIP_BACKLOG_MAX];
+	int                 nbacklog;
+};
+
+static struct lwip_conn lwip_connections[LWIP_MAX_CONNS];
+static struct lwip_thd  lwip_thds[LWIP_MAX_THDS];
+static struct sync_lock lwip_lock;
+
+static struct lwip_rx_pbuf  lwip_rx_pbufs[LWIP_RX_PBUF_MAX];
+static struct lwip_rx_pbuf *lwip_rx_pbuf_free[LWIP_RX_PBUF_MAX];
+static int                  lwip_rx_pbuf_nfree;
+
+/* The free connections of the netmgr_conn_* API */
+static int lwip_conn_free[LWIP_MAX_CONNS];
+static int lwip_conn_nfree;
+
+static struct lwip_thd *
+lwip_thd_self(void)
+{
+	thdid_t thd = cos_thdid();
+
+	assert(thd < LWIP_MAX_THDS);
+
+	return &lwip_thds[thd];
+}
+
+/* The tenant thread the current thread works for */
+static thdid_t
+lwip_owner(void)
+{
+	struct lwip_thd *t = lwip_thd_self();
+
+	return t->app ? t->app : cos_thdid();
+}
+
+/* Wake the tenant thread, if it waits for data or events. @pre `lwip_lock` is held */
+static void
+lwip_thd_notify(thdid_t thd)
+{
+	sync_cond_signal(&lwip_thds[thd].cond);
+}
+
+/* Wait for the rx threads to notify the current tenant thread. @pre `lwip_lock` is held */
+static void
+lwip_thd_wait(struct lwip_thd *t)
+{
+	if (unlikely(!t->cond_init)) {
+		if (sync_cond_init(&t->cond)) BUG();
+		t->cond_init = 1;
+	}
+	sync_cond_wait(&t->cond, &lwip_lock);
+}
+
+static struct lwip_conn *
+lwip_conn_self(void)
+{
+	thdid_t thd = cos_thdid();
+
+	assert(thd < LWIP_MAX_THDS);
+
+	return &lwip_connections[thd];
+}
+
+static inline int
+lwip_conn_id(struct lwip_conn *c)
+{
+	return c - lwip_connections;
+}
+
+/* The connection `id` of the netmgr_conn_* API, if it is the current thread's */
+static struct lwip_conn *
+lwip_conn_get(int id)
+{
+	struct lwip_conn *c;
+
+	if (id < LWIP_MAX_THDS || id >= LWIP_MAX_CONNS) return NULL;
+	c = &lwip_connections[id];
+	if (!c->used || c->closing || c->accepting || (c->thd != cos_thdid() && !c->listening)) return NULL;
+
+	return c;
+}
+
+static struct lwip_conn *
+lwip_conn_alloc(void)
+{
+	struct lwip_conn *c;
+
+	if (lwip_conn_nfree == 0) return NULL;
+	c = &lwip_connections[lwip_conn_free[--lwip_conn_nfree]];
+	*c = (struct lwip_conn) { .used = 1, .thd = lwip_owner() };
+
+	return c;
+}
+
+static void
+lwip_conn_dealloc(struct lwip_conn *c)
+{
+	assert(c->used && !c->ready);
+	c->used = 0;
+	lwip_conn_free[lwip_conn_nfree++] = lwip_conn_id(c);
+}
+
+/* Record events for `netmgr_poll` on the connection's thread, and wake it */
+static void
+lwip_conn_event(struct lwip_conn *c, u16_t events)
+{
+	struct lwip_thd *t;
+
+	lwip_thd_notify(c->thd);
+	if (lwip_conn_id(c) < LWIP_MAX_THDS || c->closing) return;
+	c->events |= events;
+	/* The tenant learns of the events before the accept with its first poll after it */
+	if (c->ready || c->accepting) return;
+
+	t = &lwip_thds[c->thd];
+	assert(t->ready_tail - t->ready_head < LWIP_MAX_CONNS);
+	t->ready[t->ready_tail++ % LWIP_MAX_CONNS] = lwip_conn_id(c);
+	c->ready = 1;
+}
+
+/*
+ * Queue the data received by a connection of the current thread's
+ * tenant, each pbuf of the chain in its own entry, with a reference to
+ * its object for the tenant. The caller frees the chain. Returns 1 if
+ * the data is for another tenant's connection (possible for data lwip
+ * held back, in another region), or if the queue is full, so the data
+ * is refused, and lwip keeps it for later.
+ */
+static int
+lwip_rx_queue(struct lwip_conn *c, struct pbuf *p, const ip_addr_t *addr, u16_t port)
+{
+	struct lwip_rx_pbuf     *rp;
+	struct netshmem_pkt_buf *obj;
+	struct lwip_rx          *rx;
+	struct pbuf             *q;
+	shm_bm_objid_t           objid;
+	u16_t                    offset;
+	unsigned int             n = 0;
+
+	for (q = p; q != NULL; q = q->next) n++;
+	if (c->thd != lwip_owner() || c->rx_tail - c->rx_head + n > LWIP_RX_MAX) return 1;
+
+	for (q = p; q != NULL; q = q->next) {
+		if (q->len == 0) continue;
+		if (q->flags & PBUF_FLAG_IS_CUSTOM) {
+			rp     = (struct lwip_rx_pbuf *)q;
+			objid  = rp->objid;
+			obj    = shm_bm_take_net_pkt_buf(netshmem_get_shm(), objid);
+			assert(obj);
+			offset = (char *)q->payload - obj->data;
+		} else {
+			/* Not from the nic (e.g. data lwip built itself), so it is copied */
+			obj = netshmem_pkt_buf_alloc(&objid);
+			if (!obj) break;
+			memcpy(obj->data, q->payload, q->len);
+			offset = 0;
+		}
+
+		rx  = &c->rx[c->rx_tail++ % LWIP_RX_MAX];
+		*rx = (struct lwip_rx) { .objid = objid, .offset = offset, .len = q->len, .port = port };
+		if (addr) rx->addr = *addr;
+	}
+	lwip_conn_event(c, NETMGR_EV_IN);
+
+	return 0;
+}
+
+/* Free the data queued for the tenant that it will never read */
+static void
+lwip_rx_drop(struct lwip_conn *c)
+{
+	struct lwip_rx *rx;
+
+	while (c->rx_head != c->rx_tail) {
+		rx = &c->rx[c->rx_head++ % LWIP_RX_MAX];
+		netshmem_pkt_buf_free(shm_bm_borrow_net_pkt_buf(netshmem_get_shm(), rx->objid));
+	}
+}
+
+/* lwip is done with a packet received: release the netmgr's reference */
+static void
+lwip_rx_pbuf_release(struct pbuf *p)
+{
+	struct lwip_rx_pbuf *rp = (struct lwip_rx_pbuf *)p;
 
+	netshmem_pkt_buf_free(rp->obj);
+	lwip_rx_pbuf_free[lwip_rx_pbuf_nfree++] = rp;
+}
+
+static void
+lwip_tx_flush(struct lwip_thd *t)
+{
+	if (t->tx_n > 0) nic_send_packets(t->tx_descs_id, t->tx_n);
+	t->tx_n = 0;
+}
+
+/*
+ * Send the descriptors of a packet output by lwip, or add them to the
+ * burst of the current thread. They hold a reference to their objects
+ * for the nic.
+ */
+void
+netmgr_lwip_tx(const struct nic_pkt_desc *d, int n)
+{
+	struct lwip_thd *t = lwip_thd_self();
+
+	assert(n <= NIC_BATCH_MAX);
+	if (unlikely(!t->tx_descs)) {
+		t->tx_descs = netshmem_pkt_buf_alloc(&t->tx_descs_id);
+		assert(t->tx_descs);
+	}
+
+	if (t->tx_n + n > NIC_BATCH_MAX) lwip_tx_flush(t);
+	memcpy(&t->tx_descs[t->tx_n], d, n * sizeof(*d));
+	t->tx_n += n;
+	if (!t->tx_batch) lwip_tx_flush(t);
+}
+
+/* Release the buffers whose data is acknowledged, in the order they were written */
 static err_t
 cos_lwip_tcp_sent(void *arg, struct tcp_pcb *tp, u16_t len)
 {
-	/* TODO: process sent state */
+	struct lwip_conn *c = arg;
+	struct lwip_tx   *t;
+
+	c->tx_acked += len;
+	while (c->tx_head != c->tx_tail) {
+		t = &c->tx[c->tx_head % LWIP_TX_MAX];
+		if (t->len > c->tx_acked) break;
+		c->tx_acked -= t->len;
+		netshmem_pkt_buf_free(t->obj);
+		c->tx_head++;
+	}
+	if (c->tx_full) {
+		c->tx_full = 0;
+		lwip_conn_event(c, NETMGR_EV_OUT);
+	}
+	/* A blocking write might wait for room */
+	lwip_thd_notify(c->thd);
+	/* A connection closed by the tenant is reused once lwip is done with its buffers */
+	if (c->closing && c->tx_head == c->tx_tail) {
+		tcp_arg(tp, NULL);
+		tcp_sent(tp, NULL);
+		tcp_err(tp, NULL);
+		lwip_conn_dealloc(c);
+	}
+
 	return ERR_OK;
 }
 
-
 static err_t
 cos_lwip_tcp_recv(void *arg, struct tcp_pcb *tp, struct pbuf *p, err_t err)
 {
-	if (p != NULL) {
-		back_to_app = 1;
-		g_pbuf = p;
-		tcp_recved(tp, p->tot_len);
+	struct lwip_conn *c = arg;
+
+	if (p == NULL) {
+		/* The peer closed the connection: hang up once the data is read */
+		c->closed = 1;
+		lwip_conn_event(c, NETMGR_EV_HUP);
+
+		return ERR_OK;
 	}
+	if (lwip_rx_queue(c, p, NULL, 0)) return ERR_MEM;
+	tcp_recved(tp, p->tot_len);
+	pbuf_free(p);
 
 	return ERR_OK;
 }
 
+/*
+ * The connection was reset, or timed out. lwip already freed the pcb
+ * and its segments, so the buffers written are released.
+ */
 static void
-cos_lwip_tcp_err(void *arg,  err_t err)
+cos_lwip_tcp_err(void *arg, err_t err)
 {
-	assert(0);
-	return;
+	struct lwip_conn *c = arg;
+
+	if (!c) return;
+	c->tp       = NULL;
+	c->closed   = 1;
+	c->tx_acked = 0;
+	while (c->tx_head != c->tx_tail) netshmem_pkt_buf_free(c->tx[c->tx_head++ % LWIP_TX_MAX].obj);
+	if (c->closing) {
+		lwip_conn_dealloc(c);
+		return;
+	}
+	lwip_conn_event(c, NETMGR_EV_HUP);
 }
 
-static err_t
-cos_lwip_tcp_accept(void *arg, struct tcp_pcb *tp, err_t err)
+static void
+lwip_tcp_conn_setup(struct lwip_conn *c, struct tcp_pcb *tp)
 {
-	err_t ret_err;
-	thdid_t thd = cos_thdid();
-
-	tcp_arg(tp, 0);
+	tcp_arg(tp, c);
 	tcp_err(tp, cos_lwip_tcp_err);
 	tcp_recv(tp, cos_lwip_tcp_recv);
 	tcp_sent(tp, cos_lwip_tcp_sent);
+	c->tp = tp;
+	tcp_nagle_disable(tp);
+}
 
-	lwip_connections[thd].tp = tp;
+/*
+ * A connection is accepted for the tenant thread of the rx thread that
+ * input the SYN. The connection of a netmgr_tcp_* thread becomes the
+ * accepted one. For a listening connection of the netmgr_conn_* API,
+ * it is queued in the thread's backlog; a full backlog refuses the
+ * connection.
+ */
+static err_t
+cos_lwip_tcp_accept(void *arg, struct tcp_pcb *tp, err_t err)
+{
+	struct lwip_conn *l = arg, *c;
+	struct lwip_thd  *t;
 
-	tcp_nagle_disable(tp);
+	if (lwip_conn_id(l) < LWIP_MAX_THDS) {
+		lwip_tcp_conn_setup(l, tp);
+		l->accepted = 1;
+		lwip_thd_notify(l->thd);
+
+		return ERR_OK;
+	}
+
+	t = &lwip_thds[lwip_owner()];
+	if (err != ERR_OK || t->nbacklog == LWIP_BACKLOG_MAX) return ERR_MEM;
+	c = lwip_conn_alloc();
+	if (!c) return ERR_MEM;
+	lwip_tcp_conn_setup(c, tp);
+	c->accepting = 1;
+	t->backlog[t->nbacklog++] = (struct lwip_backlog) { .lconn = lwip_conn_id(l), .conn = lwip_conn_id(c) };
+	lwip_thd_notify(c->thd);
+
+	return ERR_OK;
+}
+
+/*
+ * Input the packet into lwip, passing it the netmgr's reference to the
+ * object. The packet is dropped if all the pbufs are held by lwip.
+ */
+static void
+net_interface_input(struct netshmem_pkt_buf *obj, shm_bm_objid_t objid, u16_t offset, u16_t len)
+{
+	struct lwip_rx_pbuf *rp;
+	struct pbuf         *p;
+
+	if (unlikely(lwip_rx_pbuf_nfree == 0)) {
+		netshmem_pkt_buf_free(obj);
+		return;
+	}
+	rp = lwip_rx_pbuf_free[--lwip_rx_pbuf_nfree];
+	rp->obj                     = obj;
+	rp->objid                   = objid;
+	rp->pc.custom_free_function = lwip_rx_pbuf_release;
+
+	p = pbuf_alloced_custom(PBUF_RAW, len, PBUF_REF, &rp->pc, obj->data + offset, len);
+	assert(p);
+	if (net_interface.input(p, &net_interface) != ERR_OK) pbuf_free(p);
+}
+
+/*
+ * Receive a burst of packets from the nic (blocking for the first),
+ * and input all of them into lwip, which also runs its timers.
+ */
+static void
+net_receive_burst(struct lwip_thd *t)
+{
+	struct netshmem_pkt_buf *obj;
+	int i, n;
+
+	if (unlikely(!t->descs)) {
+		t->descs = netshmem_pkt_buf_alloc(&t->descs_id);
+		assert(t->descs);
+	}
+
+	n = nic_get_packets(t->descs_id, NIC_BATCH_MAX);
+	assert(n > 0);
+
+	sync_lock_take(&lwip_lock);
+	lwip_sys_now = (u32_t)(time_now_usec() / 1000);
+	/* The acknowledgments, and the data they let lwip send, go in one burst */
+	t->tx_batch = 1;
+	for (i = 0; i < n; i++) {
+		struct nic_pkt_desc d = t->descs[i];
+
+		obj = shm_bm_borrow_net_pkt_buf(netshmem_get_shm(), d.objid);
+		assert(obj);
+
+		net_interface_input(obj, d.objid, d.pkt_offset, d.pkt_len);
+	}
+	sys_check_timeouts();
+	t->tx_batch = 0;
+	lwip_tx_flush(t);
+	sync_lock_release(&lwip_lock);
+}
+
+/* A netmgr thread receiving the packets of a port for a tenant thread */
+struct lwip_rx_thd {
+	thdid_t app;
+	cbuf_t  shm_id;
+	u32_t   ip;
+	u16_t   port;
+	int     bound;
+};
+
+static struct lwip_rx_thd lwip_rx_thds[LWIP_MAX_THDS];
+static int                lwip_rx_nthds;
+
+static void
+lwip_rx_thd_fn(void *data)
+{
+	struct lwip_rx_thd *r = data;
+	struct lwip_thd    *t = lwip_thd_self();
+
+	/* Receive in the tenant thread's region, that the data queued references */
+	netshmem_share(r->app);
+	nic_shmem_map(r->shm_id);
+	nic_bind_port(r->ip, htons(r->port));
+	t->app = r->app;
 
-	ret_err = ERR_OK;
-	return ret_err;
+	ps_store(&r->bound, 1);
+	sched_thd_wakeup(r->app);
+
+	while (1) net_receive_burst(t);
+}
+
+/*
+ * Start the thread receiving the packets of the port for the current
+ * thread, on its core, and wait until it is bound to the nic. The
+ * current thread only sends.
+ */
+static void
+lwip_rx_start(u32_t ip_addr, u16_t port)
+{
+	struct lwip_thd    *t = lwip_thd_self();
+	struct lwip_rx_thd *r;
+	thdid_t             thd;
+
+	if (!t->tx_bound) {
+		nic_bind_tx();
+		t->tx_bound = 1;
+	}
+
+	sync_lock_take(&lwip_lock);
+	assert(lwip_rx_nthds < LWIP_MAX_THDS);
+	r = &lwip_rx_thds[lwip_rx_nthds++];
+	sync_lock_release(&lwip_lock);
+	*r = (struct lwip_rx_thd) { .app = cos_thdid(), .shm_id = netshmem_get_shm_id(), .ip = ip_addr, .port = port };
+
+	thd = sched_thd_create(lwip_rx_thd_fn, r);
+	assert(thd && thd < LWIP_MAX_THDS);
+	if (sched_thd_param_set(thd, sched_param_pack(SCHEDP_PRIO, LWIP_RX_PRIO))) BUG();
+	while (!ps_load(&r->bound)) sched_thd_block(0);
 }
 
 void netmgr_shmem_map(cbuf_t shm_id)
@@ -106,16 +616,18 @@ netmgr_tcp_bind(u32_t ip_addr, u16_t port)
 	struct tcp_pcb *tp;
 	struct ip4_addr ipa = *(struct ip4_addr*)&ip_addr;
 
-	thdid_t thd = cos_thdid();
+	struct lwip_conn *c = lwip_conn_self();
 
-	nic_bind_port(ip_addr, htons(port));
+	lwip_rx_start(ip_addr, port);
 
+	sync_lock_take(&lwip_lock);
 	tp = tcp_new();
 	assert(tp != NULL);
 
-	lwip_connections[thd].tp = tp;
+	c->tp = tp;
 
 	ret = tcp_bind(tp, &ipa, port);
+	sync_lock_release(&lwip_lock);
 
 	return ret;
 }
@@ -123,68 +635,69 @@ netmgr_tcp_bind(u32_t ip_addr, u16_t port)
 int
 netmgr_tcp_listen(u8_t backlog)
 {
-	struct tcp_pcb *new_tp = NULL;
-	thdid_t         thd    = cos_thdid();
+	struct tcp_pcb   *new_tp = NULL;
+	struct lwip_conn *c      = lwip_conn_self();
 
-	new_tp = tcp_listen_with_backlog(lwip_connections[thd].tp, backlog);
+	sync_lock_take(&lwip_lock);
+	new_tp = tcp_listen_with_backlog(c->tp, backlog);
 	assert(new_tp);
+	tcp_arg(new_tp, c);
 
-	lwip_connections[thd].tp = new_tp;
+	c->tp = new_tp;
+	sync_lock_release(&lwip_lock);
 
 	return ERR_OK;
 }
 
-static void
-net_interface_input(void *pkt, int len)
+/*
+ * Dequeue the next data for the tenant, that now owns its object.
+ * Returns an `objid` of `0` if none is queued.
+ */
+static struct lwip_rx
+lwip_rx_dequeue(struct lwip_conn *c, u16_t *data_offset, u16_t *data_len)
 {
-	void        *pl;
-	struct pbuf *p;
-	
-	pl = pkt;
+	struct lwip_rx rx = { 0 };
 
-	p = pbuf_alloc(PBUF_LINK, len, PBUF_ROM);
-	assert(p);
-
-	p->payload = pl;
-	if (net_interface.input(p, &net_interface) != ERR_OK) {
-		assert(0);
-	}
+	*data_offset = *data_len = 0;
+	if (c->rx_head == c->rx_tail) return rx;
+	rx = c->rx[c->rx_head++ % LWIP_RX_MAX];
 
-	if (p->ref != 0) {
-		pbuf_free(p);
-	}
+	*data_offset = rx.offset;
+	*data_len    = rx.len;
 
-	return;
+	return rx;
 }
 
-int
-net_receive_packet(char *pkt, size_t pkt_len)
+/*
+ * The next data queued for the tenant, waiting until there is some, or
+ * the connection is closed (then the `objid` is `0`).
+ */
+static struct lwip_rx
+net_receive_data(struct lwip_conn *c, u16_t *data_offset, u16_t *data_len)
 {
-	net_interface_input(pkt, pkt_len);
-	return 0;
+	struct lwip_rx rx;
+
+	sync_lock_take(&lwip_lock);
+	while (c->rx_head == c->rx_tail && !c->closed) lwip_thd_wait(lwip_thd_self());
+	rx = lwip_rx_dequeue(c, data_offset, data_len);
+	sync_lock_release(&lwip_lock);
+
+	return rx;
 }
 
 int
 netmgr_tcp_accept(struct conn_addr *client_addr)
 {
-	shm_bm_objid_t           objid = 0;
-	struct netshmem_pkt_buf *obj;
-	size_t shmsz;
-	cbuf_t rx_shm_id;
-	void  *mem;
-	u16_t  pkt_len;
-
-	thdid_t thd = cos_thdid();
+	struct lwip_conn *c = lwip_conn_self();
 
+	sync_lock_take(&lwip_lock);
 	netif_set_link_up(&net_interface);
-	tcp_accept(lwip_connections[thd].tp, cos_lwip_tcp_accept);
+	tcp_accept(c->tp, cos_lwip_tcp_accept);
+	while (!c->accepted) lwip_thd_wait(lwip_thd_self());
+	sync_lock_release(&lwip_lock);
 
-	while (!back_to_app) {
-		objid = nic_get_a_packet(&pkt_len);
-		obj   = shm_bm_take_net_pkt_buf(netshmem_get_shm(), objid);
-		net_receive_packet(obj->data, pkt_len);
-	}
-	g_objid = objid;
+	client_addr->ip   = ip_2_ip4(&c->tp->remote_ip)->addr;
+	client_addr->port = c->tp->remote_port;
 
 	return 0;
 }
@@ -192,85 +705,122 @@ netmgr_tcp_accept(struct conn_addr *client_addr)
 shm_bm_objid_t
 netmgr_tcp_shmem_read(u16_t *data_offset, u16_t *data_len)
 {
-	shm_bm_objid_t           objid;
-	struct netshmem_pkt_buf *obj;
-	u16_t pkt_len;
-
-	obj = shm_bm_take_net_pkt_buf(netshmem_get_shm(), g_objid);
-
-	while (!back_to_app) {
-		objid = nic_get_a_packet(&pkt_len);
-		obj = shm_bm_take_net_pkt_buf(netshmem_get_shm(), objid);
-		assert(obj);
+	return net_receive_data(lwip_conn_self(), data_offset, data_len).objid;
+}
 
-		net_receive_packet(obj->data, pkt_len);
-		g_objid = objid;
+/*
+ * Write the buffers, waiting for acknowledgments while lwip has no
+ * room for the next one, if `block`. Otherwise, the
+ * write stops there, and the connection gets a NETMGR_EV_OUT once
+ * there is room. The segments of all of them are output together,
+ * thus sent in bursts.
+ */
+static int
+lwip_tcp_write(struct lwip_conn *c, const struct netmgr_buf *bufs, int n, int block)
+{
+	struct lwip_thd         *t = lwip_thd_self();
+	struct netshmem_pkt_buf *obj;
+	struct netmgr_buf        b;
+	int                      i, written = 0;
+	err_t                    err;
+
+	sync_lock_take(&lwip_lock);
+	if (!c->tp || c->closed) {
+		sync_lock_release(&lwip_lock);
+		return -EPIPE;
 	}
+	c->tx_full  = 0;
+	t->tx_batch = 1;
+	for (i = 0; i < n; i++) {
+		b = bufs[i]; /* the buffers are shared with the tenant */
+		if (b.data_len == 0) continue;
+		/* The tailroom is the nic's, while the object is sent */
+		if (b.data_offset + b.data_len > PKT_BUF_SIZE - NETSHMEM_TAILROOM) break;
+
+		while (c->tp && (tcp_sndbuf(c->tp) < b.data_len || c->tx_tail - c->tx_head == LWIP_TX_MAX)) {
+			if (!block) {
+				c->tx_full = 1;
+				break;
+			}
+			tcp_output(c->tp);
+			lwip_tx_flush(t);
+			lwip_thd_wait(t);
+		}
+		/* The connection was reset while we waited */
+		if (!c->tp || c->tx_full) break;
 
-	*data_offset = (char *)g_pbuf->payload - obj->data;
-	*data_len = g_pbuf->len;
+		obj = shm_bm_take_net_pkt_buf(netshmem_get_shm(), b.objid);
+		if (!obj) break;
 
-	back_to_app = 0;
+		err = tcp_write(c->tp, obj->data + b.data_offset, b.data_len, i + 1 < n ? TCP_WRITE_FLAG_MORE : 0);
+		if (err != ERR_OK) {
+			netshmem_pkt_buf_free(obj);
+			break;
+		}
+		c->tx[c->tx_tail++ % LWIP_TX_MAX] = (struct lwip_tx) { .obj = obj, .len = b.data_len };
+		written += b.data_len;
+	}
+	if (c->tp) tcp_output(c->tp);
+	t->tx_batch = 0;
+	lwip_tx_flush(t);
+	sync_lock_release(&lwip_lock);
 
-	return g_objid;
+	return written;
 }
 
 int
 netmgr_tcp_shmem_write(shm_bm_objid_t objid, u16_t data_offset, u16_t data_len)
 {
-	struct netshmem_pkt_buf *obj;
+	struct netmgr_buf b = { .objid = objid, .data_offset = data_offset, .data_len = data_len };
+	int ret;
 
-	thdid_t thd = cos_thdid();
-	char *data;
+	ret = lwip_tcp_write(lwip_conn_self(), &b, 1, 1);
+	if (ret < 0) return ret;
+	assert(ret == data_len);
 
-	obj = shm_bm_take_net_pkt_buf(netshmem_get_shm(), objid);
-	data = obj->data + data_offset;
+	return 0;
+}
 
-	err_t wr_err = tcp_write(lwip_connections[thd].tp, data, data_len, 0);
-	assert(wr_err == ERR_OK);
+int
+netmgr_tcp_shmem_writev(shm_bm_objid_t bufs, int n)
+{
+	struct netmgr_buf *b;
 
-	/* tcp_output() might be needed in the future */
-	// wr_err = tcp_output(lwip_connections[thd].tp);
-	// assert(wr_err == ERR_OK);
+	if (n <= 0 || n > NETMGR_WRITE_MAX) return -EINVAL;
+	b = shm_bm_borrow_net_pkt_buf(netshmem_get_shm(), bufs);
+	if (!b) return -EINVAL;
 
-	return 0;
+	return lwip_tcp_write(lwip_conn_self(), b, n, 1);
 }
 
 static void
 cos_lwip_udp_recv(void *arg, struct udp_pcb *up, struct pbuf *p, const ip_addr_t *addr, u16_t port)
 {
-	if (p != NULL) {
-		back_to_app = 1;
-		g_pbuf = p;
-		g_remote_addr = *addr;
-		g_remote_port = port;
-	}
+	/* The UDP data can't be refused, so it is dropped if the queue is full */
+	if (p == NULL) return;
+	lwip_rx_queue(arg, p, addr, port);
+	pbuf_free(p);
 }
 
 int
 netmgr_udp_bind(u32_t ip_addr, u16_t port)
 {
-	unsigned long npages;
-	void         *mem;
-	shm_bm_t      shm;
-
-	struct netshmem_pkt_buf *obj;
-
 	struct ip4_addr ipa = *(struct ip4_addr *)&ip_addr;
 	err_t ret;
 
-	thdid_t thd = cos_thdid();
-	assert(thd < LWIP_MAX_CONNS);
+	struct lwip_conn *c = lwip_conn_self();
 
-	nic_bind_port(ip_addr, htons(port));
+	lwip_rx_start(ip_addr, port);
 
-	lwip_connections[thd].up = udp_new();
-	assert(lwip_connections[thd].up != NULL);
+	sync_lock_take(&lwip_lock);
+	c->up = udp_new();
+	assert(c->up != NULL);
 
-	ret = udp_bind(lwip_connections[thd].up, &ipa, port);
+	ret = udp_bind(c->up, &ipa, port);
 	assert(ret == ERR_OK);
 
-	udp_recv(lwip_connections[thd].up, cos_lwip_udp_recv, 0);
+	udp_recv(c->up, cos_lwip_udp_recv, c);
+	sync_lock_release(&lwip_lock);
 
 	return ret;
 }
@@ -278,32 +828,12 @@ netmgr_udp_bind(u32_t ip_addr, u16_t port)
 shm_bm_objid_t
 netmgr_udp_shmem_read(u16_t *data_offset, u16_t *data_len, u32_t *remote_addr, u16_t *remote_port)
 {
-	shm_bm_objid_t           objid;
-	struct netshmem_pkt_buf *obj;
-	u16_t pkt_len;
-
-	while (1) {
-		objid = nic_get_a_packet(&pkt_len);
-		obj = shm_bm_borrow_net_pkt_buf(netshmem_get_shm(), objid);
-		assert(obj);
-
-		net_receive_packet(obj->data, pkt_len);
-		g_objid = objid;
-		if (!back_to_app) {
-			/* if this packet doesn't need to transfer to application, lwip needs to free it. */
-			shm_bm_free_net_pkt_buf(obj);
-		} else {
-			break;
-		}
-	}
+	struct lwip_rx rx = net_receive_data(lwip_conn_self(), data_offset, data_len);
 
-	*data_offset = (char *)g_pbuf->payload - obj->data;
-	*data_len    = g_pbuf->len;
-	*remote_addr = g_remote_addr.addr;
-	*remote_port = g_remote_port;
+	*remote_addr = rx.addr.addr;
+	*remote_port = rx.port;
 
-	back_to_app = 0;
-	return g_objid;
+	return rx.objid;
 }
 
 int
@@ -314,20 +844,301 @@ netmgr_udp_shmem_write(shm_bm_objid_t objid, u16_t data_offset, u16_t data_len,
 
 	ip_addr_t dst_ip;
 	
-	thdid_t thd = cos_thdid();
+	struct lwip_conn *c = lwip_conn_self();
 	char *data;
 
 	obj  = shm_bm_borrow_net_pkt_buf(netshmem_get_shm(), objid);
 	data = obj->data + data_offset;
 
+	sync_lock_take(&lwip_lock);
 	p = pbuf_alloc(PBUF_LINK, data_len, PBUF_ROM);
 	assert(p);
 
 	p->payload  = data;
 	dst_ip.addr = remote_ip;
 
-	udp_sendto_if(lwip_connections[thd].up, p , &dst_ip, remote_port, &net_interface);
+	udp_sendto_if(c->up, p , &dst_ip, remote_port, &net_interface);
 	pbuf_free(p);
+	sync_lock_release(&lwip_lock);
+
+	return 0;
+}
+
+/*
+ * Close a connection of the netmgr_conn_* API. Its slot is reused
+ * once lwip is done with the buffers written, which is either now, or
+ * when they are acknowledged (or the connection is reset).
+ */
+static void
+lwip_conn_destroy(struct lwip_conn *c)
+{
+	struct lwip_thd *t = &lwip_thds[c->thd];
+	struct tcp_pcb  *tp = c->tp;
+	unsigned int     i, n;
+
+	/* Remove it from the ready queue of its thread */
+	if (c->ready) {
+		for (i = n = t->ready_head; i != t->ready_tail; i++) {
+			if (t->ready[i % LWIP_MAX_CONNS] == lwip_conn_id(c)) continue;
+			t->ready[n++ % LWIP_MAX_CONNS] = t->ready[i % LWIP_MAX_CONNS];
+		}
+		t->ready_tail = n;
+		c->ready      = 0;
+	}
+	c->closing = 1;
+	lwip_rx_drop(c);
+
+	if (!tp) {
+		lwip_conn_dealloc(c);
+		return;
+	}
+	tcp_recv(tp, NULL);
+	if (c->listening) {
+		tcp_arg(tp, NULL);
+		tcp_accept(tp, NULL);
+	}
+	if (tcp_close(tp) != ERR_OK) {
+		/* Calls cos_lwip_tcp_err, which deallocates the connection */
+		tcp_abort(tp);
+		return;
+	}
+	if (c->tx_head == c->tx_tail) {
+		tcp_arg(tp, NULL);
+		tcp_sent(tp, NULL);
+		tcp_err(tp, NULL);
+		lwip_conn_dealloc(c);
+	}
+}
+
+int
+netmgr_conn_listen(u32_t ip_addr, u16_t port, u8_t backlog)
+{
+	struct ip4_addr   ipa = *(struct ip4_addr *)&ip_addr;
+	struct tcp_pcb   *tp, *ltp;
+	struct lwip_conn *l;
+	int               i;
+
+	/* The flows of the port are spread across the rx threads of the threads that bind it */
+	lwip_rx_start(ip_addr, port);
+
+	sync_lock_take(&lwip_lock);
+	netif_set_link_up(&net_interface);
+	/* A thread binding a port that is already listening shares its connection */
+	for (i = LWIP_MAX_THDS; i < LWIP_MAX_CONNS; i++) {
+		l = &lwip_connections[i];
+		if (l->used && l->listening && !l->closing && l->tp->local_port == port) {
+			sync_lock_release(&lwip_lock);
+			return i;
+		}
+	}
+
+	l = lwip_conn_alloc();
+	tp = tcp_new();
+	if (!l || !tp) goto err;
+	if (tcp_bind(tp, &ipa, port) != ERR_OK) goto err;
+	ltp = tcp_listen_with_backlog(tp, backlog);
+	if (!ltp) goto err;
+
+	l->tp        = ltp;
+	l->listening = 1;
+	tcp_arg(ltp, l);
+	tcp_accept(ltp, cos_lwip_tcp_accept);
+	sync_lock_release(&lwip_lock);
+
+	return lwip_conn_id(l);
+err:
+	if (tp) tcp_close(tp);
+	if (l) lwip_conn_dealloc(l);
+	sync_lock_release(&lwip_lock);
+
+	return -ENOMEM;
+}
+
+int
+netmgr_conn_accept(int lconn, u32_t *remote_addr, u16_t *remote_port)
+{
+	struct lwip_thd  *t = lwip_thd_self();
+	struct lwip_conn *l, *c;
+	int               i, id;
+
+	sync_lock_take(&lwip_lock);
+	l = lwip_conn_get(lconn);
+	if (!l || !l->listening) {
+		sync_lock_release(&lwip_lock);
+		return -EINVAL;
+	}
+	for (i = 0; i < t->nbacklog && t->backlog[i].lconn != lconn; i++) ;
+	if (i == t->nbacklog) {
+		sync_lock_release(&lwip_lock);
+		return -EAGAIN;
+	}
+	id = t->backlog[i].conn;
+	t->backlog[i] = t->backlog[--t->nbacklog];
+
+	c = &lwip_connections[id];
+	if (c->tp) {
+		*remote_addr = ip_2_ip4(&c->tp->remote_ip)->addr;
+		*remote_port = c->tp->remote_port;
+	} else {
+		*remote_addr = 0;
+		*remote_port = 0;
+	}
+	c->accepting = 0;
+	if (c->events) lwip_conn_event(c, 0);
+	sync_lock_release(&lwip_lock);
+
+	return id;
+}
+
+shm_bm_objid_t
+netmgr_conn_read(int conn, u16_t *data_offset, u16_t *data_len)
+{
+	struct lwip_conn *c;
+	struct lwip_rx    rx = { 0 };
+
+	*data_offset = *data_len = 0;
+	sync_lock_take(&lwip_lock);
+	c = lwip_conn_get(conn);
+	if (c && !c->listening) rx = lwip_rx_dequeue(c, data_offset, data_len);
+	sync_lock_release(&lwip_lock);
+
+	return rx.objid;
+}
+
+int
+netmgr_conn_writev(int conn, shm_bm_objid_t bufs, int n)
+{
+	struct lwip_conn  *c;
+	struct netmgr_buf *b;
+
+	if (n <= 0 || n > NETMGR_WRITE_MAX) return -EINVAL;
+	b = shm_bm_borrow_net_pkt_buf(netshmem_get_shm(), bufs);
+	if (!b) return -EINVAL;
+
+	sync_lock_take(&lwip_lock);
+	c = lwip_conn_get(conn);
+	sync_lock_release(&lwip_lock);
+	if (!c || c->listening) return -EINVAL;
+
+	return lwip_tcp_write(c, b, n, 0);
+}
+
+int
+netmgr_conn_close(int conn)
+{
+	struct lwip_conn *c;
+	int               i, j;
+
+	sync_lock_take(&lwip_lock);
+	c = lwip_conn_get(conn);
+	if (!c) {
+		sync_lock_release(&lwip_lock);
+		return -EINVAL;
+	}
+	/* The connections not accepted yet are closed with their listening connection */
+	for (i = 0; c->listening && i < LWIP_MAX_THDS; i++) {
+		struct lwip_thd *t = &lwip_thds[i];
+
+		for (j = 0; j < t->nbacklog; ) {
+			if (t->backlog[j].lconn != conn) {
+				j++;
+				continue;
+			}
+			lwip_conn_destroy(&lwip_connections[t->backlog[j].conn]);
+			t->backlog[j] = t->backlog[--t->nbacklog];
+		}
+	}
+	lwip_conn_destroy(c);
+	sync_lock_release(&lwip_lock);
 
 	return 0;
 }
+
+/*
+ * Write the events of the thread's connections. A listening
+ * connection has NETMGR_EV_IN while the thread has connections to
+ * accept from it, and the other connections have the events since the
+ * last poll.
+ */
+static int
+lwip_poll(struct lwip_thd *t, struct netmgr_event *evs, int n)
+{
+	struct lwip_conn *c;
+	int               i, j, nevs = 0;
+
+	for (i = 0; i < t->nbacklog && nevs < n; i++) {
+		for (j = 0; j < nevs && evs[j].conn != t->backlog[i].lconn; j++) ;
+		if (j == nevs) evs[nevs++] = (struct netmgr_event) { .conn = t->backlog[i].lconn, .events = NETMGR_EV_IN };
+	}
+	while (nevs < n && t->ready_head != t->ready_tail) {
+		c = &lwip_connections[t->ready[t->ready_head++ % LWIP_MAX_CONNS]];
+		evs[nevs++] = (struct netmgr_event) { .conn = lwip_conn_id(c), .events = c->events };
+		c->ready  = 0;
+		c->events = 0;
+	}
+
+	return nevs;
+}
+
+int
+netmgr_poll(shm_bm_objid_t evs, int n, int block)
+{
+	struct lwip_thd     *t = lwip_thd_self();
+	struct netmgr_event *e;
+	int                  ret;
+
+	if (n <= 0 || n > NETMGR_POLL_MAX) return -EINVAL;
+	e = shm_bm_borrow_net_pkt_buf(netshmem_get_shm(), evs);
+	if (!e) return -EINVAL;
+
+	sync_lock_take(&lwip_lock);
+	while ((ret = lwip_poll(t, e, n)) == 0 && block) lwip_thd_wait(t);
+	sync_lock_release(&lwip_lock);
+
+	return ret;
+}
+
+/*
+ * Run lwip's timers when they are due, rather than only with the
+ * bursts received: the retransmissions, and delayed acks, of idle
+ * connections depend on them. The thread sends from its own region,
+ * so the data of the tenants it retransmits is copied.
+ */
+void
+netmgr_lwip_timers(void)
+{
+	struct lwip_thd *t = lwip_thd_self();
+	u32_t            sleep;
+
+	netshmem_create();
+	nic_shmem_map(netshmem_get_shm_id());
+	nic_bind_tx();
+	if (sched_thd_param_set(cos_thdid(), sched_param_pack(SCHEDP_PRIO, LWIP_RX_PRIO))) BUG();
+
+	while (1) {
+		sync_lock_take(&lwip_lock);
+		lwip_sys_now = (u32_t)(time_now_usec() / 1000);
+		t->tx_batch  = 1;
+		sys_check_timeouts();
+		t->tx_batch  = 0;
+		lwip_tx_flush(t);
+		sleep = sys_timeouts_sleeptime();
+		sync_lock_release(&lwip_lock);
+		pgo_dump_once(time_now(), time_usec2cyc(PGO_DUMP_DELAY_USEC));
+
+		if (sleep > LWIP_TMR_MAX_MS) sleep = LWIP_TMR_MAX_MS;
+		sched_thd_block_timeout(0, time_now() + time_usec2cyc(sleep * 1000));
+	}
+}
+
+void
+netmgr_lwip_lock_init(void)
+{
+	int i;
+
+	if (sync_lock_init(&lwip_lock)) BUG();
+
+	for (i = 0; i < LWIP_MAX_THDS; i++) lwip_connections[i].thd = i;
+	for (i = LWIP_MAX_CONNS - 1; i >= LWIP_MAX_THDS; i--) lwip_conn_free[lwip_conn_nfree++] = i;
+	for (i = 0; i < LWIP_RX_PBUF_MAX; i++) lwip_rx_pbuf_free[lwip_rx_pbuf_nfree++] = &lwip_rx_pbufs[i];
+}
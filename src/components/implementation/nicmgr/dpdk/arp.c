@@ -0,0 +1,268 @@
+#include <cos_component.h>
+#include <llprint.h>
+#include <ps.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <sync_lock.h>
+#include <nic.h>
+#include <net_stack_types.h>
+#include <net_cksum.h>
+#include "nicmgr.h"
+
+/***
+ * ARP and ICMP echo, for the addresses bound by the sessions. Both are
+ * answered in place, in the mbuf received, and sent on the core's tx
+ * queue, so they never reach the tenants' stacks.
+ *
+ * The neighbors are learned from the ARP packets received (their
+ * senders), and kept in an open-addressing table of their IPs, that
+ * the tenants' stacks query (nic_neigh_lookup) for the addresses they
+ * haven't cached yet. As the flow table, entries are only added, under
+ * the lock, and looked up without it: an entry is published by writing
+ * its IP last, and its MAC is a single word.
+ */
+
+/* Don't request an address more than once per (about) 1s of cycles */
+#define NIC_ARP_RETRY_CYCS (1ULL << 30)
+
+#define NIC_ARP_PKT_LEN (ETH_STD_LEN + sizeof(struct arp_hdr))
+
+struct nic_neigh {
+	u32_t ip;     /* 0 if the entry is empty */
+	u64_t mac;    /* the address' bytes, in tx order, 0 until it's resolved */
+	u64_t req_ts; /* the time of the last request for it */
+};
+
+static struct nic_neigh  neigh_tbl[NIC_NEIGH_TBL_SZ];
+static unsigned long     neigh_n;
+static struct sync_lock  neigh_lock;
+static u32_t             local_ips[NIC_LOCAL_IP_MAX];
+static unsigned long     nlocal_ips;
+static struct ether_addr nic_mac;
+
+static inline unsigned long
+nic_neigh_hash(u32_t ip)
+{
+	return (ip * 0x9E3779B1U) >> 16;
+}
+
+/* The entry of `ip`, or the empty entry to add it at */
+static struct nic_neigh *
+nic_neigh_probe(u32_t ip)
+{
+	struct nic_neigh *e;
+	unsigned long h = nic_neigh_hash(ip), i;
+	u32_t key;
+
+	for (i = 0; i < NIC_NEIGH_TBL_SZ; i++) {
+		e   = &neigh_tbl[(h + i) & (NIC_NEIGH_TBL_SZ - 1)];
+		key = ps_load(&e->ip);
+		if (!key || key == ip) return e;
+	}
+
+	return NULL;
+}
+
+/* The entry of `ip`, added if there is room, with the lock taken */
+static struct nic_neigh *
+nic_neigh_get(u32_t ip)
+{
+	struct nic_neigh *e = nic_neigh_probe(ip);
+
+	if (!e || e->ip) return e;
+	/* Keep the load factor low, so probes are short */
+	if (neigh_n >= NIC_NEIGH_TBL_SZ / 2) return NULL;
+
+	e->mac    = 0;
+	e->req_ts = 0;
+	ps_mem_fence();
+	e->ip = ip;
+	neigh_n++;
+
+	return e;
+}
+
+static void
+nic_neigh_learn(u32_t ip, const struct ether_addr *mac)
+{
+	struct nic_neigh *e;
+	u64_t m = 0;
+
+	memcpy(&m, mac, sizeof(*mac));
+	e = nic_neigh_probe(ip);
+	if (e && e->ip == ip && ps_load(&e->mac) == m) return;
+
+	sync_lock_take(&neigh_lock);
+	e = nic_neigh_get(ip);
+	if (e) e->mac = m;
+	sync_lock_release(&neigh_lock);
+}
+
+static int
+nic_ip_local(u32_t ip)
+{
+	unsigned long i, n = ps_load(&nlocal_ips);
+
+	for (i = 0; i < n; i++) {
+		if (local_ips[i] == ip) return 1;
+	}
+
+	return 0;
+}
+
+void
+nic_arp_local_add(u32_t ip)
+{
+	sync_lock_take(&neigh_lock);
+	if (!nic_ip_local(ip) && nlocal_ips < NIC_LOCAL_IP_MAX) {
+		local_ips[nlocal_ips] = ip;
+		ps_mem_fence();
+		nlocal_ips++;
+	}
+	sync_lock_release(&neigh_lock);
+}
+
+static void
+nic_arp_fill(struct eth_hdr *eth, u16_t op, u32_t sip, const struct ether_addr *tha, u32_t tip)
+{
+	struct arp_hdr *arp = (struct arp_hdr *)(eth + 1);
+
+	eth->src_addr   = nic_mac;
+	eth->ether_type = htons(ETH_TYPE_ARP);
+
+	arp->arp_hardware = htons(RTE_ARP_HRD_ETHER);
+	arp->arp_protocol = htons(ETH_TYPE_IPV4);
+	arp->arp_hlen     = sizeof(struct ether_addr);
+	arp->arp_plen     = sizeof(u32_t);
+	arp->arp_opcode   = htons(op);
+
+	arp->arp_data.arp_sha = nic_mac;
+	arp->arp_data.arp_sip = sip;
+	arp->arp_data.arp_tha = *tha;
+	arp->arp_data.arp_tip = tip;
+}
+
+/* Broadcast a request for `ip`, from our first address */
+static void
+nic_arp_request(u32_t ip)
+{
+	struct ether_addr zero = { { 0 } };
+	struct eth_hdr   *eth;
+	char             *mbuf;
+
+	if (!ps_load(&nlocal_ips)) return;
+	mbuf = nic_tx_alloc();
+	if (!mbuf) return;
+	eth = (struct eth_hdr *)cos_packet_append(mbuf, NIC_ARP_PKT_LEN);
+	if (!eth) {
+		cos_free_packet(mbuf);
+		return;
+	}
+
+	memset(&eth->dst_addr, 0xFF, sizeof(eth->dst_addr));
+	nic_arp_fill(eth, RTE_ARP_OP_REQUEST, local_ips[0], &zero, ip);
+	nic_tx_one(mbuf);
+}
+
+int
+nic_arp_input(char *mbuf, char *pkt, int len)
+{
+	struct eth_hdr    *eth = (struct eth_hdr *)pkt;
+	struct arp_hdr    *arp = (struct arp_hdr *)(eth + 1);
+	struct ether_addr  sha;
+	u32_t              sip, tip;
+
+	if (len < (int)NIC_ARP_PKT_LEN) return 0;
+	if (arp->arp_hardware != htons(RTE_ARP_HRD_ETHER) || arp->arp_protocol != htons(ETH_TYPE_IPV4)) return 0;
+	if (arp->arp_hlen != sizeof(struct ether_addr) || arp->arp_plen != sizeof(u32_t)) return 0;
+
+	sha = arp->arp_data.arp_sha;
+	sip = arp->arp_data.arp_sip;
+	tip = arp->arp_data.arp_tip;
+	/* Both the requests and the replies tell us the sender's address */
+	if (sip) nic_neigh_learn(sip, &sha);
+
+	if (arp->arp_opcode != htons(RTE_ARP_OP_REQUEST) || !nic_ip_local(tip)) return 0;
+
+	eth->dst_addr = sha;
+	nic_arp_fill(eth, RTE_ARP_OP_REPLY, tip, &sha, sip);
+	nic_tx_one(mbuf);
+
+	return 1;
+}
+
+int
+nic_icmp_input(char *mbuf, char *pkt, int len)
+{
+	struct eth_hdr    *eth = (struct eth_hdr *)pkt;
+	struct ip_hdr     *ip  = (struct ip_hdr *)(eth + 1);
+	struct icmp_hdr   *icmp;
+	struct ether_addr  tmp;
+	u32_t              addr;
+	int                ip_len, icmp_len;
+
+	if (len < (int)(ETH_STD_LEN + IP_STD_LEN + ICMP_STD_LEN) || ip->ihl < 5) return 0;
+	ip_len = ntohs(ip->total_len);
+	icmp_len = ip_len - ip->ihl * 4;
+	/* The frame can be padded after the IP packet */
+	if (ip_len > len - (int)ETH_STD_LEN || icmp_len < (int)ICMP_STD_LEN) return 0;
+	if (ip->frag_off & htons(0x3FFF) || !nic_ip_local(ip->dst_addr)) return 0;
+
+	icmp = (struct icmp_hdr *)((char *)ip + ip->ihl * 4);
+	if (icmp->type != ICMP_ECHO_REQUEST || icmp->code != 0) return 0;
+	if (net_cksum_fold(net_cksum_partial(icmp, icmp_len)) != 0xFFFF) return 0;
+
+	/* The reply is the request, with the addresses swapped */
+	tmp           = eth->dst_addr;
+	eth->dst_addr = eth->src_addr;
+	eth->src_addr = tmp;
+	addr          = ip->dst_addr;
+	ip->dst_addr  = ip->src_addr;
+	ip->src_addr  = addr;
+	ip->ttl       = 64;
+	ip->checksum  = 0;
+	ip->checksum  = ~net_cksum_fold(net_cksum_partial(ip, ip->ihl * 4));
+
+	icmp->type     = ICMP_ECHO_REPLY;
+	icmp->checksum = 0;
+	icmp->checksum = ~net_cksum_fold(net_cksum_partial(icmp, icmp_len));
+	nic_tx_one(mbuf);
+
+	return 1;
+}
+
+u64_t
+nic_neigh_lookup(u32_t ip)
+{
+	struct nic_neigh *e;
+	u64_t mac, now;
+	int req = 0;
+
+	e = nic_neigh_probe(ip);
+	if (e && ps_load(&e->ip) == ip) {
+		mac = ps_load(&e->mac);
+		if (mac) return mac;
+	}
+
+	/* Resolve it, without flooding the link with the requests of all of the tenants */
+	rdtscll(now);
+	sync_lock_take(&neigh_lock);
+	e = nic_neigh_get(ip);
+	if (e && !e->mac && now - e->req_ts > NIC_ARP_RETRY_CYCS) {
+		e->req_ts = now;
+		req = 1;
+	}
+	sync_lock_release(&neigh_lock);
+	if (req) nic_arp_request(ip);
+
+	return 0;
+}
+
+void
+nic_arp_init(void)
+{
+	u64_t mac = cos_get_port_mac_address(0);
+
+	if (sync_lock_init(&neigh_lock)) BUG();
+	memcpy(&nic_mac, &mac, sizeof(nic_mac));
+}
@@ -0,0 +1,201 @@
+#include <cos_component.h>
+#include <llprint.h>
+#include <ps.h>
+#include <errno.h>
+#include <string.h>
+#include <sync_lock.h>
+#include <chash.h>
+#include "nicmgr.h"
+
+/***
+ * The flow table is a concurrent hash map (chash.h) of rules per
+ * mask: a lookup masks the packet's 5-tuple with each of the masks in
+ * use (there are only a few, e.g. "the destination port"), and looks
+ * that mask's table up with it. Rules are only added, by the threads
+ * binding sessions, while the polling threads look packets up without
+ * locks: the map publishes a rule after its key, and the group of a
+ * rule is published by incrementing its size last.
+ *
+ * A burst of packets is looked up together, so the hashes of all of
+ * its keys are computed, and their slots prefetched, before any of
+ * them is looked up, and the cache misses of the packets overlap.
+ */
+
+struct nic_flow_rule {
+	unsigned long          nsessions;
+	struct client_session *sessions[NIC_FLOW_GROUP_MAX];
+};
+
+static inline unsigned long
+nic_flow_hash(const union nic_flow_key *k)
+{
+	u64_t h = (k->w[0] ^ (k->w[1] * 0x9E3779B97F4A7C15ULL)) * 0xC2B2AE3D27D4EB4FULL;
+
+	return h ^ (h >> 31);
+}
+
+static inline void
+nic_flow_mask(union nic_flow_key *masked, const union nic_flow_key *k, const union nic_flow_key *mask)
+{
+	masked->w[0] = k->w[0] & mask->w[0];
+	masked->w[1] = k->w[1] & mask->w[1];
+}
+
+static inline int
+nic_flow_key_eq(const union nic_flow_key *a, const union nic_flow_key *b)
+{
+	return ((a->w[0] ^ b->w[0]) | (a->w[1] ^ b->w[1])) == 0;
+}
+
+CHASH_FNS(flow, union nic_flow_key, struct nic_flow_rule *, NIC_FLOW_TBL_SZ, nic_flow_hash, nic_flow_key_eq);
+
+struct nic_flow_tbl {
+	union nic_flow_key mask;
+	int                nbits;  /* the number of bits matched, more wins */
+	unsigned long      nrules;
+	struct chash_flow  rules;
+} CACHE_ALIGNED;
+
+static struct nic_flow_tbl  flow_tbls[NIC_FLOW_MASK_MAX];
+static unsigned long        flow_ntbls;
+static struct nic_flow_rule flow_rules[NIC_FLOW_RULE_MAX];
+static unsigned long        flow_nrules;
+static struct sync_lock     flow_lock;
+
+static struct client_session *
+nic_flow_pick(struct nic_flow_rule *r, const union nic_flow_key *k, u32_t rss)
+{
+	unsigned long n = ps_load(&r->nsessions);
+
+	if (likely(n == 1)) return r->sessions[0];
+	if (rss) return r->sessions[rss % n];
+
+	return r->sessions[(nic_flow_hash(k) >> 16) % n];
+}
+
+void
+nic_flow_lookup_burst(const union nic_flow_key *keys, const u32_t *rss, int n, struct client_session **sessions)
+{
+	union nic_flow_key     masked[NIC_FLOW_BURST];
+	unsigned long          hashes[NIC_FLOW_BURST];
+	struct nic_flow_rule  *best[NIC_FLOW_BURST];
+	int                    nbits[NIC_FLOW_BURST];
+	struct nic_flow_tbl   *t;
+	struct nic_flow_rule  *r;
+	unsigned long          ntbls = ps_load(&flow_ntbls);
+	unsigned long          i;
+	int                    j;
+
+	assert(n <= NIC_FLOW_BURST);
+	for (j = 0; j < n; j++) {
+		best[j]  = NULL;
+		nbits[j] = -1;
+	}
+
+	for (i = 0; i < ntbls; i++) {
+		t = &flow_tbls[i];
+
+		for (j = 0; j < n; j++) {
+			nic_flow_mask(&masked[j], &keys[j], &t->mask);
+			hashes[j] = nic_flow_hash(&masked[j]);
+			chash_flow_prefetch(&t->rules, hashes[j]);
+		}
+		for (j = 0; j < n; j++) {
+			if (nbits[j] >= t->nbits) continue;
+			if (chash_flow_lookup_hash(&t->rules, &masked[j], hashes[j], &r)) continue;
+			best[j]  = r;
+			nbits[j] = t->nbits;
+		}
+	}
+
+	for (j = 0; j < n; j++) sessions[j] = best[j] ? nic_flow_pick(best[j], &keys[j], rss ? rss[j] : 0) : NULL;
+}
+
+struct client_session *
+nic_flow_lookup(const union nic_flow_key *key)
+{
+	struct client_session *session;
+
+	nic_flow_lookup_burst(key, NULL, 1, &session);
+
+	return session;
+}
+
+static struct nic_flow_tbl *
+nic_flow_tbl_get(const union nic_flow_key *mask)
+{
+	struct nic_flow_tbl *t;
+	unsigned long i;
+
+	for (i = 0; i < flow_ntbls; i++) {
+		if (nic_flow_key_eq(&flow_tbls[i].mask, mask)) return &flow_tbls[i];
+	}
+	if (flow_ntbls == NIC_FLOW_MASK_MAX) return NULL;
+
+	t = &flow_tbls[flow_ntbls];
+	t->mask  = *mask;
+	t->nbits = __builtin_popcountll(mask->w[0]) + __builtin_popcountll(mask->w[1]);
+	/* Publish the table after its mask */
+	ps_mem_fence();
+	flow_ntbls++;
+
+	return t;
+}
+
+int
+nic_flow_add(const struct cos_flow_tuple *key, const struct cos_flow_tuple *mask,
+             struct client_session *session, int queue)
+{
+	union nic_flow_key    k, m;
+	struct nic_flow_tbl  *t;
+	struct nic_flow_rule *r;
+	int                   ret = 0;
+
+	m.t = *mask;
+	k.t = *key;
+	/* The padding is never matched */
+	memset(m.t.pad, 0, sizeof(m.t.pad));
+	nic_flow_mask(&k, &k, &m);
+
+	sync_lock_take(&flow_lock);
+	t = nic_flow_tbl_get(&m);
+	if (!t) {
+		ret = -ENOSPC;
+		goto done;
+	}
+	if (!chash_flow_lookup(&t->rules, &k, &r)) {
+		if (r->nsessions == NIC_FLOW_GROUP_MAX) {
+			ret = -ENOSPC;
+			goto done;
+		}
+		/* The steering of the rule is set up by its first session */
+		r->sessions[r->nsessions] = session;
+		ps_mem_fence();
+		r->nsessions++;
+		goto done;
+	}
+	/* Keep the load factor low, so probes are short */
+	if (t->nrules >= NIC_FLOW_TBL_SZ / 2 || flow_nrules == NIC_FLOW_RULE_MAX) {
+		ret = -ENOSPC;
+		goto done;
+	}
+
+	r = &flow_rules[flow_nrules++];
+	r->sessions[0] = session;
+	r->nsessions   = 1;
+	if (queue >= 0) ret = cos_dev_port_flow_steer(0, &k.t, &m.t, queue) == 0;
+
+	/* Publishes the rule, after its key */
+	if (chash_flow_add(&t->rules, &k, &r)) BUG();
+	t->nrules++;
+done:
+	sync_lock_release(&flow_lock);
+
+	return ret;
+}
+
+void
+nic_flow_init(void)
+{
+	if (sync_lock_init(&flow_lock)) BUG();
+}
@@ -0,0 +1,110 @@
+#include <cos_component.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <net_stack_types.h>
+#include <net_cksum.h>
+#include "nicmgr.h"
+
+/***
+ * Receive coalescing of TCP segments in software (GRO), before the
+ * session's stack sees them: the payload of a segment that is the next
+ * one of the previous segment's flow is appended to that segment, so
+ * a stream of small segments costs the stack one segment (and the
+ * tenant one pbuf and object) per buffer.
+ *
+ * Only segments without IP or TCP options, and with only the ACK (and
+ * PSH) flags are merged, and a segment with PSH ends the merging. The
+ * checksums of the merged segment are updated incrementally, after
+ * checking those of the appended segment, so a corrupted segment isn't
+ * hidden in a valid one.
+ */
+
+#define GRO_HDRS_LEN (ETH_STD_LEN + IP_STD_LEN + TCP_STD_LEN)
+
+struct gro_hdrs {
+	struct eth_hdr eth;
+	struct ip_hdr  ip;
+	struct tcp_hdr tcp;
+} __attribute__((packed));
+
+/* The TCP payload of a plain data segment, or -1 */
+static inline int
+gro_payload_len(const struct gro_hdrs *h, u16_t pkt_len)
+{
+	u16_t tot = ntohs(h->ip.total_len);
+
+	if (pkt_len < GRO_HDRS_LEN || h->eth.ether_type != htons(0x0800)) return -1;
+	if (h->ip.version != IPv4 || h->ip.ihl != 5 || h->ip.proto != TCP_PROTO) return -1;
+	/* Fragments, but DF is fine */
+	if (h->ip.frag_off & htons(0x3FFF)) return -1;
+	if (h->tcp.data_off != (5 << 4) || (h->tcp.flags & ~TCP_FLAG_PSH) != TCP_FLAG_ACK) return -1;
+	/* The frame can be padded after the IP packet */
+	if (tot < IP_STD_LEN + TCP_STD_LEN || tot > pkt_len - ETH_STD_LEN) return -1;
+
+	return tot - IP_STD_LEN - TCP_STD_LEN;
+}
+
+static inline u16_t
+gro_ip_cksum(const struct ip_hdr *ip)
+{
+	return net_cksum_fold(net_cksum_partial(ip, IP_STD_LEN));
+}
+
+/* The sum of the pseudo-header of a TCP segment of `len` bytes */
+static inline u64_t
+gro_pseudo_sum(const struct ip_hdr *ip, u16_t len)
+{
+	return net_cksum_partial(&ip->src_addr, 8) + htons(TCP_PROTO) + htons(len);
+}
+
+int
+nic_gro_merge(char *buf, u16_t *len, u16_t cap, const char *pkt, u16_t pkt_len)
+{
+	struct gro_hdrs       *h = (struct gro_hdrs *)buf;
+	const struct gro_hdrs *n = (const struct gro_hdrs *)pkt;
+	int                    plen, nlen;
+	u64_t                  psum, sum;
+	u16_t                  old_tot, old_flags, new_flags;
+
+	plen = gro_payload_len(h, *len);
+	nlen = gro_payload_len(n, pkt_len);
+	if (plen <= 0 || nlen <= 0 || (h->tcp.flags & TCP_FLAG_PSH)) return 0;
+	if (GRO_HDRS_LEN + plen + nlen > cap) return 0;
+
+	/* The next segment of the same flow, with the same acknowledgment and window */
+	if (h->ip.src_addr != n->ip.src_addr || h->ip.dst_addr != n->ip.dst_addr) return 0;
+	if (h->tcp.port.src_port != n->tcp.port.src_port || h->tcp.port.dst_port != n->tcp.port.dst_port) return 0;
+	if (h->tcp.ack != n->tcp.ack || h->tcp.window != n->tcp.window) return 0;
+	if (ntohl(n->tcp.seq) != ntohl(h->tcp.seq) + plen) return 0;
+
+	/* Both checksums of the appended segment must be valid */
+	if (gro_ip_cksum(&n->ip) != 0xFFFF) return 0;
+	psum = net_cksum_partial(pkt + GRO_HDRS_LEN, nlen);
+	sum  = gro_pseudo_sum(&n->ip, TCP_STD_LEN + nlen) + net_cksum_partial(&n->tcp, TCP_STD_LEN) + psum;
+	if (net_cksum_fold(sum) != 0xFFFF) return 0;
+
+	memcpy(buf + GRO_HDRS_LEN + plen, pkt + GRO_HDRS_LEN, nlen);
+
+	/*
+	 * The TCP checksum gains the appended payload (whose 16-bit
+	 * words are byte-swapped if it starts at an odd offset), the
+	 * new length in the pseudo-header, and the PSH flag.
+	 */
+	psum = net_cksum_fold(psum);
+	if (plen & 1) psum = ((psum & 0xFF) << 8) | (psum >> 8);
+	memcpy(&old_flags, &h->tcp.data_off, 2);
+	h->tcp.flags |= n->tcp.flags & TCP_FLAG_PSH;
+	memcpy(&new_flags, &h->tcp.data_off, 2);
+	sum = (u16_t)~h->tcp.checksum + psum + htons(TCP_STD_LEN + plen + nlen)
+	      + (u16_t)~htons(TCP_STD_LEN + plen) + new_flags + (u16_t)~old_flags;
+	h->tcp.checksum = ~net_cksum_fold(sum);
+
+	old_tot          = ntohs(h->ip.total_len);
+	h->ip.total_len  = htons(old_tot + nlen);
+	h->ip.checksum   = 0;
+	h->ip.checksum   = ~gro_ip_cksum(&h->ip);
+
+	*len = ETH_STD_LEN + old_tot + nlen;
+
+	return 1;
+}
@@ -7,11 +7,10 @@
 #include <arpa/inet.h>
 #include <net_stack_types.h>
 #include <rte_atomic.h>
-#include <rte_hash.h>
-#include <rte_jhash.h>
-#include <rte_hash_crc.h>
 #include <sync_blkpt.h>
 #include <sync_lock.h>
+#include <cos_time.h>
+#include <pgo.h>
 #include "nicmgr.h"
 
 #define ENABLE_DEBUG_INFO 0
@@ -29,64 +28,18 @@ u64_t rx_enqueued_miss = 0;
 extern rte_atomic64_t tx_enqueued_miss;
 
 char *g_rx_mp[NIC_RX_QUEUE_NUM];
-char *g_tx_mp[NIC_TX_QUEUE_NUM];
 char rx_per_core_mpool_name[NIC_RX_QUEUE_NUM][32];
 char tx_per_core_mpool_name[NIC_TX_QUEUE_NUM][32];
 
 static u16_t nic_ports = 0;
 
-struct rte_hash *tenant_hash_tbl;
-struct sync_lock tx_lock[NIC_TX_QUEUE_NUM];
-
-static struct rte_hash_parameters rte_hash_params = {
-	.entries = NIC_MAX_SESSION,
-	.key_len = sizeof(uint16_t),
-	.hash_func = rte_jhash,
-	.hash_func_init_val = 0,
-	.socket_id = 0,
-	.extra_flag = RTE_HASH_EXTRA_FLAGS_MULTI_WRITER_ADD,
-};
-
-static void
-cos_hash_init()
-{
-	int pos, ret;
-
-	rte_hash_params.name = "tenant_id_tbl";
-
-	tenant_hash_tbl = rte_hash_create(&rte_hash_params);
-
-	assert(tenant_hash_tbl);
-
-	printc("tenant hash table init done\n");
-}
-
-void 
-cos_hash_add(uint16_t tenant_id, struct client_session *session)
+/* The session bound to a port (in network byte order), for debugging */
+static struct client_session *
+debug_port_session(u16_t port)
 {
-	int ret;
-	ret = rte_hash_add_key_data(tenant_hash_tbl, &tenant_id, session);
-	assert(ret >= 0);
-}
-
-struct client_session *
-cos_hash_lookup(uint16_t tenant_id)
-{
-	int ret;
-	struct client_session *session = NULL;
-
-	/* If DPDK receives this port, it goes to process debug information */
-	if (unlikely(tenant_id == htons(NIC_DEBUG_PORT))) {
-		// asm volatile("mfence");
-		printc("debug flag is open\n");
-		debug_flag = 1;
-		return NULL;
-	}
+	union nic_flow_key key = { .t = { .dst_port = port, .proto = UDP_PROTO } };
 
-	ret = rte_hash_lookup_data(tenant_hash_tbl, &tenant_id, (void *)&session);
-	if (ret < 0) return NULL;
-
-	return session;
+	return nic_flow_lookup(&key);
 }
 
 static void
@@ -99,12 +52,28 @@ debug_print_stats(void)
 	printc("tx enqueued miss:%lu\n", tx_enqueued_miss.cnt);
 	printc("enqueue:%lu, txqneueue:%lu\n", enqueued_rx, dequeued_tx);
 	struct client_session	*session1, *session2;
-	session1 = cos_hash_lookup(ntohs(6));
-	session2 = cos_hash_lookup(ntohs(7));
-	int ret1 = sched_debug_thd_state(session1->thd);
-	int ret2 = sched_debug_thd_state(session2->thd);
-	printc("com 6:%u\n", ret1);
-	printc("com 7:%u\n", ret2);
+	struct nic_rx_stats	*s;
+	struct nic_tx_stats	*t;
+	struct nic_cpu_acct	*c;
+	int			 i;
+	session1 = debug_port_session(htons(6));
+	session2 = debug_port_session(htons(7));
+	if (session1) printc("com 6:%u\n", sched_debug_thd_state(session1->thd));
+	if (session2) printc("com 7:%u\n", sched_debug_thd_state(session2->thd));
+	for (i = 0; i < NIC_MAX_SESSION; i++) {
+		s = &client_sessions[i].rx_stats;
+		if (!client_sessions[i].tx_init_done) continue;
+		printc("session %d: %lu blocks, %lu wakeups, %lu spins, %lu dropped\n", i,
+		       s->blocks, s->wakeups, s->spins, s->dropped);
+		t = &client_sessions[i].tx_qos.stats;
+		printc("session %d tx (class %u): %lu sent, %lu dropped, %lu shaped\n", i,
+		       client_sessions[i].tx_qos.class, t->sent, t->dropped, t->shaped);
+		c = &client_sessions[i].cpu;
+		printc("session %d cpu: %llu rx usec, %llu tx usec, %lu throttled\n", i,
+		       (unsigned long long)(c->rx / time_cyc_per_usec()),
+		       (unsigned long long)(c->tx / time_cyc_per_usec()), c->throttled);
+	}
+	nic_trace_report();
 }
 
 static void
@@ -119,116 +88,151 @@ debug_dump_info(void)
 	}
 }
 
+/* Enqueue the `n` packets for the session together, and wake it up */
 static void
-ext_buf_free_callback_fn(void *addr, void *opaque)
+__deliver_rx_packets(struct client_session *session, char **pkts, int n)
 {
-	/* Shared mem uses borrow api, thus do not need to free it here */
-	if (addr == NULL) {
-		printc("External buffer address is invalid\n");
-		assert(0);
+	struct nic_rx_desc descs[NIC_FLOW_BURST];
+	u64_t              ts = 0;
+	int                i, ret;
+
+	if (NETSHMEM_TRACE_ENABLE) rdtscll(ts);
+	for (i = 0; i < n; i++) descs[i] = (struct nic_rx_desc) { .pkt = pkts[i], .ts = ts };
+	/* Unsteered sessions can receive on any of the queues */
+	ret = nic_rx_ring_enqueue_n(session->rx_ring, descs, n, !session->steered);
+	for (i = ret; i < n; i++) {
+		cos_free_packet(pkts[i]);
+		rx_enqueued_miss++;
+	}
+	if (unlikely(!ret)) return;
+	enqueued_rx += ret;
+
+	if (!NIC_RX_HYBRID_WAKEUP) {
+		sync_sem_give(&session->sem);
+		return;
+	}
+	/* Only wake the tenant if it's blocked, or about to, on its empty ring */
+	ps_mem_fence();
+	if (ps_load(&session->rx_sleeping) && ps_cas(&session->rx_sleeping, 1, 0)) {
+		session->rx_stats.wakeups++;
+		sync_sem_give(&session->sem);
 	}
 }
 
-static void
-process_tx_packets(void)
+/*
+ * Deliver the packets, unless the session is over its budget, and
+ * charge it the cycles since `start`. Returns when it was done.
+ */
+static cycles_t
+deliver_rx_packets(struct client_session *session, char **pkts, int n, cycles_t start)
 {
-	struct pkt_buf buf;
-	char *mbuf;
-	void *ext_shinfo;
-	char *tx_packets[MAX_PKT_BURST];
-	struct pkt_ring_buf *per_thd_tx_ring;
-	int i = 0, j = 0;
-	// cycles_t    before, after;
-	for (j = 0; j < NIC_MAX_SESSION; j++) {
-		if (client_sessions[j].tx_init_done == 0) continue;
-
-		per_thd_tx_ring = &client_sessions[j].pkt_tx_ring;
-		while (!pkt_ring_buf_empty(per_thd_tx_ring)) {
-			i = 0;
-
-			pkt_ring_buf_dequeue(per_thd_tx_ring, &buf);
-
-			dequeued_tx++;
-			mbuf = cos_allocate_mbuf(g_tx_mp[0]);
-			assert(mbuf);
-			ext_shinfo = netshmem_get_tailroom((struct netshmem_pkt_buf *)buf.obj);
-
-			cos_attach_external_mbuf(mbuf, buf.obj, buf.paddr, PKT_BUF_SIZE, ext_buf_free_callback_fn, ext_shinfo);
-			cos_set_external_packet(mbuf, (buf.pkt - buf.obj), buf.pkt_len, ENABLE_OFFLOAD);
-			tx_packets[i++] = mbuf;
-			// rdtscll(before);
-			cos_dev_port_tx_burst(0, 0, tx_packets, i);
-			// rdtscll(after);
-		}
+	cycles_t now;
+	int      i;
 
+	if (unlikely(nic_cpu_throttled(session, start))) {
+		for (i = 0; i < n; i++) cos_free_packet(pkts[i]);
+		session->cpu.throttled += n;
+	} else {
+		__deliver_rx_packets(session, pkts, n);
 	}
+	now = time_now();
+	nic_cpu_charge(session, now, now - start, 0);
+
+	return now;
 }
 
+/*
+ * Find the sessions of up to NIC_FLOW_BURST packets in the flow table
+ * together, and deliver them. Only IPv4 TCP and UDP packets are. Each
+ * session is charged its share of the lookup, by its packets.
+ */
 static void
-process_rx_packets(cos_portid_t port_id, char** rx_pkts, uint16_t nb_pkts)
+process_rx_burst(char **rx_pkts, uint16_t nb_pkts)
 {
-	int i, ret;
+	int i, j, n = 0, nb;
 	int len = 0;
 
 	struct eth_hdr		*eth;
 	struct ip_hdr		*iph;
-	struct arp_hdr		*arp_hdr;
 	struct tcp_udp_port	*port;
-	struct client_session	*session;
 	char                    *pkt;
-	struct pkt_buf           buf;
+	char                    *pkts[NIC_FLOW_BURST], *batch[NIC_FLOW_BURST];
+	union nic_flow_key       keys[NIC_FLOW_BURST];
+	u32_t                    rss[NIC_FLOW_BURST];
+	struct client_session   *sessions[NIC_FLOW_BURST];
+	struct cos_pkt_meta      meta;
+	cycles_t                 start = time_now(), now, lookup;
 
 	for (i = 0; i < nb_pkts; i++) {
-		pkt = cos_get_packet(rx_pkts[i], &len);
+		pkt = cos_get_packet_meta(rx_pkts[i], &len, &meta);
 		eth = (struct eth_hdr *)pkt;
 
-		if (htons(eth->ether_type) == 0x0800) {
-			iph	= (struct ip_hdr *)((char *)eth + sizeof(struct eth_hdr));
-			if (unlikely(iph->proto != UDP_PROTO)) {
-				// assert(0);
-				cos_free_packet(rx_pkts[i]);
-				rx_enqueued_miss++;
-				continue;
-			}
-			port	= (struct tcp_udp_port *)((char *)eth + sizeof(struct eth_hdr) + iph->ihl * 4);
-
-			// printc("port id:0x%x\n", port->dst_port);
-			session = cos_hash_lookup(port->dst_port);
-			// assert(session->port == port->dst_port);
-			if (unlikely(debug_flag)) {
-				debug_print_stats();
-				debug_flag = 0;
-			}
-			if (unlikely(session == NULL)) {
+		if (htons(eth->ether_type) != ETH_TYPE_IPV4) {
+			/* ARP is answered here, the others aren't handled */
+			if (htons(eth->ether_type) != ETH_TYPE_ARP || !nic_arp_input(rx_pkts[i], pkt, len)) {
 				cos_free_packet(rx_pkts[i]);
-				continue;
 			}
-			// memset(&buf, 0, sizeof(buf));
-			buf.pkt = rx_pkts[i];
-			// if (ntohs(port->dst_port) == 6) {
-			// 	buf.tent_id = 6;
-			// 	buf.srcid = ntohs(port->src_port);
-			// } else if(ntohs(port->dst_port) == 7) {
-			// 	buf.tent_id = 7;
-			// 	buf.srcid = ntohs(port->src_port);
-			// } else {
-			// 	assert(0);
-			// }
-			if (unlikely(!pkt_ring_buf_enqueue(&(session->pkt_ring_buf), &buf))){
-				cos_free_packet(buf.pkt);
-				rx_enqueued_miss++;
-				continue;
-			}
-			enqueued_rx++;
-			// if (unlikely(debug_flag)) {
-			// 	session->sem.debug = 1;
-			// }
-
-			sync_sem_give(&session->sem);
-		} else if (htons(eth->ether_type) == 0x0806) {
-			cos_free_packet(buf.pkt);
 			continue;
 		}
+		iph = (struct ip_hdr *)((char *)eth + sizeof(struct eth_hdr));
+		if (unlikely(iph->proto != UDP_PROTO && iph->proto != TCP_PROTO)) {
+			if (iph->proto == ICMP_PROTO && nic_icmp_input(rx_pkts[i], pkt, len)) continue;
+			cos_free_packet(rx_pkts[i]);
+			rx_enqueued_miss++;
+			continue;
+		}
+		port = (struct tcp_udp_port *)((char *)eth + sizeof(struct eth_hdr) + iph->ihl * 4);
+
+		/* If DPDK receives this port, it goes to process debug information */
+		if (unlikely(port->dst_port == htons(NIC_DEBUG_PORT))) {
+			printc("debug flag is open\n");
+			debug_flag = 1;
+			cos_free_packet(rx_pkts[i]);
+			continue;
+		}
+
+		keys[n].t = (struct cos_flow_tuple) {
+			.src_ip   = iph->src_addr,
+			.dst_ip   = iph->dst_addr,
+			.src_port = port->src_port,
+			.dst_port = port->dst_port,
+			.proto    = iph->proto,
+		};
+		/* The NIC hashed the flow already */
+		rss[n]    = (meta.flags & COS_PKT_META_RSS) ? meta.rss_hash : 0;
+		pkts[n++] = rx_pkts[i];
+	}
+	if (unlikely(debug_flag)) {
+		debug_print_stats();
+		debug_flag = 0;
+	}
+
+	nic_flow_lookup_burst(keys, rss, n, sessions);
+	now    = time_now();
+	lookup = now - start;
+	/* The packets of a session are enqueued together, in order: bursts are usually of a few flows */
+	for (i = 0; i < n; i++) {
+		if (!pkts[i]) continue; /* enqueued with a previous packet of its session */
+		if (unlikely(sessions[i] == NULL)) {
+			cos_free_packet(pkts[i]);
+			continue;
+		}
+		for (j = i, nb = 0; j < n; j++) {
+			if (!pkts[j] || sessions[j] != sessions[i]) continue;
+			batch[nb++] = pkts[j];
+			pkts[j]     = NULL;
+		}
+		now = deliver_rx_packets(sessions[i], batch, nb, now - lookup * nb / n);
+	}
+}
+
+static void
+process_rx_packets(cos_portid_t port_id, char** rx_pkts, uint16_t nb_pkts)
+{
+	uint16_t i;
+
+	for (i = 0; i < nb_pkts; i += NIC_FLOW_BURST) {
+		process_rx_burst(&rx_pkts[i], nb_pkts - i < NIC_FLOW_BURST ? nb_pkts - i : NIC_FLOW_BURST);
 	}
 }
 
@@ -246,6 +250,12 @@ cos_free_rx_buf()
 	}
 }
 
+void
+nic_loopback_rx(char **mbufs, int n)
+{
+	process_rx_packets(0, mbufs, n);
+}
+
 static void
 swap_mac(struct eth_hdr *eth) {
 	char tmp[6];
@@ -278,30 +288,45 @@ transmit_back(cos_portid_t port_id, char** rx_pkts, uint16_t nb_pkts)
 	assert(ret == nb_pkts);
 }
 
+/* Poll the rx queue `queue` of port 0, and the zero-copy queues polled on its core */
 static void
-cos_nic_start(){
-	int i, j, recv_round;
+cos_nic_start(cos_queueid_t queue){
+	int i, j, n, q, recv_round;
 	uint16_t nb_pkts = 0;
+	cycles_t now;
 
 	char *rx_packets[MAX_PKT_BURST];
 
 	while (1) {
+		pgo_dump_once(time_now(), time_usec2cyc(PGO_DUMP_DELAY_USEC));
 #if USE_CK_RING_FREE_MBUF
 		cos_free_rx_buf();
 #endif
 #if ENABLE_DEBUG_INFO
 		debug_dump_info();
 #endif
-		// process_tx_packets();
+		/* Send what the sessions couldn't while another thread was sending on the queue */
+		nic_tx_flush(queue % nic_ntxq);
 
-		// only port 0, queue 0 receive packets
-		nb_pkts = cos_dev_port_rx_burst(0, 0, rx_packets, MAX_PKT_BURST);
+		/* only port 0 receives packets, on one queue per core */
+		nb_pkts = cos_dev_port_rx_burst(0, queue, rx_packets, MAX_PKT_BURST);
 		/* These are the two test options */
 		// if (nb_pkts!= 0) transmit_back(0, rx_packets, nb_pkts);
 		// if (nb_pkts!= 0) cos_dev_port_tx_burst(0, 0, rx_packets, nb_pkts);
 
 		/* This is the real processing logic for applications */
 		if (nb_pkts != 0) process_rx_packets(0, rx_packets, nb_pkts);
+
+		for (q = 0; q < NIC_RX_ZC_QUEUE_NUM; q++) {
+			if (ps_load(&nic_zc_queue_cores[q]) != queue + 1) continue;
+
+			/* All of the queue's packets are for its session */
+			nb_pkts = cos_dev_port_rx_burst(0, NIC_RX_QUEUE_NUM + q, rx_packets, MAX_PKT_BURST);
+			for (i = 0, now = time_now(); i < nb_pkts; i += NIC_FLOW_BURST) {
+				n   = nb_pkts - i < NIC_FLOW_BURST ? nb_pkts - i : NIC_FLOW_BURST;
+				now = deliver_rx_packets(nic_zc_queue_sessions[q], &rx_packets[i], n, now);
+			}
+		}
 	}
 }
 
@@ -359,30 +384,44 @@ cos_nic_init(void)
 		assert(g_rx_mp[i]);
 	}
 
-	for(i = 0;i < NIC_TX_QUEUE_NUM; i++) {
+	/* One tx queue, and pool, per core if the NIC has enough queues */
+	nic_ntxq = cos_dev_port_max_tx_queues(0);
+	if (nic_ntxq > NIC_TX_QUEUE_NUM) nic_ntxq = NIC_TX_QUEUE_NUM;
+	for(i = 0;i < nic_ntxq; i++) {
 		tx_per_core_mpool_name[i][0] = 'p';
 		tx_per_core_mpool_name[i][1] = i;
-		g_tx_mp[i] = cos_create_pkt_mbuf_pool_by_ops(tx_per_core_mpool_name[i], max_tx_mbufs, COS_MEMPOOL_MT_RTS_OPS);
-		assert(g_tx_mp[i]);
+		nic_txqs[i].mp = cos_create_pkt_mbuf_pool_by_ops(tx_per_core_mpool_name[i], max_tx_mbufs, COS_MEMPOOL_MT_RTS_OPS);
+		assert(nic_txqs[i].mp);
 	}
+	nic_tx_init();
 
 
 	/* 4. config each port */
 	for (i = 0; i < nic_ports; i++) {
-		cos_config_dev_port_queue(i, NIC_RX_QUEUE_NUM, NIC_TX_QUEUE_NUM);
+		/* Jumbo buffers (see netshmem.h) need the NIC to receive jumbo frames */
+		if (PKT_BUF_SIZE > NETSHMEM_BUF_STD && cos_dev_port_mtu_set(i, NETSHMEM_MTU)) {
+			printc("nicmgr: port %d doesn't support an MTU of %d\n", i, NETSHMEM_MTU);
+		}
+		/* The zero-copy queues are set up as the sessions bind */
+		cos_config_dev_port_queue(i, NIC_RX_QUEUE_NUM + NIC_RX_ZC_QUEUE_NUM, nic_ntxq);
 		cos_dev_port_adjust_rx_tx_desc(i, &nb_rx_desc, &nb_tx_desc);
 		for (int j = 0; j < NIC_RX_QUEUE_NUM; j++) {
 			cos_dev_port_rx_queue_setup(i, j, nb_rx_desc, g_rx_mp[j]);
 		}
-		for (int j = 0; j < NIC_TX_QUEUE_NUM; j++) {
+		for (int j = 0; j < nic_ntxq; j++) {
 			cos_dev_port_tx_queue_setup(i, j, nb_tx_desc);
 		}
 	}
+	nic_tso = cos_dev_port_tso_supported(0);
 
 	/* 5. start each port, this will enable rx/tx */
 	for (i = 0; i < nic_ports; i++) {
 		cos_dev_port_start(i);
 		cos_dev_port_set_promiscuous_mode(i, COS_DPDK_SWITCH_ON);
+		/* Only the sessions steered to the zero-copy queues receive on them */
+		if (NIC_RX_ZC_QUEUE_NUM > 0 && cos_dev_port_rss_queues_set(i, NIC_RX_QUEUE_NUM)) {
+			printc("nicmgr: cannot restrict RSS to the first %d rx queues\n", NIC_RX_QUEUE_NUM);
+		}
 	}
 }
 
@@ -392,13 +431,11 @@ cos_init(void)
 {
 	printc("nicmgr init...\n");
 	cos_nic_init();
-	cos_hash_init();
+	nic_flow_init();
+	nic_arp_init();
 #ifdef USE_CK_RING_FREE_MBUF
 	pkt_ring_buf_init(&g_free_ring, FREE_PKT_RBUF_NUM, FREE_PKT_RING_SZ);
 #endif
-	for (int i = 0;i < NIC_TX_QUEUE_NUM;i++) {
-		sync_lock_init(&tx_lock[i]);
-	}
 
 	printc("dpdk init end\n");
 }
@@ -406,18 +443,17 @@ cos_init(void)
 int
 parallel_main(coreid_t cid)
 {
-	/* DPDK rx and tx will only run on core 0 */
-	if(cid == 0) {
-		cos_nic_start();
+	/*
+	 * Each of the first NIC_RX_QUEUE_NUM cores polls its own rx
+	 * queue, and delivers the packets to the sessions of the server
+	 * threads on the same core (that should have a higher priority
+	 * than the polling thread).
+	 */
+	if (cid < NIC_RX_QUEUE_NUM) {
+		cos_nic_start(cid);
 	} else {
 #if 0
-#if E810_NIC == 0
-		sync_lock_take(&tx_lock[0]);
-		cos_test_send(0, g_tx_mp[0]);
-		sync_lock_release(&tx_lock[0]);
-#else
-		cos_test_send(cid - 1, g_tx_mp[cid - 1]);
-#endif
+		cos_test_send(cid % nic_ntxq, nic_txqs[cid % nic_ntxq].mp);
 #endif
 	}
 
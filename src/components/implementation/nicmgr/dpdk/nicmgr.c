@@ -3,14 +3,16 @@
 #include <netshmem.h>
 #include <shm_bm.h>
 #include <string.h>
+#include <errno.h>
+#include <stdio.h>
 #include <sched.h>
 #include <nic.h>
 #include <cos_dpdk.h>
 #include <ck_ring.h>
 #include <rte_atomic.h>
 #include <sync_sem.h>
-#include <sync_lock.h>
 #include <arpa/inet.h>
+#include <cos_time.h>
 #include "nicmgr.h"
 
 extern volatile int debug_flag;
@@ -19,27 +21,30 @@ typedef unsigned long cos_paddr_t; /* physical address */
 typedef unsigned long cos_vaddr_t; /* virtual address */
 
 extern cos_paddr_t cos_map_virt_to_phys(cos_vaddr_t addr);
-extern char *g_tx_mp[NIC_TX_QUEUE_NUM];
 
 /* indexed by thread id */
 struct client_session client_sessions[NIC_MAX_SESSION];
 
+int nic_zc_queue_cores[NIC_RX_ZC_QUEUE_NUM + 1];
+struct client_session *nic_zc_queue_sessions[NIC_RX_ZC_QUEUE_NUM + 1];
+static int nic_zc_nqueues = 0;
+
 CK_RING_PROTOTYPE(pkt_ring_buf, pkt_buf);
 
-struct pkt_ring_buf g_tx_ring;
 struct pkt_ring_buf g_free_ring;
 
+struct nic_txq nic_txqs[NIC_TX_QUEUE_NUM];
+int nic_ntxq = 1;
+int nic_tso  = 0;
+
 rte_atomic64_t tx_enqueued_miss = {0};
 
-static char ring_buffers[NIC_MAX_SESSION][RX_PKT_RING_SZ];
+static char tx_stage_buffers[NIC_TX_QUEUE_NUM][TX_STAGE_RING_SZ];
+
 void
-pkt_ring_buf_init(struct pkt_ring_buf *pkt_ring_buf, size_t ringbuf_num, size_t ringbuf_sz)
+pkt_ring_buf_init_mem(struct pkt_ring_buf *pkt_ring_buf, void *mem, size_t ringbuf_num)
 {
-	struct ck_ring *buf_addr;
-
-	/* prevent multiple thread from contending memory */
-	assert(cos_thdid() < NIC_MAX_SESSION);
-	buf_addr = (struct ck_ring *)&ring_buffers[cos_thdid()];
+	struct ck_ring *buf_addr = mem;
 
 	ck_ring_init(buf_addr, ringbuf_num);
 
@@ -47,6 +52,15 @@ pkt_ring_buf_init(struct pkt_ring_buf *pkt_ring_buf, size_t ringbuf_num, size_t
 	pkt_ring_buf->ringbuf = (struct pkt_buf *)((char *)buf_addr + sizeof(struct ck_ring));
 }
 
+void
+pkt_ring_buf_init(struct pkt_ring_buf *pkt_ring_buf, size_t ringbuf_num, size_t ringbuf_sz)
+{
+	void *mem = (void *)memmgr_heap_page_allocn(round_up_to_page(ringbuf_sz) / PAGE_SIZE);
+
+	assert(mem);
+	pkt_ring_buf_init_mem(pkt_ring_buf, mem, ringbuf_num);
+}
+
 inline int
 pkt_ring_buf_enqueue(struct pkt_ring_buf *pkt_ring_buf, struct pkt_buf *buf)
 {
@@ -55,6 +69,15 @@ pkt_ring_buf_enqueue(struct pkt_ring_buf *pkt_ring_buf, struct pkt_buf *buf)
 	return CK_RING_ENQUEUE_SPSC(pkt_ring_buf, pkt_ring_buf->ring, pkt_ring_buf->ringbuf, buf);
 }
 
+/* For the sessions whose packets can be received on any of the rx queues */
+inline int
+pkt_ring_buf_enqueue_mp(struct pkt_ring_buf *pkt_ring_buf, struct pkt_buf *buf)
+{
+	assert(pkt_ring_buf->ring && pkt_ring_buf->ringbuf);
+
+	return CK_RING_ENQUEUE_MPSC(pkt_ring_buf, pkt_ring_buf->ring, pkt_ring_buf->ringbuf, buf);
+}
+
 inline int
 pkt_ring_buf_dequeue(struct pkt_ring_buf *pkt_ring_buf, struct pkt_buf *buf)
 {
@@ -71,15 +94,297 @@ pkt_ring_buf_empty(struct pkt_ring_buf *pkt_ring_buf)
 	return (!ck_ring_size(pkt_ring_buf->ring));
 }
 
+/*
+ * Return the mbufs to their rx queue's pool once the tenant freed
+ * their buffers, leaving us with the reference taken for the pool.
+ * Tenants usually free the packets in order, so we stop at the first
+ * one still in use: it only delays the reuse of the others.
+ */
+static void
+nic_zc_reclaim(struct client_session *session)
+{
+	char *mbuf;
+	int   len;
+
+	while (session->zc_lent_head != session->zc_lent_tail) {
+		mbuf = session->zc_lent[session->zc_lent_head % NIC_ZC_RX_BUFS];
+		if (shm_bm_refcnt_net_pkt_buf(session->shemem_info.shm,
+		                              shm_bm_get_objid_net_pkt_buf(cos_get_packet(mbuf, &len))) > 1) break;
+		cos_free_packet(mbuf);
+		session->zc_lent_head++;
+	}
+}
+
+/* With the direct rx, take the next packet of the session's own queue, if there is one */
+static int
+nic_zc_poll(struct client_session *session, struct pkt_buf *buf)
+{
+	if (session->zc_rx_head == session->zc_rx_n) {
+		session->zc_rx_n    = cos_dev_port_rx_burst(0, session->zc_queue, session->zc_rx, NIC_ZC_RX_BURST);
+		session->zc_rx_head = 0;
+		if (!session->zc_rx_n) return 0;
+	}
+	buf->pkt = session->zc_rx[session->zc_rx_head++];
+	if (NETSHMEM_TRACE_ENABLE) rdtscll(buf->ts);
+
+	return 1;
+}
+
+/* Take the next packet of the session's rx ring, if there is one */
+static inline int
+nic_rx_dequeue(struct client_session *session, struct pkt_buf *buf)
+{
+	struct nic_rx_desc d;
+
+	if (!nic_rx_ring_dequeue_n(session->rx_ring, &d, 1)) return 0;
+	buf->pkt = d.pkt;
+	buf->ts  = d.ts;
+
+	return 1;
+}
+
+/*
+ * Take the next packet of the session, blocking until there is one.
+ *
+ * With the hybrid wakeup, the ring is polled for a while, then the
+ * tenant announces it sleeps, and checks the ring again before
+ * blocking: a packet enqueued after that check sees the announcement,
+ * and its polling thread wakes the tenant up (see deliver_rx_packet).
+ *
+ * Otherwise each packet consumes a count of the semaphore, but the
+ * batches can dequeue packets before the count is given (see
+ * nic_rx_try_take), so a count doesn't always come with a packet.
+ */
+static void
+nic_rx_take(struct client_session *session, struct pkt_buf *buf)
+{
+	int i;
+
+	if (NIC_RX_ZC_DIRECT && session->zc_queue) {
+		for (i = 0; !nic_zc_poll(session, buf); i++) sync_blkpt_relax();
+		if (i > 0) session->rx_stats.spins++;
+		return;
+	}
+
+	if (!NIC_RX_HYBRID_WAKEUP) {
+		session->rx_stats.blocks++;
+		do {
+			sync_sem_take(&session->sem);
+		} while (!nic_rx_dequeue(session, buf));
+
+		assert(buf->pkt);
+		return;
+	}
+
+	while (1) {
+		for (i = 0; i < NIC_RX_SPIN_LOOPS; i++) {
+			if (nic_rx_dequeue(session, buf)) {
+				if (i > 0) session->rx_stats.spins++;
+				assert(buf->pkt);
+				return;
+			}
+			sync_blkpt_relax();
+		}
+
+		session->rx_sleeping = 1;
+		ps_mem_fence();
+		if (nic_rx_dequeue(session, buf)) {
+			/* A polling thread that saw us sleeping gave a count: consume it */
+			if (!ps_cas(&session->rx_sleeping, 1, 0)) sync_sem_take(&session->sem);
+			assert(buf->pkt);
+			return;
+		}
+		session->rx_stats.blocks++;
+		sync_sem_take(&session->sem);
+	}
+}
+
+/* Take the next packet of the session if there is one, without blocking */
+static int
+nic_rx_try_take(struct client_session *session, struct pkt_buf *buf)
+{
+	if (NIC_RX_ZC_DIRECT && session->zc_queue) return nic_zc_poll(session, buf);
+	if (!nic_rx_dequeue(session, buf)) return 0;
+	/* If its count isn't given yet, nic_rx_take will skip it */
+	if (!NIC_RX_HYBRID_WAKEUP) sync_sem_try_take(&session->sem);
+
+	assert(buf->pkt);
+
+	return 1;
+}
+
+#if NETSHMEM_TRACE_ENABLE
+#include <perfdata.h>
+
+/*
+ * The latencies of the stages of the traced requests, whose replies
+ * are sent on each core, and of the whole requests, sampled until the
+ * arrays are full. The stamps of a request are taken on different
+ * cores, thus assume a TSC synchronized across cores.
+ */
+#define NIC_TRACE_SAMPLES 2048
+#define NIC_TRACE_NPD     (NETSHMEM_TRACE_NSTAGES + 1)
+
+static const char *nic_trace_names[NIC_TRACE_NPD] = {
+	"rx ring and wakeup", "tenant to app", "app", "app to stack", "stack to nic", "total",
+};
+
+struct nic_trace {
+	int             init;
+	struct perfdata pd[NIC_TRACE_NPD];
+	cycles_t        values[NIC_TRACE_NPD][NIC_TRACE_SAMPLES];
+} CACHE_ALIGNED;
+
+static struct nic_trace nic_traces[NUM_CPU];
+
+static void
+nic_trace_reset(struct nic_trace *nt)
+{
+	int i;
+
+	for (i = 0; i < NIC_TRACE_NPD; i++) {
+		perfdata_init(&nt->pd[i], nic_trace_names[i], nt->values[i], NIC_TRACE_SAMPLES);
+	}
+	nt->init = 1;
+}
+
+/* Start the trace of a packet given to the tenant */
+static void
+nic_trace_start(struct netshmem_pkt_buf *obj, struct pkt_buf *buf)
+{
+	struct netshmem_trace *t = netshmem_get_trace(obj);
+
+	memset(t, 0, sizeof(*t));
+	t->ts[NETSHMEM_TRACE_RX] = buf->ts;
+	netshmem_trace_stamp(obj, NETSHMEM_TRACE_DELIVER);
+}
+
+/* Record the trace of a reply sent, if it has all of the stamps of a request */
+static void
+nic_trace_record(struct netshmem_pkt_buf *obj)
+{
+	struct netshmem_trace *t  = netshmem_get_trace(obj);
+	struct nic_trace      *nt = &nic_traces[cos_cpuid()];
+	u64_t now;
+	int   i;
+
+	for (i = 0; i < NETSHMEM_TRACE_NSTAGES; i++) {
+		if (!t->ts[i]) return;
+	}
+	if (unlikely(!nt->init)) nic_trace_reset(nt);
+
+	rdtscll(now);
+	for (i = 1; i < NETSHMEM_TRACE_NSTAGES; i++) perfdata_add(&nt->pd[i - 1], t->ts[i] - t->ts[i - 1]);
+	perfdata_add(&nt->pd[NETSHMEM_TRACE_NSTAGES - 1], now - t->ts[NETSHMEM_TRACE_WRITE]);
+	perfdata_add(&nt->pd[NETSHMEM_TRACE_NSTAGES], now - t->ts[NETSHMEM_TRACE_RX]);
+	/* The buffer can be reused by the tenant, without the stamps of the next request */
+	t->ts[NETSHMEM_TRACE_RX] = 0;
+}
+
+void
+nic_trace_report(void)
+{
+	int c, i;
+
+	for (c = 0; c < NUM_CPU; c++) {
+		if (!nic_traces[c].init) continue;
+		printc("trace of core %d (cycles):\n", c);
+		for (i = 0; i < NIC_TRACE_NPD; i++) {
+			perfdata_calc(&nic_traces[c].pd[i]);
+			perfdata_print(&nic_traces[c].pd[i]);
+		}
+		nic_trace_reset(&nic_traces[c]);
+	}
+}
+#else
+static inline void nic_trace_start(struct netshmem_pkt_buf *obj, struct pkt_buf *buf) { }
+static inline void nic_trace_record(struct netshmem_pkt_buf *obj) { }
+void nic_trace_report(void) { }
+#endif
+
+/* Return the mbuf of a packet copied, or merged, into the tenant's memory */
+static inline void
+nic_rx_release(struct pkt_buf *buf)
+{
+#if USE_CK_RING_FREE_MBUF
+	while (!pkt_ring_buf_enqueue(&g_free_ring, buf));
+#else
+	cos_free_packet(buf->pkt);
+#endif
+}
+
+COS_STATIC_ASSERT(COS_PKT_META_RSS == NETSHMEM_META_RSS && COS_PKT_META_L4_CSUM == NETSHMEM_META_L4_CSUM &&
+                  COS_PTYPE_FRAG == NETSHMEM_PTYPE_FRAG, "the packet metadata flags must be the same");
+
+/* Write the metadata of the packet in the tailroom of the buffer */
+static inline void
+nic_rx_meta(struct netshmem_pkt_buf *obj, const struct cos_pkt_meta *meta)
+{
+	struct netshmem_meta *m = netshmem_get_meta(obj);
+
+	if (!NIC_RX_META) return;
+	*m = (struct netshmem_meta) {
+		.rx_ts    = meta->rx_ts,
+		.rss_hash = meta->rss_hash,
+		.ptype    = meta->ptype,
+		.flags    = meta->flags,
+	};
+}
+
+/*
+ * Hand the received packet over to the tenant, in its shared memory.
+ * Returns 0, or -ENOMEM if the tenant has no free buffer for it (or
+ * it doesn't fit in one), and the packet is dropped.
+ */
+static int
+nic_rx_deliver(struct client_session *session, struct pkt_buf *buf, shm_bm_objid_t *objid, u16_t *pkt_len)
+{
+	struct netshmem_pkt_buf   *obj;
+	struct cos_pkt_meta        meta;
+	int len;
+
+	char *pkt = cos_get_packet_meta(buf->pkt, &len, &meta);
+
+	if (session->zc_queue) {
+		/* The packet is already in the tenant's buffer: lend it a reference */
+		*objid = shm_bm_get_objid_net_pkt_buf(pkt);
+		obj    = shm_bm_take_net_pkt_buf(session->shemem_info.shm, *objid);
+		assert(obj);
+		session->zc_lent[session->zc_lent_tail++ % NIC_ZC_RX_BUFS] = buf->pkt;
+		nic_rx_meta(obj, &meta);
+		nic_trace_start(obj, buf);
+		*pkt_len = len;
+
+		return 0;
+	}
+
+	/* Scattered (jumbo) packets span mbufs */
+	len = cos_packet_len(buf->pkt);
+	obj = len <= PKT_BUF_SIZE - NETSHMEM_TAILROOM ? shm_bm_alloc_net_pkt_buf(session->shemem_info.shm, objid) : NULL;
+	if (unlikely(!obj)) {
+		nic_rx_release(buf);
+		session->rx_stats.dropped++;
+
+		return -ENOMEM;
+	}
+
+	cos_read_packet(buf->pkt, obj->data, len);
+	nic_rx_release(buf);
+	nic_rx_meta(obj, &meta);
+	nic_trace_start(obj, buf);
+
+	*pkt_len = len;
+
+	return 0;
+}
+
 shm_bm_objid_t
 nic_get_a_packet(u16_t *pkt_len)
 {
 	thdid_t                    thd;	
 	struct pkt_buf             buf;
-	shm_bm_objid_t             objid;
 	struct client_session     *session;
-	struct netshmem_pkt_buf   *obj;
-	int len;
+	shm_bm_objid_t             objid;
 
 	thd = cos_thdid();
 	assert(thd < NIC_MAX_SESSION);
@@ -89,33 +394,83 @@ nic_get_a_packet(u16_t *pkt_len)
 	// if (unlikely(debug_flag)) {
 	// 	printc("tenant %u(%u) is to dequeue\n", ntohs(session->port), thd);
 	// }
-	session->blocked_loops_begin++;
-	
-	sync_sem_take(&session->sem);
-	session->blocked_loops_end++;
+	if (session->zc_queue) nic_zc_reclaim(session);
 
-	assert(!pkt_ring_buf_empty(&session->pkt_ring_buf));
+	/* The packets dropped for a lack of buffers are skipped */
+	do {
+		nic_rx_take(session, &buf);
+	} while (nic_rx_deliver(session, &buf, &objid, pkt_len));
 
-	while (!pkt_ring_buf_dequeue(&session->pkt_ring_buf, &buf))
-	assert(buf.pkt);
+	return objid;
+}
 
-	char *pkt = cos_get_packet(buf.pkt, &len);
-	assert(len < PKT_BUF_SIZE);
+/*
+ * Append the packet to the previous one given to the tenant, in `d`,
+ * if they are consecutive TCP segments. The tailroom of the object is
+ * left for sending it.
+ */
+static int
+nic_rx_coalesce(struct client_session *session, struct nic_pkt_desc *d, struct pkt_buf *buf)
+{
+	struct netshmem_pkt_buf *obj;
+	char *pkt;
+	int   len;
+
+	obj = shm_bm_borrow_net_pkt_buf(session->shemem_info.shm, d->objid);
+	pkt = cos_get_packet(buf->pkt, &len);
+	/* Only the first segment of a scattered packet would be appended */
+	if (len != cos_packet_len(buf->pkt)) return 0;
+	if (!nic_gro_merge(obj->data + d->pkt_offset, &d->pkt_len, PKT_BUF_SIZE - NETSHMEM_TAILROOM - d->pkt_offset,
+	                   pkt, len)) {
+		return 0;
+	}
+	nic_rx_release(buf);
 
-	obj = shm_bm_alloc_net_pkt_buf(session->shemem_info.shm, &objid);
-	assert(obj);
+	return 1;
+}
 
-	memcpy(obj->data, pkt, len);
+static struct nic_pkt_desc *
+nic_descs_get(struct client_session *session, shm_bm_objid_t descs, int n)
+{
+	if (n <= 0 || n > NIC_BATCH_MAX) return NULL;
 
-#if USE_CK_RING_FREE_MBUF
-	while (!pkt_ring_buf_enqueue(&g_free_ring, &buf));
-#else
-	cos_free_packet(buf.pkt);
-#endif
+	return shm_bm_borrow_net_pkt_buf(session->shemem_info.shm, descs);
+}
 
-	*pkt_len = len;
+int
+nic_get_packets(shm_bm_objid_t descs, int n)
+{
+	struct pkt_buf         buf;
+	struct client_session *session;
+	struct nic_pkt_desc   *d;
+	struct nic_pkt_desc    last;
+	shm_bm_objid_t         objid;
+	u16_t                  len;
+	int                    i = 0;
 
-	return objid;
+	assert(cos_thdid() < NIC_MAX_SESSION);
+	session = &client_sessions[cos_thdid()];
+	d = nic_descs_get(session, descs, n);
+	if (!d) return -EINVAL;
+
+	if (session->zc_queue) nic_zc_reclaim(session);
+
+	/* Block for the first packet only, unless all of those taken are dropped */
+	while (i == 0) {
+		nic_rx_take(session, &buf);
+		do {
+			/* The zero-copy packets are in the NIC's buffers, so they can't be coalesced */
+			if (NIC_ENABLE_GRO && i > 0 && !session->zc_queue && nic_rx_coalesce(session, &last, &buf)) {
+				d[i - 1] = last;
+				continue;
+			}
+			if (nic_rx_deliver(session, &buf, &objid, &len)) continue;
+			last  = (struct nic_pkt_desc) { .objid = objid, .pkt_offset = 0, .pkt_len = len };
+			d[i++] = last;
+		} while (i < n && nic_rx_try_take(session, &buf));
+	}
+
+	return i;
 }
 
 static void
@@ -130,71 +485,362 @@ ext_buf_free_callback_fn(void *addr, void *opaque)
 	}
 }
 
-extern struct sync_lock tx_lock[NUM_CPU];
+/* The tx queue of the core; cores share the queues if the NIC has fewer than them */
+static inline int
+nic_tx_queue(void)
+{
+	return cos_cpuid() % nic_ntxq;
+}
+
+void
+nic_tx_init(void)
+{
+	int i;
+
+	for (i = 0; i < nic_ntxq; i++) {
+		pkt_ring_buf_init_mem(&nic_txqs[i].stage, &tx_stage_buffers[i], TX_STAGE_RBUF_NUM);
+	}
+	nic_tx_qos_init();
+}
 
 int
-nic_send_packet(shm_bm_objid_t pktid, u16_t pkt_offset, u16_t pkt_len)
+nic_tx_burst_try(int queue, char **mbufs, int n)
+{
+	if (NIC_TX_LOOPBACK) {
+		nic_loopback_rx(mbufs, n);
+		return n;
+	}
+
+	return cos_dev_port_tx_burst(0, queue, mbufs, n);
+}
+
+/* Send the mbufs, as the owner of the queue, and drop those it has no room for */
+static void
+nic_tx_burst(int queue, char **mbufs, int n)
+{
+	int i, sent;
+
+	sent = nic_tx_burst_try(queue, mbufs, n);
+	if (likely(sent == n)) return;
+
+	/* This frees their buffers too */
+	for (i = sent; i < n; i++) cos_free_packet(mbufs[i]);
+	rte_atomic64_add(&tx_enqueued_miss, n - sent);
+}
+
+/* Send the staged mbufs in bursts, then those of the sessions, as the owner of the queue */
+static void
+nic_tx_stage_drain(int queue, struct nic_txq *txq)
+{
+	char          *tx_packets[NIC_BATCH_MAX];
+	struct pkt_buf buf;
+	int            n;
+
+	do {
+		for (n = 0; n < NIC_BATCH_MAX && pkt_ring_buf_dequeue(&txq->stage, &buf); n++) tx_packets[n] = buf.pkt;
+		if (n > 0) nic_tx_burst(queue, tx_packets, n);
+	} while (n == NIC_BATCH_MAX);
+	if (NIC_TX_QOS) nic_tx_qos_drain(queue);
+}
+
+/* If there are mbufs to send, that the owner of the queue could have missed */
+static inline int
+nic_tx_ready(int queue, struct nic_txq *txq)
+{
+	return !pkt_ring_buf_empty(&txq->stage) || (NIC_TX_QOS && nic_tx_qos_pending(queue));
+}
+
+/*
+ * Stop sending on the queue. The mbufs staged after our last drain
+ * would wait for the next owner, so we take the queue back for them.
+ */
+static void
+nic_tx_release(int queue, struct nic_txq *txq)
+{
+	while (1) {
+		ps_cas(&txq->owner, 1, 0);
+		if (!nic_tx_ready(queue, txq) || !ps_cas(&txq->owner, 0, 1)) return;
+		nic_tx_stage_drain(queue, txq);
+	}
+}
+
+/*
+ * Send the mbufs on the queue if we can own it, and stage them for
+ * its owner otherwise. This never waits for another thread.
+ */
+static void
+nic_tx(int queue, char **mbufs, int n)
+{
+	struct nic_txq *txq = &nic_txqs[queue];
+	struct pkt_buf  buf = { 0 };
+	int             i;
+
+	if (likely(ps_cas(&txq->owner, 0, 1))) {
+		/* The staged mbufs were sent before ours */
+		nic_tx_stage_drain(queue, txq);
+		nic_tx_burst(queue, mbufs, n);
+		nic_tx_release(queue, txq);
+
+		return;
+	}
+
+	for (i = 0; i < n; i++) {
+		buf.pkt = mbufs[i];
+		if (likely(pkt_ring_buf_enqueue_mp(&txq->stage, &buf))) continue;
+		cos_free_packet(mbufs[i]);
+		rte_atomic64_add(&tx_enqueued_miss, 1);
+	}
+	/* The owner could have released the queue before the mbufs were staged */
+	nic_tx_flush(queue);
+}
+
+/*
+ * With the QoS, the sessions' packets can be waiting for tokens, or
+ * for room in the NIC, thus the queue is always drained.
+ */
+void
+nic_tx_flush(int queue)
+{
+	struct nic_txq *txq = &nic_txqs[queue];
+
+	if ((!NIC_TX_QOS && !nic_tx_ready(queue, txq)) || !ps_cas(&txq->owner, 0, 1)) return;
+	nic_tx_stage_drain(queue, txq);
+	nic_tx_release(queue, txq);
+}
+
+char *
+nic_tx_alloc(void)
+{
+	return cos_allocate_mbuf(nic_txqs[nic_tx_queue()].mp);
+}
+
+void
+nic_tx_one(char *mbuf)
+{
+	nic_tx(nic_tx_queue(), &mbuf, 1);
+}
+
+/* Send the mbufs of a session, through its tx ring, with the QoS */
+static void
+nic_tx_session(struct client_session *session, int queue, char **mbufs, int n)
+{
+	if (!NIC_TX_QOS) {
+		nic_tx(queue, mbufs, n);
+		return;
+	}
+	nic_tx_qos_enqueue(session, queue, mbufs, n);
+	nic_tx_flush(queue);
+}
+
+/*
+ * An mbuf with the tenant's packet attached, without copying it. The
+ * checksum offloads are only set up for the mbufs with the headers.
+ */
+static char *
+nic_tx_mbuf(struct client_session *session, int queue, shm_bm_objid_t objid, u16_t pkt_offset, u16_t pkt_len,
+            int offload)
 {
-	thdid_t                  thd;
-	shm_bm_objid_t           objid;
 	struct pkt_buf           buf;
 	struct netshmem_pkt_buf *obj;
+	char *mbuf;
+	void *ext_shinfo;
 
-	thd   = cos_thdid();
-	objid = pktid;
-
-	obj = (struct netshmem_pkt_buf *)shm_bm_borrow_net_pkt_buf(client_sessions[thd].shemem_info.shm, objid);
+	obj = (struct netshmem_pkt_buf *)shm_bm_borrow_net_pkt_buf(session->shemem_info.shm, objid);
+	if (!obj) return NULL;
 
 	buf.obj = (char *)obj;
 	buf.pkt = pkt_offset + obj->data;
+	if (offload) nic_trace_record(obj);
 
-	u64_t data_paddr = client_sessions[thd].shemem_info.paddr 
-		+ (u64_t)buf.obj - (u64_t)client_sessions[thd].shemem_info.shm;
+	u64_t data_paddr = session->shemem_info.paddr 
+		+ (u64_t)buf.obj - (u64_t)session->shemem_info.shm;
 	
 	buf.paddr   = data_paddr;
 	buf.pkt_len = pkt_len;
-#if 0
-	if (!pkt_ring_buf_enqueue(&client_sessions[thd].pkt_tx_ring, &buf)) {
-		/* tx queue is full, drop the packet */
-		rte_atomic64_add(&tx_enqueued_miss, 1);
-		shm_bm_free_net_pkt_buf(obj);
-	}
-#else 
-	char *mbuf;
-	void *ext_shinfo;
-	char *tx_packets[256];
 
-	coreid_t core_id = cos_cpuid();
-#if E810_NIC == 0
-	core_id = 1;
-#endif
-	mbuf = cos_allocate_mbuf(g_tx_mp[core_id - 1]);
+	mbuf = cos_allocate_mbuf(nic_txqs[queue].mp);
 	assert(mbuf);
 	ext_shinfo = netshmem_get_tailroom((struct netshmem_pkt_buf *)buf.obj);
 	cos_attach_external_mbuf(mbuf, buf.obj, buf.paddr, PKT_BUF_SIZE, ext_buf_free_callback_fn, ext_shinfo);
-	cos_set_external_packet(mbuf, (buf.pkt - buf.obj), buf.pkt_len, 1);
-	tx_packets[0] = mbuf;
+	cos_set_external_packet(mbuf, (buf.pkt - buf.obj), buf.pkt_len, offload);
 
-	sync_lock_take(&tx_lock[core_id - 1]);
-	cos_dev_port_tx_burst(0, core_id - 1, tx_packets, 1);
-	sync_lock_release(&tx_lock[core_id - 1]);
-#endif
+	return mbuf;
+}
+
+int
+nic_send_packet(shm_bm_objid_t pktid, u16_t pkt_offset, u16_t pkt_len)
+{
+	thdid_t  thd;
+	int      queue;
+	char    *mbuf;
+	cycles_t start = time_now(), now;
+
+	thd   = cos_thdid();
+	queue = nic_tx_queue();
+
+	mbuf = nic_tx_mbuf(&client_sessions[thd], queue, pktid, pkt_offset, pkt_len, 1);
+	assert(mbuf);
+	nic_tx_session(&client_sessions[thd], queue, &mbuf, 1);
+	now = time_now();
+	nic_cpu_charge(&client_sessions[thd], now, now - start, 1);
 
 	return 0;
 }
 
+/* The packets sent with TSO are at most 64KB, thus of at most this many 2KB buffers */
+#define NIC_TX_SEGS_MAX 33
+
+int
+nic_send_packets(shm_bm_objid_t descs, int n)
+{
+	struct client_session *session;
+	struct nic_pkt_desc   *d;
+	char                  *tx_packets[NIC_BATCH_MAX];
+	char                  *head = NULL;
+	struct nic_pkt_desc    head_desc = { 0 };
+	int                    queue, nsegs = 0, drop = 0;
+	int                    i, nb_pkts = 0, nb_descs = 0;
+	cycles_t               start = time_now(), now;
+
+	assert(cos_thdid() < NIC_MAX_SESSION);
+	session = &client_sessions[cos_thdid()];
+	d = nic_descs_get(session, descs, n);
+	if (!d) return -EINVAL;
+	queue = nic_tx_queue();
+
+	for (i = 0; i < n; i++) {
+		struct nic_pkt_desc desc = d[i]; /* the descriptors are shared with the tenant */
+		char *mbuf;
+
+		if (nsegs == 0) {
+			if (unlikely((desc.flags & (NIC_PKT_MORE | NIC_PKT_TSO)) && !nic_tso)) break;
+			head_desc = desc;
+		}
+		nsegs++;
+
+		/* A packet with a bad descriptor is dropped, freeing the buffers of all of its mbufs */
+		mbuf = nic_tx_mbuf(session, queue, desc.objid, desc.pkt_offset, desc.pkt_len, nsegs == 1);
+		if (unlikely(!mbuf || drop)) {
+			if (mbuf) cos_free_packet(mbuf);
+			if (head) cos_free_packet(head);
+			head = NULL;
+			drop = 1;
+		} else if (!head) {
+			head = mbuf;
+		} else if (unlikely(nsegs > NIC_TX_SEGS_MAX || cos_mbuf_chain(head, mbuf))) {
+			cos_free_packet(mbuf);
+			cos_free_packet(head);
+			head = NULL;
+			drop = 1;
+		}
+
+		if ((desc.flags & NIC_PKT_MORE) && i + 1 < n) continue;
+		/* The last descriptor of the packet */
+		if (likely(head)) {
+			if (head_desc.flags & NIC_PKT_TSO) cos_set_packet_tso(head, head_desc.tso_mss);
+			tx_packets[nb_pkts++] = head;
+			nb_descs += nsegs;
+		}
+		head  = NULL;
+		drop  = 0;
+		nsegs = 0;
+	}
+
+	/* One burst, thus one doorbell, for the whole batch */
+	if (nb_pkts > 0) nic_tx_session(session, queue, tx_packets, nb_pkts);
+	now = time_now();
+	nic_cpu_charge(session, now, now - start, 1);
+	if (unlikely(i < n && nb_descs == 0)) return -ENOTSUP;
+
+	return nb_descs;
+}
+
+int
+nic_tx_flags(void)
+{
+	return nic_tso ? NIC_PKT_MORE | NIC_PKT_TSO : 0;
+}
+
 void
 nic_shmem_map(cbuf_t shm_id)
 {
 	netshmem_map_shmem(shm_id);
 }
 
-int
-nic_bind_port(u32_t ip_addr, u16_t port)
+static void *
+nic_zc_buf_get(void *arg, size_t i, uint64_t *paddr)
 {
-	unsigned long npages;
-	void         *mem;
+	struct client_session   *session = arg;
+	struct netshmem_pkt_buf *obj;
 
+	obj    = shm_bm_borrow_net_pkt_buf(session->shemem_info.shm, session->zc_objs[i]);
+	*paddr = session->shemem_info.paddr + (u64_t)obj - (u64_t)session->shemem_info.shm;
+
+	/* The tailroom is left for the shinfo of tx (see nic_send_packet) */
+	return obj->data;
+}
+
+/*
+ * Receive the session's packets on its own rx queue, straight into
+ * buffers of its shared memory, that are then lent to the tenant
+ * rather than copied. Returns 0 on success, or -1 if the packets of
+ * the session are to be copied.
+ */
+static int
+nic_zc_init(struct client_session *session)
+{
+	char           name[32];
+	struct netshmem_pkt_buf *obj;
+	struct cos_flow_tuple key, mask;
+	int            i, q;
+
+	if (NIC_RX_ZC_QUEUE_NUM == 0) return -1;
+
+	/* The pool holds a reference to each buffer, so the tenant never reallocates them */
+	for (i = 0; i < NIC_ZC_RX_BUFS; i++) {
+		obj = shm_bm_alloc_net_pkt_buf(session->shemem_info.shm, &session->zc_objs[i]);
+		if (!obj) goto free;
+	}
+
+	/* Queues are never released, so sessions that bind later copy */
+	q = __sync_fetch_and_add(&nic_zc_nqueues, 1);
+	if (q >= NIC_RX_ZC_QUEUE_NUM) goto free;
+
+	snprintf(name, sizeof(name), "zc_pool_%d", q);
+	session->zc_mp = cos_create_pkt_mbuf_pool_extbufs(name, NIC_ZC_RX_BUFS, PKT_BUF_SIZE - NETSHMEM_TAILROOM,
+	                                                  nic_zc_buf_get, session);
+	if (!session->zc_mp) goto free;
+	if (cos_dev_port_rx_queue_add(0, NIC_RX_QUEUE_NUM + q, NIC_ZC_RX_DESC, session->zc_mp)) goto free;
+	/* The queue could still receive into the buffers (they are taken from the tenant) */
+	nic_flow_port(session->port, &key, &mask);
+	if (cos_dev_port_flow_steer(0, &key, &mask, NIC_RX_QUEUE_NUM + q)) return -1;
+
+	session->zc_queue     = NIC_RX_QUEUE_NUM + q;
+	session->zc_lent_head = session->zc_lent_tail = 0;
+	session->zc_rx_head   = session->zc_rx_n = 0;
+	/*
+	 * Polled by the session's thread with the direct rx, or by the
+	 * thread of the session's core, which delivers all of the
+	 * queue's packets to it, without looking up their flows
+	 */
+	nic_zc_queue_sessions[q] = session;
+	if (NIC_RX_ZC_DIRECT) return 0;
+	ps_mem_fence();
+	nic_zc_queue_cores[q] = session->core % NIC_RX_QUEUE_NUM + 1;
+
+	return 0;
+free:
+	while (i-- > 0) {
+		shm_bm_free_net_pkt_buf(shm_bm_borrow_net_pkt_buf(session->shemem_info.shm, session->zc_objs[i]));
+	}
+
+	return -1;
+}
+
+/* Set up the session of the calling thread, with its shmem region mapped by nic_shmem_map */
+static struct client_session *
+nic_session_init(u32_t ip_addr, u16_t port)
+{
 	shm_bm_t    shm;
 	cbuf_t      shmid;
 	cos_paddr_t paddr = 0;
@@ -206,6 +852,7 @@ nic_bind_port(u32_t ip_addr, u16_t port)
 	client_sessions[thd].ip_addr = ip_addr;
 	client_sessions[thd].port    = port;
 	client_sessions[thd].thd     = thd;
+	client_sessions[thd].core    = cos_coreid();
 
 	shm   = netshmem_get_shm();
 	assert(shm);
@@ -216,17 +863,69 @@ nic_bind_port(u32_t ip_addr, u16_t port)
 	client_sessions[thd].shemem_info.shmid = shmid;
 	client_sessions[thd].shemem_info.shm   = shm;
 	client_sessions[thd].shemem_info.paddr = paddr;
-	cos_hash_add(client_sessions[thd].port, &client_sessions[thd]);
 
 	sync_sem_init(&client_sessions[thd].sem, 0);
 
-	pkt_ring_buf_init(&client_sessions[thd].pkt_ring_buf, RX_PKT_RBUF_NUM, RX_PKT_RING_SZ);
-	// pkt_ring_buf_init(&client_sessions[thd].pkt_tx_ring, TX_PKT_RBUF_NUM, TX_PKT_RING_SZ);
-
-	client_sessions[thd].blocked_loops_begin = 0;
-	client_sessions[thd].blocked_loops_end = 0;
+	/* Only the sessions in use take the memory of a ring */
+	if (!client_sessions[thd].rx_ring) client_sessions[thd].rx_ring = nic_rx_ring_alloc();
+	else                               nic_rx_ring_init(client_sessions[thd].rx_ring);
+	assert(client_sessions[thd].rx_ring);
+
+	client_sessions[thd].rx_sleeping = 0;
+	client_sessions[thd].rx_stats    = (struct nic_rx_stats) { 0 };
+	nic_cpu_acct_init(&client_sessions[thd]);
+	client_sessions[thd].comp        = (compid_t)cos_inv_token();
+	/* Its tx ring could have packets queued, if the thread binds again */
+	if (!client_sessions[thd].tx_init_done) nic_tx_qos_session_init(&client_sessions[thd]);
 	client_sessions[thd].tx_init_done = 1;
 
+	return &client_sessions[thd];
+}
+
+int
+nic_bind_port(u32_t ip_addr, u16_t port)
+{
+	struct client_session *session;
+	struct cos_flow_tuple  key, mask;
+	int                    ret;
+
+	session = nic_session_init(ip_addr, port);
+	nic_arp_local_add(ip_addr);
+
+	/*
+	 * Receive the session's packets on the rx queue polled on this
+	 * core, so the polling thread doesn't wake us across cores. If
+	 * the NIC can't steer them, RSS spreads them across the queues.
+	 * The sessions with their own zero-copy queue receive all of
+	 * its packets, thus aren't in the flow table.
+	 */
+	session->zc_queue = 0;
+	if (!NIC_TX_LOOPBACK && nic_zc_init(session) == 0) {
+		session->steered = 1;
+		return 0;
+	}
+
+	/*
+	 * The polling threads can find the session from now on. Only
+	 * the first session of a port is steered to its core: the
+	 * others receive the packets of their flows from its queue.
+	 * Port 0 binds all of the TCP and UDP packets of the address.
+	 */
+	if (port) nic_flow_port(port, &key, &mask);
+	else      nic_flow_ip(ip_addr, &key, &mask);
+	ret = nic_flow_add(&key, &mask, session, NIC_RX_QUEUE_NUM == 1 ? -1 : cos_coreid() % NIC_RX_QUEUE_NUM);
+	if (ret < 0) return ret;
+	/* The looped back packets are received on the cores of their senders */
+	session->steered = !NIC_TX_LOOPBACK && (NIC_RX_QUEUE_NUM == 1 || ret == 1);
+
+	return 0;
+}
+
+int
+nic_bind_tx(void)
+{
+	nic_session_init(0, 0);
+
 	return 0;
 }
 
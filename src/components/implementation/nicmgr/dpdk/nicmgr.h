@@ -6,6 +6,8 @@
 #include <shm_bm.h>
 #include <ck_ring.h>
 #include <sync_sem.h>
+#include <cos_dpdk.h>
+#include <nic.h>
 
 #define NIC_MAX_SESSION 512
 #define NIC_MAX_SHEMEM_REGION 3
@@ -16,6 +18,95 @@
 /* Client can use this port to send debug commands */
 #define NIC_DEBUG_PORT 36000
 
+/*
+ * The zero-copy rx queue of a session has NIC_ZC_RX_DESC descriptors,
+ * and NIC_ZC_RX_BUFS buffers in the session's shared memory (out of
+ * its PKT_BUF_NUM), to also cover the packets lent to the tenant.
+ */
+#define NIC_ZC_RX_DESC 64
+#define NIC_ZC_RX_BUFS 128
+
+/*
+ * With the direct zero-copy rx, the threads of the sessions with a
+ * zero-copy queue poll it themselves, in their nic_get_a_packet and
+ * nic_get_packets, instead of the polling thread of their core
+ * enqueueing its packets on their ring, and waking them up: the nicmgr
+ * only configures the queue, and steers the flows to it. They busy-poll
+ * the queue (there is no interrupt to block on), NIC_ZC_RX_BURST
+ * packets at a time.
+ */
+#define NIC_RX_ZC_DIRECT 1
+#define NIC_ZC_RX_BURST  32
+
+/*
+ * With the hybrid rx wakeup, the polling threads only wake a tenant
+ * blocked on its empty ring, instead of giving its semaphore for each
+ * packet: the tenant drains its ring, and polls it for
+ * NIC_RX_SPIN_LOOPS iterations before blocking again.
+ */
+#define NIC_RX_HYBRID_WAKEUP 1
+#define NIC_RX_SPIN_LOOPS    256
+
+/* The receive statistics of a session */
+struct nic_rx_stats {
+	unsigned long blocks;   /* the times the tenant blocked on its empty ring */
+	unsigned long spins;    /* the packets it found while polling its ring */
+	unsigned long dropped;  /* the packets dropped as it had no free buffer for them */
+	unsigned long wakeups;  /* the times a polling thread woke it up */
+};
+
+/*
+ * The processing time of each session (qos.c): the cycles the polling
+ * threads spend on the packets received for it, and those its sends
+ * take in the manager. A session with a budget that used it up in the
+ * current window of NIC_CPU_WINDOW usec has its received packets
+ * dropped until the next window, so a flooded tenant only takes its
+ * budget of the polling threads' time from the others. The default
+ * budget (usec per window) can be set by the composition script's
+ * constants, and the sessions' components lower it with
+ * nic_cpu_budget_set.
+ */
+#ifndef NIC_CPU_BUDGET
+#define NIC_CPU_BUDGET 0    /* usec per window, 0 if unlimited */
+#endif
+#ifndef NIC_CPU_WINDOW
+#define NIC_CPU_WINDOW 1000 /* usec */
+#endif
+
+struct nic_cpu_acct {
+	cycles_t      rx, tx;    /* the cycles charged to the session */
+	cycles_t      budget;    /* per window, 0 if unlimited */
+	cycles_t      win_start; /* when the current window started */
+	cycles_t      used;      /* the cycles charged in the current window */
+	unsigned long throttled; /* the packets dropped as it was over its budget */
+};
+
+/*
+ * The tx QoS: the packets of each session are queued on its own tx
+ * ring, and the thread sending on a tx queue (qos.c) picks the next
+ * ones of the sessions sending on it, by strict priority across the
+ * classes (0 first), and by deficit round-robin, weighted, across the
+ * sessions of a class. A session with a rate is shaped by a token
+ * bucket: its packets wait on its ring until it has the tokens. The
+ * defaults can be set by the composition script's constants, and the
+ * sessions' components change them with nic_tx_qos_set.
+ */
+#define NIC_TX_QOS 1
+#ifndef NIC_TX_CLASS
+#define NIC_TX_CLASS  (NIC_TX_CLASSES - 1)
+#endif
+#ifndef NIC_TX_WEIGHT
+#define NIC_TX_WEIGHT 1
+#endif
+#ifndef NIC_TX_RATE
+#define NIC_TX_RATE   0 /* Mbit/s, 0 if unlimited */
+#endif
+#ifndef NIC_TX_BURST
+#define NIC_TX_BURST  (64 * 1024) /* bytes */
+#endif
+/* The bytes a session of weight 1 sends per round */
+#define NIC_TX_QUANTUM 1514
+
 struct shemem_info {
 	cbuf_t   shmid;
 	shm_bm_t shm;
@@ -27,6 +118,7 @@ struct pkt_buf {
 	char   *pkt;
 	u64_t   paddr;
 	int     pkt_len;
+	u64_t   ts; /* with NETSHMEM_TRACE_ENABLE, when the packet was polled */
 };
 
 struct pkt_ring_buf {
@@ -34,56 +126,283 @@ struct pkt_ring_buf {
 	struct pkt_buf *ringbuf;
 };
 
+/*
+ * The rx ring of a session (rx_ring.c), of compact descriptors, that
+ * the polling threads enqueue bursts on, and the tenant dequeues
+ * batches from, each with a single update of their index. It is
+ * allocated when the session is first set up.
+ */
+#define NIC_RX_RING_SZ    4096 /* power of two */
+#define NIC_RX_RING_BATCH 32
+
+struct nic_rx_desc {
+	char  *pkt;
+	u64_t  ts; /* with NETSHMEM_TRACE_ENABLE, when the packet was polled */
+};
+
+struct nic_rx_ring {
+	struct {
+		unsigned long reserve;    /* the slots below are reserved by producers */
+		unsigned long tail;       /* the slots below are published */
+		unsigned long head_cache; /* the consumer's head, when last read */
+	} prod CACHE_ALIGNED;
+	struct {
+		unsigned long next;       /* the next slot to consume */
+		unsigned long head;       /* the slots below are free for the producers */
+		unsigned long tail_cache; /* the producers' tail, when last read */
+	} cons CACHE_ALIGNED;
+	struct nic_rx_desc descs[NIC_RX_RING_SZ];
+};
+
+struct nic_rx_ring *nic_rx_ring_alloc(void);
+void nic_rx_ring_init(struct nic_rx_ring *r);
+/* Enqueue up to `n` descriptors, by multiple producers if `mp`; returns the number enqueued */
+int nic_rx_ring_enqueue_n(struct nic_rx_ring *r, struct nic_rx_desc *d, int n, int mp);
+/* Dequeue up to `n` descriptors, by the single consumer; returns the number dequeued */
+int nic_rx_ring_dequeue_n(struct nic_rx_ring *r, struct nic_rx_desc *d, int n);
+
+/* The transmit statistics of a session */
+struct nic_tx_stats {
+	unsigned long sent;     /* the packets sent */
+	unsigned long dropped;  /* the packets dropped as its ring was full */
+	unsigned long shaped;   /* the packets that waited for tokens */
+};
+
+struct nic_tx_qos {
+	u16_t         class, weight;
+	u32_t         rate, burst;
+	u64_t         tokens;     /* bytes */
+	cycles_t      last;       /* when the tokens were last added */
+	long          deficit;    /* bytes */
+	unsigned long active;     /* if it is in the scheduler of its tx queue */
+	struct pkt_buf head;      /* the packet dequeued, and not sent yet */
+	int           head_shaped;
+
+	struct nic_tx_stats stats;
+};
+
 /* per thread session */
 struct client_session {
 	struct shemem_info shemem_info;
 
 	thdid_t thd;
+	/* the session's packets are received on this core's rx queue, if steered */
+	coreid_t core;
+	int steered;
+
+	/*
+	 * With zero-copy rx, the session's own rx queue (0 if none),
+	 * and the ring of the mbufs whose buffers are lent to the
+	 * tenant, in the order they were received.
+	 */
+	cos_queueid_t zc_queue;
+	char *zc_mp;
+	shm_bm_objid_t zc_objs[NIC_ZC_RX_BUFS];
+	char *zc_lent[NIC_ZC_RX_BUFS];
+	unsigned int zc_lent_head, zc_lent_tail;
+	/* With the direct rx, the packets polled from the queue, not yet taken */
+	char *zc_rx[NIC_ZC_RX_BURST];
+	int zc_rx_head, zc_rx_n;
 
 	u32_t ip_addr; 
 	u16_t port;
 	int thd_state;
 
-	struct pkt_ring_buf pkt_ring_buf;
+	struct nic_rx_ring *rx_ring;
 	struct pkt_ring_buf pkt_tx_ring;
 
 	int tx_init_done;
 	struct sync_sem sem;
+	/* With the hybrid wakeup, if the tenant is (about to be) blocked on sem */
+	unsigned long rx_sleeping;
+
+	struct nic_rx_stats rx_stats;
+	struct nic_cpu_acct cpu;
 
-	/* number of blocked loops of the tenant, this is counted each time when the thread is blocked */
-	int blocked_loops_begin;
-	/* number of bloocked loops exit of the tenant, this is counted each time when the thread exits its blocked state */
-	int blocked_loops_end;
+	/* the component of the session's thread, that configures its QoS */
+	compid_t comp;
+	struct nic_tx_qos tx_qos;
 };
 
-extern struct pkt_ring_buf g_tx_ring;
 extern struct pkt_ring_buf g_free_ring;
 
 extern struct client_session client_sessions[NIC_MAX_SESSION];
 
-#define RX_PKT_RBUF_NUM 4096
-#define RX_PKT_RBUF_SZ (RX_PKT_RBUF_NUM * sizeof(struct pkt_buf))
-#define RX_PKT_RING_SZ   (sizeof(struct ck_ring) + RX_PKT_RBUF_SZ)
-#define RX_PKT_RING_PAGES (round_up_to_page(RX_PKT_RING_SZ)/PAGE_SIZE)
+/* The core (+1) polling each of the zero-copy rx queues, 0 if unused (or polled by its session) */
+extern int nic_zc_queue_cores[NIC_RX_ZC_QUEUE_NUM + 1];
+/* The session receiving all of the packets of each zero-copy rx queue */
+extern struct client_session *nic_zc_queue_sessions[NIC_RX_ZC_QUEUE_NUM + 1];
 
-#define TX_PKT_RBUF_NUM 4096
+/* The sessions' tx rings, for the QoS: enough for a few batches each */
+#define TX_PKT_RBUF_NUM 256
 #define TX_PKT_RBUF_SZ (TX_PKT_RBUF_NUM * sizeof(struct pkt_buf))
 #define TX_PKT_RING_SZ   (sizeof(struct ck_ring) + TX_PKT_RBUF_SZ)
 #define TX_PKT_RING_PAGES (round_up_to_page(TX_PKT_RING_SZ)/PAGE_SIZE)
 
+#define TX_STAGE_RBUF_NUM 1024
+#define TX_STAGE_RBUF_SZ (TX_STAGE_RBUF_NUM * sizeof(struct pkt_buf))
+#define TX_STAGE_RING_SZ   (sizeof(struct ck_ring) + TX_STAGE_RBUF_SZ)
+
 #define FREE_PKT_RBUF_NUM 4096
 #define FREE_PKT_RBUF_SZ (FREE_PKT_RBUF_NUM * sizeof(struct pkt_buf))
 #define FREE_PKT_RING_SZ   (sizeof(struct ck_ring) + FREE_PKT_RBUF_SZ)
 #define FREE_PKT_RING_PAGES (round_up_to_page(FREE_PKT_RING_SZ)/PAGE_SIZE)
 
+/*
+ * A tx queue, shared by the cores `c` with `c % nic_ntxq` equal to
+ * its index, so each core has its own if the NIC has enough queues.
+ * Only the owner of the queue sends on it, and the others (on other
+ * cores, or that preempted the owner) stage their packets for the
+ * owner to send, instead of waiting for it.
+ */
+struct nic_txq {
+	unsigned long        owner; /* 1 while a thread sends on the queue */
+	char                *mp;
+	struct pkt_ring_buf  stage; /* the mbufs to send, MPSC */
+} CACHE_ALIGNED;
+
+extern struct nic_txq nic_txqs[NIC_TX_QUEUE_NUM];
+extern int nic_ntxq;
+/* If the packets sent can be chained, and segmented by the NIC */
+extern int nic_tso;
+
+/*
+ * With the tx loopback, the packets sent are received again, as if
+ * the NIC had received them, instead of being sent: the path of the
+ * sessions' packets through the nicmgr can be benchmarked without an
+ * external traffic generator (see tests/bench_pktgen). The sessions
+ * then have no zero-copy queue, as the NIC's queues receive nothing.
+ */
+#define NIC_TX_LOOPBACK 0
+
+/* Receive the mbufs sent, with NIC_TX_LOOPBACK (init.c) */
+void nic_loopback_rx(char **mbufs, int n);
+
+void nic_tx_init(void);
+/* Send the packets staged on the queue, if no one is sending on it */
+void nic_tx_flush(int queue);
+/* Send up to `n` mbufs on the queue, as its owner, and return the number sent */
+int nic_tx_burst_try(int queue, char **mbufs, int n);
+
+/* The tx QoS (qos.c) */
+void nic_tx_qos_init(void);
+void nic_tx_qos_session_init(struct client_session *session);
+/* Queue the session's mbufs on its tx ring, dropping those it has no room for */
+void nic_tx_qos_enqueue(struct client_session *session, int queue, char **mbufs, int n);
+/* Send the packets of the sessions queued on the tx queue, as its owner */
+void nic_tx_qos_drain(int queue);
+/* If sessions queued packets on the queue since its last drain */
+int nic_tx_qos_pending(int queue);
+
+/* The processing time of the sessions (qos.c) */
+void nic_cpu_acct_init(struct client_session *session);
+/* Charge the session `cycles` of rx (or tx) processing, done by `now` */
+void nic_cpu_charge(struct client_session *session, cycles_t now, cycles_t cycles, int tx);
+/* If the session used up its budget for the window of `now` */
+int nic_cpu_throttled(struct client_session *session, cycles_t now);
+
+/* Initialize the ring, in memory allocated for it, of `ringbuf_num` pkt_bufs, of `ringbuf_sz` bytes */
 void pkt_ring_buf_init(struct pkt_ring_buf *pkt_ring_buf, size_t ringbuf_num, size_t ringbuf_sz);
+/* Initialize the ring in the memory `mem`, of a ring of `ringbuf_num` pkt_bufs */
+void pkt_ring_buf_init_mem(struct pkt_ring_buf *pkt_ring_buf, void *mem, size_t ringbuf_num);
 
 int pkt_ring_buf_enqueue(struct pkt_ring_buf *pkt_ring_buf, struct pkt_buf *buf);
+int pkt_ring_buf_enqueue_mp(struct pkt_ring_buf *pkt_ring_buf, struct pkt_buf *buf);
 int pkt_ring_buf_dequeue(struct pkt_ring_buf *pkt_ring_buf, struct pkt_buf *buf);
 int pkt_ring_buf_empty(struct pkt_ring_buf *pkt_ring_buf);
 
-void cos_hash_add(uint16_t tenant_id, struct client_session *session);
-struct client_session *cos_hash_lookup(uint16_t tenant_id);
+/*
+ * The flow table (flow.c) finds the session of each received packet by
+ * its 5-tuple. Rules are a 5-tuple, and a mask of the bits matched, so
+ * the other bits are wildcards; the packet goes to the rule with the
+ * most bits matched. A rule has a group of sessions (e.g. the server
+ * threads bound to a port), and the 5-tuple of the packet picks one,
+ * so the packets of a flow always go to the same session.
+ */
+#define NIC_FLOW_MASK_MAX  4    /* different masks of the rules */
+#define NIC_FLOW_TBL_SZ    1024 /* rules with each mask, power of two */
+#define NIC_FLOW_RULE_MAX  NIC_MAX_SESSION
+#define NIC_FLOW_GROUP_MAX 8    /* sessions of a rule */
+#define NIC_FLOW_BURST     32   /* packets looked up together */
+
+union nic_flow_key {
+	struct cos_flow_tuple t;
+	u64_t                 w[2];
+};
+
+void nic_flow_init(void);
+/*
+ * Add the session to the group of the rule, creating the rule, and
+ * offloading it to the NIC to steer its packets to `queue` (if `>= 0`)
+ * if it is new. Returns 1 if the rule is offloaded, 0 if it isn't,
+ * or a negative errno.
+ */
+int nic_flow_add(const struct cos_flow_tuple *key, const struct cos_flow_tuple *mask,
+                 struct client_session *session, int queue);
+/*
+ * `sessions[i]` is the session of `keys[i]`, or NULL. The session of a
+ * group is picked by `rss[i]`, the NIC's hash of the packet, if `rss`
+ * isn't NULL, and `rss[i]` isn't 0, instead of hashing the key again.
+ */
+void nic_flow_lookup_burst(const union nic_flow_key *keys, const u32_t *rss, int n, struct client_session **sessions);
+struct client_session *nic_flow_lookup(const union nic_flow_key *key);
+
+/* The rule of the sessions bound to a TCP or UDP port (in network byte order) */
+static inline void
+nic_flow_port(u16_t port, struct cos_flow_tuple *key, struct cos_flow_tuple *mask)
+{
+	*key  = (struct cos_flow_tuple) { .dst_port = port };
+	*mask = (struct cos_flow_tuple) { .dst_port = 0xFFFF };
+}
+
+/* The rule of the sessions bound to all of the ports of an address (in network byte order) */
+static inline void
+nic_flow_ip(u32_t ip, struct cos_flow_tuple *key, struct cos_flow_tuple *mask)
+{
+	*key  = (struct cos_flow_tuple) { .dst_ip = ip };
+	*mask = (struct cos_flow_tuple) { .dst_ip = 0xFFFFFFFF };
+}
+
+/*
+ * Coalesce the consecutive TCP segments of a flow received by a
+ * session (gro.c), appending the payload of the segment `pkt` to the
+ * one in `buf`, of `*len` bytes, if it fits in `cap` bytes. Returns 1
+ * if it was appended, with `*len` updated.
+ */
+#define NIC_ENABLE_GRO 1
+
+/*
+ * Write the metadata of each packet received (e.g. its RSS hash, and
+ * the checksums the NIC checked), in the tailroom of its buffer (see
+ * netshmem_get_meta).
+ */
+#define NIC_RX_META 1
+
+int nic_gro_merge(char *buf, u16_t *len, u16_t cap, const char *pkt, u16_t pkt_len);
+
+/*
+ * The nicmgr answers the ARP requests, and the ICMP echo requests, for
+ * the addresses bound by its sessions (arp.c), off the path of the
+ * sessions' packets. It also keeps a table of the neighbors, learned
+ * from their ARP packets, for the stacks of the tenants to resolve
+ * the addresses missing from their caches (see nic_neigh_lookup).
+ */
+#define NIC_NEIGH_TBL_SZ  256 /* power of two */
+#define NIC_LOCAL_IP_MAX  8
+
+void nic_arp_init(void);
+void nic_arp_local_add(u32_t ip);
+/* Handle a received ARP or ICMP packet: return 1 if the mbuf is consumed (e.g. sent back) */
+int nic_arp_input(char *mbuf, char *pkt, int len);
+int nic_icmp_input(char *mbuf, char *pkt, int len);
+
+/* Send a packet built by the nicmgr on the core's tx queue, in an mbuf of nic_tx_alloc */
+char *nic_tx_alloc(void);
+void nic_tx_one(char *mbuf);
 
 #define USE_CK_RING_FREE_MBUF 0
+
+/* Print (and reset) the latencies of the traced requests (see netshmem.h) */
+void nic_trace_report(void);
+
 #endif /* NICMGR_H */
@@ -0,0 +1,381 @@
+#include <cos_component.h>
+#include <llprint.h>
+#include <ps.h>
+#include <errno.h>
+#include <string.h>
+#include <cos_time.h>
+#include "nicmgr.h"
+
+/***
+ * The tx QoS: each session queues its packets (mbufs with its buffers
+ * attached) on its own tx ring, and the first time it does since it
+ * was last idle, it is activated on its tx queue, on an MPSC ring. The
+ * owner of the queue (see nic_tx) adds the sessions activated to the
+ * round-robin list of their class, and builds each burst from the
+ * lists: the sessions of class 0 are served until their packets are
+ * sent (or are shaped), then those of class 1, and so on. Within a
+ * class, the sessions send, in turn, up to their deficit, of
+ * NIC_TX_QUANTUM bytes per round per unit of weight, so they get a
+ * share of the link proportional to their weight, whatever the size
+ * of their packets.
+ *
+ * The sessions with a rate spend tokens, of bytes, added as time goes
+ * by, up to their burst. A session without the tokens for its next
+ * packet is skipped until it has them: the polling threads drain the
+ * queues of their cores (nic_tx_flush), so its packets are sent even
+ * if it stops sending.
+ *
+ * The packets the NIC has no room for are kept for the next burst,
+ * rather than dropped, so the sessions' packets wait on their rings,
+ * where the scheduler orders them, when the link is congested.
+ */
+
+struct nic_tx_active {
+	struct client_session *session;
+};
+
+CK_RING_PROTOTYPE(nic_tx_active, nic_tx_active);
+
+/* Each session is activated at most once, and a ring holds one less than its size */
+#define NIC_TX_ACTIVE_NUM (NIC_MAX_SESSION * 2)
+
+/* A round-robin list of the active sessions of a class */
+struct nic_tx_class {
+	unsigned int           head, n;
+	struct client_session *sessions[NIC_MAX_SESSION];
+};
+
+/* The scheduler of a tx queue, only used by its owner, but for the activations */
+struct nic_tx_sched {
+	struct ck_ring        active;
+	struct nic_tx_active  active_buf[NIC_TX_ACTIVE_NUM];
+	/* set as packets are queued, so that the owner drains them before it releases the queue */
+	unsigned long         kick;
+	struct nic_tx_class   classes[NIC_TX_CLASSES];
+	/* the packets the NIC had no room for */
+	char                 *pending[NIC_BATCH_MAX];
+	int                   pending_off, npending;
+} CACHE_ALIGNED;
+
+static struct nic_tx_sched nic_tx_scheds[NIC_TX_QUEUE_NUM];
+
+static cycles_t nic_cpu_window;
+
+void
+nic_tx_qos_init(void)
+{
+	int i;
+
+	for (i = 0; i < NIC_TX_QUEUE_NUM; i++) ck_ring_init(&nic_tx_scheds[i].active, NIC_TX_ACTIVE_NUM);
+	nic_cpu_window = time_usec2cyc(NIC_CPU_WINDOW);
+}
+
+void
+nic_tx_qos_session_init(struct client_session *session)
+{
+	pkt_ring_buf_init(&session->pkt_tx_ring, TX_PKT_RBUF_NUM, TX_PKT_RING_SZ);
+	session->tx_qos = (struct nic_tx_qos) {
+		.class  = NIC_TX_CLASS,
+		.weight = NIC_TX_WEIGHT,
+		.rate   = NIC_TX_RATE,
+		.burst  = NIC_TX_BURST,
+		.tokens = NIC_TX_BURST,
+		.last   = time_now(),
+	};
+}
+
+static void
+nic_tx_class_add(struct nic_tx_class *c, struct client_session *session)
+{
+	c->sessions[(c->head + c->n) % NIC_MAX_SESSION] = session;
+	c->n++;
+}
+
+/* Move the session at the head of the list to its tail */
+static inline void
+nic_tx_class_rotate(struct nic_tx_class *c)
+{
+	c->sessions[(c->head + c->n) % NIC_MAX_SESSION] = c->sessions[c->head];
+	c->head = (c->head + 1) % NIC_MAX_SESSION;
+}
+
+static inline void
+nic_tx_class_pop(struct nic_tx_class *c)
+{
+	c->head = (c->head + 1) % NIC_MAX_SESSION;
+	c->n--;
+}
+
+static void
+nic_tx_activate(struct nic_tx_sched *s, struct client_session *session)
+{
+	struct nic_tx_active a = { .session = session };
+
+	/* Never full, see NIC_TX_ACTIVE_NUM */
+	if (!CK_RING_ENQUEUE_MPSC(nic_tx_active, &s->active, s->active_buf, &a)) BUG();
+}
+
+void
+nic_tx_qos_enqueue(struct client_session *session, int queue, char **mbufs, int n)
+{
+	struct nic_tx_qos *q   = &session->tx_qos;
+	struct pkt_buf     buf = { 0 };
+	int                i;
+
+	for (i = 0; i < n; i++) {
+		buf.pkt     = mbufs[i];
+		buf.pkt_len = cos_packet_len(mbufs[i]);
+		if (likely(pkt_ring_buf_enqueue(&session->pkt_tx_ring, &buf))) continue;
+		cos_free_packet(mbufs[i]);
+		q->stats.dropped++;
+	}
+
+	/* Pairs with the check of the ring in nic_tx_deactivate */
+	ps_mem_fence();
+	if (!ps_load(&q->active) && ps_cas(&q->active, 0, 1)) nic_tx_activate(&nic_tx_scheds[queue], session);
+	ps_store(&nic_tx_scheds[queue].kick, 1);
+}
+
+/*
+ * Take the session off the scheduler, as its ring is empty, unless
+ * packets were queued in the mean time: the session that queued them
+ * saw it active, thus didn't activate it.
+ */
+static int
+nic_tx_deactivate(struct client_session *session)
+{
+	struct nic_tx_qos *q = &session->tx_qos;
+
+	q->deficit = 0;
+	ps_store(&q->active, 0);
+	ps_mem_fence();
+
+	return pkt_ring_buf_empty(&session->pkt_tx_ring) || !ps_cas(&q->active, 0, 1);
+}
+
+/* Add the tokens the session earned since it was last given some */
+static inline void
+nic_tx_tokens(struct nic_tx_qos *q, cycles_t now)
+{
+	cycles_t elapsed = now - q->last;
+	u64_t    add;
+
+	if (q->tokens >= q->burst) {
+		q->last = now;
+		return;
+	}
+	/* Don't overflow: a second fills any bucket */
+	if (elapsed > time_usec2cyc(1000 * 1000)) elapsed = time_usec2cyc(1000 * 1000);
+	/* rate Mbit/s, thus rate / 8 bytes per usec */
+	add = (elapsed * q->rate) / (8 * time_cyc_per_usec());
+	if (!add) return;
+
+	q->tokens = q->tokens + add > q->burst ? q->burst : q->tokens + add;
+	q->last   = now;
+}
+
+/*
+ * Take the next packets of the sessions of the class, up to `max`, in
+ * turn. Returns the number taken, and stops early if all of the
+ * sessions are idle, or wait for tokens.
+ */
+static int
+nic_tx_class_take(struct nic_tx_class *c, char **mbufs, int max, cycles_t now)
+{
+	struct client_session *session;
+	struct nic_tx_qos     *q;
+	unsigned int           waiting = 0;
+	int                    n = 0;
+
+	while (n < max && c->n > 0 && waiting < c->n) {
+		session = c->sessions[c->head];
+		q       = &session->tx_qos;
+
+		if (!q->head.pkt && !pkt_ring_buf_dequeue(&session->pkt_tx_ring, &q->head)) {
+			nic_tx_class_pop(c);
+			if (!nic_tx_deactivate(session)) nic_tx_class_add(c, session);
+			continue;
+		}
+		/* The deficit is replenished once per round */
+		if (q->deficit < q->head.pkt_len) {
+			q->deficit += (long)NIC_TX_QUANTUM * q->weight;
+			nic_tx_class_rotate(c);
+			continue;
+		}
+		if (q->rate) {
+			nic_tx_tokens(q, now);
+			if (q->tokens < (u64_t)q->head.pkt_len) {
+				if (!q->head_shaped) q->stats.shaped++;
+				q->head_shaped = 1;
+				/* Its turn is kept for when it has the tokens */
+				nic_tx_class_rotate(c);
+				waiting++;
+				continue;
+			}
+			q->tokens -= q->head.pkt_len;
+		}
+
+		q->deficit    -= q->head.pkt_len;
+		q->head_shaped = 0;
+		q->stats.sent++;
+		mbufs[n++]     = q->head.pkt;
+		q->head.pkt    = NULL;
+		waiting        = 0;
+	}
+
+	return n;
+}
+
+/* Send the packets kept for the NIC, and return the number still kept */
+static int
+nic_tx_pending(int queue, struct nic_tx_sched *s)
+{
+	int sent;
+
+	if (!s->npending) return 0;
+	sent = nic_tx_burst_try(queue, &s->pending[s->pending_off], s->npending);
+	s->pending_off += sent;
+	s->npending    -= sent;
+	if (!s->npending) s->pending_off = 0;
+
+	return s->npending;
+}
+
+void
+nic_tx_qos_drain(int queue)
+{
+	struct nic_tx_sched  *s = &nic_tx_scheds[queue];
+	struct nic_tx_active  a;
+	char                 *mbufs[NIC_BATCH_MAX];
+	cycles_t              now = time_now();
+	int                   c, n, sent;
+
+	ps_store(&s->kick, 0);
+	ps_mem_fence();
+	while (CK_RING_DEQUEUE_SPSC(nic_tx_active, &s->active, s->active_buf, &a)) {
+		c = a.session->tx_qos.class;
+		nic_tx_class_add(&s->classes[c < NIC_TX_CLASSES ? c : NIC_TX_CLASSES - 1], a.session);
+	}
+
+	do {
+		if (nic_tx_pending(queue, s)) return;
+
+		/* Strict priority: a class only gets the room left by those before it */
+		for (c = 0, n = 0; c < NIC_TX_CLASSES && n < NIC_BATCH_MAX; c++) {
+			n += nic_tx_class_take(&s->classes[c], &mbufs[n], NIC_BATCH_MAX - n, now);
+		}
+		if (!n) return;
+
+		sent = nic_tx_burst_try(queue, mbufs, n);
+		if (sent < n) {
+			memcpy(s->pending, &mbufs[sent], (n - sent) * sizeof(char *));
+			s->npending = n - sent;
+		}
+	} while (n == NIC_BATCH_MAX);
+}
+
+int
+nic_tx_qos_pending(int queue)
+{
+	return ps_load(&nic_tx_scheds[queue].kick) || ck_ring_size(&nic_tx_scheds[queue].active) > 0;
+}
+
+int
+nic_tx_qos_set(thdid_t thd, u32_t class_weight, u32_t rate, u32_t burst)
+{
+	struct client_session *session;
+	struct nic_tx_qos     *q;
+	u16_t class  = class_weight >> 16;
+	u16_t weight = class_weight & 0xFFFF;
+
+	if (!thd) thd = cos_thdid();
+	if (thd >= NIC_MAX_SESSION || class >= NIC_TX_CLASSES || weight == 0) return -EINVAL;
+	session = &client_sessions[thd];
+	if (!session->tx_init_done) return -EINVAL;
+	if (session->comp != (compid_t)cos_inv_token()) return -EPERM;
+
+	q = &session->tx_qos;
+	/* A new class applies from the next time the session is activated */
+	q->class  = class;
+	q->weight = weight;
+	q->burst  = burst ? burst : NIC_TX_BURST;
+	q->tokens = q->burst;
+	q->rate   = rate;
+
+	return 0;
+}
+
+/***
+ * The processing time of the sessions. The polling threads time the
+ * packets of each session in a burst together: the session is charged
+ * its share, by its number of packets, of the parsing and flow lookup
+ * of the burst, and the cycles its packets' enqueue and its wakeup
+ * took. The sends are timed on the tenant's own thread, which its
+ * scheduler already accounts for, so only the rx time is budgeted.
+ *
+ * The counts aren't synchronized: the polling threads of several
+ * cores can charge an unsteered session concurrently, so it is only
+ * approximately held to its budget.
+ */
+
+void
+nic_cpu_acct_init(struct client_session *session)
+{
+	session->cpu = (struct nic_cpu_acct) {
+		.budget    = time_usec2cyc(NIC_CPU_BUDGET),
+		.win_start = time_now(),
+	};
+}
+
+static inline void
+nic_cpu_window_roll(struct nic_cpu_acct *a, cycles_t now)
+{
+	if (now - a->win_start < nic_cpu_window) return;
+	a->win_start = now;
+	a->used      = 0;
+}
+
+void
+nic_cpu_charge(struct client_session *session, cycles_t now, cycles_t cycles, int tx)
+{
+	struct nic_cpu_acct *a = &session->cpu;
+
+	if (tx) {
+		a->tx += cycles;
+		return;
+	}
+	a->rx += cycles;
+	if (likely(!a->budget)) return;
+	nic_cpu_window_roll(a, now);
+	a->used += cycles;
+}
+
+int
+nic_cpu_throttled(struct client_session *session, cycles_t now)
+{
+	struct nic_cpu_acct *a = &session->cpu;
+
+	if (likely(!a->budget) || a->used < a->budget) return 0;
+	nic_cpu_window_roll(a, now);
+
+	return a->used >= a->budget;
+}
+
+int
+nic_cpu_budget_set(thdid_t thd, u32_t usec)
+{
+	struct client_session *session;
+	cycles_t               budget = time_usec2cyc(usec);
+
+	if (!thd) thd = cos_thdid();
+	if (thd >= NIC_MAX_SESSION) return -EINVAL;
+	session = &client_sessions[thd];
+	if (!session->tx_init_done) return -EINVAL;
+	if (session->comp != (compid_t)cos_inv_token()) return -EPERM;
+	/* The tenants can't lift the manager's own budget */
+	if (NIC_CPU_BUDGET && (!usec || usec > NIC_CPU_BUDGET)) return -EPERM;
+
+	session->cpu.budget = budget;
+
+	return 0;
+}
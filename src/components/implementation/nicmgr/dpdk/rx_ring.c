@@ -0,0 +1,101 @@
+#include <cos_component.h>
+#include <ps.h>
+#include <string.h>
+#include <memmgr.h>
+#include "nicmgr.h"
+
+/***
+ * The rx rings of the sessions. The polling threads enqueue the
+ * packets of a burst for a session at once, and publish them with a
+ * single store of the producers' tail, and the tenant only publishes
+ * its head once it has consumed NIC_RX_RING_BATCH packets (or drained
+ * the ring), so the cache-lines of the indices bounce between the
+ * cores once per batch rather than twice per packet. Each side keeps
+ * a copy of the other's index, and only reads the other's cache-line
+ * when the ring looks full (or empty) with it.
+ *
+ * The producers of the unsteered sessions are the polling threads of
+ * all of the cores: they reserve their slots with a CAS, and publish
+ * them in the order of the reservations. The copies of the head they
+ * keep can then be older than their reservation, thus are checked.
+ */
+
+struct nic_rx_ring *
+nic_rx_ring_alloc(void)
+{
+	struct nic_rx_ring *r;
+
+	r = (struct nic_rx_ring *)memmgr_heap_page_allocn(round_up_to_page(sizeof(struct nic_rx_ring)) / PAGE_SIZE);
+	if (r) nic_rx_ring_init(r);
+
+	return r;
+}
+
+void
+nic_rx_ring_init(struct nic_rx_ring *r)
+{
+	memset(&r->prod, 0, sizeof(r->prod));
+	memset(&r->cons, 0, sizeof(r->cons));
+}
+
+static inline unsigned long
+nic_rx_ring_free(unsigned long reserve, unsigned long head)
+{
+	unsigned long used = reserve - head;
+
+	return used >= NIC_RX_RING_SZ ? 0 : NIC_RX_RING_SZ - used;
+}
+
+int
+nic_rx_ring_enqueue_n(struct nic_rx_ring *r, struct nic_rx_desc *d, int n, int mp)
+{
+	unsigned long start, free;
+	int           i;
+
+	do {
+		start = ps_load(&r->prod.reserve);
+		free  = nic_rx_ring_free(start, r->prod.head_cache);
+		if (free < (unsigned long)n) {
+			r->prod.head_cache = __atomic_load_n(&r->cons.head, __ATOMIC_ACQUIRE);
+			free               = nic_rx_ring_free(start, r->prod.head_cache);
+			if (free == 0) return 0;
+			if (free < (unsigned long)n) n = free;
+		}
+	} while (mp && !ps_cas(&r->prod.reserve, start, start + n));
+	if (!mp) r->prod.reserve = start + n;
+
+	for (i = 0; i < n; i++) r->descs[(start + i) & (NIC_RX_RING_SZ - 1)] = d[i];
+
+	/* The producers that reserved before us publish first */
+	if (mp) {
+		while (__atomic_load_n(&r->prod.tail, __ATOMIC_ACQUIRE) != start) {
+			__asm__ __volatile__("pause" : : : "memory");
+		}
+	}
+	__atomic_store_n(&r->prod.tail, start + n, __ATOMIC_RELEASE);
+
+	return n;
+}
+
+int
+nic_rx_ring_dequeue_n(struct nic_rx_ring *r, struct nic_rx_desc *d, int n)
+{
+	unsigned long next = r->cons.next;
+	int           i;
+
+	if (r->cons.tail_cache - next < (unsigned long)n) {
+		r->cons.tail_cache = __atomic_load_n(&r->prod.tail, __ATOMIC_ACQUIRE);
+		if (r->cons.tail_cache - next < (unsigned long)n) n = r->cons.tail_cache - next;
+	}
+
+	for (i = 0; i < n; i++) d[i] = r->descs[(next + i) & (NIC_RX_RING_SZ - 1)];
+	next += n;
+	r->cons.next = next;
+
+	/* Give the slots back to the producers */
+	if (next != r->cons.head && (next - r->cons.head >= NIC_RX_RING_BATCH || next == r->cons.tail_cache)) {
+		__atomic_store_n(&r->cons.head, next, __ATOMIC_RELEASE);
+	}
+
+	return n;
+}
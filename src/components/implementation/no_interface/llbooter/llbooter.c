@@ -61,6 +61,33 @@ SS_STATIC_SLAB(chkpt,  struct crt_chkpt,        BOOTER_MAX_CHKPT);
 SS_STATIC_SLAB_GLOBAL_ID(ns_asid, struct protdom_ns_asid, BOOTER_MAX_NS_ASID, 0);
 SS_STATIC_SLAB_GLOBAL_ID(ns_vas, struct protdom_ns_vas, BOOTER_MAX_NS_VAS, 0);
 
+/*
+ * The components in exclusive address spaces are created in parallel
+ * on all cores (comps_create), as copying their images and building
+ * their tables dominates the boot. They don't depend on each other,
+ * only the delegations and sinvs that follow depend on them.
+ * `comps_init` collects them, and allocates what isn't thread-safe
+ * (their ASIDs).
+ */
+struct boot_comp_create {
+	struct crt_comp *comp;
+	char            *name;
+	compid_t         id;
+	void            *elf_hdr;
+	vaddr_t          info;
+	prot_domain_t    pd;
+};
+
+static struct boot_comp_create boot_creates[MAX_NUM_COMPS];
+static unsigned long           boot_ncreates, boot_creates_next;
+static struct simple_barrier   boot_created_barrier, boot_resources_barrier;
+static coreid_t                boot_init_core;
+
+/* Per-phase boot timings, in cycles */
+static cycles_t boot_tsc_start, boot_cycles_serial, boot_cycles_create, boot_cycles_resources;
+static cycles_t boot_core_create_cycles[NUM_CPU];
+static unsigned long boot_core_ncreated[NUM_CPU];
+
 /*
  * Assumptions: the component with the lowest id *must* be the one
  * that is passed into this function first. You *can* pass in an id
@@ -125,7 +152,9 @@ execution_init(int is_init_core)
 		comp = boot_comp_get(id);
 		assert(comp);
 
-		if (!strcmp(exec_type, "sched")) {
+		if (!crt_placement_oncore(id, cos_cpuid())) {
+			/* Only its cores have a thread in it */
+		} else if (!strcmp(exec_type, "sched")) {
 			struct crt_rcv *r = ss_rcv_alloc();
 
 			assert(r);
@@ -251,6 +280,7 @@ comps_init(void)
 			assert(elf_hdr);
 			if (crt_comp_create_in_vas(comp, name, id, elf_hdr, info, ns_vas)) BUG();
 			assert(comp->refcnt != 0);
+			crt_comp_placement_init(comp);
 		}
 	}
 
@@ -284,6 +314,13 @@ comps_init(void)
 		elf_hdr = (void *)args_get(imgpath);
 
 		prot_domain_t pd = protdom_ns_asid_alloc(ns_asid);
+		char *nofpu      = args_get_from("nofpu", &comp_data);
+		char *trustdom   = args_get_from("trustdom", &comp_data);
+
+		/* declared FPU-free in the composition script */
+		if (nofpu && atoi(nofpu)) pd |= PROTDOM_NOFPU_FLAG;
+		/* ...and the components it trusts, so the kernel skips the speculation barriers between them */
+		if (trustdom) pd |= PROTDOM_TRUSTDOM_INIT(atoi(trustdom));
 
 		/*
 		 * We assume, for now, that the composer is
@@ -297,13 +334,69 @@ comps_init(void)
 			ret = crt_booter_create(comp, name, id, info);
 			assert(ret == 0);
 		} else {
-			assert(elf_hdr);
-			if (crt_comp_create(comp, name, id, elf_hdr, info, pd)) {
-				printc("Error constructing the resource tables and image of component %s.\n", comp->name);
-				BUG();
-			}	
+			assert(elf_hdr && boot_ncreates < MAX_NUM_COMPS);
+			boot_creates[boot_ncreates++] = (struct boot_comp_create) {
+				.comp    = comp,
+				.name    = name,
+				.id      = id,
+				.elf_hdr = elf_hdr,
+				.info    = info,
+				.pd      = pd
+			};
 		}
 	}
+	boot_cycles_serial = ps_tsc() - boot_tsc_start;
+
+	return;
+}
+
+/*
+ * Create the components of `boot_creates`, taking them one at a time
+ * so that the cores balance the images of different sizes. Called on
+ * all cores.
+ */
+static void
+comps_create(coreid_t cid)
+{
+	unsigned long n;
+	cycles_t start = ps_tsc();
+
+	while ((n = ps_faa(&boot_creates_next, 1)) < boot_ncreates) {
+		struct boot_comp_create *b = &boot_creates[n];
+
+		if (crt_comp_create(b->comp, b->name, b->id, b->elf_hdr, b->info, b->pd)) {
+			printc("Error constructing the resource tables and image of component %s.\n", b->comp->name);
+			BUG();
+		}
+		/* Created on any core, but initialized on ours (or the first of its cores) */
+		b->comp->init_core = boot_init_core;
+		crt_comp_placement_init(b->comp);
+		boot_core_ncreated[cid]++;
+	}
+	boot_core_create_cycles[cid] = ps_tsc() - start;
+}
+
+/* The composer parses the integers of the sinvs, so this doesn't */
+static unsigned long
+sinv_arg(char *key, struct initargs *sinv)
+{
+	long v;
+
+	if (args_get_num_from(key, sinv, &v)) BUG();
+
+	return v;
+}
+
+/*
+ * The kernel resources between the components, once they are all
+ * created: capability delegations, sinvs, and the capmgr's memory.
+ */
+static void
+comps_resources_init(void)
+{
+	struct initargs curr, comps;
+	struct initargs_iter i;
+	int cont, ret;
 
 	/* perform any necessary captbl delegations */
 	ret = args_get_entry("captbl_delegations", &comps);
@@ -384,21 +477,24 @@ comps_init(void)
 	ret = args_get_entry("sinvs", &comps);
 	assert(!ret);
 	printc("Synchronous invocations (%d):\n", args_len(&comps));
+	/* Activate all of the sinvs with as few system calls as possible */
+	crt_sinv_batch_begin();
 	for (cont = args_iter(&comps, &i, &curr) ; cont ; cont = args_iter_next(&i, &curr)) {
 		struct crt_sinv *sinv;
-		int serv_id = atoi(args_get_from("server", &curr));
-		int cli_id  = atoi(args_get_from("client", &curr));
+		int serv_id = sinv_arg("server", &curr);
+		int cli_id  = sinv_arg("client", &curr);
 		struct crt_comp *serv = boot_comp_get(serv_id);
 		struct crt_comp *cli = boot_comp_get(cli_id);
 
 		sinv = ss_sinv_alloc();
 		assert(sinv);
 		crt_sinv_create(sinv, args_get_from("name", &curr), boot_comp_get(serv_id), boot_comp_get(cli_id),
-				strtoul(args_get_from("c_fn_addr", &curr), NULL, 10), 
-				strtoul(args_get_from("c_fast_callgate_addr", &curr), NULL, 10), 
-				strtoul(args_get_from("c_ucap_addr", &curr), NULL, 10),
-				strtoul(args_get_from("s_fn_addr", &curr), NULL, 10),
-				strtoul(args_get_from("s_altfn_addr", &curr), NULL, 10)
+				sinv_arg("c_fn_addr", &curr),
+				sinv_arg("c_fast_callgate_addr", &curr),
+				sinv_arg("c_ucap_addr", &curr),
+				sinv_arg("s_fn_addr", &curr),
+				sinv_arg("s_altfn_addr", &curr),
+				sinv_arg("c_capid", &curr)
 		);
 		ss_sinv_activate(sinv);
 		printc("\t%s (%lu->%lu):\tclient_fn @ 0x%lx, client_ucap @ 0x%lx, server_fn @ 0x%lx\n",
@@ -412,6 +508,8 @@ comps_init(void)
 		cli->n_sinvs++;
 	#endif /* ENABLE_CHKPT */
 	}
+	ret = crt_sinv_batch_end();
+	assert(!ret);
 
 	/*
 	 * Delegate the untyped memory to the capmgr. This should go
@@ -444,6 +542,34 @@ comps_init(void)
 	return;
 }
 
+static void
+boot_timings_print(int ncores)
+{
+	int i;
+
+	printc("Boot timings (cycles): address spaces & planning %llu, component creation %llu, delegations & sinvs %llu\n",
+	       boot_cycles_serial, boot_cycles_create, boot_cycles_resources);
+	for (i = 0; i < ncores; i++) {
+		printc("\tCore %d created %lu components in %llu cycles\n", i, boot_core_ncreated[i], boot_core_create_cycles[i]);
+	}
+}
+
+#ifdef ENABLE_CHKPT
+/* A new thread to execute `comp`, from its checkpoint */
+static void
+chkpt_comp_exec(struct crt_comp *comp)
+{
+	struct crt_comp_exec_context ctxt = { 0 };
+	struct crt_thd *t;
+
+	t = ss_thd_alloc();
+	assert(t);
+
+	if (crt_comp_exec(comp, crt_comp_exec_thd_init(&ctxt, t))) BUG();
+	ss_thd_activate(t);
+}
+#endif /* ENABLE_CHKPT */
+
 /*
  * We only support a single checkpoint directly above the existing components.
  * At this point we assume capability managers and schedulers will not be checkpointed
@@ -459,8 +585,7 @@ chkpt_comp_init(struct crt_comp *comp, struct crt_chkpt *chkpt, char *name)
 	const char *root = "binaries/";
 	int   len  = strlen(root);
 	char  path[INITARGS_MAX_PATHNAME];
-	struct crt_comp_exec_context ctxt = { 0 };
-	struct crt_thd *t;
+	cycles_t start;
 
 	id = crt_ncomp() + 1;
 	assert(id < MAX_NUM_COMPS && id > 0 && name);
@@ -476,18 +601,16 @@ chkpt_comp_init(struct crt_comp *comp, struct crt_chkpt *chkpt, char *name)
 		/* this should never happen */
 		assert(0);
 	} else {
+		start = ps_tsc();
 		if (crt_comp_create_from(comp, name, id, chkpt)) {
 			printc("Error constructing the resource tables and image of component %s.\n", comp->name);
 			BUG();
 		}
+		printc("\t(chkpt) Created component %s in %llu cycles.\n", name, (unsigned long long)(ps_tsc() - start));
 	}
 	assert(comp->refcnt != 0);
 
-	t = ss_thd_alloc();
-	assert(t);
-
-	if (crt_comp_exec(comp, crt_comp_exec_thd_init(&ctxt, t))) BUG();
-	ss_thd_activate(t);
+	chkpt_comp_exec(comp);
 	comp->init_state = CRT_COMP_INIT_COS_INIT;
 
 	/* create the sinvs */
@@ -499,7 +622,8 @@ chkpt_comp_init(struct crt_comp *comp, struct crt_chkpt *chkpt, char *name)
 		sinv = ss_sinv_alloc();
 		assert(sinv);
 		crt_sinv_create(sinv, comp->sinvs[i].name, comp->sinvs[i].server, comp->sinvs[i].client,
-			comp->sinvs[i].c_fn_addr, comp->sinvs[i].c_ucap_addr, comp->sinvs[i].s_fn_addr);
+			comp->sinvs[i].c_fn_addr, 0, comp->sinvs[i].c_ucap_addr, comp->sinvs[i].s_fn_addr, 0,
+			comp->sinvs[i].c_capid);
 		ss_sinv_activate(sinv);
 		printc("\t(chkpt) sinv: %s (%lu->%lu):\tclient_fn @ 0x%lx, client_ucap @ 0x%lx, server_fn @ 0x%lx\n",
 			sinv->name, sinv->client->id, sinv->server->id, sinv->c_fn_addr, sinv->c_ucap_addr, sinv->s_fn_addr);
@@ -531,6 +655,8 @@ addr_get(compid_t id, addr_t type)
 		return ci->cap_frontier;
 	case ADDR_HEAP_FRONTIER:
 		return ci->vas_frontier;
+	case ADDR_RW_BASE:
+		return target->rw_addr;
 	default:
 		return 0;
 	}
@@ -623,7 +749,23 @@ init_exit(int retval)
 
 	crt_compinit_exit(c, retval);
 
-	/* TODO: recycle back to a chkpt via chkpt_restore() */
+#ifdef ENABLE_CHKPT
+	/* Respawn the components created from a checkpoint that fail, from their checkpoint */
+	if (c->chkpt && retval != 0) {
+		thdcap_t thdcap;
+		int      ret;
+
+		if (crt_chkpt_restore(c->chkpt, c)) BUG();
+		chkpt_comp_exec(c);
+		thdcap = crt_comp_thdcap_get(c);
+		assert(thdcap);
+		/* This thread is never switched back to */
+		if ((ret = cos_defswitch(thdcap, TCAP_PRIO_MAX, TCAP_RES_INF, cos_sched_sync()))) {
+			printc("Switch failure on thdcap %ld, with ret %d\n", thdcap, ret);
+			BUG();
+		}
+	}
+#endif /* ENABLE_CHKPT */
 
 	while (1) ;
 }
@@ -631,7 +773,28 @@ init_exit(int retval)
 void
 cos_parallel_init(coreid_t cid, int is_init_core, int ncores)
 {
+	cycles_t start = ps_tsc();
+
 	if (!is_init_core) cos_defcompinfo_sched_init();
+#ifdef ENABLE_CHKPT
+	/* The components created from checkpoints copy their pages on their first access */
+	if (crt_chkpt_pgflt_init(boot_comp_self())) BUG();
+#endif /* ENABLE_CHKPT */
+
+	comps_create(cid);
+	simple_barrier(&boot_created_barrier);
+	if (is_init_core) {
+		boot_cycles_create = ps_tsc() - start;
+		start = ps_tsc();
+		comps_resources_init();
+		boot_cycles_resources = ps_tsc() - start;
+		boot_timings_print(ncores);
+	}
+	/*
+	 * All component resources except for those required for
+	 * execution should be setup now.
+	 */
+	simple_barrier(&boot_resources_barrier);
 
 	execution_init(is_init_core);
 }
@@ -639,13 +802,14 @@ cos_parallel_init(coreid_t cid, int is_init_core, int ncores)
 void
 cos_init(void)
 {
+	boot_tsc_start = ps_tsc();
+	boot_init_core = cos_cpuid();
+	simple_barrier_init(&boot_created_barrier, init_parallelism());
+	simple_barrier_init(&boot_resources_barrier, init_parallelism());
+
 	booter_init();
 	cos_defcompinfo_sched_init();
 	comps_init();
-	/*
-	 * All component resources except for those required for
-	 * execution should be setup now.
-	 */
 }
 
 void
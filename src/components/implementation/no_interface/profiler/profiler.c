@@ -0,0 +1,236 @@
+/*
+ * A sampling profiler: each core's execution is sampled every
+ * PROFILER_PERIOD cycles (see pmu_sample), and the samples, each the
+ * stack of components a thread executes in and where in each, are
+ * drained from the core's trace ring and counted. Every
+ * PROFILER_REPORT_USEC, the stacks counted are printed as "profile"
+ * lines, which tools/profile_fold.py symbolizes into folded stacks
+ * (for flame graphs).
+ */
+
+#include <cos_component.h>
+#include <cos_types.h>
+#include <llprint.h>
+#include <sched.h>
+#include <cos_time.h>
+#include <ktrace.h>
+#include <pmu.h>
+#include <ps.h>
+
+#define PROFILER_PERIOD      (1 << 20)
+#define PROFILER_DRAIN_USEC  10000
+#define PROFILER_REPORT_USEC 10000000
+#define PROFILER_DEPTH       8     /* the innermost frames of a stack are kept */
+#define PROFILER_NSTACKS     512   /* per core, a power of two */
+#define PROFILER_NPGTBLS     64
+#define PROFILER_NCOMPS      4     /* resolved for a page-table */
+
+struct profiler_frame {
+	u32_t   pgtbl;
+	vaddr_t ip;
+};
+
+struct profiler_stack {
+	u64_t                 count;
+	int                   depth;
+	struct profiler_frame frames[PROFILER_DEPTH]; /* innermost first */
+};
+
+struct profiler_core {
+	struct ktrace         trace;
+	unsigned long         lost;
+	struct profiler_stack curr; /* the sample being drained */
+	struct profiler_stack stacks[PROFILER_NSTACKS];
+	unsigned long         nstacks, dropped;
+	struct cos_trace_evt  evts[64];
+} CACHE_ALIGNED;
+
+static struct profiler_core profiler_cores[NUM_CPU];
+
+/* The components of each page-table id, resolved when first reported */
+static struct profiler_pgtbl {
+	u32_t    pgtbl;
+	compid_t comps[PROFILER_NCOMPS];
+} profiler_pgtbls[PROFILER_NPGTBLS];
+static unsigned long  profiler_npgtbls;
+static struct ps_lock profiler_lock;
+
+static u32_t
+profiler_hash(struct profiler_stack *s)
+{
+	u32_t h = 2166136261u;
+	int   i;
+
+	for (i = 0; i < s->depth; i++) {
+		h = (h ^ s->frames[i].pgtbl) * 16777619u;
+		h = (h ^ (u32_t)s->frames[i].ip) * 16777619u;
+	}
+
+	return h;
+}
+
+static int
+profiler_stack_eq(struct profiler_stack *a, struct profiler_stack *b)
+{
+	int i;
+
+	if (a->depth != b->depth) return 0;
+	for (i = 0; i < a->depth; i++) {
+		if (a->frames[i].pgtbl != b->frames[i].pgtbl || a->frames[i].ip != b->frames[i].ip) return 0;
+	}
+
+	return 1;
+}
+
+/* Count the current sample, in an open-addressed table of the stacks */
+static void
+profiler_count(struct profiler_core *p)
+{
+	struct profiler_stack *s;
+	u32_t                  h = profiler_hash(&p->curr);
+	int                    i;
+
+	if (p->curr.depth == 0) return;
+	for (i = 0; i < PROFILER_NSTACKS; i++) {
+		s = &p->stacks[(h + i) & (PROFILER_NSTACKS - 1)];
+		if (s->count == 0) {
+			*s       = p->curr;
+			s->count = 1;
+			p->nstacks++;
+			break;
+		}
+		if (profiler_stack_eq(s, &p->curr)) {
+			s->count++;
+			break;
+		}
+	}
+	if (i == PROFILER_NSTACKS) p->dropped++;
+	p->curr.depth = 0;
+}
+
+static void
+profiler_drain(struct profiler_core *p)
+{
+	struct cos_trace_evt *e;
+	int                   n, i;
+
+	while ((n = ktrace_drain(&p->trace, p->evts, 64)) > 0) {
+		/* the sample being drained might have lost its callers */
+		if (p->trace.lost != p->lost) {
+			p->lost       = p->trace.lost;
+			p->curr.depth = 0;
+		}
+		for (i = 0; i < n; i++) {
+			e = &p->evts[i];
+
+			if (e->type == COS_TRACE_SAMPLE_CALLER && p->curr.depth > 0) {
+				if (p->curr.depth == PROFILER_DEPTH) continue;
+				p->curr.frames[p->curr.depth++] = (struct profiler_frame) { .pgtbl = e->arg, .ip = e->tsc };
+				continue;
+			}
+			/* a sample's events are consecutive, so anything else ends it */
+			profiler_count(p);
+			if (e->type != COS_TRACE_SAMPLE) continue;
+			p->curr.frames[0] = (struct profiler_frame) { .pgtbl = e->arg, .ip = e->tsc };
+			p->curr.depth     = 1;
+		}
+	}
+}
+
+static struct profiler_pgtbl *
+profiler_pgtbl_resolve(u32_t pgtbl)
+{
+	struct profiler_pgtbl *pt;
+	unsigned long          i;
+	int                    j;
+
+	for (i = 0; i < profiler_npgtbls; i++) {
+		if (profiler_pgtbls[i].pgtbl == pgtbl) return &profiler_pgtbls[i];
+	}
+	if (profiler_npgtbls == PROFILER_NPGTBLS) return NULL;
+
+	pt        = &profiler_pgtbls[profiler_npgtbls++];
+	pt->pgtbl = pgtbl;
+	for (j = 0; j < PROFILER_NCOMPS; j++) pt->comps[j] = pmu_sample_comp(pgtbl, j);
+
+	return pt;
+}
+
+/*
+ * Print a frame as <component id>@<ip>: if the page-table is shared
+ * (by components in a shared address space), the ids of all of its
+ * components are separated with '|', and the address resolves which.
+ * Page-tables we can't resolve are printed as pgtbl<id>.
+ */
+static void
+profiler_frame_print(struct profiler_frame *f, int last)
+{
+	struct profiler_pgtbl *pt = profiler_pgtbl_resolve(f->pgtbl);
+	int                    i;
+
+	if (!pt || !pt->comps[0]) {
+		printc("pgtbl%u", f->pgtbl);
+	} else {
+		for (i = 0; i < PROFILER_NCOMPS && pt->comps[i]; i++) printc("%s%lu", i ? "|" : "", pt->comps[i]);
+	}
+	printc("@0x%lx%s", f->ip, last ? "" : ";");
+}
+
+/* The stacks, outermost frame first, with their counts */
+static void
+profiler_report(struct profiler_core *p, coreid_t cid)
+{
+	struct profiler_stack *s;
+	int                    i, j;
+
+	ps_lock_take(&profiler_lock);
+	for (i = 0; i < PROFILER_NSTACKS; i++) {
+		s = &p->stacks[i];
+		if (s->count == 0) continue;
+
+		printc("profile %u %llu ", cid, s->count);
+		for (j = s->depth - 1; j >= 0; j--) profiler_frame_print(&s->frames[j], j == 0);
+		printc("\n");
+		s->count = 0;
+	}
+	printc("profile_end %u stacks %lu dropped %lu lost %lu\n", cid, p->nstacks, p->dropped, p->lost);
+	ps_lock_release(&profiler_lock);
+	p->nstacks = p->dropped = 0;
+}
+
+void
+parallel_main(coreid_t cid)
+{
+	struct profiler_core *p = &profiler_cores[cid];
+	vaddr_t               ring;
+	cycles_t              report;
+
+	ring = pmu_sample_ring(cid);
+	if (!ring) {
+		printc("profiler: cannot map the trace ring of core %u\n", cid);
+		return;
+	}
+	p->trace = (struct ktrace) { .ring = (struct cos_trace_ring *)ring };
+	/* only the samples recorded from now on */
+	p->trace.tail = ps_load(&p->trace.ring->hdr.head);
+	if (pmu_sample(PROFILER_PERIOD)) {
+		printc("profiler: core %u cannot sample its execution\n", cid);
+		return;
+	}
+
+	report = time_now() + time_usec2cyc(PROFILER_REPORT_USEC);
+	while (1) {
+		sched_thd_block_timeout(0, time_now() + time_usec2cyc(PROFILER_DRAIN_USEC));
+		profiler_drain(p);
+		if (time_now() < report) continue;
+
+		profiler_report(p, cid);
+		report = time_now() + time_usec2cyc(PROFILER_REPORT_USEC);
+	}
+}
+
+void
+cos_init(void)
+{
+	ps_lock_init(&profiler_lock);
+}
@@ -0,0 +1 @@
+#include "../pfprr_quantum_static/init.c"
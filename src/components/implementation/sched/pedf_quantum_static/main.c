@@ -0,0 +1,7 @@
+/***
+ * The `pfprr_quantum_static` scheduler, with the earliest-deadline
+ * first, constant bandwidth server policy (`lib/slm/edf.c`) in place
+ * of fixed-priority round-robin.
+ */
+#define SLM_SCHED_EDF
+#include "../pfprr_quantum_static/main.c"
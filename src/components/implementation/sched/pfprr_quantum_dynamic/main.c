@@ -0,0 +1,8 @@
+/***
+ * The `pfprr_quantum_static` scheduler, with thread memory allocated
+ * from per-core pools that grow from the `memmgr`, and recycle the
+ * memory of exited threads (`thd_dynamic.c`), in place of the static
+ * slab sized for `MAX_NUM_THREADS`.
+ */
+#define SLM_THD_DYNAMIC
+#include "../pfprr_quantum_static/main.c"
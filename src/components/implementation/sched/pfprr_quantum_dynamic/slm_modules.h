@@ -0,0 +1 @@
+#include "../pfprr_quantum_static/slm_modules.h"
@@ -40,6 +40,7 @@
 #include <barrier.h>
 #include <init.h>
 #include <initargs.h>
+#include <capmgr.h>
 
 #include <crt.h>
 
@@ -82,8 +83,8 @@ component_initialize_next(compid_t cid)
 		.init_core = ~0,
 		.initialization_thds = { 0 },
 	};
-	/* By default, lets assume that each component can initialize onto *all* cores */
-	simple_barrier_init(&s->barrier, init_parallelism());
+	/* Each component initializes on all cores, unless it is placed on some */
+	simple_barrier_init(&s->barrier, crt_placement_ncores(cid));
 
 	return;
 }
@@ -185,6 +186,12 @@ init_done(int parallel_init, init_main_t cont)
 	 * already been hit.
 	 */
 	simple_barrier(&s->barrier);
+	/*
+	 * A passive component's threads are all here, and its clients
+	 * aren't initialized yet: its capmgr can checkpoint it to
+	 * restart it from.
+	 */
+	if (cont == INIT_MAIN_NONE && cos_coreid() == s->init_core) capmgr_restart_checkpoint(client);
 	s->status = SCHEDINIT_MAIN;
 
 	s->initialization_thds[cos_coreid()] = slm_thd_current_extern();
@@ -230,11 +237,16 @@ slm_comp_init_loop(void)
 	while (init_schedule_current != ps_load(&init_schedule_off)) {
 		/* Which is the next component to initialize? */
 		compid_t client = init_schedule[init_schedule_current];
+		unsigned int prio = crt_placement_prio(client);
 		struct schedinit_status *n;
 		struct slm_thd *t;
 		sched_param_t param[2];
 
-		param[0] = sched_param_pack(SCHEDP_INIT, 0);
+		init_schedule_current++;
+		/* The component has no thread on this core */
+		if (!crt_placement_oncore(client, cos_coreid())) continue;
+
+		param[0] = prio ? sched_param_pack(SCHEDP_PRIO, prio) : sched_param_pack(SCHEDP_INIT, 0);
 		param[1] = 0;
 
 		/* Create the thread for initialization of the next component */
@@ -243,7 +255,6 @@ slm_comp_init_loop(void)
 		assert(t);
 
 		n = &initialization_state[client];
-		init_schedule_current++;
 
 		if (cos_coreid() == 0)	printc("\tScheduler %ld: initializing component %ld with thread %ld.\n", cos_compid(), client, t->tid);
 		/*
@@ -272,6 +283,7 @@ slm_comp_init_loop(void)
 		compid_t client = init_schedule[i];
 		struct slm_thd *t;
 
+		if (!crt_placement_oncore(client, cos_coreid())) continue;
 		t = initialization_state[client].initialization_thds[cos_coreid()];
 		assert(t != NULL);
 
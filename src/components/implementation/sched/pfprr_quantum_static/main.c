@@ -1,21 +1,33 @@
 #include <cos_component.h>
 #include <llprint.h>
 #include <capmgr.h>
+#include <memmgr.h>
 #include <static_slab.h>
+#include <smr.h>
 #include <ps_list.h>
 #include <ps.h>
 #include <crt.h>
+#include <sched.h>
 
 /***
  * A version of scheduling using a simple periodic timeout,
  * preemptive, fixed priority, round-robin scheduling, and uses the
  * capability manager to allocate threads, with local thread memory
- * tracked in static (allocate-only, finite) memory.
+ * tracked in static (allocate-only, finite) memory, or with
+ * `SLM_THD_DYNAMIC`, in per-core pools (`thd_dynamic.c`).
  */
 
 #include <slm.h>
+#ifdef SLM_TIMER_WHEEL
+#include <wheel.h>
+#else
 #include <quantum.h>
+#endif
+#ifdef SLM_SCHED_EDF
+#include <edf.h>
+#else
 #include <fprr.h>
+#endif
 #include <slm_blkpt.c>
 #include <slm_modules.h>
 
@@ -25,17 +37,53 @@ struct slm_resources_thd {
 	thdcap_t cap;
 	thdid_t  tid;
 	compid_t comp;
+#ifdef SLM_THD_DYNAMIC
+	struct smr_node smr;
+#endif
 };
 
+#ifdef SLM_THD_DYNAMIC
+#define SCHED_THD_MEM dynamic_cm
+#else
+#define SCHED_THD_MEM static_cm
+#endif
+/* Expands the policy names before they are pasted */
+#define SCHED_COMPOSE_FNS(timepol, schedpol, respol) SLM_MODULES_COMPOSE_FNS(timepol, schedpol, respol)
+
 struct slm_thd *slm_thd_static_cm_lookup(thdid_t id);
+struct slm_thd *slm_thd_dynamic_cm_lookup(thdid_t id);
 
 SLM_MODULES_COMPOSE_DATA();
-SLM_MODULES_COMPOSE_FNS(quantum, fprr, static_cm);
+#if defined(SLM_TIMER_WHEEL) && defined(SLM_SCHED_EDF)
+SCHED_COMPOSE_FNS(wheel, edf, SCHED_THD_MEM);
+#elif defined(SLM_TIMER_WHEEL)
+SCHED_COMPOSE_FNS(wheel, fprr, SCHED_THD_MEM);
+#elif defined(SLM_SCHED_EDF)
+SCHED_COMPOSE_FNS(quantum, edf, SCHED_THD_MEM);
+#else
+SCHED_COMPOSE_FNS(quantum, fprr, SCHED_THD_MEM);
+#endif
 
 struct crt_comp self;
 
+/*
+ * The lazy wakeups of the clients (see `sched_thd_wakeup_lazy`), and
+ * the priorities and cores of the threads they use to decide to defer
+ * them. The threads migrated to another core are still woken when the
+ * ring of the core they left is processed, with an IPI.
+ */
+static struct sched_wakeups *wakeups;
+static cbuf_t                wakeups_id;
+
+#ifdef SLM_THD_DYNAMIC
+#include "thd_dynamic.c"
+#else
 SS_STATIC_SLAB(thd, struct slm_thd_container, MAX_NUM_THREADS);
 
+/* The static threads' memory is never reused, so lookups need no protection */
+static inline unsigned long thd_read_enter(void) { return 0; }
+static inline void thd_read_exit(unsigned long tok) { }
+
 /* Implementation for use by the other parts of the slm */
 struct slm_thd *
 slm_thd_static_cm_lookup(thdid_t id)
@@ -85,6 +133,7 @@ slm_thd_mem_alloc(thdcap_t _cap, thdid_t _tid, thdcap_t *thd, thdid_t *tid)
 void slm_thd_mem_activate(struct slm_thd_container *t) { ss_thd_activate(t); }
 /* TODO */
 void slm_thd_mem_free(struct slm_thd_container *t) { return; }
+#endif
 
 thdid_t
 sched_thd_create_closure(thdclosure_index_t idx)
@@ -100,15 +149,19 @@ sched_thd_create_closure(thdclosure_index_t idx)
 int
 sched_thd_param_set(thdid_t tid, sched_param_t p)
 {
+	unsigned long tok = thd_read_enter();
 	struct slm_thd *t = slm_thd_lookup(tid);
 	sched_param_type_t type;
 	unsigned int value;
+	int ret = -1;
 
 	sched_param_get(p, &type, &value);
 
-	if (!t) return -1;
+	if (t) ret = slm_sched_thd_update(t, type, value);
+	if (t && !ret) sched_wakeups_thd_update(t);
+	thd_read_exit(tok);
 
-	return slm_sched_thd_update(t, type, value);
+	return ret;
 }
 
 int
@@ -125,6 +178,8 @@ sched_thd_exit(void)
 
 	slm_cs_enter(current, SLM_CS_NONE);
 	slm_thd_deinit(current);
+	/* Its id could be reused by a thread of another core */
+	if (wakeups && current->tid < MAX_NUM_THREADS) ps_store(&wakeups->thds[current->tid].prio, 0);
 	for (i = 0; slm_cs_exit_reschedule(current, SLM_CS_NONE) && i < 16; i++) ;
 
 	/* If we got here, something went wrong */
@@ -137,14 +192,19 @@ int
 sched_thd_yield_to(thdid_t t)
 {
 	struct slm_thd *current = slm_thd_current();
+	unsigned long tok = thd_read_enter();
 	struct slm_thd *to = slm_thd_lookup(t);
 	int ret;
 
 	assert(to);
-	if (!to) return -1;
+	if (!to) {
+		thd_read_exit(tok);
+		return -1;
+	}
 
 	slm_cs_enter(current, SLM_CS_NONE);
         slm_sched_yield(current, to);
+	thd_read_exit(tok);
 	ret = slm_cs_exit_reschedule(current, SLM_CS_NONE);
 
 	return ret;
@@ -174,12 +234,36 @@ thd_block(void)
 	return ret;
 }
 
+/*
+ * Block, or rather, execute the thread we wait for (`dep_id`) on our
+ * scheduling context if we can: priority inheritance. A wakeup
+ * revokes the dependency (see `slm_thd_wakeup`), and one that races
+ * ahead of us is remembered, so we return immediately.
+ */
 int
 sched_thd_block(thdid_t dep_id)
 {
-	if (dep_id) return -1;
+	struct slm_thd *current = slm_thd_current();
+	struct slm_thd *dep;
+	unsigned long   tok;
+	int             ret;
+
+	if (!dep_id) return thd_block();
+
+	tok = thd_read_enter();
+	dep = slm_thd_lookup(dep_id);
+	slm_cs_enter(current, SLM_CS_NONE);
+	if (dep && !slm_thd_depend(current, dep)) {
+		thd_read_exit(tok);
+
+		return slm_cs_exit_reschedule(current, SLM_CS_NONE);
+	}
+	thd_read_exit(tok);
+	ret = slm_thd_block(current);
+	if (!ret) ret = slm_cs_exit_reschedule(current, SLM_CS_NONE);
+	else      slm_cs_exit(NULL, SLM_CS_NONE);
 
-	return thd_block();
+	return ret;
 }
 
 int
@@ -201,11 +285,14 @@ thd_wakeup(struct slm_thd *t)
 int
 sched_thd_wakeup(thdid_t tid)
 {
-	struct slm_thd *t = slm_thd_lookup(tid);
+	unsigned long   tok = thd_read_enter();
+	struct slm_thd *t   = slm_thd_lookup(tid);
+	int             ret = -1;
 
-	if (!t) return -1;
+	if (t) ret = thd_wakeup(t);
+	thd_read_exit(tok);
 
-	return thd_wakeup(t);
+	return ret;
 }
 
 int
@@ -250,6 +337,35 @@ sched_thd_block_timeout(thdid_t dep_id, cycles_t abs_timeout)
 	return now;
 }
 
+int
+sched_thd_periodic(microsec_t period)
+{
+	struct slm_timer_thd *tt = slm_thd_timer_policy(slm_thd_current());
+
+	if (period == 0) {
+		slm_timer_period_init(&tt->period);
+
+		return 0;
+	}
+	slm_timer_period_set(&tt->period, slm_usec2cyc(period), slm_now());
+
+	return 0;
+}
+
+int
+sched_thd_wait_next_period(void)
+{
+	struct slm_timer_thd *tt = slm_thd_timer_policy(slm_thd_current());
+	unsigned long missed;
+
+	if (!tt->period.period) return -EINVAL;
+	missed = slm_timer_period_next(&tt->period, slm_now());
+	/* Returns only once the release passed */
+	thd_block_until(tt->period.release);
+
+	return (int)missed;
+}
+
 int
 thd_sleep(cycles_t c)
 {
@@ -269,7 +385,15 @@ sched_blkpt_alloc(void)
 int
 sched_blkpt_free(sched_blkpt_id_t id)
 {
-	return slm_blkpt_free(id);
+	struct slm_thd *current = slm_thd_current();
+
+	return slm_blkpt_free(id, current);
+}
+
+void *
+slm_blkpt_mem_alloc(unsigned long npages)
+{
+	return (void *)memmgr_heap_page_allocn(npages);
 }
 
 int
@@ -280,6 +404,14 @@ sched_blkpt_trigger(sched_blkpt_id_t blkpt, sched_blkpt_epoch_t epoch, int singl
 	return slm_blkpt_trigger(blkpt, current, epoch, single);
 }
 
+int
+sched_blkpt_morph(sched_blkpt_id_t from, sched_blkpt_id_t to, sched_blkpt_epoch_t epoch)
+{
+	struct slm_thd *current = slm_thd_current();
+
+	return slm_blkpt_morph(from, to, current, epoch);
+}
+
 int
 sched_blkpt_block(sched_blkpt_id_t blkpt, sched_blkpt_epoch_t epoch, thdid_t dependency)
 {
@@ -288,30 +420,83 @@ sched_blkpt_block(sched_blkpt_id_t blkpt, sched_blkpt_epoch_t epoch, thdid_t dep
 	return slm_blkpt_block(blkpt, current, epoch, dependency);
 }
 
-struct ipc_retvals {
-	int ready;
-	word_t r0, r1;
-};
+/***
+ * Synchronous IPC between threads. Server threads are passive: once
+ * they `reply_wait` on an endpoint, they are blocked in the policies,
+ * and only execute on the scheduling contexts (priority and budget)
+ * of the clients they serve (see `slm_thd_donate`). A call to an
+ * endpoint with a waiting server directly switches to it, and the
+ * reply directly switches back to the client, so neither requires a
+ * scheduling decision. Calls without an available server are queued
+ * in FIFO order, blocking the context the client executes on until a
+ * server takes the call.
+ *
+ * An endpoint belongs to the core of its first server, and its
+ * servers must be on that core, as they are synchronized by its
+ * critical section. Clients on other cores can't donate their
+ * context, so their calls are queued in a ring, and served with the
+ * server's own context. The client spins on its reply's cache line
+ * for a while, then blocks until the server's reply wakes it with an
+ * IPI. Similarly, a server awaiting calls is woken by an IPI.
+ */
 
-struct ipc_ep {
-	struct slm_thd     *client, *server;
-	word_t              a0, a1;
-	struct ipc_retvals *retvals;
+struct ipc_ep;
+
+typedef enum {
+	IPC_X_PENDING = 1,
+	IPC_X_BLOCKED,  /* the client stopped spinning for the reply */
+	IPC_X_REPLIED,
+} ipc_xstate_t;
+
+struct ipc_thd {
+	struct slm_thd *thd;
+	struct ipc_ep  *ep;      /* the endpoint we serve */
+	struct ps_list  list;    /* queue of the endpoint's clients or servers */
+	struct slm_thd *client;  /* the client we're serving... */
+	struct ipc_thd *xclient; /* ...or the client on another core */
+	unsigned int    batch;   /* calls taken since the last scheduling decision */
+	word_t          a0, a1;
+	word_t          r0, r1;
+	int             replied;
+	/* Calls to other cores */
+	unsigned long   xstate;
+	struct slm_thd *xctx;    /* our context, woken by the reply */
+} CACHE_ALIGNED;
+
+struct ipc_xcall {
+	struct ipc_thd *client;
 };
 
-/* For now, mainly a testing feature, thus only one */
-#define IPC_EP_NUM 1 /* MAX_NUM_THREADS */
+CK_RING_PROTOTYPE(ipc_xring, ipc_xcall);
+
+#define IPC_EP_NUM         16 /* must be a power of two */
+#define IPC_XCALL_NUM      64 /* must be a power of two */
+#define IPC_EP_INIT        (~0UL)
+#define IPC_XCORE_SPIN_US  20
 
-struct ipc_ep eps[IPC_EP_NUM];
+struct ipc_ep {
+	unsigned long       core; /* + 1, 0 when no server has registered */
+	struct ps_list_head clients, servers;
+	/* Calls from other cores, and the server they wake */
+	struct slm_thd     *xwaiter;
+	struct ck_ring      xring;
+	struct ipc_xcall    xbuf[IPC_XCALL_NUM];
+} CACHE_ALIGNED;
+
+struct ipc_ep  eps[IPC_EP_NUM];
+struct ipc_thd ipc_thds[MAX_NUM_THREADS];
 
 enum {
 	CNT_C_CALL,
+	CNT_C_QUEUE,
 	CNT_C_LOOP,
-	CNT_C_RET,
+	CNT_C_XCALL,
+	CNT_C_XBLOCK,
 	CNT_S_REPLY,
-	CNT_S_LOOP,
+	CNT_S_BATCH,
+	CNT_S_XCALL,
 	CNT_S_WAIT,
-	CNT_S_RET,
+	CNT_S_LOOP,
 	CNT_MAX
 };
 unsigned long counts[CNT_MAX];
@@ -321,209 +506,489 @@ count_inc(int type)
 	counts[type]++;
 }
 
-cycles_t readings[4];
-struct total {
-	int cnt;
-	int prev_stage_cnt[4];
-	cycles_t tot;
-} totals[4];
+static inline struct ipc_thd *
+ipc_thd(struct slm_thd *t)
+{
+	struct ipc_thd *it = &ipc_thds[t->tid % MAX_NUM_THREADS];
 
-static void
-trace_add(int reading)
+	if (unlikely(it->thd != t)) {
+		*it = (struct ipc_thd) { .thd = t };
+		ps_list_init_d(it);
+	}
+
+	return it;
+}
+
+/* The thread whose scheduling context `t` executes on */
+static inline struct slm_thd *
+ipc_context(struct slm_thd *t)
 {
-	struct total *t = &totals[reading];
-	cycles_t prev_tsc;
-	cycles_t now = ps_tsc();
-	cycles_t max = 0;
-	int i, max_idx;
+	struct ipc_thd *it;
+	int             i;
 
-	/* Avoid this overhead for now! */
-	return;
+	for (i = 0; i < SLM_DONATION_DEPTH; i++) {
+		it = ipc_thd(t);
+		if (!it->client) break;
+		t = it->client;
+	}
 
-	for (i = 0; i < 4; i++) {
-		if (readings[i] > max) {
-			max = readings[i];
-			max_idx = i;
-		}
+	return t;
+}
+
+static inline int
+ipc_xcall_empty(struct ipc_ep *ep)
+{
+	return ck_ring_size(&ep->xring) == 0;
+}
+
+/* Store with a full barrier, as the subsequent loads depend on it being visible */
+static inline void
+ipc_xwaiter_store(struct ipc_ep *ep, struct slm_thd *w)
+{
+	unsigned long old;
+
+	do {
+		old = ps_load((unsigned long *)&ep->xwaiter);
+	} while (!ps_cas((unsigned long *)&ep->xwaiter, old, (unsigned long)w));
+}
+
+/*
+ * Make a waiting server the one that remote calls wake. A call
+ * enqueued before the waiter was visible wakes it here instead.
+ */
+static void
+ipc_xwaiter_update(struct ipc_ep *ep)
+{
+	struct slm_thd *w = NULL;
+
+	if (!ps_list_head_empty(&ep->servers)) w = ps_list_head_first_d(&ep->servers, struct ipc_thd)->thd;
+	ipc_xwaiter_store(ep, w);
+	if (w && !ipc_xcall_empty(ep) && ps_cas((unsigned long *)&ep->xwaiter, (unsigned long)w, 0)) {
+		slm_thd_wakeup(w, 0);
 	}
-	prev_tsc = max;
-	t->prev_stage_cnt[max_idx]++;
+}
 
-	t->cnt++;
-	t->tot += now - prev_tsc;
+static int
+ipc_ep_core_check(struct ipc_ep *ep)
+{
+	unsigned long core = ps_load(&ep->core);
+
+	if (unlikely(core == 0 || core == IPC_EP_INIT)) return -EAGAIN;
+	if (unlikely(core != (unsigned long)cos_cpuid() + 1)) return 1;
 
-	if (t->cnt % 128 == 128 - 1) {
-		int i;
+	return 0;
+}
+
+/*
+ * `s` takes the call from `client`, and executes on its context,
+ * which must be made runnable if it was blocked awaiting a server.
+ */
+static void
+ipc_serve(struct ipc_ep *ep, struct slm_thd *s, struct slm_thd *client)
+{
+	struct ipc_thd *is = ipc_thd(s), *ic = ipc_thd(client);
+	struct slm_thd *ctx;
+
+	ps_list_rem_d(ic);
+	ps_list_rem_d(is);
+	if (unlikely(ps_load((unsigned long *)&ep->xwaiter) == (unsigned long)s)) ipc_xwaiter_update(ep);
+	is->client = client;
+	slm_thd_donate(client, s);
+	ctx = ipc_context(s);
+	if (ctx->state == SLM_THD_BLOCKED) slm_thd_wakeup(ctx, 0);
+}
 
-		for (i = 0; i < 4; i++)	{
-			int cnt = totals[i].cnt;
-			int j;
+/* Take a call from another core, which executes on our own context */
+static int
+ipc_xserve(struct ipc_ep *ep, struct slm_thd *s)
+{
+	struct ipc_thd  *is = ipc_thd(s);
+	struct ipc_xcall xc;
+
+	if (ipc_xcall_empty(ep) || !CK_RING_DEQUEUE_MPSC(ipc_xring, &ep->xring, ep->xbuf, &xc)) return 0;
+	count_inc(CNT_S_XCALL);
+	ps_list_rem_d(is);
+	if (unlikely(ps_load((unsigned long *)&ep->xwaiter) == (unsigned long)s)) ipc_xwaiter_update(ep);
+	is->xclient = xc.client;
+	if (s->state == SLM_THD_BLOCKED) slm_thd_wakeup(s, 0);
+
+	return 1;
+}
+
+/*
+ * Either switch directly to the context, or fall back on a scheduling
+ * decision if that isn't possible. Called in the critical section,
+ * and releases it.
+ */
+static int
+ipc_switch(struct slm_thd *curr, struct slm_thd *ctx)
+{
+	sched_tok_t tok;
+	int         ret;
+
+	if (ctx && slm_state_is_runnable(ctx->state)) {
+		tok = cos_sched_sync();
+		slm_cs_exit(NULL, SLM_CS_NONE);
+		ret = slm_thd_activate(curr, ctx, tok, 0);
+		if (likely(ret == 0)) return 0;
+		if (ret != -EAGAIN) return ret;
+		slm_cs_enter(curr, SLM_CS_NONE);
+	}
 
-			if (cnt == 0) cnt = 1;
-			printc("%d:%llu (", i, totals[i].tot / cnt);
-			for (j = 0; j < 4; j++) {
-				printc("%d:%d%s", j, totals[i].prev_stage_cnt[j], j == 3 ? "" :  ", ");
+	return slm_cs_exit_reschedule(curr, SLM_CS_NONE);
+}
+
+static int
+ipc_xcall(struct ipc_ep *ep, struct slm_thd *t, word_t arg0, word_t arg1, word_t *ret0, word_t *ret1)
+{
+	struct ipc_thd  *it = ipc_thd(t);
+	struct ipc_xcall xc = { .client = it };
+	struct slm_thd  *w;
+	cycles_t         end;
+
+	count_inc(CNT_C_XCALL);
+	it->a0   = arg0;
+	it->a1   = arg1;
+	it->xctx = ipc_context(t);
+	ps_store(&it->xstate, IPC_X_PENDING);
+	if (!CK_RING_ENQUEUE_MPSC(ipc_xring, &ep->xring, ep->xbuf, &xc)) return -EAGAIN;
+
+	/* Wake the server awaiting calls, if there is one */
+	w = (struct slm_thd *)ps_load((unsigned long *)&ep->xwaiter);
+	if (w && ps_cas((unsigned long *)&ep->xwaiter, (unsigned long)w, 0)) slm_thd_wakeup(w, 0);
+
+	/* Most replies are quick: spin on the reply... */
+	end = slm_now() + slm_usec2cyc(IPC_XCORE_SPIN_US);
+	while (ps_load(&it->xstate) == IPC_X_PENDING && cycles_greater_than(end, slm_now())) ;
+	/* ...then block our context until the server's wakeup */
+	if (ps_cas(&it->xstate, IPC_X_PENDING, IPC_X_BLOCKED)) {
+		count_inc(CNT_C_XBLOCK);
+		while (ps_load(&it->xstate) != IPC_X_REPLIED) {
+			slm_cs_enter(t, SLM_CS_NONE);
+			if (it->xctx->state == SLM_THD_RUNNABLE && !slm_thd_block(it->xctx)) {
+				slm_cs_exit_reschedule(t, SLM_CS_NONE);
+			} else {
+				slm_cs_exit(NULL, SLM_CS_NONE);
 			}
-			printc(")\n");
 		}
-		printc("Counts: ");
-		for (i = 0; i < CNT_MAX; i++) {
-			printc("%ld%s", counts[i], i == CNT_MAX - 1 ? "\n\n" : ", ");
-		}
-
-		readings[reading] = ps_tsc();
-	} else {
-		readings[reading] = now;
 	}
+
+	*ret0 = it->r0;
+	*ret1 = it->r1;
+
+	return 0;
 }
 
 int
 syncipc_call(int ipc_ep, word_t arg0, word_t arg1, word_t *ret0, word_t *ret1)
 {
-	struct slm_thd *t = slm_thd_current(), *switchto, *client;
+	struct slm_thd *t = slm_thd_current(), *ctx, *s;
 	/* avoid the conditional for bounds checking, ala Nova */
-	struct ipc_ep *ep = &eps[ipc_ep % IPC_EP_NUM];
-	sched_tok_t   tok;
-	int           ret;
-	struct ipc_retvals retvals = { .ready = 0 };
+	struct ipc_ep  *ep = &eps[ipc_ep & (IPC_EP_NUM - 1)];
+	struct ipc_thd *it, *is;
+	int             ret;
 
 	count_inc(CNT_C_CALL);
 	/* No server thread yet? Nothing to do here. */
-	if (ep->server == NULL) return -EAGAIN;
-	while (1) {
-		tok      = cos_sched_sync();
-		switchto = ps_load(&ep->server);
+	if ((ret = ipc_ep_core_check(ep))) {
+		if (ret < 0) return ret;
 
+		return ipc_xcall(ep, t, arg0, arg1, ret0, ret1);
+	}
 
-		/* Lets try and set ourself as the client communicating with the server! */
-		if (likely(ps_cas((unsigned long *)&ep->client, 0, (unsigned long)t))) {
-			/* We are the serviced client, pass arguments! */
-			ep->a0      = arg0;
-			ep->a1      = arg1;
-			ep->retvals = &retvals;
-			assert(ps_load(&ep->client) == t);
-		}
-		/*
-		 * If another client is already communicating with the
-		 * server, and they haven't yet populated the
-		 * arguments and retvals, let them finish setting up
-		 * their communication.
-		 */
-		client = ps_load(&ep->client);
-		if (unlikely(ep->client != t && ep->retvals == NULL)) switchto = client;
+	slm_cs_enter(t, SLM_CS_NONE);
+	it          = ipc_thd(t);
+	it->a0      = arg0;
+	it->a1      = arg1;
+	it->replied = 0;
+	ctx         = ipc_context(t);
+
+	if (likely(!ps_list_head_empty(&ep->servers))) {
+		/* Switch directly to the server, on our context */
+		is = ps_list_head_first_d(&ep->servers, struct ipc_thd);
+		s  = is->thd;
+		ipc_serve(ep, s, t);
+		ret = ipc_switch(t, ctx);
+	} else {
+		/* Await a server in FIFO order; our context can't execute */
+		count_inc(CNT_C_QUEUE);
+		ps_list_head_append_d(&ep->clients, it);
+		if (ctx->state == SLM_THD_RUNNABLE) slm_thd_block(ctx);
+		ret = slm_cs_exit_reschedule(t, SLM_CS_NONE);
+	}
 
-		/*
-		 * If we are the client, then we're activating the
-		 * server here. If another client exists, we're
-		 * generally just performing priority inheritance
-		 * here.
-		 */
-		trace_add(0);
-		ret = slm_switch_to(t, switchto, tok, 1);
-		trace_add(3);
+	/* Wakeups while queued, or dispatches before the reply, retry */
+	while (!ps_load(&it->replied)) {
+		if (ret && ret != -EAGAIN && ret != -EBUSY) return ret;
 		count_inc(CNT_C_LOOP);
-		/*
-		 * Iterate while we are not the serviced client, we
-		 * have a stale scheduling token...
-		 */
-		if (unlikely(ret)) {
-			if (ret != -EAGAIN) return ret;
-			if (ret == EAGAIN) continue;
-		}
-
-		/* ...or the server hasn't provided a response. */
-		if (likely(ps_load(&retvals.ready))) break;
+		slm_cs_enter(t, SLM_CS_NONE);
+		if (!ps_list_singleton_d(it) && ctx->state == SLM_THD_RUNNABLE) slm_thd_block(ctx);
+		ret = slm_cs_exit_reschedule(t, SLM_CS_NONE);
 	}
 
-	count_inc(CNT_C_RET);
-	*ret0 = ps_load(&retvals.r0);
-	*ret1 = ps_load(&retvals.r1);
+	*ret0 = it->r0;
+	*ret1 = it->r1;
 
 	return 0;
 }
 
-int
-syncipc_reply_wait(int ipc_ep, word_t arg0, word_t arg1, word_t *ret0, word_t *ret1)
+/*
+ * Reply to the client `s` is serving, and take the next call. Up to
+ * `batch` queued calls are taken without a scheduling decision, while
+ * they are at least as important as the one replied to.
+ */
+static int
+ipc_reply_wait(int ipc_ep, word_t arg0, word_t arg1, unsigned int batch, word_t *ret0, word_t *ret1)
 {
-	struct slm_thd *t = slm_thd_current(), *client;
+	struct slm_thd *s = slm_thd_current(), *client, *next, *ctx = NULL;
 	/* avoid the conditional for bounds checking, ala Nova */
-	struct ipc_ep *ep = &eps[ipc_ep % IPC_EP_NUM];
-	sched_tok_t   tok;
-	int           ret;
+	struct ipc_ep  *ep = &eps[ipc_ep & (IPC_EP_NUM - 1)];
+	struct ipc_thd *is, *ic;
+	int             ret;
+
+	slm_cs_enter(s, SLM_CS_NONE);
+	is = ipc_thd(s);
 
 	/*
-	 * Phase 1: An EP is associated with a specific server. This
-	 * conditional is formulated to move the cas and awaiting the
-	 * first client off the fast-path.
+	 * Phase 1: Register as a server of the endpoint. From here, we
+	 * only execute on our clients' contexts.
 	 */
-	if (unlikely(ep->server != t)) {
-		/* Another server claimed the endpoint */
-		if (ep->server != NULL)         return -1;
-		if (!ps_cas((unsigned long *)&ep->server, 0, (unsigned long)t)) return -1;
-		ret = slm_sched_thd_update(t, SCHEDP_INIT, 0);
-		assert(ret == 0);
-		assert(ep->server == t);
-
-		/* Now await the first client spinning at idle prio! */
-		while (ps_load(&ep->client) == NULL) ;
-		*ret0 = ep->a0;
-		*ret1 = ep->a1;
-
-		return 0;
+	if (unlikely(is->ep != ep)) {
+		unsigned long core = (unsigned long)cos_cpuid() + 1;
+
+		if (is->ep) goto einval;
+		/* The first server initializes the endpoint on its core */
+		if (ps_cas(&ep->core, 0, IPC_EP_INIT)) {
+			ps_list_head_init(&ep->clients);
+			ps_list_head_init(&ep->servers);
+			ck_ring_init(&ep->xring, IPC_XCALL_NUM);
+			ps_store(&ep->core, core);
+		} else if (ps_load(&ep->core) != core) {
+			goto einval;
+		}
+		is->ep = ep;
+		slm_thd_block(s);
 	}
 
-	count_inc(CNT_S_REPLY);
-
 	/*
-	 * Phase 2: Reply to the client we are currently servicing!
+	 * Phase 2: Reply to the client we are currently servicing,
+	 * whose context is no longer donated to us.
 	 */
-	client             = ps_load(&ep->client);
-	ep->retvals->r0    = arg0;
-	ep->retvals->r1    = arg1;
-	/* Make sure to set this *last*. */
-	ep->retvals->ready = 1;
-	/*
-	 * Reset the endpoint, so that the next client can make a
-	 * request. As the client variable is the sync point, we have
-	 * to write it last.
-	 */
-	ep->retvals       = NULL;
-	ep->client        = NULL;
+	client = is->client;
+	if (likely(client)) {
+		count_inc(CNT_S_REPLY);
+		ic          = ipc_thd(client);
+		ic->r0      = arg0;
+		ic->r1      = arg1;
+		ic->replied = 1;
+		is->client  = NULL;
+		slm_thd_donate(client, NULL);
+		ctx = ipc_context(client);
+	} else if (is->xclient) {
+		count_inc(CNT_S_REPLY);
+		ic          = is->xclient;
+		ic->r0      = arg0;
+		ic->r1      = arg1;
+		is->xclient = NULL;
+		/* The client stopped spinning, and blocked */
+		if (!ps_cas(&ic->xstate, IPC_X_PENDING, IPC_X_REPLIED)) {
+			ps_store(&ic->xstate, IPC_X_REPLIED);
+			slm_thd_wakeup(ic->xctx, 0);
+		}
+	}
 
-	do {
+	while (1) {
 		/*
-		 * Switch back to the client!
-		 *
-		 * TODO: We should add a bit that designates if there
-		 * is *contention* on the server thread, and if it is
-		 * set, instead call `slm_exit_reschedule` here to
-		 * instead run the highest-priority client.
+		 * Phase 3: Take the next call...
 		 */
-		trace_add(2);
-		ret = slm_switch_to(t, client, cos_sched_sync(), 1);
-		trace_add(1);
-		if (unlikely(ret) && ret != -EAGAIN) return ret;
+		if (!ps_list_head_empty(&ep->clients)) {
+			ic   = ps_list_head_first_d(&ep->clients, struct ipc_thd);
+			next = ic->thd;
+			/* ...on the client's context, not the one a remote call woke */
+			if (s->state == SLM_THD_RUNNABLE) slm_thd_block(s);
+			ipc_serve(ep, s, next);
+			if (client && is->batch < batch && ipc_context(next)->priority <= ctx->priority) {
+				count_inc(CNT_S_BATCH);
+				is->batch++;
+				slm_cs_exit(NULL, SLM_CS_NONE);
+				break;
+			}
+			/* Let the scheduler choose between the replied to, and the next, clients */
+			ctx = NULL;
+		} else if (ipc_xserve(ep, s)) {
+			/* ...from another core, on our own context... */
+			if (!ctx) {
+				slm_cs_exit(NULL, SLM_CS_NONE);
+				break;
+			}
+			ctx = NULL;
+		} else {
+			/* ...or await it. */
+			count_inc(CNT_S_WAIT);
+			if (s->state == SLM_THD_RUNNABLE) slm_thd_block(s);
+			if (ps_list_singleton_d(is)) ps_list_head_append_d(&ep->servers, is);
+			ipc_xwaiter_update(ep);
+		}
+		is->batch = 0;
+		ret = ipc_switch(s, ctx);
+		ctx = NULL;
+
+		/* We only execute again as a client's context is dispatched, or a remote call wakes us */
+		if (is->client || is->xclient) break;
+		if (ret && ret != -EAGAIN && ret != -EBUSY) return ret;
 		count_inc(CNT_S_LOOP);
-	} while (ret == -EAGAIN);
+		client = NULL;
+		slm_cs_enter(s, SLM_CS_NONE);
+	}
 
-	count_inc(CNT_S_WAIT);
-	/*
-	 * Phase 3: Now await the next call! We spin as we're idle
-	 * priority.
-	 */
-	while (ps_load(&ep->client) == NULL) ;
+	ic    = is->client ? ipc_thd(is->client) : is->xclient;
+	*ret0 = ic->a0;
+	*ret1 = ic->a1;
+
+	return 0;
+einval:
+	slm_cs_exit(NULL, SLM_CS_NONE);
+
+	return -EINVAL;
+}
+
+int
+syncipc_reply_wait(int ipc_ep, word_t arg0, word_t arg1, word_t *ret0, word_t *ret1)
+{
+	return ipc_reply_wait(ipc_ep, arg0, arg1, 0, ret0, ret1);
+}
+
+int
+syncipc_reply_wait_batch(int ipc_ep, word_t arg0, word_t arg1, unsigned int batch, word_t *ret0, word_t *ret1)
+{
+	return ipc_reply_wait(ipc_ep, arg0, arg1, batch, ret0, ret1);
+}
+
+int
+sched_thd_running(thdid_t tid)
+{
+	return slm_thd_running(tid);
+}
+
+cbuf_t
+sched_wakeups_shared(void)
+{
+	return wakeups_id;
+}
+
+void
+sched_wakeups_thd_update(struct slm_thd *t)
+{
+	if (!wakeups || t->tid >= MAX_NUM_THREADS) return;
+
+	ps_store(&wakeups->thds[t->tid].core, t->cpuid);
+	ps_store(&wakeups->thds[t->tid].prio, t->priority);
+}
+
+/* Wake the threads deferred on this core, before the scheduling decision */
+void
+slm_deferred_process(void)
+{
+	struct sched_wakeups_core *c;
+	struct slm_thd            *t;
+	unsigned long              tid, tok;
+	int                        i;
+
+	if (!wakeups) return;
+	c = &wakeups->cores[cos_cpuid()];
+	if (likely(!ps_load(&c->nwoken))) return;
+
+	tok = thd_read_enter();
+	for (i = 0; i < SCHED_WAKEUPS_SLOTS; i++) {
+		tid = ps_load(&c->woken[i]);
+		if (!tid || !ps_cas(&c->woken[i], tid, 0)) continue;
+		/* Might transiently underflow, if the waker hasn't yet counted it */
+		ps_faa(&c->nwoken, -1);
+
+		t = slm_thd_lookup(tid);
+		if (t && slm_thd_normal(t) && !slm_state_is_dead(t->state)) slm_thd_wakeup(t, 0);
+	}
+	thd_read_exit(tok);
+}
+
+COS_STATIC_ASSERT(SCHED_HIST_BUCKETS == SLM_HIST_BUCKETS, "sched and slm histograms must have the same buckets");
+
+/* The client buffer each core last copied histograms into */
+struct hist_buf {
+	cbuf_t             id;
+	struct sched_hist *h;
+} CACHE_ALIGNED;
+
+static struct hist_buf hist_bufs[NUM_CPU];
+
+int
+sched_thd_hist(thdid_t tid, cbuf_t buf)
+{
+	struct slm_thd  *current = slm_thd_current();
+	struct hist_buf *b       = &hist_bufs[cos_cpuid()];
+	struct slm_thd  *t;
+	struct slm_hist  h;
+	vaddr_t          addr = 0;
+	int              mapped, ret;
+
+	if (tid >= MAX_NUM_THREADS) return -EINVAL;
+	t = slm_thd_lookup(tid);
+	if (!t) return -EINVAL;
+
+	/* Map a new buffer outside of the critical section */
+	slm_cs_enter(current, SLM_CS_NONE);
+	mapped = b->h && b->id == buf;
+	slm_cs_exit(current, SLM_CS_NONE);
+	if (!mapped && memmgr_shared_page_map(buf, &addr) == 0) return -EINVAL;
+
+	slm_cs_enter(current, SLM_CS_NONE);
+	if (addr) *b = (struct hist_buf) { .id = buf, .h = (struct sched_hist *)addr };
+	ret = slm_thd_hist(t, &h);
+	if (!ret) {
+		memcpy(b->h->wait, h.wait, sizeof(h.wait));
+		memcpy(b->h->run, h.run, sizeof(h.run));
+	}
+	slm_cs_exit(current, SLM_CS_NONE);
+
+	return ret;
+}
+
+static const char *trace_names[SLM_TRACE_NTYPES] = {
+	[SLM_TRACE_SWITCH]        = "switch",
+	[SLM_TRACE_BLOCK]         = "block",
+	[SLM_TRACE_WAKEUP]        = "wakeup",
+	[SLM_TRACE_WAKEUP_REMOTE] = "wakeup_remote",
+	[SLM_TRACE_DEPEND]        = "depend",
+	[SLM_TRACE_BLKPT_BLOCK]   = "blkpt_block",
+	[SLM_TRACE_BLKPT_TRIGGER] = "blkpt_trigger",
+};
+
+int
+sched_trace_print(void)
+{
+	struct slm_thd      *current = slm_thd_current();
+	struct cos_trace_evt evts[32];
+	unsigned long        lost = 0;
+	int                  n, i, total = 0;
+
+	printc("slmtrace %u cyc_per_usec %lu\n", cos_cpuid(), slm_get_cycs_per_usec());
 	/*
-	 * FIXME: If we are repriorized at higher than the client, we
-	 * might preempt it after it sets ->client, but before it sets
-	 * the arguments. The *correct* design is to create a PASSIVE
-	 * priority in which threads only execute using explicit
-	 * switches from other, properly prioritized threads. Such
-	 * threads could *not* reprioritize.
+	 * Print outside of the critical section, a batch at a time, and
+	 * at most a ring's worth, as printing can itself add events.
 	 */
-	*ret0 = ep->a0;
-	*ret1 = ep->a1;
+	do {
+		slm_cs_enter(current, SLM_CS_NONE);
+		n = slm_trace_drain(evts, 32, &lost);
+		slm_cs_exit(current, SLM_CS_NONE);
+		if (n < 0) return n;
 
-	count_inc(CNT_S_RET);
+		for (i = 0; i < n; i++) {
+			printc("slmtrace %u %llu %s %u %u\n", cos_cpuid(), evts[i].tsc,
+			       evts[i].type < SLM_TRACE_NTYPES ? trace_names[evts[i].type] : "?", evts[i].thd, evts[i].arg);
+		}
+		total += n;
+	} while (n > 0 && total < SLM_TRACE_NEVTS);
+	if (lost) printc("slmtrace %u lost %lu\n", cos_cpuid(), lost);
 
 	return 0;
 }
@@ -586,6 +1051,7 @@ slm_ipi_process(void *d)
 	struct slm_ipi_event    event    = { 0 };
 	struct slm_thd         *current  = slm_thd_current();
 	struct slm_thd         *thd;
+	unsigned long           tok;
 
 	while (1) {
 		cos_rcv(r->rcv, RCV_ALL_PENDING, &rcvd);
@@ -593,8 +1059,15 @@ slm_ipi_process(void *d)
 		while (!slm_ipi_event_empty(cos_cpuid())) {
 			slm_ipi_event_dequeue(&event, cos_cpuid());
 
-			thd = slm_thd_static_cm_lookup(event.tid);
+			tok = thd_read_enter();
+			thd = slm_thd_lookup(event.tid);
 			slm_cs_enter(current, SLM_CS_NONE);
+			thd_read_exit(tok);
+			if (event.type == SLM_IPI_MIGRATE) {
+				slm_thd_migrate_in(thd);
+				slm_cs_exit(current, SLM_CS_NONE);
+				continue;
+			}
 			ret = slm_thd_wakeup(thd, 0);
 			/*
 			 * Return "0" means the thread is woken up in this call.
@@ -634,6 +1107,8 @@ cos_parallel_init(coreid_t cid, int init_core, int ncores)
 	t = slm_thd_alloc(slm_idle, NULL, &thdcap, &tid);
 	if (!t) BUG();
 
+	/* The core is dedicated to a component's thread: no ticks */
+	if (crt_placement_dedicated(cid)) slm_tickless_set();
 	slm_init(thdcap, tid);
 
 	r = slm_ipithd_create(slm_ipi_process, NULL, 0, &ipithdcap, &ipitid);
@@ -651,4 +1126,8 @@ cos_init(void)
 	extern void calculate_initialization_schedule(void);
 	calculate_initialization_schedule();
 	cos_defcompinfo_init();
+
+	/* Without it, the clients' lazy wakeups are all immediate */
+	wakeups_id = memmgr_shared_page_allocn(round_up_to_page(sizeof(struct sched_wakeups)) / PAGE_SIZE, (vaddr_t *)&wakeups);
+	if (!wakeups_id) wakeups = NULL;
 }
@@ -16,5 +16,8 @@ struct slm_thd_container *slm_thd_alloc_in(compid_t cid, thdclosure_index_t idx,
 struct slm_thd *thd_alloc(thd_fn_t fn, void *data, sched_param_t *parameters, int reschedule);
 struct slm_thd *thd_alloc_in(compid_t id, thdclosure_index_t idx, sched_param_t *parameters, int reschedule);
 
+/* Publish the priority and core of the thread, for the clients' lazy wakeups */
+void sched_wakeups_thd_update(struct slm_thd *t);
+
 
 #endif	/* SLM_MODULES_H */
@@ -66,6 +66,7 @@ thd_alloc(thd_fn_t fn, void *data, sched_param_t *parameters, int reschedule)
 		if (slm_sched_thd_update(thd, type, value)) ERR_THROW(NULL, free);
 	}
 	slm_thd_mem_activate(t);
+	sched_wakeups_thd_update(thd);
 
 	if (reschedule) {
 		if (slm_cs_exit_reschedule(current, SLM_CS_NONE)) ERR_THROW(NULL, free);
@@ -116,6 +117,7 @@ thd_alloc_in(compid_t id, thdclosure_index_t idx, sched_param_t *parameters, int
 		if (slm_sched_thd_update(thd, type, value)) ERR_THROW(NULL, free);
 	}
 	slm_thd_mem_activate(t);
+	sched_wakeups_thd_update(thd);
 
 	if (reschedule) {
 		if (slm_cs_exit_reschedule(current, SLM_CS_NONE)) ERR_THROW(NULL, done);
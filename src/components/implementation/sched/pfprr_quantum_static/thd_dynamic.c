@@ -0,0 +1,246 @@
+/***
+ * Dynamically allocated thread memory, used in place of the static
+ * slab when compiled with `SLM_THD_DYNAMIC`. Each core has a pool of
+ * thread containers that grows by pages from the `memmgr`, and to
+ * which the containers of exited threads are returned once the slm
+ * has reaped them (see `slm_thd_reap`). Threads are found from their
+ * tids through a two-level map whose leaves are only allocated for
+ * the ranges of tids in use, so sparse tids don't require a table
+ * sized for the largest.
+ *
+ * The pools are only accessed in the core's critical section, except
+ * before `slm_init` on the core, when only the initialization thread
+ * executes there.
+ *
+ * This is included by `main.c`, so it is empty when compiled on its
+ * own (as are all `.c` files of the component).
+ */
+
+#ifdef SLM_THD_DYNAMIC
+
+#define THD_MAP_BITS      16
+#define THD_MAP_MAX       (1UL << THD_MAP_BITS)
+#define THD_MAP_LEAF_BITS 9
+#define THD_MAP_LEAF_NUM  (1UL << THD_MAP_LEAF_BITS)
+#define THD_MAP_LEAF_MASK (THD_MAP_LEAF_NUM - 1)
+#define THD_MAP_TOP_NUM   (THD_MAP_MAX >> THD_MAP_LEAF_BITS)
+#define THD_MAP_LEAF_SZ   (THD_MAP_LEAF_NUM * sizeof(struct slm_thd *))
+
+/* The pages to grow a pool by, to hold at least one container */
+#define THD_POOL_GROW_PAGES (round_up_to_page(sizeof(struct slm_thd_container)) / PAGE_SIZE)
+
+struct thd_pool {
+	/* Free containers are linked through their (unused) graveyard list */
+	struct ps_list_head free;
+	struct smr_retired  retired;
+	int                 init;
+} CACHE_ALIGNED;
+
+static struct thd_pool  thd_pools[NUM_CPU];
+static struct slm_thd **thd_map[THD_MAP_TOP_NUM];
+static struct smr       thd_smr;
+
+static inline unsigned long
+thd_read_enter(void)
+{
+	return smr_enter(&thd_smr);
+}
+
+static inline void
+thd_read_exit(unsigned long tok)
+{
+	smr_exit(&thd_smr, tok);
+}
+
+struct slm_thd *
+slm_thd_dynamic_cm_lookup(thdid_t id)
+{
+	struct slm_thd **leaf;
+
+	if (id >= THD_MAP_MAX) return NULL;
+	leaf = (struct slm_thd **)ps_load((unsigned long *)&thd_map[id >> THD_MAP_LEAF_BITS]);
+	if (!leaf) return NULL;
+
+	return leaf[id & THD_MAP_LEAF_MASK];
+}
+
+static inline struct slm_thd *
+slm_thd_current(void)
+{
+	return slm_thd_dynamic_cm_lookup(cos_thdid());
+}
+
+struct slm_thd *
+slm_thd_current_extern(void)
+{
+	return slm_thd_current();
+}
+
+struct slm_thd *
+slm_thd_from_container(struct slm_thd_container *c) {
+	return &c->thd;
+}
+
+static inline void
+thd_map_set(thdid_t id, struct slm_thd *t)
+{
+	struct slm_thd **leaf = thd_map[id >> THD_MAP_LEAF_BITS];
+
+	assert(leaf);
+	/* the thread must be initialized before it can be found */
+	ps_mem_fence();
+	leaf[id & THD_MAP_LEAF_MASK] = t;
+}
+
+/* Make sure that the map has the leaf for `id` */
+static int
+thd_map_expand(thdid_t id)
+{
+	struct slm_thd ***top = &thd_map[id >> THD_MAP_LEAF_BITS];
+	vaddr_t           leaf;
+
+	if (ps_load((unsigned long *)top)) return 0;
+	leaf = memmgr_heap_page_allocn(round_up_to_page(THD_MAP_LEAF_SZ) / PAGE_SIZE);
+	if (!leaf) return -ENOMEM;
+	memset((void *)leaf, 0, THD_MAP_LEAF_SZ);
+	/* If another core added the leaf first, we lose its (single) page */
+	ps_cas((unsigned long *)top, 0, (unsigned long)leaf);
+
+	return 0;
+}
+
+/* The thread to take the critical section with, or NULL before `slm_init` */
+static struct slm_thd *
+thd_pool_cs_thd(void)
+{
+	struct slm_thd *current = slm_thd_current();
+
+	if (!current) current = slm_thd_special();
+
+	return current;
+}
+
+static struct thd_pool *
+thd_pool(void)
+{
+	struct thd_pool *p = &thd_pools[cos_cpuid()];
+
+	if (unlikely(!p->init)) {
+		ps_list_head_init(&p->free);
+		p->init = 1;
+	}
+
+	return p;
+}
+
+static void
+thd_pool_put(struct slm_thd_container *c)
+{
+	ps_list_head_append(&thd_pool()->free, &c->thd, graveyard_list);
+}
+
+static struct slm_thd_container *
+thd_pool_get(void)
+{
+	struct thd_pool *p = thd_pool();
+	struct slm_thd  *t;
+
+	if (ps_list_head_empty(&p->free)) return NULL;
+	t = ps_list_head_first(&p->free, struct slm_thd, graveyard_list);
+	ps_list_rem(t, graveyard_list);
+
+	return ps_container(t, struct slm_thd_container, thd);
+}
+
+static void
+thd_pool_reclaim(struct smr_node *n)
+{
+	struct slm_resources_thd *r = ps_container(n, struct slm_resources_thd, smr);
+
+	thd_pool_put(ps_container(r, struct slm_thd_container, resources));
+}
+
+/*
+ * Reaped threads are unmapped, so that kernel events for them are
+ * ignored, and reused once no lookup can still use them.
+ */
+static void
+thd_pool_reap(struct slm_thd *t)
+{
+	struct slm_thd_container *c = ps_container(t, struct slm_thd_container, thd);
+
+	thd_map_set(t->tid, NULL);
+	smr_retire(&thd_smr, &thd_pool()->retired, &c->resources.smr, thd_pool_reclaim);
+}
+
+static int
+thd_pool_grow(struct slm_thd *current)
+{
+	unsigned long             n = THD_POOL_GROW_PAGES * PAGE_SIZE / sizeof(struct slm_thd_container);
+	struct slm_thd_container *cs;
+	unsigned long             i;
+
+	cs = (struct slm_thd_container *)memmgr_heap_page_allocn(THD_POOL_GROW_PAGES);
+	if (!cs) return -ENOMEM;
+
+	if (current) slm_cs_enter(current, SLM_CS_NONE);
+	for (i = 0; i < n; i++) {
+		ps_list_init(&cs[i].thd, graveyard_list);
+		thd_pool_put(&cs[i]);
+	}
+	if (current) slm_cs_exit(current, SLM_CS_NONE);
+
+	return 0;
+}
+
+struct slm_thd_container *
+slm_thd_mem_alloc(thdcap_t _cap, thdid_t _tid, thdcap_t *thd, thdid_t *tid)
+{
+	struct slm_thd           *current = thd_pool_cs_thd();
+	struct slm_thd_container *t;
+
+	assert(_cap != 0 && _tid != 0);
+	if (_tid >= THD_MAP_MAX || thd_map_expand(_tid)) return NULL;
+
+	while (1) {
+		if (current) {
+			slm_cs_enter(current, SLM_CS_NONE);
+			slm_thd_reap(thd_pool_reap);
+			smr_poll(&thd_smr, &thd_pool()->retired, thd_pool_reclaim);
+		}
+		t = thd_pool_get();
+		if (current) slm_cs_exit(current, SLM_CS_NONE);
+		if (t) break;
+
+		if (thd_pool_grow(current)) return NULL;
+	}
+
+	memset(t, 0, sizeof(struct slm_thd_container));
+	t->resources = (struct slm_resources_thd) {
+		.cap  = _cap,
+		.tid  = _tid,
+		.comp = cos_compid()
+	};
+
+	*thd = _cap;
+	*tid = _tid;
+
+	return t;
+}
+
+void slm_thd_mem_activate(struct slm_thd_container *t) { thd_map_set(t->resources.tid, &t->thd); }
+
+/*
+ * Free a container that was never activated. Activated threads are
+ * only freed by exiting. Called in the critical section, or before
+ * `slm_init`.
+ */
+void
+slm_thd_mem_free(struct slm_thd_container *t)
+{
+	if (slm_thd_dynamic_cm_lookup(t->resources.tid) == &t->thd) return;
+	ps_list_init(&t->thd, graveyard_list);
+	thd_pool_put(t);
+}
+
+#endif /* SLM_THD_DYNAMIC */
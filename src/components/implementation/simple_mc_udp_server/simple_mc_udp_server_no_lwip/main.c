@@ -2,183 +2,73 @@
 #include <string.h>
 #include <arpa/inet.h>
 #include <mc.h>
-#include <simple_udp_stack.h>
+#include <netrtc.h>
 #include <netshmem.h>
 #include <sched.h>
 
-static int fd;
-static volatile thdid_t init_thd = 0;
+/* The connection to memcached of each core, and the descriptors of its batches */
+struct mc_server_core {
+	int                 fd;
+	struct mc_req_desc *reqs;
+	shm_bm_objid_t      reqs_id;
+};
 
+static struct mc_server_core cores[NUM_CPU];
+
+/*
+ * Each instance is usually placed on a single core by the composition
+ * (`cores`), but each of its cores has its own shmem and connection.
+ */
 void
-cos_init(void)
+cos_parallel_init(coreid_t cid, int init_core, int ncores)
 {
-	shm_bm_objid_t objid;
-	struct netshmem_pkt_buf *obj;
-	init_thd = cos_thdid();
-	/* create current component's shmem */
-	netshmem_create();
+	struct mc_server_core *c = &cores[cid];
+
+	netrtc_thd_init();
+	mc_map_shmem(netshmem_get_shm_id());
+	c->fd = mc_conn_init(MC_UDP_PROTO);
+	assert(c->fd);
+
+	/* The descriptors of the batches of requests given to memcached */
+	assert(NETRTC_BATCH <= MC_BATCH_MAX);
+	c->reqs = (struct mc_req_desc *)netshmem_pkt_buf_alloc(&c->reqs_id);
+	assert(c->reqs);
+
+	printc("mc server init done, got a fd: %d\n", c->fd);
 }
-void
-cos_parallel_init(coreid_t cid, int init_core, int ncores)
+
+/* Process the batch of commands, the replies written over them */
+static void
+mc_batch(struct udp_stack_pkt *pkts, char **data, int n, void *arg)
 {
-	if (cid == 0) {
-		return;
-	}
+	struct mc_server_core *c = arg;
+	int                    i, ret;
 
-	if (cos_compid() == 6 && cid != 1) {
-		return;
-	}
-	if (cos_compid() == 7 && cid != 2) {
-		return;
-	}
-	if (cos_compid() == 8 && cid != 3) {
-		return;
-	}
-	if (cos_compid() == 9 && cid != 4) {
-		return;
-	}
-	if (cos_compid() == 10 && cid != 5) {
-		return;
-	}
-	if (cos_compid() == 11 && cid != 6) {
-		return;
-	}
-	if (cos_compid() == 12 && cid != 7) {
-		return;
-	}
-	if (cos_compid() == 13 && cid != 8) {
-		return;
-	}
-	if (cos_compid() == 14 && cid != 9) {
-		return;
-	}
-	if (cos_compid() == 15 && cid != 10) {
-		return;
-	}
-	if (cos_compid() == 16 && cid != 11) {
-		return;
-	}
-	if (cos_compid() == 17 && cid != 12) {
-		return;
-	}
-	if (cos_compid() == 18 && cid != 13) {
-		return;
-	}
-	if (cos_compid() == 19 && cid != 14) {
-		return;
-	}
-	if (cos_compid() == 20 && cid != 15) {
-		return;
-	}
-	if (cos_compid() == 21 && cid != 16) {
-		return;
+	for (i = 0; i < n; i++) {
+		c->reqs[i] = (struct mc_req_desc) {
+			.objid = pkts[i].objid, .data_offset = pkts[i].data_offset, .data_len = pkts[i].data_len
+		};
 	}
+	ret = mc_process_commands(c->fd, c->reqs_id, n);
+	assert(ret == n);
 
-	if (init_thd != cos_thdid()) {
-		netshemem_move(init_thd, cos_thdid());
+	/* No reply (a data_len of 0), e.g. if it doesn't fit in the buffer */
+	for (i = 0; i < n; i++) {
+		pkts[i].data_offset = c->reqs[i].data_offset;
+		pkts[i].data_len    = c->reqs[i].data_len;
 	}
-	udp_stack_shmem_map(netshmem_get_shm_id());
-	mc_map_shmem(netshmem_get_shm_id());
-	fd = mc_conn_init(MC_UDP_PROTO);
-	assert(fd);
-
-	printc("mc server init done, got a fd: %d\n", fd);
 }
 
 int
 parallel_main(coreid_t cid)
 {
-	if (cid == 0) {
-		return 0;
-	}
-	if (cos_compid() == 6 && cid != 1) {
-		return 0;
-	}
-	if (cos_compid() == 7 && cid != 2) {
-		return 0;
-	}
-	if (cos_compid() == 8 && cid != 3) {
-		return 0;
-	}
-	if (cos_compid() == 9 && cid != 4) {
-		return 0;
-	}
-	if (cos_compid() == 10 && cid != 5) {
-		return 0;
-	}
-	if (cos_compid() == 11 && cid != 6) {
-		return 0;
-	}
-	if (cos_compid() == 12 && cid != 7) {
-		return 0;
-	}
-	if (cos_compid() == 13 && cid != 8) {
-		return 0;
-	}
-	if (cos_compid() == 14 && cid != 9) {
-		return 0;
-	}
-	if (cos_compid() == 15 && cid != 10) {
-		return 0;
-	}
-	if (cos_compid() == 16 && cid != 11) {
-		return 0;
-	}
-	if (cos_compid() == 17 && cid != 12) {
-		return 0;
-	}
-	if (cos_compid() == 18 && cid != 13) {
-		return 0;
-	}
-	if (cos_compid() == 19 && cid != 14) {
-		return 0;
-	}
-	if (cos_compid() == 20 && cid != 15) {
-		return 0;
-	}
-	if (cos_compid() == 21 && cid != 16) {
-		return 0;
-	}
-	int ret;
-	u32_t ip;
-	compid_t compid;
-	u16_t port;
-	shm_bm_objid_t objid;
-	struct netshmem_pkt_buf *rx_obj;
-	struct netshmem_pkt_buf *tx_obj;
-	char *data;
-	u16_t data_offset, data_len;
-	u16_t remote_port;
-	u32_t remote_addr;
-
-	ret = 0;
-	ip = inet_addr("10.10.1.2");
-	compid = cos_compid();
+	compid_t compid = cos_compid();
 
 	/* we use comp id as UDP port, representing tenant id */
 	assert(compid < (1 << 16));
-	port	= (u16_t)compid;
+	printc("tenant id:%d\n", (u16_t)compid);
 
-	printc("tenant id:%d\n", port);
-	ret = udp_stack_udp_bind(ip, port);
-	assert(ret == 0);
-	objid = 0;
-	remote_addr = inet_addr("10.10.1.1");
-	remote_port = 6;
-	cycles_t    before, after;
-	
-	while (1)
-	{
-		objid  = udp_stack_shmem_read(&data_offset, &data_len, &remote_addr, &remote_port);
+	netrtc_run(inet_addr("10.10.1.2"), (u16_t)compid, mc_batch, &cores[cid]);
 
-		/* application would like to own the shmem because it does not want ohters to free it. */
-		rx_obj = shm_bm_borrow_net_pkt_buf(netshmem_get_shm(), objid);
-		if (unlikely(data_len == 0)) {
-			//invalid packet, drop it
-			shm_bm_free_net_pkt_buf(rx_obj);
-			continue;
-		}
-		data_len = mc_process_command(fd, objid, data_offset, data_len);
-		udp_stack_shmem_write(objid, netshmem_get_data_offset(), data_len, remote_addr, remote_port);
-	}
+	return 0;
 }
@@ -63,6 +63,6 @@ parallel_main(coreid_t cid)
 		data_len = mc_process_command(fd, objid, data_offset, data_len);
 		netmgr_udp_shmem_write(objid, netshmem_get_data_offset(), data_len, remote_addr, remote_port);
 
-		shm_bm_free_net_pkt_buf(rx_obj);
+		netshmem_pkt_buf_free(rx_obj);
 	}
 }
@@ -18,43 +18,66 @@ cos_init(void)
 	printc("app init shm done\n");
 }
 
-int
-main(void)
+/* Echo the data received by the connection, until there is none left */
+static void
+echo(int conn, struct netmgr_buf *buf, shm_bm_objid_t buf_id)
 {
-	int ret		= 0;
-	u32_t ip	= inet_addr("10.10.1.2");
-	u16_t port	= 80;
-	struct conn_addr client_addr;
 	shm_bm_objid_t           objid;
 	struct netshmem_pkt_buf *rx_obj;
 	struct netshmem_pkt_buf *tx_obj;
-	char *data;
 	u16_t data_offset, data_len;
 
-	ret = netmgr_tcp_bind(ip, port);
-	assert(ret == NETMGR_OK);
+	while ((objid = netmgr_conn_read(conn, &data_offset, &data_len)) != 0) {
+		/* the netmgr hands us the rx buf, as with udp */
+		rx_obj = shm_bm_transfer_net_pkt_buf(netshmem_get_shm(), objid);
 
-	ret = netmgr_tcp_listen(16);
-	assert(ret == NETMGR_OK);
+		tx_obj = netshmem_pkt_buf_alloc(&objid);
+		memcpy(netshmem_get_data_buf(tx_obj), rx_obj->data + data_offset, data_len);
 
-	printc("App begin to accept connection\n");
-	ret = netmgr_tcp_accept(&client_addr);
-	assert(ret == NETMGR_OK);
+		/* application free unused rx buf */
+		netshmem_pkt_buf_free(rx_obj);
 
-	while (1)
-	{
-		objid  = netmgr_tcp_shmem_read(&data_offset, &data_len);
-		rx_obj = shm_bm_take_net_pkt_buf(netshmem_get_shm(), objid);
-		
-		data = rx_obj->data + data_offset;
+		*buf = (struct netmgr_buf) { .objid = objid, .data_offset = netshmem_get_data_offset(), .data_len = data_len };
+		/* a short write drops the data: an echo server doesn't wait for NETMGR_EV_OUT */
+		netmgr_conn_writev(conn, buf_id, 1);
+		netshmem_pkt_buf_free(tx_obj);
+	}
+}
 
-		tx_obj = shm_bm_alloc_net_pkt_buf(netshmem_get_shm(), &objid);
-		memcpy(netshmem_get_data_buf(tx_obj), data, data_len);
+int
+main(void)
+{
+	int ret		= 0;
+	u32_t ip	= inet_addr("10.10.1.2");
+	u16_t port	= 80;
+	u32_t client_ip;
+	u16_t client_port;
+	int lconn, conn, i, n;
+	shm_bm_objid_t       evs_id, buf_id;
+	struct netmgr_event *evs;
+	struct netmgr_buf   *buf;
 
-		/* application free unused rx buf */
-		shm_bm_free_net_pkt_buf(rx_obj);
+	evs = netshmem_pkt_buf_alloc(&evs_id);
+	buf = netshmem_pkt_buf_alloc(&buf_id);
+	assert(evs && buf);
+
+	/* a single thread serves all of the connections */
+	lconn = netmgr_conn_listen(ip, port, 16);
+	assert(lconn >= 0);
+
+	printc("App begin to accept connections\n");
+	while (1)
+	{
+		n = netmgr_poll(evs_id, NETMGR_POLL_MAX, 1);
+		assert(n > 0);
 
-		netmgr_tcp_shmem_write(objid, netshmem_get_data_offset(), data_len);
-		shm_bm_free_net_pkt_buf(tx_obj);
+		for (i = 0; i < n; i++) {
+			if (evs[i].conn == lconn) {
+				while ((conn = netmgr_conn_accept(lconn, &client_ip, &client_port)) >= 0) echo(conn, buf, buf_id);
+				continue;
+			}
+			if (evs[i].events & NETMGR_EV_IN) echo(evs[i].conn, buf, buf_id);
+			if (evs[i].events & NETMGR_EV_HUP) netmgr_conn_close(evs[i].conn);
+		}
 	}
 }
@@ -52,14 +52,14 @@ parallel_main(coreid_t cid)
 		rx_obj = shm_bm_transfer_net_pkt_buf(netshmem_get_shm(), objid);
 		data = rx_obj->data + data_offset;
 
-		tx_obj = shm_bm_alloc_net_pkt_buf(netshmem_get_shm(), &objid);
+		tx_obj = netshmem_pkt_buf_alloc(&objid);
 		assert(tx_obj);
 		memcpy(netshmem_get_data_buf(tx_obj), data, data_len);
 
 		/* application free unused rx buf */
-		shm_bm_free_net_pkt_buf(rx_obj);
+		netshmem_pkt_buf_free(rx_obj);
 
 		netmgr_udp_shmem_write(objid, netshmem_get_data_offset(), data_len, remote_addr, remote_port);
-		shm_bm_free_net_pkt_buf(tx_obj);
+		netshmem_pkt_buf_free(tx_obj);
 	}
 }
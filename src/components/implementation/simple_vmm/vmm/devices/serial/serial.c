@@ -19,10 +19,8 @@ serial_handler(u16_t port, int dir, int sz, struct vmrt_vm_vcpu *vcpu)
 		case SERIAL_PORT1:
 			printc("%c", (u8_t)vcpu->shared_region->ax);
 			if (send_intr_enable) {
-				/* TODO: correctly handle serial output(eg: multiple vcpu case) and inject serial interrupt */
-
-				/* 52 is the fixed serial interrupt in Linux */
-				lapic_intr_inject(vcpu, 52, 1);
+				/* 52 is the fixed serial interrupt in Linux, that it only expects on its BSP */
+				lapic_intr_inject(vmrt_get_vcpu(vcpu->vm, 0), 52, 1);
 				serial_data[SERIAL_IIR - SERIAL_PORT_MIN] = 0x2;
 				serial_data[MODEM_STATUS_REGISTER - SERIAL_PORT_MIN] = 0x20;
 				serial_data[SERIAL_LSR - SERIAL_PORT_MIN] = 0x60;
@@ -0,0 +1,504 @@
+#include <string.h>
+#include <cos_types.h>
+#include <sched.h>
+#include <cos_time.h>
+#include <memmgr.h>
+#include <blkdev.h>
+#include "virtio_blk_io.h"
+#include "vpci.h"
+
+/***
+ * The backend of the device is the blkdev component (a RAM disk, or
+ * an NVMe driver): we share the guest's memory with it, so that it
+ * reads and writes the sectors in place, in the buffers of the
+ * requests, and we only translate the requests.
+ *
+ * Each request queue is served by its own I/O thread, as virtio-net's
+ * queues: the thread takes the requests of its queue in batches, of
+ * up to BLKDEV_BATCH_MAX segments, that the blkdev serves with one
+ * invocation. A guest's notification only wakes the thread up, and
+ * the notifications are suppressed while it has requests to take
+ * (with the event index, if the guest uses them). When the I/O
+ * threads have a core of their own, the thread keeps polling its
+ * queue for VIRTIO_BLK_POLL_USECS after it is empty.
+ *
+ * The used ring is only published once per batch, and the guest is
+ * interrupted at most once for it, only if it asked to be.
+ */
+
+/* As virtio-net's I/O threads, above the vcpus */
+#define VIRTIO_BLK_IO_PRIO 29
+#define VIRTIO_BLK_POLL_USECS 50
+/*
+ * TODO: as virtio-net's 57, the vector the guest maps the legacy
+ * interrupt of the device to, that should be read from somewhere more
+ * reliable.
+ */
+#define VIRTIO_BLK_INTR_VEC 58
+
+/* A request taken from the queue, whose segments are in the current batch */
+struct virtio_blk_pending {
+	u16_t idx;
+	u8_t *status;
+	u32_t iolen;
+	u8_t nsegs;
+};
+
+struct virtio_blk_queue {
+	thdid_t thd;
+	struct vmrt_vm_vcpu * volatile vcpu;
+	/* For the guest to notify the queue */
+	volatile int waiting;
+	struct virtio_blk_pending pending[BLKDEV_BATCH_MAX];
+	int npending, nsegs;
+};
+
+static struct virtio_blk_io_reg virtio_blk_regs;
+static struct virtio_queue virtio_blk_queues_reg[VIRTIO_BLK_MAXQ];
+static struct virtio_vq_info virtio_blk_vqs[VIRTIO_BLK_MAXQ];
+static struct virtio_blk_queue virtio_blk_queues[VIRTIO_BLK_MAXQ];
+/* The table of the requests to the blkdev, a row per queue, and the guest's memory they refer to */
+static struct blkdev_reqs *virtio_blk_reqs;
+static char *virtio_blk_mem;
+static cycles_t virtio_blk_poll_cycs;
+
+static inline int
+virtio_blk_has_feature(int feature)
+{
+	return (virtio_blk_regs.header.guest_features & (1U << feature)) != 0;
+}
+
+/* Ask the guest to notify us when it adds requests to the queue, or not to */
+static void
+virtio_blk_kick_enable(struct virtio_vq_info *vq, int enable)
+{
+	if (virtio_blk_has_feature(VIRTIO_RING_F_EVENT_IDX)) {
+		*(volatile u16_t *)&vq->used->ring[vq->qsize] = enable ? vq->last_avail : vq->last_avail - 1;
+	} else if (enable) {
+		vq->used->flags &= ~VRING_USED_F_NO_NOTIFY;
+	} else {
+		vq->used->flags |= VRING_USED_F_NO_NOTIFY;
+	}
+	/* Before we look at the avail ring again */
+	mb();
+}
+
+/* Publish the requests completed since the last call, and interrupt the guest once for them */
+static void
+virtio_blk_endchains(struct virtio_blk_queue *q, struct virtio_vq_info *vq)
+{
+	u16_t event_idx, new_idx, old_idx;
+	int intr;
+
+	vq_relchain_publish(vq);
+	mb();
+	old_idx = vq->save_used;
+	vq->save_used = new_idx = vq->used->idx;
+	if (new_idx == old_idx)
+		return;
+
+	if (virtio_blk_has_feature(VIRTIO_RING_F_EVENT_IDX)) {
+		event_idx = vq->avail->ring[vq->qsize];
+		intr = vring_need_event(event_idx, new_idx, old_idx);
+	} else {
+		intr = !(vq->avail->flags & VRING_AVAIL_F_NO_INTERRUPT);
+	}
+	if (!intr)
+		return;
+
+	__atomic_or_fetch(&virtio_blk_regs.header.ISR, 1, __ATOMIC_SEQ_CST);
+	lapic_intr_inject(vmrt_get_vcpu(q->vcpu->vm, 0), VIRTIO_BLK_INTR_VEC, 0);
+}
+
+/* Complete a request, that isn't in the batch */
+static inline void
+virtio_blk_done(struct virtio_vq_info *vq, u16_t idx, u8_t *status, u8_t s, u32_t iolen)
+{
+	if (status)
+		*status = s;
+	vq_relchain_prepare(vq, idx, iolen + (status ? 1 : 0));
+}
+
+/*
+ * Serve the segments of the batch with one invocation of the blkdev,
+ * then complete their requests: a request fails if one of its
+ * segments does.
+ */
+static void
+virtio_blk_submit(struct virtio_blk_queue *q, struct virtio_vq_info *vq)
+{
+	struct blkdev_req *reqs = virtio_blk_reqs->reqs[q - virtio_blk_queues];
+	struct virtio_blk_pending *p;
+	int i, j, seg = 0, ret;
+	u8_t s;
+
+	if (!q->npending)
+		return;
+
+	ret = q->nsegs ? blkdev_submit(q - virtio_blk_queues, q->nsegs) : 0;
+	for (i = 0; i < q->npending; i++) {
+		p = &q->pending[i];
+		s = ret < 0 ? VIRTIO_BLK_S_IOERR : VIRTIO_BLK_S_OK;
+		for (j = 0; j < p->nsegs; j++, seg++) {
+			if (ret > 0 && reqs[seg].status)
+				s = VIRTIO_BLK_S_IOERR;
+		}
+		virtio_blk_done(vq, p->idx, p->status, s, s == VIRTIO_BLK_S_OK ? p->iolen : 0);
+	}
+	q->npending = q->nsegs = 0;
+}
+
+/*
+ * Add the request of a chain to the batch, or complete it if the
+ * blkdev has nothing to do for it. The header is in the first
+ * descriptor, the status in the last, and the data in between.
+ */
+static void
+virtio_blk_req(struct virtio_blk_queue *q, struct virtio_vq_info *vq, u16_t idx, struct iovec *iov, int n)
+{
+	struct blkdev_req *reqs = virtio_blk_reqs->reqs[q - virtio_blk_queues];
+	struct virtio_blk_outhdr *hdr;
+	struct virtio_blk_pending *p;
+	u64_t sector;
+	u32_t iolen = 0;
+	u8_t *status;
+	int i, nsegs = n - 2;
+
+	if (n < 2 || iov[0].iov_len < sizeof(*hdr) || iov[n - 1].iov_len < 1) {
+		virtio_blk_done(vq, idx, n > 0 && iov[n - 1].iov_len ? iov[n - 1].iov_base : NULL, VIRTIO_BLK_S_IOERR, 0);
+		return;
+	}
+	hdr = iov[0].iov_base;
+	status = iov[n - 1].iov_base;
+
+	switch (hdr->type) {
+	case VIRTIO_BLK_T_IN:
+	case VIRTIO_BLK_T_OUT:
+		if (nsegs > BLKDEV_BATCH_MAX) {
+			virtio_blk_done(vq, idx, status, VIRTIO_BLK_S_IOERR, 0);
+			return;
+		}
+		break;
+	case VIRTIO_BLK_T_FLUSH:
+		nsegs = 1;
+		break;
+	case VIRTIO_BLK_T_GET_ID:
+		if (nsegs < 1) {
+			virtio_blk_done(vq, idx, status, VIRTIO_BLK_S_IOERR, 0);
+			return;
+		}
+		iolen = iov[1].iov_len < VIRTIO_BLK_ID_BYTES ? iov[1].iov_len : VIRTIO_BLK_ID_BYTES;
+		memset(iov[1].iov_base, 0, iolen);
+		strncpy(iov[1].iov_base, "cos-blkdev", iolen);
+		virtio_blk_done(vq, idx, status, VIRTIO_BLK_S_OK, iolen);
+		return;
+	default:
+		virtio_blk_done(vq, idx, status, VIRTIO_BLK_S_UNSUPP, 0);
+		return;
+	}
+
+	if (q->nsegs + nsegs > BLKDEV_BATCH_MAX || q->npending == BLKDEV_BATCH_MAX)
+		virtio_blk_submit(q, vq);
+
+	if (hdr->type == VIRTIO_BLK_T_FLUSH) {
+		reqs[q->nsegs++] = (struct blkdev_req) { .op = BLKDEV_OP_FLUSH };
+	} else {
+		/* The segments are in the guest's memory, at their guest-physical address */
+		for (i = 1, sector = hdr->sector; i <= nsegs; i++) {
+			reqs[q->nsegs++] = (struct blkdev_req) {
+				.sector = sector,
+				.off    = (char *)iov[i].iov_base - virtio_blk_mem,
+				.len    = iov[i].iov_len,
+				.op     = hdr->type == VIRTIO_BLK_T_IN ? BLKDEV_OP_READ : BLKDEV_OP_WRITE,
+			};
+			sector += iov[i].iov_len / BLKDEV_SECTOR_SZ;
+		}
+		/* The data read is written to the guest's buffers */
+		if (hdr->type == VIRTIO_BLK_T_IN)
+			for (i = 1; i <= nsegs; i++) iolen += iov[i].iov_len;
+	}
+
+	p = &q->pending[q->npending++];
+	*p = (struct virtio_blk_pending) { .idx = idx, .status = status, .iolen = iolen, .nsegs = nsegs };
+}
+
+/* Serve the requests of the queue, in batches; returns their number */
+static int
+virtio_blk_burst(struct virtio_blk_queue *q, struct virtio_vq_info *vq)
+{
+	struct iovec iov[BLKDEV_BATCH_MAX + 2];
+	int n, nchains = 0;
+	u16_t idx;
+
+	while (vq_has_descs(vq)) {
+		n = vq_getchain(q->vcpu, vq, &idx, iov, BLKDEV_BATCH_MAX + 2, NULL);
+		if (n < 1) {
+			printc("vtblk: virtio_blk_burst: vq_getchain = %d\n", n);
+			VM_PANIC(q->vcpu);
+		}
+		virtio_blk_req(q, vq, idx, iov, n);
+		nchains++;
+	}
+	if (nchains) {
+		virtio_blk_submit(q, vq);
+		virtio_blk_endchains(q, vq);
+	}
+
+	return nchains;
+}
+
+static void
+virtio_blk_io_thd(void *d)
+{
+	struct virtio_blk_queue *q = d;
+	struct virtio_vq_info *vq = &virtio_blk_vqs[q - virtio_blk_queues];
+	cycles_t idle;
+
+	while (1) {
+		while (!q->vcpu || !vq_ring_ready(vq)) {
+			q->waiting = 1;
+			sched_thd_block(0);
+		}
+
+		/* Poll the queue while the guest is busy, without its notifications */
+		virtio_blk_kick_enable(vq, 0);
+		idle = time_now();
+		do {
+			if (virtio_blk_burst(q, vq))
+				idle = time_now();
+		} while (time_now() - idle < virtio_blk_poll_cycs);
+
+		q->waiting = 1;
+		virtio_blk_kick_enable(vq, 1);
+		/* The guest might have added requests before it saw the notifications enabled */
+		if (vq_has_descs(vq)) {
+			q->waiting = 0;
+			continue;
+		}
+		/* The notification wakes us up, even if it is before we block */
+		sched_thd_block(0);
+		q->waiting = 0;
+	}
+}
+
+/*
+ * Create the I/O threads of the queues on the calling core. They poll
+ * the queues while busy, if they have the core to themselves.
+ */
+void
+virtio_blk_io_thds_create(int poll)
+{
+	int i;
+
+	virtio_blk_poll_cycs = poll ? time_usec2cyc(VIRTIO_BLK_POLL_USECS) : 0;
+	for (i = 0; i < VIRTIO_BLK_MAXQ; i++) {
+		virtio_blk_queues[i].thd = sched_thd_create(virtio_blk_io_thd, &virtio_blk_queues[i]);
+		assert(virtio_blk_queues[i].thd);
+		sched_thd_param_set(virtio_blk_queues[i].thd, sched_param_pack(SCHEDP_PRIO, VIRTIO_BLK_IO_PRIO));
+	}
+}
+
+static void
+virtio_blk_notify(struct vmrt_vm_vcpu *vcpu, u16_t qn)
+{
+	struct virtio_blk_queue *q;
+
+	if (qn >= VIRTIO_BLK_MAXQ)
+		VM_PANIC(vcpu);
+
+	q = &virtio_blk_queues[qn];
+	if (!q->vcpu)
+		q->vcpu = vcpu;
+	/* The requests are served by the queue's thread, we only wake it up */
+	if (q->waiting && q->thd) {
+		q->waiting = 0;
+		sched_thd_wakeup(q->thd);
+	}
+}
+
+static void
+virtio_blk_outb(u32_t port_id, struct vmrt_vm_vcpu *vcpu)
+{
+	u8_t val = vcpu->shared_region->ax;
+
+	switch (port_id)
+	{
+	case VIRTIO_BLK_DEV_STATUS:
+		virtio_blk_regs.header.dev_status = val;
+		break;
+	default:
+		VM_PANIC(vcpu);
+		break;
+	}
+}
+
+static void
+virtio_blk_outw(u32_t port_id, struct vmrt_vm_vcpu *vcpu)
+{
+	u16_t val = vcpu->shared_region->ax;
+
+	switch (port_id)
+	{
+	case VIRTIO_BLK_QUEUE_SELECT:
+		virtio_blk_regs.header.queue_select = val;
+		break;
+	case VIRTIO_BLK_QUEUE_NOTIFY:
+		virtio_blk_regs.header.queue_notify = val;
+		virtio_blk_notify(vcpu, val);
+		break;
+	default:
+		VM_PANIC(vcpu);
+		break;
+	}
+}
+
+static void
+virtio_blk_outl(u32_t port_id, struct vmrt_vm_vcpu *vcpu)
+{
+	u32_t val = vcpu->shared_region->ax;
+	u16_t sel = virtio_blk_regs.header.queue_select;
+	u64_t tmp = val;
+
+	switch (port_id)
+	{
+	case VIRTIO_BLK_GUEST_FEATURES:
+		virtio_blk_regs.header.guest_features = val;
+		break;
+	case VIRTIO_BLK_QUEUE_ADDR:
+		if (sel >= VIRTIO_BLK_MAXQ)
+			VM_PANIC(vcpu);
+		virtio_blk_queues_reg[sel].queue = (void *)tmp;
+		if (vq_ring_init(vcpu, &virtio_blk_vqs[sel], val))
+			printc("%s: vq %d enable failed\n", __func__, sel);
+		break;
+	default:
+		VM_PANIC(vcpu);
+		break;
+	}
+}
+
+static void
+virtio_blk_in(u32_t port_id, int sz, struct vmrt_vm_vcpu *vcpu)
+{
+	u16_t sel = virtio_blk_regs.header.queue_select;
+	u64_t val = 0;
+
+	/* The configuration is read in any size, at any offset */
+	if (port_id >= VIRTIO_BLK_CONFIG) {
+		memcpy(&val, (char *)&virtio_blk_regs.config_reg + (port_id - VIRTIO_BLK_CONFIG),
+		       sz < (int)(VIRTIO_BLK_IO_END - port_id) ? sz : (int)(VIRTIO_BLK_IO_END - port_id));
+		vcpu->shared_region->ax = val;
+		return;
+	}
+
+	switch (port_id)
+	{
+	case VIRTIO_BLK_DEV_FEATURES:
+		vcpu->shared_region->ax = virtio_blk_regs.header.dev_features;
+		break;
+	case VIRTIO_BLK_GUEST_FEATURES:
+		vcpu->shared_region->ax = virtio_blk_regs.header.guest_features;
+		break;
+	case VIRTIO_BLK_QUEUE_ADDR:
+		vcpu->shared_region->ax = sel < VIRTIO_BLK_MAXQ ? virtio_blk_vqs[sel].pfn : 0;
+		break;
+	case VIRTIO_BLK_QUEUE_SIZE:
+		/* The guest finds the number of queues with their size */
+		vcpu->shared_region->ax = sel < VIRTIO_BLK_MAXQ ? virtio_blk_queues_reg[sel].queue_sz : 0;
+		break;
+	case VIRTIO_BLK_QUEUE_SELECT:
+		vcpu->shared_region->ax = sel;
+		break;
+	case VIRTIO_BLK_DEV_STATUS:
+		vcpu->shared_region->ax = virtio_blk_regs.header.dev_status;
+		break;
+	case VIRTIO_BLK_ISR:
+		/* Reading the ISR clears it */
+		vcpu->shared_region->ax = __atomic_exchange_n(&virtio_blk_regs.header.ISR, 0, __ATOMIC_SEQ_CST);
+		break;
+	default:
+		VM_PANIC(vcpu);
+		break;
+	}
+}
+
+void
+virtio_blk_handler(u16_t port, int dir, int sz, struct vmrt_vm_vcpu *vcpu)
+{
+	if (dir == IO_IN) {
+		switch (sz)
+		{
+		case IO_BYTE:
+			virtio_blk_in(port, 1, vcpu);
+			break;
+		case IO_WORD:
+			virtio_blk_in(port, 2, vcpu);
+			break;
+		case IO_LONG:
+			virtio_blk_in(port, 4, vcpu);
+			break;
+		default:
+			VM_PANIC(vcpu);
+		}
+	} else {
+		switch (sz)
+		{
+		case IO_BYTE:
+			virtio_blk_outb(port, vcpu);
+			break;
+		case IO_WORD:
+			virtio_blk_outw(port, vcpu);
+			break;
+		case IO_LONG:
+			virtio_blk_outl(port, vcpu);
+			break;
+		default:
+			VM_PANIC(vcpu);
+		}
+	}
+}
+
+void
+virtio_blk_io_init(void)
+{
+	int i;
+
+	memset(&virtio_blk_regs, 0, sizeof(virtio_blk_regs));
+	memset(&virtio_blk_queues_reg, 0, sizeof(virtio_blk_queues_reg));
+	memset(&virtio_blk_vqs, 0, sizeof(virtio_blk_vqs));
+	memset(&virtio_blk_queues, 0, sizeof(virtio_blk_queues));
+
+	virtio_blk_regs.header.dev_features |= (1 << VIRTIO_BLK_F_SEG_MAX);
+	virtio_blk_regs.header.dev_features |= (1 << VIRTIO_BLK_F_BLK_SIZE);
+	virtio_blk_regs.header.dev_features |= (1 << VIRTIO_BLK_F_FLUSH);
+	virtio_blk_regs.header.dev_features |= (1 << VIRTIO_BLK_F_MQ);
+	virtio_blk_regs.header.dev_features |= (1 << VIRTIO_RING_F_EVENT_IDX);
+	virtio_blk_regs.config_reg.seg_max = BLKDEV_BATCH_MAX;
+	virtio_blk_regs.config_reg.blk_size = BLKDEV_SECTOR_SZ;
+	virtio_blk_regs.config_reg.num_queues = VIRTIO_BLK_MAXQ;
+
+	for (i = 0; i < VIRTIO_BLK_MAXQ; i++) {
+		virtio_blk_queues_reg[i].queue_sz = VQ_MAX_DESCRIPTORS;
+		virtio_blk_vqs[i].qsize = VQ_MAX_DESCRIPTORS;
+	}
+}
+
+/*
+ * The device is initialized by a constructor, before the blkdev can
+ * be invoked: share the guest's memory (mem, at vm->guest_addr) and
+ * the table of the requests with it, and size the disk.
+ */
+void
+virtio_blk_init(struct vmrt_vm_comp *vm, cbuf_t mem)
+{
+	cbuf_t reqs;
+	int ret;
+
+	reqs = memmgr_shared_page_allocn(round_up_to_page(sizeof(struct blkdev_reqs)) / PAGE_SIZE, (vaddr_t *)&virtio_blk_reqs);
+	assert(reqs);
+	ret = blkdev_mem_map(mem, reqs);
+	assert(ret == 0);
+
+	virtio_blk_mem = vm->guest_addr;
+	virtio_blk_regs.config_reg.capacity = blkdev_capacity();
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cos_types.h>
+#include <vmrt.h>
+#include "virtio_vq.h"
+
+#define VIRTIO_BLK_IO_ADDR 0x8000
+
+#define VIRTIO_BLK_DEV_FEATURES (VIRTIO_BLK_IO_ADDR + 0)
+#define VIRTIO_BLK_GUEST_FEATURES (VIRTIO_BLK_IO_ADDR + 4)
+#define VIRTIO_BLK_QUEUE_ADDR (VIRTIO_BLK_IO_ADDR + 8)
+#define VIRTIO_BLK_QUEUE_SIZE (VIRTIO_BLK_IO_ADDR + 12)
+#define VIRTIO_BLK_QUEUE_SELECT (VIRTIO_BLK_IO_ADDR + 14)
+#define VIRTIO_BLK_QUEUE_NOTIFY (VIRTIO_BLK_IO_ADDR + 16)
+#define VIRTIO_BLK_DEV_STATUS (VIRTIO_BLK_IO_ADDR + 18)
+#define VIRTIO_BLK_ISR (VIRTIO_BLK_IO_ADDR + 19)
+/* The configuration of the device (struct virtio_blk_config), read in any size */
+#define VIRTIO_BLK_CONFIG (VIRTIO_BLK_IO_ADDR + 20)
+#define VIRTIO_BLK_IO_END (VIRTIO_BLK_CONFIG + sizeof(struct virtio_blk_config))
+
+#define VIRTIO_BLK_F_SIZE_MAX (1)
+#define VIRTIO_BLK_F_SEG_MAX (2)
+#define VIRTIO_BLK_F_GEOMETRY (4)
+#define VIRTIO_BLK_F_RO (5)
+#define VIRTIO_BLK_F_BLK_SIZE (6)
+#define VIRTIO_BLK_F_FLUSH (9)
+#define VIRTIO_BLK_F_TOPOLOGY (10)
+#define VIRTIO_BLK_F_CONFIG_WCE (11)
+#define VIRTIO_BLK_F_MQ (12)
+
+/* The request queues, each served by its own thread */
+#define VIRTIO_BLK_MAXQ 4
+
+#define VIRTIO_BLK_T_IN 0
+#define VIRTIO_BLK_T_OUT 1
+#define VIRTIO_BLK_T_FLUSH 4
+#define VIRTIO_BLK_T_GET_ID 8
+
+#define VIRTIO_BLK_S_OK 0
+#define VIRTIO_BLK_S_IOERR 1
+#define VIRTIO_BLK_S_UNSUPP 2
+
+#define VIRTIO_BLK_ID_BYTES 20
+
+struct virtio_blk_config {
+	u64_t capacity;
+	u32_t size_max;
+	u32_t seg_max;
+	struct {
+		u16_t cylinders;
+		u8_t heads;
+		u8_t sectors;
+	} geometry;
+	u32_t blk_size;
+	struct {
+		u8_t physical_block_exp;
+		u8_t alignment_offset;
+		u16_t min_io_size;
+		u32_t opt_io_size;
+	} topology;
+	u8_t writeback;
+	u8_t unused0;
+	u16_t num_queues;
+} __attribute__((packed));
+
+struct virtio_blk_io_reg {
+	struct virtio_header header;
+	struct virtio_blk_config config_reg;
+} __attribute__((packed));
+
+/* The header of a request, in the first descriptor of its chain */
+struct virtio_blk_outhdr {
+	u32_t type;
+	u32_t ioprio;
+	u64_t sector;
+} __attribute__((packed));
+
+void virtio_blk_handler(u16_t port, int dir, int sz, struct vmrt_vm_vcpu *vcpu);
+void virtio_blk_init(struct vmrt_vm_comp *vm, cbuf_t mem);
+void virtio_blk_io_thds_create(int poll);
@@ -26,40 +26,93 @@
  * $FreeBSD$
  */
 #include <assert.h>
+#include <string.h>
+#include <arpa/inet.h>
 #include <cos_types.h>
+#include <sched.h>
+#include <cos_time.h>
+#include <sync_lock.h>
+#include <netshmem.h>
+#include <nic.h>
+#include <net_stack_types.h>
 #include "virtio_net_io.h"
 #include "vpci.h"
 #include "virtio_ring.h"
 
-/* TODO: remove this warning flag when virtio-net is done */
-#pragma GCC diagnostic ignored "-Wunused-but-set-variable"
+/***
+ * The backend of the device is the nicmgr: the guest is a tenant
+ * bound to all of the ports of VIRTIO_NET_GUEST_IP, with the MAC
+ * address of the NIC's port.
+ *
+ * Each queue of a pair is served by its own I/O thread, as vhost
+ * does, rather than by the vcpus on their exits: the rx thread
+ * receives the guest's packets from the nicmgr, in bursts, that it
+ * copies to the buffers of the rx queue. The nicmgr spreads the flows
+ * of the guest across the rx threads, thus across the queue pairs.
+ * The tx thread copies the packets the guest sends to the buffers of
+ * its session, and sends them with one invocation for up to
+ * NIC_BATCH_MAX. The nicmgr only takes packets in the buffers of the
+ * shared memory of its tenants, so there is a copy between those and
+ * the guest's memory.
+ *
+ * A guest's notification only wakes the tx thread up. When the I/O
+ * threads have a core of their own, the tx thread keeps polling its
+ * ring for VIRTIO_NET_POLL_USECS after it is empty, with the
+ * notifications suppressed, so a busy guest sends without exits.
+ *
+ * The used ring of a queue is only published once per burst, and the
+ * guest is interrupted at most once for it, only if it asked to be
+ * (with the event indices, or the flags of the rings).
+ */
+
+/* Above the vcpus (30), so that the packets are delivered and sent as they arrive */
+#define VIRTIO_NET_IO_PRIO 29
+#define VIRTIO_NET_POLL_USECS 50
 
 static struct virtio_net_io_reg virtio_net_regs;
-static struct virtio_queue virtio_queues[2];
-struct virtio_vq_info virtio_net_vqs[VIRTIO_NET_MAXQ - 1];
+static struct virtio_queue virtio_queues[VIRTIO_NET_MAXQ];
+struct virtio_vq_info virtio_net_vqs[VIRTIO_NET_MAXQ];
+
+/* The rx side of a queue pair */
+struct virtio_net_rx {
+	thdid_t thd;
+	/* The vcpu interrupted for the packets received, set once the pair is started */
+	struct vmrt_vm_vcpu * volatile vcpu;
+	/* Of the rx queue, also filled by the tx threads with the ARP replies */
+	struct sync_lock lock;
+	/* For the guest to add buffers to the queue */
+	volatile int waiting;
+	u64_t drops;
+};
 
-static unsigned char icmp_reply[] = {
-	/* TODO: remove icmp reply and process nic input from nic component */
+/* The tx side of a queue pair, with its session to send the packets of the guest */
+struct virtio_net_tx {
+	thdid_t thd;
+	struct vmrt_vm_vcpu * volatile vcpu;
+	/* For the guest to notify the queue */
+	volatile int waiting;
+	struct nic_pkt_desc *descs;
+	shm_bm_objid_t descs_id;
 };
 
+static struct virtio_net_rx virtio_net_rxs[VIRTIO_NET_MAX_PAIRS];
+static struct virtio_net_tx virtio_net_txs[VIRTIO_NET_MAX_PAIRS];
+static u32_t virtio_net_ip;
+static cycles_t virtio_net_poll_cycs;
+
 static inline int
-vq_ring_ready(struct virtio_vq_info *vq)
+virtio_net_has_feature(int feature)
 {
-	return 1;
+	return (virtio_net_regs.header.guest_features & (1U << feature)) != 0;
 }
 
-static inline int 
-vq_has_descs(struct virtio_vq_info *vq)
+static inline size_t
+virtio_net_hdr_len(void)
 {
-	int ret = 0;
-	if (vq_ring_ready(vq) && vq->last_avail != vq->avail->idx) {
-		if ((u16_t)((unsigned int)vq->avail->idx - vq->last_avail) > vq->qsize)
-			printc ("no valid descriptor\n");
-		else
-			ret = 1;
-	}
-	return ret;
+	if (virtio_net_has_feature(VIRTIO_NET_F_MRG_RXBUF))
+		return sizeof(struct virtio_net_rxhdr);
 
+	return sizeof(struct virtio_net_rxhdr) - sizeof(u16_t);
 }
 
 void *
@@ -69,9 +122,30 @@ paddr_guest2host(uintptr_t gaddr, struct vmrt_vm_comp *vm)
 	return va;
 }
 
-#define roundup2(x, y)  (((x)+((y)-1))&(~((y)-1)))
-#define mb()    ({ asm volatile("mfence" ::: "memory"); (void)0; })
+/*
+ * Ask the guest to notify us when it adds buffers to the queue, or
+ * not to, with the event index if it uses them.
+ */
+static void
+vq_kick_enable(struct virtio_vq_info *vq, int enable)
+{
+	if (virtio_net_has_feature(VIRTIO_RING_F_EVENT_IDX)) {
+		/* The avail event is after the used ring */
+		*(volatile u16_t *)&vq->used->ring[vq->qsize] = enable ? vq->last_avail : vq->last_avail - 1;
+	} else if (enable) {
+		vq->used->flags &= ~VRING_USED_F_NO_NOTIFY;
+	} else {
+		vq->used->flags |= VRING_USED_F_NO_NOTIFY;
+	}
+	/* Before we look at the avail ring again */
+	mb();
+}
 
+/*
+ * Interrupt the guest once for all of the chains used since the last
+ * call, unless it doesn't want to be: with the event indices, only if
+ * one of them is the used event, otherwise if it doesn't suppress them.
+ */
 void
 vq_endchains(struct vmrt_vm_vcpu *vcpu, struct virtio_vq_info *vq, int used_all_avail)
 {
@@ -80,50 +154,44 @@ vq_endchains(struct vmrt_vm_vcpu *vcpu, struct virtio_vq_info *vq, int used_all_
 
 	if (!vq || !vq->used)
 		return;
-	
-	/* TODO: 57 is virtio-net interrupt, should read it from somewhere else more reliable */
-	lapic_intr_inject(vcpu, 57, 0);
-}
-
-static inline struct iovec *
-rx_iov_trim(struct iovec *iov, int *niov, size_t tlen)
-{
-	struct iovec *riov;
 
-	/* XXX short-cut: assume first segment is >= tlen */
-	if (iov[0].iov_len < tlen) {
-		printc("vtnet: rx_iov_trim: iov_len=%lu, tlen=%lu\n", iov[0].iov_len, tlen);
-		return NULL;
-	}
+	mb();
+	old_idx = vq->save_used;
+	vq->save_used = new_idx = vq->used->idx;
+	if (new_idx == old_idx)
+		return;
 
-	iov[0].iov_len -= tlen;
-	if (iov[0].iov_len == 0) {
-		if (*niov <= 1) {
-			printc("vtnet: rx_iov_trim: *niov=%d\n", *niov);
-			return NULL;
-		}
-		*niov -= 1;
-		riov = &iov[1];
+	if (virtio_net_has_feature(VIRTIO_RING_F_EVENT_IDX)) {
+		/* The used event is after the avail ring */
+		event_idx = vq->avail->ring[vq->qsize];
+		intr = vring_need_event(event_idx, new_idx, old_idx);
 	} else {
-		iov[0].iov_base = (void *)((uintptr_t)iov[0].iov_base + tlen);
-		riov = &iov[0];
+		intr = !(vq->avail->flags & VRING_AVAIL_F_NO_INTERRUPT);
 	}
+	if (!intr)
+		return;
 
-	return riov;
+	__atomic_or_fetch(&virtio_net_regs.header.ISR, 1, __ATOMIC_SEQ_CST);
+	/*
+	 * TODO: 57 is virtio-net interrupt, should read it from somewhere else more reliable.
+	 * It is a legacy interrupt, that the guest only expects on its BSP, the first vcpu.
+	 */
+	lapic_intr_inject(vmrt_get_vcpu(vcpu->vm, 0), 57, 0);
 }
 
-static void
-virtio_vq_init(struct vmrt_vm_vcpu *vcpu, int nr_queue, u32_t pfn)
+/* Map the rings of the queue, at pfn in the guest. Returns -1 if they can't be */
+int
+vq_ring_init(struct vmrt_vm_vcpu *vcpu, struct virtio_vq_info *vq, u32_t pfn)
 {
-	struct virtio_vq_info *vq;
 	u64_t phys;
-	size_t size;
 	char *vb;
 
-	vq = &virtio_net_vqs[nr_queue];
 	vq->pfn = pfn;
+	/* The guest disables the queue with a 0 pfn */
+	if (!pfn)
+		goto error;
+
 	phys = (u64_t)pfn << VRING_PAGE_BITS;
-	size = vring_size(vq->qsize, VIRTIO_PCI_VRING_ALIGN);
 	vb = paddr_guest2host(phys, vcpu->vm);
 	if (!vb)
 		goto error;
@@ -145,17 +213,26 @@ virtio_vq_init(struct vmrt_vm_vcpu *vcpu, int nr_queue, u32_t pfn)
 	/* Start at 0 when we use it. */
 	vq->last_avail = 0;
 	vq->save_used = 0;
+	vq->used_idx = 0;
 
 	/* Mark queue as allocated after initialization is complete. */
 	mb();
 	vq->flags = VQ_ALLOC;
 
-	printc("%s: vq enable done\n", __func__);
-	return;
+	return 0;
 
 error:
 	vq->flags = 0;
-	printc("%s: vq enable failed\n", __func__);
+	return -1;
+}
+
+static void
+virtio_vq_init(struct vmrt_vm_vcpu *vcpu, int nr_queue, u32_t pfn)
+{
+	if (vq_ring_init(vcpu, &virtio_net_vqs[nr_queue], pfn))
+		printc("%s: vq %d enable failed\n", __func__, nr_queue);
+	else
+		printc("%s: vq %d enable done\n", __func__, nr_queue);
 }
 
 static inline int
@@ -176,17 +253,6 @@ _vq_record(int i, volatile struct vring_desc *vd,
 	return 0;
 }
 
-static void
-dump_packet(char *p, u16_t sz)
-{
-	for (int i = 0; i < sz; i++) {
-		if (i > 0 && (i % 8 == 0)) printc("\n");
-		u8_t c = p[i];
-		printc("%02x ", c);
-	}
-	printc("\n");
-}
-
 int
 vq_getchain(struct vmrt_vm_vcpu *vcpu, struct virtio_vq_info *vq, u16_t *pidx,
 	    struct iovec *iov, int n_iov, u16_t *flags)
@@ -311,160 +377,399 @@ loopy:
 void
 vq_relchain(struct virtio_vq_info *vq, u16_t idx, u32_t iolen)
 {
-	u16_t uidx, mask;
-	volatile struct vring_used *vuh;
-	volatile struct vring_used_elem *vue;
-
-	/*
-	 * Notes:
-	 *  - mask is N-1 where N is a power of 2 so computes x % N
-	 *  - vuh points to the "used" data shared with guest
-	 *  - vue points to the "used" ring entry we want to update
-	 *  - head is the same value we compute in vq_iovecs().
-	 *
-	 * (I apologize for the two fields named idx; the
-	 * virtio spec calls the one that vue points to, "id"...)
-	 */
-	mask = vq->qsize - 1;
-	vuh = vq->used;
-
-	uidx = vuh->idx;
-	vue = &vuh->ring[uidx++ & mask];
-	vue->id = idx;
-	vue->len = iolen;
-	vuh->idx = uidx;
+	vq_relchain_prepare(vq, idx, iolen);
+	vq_relchain_publish(vq);
 }
 
+/*
+ * Wait for the guest to add buffers to the rx queue, with its lock
+ * released. The packets received until now are given to the guest
+ * first, as it might be waiting for them to add more.
+ */
 static void
-virtio_net_tap_rx(struct vmrt_vm_vcpu *vcpu)
+virtio_net_rx_wait(struct virtio_net_rx *rx, struct virtio_vq_info *vq)
 {
-	struct iovec iov[VIRTIO_NET_MAXSEGS], *riov;
-	struct virtio_vq_info *vq;
-	void *vrx;
-	int len, n;
-	u16_t idx;
-	int ret;
+	vq_relchain_publish(vq);
+	vq_endchains(rx->vcpu, vq, 0);
 
-	/*
-	 * Check for available rx buffers
-	 */
-	vq = &virtio_net_vqs[VIRTIO_NET_RXQ];
-	if (!vq_has_descs(vq)) {
-		VM_PANIC(vcpu);
+	while (!vq_has_descs(vq)) {
+		rx->waiting = 1;
+		vq_kick_enable(vq, 1);
+		if (vq_has_descs(vq))
+			break;
+
+		/* The notification wakes us up, even if it is before we block */
+		sync_lock_release(&rx->lock);
+		sched_thd_block(0);
+		sync_lock_take(&rx->lock);
 	}
+	rx->waiting = 0;
+	vq_kick_enable(vq, 0);
+}
+
+/*
+ * Copy a packet to the buffers of the rx queue, after the virtio-net
+ * header: with mergeable buffers, the packet spans as many chains as
+ * it needs, whose number is in the header. Returns -1 if the packet
+ * is dropped or truncated.
+ */
+static int
+virtio_net_rx_one(struct virtio_net_rx *rx, struct virtio_vq_info *vq, char *pkt, u16_t len)
+{
+	struct iovec iov[VIRTIO_NET_MAXSEGS];
+	struct virtio_net_rxhdr *hdr = NULL;
+	size_t hdr_len = virtio_net_hdr_len();
+	size_t off = 0, used, cap, sz;
+	u16_t idx, nbufs = 0;
+	char *buf;
+	int i, n;
 
 	do {
-		/*
-		 * Get descriptor chain.
-		 */
-		n = vq_getchain(vcpu, vq, &idx, iov, VIRTIO_NET_MAXSEGS, NULL);
-		if (n < 1 || n > VIRTIO_NET_MAXSEGS) {
-			printc("vtnet: virtio_net_tap_rx: vq_getchain = %d\n", n);
-			VM_PANIC(vcpu);
-			return;
+		if (!vq_has_descs(vq))
+			virtio_net_rx_wait(rx, vq);
+
+		n = vq_getchain(rx->vcpu, vq, &idx, iov, VIRTIO_NET_MAXSEGS, NULL);
+		if (n < 1)
+			return -1;
+
+		used = 0;
+		for (i = 0; i < n && off < len; i++) {
+			buf = iov[i].iov_base;
+			cap = iov[i].iov_len;
+			/* The header is at the start of the first buffer */
+			if (!hdr) {
+				if (cap < hdr_len)
+					break;
+				hdr = (struct virtio_net_rxhdr *)buf;
+				memset(hdr, 0, hdr_len);
+				buf += hdr_len;
+				cap -= hdr_len;
+				used += hdr_len;
+			}
+			sz = len - off < cap ? len - off : cap;
+			memcpy(buf, pkt + off, sz);
+			off += sz;
+			used += sz;
 		}
-		/*
-		 * Get a pointer to the rx header, and use the
-		 * data immediately following it for the packet buffer.
-		 */
-		vrx = iov[0].iov_base;
-		riov = rx_iov_trim(iov, &n, sizeof(struct virtio_net_rxhdr));
+		vq_relchain_prepare(vq, idx, used);
+		nbufs++;
+	} while (hdr && off < len && virtio_net_has_feature(VIRTIO_NET_F_MRG_RXBUF));
 
-		memcpy(iov[0].iov_base, icmp_reply, sizeof(icmp_reply));
+	if (hdr && virtio_net_has_feature(VIRTIO_NET_F_MRG_RXBUF))
+		hdr->vrh_bufs = nbufs;
 
-		len = sizeof(icmp_reply);
-		if (riov == NULL)
-			VM_PANIC(vcpu);
+	return off < len ? -1 : 0;
+}
 
-		memset(vrx, 0, sizeof(struct virtio_net_rxhdr));
-		
+/* Publish the chains of a burst, and interrupt the guest once for them */
+static inline void
+virtio_net_rx_end(struct virtio_net_rx *rx, struct virtio_vq_info *vq)
+{
+	vq_relchain_publish(vq);
+	vq_endchains(rx->vcpu, vq, 0);
+}
 
-		if (len < 0 ) {
-			/*
-			 * No more packets, but still some avail ring
-			 * entries.  Interrupt if needed/appropriate.
-			 */
-			/*TODO: fix the erro case */
-			VM_PANIC(vcpu);
+static void
+virtio_net_rx_thd(void *d)
+{
+	struct virtio_net_rx *rx = d;
+	struct virtio_vq_info *vq = &virtio_net_vqs[VIRTIO_NET_RXQ(rx - virtio_net_rxs)];
+	struct netshmem_pkt_buf *obj;
+	struct nic_pkt_desc *descs;
+	shm_bm_objid_t descs_id;
+	int i, n, ret;
+
+	/* The flows are only spread to the pair once the guest uses it */
+	while (!rx->vcpu)
+		sched_thd_block(0);
+
+	netshmem_create();
+	nic_shmem_map(netshmem_get_shm_id());
+	/* All of the threads bound to the guest's address share its flows */
+	ret = nic_bind_port(virtio_net_ip, 0);
+	assert(ret == 0);
+	descs = shm_bm_alloc_net_pkt_buf(netshmem_get_shm(), &descs_id);
+	assert(descs);
+
+	while (1) {
+		n = nic_get_packets(descs_id, NIC_BATCH_MAX);
+		assert(n > 0);
+
+		sync_lock_take(&rx->lock);
+		for (i = 0; i < n; i++) {
+			struct nic_pkt_desc pd = descs[i];
+
+			obj = shm_bm_transfer_net_pkt_buf(netshmem_get_shm(), pd.objid);
+			if (!vq_ring_ready(vq) || virtio_net_rx_one(rx, vq, obj->data + pd.pkt_offset, pd.pkt_len))
+				rx->drops++;
+			netshmem_pkt_buf_free(obj);
 		}
+		virtio_net_rx_end(rx, vq);
+		sync_lock_release(&rx->lock);
+	}
+}
 
-		/*
-		 * The only valid field in the rx packet header is the
-		 * number of buffers if merged rx bufs were negotiated.
-		 */
+/* Receive and send the packets of the queue pair from now on; the pairs are never stopped */
+static void
+virtio_net_pair_start(struct vmrt_vm_vcpu *vcpu, int pair)
+{
+	struct virtio_net_rx *rx = &virtio_net_rxs[pair];
+	struct virtio_net_tx *tx = &virtio_net_txs[pair];
 
-		/*
-		 * Release this chain and handle more chains.
-		 */
-		vq_relchain(vq, idx, len);
-	} while (vq_has_descs(vq));
+	if (rx->vcpu)
+		return;
 
-	/* Interrupt if needed, including for NOTIFY_ON_EMPTY. */
-	vq_endchains(vcpu, vq, 1);
+	assert(rx->thd && tx->thd);
+	tx->vcpu = vcpu;
+	rx->vcpu = vcpu;
+	sched_thd_wakeup(rx->thd);
 }
 
+/*
+ * The nicmgr answers the ARP requests for the guest's address, and
+ * the guest's requests never reach the network: they are answered
+ * here with the neighbors the nicmgr learned, or dropped until it
+ * learns them (it then requests them), and the guest retries.
+ */
 static void
-virtio_net_proctx(struct vmrt_vm_vcpu *vcpu, struct virtio_vq_info *vq)
+virtio_net_arp(char *pkt, int len)
 {
-	struct iovec iov[VIRTIO_NET_MAXSEGS + 1];
-	int i, n;
-	int plen, tlen;
-	u16_t idx;
-
-	memset(&iov, 0, sizeof(iov));
-	/*
-	 * Obtain chain of descriptors.  The first one is
-	 * really the header descriptor, so we need to sum
-	 * up two lengths: packet length and transfer length.
-	 */
-	n = vq_getchain(vcpu, vq, &idx, iov, VIRTIO_NET_MAXSEGS, NULL);
-	if (n < 1 || n > VIRTIO_NET_MAXSEGS) {
-		printc("vtnet: virtio_net_proctx: vq_getchain = %d\n", n);
+	struct eth_hdr *eth = (struct eth_hdr *)pkt;
+	struct arp_hdr *arp = (struct arp_hdr *)(eth + 1);
+	struct virtio_net_rx *rx = &virtio_net_rxs[0];
+	struct virtio_vq_info *vq = &virtio_net_vqs[VIRTIO_NET_RXQ(0)];
+	struct ether_addr mac;
+	u64_t neigh;
+	u32_t ip;
+
+	if (len < (int)(ETH_STD_LEN + sizeof(struct arp_hdr)) || arp->arp_opcode != htons(RTE_ARP_OP_REQUEST))
+		return;
+	neigh = nic_neigh_lookup(arp->arp_data.arp_tip);
+	if (!neigh || !rx->vcpu)
 		return;
+	memcpy(&mac, &neigh, sizeof(mac));
+
+	/* The reply is the request, with the addresses swapped */
+	eth->dst_addr = eth->src_addr;
+	eth->src_addr = mac;
+	arp->arp_opcode = htons(RTE_ARP_OP_REPLY);
+	arp->arp_data.arp_tha = arp->arp_data.arp_sha;
+	ip = arp->arp_data.arp_tip;
+	arp->arp_data.arp_tip = arp->arp_data.arp_sip;
+	arp->arp_data.arp_sha = mac;
+	arp->arp_data.arp_sip = ip;
+
+	sync_lock_take(&rx->lock);
+	/* The tx thread doesn't wait for buffers, the reply is dropped without */
+	if (vq_has_descs(vq)) {
+		virtio_net_rx_one(rx, vq, pkt, len);
+		virtio_net_rx_end(rx, vq);
 	}
-	plen = 0;
-	tlen = iov[0].iov_len;
-	for (i = 1; i < n; i++) {
-		plen += iov[i].iov_len;
-		tlen += iov[i].iov_len;
+	sync_lock_release(&rx->lock);
+}
+
+/* Copy the frame of a chain, after its header, to `buf`; returns its length, or -1 if it doesn't fit */
+static int
+virtio_net_tx_copy(char *buf, size_t cap, struct iovec *iov, int n)
+{
+	size_t off = virtio_net_hdr_len(), len = 0, sz;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		if (iov[i].iov_len <= off) {
+			off -= iov[i].iov_len;
+			continue;
+		}
+		sz = iov[i].iov_len - off;
+		if (len + sz > cap)
+			return -1;
+		memcpy(buf + len, (char *)iov[i].iov_base + off, sz);
+		len += sz;
+		off = 0;
 	}
 
-	printc("virtio: packet send, %d bytes, %d segs\n\r", plen, n);
-	/* begin to send packets */
-	dump_packet(iov[1].iov_base, plen);
-	/* TODO: process tx output to nic component */
-	/* net->virtio_net_tx(net, &iov[1], n - 1, plen); */
+	return len;
+}
+
+/*
+ * Send the chains of the tx queue, in bursts of NIC_BATCH_MAX, and
+ * release them to the guest at the end. Returns the number of chains.
+ */
+static int
+virtio_net_tx_burst(struct virtio_net_tx *tx, struct virtio_vq_info *vq)
+{
+	struct iovec iov[VIRTIO_NET_MAXSEGS];
+	struct netshmem_pkt_buf *objs[NIC_BATCH_MAX];
+	shm_bm_objid_t objid;
+	struct eth_hdr *eth;
+	int i, n, len, nsegs, nchains = 0;
+	u16_t idx;
+
+	while (vq_has_descs(vq)) {
+		n = 0;
+		while (n < NIC_BATCH_MAX && vq_has_descs(vq)) {
+			nsegs = vq_getchain(tx->vcpu, vq, &idx, iov, VIRTIO_NET_MAXSEGS, NULL);
+			if (nsegs < 1 || nsegs > VIRTIO_NET_MAXSEGS) {
+				printc("vtnet: virtio_net_tx_burst: vq_getchain = %d\n", nsegs);
+				VM_PANIC(tx->vcpu);
+			}
+			nchains++;
+			objs[n] = netshmem_pkt_buf_alloc(&objid);
+			len = objs[n] ? virtio_net_tx_copy(objs[n]->data, PKT_BUF_SIZE - NETSHMEM_TAILROOM, iov, nsegs) : -1;
+			/* Whether the packet is sent or not, the guest can reuse its buffers */
+			vq_relchain_prepare(vq, idx, 0);
+			if (len < (int)ETH_STD_LEN) {
+				if (objs[n])
+					netshmem_pkt_buf_free(objs[n]);
+				continue;
+			}
+
+			eth = (struct eth_hdr *)objs[n]->data;
+			if (eth->ether_type == htons(ETH_TYPE_ARP)) {
+				virtio_net_arp(objs[n]->data, len);
+				netshmem_pkt_buf_free(objs[n]);
+				continue;
+			}
+			tx->descs[n] = (struct nic_pkt_desc) { .objid = objid, .pkt_offset = 0, .pkt_len = len };
+			n++;
+		}
+
+		if (n > 0)
+			nic_send_packets(tx->descs_id, n);
+		/* The nic holds a reference to the packets it sent */
+		for (i = 0; i < n; i++)
+			netshmem_pkt_buf_free(objs[i]);
+	}
+	if (nchains) {
+		vq_relchain_publish(vq);
+		vq_endchains(tx->vcpu, vq, 1);
+	}
 
-	/* chain is processed, release it and set tlen */
-	vq_relchain(vq, idx, tlen);
+	return nchains;
 }
 
 static void
-virtio_net_tx_thread(void *param, struct vmrt_vm_vcpu *vcpu)
+virtio_net_tx_thd(void *d)
 {
-	struct virtio_vq_info *vq = &virtio_net_vqs[VIRTIO_NET_TXQ];
+	struct virtio_net_tx *tx = d;
+	struct virtio_vq_info *vq = &virtio_net_vqs[VIRTIO_NET_TXQ(tx - virtio_net_txs)];
+	cycles_t idle;
+
+	netshmem_create();
+	nic_shmem_map(netshmem_get_shm_id());
+	nic_bind_tx();
+	tx->descs = shm_bm_alloc_net_pkt_buf(netshmem_get_shm(), &tx->descs_id);
+	assert(tx->descs);
+
+	while (1) {
+		while (!tx->vcpu || !vq_ring_ready(vq)) {
+			tx->waiting = 1;
+			sched_thd_block(0);
+		}
 
-	while (!vq_ring_ready(vq))
-		VM_PANIC(vcpu);
+		/* Poll the ring while the guest is busy sending, without its notifications */
+		vq_kick_enable(vq, 0);
+		idle = time_now();
+		do {
+			if (virtio_net_tx_burst(tx, vq))
+				idle = time_now();
+		} while (time_now() - idle < virtio_net_poll_cycs);
+
+		tx->waiting = 1;
+		vq_kick_enable(vq, 1);
+		/* The guest might have added packets before it saw the notifications enabled */
+		if (vq_has_descs(vq)) {
+			tx->waiting = 0;
+			continue;
+		}
+		/* The notification wakes us up, even if it is before we block */
+		sched_thd_block(0);
+		tx->waiting = 0;
+	}
+}
 
-	vq->used->flags |= VRING_USED_F_NO_NOTIFY;
+/*
+ * Create the I/O threads of the queues on the calling core. They poll
+ * the rings while busy, if they have the core to themselves.
+ */
+void
+virtio_net_io_thds_create(int poll)
+{
+	int i;
 
-	do {
-		/*
-		* Run through entries, placing them into
-		* iovecs and sending when an end-of-packet
-		* is found
-		*/
-		virtio_net_proctx(vcpu, vq);
-	} while (vq_has_descs(vq));
-	printc("tx done on busrt\n");
+	virtio_net_poll_cycs = poll ? time_usec2cyc(VIRTIO_NET_POLL_USECS) : 0;
+	for (i = 0; i < VIRTIO_NET_MAX_PAIRS; i++) {
+		virtio_net_rxs[i].thd = sched_thd_create(virtio_net_rx_thd, &virtio_net_rxs[i]);
+		assert(virtio_net_rxs[i].thd);
+		sched_thd_param_set(virtio_net_rxs[i].thd, sched_param_pack(SCHEDP_PRIO, VIRTIO_NET_IO_PRIO));
+		virtio_net_txs[i].thd = sched_thd_create(virtio_net_tx_thd, &virtio_net_txs[i]);
+		assert(virtio_net_txs[i].thd);
+		sched_thd_param_set(virtio_net_txs[i].thd, sched_param_pack(SCHEDP_PRIO, VIRTIO_NET_IO_PRIO));
+	}
+}
 
-	/*
-	 * Generate an interrupt if needed.
-	 */
+/* The only command of the control queue is the number of queue pairs the guest uses */
+static void
+virtio_net_ctrl(struct vmrt_vm_vcpu *vcpu, struct virtio_vq_info *vq)
+{
+	struct iovec iov[VIRTIO_NET_MAXSEGS];
+	struct virtio_net_ctrl_hdr *hdr;
+	u16_t idx, pairs;
+	u8_t *ack;
+	int i, n;
+
+	if (!vq_ring_ready(vq))
+		return;
+
+	while (vq_has_descs(vq)) {
+		n = vq_getchain(vcpu, vq, &idx, iov, VIRTIO_NET_MAXSEGS, NULL);
+		if (n < 2)
+			VM_PANIC(vcpu);
+
+		/* The header, the data of the command, then the ack */
+		hdr = iov[0].iov_base;
+		ack = iov[n - 1].iov_base;
+		*ack = VIRTIO_NET_ERR;
+		if (hdr->class == VIRTIO_NET_CTRL_MQ && hdr->cmd == VIRTIO_NET_CTRL_MQ_VQ_PAIRS_SET && n == 3 && iov[1].iov_len >= sizeof(u16_t)) {
+			pairs = *(u16_t *)iov[1].iov_base;
+			if (pairs >= 1 && pairs <= VIRTIO_NET_MAX_PAIRS) {
+				for (i = 0; i < pairs; i++)
+					virtio_net_pair_start(vcpu, i);
+				*ack = VIRTIO_NET_OK;
+			}
+		}
+		vq_relchain(vq, idx, sizeof(*ack));
+	}
 	vq_endchains(vcpu, vq, 1);
 }
 
+static void
+virtio_net_notify(struct vmrt_vm_vcpu *vcpu, u16_t q)
+{
+	struct virtio_net_rx *rx;
+	struct virtio_net_tx *tx;
+
+	if (q == VIRTIO_NET_CTLQ) {
+		virtio_net_ctrl(vcpu, &virtio_net_vqs[q]);
+	} else if (q > VIRTIO_NET_CTLQ) {
+		VM_PANIC(vcpu);
+	} else if (q == VIRTIO_NET_TXQ(q / 2)) {
+		/* The packets are sent by the queue's thread, we only wake it up */
+		tx = &virtio_net_txs[q / 2];
+		if (tx->waiting && tx->thd) {
+			tx->waiting = 0;
+			sched_thd_wakeup(tx->thd);
+		}
+	} else {
+		/* The guest added rx buffers, the receiving thread might wait for them */
+		rx = &virtio_net_rxs[q / 2];
+		if (rx->waiting && rx->thd) {
+			rx->waiting = 0;
+			sched_thd_wakeup(rx->thd);
+		}
+	}
+}
+
 static void
 virtio_net_outb(u32_t port_id, struct vmrt_vm_vcpu *vcpu)
 {
@@ -474,6 +779,9 @@ virtio_net_outb(u32_t port_id, struct vmrt_vm_vcpu *vcpu)
 	{
 	case VIRTIO_NET_DEV_STATUS:
 		virtio_net_regs.header.dev_status = val;
+		/* The first pair is used as soon as the driver is ready, the others once they are set */
+		if (val & VIRTIO_CONFIG_S_DRIVER_OK)
+			virtio_net_pair_start(vcpu, 0);
 		break;
 	default:
 		VM_PANIC(vcpu);
@@ -482,43 +790,37 @@ virtio_net_outb(u32_t port_id, struct vmrt_vm_vcpu *vcpu)
 	return;
 }
 
-static void 
+static void
 virtio_net_inb(u32_t port_id, struct vmrt_vm_vcpu *vcpu)
 {
-	u32_t bdf = 0;
-
 	switch (port_id)
 	{
 	case VIRTIO_NET_DEV_STATUS:
 		vcpu->shared_region->ax = virtio_net_regs.header.dev_status;
 		break;
 	case VIRTIO_NET_ISR:
-		vcpu->shared_region->ax = virtio_net_regs.header.ISR;
+		/* Reading the ISR clears it */
+		vcpu->shared_region->ax = __atomic_exchange_n(&virtio_net_regs.header.ISR, 0, __ATOMIC_SEQ_CST);
 		break;
 	case VIRTIO_NET_STATUS:
-		vcpu->shared_region->ax = virtio_net_regs.config_reg.status; 
+		vcpu->shared_region->ax = virtio_net_regs.config_reg.status;
 		break;
 	case VIRTIO_NET_STATUS_H:
-		vcpu->shared_region->ax = virtio_net_regs.config_reg.status >> 8; 
+		vcpu->shared_region->ax = virtio_net_regs.config_reg.status >> 8;
 		break;
-	/* TODO: read mac address from virtio-net config space */
-	case VIRTIO_NET_MAC:
-		vcpu->shared_region->ax = 0x10;
+	case VIRTIO_NET_MAX_PAIRS_L:
+		vcpu->shared_region->ax = virtio_net_regs.config_reg.max_virtqueue_pairs;
 		break;
-	case VIRTIO_NET_MAC1:
-		vcpu->shared_region->ax = 0x10;
+	case VIRTIO_NET_MAX_PAIRS_H:
+		vcpu->shared_region->ax = virtio_net_regs.config_reg.max_virtqueue_pairs >> 8;
 		break;
+	case VIRTIO_NET_MAC:
+	case VIRTIO_NET_MAC1:
 	case VIRTIO_NET_MAC2:
-		vcpu->shared_region->ax = 0x10;
-		break;
 	case VIRTIO_NET_MAC3:
-		vcpu->shared_region->ax = 0x10;
-		break;
 	case VIRTIO_NET_MAC4:
-		vcpu->shared_region->ax = 0x10;
-		break;
 	case VIRTIO_NET_MAC5:
-		vcpu->shared_region->ax = 0x11;
+		vcpu->shared_region->ax = virtio_net_regs.config_reg.mac[port_id - VIRTIO_NET_MAC];
 		break;
 	default:
 		VM_PANIC(vcpu);
@@ -529,13 +831,16 @@ virtio_net_inb(u32_t port_id, struct vmrt_vm_vcpu *vcpu)
 static void
 virtio_net_inw(u32_t port_id, struct vmrt_vm_vcpu *vcpu)
 {
+	u16_t sel = virtio_net_regs.header.queue_select;
+
 	switch (port_id)
 	{
 	case VIRTIO_NET_QUEUE_SIZE:
-		vcpu->shared_region->ax = virtio_queues[virtio_net_regs.header.queue_select].queue_sz;
+		/* The guest finds the number of queues with their size */
+		vcpu->shared_region->ax = sel < VIRTIO_NET_MAXQ ? virtio_queues[sel].queue_sz : 0;
 		break;
 	case VIRTIO_NET_QUEUE_SELECT:
-		vcpu->shared_region->ax = virtio_net_regs.header.queue_select;
+		vcpu->shared_region->ax = sel;
 		break;
 	case VIRTIO_NET_QUEUE_NOTIFY:
 		VM_PANIC(vcpu);
@@ -558,11 +863,8 @@ virtio_net_outw(u32_t port_id, struct vmrt_vm_vcpu *vcpu)
 		virtio_net_regs.header.queue_select = val;
 		break;
 	case VIRTIO_NET_QUEUE_NOTIFY:
-		if (val == VIRTIO_NET_TXQ) {
-			virtio_net_tx_thread(0, vcpu);
-			virtio_net_tap_rx(vcpu);
-		}
 		virtio_net_regs.header.queue_notify = val;
+		virtio_net_notify(vcpu, val);
 		break;
 	default:
 		VM_PANIC(vcpu);
@@ -574,6 +876,7 @@ static void
 virtio_net_outl(u32_t port_id, struct vmrt_vm_vcpu *vcpu)
 {
 	u32_t val = vcpu->shared_region->ax;
+	u16_t sel = virtio_net_regs.header.queue_select;
 	u64_t tmp = val;
 
 	switch (port_id)
@@ -582,8 +885,10 @@ virtio_net_outl(u32_t port_id, struct vmrt_vm_vcpu *vcpu)
 		virtio_net_regs.header.guest_features = val;
 		break;
 	case VIRTIO_NET_QUEUE_ADDR:
-		virtio_queues[virtio_net_regs.header.queue_select].queue = (void *)tmp;
-		virtio_vq_init(vcpu, virtio_net_regs.header.queue_select, val);
+		if (sel >= VIRTIO_NET_MAXQ)
+			VM_PANIC(vcpu);
+		virtio_queues[sel].queue = (void *)tmp;
+		virtio_vq_init(vcpu, sel, val);
 		break;
 	default:
 		VM_PANIC(vcpu);
@@ -651,15 +956,39 @@ virtio_net_handler(u16_t port, int dir, int sz, struct vmrt_vm_vcpu *vcpu)
 void
 virtio_net_io_init(void)
 {
+	int i;
+
 	memset(&virtio_net_regs, 0, sizeof(virtio_net_regs));
 	memset(&virtio_queues, 0, sizeof(virtio_queues));
 	memset(&virtio_net_vqs, 0, sizeof(virtio_net_vqs));
+	memset(&virtio_net_rxs, 0, sizeof(virtio_net_rxs));
+	memset(&virtio_net_txs, 0, sizeof(virtio_net_txs));
 
 	virtio_net_regs.header.dev_features |= (1 << VIRTIO_NET_F_STATUS);
 	virtio_net_regs.header.dev_features |= (1 << VIRTIO_NET_F_MAC);
+	virtio_net_regs.header.dev_features |= (1 << VIRTIO_NET_F_MRG_RXBUF);
+	virtio_net_regs.header.dev_features |= (1 << VIRTIO_NET_F_CTRL_VQ);
+	virtio_net_regs.header.dev_features |= (1 << VIRTIO_NET_F_MQ);
+	virtio_net_regs.header.dev_features |= (1 << VIRTIO_RING_F_EVENT_IDX);
 	virtio_net_regs.config_reg.status = VIRTIO_NET_S_LINK_UP;
-	virtio_queues[0].queue_sz = VQ_MAX_DESCRIPTORS;
-	virtio_queues[1].queue_sz = VQ_MAX_DESCRIPTORS;
-	virtio_net_vqs[VIRTIO_NET_RX].qsize = VQ_MAX_DESCRIPTORS;
-	virtio_net_vqs[VIRTIO_NET_TX].qsize = VQ_MAX_DESCRIPTORS;
-}
\ No newline at end of file
+	virtio_net_regs.config_reg.max_virtqueue_pairs = VIRTIO_NET_MAX_PAIRS;
+
+	for (i = 0; i < VIRTIO_NET_MAXQ; i++) {
+		virtio_queues[i].queue_sz = VQ_MAX_DESCRIPTORS;
+		virtio_net_vqs[i].qsize = VQ_MAX_DESCRIPTORS;
+	}
+	for (i = 0; i < VIRTIO_NET_MAX_PAIRS; i++)
+		sync_lock_init(&virtio_net_rxs[i].lock);
+}
+
+/* The device is initialized by a constructor, before the nicmgr can be invoked */
+void
+virtio_net_nic_init(void)
+{
+	u64_t mac;
+
+	/* The guest uses the address of the NIC's port, whose packets the nicmgr gives us */
+	virtio_net_ip = inet_addr(VIRTIO_NET_GUEST_IP);
+	mac = nic_get_port_mac_address(0);
+	memcpy(virtio_net_regs.config_reg.mac, &mac, sizeof(virtio_net_regs.config_reg.mac));
+}
@@ -2,6 +2,7 @@
 
 #include <cos_types.h>
 #include <vmrt.h>
+#include "virtio_vq.h"
 
 #define VIRTIO_NET_IO_ADDR 0x4000
 
@@ -23,6 +24,8 @@
 
 #define VIRTIO_NET_STATUS (VIRTIO_NET_IO_ADDR + 26)
 #define VIRTIO_NET_STATUS_H (VIRTIO_NET_IO_ADDR + 27)
+#define VIRTIO_NET_MAX_PAIRS_L (VIRTIO_NET_IO_ADDR + 28)
+#define VIRTIO_NET_MAX_PAIRS_H (VIRTIO_NET_IO_ADDR + 29)
 
 #define VIRTIO_NET_F_CSUM (0)
 #define VIRTIO_NET_F_GUEST_CSUM (1)
@@ -42,48 +45,33 @@
 #define VIRTIO_NET_F_CTRL_RX (18)
 #define VIRTIO_NET_F_CTRL_VLAN (19)
 #define VIRTIO_NET_F_GUEST_ANNOUNCE (21)
+#define VIRTIO_NET_F_MQ (22)
 
 #define VIRTIO_NET_RINGSZ	512
 #define VIRTIO_NET_MAXSEGS	256
-#define	VQ_MAX_DESCRIPTORS	512
-
-struct virtio_header {
-	u32_t dev_features;
-	u32_t guest_features;
-	u32_t queue_addr;
-	u16_t queue_size;
-	u16_t queue_select;
-	u16_t queue_notify;
-	u8_t dev_status;
-	u8_t ISR;
-} __attribute__((packed));
-
-struct virtio_queue {
-	u16_t queue_sz;
-	void *queue;
-};
 
 #define VIRTIO_NET_S_LINK_UP 1
 #define VIRTIO_NET_S_ANNOUNCE 2
 
-#define VIRTIO_NET_RX 0
-#define VIRTIO_NET_TX 1
-
-#define VIRTIO_NET_RXQ	0
-#define VIRTIO_NET_TXQ	1
-#define VIRTIO_NET_CTLQ	2
+/*
+ * The queue pairs of the device, each received by its own thread from
+ * the nicmgr, followed by the control queue.
+ */
+#define VIRTIO_NET_MAX_PAIRS	4
 
-#define VIRTIO_NET_MAXQ	3
+#define VIRTIO_NET_RXQ(pair)	(2 * (pair))
+#define VIRTIO_NET_TXQ(pair)	(2 * (pair) + 1)
+#define VIRTIO_NET_CTLQ		(2 * VIRTIO_NET_MAX_PAIRS)
 
-#define VRING_PAGE_BITS		12
-#define VIRTIO_PCI_VRING_ALIGN	4096
+#define VIRTIO_NET_MAXQ		(VIRTIO_NET_CTLQ + 1)
 
-#define	VQ_ALLOC	0x01	/* set once we have a pfn */
-#define	VQ_BROKED	0x02
+/* The address of the guest: the nicmgr delivers all of its TCP and UDP packets to the device */
+#define VIRTIO_NET_GUEST_IP	"10.10.1.2"
 
 struct virtio_net_config {
 	u8_t mac[6];
 	u16_t status;
+	u16_t max_virtqueue_pairs;
 } __attribute__((packed));
 
 struct virtio_net_io_reg {
@@ -91,41 +79,10 @@ struct virtio_net_io_reg {
 	struct virtio_net_config config_reg;
 } __attribute__((packed));
 
-struct iovec
-{
-    void *iov_base;	/* Pointer to data.  */
-    size_t iov_len;	/* Length of data.  */
-};
-
-struct virtio_vq_info {
-	u16_t qsize;		/* size of this queue (a power of 2) */
-	void (*notify)(void *, struct virtio_vq_info *);
-				/* called instead of notify, if not NULL */
-
-	u16_t num;		/* the num'th queue in the virtio_base */
-
-	u16_t flags;		/* flags (see above) */
-	u16_t last_avail;	/* a recent value of avail->idx */
-	u16_t save_used;	/* saved used->idx; see vq_endchains */
-	u16_t msix_idx;		/* MSI-X index, or VIRTIO_MSI_NO_VECTOR */
-
-	u32_t pfn;		/* PFN of virt queue (not shifted!) */
-
-	volatile struct vring_desc *desc;
-				/* descriptor array */
-	volatile struct vring_avail *avail;
-				/* the "avail" ring */
-	volatile struct vring_used *used;
-				/* the "used" ring */
-
-	u32_t gpa_desc[2];	/* gpa of descriptors */
-	u32_t gpa_avail[2];	/* gpa of avail_ring */
-	u32_t gpa_used[2];	/* gpa of used_ring */
-	int enabled;		/* whether the virtqueue is enabled */
-};
 
 /*
- * Fixed network header size
+ * The network header, whose number of buffers is only there with
+ * mergeable rx buffers.
  */
 struct virtio_net_rxhdr {
 	u8_t	vrh_flags;
@@ -134,7 +91,20 @@ struct virtio_net_rxhdr {
 	u16_t	vrh_gso_size;
 	u16_t	vrh_csum_start;
 	u16_t	vrh_csum_offset;
-	/* u16_t	vrh_bufs; */
+	u16_t	vrh_bufs;
 } __attribute__((packed));
 
+struct virtio_net_ctrl_hdr {
+	u8_t	class;
+	u8_t	cmd;
+} __attribute__((packed));
+
+#define VIRTIO_NET_OK	0
+#define VIRTIO_NET_ERR	1
+
+#define VIRTIO_NET_CTRL_MQ			4
+#define VIRTIO_NET_CTRL_MQ_VQ_PAIRS_SET		0
+
 void virtio_net_handler(u16_t port, int dir, int sz, struct vmrt_vm_vcpu *vcpu);
+void virtio_net_nic_init(void);
+void virtio_net_io_thds_create(int poll);
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <cos_types.h>
+#include <llprint.h>
+#include <vmrt.h>
+#include "virtio_ring.h"
+
+/*
+ * The legacy virtio-pci transport, and the virtqueues, shared by the
+ * virtio devices: their registers start with the header, followed
+ * by the configuration of the device.
+ */
+
+#define	VQ_MAX_DESCRIPTORS	512
+
+struct virtio_header {
+	u32_t dev_features;
+	u32_t guest_features;
+	u32_t queue_addr;
+	u16_t queue_size;
+	u16_t queue_select;
+	u16_t queue_notify;
+	u8_t dev_status;
+	u8_t ISR;
+} __attribute__((packed));
+
+struct virtio_queue {
+	u16_t queue_sz;
+	void *queue;
+};
+
+#define VIRTIO_CONFIG_S_DRIVER_OK 4
+
+#define VRING_PAGE_BITS		12
+#define VIRTIO_PCI_VRING_ALIGN	4096
+
+#define	VQ_ALLOC	0x01	/* set once we have a pfn */
+#define	VQ_BROKED	0x02
+
+struct iovec
+{
+    void *iov_base;	/* Pointer to data.  */
+    size_t iov_len;	/* Length of data.  */
+};
+
+struct virtio_vq_info {
+	u16_t qsize;		/* size of this queue (a power of 2) */
+	void (*notify)(void *, struct virtio_vq_info *);
+				/* called instead of notify, if not NULL */
+
+	u16_t num;		/* the num'th queue in the virtio_base */
+
+	u16_t flags;		/* flags (see above) */
+	u16_t last_avail;	/* a recent value of avail->idx */
+	u16_t save_used;	/* saved used->idx; see vq_endchains */
+	u16_t used_idx;		/* used->idx with the chains released, see vq_relchain_publish */
+	u16_t msix_idx;		/* MSI-X index, or VIRTIO_MSI_NO_VECTOR */
+
+	u32_t pfn;		/* PFN of virt queue (not shifted!) */
+
+	volatile struct vring_desc *desc;
+				/* descriptor array */
+	volatile struct vring_avail *avail;
+				/* the "avail" ring */
+	volatile struct vring_used *used;
+				/* the "used" ring */
+
+	u32_t gpa_desc[2];	/* gpa of descriptors */
+	u32_t gpa_avail[2];	/* gpa of avail_ring */
+	u32_t gpa_used[2];	/* gpa of used_ring */
+	int enabled;		/* whether the virtqueue is enabled */
+};
+
+#define roundup2(x, y)  (((x)+((y)-1))&(~((y)-1)))
+#define mb()    ({ asm volatile("mfence" ::: "memory"); (void)0; })
+
+static inline int
+vq_ring_ready(struct virtio_vq_info *vq)
+{
+	return vq->flags & VQ_ALLOC;
+}
+
+static inline int
+vq_has_descs(struct virtio_vq_info *vq)
+{
+	int ret = 0;
+	if (vq_ring_ready(vq) && vq->last_avail != vq->avail->idx) {
+		if ((u16_t)((unsigned int)vq->avail->idx - vq->last_avail) > vq->qsize)
+			printc ("no valid descriptor\n");
+		else
+			ret = 1;
+	}
+	return ret;
+
+}
+
+/* Put the chain in the used ring, for the guest to see it with the others at vq_relchain_publish */
+static inline void
+vq_relchain_prepare(struct virtio_vq_info *vq, u16_t idx, u32_t iolen)
+{
+	volatile struct vring_used_elem *vue;
+
+	/* The mask is qsize - 1, as it is a power of 2 */
+	vue = &vq->used->ring[vq->used_idx++ & (vq->qsize - 1)];
+	vue->id = idx;
+	vue->len = iolen;
+}
+
+static inline void
+vq_relchain_publish(struct virtio_vq_info *vq)
+{
+	/* The stores to the ring are ordered before the index on x86, only the compiler can reorder them */
+	asm volatile("" ::: "memory");
+	vq->used->idx = vq->used_idx;
+}
+
+void *paddr_guest2host(uintptr_t gaddr, struct vmrt_vm_comp *vm);
+int vq_ring_init(struct vmrt_vm_vcpu *vcpu, struct virtio_vq_info *vq, u32_t pfn);
+int vq_getchain(struct vmrt_vm_vcpu *vcpu, struct virtio_vq_info *vq, u16_t *pidx,
+		struct iovec *iov, int n_iov, u16_t *flags);
+void vq_relchain(struct virtio_vq_info *vq, u16_t idx, u32_t iolen);
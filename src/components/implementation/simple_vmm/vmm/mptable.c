@@ -0,0 +1,112 @@
+/*
+ * The MultiProcessor Specification table through which the guest
+ * discovers its vcpus: a processor entry for each, with the APIC ID
+ * of its vlapic (its vcpu number), the first one being the BSP. There
+ * is no I/O APIC, so the guest keeps the interrupt controllers in
+ * virtual wire mode.
+ */
+#include <string.h>
+#include <cos_types.h>
+#include <cos_debug.h>
+#include <vmrt.h>
+#include "mptable.h"
+
+#define MP_SPEC_REV   4
+#define MP_LAPIC_ADDR 0xFEE00000
+/* As in the version register of the vlapics */
+#define MP_LAPIC_VER  0x15
+
+#define MPE_TYPE_PROC 0
+#define MPE_PROC_EN   (1 << 0)
+#define MPE_PROC_BSP  (1 << 1)
+
+struct mp_floating {
+	char sig[4];
+	u32_t table;
+	u8_t len;
+	u8_t rev;
+	u8_t checksum;
+	u8_t features[5];
+} __attribute__((packed));
+
+struct mp_table_hdr {
+	char sig[4];
+	u16_t len;
+	u8_t rev;
+	u8_t checksum;
+	char oem[8];
+	char product[12];
+	u32_t oem_table;
+	u16_t oem_table_sz;
+	u16_t nentries;
+	u32_t lapic;
+	u16_t ext_len;
+	u8_t ext_checksum;
+	u8_t reserved;
+} __attribute__((packed));
+
+struct mp_proc_entry {
+	u8_t type;
+	u8_t apic_id;
+	u8_t apic_ver;
+	u8_t flags;
+	u32_t signature;
+	u32_t features;
+	u32_t reserved[2];
+} __attribute__((packed));
+
+struct mptable {
+	struct mp_floating fp;
+	struct mp_table_hdr hdr;
+	struct mp_proc_entry procs[VMRT_VM_MAX_VCPU];
+} __attribute__((packed));
+
+static u8_t
+mp_checksum(void *base, size_t len)
+{
+	u8_t *b = base, sum = 0;
+	size_t i;
+
+	for (i = 0; i < len; i++) sum += b[i];
+
+	return -sum;
+}
+
+void
+mptable_build(struct vmrt_vm_comp *vm)
+{
+	struct mptable t;
+	size_t len;
+	int i;
+
+	assert(vm->num_vpu <= VMRT_VM_MAX_VCPU);
+	memset(&t, 0, sizeof(t));
+
+	for (i = 0; i < vm->num_vpu; i++) {
+		t.procs[i] = (struct mp_proc_entry) {
+			.type     = MPE_TYPE_PROC,
+			.apic_id  = i,
+			.apic_ver = MP_LAPIC_VER,
+			.flags    = MPE_PROC_EN | (i == 0 ? MPE_PROC_BSP : 0),
+		};
+	}
+	len = sizeof(t.hdr) + vm->num_vpu * sizeof(struct mp_proc_entry);
+
+	memcpy(t.hdr.sig, "PCMP", 4);
+	t.hdr.len      = len;
+	t.hdr.rev      = MP_SPEC_REV;
+	memcpy(t.hdr.oem, "COMPOSIT", 8);
+	memcpy(t.hdr.product, "SIMPLE VMM  ", 12);
+	t.hdr.nentries = vm->num_vpu;
+	t.hdr.lapic    = MP_LAPIC_ADDR;
+	t.hdr.checksum = mp_checksum(&t.hdr, len);
+
+	/* The configuration table directly follows the floating pointer */
+	memcpy(t.fp.sig, "_MP_", 4);
+	t.fp.table     = MPTABLE_GPA + sizeof(t.fp);
+	t.fp.len       = sizeof(t.fp) / 16;
+	t.fp.rev       = MP_SPEC_REV;
+	t.fp.checksum  = mp_checksum(&t.fp, sizeof(t.fp));
+
+	vmrt_vm_data_copy_to(vm, (char *)&t, sizeof(t.fp) + len, MPTABLE_GPA);
+}
@@ -0,0 +1,8 @@
+#pragma once
+
+#include <vmrt.h>
+
+/* In the BIOS area, where the guest looks for the MP floating pointer */
+#define MPTABLE_GPA 0xF0000
+
+void mptable_build(struct vmrt_vm_comp *vm);
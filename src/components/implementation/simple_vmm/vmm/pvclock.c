@@ -0,0 +1,121 @@
+/*
+ * The kvmclock paravirtual clock: the guest reads the time from the
+ * TSC, that doesn't exit, scaled with the parameters of a page per
+ * vcpu. The TSC is the host's, invariant and synchronized across the
+ * cores, so the parameters never change and the pages are only filled
+ * when the guest registers them, and flagged stable: the guest doesn't
+ * have to keep the clock monotonic across vcpus itself.
+ */
+#include <string.h>
+#include <cos_types.h>
+#include <cos_debug.h>
+#include <sched.h>
+#include <ps.h>
+#include <vmrt.h>
+#include "pvclock.h"
+
+#define PVCLOCK_SYSTEM_TIME_EN 1ULL
+#define PVCLOCK_TSC_STABLE_BIT (1 << 0)
+
+struct pvclock_vcpu_time_info {
+	u32_t version;
+	u32_t pad0;
+	u64_t tsc_timestamp;
+	u64_t system_time;
+	u32_t tsc_to_system_mul;
+	s8_t tsc_shift;
+	u8_t flags;
+	u8_t pad[2];
+} __attribute__((packed));
+
+struct pvclock_wall_clock {
+	u32_t version;
+	u32_t sec;
+	u32_t nsec;
+} __attribute__((packed));
+
+/* The guest's time is 0 at the boot TSC, and there is no wall clock: it starts at the epoch, as the vrtc */
+static u64_t pvclock_boot_tsc;
+static u32_t pvclock_mul;
+static s8_t pvclock_shift;
+static u64_t pvclock_system_time_msr[VMRT_VM_MAX_VCPU];
+
+/*
+ * ns = ((cycles << shift) * mul) >> 32 (a negative shift being a right
+ * shift), with mul as precise as 32 bits allow, as KVM computes it.
+ */
+static void
+pvclock_scale(u64_t scaled, u64_t base, u32_t *mul, s8_t *shift)
+{
+	u64_t base64 = base;
+	u32_t base32;
+	s8_t s = 0;
+
+	while (base64 > scaled * 2 || base64 & 0xffffffff00000000ULL) {
+		base64 >>= 1;
+		s--;
+	}
+	base32 = (u32_t)base64;
+	while (base32 <= scaled || scaled & 0xffffffff00000000ULL) {
+		if (scaled & 0xffffffff00000000ULL || base32 & 0x80000000) scaled >>= 1;
+		else base32 <<= 1;
+		s++;
+	}
+
+	*shift = s;
+	*mul   = (u32_t)((scaled << 32) / base32);
+}
+
+void
+pvclock_init(void)
+{
+	unsigned long cycs_per_usec = sched_get_cpu_freq();
+
+	assert(cycs_per_usec);
+	pvclock_boot_tsc = ps_tsc();
+	/* Nanoseconds per cycle are 1000 / cycs_per_usec */
+	pvclock_scale(1000, cycs_per_usec, &pvclock_mul, &pvclock_shift);
+}
+
+void
+pvclock_wall_clock_set(struct vmrt_vm_vcpu *vcpu, u64_t gpa)
+{
+	volatile struct pvclock_wall_clock *wc = GPA2HVA(gpa, vcpu->vm);
+
+	/* An odd version while it is updated */
+	wc->version++;
+	ps_mem_fence();
+	wc->sec  = 0;
+	wc->nsec = 0;
+	ps_mem_fence();
+	wc->version++;
+}
+
+void
+pvclock_system_time_set(struct vmrt_vm_vcpu *vcpu, u64_t val)
+{
+	u64_t gpa = val & ~PVCLOCK_SYSTEM_TIME_EN;
+	volatile struct pvclock_vcpu_time_info *ti = GPA2HVA(gpa, vcpu->vm);
+
+	assert(vcpu->cpuid < VMRT_VM_MAX_VCPU);
+	pvclock_system_time_msr[vcpu->cpuid] = val;
+	if (!(val & PVCLOCK_SYSTEM_TIME_EN)) return;
+
+	ti->version++;
+	ps_mem_fence();
+	ti->tsc_timestamp     = pvclock_boot_tsc;
+	ti->system_time       = 0;
+	ti->tsc_to_system_mul = pvclock_mul;
+	ti->tsc_shift         = pvclock_shift;
+	ti->flags             = PVCLOCK_TSC_STABLE_BIT;
+	ps_mem_fence();
+	ti->version++;
+}
+
+u64_t
+pvclock_system_time_get(struct vmrt_vm_vcpu *vcpu)
+{
+	assert(vcpu->cpuid < VMRT_VM_MAX_VCPU);
+
+	return pvclock_system_time_msr[vcpu->cpuid];
+}
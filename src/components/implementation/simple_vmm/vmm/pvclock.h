@@ -0,0 +1,16 @@
+#pragma once
+
+#include <vmrt.h>
+
+/* The kvmclock MSRs, through which the guest gives the GPAs of the pages to fill */
+#define MSR_KVM_WALL_CLOCK_NEW  0x4b564d00
+#define MSR_KVM_SYSTEM_TIME_NEW 0x4b564d01
+
+/* The KVM paravirtual features of leaf 0x40000101 */
+#define KVM_FEATURE_CLOCKSOURCE2          (1U << 3)
+#define KVM_FEATURE_CLOCKSOURCE_STABLE_BIT (1U << 24)
+
+void pvclock_init(void);
+void pvclock_wall_clock_set(struct vmrt_vm_vcpu *vcpu, u64_t gpa);
+void pvclock_system_time_set(struct vmrt_vm_vcpu *vcpu, u64_t val);
+u64_t pvclock_system_time_get(struct vmrt_vm_vcpu *vcpu);
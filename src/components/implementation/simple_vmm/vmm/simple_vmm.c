@@ -15,6 +15,12 @@
 #include <vmrt.h>
 
 #include <vlapic.h>
+#include "vcpuid.h"
+#include "vmsr.h"
+#include "mptable.h"
+#include "pvclock.h"
+#include "devices/vpci/virtio_net_io.h"
+#include "devices/vpci/virtio_blk_io.h"
 
 INCBIN(vmlinux, "guest/vmlinux.img")
 INCBIN(bios, "guest/guest.img")
@@ -22,12 +28,36 @@ INCBIN(bios, "guest/guest.img")
 
 /* Currently only have one VM component globally managed by this VMM */
 static struct vmrt_vm_comp *g_vm;
+/* Its memory, shared with the backends of its devices */
+static cbuf_t g_vm_mem;
 
-#define VM_MAX_COMPS (2)
+/* The number of VMs created from the snapshot the guest takes of itself */
+#ifndef VM_NUM_CLONES
+#define VM_NUM_CLONES 0
+#endif
+
+#define VM_MAX_COMPS (1 + VM_NUM_CLONES)
 
 SS_STATIC_SLAB(vm_comp, struct vmrt_vm_comp, VM_MAX_COMPS);
 SS_STATIC_SLAB(vm_lapic, struct acrn_vlapic, VM_MAX_COMPS * VMRT_VM_MAX_VCPU);
 
+/* The number of vcpus of the VM, each on its own core */
+#ifndef VM_NUM_VCPU
+#define VM_NUM_VCPU 1
+#endif
+
+/* In the BIOS (ap_sipi_vector), where the APs find the vector they are started at */
+#define VM_SIPI_VECTOR_GPA 0x1008
+
+/* The main threads of the cores of the APs, waiting for their STARTUP IPI */
+static thdid_t vm_ap_thds[VMRT_VM_MAX_VCPU];
+static int vm_ap_started[VMRT_VM_MAX_VCPU];
+
+/* The snapshot of the first VM, and the vlapic of its vcpu, that the clones start from */
+static struct vmrt_vm_snapshot vm_snapshot;
+static struct acrn_vlapic vm_snapshot_vlapic;
+static cycles_t vm_snapshot_start;
+
 void
 init_lapic(struct vmrt_vm_vcpu *vcpu)
 {
@@ -47,7 +77,8 @@ init_lapic(struct vmrt_vm_vcpu *vcpu)
 	/* Status: enable APIC and vector be 0xFF */
 	lapic->svr.v = 0x1FF;
 	lapic->version.v = 0x50015;
-	lapic->id.v = 0x3000000;
+	/* The APIC ID of a vcpu is its number, as in the cpuid and the MP table */
+	lapic->id.v = (u32_t)vcpu->cpuid << 24;
 
 	lapic->dfr.v = 0xFFFFFFFFU;
 	lapic->icr_timer.v = 0U;
@@ -64,24 +95,27 @@ struct vmrt_vm_comp *
 vm_comp_create(void)
 {
 	u64_t guest_mem_sz = 64*1024*1024;
-	u64_t num_vpu = 1;
+	u64_t num_vpu = VM_NUM_VCPU;
 	void *start;
 	void *end;
 	cbuf_t shm_id;
-	void  *mem, *vm_mem;
+	void  *mem;
 	size_t sz;
+	cycles_t map_start;
 
 	struct vmrt_vm_comp *vm = ss_vm_comp_alloc();
 	assert(vm);
+	assert(num_vpu > 0 && num_vpu <= NUM_CPU && num_vpu <= VMRT_VM_MAX_VCPU);
 	
 	vmrt_vm_create(vm, "vmlinux-5.15", num_vpu, guest_mem_sz);
 
-	/* Allocate memory for the VM */
-	shm_id	= contigmem_shared_alloc_aligned(guest_mem_sz / PAGE_SIZE_4K, PAGE_SIZE_4K, (vaddr_t *)&mem);
+	/* Allocate memory for the VM, as superpages so that the EPT can map it with 2MB entries */
+	shm_id	= contigmem_shared_alloc_aligned(guest_mem_sz / PAGE_SIZE_4K, SUPER_PAGE_SIZE, (vaddr_t *)&mem);
 	/* Make the memory accessible to VM */
-	memmgr_shared_page_map_aligned_in_vm(shm_id, PAGE_SIZE_4K, (vaddr_t *)&vm_mem, vm->comp_id);
-	vmrt_vm_mem_init(vm, mem);
-	printc("created VM with %u cpus, memory size: %luMB, at host vaddr: %p\n", vm->num_vpu, vm->guest_mem_sz/1024/1024, vm->guest_addr);
+	map_start = ps_tsc();
+	vmrt_vm_mem_init(vm, mem, shm_id);
+	g_vm_mem = shm_id;
+	printc("created VM with %u cpus, memory size: %luMB, at host vaddr: %p (mapped in %llu cycles)\n", vm->num_vpu, vm->guest_mem_sz/1024/1024, vm->guest_addr, ps_tsc() - map_start);
 
 	ss_vm_comp_activate(vm);
 
@@ -91,7 +125,8 @@ vm_comp_create(void)
 
 	printc("BIOS image start: %p, end: %p, size: %lu(%luKB)\n", start, end, sz, sz/1024);
 	vmrt_vm_data_copy_to(vm, start, sz, PAGE_SIZE_4K);
-	
+	mptable_build(vm);
+
 	start = &incbin_vmlinux_start;
 	end = &incbin_vmlinux_end;
 	sz = end - start + 1;
@@ -105,10 +140,122 @@ vm_comp_create(void)
 	return vm;
 }
 
+/*
+ * The guest starts its APs with INIT-SIPI-SIPI: the first STARTUP IPI
+ * wakes the main thread of the AP's core that starts the vcpu, in the
+ * BIOS, which jumps to the vector. The guest starts the APs one at a
+ * time, waiting for each to be up, so that they share the vector.
+ */
+void
+vm_vcpu_sipi(struct vmrt_vm_vcpu *vcpu, uint32_t vector)
+{
+	volatile u16_t *sipi_vector = GPA2HVA(VM_SIPI_VECTOR_GPA, vcpu->vm);
+
+	if (vcpu->cpuid == 0 || vm_ap_started[vcpu->cpuid]) return;
+
+	*sipi_vector = vector;
+	__atomic_store_n(&vm_ap_started[vcpu->cpuid], 1, __ATOMIC_SEQ_CST);
+	sched_thd_wakeup(vm_ap_thds[vcpu->cpuid]);
+}
+
+/*
+ * The guest takes a snapshot of itself with a vmcall, that returns 0
+ * in the guest, and 1 in its clones, that start from the instruction
+ * that follows it. Only the first VM can take one, once.
+ */
+void
+snapshot_handler(struct vmrt_vm_vcpu *vcpu)
+{
+	struct vm_vcpu_shared_region *regs = vcpu->shared_region;
+	void *mem;
+
+	GOTO_NEXT_INST(regs);
+	if (vcpu->vm != g_vm || vm_snapshot.mem || vcpu->vm->num_vpu != 1) {
+		regs->ax = ~0UL;
+		return;
+	}
+	regs->ax = 0;
+
+	mem = (void *)contigmem_alloc(vcpu->vm->guest_mem_sz / PAGE_SIZE_4K);
+	assert(mem);
+
+	vm_snapshot_start = ps_tsc();
+	vmrt_vm_snapshot_create(vcpu, &vm_snapshot, mem);
+	vm_snapshot_vlapic = *(struct acrn_vlapic *)vcpu->vlapic;
+}
+
+static struct vmrt_vm_comp *
+vm_comp_clone(void)
+{
+	struct vmrt_vm_comp *vm = ss_vm_comp_alloc();
+	struct vmrt_vm_vcpu *vcpu;
+	struct acrn_vlapic *vlapic;
+	cbuf_t shm_id;
+	void *mem;
+
+	assert(vm);
+	shm_id = contigmem_shared_alloc_aligned(vm_snapshot.mem_sz / PAGE_SIZE_4K, SUPER_PAGE_SIZE, (vaddr_t *)&mem);
+	vmrt_vm_create_from(vm, "vmlinux-5.15-clone", &vm_snapshot, mem, shm_id);
+	ss_vm_comp_activate(vm);
+
+	vmrt_vm_vcpu_init(vm, 0);
+	vcpu = vmrt_get_vcpu(vm, 0);
+	init_lapic(vcpu);
+	vmrt_vm_vcpu_restore(vcpu, &vm_snapshot);
+
+	/* The vlapic's state, but its own page and vcpu */
+	vlapic  = vcpu->vlapic;
+	*vlapic = vm_snapshot_vlapic;
+	vlapic->apic_page = vcpu->lapic_page;
+	vlapic->vcpu      = vcpu;
+
+	/* What the snapshot's vmcall returns in the clones */
+	vcpu->shared_region->ax = 1;
+
+	return vm;
+}
+
+/* Creates the clones, on the first core, once the snapshot is taken */
+static void
+vm_clones_create(void *d)
+{
+	cycles_t start;
+	int i;
+
+	vmrt_vm_snapshot_wait(&vm_snapshot);
+	printc("VM snapshot of %luMB taken in %llu cycles\n", vm_snapshot.mem_sz/1024/1024, ps_tsc() - vm_snapshot_start);
+
+	for (i = 0; i < VM_NUM_CLONES; i++) {
+		struct vmrt_vm_comp *vm;
+
+		start = ps_tsc();
+		vm    = vm_comp_clone();
+		printc("VM clone %d created from the snapshot in %llu cycles\n", i, ps_tsc() - start);
+		vmrt_vm_vcpu_start(vmrt_get_vcpu(vm, 0));
+	}
+
+	sched_thd_block(0);
+	assert(0);
+}
+
 void
 cos_init(void)
 {
+	pvclock_init();
 	g_vm = vm_comp_create();
+	virtio_net_nic_init();
+	virtio_blk_init(g_vm, g_vm_mem);
+}
+
+/*
+ * The virtio I/O threads are on the first core without a vcpu, if
+ * there is one, where they poll the busy rings, otherwise on the
+ * first vcpu's core.
+ */
+static inline coreid_t
+vm_io_core(int ncores)
+{
+	return ncores > g_vm->num_vpu ? g_vm->num_vpu : 0;
 }
 
 void
@@ -116,10 +263,29 @@ cos_parallel_init(coreid_t cid, int init_core, int ncores)
 {
 	struct vmrt_vm_vcpu *vcpu;
 
+	if (cid == vm_io_core(ncores)) {
+		virtio_net_io_thds_create(cid >= g_vm->num_vpu);
+		virtio_blk_io_thds_create(cid >= g_vm->num_vpu);
+	}
+	if (cid >= g_vm->num_vpu) return;
+
 	vmrt_vm_vcpu_init(g_vm, cid);
 	vcpu = vmrt_get_vcpu(g_vm, cid);
 
 	init_lapic(vcpu);
+	vm_ap_thds[cid] = cos_thdid();
+
+	if (cid == 0 && VM_NUM_CLONES > 0) {
+		thdid_t clones = sched_thd_create(vm_clones_create, NULL);
+
+		sched_thd_param_set(clones, sched_param_pack(SCHEDP_PRIO, 30));
+	}
+
+	/* Serve the hot cpuid and msr exits in the kernel, PAUSE exits yield in vmrt */
+	vmrt_vm_vcpu_fastexit_flags(vcpu, VM_FASTEXIT_XSETBV);
+	vcpuid_fastexit_init(vcpu);
+	vmsr_fastexit_init(vcpu);
+
 	return;
 }
 
@@ -127,9 +293,13 @@ void
 parallel_main(coreid_t cid)
 {
 	struct vmrt_vm_vcpu *vcpu;
-	vcpu = vmrt_get_vcpu(g_vm, cid);
 
-	vmrt_vm_vcpu_start(vcpu);
+	if (cid < g_vm->num_vpu) {
+		vcpu = vmrt_get_vcpu(g_vm, cid);
+		/* The APs wait for the guest to start them */
+		while (cid != 0 && !__atomic_load_n(&vm_ap_started[cid], __ATOMIC_SEQ_CST)) sched_thd_block(0);
+		vmrt_vm_vcpu_start(vcpu);
+	}
 
 	while (1)
 	{
@@ -9,6 +9,7 @@
 #include "vcpuid.h"
 #include "cpu_caps.h"
 #include "apicreg.h"
+#include "pvclock.h"
 
 /*
  * Copyright (C) 2018-2022 Intel Corporation.
@@ -201,6 +202,31 @@ static void init_vcpuid_entry(uint32_t leaf, uint32_t subleaf,
 		entry->edx = 0U;
 		break;
 
+	/*
+	 * Leaf 0x40000100 - 0x40000101
+	 * A second range, with the KVM signature, for the guest to find
+	 * the kvmclock paravirtual clock (Linux looks for KVM's leaves
+	 * every 0x100 past 0x40000000). It is the only KVM feature.
+	 */
+	case 0x40000100U:
+	{
+		static const char sig[12] = "KVMKVMKVM\0\0\0";
+		const uint32_t *sigptr = (const uint32_t *)sig;
+
+		entry->eax = 0x40000101U;
+		entry->ebx = sigptr[0];
+		entry->ecx = sigptr[1];
+		entry->edx = sigptr[2];
+		break;
+	}
+
+	case 0x40000101U:
+		entry->eax = KVM_FEATURE_CLOCKSOURCE2 | KVM_FEATURE_CLOCKSOURCE_STABLE_BIT;
+		entry->ebx = 0U;
+		entry->ecx = 0U;
+		entry->edx = 0U;
+		break;
+
 	/*
 	 * Leaf 0x40000010 - Timing Information.
 	 * This leaf returns the current TSC frequency and
@@ -266,6 +292,16 @@ static int32_t set_vcpuid_extended_function(void)
 		result = set_vcpuid_entry(vcpuid_entries, &entry);
 	}
 
+	if (result == 0) {
+		init_vcpuid_entry(0x40000100U, 0U, 0U, &entry);
+		result = set_vcpuid_entry(vcpuid_entries, &entry);
+	}
+
+	if (result == 0) {
+		init_vcpuid_entry(0x40000101U, 0U, 0U, &entry);
+		result = set_vcpuid_entry(vcpuid_entries, &entry);
+	}
+
 	if (result == 0) {
 		init_vcpuid_entry(0x80000000U, 0U, 0U, &entry);
 		result = set_vcpuid_entry(vcpuid_entries, &entry);
@@ -516,7 +552,8 @@ static inline const struct vcpuid_entry *find_vcpuid_entry(uint32_t leaf_arg, ui
 
 static void guest_cpuid_01h(struct vmrt_vm_vcpu *vcpu, uint32_t *eax, uint32_t *ebx, uint32_t *ecx, uint32_t *edx)
 {
-	uint32_t apicid = 1;
+	/* The APIC ID of a vcpu is its number */
+	uint32_t apicid = vcpu->cpuid;
 
 	cpuid_subleaf(0x1U, 0x0U, eax, ebx, ecx, edx);
 	/* Patching initial APIC ID */
@@ -585,13 +622,13 @@ static void guest_cpuid_01h(struct vmrt_vm_vcpu *vcpu, uint32_t *eax, uint32_t *
 	*edx &= ~CPUID_EDX_DTES;
 }
 
-static void guest_cpuid_0bh(uint32_t *eax, uint32_t *ebx, uint32_t *ecx, uint32_t *edx)
+static void guest_cpuid_0bh(struct vmrt_vm_vcpu *vcpu, uint32_t *eax, uint32_t *ebx, uint32_t *ecx, uint32_t *edx)
 {
 	/* Forward host cpu topology to the guest, guest will know the native platform information such as host cpu topology here */
 	cpuid_subleaf(0x0BU, *ecx, eax, ebx, ecx, edx);
 
 	/* Patching X2APIC */
-	*edx = 1;
+	*edx = vcpu->cpuid;
 }
 
 static void guest_cpuid_0dh(uint32_t *eax, uint32_t *ebx, uint32_t *ecx, uint32_t *edx)
@@ -702,7 +739,7 @@ void guest_cpuid(struct vmrt_vm_vcpu *vcpu, uint32_t *eax, uint32_t *ebx, uint32
 			break;
 
 		case 0x0bU:
-			guest_cpuid_0bh(eax, ebx, ecx, edx);
+			guest_cpuid_0bh(vcpu, eax, ebx, ecx, edx);
 			break;
 
 		case 0x0dU:
@@ -755,6 +792,30 @@ cpuid_handler(struct vmrt_vm_vcpu *vcpu)
 	return;
 }
 
+/*
+ * Load the leaves that don't depend on the vcpu's state into the
+ * kernel's fast-exit table, thus cpuid of those leaves never leaves
+ * the kernel. The table is smaller than the entries, the remaining
+ * leaves are served by cpuid_handler.
+ */
+void
+vcpuid_fastexit_init(struct vmrt_vm_vcpu *vcpu)
+{
+	u32_t i;
+
+	for (i = 0; i < g_entry_nr; i++) {
+		const struct vcpuid_entry *entry = &vcpuid_entries[i];
+		uint32_t eax = entry->leaf, ebx = 0, ecx = entry->subleaf, edx = 0;
+		uint32_t flags = 0;
+
+		if (is_percpu_related(entry->leaf)) continue;
+
+		guest_cpuid(vcpu, &eax, &ebx, &ecx, &edx);
+		if (entry->flags & CPUID_CHECK_SUBLEAF) flags |= VM_FASTEXIT_CPUID_SUBLEAF;
+		if (vmrt_vm_vcpu_fastexit_cpuid(vcpu, entry->leaf, entry->subleaf, flags, eax, ebx, ecx, edx)) break;
+	}
+}
+
 static void __attribute__((constructor))
 init(void)
 {
@@ -31,5 +31,6 @@ int32_t set_vcpuid_entries(void);
 void guest_cpuid(struct vmrt_vm_vcpu *vcpu,
 			uint32_t *eax, uint32_t *ebx,
 			uint32_t *ecx, uint32_t *edx);
+void vcpuid_fastexit_init(struct vmrt_vm_vcpu *vcpu);
 
 #endif /* VCPUID_H_ */
@@ -5,6 +5,7 @@
 #include "devices/vrtc/vrtc.h"
 #include "devices/vps2/vps2.h"
 #include "devices/vpci/virtio_net_io.h"
+#include "devices/vpci/virtio_blk_io.h"
 
 void 
 io_handler(struct vmrt_vm_vcpu *vcpu)
@@ -62,13 +63,20 @@ io_handler(struct vmrt_vm_vcpu *vcpu)
 	case VIRTIO_NET_MAC4:
 	case VIRTIO_NET_MAC5:
 	case VIRTIO_NET_STATUS:
-	case VIRTIO_NET_STATUS_H:	
+	case VIRTIO_NET_STATUS_H:
+	case VIRTIO_NET_MAX_PAIRS_L:
+	case VIRTIO_NET_MAX_PAIRS_H:
 		virtio_net_handler(port_id, access_dir, access_sz, vcpu);
 		goto done;	
 	default:
 		break;
 	}
 
+	if (port_id >= VIRTIO_BLK_IO_ADDR && port_id < VIRTIO_BLK_IO_END) {
+		virtio_blk_handler(port_id, access_dir, access_sz, vcpu);
+		goto done;
+	}
+
 	switch (port_id)
 	{
 	case CMOS_CMD_PORT:
@@ -633,6 +633,47 @@ vlapic_set_error(struct acrn_vlapic *vlapic, uint32_t mask)
 	}
 }
 
+/*
+ * Whether the vlapic is a destination of the IPI, by its APIC ID, or by
+ * its logical ID in the flat or cluster model.
+ */
+static bool
+vlapic_is_dest(const struct acrn_vlapic *vlapic, uint32_t dest, bool phys, bool is_broadcast)
+{
+	const struct lapic_regs *lapic = vlapic->apic_page;
+	uint32_t ldr = lapic->ldr.v >> 24U;
+
+	if (is_broadcast) return true;
+	if (phys) return dest == (lapic->id.v >> APIC_ID_SHIFT);
+	if ((lapic->dfr.v & APIC_DFR_MODEL_MASK) == APIC_DFR_MODEL_FLAT) return (ldr & dest) != 0U;
+
+	return ((ldr >> 4U) == (dest >> 4U)) && ((ldr & dest & 0xfU) != 0U);
+}
+
+/*
+ * The fixed IPIs are posted to the target vcpu, and the kernel sends
+ * an IPI to its core if it is running there. The APs are started by
+ * the VMM on their STARTUP IPI, the INIT IPI before it has no effect.
+ */
+static void
+vlapic_ipi(struct vmrt_vm_vcpu *target_vcpu, uint32_t mode, uint32_t vec)
+{
+	switch (mode) {
+	case APIC_DELMODE_FIXED:
+	case APIC_DELMODE_LOWPRIO:
+		lapic_intr_inject(target_vcpu, vec, 0);
+		break;
+	case APIC_DELMODE_INIT:
+		break;
+	case APIC_DELMODE_STARTUP:
+		vm_vcpu_sipi(target_vcpu, vec);
+		break;
+	default:
+		printc("vlapic: ignoring IPI with delivery mode 0x%x to vcpu %u\n", mode, target_vcpu->cpuid);
+		break;
+	}
+}
+
 static void vlapic_write_icrlo(struct acrn_vlapic *vlapic)
 {
 	uint16_t vcpu_id;
@@ -670,12 +711,28 @@ static void vlapic_write_icrlo(struct acrn_vlapic *vlapic)
 		assert(0);
 	} else {
 		struct vmrt_vm_vcpu *vcpu = vlapic2vcpu(vlapic);
+		struct vmrt_vm_comp *vm = vcpu->vm;
 
-		printc(
-			"icrlo 0x%08x icrhi 0x%08x triggered ipi %u",
-				icr_low, icr_high, vec);
+		for (vcpu_id = 0U; vcpu_id < vm->num_vpu; vcpu_id++) {
+			target_vcpu = vmrt_get_vcpu(vm, vcpu_id);
+			/* Not initialized yet, on its core */
+			if (!target_vcpu->vlapic) continue;
 
-		assert(0);
+			switch (shorthand) {
+			case APIC_DEST_NOSHORT:
+				if (!vlapic_is_dest(vcpu_vlapic(target_vcpu), dest, phys, is_broadcast)) continue;
+				break;
+			case APIC_DEST_SELF:
+				if (target_vcpu != vcpu) continue;
+				break;
+			case APIC_DEST_ALLESELF:
+				if (target_vcpu == vcpu) continue;
+				break;
+			default:
+				break;
+			}
+			vlapic_ipi(target_vcpu, mode, vec);
+		}
 	}
 }
 
@@ -1414,6 +1471,16 @@ lapic_intr_inject(struct vmrt_vm_vcpu *vcpu, u8_t vector, int autoeoi)
 	u8_t svi = (u8_t)(shared_region->interrupt_status >> 8);
 	u8_t rvi = (u8_t)shared_region->interrupt_status;
 
+	/*
+	 * Outside of the vcpu's exit handling, the vcpu might be running,
+	 * and the shared region is overwritten on its next exit: post the
+	 * interrupt instead, the hardware delivers it without an exit.
+	 */
+	if (cos_thdid() != vcpu->handler_tid && !autoeoi) {
+		vmrt_vm_vcpu_intr_post(vcpu, vector);
+		return;
+	}
+
 	if (svi == vector && autoeoi) {
 		/* TODO: svi should be the second highest priority bit in isr */
 		svi = 0;
@@ -1427,4 +1494,6 @@ lapic_intr_inject(struct vmrt_vm_vcpu *vcpu, u8_t vector, int autoeoi)
 	lapic->irr[offset].v |= (1U << bit);
 
 	shared_region->interrupt_status = svi << 8 | rvi;
+
+	vmrt_vm_vcpu_kick(vcpu);
 }
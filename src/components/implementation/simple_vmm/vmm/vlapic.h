@@ -205,6 +205,9 @@ void vlapic_create(struct vmrt_vm_vcpu *vcpu, uint16_t pcpu_id);
  */
 void vlapic_free(struct vmrt_vm_vcpu *vcpu);
 
+/* Provided by the VMM: start the AP of the vcpu at the vector of its STARTUP IPI */
+void vm_vcpu_sipi(struct vmrt_vm_vcpu *vcpu, uint32_t vector);
+
 void vlapic_reset(struct acrn_vlapic *vlapic, const struct acrn_apicv_ops *ops, enum reset_mode mode);
 void vlapic_restore(struct acrn_vlapic *vlapic, const struct lapic_regs *regs);
 uint64_t vlapic_apicv_get_apic_access_addr(void);
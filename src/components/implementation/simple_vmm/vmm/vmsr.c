@@ -1,5 +1,63 @@
 #include <vmrt.h>
 #include <vmx_msr.h>
+#include "vmsr.h"
+#include "pvclock.h"
+
+/*
+ * The constant MSRs emulated by the handlers below, served by the
+ * kernel's fast-exit table without leaving it. These must agree with
+ * rdmsr_handler and wrmsr_handler, that still serve them if the table
+ * is not loaded.
+ */
+static const struct vm_fastexit_msr fastexit_msrs[] = {
+	/* MTRRs can be ingored in Linux and Linux knows it is a virtual environment */
+	{ MSR_IA32_MTRR_CAP, VM_FASTEXIT_MSR_RD | VM_FASTEXIT_MSR_WR_IGNORE, 0 },
+	{ MSR_IA32_MTRR_DEF_TYPE, VM_FASTEXIT_MSR_RD | VM_FASTEXIT_MSR_WR_IGNORE, 0 },
+	{ MSR_IA32_MTRR_PHYSBASE_0, VM_FASTEXIT_MSR_RD | VM_FASTEXIT_MSR_WR_IGNORE, 0 },
+	{ MSR_IA32_MTRR_PHYSMASK_0, VM_FASTEXIT_MSR_RD | VM_FASTEXIT_MSR_WR_IGNORE, 0 },
+	{ MSR_IA32_MTRR_PHYSBASE_1, VM_FASTEXIT_MSR_RD | VM_FASTEXIT_MSR_WR_IGNORE, 0 },
+	{ MSR_IA32_MTRR_PHYSMASK_1, VM_FASTEXIT_MSR_RD | VM_FASTEXIT_MSR_WR_IGNORE, 0 },
+	{ MSR_IA32_MTRR_PHYSBASE_2, VM_FASTEXIT_MSR_RD | VM_FASTEXIT_MSR_WR_IGNORE, 0 },
+	{ MSR_IA32_MTRR_PHYSMASK_2, VM_FASTEXIT_MSR_RD | VM_FASTEXIT_MSR_WR_IGNORE, 0 },
+	{ MSR_IA32_MTRR_PHYSBASE_3, VM_FASTEXIT_MSR_RD | VM_FASTEXIT_MSR_WR_IGNORE, 0 },
+	{ MSR_IA32_MTRR_PHYSMASK_3, VM_FASTEXIT_MSR_RD | VM_FASTEXIT_MSR_WR_IGNORE, 0 },
+	{ MSR_IA32_MTRR_PHYSBASE_4, VM_FASTEXIT_MSR_RD | VM_FASTEXIT_MSR_WR_IGNORE, 0 },
+	{ MSR_IA32_MTRR_PHYSMASK_4, VM_FASTEXIT_MSR_RD | VM_FASTEXIT_MSR_WR_IGNORE, 0 },
+	{ MSR_IA32_MTRR_PHYSBASE_5, VM_FASTEXIT_MSR_RD | VM_FASTEXIT_MSR_WR_IGNORE, 0 },
+	{ MSR_IA32_MTRR_PHYSMASK_5, VM_FASTEXIT_MSR_RD | VM_FASTEXIT_MSR_WR_IGNORE, 0 },
+	{ MSR_IA32_MTRR_PHYSBASE_6, VM_FASTEXIT_MSR_RD | VM_FASTEXIT_MSR_WR_IGNORE, 0 },
+	{ MSR_IA32_MTRR_PHYSMASK_6, VM_FASTEXIT_MSR_RD | VM_FASTEXIT_MSR_WR_IGNORE, 0 },
+	{ MSR_IA32_MTRR_PHYSBASE_7, VM_FASTEXIT_MSR_RD | VM_FASTEXIT_MSR_WR_IGNORE, 0 },
+	{ MSR_IA32_MTRR_PHYSMASK_7, VM_FASTEXIT_MSR_RD | VM_FASTEXIT_MSR_WR_IGNORE, 0 },
+	{ MSR_IA32_MTRR_PHYSBASE_8, VM_FASTEXIT_MSR_RD | VM_FASTEXIT_MSR_WR_IGNORE, 0 },
+	{ MSR_IA32_MTRR_PHYSMASK_8, VM_FASTEXIT_MSR_RD | VM_FASTEXIT_MSR_WR_IGNORE, 0 },
+	{ MSR_IA32_MTRR_PHYSBASE_9, VM_FASTEXIT_MSR_RD | VM_FASTEXIT_MSR_WR_IGNORE, 0 },
+	{ MSR_IA32_MTRR_PHYSMASK_9, VM_FASTEXIT_MSR_RD | VM_FASTEXIT_MSR_WR_IGNORE, 0 },
+	{ MSR_IA32_MTRR_FIX64K_00000, VM_FASTEXIT_MSR_RD | VM_FASTEXIT_MSR_WR_IGNORE, 0 },
+	{ MSR_IA32_MTRR_FIX16K_80000, VM_FASTEXIT_MSR_RD | VM_FASTEXIT_MSR_WR_IGNORE, 0 },
+	{ MSR_IA32_MTRR_FIX16K_A0000, VM_FASTEXIT_MSR_RD | VM_FASTEXIT_MSR_WR_IGNORE, 0 },
+	{ MSR_IA32_MTRR_FIX4K_C0000, VM_FASTEXIT_MSR_RD | VM_FASTEXIT_MSR_WR_IGNORE, 0 },
+	{ MSR_IA32_MTRR_FIX4K_C8000, VM_FASTEXIT_MSR_RD | VM_FASTEXIT_MSR_WR_IGNORE, 0 },
+	{ MSR_IA32_MTRR_FIX4K_D0000, VM_FASTEXIT_MSR_RD | VM_FASTEXIT_MSR_WR_IGNORE, 0 },
+	{ MSR_IA32_MTRR_FIX4K_D8000, VM_FASTEXIT_MSR_RD | VM_FASTEXIT_MSR_WR_IGNORE, 0 },
+	{ MSR_IA32_MTRR_FIX4K_E0000, VM_FASTEXIT_MSR_RD | VM_FASTEXIT_MSR_WR_IGNORE, 0 },
+	{ MSR_IA32_MTRR_FIX4K_E8000, VM_FASTEXIT_MSR_RD | VM_FASTEXIT_MSR_WR_IGNORE, 0 },
+	{ MSR_IA32_MTRR_FIX4K_F0000, VM_FASTEXIT_MSR_RD | VM_FASTEXIT_MSR_WR_IGNORE, 0 },
+	{ MSR_IA32_MTRR_FIX4K_F8000, VM_FASTEXIT_MSR_RD | VM_FASTEXIT_MSR_WR_IGNORE, 0 },
+	{ MSR_IA32_PAT, VM_FASTEXIT_MSR_RD | VM_FASTEXIT_MSR_WR_IGNORE, 0 },
+	{ MSR_IA32_MISC_ENABLE, VM_FASTEXIT_MSR_RD, 0x800001 },
+	{ MSR_PPERF, VM_FASTEXIT_MSR_RD, 0 },
+	{ MSR_SMI_COUNT, VM_FASTEXIT_MSR_RD, 0 },
+	{ MSR_IA32_APIC_BASE, VM_FASTEXIT_MSR_RD, 0XFEE00000 | 0x900 },
+	{ MSR_IA32_FEATURE_CONTROL, VM_FASTEXIT_MSR_RD, 1 },
+	{ MSR_MISC_FEATURE_ENABLES, VM_FASTEXIT_MSR_RD | VM_FASTEXIT_MSR_WR_IGNORE, 0 },
+	{ MSR_PLATFORM_INFO, VM_FASTEXIT_MSR_RD, 0 },
+	{ MSR_IA32_SPEC_CTRL, VM_FASTEXIT_MSR_RD | VM_FASTEXIT_MSR_WR_IGNORE, 0 },
+	{ MSR_IA32_BIOS_SIGN_ID, VM_FASTEXIT_MSR_WR_IGNORE, 0 },
+	{ MSR_IA32_SYSENTER_CS, VM_FASTEXIT_MSR_WR_IGNORE, 0 },
+	{ MSR_IA32_SYSENTER_ESP, VM_FASTEXIT_MSR_WR_IGNORE, 0 },
+	{ MSR_IA32_SYSENTER_EIP, VM_FASTEXIT_MSR_WR_IGNORE, 0 },
+};
 
 void 
 rdmsr_handler(struct vmrt_vm_vcpu *vcpu)
@@ -30,6 +88,13 @@ rdmsr_handler(struct vmrt_vm_vcpu *vcpu)
 		regs->dx = (u32_t)(v >> 32);
 		goto done;
 	}
+	case MSR_KVM_SYSTEM_TIME_NEW:
+	{
+		u64_t v = pvclock_system_time_get(vcpu);
+		regs->ax = (u32_t)v;
+		regs->dx = (u32_t)(v >> 32);
+		goto done;
+	}
 	case MSR_IA32_TSC_ADJUST:
 	{
 		/* TODO: need to handle tsc adjustment in VM */
@@ -214,7 +279,19 @@ wrmsr_handler(struct vmrt_vm_vcpu *vcpu)
 		rdtscll(curr_tsc);
 		tsc_future = regs->ax & 0xffffffff;
 		tsc_future |= ((regs->dx & 0xffffffff) << 32);
-		vcpu->next_timer = tsc_future;
+		/* Writing 0 disarms the timer */
+		vcpu->next_timer = tsc_future ? tsc_future : ~0ULL;
+
+		goto done;
+	}
+	case MSR_KVM_WALL_CLOCK_NEW:
+	case MSR_KVM_SYSTEM_TIME_NEW:
+	{
+		u64_t val;
+		val = regs->ax & 0xffffffff;
+		val |= ((regs->dx & 0xffffffff) << 32);
+		if (regs->cx == MSR_KVM_WALL_CLOCK_NEW) pvclock_wall_clock_set(vcpu, val);
+		else                                    pvclock_system_time_set(vcpu, val);
 
 		goto done;
 	}
@@ -243,3 +320,15 @@ done:
 	GOTO_NEXT_INST(regs);
 	return;
 }
+
+void
+vmsr_fastexit_init(struct vmrt_vm_vcpu *vcpu)
+{
+	size_t i;
+
+	for (i = 0; i < sizeof(fastexit_msrs) / sizeof(fastexit_msrs[0]); i++) {
+		const struct vm_fastexit_msr *e = &fastexit_msrs[i];
+
+		if (vmrt_vm_vcpu_fastexit_msr(vcpu, e->msr, e->flags, e->val)) break;
+	}
+}
@@ -0,0 +1,5 @@
+#pragma once
+
+#include <vmrt.h>
+
+void vmsr_fastexit_init(struct vmrt_vm_vcpu *vcpu);
@@ -8,7 +8,7 @@
 #include <sched.h>
 
 #include <sync_chan.h>
-#include <perfdata.h>
+#include <ubench.h>
 #include <cos_time.h>
 
 #undef CHAN_TRACE_DEBUG
@@ -19,7 +19,6 @@
 #endif
 
 #define ITERATION  10000
-/* #define PRINT_ALL */
 #define DATA_WORDS 2
 
 thdid_t main_thd = 0, chan_reader = 0, chan_writer = 0;
@@ -31,10 +30,7 @@ cycles_32_t ts1[DATA_WORDS] = {0, };
 cycles_32_t ts2[DATA_WORDS] = {0, };
 cycles_32_t ts3[DATA_WORDS] = {0, };
 
-struct perfdata perf1, perf2, perf3;
-cycles_t result1[ITERATION] = {0, };
-cycles_t result2[ITERATION] = {0, };
-cycles_t result3[ITERATION] = {0, };
+struct ubench bench1, bench2, bench3;
 
 SYNC_CHAN_STATIC_ALLOC(chan0, cycles_32_t, DATA_WORDS);
 SYNC_CHAN_STATIC_ALLOC(chan1, cycles_32_t, DATA_WORDS);
@@ -73,12 +69,11 @@ chan_reader_thd(void *d)
 void
 chan_writer_thd(void *d)
 {
-	int i;
-	int first = 0;
+	int done = 0;
 	struct bench_args *cs = d;
 	assert(cs);
 
-	for (int i = 0; i < ITERATION + 1; i++) {
+	do {
 		debug("w1,");
 		ts1[0] = time_now();
 		debug("ts1: %d,", ts1[0]);
@@ -91,39 +86,33 @@ chan_writer_thd(void *d)
 		ts3[0] = time_now();
 		debug("w5,");
 
-		if (first == 0) {
-			first = 1;
-		} else if (ts2[0] > ts1[0] && ts3[0] > ts2[0]) {
-			perfdata_add(&perf1, ts2[0] - ts1[0]);
-			perfdata_add(&perf2, ts3[0] - ts2[0]);
-			perfdata_add(&perf3, ts3[0] - ts1[0]);
+		/* The 32 bit timestamps can wrap around */
+		if (ts2[0] > ts1[0] && ts3[0] > ts2[0]) {
+			ubench_sample(&bench1, ts2[0] - ts1[0]);
+			ubench_sample(&bench2, ts3[0] - ts2[0]);
+			done = ubench_sample(&bench3, ts3[0] - ts1[0]);
 		}
-	}
-
-	perfdata_calc(&perf1);
-	perfdata_calc(&perf2);
-	perfdata_calc(&perf3);
-#ifdef PRINT_ALL
-	perfdata_all(&perf1);
-	perfdata_all(&perf2);
-	perfdata_all(&perf3);
-#else
-	perfdata_print(&perf1);
-	perfdata_print(&perf2);
-	perfdata_print(&perf3);
-#endif
+	} while (!done);
+	ubench_report(&bench1);
+	ubench_report(&bench2);
+	ubench_report(&bench3);
 
 	sched_thd_wakeup(main_thd);
 	sched_thd_block(0);
 	BUG();
 }
 
+static void
+chan_selfloop(void *d)
+{
+	sync_chan_send_bench(chan0, tmp);
+	sync_chan_recv_bench(chan0, tmp);
+}
+
 void
 test_chan(void)
 {
 	int i;
-	int first = 0;
-	cycles_t begin, end;
 	struct bench_args _args[] = {
 		{.r = chan1, .w = chan2},
 		{.r = chan2, .w = chan1},
@@ -146,23 +135,9 @@ test_chan(void)
 	/*
 	 * Test the uncontended channel.
 	 */
-	perfdata_init(&perf1, "Uncontended channel - selfloop", result1, ITERATION);
-	for (i = 0; i < ITERATION + 1; i++) {
-		begin = time_now();
-
-		sync_chan_send_bench(chan0, tmp);
-		sync_chan_recv_bench(chan0, tmp);
-
-		end = time_now();
-		if (first == 0) first = 1;
-		else            perfdata_add(&perf1, end - begin);
-	}
-	perfdata_calc(&perf1);
-#ifdef PRINT_ALL
-	perfdata_all(&perf1);
-#else
-	perfdata_print(&perf1);
-#endif
+	ubench_init(&bench1, "Uncontended channel - selfloop", "", UBENCH_OPTS(ITERATION));
+	ubench_run(&bench1, chan_selfloop, NULL);
+	ubench_report(&bench1);
 
 	sync_chan_init_bench(chan1);
 	sync_chan_init_bench(chan2);
@@ -174,9 +149,9 @@ test_chan(void)
 	/*
 	 * Test from a low to a high thread.
 	 */
-	perfdata_init(&perf1, "Contended channel - low writer -> high reader", result1, ITERATION);
-	perfdata_init(&perf2, "Contended channel - high reader -> low writer", result2, ITERATION);
-	perfdata_init(&perf3, "Contended channel - round trip", result3, ITERATION);
+	ubench_init(&bench1, "Contended channel - low writer -> high reader", "", UBENCH_OPTS(ITERATION));
+	ubench_init(&bench2, "Contended channel - high reader -> low writer", "", UBENCH_OPTS(ITERATION));
+	ubench_init(&bench3, "Contended channel - round trip", "writer=low", UBENCH_OPTS(ITERATION));
 
 	printc("Create threads:\n");
 
@@ -193,9 +168,9 @@ test_chan(void)
 	/*
 	 * Test from a high to a low thread.
 	 */
-	perfdata_init(&perf1, "Contended channel - high writer -> low reader", result1, ITERATION);
-	perfdata_init(&perf2, "Contended channel - low reader -> high writer", result2, ITERATION);
-	perfdata_init(&perf3, "Contended channel - round trip", result3, ITERATION);
+	ubench_init(&bench1, "Contended channel - high writer -> low reader", "", UBENCH_OPTS(ITERATION));
+	ubench_init(&bench2, "Contended channel - low reader -> high writer", "", UBENCH_OPTS(ITERATION));
+	ubench_init(&bench3, "Contended channel - round trip", "writer=high", UBENCH_OPTS(ITERATION));
 
 	chan_reader = sched_thd_create(chan_reader_thd, &args[2]);
 	printc("\tcreating reader thread %lu at prio %d\n", chan_reader, sps[2]);
@@ -207,6 +182,7 @@ test_chan(void)
 
 	sched_thd_block(0);
 
+	ubench_end();
 	printc("SUCCESS: channel benchmark complete.\n");
 }
 
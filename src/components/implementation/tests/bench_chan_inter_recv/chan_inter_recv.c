@@ -19,11 +19,27 @@ struct evt e;
 /* Keep these settings below consistent with the sender side */
 #define READER_HIGH
 #define USE_EVTMGR
+/* #define USE_MPMC */
+/* #define USE_BATCH */
+/* Wait for (and trigger) events in memory shared with the evtmgr */
+/* #define USE_EVT_SHM */
 
 #define TEST_CHAN_ITEM_SZ   sizeof(u32_t)
+#ifdef USE_BATCH
+#define TEST_CHAN_BATCH     8
+#define TEST_CHAN_NSLOTS    16
+#define TEST_CHAN_SEND_ID   5
+#define TEST_CHAN_RECV_ID   6
+#else
 #define TEST_CHAN_NSLOTS    2
 #define TEST_CHAN_SEND_ID   3
 #define TEST_CHAN_RECV_ID   4
+#endif
+#ifdef USE_MPMC
+#define TEST_CHAN_FLAGS     CHAN_MPMC
+#else
+#define TEST_CHAN_FLAGS     CHAN_DEFAULT
+#endif
 /* We are the receiver, and we don't care about data gathering */
 #ifdef READER_HIGH
 #define TEST_CHAN_PRIO_SELF 4
@@ -33,6 +49,33 @@ struct evt e;
 
 typedef unsigned int cycles_32_t;
 
+#ifdef USE_BATCH
+/* Receive the sender's whole batch, and return its first timestamp */
+static cycles_32_t
+recv_batch(void)
+{
+	cycles_32_t batch[TEST_CHAN_BATCH];
+	int rcvd, ret;
+#ifdef USE_EVTMGR
+	evt_res_data_t evtdata;
+	evt_res_type_t  evtsrc;
+#endif
+
+	for (rcvd = 0; rcvd < TEST_CHAN_BATCH; rcvd += ret) {
+#ifdef USE_EVTMGR
+		while ((ret = chan_recv_n(&r, &batch[rcvd], TEST_CHAN_BATCH - rcvd, CHAN_NONBLOCKING)) == 0) {
+			evt_get(&e, EVT_WAIT_DEFAULT, &evtsrc, &evtdata);
+		}
+#else
+		ret = chan_recv_n(&r, &batch[rcvd], TEST_CHAN_BATCH - rcvd, 0);
+#endif
+		assert(ret > 0);
+	}
+
+	return batch[0];
+}
+#endif
+
 int
 main(void)
 {
@@ -48,7 +91,11 @@ main(void)
 
 	/* See if event manager is in use. If yes, log the receiver channel into it */
 #ifdef USE_EVTMGR
+#ifdef USE_EVT_SHM
+	assert(evt_init_shm(&e, 2) == 0);
+#else
 	assert(evt_init(&e, 2) == 0);
+#endif
 	evt_id = evt_add(&e, 0, (evt_res_data_t)&r);
 	assert(evt_id != 0);
 	assert(chan_rcv_evt_associate(&r, evt_id) == 0);
@@ -68,7 +115,9 @@ main(void)
 	/* Never stops running; sender controls how many iters to run. */
 	while(1) {
 		debug("r1,");
-#ifdef USE_EVTMGR
+#ifdef USE_BATCH
+		tmp = recv_batch();
+#elif defined(USE_EVTMGR)
 		/* Receive from the events then the channel */
 		while (chan_recv(&r, &tmp, CHAN_NONBLOCKING) == CHAN_TRY_AGAIN) evt_get(&e, EVT_WAIT_DEFAULT, &evtsrc, &evtdata);
 #else
@@ -92,12 +141,12 @@ cos_init(void)
 	memset(&s, 0, sizeof(struct chan_snd));
 	memset(&r, 0, sizeof(struct chan_rcv));
 	printc("Component chan receiver initializing:\n\tCreate channel %d\n", TEST_CHAN_SEND_ID);
-	if (chan_snd_init_with(&s, TEST_CHAN_SEND_ID, TEST_CHAN_ITEM_SZ, TEST_CHAN_NSLOTS, CHAN_DEFAULT)) {
+	if (chan_snd_init_with(&s, TEST_CHAN_SEND_ID, TEST_CHAN_ITEM_SZ, TEST_CHAN_NSLOTS, TEST_CHAN_FLAGS)) {
 		printc("Chan test 1 (%ld): Could not initialize send.\n", cos_compid());
 		BUG();
 	}
 	printc("\tCreate channel %d\n", TEST_CHAN_RECV_ID);
-	if (chan_rcv_init_with(&r, TEST_CHAN_RECV_ID, TEST_CHAN_ITEM_SZ, TEST_CHAN_NSLOTS, CHAN_DEFAULT)) {
+	if (chan_rcv_init_with(&r, TEST_CHAN_RECV_ID, TEST_CHAN_ITEM_SZ, TEST_CHAN_NSLOTS, TEST_CHAN_FLAGS)) {
 		printc("Chan test 1 (%ld): Could not initialize recv.\n", cos_compid());
 		BUG();
 	}
@@ -2,7 +2,7 @@
 #include <llprint.h>
 #include <chan.h>
 #include <ps.h>
-#include <perfdata.h>
+#include <ubench.h>
 #include <cos_time.h>
 
 #undef CHAN_TRACE_DEBUG
@@ -21,33 +21,68 @@ struct evt e;
 #define ITERATION 	10000
 #define READER_HIGH
 #define USE_EVTMGR
-/* #define PRINT_ALL */
+/* #define USE_MPMC */
+/* #define USE_BATCH */
+/* Wait for (and trigger) events in memory shared with the evtmgr */
+/* #define USE_EVT_SHM */
 
 #define TEST_CHAN_ITEM_SZ   sizeof(u32_t)
+#ifdef USE_BATCH
+/* Each roundtrip sends a batch of timestamps, and receives one back */
+#define TEST_CHAN_BATCH     8
+#define TEST_CHAN_NSLOTS    16
+#define TEST_CHAN_SEND_ID   6
+#define TEST_CHAN_RECV_ID   5
+#else
 #define TEST_CHAN_NSLOTS    2
 #define TEST_CHAN_SEND_ID   4
 #define TEST_CHAN_RECV_ID   3
+#endif
+#ifdef USE_MPMC
+#define TEST_CHAN_FLAGS     CHAN_MPMC
+#else
+#define TEST_CHAN_FLAGS     CHAN_DEFAULT
+#endif
 /* We are the sender, and we will be responsible for collecting resulting data */
 #ifdef READER_HIGH
 #define TEST_CHAN_PRIO_SELF 5
+#define TEST_CHAN_PARAMS    "reader=high,"
 #else
 #define TEST_CHAN_PRIO_SELF 4
+#define TEST_CHAN_PARAMS    "reader=low,"
+#endif
+#ifdef USE_EVTMGR
+#define TEST_CHAN_PARAMS_EVT "evt=1,"
+#else
+#define TEST_CHAN_PARAMS_EVT "evt=0,"
 #endif
 
 typedef unsigned int cycles_32_t;
 
-struct perfdata perf1, perf2, perf3;
-cycles_t result1[ITERATION] = {0, };
-cycles_t result2[ITERATION] = {0, };
-cycles_t result3[ITERATION] = {0, };
+/* The one-way latency to the high priority side, and the round trip */
+struct ubench bench_oneway, bench_roundtrip;
+
+#ifdef USE_BATCH
+static void
+send_batch(cycles_32_t ts)
+{
+	cycles_32_t batch[TEST_CHAN_BATCH];
+	int sent, ret;
+
+	for (sent = 0; sent < TEST_CHAN_BATCH; sent++) batch[sent] = ts;
+	for (sent = 0; sent < TEST_CHAN_BATCH; sent += ret) {
+		ret = chan_send_n(&s, &batch[sent], TEST_CHAN_BATCH - sent, 0);
+		assert(ret > 0);
+	}
+}
+#endif
 
 int
 main(void)
 {
-	int i;
 	cycles_t wakeup;
 	cycles_32_t ts1, ts2, ts3;
-	int first = 0;
+	int done = 0;
 #ifdef USE_EVTMGR
 	evt_res_id_t evt_id;
 	evt_res_data_t evtdata;
@@ -59,7 +94,11 @@ main(void)
 	/* Send data to receiver so it can register for channels */
 
 #ifdef USE_EVTMGR
+#ifdef USE_EVT_SHM
+	assert(evt_init_shm(&e, 2) == 0);
+#else
 	assert(evt_init(&e, 2) == 0);
+#endif
 	evt_id = evt_add(&e, 0, (evt_res_data_t)&r);
 	assert(evt_id != 0);
 	assert(chan_rcv_evt_associate(&r, evt_id) == 0);
@@ -76,12 +115,16 @@ main(void)
 	wakeup = time_now() + time_usec2cyc(100 * 1000);
 	sched_thd_block_timeout(0, wakeup);
 
-	for (int i = 0; i < ITERATION + 1; i++) {
+	do {
 		debug("w1,");
 		ts1 = time_now();
 		debug("ts1: %d,", ts1);
 		debug("w2,");
+#ifdef USE_BATCH
+		send_batch(ts1);
+#else
 		chan_send(&s, &ts1, 0);
+#endif
 		debug("w3,");
 #ifdef USE_EVTMGR
 		/* Receive from the events then the channel */
@@ -94,34 +137,19 @@ main(void)
 		ts3 = time_now();
 		debug("w5,");
 
-		if (first == 0) first = 1;
-		else {
-			if (ts2 > ts1 && ts3 > ts2) {
-				perfdata_add(&perf1, ts2 - ts1);
-				perfdata_add(&perf2, ts3 - ts2);
-				perfdata_add(&perf3, ts3 - ts1);
-			}
-		}
-	}
-
-	perfdata_calc(&perf1);
-	perfdata_calc(&perf2);
-	perfdata_calc(&perf3);
-#ifdef PRINT_ALL
+		/* The 32 bit timestamps can wrap around */
+		if (ts2 > ts1 && ts3 > ts2) {
 #ifdef READER_HIGH
-	perfdata_all(&perf1);
+			ubench_sample(&bench_oneway, ts2 - ts1);
 #else
-	perfdata_all(&perf2);
-#endif
-	perfdata_all(&perf3);
-#else
-#ifdef READER_HIGH
-	perfdata_print(&perf1);
-#else
-	perfdata_print(&perf2);
-#endif
-	perfdata_print(&perf3);
+			ubench_sample(&bench_oneway, ts3 - ts2);
 #endif
+			done = ubench_sample(&bench_roundtrip, ts3 - ts1);
+		}
+	} while (!done);
+	ubench_report(&bench_oneway);
+	ubench_report(&bench_roundtrip);
+	ubench_end();
 
 	while(1);
 }
@@ -130,17 +158,18 @@ void
 cos_init(void)
 {
 	/* Initialize performance data */
-	perfdata_init(&perf1, "IPC channel - reader high use this", result1, ITERATION);
-	perfdata_init(&perf2, "IPC channel - writer high use this", result2, ITERATION);
-	perfdata_init(&perf3, "IPC channel - roundtrip", result3, ITERATION);
+	ubench_init(&bench_oneway, "IPC channel - to high priority", TEST_CHAN_PARAMS TEST_CHAN_PARAMS_EVT "slots=" STR(TEST_CHAN_NSLOTS),
+	            UBENCH_OPTS(ITERATION));
+	ubench_init(&bench_roundtrip, "IPC channel - roundtrip", TEST_CHAN_PARAMS TEST_CHAN_PARAMS_EVT "slots=" STR(TEST_CHAN_NSLOTS),
+	            UBENCH_OPTS(ITERATION));
 
 	printc("Component chan sender initializing:\n\tJoin channel %d\n", TEST_CHAN_SEND_ID);
-	if (chan_snd_init_with(&s, TEST_CHAN_SEND_ID, TEST_CHAN_ITEM_SZ, TEST_CHAN_NSLOTS, CHAN_DEFAULT)) {
+	if (chan_snd_init_with(&s, TEST_CHAN_SEND_ID, TEST_CHAN_ITEM_SZ, TEST_CHAN_NSLOTS, TEST_CHAN_FLAGS)) {
 		printc("Chan test 2 (%ld): Could not initialize send.\n", cos_compid());
 		BUG();
 	}
 	printc("\tJoin channel %d\n", TEST_CHAN_RECV_ID);
-	if (chan_rcv_init_with(&r, TEST_CHAN_RECV_ID, TEST_CHAN_ITEM_SZ, TEST_CHAN_NSLOTS, CHAN_DEFAULT)) {
+	if (chan_rcv_init_with(&r, TEST_CHAN_RECV_ID, TEST_CHAN_ITEM_SZ, TEST_CHAN_NSLOTS, TEST_CHAN_FLAGS)) {
 		printc("Chan test 2 (%ld): Could not initialize recv.\n", cos_compid());
 		BUG();
 	}
@@ -0,0 +1,80 @@
+#include <llprint.h>
+#include <string.h>
+#include <cos_time.h>
+#include <net_cksum.h>
+
+/***
+ * The cycles to checksum a packet with each of the kernels of
+ * `net_cksum.h`, for packets of each size, from the headers of a
+ * minimal frame to a full MTU frame. The buffer is offset by 2 bytes,
+ * as are the IP headers after the Ethernet header.
+ */
+
+#define ITERATION 100000
+#define BUF_OFF   2
+
+typedef u64_t (*cksum_fn_t)(const void *buf, size_t len);
+
+static const size_t sizes[] = { 20, 64, 128, 256, 512, 1024, 1500 };
+
+static const struct {
+	const char *name;
+	cksum_fn_t  fn;
+} kernels[] = {
+	{ "scalar", net_cksum_partial_scalar },
+	{ "sse2",   net_cksum_partial_sse2 },
+	{ "avx2",   net_cksum_partial_avx2 },
+};
+
+static u8_t buf[2048] CACHE_ALIGNED;
+
+/* Keep the compiler from removing the sums */
+static volatile u64_t sink;
+
+static cycles_t
+bench_kernel(cksum_fn_t fn, size_t len)
+{
+	cycles_t start, end;
+	u64_t    sum = 0;
+	int      i;
+
+	start = time_now();
+	for (i = 0; i < ITERATION; i++) sum += fn(&buf[BUF_OFF], len);
+	end = time_now();
+	sink = sum;
+
+	return (end - start) / ITERATION;
+}
+
+void
+cos_init(void)
+{
+	printc("Benchmark for the checksum kernels.\n");
+}
+
+int
+main(void)
+{
+	unsigned int i, j;
+	u16_t        ref;
+
+	for (i = 0; i < sizeof(buf); i++) buf[i] = (u8_t)(i * 7 + 3);
+
+	printc("Kernel used by net_cksum_partial: %s\n", net_cksum_kernel());
+	for (i = 0; i < sizeof(kernels) / sizeof(kernels[0]); i++) {
+		/* The avx2 kernel can only run where it's used */
+		if (kernels[i].fn == net_cksum_partial_avx2 && strcmp(net_cksum_kernel(), "avx2")) continue;
+
+		for (j = 0; j < sizeof(sizes) / sizeof(sizes[0]); j++) {
+			ref = net_cksum_fold(net_cksum_partial_scalar(&buf[BUF_OFF], sizes[j]));
+			assert(net_cksum_fold(kernels[i].fn(&buf[BUF_OFF], sizes[j])) == ref);
+
+			printc("%s, %lu bytes: %llu cycles\n", kernels[i].name, (unsigned long)sizes[j],
+			       bench_kernel(kernels[i].fn, sizes[j]));
+		}
+	}
+
+	printc("SUCCESS: Finished checksum benchmark.\n");
+
+	return 0;
+}
@@ -1,5 +1,6 @@
 #include <llprint.h>
 #include <cos_dpdk.h>
+#include <cos_time.h>
 
 #define NB_RX_DESC_DEFAULT 1024
 #define NB_TX_DESC_DEFAULT 1024
@@ -7,32 +8,53 @@
 
 static u16_t nic_ports = 0;
 
-static void
+/* Forward the packets with bursts of 1 to BENCH_BATCH_MAX, BENCH_BATCH_USECS each */
+#define BENCH_BATCH_MAX   64
+#define BENCH_BATCH_USECS (5 * 1000 * 1000)
+
+static uint16_t
 process_packets(cos_portid_t port_id, char** rx_pkts, uint16_t nb_pkts)
 {
+	uint16_t i, nb_tx;
+
 	/* sent this group of packets out */
-	cos_dev_port_tx_burst(port_id, 0, rx_pkts, nb_pkts);
+	nb_tx = cos_dev_port_tx_burst(port_id, 0, rx_pkts, nb_pkts);
+	for (i = nb_tx; i < nb_pkts; i++) cos_free_packet(rx_pkts[i]);
+
+	return nb_tx;
 }
 
 static void
-cos_nic_start(){
-	int i, loop = 1000000000;
+cos_nic_bench_batch(uint16_t batch)
+{
+	int i;
 	uint16_t nb_pkts = 0;
+	unsigned long nb_fwd = 0;
+	cycles_t end;
 
-	char* rx_packets[MAX_PKT_BURST];
+	char* rx_packets[BENCH_BATCH_MAX];
 
-	/* only burst for a little time */
-	while (--loop)
-	{
-		/* infinite loop to process packets */
+	end = time_now() + time_usec2cyc(BENCH_BATCH_USECS);
+	while (time_now() < end) {
 		for (i = 0; i < nic_ports; i++) {
 			/* process rx */
-			nb_pkts = cos_dev_port_rx_burst(i, 0, rx_packets, MAX_PKT_BURST);
+			nb_pkts = cos_dev_port_rx_burst(i, 0, rx_packets, batch);
 			if (nb_pkts != 0) {
-				process_packets(i, rx_packets, nb_pkts);
+				nb_fwd += process_packets(i, rx_packets, nb_pkts);
 			}
 		}
 	}
+
+	printc("Batch size %u: %lu packets/s forwarded\n", batch,
+	       (unsigned long)((u64_t)nb_fwd * 1000000 / BENCH_BATCH_USECS));
+}
+
+static void
+cos_nic_start(){
+	uint16_t batch;
+
+	for (batch = 1; batch <= BENCH_BATCH_MAX; batch *= 2) cos_nic_bench_batch(batch);
+
 	/* print stats */
 	cos_get_port_stats(0);
 }
@@ -0,0 +1,15 @@
+#!/usr/bin/python3
+
+# Ask the nicmgr for its stats, with the latency breakdown of the
+# traced requests if NETSHMEM_TRACE_ENABLE is set (see netshmem.h):
+# the packets to its debug port (NIC_DEBUG_PORT) make it print them
+# on the console. Run it at the end of a benchmark run.
+
+from scapy.all import *
+import sys
+
+iface = sys.argv[1] if len(sys.argv) > 1 else 'tap0'
+
+debug_pkt = Ether(dst='66:66:66:66:66:66')/IP(src='10.10.1.1', dst='10.10.1.2')/UDP(sport=36000, dport=36000)/'report'
+sendp(debug_pkt, iface=iface)
+print('Report requested, see the Composite console')
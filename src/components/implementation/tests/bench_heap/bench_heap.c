@@ -0,0 +1,207 @@
+#include <llprint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <cos_time.h>
+#include <ubench.h>
+#include <heap.h>
+#include <dheap.h>
+
+/***
+ * The costs of the timer heaps' operations, with HEAP_N timers: those
+ * of the binary heap of `heap.h`, that compares the timers through a
+ * function pointer, and of the 4-ary heap of `dheap.h`, with the
+ * timeouts inline. Each operation is timed on its own, as the
+ * schedulers and the timer manager execute them: adding a timer,
+ * adjusting a timer's timeout, removing a timer, and expiring the
+ * earliest timer. The 4-ary heap also expires timers HEAP_EXPIRE at a
+ * time (`pop_until`), timed per timer.
+ */
+
+#define HEAP_N      10000
+#define HEAP_EXPIRE 16
+#define HEAP_RANGE  (1ULL << 32)
+
+struct timer {
+	int   idx; /* in either heap */
+	u64_t timeout;
+	char  pad[48]; /* as the timer structures of the schedulers, a cache line each */
+};
+
+static struct timer timers[HEAP_N];
+
+/* The binary heap */
+static struct {
+	struct heap h;
+	void       *data[HEAP_N + 1];
+} bheap;
+
+static int
+bheap_cmp(void *a, void *b)
+{
+	return ((struct timer *)a)->timeout <= ((struct timer *)b)->timeout;
+}
+
+static void
+bheap_update(void *e, int pos)
+{
+	((struct timer *)e)->idx = pos;
+}
+
+DECLARE_HEAP(bench, bheap_cmp, bheap_update);
+
+/* The 4-ary heap */
+static struct dheap     dheap;
+static struct dheap_ent dheap_ents[DHEAP_ENTS(HEAP_N)] CACHE_ALIGNED;
+
+static inline void
+dheap_update(void *e, int pos)
+{
+	((struct timer *)e)->idx = pos;
+}
+
+DECLARE_DHEAP(bench, dheap_update);
+
+static u64_t rand_state = 1;
+
+static inline u64_t
+rand_timeout(void)
+{
+	/* xorshift: cheap, so it doesn't dominate the operations */
+	rand_state ^= rand_state << 13;
+	rand_state ^= rand_state >> 7;
+	rand_state ^= rand_state << 17;
+
+	return rand_state % HEAP_RANGE;
+}
+
+enum { OP_ADD = 0, OP_ADJUST, OP_REMOVE, OP_POP, OP_NOPS };
+
+static const char *op_names[OP_NOPS] = { "heap_add", "heap_adjust", "heap_remove", "heap_pop" };
+
+static struct ubench benches[2][OP_NOPS];
+static char          params[2][32];
+
+static void
+bench_binary(void)
+{
+	struct ubench *b = benches[0];
+	cycles_t       start, end;
+	int            i, k;
+
+	heap_init(&bheap.h, HEAP_N);
+	for (i = 0; i < HEAP_N; i++) {
+		timers[i].timeout = rand_timeout();
+		start = time_now();
+		bench_heap_add(&bheap.h, &timers[i]);
+		end = time_now();
+		ubench_sample(&b[OP_ADD], end - start);
+	}
+	for (k = 0; k < HEAP_N; k++) {
+		i = rand_timeout() % HEAP_N;
+		timers[i].timeout = rand_timeout();
+		start = time_now();
+		bench_heap_adjust(&bheap.h, timers[i].idx);
+		end = time_now();
+		ubench_sample(&b[OP_ADJUST], end - start);
+	}
+	/* Remove half, at random, and add them back */
+	for (k = 0; k < HEAP_N / 2; k++) {
+		i = rand_timeout() % heap_size(&bheap.h) + 1;
+		start = time_now();
+		bench_heap_remove(&bheap.h, i);
+		end = time_now();
+		ubench_sample(&b[OP_REMOVE], end - start);
+	}
+	for (i = 0; i < HEAP_N; i++) {
+		if (timers[i].idx == 0) bench_heap_add(&bheap.h, &timers[i]);
+	}
+	while (!heap_empty(&bheap.h)) {
+		start = time_now();
+		bench_heap_highest(&bheap.h);
+		end = time_now();
+		ubench_sample(&b[OP_POP], end - start);
+	}
+}
+
+static void
+bench_dary(struct ubench *expire)
+{
+	struct ubench *b = benches[1];
+	void          *vals[HEAP_EXPIRE];
+	cycles_t       start, end;
+	int            i, k, n;
+
+	dheap_init(&dheap, dheap_ents, HEAP_N);
+	for (i = 0; i < HEAP_N; i++) {
+		timers[i].timeout = rand_timeout();
+		start = time_now();
+		bench_dheap_add(&dheap, timers[i].timeout, &timers[i]);
+		end = time_now();
+		ubench_sample(&b[OP_ADD], end - start);
+	}
+	for (k = 0; k < HEAP_N; k++) {
+		i = rand_timeout() % HEAP_N;
+		timers[i].timeout = rand_timeout();
+		start = time_now();
+		bench_dheap_adjust(&dheap, timers[i].idx, timers[i].timeout);
+		end = time_now();
+		ubench_sample(&b[OP_ADJUST], end - start);
+	}
+	for (k = 0; k < HEAP_N / 2; k++) {
+		i = rand_timeout() % dheap_size(&dheap) + DHEAP_ROOT;
+		start = time_now();
+		bench_dheap_remove(&dheap, i);
+		end = time_now();
+		ubench_sample(&b[OP_REMOVE], end - start);
+	}
+	for (i = 0; i < HEAP_N; i++) {
+		if (timers[i].idx == 0) bench_dheap_add(&dheap, timers[i].timeout, &timers[i]);
+	}
+	/* Expire the first half one at a time, and the rest in batches */
+	for (k = 0; k < HEAP_N / 2; k++) {
+		start = time_now();
+		bench_dheap_pop(&dheap);
+		end = time_now();
+		ubench_sample(&b[OP_POP], end - start);
+	}
+	while (!dheap_empty(&dheap)) {
+		start = time_now();
+		n = bench_dheap_pop_until(&dheap, HEAP_RANGE, vals, HEAP_EXPIRE);
+		end = time_now();
+		ubench_sample(expire, (end - start) / n);
+	}
+}
+
+void
+cos_init(void)
+{
+	printc("Benchmark for the timer heaps.\n");
+}
+
+int
+main(void)
+{
+	struct ubench expire;
+	int           i, j;
+
+	snprintf(params[0], sizeof(params[0]), "n=%d,d=2", HEAP_N);
+	snprintf(params[1], sizeof(params[1]), "n=%d,d=4", HEAP_N);
+	for (i = 0; i < 2; i++) {
+		for (j = 0; j < OP_NOPS; j++) ubench_init(&benches[i][j], op_names[j], params[i], UBENCH_OPTS(HEAP_N));
+	}
+	ubench_init(&expire, "heap_pop_until", params[1], UBENCH_OPTS(HEAP_N / 2 / HEAP_EXPIRE));
+
+	bench_binary();
+	for (i = 0; i < HEAP_N; i++) timers[i].idx = 0;
+	bench_dary(&expire);
+
+	for (i = 0; i < 2; i++) {
+		for (j = 0; j < OP_NOPS; j++) ubench_report(&benches[i][j]);
+	}
+	ubench_report(&expire);
+	ubench_end();
+
+	printc("SUCCESS: Finished heap benchmark.\n");
+
+	return 0;
+}
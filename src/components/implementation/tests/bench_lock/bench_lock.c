@@ -8,7 +8,8 @@
 #include <sched.h>
 
 #include <sync_lock.h>
-#include <perfdata.h>
+#include <sync_qlock.h>
+#include <ubench.h>
 #include <cos_time.h>
 
 #undef LOCK_TRACE_DEBUG
@@ -20,17 +21,26 @@
 
 /* One low-priority thread and one high-priority thread contends on the lock */
 #define ITERATION 200
-/* #define PRINT_ALL */
+
+/* Define to run the contended benchmark on the queued lock (sync_qlock.h) */
+#undef BENCH_QLOCK
 
 struct sync_lock lock;
+struct sync_qlock qlock;
+#ifdef BENCH_QLOCK
+#define bench_take(n)    sync_qlock_take(&qlock, n)
+#define bench_release(n) sync_qlock_release(&qlock, n)
+#else
+#define bench_take(n)    ((void)(n), sync_lock_take(&lock))
+#define bench_release(n) ((void)(n), sync_lock_release(&lock))
+#endif
 thdid_t lock_hi = 0, lock_lo = 0;
 volatile int flag = 0;
 
 volatile cycles_t start;
 volatile cycles_t end;
 
-struct perfdata perf;
-cycles_t result[ITERATION] = {0, };
+struct ubench bench;
 
 /***
  * The high priority thread periodically challenges the lock while the low priority thread keeps spinning.
@@ -40,6 +50,8 @@ cycles_t result[ITERATION] = {0, };
 void
 lock_hi_thd(void *d)
 {
+	struct sync_qlock_node n;
+
 	/* Never stops running; low priority controls how many iters to run. */
 	while (1) {
 		debug("h1,");
@@ -49,9 +61,9 @@ lock_hi_thd(void *d)
 		debug("h2,");
 		flag = 1;
 		start = time_now();
-		sync_lock_take(&lock);
+		bench_take(&n);
 
-		sync_lock_release(&lock);
+		bench_release(&n);
 		end = time_now();
 		debug("h3,");
 	}
@@ -60,72 +72,66 @@ lock_hi_thd(void *d)
 void
 lock_lo_thd(void *d)
 {
-	int i;
-	int first = 0;
+	struct sync_qlock_node n;
 
-	for (i = 0; i < ITERATION + 1; i++) {
+	do {
 		debug("l1,");
 		//sched_thd_wakeup(lock_hi);
 
 		debug("l2,");
 		//flag = 0;
-		sync_lock_take(&lock);
+		bench_take(&n);
 
 		debug("l3,");
 		while (flag != 1) ;
 		flag = 0;
 
-		sync_lock_release(&lock);
-
-		if (first == 0) first = 1;
-		else perfdata_add(&perf, end - start);
+		bench_release(&n);
 		debug("l4,");
-	}
-
-	perfdata_calc(&perf);
-#ifdef PRINT_ALL
-	perfdata_all(&perf);
-#else
-	perfdata_print(&perf);
-#endif
+	} while (!ubench_sample(&bench, end - start));
+	ubench_report(&bench);
+	ubench_end();
 
 	printc("SUCCESS: Finished lock tests.\n");
 	while (1) ;
 }
 
+static void
+lock_take_release(void *d)
+{
+	sync_lock_take(&lock);
+	sync_lock_release(&lock);
+}
+
+static void
+qlock_take_release(void *d)
+{
+	struct sync_qlock_node n;
+
+	sync_qlock_take(&qlock, &n);
+	sync_qlock_release(&qlock, &n);
+}
+
 void
 test_lock(void)
 {
-	int i;
-	int first = 0;
-
 	sched_param_t sps[] = {
 		SCHED_PARAM_CONS(SCHEDP_PRIO, 4),
 		SCHED_PARAM_CONS(SCHEDP_PRIO, 6)
 	};
 
 	sync_lock_init(&lock);
+	sync_qlock_init(&qlock);
 
 	/* Uncontended lock taking/releasing */
-	perfdata_init(&perf, "Uncontended lock - take+release", result, ITERATION);
-	for (i = 0; i < ITERATION + 1; i++) {
-		start = time_now();
-
-		sync_lock_take(&lock);
-		sync_lock_release(&lock);
-
-		end = time_now();
-		if (first == 0) first = 1;
-		else perfdata_add(&perf, end - start);
-	}
-	perfdata_calc(&perf);
-#ifdef PRINT_ALL
-	perfdata_all(&perf);
-#else
-	perfdata_print(&perf);
-#endif
-
-	perfdata_init(&perf, "Contended lock - take+release", result, ITERATION);
+	ubench_init(&bench, "Uncontended lock - take+release", "", UBENCH_OPTS(ITERATION));
+	ubench_run(&bench, lock_take_release, NULL);
+	ubench_report(&bench);
+	ubench_init(&bench, "Uncontended queued lock - take+release", "", UBENCH_OPTS(ITERATION));
+	ubench_run(&bench, qlock_take_release, NULL);
+	ubench_report(&bench);
+
+	ubench_init(&bench, "Contended lock - take+release", "prio_hi=4,prio_lo=6", UBENCH_OPTS(ITERATION));
 
 	printc("Create threads:\n");
 
@@ -0,0 +1,346 @@
+#include <cos_types.h>
+#include <llprint.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <sched.h>
+#include <cos_time.h>
+#include <perfdata.h>
+#include <netshmem.h>
+#include <nic.h>
+#include <net_stack_types.h>
+#include <net_cksum.h>
+
+/***
+ * A packet generator for the path of the packets through the nicmgr,
+ * to run with its NIC_TX_LOOPBACK: the tx thread sends UDP or TCP
+ * packets of several flows to the port of the rx thread, as a tenant
+ * does, and the nicmgr receives them (flow lookup, rings, wakeup and
+ * copy included) instead of sending them. Each phase of `phases` sends
+ * for PKTGEN_PHASE_USECS, then reports the packets sent, those the nic
+ * refused, those received, and the percentiles of their latency from
+ * their sending to their reception. The nicmgr then prints where the
+ * others were dropped (its counters), as it does when it receives a
+ * packet for NIC_DEBUG_PORT.
+ *
+ * The flows differ by their source IP and port, and the packets of a
+ * phase are spread across them uniformly (round-robin), or skewed, with
+ * 9 packets out of 10 in the first flow. A rate of 0 sends as fast as
+ * the nic takes the packets.
+ */
+
+#define PKTGEN_PHASE_USECS   (2 * 1000 * 1000)
+#define PKTGEN_DRAIN_USECS   (10 * 1000)
+#define PKTGEN_BURST         NIC_BATCH_MAX
+#define PKTGEN_LAT_SAMPLES   8192
+/* Sample the latency of one packet out of PKTGEN_LAT_EVERY, to cover the whole phase */
+#define PKTGEN_LAT_EVERY     64
+#define PKTGEN_MAGIC         0x7067656e /* "pgen" */
+
+#define PKTGEN_RX_PORT       7000
+#define PKTGEN_TX_PORT       7001
+#define PKTGEN_SRC_PORT_BASE 10000
+#define PKTGEN_RX_PRIO       4
+#define PKTGEN_TX_PRIO       6
+/* The NIC_DEBUG_PORT of the nicmgr */
+#define PKTGEN_NIC_DEBUG_PORT 36000
+
+enum pktgen_dist {
+	PKTGEN_UNIFORM,
+	PKTGEN_SKEWED,
+};
+
+struct pktgen_phase {
+	const char      *name;
+	u8_t             proto;
+	u16_t            size;  /* of the frames, without the FCS */
+	u32_t            rate;  /* in packets/s, 0 for the highest */
+	u16_t            nflows;
+	enum pktgen_dist dist;
+};
+
+static const struct pktgen_phase phases[] = {
+	{ "udp 64B, 1 flow",              UDP_PROTO, 64,   0,      1,  PKTGEN_UNIFORM },
+	{ "udp 64B, 64 flows",            UDP_PROTO, 64,   0,      64, PKTGEN_UNIFORM },
+	{ "udp 64B, 64 flows, skewed",    UDP_PROTO, 64,   0,      64, PKTGEN_SKEWED },
+	{ "udp 512B, 64 flows",           UDP_PROTO, 512,  0,      64, PKTGEN_UNIFORM },
+	{ "udp 1514B, 64 flows",          UDP_PROTO, 1514, 0,      64, PKTGEN_UNIFORM },
+	{ "udp 64B, 64 flows, 100kpps",   UDP_PROTO, 64,   100000, 64, PKTGEN_UNIFORM },
+	{ "tcp 64B, 64 flows",            TCP_PROTO, 64,   0,      64, PKTGEN_UNIFORM },
+	{ "tcp 1514B, 64 flows",          TCP_PROTO, 1514, 0,      64, PKTGEN_UNIFORM },
+};
+
+#define PKTGEN_NPHASES (sizeof(phases) / sizeof(phases[0]))
+
+/* At the start of the payload of each packet */
+struct pktgen_hdr {
+	u32_t magic;
+	u32_t flow;
+	u64_t seq;
+	u64_t ts;
+} __attribute__((packed));
+
+struct pktgen_stats {
+	u64_t sent, refused;
+	u64_t received, bytes;
+};
+
+static u32_t             host_ip;
+static struct ether_addr host_mac;
+static thdid_t           rx_thd, tx_thd;
+static volatile int      rx_ready;
+/* The phase whose packets are being received, -1 between phases */
+static volatile int      cur_phase = -1;
+static struct pktgen_stats stats;
+
+static struct perfdata lat_pd;
+static cycles_t        lat_values[PKTGEN_LAT_SAMPLES];
+
+static void
+pktgen_session_init(u16_t port, shm_bm_objid_t *descs_id, struct nic_pkt_desc **descs)
+{
+	netshmem_create();
+	nic_shmem_map(netshmem_get_shm_id());
+	if (nic_bind_port(host_ip, htons(port))) BUG();
+
+	*descs = shm_bm_alloc_net_pkt_buf(netshmem_get_shm(), descs_id);
+	assert(*descs);
+}
+
+static inline u32_t
+pktgen_flow(const struct pktgen_phase *p, u64_t seq)
+{
+	if (p->nflows == 1) return 0;
+	if (p->dist == PKTGEN_SKEWED && seq % 10) return 0;
+
+	return (seq / (p->dist == PKTGEN_SKEWED ? 10 : 1)) % p->nflows;
+}
+
+/* Build the packet `seq` of the phase in `data`, and return its length */
+static u16_t
+pktgen_build(char *data, const struct pktgen_phase *p, u64_t seq)
+{
+	struct eth_hdr    *eth = (struct eth_hdr *)data;
+	struct ip_hdr     *ip  = (struct ip_hdr *)(eth + 1);
+	struct udp_hdr    *udp = (struct udp_hdr *)(ip + 1);
+	struct tcp_hdr    *tcp = (struct tcp_hdr *)(ip + 1);
+	struct pktgen_hdr *h;
+	u32_t              flow = pktgen_flow(p, seq);
+	u16_t              l4_len, hdrs_len, len;
+	u64_t              sum;
+
+	hdrs_len = ETH_STD_LEN + IP_STD_LEN + (p->proto == TCP_PROTO ? TCP_STD_LEN : UDP_STD_LEN);
+	len      = p->size > hdrs_len + sizeof(*h) ? p->size : hdrs_len + sizeof(*h);
+	l4_len   = len - ETH_STD_LEN - IP_STD_LEN;
+
+	eth->dst_addr   = host_mac;
+	eth->src_addr   = host_mac;
+	eth->ether_type = htons(ETH_TYPE_IPV4);
+
+	*ip = (struct ip_hdr) {
+		.ihl       = IP_STD_LEN / 4,
+		.version   = IPv4,
+		.total_len = htons(len - ETH_STD_LEN),
+		.id        = htons((u16_t)seq),
+		.frag_off  = htons(0x4000),
+		.ttl       = 64,
+		.proto     = p->proto,
+		/* 10.10.2.x, in network order */
+		.src_addr  = htonl(0x0a0a0200 | (flow % 250 + 1)),
+		.dst_addr  = host_ip,
+	};
+	ip->checksum = ~net_cksum_fold(net_cksum_partial(ip, IP_STD_LEN));
+
+	h = (struct pktgen_hdr *)(data + hdrs_len);
+	h->magic = PKTGEN_MAGIC;
+	h->flow  = flow;
+	h->seq   = seq;
+	h->ts    = time_now();
+
+	if (p->proto == UDP_PROTO) {
+		/* The UDP checksum is optional with IPv4 */
+		*udp = (struct udp_hdr) {
+			.port = { htons(PKTGEN_SRC_PORT_BASE + flow), htons(PKTGEN_RX_PORT) },
+			.len  = htons(l4_len),
+		};
+
+		return len;
+	}
+
+	/* PSH keeps the nicmgr's GRO from coalescing the segments */
+	*tcp = (struct tcp_hdr) {
+		.port     = { htons(PKTGEN_SRC_PORT_BASE + flow), htons(PKTGEN_RX_PORT) },
+		.seq      = htonl((u32_t)seq),
+		.data_off = (TCP_STD_LEN / 4) << 4,
+		.flags    = TCP_FLAG_PSH | TCP_FLAG_ACK,
+		.window   = htons(65535),
+	};
+	sum = net_cksum_partial(&ip->src_addr, 8) + htons(TCP_PROTO) + htons(l4_len) + net_cksum_partial(tcp, l4_len);
+	tcp->checksum = ~net_cksum_fold(sum);
+
+	return len;
+}
+
+static void
+pktgen_send(struct nic_pkt_desc *descs, shm_bm_objid_t descs_id, const struct pktgen_phase *p, u64_t *seq, int n)
+{
+	struct netshmem_pkt_buf *objs[PKTGEN_BURST];
+	shm_bm_objid_t           objid;
+	int                      i, sent;
+
+	for (i = 0; i < n; i++) {
+		objs[i] = netshmem_pkt_buf_alloc(&objid);
+		if (!objs[i]) break;
+		descs[i] = (struct nic_pkt_desc) {
+			.objid      = objid,
+			.pkt_offset = 0,
+			.pkt_len    = pktgen_build(objs[i]->data, p, (*seq)++),
+		};
+	}
+
+	sent = i > 0 ? nic_send_packets(descs_id, i) : 0;
+	if (sent < 0) sent = 0;
+	stats.sent    += sent;
+	stats.refused += n - sent;
+	/* The nic holds a reference to the packets it sent */
+	while (i-- > 0) netshmem_pkt_buf_free(objs[i]);
+}
+
+/* Send a packet to the nicmgr's debug port, for it to print its counters */
+static void
+pktgen_nic_stats(struct nic_pkt_desc *descs, shm_bm_objid_t descs_id)
+{
+	struct pktgen_phase p = { "debug", UDP_PROTO, 64, 0, 1, PKTGEN_UNIFORM };
+	struct netshmem_pkt_buf *obj;
+	struct udp_hdr *udp;
+	shm_bm_objid_t objid;
+
+	obj = netshmem_pkt_buf_alloc(&objid);
+	if (!obj) return;
+	descs[0] = (struct nic_pkt_desc) { .objid = objid, .pkt_len = pktgen_build(obj->data, &p, 0) };
+	udp = (struct udp_hdr *)(obj->data + ETH_STD_LEN + IP_STD_LEN);
+	udp->port.dst_port = htons(PKTGEN_NIC_DEBUG_PORT);
+	nic_send_packets(descs_id, 1);
+	netshmem_pkt_buf_free(obj);
+}
+
+static void
+pktgen_report(const struct pktgen_phase *p, cycles_t elapsed)
+{
+	u64_t usecs = time_cyc2usec(elapsed);
+
+	printc("%s: sent %llu (%llu.%03llu Mpps), refused %llu, received %llu (%llu.%03llu Mpps, %llu Mbps), lost %llu\n",
+	       p->name, stats.sent, stats.sent / usecs, (stats.sent * 1000 / usecs) % 1000, stats.refused,
+	       stats.received, stats.received / usecs, (stats.received * 1000 / usecs) % 1000,
+	       stats.bytes * 8 / usecs, stats.sent - stats.received);
+
+	perfdata_calc(&lat_pd);
+	perfdata_print(&lat_pd);
+}
+
+static void
+pktgen_tx(void *d)
+{
+	struct nic_pkt_desc *descs;
+	shm_bm_objid_t       descs_id;
+	cycles_t             start, end, next, interval;
+	u64_t                seq;
+	unsigned int         i;
+
+	pktgen_session_init(PKTGEN_TX_PORT, &descs_id, &descs);
+	while (!rx_ready) sched_thd_block_timeout(0, time_now() + time_usec2cyc(1000));
+
+	for (i = 0; i < PKTGEN_NPHASES; i++) {
+		const struct pktgen_phase *p = &phases[i];
+
+		memset(&stats, 0, sizeof(stats));
+		perfdata_init(&lat_pd, p->name, lat_values, PKTGEN_LAT_SAMPLES);
+		cur_phase = i;
+
+		interval = p->rate ? time_usec2cyc(1000000ULL * PKTGEN_BURST / p->rate) : 0;
+		seq      = 0;
+		start    = next = time_now();
+		end      = start + time_usec2cyc(PKTGEN_PHASE_USECS);
+		while (time_now() < end) {
+			pktgen_send(descs, descs_id, p, &seq, PKTGEN_BURST);
+			if (!interval) continue;
+			/* Open loop: the bursts are sent on time, whether the previous were received or not */
+			next += interval;
+			if (next > time_now()) sched_thd_block_timeout(0, next);
+		}
+		end = time_now();
+
+		/* The packets in flight are either received or dropped */
+		sched_thd_block_timeout(0, time_now() + time_usec2cyc(PKTGEN_DRAIN_USECS));
+		cur_phase = -1;
+		pktgen_report(p, end - start);
+		pktgen_nic_stats(descs, descs_id);
+	}
+
+	printc("SUCCESS: Finished packet generator benchmark.\n");
+	while (1) sched_thd_block(0);
+}
+
+static void
+pktgen_rx(void *d)
+{
+	struct nic_pkt_desc     *descs;
+	struct netshmem_pkt_buf *obj;
+	struct ip_hdr           *ip;
+	struct tcp_hdr          *tcp;
+	struct pktgen_hdr       *h;
+	shm_bm_objid_t           descs_id;
+	u16_t                    off;
+	int                      i, n;
+
+	pktgen_session_init(PKTGEN_RX_PORT, &descs_id, &descs);
+	rx_ready = 1;
+
+	while (1) {
+		n = nic_get_packets(descs_id, NIC_BATCH_MAX);
+		assert(n > 0);
+		for (i = 0; i < n; i++) {
+			struct nic_pkt_desc d = descs[i];
+
+			obj = shm_bm_transfer_net_pkt_buf(netshmem_get_shm(), d.objid);
+			ip  = (struct ip_hdr *)(obj->data + d.pkt_offset + ETH_STD_LEN);
+			off = ip->ihl * 4;
+			if (ip->proto == TCP_PROTO) {
+				tcp  = (struct tcp_hdr *)((char *)ip + off);
+				off += (tcp->data_off >> 4) * 4;
+			} else {
+				off += UDP_STD_LEN;
+			}
+			h = (struct pktgen_hdr *)((char *)ip + off);
+
+			if (cur_phase >= 0 && h->magic == PKTGEN_MAGIC) {
+				stats.received++;
+				stats.bytes += d.pkt_len;
+				if (h->seq % PKTGEN_LAT_EVERY == 0) perfdata_add(&lat_pd, time_now() - h->ts);
+			}
+			netshmem_pkt_buf_free(obj);
+		}
+	}
+}
+
+void
+cos_init(void)
+{
+	u64_t mac;
+
+	printc("Packet generator benchmark for the nicmgr (with NIC_TX_LOOPBACK).\n");
+
+	host_ip = inet_addr("10.10.1.2");
+	mac     = nic_get_port_mac_address(0);
+	memcpy(&host_mac, &mac, sizeof(host_mac));
+}
+
+int
+main(void)
+{
+	rx_thd = sched_thd_create(pktgen_rx, NULL);
+	sched_thd_param_set(rx_thd, sched_param_pack(SCHEDP_PRIO, PKTGEN_RX_PRIO));
+	tx_thd = sched_thd_create(pktgen_tx, NULL);
+	sched_thd_param_set(tx_thd, sched_param_pack(SCHEDP_PRIO, PKTGEN_TX_PRIO));
+
+	return 0;
+}
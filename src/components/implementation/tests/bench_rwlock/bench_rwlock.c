@@ -0,0 +1,220 @@
+#include <llprint.h>
+#include <sched.h>
+
+#include <sync_rwlock.h>
+#include <sync_seqlock.h>
+#include <perfdata.h>
+#include <cos_time.h>
+
+#undef RWLOCK_TRACE_DEBUG
+#ifdef RWLOCK_TRACE_DEBUG
+#define debug(format, ...) printc(format, ##__VA_ARGS__)
+#else
+#define debug(format, ...)
+#endif
+
+/* One low-priority thread and one high-priority thread contends on the lock */
+#define ITERATION 200
+/* #define PRINT_ALL */
+
+typedef enum {
+	HI_WRITES = 0, 		/* lo holds the lock for reading, hi writes */
+	HI_READS,		/* lo holds the lock for writing, hi reads (priority inheritance) */
+	PHASE_MAX
+} bench_phase_t;
+
+static const char *phase_names[PHASE_MAX] = {
+	"Contended rwlock - (read held) write take+release",
+	"Contended rwlock - (write held) read take+release",
+};
+
+struct sync_rwlock lock;
+struct sync_seqlock seqlock;
+volatile struct snapshot {
+	u64_t a, b;
+} snap;
+
+thdid_t lock_hi = 0, lock_lo = 0;
+volatile int flag = 0;
+volatile bench_phase_t phase = HI_WRITES;
+
+volatile cycles_t start;
+volatile cycles_t end;
+
+struct perfdata perf;
+cycles_t result[ITERATION] = {0, };
+
+static void
+perf_print(void)
+{
+	perfdata_calc(&perf);
+#ifdef PRINT_ALL
+	perfdata_all(&perf);
+#else
+	perfdata_print(&perf);
+#endif
+}
+
+/***
+ * As in `bench_lock`, the high priority thread periodically
+ * challenges the lock while the low priority thread holds it and
+ * spins. When the low-priority thread detects that the flag is
+ * changed, it knows that the lock is challenged, and releases it.
+ */
+void
+lock_hi_thd(void *d)
+{
+	/* Never stops running; low priority controls how many iters to run. */
+	while (1) {
+		debug("h1,");
+		sched_thd_block_timeout(0, time_now() + time_usec2cyc(1000));
+
+		debug("h2,");
+		flag = 1;
+		start = time_now();
+		if (phase == HI_WRITES) {
+			sync_rwlock_write_take(&lock);
+			sync_rwlock_write_release(&lock);
+		} else {
+			sync_rwlock_read_take(&lock);
+			sync_rwlock_read_release(&lock);
+		}
+		end = time_now();
+		debug("h3,");
+	}
+}
+
+void
+lock_lo_thd(void *d)
+{
+	bench_phase_t p;
+	int i;
+
+	for (p = HI_WRITES; p < PHASE_MAX; p++) {
+		int first = 0;
+
+		perfdata_init(&perf, phase_names[p], result, ITERATION);
+		phase = p;
+
+		for (i = 0; i < ITERATION + 1; i++) {
+			debug("l1,");
+			if (p == HI_WRITES) sync_rwlock_read_take(&lock);
+			else                sync_rwlock_write_take(&lock);
+
+			debug("l2,");
+			while (flag != 1) ;
+			flag = 0;
+
+			if (p == HI_WRITES) sync_rwlock_read_release(&lock);
+			else                sync_rwlock_write_release(&lock);
+
+			if (first == 0) first = 1;
+			else perfdata_add(&perf, end - start);
+			debug("l3,");
+		}
+		perf_print();
+	}
+
+	printc("SUCCESS: Finished rwlock tests.\n");
+	while (1) ;
+}
+
+void
+test_uncontended(void)
+{
+	struct snapshot s = { 0 };
+	int i, first;
+
+	perfdata_init(&perf, "Uncontended rwlock - read take+release", result, ITERATION);
+	for (i = 0, first = 0; i < ITERATION + 1; i++) {
+		start = time_now();
+
+		sync_rwlock_read_take(&lock);
+		sync_rwlock_read_release(&lock);
+
+		end = time_now();
+		if (first == 0) first = 1;
+		else perfdata_add(&perf, end - start);
+	}
+	perf_print();
+
+	perfdata_init(&perf, "Uncontended rwlock - write take+release", result, ITERATION);
+	for (i = 0, first = 0; i < ITERATION + 1; i++) {
+		start = time_now();
+
+		sync_rwlock_write_take(&lock);
+		sync_rwlock_write_release(&lock);
+
+		end = time_now();
+		if (first == 0) first = 1;
+		else perfdata_add(&perf, end - start);
+	}
+	perf_print();
+
+	perfdata_init(&perf, "Uncontended seqlock - write", result, ITERATION);
+	for (i = 0, first = 0; i < ITERATION + 1; i++) {
+		s.a = i;
+		s.b = i;
+		start = time_now();
+
+		sync_seqlock_write(&seqlock, &snap, &s, sizeof(struct snapshot));
+
+		end = time_now();
+		if (first == 0) first = 1;
+		else perfdata_add(&perf, end - start);
+	}
+	perf_print();
+
+	perfdata_init(&perf, "Uncontended seqlock - read", result, ITERATION);
+	for (i = 0, first = 0; i < ITERATION + 1; i++) {
+		start = time_now();
+
+		sync_seqlock_read(&seqlock, &s, &snap, sizeof(struct snapshot));
+
+		end = time_now();
+		assert(s.a == s.b);
+		if (first == 0) first = 1;
+		else perfdata_add(&perf, end - start);
+	}
+	perf_print();
+}
+
+void
+test_rwlock(void)
+{
+	sched_param_t sps[] = {
+		SCHED_PARAM_CONS(SCHEDP_PRIO, 4),
+		SCHED_PARAM_CONS(SCHEDP_PRIO, 6)
+	};
+
+	if (sync_rwlock_init(&lock)) BUG();
+	sync_seqlock_init(&seqlock);
+
+	test_uncontended();
+
+	printc("Create threads:\n");
+
+	lock_lo = sched_thd_create(lock_lo_thd, NULL);
+	printc("\tcreating lo thread %lu at prio %d\n", lock_lo, sps[1]);
+	sched_thd_param_set(lock_lo, sps[1]);
+
+	lock_hi = sched_thd_create(lock_hi_thd, NULL);
+	printc("\tcreating hi thread %lu at prio %d\n", lock_hi, sps[0]);
+	sched_thd_param_set(lock_hi, sps[0]);
+}
+
+void
+cos_init(void)
+{
+	printc("Benchmark for the sync_rwlock and sync_seqlock (w/sched interface).\n");
+}
+
+int
+main(void)
+{
+	test_rwlock();
+
+	printc("Running benchmark, exiting main thread...\n");
+
+	return 0;
+}
@@ -6,7 +6,8 @@
 
 #include <llprint.h>
 #include <sched.h>
-#include <perfdata.h>
+#include <ubench.h>
+#include <ubench_pmu.h>
 #include <cos_time.h>
 
 #undef YIELD_TRACE_DEBUG
@@ -16,16 +17,19 @@
 #define debug(format, ...)
 #endif
 
-/* lo and hi is actually running at the same prio */
+/*
+ * lo and hi is actually running at the same prio.  A low priority
+ * makes the scheduler's search for the highest runnable priority
+ * part of the measurement.
+ */
+#define YIELD_PRIO 200
 #define ITERATION 10000
-/* #define PRINT_ALL */
 
 thdid_t yield_hi = 0, yield_lo = 0;
 volatile cycles_t start;
 volatile cycles_t end;
 
-struct perfdata perf;
-cycles_t result[ITERATION] = {0, };
+struct ubench bench;
 
 /***
  * We're measuring 2-way context switch time.
@@ -44,10 +48,12 @@ yield_hi_thd(void *d)
 void
 yield_lo_thd(void *d)
 {
-	int i;
-	int first = 0;
+	struct ubench_pmu pmu;
+	/* the instructions are stable across runs, and under virtualization, unlike the cycles */
+	int counting = !ubench_pmu_init(&pmu, bench.name, NULL, 0);
 
-	for (i = 0; i < ITERATION + 1; i++) {
+	if (counting) ubench_pmu_begin(&pmu);
+	do {
 		debug("l1,");
 
 		start = time_now();
@@ -55,17 +61,14 @@ yield_lo_thd(void *d)
 		end = time_now();
 
 		debug("l2,");
-
-		if (first == 0) first = 1;
-		else perfdata_add(&perf, end - start);
+	} while (!ubench_sample(&bench, end - start));
+	if (counting) ubench_pmu_end(&pmu, ubench_nsamples(&bench));
+	ubench_report(&bench);
+	if (counting) {
+		ubench_pmu_report(&pmu);
+		ubench_pmu_done(&pmu);
 	}
-
-	perfdata_calc(&perf);
-#ifdef PRINT_ALL
-	perfdata_all(&perf);
-#else
-	perfdata_print(&perf);
-#endif
+	ubench_end();
 
 	while (1) ;
 }
@@ -74,11 +77,11 @@ void
 test_yield(void)
 {
 	sched_param_t sps[] = {
-		SCHED_PARAM_CONS(SCHEDP_PRIO, 6),
-		SCHED_PARAM_CONS(SCHEDP_PRIO, 6)
+		SCHED_PARAM_CONS(SCHEDP_PRIO, YIELD_PRIO),
+		SCHED_PARAM_CONS(SCHEDP_PRIO, YIELD_PRIO)
 	};
 
-	perfdata_init(&perf, "Context switch time", result, ITERATION);
+	ubench_init(&bench, "Context switch time", "prio=" STR(YIELD_PRIO), UBENCH_OPTS(ITERATION));
 
 	printc("Create threads:\n");
 
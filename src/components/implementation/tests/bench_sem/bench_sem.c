@@ -8,7 +8,7 @@
 #include <sched.h>
 
 #include <sync_sem.h>
-#include <perfdata.h>
+#include <ubench.h>
 #include <cos_time.h>
 
 #undef SEM_TRACE_DEBUG
@@ -20,17 +20,18 @@
 
 /* One low-priority thread and one high-priority thread contends on the semaphore */
 #define ITERATION 100
-//#define PRINT_ALL
 
-struct sync_sem sem;
+/* The threads blocked on the semaphore for the give with many waiters */
+#define SEM_WAITERS 32
+
+struct sync_sem sem, sem_many;
 thdid_t sem_hi = 0, sem_lo = 0;
 volatile int flag = 0;
 
 volatile cycles_t start;
 volatile cycles_t end;
 
-struct perfdata perf;
-cycles_t result[ITERATION] = {0, };
+struct ubench bench;
 
 /***
  * The high priority thread periodically challenges the sem while the low priority thread keeps spinning.
@@ -61,10 +62,7 @@ sem_hi_thd(void *d)
 void
 sem_lo_thd(void *d)
 {
-	int i;
-	int first = 0;
-
-	for (i = 0; i < ITERATION + 1; i++) {
+	do {
 		debug("l1");
 		sched_thd_wakeup(sem_hi);
 
@@ -76,56 +74,59 @@ sem_lo_thd(void *d)
 		while (flag != 1) {}
 
 		sync_sem_give(&sem);
-
-		if (first == 0) first = 1;
-		else perfdata_add(&perf, end - start);
 		debug("l4");
-	}
-
-	perfdata_calc(&perf);
-#ifdef PRINT_ALL
-	perfdata_all(&perf);
-#else
-	perfdata_print(&perf);
-#endif
+	} while (!ubench_sample(&bench, end - start));
+	ubench_report(&bench);
+
+	/*
+	 * The waiters have a higher priority: each give hands a count
+	 * off to one of them, which takes the semaphore again, and
+	 * blocks before we return. Waking all of the waiters would
+	 * have them all execute, and re-block, in each give.
+	 */
+	ubench_init(&bench, "Semaphore with many waiters - give", "waiters=32,prio_waiters=5,prio_give=6", UBENCH_OPTS(ITERATION));
+	do {
+		start = time_now();
+		sync_sem_give(&sem_many);
+		end = time_now();
+	} while (!ubench_sample(&bench, end - start));
+	ubench_report(&bench);
+	ubench_end();
 
 	while (1) ;
 }
 
 void
-test_sem(void)
+sem_waiter_thd(void *d)
 {
-	int i;
-	int first = 0;
-	cycles_t start, end;
+	while (1) sync_sem_take(&sem_many);
+}
+
+static void
+sem_take_give(void *d)
+{
+	sync_sem_take(&sem);
+	sync_sem_give(&sem);
+}
 
+void
+test_sem(void)
+{
 	sched_param_t sps[] = {
 		SCHED_PARAM_CONS(SCHEDP_PRIO, 4),
 		SCHED_PARAM_CONS(SCHEDP_PRIO, 6)
 	};
+	int i;
 
 	sync_sem_init(&sem, 1);
+	sync_sem_init(&sem_many, 0);
 
 	/* Uncontended semaphore taking/releasing */
-	perfdata_init(&perf, "Uncontended semaphore - take+give", result, ITERATION);
-	for (i = 0; i < ITERATION + 1; i++) {
-		start = time_now();
-
-		sync_sem_take(&sem);
-		sync_sem_give(&sem);
+	ubench_init(&bench, "Uncontended semaphore - take+give", "", UBENCH_OPTS(ITERATION));
+	ubench_run(&bench, sem_take_give, NULL);
+	ubench_report(&bench);
 
-		end = time_now();
-		if (first == 0) first = 1;
-		else perfdata_add(&perf, end - start);
-	}
-	perfdata_calc(&perf);
-#ifdef PRINT_ALL
-	perfdata_all(&perf);
-#else
-	perfdata_print(&perf);
-#endif
-
-	perfdata_init(&perf, "Contended semaphore - take+give", result, ITERATION);
+	ubench_init(&bench, "Contended semaphore - take+give", "prio_hi=4,prio_lo=6", UBENCH_OPTS(ITERATION));
 
 	printc("Create threads:\n");
 
@@ -136,6 +137,13 @@ test_sem(void)
 	sem_hi = sched_thd_create(sem_hi_thd, NULL);
 	printc("\tcreating hi thread %ld at prio %d\n", sem_hi, sps[0]);
 	sched_thd_param_set(sem_hi, sps[0]);
+
+	for (i = 0; i < SEM_WAITERS; i++) {
+		thdid_t t = sched_thd_create(sem_waiter_thd, NULL);
+
+		sched_thd_param_set(t, SCHED_PARAM_CONS(SCHEDP_PRIO, 5));
+	}
+	printc("\tcreating %d waiter threads at prio 5\n", SEM_WAITERS);
 }
 
 void
@@ -2,23 +2,36 @@
 #include <llprint.h>
 
 #include <cos_time.h>
-#include <perfdata.h>
+#include <ubench.h>
+#include <ubench_pmu.h>
 #include <syncipc.h>
+#include <ps.h>
 
 #define ITERATION 256
-struct perfdata perf;
-cycles_t results[ITERATION] = {0, };
+struct ubench bench, queued_bench;
+/* The two benchmarks executed concurrently that must finish */
+unsigned long benches_done = 0;
+
+static void
+bench_done(void)
+{
+	if (ps_faa(&benches_done, 1) == 1) ubench_end();
+}
 
 static void
 client(void *d)
 {
 	word_t arg0 = 0, arg1 = 1;
 	cycles_t start, end;
-	int i;
+	struct ubench_pmu pmu;
+	int counting;
 
 	sched_thd_block_timeout(0, time_now() + (1 << 15));
 
-	for (i = 0; i < ITERATION; i++) {
+	/* The client's instructions (in its and the scheduler's code) per call */
+	counting = !ubench_pmu_init(&pmu, bench.name, NULL, 0);
+	if (counting) ubench_pmu_begin(&pmu);
+	do {
 		word_t ret0 = 0, ret1 = 0;
 		int ret;
 
@@ -34,17 +47,69 @@ client(void *d)
 
 		arg0++;
 		arg1++;
-
-		perfdata_add(&perf, end - start);
+	} while (!ubench_sample(&bench, end - start));
+	if (counting) ubench_pmu_end(&pmu, ubench_nsamples(&bench));
+	ubench_report(&bench);
+	if (counting) {
+		ubench_pmu_report(&pmu);
+		ubench_pmu_done(&pmu);
 	}
-	perfdata_calc(&perf);
-	perfdata_print(&perf);
+	bench_done();
 
 	printc("SUCCESS: synchronous IPC between threads\n");
 
 	sched_thd_block(0);
 }
 
+/*
+ * Multiple clients and servers on an endpoint: the calls are queued,
+ * and the servers take them in batches.
+ */
+#define QUEUED_EP       1
+#define QUEUED_CLIENTS  4
+#define QUEUED_SERVERS  2
+#define QUEUED_BATCH    4
+unsigned long queued_done = 0;
+cycles_t      queued_start;
+
+static void
+queued_client(void *d)
+{
+	int i;
+
+	sched_thd_block_timeout(0, time_now() + (1 << 15));
+	if (!queued_start) queued_start = time_now();
+
+	for (i = 0; i < ITERATION; i++) {
+		word_t ret0 = 0, ret1 = 0;
+
+		if (syncipc_call(QUEUED_EP, i, (word_t)d, &ret0, &ret1)) assert(0);
+		assert(ret0 == (word_t)i && ret1 == (word_t)d);
+	}
+	if (ps_faa(&queued_done, 1) == QUEUED_CLIENTS - 1) {
+		/* A single sample, of the average over all of the calls */
+		ubench_sample(&queued_bench, (time_now() - queued_start) / (QUEUED_CLIENTS * ITERATION));
+		ubench_report(&queued_bench);
+		printc("SUCCESS: queued synchronous IPC between threads\n");
+		bench_done();
+	}
+
+	sched_thd_block(0);
+}
+
+static void
+queued_server(void *d)
+{
+	word_t ret0 = 0, ret1 = 0;
+
+	while (1) {
+		/* Echo the arguments */
+		if (syncipc_reply_wait_batch(QUEUED_EP, ret0, ret1, QUEUED_BATCH, &ret0, &ret1)) {
+			printc("syncipc benchmark: queued server reply_wait returned error\n");
+		}
+	}
+}
+
 static void
 server(void *d)
 {
@@ -68,9 +133,14 @@ main(void)
 	sched_param_t sps[] = {
 		SCHED_PARAM_CONS(SCHEDP_PRIO, 4),
 		SCHED_PARAM_CONS(SCHEDP_PRIO, 6),
+		SCHED_PARAM_CONS(SCHEDP_PRIO, 5),
 	};
+	int i;
 
-	perfdata_init(&perf, "Synchronous IPC round trip latency", results, ITERATION);
+	ubench_init(&bench, "Synchronous IPC round trip latency", "", UBENCH_OPTS(ITERATION));
+	ubench_init(&queued_bench, "Queued synchronous IPC - cycles per call",
+	            "clients=" STR(QUEUED_CLIENTS) ",servers=" STR(QUEUED_SERVERS) ",batch=" STR(QUEUED_BATCH),
+	            (struct ubench_opts) { .iterations = 1 });
 
 	tid = sched_thd_create(client, NULL);
 	assert(tid > 0);
@@ -80,5 +150,16 @@ main(void)
 	assert(tid > 0);
 	sched_thd_param_set(tid, sps[1]);
 
+	for (i = 0; i < QUEUED_SERVERS; i++) {
+		tid = sched_thd_create(queued_server, NULL);
+		assert(tid > 0);
+		sched_thd_param_set(tid, sps[1]);
+	}
+	for (i = 0; i < QUEUED_CLIENTS; i++) {
+		tid = sched_thd_create(queued_client, (void *)(word_t)i);
+		assert(tid > 0);
+		sched_thd_param_set(tid, sps[2]);
+	}
+
 	sched_thd_block(0);
 }
@@ -9,8 +9,10 @@
 
 #include <evt.h>
 #include <tmr.h>
-#include <perfdata.h>
+#include <ubench.h>
 #include <cos_time.h>
+#include <heap.h>
+#include <twheel.h>
 
 #undef TMR_TRACE_DEBUG
 #ifdef TMR_TRACE_DEBUG
@@ -24,16 +26,13 @@
 #define TMR_PERIODIC_TIME	10000
 /* #define DROP_THRESHOLD		0x1000000U */
 
-#define PRINT_ALL
-
 thdid_t tmr_hi = 0, tmr_lo = 0;
 
 typedef unsigned int cycles_32_t;
 volatile cycles_32_t start;
 volatile cycles_32_t end;
 
-struct perfdata perf;
-cycles_t result[ITERATION] = {0, };
+struct ubench bench;
 
 /***
  * The high priority thread sets up a periodic timer while the low priority thread keeps looping and updating
@@ -43,16 +42,14 @@ cycles_t result[ITERATION] = {0, };
 void
 tmr_hi_thd(void *d)
 {
-	int i;
 	struct tmr t;
 	struct evt e;
 	evt_res_id_t evt_id;
 	evt_res_data_t evtdata;
 	evt_res_type_t  evtsrc;
-	int first = 0;
 
 	printc("Call into timer manager to make a timer.\n");
-	assert(tmr_init(&t, TMR_PERIODIC_TIME, TMR_PERIODIC) == 0);
+	assert(tmr_init(&t, TMR_PERIODIC_TIME, 0, TMR_PERIODIC) == 0);
 
 	printc("Call into event manager to make a event.\n");
 	assert(evt_init(&e, 2) == 0);
@@ -69,27 +66,16 @@ tmr_hi_thd(void *d)
 	assert(tmr_start(&t) == 0);
 
 	/* Event loop */
-	i = 0;
- 	while (i < ITERATION + 1) {
+	do {
 		evt_get(&e, EVT_WAIT_DEFAULT, &evtsrc, &evtdata);
 		end = (cycles_32_t)time_now();
 
 		/* Drop not used; we're dealing with unsigned ints */
 		/* if ((end - start) > DROP_THRESHOLD) continue; */
-
-		if (first == 0) first = 1;
-		else perfdata_add(&perf, end - start);
 		debug("%lld.\n", end - start);
-
-		i++;
-	}
-
-	perfdata_calc(&perf);
-#ifdef PRINT_ALL
-	perfdata_all(&perf);
-#else
-	perfdata_print(&perf);
-#endif
+	} while (!ubench_sample(&bench, end - start));
+	ubench_report(&bench);
+	ubench_end();
 
 	while (1) ;
 }
@@ -106,15 +92,13 @@ tmr_lo_thd(void *d)
 void
 test_tmr(void)
 {
-	int i;
-
 	sched_param_t sps[] = {
 		SCHED_PARAM_CONS(SCHEDP_PRIO, 4),
 		SCHED_PARAM_CONS(SCHEDP_PRIO, 6)
 	};
 
 
-	perfdata_init(&perf, "Timer latency - total", result, ITERATION);
+	ubench_init(&bench, "Timer latency - total", "period_us=" STR(TMR_PERIODIC_TIME), UBENCH_OPTS(ITERATION));
 
 	printc("Create threads:\n");
 
@@ -127,6 +111,136 @@ test_tmr(void)
 	sched_thd_param_set(tmr_hi, sps[0]);
 }
 
+/***
+ * The scheduler's timeout data-structures with many concurrent
+ * timeouts: the heap of the quantum timer policy, and the timing
+ * wheel of the wheel policy. Timeouts are added in a pseudo-random
+ * order, half are canceled, and the rest are expired by advancing
+ * time past all of them.
+ */
+#define NTIMEOUTS    4096
+#define TIMEOUT_MAX  (1 << 16) /* in ticks */
+
+struct timeout {
+	struct twheel_timer timer;
+	int                 idx;
+	u64_t               when;
+};
+
+static struct timeout timeouts[NTIMEOUTS];
+static struct twheel  wheel;
+static struct {
+	struct heap h;
+	void       *data[NTIMEOUTS];
+} theap;
+static int nexpired;
+
+static int
+timeout_cmp(void *a, void *b)
+{ return ((struct timeout *)a)->when <= ((struct timeout *)b)->when; }
+
+static void
+timeout_idx(void *e, int pos)
+{ ((struct timeout *)e)->idx = pos; }
+
+DECLARE_HEAP(timeout, timeout_cmp, timeout_idx);
+
+static void
+timeout_expire(struct twheel_timer *t, void *d)
+{ nexpired++; }
+
+/* Each operation is reported as a single sample, of its average cost per timeout */
+static struct ubench timeouts_bench;
+
+static void
+bench_timeouts_report(const char *name, cycles_t cyc, int n)
+{
+	ubench_init(&timeouts_bench, name, "timeouts=" STR(NTIMEOUTS), (struct ubench_opts) { .iterations = 1 });
+	ubench_sample(&timeouts_bench, cyc / n);
+	ubench_report(&timeouts_bench);
+}
+
+void
+bench_timeouts(void)
+{
+	cycles_t      s, add, cancel, expire;
+	u64_t         now;
+	unsigned long seed = 1;
+	int           i;
+
+	for (i = 0; i < NTIMEOUTS; i++) {
+		seed = seed * 1103515245 + 12345;
+		timeouts[i].when = (seed >> 8) % TIMEOUT_MAX;
+	}
+
+	heap_init(&theap.h, NTIMEOUTS);
+	s = time_now();
+	for (i = 0; i < NTIMEOUTS; i++) timeout_heap_add(&theap.h, &timeouts[i]);
+	add = time_now() - s;
+	s = time_now();
+	for (i = 0; i < NTIMEOUTS; i += 2) timeout_heap_remove(&theap.h, timeouts[i].idx);
+	cancel = time_now() - s;
+	s = time_now();
+	for (now = 0; heap_size(&theap.h) > 0; now++) {
+		while (heap_size(&theap.h) > 0 && ((struct timeout *)heap_peek(&theap.h))->when <= now) {
+			timeout_heap_highest(&theap.h);
+		}
+	}
+	expire = time_now() - s;
+	bench_timeouts_report("Timeout heap - add", add, NTIMEOUTS);
+	bench_timeouts_report("Timeout heap - cancel", cancel, NTIMEOUTS / 2);
+	bench_timeouts_report("Timeout heap - expire", expire, NTIMEOUTS / 2);
+
+	twheel_init(&wheel, 0);
+	for (i = 0; i < NTIMEOUTS; i++) twheel_timer_init(&timeouts[i].timer);
+	s = time_now();
+	for (i = 0; i < NTIMEOUTS; i++) twheel_add(&wheel, &timeouts[i].timer, timeouts[i].when);
+	add = time_now() - s;
+	s = time_now();
+	for (i = 0; i < NTIMEOUTS; i += 2) twheel_cancel(&wheel, &timeouts[i].timer);
+	cancel = time_now() - s;
+	nexpired = 0;
+	s = time_now();
+	for (now = 0; wheel.ntimers > 0; now++) twheel_advance(&wheel, now, timeout_expire, NULL);
+	expire = time_now() - s;
+	assert(nexpired == NTIMEOUTS / 2);
+	bench_timeouts_report("Timing wheel - add", add, NTIMEOUTS);
+	bench_timeouts_report("Timing wheel - cancel", cancel, NTIMEOUTS / 2);
+	bench_timeouts_report("Timing wheel - expire", expire, NTIMEOUTS / 2);
+}
+
+/***
+ * Timers with slack: NSLACK one-shot timers with staggered timeouts
+ * and overlapping windows are started together, and the manager
+ * should merge their expiries into few wakeups.
+ */
+#define NSLACK        16
+#define SLACK_TIME    10000
+#define SLACK_STAGGER 500
+
+void
+bench_slack(void)
+{
+	struct tmr     tmrs[NSLACK];
+	struct evt     e;
+	evt_res_data_t evtdata;
+	evt_res_type_t evtsrc;
+	unsigned long  merged;
+	int            i;
+
+	assert(evt_init(&e, NSLACK) == 0);
+	for (i = 0; i < NSLACK; i++) {
+		assert(tmr_init(&tmrs[i], TMR_PERIODIC_TIME + i * SLACK_STAGGER, SLACK_TIME, TMR_ONESHOT) == 0);
+		assert(tmr_evt_associate(&tmrs[i], evt_add(&e, 1, (evt_res_data_t)&tmrs[i])) == 0);
+	}
+
+	merged = tmr_nmerged();
+	for (i = 0; i < NSLACK; i++) assert(tmr_start(&tmrs[i]) == 0);
+	for (i = 0; i < NSLACK; i++) evt_get(&e, EVT_WAIT_DEFAULT, &evtsrc, &evtdata);
+
+	printc("Timer slack (%d timers): %lu merged wakeups\n", NSLACK, tmr_nmerged() - merged);
+}
+
 void
 cos_init(void)
 {
@@ -136,6 +250,8 @@ cos_init(void)
 int
 main(void)
 {
+	bench_timeouts();
+	bench_slack();
 	test_tmr();
 
 	printc("Running benchmark, exiting main thread...\n");
@@ -0,0 +1,274 @@
+#include <cos_component.h>
+#include <llprint.h>
+#include <chan.h>
+#include <ps.h>
+#include <cos_time.h>
+#include <sched.h>
+#include <syncipc.h>
+#include <ubench.h>
+
+/***
+ * The communication costs between each pair of cores: for each
+ * ordered pair (src, dst), and each of
+ *
+ * - ipi: a cross-core wakeup, which the scheduler delivers with an
+ *   asnd to the IPI thread (arcv) of the destination's core,
+ * - chan: a message through a blocking channel,
+ * - cacheline: a cache line written by one core, and read by the
+ *   other, and
+ * - syncipc: a call to a server thread on the destination's core,
+ *
+ * the round trip from src to dst and back, and the one-way latency
+ * from src to dst, from the timestamp taken by src before sending, to
+ * that of dst on receiving (so the TSCs must be synchronized across
+ * cores). The pairs are measured one at a time, while the other cores
+ * spin. Each measurement is reported as a `ubench` line, and the
+ * medians as matrices.
+ */
+
+#define MATRIX_ITERS       1024
+#define MATRIX_WARMUP      16
+#define MATRIX_EP_BASE     4  /* the syncipc endpoint of core c's server is MATRIX_EP_BASE + c... */
+#define MATRIX_EP_NUM      16 /* ...if it's one of the scheduler's endpoints */
+#define MATRIX_PRIO_SERVER 4
+#define MATRIX_PRIO_MAIN   6
+
+enum {
+	MATRIX_IPI = 0,
+	MATRIX_CHAN,
+	MATRIX_LINE,
+	MATRIX_SYNCIPC,
+	MATRIX_NTESTS
+};
+
+static const char *matrix_names[MATRIX_NTESTS][2] = {
+	{ "xcore_ipi_roundtrip",       "xcore_ipi_oneway" },
+	{ "xcore_chan_roundtrip",      "xcore_chan_oneway" },
+	{ "xcore_cacheline_roundtrip", "xcore_cacheline_oneway" },
+	{ "xcore_syncipc_roundtrip",   "xcore_syncipc_oneway" },
+};
+
+static struct chan     inbox[NUM_CPU];
+static struct chan_rcv inbox_r[NUM_CPU];
+static struct chan_snd inbox_s[NUM_CPU][NUM_CPU]; /* [sender][receiver] */
+static thdid_t         mains[NUM_CPU];
+
+/* The cache line bounced between the cores, and the timestamp of the other tests' sends */
+static volatile struct {
+	unsigned long seq;
+	cycles_t      stamp;
+} line CACHE_ALIGNED;
+static volatile cycles_t stamp CACHE_ALIGNED;
+
+/* The current pair's round trips, measured by src, and one-way latencies, measured by dst */
+static struct ubench  rt, ow;
+static char           params[32];
+static unsigned long  go CACHE_ALIGNED; /* the step whose benchmarks are initialized */
+static unsigned long  arrived CACHE_ALIGNED;
+
+/* The medians, by test, src, and dst */
+static cycles_t rt_p50[MATRIX_NTESTS][NUM_CPU][NUM_CPU];
+static cycles_t ow_p50[MATRIX_NTESTS][NUM_CPU][NUM_CPU];
+
+static int
+matrix_ep(coreid_t c)
+{
+	return MATRIX_EP_BASE + c < MATRIX_EP_NUM ? MATRIX_EP_BASE + c : -1;
+}
+
+/* All cores pass their nth barrier together */
+static void
+matrix_barrier(unsigned long *n)
+{
+	(*n)++;
+	ps_faa(&arrived, 1);
+	while (ps_load(&arrived) < *n * NUM_CPU) ;
+}
+
+static void
+matrix_server(void *d)
+{
+	int    ep   = (int)(word_t)d;
+	word_t arg0 = 0, arg1 = 0;
+
+	/* Echo the arguments, the first being the caller's timestamp */
+	while (1) {
+		if (syncipc_reply_wait(ep, arg0, arg1, &arg0, &arg1)) {
+			printc("xcore matrix benchmark: server reply_wait returned error\n");
+			continue;
+		}
+		ubench_sample(&ow, time_now() - arg0);
+	}
+}
+
+static void
+matrix_initiate(int test, coreid_t src, coreid_t dst, unsigned long step)
+{
+	struct ubench_opts opts = { .warmup = MATRIX_WARMUP, .iterations = MATRIX_ITERS };
+	cycles_t           start, end;
+	word_t             v, ret0, ret1;
+	int                k, ret;
+
+	snprintf(params, sizeof(params), "src=%u,dst=%u", src, dst);
+	ubench_init(&rt, matrix_names[test][0], params, opts);
+	ubench_init(&ow, matrix_names[test][1], params, opts);
+	line.seq = 0;
+	ps_mem_fence();
+	go = step;
+
+	if (test == MATRIX_SYNCIPC) {
+		/* Await the server's registration on the endpoint */
+		while ((ret = syncipc_call(matrix_ep(dst), time_now(), 0, &ret0, &ret1)) == -EAGAIN) {
+			sched_thd_block_timeout(0, time_now() + time_usec2cyc(100));
+		}
+		assert(ret == 0);
+	}
+
+	for (k = 0; k < MATRIX_WARMUP + MATRIX_ITERS; k++) {
+		start = time_now();
+		switch (test) {
+		case MATRIX_IPI:
+			stamp = start;
+			sched_thd_wakeup(mains[dst]);
+			sched_thd_block(0);
+			break;
+		case MATRIX_CHAN:
+			v = start;
+			if (chan_send(&inbox_s[src][dst], &v, 0)) assert(0);
+			if (chan_recv(&inbox_r[src], &v, 0)) assert(0);
+			break;
+		case MATRIX_LINE:
+			line.stamp = start;
+			line.seq   = 2 * k + 1;
+			while (line.seq != (unsigned long)2 * k + 2) ;
+			break;
+		case MATRIX_SYNCIPC:
+			ret = syncipc_call(matrix_ep(dst), start, 0, &ret0, &ret1);
+			assert(ret == 0);
+			break;
+		}
+		end = time_now();
+		ubench_sample(&rt, end - start);
+	}
+	/* The responder of syncipc waits for the server's calls to end */
+	if (test == MATRIX_SYNCIPC) sched_thd_wakeup(mains[dst]);
+
+	ubench_report(&rt);
+	ubench_report(&ow);
+	rt_p50[test][src][dst] = perfdata_ptile(&rt.pd, 500000);
+	ow_p50[test][src][dst] = perfdata_ptile(&ow.pd, 500000);
+}
+
+static void
+matrix_respond(int test, coreid_t src, coreid_t dst, unsigned long step)
+{
+	word_t v;
+	int    k;
+
+	while (ps_load(&go) != step) ;
+
+	/* The server thread responds, and it needs the core */
+	if (test == MATRIX_SYNCIPC) {
+		sched_thd_block(0);
+		return;
+	}
+
+	for (k = 0; k < MATRIX_WARMUP + MATRIX_ITERS; k++) {
+		switch (test) {
+		case MATRIX_IPI:
+			sched_thd_block(0);
+			ubench_sample(&ow, time_now() - stamp);
+			sched_thd_wakeup(mains[src]);
+			break;
+		case MATRIX_CHAN:
+			if (chan_recv(&inbox_r[dst], &v, 0)) assert(0);
+			ubench_sample(&ow, time_now() - v);
+			if (chan_send(&inbox_s[dst][src], &v, 0)) assert(0);
+			break;
+		case MATRIX_LINE:
+			while (line.seq != (unsigned long)2 * k + 1) ;
+			ubench_sample(&ow, time_now() - line.stamp);
+			line.seq = 2 * k + 2;
+			break;
+		}
+	}
+}
+
+static void
+matrix_print(int test, int oneway)
+{
+	cycles_t (*m)[NUM_CPU] = oneway ? ow_p50[test] : rt_p50[test];
+	int      i, j;
+
+	printc("%s median (cycles), from the row's core to the column's:\n", matrix_names[test][oneway]);
+	printc("%6s", "");
+	for (j = 0; j < NUM_CPU; j++) printc("%8d", j);
+	printc("\n");
+	for (i = 0; i < NUM_CPU; i++) {
+		printc("%6d", i);
+		for (j = 0; j < NUM_CPU; j++) {
+			if (m[i][j] == 0) printc("%8s", "-");
+			else              printc("%8llu", m[i][j]);
+		}
+		printc("\n");
+	}
+}
+
+void
+cos_init(void)
+{
+	int i, j;
+
+	assert(NUM_CPU > 1);
+
+	for (i = 0; i < NUM_CPU; i++) {
+		if (chan_init(&inbox[i], sizeof(word_t), 16, CHAN_DEFAULT)) assert(0);
+		if (chan_rcv_init(&inbox_r[i], &inbox[i])) assert(0);
+	}
+	for (i = 0; i < NUM_CPU; i++) {
+		for (j = 0; j < NUM_CPU; j++) {
+			if (i != j && chan_snd_init(&inbox_s[i][j], &inbox[j])) assert(0);
+		}
+	}
+}
+
+void
+parallel_main(coreid_t cid)
+{
+	unsigned long nbarriers = 0, step = 0;
+	thdid_t       tid;
+	int           test, src, dst;
+
+	mains[cid] = cos_thdid();
+	sched_thd_param_set(cos_thdid(), sched_param_pack(SCHEDP_PRIO, MATRIX_PRIO_MAIN));
+	if (matrix_ep(cid) >= 0) {
+		tid = sched_thd_create(matrix_server, (void *)(word_t)matrix_ep(cid));
+		assert(tid > 0);
+		sched_thd_param_set(tid, sched_param_pack(SCHEDP_PRIO, MATRIX_PRIO_SERVER));
+	}
+	matrix_barrier(&nbarriers);
+
+	for (test = 0; test < MATRIX_NTESTS; test++) {
+		for (src = 0; src < NUM_CPU; src++) {
+			for (dst = 0; dst < NUM_CPU; dst++) {
+				if (src == dst || (test == MATRIX_SYNCIPC && matrix_ep(dst) < 0)) continue;
+
+				step++;
+				if (cid == src)      matrix_initiate(test, src, dst, step);
+				else if (cid == dst) matrix_respond(test, src, dst, step);
+				matrix_barrier(&nbarriers);
+			}
+		}
+	}
+
+	if (cid == 0) {
+		for (test = 0; test < MATRIX_NTESTS; test++) {
+			matrix_print(test, 0);
+			matrix_print(test, 1);
+		}
+		ubench_end();
+		printc("SUCCESS: cross-core matrix\n");
+	}
+
+	sched_thd_block(0);
+}
@@ -0,0 +1,132 @@
+#include <cos_component.h>
+#include <llprint.h>
+#include <chan.h>
+#include <ps.h>
+#include <cos_time.h>
+#include <sched.h>
+#include <perfdata.h>
+#include <syncipc.h>
+
+/***
+ * Cross-core RPC round-trip latency, between a client on one core,
+ * and a server on another, with 1. a request and a reply channel,
+ * the server awaiting requests with an event, and 2. a `syncipc`
+ * endpoint.
+ */
+
+#define ITERATION   1024
+#define SERVER_CORE 0
+#define CLIENT_CORE 1
+#define RPC_EP      2
+
+struct perfdata perf_chan, perf_ipc;
+cycles_t        results_chan[ITERATION], results_ipc[ITERATION];
+
+struct chan     req, rep;
+struct chan_snd req_s, rep_s;
+struct chan_rcv req_r, rep_r;
+struct evt      e;
+evt_res_id_t    req_evt;
+
+static void
+chan_server(void)
+{
+	int i;
+
+	for (i = 0; i < ITERATION; i++) {
+		evt_res_data_t evtdata;
+		evt_res_type_t evtsrc;
+		word_t         v;
+
+		if (evt_get(&e, EVT_WAIT_DEFAULT, &evtsrc, &evtdata)) assert(0);
+		if (chan_recv(&req_r, &v, CHAN_NONBLOCKING)) assert(0);
+		if (chan_send(&rep_s, &v, 0)) assert(0);
+	}
+}
+
+static void
+ipc_server(void *d)
+{
+	word_t ret0 = 0, ret1 = 0;
+
+	/* Echo the arguments */
+	while (1) {
+		if (syncipc_reply_wait(RPC_EP, ret0, ret1, &ret0, &ret1)) {
+			printc("xcore rpc benchmark: server reply_wait returned error\n");
+		}
+	}
+}
+
+static void
+client(void)
+{
+	cycles_t start, end;
+	word_t   i, v, ret0, ret1;
+	int      ret;
+
+	for (i = 0; i < ITERATION; i++) {
+		start = time_now();
+		if (chan_send(&req_s, &i, 0)) assert(0);
+		if (chan_recv(&rep_r, &v, 0)) assert(0);
+		end = time_now();
+		assert(v == i);
+
+		perfdata_add(&perf_chan, end - start);
+	}
+	perfdata_calc(&perf_chan);
+	perfdata_print(&perf_chan);
+
+	/* Await the server's registration on the endpoint */
+	while ((ret = syncipc_call(RPC_EP, 0, 0, &ret0, &ret1)) == -EAGAIN) {
+		sched_thd_block_timeout(0, time_now() + time_usec2cyc(100));
+	}
+	assert(ret == 0);
+	for (i = 0; i < ITERATION; i++) {
+		start = time_now();
+		ret   = syncipc_call(RPC_EP, i, i + 1, &ret0, &ret1);
+		end   = time_now();
+		assert(ret == 0 && ret0 == i && ret1 == i + 1);
+
+		perfdata_add(&perf_ipc, end - start);
+	}
+	perfdata_calc(&perf_ipc);
+	perfdata_print(&perf_ipc);
+
+	printc("SUCCESS: cross-core RPC\n");
+}
+
+void
+cos_init(void)
+{
+	assert(NUM_CPU > 1);
+
+	perfdata_init(&perf_chan, "Cross-core RPC round trip latency (chan + evt)", results_chan, ITERATION);
+	perfdata_init(&perf_ipc, "Cross-core RPC round trip latency (syncipc)", results_ipc, ITERATION);
+
+	if (chan_init(&req, sizeof(word_t), 16, CHAN_DEFAULT) || chan_init(&rep, sizeof(word_t), 16, CHAN_DEFAULT)) assert(0);
+	if (chan_snd_init(&req_s, &req) || chan_rcv_init(&req_r, &req)) assert(0);
+	if (chan_snd_init(&rep_s, &rep) || chan_rcv_init(&rep_r, &rep)) assert(0);
+
+	assert(evt_init(&e, 1) == 0);
+	req_evt = evt_add(&e, 0, (evt_res_data_t)&req_r);
+	assert(req_evt != 0);
+	assert(chan_evt_associate(&req, req_evt) == 0);
+}
+
+void
+parallel_main(coreid_t cid)
+{
+	thdid_t tid;
+
+	if (cid == SERVER_CORE) {
+		tid = sched_thd_create(ipc_server, NULL);
+		assert(tid > 0);
+		sched_thd_param_set(tid, sched_param_pack(SCHEDP_PRIO, 4));
+
+		chan_server();
+	} else if (cid == CLIENT_CORE) {
+		client();
+	}
+
+	sched_thd_block(0);
+}
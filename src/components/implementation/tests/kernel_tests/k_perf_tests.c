@@ -4,7 +4,11 @@
 static struct perfdata pd[NUM_CPU] CACHE_ALIGNED;
 extern struct results  result_test_timer;
 extern struct results  result_budgets_single;
+extern struct results  result_tcap_deleg, result_tcap_deleg_uncached, result_tcap_deleg_bulk;
 extern struct results  result_sinv;
+extern struct results  result_sinv_mpk;
+extern struct results  result_sinv_uncached;
+extern struct results  result_slowpath;
 struct results  result_switch, result_thd_switch;
 struct results  result_async_roundtrip, result_async_oneway;
 
@@ -197,8 +201,19 @@ test_print_ubench(void)
 	results_print(&result_async_roundtrip, "Async => Roundtrip:");
 	results_print(&result_async_oneway, "Async => Oneway:");
 	results_print(&result_sinv, "Synchronous Invocations:");
+	results_print(&result_sinv_mpk, "Synchronous Invocations (MPK domain switch):");
+	results_print(&result_sinv_uncached, "Synchronous Invocations (captbl walk):");
+	results_print(&result_slowpath, "Slowpath Trap (sinv baseline):");
+	PRINTC("\tSinv fast path saves %lld cycles (avg) per round trip over the slowpath\n",
+	       (long long)result_slowpath.avg - (long long)result_sinv.avg);
+	PRINTC("Capability lookup cache: %d hits, %d misses\n",
+	       cos_introspect(&booter_info, booter_info.captbl_cap, CAPTBL_GET_LKUP_HITS),
+	       cos_introspect(&booter_info, booter_info.captbl_cap, CAPTBL_GET_LKUP_MISSES));
 	results_print(&result_test_timer, "Timer => Timeout Overhead:");
 	results_print(&result_budgets_single, "Timer => Budget Based:");
+	results_print(&result_tcap_deleg, "TCAP => Delegate:");
+	results_print(&result_tcap_deleg_uncached, "TCAP => Delegate (uncached):");
+	results_print(&result_tcap_deleg_bulk, "TCAP => Bulk delegate (per child):");
 }
 
 void
@@ -1,6 +1,7 @@
 /*
  * Test allocates a new component, then proceeds to allocate a new invocation
- * the allocation cos_sinv_alloc is checked
+ * the allocation cos_sinv_alloc is checked. The same is done through a
+ * batch of capability operations (cos_capop_batch_*).
  */
 
 #include <stdint.h>
@@ -31,3 +32,40 @@ test_captbl_expands(void)
         }
         PRINTC("\t%s: \t\tSuccess\n", "Capability Table Expansion");
 }
+
+#define CAPTBL_BATCH_ITER (COS_CAPOP_BATCH_MAX * 2 + 1)
+
+static COS_CAPOP_BATCH_DECLARE(batch);
+
+void
+test_captbl_batch(void)
+{
+        int          i, ret;
+        compcap_t    cc;
+        sinvcap_t    ic = 0;
+
+        cc = cos_comp_alloc(&booter_info, booter_info.captbl_cap, booter_info.pgtbl_cap, (vaddr_t)NULL, 0);
+        if (EXPECT_LL_LT(1, cc, "Capability Batch: Cannot Allocate")) {
+                return;
+        }
+        cos_capop_batch_init(&batch);
+        for (i = 0; i < CAPTBL_BATCH_ITER; i++) {
+                ic = cos_sinv_alloc_batch(&booter_info, &batch, cc, (vaddr_t)__inv_test_serverfn, 0xdead);
+                if (EXPECT_LL_LT(1, ic, "Capability Batch: Cannot Allocate")) {
+                        return;
+                }
+        }
+        ret = cos_capop_batch_flush(&batch);
+        if (EXPECT_LL_NEQ(0, ret, "Capability Batch: Flush")) {
+                return;
+        }
+
+        /* The last sinv is live: re-activating it fails, and stops the batch at that operation */
+        cos_capop_batch_add(&batch, booter_info.captbl_cap, CAPTBL_OP_SINVACTIVATE, ic, cc, (vaddr_t)__inv_test_serverfn, 0);
+        cos_capop_batch_add(&batch, booter_info.captbl_cap, CAPTBL_OP_SINVACTIVATE, ic, cc, (vaddr_t)__inv_test_serverfn, 0);
+        ret = cos_capop_batch_flush(&batch);
+        if (EXPECT_LL_EQ(0, ret, "Capability Batch: Error Propagation") || EXPECT_LL_NEQ(0, batch.err_idx, "Capability Batch: Error Index")) {
+                return;
+        }
+        PRINTC("\t%s: \t\tSuccess\n", "Capability Batch");
+}
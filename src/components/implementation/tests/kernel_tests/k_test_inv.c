@@ -9,6 +9,12 @@
 static int      failure = 0;
 static struct perfdata result;
 struct results  result_sinv;
+struct results  result_sinv_mpk;
+struct results  result_slowpath;
+struct results  result_sinv_uncached;
+
+/* More than the kernel's capability lookup cache holds, so that each lookup walks the captbl */
+#define INV_UNCACHED_NCAPS 64
 
 #define ARRAY_SIZE 10000
 static cycles_t test_results[ARRAY_SIZE] = { 0 };
@@ -21,7 +27,7 @@ test_serverfn(int a, int b, int c)
 
 extern void *__inv_test_serverfn(int a, int b, int c);
 
-static inline int
+int
 call_cap_mb(u32_t cap_no, int arg1, int arg2, int arg3)
 {
         int ret;
@@ -77,17 +83,37 @@ call_cap_mb(u32_t cap_no, int arg1, int arg2, int arg3)
         return ret;
 }
 
+static void
+inv_bench(sinvcap_t ic, char *name, struct results *r)
+{
+        cycles_t start_cycles, end_cycles;
+        int      i;
+
+        perfdata_init(&result, name, test_results, ARRAY_SIZE);
+	perfcntr_init(); /* 32bit counter, so resetting before every benchmark */
+
+        for (i = 0; i < ITER; i++) {
+                start_cycles = ps_tsc();
+                call_cap_mb(ic, 1, 2, 3);
+                end_cycles = ps_tsc();
+
+                perfdata_add(&result, end_cycles - start_cycles);
+        }
+
+        perfdata_calc(&result);
+	results_save(r, &result);
+}
+
 void
 test_inv(void)
 {
         compcap_t        cc;
-        sinvcap_t        ic;
+        sinvcap_t        ic, ics[INV_UNCACHED_NCAPS];
         unsigned int r;
-        int                  i;
+        int                  i, ret;
+        void            *page;
         cycles_t         start_cycles = 0LL, end_cycles = 0LL;
 
-        perfdata_init(&result, "SINV", test_results, ARRAY_SIZE);
-
         cc = cos_comp_alloc(&booter_info, booter_info.captbl_cap, booter_info.pgtbl_cap, (vaddr_t)NULL, 0);
         if (EXPECT_LL_LT(1, cc, "Invocation: Cannot Allocate")) return;
         ic = cos_sinv_alloc(&booter_info, cc, (vaddr_t)__inv_test_serverfn, 0xdead);
@@ -95,9 +121,39 @@ test_inv(void)
 
         r = call_cap_mb(ic, 1, 2, 3);
         if (EXPECT_LLU_NEQ(0xDEADBEEF, r, "Test Invocation")) return;
-	perfcntr_init(); /* 32bit counter, so resetting before every benchmark */
+
+        /*
+         * The server shares our page-table, so a page grant to it is
+         * refused by the sinv, and only applies to that sinv.
+         */
+        page = cos_page_bump_alloc(&booter_info);
+        if (EXPECT_LL_LT(1, (long long)page, "Invocation: Cannot Allocate")) return;
+        ret = cos_mem_grant(booter_info.pgtbl_cap, (vaddr_t)page, 0, PAGE_SIZE * (COS_GRANT_MAX_PAGES + 1), COS_GRANT_READ);
+        if (EXPECT_LL_NEQ(-EINVAL, ret, "Grant: Oversized")) return;
+        ret = cos_mem_grant(booter_info.pgtbl_cap, (vaddr_t)page, (vaddr_t)page, PAGE_SIZE, COS_GRANT_READ);
+        if (EXPECT_LL_NEQ(0, ret, "Grant")) return;
+        r = call_cap_mb(ic, 1, 2, 3);
+        if (EXPECT_LL_NEQ(-EINVAL, (int)r, "Grant: Same Page-Table")) return;
+        r = call_cap_mb(ic, 1, 2, 3);
+        if (EXPECT_LLU_NEQ(0xDEADBEEF, r, "Grant: Consumed")) return;
+
+        /* The server shares our page-table and protection domain: neither CR3 nor PKRU is written */
+        inv_bench(ic, "SINV", &result_sinv);
+
+        /*
+         * Invocations of sinvs in turn, each evicting the previous
+         * ones from the lookup cache, thus with the captbl walk (to
+         * compare with SINV).
+         */
+        for (i = 0; i < INV_UNCACHED_NCAPS; i++) {
+                ics[i] = cos_sinv_alloc(&booter_info, cc, (vaddr_t)__inv_test_serverfn, 0xdead);
+                if (EXPECT_LL_LT(1, ics[i], "Invocation: Cannot Allocate")) return;
+        }
+        perfdata_init(&result, "SINV_UNCACHED", test_results, ARRAY_SIZE);
+	perfcntr_init();
 
         for (i = 0; i < ITER; i++) {
+                ic = ics[i % INV_UNCACHED_NCAPS];
                 start_cycles = ps_tsc();
                 call_cap_mb(ic, 1, 2, 3);
                 end_cycles = ps_tsc();
@@ -106,7 +162,39 @@ test_inv(void)
         }
 
         perfdata_calc(&result);
-	results_save(&result_sinv, &result);
+	results_save(&result_sinv_uncached, &result);
+
+        /*
+         * A server in another MPK protection domain of our
+         * page-table: only the PKRU is written, on the call and the
+         * return (without MPK, this is the same as above).
+         */
+        cc = cos_comp_alloc(&booter_info, booter_info.captbl_cap, booter_info.pgtbl_cap, (vaddr_t)NULL, PROTDOM_INIT(0, 1));
+        if (EXPECT_LL_LT(1, cc, "Invocation: Cannot Allocate")) return;
+        ic = cos_sinv_alloc(&booter_info, cc, (vaddr_t)__inv_test_serverfn, 0xdead);
+        if (EXPECT_LL_LT(1, ic, "Invocation: Cannot Allocate")) return;
+        r = call_cap_mb(ic, 1, 2, 3);
+        if (EXPECT_LLU_NEQ(0xDEADBEEF, r, "Test Invocation (MPK)")) return;
+        inv_bench(ic, "SINV_MPK", &result_sinv_mpk);
+
+        /*
+         * Baseline for the invocation fast path: a null trap that
+         * takes the out-of-line capability operation path
+         * (CAP_HW cycles-per-usec read) through the same entry.
+         */
+        perfdata_init(&result, "SLOWPATH", test_results, ARRAY_SIZE);
+	perfcntr_init();
+
+        for (i = 0; i < ITER; i++) {
+                start_cycles = ps_tsc();
+                cos_hw_cycles_per_usec(BOOT_CAPTBL_SELF_INITHW_BASE);
+                end_cycles = ps_tsc();
+
+                perfdata_add(&result, end_cycles - start_cycles);
+        }
+
+        perfdata_calc(&result);
+	results_save(&result_slowpath, &result);
 
         CHECK_STATUS_FLAG();
         PRINTC("\t%s: \t\tSuccess\n", "Synchronous Invocations");
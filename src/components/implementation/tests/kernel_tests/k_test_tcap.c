@@ -11,6 +11,7 @@
 
 struct results result_test_timer;
 struct results result_budgets_single;
+struct results result_tcap_deleg, result_tcap_deleg_uncached, result_tcap_deleg_bulk;
 static struct perfdata result;
 
 #define ARRAY_SIZE 10000
@@ -47,8 +48,11 @@ test_timer(void)
         cycles_t    cycles, now, utime;
         long long   time, mask;
         tcap_time_t timer, thd_timeout;
+        unsigned long programmed, skipped;
 
         tc = cos_thd_alloc(&booter_info, booter_info.comp_cap, spinner, NULL);
+        programmed = cos_introspect(&booter_info, BOOT_CAPTBL_SELF_INITTCAP_CPU_BASE, TCAP_GET_TIMER_PROGRAMMED);
+        skipped    = cos_introspect(&booter_info, BOOT_CAPTBL_SELF_INITTCAP_CPU_BASE, TCAP_GET_TIMER_SKIPPED);
 
         perfdata_init(&result, "COS THD => COS_THD_SWITCH", test_results, ARRAY_SIZE);
 
@@ -79,6 +83,14 @@ test_timer(void)
         perfdata_calc(&result);
         results_save(&result_test_timer, &result);	
 
+        /* Each of the distinct timeouts has to be programmed */
+        programmed = cos_introspect(&booter_info, BOOT_CAPTBL_SELF_INITTCAP_CPU_BASE, TCAP_GET_TIMER_PROGRAMMED) - programmed;
+        skipped    = cos_introspect(&booter_info, BOOT_CAPTBL_SELF_INITTCAP_CPU_BASE, TCAP_GET_TIMER_SKIPPED) - skipped;
+        if (EXPECT_LLU_LT((long long unsigned)TEST_ITER, (long long unsigned)programmed, "Timer: Reprogram Count")) {
+                return;
+        }
+        PRINTC("	Timer reprograms: %lu, coalesced: %lu\n", programmed, skipped);
+
         /* Timer in past */
         c = 0, p = 0;
 
@@ -369,6 +381,84 @@ test_tcap_budgets_multi(void)
         PRINTC("\t%s: \t\tSuccess\n", "Timer => Hierarchical Budget");
 }
 
+#define DELEG_NCHILD 8
+
+static struct exec_cluster         dbt[NUM_CPU][DELEG_NCHILD];
+static struct cos_tcap_deleg_batch deleg_batch[NUM_CPU];
+
+/*
+ * A parent scheduler repeatedly replenishing its children: the same
+ * delegation (hitting the kernel's delegation cache), one that
+ * changes priority each time (so the delegations are re-merged), and
+ * a bulk replenish of all of the children (per child).
+ */
+static void
+test_tcap_delegate(void)
+{
+        struct exec_cluster         *c = dbt[cos_cpuid()];
+        struct cos_tcap_deleg_batch *b = &deleg_batch[cos_cpuid()];
+        unsigned long                budget;
+        cycles_t                     s, e;
+        int                          i, j, ret;
+
+        for (i = 0; i < DELEG_NCHILD; i++) {
+                if (EXPECT_LL_NEQ(0, exec_cluster_alloc(&c[i], spinner, &c[i], BOOT_CAPTBL_SELF_INITRCV_CPU_BASE),
+                                  "TCAP Delegate: Cannot Allocate")) {
+                        return;
+                }
+        }
+
+        perfdata_init(&result, "TCAP => Delegate", test_results, ARRAY_SIZE);
+        for (i = 0; i < ITER; i++) {
+                rdtscll(s);
+                ret = cos_tcap_transfer(c[0].rc, BOOT_CAPTBL_SELF_INITTCAP_CPU_BASE, GRANULARITY, TCAP_PRIO_MAX + 2);
+                rdtscll(e);
+                if (EXPECT_LL_NEQ(0, ret, "TCAP Delegate: TCAP Transfer")) return;
+                perfdata_add(&result, e - s);
+        }
+        perfdata_calc(&result);
+        results_save(&result_tcap_deleg, &result);
+
+        perfdata_init(&result, "TCAP => Delegate (uncached)", test_results, ARRAY_SIZE);
+        for (i = 0; i < ITER; i++) {
+                rdtscll(s);
+                ret = cos_tcap_transfer(c[1].rc, BOOT_CAPTBL_SELF_INITTCAP_CPU_BASE, GRANULARITY,
+                                        TCAP_PRIO_MAX + 2 + (i & 1));
+                rdtscll(e);
+                if (EXPECT_LL_NEQ(0, ret, "TCAP Delegate: TCAP Transfer")) return;
+                perfdata_add(&result, e - s);
+        }
+        perfdata_calc(&result);
+        results_save(&result_tcap_deleg_uncached, &result);
+
+        budget = cos_introspect(&booter_info, c[DELEG_NCHILD - 1].tcc, TCAP_GET_BUDGET);
+        perfdata_init(&result, "TCAP => Bulk delegate", test_results, ARRAY_SIZE);
+        for (i = 0; i < ITER; i++) {
+                for (j = 0; j < DELEG_NCHILD; j++) {
+                        b->ds[j] = (struct cos_tcap_deleg) {
+                                .rcv  = c[j].rc,
+                                .res  = GRANULARITY,
+                                .prio = TCAP_PRIO_MAX + 2,
+                        };
+                }
+                rdtscll(s);
+                ret = cos_tcap_delegate_bulk(BOOT_CAPTBL_SELF_INITTCAP_CPU_BASE, b, DELEG_NCHILD);
+                rdtscll(e);
+                if (EXPECT_LL_NEQ(DELEG_NCHILD, ret, "TCAP Delegate: Bulk")) return;
+                perfdata_add(&result, (e - s) / DELEG_NCHILD);
+        }
+        perfdata_calc(&result);
+        results_save(&result_tcap_deleg_bulk, &result);
+
+        budget = cos_introspect(&booter_info, c[DELEG_NCHILD - 1].tcc, TCAP_GET_BUDGET) - budget;
+        if (EXPECT_LLU_NEQ((long long unsigned)ITER * GRANULARITY, (long long unsigned)budget,
+                           "TCAP Delegate: Bulk Budget")) {
+                return;
+        }
+
+        PRINTC("\t%s: \t\tSuccess\n", "TCAP => Delegation");
+}
+
 void
 test_tcap_budgets(void)
 {
@@ -377,4 +467,7 @@ test_tcap_budgets(void)
 
         /* multi-level budgets test */
         test_tcap_budgets_multi();
+
+        /* delegation fast path and bulk replenish */
+        test_tcap_delegate();
 }
@@ -0,0 +1,46 @@
+/*
+ * Test maps this core's kernel trace ring, traces a synchronous
+ * invocation, and checks that its sinv and sret are recorded, and
+ * that nothing is recorded once tracing is disabled.
+ */
+
+#include "kernel_tests.h"
+#include <ktrace.h>
+
+extern void *__inv_test_serverfn(int a, int b, int c);
+
+static struct ktrace        trace;
+static struct cos_trace_evt trace_evts[16];
+
+void
+test_trace(void)
+{
+        compcap_t cc;
+        sinvcap_t ic;
+        hwcap_t   hwc = BOOT_CAPTBL_SELF_INITHW_BASE;
+        int       n, i, sinv = 0, sret = 0;
+
+        if (EXPECT_LL_NEQ(0, ktrace_init(&trace, &booter_info, hwc, cos_cpuid()), "Trace: Cannot Map Ring")) return;
+        cc = cos_comp_alloc(&booter_info, booter_info.captbl_cap, booter_info.pgtbl_cap, (vaddr_t)NULL, 0);
+        if (EXPECT_LL_LT(1, cc, "Trace: Cannot Allocate")) return;
+        ic = cos_sinv_alloc(&booter_info, cc, (vaddr_t)__inv_test_serverfn, 0xbeef);
+        if (EXPECT_LL_LT(1, ic, "Trace: Cannot Allocate")) return;
+
+        cos_hw_trace_mask(hwc, COS_TRACE_MASK(COS_TRACE_SINV) | COS_TRACE_MASK(COS_TRACE_SRET));
+        call_cap_mb(ic, 1, 2, 3);
+        cos_hw_trace_mask(hwc, 0);
+
+        n = ktrace_drain(&trace, trace_evts, 16);
+        for (i = 0; i < n; i++) {
+                if (trace_evts[i].type == COS_TRACE_SINV && trace_evts[i].arg == 0xbeef) sinv++;
+                if (trace_evts[i].type == COS_TRACE_SRET) sret++;
+        }
+        if (EXPECT_LL_NEQ(1, sinv, "Trace: Sinv Event") || EXPECT_LL_LT(1, sret, "Trace: Sret Event")) return;
+
+        /* disabled: no new events */
+        call_cap_mb(ic, 1, 2, 3);
+        n = ktrace_drain(&trace, trace_evts, 16);
+        if (EXPECT_LL_NEQ(0, n, "Trace: Disabled") || EXPECT_LL_NEQ(0, trace.lost, "Trace: Lost Events")) return;
+
+        PRINTC("\t%s: \t\tSuccess\n", "Kernel Event Trace");
+}
@@ -45,6 +45,8 @@ test_run_unit_kernel(void)
         test_async_endpoints();
         test_inv();
         test_captbl_expands();
+        test_captbl_batch();
+        test_trace();
 }
 
 int
@@ -147,5 +147,10 @@ extern void test_mem_alloc(void);
 extern void test_async_endpoints(void);
 extern void test_inv(void);
 extern void test_captbl_expands(void);
+extern void test_captbl_batch(void);
+extern void test_trace(void);
+
+/* a synchronous invocation through cap_no */
+extern int call_cap_mb(u32_t cap_no, int arg1, int arg2, int arg3);
 
 #endif /* KERNEL_TESTS_H */
@@ -1,11 +1,72 @@
 #include <llprint.h>
 #include <cos_mc_adapter.h>
 #include <cos_memcached.h>
+#include <cos_time.h>
+#include <string.h>
+#include <stdio.h>
+
+/*
+ * The cycles of GETs of values of each size, whose replies are
+ * scattered across reply buffers the size of the shmem ones (see
+ * cos_mc_process_command_v), as for TCP connections.
+ */
+#define BENCH_ITER    10000
+#define BENCH_BUF_SZ  1792
+#define BENCH_NBUFS   64
+#define BENCH_REQ_SZ  16384
+
+static const int bench_sizes[] = { 64, 1024, 4096, 8192 };
+
+static char bench_bufs[BENCH_NBUFS][BENCH_BUF_SZ];
+static char bench_req[BENCH_REQ_SZ];
+static unsigned long bench_nbufs;
+
+static int
+bench_next(struct cos_mc_wbuf *w)
+{
+	bench_nbufs++;
+	w->buf = bench_bufs[bench_nbufs % BENCH_NBUFS];
+	w->len = 0;
+
+	return 0;
+}
+
+static u16_t
+bench_request(int fd, u16_t len)
+{
+	struct cos_mc_wbuf w = { .buf = bench_bufs[0], .sz = BENCH_BUF_SZ, .next = bench_next };
+
+	return cos_mc_process_command_v(fd, bench_req, len, &w);
+}
+
+static void
+bench_get(int fd, int vlen)
+{
+	cycles_t start, end;
+	int      len, i;
+
+	/* The frame header of a single datagram, and the value */
+	memcpy(bench_req, "\0\0\0\0\0\1\0\0", 8);
+	len  = 8 + sprintf(bench_req + 8, "set bench 0 0 %d\r\n", vlen);
+	memset(bench_req + len, 'v', vlen);
+	len += vlen;
+	len += sprintf(bench_req + len, "\r\n");
+	bench_request(fd, len);
+
+	len = 8 + sprintf(bench_req + 8, "get bench\r\n");
+	bench_nbufs = 0;
+	start = time_now();
+	for (i = 0; i < BENCH_ITER; i++) bench_request(fd, len);
+	end = time_now();
+
+	printc("get %d bytes: %llu cycles, %lu buffers\n", vlen, (end - start) / BENCH_ITER,
+	       (bench_nbufs + BENCH_ITER) / BENCH_ITER);
+}
 
 void
 cos_init(void)
 {
-	int argc, ret;
+	int argc, ret, fd, i;
 
 	printc("lib memcached init...\n");
 
@@ -25,7 +86,9 @@ cos_init(void)
 	ret = cos_mc_init(argc, argv);
 	printc("cos_mc_init done, ret: %d\n", ret);
 
-	mc_test();
+	fd = mc_test();
+
+	for (i = 0; i < (int)ARRAY_SIZE(bench_sizes); i++) bench_get(fd, bench_sizes[i]);
 }
 
 int
@@ -40,11 +40,20 @@ cos_init(void)
         assert(termthd[cos_cpuid()]);
         if (cos_cpuid() == 0) PRINTC("Micro Booter Xcore started.\n");
 
+        // Parallel thread creation
+        test_thd_create();
+
+        // TLB shootdown Test
+        test_tlb_shootdown();
+
         // Ipi Test
         test_ipi_switch();
         test_ipi_interference();
         test_ipi_roundtrip();
 
+        // Ipi N to 1
+        test_ipi_fanin();
+
         // Ipi N to N
         //test_ipi_full();
 
@@ -41,5 +41,8 @@ extern void test_ipi_n_n(void);
 extern void test_ipi_interference(void);
 extern void test_ipi_switch(void);
 extern void test_ipi_roundtrip(void);
+extern void test_ipi_fanin(void);
+extern void test_tlb_shootdown(void);
+extern void test_thd_create(void);
 
 #endif /* MICRO_XCORES_H */
@@ -0,0 +1,152 @@
+#include <stdint.h>
+
+#include "micro_xcores.h"
+
+extern void sched_events_clear(int* rcvd, thdid_t* tid, int* blocked, cycles_t* cycles, tcap_time_t* thd_timeout);
+
+/*
+ * Test asnd fan-in: every other core sends to a single receiving
+ * thread on TEST_RCV_CORE.  Measures the send cost on each sender,
+ * and the receiving core's cost per event it processes.
+ */
+
+#define TEST_FANIN_ITERS 1000
+
+static volatile arcvcap_t rcv = 0;
+static volatile thdcap_t  thd = 0;
+static volatile thdid_t   tid = 0;
+static volatile int       blkd = 0;
+
+static volatile unsigned long long total_rcvd = 0;
+static volatile unsigned long long total_sent[NUM_CPU] = { 0 };
+static volatile unsigned long long total_busy[NUM_CPU] = { 0 };
+
+static volatile int       ready[NUM_CPU] = { 0 };
+static volatile int       senders_done = 0;
+static volatile cycles_t  start_time = 0;
+
+static struct             perfdata pd[NUM_CPU] CACHE_ALIGNED;
+
+#define ARRAY_SIZE 10000
+static cycles_t           results[NUM_CPU][ARRAY_SIZE];
+
+static void
+test_rcv_fn(void *d)
+{
+        while (1) {
+                int rcvd = 0;
+
+                cos_rcv(rcv, RCV_ALL_PENDING, &rcvd);
+                total_rcvd += rcvd;
+        }
+}
+
+static void
+test_sched_loop(void)
+{
+        int         blocked, rcvd, pending, ret;
+        cycles_t    cycles, end;
+        tcap_time_t thd_timeout;
+        thdid_t     thdid;
+        unsigned long long sent = 0;
+        int         i;
+
+        sched_events_clear(&rcvd, &thdid, &blocked, &cycles, &thd_timeout);
+
+        while (1) {
+                while ((pending = cos_sched_rcv(BOOT_CAPTBL_SELF_INITRCV_CPU_BASE, RCV_ALL_PENDING | RCV_NON_BLOCKING, 0,
+                                                &rcvd, &thdid, &blocked, &cycles, &thd_timeout)) >= 0) {
+                        if (!thdid) goto done;
+                        assert(thdid == tid);
+                        blkd = blocked;
+done:
+                        if (!pending) break;
+                }
+
+                if (blkd && senders_done == NUM_CPU - 1) break;
+                if (blkd) continue;
+
+                do {
+                        ret = cos_switch(thd, BOOT_CAPTBL_SELF_INITTCAP_CPU_BASE, 0, 0, 0, 0);
+                } while (ret == -EAGAIN);
+        }
+        rdtscll(end);
+
+        for (i = 0; i < NUM_CPU; i++) sent += total_sent[i];
+        PRINTC("Test IPI Fan-in (%d senders):\t RCVD:%llu, SENT:%llu, RCV CORE CYCLES/EVENT:%llu\n",
+               NUM_CPU - 1, total_rcvd, sent, total_rcvd ? (end - start_time) / total_rcvd : 0);
+}
+
+static void
+test_asnd_loop(void)
+{
+        asndcap_t s;
+        cycles_t  st, en;
+        int       i, ret;
+
+        perfdata_init(&pd[cos_cpuid()], "Test IPI Fan-in: SEND TIME", results[cos_cpuid()], ARRAY_SIZE);
+
+        while (!rcv) ;
+        s = cos_asnd_alloc(&booter_info, rcv, booter_info.captbl_cap);
+        if (EXPECT_LL_LT(1, s, "IPI FANIN: ASND Allocation")) {
+                cos_faa((int *)&senders_done, 1);
+                return;
+        }
+
+        /* start all of the senders together */
+        ready[cos_cpuid()] = 1;
+        for (i = 0; i < NUM_CPU; i++) {
+                while (i != TEST_RCV_CORE && !ready[i]) ;
+        }
+        if (cos_cpuid() == TEST_SND_CORE) rdtscll(start_time);
+
+        for (i = 0; i < TEST_FANIN_ITERS; i++) {
+                rdtscll(st);
+                ret = cos_asnd(s, 0);
+                rdtscll(en);
+                assert(ret == 0 || ret == -EBUSY);
+
+                if (ret) {
+                        total_busy[cos_cpuid()]++;
+                        continue;
+                }
+                total_sent[cos_cpuid()]++;
+                perfdata_add(&pd[cos_cpuid()], en - st);
+        }
+
+        perfdata_calc(&pd[cos_cpuid()]);
+        PRINTC("Test IPI Fan-in Send:\t\t SEND TIME AVG:%llu, MAX:%llu, MIN:%llu, ITER:%d, BUSY:%llu\n",
+               perfdata_avg(&pd[cos_cpuid()]), perfdata_max(&pd[cos_cpuid()]),
+               perfdata_min(&pd[cos_cpuid()]), perfdata_sz(&pd[cos_cpuid()]), total_busy[cos_cpuid()]);
+
+        cos_faa((int *)&senders_done, 1);
+}
+
+void
+test_ipi_fanin(void)
+{
+        arcvcap_t r;
+        thdcap_t  t;
+        tcap_t    tcc;
+
+        if (NUM_CPU == 1) return;
+
+        if (cos_cpuid() != TEST_RCV_CORE) {
+                test_asnd_loop();
+                return;
+        }
+
+        tcc = cos_tcap_alloc(&booter_info);
+        if (EXPECT_LL_LT(1, tcc, "IPI FANIN: TCAP Allocation")) return;
+        t = cos_thd_alloc(&booter_info, booter_info.comp_cap, test_rcv_fn, NULL);
+        if (EXPECT_LL_LT(1, t, "IPI FANIN: Thread Allocation")) return;
+        r = cos_arcv_alloc(&booter_info, t, tcc, booter_info.comp_cap, BOOT_CAPTBL_SELF_INITRCV_CPU_BASE);
+        if (EXPECT_LL_LT(1, r, "IPI FANIN: ARCV Allocation")) return;
+        cos_tcap_transfer(r, BOOT_CAPTBL_SELF_INITTCAP_CPU_BASE, TCAP_RES_INF, TCAP_PRIO_MAX);
+
+        thd = t;
+        tid = cos_introspect(&booter_info, t, THD_GET_TID);
+        rcv = r;
+
+        test_sched_loop();
+}
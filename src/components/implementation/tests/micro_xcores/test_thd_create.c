@@ -0,0 +1,80 @@
+#include <stdint.h>
+
+#include "micro_xcores.h"
+
+/*
+ * Test parallel thread creation: every core allocates threads at the
+ * same time.  Measures the creation cost on each core, and checks
+ * that the per-core thread id allocation never hands out an id twice.
+ */
+
+#define TEST_CREATE_NTHDS 8
+
+static volatile int       ready[NUM_CPU] = { 0 };
+static volatile int       done[NUM_CPU] = { 0 };
+static thdid_t            tids[NUM_CPU][TEST_CREATE_NTHDS];
+
+static struct             perfdata pd[NUM_CPU] CACHE_ALIGNED;
+static cycles_t           results[NUM_CPU][TEST_CREATE_NTHDS];
+
+static void
+test_thd_fn(void *d)
+{
+        SPIN();
+}
+
+static int
+test_tids_unique(void)
+{
+        int i, j, k, l;
+
+        for (i = 0; i < NUM_CPU; i++) {
+                for (j = 0; j < TEST_CREATE_NTHDS; j++) {
+                        for (k = i; k < NUM_CPU; k++) {
+                                for (l = (k == i ? j + 1 : 0); l < TEST_CREATE_NTHDS; l++) {
+                                        if (tids[i][j] == tids[k][l]) return 0;
+                                }
+                        }
+                }
+        }
+
+        return 1;
+}
+
+void
+test_thd_create(void)
+{
+        thdcap_t t;
+        cycles_t st, en;
+        int      i, cpu = cos_cpuid();
+
+        perfdata_init(&pd[cpu], "Test Parallel Thread Creation", results[cpu], TEST_CREATE_NTHDS);
+
+        /* start all of the cores together */
+        ready[cpu] = 1;
+        for (i = 0; i < NUM_CPU; i++) {
+                while (!ready[i]) ;
+        }
+
+        for (i = 0; i < TEST_CREATE_NTHDS; i++) {
+                rdtscll(st);
+                t = cos_thd_alloc(&booter_info, booter_info.comp_cap, test_thd_fn, NULL);
+                rdtscll(en);
+                if (EXPECT_LL_LT(1, t, "Parallel Thread Creation: Allocation")) break;
+
+                tids[cpu][i] = cos_introspect(&booter_info, t, THD_GET_TID);
+                perfdata_add(&pd[cpu], en - st);
+        }
+
+        perfdata_calc(&pd[cpu]);
+        PRINTC("Test Parallel Thread Creation:\t CREATE TIME AVG:%llu, MAX:%llu, MIN:%llu, ITER:%d\n",
+               perfdata_avg(&pd[cpu]), perfdata_max(&pd[cpu]), perfdata_min(&pd[cpu]), perfdata_sz(&pd[cpu]));
+
+        done[cpu] = 1;
+        if (cpu != TEST_RCV_CORE) return;
+        for (i = 0; i < NUM_CPU; i++) {
+                while (!done[i]) ;
+        }
+        if (EXPECT_LL_NEQ(1, test_tids_unique(), "Parallel Thread Creation: Unique Ids")) return;
+        PRINTC("Test Parallel Thread Creation:\t %d threads on %d cores, ids unique\n", TEST_CREATE_NTHDS * NUM_CPU, NUM_CPU);
+}
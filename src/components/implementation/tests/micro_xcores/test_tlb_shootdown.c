@@ -0,0 +1,93 @@
+#include <stdint.h>
+
+#include "micro_xcores.h"
+
+/*
+ * Test the cost of unmapping memory that is in the TLB of all cores:
+ * the unmap itself, and the time until the unmapped address can be
+ * reused (i.e. until all cores have flushed their TLBs).  Run on
+ * builds with different NUM_CPU to see the scaling with core count.
+ */
+
+#define TEST_TLB_ITERS 1000
+
+static volatile vaddr_t   page  = 0;
+static volatile vaddr_t   alias = 0;
+static volatile int       done_test = 0;
+static volatile int       ready[NUM_CPU] = { 0 };
+
+static struct             perfdata pd[2];
+
+#define ARRAY_SIZE 10000
+static cycles_t           results[2][ARRAY_SIZE];
+
+static void
+test_tlb_toucher(void)
+{
+        while (!alias && !done_test) ;
+        ready[cos_cpuid()] = 1;
+
+        /* Stay busy in this address space; the shootdown must interrupt us */
+        while (!done_test) (void)*(volatile int *)page;
+}
+
+static void
+test_tlb_unmapper(void)
+{
+        cycles_t start, mid, end;
+        int      i, ret;
+
+        perfdata_init(&pd[0], "Test Unmap", results[0], ARRAY_SIZE);
+        perfdata_init(&pd[1], "Test Unmap to Reuse", results[1], ARRAY_SIZE);
+
+        page = (vaddr_t)cos_page_bump_alloc(&booter_info);
+        if (EXPECT_LL_LT(1, page, "TLB Shootdown: Page Allocation")) goto done;
+        alias = cos_mem_alias(&booter_info, &booter_info, page, COS_PAGE_READABLE | COS_PAGE_WRITABLE);
+        if (EXPECT_LL_LT(1, alias, "TLB Shootdown: Alias")) goto done;
+
+        for (i = 1; i < NUM_CPU; i++) {
+                while (!ready[i]) ;
+        }
+
+        for (i = 0; i < TEST_TLB_ITERS; i++) {
+                *(volatile int *)alias = i;
+
+                rdtscll(start);
+                ret = cos_mem_remove(booter_info.pgtbl_cap, alias);
+                rdtscll(mid);
+                if (EXPECT_LL_NEQ(0, ret, "TLB Shootdown: Unmap")) break;
+
+                /* Reuse waits for the TLB quiescence of all cores */
+                do {
+                        ret = call_cap_op(booter_info.pgtbl_cap, CAPTBL_OP_CPY, page, booter_info.pgtbl_cap, alias,
+                                          COS_PAGE_READABLE | COS_PAGE_WRITABLE);
+                } while (ret == -EQUIESCENCE);
+                rdtscll(end);
+                if (EXPECT_LL_NEQ(0, ret, "TLB Shootdown: Reuse")) break;
+
+                perfdata_add(&pd[0], mid - start);
+                perfdata_add(&pd[1], end - start);
+        }
+
+        perfdata_calc(&pd[0]);
+        perfdata_calc(&pd[1]);
+
+        PRINTC("Test Unmap (%d cores):\t\t AVG:%llu, MAX:%llu, MIN:%llu, ITER:%d\n", NUM_CPU,
+                perfdata_avg(&pd[0]), perfdata_max(&pd[0]),
+                perfdata_min(&pd[0]), perfdata_sz(&pd[0]));
+        PRINTC("Test Unmap to Reuse (%d cores):\t AVG:%llu, MAX:%llu, MIN:%llu, ITER:%d\n", NUM_CPU,
+                perfdata_avg(&pd[1]), perfdata_max(&pd[1]),
+                perfdata_min(&pd[1]), perfdata_sz(&pd[1]));
+        printc("\t\t\t\t\t SD:%llu, 90%%:%llu, 95%%:%llu, 99%%:%llu\n",
+                perfdata_sd(&pd[1]),perfdata_90ptile(&pd[1]),
+                perfdata_95ptile(&pd[1]), perfdata_99ptile(&pd[1]));
+done:
+        done_test = 1;
+}
+
+void
+test_tlb_shootdown(void)
+{
+        if (cos_cpuid() == TEST_RCV_CORE) test_tlb_unmapper();
+        else                              test_tlb_toucher();
+}
@@ -385,11 +385,39 @@ interleave_test(unsigned int prio_base)
 	}
 }
 
+#define CS_BENCH_ITER 10000
+
+/*
+ * The cost of the uncontended critical section: a single CAS to
+ * enter, and a load and CAS to exit. The contention counters show
+ * how often the tests so far took the slowpaths.
+ */
+void
+cs_bench(void)
+{
+	struct slm_thd     *current = slm_thd_current();
+	struct slm_cs_stats s;
+	cycles_t            start, end;
+	int                 i;
+
+	start = slm_now();
+	for (i = 0; i < CS_BENCH_ITER; i++) {
+		slm_cs_enter(current, SLM_CS_NONE);
+		slm_cs_exit(NULL, SLM_CS_NONE);
+	}
+	end = slm_now();
+
+	slm_cs_stats(cos_cpuid(), &s);
+	printc("Critical section enter/exit: %llu cycles (contended enters %lu, exits %lu, retries %lu)\n",
+	       (end - start) / CS_BENCH_ITER, s.contended_enter, s.contended_exit, s.retries);
+}
+
 void
 done_fn(void *d)
 {
 	thd_block();
 	printc("SUCCESS for %ld / 3. Tests complete.\n", num_success);
+	cs_bench();
 	thd_block();
 }
 
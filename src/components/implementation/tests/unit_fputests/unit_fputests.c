@@ -0,0 +1,88 @@
+/*
+ * Per-switch cost of the (lazy) FPU state switching: switch back and
+ * forth between the initial thread and a second one, with neither,
+ * one, or both of them using the FPU between switches.
+ */
+
+#include <cos_component.h>
+#include <cos_kernel_api.h>
+#include <llprint.h>
+#include <ps.h>
+
+#define ITER 1024
+
+static struct cos_compinfo booter_info;
+static volatile int        helper_fp;
+static volatile double     fp_acc[2];
+
+static void
+fpu_touch(int which)
+{
+	fp_acc[which] = fp_acc[which] * 1.0001 + 1.0;
+}
+
+static void
+helper(void *d)
+{
+	while (1) {
+		if (helper_fp) fpu_touch(1);
+		cos_thd_switch(BOOT_CAPTBL_SELF_INITTHD_CPU_BASE);
+	}
+}
+
+static ps_tsc_t
+switch_bench(thdcap_t t, int main_fp, int h_fp)
+{
+	ps_tsc_t begin, end;
+	int      i;
+
+	helper_fp = h_fp;
+	/* warm up: let the fpu ownership settle */
+	if (main_fp) fpu_touch(0);
+	cos_thd_switch(t);
+
+	begin = ps_tsc();
+	for (i = 0; i < ITER; i++) {
+		if (main_fp) fpu_touch(0);
+		cos_thd_switch(t);
+	}
+	end = ps_tsc();
+
+	/* two switches per iteration */
+	return (end - begin) / (ITER * 2);
+}
+
+void
+cos_init(void)
+{
+	cos_meminfo_init(&booter_info.mi, BOOT_MEM_KM_BASE, COS_MEM_KERN_PA_SZ, BOOT_CAPTBL_SELF_UNTYPED_PT);
+	cos_compinfo_init(&booter_info, BOOT_CAPTBL_SELF_PT, BOOT_CAPTBL_SELF_CT, BOOT_CAPTBL_SELF_COMP,
+			  (vaddr_t)cos_get_heap_ptr(), BOOT_CAPTBL_FREE, &booter_info);
+}
+
+int
+main(void)
+{
+	thdcap_t int_thd, fp_thd;
+	ps_tsc_t none, one, both;
+
+	int_thd = cos_thd_alloc(&booter_info, booter_info.comp_cap, helper, NULL);
+	assert(int_thd);
+	fp_thd = cos_thd_alloc(&booter_info, booter_info.comp_cap, helper, NULL);
+	assert(fp_thd);
+
+	/* separate helpers, so that int_thd never uses, nor owns, the fpu */
+	none = switch_bench(int_thd, 0, 0);
+	one  = switch_bench(fp_thd, 0, 1);
+	both = switch_bench(fp_thd, 1, 1);
+
+	printc("FPU thread switch costs (cycles per switch):\n");
+	printc("\tno thread uses the FPU:       %llu\n", none);
+	printc("\tone thread uses the FPU:      %llu (fpu enable/disable: %lld)\n", one, (long long)(one - none));
+	printc("\tboth threads use the FPU:     %llu (lazy save/restore: %lld)\n", both, (long long)(both - one));
+	printc("SUCCESS: FPU switch benchmark\n");
+
+	while (1) ;
+
+	return 0;
+}
@@ -133,6 +133,8 @@ test_driver(int amnt, int type)
 #define ITER 10
 #define BOUND 4096
 
+void malloc_bench(void);
+
 int
 main(void)
 {
@@ -150,5 +152,7 @@ main(void)
 	}
 
 	printc("TEST PASSED\n");
+	malloc_bench();
+
 	return 0;
 }
@@ -0,0 +1,69 @@
+#include <llprint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <cos_time.h>
+
+/***
+ * The cycles of a malloc and free of objects of each size, freed
+ * right away (the common case of the allocators' caches), and in
+ * batches, freed in the order they were allocated. It measures the
+ * malloc linked in: the `arena` library, or musl's, if it is removed
+ * from the LIBRARY_DEPENDENCIES.
+ */
+
+#define MB_ITER  100000
+#define MB_BATCH 1024
+
+static const size_t mb_sizes[] = { 16, 64, 256, 1024, 4096, 16384 };
+
+static void *mb_objs[MB_BATCH];
+
+static cycles_t
+mb_pairs(size_t sz)
+{
+	cycles_t start, end;
+	void    *p;
+	int      i;
+
+	start = time_now();
+	for (i = 0; i < MB_ITER; i++) {
+		p = malloc(sz);
+		assert(p);
+		/* Keep the compiler from removing the pair */
+		*(volatile char *)p = 1;
+		free(p);
+	}
+	end = time_now();
+
+	return (end - start) / MB_ITER;
+}
+
+static cycles_t
+mb_batches(size_t sz)
+{
+	cycles_t start, end;
+	int      i, j, n = MB_ITER / MB_BATCH;
+
+	start = time_now();
+	for (i = 0; i < n; i++) {
+		for (j = 0; j < MB_BATCH; j++) {
+			mb_objs[j] = malloc(sz);
+			assert(mb_objs[j]);
+		}
+		for (j = 0; j < MB_BATCH; j++) free(mb_objs[j]);
+	}
+	end = time_now();
+
+	return (end - start) / (n * MB_BATCH);
+}
+
+void
+malloc_bench(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < sizeof(mb_sizes) / sizeof(mb_sizes[0]); i++) {
+		printc("malloc/free, %lu bytes: %llu cycles, %llu cycles in batches of %d\n", (unsigned long)mb_sizes[i],
+		       mb_pairs(mb_sizes[i]), mb_batches(mb_sizes[i]), MB_BATCH);
+	}
+}
@@ -1,5 +1,6 @@
 #include <cos_types.h>
 #include <memmgr.h>
+#include <ps.h>
 
 
 static void
@@ -43,10 +44,116 @@ test_aligned_allocation_continuity()
 
 }
 
+static void
+test_node_allocation()
+{
+	char *local, *node0;
+	int   i;
+
+	local = (char *)memmgr_heap_page_allocn_node(2, COS_NUMA_NODE_LOCAL);
+	node0 = (char *)memmgr_heap_page_allocn_node(2, 0);
+	if (!local || !node0 || memmgr_heap_page_allocn_node(1, NUMA_NODES_MAX)) {
+		printc("FAILURE: NUMA node memory allocation\n");
+		return;
+	}
+	for (i = 0; i < 2 * PAGE_SIZE; i++) local[i] = node0[i] = '\1';
+
+	printc("SUCCESS: NUMA node memory allocation\n");
+}
+
+static void
+test_release(void)
+{
+	char   *a, *b;
+	vaddr_t end;
+	int     i;
+
+	a = (char *)memmgr_heap_page_allocn(4);
+	if (!a) goto fail;
+	for (i = 0; i < 4 * PAGE_SIZE; i++) a[i] = '\1';
+
+	/* The frames released are reused by our next allocation, zeroed */
+	if (memmgr_heap_page_release((vaddr_t)a + 2 * PAGE_SIZE, 2)) goto fail;
+	if (memmgr_heap_page_release((vaddr_t)a + 2 * PAGE_SIZE, 1) != -EINVAL) goto fail;
+	b = (char *)memmgr_heap_page_allocn(2);
+	if (!b) goto fail;
+	for (i = 0; i < 2 * PAGE_SIZE; i++) {
+		if (b[i]) goto fail;
+	}
+
+	/* The end of the heap grows in place */
+	end = (vaddr_t)b + 2 * PAGE_SIZE;
+	if (memmgr_heap_page_allocn_at(end, 1) != end) goto fail;
+	((char *)end)[0] = '\1';
+	if (memmgr_heap_page_release((vaddr_t)a, 2) || memmgr_heap_page_release((vaddr_t)b, 3)) goto fail;
+
+	printc("SUCCESS: Heap memory release and reuse\n");
+	return;
+fail:
+	printc("FAILURE: Heap memory release and reuse\n");
+}
+
+/*
+ * The TLB-miss benchmark touches one word in each page of a region
+ * larger than the reach of the 4K TLB entries, in an order that
+ * defeats the prefetchers, first with 4K mappings, then with
+ * superpage mappings.
+ */
+#define TLB_BENCH_NSUPER 8
+#define TLB_BENCH_SZ     (TLB_BENCH_NSUPER * SUPER_PAGE_SIZE)
+#define TLB_BENCH_NPAGES (TLB_BENCH_SZ / PAGE_SIZE)
+#define TLB_BENCH_STRIDE 1021 /* prime, so the walk visits every page */
+#define TLB_BENCH_ITER   16
+
+static cycles_t
+tlb_bench_touch(volatile char *mem)
+{
+	cycles_t      start, end;
+	unsigned long i, j, pg = 0;
+
+	/* warm up the page tables and caches */
+	for (i = 0; i < TLB_BENCH_NPAGES; i++) mem[i * PAGE_SIZE] = 1;
+
+	start = ps_tsc();
+	for (j = 0; j < TLB_BENCH_ITER; j++) {
+		for (i = 0; i < TLB_BENCH_NPAGES; i++) {
+			mem[pg * PAGE_SIZE]++;
+			pg = (pg + TLB_BENCH_STRIDE) % TLB_BENCH_NPAGES;
+		}
+	}
+	end = ps_tsc();
+
+	return (end - start) / (TLB_BENCH_ITER * TLB_BENCH_NPAGES);
+}
+
+static void
+test_superpage_tlb_bench()
+{
+	char    *pages, *superpages;
+	cycles_t c_pages, c_superpages;
+
+	pages      = (char *)memmgr_heap_page_allocn(TLB_BENCH_NPAGES);
+	superpages = (char *)memmgr_heap_superpage_allocn(TLB_BENCH_NSUPER);
+	if (!pages || !superpages || (unsigned long)superpages % SUPER_PAGE_SIZE != 0) {
+		printc("FAILURE: Superpage allocation\n");
+		return;
+	}
+
+	c_pages      = tlb_bench_touch(pages);
+	c_superpages = tlb_bench_touch(superpages);
+
+	printc("SUCCESS: Superpage allocation\n");
+	printc("Page access over %lu MB: 4K pages %llu cycles, superpages %llu cycles\n",
+	       (unsigned long)(TLB_BENCH_SZ >> 20), c_pages, c_superpages);
+}
+
 int
 main(void)
 {
 	test_alignment();
 	test_aligned_allocation_continuity();
+	test_node_allocation();
+	test_release();
+	test_superpage_tlb_bench();
 	return 0;
 }
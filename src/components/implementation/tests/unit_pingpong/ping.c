@@ -4,8 +4,18 @@
 #include <ps.h>
 
 #define ITER 1024
+#define WS_PAGES 64
 
-volatile ps_tsc_t fast_path, all_args;
+volatile ps_tsc_t fast_path, all_args, ws_touch, ws_touch_inv;
+static char working_set[WS_PAGES * PAGE_SIZE];
+
+static void
+ws_touch_all(void)
+{
+	int i;
+
+	for (i = 0; i < WS_PAGES; i++) ((volatile char *)working_set)[i * PAGE_SIZE]++;
+}
 
 void
 cos_init(void)
@@ -62,6 +72,28 @@ cos_init(void)
 	end = ps_tsc();
 	all_args = (end - begin)/ITER;
 
+	/*
+	 * TLB retention across invocations: touching the working set
+	 * after a round-trip only costs more than touching it
+	 * back-to-back if the page-table switches flushed our TLB
+	 * entries (i.e. without PCID-tagged page-tables).
+	 */
+	ws_touch_all();
+	begin = ps_tsc();
+	for (i = 0; i < ITER; i++) {
+		ws_touch_all();
+	}
+	end = ps_tsc();
+	ws_touch = (end - begin)/ITER;
+
+	begin = ps_tsc();
+	for (i = 0; i < ITER; i++) {
+		pong_call();
+		ws_touch_all();
+	}
+	end = ps_tsc();
+	ws_touch_inv = (end - begin)/ITER - fast_path;
+
 	return;
 }
 
@@ -71,6 +103,7 @@ main(void)
 	printc("Ping component %ld: main execution\n", cos_compid());
 	printc("Fast-path invocation: %llu cycles\n", fast_path);
 	printc("Three return value invocation: %llu cycles\n", all_args);
+	printc("%d-page working set touch: %llu cycles, after an invocation: %llu cycles\n", WS_PAGES, ws_touch, ws_touch_inv);
 
 	return 0;
 }
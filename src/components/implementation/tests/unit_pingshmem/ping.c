@@ -240,6 +240,53 @@ done:
 	printc("%s: Reference counts prevent freeing object in-use\n", (failure) ? "FAILURE" : "SUCCESS");
 }
 
+#define PING_BATCH 32
+
+void
+ping_test_batch(void)
+{
+	struct obj_test *objs[PING_BATCH], *taken[PING_BATCH + 1], *obj;
+	shm_bm_objid_t   objids[PING_BATCH + 1];
+	int              i, failure = 0;
+
+	/* reset memory for test */
+	shm_bm_init_testobj(shm);
+
+	for (i = 0; i < PING_BATCH; i++) objs[i] = shm_bm_alloc_testobj(shm, &objids[i]);
+	/* an invalid id is skipped */
+	objids[PING_BATCH] = ~0U;
+
+	/* a second reference to each object, as a pong would take them */
+	if (shm_bm_take_n_testobj(shm, objids, (void **)taken, PING_BATCH + 1) != PING_BATCH) failure = 1;
+	for (i = 0; i < PING_BATCH; i++) {
+		if (taken[i] != objs[i] || shm_bm_refcnt_testobj(shm, objids[i]) != 2) failure = 1;
+	}
+	if (taken[PING_BATCH] != NULL) failure = 1;
+	if (failure) goto done;
+
+	/* dropping the references taken keeps the objects allocated */
+	shm_bm_free_n_testobj((void **)taken, PING_BATCH + 1);
+	for (i = 0; i < PING_BATCH; i++) {
+		if (shm_bm_refcnt_testobj(shm, objids[i]) != 1) failure = 1;
+	}
+	/* a transfer doesn't take a reference */
+	if (shm_bm_transfer_n_testobj(shm, objids, (void **)taken, PING_BATCH) != PING_BATCH) failure = 1;
+	if (shm_bm_refcnt_testobj(shm, objids[0]) != 1) failure = 1;
+
+	/* the last references free them, and they are allocated again */
+	shm_bm_free_n_testobj((void **)objs, PING_BATCH);
+	for (i = 0; i < PING_BATCH; i++) {
+		if (shm_bm_refcnt_testobj(shm, objids[i]) != 0) failure = 1;
+	}
+	for (i = 0; i < PING_BATCH; i++) {
+		obj = shm_bm_alloc_testobj(shm, &objids[i]);
+		if (!obj) failure = 1;
+	}
+
+done:
+	printc("%s: Ping can take, transfer and free objects in batches\n", (failure) ? "FAILURE" : "SUCCESS");
+}
+
 void
 ping_bench_syncinv(void)
 {
@@ -279,6 +326,54 @@ ping_bench_msgpassing(void)
 	printc("BENCHMARK Message passing: %llu cycles\n", bench);
 }
 
+SHM_BM_INTERFACE_CREATE(testobj_s, 64, 64);
+SHM_BM_INTERFACE_CREATE(testobj_m, 2048, 64);
+SHM_BM_INTERFACE_CREATE(testobj_l, 9216, 16);
+#define TESTOBJ_CLASSES(X, n) X(n, 0, testobj_s) X(n, 1, testobj_m) X(n, 2, testobj_l)
+SHM_BM_MC_INTERFACE_CREATE(testobj_mc, TESTOBJ_CLASSES)
+
+void
+ping_test_mc(void)
+{
+	shm_bm_t       mc;
+	shm_bm_objid_t objid, ids[3];
+	size_t         szs[3] = { 60, 1500, 9000 };
+	void          *mem, *obj[3];
+	size_t         shmsz;
+	int            i, failure = 0;
+
+	shmsz = round_up_to_page(shm_bm_size_testobj_mc());
+	memmgr_shared_page_allocn_aligned(shmsz / PAGE_SIZE, SHM_BM_ALIGN, (vaddr_t *)&mem);
+	mc = shm_bm_create_testobj_mc(mem, shmsz);
+	if (!mc) {
+		printc("FAILURE: could not create multi-class shm from allocated memory\n");
+		return;
+	}
+	shm_bm_init_testobj_mc(mc);
+
+	/* Each size gets its class, and the ids and pointers translate both ways */
+	for (i = 0; i < 3; i++) {
+		obj[i] = shm_bm_alloc_testobj_mc(mc, szs[i], &ids[i]);
+		if (!obj[i] || SHM_BM_MC_CLS(ids[i]) != (unsigned int)i || shm_bm_objsz_testobj_mc(ids[i]) < szs[i]) failure = 1;
+		if (shm_bm_borrow_testobj_mc(mc, ids[i]) != obj[i] || shm_bm_get_objid_testobj_mc(obj[i]) != ids[i]) failure = 1;
+		if (!failure) memset(obj[i], i, szs[i]);
+	}
+	if (shm_bm_alloc_testobj_mc(mc, 16384, &objid)) failure = 1;
+	for (i = 0; i < 3 && !failure; i++) {
+		shm_bm_free_testobj_mc(obj[i]);
+		if (shm_bm_refcnt_testobj_mc(mc, ids[i])) failure = 1;
+	}
+	printc("%s: Ping can allocate objects of each size class\n", (failure) ? "FAILURE" : "SUCCESS");
+
+	/* A full class spills into the next one */
+	failure = 0;
+	for (i = 0; i < 64; i++) {
+		if (!shm_bm_alloc_testobj_mc(mc, 64, &objid) || SHM_BM_MC_CLS(objid) != 0) failure = 1;
+	}
+	if (!shm_bm_alloc_testobj_mc(mc, 64, &objid) || SHM_BM_MC_CLS(objid) != 1) failure = 1;
+	printc("%s: Ping can allocate from the next class of a full class\n", (failure) ? "FAILURE" : "SUCCESS");
+}
+
 int
 main(void)
 {
@@ -301,6 +396,8 @@ main(void)
 	ping_test_objfree();
 	ping_test_bigfree();
 	ping_test_refcnt();
+	ping_test_batch();
+	ping_test_mc();
 
 	ping_bench_syncinv();
 	ping_bench_msgpassing();
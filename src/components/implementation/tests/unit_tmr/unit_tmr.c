@@ -25,7 +25,7 @@ main(void)
 	evt_res_id_t evt_id;
 	
 	printc("Call into timer manager to make a timer.\n");
-	assert(tmr_init(&t, TMR_PERIODIC_TIME, TMR_PERIODIC) == 0);
+	assert(tmr_init(&t, TMR_PERIODIC_TIME, 0, TMR_PERIODIC) == 0);
 
 	printc("Call into event manager to make a event.\n");
 	assert(evt_init(&e, 2) == 0);
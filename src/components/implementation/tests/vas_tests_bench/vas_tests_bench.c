@@ -0,0 +1,51 @@
+#include <cos_kernel_api.h>
+#include <cos_types.h>
+#include <vas_test_call_a.h>
+#include <vas_test_call_b.h>
+#include <ps.h>
+
+#define ITER 1024
+
+/*
+ * Compare the cost of a user-level invocation (vas_test_call_a, whose
+ * server shares our address space and is called through the MPK
+ * callgate) with that of a kernel sinv (vas_test_call_b, whose server
+ * is in a separate address space).
+ */
+static ps_tsc_t
+bench(void (*fn)(void), ps_tsc_t *min)
+{
+	ps_tsc_t begin, end, tot = 0;
+	int i;
+
+	*min = ~0ULL;
+	for (i = 0; i < ITER; i++) {
+		begin = ps_tsc();
+		fn();
+		end = ps_tsc();
+
+		tot += end - begin;
+		if (end - begin < *min) *min = end - begin;
+	}
+
+	return tot / ITER;
+}
+
+int
+main(void)
+{
+	ps_tsc_t ulk, ulk_min, kern, kern_min;
+
+	printc("Benchmarking user-level vs. kernel synchronous invocations (component %ld)...\n", cos_compid());
+
+	/* warm up both paths */
+	vas_test_call_a();
+	vas_test_call_b();
+
+	ulk  = bench(vas_test_call_a, &ulk_min);
+	kern = bench(vas_test_call_b, &kern_min);
+
+	printc("User-level sinv (shared VAS):\tavg %llu, min %llu cycles\n", ulk, ulk_min);
+	printc("Kernel sinv (separate VAS):\tavg %llu, min %llu cycles\n", kern, kern_min);
+	printc("SUCCESS\n");
+}
@@ -0,0 +1,22 @@
+#include <cos_kernel_api.h>
+#include <cos_types.h>
+#include <vas_test_call_a.h>
+#include <vas_test_call_b.h>
+
+/*
+ * Null servers for vas_tests_bench: the same image is instantiated
+ * once in the client's address space, and once outside of it.
+ */
+void
+vas_test_call_a(void)
+{
+	return;
+}
+
+void
+vas_test_call_b(void)
+{
+	return;
+}
+
+int main(void) {}
@@ -7,7 +7,7 @@
 #include <tmr.h>
 #include <tmrmgr.h>
 #include <static_slab.h>
-#include <heap.h>
+#include <dheap.h>
 #include <cos_time.h>
 
 #define MAX_NUM_TMR 32
@@ -23,33 +23,38 @@
 struct tmr_info {
 	unsigned int index;
 	cycles_t timeout_cyc;
+	cycles_t slack_cyc;
 	unsigned int usecs;
 	tmr_flags_t flags;
 	evt_res_id_t evt_id;
 };
 
 SS_STATIC_SLAB(timer, struct tmr_info, MAX_NUM_TMR);
-struct heap * timer_active;
-unsigned int timer_heap[sizeof(struct heap) / sizeof(unsigned int) + MAX_NUM_TMR];
+struct dheap *timer_active;
+struct dheap timer_heap;
+struct dheap_ent timer_ents[DHEAP_ENTS(MAX_NUM_TMR)] CACHE_ALIGNED;
 thdid_t main_thdid;
 unsigned long modifying;
+unsigned long nmerged;
 
-int
-timer_cmp_fn(void* a, void* b)
+/* Timers are ordered by the latest time they can expire */
+static inline cycles_t
+timer_latest(struct tmr_info *t)
 {
-	return ((struct tmr_info*)a)->timeout_cyc <= ((struct tmr_info*)b)->timeout_cyc;
+	return t->timeout_cyc + t->slack_cyc;
 }
 
-void
+static inline void
 timer_update_fn(void* e, int pos)
 {
 	((struct tmr_info*)e)->index = pos;
 }
 
-DECLARE_HEAP(tmrmgr, timer_cmp_fn, timer_update_fn);
+/* The timers are keyed by their latest expiration */
+DECLARE_DHEAP(tmrmgr, timer_update_fn);
 
 tmr_id_t
-tmrmgr_create(unsigned int usecs, tmr_flags_t flags)
+tmrmgr_create(unsigned int usecs, unsigned int slack, tmr_flags_t flags)
 {
 	tmr_id_t id;
 	struct tmr_info* t;
@@ -62,6 +67,7 @@ tmrmgr_create(unsigned int usecs, tmr_flags_t flags)
 	t->usecs = usecs;
 	t->flags = flags;
 	t->timeout_cyc = 0;
+	t->slack_cyc = time_usec2cyc(slack);
 	t->evt_id = 0;
 
 	if (t->usecs < MIN_USECS_LIMIT) t->usecs = MIN_USECS_LIMIT;
@@ -94,7 +100,7 @@ tmrmgr_start(tmr_id_t id)
 	lock = ps_faa(&modifying, 1);
 	if (lock == 0) {
 		t->timeout_cyc = time_now() + time_usec2cyc(t->usecs);
-		assert(tmrmgr_heap_add(timer_active, t) == 0);
+		assert(tmrmgr_dheap_add(timer_active, timer_latest(t), t) == 0);
 		ps_faa(&modifying, -1);
 	} else return -2;
 
@@ -120,7 +126,7 @@ tmrmgr_stop(tmr_id_t id)
 
 	lock = ps_faa(&modifying, 1);
 	if (lock == 0) {
-		tmrmgr_heap_remove(timer_active, t->index);
+		tmrmgr_dheap_remove(timer_active, t->index);
 		t->timeout_cyc = 0;
 		ps_faa(&modifying, -1);
 	} else return -2;
@@ -163,11 +169,18 @@ tmrmgr_evt_get(tmr_id_t id)
 	return t->evt_id;
 }
 
+unsigned long
+tmrmgr_nmerged(void)
+{
+	return ps_load(&nmerged);
+}
+
 int
 main(void)
 {
 	cycles_t wakeup;
 	struct tmr_info *t;
+	unsigned long nexpired;
 
 	main_thdid=cos_thdid();
 	printc("Timer manager: executing main with thread ID %lu.\n", main_thdid);
@@ -180,6 +193,9 @@ main(void)
 		 * whatever have happened. By default, we wakeup at least a once per second. The
 		 * accuracy of the timer is at about a millisecond. If we got a periodic timer,
 		 * we insert that guy into the queue repeatedly after its expire.
+		 * We wake up for the latest time the first timer can expire,
+		 * and expire all timers that can then expire (i.e. those with
+		 * slack whose windows overlap) in the same wakeup.
 		 */
 		if (modifying != 0) {
 			wakeup = time_now() + time_usec2cyc(1000 * 1000);
@@ -188,34 +204,37 @@ main(void)
 		}
 
 		wakeup = time_now();
-		t = heap_peek((struct heap *)timer_heap);
+		t = dheap_peek(timer_active);
 
+		nexpired = 0;
 		if (t != NULL) {
 			/* At least one timer expired. Process all of them. */
 			while(t->timeout_cyc <= (wakeup + time_usec2cyc(MIN_USECS_LIMIT))) {
 				debug("Timer manager: id %d expired.\n", ss_timer_id(t));
 				evt_trigger(t->evt_id);
-				t = tmrmgr_heap_highest((struct heap *)timer_heap);
+				nexpired++;
+				t = tmrmgr_dheap_pop(timer_active);
 
 				if (t->flags == TMR_PERIODIC) {
 					debug("Timer manager: added back id %d to heap.\n", ss_timer_id(t));
 					t->timeout_cyc = time_now() + time_usec2cyc(t->usecs);
-					assert(tmrmgr_heap_add((struct heap *)timer_heap, t) == 0);
+					assert(tmrmgr_dheap_add(timer_active, timer_latest(t), t) == 0);
 				} else {
 					t->timeout_cyc = 0;
 				}
 
-				t = heap_peek((struct heap *)timer_heap);
+				t = dheap_peek(timer_active);
 				if (t == NULL) break;
 			}
 		}
+		if (nexpired > 1) ps_faa(&nmerged, nexpired - 1);
 
 		if (t == NULL) {
 			wakeup = time_now() + time_usec2cyc(1000 * 1000);
 			sched_thd_block_timeout(0, wakeup);
 			debug("Timer manager: idle-wakeup.\n");
 		} else {
-			wakeup = t->timeout_cyc;
+			wakeup = timer_latest(t);
 			sched_thd_block_timeout(0, wakeup);
 		}
 	}
@@ -230,6 +249,7 @@ cos_init(void)
 
 	/* Initialize active timer heap */
 	modifying = 0;
-	timer_active = (struct heap *)timer_heap;
-	heap_init(timer_active, MAX_NUM_TMR);
+	nmerged = 0;
+	timer_active = &timer_heap;
+	dheap_init(timer_active, timer_ents, MAX_NUM_TMR);
 }
@@ -0,0 +1,333 @@
+#include <cos_component.h>
+#include <llprint.h>
+#include <consts.h>
+#include <ps.h>
+#include <sched.h>
+
+#include <tmr.h>
+#include <tmrmgr.h>
+#include <evt.h>
+#include <static_slab.h>
+#include <twheel.h>
+#include <sync_lock.h>
+#include <cos_time.h>
+
+/***
+ * The timer manager with a hierarchical timing wheel (`twheel.h`) per
+ * core, rather than the single heap of `tmrmgr.simple`: starting and
+ * stopping timers is O(1), and only contends with the expiry thread
+ * of the timer's core. A timer is on the wheel of the core it is
+ * started on. Periodic timers expire relative to their previous
+ * deadline, so they don't drift with the latency of the expiry
+ * thread. All timers due at a wakeup are expired in one batch, with
+ * their events posted to the shared memory of their aggregates
+ * (`evt_src_post`), and the waiters of each aggregate woken once.
+ * Timers with slack expire on the most aligned tick within their
+ * window, so timers whose windows overlap tend to share a tick, thus a
+ * wakeup.
+ *
+ * As with the `tmr` library, a timer is used by a single thread, so
+ * only the expiry thread of the timer's core executes concurrently
+ * with its start, stop, and event operations.
+ */
+
+#define MAX_NUM_TMR     (1 << 14)
+#define MIN_USECS_LIMIT 1000
+/* The resolution of the wheel */
+#define TMR_TICK_USECS  MIN_USECS_LIMIT
+/* The number of aggregates to notify after a batch of expiries */
+#define TMR_NOTIFY_MAX  32
+
+#undef TMR_TRACE_DEBUG
+#ifdef TMR_TRACE_DEBUG
+#define debug(format, ...) printc(format, ##__VA_ARGS__)
+#else
+#define debug(format, ...)
+#endif
+
+struct tmr_info {
+	struct twheel_timer timer;
+	cycles_t            deadline; /* `0` if the timer isn't started */
+	cycles_t            period;
+	cycles_t            slack;
+	tmr_flags_t         flags;
+	coreid_t            core;     /* the wheel the timer is on */
+	evt_res_id_t        evt_id;
+	struct evt_src      src;
+};
+
+SS_STATIC_SLAB(timer, struct tmr_info, MAX_NUM_TMR);
+
+struct tmr_core {
+	struct sync_lock lock;
+	struct twheel    w;
+	thdid_t          thd;
+	twheel_tick_t    next;  /* the tick the thread next wakes up at */
+	cycles_t         now;   /* the time of the current expiry batch */
+	unsigned long    nexpired, nmerged;
+	int              nnotify;
+	struct evt_src   notify[TMR_NOTIFY_MAX];
+} CACHE_ALIGNED;
+
+static struct tmr_core tmr_cores[NUM_CPU];
+static unsigned int    tick_shift;
+
+/* The first tick at, or after, `c`, so timers never expire early */
+static inline twheel_tick_t
+tmr_tick(cycles_t c)
+{
+	return (c + (1ULL << tick_shift) - 1) >> tick_shift;
+}
+
+/*
+ * The tick in the window of the timer, `[deadline, deadline + slack]`,
+ * that is the multiple of the largest power of two. Timers with
+ * overlapping windows are likely to round to the same tick.
+ */
+static inline twheel_tick_t
+tmr_tick_slack(struct tmr_info *t)
+{
+	twheel_tick_t lo = tmr_tick(t->deadline), hi = (t->deadline + t->slack) >> tick_shift;
+
+	if (hi <= lo) return lo;
+
+	return hi & ~((1ULL << (63 - __builtin_clzll(lo ^ hi))) - 1);
+}
+
+static void
+tmr_notify(struct tmr_core *c)
+{
+	int i;
+
+	for (i = 0; i < c->nnotify; i++) evt_src_notify(&c->notify[i]);
+	c->nnotify = 0;
+}
+
+/* Post the timer's event, and remember to notify its aggregate */
+static void
+tmr_post(struct tmr_core *c, struct evt_src *src)
+{
+	int i;
+
+	if (evt_src_post(src) <= 0) return;
+	for (i = 0; i < c->nnotify; i++) {
+		if (c->notify[i].shm == src->shm) return;
+	}
+	if (unlikely(c->nnotify == TMR_NOTIFY_MAX)) tmr_notify(c);
+	c->notify[c->nnotify++] = *src;
+}
+
+static void
+tmr_expire(struct twheel_timer *timer, void *data)
+{
+	struct tmr_core *c = data;
+	struct tmr_info *t = ps_container(timer, struct tmr_info, timer);
+
+	debug("Timer manager: id %d expired.\n", ss_timer_id(t));
+	c->nexpired++;
+	tmr_post(c, &t->src);
+	if (t->flags != TMR_PERIODIC) {
+		t->deadline = 0;
+		return;
+	}
+
+	t->deadline += t->period;
+	/* Skip the periods we missed, but keep the phase */
+	if (unlikely((s64_t)(t->deadline - c->now) <= 0)) {
+		t->deadline += ((c->now - t->deadline) / t->period + 1) * t->period;
+	}
+	twheel_add(&c->w, &t->timer, tmr_tick_slack(t));
+}
+
+tmr_id_t
+tmrmgr_create(unsigned int usecs, unsigned int slack, tmr_flags_t flags)
+{
+	tmr_id_t id;
+	struct tmr_info* t;
+
+	t = ss_timer_alloc();
+	if (!t) return 0;
+
+	id = ss_timer_id(t);
+
+	if (usecs < MIN_USECS_LIMIT) usecs = MIN_USECS_LIMIT;
+	twheel_timer_init(&t->timer);
+	t->period   = time_usec2cyc(usecs);
+	t->slack    = time_usec2cyc(slack);
+	t->flags    = flags;
+	t->deadline = 0;
+	t->core     = cos_coreid();
+	t->evt_id   = 0;
+
+	debug("Timer manager: timer created, id %d, usecs %d, flags %d\n", id, usecs, flags);
+
+	ss_timer_activate(t);
+
+	return id;
+}
+
+/**
+ * Start the timer on the current core's wheel. As in `tmrmgr.simple`,
+ * timers must be started after creation, and must have an event.
+ */
+int
+tmrmgr_start(tmr_id_t id)
+{
+	struct tmr_info *t;
+	struct tmr_core *c = &tmr_cores[cos_coreid()];
+	twheel_tick_t    tick;
+	int              wake;
+
+	debug("Timer manager: timer start, id %d\n", id);
+	t = ss_timer_get(id);
+	if (!t) return -1;
+	if (t->evt_id == 0) return -1;
+
+	sync_lock_take(&c->lock);
+	if (t->deadline != 0) {
+		sync_lock_release(&c->lock);
+		return -1;
+	}
+	t->core     = cos_coreid();
+	t->deadline = time_now() + t->period;
+	tick        = tmr_tick_slack(t);
+	twheel_add(&c->w, &t->timer, tick);
+	/* Only wake the expiry thread if it would sleep past this timer */
+	wake = (s64_t)(tick - c->next) < 0;
+	if (wake) c->next = tick;
+	sync_lock_release(&c->lock);
+
+	if (wake && c->thd) sched_thd_wakeup(c->thd);
+
+	return 0;
+}
+
+/**
+ * Stop the timer. Nothing will happen if we try to stop a timer that is already stopped.
+ */
+int
+tmrmgr_stop(tmr_id_t id)
+{
+	struct tmr_info *t;
+	struct tmr_core *c;
+
+	debug("Timer manager: timer stop, id %d\n", id);
+	t = ss_timer_get(id);
+	if (!t) return -1;
+	if (t->deadline == 0) return -1;
+
+	/* The expiry thread wakes up early, at worst */
+	c = &tmr_cores[t->core];
+	sync_lock_take(&c->lock);
+	if (t->deadline == 0) {
+		sync_lock_release(&c->lock);
+		return -1;
+	}
+	twheel_cancel(&c->w, &t->timer);
+	t->deadline = 0;
+	sync_lock_release(&c->lock);
+
+	return 0;
+}
+
+int
+tmrmgr_delete(tmr_id_t id)
+{
+	/* TODO */
+	return -1;
+}
+
+int
+tmrmgr_evt_set(tmr_id_t id, evt_res_id_t rid)
+{
+	struct tmr_info *t;
+	struct tmr_core *c;
+
+	debug("Timer manager: timer event set, id %d, event %d\n", id, rid);
+	t = ss_timer_get(id);
+	if (!t) return -1;
+	if (t->evt_id && rid != 0) return -1;
+
+	c = &tmr_cores[t->core];
+	sync_lock_take(&c->lock);
+	t->evt_id = rid;
+	/* If the event's memory can't be mapped, `evt_src_post` uses `evt_trigger` */
+	if (rid) evt_src_init(&t->src, rid);
+	else     t->src = (struct evt_src) { .rid = 0 };
+	sync_lock_release(&c->lock);
+
+	return 0;
+}
+
+evt_res_id_t
+tmrmgr_evt_get(tmr_id_t id)
+{
+	struct tmr_info *t;
+
+	t = ss_timer_get(id);
+	if (!t) return -1;
+
+	return t->evt_id;
+}
+
+unsigned long
+tmrmgr_nmerged(void)
+{
+	unsigned long n = 0;
+	int i;
+
+	for (i = 0; i < NUM_CPU; i++) n += ps_load(&tmr_cores[i].nmerged);
+
+	return n;
+}
+
+void
+parallel_main(coreid_t cid)
+{
+	struct tmr_core *c = &tmr_cores[cid];
+	twheel_tick_t    next;
+	int              idle;
+
+	c->thd = cos_thdid();
+	printc("Timer manager: executing expiry on core %d with thread ID %lu.\n", cid, c->thd);
+
+	while (1) {
+		sync_lock_take(&c->lock);
+		c->now      = time_now();
+		c->nexpired = 0;
+		twheel_advance(&c->w, c->now >> tick_shift, tmr_expire, c);
+		if (c->nexpired > 1) c->nmerged += c->nexpired - 1;
+		next = c->next = twheel_next(&c->w);
+		idle = c->w.ntimers == 0;
+		sync_lock_release(&c->lock);
+
+		/* Wake the waiters outside of the lock, as they might preempt us */
+		tmr_notify(c);
+
+		/*
+		 * Without timers, we block until one is started. Timers
+		 * started before we block wake us up, so we don't block.
+		 */
+		if (idle) sched_thd_block(0);
+		else      sched_thd_block_timeout(0, next << tick_shift);
+	}
+}
+
+void
+cos_parallel_init(coreid_t cid, int init_core, int ncores)
+{
+	struct tmr_core *c = &tmr_cores[cid];
+
+	if (sync_lock_init(&c->lock)) BUG();
+	twheel_init(&c->w, time_now() >> tick_shift);
+	c->next = c->w.curr + TWHEEL_SPAN;
+}
+
+void
+cos_init(void)
+{
+	printc("Timer manager: init.\n");
+
+	/* The largest power-of-two number of cycles within a tick */
+	tick_shift = 63 - __builtin_clzll(time_usec2cyc(TMR_TICK_USECS));
+}
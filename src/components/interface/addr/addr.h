@@ -1,8 +1,9 @@
 /*
  * This API is really meant to only be used by capmgrs. It allows the
  * capmgr to get key addresses within another component they
- * oversee. For the time being, this is limited to the heap pointer
- * and capability frontier.
+ * oversee. For the time being, this is limited to the heap pointer,
+ * capability frontier, and the start of the writable image (its data
+ * and BSS).
  */
 
 #ifndef ADDR_H
@@ -11,6 +12,7 @@
 typedef enum {
 	ADDR_HEAP_FRONTIER,
 	ADDR_CAPTBL_FRONTIER,
+	ADDR_RW_BASE,
 } addr_t;
 
 unsigned long addr_get(compid_t id, addr_t type);
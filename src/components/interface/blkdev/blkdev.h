@@ -0,0 +1,55 @@
+#ifndef BLKDEV_H
+#define BLKDEV_H
+
+#include <cos_types.h>
+#include <cos_component.h>
+#include <cos_stubs.h>
+
+/***
+ * A block device: an array of sectors, that are read and written in
+ * place, in the memory of the client it shares with the device with
+ * blkdev_mem_map (e.g. the memory of a VM, for its virtio-blk
+ * device), so without copies through intermediate buffers. The
+ * requests are in a table in shared memory as well, with a row of up
+ * to BLKDEV_BATCH_MAX requests for each of the client's queues, so a
+ * batch of requests only costs one invocation.
+ */
+
+#define BLKDEV_SECTOR_SZ 512
+#define BLKDEV_QUEUES_MAX 8
+#define BLKDEV_BATCH_MAX 32
+
+#define BLKDEV_OP_READ 0
+#define BLKDEV_OP_WRITE 1
+#define BLKDEV_OP_FLUSH 2
+
+struct blkdev_req {
+	u64_t sector;
+	u64_t off;    /* of the buffer, in the client's memory */
+	u32_t len;    /* of the buffer, a multiple of BLKDEV_SECTOR_SZ */
+	u16_t op;
+	s16_t status; /* 0, or -errno, set by blkdev_submit */
+};
+
+struct blkdev_reqs {
+	struct blkdev_req reqs[BLKDEV_QUEUES_MAX][BLKDEV_BATCH_MAX];
+};
+
+/* The number of sectors of the device */
+u64_t blkdev_capacity(void);
+/*
+ * Share with the device the memory in which the client's buffers
+ * are, at offsets from its start, and the table of its requests (a
+ * struct blkdev_reqs, in its own shared memory). Returns 0, or
+ * -errno.
+ */
+int blkdev_mem_map(cbuf_t mem, cbuf_t reqs);
+/*
+ * Serve the first n requests of the queue's row of the table, in
+ * order, and set their status. The requests of different queues are
+ * served concurrently. Returns the number of requests that failed,
+ * or -errno if none was served.
+ */
+int blkdev_submit(int queue, int n);
+
+#endif /* BLKDEV_H */
@@ -0,0 +1,3 @@
+#include <cos_component.h>
+#include <cos_stubs.h>
+#include <blkdev.h>
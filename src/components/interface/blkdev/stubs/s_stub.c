@@ -0,0 +1,2 @@
+#include <cos_stubs.h>
+#include <blkdev.h>
@@ -27,6 +27,17 @@ void capmgr_set_tls(thdcap_t cap, void* tls_addr);
 thdcap_t  capmgr_initthd_create(spdid_t child, thdid_t *tid);
 thdcap_t  COS_STUB_DECL(capmgr_initthd_create)(spdid_t child, thdid_t *tid);
 
+/*
+ * The aep (asynchronous end-point) creation: `initaep` is the initial
+ * thread of a child scheduler on the current core, `thunk` a thread
+ * of the caller, and `ext` a thread of the child, all scheduled by
+ * the caller (a scheduler, and the child's for `initaep` and `ext`),
+ * with the aep's capabilities in the caller. `key` (if not `0`) finds the aep for
+ * `capmgr_asnd_key_create`, and the asnds to the aep send at most
+ * `ipimax` IPIs per `ipiwin` microseconds (`ipimax = 0`: no limit),
+ * the notifications beyond those being delivered at the aep core's
+ * next IPI or timer interrupt (see `cos_asnd_alloc_ipilimit`).
+ */
 thdcap_t  capmgr_initaep_create(spdid_t child, struct cos_aep_info *aep, int owntc, cos_channelkey_t key, microsec_t ipiwin, u32_t ipimax, asndcap_t *sndret);
 thdcap_t  COS_STUB_DECL(capmgr_initaep_create)(spdid_t child, struct cos_aep_info *aep, int owntc, cos_channelkey_t key, microsec_t ipiwin, u32_t ipimax, asndcap_t *sndret);
 
@@ -64,9 +75,29 @@ vaddr_t COS_STUB_DECL(capmgr_shared_kernel_page_create)(vaddr_t *resource);
 vaddr_t capmgr_vm_shared_kernel_page_create_at(compid_t comp_id, vaddr_t addr);
 vaddr_t COS_STUB_DECL(capmgr_vm_shared_kernel_page_create_at)(compid_t comp_id, vaddr_t addr);
 
+/*
+ * The scheduler of the passive component id notifies that its
+ * initialization is complete: if it is to be restarted on a fault,
+ * the capmgr checkpoints it. Returns 0, or -EINVAL if the caller isn't
+ * its scheduler, or it can't be checkpointed.
+ */
+int capmgr_restart_checkpoint(compid_t id);
+int COS_STUB_DECL(capmgr_restart_checkpoint)(compid_t id);
+
 compid_t capmgr_vm_comp_create(u64_t mem_sz);
 compid_t COS_STUB_DECL(capmgr_vm_comp_create)(u64_t mem_sz);
 
+int capmgr_vm_mem_map(compid_t vm_id, cbuf_t id);
+int COS_STUB_DECL(capmgr_vm_mem_map)(compid_t vm_id, cbuf_t id);
+
+/*
+ * Set a bit in the shared memory bitmap for each of the npages
+ * guest-physical pages of the VM at gpa written since the last call,
+ * and clear their dirty bits. Returns the number of dirty pages.
+ */
+int capmgr_vm_mem_dirty(compid_t vm_id, cbuf_t bitmap, vaddr_t gpa, unsigned long npages);
+int COS_STUB_DECL(capmgr_vm_mem_dirty)(compid_t vm_id, cbuf_t bitmap, vaddr_t gpa, unsigned long npages);
+
 capid_t capmgr_vm_vmcs_create(void);
 capid_t COS_STUB_DECL(capmgr_vm_vmcs_create)(void);
 
@@ -4,7 +4,7 @@
 thdcap_t
 capmgr_thd_create(cos_thd_fn_t fn, void *data, thdid_t *tid)
 {
-	thdclosure_index_t idx = cos_thd_init_alloc(fn, data);
+	thdclosure_index_t idx = cos_thd_pool_alloc(fn, data);
 
 	if (idx < 1) return 0;
 
@@ -124,8 +124,8 @@ COS_CLIENT_STUB(thdcap_t, capmgr_aep_create_thunk, struct cos_aep_info *aep, thd
 	if (!thd) return 0;
 
 	aep->thd  = thd;
-	aep->rcv  = (tcrcvret << 16) >> 16;
-	aep->tc   = (tcrcvret >> 16);
+	aep->rcv  = tcrcvret >> 16;
+	aep->tc   = (tcrcvret << 16) >> 16;
 	aep->tid  = tid;
 
 	return thd;
@@ -179,7 +179,7 @@ COS_CLIENT_STUB(thdcap_t, capmgr_initaep_create, spdid_t child, struct cos_aep_i
 {
 	COS_CLIENT_INVCAP;
 	u32_t child_owntc = (child << 16) | owntc;
-	u32_t key_ipimax  = (key << 16) >> ipimax;
+	u32_t key_ipimax  = (key << 16) | ((ipimax << 16) >> 16);
 	u32_t ipiwin32b   = (u32_t)ipiwin;
 	thdcap_t thd = 0;
 	word_t sndtidret = 0, rcvtcret = 0;
@@ -103,7 +103,7 @@ COS_SERVER_3RET_STUB(thdcap_t, capmgr_initaep_create)
 	asndcap_t               snd = 0;
 	thdcap_t                thd;
 
-	thd = capmgr_initaep_create(child, &aep, owntc, key, ipimax, ipiwin32b, &snd);
+	thd = capmgr_initaep_create(child, &aep, owntc, key, ipiwin32b, ipimax, &snd);
 	*r1 = (snd << 16)      | aep.tid;
 	*r2 = (aep.rcv << 16) | aep.tc;
 
@@ -121,7 +121,7 @@ COS_SERVER_3RET_STUB(thdcap_t, capmgr_aep_create_thunk)
 	asndcap_t               snd;
 	thdcap_t                thd;
 
-	thd = capmgr_aep_create_thunk(&aep, thunk, owntc, key, ipimax, ipiwin32b);
+	thd = capmgr_aep_create_thunk(&aep, thunk, owntc, key, ipiwin32b, ipimax);
 	*r1 = aep.tid;
 	*r2 = (aep.rcv << 16) | aep.tc;
 
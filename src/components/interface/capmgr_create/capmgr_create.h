@@ -1,6 +1,17 @@
 #ifndef CAPMGR_CREATE_H
 #define CAPMGR_CREATE_H
 
+#include <cos_types.h>
+
 void capmgr_create_noop(void);
+/*
+ * Reserve one of the client's pooled threads (`thd_pool` in the
+ * composition). Returns its id, or 0 if the pool is empty. Creating a
+ * thread with the COS_THD_POOL_RESERVED(id) closure (see
+ * cos_thd_init.h) then yields the reserved thread.
+ */
+thdid_t capmgr_create_thd_reserve(void);
+/* Refill the client's pool to its configured size; returns the number of threads added */
+int capmgr_create_thd_pool_fill(void);
 
 #endif /* CAPMGR_CREATE_H */
@@ -28,6 +28,41 @@
  */
 chan_id_t chanmgr_create(unsigned int item_sz, unsigned int slots, chan_flags_t flags);
 
+/**
+ * Create the new channel, and return, in the same invocation, the
+ * resources of `chanmgr_sync_resources` and `chanmgr_mem_resources`
+ * (see below). The channel's memory and blockpoints are often those
+ * of a deleted channel of the same size class, so this is the fast
+ * path to create channels dynamically.
+ *
+ * - @args   - see `chanmgr_create`
+ * - @return - the channel id, or `0` on error, with its resources in
+ *             `cb`, `mem`, `full` and `empty`
+ */
+chan_id_t chanmgr_create_resources(unsigned int item_sz, unsigned int slots, chan_flags_t flags, cbuf_t *cb, void **mem, sched_blkpt_id_t *full, sched_blkpt_id_t *empty);
+
+/*
+ * The two blockpoints are returned in a single register, if their
+ * ids fit in half of one; otherwise `0` is, and the client stub gets
+ * them with `chanmgr_sync_resources`.
+ */
+#define CHANMGR_BLKPT_BITS (sizeof(word_t) * 4)
+
+static inline word_t
+chanmgr_blkpts_pack(sched_blkpt_id_t full, sched_blkpt_id_t empty)
+{
+	if ((word_t)full >> CHANMGR_BLKPT_BITS || (word_t)empty >> CHANMGR_BLKPT_BITS) return 0;
+
+	return ((word_t)full << CHANMGR_BLKPT_BITS) | (word_t)empty;
+}
+
+static inline void
+chanmgr_blkpts_unpack(word_t packed, sched_blkpt_id_t *full, sched_blkpt_id_t *empty)
+{
+	*full  = (sched_blkpt_id_t)(packed >> CHANMGR_BLKPT_BITS);
+	*empty = (sched_blkpt_id_t)(packed & (((word_t)1 << CHANMGR_BLKPT_BITS) - 1));
+}
+
 /**
  * Two functions to get the *resources* associated with the allocated
  * channel. These resources include the blockpoints used for
@@ -53,10 +88,14 @@ int chanmgr_mem_resources(chan_id_t id, cbuf_t *cb, void **mem);
 
 /**
  * Delete an existing channel in a component, and dereference it if it
- * is accessed from within multiple components.
+ * is accessed from within multiple components. Only the component that
+ * created the channel deletes it, and its memory and blockpoints are
+ * recycled for the next channels of the same size: no component should
+ * access the channel after it is deleted.
  *
  * - @id - the channel id.
- * - @return - `0` on success. `-EINVAL` if `id` is not valid.
+ * - @return - `0` on success. `-EINVAL` if `id` is not valid, `-EPERM`
+ *             if the channel wasn't created by the client.
  */
 int chanmgr_delete(chan_id_t id);
 
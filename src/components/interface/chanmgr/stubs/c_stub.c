@@ -3,6 +3,34 @@
 #include <chanmgr.h>
 #include <memmgr.h>
 
+/*
+ * The mappings of the channels' memory, by composite buffer: the
+ * chanmgr recycles the memory of deleted channels, so a component
+ * often gets the memory it already has mapped.
+ */
+#ifndef CHANMGR_MAP_CACHE
+#define CHANMGR_MAP_CACHE 256
+#endif
+static vaddr_t chanmgr_maps[CHANMGR_MAP_CACHE];
+
+static int
+__chanmgr_map(cbuf_t cb, void **mem)
+{
+	vaddr_t addr;
+
+	if (cb < CHANMGR_MAP_CACHE && (addr = ps_load(&chanmgr_maps[cb])) != 0) {
+		*mem = (void *)addr;
+
+		return 0;
+	}
+	if (memmgr_shared_page_map(cb, &addr) == 0) return -CHAN_ERR_NOMEM;
+	/* Racing maps of the same memory only waste one of them */
+	if (cb < CHANMGR_MAP_CACHE) ps_store(&chanmgr_maps[cb], addr);
+	*mem = (void *)addr;
+
+	return 0;
+}
+
 COS_CLIENT_STUB(int, chanmgr_sync_resources, chan_id_t id, sched_blkpt_id_t *full, sched_blkpt_id_t *empty)
 {
 	COS_CLIENT_INVCAP;
@@ -26,7 +54,26 @@ COS_CLIENT_STUB(int, chanmgr_mem_resources, chan_id_t id, cbuf_t *cb, void **mem
 	*cb = (cbuf_t)c;
 	if (ret < 0) return ret;
 	/* Lets get our own mapping for the channel */
-	if (memmgr_shared_page_map(*cb, (vaddr_t *)mem) == 0) return -CHAN_ERR_NOMEM;
+	if (__chanmgr_map(*cb, mem)) return -CHAN_ERR_NOMEM;
 
 	return ret;
 }
+
+COS_CLIENT_STUB(chan_id_t, chanmgr_create_resources, unsigned int item_sz, unsigned int slots, chan_flags_t flags, cbuf_t *cb, void **mem, sched_blkpt_id_t *full, sched_blkpt_id_t *empty)
+{
+	COS_CLIENT_INVCAP;
+	word_t c, blkpts;
+	chan_id_t id;
+
+	id  = cos_sinv_2rets(uc, item_sz, slots, flags, 0, &c, &blkpts);
+	*cb = (cbuf_t)c;
+	if (id == 0) return 0;
+	if (blkpts != 0) {
+		chanmgr_blkpts_unpack(blkpts, full, empty);
+	} else if (chanmgr_sync_resources(id, full, empty)) {
+		return 0;
+	}
+	if (__chanmgr_map(*cb, mem)) return 0;
+
+	return id;
+}
@@ -25,3 +25,17 @@ COS_SERVER_3RET_STUB(int, chanmgr_mem_resources)
 
 	return ret;
 }
+
+COS_SERVER_3RET_STUB(chan_id_t, chanmgr_create_resources)
+{
+	cbuf_t cb;
+	void *mem;
+	sched_blkpt_id_t full, empty;
+	chan_id_t id;
+
+	id = chanmgr_create_resources((unsigned int)p0, (unsigned int)p1, (chan_flags_t)p2, &cb, &mem, &full, &empty);
+	*r1 = (word_t)cb;
+	*r2 = chanmgr_blkpts_pack(full, empty);
+
+	return id;
+}
@@ -13,5 +13,6 @@
 #include <cos_stubs.h>
 
 vaddr_t contigmem_alloc(unsigned long npages);
+vaddr_t contigmem_superpage_alloc(unsigned long nsuperpages);
 cbuf_t contigmem_shared_alloc_aligned(unsigned long npages, unsigned long align, vaddr_t *pgaddr);
 #endif /* MEMMGR_H */
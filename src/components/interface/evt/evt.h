@@ -81,6 +81,12 @@ typedef word_t evt_res_data_t;
  */
 typedef word_t evt_res_id_t;
 
+/* An event returned by `evt_get_n` */
+struct evt_event {
+	evt_res_type_t type;
+	evt_res_data_t data;
+};
+
 typedef enum {
 	EVT_WAIT_DEFAULT     = 0,
 	EVT_WAIT_NONBLOCKING = 1
@@ -129,6 +135,35 @@ int evt_teardown(struct evt *evt);
  */
 int evt_get(struct evt *evt, evt_wait_flags_t flags, evt_res_type_t *src, evt_res_data_t *ret_data);
 
+/**
+ * Get all pending events (up to `n`) with a single invocation of the
+ * event manager, waiting for at least one. The events are returned
+ * through a buffer shared with the manager, that is allocated (from
+ * the `memmgr`) on the first call. Thus clients using this must
+ * depend on the `memmgr`.
+ *
+ * - @evt - the event
+ * - @flags - options for retrieving the events
+ * - @evts - the array to return the events into
+ * - @n - the size of `evts`
+ * - @return -
+ *
+ *     - `> 0` the number of events returned,
+ *     - `0` if nonblocking, and no events are available
+ *     - `< 0` if there is an error, interpret as -errno
+ */
+int evt_get_n(struct evt *evt, evt_wait_flags_t flags, struct evt_event *evts, unsigned long n);
+
+/**
+ * Initialize an event to share its memory with the manager, so that
+ * `evt_get` and `evt_get_n` take the events in the client, and block
+ * directly on its blockpoint, rather than invoking the manager. As
+ * `evt_get_n`, this requires a memmgr dependency.
+ *
+ * - @return - `0` on success, and `!0` otherwise
+ */
+int evt_init_shm(struct evt *evt, unsigned long max_evts);
+
 /**
  * Client API for generating and using `evt_res_id_t`s. This is the
  * *second* resource provided by the event manager. Each of these
@@ -164,4 +199,31 @@ int evt_rem(struct evt *e, evt_res_id_t rid);
 
 int evt_trigger(evt_res_id_t rid);
 
+/**
+ * A faster `evt_trigger` for components that trigger a resource
+ * repeatedly (e.g. channels). `evt_src_init` maps the memory of the
+ * resource's event (the manager only does so for active resource
+ * ids), and `evt_src_trigger` then triggers the resource directly in
+ * that memory, with at most a scheduler invocation to wake the
+ * waiters. If the memory cannot be mapped, `evt_src_trigger` uses
+ * `evt_trigger`. Requires a memmgr dependency.
+ *
+ * - @src - the trigger's state
+ * - @rid - the resource to trigger
+ * - @return - `0` on success, and `<0` on error (`-errno`)
+ */
+int evt_src_init(struct evt_src *src, evt_res_id_t rid);
+int evt_src_trigger(struct evt_src *src);
+
+/**
+ * Trigger many resources with one wakeup of each aggregate's waiters:
+ * `evt_src_post` makes the event pending, and returns `1` if the
+ * waiters of the aggregate must then be woken with `evt_src_notify`
+ * (once for all of the sources posted to with the same `shm`). If the
+ * memory isn't mapped, `evt_src_post` triggers the event, and returns
+ * `0`.
+ */
+int evt_src_post(struct evt_src *src);
+void evt_src_notify(struct evt_src *src);
+
 #endif /* EVT_H */
@@ -10,13 +10,30 @@ typedef word_t evt_id_t;
  */
 struct evt {
 	evt_id_t id;
+	/* The buffer shared with the manager for `evt_get_n` */
+	struct evt_event *buf;
+	/* The aggregate's memory, if shared with us (see `evt_init_shm`) */
+	struct evt_shm *shm;
+	word_t blkpt_id;
+	unsigned long nslots, max;
+};
+
+/* The triggering side of a resource, see `evt_src_init` */
+struct evt_src {
+	evt_res_id_t rid;
+	struct evt_shm *shm;
+	word_t blkpt_id;
+	unsigned long nslots;
 };
 
 evt_id_t __evt_alloc(unsigned long max_evts);
 int __evt_free(evt_id_t id);
 int __evt_get(evt_id_t id, evt_wait_flags_t flags, evt_res_type_t *src, evt_res_data_t *ret_data);
+int __evt_buf_set(evt_id_t id, cbuf_t buf);
+int __evt_get_n(evt_id_t id, evt_wait_flags_t flags, unsigned long max);
 evt_res_id_t __evt_add(evt_id_t id, evt_res_type_t srctype, evt_res_data_t ret_data);
 int __evt_rem(evt_id_t id, evt_res_id_t rid);
 int __evt_trigger(evt_res_id_t rid);
+int __evt_shm_map(evt_id_t id, evt_res_id_t rid, cbuf_t *shm, word_t *blkpt);
 
 #endif	/* EVT_PRIVATE_H */
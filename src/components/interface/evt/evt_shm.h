@@ -0,0 +1,234 @@
+#ifndef EVT_SHM_H
+#define EVT_SHM_H
+
+/***
+ * The memory of an event aggregate, shared between the event manager,
+ * the waiting client, and the components that trigger its resources
+ * (see `evt_init_shm` and `evt_src_init`). The pending events are a
+ * lock-free multi-producer, multi-consumer ring of resource indices,
+ * with a sequence number in each slot (as in `chan` with
+ * `CHAN_MPMC`), so triggers can execute on any core, and in any of
+ * the components. A resource is in the ring at most once (see
+ * `pending`), so the ring never fills.
+ *
+ * The layout is the header, the ring's slots, then the resources. As
+ * with channels, all of this memory can be corrupted by any of the
+ * components sharing it: the ring size, the number of resources, and
+ * the blockpoint id are passed in by each user from its own memory,
+ * and indices read from the ring are checked.
+ */
+
+#include <cos_component.h>
+#include <sync_blkpt.h>
+#include <evt.h>
+
+/*
+ * A resource id is its aggregate's id and its index in the
+ * aggregate. Resource ids are never 0, as their index is offset by 1.
+ */
+#define EVT_RES_IDX_BITS 16
+#define EVT_RES_MAX      ((1UL << EVT_RES_IDX_BITS) - 1)
+#define EVT_RES_ID(agg, idx) (((agg) << EVT_RES_IDX_BITS) | ((idx) + 1))
+#define EVT_RES_AGG(rid)     ((rid) >> EVT_RES_IDX_BITS)
+#define EVT_RES_IDX(rid)     (((rid) & EVT_RES_MAX) - 1)
+
+typedef enum {
+	EVT_RES_FREE = 0,
+	EVT_RES_ACTIVE,
+} evt_res_state_t;
+
+struct evt_shm_res {
+	unsigned long  state;
+	unsigned long  pending;	/* is the resource in the ring? */
+	evt_res_type_t type;
+	evt_res_data_t data;
+};
+
+struct evt_shm_slot {
+	unsigned long seq;
+	unsigned long idx;
+};
+
+struct evt_shm {
+	struct sync_blkpt blkpt;
+	unsigned long producer CACHE_ALIGNED;
+	unsigned long consumer CACHE_ALIGNED;
+} CACHE_ALIGNED;
+
+static inline struct evt_shm_slot *
+evt_shm_slots(struct evt_shm *s)
+{
+	return (struct evt_shm_slot *)&s[1];
+}
+
+static inline struct evt_shm_res *
+evt_shm_res(struct evt_shm *s, unsigned long nslots)
+{
+	return (struct evt_shm_res *)&evt_shm_slots(s)[nslots];
+}
+
+static inline unsigned long
+evt_shm_size(unsigned long nslots, unsigned long max)
+{
+	return sizeof(struct evt_shm) + nslots * sizeof(struct evt_shm_slot) + max * sizeof(struct evt_shm_res);
+}
+
+/* `nslots` must be a power of two */
+static inline void
+evt_shm_init(struct evt_shm *s, unsigned long nslots)
+{
+	struct evt_shm_slot *slots = evt_shm_slots(s);
+	unsigned long i;
+
+	s->producer = s->consumer = 0;
+	for (i = 0; i < nslots; i++) slots[i].seq = i;
+}
+
+static inline int
+evt_shm_empty(struct evt_shm *s, unsigned long nslots)
+{
+	unsigned long pos = ps_load(&s->consumer);
+
+	return ps_load(&evt_shm_slots(s)[pos & (nslots - 1)].seq) != pos + 1;
+}
+
+static inline int
+evt_shm_dequeue(struct evt_shm *s, unsigned long nslots, unsigned long *idx)
+{
+	struct evt_shm_slot *slot;
+	unsigned long pos = ps_load(&s->consumer);
+
+	while (1) {
+		long diff;
+
+		slot = &evt_shm_slots(s)[pos & (nslots - 1)];
+		diff = (long)(ps_load(&slot->seq) - (pos + 1));
+		if (diff < 0) return 1; /* empty */
+		if (diff == 0 && ps_cas(&s->consumer, pos, pos + 1)) break;
+		pos = ps_load(&s->consumer);
+	}
+	*idx = slot->idx;
+	/* read the index before handing the slot back to the producers */
+	ps_mem_fence();
+	slot->seq = pos + nslots;
+
+	return 0;
+}
+
+static inline int
+evt_shm_enqueue(struct evt_shm *s, unsigned long nslots, unsigned long idx)
+{
+	struct evt_shm_slot *slot;
+	unsigned long pos = ps_load(&s->producer);
+
+	while (1) {
+		long diff;
+
+		slot = &evt_shm_slots(s)[pos & (nslots - 1)];
+		diff = (long)(ps_load(&slot->seq) - pos);
+		if (diff < 0) return 1; /* full */
+		if (diff == 0 && ps_cas(&s->producer, pos, pos + 1)) break;
+		pos = ps_load(&s->producer);
+	}
+	slot->idx = idx;
+	/* publish the index before the slot */
+	ps_mem_fence();
+	slot->seq = pos + 1;
+
+	return 0;
+}
+
+/**
+ * Make resource `idx` pending without waking the waiters, so that
+ * many resources of an aggregate can be posted before a single
+ * `evt_shm_notify`.
+ *
+ * - @return - `1` if the waiters must be notified,
+ *             `0` if the resource was already triggered,
+ *             `-EINVAL` if the resource isn't active, and
+ *             `-EAGAIN` if the ring is full (thus corrupted).
+ */
+static inline int
+evt_shm_post(struct evt_shm *s, unsigned long nslots, unsigned long idx)
+{
+	struct evt_shm_res *res = &evt_shm_res(s, nslots)[idx];
+
+	if (ps_load(&res->state) != EVT_RES_ACTIVE) return -EINVAL;
+	if (!ps_cas(&res->pending, 0, 1)) return 0; /* already triggered! */
+	if (evt_shm_enqueue(s, nslots, idx)) return -EAGAIN;
+
+	return 1;
+}
+
+/* Wake the waiters for the posted resources */
+static inline void
+evt_shm_notify(struct evt_shm *s, sched_blkpt_id_t blkpt_id)
+{
+	sync_blkpt_id_trigger(&s->blkpt, blkpt_id, 0);
+}
+
+/**
+ * Trigger resource `idx`, and wake the waiters.
+ *
+ * - @return - `0` on success (including if it was already triggered),
+ *             or the errors of `evt_shm_post`.
+ */
+static inline int
+evt_shm_trigger(struct evt_shm *s, sched_blkpt_id_t blkpt_id, unsigned long nslots, unsigned long idx)
+{
+	int ret = evt_shm_post(s, nslots, idx);
+
+	if (ret <= 0) return ret;
+	evt_shm_notify(s, blkpt_id);
+
+	return 0;
+}
+
+/*
+ * Take the next pending event from the ring. Removed resources can
+ * still be in the ring, and are skipped.
+ */
+static inline int
+evt_shm_next(struct evt_shm *s, unsigned long nslots, unsigned long max, struct evt_event *evt)
+{
+	struct evt_shm_res *res;
+	unsigned long idx;
+
+	while (!evt_shm_dequeue(s, nslots, &idx)) {
+		if (unlikely(idx >= max)) continue;
+		res = &evt_shm_res(s, nslots)[idx];
+		/* Triggers from now on must enqueue the resource again */
+		ps_cas(&res->pending, 1, 0);
+		if (ps_load(&res->state) != EVT_RES_ACTIVE) continue;
+
+		*evt = (struct evt_event) {
+			.type = res->type,
+			.data = res->data,
+		};
+
+		return 0;
+	}
+
+	return 1;
+}
+
+/* Wait for an event, or return `1` if nonblocking, and there are none */
+static inline int
+evt_shm_wait(struct evt_shm *s, sched_blkpt_id_t blkpt_id, unsigned long nslots, unsigned long max,
+             evt_wait_flags_t flags, struct evt_event *evt)
+{
+	struct sync_blkpt_checkpoint chkpt;
+
+	while (1) {
+		sync_blkpt_checkpoint(&s->blkpt, &chkpt);
+
+		if (!evt_shm_next(s, nslots, max, evt)) return 0;
+		if (flags & EVT_WAIT_NONBLOCKING) return 1;
+
+		if (sync_blkpt_id_blocking(&s->blkpt, blkpt_id, 0, &chkpt)) continue;
+		if (!evt_shm_empty(s, nslots)) continue;
+		sync_blkpt_id_wait(&s->blkpt, blkpt_id, 0, &chkpt);
+	}
+}
+
+#endif /* EVT_SHM_H */
@@ -6,7 +6,9 @@ evt_init(struct evt *evt, unsigned long max_evts)
 	evt_id_t eid = __evt_alloc(max_evts);
 
 	if (eid == 0) return -1;
-	evt->id = eid;
+	evt->id  = eid;
+	evt->buf = NULL;
+	evt->shm = NULL;
 
 	return 0;
 }
@@ -20,9 +22,18 @@ evt_teardown(struct evt *evt)
 	return 0;
 }
 
+/* Defined in `lib_shm.c`, and only used if `evt_init_shm` linked it in */
+CWEAKSYMB int
+evt_shm_get(struct evt *evt, evt_wait_flags_t flags, evt_res_type_t *src, evt_res_data_t *ret_data)
+{
+	return -EINVAL;
+}
+
 int
 evt_get(struct evt *evt, evt_wait_flags_t flags, evt_res_type_t *src, evt_res_data_t *ret_data)
 {
+	if (evt->shm) return evt_shm_get(evt, flags, src, ret_data);
+
 	return __evt_get(evt->id, flags, src, ret_data);
 }
 
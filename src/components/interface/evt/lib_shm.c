@@ -0,0 +1,149 @@
+#include <evt.h>
+#include <evt_shm.h>
+#include <memmgr.h>
+
+/*
+ * The APIs using memory shared with the event manager. Separate from
+ * `lib.c` so that only the clients that use them depend on the
+ * memmgr.
+ */
+
+#define EVT_BUF_PAGES 1
+#define EVT_BUF_NUM   (EVT_BUF_PAGES * PAGE_SIZE / sizeof(struct evt_event))
+
+/* Map the memory of the aggregate `id` (or of the resource `rid`'s) */
+static int
+evt_shm_map(evt_id_t id, evt_res_id_t rid, struct evt_shm **shm, word_t *blkpt_id)
+{
+	cbuf_t  cb;
+	vaddr_t addr;
+	int     nslots;
+
+	nslots = __evt_shm_map(id, rid, &cb, blkpt_id);
+	if (nslots <= 0) return nslots ? nslots : -EINVAL;
+	/* The manager could give us a ring that isn't a power of two */
+	if (nslots & (nslots - 1)) return -EINVAL;
+	if (memmgr_shared_page_map(cb, &addr) == 0) return -ENOMEM;
+	*shm = (struct evt_shm *)addr;
+
+	return nslots;
+}
+
+int
+evt_init_shm(struct evt *evt, unsigned long max_evts)
+{
+	int nslots;
+
+	if (evt_init(evt, max_evts)) return -1;
+	nslots = evt_shm_map(evt->id, 0, &evt->shm, &evt->blkpt_id);
+	if (nslots < 0 || (unsigned long)nslots < max_evts) {
+		evt->shm = NULL;
+		evt_teardown(evt);
+
+		return -1;
+	}
+	evt->nslots = nslots;
+	evt->max    = max_evts;
+
+	return 0;
+}
+
+/* Overrides the weak version in `lib.c`, as `evt->shm` is only set here */
+int
+evt_shm_get(struct evt *evt, evt_wait_flags_t flags, evt_res_type_t *src, evt_res_data_t *ret_data)
+{
+	struct evt_event e;
+	int ret;
+
+	ret = evt_shm_wait(evt->shm, evt->blkpt_id, evt->nslots, evt->max, flags, &e);
+	if (ret) return ret;
+	*src      = e.type;
+	*ret_data = e.data;
+
+	return 0;
+}
+
+static int
+evt_buf_init(struct evt *evt)
+{
+	struct evt_event *buf;
+	cbuf_t id;
+
+	id = memmgr_shared_page_allocn(EVT_BUF_PAGES, (vaddr_t *)&buf);
+	if (id == 0) return -ENOMEM;
+	if (__evt_buf_set(evt->id, id)) return -EINVAL;
+	evt->buf = buf;
+
+	return 0;
+}
+
+int
+evt_get_n(struct evt *evt, evt_wait_flags_t flags, struct evt_event *evts, unsigned long n)
+{
+	unsigned long i;
+	int ret;
+
+	if (n == 0) return -EINVAL;
+	/* Take the events from the shared ring, without invoking the manager */
+	if (evt->shm) {
+		if (evt_shm_wait(evt->shm, evt->blkpt_id, evt->nslots, evt->max, flags, &evts[0])) return 0;
+		for (i = 1; i < n; i++) {
+			if (evt_shm_next(evt->shm, evt->nslots, evt->max, &evts[i])) break;
+		}
+
+		return i;
+	}
+
+	if (unlikely(!evt->buf)) {
+		ret = evt_buf_init(evt);
+		if (ret) return ret;
+	}
+	if (n > EVT_BUF_NUM) n = EVT_BUF_NUM;
+
+	ret = __evt_get_n(evt->id, flags, n);
+	if (ret <= 0) return ret;
+	memcpy(evts, evt->buf, ret * sizeof(struct evt_event));
+
+	return ret;
+}
+
+int
+evt_src_init(struct evt_src *src, evt_res_id_t rid)
+{
+	int nslots;
+
+	*src = (struct evt_src) { .rid = rid };
+	nslots = evt_shm_map(0, rid, &src->shm, &src->blkpt_id);
+	if (nslots < 0) {
+		src->shm = NULL;
+
+		return nslots;
+	}
+	src->nslots = nslots;
+
+	return 0;
+}
+
+int
+evt_src_trigger(struct evt_src *src)
+{
+	if (unlikely(!src->shm)) return evt_trigger(src->rid);
+
+	return evt_shm_trigger(src->shm, src->blkpt_id, src->nslots, EVT_RES_IDX(src->rid));
+}
+
+int
+evt_src_post(struct evt_src *src)
+{
+	if (unlikely(!src->shm)) return evt_trigger(src->rid);
+
+	return evt_shm_post(src->shm, src->nslots, EVT_RES_IDX(src->rid));
+}
+
+void
+evt_src_notify(struct evt_src *src)
+{
+	if (unlikely(!src->shm)) return;
+
+	evt_shm_notify(src->shm, src->blkpt_id);
+}
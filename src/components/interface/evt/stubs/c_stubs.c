@@ -13,3 +13,16 @@ COS_CLIENT_STUB(int, __evt_get, evt_id_t id, evt_wait_flags_t flags, evt_res_typ
 
 	return ret;
 }
+
+COS_CLIENT_STUB(int, __evt_shm_map, evt_id_t id, evt_res_id_t rid, cbuf_t *shm, word_t *blkpt)
+{
+	COS_CLIENT_INVCAP;
+	word_t s = 0, b = 0;
+	int ret;
+
+	ret = cos_sinv_2rets(uc, id, rid, 0, 0, &s, &b);
+	*shm   = s;
+	*blkpt = b;
+
+	return ret;
+}
@@ -13,3 +13,16 @@ COS_SERVER_3RET_STUB(int, __evt_get)
 
 	return ret;
 }
+
+COS_SERVER_3RET_STUB(int, __evt_shm_map)
+{
+	cbuf_t shm;
+	word_t blkpt;
+	int ret;
+
+	ret = __evt_shm_map(p0, p1, &shm, &blkpt);
+	*r1 = shm;
+	*r2 = blkpt;
+
+	return ret;
+}
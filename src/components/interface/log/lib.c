@@ -0,0 +1,65 @@
+#include <log.h>
+#include <memmgr.h>
+#include <string.h>
+
+struct log_shm *__log_shm;
+
+/*
+ * Map the memory shared with the manager. Threads that log while
+ * another maps it drop their records, rather than wait.
+ */
+struct log_shm *
+__log_shm_map(void)
+{
+	static unsigned long mapping;
+	vaddr_t addr;
+	cbuf_t  id;
+
+	if (!ps_cas(&mapping, 0, 1)) return ps_load(&__log_shm);
+
+	id = __log_shm_get();
+	if (id == 0 || memmgr_shared_page_map(id, &addr) < LOG_SHM_PAGES) {
+		/* let a later call try again */
+		mapping = 0;
+
+		return NULL;
+	}
+	ps_mem_fence();
+	__log_shm = (struct log_shm *)addr;
+
+	return __log_shm;
+}
+
+/*
+ * Copy the format into the shared table, and publish its offset for
+ * the call site. Call sites racing on their first call each copy it,
+ * and only one of the copies is used.
+ */
+unsigned long
+__log_fmt_intern(struct log_shm *s, unsigned long *fmtid, const char *fmt)
+{
+	unsigned long len = strlen(fmt) + 1, off;
+
+	do {
+		off = ps_load(&s->fmt_end);
+		/* records of formats not in the full table have format 0 */
+		if (off + len > LOG_FMT_SZ) return 0;
+	} while (!ps_cas(&s->fmt_end, off, off + len));
+	memcpy(&s->fmts[off], fmt, len);
+	ps_mem_fence();
+	if (!ps_cas(fmtid, 0, off)) return ps_load(fmtid);
+
+	return off;
+}
+
+int
+log_level_set(log_level_t level)
+{
+	struct log_shm *s = __log_shm ? __log_shm : __log_shm_map();
+
+	if (!s) return -ENOMEM;
+	if (level > LOG_LEVEL_MAX) level = LOG_LEVEL_MAX;
+	s->level = level;
+
+	return 0;
+}
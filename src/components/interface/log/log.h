@@ -0,0 +1,113 @@
+#ifndef LOG_H
+#define LOG_H
+
+/***
+ * Logging that doesn't stall on the serial line: `log_info("...%d\n",
+ * x)` and its siblings record the format and arguments in a ring in
+ * memory shared with the log manager, without invoking it, and the
+ * manager's low-priority drain thread formats and prints the records
+ * later. Use it instead of `printc` in performance-sensitive paths.
+ *
+ * - Levels more verbose than `LOG_LEVEL_MAX` (a compile-time
+ *   threshold) are compiled out, and those more verbose than the
+ *   component's level (`log_level_set`, `LOG_INFO` by default) are
+ *   filtered out when logging, before anything is recorded.
+ * - At most `LOG_NARGS` arguments are recorded, each as a word. The
+ *   conversions are printf's integer ones (`d`, `i`, `u`, `x`, `X`,
+ *   `o`, `c`, and `p`); the strings `%s` refers to aren't copied, as
+ *   they could change before the record is formatted, so they print
+ *   as "(str)".
+ * - Records are dropped (and counted) when a core's ring is full.
+ */
+
+#include <cos_component.h>
+#include <cos_stubs.h>
+#include <log_shm.h>
+
+typedef enum {
+	LOG_ERR = 0,
+	LOG_WARN,
+	LOG_INFO,
+	LOG_DEBUG,
+} log_level_t;
+
+#ifndef LOG_LEVEL_MAX
+#define LOG_LEVEL_MAX LOG_DEBUG
+#endif
+
+/* The memory shared with the manager, mapped when the component first logs */
+extern struct log_shm *__log_shm;
+
+struct log_shm *__log_shm_map(void);
+unsigned long __log_fmt_intern(struct log_shm *s, unsigned long *fmtid, const char *fmt);
+/* The manager's side: the id of the caller's shared memory (cbuf), allocated on the first call */
+cbuf_t __log_shm_get(void);
+
+/* The level most verbose that is logged (at most `LOG_LEVEL_MAX`) */
+int log_level_set(log_level_t level);
+
+static inline void
+__log_record(log_level_t level, unsigned long *fmtid, const char *fmt, word_t *args, int nargs)
+{
+	struct log_shm  *s = __log_shm;
+	struct log_ring *r;
+	struct log_rec  *rec;
+	unsigned long    pos, fmt_off;
+	int              i;
+
+	if (unlikely(!s)) {
+		s = __log_shm_map();
+		if (!s) return;
+	}
+	if ((int)level > ps_load(&s->level)) return;
+	fmt_off = ps_load(fmtid);
+	if (unlikely(!fmt_off)) fmt_off = __log_fmt_intern(s, fmtid, fmt);
+
+	r   = &s->rings[cos_coreid()];
+	rec = log_ring_reserve(r, &pos);
+	if (unlikely(!rec)) {
+		ps_faa(&r->dropped, 1);
+		return;
+	}
+	rec->fmt   = fmt_off;
+	rec->thd   = (u16_t)cos_thdid();
+	rec->level = level;
+	rec->nargs = nargs;
+	for (i = 0; i < nargs; i++) rec->args[i] = args[i];
+	log_ring_commit(rec, pos);
+}
+
+/* Each argument as a word, for at most LOG_NARGS of them */
+#define __LOG_NARGS_(_0, _1, _2, _3, _4, _5, _6, _7, n, ...) n
+#define __LOG_NARGS(...) __LOG_NARGS_(0, ##__VA_ARGS__, __log_too_many_arguments, 6, 5, 4, 3, 2, 1, 0)
+#define __LOG_W0()
+#define __LOG_W1(a)      (word_t)(a)
+#define __LOG_W2(a, ...) (word_t)(a), __LOG_W1(__VA_ARGS__)
+#define __LOG_W3(a, ...) (word_t)(a), __LOG_W2(__VA_ARGS__)
+#define __LOG_W4(a, ...) (word_t)(a), __LOG_W3(__VA_ARGS__)
+#define __LOG_W5(a, ...) (word_t)(a), __LOG_W4(__VA_ARGS__)
+#define __LOG_W6(a, ...) (word_t)(a), __LOG_W5(__VA_ARGS__)
+#define __LOG_WORDS_(n, ...) __LOG_W##n(__VA_ARGS__)
+#define __LOG_WORDS(n, ...) __LOG_WORDS_(n, ##__VA_ARGS__)
+
+/*
+ * The format must be a string literal: each call site interns it in
+ * the shared table once, and then only records its offset.
+ */
+#define log_printf(level, fmt, ...)							\
+	do {										\
+		static unsigned long __log_fmtid;					\
+		word_t __log_args[] = { 0, __LOG_WORDS(__LOG_NARGS(__VA_ARGS__), ##__VA_ARGS__) }; \
+											\
+		if ((level) <= LOG_LEVEL_MAX) {						\
+			__log_record((level), &__log_fmtid, "" fmt, &__log_args[1],	\
+			             __LOG_NARGS(__VA_ARGS__));				\
+		}									\
+	} while (0)
+
+#define log_err(fmt, ...)   log_printf(LOG_ERR, fmt, ##__VA_ARGS__)
+#define log_warn(fmt, ...)  log_printf(LOG_WARN, fmt, ##__VA_ARGS__)
+#define log_info(fmt, ...)  log_printf(LOG_INFO, fmt, ##__VA_ARGS__)
+#define log_debug(fmt, ...) log_printf(LOG_DEBUG, fmt, ##__VA_ARGS__)
+
+#endif /* LOG_H */
@@ -0,0 +1,119 @@
+#ifndef LOG_SHM_H
+#define LOG_SHM_H
+
+/***
+ * The memory a client shares with the log manager: a ring of log
+ * records for each core, and the client's format strings. A record
+ * only holds the format string's offset in that table, and the
+ * arguments, so a client's log call is a few stores, and the string
+ * is only formatted when the manager's drain thread prints it.
+ *
+ * The rings are lock-free multi-producer, single-consumer rings, with
+ * a sequence number in each record (as in `evt_shm.h`): the client's
+ * threads on a core can preempt each other while logging, and only
+ * the drain thread of that core consumes the ring. Records are
+ * dropped, and counted, when a ring is full, so logging never blocks.
+ *
+ * The manager trusts none of this memory: the format offsets and
+ * argument counts are checked, and the table's strings are bounded.
+ */
+
+#include <cos_component.h>
+#include <ps.h>
+
+#define LOG_NARGS        6      /* arguments in a record */
+#define LOG_RING_NRECS   256    /* records in each core's ring, a power of two */
+#define LOG_FMT_SZ       (2 * PAGE_SIZE)
+
+struct log_rec {
+	unsigned long seq;
+	u32_t         fmt; /* the format string's offset in the table */
+	u16_t         thd;
+	u8_t          level;
+	u8_t          nargs;
+	word_t        args[LOG_NARGS];
+};
+
+struct log_ring {
+	unsigned long  head CACHE_ALIGNED;
+	unsigned long  tail CACHE_ALIGNED;
+	unsigned long  dropped;
+	struct log_rec recs[LOG_RING_NRECS] CACHE_ALIGNED;
+};
+
+struct log_shm {
+	int             level;   /* the most verbose level that is recorded */
+	unsigned long   fmt_end; /* of the strings in the table */
+	char            fmts[LOG_FMT_SZ] CACHE_ALIGNED;
+	struct log_ring rings[NUM_CPU];
+};
+
+#define LOG_SHM_PAGES (round_up_to_page(sizeof(struct log_shm)) / PAGE_SIZE)
+
+static inline void
+log_shm_init(struct log_shm *s, int level)
+{
+	unsigned long i, j;
+
+	s->level   = level;
+	/* offset 0 is "not interned" */
+	s->fmt_end = 1;
+	for (i = 0; i < NUM_CPU; i++) {
+		s->rings[i].head    = s->rings[i].tail = 0;
+		s->rings[i].dropped = 0;
+		for (j = 0; j < LOG_RING_NRECS; j++) s->rings[i].recs[j].seq = j;
+	}
+}
+
+/* Reserve the ring's next record, or return NULL if it's full */
+static inline struct log_rec *
+log_ring_reserve(struct log_ring *r, unsigned long *pos)
+{
+	struct log_rec *rec;
+	unsigned long   p = ps_load(&r->head);
+
+	while (1) {
+		long diff;
+
+		rec  = &r->recs[p & (LOG_RING_NRECS - 1)];
+		diff = (long)(ps_load(&rec->seq) - p);
+		if (diff < 0) return NULL;
+		if (diff == 0 && ps_cas(&r->head, p, p + 1)) break;
+		p = ps_load(&r->head);
+	}
+	*pos = p;
+
+	return rec;
+}
+
+/* Publish the record reserved at pos */
+static inline void
+log_ring_commit(struct log_rec *rec, unsigned long pos)
+{
+	ps_mem_fence();
+	rec->seq = pos + 1;
+}
+
+/* The next record, by the ring's single consumer, or NULL if there is none */
+static inline struct log_rec *
+log_ring_peek(struct log_ring *r)
+{
+	struct log_rec *rec = &r->recs[r->tail & (LOG_RING_NRECS - 1)];
+
+	if (ps_load(&rec->seq) != r->tail + 1) return NULL;
+	/* read the record after its sequence number */
+	ps_mem_fence();
+
+	return rec;
+}
+
+/* Hand the record returned by `log_ring_peek` back to the producers */
+static inline void
+log_ring_release(struct log_ring *r, struct log_rec *rec)
+{
+	ps_mem_fence();
+	rec->seq = r->tail + LOG_RING_NRECS;
+	r->tail++;
+}
+
+#endif /* LOG_SHM_H */
@@ -15,4 +15,41 @@ int mc_conn_init(int proto);
 
 u16_t mc_process_command(int fd, shm_bm_objid_t objid, u16_t data_offset, u16_t data_len);
 
+/*
+ * The batched version, that processes up to MC_BATCH_MAX requests
+ * (e.g. the pipelined GETs of a burst of packets) in one invocation.
+ * The requests are described by an array of descriptors, in the
+ * object `descs` of the caller's shmem region. The reply of each
+ * request is written in its buffer, which its descriptor is updated
+ * to describe (with a `data_len` of 0 if there's no reply). Returns
+ * the number of requests processed, or -EINVAL.
+ */
+#define MC_BATCH_MAX 32
+
+struct mc_req_desc {
+	shm_bm_objid_t objid;
+	u16_t          data_offset;
+	u16_t          data_len;
+};
+
+int mc_process_commands(int fd, shm_bm_objid_t descs, int n);
+
+/*
+ * Process the request of a TCP connection, and write its reply, which
+ * can span many buffers (e.g. a GET of a large value), with the
+ * netmgr: the buffers are written by batches of NETMGR_WRITE_MAX, the
+ * first of them being the request's. Returns the number of bytes
+ * written, -ENOMEM if the caller's region is out of buffers, or -EIO
+ * if the connection fails.
+ */
+int mc_tcp_process_command(int fd, shm_bm_objid_t objid, u16_t data_offset, u16_t data_len);
+
+/*
+ * Warm the cache up with the snapshot of items (see
+ * cos_mc_snap_load) in the shared pages `shm_id`, e.g. at boot. It
+ * is loaded with the caller's udp connection `fd`. Returns the number
+ * of items loaded, or -EINVAL.
+ */
+int mc_snapshot_load(int fd, cbuf_t shm_id);
+
 #endif /* MC_H */
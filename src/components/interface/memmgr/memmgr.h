@@ -22,6 +22,36 @@ vaddr_t       COS_STUB_DECL(memmgr_heap_page_allocn)(unsigned long num_pages);
 vaddr_t       memmgr_heap_page_allocn_aligned(unsigned long num_pages, unsigned long align);
 vaddr_t       COS_STUB_DECL(memmgr_heap_page_allocn_aligned)(unsigned long num_pages, unsigned long align);
 
+/* Pages from the NUMA node's memory where possible; COS_NUMA_NODE_LOCAL is the caller's core's node */
+vaddr_t       memmgr_heap_page_allocn_node(unsigned long num_pages, int node);
+vaddr_t       COS_STUB_DECL(memmgr_heap_page_allocn_node)(unsigned long num_pages, int node);
+
+/*
+ * Heap pages at `addr`, which is either the end of the component's
+ * heap, or the start of a range (released, or never mapped) below it.
+ * Returns `addr`, or 0 if the range can't be mapped (yet: a range
+ * released is only reusable once the TLBs are quiescent).
+ */
+vaddr_t       memmgr_heap_page_allocn_at(vaddr_t addr, unsigned long num_pages);
+vaddr_t       COS_STUB_DECL(memmgr_heap_page_allocn_at)(vaddr_t addr, unsigned long num_pages);
+
+/*
+ * Heap pages whose frames are only mapped on their first access (in
+ * batches, around the address accessed), for large allocations that
+ * might not all be used. The pages read as zero. Falls back to mapping
+ * them now if the capmgr can't handle the faults.
+ */
+vaddr_t       memmgr_heap_page_allocn_lazy(unsigned long num_pages);
+vaddr_t       COS_STUB_DECL(memmgr_heap_page_allocn_lazy)(unsigned long num_pages);
+
+/* Release heap pages (of any of the allocations); returns 0, -EINVAL if a page isn't one, or -ENOMEM */
+int           memmgr_heap_page_release(vaddr_t addr, unsigned long num_pages);
+int           COS_STUB_DECL(memmgr_heap_page_release)(vaddr_t addr, unsigned long num_pages);
+
+/* Physically contiguous memory, mapped with superpages (of SUPER_PAGE_SIZE) where the platform supports them */
+vaddr_t       memmgr_heap_superpage_allocn(unsigned long num_superpages);
+vaddr_t       COS_STUB_DECL(memmgr_heap_superpage_allocn)(unsigned long num_superpages);
+
 cbuf_t        memmgr_shared_page_alloc(vaddr_t *pgaddr);
 
 cbuf_t        memmgr_shared_page_allocn(unsigned long num_pages, vaddr_t *pgaddr);
@@ -39,4 +69,47 @@ unsigned long COS_STUB_DECL(memmgr_shared_page_map_aligned)(cbuf_t id, unsigned
 unsigned long memmgr_shared_page_map_aligned_in_vm(cbuf_t id, unsigned long align, vaddr_t *pgaddr, compid_t cid);
 unsigned long COS_STUB_DECL(memmgr_shared_page_map_aligned_in_vm)(cbuf_t id, unsigned long align, vaddr_t *pgaddr, compid_t cid);
 
+/*
+ * The memory accounting of the memmgr's components, in a read-only page
+ * (`memmgr_stats_map`), indexed by the components' ids. The counters
+ * are updated as the memory is allocated, so sampling them twice gives
+ * the allocation rates.
+ */
+struct memmgr_comp_stats {
+	unsigned long frames; /* the frames it allocated, and holds (heap, shared, and contiguous) */
+	unsigned long shared; /* the pages of the other components' allocations it mapped */
+	unsigned long quota;  /* the most frames it can hold, 0 if unlimited */
+	unsigned long allocs; /* the allocations it made */
+	unsigned long denied; /* the allocations refused as they exceeded the quota */
+};
+
+struct memmgr_stats {
+	struct memmgr_comp_stats comps[MAX_NUM_COMPS + 1];
+};
+
+/* Map the (read-only) stats of the capmgr's components; 0 on error */
+vaddr_t       memmgr_stats_map(void);
+vaddr_t       COS_STUB_DECL(memmgr_stats_map)(void);
+
+/*
+ * Map the kernel's (read-only) clock page, a `struct cos_time_page`,
+ * to read the time without invocations; 0 on error.
+ */
+vaddr_t       memmgr_time_map(void);
+vaddr_t       COS_STUB_DECL(memmgr_time_map)(void);
+/*
+ * Map the kernel's (read-only) thread accounting table, `struct
+ * cos_thd_acct`s indexed by thread id, for the threads' execution
+ * times; 0 on error, e.g. if a scheduler mapped it (`slm_acct_init`).
+ */
+vaddr_t       memmgr_thd_acct_map(void);
+vaddr_t       COS_STUB_DECL(memmgr_thd_acct_map)(void);
+/*
+ * Map the (read-only) processor topology, a `struct cos_topology`:
+ * the package, SMT siblings, L2 and L3 sharing, and NUMA node of each
+ * core, and the distances between the nodes; 0 on error.
+ */
+vaddr_t       memmgr_topology_map(void);
+vaddr_t       COS_STUB_DECL(memmgr_topology_map)(void);
+
 #endif /* MEMMGR_H */
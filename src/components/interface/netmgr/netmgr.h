@@ -23,6 +23,66 @@ int netmgr_tcp_accept(struct conn_addr *client_addr);
 shm_bm_objid_t netmgr_tcp_shmem_read(u16_t *data_offset, u16_t *data_len);
 int netmgr_tcp_shmem_write(shm_bm_objid_t objid, u16_t data_offset, u16_t data_len);
 
+/*
+ * Write the data of up to NETMGR_WRITE_MAX buffers (64KB), whose
+ * descriptors are in the object `bufs` of the tenant's shmem, with a
+ * single invocation. The segments are sent to the nic in bursts, and
+ * without copying the data if the nic can chain buffers. The netmgr
+ * holds a reference to each buffer until its data is acknowledged.
+ * Returns the number of bytes written, or -EINVAL.
+ */
+#define NETMGR_WRITE_MAX 32
+
+struct netmgr_buf {
+	shm_bm_objid_t objid;
+	u16_t          data_offset;
+	u16_t          data_len;
+};
+
+int netmgr_tcp_shmem_writev(shm_bm_objid_t bufs, int n);
+
+/*
+ * Many connections per thread, for event-driven servers. Connections
+ * are identified by ids, and the calls on them don't block: a thread
+ * waits for the events of all of its connections with `netmgr_poll`.
+ *
+ * The threads that listen on a port share its listening connection,
+ * and the nic spreads the flows of the port across their netmgr rx
+ * threads: a thread accepts (and is the only one to use) the
+ * connections whose SYN its rx thread received. The events of a connection are reported once, until new
+ * ones, so a thread reads its data until `netmgr_conn_read` returns
+ * 0, and writes until the write is short, then awaits NETMGR_EV_OUT.
+ * After a NETMGR_EV_HUP, the thread reads the remaining data, and
+ * closes the connection.
+ */
+#define NETMGR_EV_IN   (1 << 0) /* data to read, or connections to accept */
+#define NETMGR_EV_OUT  (1 << 1) /* room to write after a short write */
+#define NETMGR_EV_HUP  (1 << 2) /* closed by the peer, or reset */
+
+#define NETMGR_POLL_MAX 64
+
+struct netmgr_event {
+	int   conn;
+	u16_t events;
+};
+
+/* Returns the listening connection, or -ENOMEM */
+int netmgr_conn_listen(u32_t ip_addr, u16_t port, u8_t backlog);
+/* Returns a connection accepted by `lconn`, or -EAGAIN if there is none, or -EINVAL */
+int netmgr_conn_accept(int lconn, u32_t *remote_addr, u16_t *remote_port);
+/* Returns the next data received by the connection, as for netmgr_tcp_shmem_read, or 0 if there is none */
+shm_bm_objid_t netmgr_conn_read(int conn, u16_t *data_offset, u16_t *data_len);
+/* As netmgr_tcp_shmem_writev, but returns early if lwip has no room, or -EPIPE if the connection was reset */
+int netmgr_conn_writev(int conn, shm_bm_objid_t bufs, int n);
+int netmgr_conn_close(int conn);
+
+/*
+ * Write up to `n` (at most NETMGR_POLL_MAX) events in the object
+ * `evs` of the tenant's shmem, waiting until there are some, if
+ * `block`. Returns the number of events, or -EINVAL.
+ */
+int netmgr_poll(shm_bm_objid_t evs, int n, int block);
+
 int netmgr_udp_bind(u32_t ip_addr, u16_t port);
 
 shm_bm_objid_t netmgr_udp_shmem_read(u16_t *data_offset, u16_t *data_len, u32_t *remote_addr, u16_t *remote_port);
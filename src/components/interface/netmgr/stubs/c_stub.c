@@ -16,6 +16,32 @@ COS_CLIENT_STUB(shm_bm_objid_t, netmgr_tcp_shmem_read, u16_t *data_offset, u16_t
 	return ret;
 }
 
+COS_CLIENT_STUB(int, netmgr_conn_accept, int lconn, u32_t *remote_addr, u16_t *remote_port)
+{
+	COS_CLIENT_INVCAP;
+	word_t addr, port;
+	int ret;
+
+	ret = cos_sinv_2rets(uc, lconn, 0, 0, 0, &addr, &port);
+	*remote_addr = (u32_t)addr;
+	*remote_port = (u16_t)port;
+
+	return ret;
+}
+
+COS_CLIENT_STUB(shm_bm_objid_t, netmgr_conn_read, int conn, u16_t *data_offset, u16_t *data_len)
+{
+	COS_CLIENT_INVCAP;
+	word_t offset, len;
+	int ret;
+
+	ret = cos_sinv_2rets(uc, conn, 0, 0, 0, &offset, &len);
+	*data_len = (u16_t)len;
+	*data_offset = (u16_t)offset;
+
+	return ret;
+}
+
 COS_CLIENT_STUB(shm_bm_objid_t, netmgr_udp_shmem_read, u16_t *data_offset, u16_t *data_len, u32_t *remote_addr, u16_t *remote_port)
 {
 	COS_CLIENT_INVCAP;
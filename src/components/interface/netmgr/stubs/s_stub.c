@@ -6,6 +6,33 @@ COS_SERVER_3RET_STUB(shm_bm_objid_t, netmgr_tcp_shmem_read)
 	return netmgr_tcp_shmem_read((u16_t *)r1, (u16_t *)r2);
 }
 
+COS_SERVER_3RET_STUB(int, netmgr_conn_accept)
+{
+	u32_t remote_addr;
+	u16_t remote_port;
+	int conn;
+
+	conn = netmgr_conn_accept(p0, &remote_addr, &remote_port);
+
+	*r1 = remote_addr;
+	*r2 = remote_port;
+
+	return conn;
+}
+
+COS_SERVER_3RET_STUB(shm_bm_objid_t, netmgr_conn_read)
+{
+	u16_t data_offset, data_len;
+	shm_bm_objid_t objid;
+
+	objid = netmgr_conn_read(p0, &data_offset, &data_len);
+
+	*r1 = data_offset;
+	*r2 = data_len;
+
+	return objid;
+}
+
 COS_SERVER_3RET_STUB(shm_bm_objid_t, netmgr_udp_shmem_read)
 {
 	u16_t data_offset, data_len, remote_port;
@@ -14,8 +14,8 @@ netshmem_create(void)
 	thdid_t thd = cos_thdid();
 	assert(thd < NETSHMEM_REGION_SZ);
 
-	/* init rx shmem */
-	netshmems[thd].shmsz	= round_up_to_page(shm_bm_size_net_pkt_buf());
+	/* init rx shmem, of whole superpages, so the contigmem maps it with superpages */
+	netshmems[thd].shmsz	= round_up_to_pow2(shm_bm_size_net_pkt_buf(), SUPER_PAGE_SIZE);
 	netshmems[thd].shm_id	= contigmem_shared_alloc_aligned(netshmems[thd].shmsz/PAGE_SIZE, SHM_BM_ALIGN, (vaddr_t *)&mem);
 	netshmems[thd].shm	= shm_bm_create_net_pkt_buf(mem, netshmems[thd].shmsz);
 
@@ -49,6 +49,8 @@ netshmem_map_shmem(cbuf_t shm_id)
 	assert(!netshmems[thd].shm);
 
 	npages	= memmgr_shared_page_map_aligned(shm_id, SHM_BM_ALIGN, (vaddr_t *)&mem);
+	/* The creator of the region must agree on PKT_BUF_NUM, and PKT_BUF_SIZE */
+	assert(npages * PAGE_SIZE == round_up_to_pow2(shm_bm_size_net_pkt_buf(), SUPER_PAGE_SIZE));
 	shm	= shm_bm_create_net_pkt_buf(mem, npages * PAGE_SIZE);
 	assert(shm);
 
@@ -57,14 +59,52 @@ netshmem_map_shmem(cbuf_t shm_id)
 	netshmems[thd].shmsz	= npages * PAGE_SIZE;
 }
 
+void
+netshmem_share(thdid_t thd)
+{
+	thdid_t self = cos_thdid();
+
+	assert(thd != self && thd < NETSHMEM_REGION_SZ && self < NETSHMEM_REGION_SZ);
+	/* The same mapping, with its own cache */
+	netshmems[self] = (struct netshmem) {
+		.shmsz  = netshmems[thd].shmsz,
+		.shm    = netshmems[thd].shm,
+		.shm_id = netshmems[thd].shm_id,
+	};
+}
+
 void
 netshemem_move(thdid_t old, thdid_t new) {
 	assert(old != new && old < NETSHMEM_REGION_SZ);
-	netshmems[new].shm	= netshmems[old].shm;
-	netshmems[new].shm_id	= netshmems[old].shm_id;
-	netshmems[new].shmsz	= netshmems[old].shmsz;
+	/* The cache moves with its region */
+	netshmems[new] = netshmems[old];
+	netshmems[old] = (struct netshmem) { 0 };
+}
+
+struct netshmem_pkt_buf *
+netshmem_pkt_buf_alloc(shm_bm_objid_t *objid)
+{
+	struct netshmem *s = &netshmems[cos_thdid()];
+
+	if (likely(s->ncached > 0)) {
+		*objid = s->cache[--s->ncached];
+		return shm_bm_reuse_net_pkt_buf(s->shm, *objid);
+	}
+
+	return shm_bm_alloc_net_pkt_buf(s->shm, objid);
+}
+
+void
+netshmem_pkt_buf_free(struct netshmem_pkt_buf *obj)
+{
+	struct netshmem *s = &netshmems[cos_thdid()];
+
+	/* Only the buffers of the thread's region are cached */
+	if (unlikely(((word_t)obj & ~(SHM_BM_ALIGN - 1)) != (word_t)s->shm || s->ncached == NETSHMEM_CACHE_SZ)) {
+		shm_bm_free_net_pkt_buf(obj);
+		return;
+	}
+	if (!shm_bm_put_net_pkt_buf(obj)) return;
 
-	netshmems[old].shm = 0;
-	netshmems[old].shm_id = 0;
-	netshmems[old].shmsz = 0;
+	s->cache[s->ncached++] = shm_bm_get_objid_net_pkt_buf(obj);
 }
@@ -4,13 +4,45 @@
 #include <cos_component.h>
 #include <shm_bm.h>
 
-#define PKT_BUF_NUM 64
-#define PKT_BUF_SIZE 2048
+/*
+ * The buffer classes: buffers for standard Ethernet frames, or for
+ * jumbo frames (of a 9000B MTU).
+ */
+#define NETSHMEM_BUF_STD   2048
+#define NETSHMEM_BUF_JUMBO 10240
+
+/*
+ * The number of buffers of each region, and their class. The layout
+ * of a region depends on both, so they can be set by the composition
+ * script (e.g. `constants = [{variable = "PKT_BUF_NUM", value =
+ * "1024"}]`), but must be the same for all of the components sharing
+ * the regions, e.g. the nicmgr, netmgr, and their tenants.
+ */
+#ifndef PKT_BUF_NUM
+#define PKT_BUF_NUM 256
+#endif
+#ifndef PKT_BUF_SIZE
+#define PKT_BUF_SIZE NETSHMEM_BUF_STD
+#endif
+
+/* The MTU of the frames the buffers hold */
+#define NETSHMEM_MTU (PKT_BUF_SIZE >= NETSHMEM_BUF_JUMBO ? 9000 : 1500)
+
+/*
+ * The free buffers cached by each thread, for its region: freeing and
+ * allocating them doesn't touch the bitmap, shared with the other
+ * components using the region. The buffers cached by a thread can't
+ * be allocated by the others, so there are only a few.
+ */
+#define NETSHMEM_CACHE_SZ 16
 
 struct netshmem {
 	size_t shmsz;
 	shm_bm_t shm;
 	cbuf_t shm_id;
+
+	unsigned int   ncached;
+	shm_bm_objid_t cache[NETSHMEM_CACHE_SZ];
 };
 
 /*
@@ -48,7 +80,19 @@ void netshmem_create(void);
 
 cbuf_t netshmem_get_shm_id();
 shm_bm_t netshmem_get_shm();
+
+/*
+ * Allocate and free the buffers of the current thread's region, with
+ * the thread's cache. The buffers of other regions can be freed too.
+ */
+struct netshmem_pkt_buf *netshmem_pkt_buf_alloc(shm_bm_objid_t *objid);
+void netshmem_pkt_buf_free(struct netshmem_pkt_buf *obj);
 void netshemem_move(thdid_t old, thdid_t new);
+/*
+ * Use the region of thread `thd` from the current thread too, e.g. to
+ * receive packets on its behalf.
+ */
+void netshmem_share(thdid_t thd);
 
 /* map a shmem for a client component */
 void netshmem_map_shmem(cbuf_t shm_id);
@@ -72,4 +116,73 @@ static inline void * netshmem_get_tailroom(struct netshmem_pkt_buf *pkt_buf)
 {
 	return (char *)pkt_buf + (PKT_BUF_SIZE - NETSHMEM_TAILROOM);
 }
+
+/*
+ * The latency trace of a request, with the TSC at each stage from its
+ * reception to the sending of its reply in the same buffer, which the
+ * nicmgr records (see nic_trace_record). It is in the tailroom, after
+ * the room of the nic's shared info of the mbufs sent (which is
+ * smaller than NETSHMEM_TRACE_OFF).
+ */
+#define NETSHMEM_TRACE_ENABLE 0
+#define NETSHMEM_TRACE_OFF    64
+
+enum netshmem_trace_stage {
+	NETSHMEM_TRACE_RX = 0,   /* polled by the nicmgr */
+	NETSHMEM_TRACE_DELIVER,  /* given to the tenant, after its wakeup */
+	NETSHMEM_TRACE_APP,      /* processed by the application, e.g. memcached ... */
+	NETSHMEM_TRACE_APP_DONE, /* ...until here */
+	NETSHMEM_TRACE_WRITE,    /* written to the stack */
+	NETSHMEM_TRACE_NSTAGES
+};
+
+struct netshmem_trace {
+	u64_t ts[NETSHMEM_TRACE_NSTAGES];
+};
+
+static inline struct netshmem_trace * netshmem_get_trace(struct netshmem_pkt_buf *pkt_buf)
+{
+	return (struct netshmem_trace *)((char *)netshmem_get_tailroom(pkt_buf) + NETSHMEM_TRACE_OFF);
+}
+
+static inline void netshmem_trace_stamp(struct netshmem_pkt_buf *pkt_buf, enum netshmem_trace_stage stage)
+{
+	u64_t now;
+
+	if (!NETSHMEM_TRACE_ENABLE) return;
+	rdtscll(now);
+	netshmem_get_trace(pkt_buf)->ts[stage] = now;
+}
+
+/*
+ * The metadata of a received packet, as the NIC computed it (see
+ * cos_get_packet_meta), which the nicmgr writes in the tailroom, after
+ * the trace. A field is only valid with its flag: the stacks can
+ * e.g. skip the checksums the NIC checked, dispatch with the RSS hash,
+ * or measure the latency from the NIC's timestamp (of its own clock).
+ */
+#define NETSHMEM_META_OFF (NETSHMEM_TRACE_OFF + sizeof(struct netshmem_trace))
+
+#define NETSHMEM_META_RSS     (1 << 0)
+#define NETSHMEM_META_TS      (1 << 1)
+#define NETSHMEM_META_PTYPE   (1 << 2)
+#define NETSHMEM_META_IP_CSUM (1 << 3) /* the IPv4 checksum is good */
+#define NETSHMEM_META_L4_CSUM (1 << 4) /* the TCP or UDP checksum is good */
+
+#define NETSHMEM_PTYPE_IPV4 (1 << 0)
+#define NETSHMEM_PTYPE_TCP  (1 << 1)
+#define NETSHMEM_PTYPE_UDP  (1 << 2)
+#define NETSHMEM_PTYPE_FRAG (1 << 3)
+
+struct netshmem_meta {
+	u64_t rx_ts;
+	u32_t rss_hash;
+	u16_t ptype;
+	u16_t flags;
+};
+
+static inline struct netshmem_meta * netshmem_get_meta(struct netshmem_pkt_buf *pkt_buf)
+{
+	return (struct netshmem_meta *)((char *)netshmem_get_tailroom(pkt_buf) + NETSHMEM_META_OFF);
+}
 #endif
@@ -9,8 +9,26 @@
 void nic_shmem_map(cbuf_t shm_id);
 
 int nic_send_packet(shm_bm_objid_t pktid, u16_t pkt_offset, u16_t pkt_len);
+/*
+ * Receive the TCP and UDP packets of `port` (in network byte order)
+ * at `ip_addr`, or of all of its ports if `port` is 0, e.g. for a
+ * VM. The sessions of the threads bound to the same port form a
+ * group, and its flows are spread across them.
+ */
 int nic_bind_port(u32_t ip_addr, u16_t port);
+/*
+ * Only send packets, from the calling thread's shmem region (mapped
+ * with nic_shmem_map), without receiving any.
+ */
+int nic_bind_tx(void);
 u64_t nic_get_port_mac_address(u16_t port);
+/*
+ * The MAC address of the neighbor `ip` (its bytes in tx order), as
+ * learned by the nic from the ARP packets it received. If it isn't
+ * known, this returns 0, and the nic requests it, so callers should
+ * cache the addresses, and ask again later.
+ */
+u64_t nic_neigh_lookup(u32_t ip);
 
 /*
  * caller will be suspended until there is a packet for this thread,
@@ -18,4 +36,75 @@ u64_t nic_get_port_mac_address(u16_t port);
  * and return its shmem objectid.
  */
 shm_bm_objid_t nic_get_a_packet(u16_t *pkt_len);
+
+/*
+ * The batched versions take an array of up to NIC_BATCH_MAX
+ * descriptors, in the object `descs` of the caller's shmem region,
+ * so that many packets only cost one invocation (and one tx burst).
+ */
+#define NIC_BATCH_MAX 32
+
+struct nic_pkt_desc {
+	shm_bm_objid_t objid;
+	u16_t          pkt_offset;
+	u16_t          pkt_len;
+	u16_t          flags;
+	u16_t          tso_mss; /* with NIC_PKT_TSO, the TCP payload of each segment */
+};
+
+/*
+ * A packet sent can span the buffers of consecutive descriptors (e.g.
+ * the headers, then the payload of several buffers, up to 64KB), all
+ * but the last with NIC_PKT_MORE. With NIC_PKT_TSO on its first
+ * descriptor, a TCP/IPv4 packet is segmented by the NIC into segments
+ * of tso_mss bytes of payload, with the headers of the first buffer.
+ * Each descriptor sent gives the nic a reference to its object.
+ */
+#define NIC_PKT_MORE (1 << 0)
+#define NIC_PKT_TSO  (1 << 1)
+
+/*
+ * Like nic_get_a_packet, but fills in the descriptors with the packets
+ * available once there is one, up to `n`. Returns the number of
+ * packets, or -EINVAL if the descriptors aren't valid.
+ */
+int nic_get_packets(shm_bm_objid_t descs, int n);
+/*
+ * Send the packets of the `n` descriptors, and return the number of
+ * descriptors sent (or queued), -EINVAL, or -ENOTSUP if the first
+ * packet spans several descriptors, or needs TSO, and the NIC can't
+ * chain and segment packets.
+ */
+int nic_send_packets(shm_bm_objid_t descs, int n);
+/* The descriptor flags nic_send_packets supports (NIC_PKT_MORE, NIC_PKT_TSO) */
+int nic_tx_flags(void);
+
+/*
+ * The tx QoS of the session of thread `thd` (or of the caller, if 0),
+ * which must be of the caller's component. Its packets are sent after
+ * those of the sessions of a lower class (of NIC_TX_CLASSES, 0 for the
+ * latency-critical ones), and in proportion to its weight among those
+ * of its class, at most at `rate` Mbit/s (unless 0), with bursts of
+ * `burst` bytes. `class_weight` is nic_tx_qos_pack(class, weight).
+ * Returns 0, or -EINVAL, or -EPERM.
+ */
+#define NIC_TX_CLASSES 4
+
+static inline u32_t
+nic_tx_qos_pack(u16_t class, u16_t weight)
+{
+	return ((u32_t)class << 16) | weight;
+}
+
+int nic_tx_qos_set(thdid_t thd, u32_t class_weight, u32_t rate, u32_t burst);
+
+/*
+ * The budget of the session of thread `thd` (or of the caller, if 0),
+ * which must be of the caller's component: the usec, per window of
+ * the manager, its polling threads spend on the packets received for
+ * it, past which they are dropped until the next window (0 if
+ * unlimited). It can't be over the manager's own budget, if it has
+ * one. Returns 0, or -EINVAL, or -EPERM.
+ */
+int nic_cpu_budget_set(thdid_t thd, u32_t usec);
 #endif /* NIC_H */
@@ -0,0 +1,47 @@
+#ifndef PMU_H
+#define PMU_H
+
+#include <cos_types.h>
+
+/*
+ * Architectural events, as event | (umask << 8), and some common
+ * model-specific ones (these are Skylake's and later).
+ */
+#define PMU_EVT_LLC_REFS     0x4f2e
+#define PMU_EVT_LLC_MISSES   0x412e
+#define PMU_EVT_BRANCHES     0x00c4
+#define PMU_EVT_BRANCH_MISSES 0x00c5
+#define PMU_EVT_DTLB_LD_WALKS 0x0108 /* load misses that cause a page walk */
+#define PMU_EVT_ITLB_WALKS   0x0185  /* misses that cause a page walk */
+
+/* The fixed counters, counted for each thread that programs a counter */
+#define PMU_FIXED_INSTRS      0
+#define PMU_FIXED_CYCLES      1
+#define PMU_FIXED_REF_CYCLES  2
+
+/* The number of general-purpose counters, 0 if they can't be used */
+int pmu_ncounters(void);
+/*
+ * Count evt (PMU_EVT_*) in counter ctr of the invoking thread, from 0,
+ * or stop counting with evt 0. The thread then reads the counter, and
+ * the fixed ones, with rdpmc (see lib/ubench/ubench_pmu.h).
+ */
+int pmu_program(unsigned long ctr, unsigned long evt);
+/* Stop, and clear, all of the invoking thread's counters */
+int pmu_disable(void);
+
+/*
+ * Sample the execution of the invoking thread's core every period
+ * cycles (at most 2^31), or stop with 0. The samples are recorded in
+ * the core's kernel trace ring (see COS_TRACE_SAMPLE in cos_types.h).
+ */
+int     pmu_sample(unsigned long period);
+/* Map core's trace ring into the invoker, once; returns its address, or 0 */
+vaddr_t pmu_sample_ring(coreid_t core);
+/*
+ * The nth (from 0) of the components using the page-table with the id
+ * of a sample, or 0: components in a shared address space share it.
+ */
+compid_t pmu_sample_comp(unsigned long pgtbl, int nth);
+
+#endif /* PMU_H */
@@ -1,10 +1,11 @@
 #include <sched.h>
 #include <cos_thd_init.h>
+#include <ps.h>
 
 thdid_t
 sched_thd_create(cos_thd_fn_t fn, void *data)
 {
-	thdclosure_index_t idx = cos_thd_init_alloc(fn, data);
+	thdclosure_index_t idx = cos_thd_pool_alloc(fn, data);
 
 	if (idx < 1) return 0;
 
@@ -33,3 +34,30 @@ sched_aep_create(struct cos_aep_info *aep, cos_aepthd_fn_t fn, void *data, int o
 
 	return ret;
 }
+
+int
+sched_thd_wakeup_lazy(struct sched_wakeups *w, thdid_t tid)
+{
+	struct sched_wakeups_core *c;
+	thdid_t     curr = cos_thdid();
+	cpuid_t     core = cos_cpuid();
+	tcap_prio_t prio, curr_prio;
+	int         i;
+
+	if (!w || tid >= MAX_NUM_THREADS || curr >= MAX_NUM_THREADS) return sched_thd_wakeup(tid);
+	prio      = ps_load(&w->thds[tid].prio);
+	curr_prio = ps_load(&w->thds[curr].prio);
+	/* Wake now the threads of other cores, and those that would preempt us (lower is higher) */
+	if (!prio || !curr_prio || ps_load(&w->thds[tid].core) != core || prio < curr_prio) return sched_thd_wakeup(tid);
+
+	c = &w->cores[core];
+	for (i = 0; i < SCHED_WAKEUPS_SLOTS; i++) {
+		if (ps_load(&c->woken[i]) || !ps_cas(&c->woken[i], 0, tid)) continue;
+		/* The scheduler wakes it before its next decision on this core */
+		ps_faa(&c->nwoken, 1);
+
+		return 0;
+	}
+
+	return sched_thd_wakeup(tid);
+}
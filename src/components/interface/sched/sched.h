@@ -29,6 +29,11 @@ int      sched_thd_wakeup(thdid_t t);
 int      COS_STUB_DECL(sched_thd_wakeup)(thdid_t t);
 int      sched_debug_thd_state(thdid_t t);
 int      COS_STUB_DECL(sched_debug_thd_state)(thdid_t t);
+/*
+ * Block until `sched_thd_wakeup`. If we wait for thread `dep_id`
+ * (e.g. a lock owner), the scheduler can execute it on our behalf
+ * until the wakeup, for priority inheritance.
+ */
 int      sched_thd_block(thdid_t dep_id);
 int      COS_STUB_DECL(sched_thd_block)(thdid_t dep_id);
 cycles_t sched_thd_block_timeout(thdid_t dep_id, cycles_t abs_timeout);
@@ -45,6 +50,8 @@ sched_blkpt_id_t sched_blkpt_alloc(void);
 int sched_blkpt_free(sched_blkpt_id_t id);
 int sched_blkpt_trigger(sched_blkpt_id_t blkpt, sched_blkpt_epoch_t epoch, int single);
 int sched_blkpt_block(sched_blkpt_id_t blkpt, sched_blkpt_epoch_t epoch, thdid_t dependency);
+/* Trigger `epoch` on `from`, moving its blocked threads to `to` rather than waking them */
+int sched_blkpt_morph(sched_blkpt_id_t from, sched_blkpt_id_t to, sched_blkpt_epoch_t epoch);
 
 thdid_t sched_aep_create(struct cos_aep_info *aep, cos_aepthd_fn_t fn, void *data, int owntc, cos_channelkey_t key, microsec_t ipiwin, u32_t ipimax); /* lib.c */
 thdid_t sched_aep_create_closure(thdclosure_index_t id, int owntc, cos_channelkey_t key, microsec_t ipiwin, u32_t ipimax, arcvcap_t *rcv);
@@ -59,6 +66,96 @@ int COS_STUB_DECL(sched_thd_delete)(thdid_t tid);
 int sched_thd_exit(void);
 int COS_STUB_DECL(sched_thd_exit)(void);
 
+/*
+ * Scheduling latency histograms for thread `tid`: counts of its
+ * wakeup-to-dispatch latencies (`wait`) and execution lengths (`run`),
+ * with bucket `i` holding samples of `[2^i, 2^(i+1))` cycles (the last
+ * bucket also holds longer samples). These are copied into the
+ * `struct sched_hist` at the start of the shared memory `buf`
+ * (allocated with `memmgr_shared_page_alloc`); schedulers map the
+ * last buffer a core used, so clients should reuse it. Returns `0`,
+ * or a negative error value, e.g. if the scheduler doesn't keep the
+ * histograms.
+ */
+#define SCHED_HIST_BUCKETS 32
+
+struct sched_hist {
+	u32_t wait[SCHED_HIST_BUCKETS];
+	u32_t run[SCHED_HIST_BUCKETS];
+};
+
+int sched_thd_hist(thdid_t tid, cbuf_t buf);
+
+/*
+ * Print the scheduling events (block, wakeup, dispatch, blockpoint
+ * wait and trigger, ...) recorded on the calling core since the last
+ * call, one `slmtrace` line each, for tools/trace_chrome.py. Returns
+ * `0`, or a negative error value, e.g. if the scheduler doesn't
+ * record them (see `slm_trace.h`).
+ */
+int sched_trace_print(void);
+
+/*
+ * A hint of whether thread `tid` is currently running on another
+ * core, e.g. to decide if it is worth spinning while it holds a lock
+ * (see `sync_lock`). Returns `1` if it likely is, and `0` otherwise.
+ */
+int sched_thd_running(thdid_t tid);
+
+/*
+ * Periodic execution of the calling thread, without a timer manager:
+ * `sched_thd_periodic` makes its releases `period` microseconds apart
+ * (the first being now), or stops them if `period` is `0`, and
+ * `sched_thd_wait_next_period` blocks until the next release. The
+ * releases are a period after the previous ones, so they don't drift,
+ * and those the thread overran are skipped. The latter returns the
+ * number of skipped releases, or `-EINVAL` if the thread isn't
+ * periodic.
+ */
+int sched_thd_periodic(microsec_t period);
+int sched_thd_wait_next_period(void);
+
+/*
+ * Lazy wakeups, that avoid invoking the scheduler when the woken
+ * thread wouldn't preempt the waker anyway. The scheduler shares the
+ * priority and core of its threads, and a ring of deferred wakeups
+ * per core, in `struct sched_wakeups` (mapped by the clients with
+ * `memmgr_shared_page_map` from the id `sched_wakeups_shared`
+ * returns, or `0` if the scheduler doesn't share it). A thread woken
+ * with `sched_thd_wakeup_lazy` by a thread on its core, with at least
+ * the same priority, is added to the core's ring rather than woken,
+ * and the scheduler wakes it before its next scheduling decision on
+ * the core (e.g. when the waker blocks, or at the next tick). Other
+ * wakeups, and those that don't fit in the ring, invoke
+ * `sched_thd_wakeup`.
+ *
+ * The clients of a scheduler trust each other not to corrupt the
+ * shared memory, but can at most delay, or spuriously cause, the
+ * wakeups of the threads of their core.
+ */
+#define SCHED_WAKEUPS_SLOTS 32
+
+struct sched_wakeups_core {
+	/* the number of woken threads in the ring */
+	unsigned long nwoken;
+	/* the ids of the woken threads, or 0 */
+	unsigned long woken[SCHED_WAKEUPS_SLOTS];
+} CACHE_ALIGNED;
+
+struct sched_wakeups_thd {
+	/* 0 if unknown */
+	tcap_prio_t prio;
+	cpuid_t     core;
+};
+
+struct sched_wakeups {
+	struct sched_wakeups_core cores[NUM_CPU];
+	struct sched_wakeups_thd  thds[MAX_NUM_THREADS];
+};
+
+cbuf_t sched_wakeups_shared(void);
+int    sched_thd_wakeup_lazy(struct sched_wakeups *w, thdid_t tid); /* lib.c */
+
 /* TODO: lock i/f */
 
 #endif /* SCHED_H */
@@ -14,3 +14,10 @@ COS_CLIENT_STUB(int, syncipc_reply_wait, int ipc_ep, word_t a0, word_t a1, word_
 
 	return cos_sinv_2rets(uc, ipc_ep, a0, a1, 0, r0, r1);
 }
+
+COS_CLIENT_STUB(int, syncipc_reply_wait_batch, int ipc_ep, word_t a0, word_t a1, unsigned int batch, word_t *r0, word_t *r1)
+{
+	COS_CLIENT_INVCAP;
+
+	return cos_sinv_2rets(uc, ipc_ep, a0, a1, batch, r0, r1);
+}
@@ -10,3 +10,8 @@ COS_SERVER_3RET_STUB(int, syncipc_reply_wait)
 {
 	return syncipc_reply_wait((int)p0, p1, p2, r1, r2);
 }
+
+COS_SERVER_3RET_STUB(int, syncipc_reply_wait_batch)
+{
+	return syncipc_reply_wait_batch((int)p0, p1, p2, (unsigned int)p3, r1, r2);
+}
@@ -13,7 +13,10 @@
  * `syncipc_call` invokes the IPC endpoint (`ipc_ep`), which is an
  * opaque identifier for an endpoint, passing two arguments, and
  * awaits two reply arguments. Another thread, rendezvousing on the
- * endpoint, is the communicating pair.
+ * endpoint, is the communicating pair. Concurrent calls are served in
+ * FIFO order, and the server executes with the caller's priority and
+ * budget. Returns `-EAGAIN` if no server has yet waited on the
+ * endpoint.
  */
 int syncipc_call(int ipc_ep, word_t arg0, word_t arg1, word_t *ret0, word_t *ret1);
 
@@ -26,4 +29,12 @@ int syncipc_call(int ipc_ep, word_t arg0, word_t arg1, word_t *ret0, word_t *ret
  */
 int syncipc_reply_wait(int ipc_ep, word_t arg0, word_t arg1, word_t *ret0, word_t *ret1);
 
+/**
+ * `syncipc_reply_wait_batch` is `syncipc_reply_wait`, but if calls
+ * are queued, the next is received without a scheduling decision, up
+ * to `batch` times in a row. Multiple server threads can wait on an
+ * endpoint, each serving one call at a time.
+ */
+int syncipc_reply_wait_batch(int ipc_ep, word_t arg0, word_t arg1, unsigned int batch, word_t *ret0, word_t *ret1);
+
 #endif /* SYNCIPC_H */
@@ -27,13 +27,17 @@ typedef enum {
  * Register a timer.
  *
  * - @usecs - The time to timeout in microseconds.
+ * - @slack - How much later than `usecs` the timer may expire, in
+ *            microseconds. The manager merges the expiries of timers
+ *            whose windows overlap into a single wakeup (as with
+ *            `timer_slack_ns` for Linux timers).
  * - @tmr_flags_t flags - The type of the timer.
  * - @return - The ID of the timer that have been created.
  *
  *     - `0` on success, and
  *     - `!0` if a timer cannot be created.
  */
- tmr_id_t tmrmgr_create(unsigned int usecs, tmr_flags_t flags);
+ tmr_id_t tmrmgr_create(unsigned int usecs, unsigned int slack, tmr_flags_t flags);
 
 /**
  * Teardown a timer.
@@ -87,4 +91,11 @@ typedef enum {
 int tmrmgr_evt_set(tmr_id_t id, evt_res_id_t rid);
 evt_res_id_t tmrmgr_evt_get(tmr_id_t id);
 
+/**
+ * The number of merged wakeups: timer expiries that shared a wakeup
+ * of the manager with an earlier expiry, rather than requiring their
+ * own.
+ */
+unsigned long tmrmgr_nmerged(void);
+
 #endif /* TMRMGR_H */
@@ -0,0 +1,220 @@
+#include <cos_component.h>
+#include <ps.h>
+#include <errno.h>
+#include <sched.h>
+#include <bitmap.h>
+#include <ainv.h>
+
+/*
+ * The client side: the completion ring is created by the client, and
+ * the server's submission ring is mapped.
+ */
+
+int
+ainv_init(struct ainv *a, unsigned int depth, ainv_attach_fn_t attach, ainv_sq_fn_t sq)
+{
+	chan_id_t sq_id;
+	int       ret;
+
+	depth = nlepow2(depth);
+	*a    = (struct ainv) {
+		.tag   = 1,
+		.depth = depth,
+	};
+	if (chan_init(&a->cq, sizeof(struct ainv_cmpl), depth, CHAN_MPSC)) return -ENOMEM;
+	if (chan_rcv_init(&a->cq_r, &a->cq)) ERR_THROW(-ENOMEM, free);
+
+	sq_id = sq();
+	if (!sq_id) ERR_THROW(-ENOENT, rcv);
+	if (chan_snd_init_with(&a->sq, sq_id, sizeof(struct ainv_req), AINV_SQ_SLOTS, CHAN_MPMC)) ERR_THROW(-ENOENT, rcv);
+	a->session = attach(a->cq.meta.id, depth);
+	if (!a->session) ERR_THROW(-ENOENT, rcv);
+
+	return 0;
+rcv:
+	chan_rcv_teardown(&a->cq_r);
+free:
+	chan_teardown(&a->cq);
+
+	return ret;
+}
+
+word_t
+ainv_call(struct ainv *a, word_t op, word_t p0, word_t p1, word_t p2, word_t p3)
+{
+	struct ainv_req r = {
+		.session = a->session,
+		.op      = op,
+		.tag     = a->tag,
+		.args    = { p0, p1, p2, p3 },
+	};
+
+	/* The completion ring must have room for the completions of all of the requests in flight */
+	if (a->inflight == a->depth) return 0;
+	if (chan_send(&a->sq, &r, 0)) return 0;
+	a->inflight++;
+	/* 0 isn't a tag */
+	a->tag = a->tag + 1 ? a->tag + 1 : 1;
+
+	return r.tag;
+}
+
+static inline int
+ainv_recv(struct ainv *a, struct ainv_cmpl *c, chan_comm_t flags)
+{
+	int ret;
+
+	if (a->inflight == 0) return -EINVAL;
+	ret = chan_recv(&a->cq_r, c, flags);
+	if (ret == CHAN_TRY_AGAIN) return -EAGAIN;
+	if (ret) return -EINVAL;
+	a->inflight--;
+
+	return 0;
+}
+
+int
+ainv_wait(struct ainv *a, struct ainv_cmpl *c)
+{
+	return ainv_recv(a, c, 0);
+}
+
+int
+ainv_poll(struct ainv *a, struct ainv_cmpl *c)
+{
+	return ainv_recv(a, c, CHAN_NONBLOCKING);
+}
+
+/*
+ * The server side: the sessions of the clients, for all of the
+ * asynchronous interfaces, and the submission ring they share.
+ */
+
+/* A session's handle is its index, and a random key above it */
+#define AINV_SESSION_IDX(h)  ((h) & 0xFFFF)
+/* The handle of a session being attached, that no request holds */
+#define AINV_SESSION_CLAIMED 1
+
+COS_STATIC_ASSERT(AINV_SESSIONS_MAX <= 0xFFFF, "The index of a session must fit in its handle");
+
+struct ainv_session {
+	/* 0 if the session is free */
+	word_t          handle;
+	invtoken_t      token;
+	struct ainv_op *ops;
+	unsigned int    nops;
+	struct chan_snd cq;
+};
+
+static struct ainv_session ainv_sessions[AINV_SESSIONS_MAX];
+static struct chan         ainv_sq;
+static struct chan_rcv     ainv_sq_r;
+
+/* The descriptions of the functions of the asynchronous interfaces, see the stubs */
+extern struct ainv_op __cosrt_ainv_start[], __cosrt_ainv_end[];
+
+int
+ainv_server_init(void)
+{
+	if (chan_init(&ainv_sq, sizeof(struct ainv_req), AINV_SQ_SLOTS, CHAN_MPMC)) return -ENOMEM;
+	if (chan_rcv_init(&ainv_sq_r, &ainv_sq)) {
+		chan_teardown(&ainv_sq);
+
+		return -ENOMEM;
+	}
+
+	return 0;
+}
+
+word_t
+ainv_server_sq(void)
+{
+	return ainv_sq.meta.id;
+}
+
+word_t
+ainv_server_attach(word_t cq, word_t depth, const char *iface)
+{
+	struct ainv_session *s = NULL;
+	struct ainv_op      *op;
+	word_t               handle;
+	int                  i;
+
+	if (!ainv_sq.meta.id || depth == 0 || (depth & (depth - 1))) return 0;
+
+	for (i = 0; i < AINV_SESSIONS_MAX; i++) {
+		s = &ainv_sessions[i];
+		if (ps_load(&s->handle) == 0 && ps_cas(&s->handle, 0, AINV_SESSION_CLAIMED)) break;
+	}
+	if (i == AINV_SESSIONS_MAX) return 0;
+
+	/* An interface's functions are contiguous, as they are described by its stubs' object */
+	for (op = __cosrt_ainv_start; op < __cosrt_ainv_end && op->iface != iface; op++) ;
+	s->ops  = op;
+	s->nops = 0;
+	for (; op < __cosrt_ainv_end && op->iface == iface; op++) s->nops++;
+	s->token = cos_inv_token();
+	if (chan_snd_init_with(&s->cq, cq, sizeof(struct ainv_cmpl), depth, CHAN_MPSC)) {
+		ps_store(&s->handle, 0);
+
+		return 0;
+	}
+
+	/* The requests of other clients can't guess the key */
+	handle = ((((word_t)((ps_tsc() * 0x9E3779B97F4A7C15ULL) >> 32)) | 1) << 16) | i;
+	ps_store(&s->handle, handle);
+
+	return handle;
+}
+
+/* Set the invocation token of the current thread, for `cos_inv_token` (see `get_stk_data`) */
+static inline void
+ainv_inv_token_set(invtoken_t token)
+{
+	unsigned long sp = (unsigned long)&token;
+
+	*(unsigned long *)((sp & ~(COS_STACK_SZ - 1)) + COS_STACK_SZ - INVTOKEN_OFFSET * sizeof(unsigned long)) = token;
+}
+
+static void
+ainv_serve(struct ainv_req *r)
+{
+	struct ainv_session *s;
+	struct ainv_cmpl     c = { .tag = r->tag };
+
+	if (AINV_SESSION_IDX(r->session) >= AINV_SESSIONS_MAX) return;
+	s = &ainv_sessions[AINV_SESSION_IDX(r->session)];
+	/* A forged handle */
+	if (ps_load(&s->handle) != r->session) return;
+
+	if (r->op < s->nops) {
+		/* The function executes on behalf of the client */
+		ainv_inv_token_set(s->token);
+		c.ret = s->ops[r->op].fn(r->args[0], r->args[1], r->args[2], r->args[3], &c.r1, &c.r2);
+	} else {
+		c.ret = (word_t)-EINVAL;
+	}
+	/*
+	 * The client keeps room for the completion (see ainv_call), so
+	 * a full ring is the client's fault, and it loses the completion.
+	 */
+	chan_send(&s->cq, &c, CHAN_NONBLOCKING);
+}
+
+static void
+ainv_worker(void *d)
+{
+	struct ainv_req reqs[AINV_BATCH];
+	int             n, i;
+
+	while (1) {
+		n = chan_recv_n(&ainv_sq_r, reqs, AINV_BATCH, 0);
+		for (i = 0; i < n; i++) ainv_serve(&reqs[i]);
+	}
+}
+
+thdid_t
+ainv_server_worker_create(void)
+{
+	return sched_thd_create(ainv_worker, NULL);
+}
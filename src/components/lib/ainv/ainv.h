@@ -0,0 +1,182 @@
+#ifndef AINV_H
+#define AINV_H
+
+/***
+ * Asynchronous invocations of a server's interface functions. Rather
+ * than a synchronous invocation that executes the server's function
+ * on the client's thread, a client submits requests to the server's
+ * submission ring (a `CHAN_MPMC` channel shared by all of its
+ * clients), and continues. The server's worker threads, on the cores
+ * the server dedicates to them, execute the requests, and post their
+ * completions (the return values) on the client's completion ring
+ * (a channel created by the client), in the style of io_uring. Thus a
+ * client can overlap several invocations of one, or several servers,
+ * with its own execution.
+ *
+ * The stubs for asynchronous invocations are generated from the
+ * interface's `stubs.S`, and linked by the composer into the servers
+ * whose export of the interface is declared `async = true` in the
+ * composition script (in `implements`), and into their clients. For
+ * each interface function `fn` (in the order of `stubs.S`), a client
+ * gets `fn_async(a, p0, p1, p2, p3)`, that takes the words of the
+ * invocation (as `cos_sinv`), submits the request, and returns its
+ * tag:
+ *
+ *     AINV_INTERFACE(pong);
+ *     AINV_STUB_DECL(pong_args);
+ *
+ *     struct ainv a;
+ *     struct ainv_cmpl c;
+ *     word_t t;
+ *
+ *     if (AINV_INIT(&a, 16, pong)) BUG();
+ *     t = pong_args_async(&a, 1, 2, 3, 4);
+ *     ...
+ *     ainv_wait(&a, &c);
+ *     assert(c.tag == t);
+ *
+ * The server's functions are called with the 4 words, and pointers
+ * to 2 more return values: the C stub of functions with
+ * `cos_asm_stub_indirect` (`s_stub.c`), and the function itself for
+ * the others. They execute with the client's invocation token, so
+ * `cos_inv_token` identifies the client. The server initializes the
+ * submission ring with `ainv_server_init` in `cos_init`, and creates
+ * its workers with `ainv_server_worker_create` on each of their
+ * cores (e.g. in `parallel_main`). Both sides depend on this library.
+ *
+ * Limitations: an `ainv` must be used by one client thread at a
+ * time. The clients of a server trust each other not to corrupt the
+ * shared submission ring (as for the producers of any `CHAN_MPMC`
+ * channel), but the requests are only executed for the client whose
+ * session's (random) handle they hold. Only x86_64 has the stubs.
+ */
+
+#include <cos_component.h>
+#include <chan.h>
+
+/* The number of requests in the submission ring of a server */
+#ifndef AINV_SQ_SLOTS
+#define AINV_SQ_SLOTS 256
+#endif
+
+/* The number of clients' sessions, for all of the server's asynchronous interfaces */
+#ifndef AINV_SESSIONS_MAX
+#define AINV_SESSIONS_MAX 64
+#endif
+
+/* The maximum number of requests a worker receives at once */
+#ifndef AINV_BATCH
+#define AINV_BATCH 16
+#endif
+
+/* A request, in the submission ring */
+struct ainv_req {
+	word_t session; /* the handle of the client's session */
+	word_t op;      /* the function's number in the interface */
+	word_t tag;
+	word_t args[4];
+};
+
+/* The completion of a request, in the client's completion ring */
+struct ainv_cmpl {
+	word_t tag;
+	word_t ret, r1, r2;
+};
+
+/* A client's asynchronous invocations of an interface of a server */
+struct ainv {
+	struct chan     cq;
+	struct chan_rcv cq_r;
+	struct chan_snd sq;
+	word_t          session;
+	/* the tag of the next request */
+	word_t          tag;
+	/* the requests whose completion hasn't been received, at most `depth` */
+	unsigned int    inflight, depth;
+};
+
+/* The functions of the server's description of its interface, see the stubs */
+typedef word_t (*ainv_fn_t)(word_t p0, word_t p1, word_t p2, word_t p3, word_t *r1, word_t *r2);
+
+struct ainv_op {
+	const char *iface;
+	ainv_fn_t   fn;
+};
+
+typedef word_t (*ainv_attach_fn_t)(word_t cq, word_t depth);
+typedef word_t (*ainv_sq_fn_t)(void);
+
+/* The declarations of the invocations of an interface that set up its asynchronous invocations */
+#define AINV_INTERFACE(iface)                                   \
+	word_t iface##_ainv_attach(word_t cq, word_t depth);   \
+	word_t iface##_ainv_sq(void)
+
+/* The declaration of the asynchronous stub of the function */
+#define AINV_STUB_DECL(fn) word_t fn##_async(struct ainv *a, word_t p0, word_t p1, word_t p2, word_t p3)
+
+#define AINV_INIT(a, depth, iface) ainv_init(a, depth, iface##_ainv_attach, iface##_ainv_sq)
+
+/**
+ * Set up the asynchronous invocations of a server's interface (see
+ * `AINV_INIT`): create the completion ring, and attach it to the
+ * server.
+ *
+ * - @a      - the client's `ainv` to initialize
+ * - @depth  - the maximum number of requests in flight
+ * - @attach - the interface's `_ainv_attach` invocation
+ * - @sq     - the interface's `_ainv_sq` invocation
+ * - @return - `0` on success, `-ENOMEM` if the completion ring can't
+ *             be created, or `-ENOENT` if the server didn't accept
+ *             the session.
+ */
+int ainv_init(struct ainv *a, unsigned int depth, ainv_attach_fn_t attach, ainv_sq_fn_t sq);
+
+/**
+ * Submit a request for the interface's function `op`. The
+ * `fn_async` stubs call this with the function's number. Blocks if
+ * the server's submission ring is full.
+ *
+ * - @a      - the client's `ainv`
+ * - @op     - the function's number
+ * - @p*     - the invocation's arguments
+ * - @return - the request's tag, or `0` if `depth` requests are
+ *             already in flight: their completions must be received
+ *             first.
+ */
+word_t ainv_call(struct ainv *a, word_t op, word_t p0, word_t p1, word_t p2, word_t p3);
+
+/**
+ * Receive the next completion. Completions are received in the
+ * order the requests completed, which isn't the order of their
+ * submission, as several workers can execute them.
+ *
+ * - @a      - the client's `ainv`
+ * - @c      - the completion, with the tag of its request
+ * - @return - `0` on success, `-EINVAL` if no request is in flight
+ *             (for `ainv_wait`, that would otherwise block forever),
+ *             or `-EAGAIN` if none has completed (for `ainv_poll`).
+ */
+int ainv_wait(struct ainv *a, struct ainv_cmpl *c);
+int ainv_poll(struct ainv *a, struct ainv_cmpl *c);
+
+/**
+ * Initialize the server's submission ring, before any client
+ * attaches.
+ *
+ * - @return - `0` on success, `-ENOMEM` if the ring can't be created.
+ */
+int ainv_server_init(void);
+
+/**
+ * Create a worker thread, that executes the requests, on the current
+ * core.
+ *
+ * - @return - the worker's id, or `0` on failure.
+ */
+thdid_t ainv_server_worker_create(void);
+
+/* The implementations of the `_ainv_attach` and `_ainv_sq` invocations of all interfaces, see the stubs */
+word_t ainv_server_attach(word_t cq, word_t depth, const char *iface);
+word_t ainv_server_sq(void);
+
+#endif /* AINV_H */
@@ -0,0 +1,408 @@
+#include <errno.h>
+#include <string.h>
+#include <cos_component.h>
+#include <cos_types.h>
+#include <ps.h>
+#include <memmgr.h>
+
+/***
+ * A malloc for the components, that replaces musl's when `arena` is
+ * in their LIBRARY_DEPENDENCIES (its object is linked before libc,
+ * so none of musl's malloc is).
+ *
+ * The small objects (up to ARENA_SMALL_MAX bytes) are carved out of
+ * spans of ARENA_SPAN_SZ bytes, aligned on their size, so the span of
+ * an object is its address, masked. Each span holds the objects of a
+ * single size class (16 byte steps to 128 bytes, then four classes per
+ * power of two), and belongs to a thread: only that thread allocates
+ * from it, and frees into it, so neither needs a lock, or an atomic
+ * instruction. The objects freed by the other threads are pushed on
+ * a stack of the owner, that it takes on its next slow path.
+ *
+ * A thread has a span it allocates from for each class, and the list
+ * of its other spans with free objects. A span whose objects are all
+ * free is released to the memmgr, but for one, kept to avoid
+ * releasing and allocating a span for each object of a loop. The
+ * large objects get their own span, released by `free`.
+ *
+ * The alignments are at most PAGE_SIZE. The spans of a thread that
+ * exits are never released.
+ */
+
+#define ARENA_SPAN_SZ    (64 * 1024)
+#define ARENA_SPAN_PAGES (ARENA_SPAN_SZ / PAGE_SIZE)
+#define ARENA_HDR_SZ     128
+#define ARENA_SMALL_MAX  8192
+#define ARENA_NCLS       32
+#define ARENA_CLS_LARGE  ARENA_NCLS
+#define ARENA_ALIGN      16
+/* The largest allocation, so the sizes computed don't overflow */
+#define ARENA_SZ_MAX     (1UL << 40)
+
+struct arena_thd;
+
+struct arena_span {
+	struct arena_thd  *owner;
+	struct arena_span *prev, *next; /* in the owner's list of spans with free objects */
+	unsigned int       cls;
+	unsigned int       obj_sz;
+	unsigned long      npages;
+	unsigned long      inuse;
+	int                partial;     /* is it in the list? */
+	void              *free;        /* the objects freed, linked by their first word */
+	char              *bump, *end;  /* the objects never allocated */
+};
+
+struct arena_cls {
+	struct arena_span *cur;     /* the span to allocate from */
+	struct arena_span *partial; /* the other spans with free objects */
+};
+
+struct arena_thd {
+	struct arena_cls   cls[ARENA_NCLS];
+	unsigned long      remote; /* the objects freed by the other threads */
+	struct arena_span *spare;  /* an empty span */
+};
+
+static struct arena_thd *arena_thds[MAX_NUM_THREADS];
+
+static inline unsigned int
+arena_cls_of(size_t sz)
+{
+	unsigned int b;
+
+	if (sz <= 128) return sz ? (sz - 1) / 16 : 0;
+	/* `sz` is in (2^b, 2^(b + 1)] */
+	b = 63 - __builtin_clzl(sz - 1);
+
+	return 8 + (b - 7) * 4 + (((sz - 1) >> (b - 2)) & 3);
+}
+
+static inline unsigned int
+arena_cls_sz(unsigned int cls)
+{
+	unsigned int b;
+
+	if (cls < 8) return (cls + 1) * 16;
+	b = 7 + (cls - 8) / 4;
+
+	return (5 + (cls - 8) % 4) << (b - 2);
+}
+
+static inline struct arena_span *
+arena_span_of(void *p)
+{
+	return (struct arena_span *)((word_t)p & ~(word_t)(ARENA_SPAN_SZ - 1));
+}
+
+static struct arena_thd *
+arena_thd_get(void)
+{
+	thdid_t           tid = cos_thdid();
+	struct arena_thd *t;
+
+	if (unlikely(tid >= MAX_NUM_THREADS)) return NULL;
+	t = arena_thds[tid];
+	if (likely(t)) return t;
+
+	/* The memmgr's pages are zeroed */
+	t = (struct arena_thd *)memmgr_heap_page_allocn(round_up_to_page(sizeof(struct arena_thd)) / PAGE_SIZE);
+	arena_thds[tid] = t;
+
+	return t;
+}
+
+static void
+arena_partial_del(struct arena_cls *c, struct arena_span *s)
+{
+	if (s->prev) s->prev->next = s->next;
+	else         c->partial    = s->next;
+	if (s->next) s->next->prev = s->prev;
+	s->partial = 0;
+}
+
+static void
+arena_partial_add(struct arena_cls *c, struct arena_span *s)
+{
+	s->prev = NULL;
+	s->next = c->partial;
+	if (c->partial) c->partial->prev = s;
+	c->partial = s;
+	s->partial = 1;
+}
+
+static struct arena_span *
+arena_span_alloc(struct arena_thd *t, unsigned int cls)
+{
+	struct arena_span *s = t->spare;
+	unsigned int       sz = arena_cls_sz(cls);
+
+	if (s) {
+		t->spare = NULL;
+	} else {
+		s = (struct arena_span *)memmgr_heap_page_allocn_aligned(ARENA_SPAN_PAGES, ARENA_SPAN_SZ);
+		if (!s) return NULL;
+	}
+
+	*s = (struct arena_span) {
+		.owner  = t,
+		.cls    = cls,
+		.obj_sz = sz,
+		.npages = ARENA_SPAN_PAGES,
+		.bump   = (char *)s + ARENA_HDR_SZ,
+		.end    = (char *)s + ARENA_HDR_SZ + ((ARENA_SPAN_SZ - ARENA_HDR_SZ) / sz) * sz,
+	};
+
+	return s;
+}
+
+static void
+arena_span_release(struct arena_thd *t, struct arena_span *s)
+{
+	if (!t->spare) {
+		t->spare = s;
+		return;
+	}
+	memmgr_heap_page_release((vaddr_t)s, s->npages);
+}
+
+/* Free an object of one of our spans */
+static void
+arena_free_local(struct arena_thd *t, struct arena_span *s, void *o)
+{
+	struct arena_cls *c = &t->cls[s->cls];
+
+	*(void **)o = s->free;
+	s->free     = o;
+	s->inuse--;
+	if (s == c->cur) return;
+
+	if (!s->inuse) {
+		if (s->partial) arena_partial_del(c, s);
+		arena_span_release(t, s);
+	} else if (!s->partial) {
+		arena_partial_add(c, s);
+	}
+}
+
+/* Free the objects the other threads freed */
+static void
+arena_remote_drain(struct arena_thd *t)
+{
+	unsigned long list;
+	void         *o, *next;
+
+	do {
+		list = ps_load(&t->remote);
+		if (!list) return;
+	} while (!ps_cas(&t->remote, list, 0));
+
+	for (o = (void *)list; o; o = next) {
+		next = *(void **)o;
+		arena_free_local(t, arena_span_of(o), o);
+	}
+}
+
+static inline void *
+arena_span_take(struct arena_span *s)
+{
+	void *o = s->free;
+
+	if (o) {
+		s->free = *(void **)o;
+	} else if (s->bump < s->end) {
+		o        = s->bump;
+		s->bump += s->obj_sz;
+	} else {
+		return NULL;
+	}
+	s->inuse++;
+
+	return o;
+}
+
+static void *
+arena_alloc_slow(struct arena_thd *t, unsigned int cls)
+{
+	struct arena_cls  *c = &t->cls[cls];
+	struct arena_span *s;
+	void              *o;
+
+	arena_remote_drain(t);
+	if (c->cur) {
+		o = arena_span_take(c->cur);
+		if (o) return o;
+	}
+
+	/* The current span is full: it joins the list once one of its objects is freed */
+	s = c->partial;
+	if (s) {
+		arena_partial_del(c, s);
+	} else {
+		s = arena_span_alloc(t, cls);
+		if (!s) return NULL;
+	}
+	c->cur = s;
+
+	return arena_span_take(s);
+}
+
+static void *
+arena_alloc_large(size_t sz)
+{
+	struct arena_span *s;
+	unsigned long      npages = round_up_to_page(ARENA_HDR_SZ + sz) / PAGE_SIZE;
+
+	s = (struct arena_span *)memmgr_heap_page_allocn_aligned(npages, ARENA_SPAN_SZ);
+	if (!s) return NULL;
+	s->cls    = ARENA_CLS_LARGE;
+	s->npages = npages;
+
+	return (char *)s + ARENA_HDR_SZ;
+}
+
+void *
+malloc(size_t sz)
+{
+	struct arena_thd *t;
+	unsigned int      cls;
+	void             *o = NULL;
+
+	if (unlikely(sz > ARENA_SZ_MAX)) goto nomem;
+	if (unlikely(sz > ARENA_SMALL_MAX)) {
+		o = arena_alloc_large(sz);
+		goto done;
+	}
+
+	t = arena_thd_get();
+	if (unlikely(!t)) goto nomem;
+	cls = arena_cls_of(sz);
+	if (likely(t->cls[cls].cur)) o = arena_span_take(t->cls[cls].cur);
+	if (unlikely(!o)) o = arena_alloc_slow(t, cls);
+done:
+	if (unlikely(!o)) goto nomem;
+
+	return o;
+nomem:
+	errno = ENOMEM;
+	return NULL;
+}
+
+void
+free(void *p)
+{
+	struct arena_span *s;
+	struct arena_thd  *t;
+	unsigned long      old;
+	char              *base;
+	void              *o;
+
+	if (!p) return;
+	s = arena_span_of(p);
+	if (s->cls == ARENA_CLS_LARGE) {
+		memmgr_heap_page_release((vaddr_t)s, s->npages);
+		return;
+	}
+
+	/* The pointer can be within the object, if it was aligned */
+	base = (char *)s + ARENA_HDR_SZ;
+	o    = base + (((char *)p - base) / s->obj_sz) * s->obj_sz;
+	t    = arena_thd_get();
+	if (likely(t == s->owner)) {
+		arena_free_local(t, s, o);
+		return;
+	}
+
+	do {
+		old         = ps_load(&s->owner->remote);
+		*(void **)o = (void *)old;
+	} while (!ps_cas(&s->owner->remote, old, (unsigned long)o));
+}
+
+size_t
+malloc_usable_size(void *p)
+{
+	struct arena_span *s;
+	char              *base;
+
+	if (!p) return 0;
+	s = arena_span_of(p);
+	if (s->cls == ARENA_CLS_LARGE) return (char *)s + s->npages * PAGE_SIZE - (char *)p;
+
+	base = (char *)s + ARENA_HDR_SZ;
+
+	return s->obj_sz - ((char *)p - base) % s->obj_sz;
+}
+
+void *
+calloc(size_t m, size_t n)
+{
+	void *p;
+
+	if (n && m > ARENA_SZ_MAX / n) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	p = malloc(m * n);
+	if (p) memset(p, 0, m * n);
+
+	return p;
+}
+
+void *
+realloc(void *p, size_t n)
+{
+	size_t usable;
+	void  *new;
+
+	if (!p) return malloc(n);
+	usable = malloc_usable_size(p);
+	if (n <= usable) return p;
+
+	new = malloc(n);
+	if (!new) return NULL;
+	memcpy(new, p, usable);
+	free(p);
+
+	return new;
+}
+
+void *
+aligned_alloc(size_t align, size_t sz)
+{
+	char *p;
+
+	if (align <= ARENA_ALIGN) return malloc(sz);
+	if ((align & (align - 1)) || align > PAGE_SIZE) {
+		errno = EINVAL;
+		return NULL;
+	}
+	if (sz > ARENA_SZ_MAX) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	p = malloc(sz + align - 1);
+	if (!p) return NULL;
+
+	return (void *)round_up_to_pow2((word_t)p, align);
+}
+
+void *
+memalign(size_t align, size_t sz)
+{
+	return aligned_alloc(align, sz);
+}
+
+int
+posix_memalign(void **res, size_t align, size_t sz)
+{
+	void *p;
+
+	if (align < sizeof(void *) || (align & (align - 1))) return EINVAL;
+	p = aligned_alloc(align, sz);
+	if (!p) return errno;
+	*res = p;
+
+	return 0;
+}
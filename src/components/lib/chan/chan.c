@@ -23,38 +23,54 @@ chan_rcv_init(struct chan_rcv *r, struct chan *c)
 	assert(r && c);
 	assert(c->refcnt > 0);
 
-	ps_faa(&c->refcnt, 1);
 	*r = (struct chan_rcv) {
 		.meta = c->meta,
 		.c    = c,
 	};
+	if ((r->meta.flags & CHAN_BCAST) && __chan_bcast_rcv_register(&r->meta)) return -CHAN_ERR_NOMEM;
+	ps_faa(&c->refcnt, 1);
 
 	return 0;
 }
 
-static int
-__chan_gather_resources(struct __chan_meta *m, chan_id_t id, unsigned int item_sz, unsigned int nslots, chan_flags_t flags)
+static void
+__chan_meta_set(struct __chan_meta *m, chan_id_t id, unsigned int item_sz, unsigned int nslots, chan_flags_t flags,
+		cbuf_t cb, void *mem, sched_blkpt_id_t full, sched_blkpt_id_t empty)
 {
-	cbuf_t cb;
-	void *mem = NULL;
-	sched_blkpt_id_t full = 0, empty = 0;
-	int ret;
-
-	if ((ret = chanmgr_mem_resources(id, &cb, &mem)))      return ret;
-	if ((ret = chanmgr_sync_resources(id, &full, &empty))) return ret;
 	assert(mem != NULL && full > 0 && empty > 0);
 
 	*m = (struct __chan_meta) {
+		.mem             = mem,
 		.nslots          = nslots,
 		.item_sz         = item_sz,
 		.wraparound_mask = (1 << log32(nslots)) - 1,
+		.flags           = flags,
 		.id              = id,
 		.cbuf_id         = cb,
 		.blkpt_full_id   = full,
 		.blkpt_empty_id  = empty,
 	};
+}
 
+static void
+__chan_meta_init(struct __chan_meta *m, chan_id_t id, unsigned int item_sz, unsigned int nslots, chan_flags_t flags,
+		 cbuf_t cb, void *mem, sched_blkpt_id_t full, sched_blkpt_id_t empty)
+{
+	__chan_meta_set(m, id, item_sz, nslots, flags, cb, mem, full, empty);
 	__chan_init_with(m, full, empty, mem);
+}
+
+static int
+__chan_gather_resources(struct __chan_meta *m, chan_id_t id, unsigned int item_sz, unsigned int nslots, chan_flags_t flags)
+{
+	cbuf_t cb;
+	void *mem = NULL;
+	sched_blkpt_id_t full = 0, empty = 0;
+	int ret;
+
+	if ((ret = chanmgr_mem_resources(id, &cb, &mem)))      return ret;
+	if ((ret = chanmgr_sync_resources(id, &full, &empty))) return ret;
+	__chan_meta_init(m, id, item_sz, nslots, flags, cb, mem, full, empty);
 
 	return 0;
 }
@@ -63,20 +79,60 @@ int
 chan_init(struct chan *c, unsigned int item_sz, unsigned int nslots, chan_flags_t flags)
 {
 	chan_id_t id;
-	int ret;
+	cbuf_t cb;
+	void *mem = NULL;
+	sched_blkpt_id_t full = 0, empty = 0;
 
 	assert((flags & CHAN_EXACT_SIZE) == 0);
-	assert((flags & CHAN_MPSC) == 0);
 	nslots = (unsigned int)nlepow2((u32_t)nslots);
 
-	id = chanmgr_create(item_sz, nslots, flags);
+	/* A single invocation creates the channel and returns its resources */
+	id = chanmgr_create_resources(item_sz, nslots, flags, &cb, &mem, &full, &empty);
 	if (id == 0) return -CHAN_ERR_NOMEM;
 	c->refcnt = 1;
-	if (__chan_gather_resources(&c->meta, id, item_sz, nslots, flags)) return -CHAN_ERR_INVAL_ARG;
+	__chan_meta_init(&c->meta, id, item_sz, nslots, flags, cb, mem, full, empty);
 
 	return 0;
 }
 
+/* The states of the blkpts of the channels in memory passed in (`__chan_mem.init`) */
+#define CHAN_MEM_UNINIT 0
+#define CHAN_MEM_INITING 1
+#define CHAN_MEM_READY   2
+
+int
+chan_init_mem(struct chan *c, void *mem, unsigned int item_sz, unsigned int nslots, chan_flags_t flags)
+{
+	struct __chan_mem *m = mem;
+	struct sync_blkpt empty, full;
+
+	assert((flags & CHAN_EXACT_SIZE) == 0 && pow2(nslots));
+	c->refcnt = 1;
+
+	/* The first endpoint allocates the blkpts, and initializes the ring */
+	if (ps_load(&m->init) == CHAN_MEM_UNINIT && ps_cas(&m->init, CHAN_MEM_UNINIT, CHAN_MEM_INITING)) {
+		if (sync_blkpt_init(&empty)) goto err;
+		if (sync_blkpt_init(&full)) {
+			sync_blkpt_teardown(&empty);
+			goto err;
+		}
+		__chan_meta_init(&c->meta, 0, item_sz, nslots, flags | CHAN_LOCAL, 0, mem, full.id, empty.id);
+		ps_store(&m->init, CHAN_MEM_READY);
+
+		return 0;
+	}
+
+	/* The others wait for it to be done, and share them */
+	while (ps_load(&m->init) != CHAN_MEM_READY) ;
+	__chan_meta_set(&c->meta, 0, item_sz, nslots, flags, 0, mem, m->full.id, m->empty.id);
+
+	return 0;
+err:
+	ps_store(&m->init, CHAN_MEM_UNINIT);
+
+	return -CHAN_ERR_NOMEM;
+}
+
 int
 chan_snd_init_with(struct chan_snd *s, chan_id_t cap_id, unsigned int item_sz, unsigned int nslots, chan_flags_t flags)
 {
@@ -87,8 +143,13 @@ chan_snd_init_with(struct chan_snd *s, chan_id_t cap_id, unsigned int item_sz, u
 int
 chan_rcv_init_with(struct chan_rcv *r, chan_id_t cap_id, unsigned int item_sz, unsigned int nslots, chan_flags_t flags)
 {
+	int ret;
+
 	r->c = NULL;
-	return __chan_gather_resources(&r->meta, cap_id, item_sz, nslots, flags);
+	if ((ret = __chan_gather_resources(&r->meta, cap_id, item_sz, nslots, flags))) return ret;
+	if ((flags & CHAN_BCAST) && __chan_bcast_rcv_register(&r->meta)) return -CHAN_ERR_NOMEM;
+
+	return 0;
 }
 
 static int
@@ -102,7 +163,12 @@ chan_release_resources(struct chan *c)
 	if (cnt > 1) return 1; /* still referenced elsewhere */
 
 	assert(cnt == 0);
-	chanmgr_delete(c->meta.id);
+	if (c->meta.id) {
+		chanmgr_delete(c->meta.id);
+	} else if (c->meta.flags & CHAN_LOCAL) {
+		sched_blkpt_free(c->meta.blkpt_empty_id);
+		sched_blkpt_free(c->meta.blkpt_full_id);
+	}
 
 	return 0;
 }
@@ -120,6 +186,7 @@ chan_snd_teardown(struct chan_snd *s)
 void
 chan_rcv_teardown(struct chan_rcv *r)
 {
+	if (r->meta.flags & CHAN_BCAST) __chan_bcast_rcv_unregister(&r->meta);
 	if (!r->c) {
 		chanmgr_delete(r->meta.id);
 	} else {
@@ -146,9 +213,9 @@ chan_rcv_get_chan(struct chan_rcv *r)
 }
 
 unsigned int
-chan_mem_sz(unsigned int item_sz, unsigned int slots)
+chan_mem_sz(unsigned int item_sz, unsigned int slots, chan_flags_t flags)
 {
-	return sizeof(struct __chan_mem) + item_sz * slots;
+	return CHAN_MEM_SZ(item_sz, slots, flags);
 }
 
 inline unsigned int
@@ -158,6 +225,8 @@ __chan_meta_evt_associate(struct __chan_meta *meta, evt_res_id_t eid)
 
 	if (meta->evt_id != 0) return -1;
 	meta->evt_id = eid;
+	/* On failure, triggers fall back to invoking the evtmgr */
+	evt_src_init(&meta->evt_src, eid);
 
 	ret = chanmgr_evt_set(meta->id, meta->evt_id, 1);
 	/* signal to the communicating pair to update their event resource id. */
@@ -189,6 +258,7 @@ __chan_meta_evt_update(struct __chan_meta *meta)
 {
 	if (meta->evt_id == 0) {
 		meta->evt_id = chanmgr_evt_get(meta->id, 1);
+		if (meta->evt_id) evt_src_init(&meta->evt_src, meta->evt_id);
 	}
 }
 
@@ -9,8 +9,17 @@
 
 /***
  * Channel implementation that enables intra- and inter-core
- * communication. Currently, we assume only single-producer,
- * single-consumer communication (SPSC).
+ * communication. By default, channels are single-producer,
+ * single-consumer (SPSC), and channels created with `CHAN_MPSC` or
+ * `CHAN_MPMC` support multiple producers, or multiple producers and
+ * consumers with sequence-numbered slots (see `chan_private.h`).
+ * Channels created with `CHAN_BCAST` have a single producer, and
+ * deliver each item to all of their receive endpoints, each with its
+ * own cursor into the ring; the producer waits for the slowest of
+ * them, unless `CHAN_LOSSY` is also passed, in which case consumers
+ * that fall a ring behind skip the items they missed (see
+ * `chan_rcv_lost`). All endpoints of a channel must be created with
+ * the same flags.
  */
 
 /* Internal implementation details of the channel */
@@ -36,11 +45,16 @@
  *     - `-CHAN_ERR_*` if an error occurred.
  */
 static inline int
-chan_send(struct chan_snd *c, void *item, chan_comm_t flags)
+__chan_send(struct chan_snd *c, void *item, u32_t wraparound_mask, u32_t item_sz, chan_flags_t cflags, chan_comm_t flags)
 {
 	int ret;
 
-	ret = __chan_send_pow2(c, item, c->meta.wraparound_mask, c->meta.item_sz, !(flags & CHAN_NONBLOCKING));
+	if (unlikely(cflags & (CHAN_MULTI | CHAN_BCAST))) {
+		ret = __chan_send_n_pow2(c, item, 1, wraparound_mask, item_sz, !(flags & CHAN_NONBLOCKING));
+		ret = ret == 1 ? 0 : (ret == 0 ? 1 : ret);
+	} else {
+		ret = __chan_send_pow2(c, item, wraparound_mask, item_sz, !(flags & CHAN_NONBLOCKING));
+	}
 	if (likely(ret == 0)) {
 		return 0;
 	} else if (ret > 0) {
@@ -51,6 +65,12 @@ chan_send(struct chan_snd *c, void *item, chan_comm_t flags)
 	}
 }
 
+static inline int
+chan_send(struct chan_snd *c, void *item, chan_comm_t flags)
+{
+	return __chan_send(c, item, c->meta.wraparound_mask, c->meta.item_sz, c->meta.flags, flags);
+}
+
 /**
  * `chan_recv` reads an item off of the channel. The size of the item
  * is provided by the channel creation APIs. The flags indicate if
@@ -69,11 +89,16 @@ chan_send(struct chan_snd *c, void *item, chan_comm_t flags)
  *     - `-CHAN_ERR_*` if an error occurred.
  */
 static inline int
-chan_recv(struct chan_rcv *c, void *item, chan_comm_t flags)
+__chan_recv(struct chan_rcv *c, void *item, u32_t wraparound_mask, u32_t item_sz, chan_flags_t cflags, chan_comm_t flags)
 {
 	int ret;
 
-	ret = __chan_recv_pow2(c, item, c->meta.wraparound_mask, c->meta.item_sz, !(flags & CHAN_NONBLOCKING));
+	if (unlikely(cflags & (CHAN_MULTI | CHAN_BCAST))) {
+		ret = __chan_recv_n_pow2(c, item, 1, wraparound_mask, item_sz, !(flags & CHAN_NONBLOCKING));
+		ret = ret == 1 ? 0 : (ret == 0 ? 1 : ret);
+	} else {
+		ret = __chan_recv_pow2(c, item, wraparound_mask, item_sz, !(flags & CHAN_NONBLOCKING));
+	}
 	if (likely(ret == 0)) {
 		return 0;
 	} else if (ret > 0) {
@@ -84,6 +109,127 @@ chan_recv(struct chan_rcv *c, void *item, chan_comm_t flags)
 	}
 }
 
+static inline int
+chan_recv(struct chan_rcv *c, void *item, chan_comm_t flags)
+{
+	return __chan_recv(c, item, c->meta.wraparound_mask, c->meta.item_sz, c->meta.flags, flags);
+}
+
+/**
+ * `chan_send_n` and `chan_recv_n` send or receive up to `n` items
+ * (contiguous in `items`) with a single update of the channel's
+ * index, and a single wakeup of blocked threads, and `evt` trigger.
+ * Blocking calls return once at least one item has been transferred.
+ *
+ * - @c      - Channel to send to, or receive from.
+ * - @items  - The array of items to copy in or out of the channel.
+ * - @n      - The maximum number of items to transfer.
+ * - @flags  - The flags.
+ * - @return - One of these values:
+ *
+ *     - the number of items transferred,
+ *     - `0` if `CHAN_NONBLOCKING` was passed in, and no item could
+ *       be transferred, or
+ *     - `-CHAN_ERR_*` if an error occurred.
+ */
+static inline int
+chan_send_n(struct chan_snd *c, void *items, unsigned int n, chan_comm_t flags)
+{
+	int ret;
+
+	ret = __chan_send_n_pow2(c, items, n, c->meta.wraparound_mask, c->meta.item_sz, !(flags & CHAN_NONBLOCKING));
+	if (unlikely(ret < 0)) return -CHAN_ERR_INVAL_ARG;
+	assert(ret > 0 || (flags & CHAN_NONBLOCKING));
+
+	return ret;
+}
+
+static inline int
+chan_recv_n(struct chan_rcv *c, void *items, unsigned int n, chan_comm_t flags)
+{
+	int ret;
+
+	ret = __chan_recv_n_pow2(c, items, n, c->meta.wraparound_mask, c->meta.item_sz, !(flags & CHAN_NONBLOCKING));
+	if (unlikely(ret < 0)) return -CHAN_ERR_INVAL_ARG;
+	assert(ret > 0 || (flags & CHAN_NONBLOCKING));
+
+	return ret;
+}
+
+/**
+ * `chan_send_reserve` and `chan_send_commit` send an item without
+ * copying it into the channel: the reservation returns the next slot
+ * of the channel's ring (in the channel's shared memory), the item is
+ * written into it in place, and the commit sends it. Similarly,
+ * `chan_recv_peek` returns the next item in place in the ring, and
+ * `chan_recv_release` removes it once it has been read. An endpoint
+ * can have a single reservation (or peeked item) at a time, and the
+ * slot must not be accessed after it is committed (released).
+ * Broadcast channels don't support these.
+ *
+ * - @c      - Channel to send to, or receive from.
+ * - @flags  - The flags.
+ * - @return - The slot, or `NULL` if `CHAN_NONBLOCKING` was passed
+ *             in, and the channel is full (empty).
+ */
+static inline void *
+chan_send_reserve(struct chan_snd *c, chan_comm_t flags)
+{
+	assert(!(c->meta.flags & CHAN_BCAST));
+
+	return __chan_send_reserve_pow2(c, c->meta.wraparound_mask, c->meta.item_sz, !(flags & CHAN_NONBLOCKING));
+}
+
+/**
+ * `chan_send_commit` sends the item written into the slot returned
+ * by the last `chan_send_reserve`.
+ *
+ * - @c      - Channel to send to.
+ * - @return - `0` on success, or `-CHAN_ERR_*` if an error occurred.
+ */
+static inline int
+chan_send_commit(struct chan_snd *c)
+{
+	if (unlikely(__chan_send_commit_pow2(c, c->meta.wraparound_mask, c->meta.item_sz))) return -CHAN_ERR_INVAL_ARG;
+
+	return 0;
+}
+
+static inline void *
+chan_recv_peek(struct chan_rcv *c, chan_comm_t flags)
+{
+	assert(!(c->meta.flags & CHAN_BCAST));
+
+	return __chan_recv_peek_pow2(c, c->meta.wraparound_mask, c->meta.item_sz, !(flags & CHAN_NONBLOCKING));
+}
+
+/**
+ * `chan_recv_release` removes the item returned by the last
+ * `chan_recv_peek` from the channel, freeing its slot for the
+ * senders.
+ *
+ * - @c      - Channel to receive from.
+ */
+static inline void
+chan_recv_release(struct chan_rcv *c)
+{
+	__chan_recv_release_pow2(c, c->meta.wraparound_mask, c->meta.item_sz);
+}
+
+/**
+ * `chan_rcv_lost` returns the number of items a receive endpoint of a
+ * `CHAN_BCAST | CHAN_LOSSY` channel skipped, as the producer
+ * overwrote them before it received them.
+ *
+ * - @c      - Channel receive endpoint.
+ * - @return - The number of items lost since the endpoint was created.
+ */
+static inline unsigned long
+chan_rcv_lost(struct chan_rcv *c)
+{
+	return c->meta.lost;
+}
+
 /**
  * `chan_init` initializes a channel data-structure, and creates a new
  * channel with `slots` items each of maximum size `item_sz`.
@@ -95,8 +241,29 @@ chan_recv(struct chan_rcv *c, void *item, chan_comm_t flags)
  */
 int chan_init(struct chan *c, unsigned int item_sz, unsigned int nslots, chan_flags_t flags);
 
+/**
+ * `chan_init_mem` initializes a channel in memory passed in, of
+ * `chan_mem_sz` bytes, without the chanmgr: the channels local to a
+ * component (see `CHAN_STATIC_ALLOC`), and those in memory shared
+ * between components (e.g. by the `crt_pipeline`). The memory must be
+ * zeroed before the first initialization. The first of the
+ * initializations of a shared channel allocates its blkpts, and the
+ * others use them, so the components sharing the channel must share
+ * their scheduler. Such channels have no id, so they can't be used
+ * with the `_with` APIs, or be associated with an `evt`.
+ *
+ * - @mem    - The channel's memory.
+ * - @others - See `chan_init`, but `nslots` must be a power of 2.
+ * - @return - `0` on success, `-CHAN_ERR_NOMEM` if the blkpts can't
+ *             be allocated.
+ */
+int chan_init_mem(struct chan *c, void *mem, unsigned int item_sz, unsigned int nslots, chan_flags_t flags);
+
 /**
  * `chan_snd|rcv_init` initializes a new sender or receiver endpoint.
+ * A receive endpoint of a broadcast channel receives the items sent
+ * after it is initialized, and the channel has up to
+ * `CHAN_BCAST_RCV_MAX` of them.
  *
  * - @ep     - The send or receive endpoint to populate.
  * - @c      - The channel for which we're creating the end-point.
@@ -144,9 +311,10 @@ int  chan_teardown(struct chan *c);
  *
  * - @item_sz - size of each item
  * - @slots   - number of items
+ * - @flags   - the channel's flags
  * - @return  - number of bytes required for the channel's memory
  */
-unsigned int chan_mem_sz(unsigned int item_sz, unsigned int slots);
+unsigned int chan_mem_sz(unsigned int item_sz, unsigned int slots, chan_flags_t flags);
 
 /**
  * Add the event resource id into the channel so that when a send
@@ -177,6 +345,80 @@ int chan_evt_disassociate(struct chan *c);
 int chan_rcv_evt_disassociate(struct chan_rcv *r);
 int chan_snd_evt_disassociate(struct chan_snd *s);
 
+/***
+ * The channels specialized for a type of item, at compile time (as
+ * `chan.hpp` does for C++): the item size, the number of slots, and
+ * the mode are constants, so the copies into the ring are inlined,
+ * and the functions don't branch on the mode. These are the
+ * `chan_*` APIs for each of the ways to set up a channel:
+ *
+ * - managed by the chanmgr: `chan_init_<name>` creates the channel,
+ *   and `chan_snd|rcv_init_with_<name>` uses one that the component
+ *   was initialized with,
+ * - inline: `chan_init_mem_<name>` initializes the channel in
+ *   memory passed in, for example in memory shared with another
+ *   component, and
+ * - static: `CHAN_STATIC_ALLOC` defines a channel, with its memory,
+ *   in the component's data, that `chan_static_init_<name>`
+ *   initializes.
+ *
+ * *Example*:
+ *
+ * ```c
+ * CHAN_TYPE_PROTOTYPES(req, struct req, 64, CHAN_DEFAULT);
+ * CHAN_STATIC_ALLOC(req, struct req, 64, CHAN_DEFAULT);
+ *
+ * chan_static_init_req();
+ * chan_snd_init(&s, &req);
+ * chan_send_req(&s, &r, 0);
+ * ```
+ */
+#define CHAN_TYPE_PROTOTYPES(name, type, nslots, flags)			\
+static inline int							\
+chan_init_##name(struct chan *c)					\
+{ return chan_init(c, sizeof(type), nslots, flags); }			\
+static inline int							\
+chan_init_mem_##name(struct chan *c, void *mem)				\
+{ return chan_init_mem(c, mem, sizeof(type), nslots, flags); }		\
+static inline int							\
+chan_snd_init_with_##name(struct chan_snd *s, chan_id_t id)		\
+{ return chan_snd_init_with(s, id, sizeof(type), nslots, flags); }	\
+static inline int							\
+chan_rcv_init_with_##name(struct chan_rcv *r, chan_id_t id)		\
+{ return chan_rcv_init_with(r, id, sizeof(type), nslots, flags); }	\
+static inline int							\
+chan_send_##name(struct chan_snd *s, type *item, chan_comm_t f)	\
+{									\
+	assert(pow2(nslots) && s->meta.item_sz == sizeof(type));	\
+	return __chan_send(s, item, nslots - 1, sizeof(type), flags, f); \
+}									\
+static inline int							\
+chan_recv_##name(struct chan_rcv *r, type *item, chan_comm_t f)	\
+{									\
+	assert(pow2(nslots) && r->meta.item_sz == sizeof(type));	\
+	return __chan_recv(r, item, nslots - 1, sizeof(type), flags, f); \
+}									\
+static inline int							\
+chan_send_n_##name(struct chan_snd *s, type *items, unsigned int n, chan_comm_t f) \
+{									\
+	int ret = __chan_send_n_pow2(s, items, n, nslots - 1, sizeof(type), !(f & CHAN_NONBLOCKING)); \
+	return unlikely(ret < 0) ? -CHAN_ERR_INVAL_ARG : ret;		\
+}									\
+static inline int							\
+chan_recv_n_##name(struct chan_rcv *r, type *items, unsigned int n, chan_comm_t f) \
+{									\
+	int ret = __chan_recv_n_pow2(r, items, n, nslots - 1, sizeof(type), !(f & CHAN_NONBLOCKING)); \
+	return unlikely(ret < 0) ? -CHAN_ERR_INVAL_ARG : ret;		\
+}
+
+/* Define the channel `name`, with its memory, initialized by `chan_static_init_<name>` */
+#define CHAN_STATIC_ALLOC(name, type, nslots, flags)			\
+struct chan name;							\
+static char __chan_mem_##name[CHAN_MEM_SZ(sizeof(type), nslots, flags)] __attribute__((aligned(CACHE_LINE * 2))); \
+static inline int							\
+chan_static_init_##name(void)						\
+{ return chan_init_mem(&name, __chan_mem_##name, sizeof(type), nslots, flags); }
+
 /**
  * The following are the APIs for dynamic memory allocation of
  * channels. This is only compiled into your component if they are
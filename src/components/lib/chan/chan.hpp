@@ -0,0 +1,154 @@
+/*
+ * Copyright 2020, Gabriel Parmer, GWU, gparmer@gwu.edu.
+ *
+ * This uses a two clause BSD License.
+ */
+
+#ifndef CHAN_HPP
+#define CHAN_HPP
+
+/***
+ * Typed channel endpoints for C++ components.
+ * `composite::chan_snd<T, F>` and `composite::chan_rcv<T, F>` wrap the
+ * endpoints of a channel of items of type `T`, created with the flags
+ * `F`, and send and receive `T`s.
+ * The item size and the channel's mode are compile-time constants,
+ * so the copies into the ring are of a constant size (that the
+ * compiler inlines), and the endpoints don't branch on the mode, as
+ * `chan_send` and `chan_recv` do. They are otherwise the inlined C
+ * functions, and an endpoint is a pointer.
+ *
+ * The channel must have been created with `sizeof(T)` items, and the
+ * same multi-producer (consumer) and broadcast flags: the constructors
+ * assert it.
+ *
+ * *Example*:
+ * ```c++
+ * struct chan *c = chan_alloc(sizeof(struct pkt), 128, CHAN_MPSC);
+ * composite::chan_snd<struct pkt, CHAN_MPSC> s(chan_snd_alloc(c));
+ *
+ * s.send(p);
+ * ```
+ */
+
+extern "C" {
+#include <chan.h>
+}
+
+namespace composite {
+
+template<typename T, chan_flags_t F = CHAN_DEFAULT>
+class chan_snd {
+	static_assert(__is_trivially_copyable(T), "channel items are copied as bytes");
+	static constexpr bool multi = (F & (CHAN_MULTI | CHAN_BCAST)) != 0;
+
+	struct ::chan_snd *s;
+
+public:
+	static constexpr u32_t item_sz = sizeof(T);
+
+	explicit chan_snd(struct ::chan_snd *s) : s(s)
+	{
+		assert(s->meta.item_sz == item_sz && !(s->meta.flags & (CHAN_MULTI | CHAN_BCAST)) == !multi);
+	}
+
+	/* `0`, `CHAN_TRY_AGAIN` (if `CHAN_NONBLOCKING`), or `-CHAN_ERR_*`, as `chan_send` */
+	int
+	send(const T &item, chan_comm_t flags = (chan_comm_t)0)
+	{
+		void *p = const_cast<T *>(&item);
+		int   ret;
+
+		if (multi) {
+			ret = __chan_send_n_pow2(s, p, 1, s->meta.wraparound_mask, item_sz, !(flags & CHAN_NONBLOCKING));
+			ret = ret == 1 ? 0 : (ret == 0 ? 1 : ret);
+		} else {
+			ret = __chan_send_pow2(s, p, s->meta.wraparound_mask, item_sz, !(flags & CHAN_NONBLOCKING));
+		}
+		if (likely(ret == 0)) return 0;
+		if (ret > 0) return CHAN_TRY_AGAIN;
+
+		return -CHAN_ERR_INVAL_ARG;
+	}
+
+	/* The number of items sent, as `chan_send_n` */
+	int
+	send_n(const T *items, unsigned int n, chan_comm_t flags = (chan_comm_t)0)
+	{
+		int ret = __chan_send_n_pow2(s, const_cast<T *>(items), n, s->meta.wraparound_mask, item_sz, !(flags & CHAN_NONBLOCKING));
+
+		return unlikely(ret < 0) ? -CHAN_ERR_INVAL_ARG : ret;
+	}
+
+	/* Write the item in place, then `commit` it */
+	T *
+	reserve(chan_comm_t flags = (chan_comm_t)0)
+	{
+		return static_cast<T *>(__chan_send_reserve_pow2(s, s->meta.wraparound_mask, item_sz, !(flags & CHAN_NONBLOCKING)));
+	}
+
+	int
+	commit()
+	{
+		return unlikely(__chan_send_commit_pow2(s, s->meta.wraparound_mask, item_sz)) ? -CHAN_ERR_INVAL_ARG : 0;
+	}
+
+	struct ::chan_snd *get() { return s; }
+};
+
+template<typename T, chan_flags_t F = CHAN_DEFAULT>
+class chan_rcv {
+	static_assert(__is_trivially_copyable(T), "channel items are copied as bytes");
+	static constexpr bool multi = (F & (CHAN_MULTI | CHAN_BCAST)) != 0;
+
+	struct ::chan_rcv *r;
+
+public:
+	static constexpr u32_t item_sz = sizeof(T);
+
+	explicit chan_rcv(struct ::chan_rcv *r) : r(r)
+	{
+		assert(r->meta.item_sz == item_sz && !(r->meta.flags & (CHAN_MULTI | CHAN_BCAST)) == !multi);
+	}
+
+	/* As `chan_recv` */
+	int
+	recv(T &item, chan_comm_t flags = (chan_comm_t)0)
+	{
+		int ret;
+
+		if (multi) {
+			ret = __chan_recv_n_pow2(r, &item, 1, r->meta.wraparound_mask, item_sz, !(flags & CHAN_NONBLOCKING));
+			ret = ret == 1 ? 0 : (ret == 0 ? 1 : ret);
+		} else {
+			ret = __chan_recv_pow2(r, &item, r->meta.wraparound_mask, item_sz, !(flags & CHAN_NONBLOCKING));
+		}
+		if (likely(ret == 0)) return 0;
+		if (ret > 0) return CHAN_TRY_AGAIN;
+
+		return -CHAN_ERR_INVAL_ARG;
+	}
+
+	int
+	recv_n(T *items, unsigned int n, chan_comm_t flags = (chan_comm_t)0)
+	{
+		int ret = __chan_recv_n_pow2(r, items, n, r->meta.wraparound_mask, item_sz, !(flags & CHAN_NONBLOCKING));
+
+		return unlikely(ret < 0) ? -CHAN_ERR_INVAL_ARG : ret;
+	}
+
+	/* Read the item in place, then `release` it */
+	T *
+	peek(chan_comm_t flags = (chan_comm_t)0)
+	{
+		return static_cast<T *>(__chan_recv_peek_pow2(r, r->meta.wraparound_mask, item_sz, !(flags & CHAN_NONBLOCKING)));
+	}
+
+	void release() { __chan_recv_release_pow2(r, r->meta.wraparound_mask, item_sz); }
+
+	struct ::chan_rcv *get() { return r; }
+};
+
+}
+
+#endif /* CHAN_HPP */
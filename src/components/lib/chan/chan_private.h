@@ -15,20 +15,27 @@ struct __chan_meta {
 	sched_blkpt_id_t blkpt_empty_id, blkpt_full_id;
 	u32_t item_sz, nslots, wraparound_mask;
 	evt_res_id_t evt_id;
+	struct evt_src evt_src; /* to trigger `evt_id` without invoking the evtmgr */
 	chan_flags_t flags;
+	unsigned long reserved; /* the slot reserved for zero-copy access in MP channels */
+	/* The private cursor of a consumer of a CHAN_BCAST channel, its index, and the items it lost */
+	unsigned long cursor, lost;
+	u32_t rcv_idx;
 	cbuf_t cbuf_id;
 	chan_id_t id;
 };
 
 /*
- * Padding is to avoid cache-line false sharing, which doesn't exist
- * on a single core. Padding to CACHE_LINE * 2 as Intel units of
- * coherency seem to be 128 bytes rather than 64 (CACHE_LINE).
+ * Alignment is to avoid cache-line false sharing, which doesn't exist
+ * on a single core. Aligning to CACHE_LINE * 2 as Intel units of
+ * coherency seem to be 128 bytes rather than 64 (CACHE_LINE). Each
+ * side's fields, and the items, start a new unit, so the padding
+ * doesn't depend on the sizes (and alignment) of the fields.
  */
 #if NUM_CPU > 1
-#define CHAN_PADDING(num, prevsz) char _padding##num[CACHE_LINE * 2 - prevsz];
+#define CHAN_ALIGNED __attribute__((aligned(CACHE_LINE * 2)))
 #else
-#define CHAN_PADDING(num, prevsz)
+#define CHAN_ALIGNED
 #endif
 
 /*
@@ -37,20 +44,32 @@ struct __chan_meta {
  * data as potentially faulty. Thus the blockpoint identifiers are
  * stored redundantly in non-shared memory. If synchronous (blocking)
  * APIs are used, then it is possible to have unbounded blocking.
+ *
+ * For SPSC channels, each side keeps a copy of the other side's
+ * index in its own unit (as in FastForward, or Lamport's queue with
+ * cached indices), and only reads the remote index (thus takes a
+ * cache miss) when the ring looks full (for the producer), or empty
+ * (for the consumer) according to the copy.
  */
 struct __chan_mem {
-	u32_t producer;
+	unsigned long producer;
+	unsigned long consumer_cached; /* the producer's copy of `consumer` */
 	u32_t producer_update;
+	/* For channels in memory the endpoints initialize (`chan_init_mem`), the state of the blkpts */
+	unsigned long init;
 	/* If the ring is empty, recving threads will block on this blkpt. */
 	struct sync_blkpt empty;
-	CHAN_PADDING(1, (sizeof(struct sync_blkpt) + 2 * sizeof(u32_t)));
- 	u32_t consumer;
+ 	unsigned long consumer CHAN_ALIGNED;
+	unsigned long producer_cached; /* the consumer's copy of `producer` */
 	u32_t consumer_update;
 	/* If the ring is full, sending thread will block on this blkpt. */
 	struct sync_blkpt full;
-	CHAN_PADDING(2, (sizeof(struct sync_blkpt) + 2* sizeof(u32_t)));
-	/* The memory for the channel. */
-	char mem[0];
+	/*
+	 * The memory for the channel: the items, followed, for
+	 * channels with multiple producers or consumers, by the
+	 * sequence number of each slot (see `__chan_seqs`).
+	 */
+	char mem[0] CHAN_ALIGNED;
 };
 
 struct chan {
@@ -70,6 +89,62 @@ struct chan_rcv {
 
 #include <chanmgr.h>
 
+/*
+ * The multi-producer and multi-consumer channels are Vyukov's bounded
+ * queue: each slot has a sequence number that is the producer index
+ * that can next fill it, and once filled, that index + 1, which is
+ * the consumer index that can empty it. Emptying it releases the slot
+ * to the producer index of the next lap around the ring. Producers
+ * (and, for MPMC, consumers) claim slots by advancing their index
+ * with a `cas`, then fill (empty) them, and publish them by updating
+ * the slot's sequence number.
+ */
+static inline unsigned long *
+__chan_seqs(struct __chan_mem *m, u32_t wraparound_mask, u32_t item_sz)
+{ return (unsigned long *)(m->mem + round_up_to_pow2((wraparound_mask + 1) * item_sz, sizeof(unsigned long))); }
+
+/*
+ * Broadcast channels (`CHAN_BCAST`) have a single producer, and each
+ * consumer receives all of the items, as in a disruptor ring: each
+ * slot's sequence number is its producer index + 1 once the item is
+ * published, and each consumer reads the slots from its private
+ * cursor, that it publishes in one of the cursors following the
+ * sequence numbers. The producer doesn't overwrite the items the
+ * slowest registered consumer has yet to read, unless the channel is
+ * `CHAN_LOSSY`: the producer then invalidates the slot's sequence
+ * number while it overwrites it, and consumers check that it is
+ * unchanged after they copy the item, so that a consumer a lap
+ * behind skips to the producer, and counts the items it lost.
+ */
+#ifndef CHAN_BCAST_RCV_MAX
+#define CHAN_BCAST_RCV_MAX 8
+#endif
+
+#define CHAN_BCAST_FREE   0
+#define CHAN_BCAST_CLAIM  1
+#define CHAN_BCAST_ACTIVE 2
+
+struct __chan_bcast_cursor {
+	unsigned long cursor;
+	unsigned long state;
+} CHAN_ALIGNED;
+
+static inline struct __chan_bcast_cursor *
+__chan_bcast_cursors(struct __chan_mem *m, u32_t wraparound_mask, u32_t item_sz)
+{ return (struct __chan_bcast_cursor *)round_up_to_pow2(__chan_seqs(m, wraparound_mask, item_sz) + wraparound_mask + 1, CACHE_LINE * 2); }
+
+/*
+ * The size of the memory of a channel (see `chan_mem_sz`), as a
+ * constant expression for constant arguments: the slots' sequence
+ * numbers are only used by MPSC, MPMC, and broadcast channels.
+ */
+#define __CHAN_MEM_SZ(item_sz, slots) \
+	(sizeof(struct __chan_mem) + round_up_to_pow2((item_sz) * (slots), sizeof(unsigned long)) + sizeof(unsigned long) * (slots))
+#define CHAN_MEM_SZ(item_sz, slots, flags)							\
+	(((flags) & CHAN_BCAST)									\
+	 ? round_up_to_pow2(__CHAN_MEM_SZ(item_sz, slots), CACHE_LINE * 2) + sizeof(struct __chan_bcast_cursor) * CHAN_BCAST_RCV_MAX \
+	 : __CHAN_MEM_SZ(item_sz, slots))
+
 static inline void
 __chan_init_with(struct __chan_meta *meta, sched_blkpt_id_t full, sched_blkpt_id_t empty, void *mem)
 {
@@ -82,6 +157,13 @@ __chan_init_with(struct __chan_meta *meta, sched_blkpt_id_t full, sched_blkpt_id
 	sync_blkpt_init_w_id(&m->full,  full);
 
 	m->producer = m->consumer = 0;
+	m->producer_cached = m->consumer_cached = 0;
+	if (meta->flags & CHAN_MULTI) {
+		unsigned long *seqs = __chan_seqs(m, meta->wraparound_mask, meta->item_sz);
+		u32_t          i;
+
+		for (i = 0; i <= meta->wraparound_mask; i++) seqs[i] = i;
+	}
 
 	meta->mem = m;
 
@@ -89,16 +171,31 @@ __chan_init_with(struct __chan_meta *meta, sched_blkpt_id_t full, sched_blkpt_id
 }
 
 static inline unsigned int
-__chan_buff_idx_pow2(u32_t v, u32_t wraparound_mask)
+__chan_buff_idx_pow2(unsigned long v, u32_t wraparound_mask)
 { return v & wraparound_mask; }
 
+/*
+ * The SPSC full and empty checks are only called by the producer and
+ * consumer, respectively, and refresh the copy of the remote index
+ * when the ring looks full (empty).
+ */
 static inline int
 __chan_full_pow2(struct __chan_mem *m, u32_t wraparound_mask)
-{ return __chan_buff_idx_pow2(m->consumer, wraparound_mask) == __chan_buff_idx_pow2(m->producer + 1, wraparound_mask); }
+{
+	if (likely(__chan_buff_idx_pow2(m->consumer_cached, wraparound_mask) != __chan_buff_idx_pow2(m->producer + 1, wraparound_mask))) return 0;
+	m->consumer_cached = ps_load(&m->consumer);
+
+	return __chan_buff_idx_pow2(m->consumer_cached, wraparound_mask) == __chan_buff_idx_pow2(m->producer + 1, wraparound_mask);
+}
 
 static inline int
 __chan_empty_pow2(struct __chan_mem *m, u32_t wraparound_mask)
-{ return m->producer == m->consumer; }
+{
+	if (likely(m->producer_cached != m->consumer)) return 0;
+	m->producer_cached = ps_load(&m->producer);
+
+	return m->producer_cached == m->consumer;
+}
 
 static inline int
 __chan_produce_pow2(struct __chan_mem *m, void *d, u32_t wraparound_mask, u32_t item_sz)
@@ -122,8 +219,331 @@ __chan_consume_pow2(struct __chan_mem *m, void *d, u32_t wraparound_mask, u32_t
 	return 0;
 }
 
+/*
+ * Produce or consume up to `n` items with a single update of the
+ * index. These return the number of items transferred.
+ */
+static inline u32_t
+__chan_produce_n_pow2(struct __chan_mem *m, void *d, u32_t n, u32_t wraparound_mask, u32_t item_sz)
+{
+	u32_t avail = wraparound_mask - (u32_t)(m->producer - m->consumer_cached);
+	u32_t i;
+
+	if (n > avail) {
+		m->consumer_cached = ps_load(&m->consumer);
+		avail              = wraparound_mask - (u32_t)(m->producer - m->consumer_cached);
+		if (n > avail) n = avail;
+	}
+	for (i = 0; i < n; i++) {
+		memcpy(m->mem + (__chan_buff_idx_pow2(m->producer + i, wraparound_mask) * item_sz), (char *)d + i * item_sz, item_sz);
+	}
+	m->producer += n;
+
+	return n;
+}
+
+static inline u32_t
+__chan_consume_n_pow2(struct __chan_mem *m, void *d, u32_t n, u32_t wraparound_mask, u32_t item_sz)
+{
+	u32_t avail = (u32_t)(m->producer_cached - m->consumer);
+	u32_t i;
+
+	if (n > avail) {
+		m->producer_cached = ps_load(&m->producer);
+		avail              = (u32_t)(m->producer_cached - m->consumer);
+		if (n > avail) n = avail;
+	}
+	for (i = 0; i < n; i++) {
+		memcpy((char *)d + i * item_sz, m->mem + (__chan_buff_idx_pow2(m->consumer + i, wraparound_mask) * item_sz), item_sz);
+	}
+	m->consumer += n;
+
+	return n;
+}
+
+/* Is the slot at the producer index still holding an item from the previous lap? */
+static inline int
+__chan_mp_full_pow2(struct __chan_mem *m, u32_t wraparound_mask, u32_t item_sz)
+{
+	unsigned long p = ps_load(&m->producer);
+
+	return (long)(ps_load(&__chan_seqs(m, wraparound_mask, item_sz)[__chan_buff_idx_pow2(p, wraparound_mask)]) - p) < 0;
+}
+
+/* Is the slot at the consumer index yet to be published? */
+static inline int
+__chan_mp_empty_pow2(struct __chan_mem *m, u32_t wraparound_mask, u32_t item_sz)
+{
+	unsigned long c = ps_load(&m->consumer);
+
+	return (long)(ps_load(&__chan_seqs(m, wraparound_mask, item_sz)[__chan_buff_idx_pow2(c, wraparound_mask)]) - (c + 1)) < 0;
+}
+
+/*
+ * Claim up to `n` of the slots following `*index` that have sequence
+ * numbers of their index + `off` (the free slots for producers, with
+ * `off == 0`, and the published slots for consumers, with `off ==
+ * 1`), returning the number claimed, and the first's index in
+ * `pos`. `cas` is required if there are multiple claimants.
+ */
+static inline u32_t
+__chan_mp_claim_pow2(unsigned long *index, unsigned long *seqs, u32_t n, u32_t wraparound_mask, unsigned long off, int cas, unsigned long *pos)
+{
+	unsigned long p;
+	u32_t         i;
+
+	while (1) {
+		p = ps_load(index);
+		for (i = 0; i < n && ps_load(&seqs[__chan_buff_idx_pow2(p + i, wraparound_mask)]) == p + i + off; i++) ;
+		if (i == 0) {
+			/* Full (empty), unless another producer (consumer) claimed the slot first */
+			if ((long)(ps_load(&seqs[__chan_buff_idx_pow2(p, wraparound_mask)]) - (p + off)) < 0) return 0;
+			continue;
+		}
+		if (!cas) {
+			*index = p + i;
+			break;
+		}
+		if (ps_cas(index, p, p + i)) break;
+	}
+	*pos = p;
+
+	return i;
+}
+
+/*
+ * Hand `n` claimed slots from `pos` off by giving them the sequence
+ * numbers of their index + `off`: to the consumers with `off == 1`,
+ * and to the producers' next lap with `off == wraparound_mask + 1`.
+ */
+static inline void
+__chan_mp_publish_pow2(unsigned long *seqs, unsigned long pos, u32_t n, u32_t wraparound_mask, unsigned long off)
+{
+	u32_t i;
+
+	/* The slots' accesses must complete before they are handed off */
+	ps_mem_fence();
+	for (i = 0; i < n; i++) seqs[__chan_buff_idx_pow2(pos + i, wraparound_mask)] = pos + i + off;
+}
+
+static inline u32_t
+__chan_mp_produce_n_pow2(struct __chan_mem *m, void *d, u32_t n, u32_t wraparound_mask, u32_t item_sz)
+{
+	unsigned long *seqs = __chan_seqs(m, wraparound_mask, item_sz);
+	unsigned long  pos;
+	u32_t          i;
+
+	n = __chan_mp_claim_pow2(&m->producer, seqs, n, wraparound_mask, 0, 1, &pos);
+	for (i = 0; i < n; i++) {
+		memcpy(m->mem + (__chan_buff_idx_pow2(pos + i, wraparound_mask) * item_sz), (char *)d + i * item_sz, item_sz);
+	}
+	if (n > 0) __chan_mp_publish_pow2(seqs, pos, n, wraparound_mask, 1);
+
+	return n;
+}
+
+/* `multi` denotes multiple consumers (MPMC), that must claim slots with a `cas` */
+static inline u32_t
+__chan_mp_consume_n_pow2(struct __chan_mem *m, void *d, u32_t n, u32_t wraparound_mask, u32_t item_sz, int multi)
+{
+	unsigned long *seqs = __chan_seqs(m, wraparound_mask, item_sz);
+	unsigned long  pos;
+	u32_t          i;
+
+	n = __chan_mp_claim_pow2(&m->consumer, seqs, n, wraparound_mask, 1, multi, &pos);
+	for (i = 0; i < n; i++) {
+		memcpy((char *)d + i * item_sz, m->mem + (__chan_buff_idx_pow2(pos + i, wraparound_mask) * item_sz), item_sz);
+	}
+	if (n > 0) __chan_mp_publish_pow2(seqs, pos, n, wraparound_mask, wraparound_mask + 1);
+
+	return n;
+}
+
+/* The cursor of the slowest registered consumer, or the producer's index if there are none */
+static inline unsigned long
+__chan_bcast_min_pow2(struct __chan_mem *m, u32_t wraparound_mask, u32_t item_sz)
+{
+	struct __chan_bcast_cursor *cs  = __chan_bcast_cursors(m, wraparound_mask, item_sz);
+	unsigned long               min = m->producer, c;
+	int                         i;
+
+	for (i = 0; i < CHAN_BCAST_RCV_MAX; i++) {
+		if (ps_load(&cs[i].state) != CHAN_BCAST_ACTIVE) continue;
+		c = ps_load(&cs[i].cursor);
+		if ((long)(c - min) < 0) min = c;
+	}
+
+	return min;
+}
+
+static inline int
+__chan_bcast_full_pow2(struct __chan_mem *m, u32_t wraparound_mask, u32_t item_sz, int lossy)
+{
+	if (lossy || (u32_t)(m->producer - m->consumer_cached) <= wraparound_mask) return 0;
+	m->consumer_cached = __chan_bcast_min_pow2(m, wraparound_mask, item_sz);
+
+	return (u32_t)(m->producer - m->consumer_cached) > wraparound_mask;
+}
+
+/* Only the (single) producer updates the index: the consumers have their own cursors */
+static inline u32_t
+__chan_bcast_produce_n_pow2(struct __chan_mem *m, void *d, u32_t n, u32_t wraparound_mask, u32_t item_sz, int lossy)
+{
+	unsigned long *seqs = __chan_seqs(m, wraparound_mask, item_sz);
+	unsigned long  p    = m->producer;
+	u32_t          avail, i;
+
+	if (!lossy) {
+		avail = wraparound_mask + 1 - (u32_t)(p - m->consumer_cached);
+		if (n > avail) {
+			m->consumer_cached = __chan_bcast_min_pow2(m, wraparound_mask, item_sz);
+			avail              = wraparound_mask + 1 - (u32_t)(p - m->consumer_cached);
+			if (n > avail) n = avail;
+		}
+	} else {
+		if (n > wraparound_mask + 1) n = wraparound_mask + 1;
+		/* Consumers reading the previous lap's items see them change */
+		for (i = 0; i < n; i++) seqs[__chan_buff_idx_pow2(p + i, wraparound_mask)] = 0;
+		ps_mem_fence();
+	}
+	for (i = 0; i < n; i++) {
+		memcpy(m->mem + (__chan_buff_idx_pow2(p + i, wraparound_mask) * item_sz), (char *)d + i * item_sz, item_sz);
+	}
+	if (n == 0) return 0;
+	__chan_mp_publish_pow2(seqs, p, n, wraparound_mask, 1);
+	ps_store(&m->producer, p + n);
+
+	return n;
+}
+
+/* Has the item at the consumer's cursor been overwritten by the next lap? */
+static inline int
+__chan_bcast_lagged_pow2(struct __chan_mem *m, unsigned long cursor, u32_t wraparound_mask)
+{
+	return (long)(ps_load(&m->producer) - cursor) > (long)wraparound_mask + 1;
+}
+
+static inline int
+__chan_bcast_empty_pow2(struct __chan_meta *meta)
+{
+	struct __chan_mem *m = meta->mem;
+	unsigned long      c = meta->cursor;
+
+	if (ps_load(&__chan_seqs(m, meta->wraparound_mask, meta->item_sz)[__chan_buff_idx_pow2(c, meta->wraparound_mask)]) == c + 1) return 0;
+
+	return !__chan_bcast_lagged_pow2(m, c, meta->wraparound_mask);
+}
+
+static inline u32_t
+__chan_bcast_consume_n_pow2(struct __chan_meta *meta, void *d, u32_t n, u32_t wraparound_mask, u32_t item_sz, int lossy)
+{
+	struct __chan_mem *m    = meta->mem;
+	unsigned long     *seqs = __chan_seqs(m, wraparound_mask, item_sz);
+	unsigned long      c    = meta->cursor, *seq, p;
+	u32_t              i;
+
+	while (1) {
+		for (i = 0; i < n; i++) {
+			seq = &seqs[__chan_buff_idx_pow2(c + i, wraparound_mask)];
+			if (ps_load(seq) != c + i + 1) break;
+			memcpy((char *)d + i * item_sz, m->mem + (__chan_buff_idx_pow2(c + i, wraparound_mask) * item_sz), item_sz);
+			if (!lossy) continue;
+			/* The copy must complete before we check that the producer didn't overwrite it */
+			ps_mem_fence();
+			if (ps_load(seq) != c + i + 1) break;
+		}
+		if (i > 0 || !__chan_bcast_lagged_pow2(m, c, wraparound_mask)) break;
+		/* The producer lapped us: skip to the next item it produces */
+		p           = ps_load(&m->producer);
+		meta->lost += p - c;
+		c           = p;
+	}
+	c += i;
+	meta->cursor = c;
+	ps_store(&__chan_bcast_cursors(m, wraparound_mask, item_sz)[meta->rcv_idx].cursor, c);
+
+	return i;
+}
+
+/*
+ * Register a consumer of a broadcast channel, that receives the items
+ * sent after it registers. Returns `0`, or `-1` if the channel has
+ * `CHAN_BCAST_RCV_MAX` consumers.
+ */
+static inline int
+__chan_bcast_rcv_register(struct __chan_meta *meta)
+{
+	struct __chan_bcast_cursor *cs = __chan_bcast_cursors(meta->mem, meta->wraparound_mask, meta->item_sz);
+	u32_t                       i;
+
+	for (i = 0; i < CHAN_BCAST_RCV_MAX; i++) {
+		if (ps_load(&cs[i].state) != CHAN_BCAST_FREE || !ps_cas(&cs[i].state, CHAN_BCAST_FREE, CHAN_BCAST_CLAIM)) continue;
+
+		meta->rcv_idx = i;
+		meta->cursor  = ps_load(&meta->mem->producer);
+		meta->lost    = 0;
+		ps_store(&cs[i].cursor, meta->cursor);
+		/* The producer must see our cursor before it accounts for it */
+		ps_mem_fence();
+		ps_store(&cs[i].state, CHAN_BCAST_ACTIVE);
+
+		return 0;
+	}
+
+	return -1;
+}
+
+static inline void
+__chan_bcast_rcv_unregister(struct __chan_meta *meta)
+{
+	struct __chan_mem *m = meta->mem;
+
+	ps_store(&__chan_bcast_cursors(m, meta->wraparound_mask, meta->item_sz)[meta->rcv_idx].state, CHAN_BCAST_FREE);
+	/* The producer might wait for us */
+	sync_blkpt_id_trigger(&m->full, meta->blkpt_full_id, 0);
+}
+
+/* Can a spinning sender (receiver) stop waiting (see `sync_blkpt_spin`)? */
+static inline int
+__chan_snd_ready(void *d)
+{
+	struct __chan_meta *meta = d;
+
+	if (meta->flags & CHAN_BCAST) return !__chan_bcast_full_pow2(meta->mem, meta->wraparound_mask, meta->item_sz, meta->flags & CHAN_LOSSY);
+	if (meta->flags & CHAN_MULTI) return !__chan_mp_full_pow2(meta->mem, meta->wraparound_mask, meta->item_sz);
+
+	return !__chan_full_pow2(meta->mem, meta->wraparound_mask);
+}
+
+static inline int
+__chan_rcv_ready(void *d)
+{
+	struct __chan_meta *meta = d;
+
+	if (meta->flags & CHAN_BCAST) return !__chan_bcast_empty_pow2(meta);
+	if (meta->flags & CHAN_MULTI) return !__chan_mp_empty_pow2(meta->mem, meta->wraparound_mask, meta->item_sz);
+
+	return !__chan_empty_pow2(meta->mem, meta->wraparound_mask);
+}
+
 void __chan_meta_evt_update(struct __chan_meta *meta);
 
+/* Wake the receivers of a send */
+static inline int
+__chan_send_notify(struct __chan_meta *meta)
+{
+	sync_blkpt_id_trigger(&meta->mem->empty, meta->blkpt_empty_id, 0);
+	if (unlikely(meta->mem->producer_update)) {
+		meta->mem->producer_update = 0;
+		__chan_meta_evt_update(meta);
+	}
+	if (meta->evt_id) {
+		if (evt_src_trigger(&meta->evt_src)) return -1;
+	}
+
+	return 0;
+}
+
 /**
  * The next two functions pass all of the variables in via arguments,
  * so that we can use them for constant propagation along with
@@ -145,21 +565,13 @@ __chan_send_pow2(struct chan_snd *s, void *item, u32_t wraparound_mask, u32_t it
 
 		sync_blkpt_checkpoint(&m->full, &chkpt);
 		if (!__chan_produce_pow2(m, item, wraparound_mask, item_sz)) {
-			struct __chan_meta *meta = &s->meta;
-
 			/* success! */
-			sync_blkpt_id_trigger(&m->empty, s->meta.blkpt_empty_id, 0);
-			if (unlikely(meta->mem->producer_update)) {
-				meta->mem->producer_update = 0;
-				__chan_meta_evt_update(meta);
-			}
-			if (meta->evt_id) {
-				if (evt_trigger(meta->evt_id)) return -1;
-			}
+			if (__chan_send_notify(&s->meta)) return -1;
 			break;
 		}
 		if (!blking) return 1;
-
+		/* Spin for a while, in case a receiver on another core is about to open a slot */
+		if (sync_blkpt_spin(&m->full, __chan_snd_ready, &s->meta)) continue;
 		/* Post that we want to block */
 		if (sync_blkpt_id_blocking(&m->full, s->meta.blkpt_full_id, 0, &chkpt)) continue;
 		/* has a preemption before wait opened an empty slot? */
@@ -185,6 +597,8 @@ __chan_recv_pow2(struct chan_rcv *r, void *item, u32_t wraparound_mask, u32_t it
 			break;
 		}
 		if (!blking) return 1;
+		/* Spin for a while, in case a sender on another core is about to add an item */
+		if (sync_blkpt_spin(&m->empty, __chan_rcv_ready, &r->meta)) continue;
 		/* Post that we want to block */
 		if (sync_blkpt_id_blocking(&m->empty, r->meta.blkpt_empty_id, 0, &chkpt)) continue;
 		/* has a preemption before wait added data into a slot? */
@@ -195,11 +609,179 @@ __chan_recv_pow2(struct chan_rcv *r, void *item, u32_t wraparound_mask, u32_t it
 	return 0;
 }
 
+/**
+ * Send or receive up to `n` items, in any of the channel modes, with
+ * a single blkpt (thus evt) notification. Blocking calls wait until
+ * at least one item is transferred.
+ *
+ * - @return -
+ *
+ *     - `-n` on error,
+ *     - the number of items sent/received, or
+ *     - `0` if none could be (non-blocking).
+ */
+static inline int
+__chan_send_n_pow2(struct chan_snd *s, void *items, u32_t n, u32_t wraparound_mask, u32_t item_sz, int blking)
+{
+	struct __chan_mem *m = s->meta.mem;
+	int                multi = s->meta.flags & CHAN_MULTI;
+	int                bcast = s->meta.flags & CHAN_BCAST;
+	u32_t              sent;
+
+	while (1) {
+		struct sync_blkpt_checkpoint chkpt;
+
+		sync_blkpt_checkpoint(&m->full, &chkpt);
+		if (bcast)      sent = __chan_bcast_produce_n_pow2(m, items, n, wraparound_mask, item_sz, s->meta.flags & CHAN_LOSSY);
+		else if (multi) sent = __chan_mp_produce_n_pow2(m, items, n, wraparound_mask, item_sz);
+		else            sent = __chan_produce_n_pow2(m, items, n, wraparound_mask, item_sz);
+		if (sent > 0) {
+			if (__chan_send_notify(&s->meta)) return -1;
+
+			return sent;
+		}
+		if (!blking) return 0;
+		/* Spin for a while, in case a receiver on another core is about to open a slot */
+		if (sync_blkpt_spin(&m->full, __chan_snd_ready, &s->meta)) continue;
+		/* Post that we want to block */
+		if (sync_blkpt_id_blocking(&m->full, s->meta.blkpt_full_id, 0, &chkpt)) continue;
+		/* has a preemption before wait opened an empty slot? */
+		if (__chan_snd_ready(&s->meta)) continue;
+		sync_blkpt_id_wait(&m->full, s->meta.blkpt_full_id, 0, &chkpt);
+	}
+}
+
+static inline int
+__chan_recv_n_pow2(struct chan_rcv *r, void *items, u32_t n, u32_t wraparound_mask, u32_t item_sz, int blking)
+{
+	struct __chan_mem *m = r->meta.mem;
+	int                multi = r->meta.flags & CHAN_MULTI;
+	int                bcast = r->meta.flags & CHAN_BCAST;
+	u32_t              rcvd;
+
+	while (1) {
+		struct sync_blkpt_checkpoint chkpt;
+
+		sync_blkpt_checkpoint(&m->empty, &chkpt);
+		if (bcast)      rcvd = __chan_bcast_consume_n_pow2(&r->meta, items, n, wraparound_mask, item_sz, r->meta.flags & CHAN_LOSSY);
+		else if (multi) rcvd = __chan_mp_consume_n_pow2(m, items, n, wraparound_mask, item_sz, r->meta.flags & CHAN_MPMC);
+		else            rcvd = __chan_consume_n_pow2(m, items, n, wraparound_mask, item_sz);
+		if (rcvd > 0) {
+			sync_blkpt_id_trigger(&m->full, r->meta.blkpt_full_id, 0);
+
+			return rcvd;
+		}
+		if (!blking) return 0;
+		/* Spin for a while, in case a sender on another core is about to add an item */
+		if (sync_blkpt_spin(&m->empty, __chan_rcv_ready, &r->meta)) continue;
+		/* Post that we want to block */
+		if (sync_blkpt_id_blocking(&m->empty, r->meta.blkpt_empty_id, 0, &chkpt)) continue;
+		/* has a preemption before wait added data into a slot? */
+		if (__chan_rcv_ready(&r->meta)) continue;
+		sync_blkpt_id_wait(&m->empty, r->meta.blkpt_empty_id, 0, &chkpt);
+	}
+}
+
+/*
+ * Zero-copy sends and receives: reserve the next slot, and access the
+ * item in place in the ring, before committing (releasing) it. For
+ * MP channels, the endpoint remembers the index of the slot it
+ * claimed in `meta.reserved`, so each endpoint can hold a single
+ * reservation at a time.
+ */
+static inline void *
+__chan_send_reserve_pow2(struct chan_snd *s, u32_t wraparound_mask, u32_t item_sz, int blking)
+{
+	struct __chan_mem *m     = s->meta.mem;
+	int                multi = s->meta.flags & CHAN_MULTI;
+
+	while (1) {
+		struct sync_blkpt_checkpoint chkpt;
+
+		sync_blkpt_checkpoint(&m->full, &chkpt);
+		if (multi) {
+			if (__chan_mp_claim_pow2(&m->producer, __chan_seqs(m, wraparound_mask, item_sz), 1, wraparound_mask, 0, 1, &s->meta.reserved)) {
+				return m->mem + (__chan_buff_idx_pow2(s->meta.reserved, wraparound_mask) * item_sz);
+			}
+		} else if (!__chan_full_pow2(m, wraparound_mask)) {
+			return m->mem + (__chan_buff_idx_pow2(m->producer, wraparound_mask) * item_sz);
+		}
+		if (!blking) return NULL;
+		/* Spin for a while, in case a receiver on another core is about to open a slot */
+		if (sync_blkpt_spin(&m->full, __chan_snd_ready, &s->meta)) continue;
+		/* Post that we want to block */
+		if (sync_blkpt_id_blocking(&m->full, s->meta.blkpt_full_id, 0, &chkpt)) continue;
+		/* has a preemption before wait opened an empty slot? */
+		if (multi ? !__chan_mp_full_pow2(m, wraparound_mask, item_sz) : !__chan_full_pow2(m, wraparound_mask)) continue;
+		sync_blkpt_id_wait(&m->full, s->meta.blkpt_full_id, 0, &chkpt);
+	}
+}
+
+static inline int
+__chan_send_commit_pow2(struct chan_snd *s, u32_t wraparound_mask, u32_t item_sz)
+{
+	struct __chan_mem *m = s->meta.mem;
+
+	if (s->meta.flags & CHAN_MULTI) {
+		__chan_mp_publish_pow2(__chan_seqs(m, wraparound_mask, item_sz), s->meta.reserved, 1, wraparound_mask, 1);
+	} else {
+		/* The item is written in place, so the compiler must not sink its stores past the index update */
+		__asm__ __volatile__("" : : : "memory");
+		m->producer++;
+	}
+
+	return __chan_send_notify(&s->meta);
+}
+
+static inline void *
+__chan_recv_peek_pow2(struct chan_rcv *r, u32_t wraparound_mask, u32_t item_sz, int blking)
+{
+	struct __chan_mem *m     = r->meta.mem;
+	int                multi = r->meta.flags & CHAN_MULTI;
+
+	while (1) {
+		struct sync_blkpt_checkpoint chkpt;
+
+		sync_blkpt_checkpoint(&m->empty, &chkpt);
+		if (multi) {
+			if (__chan_mp_claim_pow2(&m->consumer, __chan_seqs(m, wraparound_mask, item_sz), 1, wraparound_mask, 1,
+			                         r->meta.flags & CHAN_MPMC, &r->meta.reserved)) {
+				return m->mem + (__chan_buff_idx_pow2(r->meta.reserved, wraparound_mask) * item_sz);
+			}
+		} else if (!__chan_empty_pow2(m, wraparound_mask)) {
+			return m->mem + (__chan_buff_idx_pow2(m->consumer, wraparound_mask) * item_sz);
+		}
+		if (!blking) return NULL;
+		/* Spin for a while, in case a sender on another core is about to add an item */
+		if (sync_blkpt_spin(&m->empty, __chan_rcv_ready, &r->meta)) continue;
+		/* Post that we want to block */
+		if (sync_blkpt_id_blocking(&m->empty, r->meta.blkpt_empty_id, 0, &chkpt)) continue;
+		/* has a preemption before wait added data into a slot? */
+		if (multi ? !__chan_mp_empty_pow2(m, wraparound_mask, item_sz) : !__chan_empty_pow2(m, wraparound_mask)) continue;
+		sync_blkpt_id_wait(&m->empty, r->meta.blkpt_empty_id, 0, &chkpt);
+	}
+}
+
+static inline void
+__chan_recv_release_pow2(struct chan_rcv *r, u32_t wraparound_mask, u32_t item_sz)
+{
+	struct __chan_mem *m = r->meta.mem;
+
+	if (r->meta.flags & CHAN_MULTI) {
+		__chan_mp_publish_pow2(__chan_seqs(m, wraparound_mask, item_sz), r->meta.reserved, 1, wraparound_mask, wraparound_mask + 1);
+	} else {
+		/* Reads of the item in place must complete before the producer can reuse the slot */
+		__asm__ __volatile__("" : : : "memory");
+		m->consumer++;
+	}
+	sync_blkpt_id_trigger(&m->full, r->meta.blkpt_full_id, 0);
+}
+
 /* How many slots can we fit into an allocation of a specific mem_sz */
 static inline int
 chan_nslots(int item_sz, int mem_sz)
 {
-	return leqpow2((mem_sz - sizeof(struct __chan_mem)) / item_sz);
+	return leqpow2((mem_sz - sizeof(struct __chan_mem)) / (item_sz + sizeof(unsigned long)));
 }
 
 #endif /* CHAN_PRIVATE_H */
@@ -34,9 +34,16 @@ typedef word_t chan_id_t;
 /* Values for channel initialization */
 typedef enum {
 	CHAN_DEFAULT    = 0,
-	CHAN_MPSC       = 1,	  /* !CHAN_MPSC == SPSC */
+	CHAN_MPSC       = 1,	  /* !(CHAN_MPSC | CHAN_MPMC) == SPSC */
 	CHAN_EXACT_SIZE = 1 << 1, /* The channel size cannot be higher than its initialization size */
-	CHAN_DEALLOCATE = 1 << 2  /* used internally for the `_alloc` APIs */
+	CHAN_DEALLOCATE = 1 << 2, /* used internally for the `_alloc` APIs */
+	CHAN_MPMC       = 1 << 3,
+	CHAN_BCAST      = 1 << 4, /* Single producer, each item received by all of the consumers */
+	CHAN_LOSSY      = 1 << 5, /* For CHAN_BCAST: the producer overwrites the items of slow consumers */
+	CHAN_LOCAL      = 1 << 6  /* used internally: `chan_init_mem` allocated the blkpts */
 } chan_flags_t;
 
+/* Channels with multiple producers or consumers */
+#define CHAN_MULTI (CHAN_MPSC | CHAN_MPMC)
+
 #endif	/* CHAN_TYPES_H */
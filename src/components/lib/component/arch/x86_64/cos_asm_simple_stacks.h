@@ -26,6 +26,7 @@
 #define COS_ASM_REQUEST_STACK
 
 #define COS_SIMPLE_STACK_THDID_OFF 0x1fff0
+#define COS_SIMPLE_STACK_CPUID_OFF 0x1fff8
 
 /*
  * pkru = ~(0b11 << (2 * pkey)) & ~0b11;
@@ -33,16 +34,24 @@
  * the pkey we want to enable. 
  * See intels manual for pkru details
  */
+#define COS_ULINV_PKRU(pkey) (~(0b11 << (2 * (pkey))) & ~0b11)
+
 #define COS_ULINV_SWITCH_DOMAIN(protdom)			\
-	movl	$protdom,  %ecx;				\
-	addl	%ecx,      %ecx;				\
-	movl	$0b11,     %eax;				\
-	sall	%cl,       %eax;				\
-	notl	%eax;						\
-	andl	$-4,       %eax;				\
-	xor	%rcx,      %rcx;				\
-	xor	%rdx,      %rdx;				\
-	wrpkru;	
+	movl	$COS_ULINV_PKRU(protdom), %eax;			\
+	xor	%ecx,      %ecx;				\
+	xor	%edx,      %edx;				\
+	wrpkru;
+
+/*
+ * Switch to the PKRU value patched in at boot time, in the
+ * immediate before `label`.
+ */
+#define COS_ULINV_SWITCH_PKRU_AT(label)				\
+	movl	$0,        %eax;				\
+label:								\
+	xor	%ecx,      %ecx;				\
+	xor	%edx,      %edx;				\
+	wrpkru;
 
 /* 
  * Get a pointer to this thread's user-level
@@ -64,15 +73,18 @@
  * push an entry onto this thread's user-level
  * invocation stack. 
  * - input: r14 = pointer to stack
+ * - the cap no is patched at boot time, in the
+ *   immediate before `capno`
  */
-#define COS_ULINV_PUSH_INVSTK					\
+#define COS_ULINV_PUSH_INVSTK(capno)				\
 	movq    (%r14), %rdx;					\
 	addq    $1,     %rdx;					\
 	shlq    $4,     %rdx;					\
 	/* rdx = &stack_entry */	 			\
 	addq    %r14,   %rdx;					\
 	/* store cap no and sp */				\
-	movq    $0x0123456789abcdef, %rax; 			\
+	movabs  $0, %rax; 					\
+capno:								\
 	movq    %rax, (%rdx); 					\
 	movq    %rsp, 8(%rdx); 					\
 	/* increment top-of-stack */				\
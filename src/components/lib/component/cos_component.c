@@ -116,6 +116,11 @@ libc_posixsched_initialization_handler()
 {
 }
 
+CWEAKSYMB void
+libc_posixnet_initialization_handler()
+{
+}
+
 CWEAKSYMB void
 libc_tls_init(unsigned int cpuid)
 {
@@ -174,6 +179,13 @@ cos_thd_entry_static(u32_t idx)
 	return 0;
 }
 
+/* Overridden by the capmgr_create stubs: no pooled threads without them */
+CWEAKSYMB thdid_t
+capmgr_create_thd_reserve(void)
+{
+	return 0;
+}
+
 CWEAKSYMB int
 cos_print_str(char *s, int len)
 {
@@ -229,6 +241,26 @@ cos_thd_entry_exec(u32_t idx)
 	(fn)(data);
 }
 
+/* The closures of the pooled threads, indexed by their ids (see cos_thd_init.h) */
+struct __thd_init_data __thd_pool_data[MAX_NUM_THREADS + 1];
+
+static void
+cos_thd_entry_pool(void)
+{
+	thdid_t tid = cos_thdid();
+	void (*fn)(void *);
+	void *data;
+
+	assert(tid <= MAX_NUM_THREADS);
+	fn   = __thd_pool_data[tid].fn;
+	data = __thd_pool_data[tid].data;
+	assert(fn);
+	__thd_pool_data[tid].data = NULL;
+	__thd_pool_data[tid].fn   = NULL;
+
+	(fn)(data);
+}
+
 static void
 start_execution(coreid_t cid, int init_core, int ncores)
 {
@@ -332,6 +364,7 @@ cos_upcall_fn(upcall_type_t t, void *arg1, void *arg2, void *arg3)
 		/* init lib posix variants */
 		libc_posixcap_initialization_handler();
 		libc_posixsched_initialization_handler();
+		libc_posixnet_initialization_handler();
 
 
 		constructors_execute();
@@ -361,7 +394,9 @@ cos_upcall_fn(upcall_type_t t, void *arg1, void *arg2, void *arg3)
 			start_execution(cos_coreid(), ps_cas(&first_core, 1, 0), init_parallelism());
 		} else {
 			word_t idx = (word_t)arg1 - 1;
-			if (idx >= COS_THD_INIT_REGION_SIZE) {
+			if ((word_t)arg1 == COS_THD_POOL_CLOSURE) {
+				cos_thd_entry_pool();
+			} else if (idx >= COS_THD_INIT_REGION_SIZE) {
 				/* This means static defined entry */
 				cos_thd_entry_static(idx - COS_THD_INIT_REGION_SIZE);
 			} else {
@@ -1,9 +1,28 @@
 #ifndef COS_THD_INIT_H
 #define COS_THD_INIT_H
 
+#include <consts.h>
 #include <cos_debug.h>
 
 extern struct __thd_init_data __thd_init_data[COS_THD_INIT_REGION_SIZE];
+extern struct __thd_init_data __thd_pool_data[MAX_NUM_THREADS + 1];
+
+/*
+ * The capmgr can pre-create a pool of threads in a component (`thd_pool`
+ * in the composition) so that creating one doesn't take the kernel
+ * operations. They all begin execution in the pool closure, which
+ * executes the closure set for the thread's id. The component sets it
+ * after reserving a pooled thread, and before creating a thread with
+ * the reserved closure, thus before the thread can execute.
+ */
+#define COS_THD_POOL_CLOSURE COS_STATIC_THD_ENTRY(1 << 16)
+#define COS_THD_POOL_RESERVED(tid) (COS_THD_POOL_CLOSURE + (thdclosure_index_t)(tid))
+/* The reserved thread's id, or 0 if the closure isn't for a reserved thread */
+#define COS_THD_POOL_RESERVED_TID(idx) \
+	(((idx) > COS_THD_POOL_CLOSURE && (idx) <= COS_THD_POOL_CLOSURE + MAX_NUM_THREADS) ? (thdid_t)((idx) - COS_THD_POOL_CLOSURE) : 0)
+
+/* capmgr_create interface; returns 0 (no pool) if the component doesn't depend on it */
+thdid_t capmgr_create_thd_reserve(void);
 
 static inline thdclosure_index_t
 __init_data_alloc(void *fn, void *data)
@@ -70,4 +89,24 @@ cos_thd_init_free(thdclosure_index_t idx)
 	return;
 }
 
+/*
+ * Allocate the closure to create a thread that executes fn with data:
+ * from a pooled thread if one is available, else from the dynamic
+ * closures.
+ */
+static thdclosure_index_t
+cos_thd_pool_alloc(void *fn, void *data)
+{
+	thdid_t tid;
+
+	if (!fn) return -1;
+	tid = capmgr_create_thd_reserve();
+	if (tid == 0 || tid > MAX_NUM_THREADS) return __init_data_alloc(fn, data);
+
+	__thd_pool_data[tid].data = data;
+	__thd_pool_data[tid].fn   = fn;
+
+	return COS_THD_POOL_RESERVED(tid);
+}
+
 #endif /* COS_THD_INIT_H */
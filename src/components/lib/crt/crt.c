@@ -78,38 +78,400 @@ crt_nchkpt()
 	return nchkpt;
 }
 
+/***
+ * The text and read-only data of the components are shared, read-only,
+ * by the instances of the same object (the same image at the same
+ * address), and by the checkpoints and the components created from
+ * them: only their data and BSS are copied. `crt_images` are the
+ * read-only frames of each object, found by comparing the images. The
+ * components of a shared vas don't share their text, as the
+ * call-gates of their sinvs are written into it.
+ *
+ * The image memory of a component (`c->mem`) is still contiguous in
+ * our address space: the shared frames are mapped read-only,
+ * followed by the component's own pages.
+ */
+#define CRT_IMAGES_MAX 64
+
+struct crt_image {
+	vaddr_t ro_addr;
+	size_t  ro_sz;
+	char   *ro;     /* NULL until the image is published */
+};
+
+static struct crt_image crt_images[CRT_IMAGES_MAX];
+static unsigned long    crt_nimages;
+
+static char *
+crt_image_lookup(vaddr_t ro_addr, size_t ro_sz, char *ro_src)
+{
+	unsigned long i, n = ps_load(&crt_nimages);
+
+	if (n > CRT_IMAGES_MAX) n = CRT_IMAGES_MAX;
+	for (i = 0; i < n; i++) {
+		struct crt_image *im = &crt_images[i];
+		char             *ro = ps_load(&im->ro);
+
+		if (!ro || im->ro_addr != ro_addr || im->ro_sz != ro_sz) continue;
+		if (!memcmp(ro, ro_src, ro_sz)) return ro;
+	}
+
+	return NULL;
+}
+
+static void
+crt_image_add(vaddr_t ro_addr, size_t ro_sz, char *ro)
+{
+	unsigned long i = ps_faa(&crt_nimages, 1);
+
+	if (i >= CRT_IMAGES_MAX) return;
+	crt_images[i].ro_addr = ro_addr;
+	crt_images[i].ro_sz   = ro_sz;
+	ps_mem_fence();
+	crt_images[i].ro = ro;
+}
+
+/*
+ * Image memory of `tot_sz` bytes whose first `ro_sz` (rounded up to a
+ * page) are the frames at `ro`, mapped read-only, and the rest new
+ * pages.
+ */
+static char *
+crt_image_mem_shared(struct cos_compinfo *root_ci, char *ro, size_t ro_sz, size_t tot_sz)
+{
+	size_t  ro_pgs = round_up_to_page(ro_sz), rw_sz = tot_sz - ro_pgs;
+	vaddr_t mem;
+	char   *rw = NULL;
+
+	mem = cos_page_bump_valloc(root_ci, tot_sz, PAGE_SIZE);
+	if (!mem) return NULL;
+	if (rw_sz) {
+		rw = cos_page_bump_allocn(root_ci, rw_sz);
+		if (!rw) return NULL;
+	}
+	cos_mem_alias_atn(root_ci, mem, root_ci, (vaddr_t)ro, ro_pgs, COS_PAGE_READABLE);
+	if (rw_sz) cos_mem_alias_atn(root_ci, mem + ro_pgs, root_ci, (vaddr_t)rw, rw_sz, COS_PAGE_READABLE | COS_PAGE_WRITABLE);
+
+	return (char *)mem;
+}
+
+/*
+ * Image memory of `tot_sz` bytes for the object `img`, pre-laid by the
+ * composer, at `ro_src` in the booter's tarball: its RO and data
+ * frames are aliased (read-only, and writable) rather than copied, and
+ * only the remaining BSS pages are new. The data frames are the
+ * component's from now on, so an image can only be mapped once, and
+ * it must be page-aligned in our memory. NULL if it cannot be mapped,
+ * and should be copied instead.
+ */
+static char *
+crt_image_mem_prelaid(struct cos_compinfo *root_ci, struct img_hdr *img, char *ro_src, size_t tot_sz)
+{
+	size_t  ro_pgs = round_up_to_page(img->ro_sz), data_pgs = round_up_to_page(img->data_sz);
+	size_t  bss_pgs = tot_sz - ro_pgs - data_pgs;
+	vaddr_t mem;
+	char   *bss = NULL;
+
+	if (round_to_page(ro_src) != (unsigned long)ro_src) return NULL;
+	if (!ps_cas((unsigned long *)&img->mapped, 0, 1)) return NULL;
+
+	mem = cos_page_bump_valloc(root_ci, tot_sz, PAGE_SIZE);
+	if (!mem) return NULL;
+	if (bss_pgs) {
+		bss = cos_page_bump_allocn(root_ci, bss_pgs);
+		if (!bss) return NULL;
+		memset(bss, 0, bss_pgs);
+	}
+	cos_mem_alias_atn(root_ci, mem, root_ci, (vaddr_t)ro_src, ro_pgs, COS_PAGE_READABLE);
+	if (data_pgs) cos_mem_alias_atn(root_ci, mem + ro_pgs, root_ci, (vaddr_t)ro_src + ro_pgs, data_pgs, COS_PAGE_READABLE | COS_PAGE_WRITABLE);
+	if (bss_pgs) cos_mem_alias_atn(root_ci, mem + ro_pgs + data_pgs, root_ci, (vaddr_t)bss, bss_pgs, COS_PAGE_READABLE | COS_PAGE_WRITABLE);
+
+	return (char *)mem;
+}
+
+/***
+ * Checkpoints hold a copy of the data and BSS of a component, and of
+ * the pages mapped in it beyond its image (its heap, found in its page
+ * table up to its heap frontier). The components created from a
+ * checkpoint share its text, and if the booter handles the page
+ * faults of all cores (`crt_chkpt_pgflt_init`), get none of their
+ * other pages at creation: each is copied from the checkpoint on its
+ * first access (`crt_chkpt_pgflt`). The kernel can't replace a present
+ * mapping before its TLB quiescence, so the pages are copied on their
+ * first access, read or write, rather than on write.
+ */
+#define CRT_CHKPT_FORKS_MAX 64
+
+static struct crt_comp *crt_chkpt_forks[CRT_CHKPT_FORKS_MAX];
+static unsigned long    crt_chkpt_nforks, crt_chkpt_pgflt_ncores;
+static struct ps_lock   crt_chkpt_lock;
+
+static inline unsigned long
+crt_chkpt_npgs(struct crt_comp *c)
+{
+	return c->tot_sz_mem / PAGE_SIZE + c->chkpt->heap_npgs;
+}
+
+/*
+ * The address in `c` of its page `pg`, our view of it, and the copy
+ * of it in the checkpoint.
+ */
+static vaddr_t
+crt_chkpt_page(struct crt_comp *c, unsigned long pg, char **view, char **src)
+{
+	struct crt_chkpt *chkpt   = c->chkpt;
+	unsigned long     img_pgs = c->tot_sz_mem / PAGE_SIZE;
+
+	if (pg < img_pgs) {
+		*view = c->mem + pg * PAGE_SIZE;
+		*src  = chkpt->mem + pg * PAGE_SIZE;
+
+		return c->ro_addr + pg * PAGE_SIZE;
+	}
+	pg -= img_pgs;
+	*view = c->heap_mem + pg * PAGE_SIZE;
+	*src  = chkpt->heap + pg * PAGE_SIZE;
+
+	return chkpt->heap_addrs[pg];
+}
+
+/* Copy the page `pg` of `c` from its checkpoint, if it isn't yet */
+static int
+crt_chkpt_page_populate(struct crt_comp *c, unsigned long pg)
+{
+	struct cos_compinfo *ci      = cos_compinfo_get(c->comp_res);
+	struct cos_compinfo *root_ci = cos_compinfo_get(cos_defcompinfo_curr_get());
+	char                *view, *src, *page;
+	vaddr_t              addr;
+	int                  ret = 0;
+
+	assert(c->chkpt && pg < crt_chkpt_npgs(c));
+	if (ps_load(&c->populated[pg])) return 0;
+
+	ps_lock_take(&crt_chkpt_lock);
+	if (c->populated[pg]) goto done;
+
+	addr = crt_chkpt_page(c, pg, &view, &src);
+	page = cos_page_bump_alloc(root_ci);
+	if (!page) {
+		ret = -ENOMEM;
+		goto done;
+	}
+	memcpy(page, src, PAGE_SIZE);
+	cos_mem_alias_at(root_ci, (vaddr_t)view, root_ci, (vaddr_t)page, COS_PAGE_READABLE | COS_PAGE_WRITABLE);
+	cos_mem_alias_at(ci, addr, root_ci, (vaddr_t)page, COS_PAGE_READABLE | COS_PAGE_WRITABLE);
+	ps_mem_fence();
+	c->populated[pg] = 1;
+done:
+	ps_lock_release(&crt_chkpt_lock);
+
+	return ret;
+}
+
+/* Populate the pages of `c` that hold `sz` bytes at `off` in its image */
+static int
+crt_comp_mem_populate(struct crt_comp *c, size_t off, size_t sz)
+{
+	unsigned long pg;
+
+	if (!c->chkpt) return 0;
+	for (pg = off / PAGE_SIZE; pg * PAGE_SIZE < off + sz; pg++) {
+		if (crt_chkpt_page_populate(c, pg)) return -ENOMEM;
+	}
+
+	return 0;
+}
+
+static int
+crt_comp_populate(struct crt_comp *c)
+{
+	unsigned long pg;
+
+	if (!c->chkpt) return 0;
+	for (pg = 0; pg < crt_chkpt_npgs(c); pg++) {
+		if (crt_chkpt_page_populate(c, pg)) return -ENOMEM;
+	}
+
+	return 0;
+}
+
+/*
+ * Copy the pages mapped in `c` beyond its image, up to its heap
+ * frontier, into the checkpoint. The pages that can't be aliased
+ * (e.g. the kernel's) aren't part of it.
+ */
+static int
+crt_chkpt_heap_create(struct crt_chkpt *chkpt, struct crt_comp *c)
+{
+	struct cos_compinfo *ci      = cos_compinfo_get(c->comp_res);
+	struct cos_compinfo *root_ci = cos_compinfo_get(cos_defcompinfo_curr_get());
+	vaddr_t              start   = c->ro_addr + c->tot_sz_mem, addr;
+	unsigned long        max_pgs, n = 0;
+
+	chkpt->heap_npgs = 0;
+	if (ci->vas_frontier <= start) return 0;
+	max_pgs = (ci->vas_frontier - start) / PAGE_SIZE;
+
+	chkpt->heap_orig  = (char *)cos_page_bump_valloc(root_ci, max_pgs * PAGE_SIZE, PAGE_SIZE);
+	chkpt->heap_addrs = cos_page_bump_allocn(root_ci, round_up_to_page(max_pgs * sizeof(vaddr_t)));
+	if (!chkpt->heap_orig || !chkpt->heap_addrs) return -ENOMEM;
+	for (addr = start; addr < start + max_pgs * PAGE_SIZE; addr += PAGE_SIZE) {
+		if (cos_mem_alias_superpagen_at(root_ci, (vaddr_t)chkpt->heap_orig + n * PAGE_SIZE, ci, addr, PAGE_SIZE,
+		                                COS_PAGE_READABLE | COS_PAGE_WRITABLE)) continue;
+		chkpt->heap_addrs[n++] = addr;
+	}
+	if (!n) return 0;
+
+	chkpt->heap = cos_page_bump_allocn(root_ci, n * PAGE_SIZE);
+	if (!chkpt->heap) return -ENOMEM;
+	memcpy(chkpt->heap, chkpt->heap_orig, n * PAGE_SIZE);
+	chkpt->heap_npgs = n;
+
+	return 0;
+}
+
 int
 crt_chkpt_create(struct crt_chkpt *chkpt, struct crt_comp *c)
 {
 	char *mem;
 	struct cos_compinfo *root_ci;
+	size_t ro_pgs = round_up_to_page(c->ro_sz);
 
-	chkpt->c = c;
+	*chkpt = (struct crt_chkpt) {
+		.c          = c,
+		.init_state = c->init_state,
+	};
 	ps_faa(&nchkpt, 1);
+	/* The checkpoint of a component created from another needs all of its pages */
+	if (crt_comp_populate(c)) return -ENOMEM;
 
-	/* allocate space for saving the component's memory */
+	/* allocate space for saving the component's memory, but its text, that doesn't change */
 	root_ci = cos_compinfo_get(cos_defcompinfo_curr_get());
-	mem = cos_page_bump_allocn(root_ci, c->tot_sz_mem);
-	if (!mem) return -ENOMEM;
+	if (c->ns_vas) {
+		mem = cos_page_bump_allocn(root_ci, c->tot_sz_mem);
+		if (!mem) return -ENOMEM;
+		memcpy(mem, c->mem, c->tot_sz_mem);
+	} else {
+		mem = crt_image_mem_shared(root_ci, c->mem, c->ro_sz, c->tot_sz_mem);
+		if (!mem) return -ENOMEM;
+		memcpy(mem + ro_pgs, c->mem + ro_pgs, c->tot_sz_mem - ro_pgs);
+	}
 
 	chkpt->mem = mem;
 	chkpt->tot_sz_mem = c->tot_sz_mem;
 
-	memcpy(mem, c->mem, c->tot_sz_mem);
 	/*
 	 * TODO: capabilities aren't copied, so components that could modify their capabilities
 	 * while running (schedulers/cap mgrs) shouldn't be checkpointed
-	 * TODO: copy dynamically allocated memory into the checkpoint
 	 */
+	return crt_chkpt_heap_create(chkpt, c);
+}
+
+/**
+ * Return `c`, the component checkpointed in `chkpt` or one created
+ * from it, to the state of the checkpoint: its data, BSS, and heap
+ * pages are those of the checkpoint again, and its initialization
+ * state is the checkpoint's. `c` must not be executing. The pages
+ * mapped in `c` since the checkpoint are left as they are.
+ *
+ * The components created from the checkpoint only have the pages they
+ * accessed restored.
+ *
+ * @return: 0 on success, -EINVAL if `c` isn't from `chkpt`.
+ */
+int
+crt_chkpt_restore(struct crt_chkpt *chkpt, struct crt_comp *c)
+{
+	size_t        ro_pgs = round_up_to_page(c->ro_sz);
+	unsigned long pg;
+
+	if (c == chkpt->c) {
+		memcpy(c->mem + ro_pgs, chkpt->mem + ro_pgs, c->tot_sz_mem - ro_pgs);
+		if (chkpt->heap_npgs) memcpy(chkpt->heap_orig, chkpt->heap, chkpt->heap_npgs * PAGE_SIZE);
+	} else if (c->chkpt == chkpt) {
+		for (pg = ro_pgs / PAGE_SIZE; pg < crt_chkpt_npgs(c); pg++) {
+			char *view, *src;
+
+			if (!c->populated[pg]) continue;
+			crt_chkpt_page(c, pg, &view, &src);
+			memcpy(view, src, PAGE_SIZE);
+		}
+	} else {
+		return -EINVAL;
+	}
+	c->init_state = chkpt->init_state;
 
 	return 0;
 }
 
+/*
+ * Resolve the page fault `f` if it is the first access to a page of a
+ * component created from a checkpoint.
+ *
+ * @return: 0 if the page is now mapped, -1 if the fault isn't ours.
+ */
+static int
+crt_chkpt_pgflt(struct cos_pgflt *f)
+{
+	unsigned long i, n = ps_load(&crt_chkpt_nforks), pg;
+	vaddr_t       page = round_to_page(f->addr);
+
+	if (n > CRT_CHKPT_FORKS_MAX) n = CRT_CHKPT_FORKS_MAX;
+	for (i = 0; i < n; i++) {
+		struct crt_comp *c = ps_load(&crt_chkpt_forks[i]);
+
+		if (!c || c->pgflt_pgtbl != f->pgtbl) continue;
+		if (page >= c->ro_addr && page < c->ro_addr + c->tot_sz_mem) {
+			return crt_chkpt_page_populate(c, (page - c->ro_addr) / PAGE_SIZE) ? -1 : 0;
+		}
+		for (pg = 0; pg < c->chkpt->heap_npgs; pg++) {
+			if (c->chkpt->heap_addrs[pg] != page) continue;
+
+			return crt_chkpt_page_populate(c, c->tot_sz_mem / PAGE_SIZE + pg) ? -1 : 0;
+		}
+
+		return -1;
+	}
+
+	return -1;
+}
+
+static void
+crt_chkpt_pgflt_handler(void *d)
+{
+	struct cos_pgflt f;
+
+	/* We only run when a fault switches to us */
+	while (1) {
+		if (cos_hw_pgflt_info(BOOT_CAPTBL_SELF_INITHW_BASE, &f)) BUG();
+		if (crt_chkpt_pgflt(&f)) {
+			printc("crt: unhandled page fault of thread %lu at %lx (ip %lx, errcode %lx)\n",
+			       (unsigned long)f.tid, f.addr, f.ip, f.errcode);
+			BUG();
+		}
+		cos_hw_pgflt_resume(BOOT_CAPTBL_SELF_INITHW_BASE);
+	}
+}
+
+/**
+ * Handle the page faults of this core in `self` (the booter), so
+ * that the components created from checkpoints copy their pages on
+ * their first access. Called on each core: until it is called on all
+ * of them, the components created from checkpoints are copied
+ * entirely at their creation. Only one component can handle the
+ * faults of a core, so this replaces any other handler.
+ *
+ * @return: 0 on success, != 0 on error.
+ */
 int
-crt_chkpt_restore(struct crt_chkpt *chkpt, struct crt_comp *c)
+crt_chkpt_pgflt_init(struct crt_comp *self)
 {
-	/* turning c, a terminated component, back into a chkpt */
-	/* TODO: return memory to a previous saved state */
+	static struct crt_thd pgflt_thds[NUM_CPU];
+
+	if (crt_thd_create(&pgflt_thds[cos_cpuid()], self, crt_chkpt_pgflt_handler, NULL)) return -ENOMEM;
+	if (cos_hw_pgflt_attach(BOOT_CAPTBL_SELF_INITHW_BASE, pgflt_thds[cos_cpuid()].cap)) return -EINVAL;
+	ps_faa(&crt_chkpt_pgflt_ncores, 1);
+
 	return 0;
 }
 
@@ -134,6 +496,8 @@ crt_ulk_map_in(struct crt_comp *comp)
 	return cos_ulk_map_in(ci->pgtbl_cap);
 }
 
+static int crt_comp_create_image(struct crt_comp *c, char *name, compid_t id, void *elf_hdr, vaddr_t info, prot_domain_t protdom, int share_ro);
+
 /*
  * A `crt_comp_create` replacement if you want to create a component
  * in a vas directly.
@@ -153,7 +517,8 @@ crt_comp_create_in_vas(struct crt_comp *c, char *name, compid_t id, void *elf_hd
 
 	protdom = protdom_ns_vas_alloc(vas, (elf_hdr ? elf_entry_addr(elf_hdr) : 0));
 
-	crt_comp_create(c, name, id, elf_hdr, info, protdom);
+	/* Its text is written with the call-gates of its sinvs, so it isn't shared */
+	crt_comp_create_image(c, name, id, elf_hdr, info, protdom, 0);
 
 	protdom_ns_vas_set_comp(vas, elf_entry_addr(elf_hdr), c->comp_res);
 	top_lvl_ptc = protdom_ns_vas_pgtbl(vas);
@@ -293,7 +658,10 @@ crt_comp_create_with(struct crt_comp *c, char *name, compid_t id, struct crt_com
 }
 
 /**
- * Creates the new component from the checkpoint
+ * Creates the new component from the checkpoint. It shares the
+ * checkpoint's text. Its data, BSS, and heap pages are copies of the
+ * checkpoint's, made as it accesses them if the booter handles the
+ * page faults (`crt_chkpt_pgflt_init`), or now otherwise.
  *
  * Arguments:
  * - @c the new component to initialize
@@ -308,10 +676,10 @@ crt_comp_create_from(struct crt_comp *c, char *name, compid_t id, struct crt_chk
 {
 	struct cos_compinfo *ci, *root_ci;
 	struct cos_component_information *comp_info;
-	unsigned long info_offset;
-	size_t  ro_sz,   rw_sz, data_sz, bss_sz;
-	char   *ro_src, *data_src, *mem;
-	int     ret;
+	unsigned long info_offset, npgs, i;
+	size_t  ro_pgs, heap_sz = 0;
+	char   *mem;
+	int     ret, lazy;
 	vaddr_t	info = chkpt->c->info;
 
 	assert(c && name);
@@ -339,23 +707,47 @@ crt_comp_create_from(struct crt_comp *c, char *name, compid_t id, struct crt_chk
 	ret = cos_compinfo_alloc(ci, c->ro_addr, BOOT_CAPTBL_FREE, c->entry_addr, root_ci, 0);
 	assert(!ret);
 
-	mem = cos_page_bump_allocn(root_ci, chkpt->tot_sz_mem);
-	if (!mem) return -ENOMEM;
-	c->mem = mem;
 	c->tot_sz_mem = chkpt->tot_sz_mem;
 	c->ro_sz = chkpt->c->ro_sz;
+	ro_pgs   = round_up_to_page(c->ro_sz);
+	if (chkpt->heap_npgs) heap_sz = chkpt->heap_addrs[chkpt->heap_npgs - 1] + PAGE_SIZE - (c->ro_addr + c->tot_sz_mem);
 
-	memcpy(mem, chkpt->mem, round_up_to_page(chkpt->tot_sz_mem));
+	/* Only the text is mapped now; the rest is populated from the checkpoint */
+	mem = (char *)cos_page_bump_valloc(root_ci, c->tot_sz_mem, PAGE_SIZE);
+	if (!mem) return -ENOMEM;
+	cos_mem_alias_atn(root_ci, (vaddr_t)mem, root_ci, (vaddr_t)chkpt->mem, ro_pgs, COS_PAGE_READABLE);
+	c->mem = mem;
+	if (chkpt->heap_npgs) {
+		c->heap_mem = (char *)cos_page_bump_valloc(root_ci, chkpt->heap_npgs * PAGE_SIZE, PAGE_SIZE);
+		if (!c->heap_mem) return -ENOMEM;
+	}
+	npgs = c->tot_sz_mem / PAGE_SIZE + chkpt->heap_npgs;
+	c->populated = cos_page_bump_allocn(root_ci, round_up_to_page(npgs));
+	if (!c->populated) return -ENOMEM;
+	memset(c->populated, 0, npgs);
+	memset(c->populated, 1, ro_pgs / PAGE_SIZE);
+	c->chkpt = chkpt;
+
+	if (c->ro_addr != cos_mem_aliasn(ci, root_ci, (vaddr_t)mem, ro_pgs, COS_PAGE_READABLE)) return -ENOMEM;
+	if (c->rw_addr != cos_page_bump_valloc(ci, c->tot_sz_mem - ro_pgs, PAGE_SIZE)) return -ENOMEM;
+	if (heap_sz && c->ro_addr + c->tot_sz_mem != cos_page_bump_valloc(ci, heap_sz, PAGE_SIZE)) return -ENOMEM;
+
+	lazy = ps_load(&crt_chkpt_pgflt_ncores) == (unsigned long)init_parallelism();
+	if (lazy) {
+		c->pgflt_pgtbl = cos_hw_pgflt_pgtbl_id(BOOT_CAPTBL_SELF_INITHW_BASE, ci->pgtbl_cap);
+		i = ps_faa(&crt_chkpt_nforks, 1);
+		lazy = c->pgflt_pgtbl && i < CRT_CHKPT_FORKS_MAX;
+		if (lazy) crt_chkpt_forks[i] = c;
+	}
+	if (!lazy && crt_comp_populate(c)) return -ENOMEM;
 
 	info_offset = info - c->rw_addr;
-	comp_info   = (struct cos_component_information *)(mem + round_up_to_page(c->ro_sz) + info_offset);
+	if (crt_comp_mem_populate(c, ro_pgs + info_offset, sizeof(struct cos_component_information))) return -ENOMEM;
+	comp_info   = (struct cos_component_information *)(mem + ro_pgs + info_offset);
 	comp_info->cos_this_spd_id = 0;
 	assert(comp_info->cos_this_spd_id == 0);
 	comp_info->cos_this_spd_id = id;
 
-	if (c->ro_addr != cos_mem_aliasn(ci, root_ci, (vaddr_t)mem, round_up_to_page(c->ro_sz), COS_PAGE_READABLE)) return -ENOMEM;
-	if (c->rw_addr != cos_mem_aliasn(ci, root_ci, (vaddr_t)mem + round_up_to_page(c->ro_sz), c->tot_sz_mem - round_to_page(c->ro_sz), COS_PAGE_READABLE | COS_PAGE_WRITABLE)) return -ENOMEM;
-
 	/* FIXME: cos_time.h assumes we have access to this... */
 	ret = cos_cap_cpy_at(ci, BOOT_CAPTBL_SELF_INITHW_BASE, root_ci, BOOT_CAPTBL_SELF_INITHW_BASE);
 	assert(ret == 0);
@@ -384,13 +776,19 @@ crt_comp_create_from(struct crt_comp *c, char *name, compid_t id, struct crt_chk
  */
 int
 crt_comp_create(struct crt_comp *c, char *name, compid_t id, void *elf_hdr, vaddr_t info, prot_domain_t protdom)
+{
+	return crt_comp_create_image(c, name, id, elf_hdr, info, protdom, 1);
+}
+
+static int
+crt_comp_create_image(struct crt_comp *c, char *name, compid_t id, void *elf_hdr, vaddr_t info, prot_domain_t protdom, int share_ro)
 {
 	struct cos_compinfo *ci, *root_ci;
 	struct cos_component_information *comp_info;
 	unsigned long info_offset;
 	size_t  ro_sz,   rw_sz, data_sz, bss_sz, tot_sz;
-	char   *ro_src, *data_src, *mem;
-	int     ret;
+	char   *ro_src, *data_src, *mem, *ro = NULL;
+	int     ret, prelaid = 0;
 
 	assert(c && name);
 
@@ -408,15 +806,31 @@ crt_comp_create(struct crt_comp *c, char *name, compid_t id, void *elf_hdr, vadd
 	assert(!ret);
 
 	tot_sz = round_up_to_page(round_up_to_page(ro_sz) + data_sz + bss_sz);
-	mem    = cos_page_bump_allocn(root_ci, tot_sz);
-	if (!mem) return -ENOMEM;
+	if (share_ro) ro = crt_image_lookup(c->ro_addr, ro_sz, ro_src);
+	if (ro) {
+		mem = crt_image_mem_shared(root_ci, ro, ro_sz, tot_sz);
+		if (!mem) return -ENOMEM;
+	} else {
+		/* Not in a shared vas, whose text is written into: it's copied */
+		if (share_ro && img_chk_format(c->elf_hdr)) {
+			mem     = crt_image_mem_prelaid(root_ci, (struct img_hdr *)c->elf_hdr, ro_src, tot_sz);
+			prelaid = mem != NULL;
+		}
+		if (!prelaid) {
+			mem = cos_page_bump_allocn(root_ci, tot_sz);
+			if (!mem) return -ENOMEM;
+			memcpy(mem, ro_src, ro_sz);
+		}
+		if (share_ro) crt_image_add(c->ro_addr, ro_sz, mem);
+	}
 	c->mem = mem;
 	c->tot_sz_mem = tot_sz;
 	c->ro_sz = ro_sz;
 
-	memcpy(mem, ro_src, ro_sz);
-	memcpy(mem + round_up_to_page(ro_sz), data_src, data_sz);
-	memset(mem + round_up_to_page(ro_sz) + data_sz, 0, bss_sz);
+	if (!prelaid) {
+		memcpy(mem + round_up_to_page(ro_sz), data_src, data_sz);
+		memset(mem + round_up_to_page(ro_sz) + data_sz, 0, bss_sz);
+	}
 
 	assert(info >= c->rw_addr && info < c->rw_addr + data_sz);
 	info_offset = info - c->rw_addr;
@@ -467,7 +881,6 @@ int
 crt_comp_vm_create(struct crt_comp *c, char *name, compid_t id, prot_domain_t protdom)
 {
 	struct cos_compinfo *ci, *root_ci;
-	void *mem;
 	compid_t vmm = (compid_t)cos_inv_token();
 
 	/* FIXME: the VM's memory first set up its head_ptr to be 4K just to keep legacy code path simple, should be fixed later */
@@ -485,17 +898,41 @@ crt_comp_vm_create(struct crt_comp *c, char *name, compid_t id, prot_domain_t pr
 	assert(c->flags & CRT_COMP_VM);
 	ci->comp_type = COMP_TYPE_VM;
 
+	/* Guest-physical page 0 is left for the guest memory (crt_comp_vm_mem_map) */
 	cos_compinfo_alloc(ci, heap_ptr, cap_frontier, entry, root_ci, protdom);
 
-	/* We would like to first map the zero page for a VM since the heap_ptr cannot be 0 */
-	mem = cos_page_bump_alloc(root_ci);
-	assert(mem);
-	memset(mem, 0, PAGE_SIZE_4K);
-	cos_mem_alias_at(ci, 0, root_ci, (vaddr_t)mem, protdom);
-
 	return 0;
 }
 
+/*
+ * Map the guest memory, `sz` bytes at `mem` in `self`, into the VM
+ * `c` at guest-physical address `gpa`.  Where the memory is backed by
+ * superpages, and `gpa` is aligned the same way, the EPT uses 2MB
+ * entries, which is both faster to map and shortens the guest's
+ * two-dimensional page walks.
+ */
+int
+crt_comp_vm_mem_map(struct crt_comp *c, vaddr_t gpa, void *mem, size_t sz, struct crt_comp *self)
+{
+	assert(c->flags & CRT_COMP_VM);
+
+	return cos_mem_alias_superpagen_at(cos_compinfo_get(c->comp_res), gpa, cos_compinfo_get(self->comp_res), (vaddr_t)mem, sz,
+	                                   COS_PAGE_READABLE | COS_PAGE_WRITABLE);
+}
+
+/*
+ * Collect the pages of the VM `c` written since the last collection
+ * (see cos_vm_mem_dirty), for incremental snapshots and the pre-copy
+ * rounds of migrations.
+ */
+int
+crt_comp_vm_mem_dirty(struct crt_comp *c, vaddr_t gpa, unsigned long npages, unsigned long *bitmap)
+{
+	assert(c->flags & CRT_COMP_VM);
+
+	return cos_vm_mem_dirty(cos_compinfo_get(c->comp_res), gpa, npages, bitmap);
+}
+
 vaddr_t
 crt_comp_shared_kernel_page_alloc_at(struct crt_comp *c, vaddr_t mem_ptr)
 {
@@ -652,6 +1089,48 @@ crt_comp_sched_delegate(struct crt_comp *child, struct crt_comp *self, tcap_prio
 	return cos_tcap_delegate(child->exec_ctxt.exec[cos_coreid()].sched.sched_asnd.asnd, sched_aep->tc, res, prio, TCAP_DELEG_YIELD);
 }
 
+static struct cos_tcap_deleg_batch crt_replenish_batch[NUM_CPU];
+
+/*
+ * Replenish the budgets of @n child schedulers with @res cycles at
+ * @prio, without dispatching to them.  This takes a single system
+ * call per COS_TCAP_DELEG_BULK_MAX children.  Returns the number of
+ * children replenished.
+ */
+int
+crt_comp_sched_replenish(struct crt_comp **children, int n, struct crt_comp *self, tcap_prio_t prio, tcap_res_t res)
+{
+	struct cos_tcap_deleg_batch *b = &crt_replenish_batch[cos_coreid()];
+	struct cos_aep_info         *sched_aep;
+	int                          done = 0;
+
+	assert(children && self && n >= 0);
+
+	sched_aep = cos_sched_aep_get(self->comp_res);
+
+	while (done < n) {
+		int nb = n - done < COS_TCAP_DELEG_BULK_MAX ? n - done : COS_TCAP_DELEG_BULK_MAX;
+		int i, ret;
+
+		for (i = 0; i < nb; i++) {
+			struct crt_rcv *r = children[done + i]->exec_ctxt.exec[cos_coreid()].sched.sched_rcv;
+
+			assert(r);
+			b->ds[i] = (struct cos_tcap_deleg) {
+				.rcv  = r->aep->rcv,
+				.res  = res,
+				.prio = prio,
+			};
+		}
+		ret = cos_tcap_delegate_bulk(sched_aep->tc, b, nb);
+		if (ret < 0) break;
+		done += ret;
+		if (ret < nb) break;
+	}
+
+	return done;
+}
+
 /**
  * Alias the component, pgtbl, and/or captbl for `c` into `c_in`. Can
  * be placed into specific capability slots as specified in `res`. The
@@ -680,9 +1159,45 @@ crt_comp_alias_in(struct crt_comp *c, struct crt_comp *c_in, struct crt_comp_res
 	return 0;
 }
 
+static COS_CAPOP_BATCH_DECLARE(crt_sinv_batch);
+static int crt_sinv_batching = 0;
+
+void
+crt_sinv_batch_begin(void)
+{
+	assert(!crt_sinv_batching);
+	cos_capop_batch_init(&crt_sinv_batch);
+	crt_sinv_batching = 1;
+}
+
+int
+crt_sinv_batch_end(void)
+{
+	assert(crt_sinv_batching);
+	crt_sinv_batching = 0;
+
+	return cos_capop_batch_flush(&crt_sinv_batch);
+}
+
+/*
+ * Record that @client depends on @server, so that the initialization
+ * of the @client awaits the @server's (see crt_compinit_execute).
+ */
+static void
+crt_comp_dep_add(struct crt_comp *client, struct crt_comp *server)
+{
+	u32_t i;
+
+	for (i = 0; i < client->n_deps; i++) {
+		if (client->deps[i] == server) return;
+	}
+	assert(client->n_deps < CRT_COMP_DEPS_LEN);
+	client->deps[client->n_deps++] = server;
+}
+
 int
 crt_sinv_create(struct crt_sinv *sinv, char *name, struct crt_comp *server, struct crt_comp *client,
-		vaddr_t c_fn_addr, vaddr_t c_fast_callgate_addr, vaddr_t c_ucap_addr, vaddr_t s_fn_addr, vaddr_t s_altfn_addr)
+		vaddr_t c_fn_addr, vaddr_t c_fast_callgate_addr, vaddr_t c_ucap_addr, vaddr_t s_fn_addr, vaddr_t s_altfn_addr, capid_t c_capid)
 {
 	struct cos_compinfo *cli;
 	struct cos_compinfo *srv;
@@ -710,12 +1225,31 @@ crt_sinv_create(struct crt_sinv *sinv, char *name, struct crt_comp *server, stru
 		.client      = client,
 		.c_fn_addr   = c_fn_addr,
 		.c_ucap_addr = c_ucap_addr,
-		.s_fn_addr   = s_fn_addr
+		.s_fn_addr   = s_fn_addr,
+		.c_capid     = c_capid
 	};
 
 	comp_s = (srv->comp_cap_shared) ? srv->comp_cap_shared : srv->comp_cap;
-	sinv->sinv_cap = cos_sinv_alloc(cli, comp_s, sinv->s_fn_addr, client->id);
+	if (c_capid) {
+		/*
+		 * The composer allocated the capability past the
+		 * client's static ones, and might have encoded it in
+		 * the client's stubs: it must be exactly this one.
+		 */
+		assert(c_capid >= BOOT_CAPTBL_FREE && c_capid % CAPMAX_ENTRY_SZ == 0);
+		cos_comp_capfrontier_update(cli, c_capid + CAPMAX_ENTRY_SZ, 1);
+		if (crt_sinv_batching) {
+			sinv->sinv_cap = cos_sinv_alloc_at_batch(cli, &crt_sinv_batch, c_capid, comp_s, sinv->s_fn_addr, client->id);
+		} else {
+			sinv->sinv_cap = cos_sinv_alloc_at(cli, c_capid, comp_s, sinv->s_fn_addr, client->id);
+		}
+	} else if (crt_sinv_batching) {
+		sinv->sinv_cap = cos_sinv_alloc_batch(cli, &crt_sinv_batch, comp_s, sinv->s_fn_addr, client->id);
+	} else {
+		sinv->sinv_cap = cos_sinv_alloc(cli, comp_s, sinv->s_fn_addr, client->id);
+	}
 	assert(sinv->sinv_cap);
+	crt_comp_dep_add(client, server);
 
 	if (protdom_ns_vas_shared(client->ns_vas, server->ns_vas)) {
 		assert(s_altfn_addr && c_fast_callgate_addr);
@@ -735,6 +1269,7 @@ crt_sinv_create(struct crt_sinv *sinv, char *name, struct crt_comp *server, stru
 	/* poor-mans virtual address translation from client VAS -> our ptrs */
 	assert(sinv->c_ucap_addr - sinv->client->ro_addr > 0);
 	ucap_off = sinv->c_ucap_addr - sinv->client->ro_addr;
+	if (crt_comp_mem_populate(sinv->client, ucap_off, sizeof(struct usr_inv_cap))) BUG();
 	ucap = (struct usr_inv_cap *)(sinv->client->mem + ucap_off);
 	*ucap = (struct usr_inv_cap) {
 		.invocation_fn = sinv->c_fn_addr,
@@ -1081,8 +1616,13 @@ crt_rcv_alias_in(struct crt_rcv *r, struct crt_comp *c, struct crt_rcv_resources
 	return 0;
 }
 
+/**
+ * Create an asnd to the rcv end-point r, that sends at most ipimax
+ * IPIs (if r is on another core) per ipiwin microseconds, see
+ * cos_asnd_alloc_ipilimit. crt_asnd_create creates one without limit.
+ */
 int
-crt_asnd_create(struct crt_asnd *s, struct crt_rcv *r)
+crt_asnd_create_ipilimit(struct crt_asnd *s, struct crt_rcv *r, microsec_t ipiwin, u32_t ipimax)
 {
 	struct cos_compinfo    *ci = cos_compinfo_get(cos_defcompinfo_curr_get());
 	struct cos_compinfo    *target_ci;
@@ -1096,7 +1636,7 @@ crt_asnd_create(struct crt_asnd *s, struct crt_rcv *r)
 	crt_refcnt_take(&r->refcnt);
 
 	assert(r->aep->rcv && target_ci->captbl_cap);
-	ascap = cos_asnd_alloc(ci, r->child_rcv, target_ci->captbl_cap);
+	ascap = cos_asnd_alloc_ipilimit(ci, r->child_rcv, target_ci->captbl_cap, ipiwin, ipimax);
 	assert(ascap);
 
 	*s = (struct crt_asnd) {
@@ -1107,6 +1647,12 @@ crt_asnd_create(struct crt_asnd *s, struct crt_rcv *r)
 	return 0;
 }
 
+int
+crt_asnd_create(struct crt_asnd *s, struct crt_rcv *r)
+{
+	return crt_asnd_create_ipilimit(s, r, 0, 0);
+}
+
 int
 crt_asnd_alias_in(struct crt_asnd *s, struct crt_comp *c, struct crt_asnd_resources *res)
 {
@@ -1352,6 +1898,15 @@ crt_page_allocn(struct crt_comp *c, u32_t n_pages)
 	return cos_page_bump_allocn(cos_compinfo_get(c->comp_res), n_pages * PAGE_SIZE);
 }
 
+/* As crt_page_allocn, but preferring memory in the NUMA node (or COS_NUMA_NODE_LOCAL) */
+void *
+crt_page_allocn_node(struct crt_comp *c, u32_t n_pages, int node)
+{
+	assert(c);
+
+	return cos_page_bump_allocn_node(cos_compinfo_get(c->comp_res), n_pages * PAGE_SIZE, node);
+}
+
 int
 crt_page_aliasn_aligned_in(void *pages, unsigned long align, u32_t n_pages, struct crt_comp *self, struct crt_comp *c_in, vaddr_t *map_addr)
 {
@@ -1367,6 +1922,131 @@ crt_page_aliasn_in(void *pages, u32_t n_pages, struct crt_comp *self, struct crt
 	return crt_page_aliasn_aligned_in(pages, PAGE_SIZE, n_pages, self, c_in, map_addr);
 }
 
+void *
+crt_superpage_allocn(struct crt_comp *c, u32_t n_superpages)
+{
+	assert(c);
+
+	return cos_superpage_bump_allocn(cos_compinfo_get(c->comp_res), n_superpages * SUPER_PAGE_SIZE);
+}
+
+int
+crt_superpage_aliasn_in(void *superpages, u32_t n_superpages, struct crt_comp *self, struct crt_comp *c_in, vaddr_t *map_addr)
+{
+	return crt_superpage_aliasn_aligned_in(superpages, SUPER_PAGE_SIZE, n_superpages, self, c_in, map_addr);
+}
+
+int
+crt_superpage_aliasn_aligned_in(void *superpages, unsigned long align, u32_t n_superpages, struct crt_comp *self, struct crt_comp *c_in, vaddr_t *map_addr)
+{
+	*map_addr = cos_mem_alias_superpagen_aligned(cos_compinfo_get(c_in->comp_res), cos_compinfo_get(self->comp_res), (vaddr_t)superpages,
+	                                             n_superpages * SUPER_PAGE_SIZE, align, COS_PAGE_READABLE | COS_PAGE_WRITABLE);
+	if (!*map_addr) return -EINVAL;
+
+	return 0;
+}
+
+/* The component's cos_component_information, in its image */
+static struct cos_component_information *
+crt_comp_info(struct crt_comp *c)
+{
+	size_t off = c->info - c->ro_addr;
+
+	if (!c->mem || crt_comp_mem_populate(c, off, sizeof(struct cos_component_information))) return NULL;
+
+	return (struct cos_component_information *)(c->mem + off);
+}
+
+static int
+crt_core_numa_node(coreid_t core)
+{
+	return cos_hw_numa_introspect(BOOT_CAPTBL_SELF_INITHW_BASE, NUMA_GET_CPU_NODE, core, 0);
+}
+
+/**
+ * Create a pipeline of the `nstages` components `comps`, each placed
+ * on the corresponding core of `cores`, connected by channels of
+ * `nslots` items of `item_sz` bytes, created with `flags`, in `chan_sz`
+ * bytes of memory (`chan_mem_sz` of these). Each stage finds its
+ * description, and its channels, with `crt_pipeline_info`. This must
+ * be called before the stages execute (initialize).
+ *
+ * - @p      - the pipeline to populate
+ * - @self   - the crt_comp that represents us
+ * - @return - `0` on success, `-EINVAL` for a bad number of stages,
+ *             or `-ENOMEM`.
+ */
+int
+crt_pipeline_create(struct crt_pipeline *p, struct crt_comp *self, struct crt_comp **comps, coreid_t *cores, u32_t nstages,
+                    u32_t item_sz, u32_t nslots, u32_t flags, size_t chan_sz)
+{
+	struct cos_component_information *ci;
+	struct crt_pipeline_stage *s;
+	vaddr_t addr;
+	void *mem;
+	u32_t i;
+
+	assert(p && self && comps && cores);
+	if (nstages == 0 || nstages > CRT_PIPELINE_MAX_STAGES) return -EINVAL;
+
+	*p = (struct crt_pipeline) {
+		.nstages = nstages,
+		.npages  = round_up_to_page(chan_sz) / PAGE_SIZE,
+	};
+	for (i = 0; i < nstages; i++) {
+		s = &p->stages[i];
+		*s = (struct crt_pipeline_stage) {
+			.comp = comps[i],
+			.core = cores[i],
+		};
+		if (cores[i] >= NUM_CPU) return -EINVAL;
+
+		/* The stage's description, read by its core */
+		s->info = crt_page_allocn_node(self, 1, crt_core_numa_node(cores[i]));
+		if (!s->info || crt_page_aliasn_in(s->info, 1, self, s->comp, &addr)) return -ENOMEM;
+		*s->info = (struct crt_pipeline_info) {
+			.stage   = i,
+			.nstages = nstages,
+			.core    = cores[i],
+			.item_sz = item_sz,
+			.nslots  = nslots,
+			.flags   = flags,
+		};
+		ci = crt_comp_info(s->comp);
+		if (!ci) return -ENOMEM;
+		ci->cos_poly[CRT_PIPELINE_POLY] = addr;
+	}
+
+	for (i = 0; i + 1 < nstages; i++) {
+		/* The channel to the next stage, in its consumer's node */
+		mem = crt_page_allocn_node(self, p->npages, crt_core_numa_node(cores[i + 1]));
+		if (!mem) return -ENOMEM;
+		/* The first endpoint to initialize it expects it zeroed (see `chan_init_mem`) */
+		memset(mem, 0, p->npages * PAGE_SIZE);
+		if (crt_page_aliasn_in(mem, p->npages, self, comps[i], &p->stages[i].info->out)) return -ENOMEM;
+		if (crt_page_aliasn_in(mem, p->npages, self, comps[i + 1], &p->stages[i + 1].info->in)) return -ENOMEM;
+	}
+
+	return 0;
+}
+
+/**
+ * Create a thread in a stage of the pipeline, executing the closure
+ * `closure_id` in the stage. Threads execute on the core that creates
+ * them, so this must be called on the stage's core.
+ *
+ * - @return - `0` on success, `-EINVAL` if called on another core,
+ *             or `<0` if the thread can't be created.
+ */
+int
+crt_pipeline_thd_create(struct crt_pipeline *p, u32_t stage, struct crt_thd *t, thdclosure_index_t closure_id)
+{
+	assert(p && t);
+	if (stage >= p->nstages || p->stages[stage].core != cos_cpuid()) return -EINVAL;
+
+	return crt_thd_create_in(t, p->stages[stage].comp, closure_id);
+}
+
 static void
 crt_clear_schedevents(void)
 {
@@ -1387,59 +2067,265 @@ crt_clear_schedevents(void)
 	return;
 }
 
+/*
+ * The placement of a component's initial threads, in our initargs
+ * under `placement/<id>`: its cores (if constrained), and those of
+ * its NUMA node (if constrained), its priority, and if its cores are
+ * dedicated to it.
+ */
+static int
+crt_placement_get(compid_t id, struct initargs *p)
+{
+	char path[32];
+
+	snprintf(path, sizeof(path), "placement/%lu", id);
+
+	return args_get_entry(path, p);
+}
+
+/* Is `core` in the `cores` of placement `p`? */
+static int
+crt_placement_incores(struct initargs *p, coreid_t core)
+{
+	struct initargs cores, c;
+	struct initargs_iter i;
+	long v;
+	int cont;
+
+	if (args_get_entry_from("cores", p, &cores)) return 0;
+	for (cont = args_iter(&cores, &i, &c); cont; cont = args_iter_next(&i, &c)) {
+		if (!args_num(&c, &v) && (coreid_t)v == core) return 1;
+	}
+
+	return 0;
+}
+
+compid_t
+crt_placement_dedicated(coreid_t core)
+{
+	struct initargs all, p;
+	struct initargs_iter i;
+	int cont, keylen;
+
+	if (args_get_entry("placement", &all)) return 0;
+	for (cont = args_iter(&all, &i, &p); cont; cont = args_iter_next(&i, &p)) {
+		if (args_get_from("dedicated", &p) && crt_placement_incores(&p, core)) return atoi(args_key(&p, &keylen));
+	}
+
+	return 0;
+}
+
+int
+crt_placement_oncore(compid_t id, coreid_t core)
+{
+	struct initargs p, cores;
+	compid_t owner;
+	long v;
+
+	/* A dedicated core only executes the threads of its component */
+	owner = crt_placement_dedicated(core);
+	if (owner && owner != id) return 0;
+	if (crt_placement_get(id, &p)) return 1;
+	if (!args_get_num_from("numa_node", &p, &v) &&
+	    cos_hw_numa_introspect(BOOT_CAPTBL_SELF_INITHW_BASE, NUMA_GET_CPU_NODE, core, 0) != v) return 0;
+	if (args_get_entry_from("cores", &p, &cores)) return 1;
+
+	return crt_placement_incores(&p, core);
+}
+
+int
+crt_placement_ncores(compid_t id)
+{
+	coreid_t core;
+	int n = 0;
+
+	for (core = 0; core < NUM_CPU; core++) n += crt_placement_oncore(id, core);
+
+	return n;
+}
+
+/* The first of its cores, or NUM_CPU if it has none */
+coreid_t
+crt_placement_initcore(compid_t id)
+{
+	coreid_t core;
+
+	for (core = 0; core < NUM_CPU; core++) {
+		if (crt_placement_oncore(id, core)) break;
+	}
+
+	return core;
+}
+
+unsigned int
+crt_placement_prio(compid_t id)
+{
+	struct initargs p;
+	long prio;
+
+	if (crt_placement_get(id, &p) || args_get_num_from("priority", &p, &prio)) return 0;
+
+	return prio;
+}
+
+/*
+ * Initialize the component on the first of its cores, and only await
+ * the parallel initialization of its cores.
+ */
+void
+crt_comp_placement_init(struct crt_comp *c)
+{
+	struct initargs p;
+	int ncores;
+
+	if (crt_placement_get(c->id, &p)) return;
+
+	ncores = crt_placement_ncores(c->id);
+	if (ncores == 0) {
+		printc("Warning: component %lu is placed on none of the cores, so won't execute.\n", c->id);
+		return;
+	}
+	c->init_core = crt_placement_initcore(c->id);
+	simple_barrier_init(&c->barrier, ncores);
+}
+
 /*
  * The functions to automate much of the component initialization
  * logic follow.
+ *
+ * The initialization of the components is a DAG: the cos_init of a
+ * component awaits only the initialization of its servers (the
+ * `deps`, from the sinvs of the composer), so the components that
+ * don't depend on each other initialize concurrently on their
+ * initialization cores. The parallel initialization (with the
+ * barrier across the component's cores) is entered by each core in
+ * the order of the composer's schedule, only once the core is done
+ * with all of the previous components, so two components' barriers
+ * can never wait on each other's cores.
  */
+
+/* The components in our "execute" schedule, and those each core is done initializing */
+static unsigned char crt_compinit_scheduled[MAX_NUM_COMPS + 1];
+static unsigned char crt_compinit_core_done[NUM_CPU][MAX_NUM_COMPS + 1];
+
+static int
+crt_compinit_deps_ready(struct crt_comp *c)
+{
+	u32_t i;
+
+	for (i = 0; i < c->n_deps; i++) {
+		struct crt_comp *s = c->deps[i];
+
+		/* Servers we don't initialize (e.g. ourself) are ready */
+		if (s->id > MAX_NUM_COMPS || !crt_compinit_scheduled[s->id]) continue;
+		if (ps_load(&s->init_state) <= CRT_COMP_INIT_PAR_INIT) return 0;
+	}
+
+	return 1;
+}
+
+/*
+ * Switch to the initial thread of @comp on this core, either to
+ * start it (@resume == 0), or to resume it where it switched back to
+ * us in crt_compinit_done.
+ */
+static void
+crt_compinit_switch(struct crt_comp *comp, struct crt_comp *self, int resume)
+{
+	thdcap_t thdcap = crt_comp_thdcap_get(comp);
+	int ret;
+
+	assert(thdcap);
+	if (comp->flags & CRT_COMP_SCHED) {
+		struct cos_defcompinfo *compci    = comp->comp_res;
+		struct cos_aep_info    *child_aep = cos_sched_aep_get(compci);
+		struct cos_aep_info    *sched_aep = cos_sched_aep_get(cos_defcompinfo_curr_get());
+
+		if (!resume) {
+			if (crt_comp_sched_delegate(comp, self, TCAP_PRIO_MAX, TCAP_RES_INF)) BUG();
+			return;
+		}
+		assert(sched_aep->rcv != 0 && child_aep->tc != 0);
+		if (cos_switch(thdcap, child_aep->tc, TCAP_PRIO_MAX, TCAP_TIME_NIL, sched_aep->rcv, cos_sched_sync())) BUG();
+	} else {
+		if ((ret = cos_defswitch(thdcap, TCAP_PRIO_MAX, TCAP_TIME_NIL, cos_sched_sync()))) {
+			printc("Switch failure on thdcap %ld, with ret %d\n", thdcap, ret);
+			BUG();
+		}
+	}
+}
+
 void
 crt_compinit_execute(comp_get_fn_t comp_get)
 {
 	struct initargs comps, curr;
 	struct initargs_iter i;
+	struct crt_comp *self = comp_get(cos_compid());
+	unsigned char *done = crt_compinit_core_done[cos_cpuid()];
 	int cont;
 	int ret;
+	int ninit = 0, nleft = 0;
+	cycles_t start = ps_tsc();
 
-	/*
-	 * Initialize components (cos_init, then cos_parallel_init) in
-	 * order of the pre-computed schedule from the composer.
-	 */
 	ret = args_get_entry("execute", &comps);
 	assert(!ret);
 	for (cont = args_iter(&comps, &i, &curr) ; cont ; cont = args_iter_next(&i, &curr)) {
-		struct crt_comp  *comp;
 		int      keylen;
-		compid_t id        = atoi(args_key(&curr, &keylen));
-		char    *exec_type = args_value(&curr);
-		int      initcore, ret;
-		thdcap_t thdcap;
-
-		comp     = comp_get(id);
-		assert(comp);
-		initcore = comp->init_core == cos_cpuid();
-		assert(comp->init_state = CRT_COMP_INIT_COS_INIT);
-
-		if (initcore) {
-			thdcap = crt_comp_thdcap_get(comp);
-			printc("Initializing component %lu (executing cos_init).\n", comp->id);
-		} else {
-			/* wait for the init core's thread to initialize */
-			while (ps_load(&comp->init_state) == CRT_COMP_INIT_COS_INIT) ;
-			if (ps_load(&comp->init_state) != CRT_COMP_INIT_PAR_INIT) continue;
+		compid_t id = atoi(args_key(&curr, &keylen));
 
-			thdcap = crt_comp_thdcap_get(comp);
-		}
-		assert(thdcap);
+		assert(id > 0 && id <= MAX_NUM_COMPS);
+		crt_compinit_scheduled[id] = 1;
+		if (crt_placement_oncore(id, cos_cpuid())) nleft++;
+	}
 
-		if (comp->flags & CRT_COMP_SCHED) {
-			if (crt_comp_sched_delegate(comp, comp_get(cos_compid()), TCAP_PRIO_MAX, TCAP_RES_INF)) BUG();
-		} else {
-			if ((ret = cos_defswitch(thdcap, TCAP_PRIO_MAX, TCAP_TIME_NIL, cos_sched_sync()))) {
-				printc("Switch failure on thdcap %ld, with ret %d\n", thdcap, ret);
-				BUG();
+	/*
+	 * Initialize components (cos_init, then cos_parallel_init) as
+	 * their servers are initialized. Each pass takes the first
+	 * component in the pre-computed schedule from the composer
+	 * that this core can make progress on.
+	 */
+	while (nleft > 0) {
+		/* is a previous component on this core still initializing? */
+		int pending = 0;
+
+		ret = args_get_entry("execute", &comps);
+		assert(!ret);
+		for (cont = args_iter(&comps, &i, &curr) ; cont ; cont = args_iter_next(&i, &curr)) {
+			struct crt_comp *comp;
+			int      keylen;
+			compid_t id = atoi(args_key(&curr, &keylen));
+			int      initcore;
+			crt_comp_init_state_t state;
+
+			/* No initial thread on this core */
+			if (!crt_placement_oncore(id, cos_cpuid()) || done[id]) continue;
+			comp     = comp_get(id);
+			assert(comp);
+			initcore = comp->init_core == cos_cpuid();
+			state    = ps_load(&comp->init_state);
+
+			if (state <= CRT_COMP_INIT_COS_INIT) {
+				/* wait for the init core, or for the servers to initialize */
+				if (!initcore || !crt_compinit_deps_ready(comp)) {
+					pending = 1;
+					continue;
+				}
+				printc("Initializing component %lu (executing cos_init).\n", comp->id);
+				ninit++;
+				crt_compinit_switch(comp, self, 0);
+				/* the parallel initialization is entered in order, as on the other cores */
+				if (ps_load(&comp->init_state) == CRT_COMP_INIT_PAR_INIT) break;
+			} else if (state == CRT_COMP_INIT_PAR_INIT) {
+				if (pending) continue;
+				crt_compinit_switch(comp, self, initcore);
 			}
+			/* Initialization is complete on this core */
+			done[id] = 1;
+			nleft--;
+			break;
 		}
-		assert(comp->init_state > CRT_COMP_INIT_PAR_INIT);
 	}
+	if (ninit) printc("Initialized %d components in %llu cycles.\n", ninit, ps_tsc() - start);
 
 	/*
 	 * Initialization of components (parallel or sequential)
@@ -1454,15 +2340,12 @@ crt_compinit_execute(comp_get_fn_t comp_get)
 		struct crt_comp  *comp;
 		int      keylen;
 		compid_t id        = atoi(args_key(&curr, &keylen));
-		char    *exec_type = args_value(&curr);
 		int initcore;
-		thdcap_t thdcap;
 
 		comp = comp_get(id);
 		assert(comp);
+		if (!crt_placement_oncore(id, cos_cpuid())) continue;
 		initcore = comp->init_core == cos_cpuid();
-		thdcap   = crt_comp_thdcap_get(comp);
-		assert(thdcap);
 
 		/* wait for the initcore to change the state... */
 		while (ps_load(&comp->init_state) == CRT_COMP_INIT_COS_INIT || ps_load(&comp->init_state) == CRT_COMP_INIT_PAR_INIT) ;
@@ -1472,17 +2355,7 @@ crt_compinit_execute(comp_get_fn_t comp_get)
 
 		if (initcore) printc("Switching to main in component %lu.\n", comp->id);
 
-		if (comp->flags & CRT_COMP_SCHED) {
-			struct cos_defcompinfo *compci     = comp->comp_res;
-			struct cos_aep_info    *child_aep = cos_sched_aep_get(compci);
-			struct cos_defcompinfo *defci     = cos_defcompinfo_curr_get();
-			struct cos_aep_info    *sched_aep = cos_sched_aep_get(defci);
-
-			assert(sched_aep->rcv != 0 && child_aep->tc != 0);
-			if (cos_switch(thdcap, child_aep->tc, TCAP_PRIO_MAX, TCAP_TIME_NIL, sched_aep->rcv, cos_sched_sync())) BUG();
-		} else {
-			if (cos_defswitch(thdcap, TCAP_PRIO_MAX, TCAP_TIME_NIL, cos_sched_sync())) BUG();
-		}
+		crt_compinit_switch(comp, self, 1);
 	}
 
 	printc("%ld: All main functions returned: shutting down...\n", cos_compid());
@@ -1507,6 +2380,13 @@ crt_compinit_done(struct crt_comp *c, int parallel_init, init_main_t main_type)
 		if (parallel_init) {
 			/* This will activate any parallel threads */
 			ps_store(&c->init_state, CRT_COMP_INIT_PAR_INIT);
+			/*
+			 * Await the booter to enter the parallel
+			 * initialization on this core, in order with
+			 * its other cores (see crt_compinit_execute).
+			 */
+			if (cos_defswitch(BOOT_CAPTBL_SELF_INITTHD_CPU_BASE, TCAP_PRIO_MAX, TCAP_RES_INF, cos_sched_sync())) BUG();
+
 			return; /* we're continuing with initialization, return! */
 		}
 
@@ -8,10 +8,12 @@
 #include <init.h>
 #include <barrier.h>
 #include <protdom.h>
+#include <crt_pipeline.h>
 
 typedef unsigned long crt_refcnt_t;
 
 #define CRT_COMP_SINVS_LEN 16
+#define CRT_COMP_DEPS_LEN  32
 
 struct crt_comp;
 
@@ -59,6 +61,7 @@ struct crt_sinv {
 	struct crt_comp *server, *client;
 	vaddr_t c_fn_addr, c_ucap_addr;
 	vaddr_t s_fn_addr;
+	capid_t c_capid;	/* statically allocated by the composer, or 0 */
 	sinvcap_t sinv_cap;
 };
 
@@ -86,6 +89,9 @@ struct crt_comp {
 	init_main_t main_type; /* does this component have post-initialization execution? */
 	struct simple_barrier barrier;
 	coreid_t init_core;
+	/* The servers of the component's sinvs: its cos_init awaits their initialization */
+	struct crt_comp *deps[CRT_COMP_DEPS_LEN];
+	u32_t n_deps;
 
 	crt_refcnt_t refcnt;
 
@@ -99,6 +105,16 @@ struct crt_comp {
 	struct protdom_ns_vas *ns_vas;
 
 	struct crt_vm_comp_info vm_comp_info;
+
+	/*
+	 * Components created from a checkpoint: their pages that are
+	 * populated (a byte per page of the image, then per page of
+	 * the checkpoint's heap), and our view of the heap pages.
+	 */
+	struct crt_chkpt *chkpt;
+	u8_t *populated;
+	char *heap_mem;
+	unsigned long pgflt_pgtbl;
 };
 
 struct crt_comp_resources {
@@ -114,6 +130,17 @@ struct crt_chkpt {
 	struct crt_comp *c;
 	char            *mem;
 	size_t           tot_sz_mem;
+	crt_comp_init_state_t init_state;
+
+	/*
+	 * The pages mapped in the component beyond its image (its heap)
+	 * when checkpointed: their addresses, a copy of each, and our
+	 * view of the component's own pages (to restore it).
+	 */
+	unsigned long    heap_npgs;
+	vaddr_t         *heap_addrs;
+	char            *heap;
+	char            *heap_orig;
 };
 
 typedef enum {
@@ -173,6 +200,8 @@ struct crt_sinv_resources {
 int crt_comp_create(struct crt_comp *c, char *name, compid_t id, void *elf_hdr, vaddr_t info, prot_domain_t protdom);
 int crt_comp_create_with(struct crt_comp *c, char *name, compid_t id, struct crt_comp_resources *resources);
 int crt_comp_vm_create(struct crt_comp *c, char *name, compid_t id, prot_domain_t protdom);
+int crt_comp_vm_mem_map(struct crt_comp *c, vaddr_t gpa, void *mem, size_t sz, struct crt_comp *self);
+int crt_comp_vm_mem_dirty(struct crt_comp *c, vaddr_t gpa, unsigned long npages, unsigned long *bitmap);
 int crt_vm_comp_init(struct crt_comp *c, char *name, compid_t id, vaddr_t info);
 
 int crt_comp_create_from(struct crt_comp *c, char *name, compid_t id, struct crt_chkpt *chkpt);
@@ -187,6 +216,7 @@ vaddr_t crt_comp_shared_kernel_page_alloc(struct crt_comp *c, vaddr_t *resource)
 int crt_booter_create(struct crt_comp *c, char *name, compid_t id, vaddr_t info);
 thdcap_t crt_comp_thdcap_get(struct crt_comp *c);
 int crt_comp_sched_delegate(struct crt_comp *child, struct crt_comp *self, tcap_prio_t prio, tcap_res_t res);
+int crt_comp_sched_replenish(struct crt_comp **children, int n, struct crt_comp *self, tcap_prio_t prio, tcap_res_t res);
 
 struct crt_comp_exec_context *crt_comp_exec_sched_init(struct crt_comp_exec_context *ctxt, struct crt_rcv *r);
 struct crt_comp_exec_context *crt_comp_exec_thd_init(struct crt_comp_exec_context *ctxt, struct crt_thd *t);
@@ -202,12 +232,21 @@ capid_t crt_vm_lapic_access_create(struct crt_comp *comp, vaddr_t mem);
 capid_t crt_vm_shared_region_create(struct crt_comp *comp, vaddr_t *page);
 capid_t crt_vm_vmcb_create(struct crt_comp *comp, vm_vmcscap_t vmcs_cap, vm_msrbitmapcap_t msr_bitmap_cap, vm_lapicaccesscap_t lapic_access_cap, vm_lapiccap_t lapic_cap, vm_shared_mem_t shared_mem_cap, thdcap_t handler_thd_cap, u16_t vpid);
 
-int crt_sinv_create(struct crt_sinv *sinv, char *name, struct crt_comp *server, struct crt_comp *client, vaddr_t c_fn_addr, vaddr_t c_fast_callgate_addr, vaddr_t c_ucap_addr, vaddr_t s_fn_addr, vaddr_t s_altfn_addr);
+int crt_sinv_create(struct crt_sinv *sinv, char *name, struct crt_comp *server, struct crt_comp *client, vaddr_t c_fn_addr, vaddr_t c_fast_callgate_addr, vaddr_t c_ucap_addr, vaddr_t s_fn_addr, vaddr_t s_altfn_addr, capid_t c_capid);
 int crt_sinv_create_shared(struct crt_sinv *sinv, char *name, struct crt_comp *server, struct crt_comp *client, vaddr_t c_fn_addr, vaddr_t c_ucap_addr, vaddr_t s_fn_addr);
 
 int crt_sinv_alias_in(struct crt_sinv *s, struct crt_comp *c, struct crt_sinv_resources *res);
+/*
+ * Between these calls, the kernel activations of crt_sinv_create are
+ * queued and issued in batches (see cos_capop_batch_*) rather than
+ * with a system call per sinv. The sinvs cannot be invoked before
+ * crt_sinv_batch_end returns.
+ */
+void crt_sinv_batch_begin(void);
+int  crt_sinv_batch_end(void);
 
 int crt_asnd_create(struct crt_asnd *s, struct crt_rcv *r);
+int crt_asnd_create_ipilimit(struct crt_asnd *s, struct crt_rcv *r, microsec_t ipiwin, u32_t ipimax);
 int crt_asnd_alias_in(struct crt_asnd *s, struct crt_comp *c, struct crt_asnd_resources *res);
 
 typedef cos_thd_fn_t crt_thd_fn_t;
@@ -222,8 +261,12 @@ int crt_thd_create_with(struct crt_thd *t, struct crt_comp *c, struct crt_thd_re
 int crt_thd_alias_in(struct crt_thd *t, struct crt_comp *c, struct crt_thd_resources *res);
 
 void *crt_page_allocn(struct crt_comp *c, u32_t n_pages);
+void *crt_page_allocn_node(struct crt_comp *c, u32_t n_pages, int node);
 int crt_page_aliasn_in(void *pages, u32_t n_pages, struct crt_comp *self, struct crt_comp *c_in, vaddr_t *map_addr);
 int crt_page_aliasn_aligned_in(void *pages, unsigned long align, u32_t n_pages, struct crt_comp *self, struct crt_comp *c_in, vaddr_t *map_addr);
+void *crt_superpage_allocn(struct crt_comp *c, u32_t n_superpages);
+int crt_superpage_aliasn_in(void *superpages, u32_t n_superpages, struct crt_comp *self, struct crt_comp *c_in, vaddr_t *map_addr);
+int crt_superpage_aliasn_aligned_in(void *superpages, unsigned long align, u32_t n_superpages, struct crt_comp *self, struct crt_comp *c_in, vaddr_t *map_addr);
 
 /**
  * Initialization API to automate the coordination necessary for
@@ -235,8 +278,48 @@ void crt_compinit_execute(comp_get_fn_t comp_get);
 void crt_compinit_done(struct crt_comp *c, int parallel_init, init_main_t main_type);
 void crt_compinit_exit(struct crt_comp *c, int retval);
 
+/*
+ * The placement of the initial threads of the components we schedule,
+ * from the composition (`cores`, `numa_node`, and `priority`). The
+ * components without one have a thread on each core, at our default
+ * priority (0), but those of the cores `dedicated` to a component
+ * (`crt_placement_dedicated` returns it, or 0) are only its own.
+ */
+compid_t     crt_placement_dedicated(coreid_t core);
+int          crt_placement_oncore(compid_t id, coreid_t core);
+int          crt_placement_ncores(compid_t id);
+coreid_t     crt_placement_initcore(compid_t id);
+unsigned int crt_placement_prio(compid_t id);
+void         crt_comp_placement_init(struct crt_comp *c);
+
+/*
+ * Pipelines of components: each stage is a component, placed on a
+ * core, that receives the items of the previous stage, and sends
+ * items to the next one, on channels in memory shared between them
+ * (see `crt_pipeline.h`). The memory of each channel is in the NUMA
+ * node of its consumer's core, as its reads of the items miss in its
+ * cache, while the producer's writes are buffered.
+ */
+#define CRT_PIPELINE_MAX_STAGES 8
+
+struct crt_pipeline_stage {
+	struct crt_comp          *comp;
+	coreid_t                  core;
+	struct crt_pipeline_info *info; /* our view of the stage's description */
+};
+
+struct crt_pipeline {
+	u32_t                     nstages, npages;
+	struct crt_pipeline_stage stages[CRT_PIPELINE_MAX_STAGES];
+};
+
+int crt_pipeline_create(struct crt_pipeline *p, struct crt_comp *self, struct crt_comp **comps, coreid_t *cores, u32_t nstages,
+                        u32_t item_sz, u32_t nslots, u32_t flags, size_t chan_sz);
+int crt_pipeline_thd_create(struct crt_pipeline *p, u32_t stage, struct crt_thd *t, thdclosure_index_t closure_id);
+
 int crt_chkpt_create(struct crt_chkpt *chkpt, struct crt_comp *c);
 int crt_chkpt_restore(struct crt_chkpt *chkpt, struct crt_comp *c);
+int crt_chkpt_pgflt_init(struct crt_comp *self);
 
 int crt_ulk_init(void);
 int crt_ulk_map_in(struct crt_comp *c);
@@ -0,0 +1,44 @@
+#ifndef CRT_PIPELINE_H
+#define CRT_PIPELINE_H
+
+/***
+ * The description of a stage of a component pipeline (see
+ * `crt_pipeline_create`), shared between the component that creates
+ * the pipeline, and the stage's component. Each stage receives the
+ * items of the previous stage on its `in` channel, and sends items to
+ * the next stage on its `out` channel. Both are in memory mapped into
+ * the stage, to be initialized with `chan_init_mem` (with the
+ * pipeline's `item_sz`, `nslots`, and `flags`), which doesn't invoke
+ * the chanmgr:
+ *
+ *     struct crt_pipeline_info *p = crt_pipeline_info();
+ *
+ *     if (p->in && chan_init_mem(&in, (void *)p->in, p->item_sz, p->nslots, p->flags)) BUG();
+ *     chan_rcv_init(&r, &in);
+ *
+ * This header only depends on `cos_component.h`, so that the stages
+ * can include it without depending on `crt`.
+ */
+
+#include <cos_component.h>
+
+/* The word of the stage's `cos_component_information` with the address of its description */
+#define CRT_PIPELINE_POLY 0
+
+struct crt_pipeline_info {
+	u32_t    stage, nstages;
+	/* The core the stage should execute on */
+	coreid_t core;
+	u32_t    item_sz, nslots, flags;
+	/* The memory of the channels from the previous, and to the next stage, or `0` */
+	vaddr_t  in, out;
+};
+
+/* The description of the pipeline stage we are, or `NULL` if we aren't one */
+static inline struct crt_pipeline_info *
+crt_pipeline_info(void)
+{
+	return (struct crt_pipeline_info *)__cosrt_comp_info.cos_poly[CRT_PIPELINE_POLY];
+}
+
+#endif /* CRT_PIPELINE_H */
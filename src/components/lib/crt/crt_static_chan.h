@@ -8,7 +8,11 @@
 #define CRT_STATIC_CHAN_H
 
 /***
- *
+ * A single producer, single consumer channel in static memory,
+ * blocking on `crt_blkpt`s. Superseded by the channels of
+ * `lib/chan`, whose `CHAN_TYPE_PROTOTYPES` and `CHAN_STATIC_ALLOC`
+ * provide the same typed, static channels, as well as those shared
+ * between components: new code should use those.
  */
 
 #include <cos_component.h>
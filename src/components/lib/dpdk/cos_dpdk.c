@@ -9,9 +9,14 @@
 #include <rte_log.h>
 #include <rte_config.h>
 #include <rte_mbuf.h>
+#include <rte_mbuf_dyn.h>
+#include <rte_tcp.h>
+#include <rte_flow.h>
+#include <rte_malloc.h>
 
 #include <arpa/inet.h>
 #include <net_stack_types.h>
+#include <string.h>
 
 #include "cos_dpdk.h"
 extern struct rte_pci_bus rte_pci_bus;
@@ -123,6 +128,21 @@ cos_eth_ports_init(void)
 }
 
 static struct rte_mempool * cos_dpdk_pktmbuf_pool = NULL;
+#define COS_TSO_OFFLOADS \
+	(RTE_ETH_TX_OFFLOAD_TCP_TSO | RTE_ETH_TX_OFFLOAD_IPV4_CKSUM | RTE_ETH_TX_OFFLOAD_TCP_CKSUM)
+
+/* The tx offloads enabled on each port, by cos_config_dev_port_queue */
+static uint64_t port_tx_offloads[RTE_MAX_ETHPORTS];
+/* The MTU of each port set by cos_dev_port_mtu_set, 0 for the default one */
+static uint16_t port_mtu[RTE_MAX_ETHPORTS];
+/* The dynamic field, and flag, of the mbufs with an rx timestamp, if it is enabled */
+static int      rx_ts_off = -1;
+static uint64_t rx_ts_flag;
+
+#define COS_RX_META_OFFLOADS \
+	(RTE_ETH_RX_OFFLOAD_RSS_HASH | RTE_ETH_RX_OFFLOAD_IPV4_CKSUM | \
+	 RTE_ETH_RX_OFFLOAD_TCP_CKSUM | RTE_ETH_RX_OFFLOAD_UDP_CKSUM)
+
 static struct rte_eth_conf default_port_conf = {
 	.rxmode = {
 		.mq_mode = RTE_ETH_MQ_RX_NONE,
@@ -181,13 +201,45 @@ cos_free_packet(char* packet)
  * 
  * return: 0 on success, others will cause panic
  * 
- * note: this function gives users ability to config a port's rx/tx queues
+ * note: this function gives users ability to config a port's rx/tx queues;
+ *       with multiple rx queues, packets are spread across them with RSS
+ *       on their IP addresses and UDP/TCP ports (see also
+ *       cos_dev_port_flow_steer)
  */
 int
 cos_config_dev_port_queue(cos_portid_t port_id, uint16_t nb_rx_q, uint16_t nb_tx_q)
 {
 	int ret;
 	struct rte_eth_conf local_port_conf = default_port_conf;
+	struct rte_eth_dev_info dev_info;
+
+	rte_eth_dev_info_get(ports_ids[port_id], &dev_info);
+	if (ENABLE_TSO) {
+		/* Packets of chained mbufs, and TSO only if the NIC also does the checksums it needs */
+		local_port_conf.txmode.offloads = dev_info.tx_offload_capa & RTE_ETH_TX_OFFLOAD_MULTI_SEGS;
+		if ((dev_info.tx_offload_capa & COS_TSO_OFFLOADS) == COS_TSO_OFFLOADS) {
+			local_port_conf.txmode.offloads |= COS_TSO_OFFLOADS;
+		}
+		port_tx_offloads[port_id] = local_port_conf.txmode.offloads;
+	}
+	if (port_mtu[port_id]) {
+		/* Frames larger than an mbuf are scattered into chains of them */
+		local_port_conf.rxmode.mtu      = port_mtu[port_id];
+		local_port_conf.rxmode.offloads = dev_info.rx_offload_capa & RTE_ETH_RX_OFFLOAD_SCATTER;
+	}
+	/* The metadata of cos_get_packet_meta, as far as the NIC computes it */
+	local_port_conf.rxmode.offloads |= dev_info.rx_offload_capa & COS_RX_META_OFFLOADS;
+	if (COS_RX_TIMESTAMP && (dev_info.rx_offload_capa & RTE_ETH_RX_OFFLOAD_TIMESTAMP) &&
+	    rte_mbuf_dyn_rx_timestamp_register(&rx_ts_off, &rx_ts_flag) == 0) {
+		local_port_conf.rxmode.offloads |= RTE_ETH_RX_OFFLOAD_TIMESTAMP;
+	}
+
+	if (nb_rx_q > 1) {
+		local_port_conf.rxmode.mq_mode = RTE_ETH_MQ_RX_RSS;
+		local_port_conf.rx_adv_conf.rss_conf.rss_key = NULL;
+		local_port_conf.rx_adv_conf.rss_conf.rss_hf  =
+			(RTE_ETH_RSS_IP | RTE_ETH_RSS_UDP | RTE_ETH_RSS_TCP) & dev_info.flow_type_rss_offloads;
+	}
 
 	ret = rte_eth_dev_configure(ports_ids[port_id], nb_rx_q, nb_tx_q, &local_port_conf);
 	if (ret < 0) {
@@ -196,7 +248,7 @@ cos_config_dev_port_queue(cos_portid_t port_id, uint16_t nb_rx_q, uint16_t nb_tx
 	}
 	
 	COS_DPDK_APP_LOG(NOTICE, "cos_config_dev_port_queue success, with "
-			"%d rx_queue, %d tx_queues\n", nb_tx_q, nb_tx_q);
+			"%d rx_queue, %d tx_queues\n", nb_rx_q, nb_tx_q);
 
 	return ret;
 }
@@ -447,14 +499,102 @@ cos_dev_port_tx_burst(cos_portid_t port_id, uint16_t queue_id,
 
 /*
  * cos_parse_pkts: return data pointer of this packet
+ *
+ * note: len is the length of the data in the first mbuf of the packet,
+ *       which is the whole packet unless it's scattered (see
+ *       cos_packet_len)
  */
 char*
 cos_get_packet(char* mbuf, int *len)
 {
-	*len = ((struct rte_mbuf*)mbuf)->pkt_len;
+	*len = ((struct rte_mbuf*)mbuf)->data_len;
 	return (char *)rte_pktmbuf_mtod((struct rte_mbuf*)mbuf, struct rte_ether_hdr *);
 }
 
+/*
+ * cos_get_packet_meta: as cos_get_packet, also filling in the metadata
+ *                      the NIC computed for the packet
+ *
+ * note: the metadata is only valid for packets received from the NIC
+ */
+char *
+cos_get_packet_meta(char *mbuf, int *len, struct cos_pkt_meta *meta)
+{
+	struct rte_mbuf *m     = (struct rte_mbuf *)mbuf;
+	uint64_t         flags = m->ol_flags;
+	uint32_t         ptype = m->packet_type;
+
+	meta->flags = 0;
+	meta->ptype = 0;
+	if (flags & RTE_MBUF_F_RX_RSS_HASH) {
+		meta->rss_hash = m->hash.rss;
+		meta->flags   |= COS_PKT_META_RSS;
+	}
+	if (rx_ts_off >= 0 && (flags & rx_ts_flag)) {
+		meta->rx_ts  = *RTE_MBUF_DYNFIELD(m, rx_ts_off, rte_mbuf_timestamp_t *);
+		meta->flags |= COS_PKT_META_TS;
+	}
+	if (ptype & (RTE_PTYPE_L3_MASK | RTE_PTYPE_L4_MASK)) {
+		meta->flags |= COS_PKT_META_PTYPE;
+		if (RTE_ETH_IS_IPV4_HDR(ptype))                       meta->ptype |= COS_PTYPE_IPV4;
+		if ((ptype & RTE_PTYPE_L4_MASK) == RTE_PTYPE_L4_TCP)  meta->ptype |= COS_PTYPE_TCP;
+		if ((ptype & RTE_PTYPE_L4_MASK) == RTE_PTYPE_L4_UDP)  meta->ptype |= COS_PTYPE_UDP;
+		if ((ptype & RTE_PTYPE_L4_MASK) == RTE_PTYPE_L4_FRAG) meta->ptype |= COS_PTYPE_FRAG;
+	}
+	if ((flags & RTE_MBUF_F_RX_IP_CKSUM_MASK) == RTE_MBUF_F_RX_IP_CKSUM_GOOD) meta->flags |= COS_PKT_META_IP_CSUM;
+	if ((flags & RTE_MBUF_F_RX_L4_CKSUM_MASK) == RTE_MBUF_F_RX_L4_CKSUM_GOOD) meta->flags |= COS_PKT_META_L4_CSUM;
+
+	return cos_get_packet(mbuf, len);
+}
+
+/*
+ * cos_dev_port_read_clock: read the NIC's clock, of the rx timestamps
+ *
+ * @return: 0 on success, a negative errno if the NIC doesn't support it
+ */
+int
+cos_dev_port_read_clock(cos_portid_t port_id, uint64_t *clock)
+{
+	return rte_eth_read_clock(ports_ids[port_id], clock);
+}
+
+/*
+ * cos_packet_append: append len bytes of data to an mbuf
+ *
+ * @return: the data appended, NULL if the mbuf has no room for it
+ */
+char *
+cos_packet_append(char *mbuf, uint16_t len)
+{
+	return rte_pktmbuf_append((struct rte_mbuf *)mbuf, len);
+}
+
+/*
+ * cos_packet_len: the length of a packet, in all of its mbufs
+ */
+int
+cos_packet_len(char *mbuf)
+{
+	return ((struct rte_mbuf *)mbuf)->pkt_len;
+}
+
+/*
+ * cos_read_packet: copy the first len bytes of a packet, from all of its mbufs
+ *
+ * @return: 0 on success, -1 if the packet is shorter than len
+ */
+int
+cos_read_packet(char *mbuf, void *dst, uint32_t len)
+{
+	const void *data = rte_pktmbuf_read((struct rte_mbuf *)mbuf, 0, len, dst);
+
+	if (data == NULL) return -1;
+	/* The data of a single mbuf is returned in place */
+	if (data != dst) memcpy(dst, data, len);
+
+	return 0;
+}
+
 /*
  * cos_get_port_stats: get a port's NIC stats
  *
@@ -669,6 +809,82 @@ cos_set_external_packet(char*mbuf, uint16_t data_offset, uint16_t pkt_len, int o
 	}
 }
 
+/*
+ * cos_dev_port_mtu_set: set the MTU of a port, e.g. for jumbo frames
+ *
+ * @return: 0 on success, others on failure
+ *
+ * note: this must be called before cos_config_dev_port_queue, which also
+ *       enables the scattering of received frames into mbufs, as the
+ *       mbufs of a pool can be smaller than a frame
+ */
+int
+cos_dev_port_mtu_set(cos_portid_t port_id, uint16_t mtu)
+{
+	struct rte_eth_dev_info dev_info;
+
+	rte_eth_dev_info_get(ports_ids[port_id], &dev_info);
+	if (mtu < dev_info.min_mtu || mtu > dev_info.max_mtu) return -1;
+	port_mtu[port_id] = mtu;
+
+	return 0;
+}
+
+/*
+ * cos_dev_port_tso_supported: if TCP segmentation offload is enabled on a port
+ *
+ * @return: 1 if the mbufs sent on the port can be chained, and segmented
+ *          by the NIC (see cos_set_packet_tso), 0 otherwise
+ */
+int
+cos_dev_port_tso_supported(cos_portid_t port_id)
+{
+	uint64_t offloads = COS_TSO_OFFLOADS | RTE_ETH_TX_OFFLOAD_MULTI_SEGS;
+
+	return (port_tx_offloads[port_id] & offloads) == offloads;
+}
+
+/*
+ * cos_mbuf_chain: append the mbuf tail (and its segments) to the packet of head
+ *
+ * @return: 0 on success, -EOVERFLOW if the packet would have too many segments
+ */
+int
+cos_mbuf_chain(char *head, char *tail)
+{
+	return rte_pktmbuf_chain((struct rte_mbuf *)head, (struct rte_mbuf *)tail);
+}
+
+/*
+ * cos_set_packet_tso: have the NIC segment a TCP/IPv4 packet
+ *
+ * @mbuf: the first mbuf of the packet, with all of the headers
+ * @mss: the TCP payload of each of the segments
+ *
+ * note: the NIC copies the headers into each segment, and computes
+ *       their IP and TCP checksums, and TCP sequence numbers
+ */
+void
+cos_set_packet_tso(char *mbuf, uint16_t mss)
+{
+	struct rte_mbuf *_mbuf = (struct rte_mbuf *)mbuf;
+	struct rte_ipv4_hdr *ipv4_hdr;
+	struct rte_tcp_hdr *tcp_hdr;
+
+	ipv4_hdr = rte_pktmbuf_mtod_offset(_mbuf, struct rte_ipv4_hdr *, ETH_STD_LEN);
+	tcp_hdr  = (struct rte_tcp_hdr *)((char *)ipv4_hdr + ipv4_hdr->ihl * 4);
+
+	_mbuf->l2_len    = ETH_STD_LEN;
+	_mbuf->l3_len    = ipv4_hdr->ihl * 4;
+	_mbuf->l4_len    = (tcp_hdr->data_off >> 4) * 4;
+	_mbuf->tso_segsz = mss;
+	_mbuf->ol_flags  = RTE_MBUF_F_TX_IPV4 | RTE_MBUF_F_TX_IP_CKSUM | RTE_MBUF_F_TX_TCP_SEG;
+
+	/* The NIC needs the pseudo-header checksum, without the length, of the segments */
+	ipv4_hdr->hdr_checksum = 0;
+	tcp_hdr->cksum         = rte_ipv4_phdr_cksum(ipv4_hdr, _mbuf->ol_flags);
+}
+
 int
 cos_mempool_full(const char *mp)
 {
@@ -720,6 +936,250 @@ cos_get_port_mac_address(uint16_t port_id)
 	return mac_addr_ret;
 }
 
+/*
+ * cos_dev_port_flow_steer: steer the IPv4 packets of a (wildcard) 5-tuple
+ *                          to a rx queue
+ *
+ * @port_id: eth port id, from user's perspective, the maximum id is get
+ *           from cos_eth_ports_init
+ * @spec: the 5-tuple to match, in network byte order
+ * @mask: the bits of spec that are matched, the others are wildcards
+ * @rx_queue_id: the queue to receive the packets
+ *
+ * @return: 0 on success, -1 if the NIC cannot steer the packets (they
+ *          are then spread across the queues by RSS)
+ *
+ * note: this enables the packets of a flow to be received on the core
+ *       that processes them. With the ports matched, but not the
+ *       protocol, both the UDP and the TCP packets are steered.
+ */
+int
+cos_dev_port_flow_steer(cos_portid_t port_id, const struct cos_flow_tuple *spec,
+			const struct cos_flow_tuple *mask, uint16_t rx_queue_id)
+{
+	struct rte_flow_attr attr;
+	struct rte_flow_item pattern[4];
+	struct rte_flow_action action[2];
+	struct rte_flow_action_queue queue = { .index = rx_queue_id };
+	struct rte_flow_item_ipv4 ip_spec, ip_mask;
+	struct rte_flow_item_udp udp_spec, udp_mask;
+	struct rte_flow_item_tcp tcp_spec, tcp_mask;
+	struct rte_flow_error error;
+	struct rte_flow *flow;
+
+	if (!mask->proto && (mask->src_port || mask->dst_port)) {
+		struct cos_flow_tuple s = *spec, m = *mask;
+
+		m.proto = 0xFF;
+		s.proto = UDP_PROTO;
+		if (cos_dev_port_flow_steer(port_id, &s, &m, rx_queue_id)) return -1;
+		s.proto = TCP_PROTO;
+
+		return cos_dev_port_flow_steer(port_id, &s, &m, rx_queue_id);
+	}
+
+	memset(&attr, 0, sizeof(attr));
+	memset(pattern, 0, sizeof(pattern));
+	memset(action, 0, sizeof(action));
+	memset(&ip_spec, 0, sizeof(ip_spec));
+	memset(&ip_mask, 0, sizeof(ip_mask));
+	memset(&udp_spec, 0, sizeof(udp_spec));
+	memset(&udp_mask, 0, sizeof(udp_mask));
+	memset(&tcp_spec, 0, sizeof(tcp_spec));
+	memset(&tcp_mask, 0, sizeof(tcp_mask));
+
+	attr.ingress = 1;
+	action[0].type = RTE_FLOW_ACTION_TYPE_QUEUE;
+	action[0].conf = &queue;
+	action[1].type = RTE_FLOW_ACTION_TYPE_END;
+
+	ip_spec.hdr.src_addr      = spec->src_ip & mask->src_ip;
+	ip_spec.hdr.dst_addr      = spec->dst_ip & mask->dst_ip;
+	ip_spec.hdr.next_proto_id = spec->proto & mask->proto;
+	ip_mask.hdr.src_addr      = mask->src_ip;
+	ip_mask.hdr.dst_addr      = mask->dst_ip;
+	ip_mask.hdr.next_proto_id = mask->proto;
+
+	pattern[0].type = RTE_FLOW_ITEM_TYPE_ETH;
+	pattern[1].type = RTE_FLOW_ITEM_TYPE_IPV4;
+	pattern[1].spec = &ip_spec;
+	pattern[1].mask = &ip_mask;
+	pattern[2].type = RTE_FLOW_ITEM_TYPE_END;
+	pattern[3].type = RTE_FLOW_ITEM_TYPE_END;
+
+	if (mask->proto && spec->proto == UDP_PROTO) {
+		udp_spec.hdr.src_port = spec->src_port & mask->src_port;
+		udp_spec.hdr.dst_port = spec->dst_port & mask->dst_port;
+		udp_mask.hdr.src_port = mask->src_port;
+		udp_mask.hdr.dst_port = mask->dst_port;
+
+		pattern[2].type = RTE_FLOW_ITEM_TYPE_UDP;
+		pattern[2].spec = &udp_spec;
+		pattern[2].mask = &udp_mask;
+	} else if (mask->proto && spec->proto == TCP_PROTO) {
+		tcp_spec.hdr.src_port = spec->src_port & mask->src_port;
+		tcp_spec.hdr.dst_port = spec->dst_port & mask->dst_port;
+		tcp_mask.hdr.src_port = mask->src_port;
+		tcp_mask.hdr.dst_port = mask->dst_port;
+
+		pattern[2].type = RTE_FLOW_ITEM_TYPE_TCP;
+		pattern[2].spec = &tcp_spec;
+		pattern[2].mask = &tcp_mask;
+	} else if (mask->src_port || mask->dst_port) {
+		/* Only TCP and UDP have ports */
+		return -1;
+	}
+
+	if (rte_flow_validate(ports_ids[port_id], &attr, pattern, action, &error)) return -1;
+	flow = rte_flow_create(ports_ids[port_id], &attr, pattern, action, &error);
+	if (!flow) return -1;
+
+	COS_DPDK_APP_LOG(NOTICE, "cos_dev_port_flow_steer success, proto %u, dst "NIPQUAD_FMT":%u to rx_queue %u\n",
+			spec->proto & mask->proto, NIPQUAD(ip_spec.hdr.dst_addr),
+			ntohs(spec->dst_port & mask->dst_port), rx_queue_id);
+
+	return 0;
+}
+
+/*
+ * cos_dev_port_rss_queues_set: spread the packets with RSS only across
+ *                              the first queues of a port
+ *
+ * @port_id: eth port id, from user's perspective, the maximum id is get
+ *           from cos_eth_ports_init
+ * @nb_rss_q: the number of queues, from queue 0, used by RSS
+ *
+ * @return: 0 on success, others on failure
+ *
+ * note: the other queues then only receive the packets steered to them
+ *       (see cos_dev_port_flow_steer). The port must be started.
+ */
+int
+cos_dev_port_rss_queues_set(cos_portid_t port_id, uint16_t nb_rss_q)
+{
+	struct rte_eth_rss_reta_entry64 reta_conf[RTE_ETH_RSS_RETA_SIZE_512 / RTE_ETH_RETA_GROUP_SIZE];
+	struct rte_eth_dev_info dev_info;
+	uint16_t i;
+	int ret;
+
+	ret = rte_eth_dev_info_get(ports_ids[port_id], &dev_info);
+	if (ret < 0) return ret;
+	if (dev_info.reta_size == 0 || dev_info.reta_size > RTE_ETH_RSS_RETA_SIZE_512) return -1;
+
+	memset(reta_conf, 0, sizeof(reta_conf));
+	for (i = 0; i < dev_info.reta_size; i++) {
+		reta_conf[i / RTE_ETH_RETA_GROUP_SIZE].mask |= 1ULL << (i % RTE_ETH_RETA_GROUP_SIZE);
+		reta_conf[i / RTE_ETH_RETA_GROUP_SIZE].reta[i % RTE_ETH_RETA_GROUP_SIZE] = i % nb_rss_q;
+	}
+
+	return rte_eth_dev_rss_reta_update(ports_ids[port_id], reta_conf, dev_info.reta_size);
+}
+
+/*
+ * cos_dev_port_max_tx_queues: the number of tx queues the port supports
+ *
+ * @port_id: eth port id, from user's perspective, the maximum id is get
+ *           from cos_eth_ports_init
+ *
+ * @return: the maximum number of tx queues, at least 1
+ */
+uint16_t
+cos_dev_port_max_tx_queues(cos_portid_t port_id)
+{
+	struct rte_eth_dev_info dev_info;
+
+	if (rte_eth_dev_info_get(ports_ids[port_id], &dev_info) < 0 || dev_info.max_tx_queues == 0) return 1;
+
+	return dev_info.max_tx_queues;
+}
+
+/*
+ * cos_dev_port_rx_queue_add: set up and start a rx queue of a started port
+ *
+ * @port_id: eth port id, from user's perspective, the maximum id is get
+ *           from cos_eth_ports_init
+ * @rx_queue_id: queue idx setup by user, within the queues configured
+ *               with cos_config_dev_port_queue
+ * @nb_rx_desc: number of rx descriptors used with this queue
+ * @mp: the mbuf pool the queue receives into
+ *
+ * @return: 0 on success, others on failure (without panic, unlike
+ *          cos_dev_port_rx_queue_setup)
+ *
+ * note: the NIC must support setting up queues at runtime
+ */
+int
+cos_dev_port_rx_queue_add(cos_portid_t port_id, uint16_t rx_queue_id, uint16_t nb_rx_desc, char *mp)
+{
+	cos_portid_t real_port_id = ports_ids[port_id];
+	struct rte_eth_dev_info dev_info;
+	struct rte_eth_rxconf rxq_conf;
+	int ret;
+
+	ret = rte_eth_dev_info_get(real_port_id, &dev_info);
+	if (ret < 0) return ret;
+	if (!(dev_info.dev_capa & RTE_ETH_DEV_CAPA_RUNTIME_RX_QUEUE_SETUP)) return -1;
+	rxq_conf = dev_info.default_rxconf;
+
+	ret = rte_eth_rx_queue_setup(real_port_id, rx_queue_id, nb_rx_desc,
+					rte_eth_dev_socket_id(real_port_id),
+					&rxq_conf,
+					(struct rte_mempool *)mp);
+	if (ret < 0) return ret;
+	ret = rte_eth_dev_rx_queue_start(real_port_id, rx_queue_id);
+	if (ret < 0) return ret;
+
+	COS_DPDK_APP_LOG(NOTICE, "cos_dev_port_rx_queue_add success, with "
+			"%d rx_desc in rx_queue_%d\n", nb_rx_desc, rx_queue_id);
+
+	return 0;
+}
+
+/*
+ * cos_create_pkt_mbuf_pool_extbufs: create a pool of mbufs whose data buffers
+ *                                   are in the caller's memory
+ *
+ * @name: pkt pool name
+ * @nb_bufs: number of buffers, thus of mbufs within this pool
+ * @buf_sz: the size of each buffer
+ * @buf_get: returns the i-th buffer, and its physical address in paddr
+ * @arg: passed to buf_get
+ *
+ * @return: NULL on allocate failure, others on success
+ *
+ * note: the NIC receives the packets straight into the buffers, with
+ *       cos_get_packet returning the buffer itself. The RTE_PKTMBUF_HEADROOM
+ *       bytes before each buffer are the headroom of its mbuf, which is never
+ *       written on receive, so they can belong to something else. The buffers
+ *       stay with the pool: freeing an mbuf returns it, with its buffer.
+ */
+char*
+cos_create_pkt_mbuf_pool_extbufs(const char *name, size_t nb_bufs, uint16_t buf_sz,
+			void *(*buf_get)(void *arg, size_t i, uint64_t *paddr), void *arg)
+{
+	struct rte_pktmbuf_extmem *ext_mem;
+	struct rte_mempool *mp;
+	uint64_t paddr;
+	size_t i;
+
+	ext_mem = rte_zmalloc(NULL, nb_bufs * sizeof(struct rte_pktmbuf_extmem), 0);
+	if (!ext_mem) return NULL;
+
+	/* Each buffer is its own memory segment, with a single mbuf */
+	for (i = 0; i < nb_bufs; i++) {
+		ext_mem[i].buf_ptr  = (char *)buf_get(arg, i, &paddr) - RTE_PKTMBUF_HEADROOM;
+		ext_mem[i].buf_iova = paddr - RTE_PKTMBUF_HEADROOM;
+		ext_mem[i].buf_len  = RTE_PKTMBUF_HEADROOM + buf_sz;
+		ext_mem[i].elt_size = RTE_PKTMBUF_HEADROOM + buf_sz;
+	}
+	mp = rte_pktmbuf_pool_create_extbuf(name, nb_bufs, 0, 0, RTE_PKTMBUF_HEADROOM + buf_sz,
+					    rte_socket_id(), ext_mem, nb_bufs);
+	/* The pool only uses the segments while initializing the mbufs */
+	rte_free(ext_mem);
+
+	return (char *)mp;
+}
+
 void cos_rte_flow(void)
 {
 	#define MAX_PATTERN_NUM		3
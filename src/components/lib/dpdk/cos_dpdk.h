@@ -50,6 +50,20 @@ typedef uint8_t  cos_coreid_t;
 typedef uint16_t cos_portid_t;
 typedef uint16_t cos_queueid_t;
 
+/*
+ * The 5-tuple of an IPv4 packet, in network byte order, and padded to
+ * 16 bytes so it can be compared as two words. A protocol of 0 (not
+ * matched) with matched ports is either TCP or UDP.
+ */
+struct cos_flow_tuple {
+	uint32_t src_ip;
+	uint32_t dst_ip;
+	uint16_t src_port;
+	uint16_t dst_port;
+	uint8_t  proto;
+	uint8_t  pad[3];
+} __attribute__((aligned(8)));
+
 /* use opeaque pointer to hide details from DPDK to Composite app */
 
 enum cos_dpdk_status_t {
@@ -97,9 +111,51 @@ uint16_t cos_dev_port_rx_burst(cos_portid_t port_id, uint16_t queue_id,
 uint16_t cos_dev_port_tx_burst(cos_portid_t port_id, uint16_t queue_id,
 		 char**tx_pkts, const uint16_t nb_pkts);
 
+int cos_dev_port_flow_steer(cos_portid_t port_id, const struct cos_flow_tuple *spec,
+			const struct cos_flow_tuple *mask, uint16_t rx_queue_id);
+int cos_dev_port_rss_queues_set(cos_portid_t port_id, uint16_t nb_rss_q);
+uint16_t cos_dev_port_max_tx_queues(cos_portid_t port_id);
+int cos_dev_port_rx_queue_add(cos_portid_t port_id, uint16_t rx_queue_id, uint16_t nb_rx_desc, char *mp);
+
+/* buf_get: returns the i-th buffer of the pool, and its physical address in paddr */
+char* cos_create_pkt_mbuf_pool_extbufs(const char *name, size_t nb_bufs, uint16_t buf_sz,
+			void *(*buf_get)(void *arg, size_t i, uint64_t *paddr), void *arg);
+
 void cos_get_port_stats(cos_portid_t port_id);
 
 char* cos_get_packet(char* mbuf, int *len);
+
+/*
+ * The metadata of a received packet, that the NIC computed: each field
+ * is only valid with its flag, as NICs don't all provide them. The
+ * timestamp is in the NIC's clock (see cos_dev_port_read_clock), and
+ * only taken with COS_RX_TIMESTAMP, as it can slow the rx down.
+ */
+#define COS_RX_TIMESTAMP 0
+
+#define COS_PKT_META_RSS      (1 << 0) /* rss_hash is the NIC's RSS hash of the packet */
+#define COS_PKT_META_TS       (1 << 1) /* rx_ts is when the NIC received the packet */
+#define COS_PKT_META_PTYPE    (1 << 2) /* ptype is the packet's type, as parsed by the NIC */
+#define COS_PKT_META_IP_CSUM  (1 << 3) /* the IPv4 checksum was checked, and is good */
+#define COS_PKT_META_L4_CSUM  (1 << 4) /* the TCP or UDP checksum was checked, and is good */
+
+#define COS_PTYPE_IPV4 (1 << 0)
+#define COS_PTYPE_TCP  (1 << 1)
+#define COS_PTYPE_UDP  (1 << 2)
+#define COS_PTYPE_FRAG (1 << 3)
+
+struct cos_pkt_meta {
+	uint64_t rx_ts;
+	uint32_t rss_hash;
+	uint16_t ptype;
+	uint16_t flags;
+};
+
+char *cos_get_packet_meta(char *mbuf, int *len, struct cos_pkt_meta *meta);
+int cos_dev_port_read_clock(cos_portid_t port_id, uint64_t *clock);
+int cos_packet_len(char *mbuf);
+char *cos_packet_append(char *mbuf, uint16_t len);
+int cos_read_packet(char *mbuf, void *dst, uint32_t len);
 uint16_t cos_send_a_packet(char * pkt, uint32_t pkt_size, char* mp);
 char* cos_allocate_mbuf(char* mp);
 
@@ -110,6 +166,10 @@ int cos_attach_external_mbuf(char *mbuf, void *buf_vaddr,
 			void *ext_shinfo);
 
 void cos_set_external_packet(char*mbuf, uint16_t data_offset, uint16_t pkt_len, int offload);
+int cos_dev_port_mtu_set(cos_portid_t port_id, uint16_t mtu);
+int cos_dev_port_tso_supported(cos_portid_t port_id);
+int cos_mbuf_chain(char *head, char *tail);
+void cos_set_packet_tso(char *mbuf, uint16_t mss);
 int cos_mempool_full(const char *mp);
 unsigned int cos_mempool_in_use_count(const char *mp);
 int cos_eth_tx_done_cleanup(uint16_t port_id, uint16_t queue_id, uint32_t free_cnt);
@@ -118,12 +178,26 @@ uint64_t cos_get_port_mac_address(uint16_t port_id);
 void cos_test_send(int queue, char *mp);
 
 #define E810_NIC 0
-#define NIC_RX_QUEUE_NUM 1
 
+/* One rx queue polled per core, with RSS, if the NIC supports it */
+#if E810_NIC
+#define NIC_RX_QUEUE_NUM NUM_CPU
+#else
+#define NIC_RX_QUEUE_NUM 1
+#endif
+/* At most one tx queue per core, as many as the NIC has (see cos_dev_port_max_tx_queues) */
+#define NIC_TX_QUEUE_NUM NUM_CPU
+
+/*
+ * The rx queues, after the RSS ones, that are each dedicated to one
+ * session, and receive straight into its shared memory (zero-copy).
+ * They are set up when the sessions bind, so the NIC must support
+ * setting up queues while it is started.
+ */
 #if E810_NIC
-#define NIC_TX_QUEUE_NUM (NUM_CPU - 1)
+#define NIC_RX_ZC_QUEUE_NUM 8
 #else
-#define NIC_TX_QUEUE_NUM 1
+#define NIC_RX_ZC_QUEUE_NUM 0
 #endif
 
 #endif /* COS_DPDK_H */
\ No newline at end of file
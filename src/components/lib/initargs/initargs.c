@@ -35,6 +35,39 @@ kv_value(struct kv_entry *kv)
 	}
 }
 
+/* Parse at most len characters of a decimal integer */
+static int
+args_strtonum(char *str, int len, long *num)
+{
+	long n = 0;
+	int i = 0, neg = 0;
+
+	if (!str) return -1;
+	if (len > 0 && str[0] == '-') {
+		neg = 1;
+		i++;
+	}
+	if (i == len || str[i] < '0' || str[i] > '9') return -1;
+	for (; i < len && str[i] >= '0' && str[i] <= '9'; i++) {
+		n = n * 10 + (str[i] - '0');
+	}
+	*num = neg ? -n : n;
+
+	return 0;
+}
+
+static int
+kv_num(struct kv_entry *kv, long *num)
+{
+	if (!kv || kv->vtype != VTYPE_STR) return -1;
+	if (kv->isnum) {
+		*num = kv->num;
+		return 0;
+	}
+
+	return args_strtonum(kv->val.str, strlen(kv->val.str), num);
+}
+
 static args_type_t
 kv_type(struct kv_entry *kv)
 {
@@ -118,6 +151,16 @@ args_value(struct initargs *arg)
 	}
 }
 
+int
+args_num(struct initargs *arg, long *num)
+{
+	switch (arg->type) {
+	case ARGS_IMPL_KV:  return kv_num(arg->d.kv_ent, num);
+	case ARGS_IMPL_TAR: return args_strtonum(tar_value(&arg->d.tar_ent), tar_value_sz(&arg->d.tar_ent), num);
+	default:            return -1;
+	}
+}
+
 int
 args_len(struct initargs *arg)
 {
@@ -168,52 +211,70 @@ args_foreach(struct initargs *ent, args_visitor_fn_t fn, void *data)
 }
 
 /*
- * Lookup a key in a K/V map and return the corresponding entry.  Note
- * that this lookup is somewhat unique in that it will lookup the key
- * as a string (null terminated), or as a part of a path (up to and
- * not including a '/').  This enables this function to be used to
- * walk through the data-structure guided by a path through the k/v.
+ * Lookup a key of len characters in a K/V map: a single comparison
+ * with the generated index, and a walk through the map otherwise.
  */
-int
-args_lkup_entry(struct initargs *arg, char *path, struct initargs *ret)
+static struct kv_entry *
+kv_lkup(struct kv_entry *kv, char *key, unsigned int len)
 {
-	struct initargs_iter i;
-	struct initargs curr, start;
-	unsigned int len, cont;
-	char *slash, *key = path;
+	struct kv_entry *e;
+	int i;
+
+	if (!kv || kv->vtype != VTYPE_ARR) return NULL;
+	if (kv->val.arr.htbl) {
+		e = kv->val.arr.htbl[kv_hash(key, len, kv->val.arr.seed) & (kv->val.arr.hsz - 1)];
+		if (e && strncmp(e->key, key, len) == 0 && e->key[len] == '\0') return e;
+
+		return NULL;
+	}
+	for (i = 0; i < kv->val.arr.sz; i++) {
+		e = kv->val.arr.kvs[i];
+		if (strncmp(e->key, key, len) == 0 && e->key[len] == '\0') return e;
+	}
+
+	return NULL;
+}
+
+/* Walk through the maps, guided by each of the keys of the path. */
+static int
+kv_lkup_path(struct kv_entry *kv, char *path, struct kv_entry **ret)
+{
+	char *slash;
+	unsigned int len;
 
-	if (!arg || !key || !ret) return -1;
-	start = *arg;
-	/* Iterate through the path... */
 	do {
-		int found = 0;
-
-		slash = strchr(key, '/');
-		len = slash ? (unsigned int)(slash - key) : strlen(key);
-
-		/* ...and look the key up in the KV */
-		for (cont = args_iter(&start, &i, &curr) ; cont ; cont = args_iter_next(&i, &curr)) {
-			int key_len;
-			char *k = args_key(&curr, &key_len);
-
-			if ((unsigned int)key_len == len && strncmp(k, key, len) == 0) {
-				if (strlen(key) == len) {
-					*ret = curr;
-					return 0;
-				}
-				start = curr;
-				found = 1;
-				break;
-			}
+		slash = strchr(path, '/');
+		len   = slash ? (unsigned int)(slash - path) : strlen(path);
+
+		kv = kv_lkup(kv, path, len);
+		if (!kv) return -1;
+		if (!slash) {
+			*ret = kv;
+			return 0;
 		}
-		if (!found) return -1;
-
-		if (slash) key = slash + 1;
-	} while (slash && *key != '\0');
+		path = slash + 1;
+	} while (*path != '\0');
 
 	return -1;
 }
 
+/*
+ * Lookup a path (/-delimited keys) in a K/V map and return the
+ * corresponding entry.
+ */
+int
+args_lkup_entry(struct initargs *arg, char *path, struct initargs *ret)
+{
+	if (!arg || !path || !ret) return -1;
+
+	ret->type = arg->type;
+	switch (arg->type) {
+	case ARGS_IMPL_KV:  return kv_lkup_path(arg->d.kv_ent, path, &ret->d.kv_ent);
+	case ARGS_IMPL_TAR: return tar_lkup(&arg->d.tar_ent, path, &ret->d.tar_ent);
+	default:            return -1;
+	}
+}
+
 args_type_t
 args_type(struct initargs *ent)
 {
@@ -240,6 +301,16 @@ args_get_from(char *path, struct initargs *from)
 	return args_value(&ent);
 }
 
+int
+args_get_num_from(char *path, struct initargs *from, long *num)
+{
+	struct initargs ent;
+
+	if (args_get_entry_from(path, from, &ent)) return -1;
+
+	return args_num(&ent, num);
+}
+
 /*
  * The "base-case" API where we need to do the initial lookup in the
  * KV map.  This requires basing the search in some structure:
@@ -275,6 +346,16 @@ args_get(char *path)
 	return args_value(&ent);
 }
 
+int
+args_get_num(char *path, long *num)
+{
+	struct initargs ent;
+
+	if (args_get_entry(path, &ent)) return -1;
+
+	return args_num(&ent, num);
+}
+
 #ifdef ARGS_TEST
 
 static struct kv_entry __initargs_autogen_6 = { key: "name", vtype: VTYPE_STR, val: { str: "call_args" } };
@@ -391,6 +472,8 @@ tar_test(void)
 	char *val;
 	struct initargs entry, e;
 	struct initargs_iter i;
+	void *addr;
+	unsigned long len;
 	int cont;
 
 	if (args_get_entry("binaries", &entry)) printf("\"binaries\" not found in the initargs namespace.\n");
@@ -405,6 +488,10 @@ tar_test(void)
 	if (expect(val != NULL, "Lookup of tar file binaries/dir2/subdir2/file3")) {
 		expect(!strcmp(val, "file3 contents\n"), "checking contents of file3");
 	}
+	if (expect(tar_file_map("binaries/dir2/subdir2/file3", &addr, &len) == 0, "tar_file_map of file3")) {
+		expect(addr == val && len == strlen("file3 contents\n"), "file3 is mapped in place");
+	}
+	expect(tar_file_map("binaries/dir2", &addr, &len) != 0, "tar_file_map of a directory fails");
 
 	if (expect(args_get_entry("binaries/dir2", &entry) == 0, "Looking up the binaries/dir2 tar subdirectory")) {
 		expect(args_type(&entry) == ARGS_MAP, "Checking that dir2 is a map");
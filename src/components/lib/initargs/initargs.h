@@ -11,6 +11,11 @@
  * - The top K/V has a key "args" and contains only an array of the K/V arguments.
  * - If a map is just an array of values, then *each* key should be set to "_".
  * - Keys should not include '/' characters.
+ *
+ * The composer generates the K/V with an index for each map: a
+ * perfect hash of its keys (see kv_hash), so that looking a key up is
+ * a hash and a single comparison. It also parses the values that are
+ * integers, so that the args_get_num* functions don't have to.
  */
 
 typedef enum {
@@ -35,6 +40,13 @@ union kv_val {
 	struct {
 		int sz;
 		struct kv_entry **kvs;
+		/*
+		 * The index of the keys: each is at the slot of its
+		 * hash in htbl (of hsz, a power of 2, entries). NULL
+		 * if the keys aren't unique (e.g. arrays of "_").
+		 */
+		unsigned int hsz, seed;
+		struct kv_entry **htbl;
 	} arr;
 };
 
@@ -42,8 +54,33 @@ struct kv_entry {
 	char *key;
 	kv_valtype_t vtype;
 	union kv_val val;
+	/* If the string value is an integer, it is also in num */
+	int isnum;
+	long num;
 };
 
+/*
+ * FNV-1a, from the seed of the map, and mixed so that the seed
+ * changes the low bits we use. The composer (initargs.rs) must
+ * compute the same hash to generate the index.
+ */
+static inline unsigned int
+kv_hash(const char *key, unsigned int len, unsigned int seed)
+{
+	unsigned int h = 2166136261u ^ seed;
+	unsigned int i;
+
+	for (i = 0; i < len; i++) {
+		h ^= (unsigned char)key[i];
+		h *= 16777619u;
+	}
+	h ^= h >> 16;
+	h *= 0x85ebca6bu;
+	h ^= h >> 13;
+
+	return h;
+}
+
 struct kv_iter {
 	struct kv_entry *start;
 	int curr, len;
@@ -75,10 +112,14 @@ int args_get_entry(char *path, struct initargs *entry);
 /* ...and if you already have a node, search *from* there */
 char *args_get_from(char *path, struct initargs *from);
 int args_get_entry_from(char *path, struct initargs *from, struct initargs *ent);
+/* Integer values, without parsing them if we can avoid it: 0 on success */
+int args_get_num(char *path, long *num);
+int args_get_num_from(char *path, struct initargs *from, long *num);
 
 /* Access the k/v of a given entry */
 char *args_key(struct initargs *entry, int *str_len);
 char *args_value(struct initargs *entry);
+int args_num(struct initargs *entry, long *num);
 args_type_t args_type(struct initargs *ent);
 /* Iterate through the entries, particularly in a map. */
 int args_len(struct initargs *kv);
@@ -278,6 +278,191 @@ tar_root(void)
 	return &__tar_root;
 }
 
+/*
+ * An index of the records of the tarball, by their path (without the
+ * trailing '/' of directories), so that lookups don't scan through
+ * the headers of the records. It is built on the first lookup, and if
+ * the tarball has too many records for it, lookups walk through the
+ * directories instead.
+ */
+#define TAR_INDEX_SZ 1024 	/* power of 2 */
+
+typedef enum {
+	TAR_INDEX_NONE = 0,
+	TAR_INDEX_BUILDING,
+	TAR_INDEX_READY,
+	TAR_INDEX_UNUSABLE
+} tar_index_state_t;
+
+static struct tar_record *tar_index[TAR_INDEX_SZ];
+static tar_index_state_t tar_index_state = TAR_INDEX_NONE;
+
+/* FNV-1a */
+static inline unsigned int
+tar_hash(const char *path, int len)
+{
+	unsigned int h = 2166136261u;
+	int i;
+
+	for (i = 0; i < len; i++) {
+		h ^= (unsigned char)path[i];
+		h *= 16777619u;
+	}
+
+	return h;
+}
+
+/* The length of the record's path, without the trailing '/' */
+static inline int
+tar_record_pathlen(struct tar_record *r)
+{
+	int len = strnlen(r->name, TAR_NAME_SZ);
+
+	if (len > 0 && r->name[len - 1] == '/') len--;
+
+	return len;
+}
+
+static int
+tar_index_build(void)
+{
+	struct tar_record *r;
+	int n = 0;
+
+	for (r = tar_root()->record; !tar_end(r); r = tar_next_record(r)) {
+		unsigned int slot;
+
+		/* keep the index at most half full */
+		if (++n > TAR_INDEX_SZ / 2) return -1;
+		slot = tar_hash(r->name, tar_record_pathlen(r));
+		while (tar_index[slot & (TAR_INDEX_SZ - 1)]) slot++;
+		tar_index[slot & (TAR_INDEX_SZ - 1)] = r;
+	}
+
+	return 0;
+}
+
+/* Is the index ready? Only the first to get here builds it. */
+static int
+tar_index_ready(void)
+{
+	tar_index_state_t s = __atomic_load_n(&tar_index_state, __ATOMIC_ACQUIRE);
+
+	if (s == TAR_INDEX_NONE && tar_root() &&
+	    __atomic_compare_exchange_n(&tar_index_state, &s, TAR_INDEX_BUILDING, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+		s = tar_index_build() ? TAR_INDEX_UNUSABLE : TAR_INDEX_READY;
+		__atomic_store_n(&tar_index_state, s, __ATOMIC_RELEASE);
+	}
+
+	return s == TAR_INDEX_READY;
+}
+
+static struct tar_record *
+tar_index_lkup(char *path, int len)
+{
+	struct tar_record *r;
+	unsigned int slot;
+
+	for (slot = tar_hash(path, len); (r = tar_index[slot & (TAR_INDEX_SZ - 1)]) != NULL; slot++) {
+		if (tar_record_pathlen(r) == len && strncmp(r->name, path, len) == 0) return r;
+	}
+
+	return NULL;
+}
+
+/* Walk through the directories, one key of the path at a time */
+static int
+tar_lkup_walk(struct tar_entry *ent, char *path, struct tar_entry *ret)
+{
+	struct tar_entry start = *ent, curr;
+	struct tar_iter i;
+	char *slash;
+	int len, cont;
+
+	do {
+		int found = 0;
+
+		slash = strchr(path, '/');
+		len   = slash ? (int)(slash - path) : (int)strlen(path);
+
+		for (cont = tar_iter(&start, &i, &curr); cont; cont = tar_iter_next(&i, &curr)) {
+			int key_len;
+			char *k = tar_key(&curr, &key_len);
+
+			if (key_len == len && strncmp(k, path, len) == 0) {
+				if (!slash) {
+					*ret = curr;
+					return 0;
+				}
+				start = curr;
+				found = 1;
+				break;
+			}
+		}
+		if (!found) return -1;
+		path = slash + 1;
+	} while (*path != '\0');
+
+	return -1;
+}
+
+int
+tar_lkup(struct tar_entry *ent, char *path, struct tar_entry *ret)
+{
+	char full[TAR_NAME_SZ];
+	struct tar_record *r;
+	int prefix_len = 0, len, nesting = ent->nesting_lvl;
+	char *p;
+
+	if (!tar_valid(ent) || !tar_is_dir(ent->record)) return -1;
+	if (!tar_index_ready()) return tar_lkup_walk(ent, path, ret);
+
+	/* The path of the record is relative to the directory's... */
+	if (nesting >= 0) prefix_len = strnlen(ent->record->name, TAR_NAME_SZ);
+	len = strlen(path);
+	if (len == 0 || prefix_len + len > TAR_NAME_SZ) return -1;
+	memcpy(full, ent->record->name, prefix_len);
+	memcpy(&full[prefix_len], path, len);
+
+	/* ...and each of its (non-empty) keys is a level deeper */
+	for (p = path; *p != '\0'; p++) {
+		if (*p != '/') continue;
+		if (p == path || p[-1] == '/' || p[1] == '\0') return -1;
+		nesting++;
+	}
+
+	r = tar_index_lkup(full, prefix_len + len);
+	if (!r) return -1;
+	*ret = (struct tar_entry) {
+		.nesting_lvl = nesting + 1,
+		.record      = r
+	};
+
+	return 0;
+}
+
+/*
+ * Zero-copy access to the file at path (from the root) of the
+ * component's tarball: *addr is its data, in place in the tarball, and
+ * *len its size. The composer aligns the data of each file on a page,
+ * and the tarball is linked page-aligned, so the pages of the file can
+ * be aliased (e.g. read-only into another component) rather than
+ * copied; *addr is only page-aligned if so. The data must not be
+ * written, as it is shared by all of the users of the tarball.
+ * Returns 0, or -1 if there is no such file.
+ */
+int
+tar_file_map(char *path, void **addr, unsigned long *len)
+{
+	struct tar_entry *root = tar_root(), ent;
+
+	if (!root || tar_lkup(root, path, &ent) || !tar_is_value(&ent)) return -1;
+	*addr = tar_value(&ent);
+	*len  = tar_value_sz(&ent);
+
+	return 0;
+}
+
 #ifdef TAR_TEST
 
 #include <stdio.h>
@@ -49,6 +49,8 @@ char *tar_value(struct tar_entry *ent);
 int tar_value_sz(struct tar_entry *ent);
 int tar_len(struct tar_entry *ent);
 int tar_is_value(struct tar_entry *ent);
+/* lookup the /-delimited path relative to the directory ent */
+int tar_lkup(struct tar_entry *ent, char *path, struct tar_entry *ret);
 
 /* create the iterator for a directory, and return the first entry */
 int tar_iter(struct tar_entry *ent, struct tar_iter *i, struct tar_entry *first);
@@ -56,5 +58,7 @@ int tar_iter(struct tar_entry *ent, struct tar_iter *i, struct tar_entry *first)
 int tar_iter_next(struct tar_iter *i, struct tar_entry *next);
 
 struct tar_entry *tar_root(void);
+/* the data of a file of the tarball, without copying it (see tar.c) */
+int tar_file_map(char *path, void **addr, unsigned long *len);
 
 #endif /* TAR_H */
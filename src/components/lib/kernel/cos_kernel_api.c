@@ -10,6 +10,7 @@
 
 #include <stdarg.h>
 #include <stdio.h>
+#include <string.h>
 
 #ifdef NIL
 #define printd(...) printc(__VA_ARGS__)
@@ -88,12 +89,23 @@ cos_pgtbl_round_up_to_page(int pgtbl_lvl, vaddr_t vaddr)
 	return 0;
 }
 
+static void
+__mempool_init(struct cos_mempool *p, int node, vaddr_t untyped_ptr, vaddr_t untyped_frontier)
+{
+	p->node        = node;
+	p->untyped_ptr = p->umem_ptr = p->kmem_ptr = p->umem_frontier = p->kmem_frontier = untyped_ptr;
+	p->untyped_frontier = untyped_frontier;
+}
+
 void
 cos_meminfo_init(struct cos_meminfo *mi, vaddr_t untyped_ptr, unsigned long untyped_sz, pgtblcap_t pgtbl_cap)
 {
-	mi->untyped_ptr = mi->umem_ptr = mi->kmem_ptr = mi->umem_frontier = mi->kmem_frontier = untyped_ptr;
-	mi->untyped_frontier = untyped_ptr + untyped_sz;
-	mi->pgtbl_cap        = pgtbl_cap;
+	mi->npools = 1;
+	__mempool_init(&mi->pools[0], 0, untyped_ptr, untyped_ptr + untyped_sz);
+	memset(mi->cpu_node, 0, sizeof(mi->cpu_node));
+	mi->partitioned = 0;
+	memset(mi->parts, 0, sizeof(mi->parts));
+	mi->pgtbl_cap = pgtbl_cap;
 }
 
 static inline struct cos_compinfo *
@@ -188,27 +200,19 @@ cos_compinfo_init(struct cos_compinfo *ci, pgtblcap_t pgtbl_cap, captblcap_t cap
 
 /**************** [Memory Capability Allocation Functions] ***************/
 
+/* Called with the mem_lock held; 0 if the pool is exhausted */
 static vaddr_t
-__mem_bump_alloc(struct cos_compinfo *__ci, int km, int retype)
+__mempool_bump_alloc(struct cos_compinfo *ci, struct cos_mempool *p, int km, int retype)
 {
-	vaddr_t              ret = 0;
-	struct cos_compinfo *ci;
-	vaddr_t *            ptr, *frontier;
-
-	printd("__mem_bump_alloc\n");
-
-	assert(__ci);
-	ci = __compinfo_metacap(__ci);
-	assert(ci && ci == __compinfo_metacap(__ci));
-
-	ps_lock_take(&ci->mem_lock);
+	vaddr_t  ret = 0;
+	vaddr_t *ptr, *frontier;
 
 	if (km) {
-		ptr      = &ci->mi.kmem_ptr;
-		frontier = &ci->mi.kmem_frontier;
+		ptr      = &p->kmem_ptr;
+		frontier = &p->kmem_frontier;
 	} else {
-		ptr      = &ci->mi.umem_ptr;
-		frontier = &ci->mi.umem_frontier;
+		ptr      = &p->umem_ptr;
+		frontier = &p->umem_frontier;
 	}
 
 	ret = ps_faa(ptr, PAGE_SIZE);
@@ -217,9 +221,9 @@ __mem_bump_alloc(struct cos_compinfo *__ci, int km, int retype)
 		vaddr_t ptr_tmp = *ptr, front_tmp = *frontier;
 
 		/* TODO: expand frontier if introspection says there is more memory */
-		if (ci->mi.untyped_ptr == ci->mi.untyped_frontier) goto error;
+		if (p->untyped_ptr == p->untyped_frontier) return 0;
 		/* this is the overall frontier, so we know we can use this value... */
-		ret = ps_faa(&ci->mi.untyped_ptr, RETYPE_MEM_SIZE);
+		ret = ps_faa(&p->untyped_ptr, RETYPE_MEM_SIZE);
 		/* failure here means that someone else already advanced the frontier/ptr */
 		if (ps_cas(ptr, ptr_tmp, ret + PAGE_SIZE)) {
 			ps_cas(frontier, front_tmp, ret + RETYPE_MEM_SIZE);
@@ -229,38 +233,267 @@ __mem_bump_alloc(struct cos_compinfo *__ci, int km, int retype)
 	if (retype && (ret % RETYPE_MEM_SIZE == 0)) {
 		/* are we dealing with a kernel memory allocation? */
 		syscall_op_t op = km ? CAPTBL_OP_MEM_RETYPE2KERN : CAPTBL_OP_MEM_RETYPE2USER;
-		if (call_cap_op(ci->mi.pgtbl_cap, op, ret, 0, 0, 0)) goto error;
+		if (call_cap_op(ci->mi.pgtbl_cap, op, ret, 0, 0, 0)) return 0;
 	}
 
-	ps_lock_release(&ci->mem_lock);
+	return ret;
+}
+
+int
+cos_numa_node_curr(struct cos_compinfo *ci)
+{
+	return __compinfo_metacap(ci)->mi.cpu_node[cos_cpuid()];
+}
+
+/*
+ * Take sz bytes, aligned to align, straight from the untyped memory
+ * of a pool, preferring the pool of the node.  The untyped memory
+ * skipped to reach the alignment is not reused.  Called with the
+ * mem_lock held.
+ */
+static struct cos_mempool *
+__mempool_untyped_take(struct cos_compinfo *ci, size_t sz, size_t align, int node, vaddr_t *addr)
+{
+	int i, local;
+
+	for (local = 1; local >= 0; local--) {
+		for (i = 0; i < ci->mi.npools; i++) {
+			struct cos_mempool *p = &ci->mi.pools[i];
+			vaddr_t             ret;
+
+			if ((p->node == node) != local) continue;
+			ret = round_up_to_pow2(p->untyped_ptr, align);
+			if (ret + sz > p->untyped_frontier || ret + sz < ret) continue;
+			p->untyped_ptr = ret + sz;
+			*addr          = ret;
+
+			return p;
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Take a page of a core's part of the untyped memory, or 0 if it is
+ * exhausted; *front is the frontier it was taken against. Any core
+ * can take from any part: the pages are claimed with an atomic
+ * increment, and only valid below the frontier read before it.
+ */
+static vaddr_t
+__mempart_take(struct cos_mempart *part, vaddr_t *front)
+{
+	vaddr_t ret;
+
+	*front = ps_load(&part->frontier);
+	ret    = ps_faa(&part->ptr, PAGE_SIZE);
+	if (ret < *front && *front - ret <= COS_MEMPART_SZ) return ret;
+
+	return 0;
+}
+
+/* Called with the mem_lock held, once the pools are exhausted */
+static vaddr_t
+__mempart_steal(struct cos_compinfo *ci)
+{
+	vaddr_t ret, front;
+	int     i;
+
+	for (i = 0; i < NUM_CPU; i++) {
+		ret = __mempart_take(&ci->mi.parts[i], &front);
+		if (ret) return ret;
+	}
+
+	return 0;
+}
+
+static vaddr_t
+__mempart_bump_alloc(struct cos_compinfo *ci, int km)
+{
+	struct cos_mempart *part = &ci->mi.parts[cos_cpuid()];
+	syscall_op_t        op   = km ? CAPTBL_OP_MEM_RETYPE2KERN : CAPTBL_OP_MEM_RETYPE2USER;
+	vaddr_t             ret, front, chunk;
+	int                 i;
+
+	while (!(ret = __mempart_take(part, &front))) {
+		ps_lock_take(&ci->mem_lock);
+		/* Another thread of the core might have taken a new part meanwhile */
+		if (ps_load(&part->frontier) != front) {
+			ps_lock_release(&ci->mem_lock);
+			continue;
+		}
+		if (__mempool_untyped_take(ci, COS_MEMPART_SZ, PAGE_SIZE, cos_numa_node_curr(ci), &chunk)) {
+			part->ptr = chunk;
+			ps_mem_fence();
+			part->frontier = chunk + COS_MEMPART_SZ;
+			ps_lock_release(&ci->mem_lock);
+			continue;
+		}
+		/* The remainder of the pools, then of the other cores' parts */
+		for (i = 0; i < ci->mi.npools && !ret; i++) ret = __mempool_bump_alloc(ci, &ci->mi.pools[i], km, 0);
+		if (!ret) ret = __mempart_steal(ci);
+		ps_lock_release(&ci->mem_lock);
+		if (!ret) return 0;
+		break;
+	}
+
+	/* Retyping doesn't need the lock, so no other core waits on it */
+	if (call_cap_op(ci->mi.pgtbl_cap, op, ret, 0, 0, 0)) return 0;
 
 	return ret;
-error:
+}
+
+static vaddr_t
+__mem_bump_alloc(struct cos_compinfo *__ci, int km, int retype, int node)
+{
+	vaddr_t              ret = 0;
+	struct cos_compinfo *ci;
+	int                  i;
+
+	printd("__mem_bump_alloc\n");
+
+	assert(__ci);
+	ci = __compinfo_metacap(__ci);
+	assert(ci && ci == __compinfo_metacap(__ci));
+
+	if (node == COS_NUMA_NODE_LOCAL) node = cos_numa_node_curr(ci);
+	if (ci->mi.partitioned && retype && node == cos_numa_node_curr(ci)) return __mempart_bump_alloc(ci, km);
+
+	ps_lock_take(&ci->mem_lock);
+	/* Prefer memory from the node, but fall back on any other */
+	for (i = 0; i < ci->mi.npools && !ret; i++) {
+		if (ci->mi.pools[i].node == node) ret = __mempool_bump_alloc(ci, &ci->mi.pools[i], km, retype);
+	}
+	for (i = 0; i < ci->mi.npools && !ret; i++) {
+		if (ci->mi.pools[i].node != node) ret = __mempool_bump_alloc(ci, &ci->mi.pools[i], km, retype);
+	}
 	ps_lock_release(&ci->mem_lock);
 
-	return 0;
+	return ret;
 }
 
 static vaddr_t
 __kmem_bump_alloc(struct cos_compinfo *ci)
 {
 	printd("__kmem_bump_alloc\n");
-	return __mem_bump_alloc(ci, 1, 1);
+	return __mem_bump_alloc(ci, 1, 1, COS_NUMA_NODE_LOCAL);
 }
 
 /* this should back-up to using untyped memory... */
 static vaddr_t
-__umem_bump_alloc(struct cos_compinfo *ci)
+__umem_bump_alloc(struct cos_compinfo *ci, int node)
 {
 	printd("__umem_bump_alloc\n");
-	return __mem_bump_alloc(ci, 0, 1);
+	return __mem_bump_alloc(ci, 0, 1, node);
 }
 
 static vaddr_t
 __untyped_bump_alloc(struct cos_compinfo *ci)
 {
 	printd("__umem_bump_alloc\n");
-	return __mem_bump_alloc(ci, 1, 0);
+	return __mem_bump_alloc(ci, 1, 0, COS_NUMA_NODE_LOCAL);
+}
+
+/*
+ * Allocate sz bytes of physically contiguous, SUPER_PAGE_SIZE
+ * aligned user memory straight from the untyped memory.  The
+ * untyped memory skipped to reach the alignment is not reused.
+ */
+static vaddr_t
+__umem_bump_alloc_super(struct cos_compinfo *__ci, size_t sz)
+{
+	struct cos_compinfo *ci = __compinfo_metacap(__ci);
+	vaddr_t              ret, i;
+
+	assert(sz % SUPER_PAGE_SIZE == 0);
+
+	ps_lock_take(&ci->mem_lock);
+
+	if (!__mempool_untyped_take(ci, sz, SUPER_PAGE_SIZE, cos_numa_node_curr(ci), &ret)) goto error;
+
+	for (i = ret; i < ret + sz; i += RETYPE_MEM_SIZE) {
+		if (call_cap_op(ci->mi.pgtbl_cap, CAPTBL_OP_MEM_RETYPE2USER, i, 0, 0, 0)) goto error;
+	}
+
+	ps_lock_release(&ci->mem_lock);
+
+	return ret;
+error:
+	ps_lock_release(&ci->mem_lock);
+
+	return 0;
+}
+
+int
+cos_meminfo_numa_init(struct cos_compinfo *ci, hwcap_t hwc)
+{
+	struct cos_meminfo *mi = &ci->mi;
+	struct cos_mempool  pools[COS_MEMPOOLS_MAX];
+	vaddr_t             addr, end;
+	int                 i, n, npools = 0;
+
+	assert(__compinfo_metacap(ci) == ci);
+
+	n = cos_hw_numa_introspect(hwc, NUMA_GET_NNODES, 0, 0);
+	if (n < 1) return -EINVAL;
+	for (i = 0; i < NUM_CPU; i++) {
+		int node = cos_hw_numa_introspect(hwc, NUMA_GET_CPU_NODE, i, 0);
+
+		mi->cpu_node[i] = (node < 0 || node >= n) ? 0 : node;
+	}
+
+	ps_lock_take(&ci->mem_lock);
+	if (mi->npools != 1) goto err;
+
+	/*
+	 * Only the untyped memory we haven't carved into user or
+	 * kernel memory yet is split.  The untyped memory is mapped
+	 * contiguously, so each node's physical range is a range of
+	 * our addresses.
+	 */
+	addr = mi->pools[0].untyped_ptr;
+	end  = mi->pools[0].untyped_frontier;
+	while (addr < end && npools < COS_MEMPOOLS_MAX) {
+		int node  = cos_hw_numa_introspect(hwc, NUMA_GET_VADDR_NODE, mi->pgtbl_cap, addr);
+		int pages = cos_hw_numa_introspect(hwc, NUMA_GET_VADDR_EXTENT, mi->pgtbl_cap, addr);
+		vaddr_t range_end;
+
+		if (node < 0 || pages <= 0) break;
+		range_end = addr + (vaddr_t)pages * PAGE_SIZE;
+		if (range_end > end || range_end < addr) range_end = end;
+
+		__mempool_init(&pools[npools++], node, addr, range_end);
+		addr = range_end;
+	}
+	if (npools == 0) goto err;
+	/* Anything past what the kernel knows about stays with the last pool, as before */
+	pools[npools - 1].untyped_frontier = end;
+	/* Keep allocating from the user and kernel memory already carved out */
+	pools[0].umem_ptr      = mi->pools[0].umem_ptr;
+	pools[0].umem_frontier = mi->pools[0].umem_frontier;
+	pools[0].kmem_ptr      = mi->pools[0].kmem_ptr;
+	pools[0].kmem_frontier = mi->pools[0].kmem_frontier;
+
+	memcpy(mi->pools, pools, sizeof(struct cos_mempool) * npools);
+	mi->npools = npools;
+	ps_lock_release(&ci->mem_lock);
+
+	return npools;
+err:
+	ps_lock_release(&ci->mem_lock);
+
+	return -EINVAL;
+}
+
+int
+cos_meminfo_partition(struct cos_compinfo *ci)
+{
+	if (__compinfo_metacap(ci) != ci) return -EINVAL;
+	ps_lock_take(&ci->mem_lock);
+	ci->mi.partitioned = 1;
+	ps_lock_release(&ci->mem_lock);
+
+	return 0;
 }
 
 /**************** [Capability Allocation Functions] ****************/
@@ -359,12 +592,87 @@ __capid_captbl_check_expand(struct cos_compinfo *ci)
 	return 0;
 }
 
+/*
+ * Allocate n consecutive captbl capids (captbl_idsize(CAP_CAPTBL)
+ * apart) from whole, fresh cache-lines in ci's capability table.
+ * This never expands ci's captbl: if the lines don't fit in the
+ * current captbl range, return 0, and the caller falls back on
+ * single allocations.
+ */
+static capid_t
+__capid_captbl_bump_alloc_contig(struct cos_compinfo *ci, unsigned long n)
+{
+	unsigned long nlines = round_up_to_pow2(n * captbl_idsize(CAP_CAPTBL), CAPMAX_ENTRY_SZ) / CAPMAX_ENTRY_SZ;
+	capid_t       frontier, ret = 0;
+
+	ps_lock_take(&ci->cap_lock);
+	frontier = ps_load(&ci->caprange_frontier);
+	/* don't consume the cache-line reserved for the next captbl node */
+	if (__compinfo_metacap(ci) == ci) frontier -= CAPMAX_ENTRY_SZ;
+	if (ci->cap_frontier + nlines * CAPMAX_ENTRY_SZ <= frontier) {
+		ret = ps_faa(&ci->cap_frontier, nlines * CAPMAX_ENTRY_SZ);
+	}
+	ps_lock_release(&ci->cap_lock);
+
+	return ret;
+}
+
+/*
+ * Expand ci's captbl by npages second-level pages with a single
+ * CAPTBL_OP_CONS.  Only possible when a separate meta provides the
+ * resources: a self-managed captbl must place each node's capability
+ * in the previous node, thus can only grow a page at a time.
+ */
+static int
+__capid_captbl_expand_n(struct cos_compinfo *ci, unsigned long npages)
+{
+	struct cos_compinfo *meta = __compinfo_metacap(ci);
+	capid_t              captblcap, captblid_add, frontier, range_frontier;
+	vaddr_t              kmem;
+	unsigned long        i;
+
+	if (meta == ci || npages < 2 || npages > COS_CAPTBL_CONS_MAX) return -1;
+	assert(ci->cap_frontier == ps_load(&ci->caprange_frontier));
+
+	captblcap = __capid_captbl_bump_alloc_contig(meta, npages);
+	if (!captblcap) return -1;
+	for (i = 0; i < npages; i++) {
+		kmem = __kmem_bump_alloc(ci);
+		assert(kmem);
+		if (call_cap_op(meta->captbl_cap, CAPTBL_OP_CAPTBLACTIVATE, captblcap + i * captbl_idsize(CAP_CAPTBL),
+		                meta->mi.pgtbl_cap, kmem, 1)) {
+			assert(0);
+			return -1;
+		}
+	}
+
+	captblid_add = ps_load(&ci->caprange_frontier);
+	assert(captblid_add % CAPTBL_EXPAND_SZ == 0);
+	if (call_cap_op(ci->captbl_cap, CAPTBL_OP_CONS, captblcap, captblid_add, npages, 0)) {
+		assert(0); /* race? */
+		return -1;
+	}
+
+	frontier       = ps_load(&ci->cap_frontier);
+	range_frontier = ps_faa(&ci->caprange_frontier, CAPTBL_EXPAND_SZ * 2 * npages);
+	ps_cas(&ci->cap_frontier, frontier, range_frontier);
+
+	return 0;
+}
+
 static capid_t
 __capid_bump_alloc_generic(struct cos_compinfo *ci, capid_t *capsz_frontier, cap_sz_t sz)
 {
 	printd("__capid_bump_alloc_generic\n");
 	capid_t ret;
 
+	/*
+	 * The frontier is the core's, so within its current cache-line
+	 * only the core's threads race on it, without the lock.
+	 */
+	ret = ps_load(capsz_frontier);
+	if (ret % CAPMAX_ENTRY_SZ != 0 && ps_cas(capsz_frontier, ret, ret + sz)) return ret;
+
 	ps_lock_take(&ci->cap_lock);
 	/*
 	 * Do we need a new cache-line in the capability table for
@@ -566,6 +874,7 @@ __cos_meminfo_populate(struct cos_compinfo *ci, vaddr_t untyped_ptr, unsigned lo
 	vaddr_t		addr, start_addr, retaddr;
 	size_t		pgtbl_lvl;
 	struct cos_compinfo *meta = __compinfo_metacap(ci);
+	struct cos_mempool  *p;
 
 	assert(untyped_ptr == round_up_to_pgd_page(untyped_ptr));
 
@@ -583,8 +892,10 @@ __cos_meminfo_populate(struct cos_compinfo *ci, vaddr_t untyped_ptr, unsigned lo
 
 	ps_lock_take(&ci->mem_lock);
 	/* untyped mem from current bump pointer */
-	start_addr = ps_faa(&(meta->mi.untyped_ptr), untyped_sz);
-	ps_faa(&(meta->mi.untyped_frontier), untyped_sz);
+	p = __mempool_untyped_take(meta, untyped_sz, PAGE_SIZE, cos_numa_node_curr(meta), &start_addr);
+	assert(p);
+	/* the last pool's frontier is nominal (see cos_meminfo_init), so keep its size */
+	if (p == &meta->mi.pools[meta->mi.npools - 1]) ps_faa(&(p->untyped_frontier), untyped_sz);
 	ps_lock_release(&ci->mem_lock);
 
 	for (addr = untyped_ptr; addr < untyped_ptr + untyped_sz; addr += PAGE_SIZE, start_addr += PAGE_SIZE) {
@@ -597,9 +908,8 @@ cos_meminfo_alloc(struct cos_compinfo *ci, vaddr_t untyped_ptr, unsigned long un
 {
 	__cos_meminfo_populate(ci, untyped_ptr, untyped_sz);
 
-	ci->mi.untyped_ptr = ci->mi.umem_ptr = ci->mi.kmem_ptr = ci->mi.umem_frontier = ci->mi.kmem_frontier =
-	  untyped_ptr;
-	ci->mi.untyped_frontier = untyped_ptr + untyped_sz;
+	ci->mi.npools = 1;
+	__mempool_init(&ci->mi.pools[0], 0, untyped_ptr, untyped_ptr + untyped_sz);
 }
 
 /* 
@@ -607,7 +917,7 @@ cos_meminfo_alloc(struct cos_compinfo *ci, vaddr_t untyped_ptr, unsigned long un
  * into pagetbl lvl. However, there should be a new api for creating EPT type pagetbl.
  */
 static vaddr_t
-__page_bump_mem_alloc(struct cos_compinfo *ci, vaddr_t *mem_addr, vaddr_t *mem_frontier, size_t sz)
+__page_bump_mem_alloc(struct cos_compinfo *ci, vaddr_t *mem_addr, vaddr_t *mem_frontier, size_t sz, u32_t nlvls)
 {
 	vaddr_t              heap_vaddr, retaddr;
 	struct cos_compinfo *meta = __compinfo_metacap(ci);
@@ -622,8 +932,12 @@ __page_bump_mem_alloc(struct cos_compinfo *ci, vaddr_t *mem_addr, vaddr_t *mem_f
 
 #if defined(__x86_64__)
 	if (unlikely(ci->comp_type == COMP_TYPE_VM)) pgtbl_flag = PGTBL_LVL_FLAG_VM;
-	/* Just need to map COS_PGTBL_DEPTH - 1 levels page tables, assuming root page table is already there */
-	for (pgtbl_lvl = 0; pgtbl_lvl < COS_PGTBL_DEPTH - 1; pgtbl_lvl++) {
+	/*
+	 * Just need to map nlvls (at most COS_PGTBL_DEPTH - 1) levels page tables,
+	 * assuming root page table is already there
+	 */
+	assert(nlvls <= COS_PGTBL_DEPTH - 1);
+	for (pgtbl_lvl = 0; pgtbl_lvl < nlvls; pgtbl_lvl++) {
 		if (heap_vaddr + sz > ci->vasrange_frontier[pgtbl_lvl]) {
 			retaddr = __bump_mem_expand_range(meta, ci->pgtbl_cap, heap_vaddr, sz, pgtbl_lvl | pgtbl_flag);
 			assert(retaddr);
@@ -674,7 +988,7 @@ __page_bump_valloc(struct cos_compinfo *ci, size_t sz, size_t align)
 	ps_lock_take(&ci->va_lock);
 	rounding = round_up_to_pow2(ci->vas_frontier, align) - ci->vas_frontier;
 	sz += rounding;
-	ret_addr = __page_bump_mem_alloc(ci, &ci->vas_frontier, &ci->vasrange_frontier[0], sz);
+	ret_addr = __page_bump_mem_alloc(ci, &ci->vas_frontier, &ci->vasrange_frontier[0], sz, COS_PGTBL_DEPTH - 1);
 	ret_addr += rounding;
 	ps_lock_release(&ci->va_lock);
 	assert(ret_addr % align == 0);
@@ -682,8 +996,41 @@ __page_bump_valloc(struct cos_compinfo *ci, size_t sz, size_t align)
 	return ret_addr;
 }
 
+#if defined(__x86_64__)
+/*
+ * Allocate a SUPER_PAGE_SIZE aligned virtual range to be mapped
+ * with superpages.  The range must not share a last-level page
+ * table with 4K mappings, so we start past the range covered by
+ * those, and only expand the levels above them.
+ */
+static vaddr_t
+__page_bump_valloc_super(struct cos_compinfo *ci, size_t sz, size_t align)
+{
+	vaddr_t ret_addr, start, end;
+	u32_t   ptelvl = COS_PGTBL_DEPTH - 2;
+
+	assert(sz % SUPER_PAGE_SIZE == 0 && align % SUPER_PAGE_SIZE == 0);
+
+	ps_lock_take(&ci->va_lock);
+	start = ci->vas_frontier;
+	if (ci->vasrange_frontier[ptelvl] > start) start = ci->vasrange_frontier[ptelvl];
+	start = round_up_to_pow2(start, align);
+	sz   += start - ci->vas_frontier;
+
+	ret_addr = __page_bump_mem_alloc(ci, &ci->vas_frontier, &ci->vasrange_frontier[0], sz, ptelvl);
+	end      = ret_addr + sz;
+	ret_addr = start;
+	/* No last-level page tables exist below the end of the superpages */
+	ci->vasrange_frontier[ptelvl] = end;
+	ps_lock_release(&ci->va_lock);
+	assert(ret_addr % SUPER_PAGE_SIZE == 0);
+
+	return ret_addr;
+}
+#endif
+
 static vaddr_t
-__page_bump_alloc(struct cos_compinfo *ci, size_t sz, size_t align)
+__page_bump_alloc(struct cos_compinfo *ci, size_t sz, size_t align, int node)
 {
 	struct cos_compinfo *meta = __compinfo_metacap(ci);
 	vaddr_t              heap_vaddr, heap_cursor, heap_limit;
@@ -708,7 +1055,7 @@ __page_bump_alloc(struct cos_compinfo *ci, size_t sz, size_t align)
 	for (heap_cursor = heap_vaddr; heap_cursor < heap_limit; heap_cursor += PAGE_SIZE) {
 		vaddr_t umem;
 
-		umem = __umem_bump_alloc(ci);
+		umem = __umem_bump_alloc(ci, node);
 		if (!umem) return 0;
 
 		/* Actually map in the memory. */
@@ -812,8 +1159,16 @@ cos_comp_capfrontier_update(struct cos_compinfo *ci, capid_t cap_frontier, int t
 
 	if (try_expand) {
 		while (cap_frontier > ci->caprange_frontier) {
-			ci->cap_frontier = ci->caprange_frontier;	
-			__capid_captbl_check_expand(ci);
+			unsigned long pgsz   = CAPTBL_EXPAND_SZ * 2;
+			unsigned long needed = round_up_to_pow2(cap_frontier - ci->caprange_frontier, pgsz) / pgsz;
+			unsigned long npages = ci->caprange_frontier / pgsz;
+
+			/* Grow geometrically, in as few operations as possible */
+			if (npages < needed) npages = needed;
+			if (npages > COS_CAPTBL_CONS_MAX) npages = COS_CAPTBL_CONS_MAX;
+
+			ci->cap_frontier = ci->caprange_frontier;
+			if (__capid_captbl_expand_n(ci, npages)) __capid_captbl_check_expand(ci);
 		}
 	}
 
@@ -851,18 +1206,46 @@ __alloc_mem_cap(struct cos_compinfo *ci, cap_t ct, vaddr_t *kmem, capid_t *cap)
  * We're doing the thread id allocation here. The kernel initially
  * allocates N threads, one per core, and uses the coreid + 1 as the
  * thread's id. Thus, we want to start our thread ids at NUM_CPU + 2.
+ *
+ * Each core takes ids from __thdid_alloc a batch at a time, a batch
+ * being the ids whose ulk invocation stacks share a page, and hands
+ * them out from its own frontier.  Parallel thread creation thus only
+ * touches the shared counter once per batch, and each ulk page is
+ * only ever populated by a single core.
  */
 unsigned long __thdid_alloc = NUM_CPU + 2;
+static unsigned long __thdid_frontier[NUM_CPU];
+
+static unsigned long
+__thdid_batch_alloc(void)
+{
+	unsigned long base, end;
+
+	do {
+		base = __thdid_alloc;
+		end  = (base / ULK_STACKS_PER_PAGE + 1) * ULK_STACKS_PER_PAGE;
+	} while (!ps_cas(&__thdid_alloc, base, end));
+
+	return base;
+}
 
 thdid_t
 cos_thd_id_alloc(void)
 {
-  unsigned long id = ps_faa(&__thdid_alloc, 1);
-  thdid_t assignment = (thdid_t)id;
+	unsigned long *frontier = &__thdid_frontier[cos_cpuid()];
+	unsigned long  old, id;
+	thdid_t        assignment;
 
-  assert((unsigned long)assignment == id);
+	do {
+		old = id = *frontier;
+		/* Have we used up this core's batch? */
+		if (id % ULK_STACKS_PER_PAGE == 0) id = __thdid_batch_alloc();
+	} while (!ps_cas(frontier, old, id + 1));
 
-  return assignment;
+	assignment = (thdid_t)id;
+	assert((unsigned long)assignment == id && id < MAX_NUM_THREADS);
+
+	return assignment;
 }
 
 /*
@@ -875,15 +1258,14 @@ cos_thd_id_alloc(void)
 struct {
 	pgtblcap_t toplvl;      /* for page allocation */
 	pgtblcap_t secondlvl;   /* for pgtbl mapping */
-	ulkcap_t   curr_pg;     /* current ulk page to alloc stacks in */
-	vaddr_t    pg_frontier; /* vaddr of next page to alloc */
+	ulkcap_t   curr_pg[NUM_CPU];  /* current ulk page to alloc stacks in */
+	vaddr_t    curr_addr[NUM_CPU]; /* and its vaddr */
 } __cos_ulk_info;
 
 void
 cos_ulk_info_init(struct cos_compinfo *ci)
 {
 	__cos_ulk_info.toplvl = cos_ulk_pgtbl_create(ci, &__cos_ulk_info.secondlvl);
-	__cos_ulk_info.pg_frontier = ULK_BASE_ADDR + __thdid_alloc * sizeof(struct ulk_invstk);
 	assert(__cos_ulk_info.toplvl);
 }
 
@@ -947,18 +1329,26 @@ cos_ulk_map_in(pgtblcap_t ptc)
 	return 0;
 }
 
+/*
+ * The ulk stack of thread tid is at ULK_BASE_ADDR + tid * sizeof(struct
+ * ulk_invstk) (see COS_ULINV_GET_INVSTK).  Ids are allocated in
+ * page-sized batches per core, so the page backing them is core-local.
+ */
 static ulkcap_t
 __cos_thd_ulk_page_alloc(struct cos_compinfo *ci, thdid_t tid)
-{	
+{
+	vaddr_t addr = round_to_page(ULK_BASE_ADDR + tid * sizeof(struct ulk_invstk));
+	int     cpu  = cos_cpuid();
+
 	if (!__cos_ulk_info.toplvl) return 0;
 
-	if (!__cos_ulk_info.curr_pg || tid % ULK_STACKS_PER_PAGE == 0) {
-		__cos_ulk_info.curr_pg = cos_ulk_page_alloc(ci, __cos_ulk_info.toplvl, __cos_ulk_info.pg_frontier);
-		assert(__cos_ulk_info.curr_pg);
-		__cos_ulk_info.pg_frontier += PAGE_SIZE;
+	if (!__cos_ulk_info.curr_pg[cpu] || __cos_ulk_info.curr_addr[cpu] != addr) {
+		__cos_ulk_info.curr_pg[cpu] = cos_ulk_page_alloc(ci, __cos_ulk_info.toplvl, addr);
+		assert(__cos_ulk_info.curr_pg[cpu]);
+		__cos_ulk_info.curr_addr[cpu] = addr;
 	}
-	
-	return __cos_ulk_info.curr_pg;
+
+	return __cos_ulk_info.curr_pg[cpu];
 }
 
 static thdcap_t
@@ -1172,6 +1562,21 @@ cos_vm_vmcb_alloc(struct cos_compinfo *ci, vm_vmcscap_t vmcs_cap, vm_msrbitmapca
 
 }
 
+int
+cos_vm_vcpu_notify(vm_vmcb_t vmcb)
+{
+	return call_cap_op(vmcb, CAPTBL_OP_VM_VCPU_NOTIFY, 0, 0, 0, 0);
+}
+
+int
+cos_vm_mem_dirty(struct cos_compinfo *vmci, vaddr_t gpa, unsigned long npages, unsigned long *bitmap)
+{
+	assert(vmci && vmci->comp_type == COMP_TYPE_VM);
+	assert(npages > 0 && npages <= COS_EPT_DIRTY_MAX);
+
+	return call_cap_op(vmci->pgtbl_cap, CAPTBL_OP_EPT_DIRTY, gpa, npages, (word_t)bitmap, 0);
+}
+
 thdcap_t
 cos_initthd_alloc(struct cos_compinfo *ci, compcap_t comp)
 {
@@ -1210,7 +1615,8 @@ cos_pgtbl_alloc(struct cos_compinfo *ci, u8_t type)
 
 	if (__alloc_mem_cap(ci, CAP_PGTBL, &kmem, &cap)) return 0;
 
-	if (unlikely(type)) lvl |= PGTBL_LVL_FLAG_VM;
+	if (unlikely(type == PGTBL_TYPE_EPT)) lvl |= PGTBL_LVL_FLAG_VM;
+	if (unlikely(type == PGTBL_TYPE_IOMMU)) lvl |= PGTBL_LVL_FLAG_IOMMU;
 	if (call_cap_op(ci->captbl_cap, CAPTBL_OP_PGTBLACTIVATE, cap, __compinfo_metacap(ci)->mi.pgtbl_cap, kmem, lvl))
 		BUG();
 
@@ -1344,6 +1750,99 @@ cos_sinv_alloc(struct cos_compinfo *srcci, compcap_t dstcomp, vaddr_t entry, inv
 	return cap;
 }
 
+/*
+ * Activate the sinv at a statically allocated capability id: the
+ * caller makes sure that the captbl's frontier is past it (see
+ * cos_comp_capfrontier_update).
+ */
+sinvcap_t
+cos_sinv_alloc_at(struct cos_compinfo *srcci, capid_t cap, compcap_t dstcomp, vaddr_t entry, invtoken_t token)
+{
+	printd("cos_sinv_alloc_at\n");
+
+	assert(srcci && dstcomp && cap && cap < srcci->cap_frontier);
+	if (call_cap_op(srcci->captbl_cap, CAPTBL_OP_SINVACTIVATE, cap, dstcomp, entry, token)) return 0;
+
+	return cap;
+}
+
+void
+cos_capop_batch_init(struct cos_capop_batch *b)
+{
+	assert(b);
+	assert(round_to_page(b->ops) == round_to_page((char *)&b->ops[COS_CAPOP_BATCH_MAX] - 1));
+
+	b->nops    = 0;
+	b->err_idx = -1;
+}
+
+int
+cos_capop_batch_flush(struct cos_capop_batch *b)
+{
+	int ndone;
+
+	assert(b);
+	if (b->nops == 0) return 0;
+
+	ndone = call_cap_op(BOOT_CAPTBL_SELF_CT, CAPTBL_OP_CAPOP_BATCH, (word_t)b->ops, b->nops, 0, 0);
+	if (ndone < 0) return ndone;
+	assert(ndone <= b->nops);
+
+	b->err_idx = -1;
+	if (ndone < b->nops) b->err_idx = ndone;
+	b->nops    = 0;
+
+	return b->err_idx < 0 ? 0 : (int)b->ops[b->err_idx].ret;
+}
+
+int
+cos_capop_batch_add(struct cos_capop_batch *b, capid_t cap, syscall_op_t op, word_t a1, word_t a2, word_t a3, word_t a4)
+{
+	int ret = 0;
+
+	assert(b);
+	if (b->nops == COS_CAPOP_BATCH_MAX) {
+		ret = cos_capop_batch_flush(b);
+		if (ret) return ret;
+	}
+	b->ops[b->nops] = (struct cos_capop) {
+		.cap  = cap,
+		.op   = op,
+		.args = { a1, a2, a3, a4 },
+		.ret  = 0,
+	};
+	b->nops++;
+
+	return 0;
+}
+
+sinvcap_t
+cos_sinv_alloc_batch(struct cos_compinfo *srcci, struct cos_capop_batch *b, compcap_t dstcomp, vaddr_t entry, invtoken_t token)
+{
+	capid_t cap;
+
+	printd("cos_sinv_alloc_batch\n");
+
+	assert(srcci && b && dstcomp);
+	missing_captbl_node_expand(srcci);
+	cap = __capid_bump_alloc(srcci, CAP_COMP);
+	if (!cap) return 0;
+	if (cos_capop_batch_add(b, srcci->captbl_cap, CAPTBL_OP_SINVACTIVATE, cap, dstcomp, entry, token)) BUG();
+
+	return cap;
+}
+
+sinvcap_t
+cos_sinv_alloc_at_batch(struct cos_compinfo *srcci, struct cos_capop_batch *b, capid_t cap, compcap_t dstcomp, vaddr_t entry, invtoken_t token)
+{
+	printd("cos_sinv_alloc_at_batch\n");
+
+	assert(srcci && b && dstcomp && cap && cap < srcci->cap_frontier);
+	if (cos_capop_batch_add(b, srcci->captbl_cap, CAPTBL_OP_SINVACTIVATE, cap, dstcomp, entry, token)) BUG();
+
+	return cap;
+}
+
 /*
  * Arguments:
  * thdcap:  the thread to activate on snds to the rcv endpoint.
@@ -1370,19 +1869,26 @@ cos_arcv_alloc(struct cos_compinfo *ci, thdcap_t thdcap, tcap_t tcapcap, compcap
 }
 
 asndcap_t
-cos_asnd_alloc(struct cos_compinfo *ci, arcvcap_t arcvcap, captblcap_t ctcap)
+cos_asnd_alloc_ipilimit(struct cos_compinfo *ci, arcvcap_t arcvcap, captblcap_t ctcap, microsec_t ipiwin, u32_t ipimax)
 {
 	capid_t cap;
 
 	assert(ci && arcvcap && ctcap);
+	assert(ipimax <= 0xFFFF && ipiwin <= (~0UL >> 16));
 
 	cap = __capid_bump_alloc(ci, CAP_ASND);
 	if (!cap) return 0;
-	if (call_cap_op(ci->captbl_cap, CAPTBL_OP_ASNDACTIVATE, cap, ctcap, arcvcap, 0)) BUG();
+	if (call_cap_op(ci->captbl_cap, CAPTBL_OP_ASNDACTIVATE, cap, ctcap, arcvcap, ((word_t)ipiwin << 16) | ipimax)) BUG();
 
 	return cap;
 }
 
+asndcap_t
+cos_asnd_alloc(struct cos_compinfo *ci, arcvcap_t arcvcap, captblcap_t ctcap)
+{
+	return cos_asnd_alloc_ipilimit(ci, arcvcap, ctcap, 0, 0);
+}
+
 /*
  * TODO: bitmap must be a subset of existing one.
  *       but there is no such check now, violates access control policy.
@@ -1405,7 +1911,14 @@ void *
 cos_page_bump_allocn(struct cos_compinfo *ci, size_t sz)
 {
 	assert(sz % PAGE_SIZE == 0);
-	return (void *)__page_bump_alloc(ci, sz, PAGE_SIZE);
+	return (void *)__page_bump_alloc(ci, sz, PAGE_SIZE, COS_NUMA_NODE_LOCAL);
+}
+
+void *
+cos_page_bump_allocn_node(struct cos_compinfo *ci, size_t sz, int node)
+{
+	assert(sz % PAGE_SIZE == 0);
+	return (void *)__page_bump_alloc(ci, sz, PAGE_SIZE, node);
 }
 
 void *
@@ -1414,7 +1927,45 @@ cos_page_bump_allocn_aligned(struct cos_compinfo *ci, size_t sz, size_t align)
 	assert(sz % PAGE_SIZE == 0);
 	assert(align % PAGE_SIZE == 0);
 
-	return (void *)__page_bump_alloc(ci, sz, align);
+	return (void *)__page_bump_alloc(ci, sz, align, COS_NUMA_NODE_LOCAL);
+}
+
+vaddr_t
+cos_page_bump_valloc(struct cos_compinfo *ci, size_t sz, size_t align)
+{
+	assert(sz % PAGE_SIZE == 0);
+	assert(align % PAGE_SIZE == 0);
+
+	return __page_bump_valloc(ci, sz, align);
+}
+
+void *
+cos_superpage_bump_allocn(struct cos_compinfo *ci, size_t sz)
+{
+#if defined(__x86_64__)
+	struct cos_compinfo *meta = __compinfo_metacap(ci);
+	vaddr_t              heap_vaddr, umem, off;
+
+	assert(sz && sz % SUPER_PAGE_SIZE == 0);
+
+	heap_vaddr = __page_bump_valloc_super(ci, sz, SUPER_PAGE_SIZE);
+	if (unlikely(!heap_vaddr)) return NULL;
+	umem = __umem_bump_alloc_super(ci, sz);
+	if (unlikely(!umem)) return NULL;
+
+	for (off = 0; off < sz; off += SUPER_PAGE_SIZE) {
+		if (call_cap_op(meta->mi.pgtbl_cap, CAPTBL_OP_MEMACTIVATE, umem + off, ci->pgtbl_cap, heap_vaddr + off,
+		                SUPER_PAGE_ORDER)) {
+			assert(0);
+			return NULL;
+		}
+	}
+
+	return (void *)heap_vaddr;
+#else
+	/* No superpage mappings for user memory here; just provide the alignment */
+	return cos_page_bump_allocn_aligned(ci, sz, SUPER_PAGE_SIZE);
+#endif
 }
 
 void *
@@ -1496,6 +2047,14 @@ cos_asnd(asndcap_t snd, int yield)
 	return call_cap_op(snd, 0, 0, 0, 0, yield);
 }
 
+int
+cos_asnd_bulk(struct cos_asnd_batch *b, int n, tcap_time_t timeout)
+{
+	assert(b && n > 0 && n <= COS_ASND_BULK_MAX);
+
+	return call_cap_op(BOOT_CAPTBL_SELF_CT, CAPTBL_OP_ASND_BULK, (word_t)b->ss, n, timeout, 0);
+}
+
 int
 cos_sched_rcv(arcvcap_t rcv, rcv_flags_t flags, tcap_time_t timeout,
 	      int *rcvd, thdid_t *thdid, int *blocked, cycles_t *cycles, tcap_time_t *thd_timeout)
@@ -1518,6 +2077,27 @@ cos_sched_rcv(arcvcap_t rcv, rcv_flags_t flags, tcap_time_t timeout,
 	return ret;
 }
 
+int
+cos_sched_rcv_batch(arcvcap_t rcv, rcv_flags_t flags, tcap_time_t timeout, int *rcvd, struct cos_sched_evt_batch *b)
+{
+	unsigned long nevts = 0, cyc = 0;
+	tcap_time_t   thd_timeout;
+	int           ret;
+
+	assert(b);
+	ret = call_cap_retvals_asm(rcv, 0, flags | RCV_EVT_BATCH, timeout, (word_t)b->evts, COS_SCHED_EVT_BATCH_MAX,
+	                           &nevts, &cyc, &thd_timeout);
+	b->nevts = ret < 0 ? 0 : (int)nevts;
+	assert(b->nevts <= COS_SCHED_EVT_BATCH_MAX);
+
+	if (ret >= 0 && flags & RCV_ALL_PENDING) {
+		*rcvd = (ret >> 1);
+		ret &= 1;
+	}
+
+	return ret;
+}
+
 int
 cos_rcv(arcvcap_t rcv, rcv_flags_t flags, int *rcvd)
 {
@@ -1533,11 +2113,30 @@ cos_rcv(arcvcap_t rcv, rcv_flags_t flags, int *rcvd)
 	return ret;
 }
 
+/*
+ * Alias the sz bytes of pages at src in srcci to dst in dstci, whose
+ * page-table must cover them, with up to COS_PGTBL_CPY_N_MAX pages
+ * per system call.
+ */
+static int
+__mem_alias_range(struct cos_compinfo *dstci, vaddr_t dst, struct cos_compinfo *srcci, vaddr_t src, size_t sz, unsigned long perm_flags)
+{
+	unsigned long npages = sz / PAGE_SIZE, n;
+	int ret;
+
+	for (; npages > 0; npages -= n, src += n * PAGE_SIZE, dst += n * PAGE_SIZE) {
+		n   = npages > COS_PGTBL_CPY_N_MAX ? COS_PGTBL_CPY_N_MAX : npages;
+		ret = call_cap_op(srcci->pgtbl_cap, CAPTBL_OP_CPY_N, src, (n << 16) | dstci->pgtbl_cap, dst, perm_flags);
+		if (ret) return ret;
+	}
+
+	return 0;
+}
+
 vaddr_t
 cos_mem_aliasn_aligned(struct cos_compinfo *dstci, struct cos_compinfo *srcci, vaddr_t src, size_t sz, size_t align, unsigned long perm_flags)
 {
-	size_t i;
-	vaddr_t dst, first_dst;
+	vaddr_t dst;
 
 	assert(srcci && dstci);
 	assert(sz && (sz % PAGE_SIZE == 0));
@@ -1545,13 +2144,86 @@ cos_mem_aliasn_aligned(struct cos_compinfo *dstci, struct cos_compinfo *srcci, v
 
 	dst = __page_bump_valloc(dstci, sz, align);
 	if (unlikely(!dst)) return 0;
-	first_dst = dst;
 
-	for (i = 0; i < sz; i += PAGE_SIZE, src += PAGE_SIZE, dst += PAGE_SIZE) {
-		if (call_cap_op(srcci->pgtbl_cap, CAPTBL_OP_CPY, src, dstci->pgtbl_cap, dst, perm_flags)) return 0;
+	if (__mem_alias_range(dstci, dst, srcci, src, sz, perm_flags)) return 0;
+
+	return dst;
+}
+
+vaddr_t
+cos_mem_alias_superpagen(struct cos_compinfo *dstci, struct cos_compinfo *srcci, vaddr_t src, size_t sz, unsigned long perm_flags)
+{
+	return cos_mem_alias_superpagen_aligned(dstci, srcci, src, sz, SUPER_PAGE_SIZE, perm_flags);
+}
+
+vaddr_t
+cos_mem_alias_superpagen_aligned(struct cos_compinfo *dstci, struct cos_compinfo *srcci, vaddr_t src, size_t sz, size_t align, unsigned long perm_flags)
+{
+#if defined(__x86_64__)
+	size_t  i;
+	vaddr_t dst;
+
+	if (align < SUPER_PAGE_SIZE) align = SUPER_PAGE_SIZE;
+	assert(srcci && dstci);
+	assert(sz && sz % SUPER_PAGE_SIZE == 0 && src % SUPER_PAGE_SIZE == 0);
+
+	dst = __page_bump_valloc_super(dstci, sz, align);
+	if (unlikely(!dst)) return 0;
+
+	for (i = 0; i < sz; i += SUPER_PAGE_SIZE) {
+		if (call_cap_op(srcci->pgtbl_cap, CAPTBL_OP_CPY, src + i, dstci->pgtbl_cap, dst + i, perm_flags | COS_PAGE_SUPER)) return 0;
 	}
 
-	return first_dst;
+	return dst;
+#else
+	if (align < SUPER_PAGE_SIZE) align = SUPER_PAGE_SIZE;
+
+	return cos_mem_aliasn_aligned(dstci, srcci, src, sz, align, perm_flags);
+#endif
+}
+
+/*
+ * Alias `sz` bytes at `src` to `dst` in `dstci`, with a superpage
+ * mapping for each SUPER_PAGE_SIZE aligned chunk that is a superpage
+ * in `srcci`, and isn't already covered by a last-level page table in
+ * `dstci`.  The rest is aliased a page at a time, expanding the
+ * last-level page tables only where they are needed.
+ */
+int
+cos_mem_alias_superpagen_at(struct cos_compinfo *dstci, vaddr_t dst, struct cos_compinfo *srcci, vaddr_t src, size_t sz, unsigned long perm_flags)
+{
+	size_t i = 0;
+
+	assert(srcci && dstci);
+	assert(sz % PAGE_SIZE == 0);
+
+#if defined(__x86_64__)
+	word_t pgtbl_lvl, pgtbl_flag = 0;
+
+	if (unlikely(dstci->comp_type == COMP_TYPE_VM)) pgtbl_flag = PGTBL_LVL_FLAG_VM;
+	for (pgtbl_lvl = 0; pgtbl_lvl < COS_PGTBL_DEPTH - 2; pgtbl_lvl++) {
+		if (!__bump_mem_expand_range(__compinfo_metacap(dstci), dstci->pgtbl_cap, dst, sz, pgtbl_lvl | pgtbl_flag)) return -ENOMEM;
+	}
+	while (i < sz) {
+		if ((dst - src) % SUPER_PAGE_SIZE == 0 && (dst + i) % SUPER_PAGE_SIZE == 0 && i + SUPER_PAGE_SIZE <= sz
+		    && !call_cap_op(srcci->pgtbl_cap, CAPTBL_OP_CPY, src + i, dstci->pgtbl_cap, dst + i, perm_flags | COS_PAGE_SUPER)) {
+			i += SUPER_PAGE_SIZE;
+			continue;
+		}
+		if (call_cap_op(srcci->pgtbl_cap, CAPTBL_OP_CPY, src + i, dstci->pgtbl_cap, dst + i, perm_flags)) {
+			/* No last-level page table covers the page yet */
+			if (!__bump_mem_expand_intern(__compinfo_metacap(dstci), dstci->pgtbl_cap, dst + i, 0, (COS_PGTBL_DEPTH - 2) | pgtbl_flag)) return -ENOMEM;
+			if (call_cap_op(srcci->pgtbl_cap, CAPTBL_OP_CPY, src + i, dstci->pgtbl_cap, dst + i, perm_flags)) return -EINVAL;
+		}
+		i += PAGE_SIZE;
+	}
+#else
+	for (; i < sz; i += PAGE_SIZE) {
+		if (call_cap_op(srcci->pgtbl_cap, CAPTBL_OP_CPY, src + i, dstci->pgtbl_cap, dst + i, perm_flags)) return -EINVAL;
+	}
+#endif
+
+	return 0;
 }
 
 vaddr_t
@@ -1579,16 +2251,10 @@ cos_mem_alias_at(struct cos_compinfo *dstci, vaddr_t dst, struct cos_compinfo *s
 int
 cos_mem_alias_atn(struct cos_compinfo *dstci, vaddr_t dst, struct cos_compinfo *srcci, vaddr_t src, size_t sz, unsigned long perm_flags)
 {
-	size_t i;
-	size_t npages;
-
 	assert(srcci && dstci);
 	assert(sz % PAGE_SIZE == 0);
 
-	npages = sz / PAGE_SIZE;
-	for (i=0; i < npages; i++) {
-		if (call_cap_op(srcci->pgtbl_cap, CAPTBL_OP_CPY, src + i * PAGE_SIZE, dstci->pgtbl_cap, dst + i * PAGE_SIZE, perm_flags)) BUG();
-	}
+	if (sz && __mem_alias_range(dstci, dst, srcci, src, sz, perm_flags)) BUG();
 
 	return 0;
 }
@@ -1596,8 +2262,14 @@ cos_mem_alias_atn(struct cos_compinfo *dstci, vaddr_t dst, struct cos_compinfo *
 int
 cos_mem_remove(pgtblcap_t pt, vaddr_t addr)
 {
-	assert(0);
-	return 0;
+	/* The TLBs are flushed lazily; the address can be reused after quiescence */
+	return call_cap_op(pt, CAPTBL_OP_MEMDEACTIVATE, addr, livenessid_bump_alloc(), 0, 0);
+}
+
+int
+cos_mem_grant(pgtblcap_t pt, vaddr_t src, vaddr_t dst, size_t sz, cos_grant_flags_t flags)
+{
+	return call_cap_op(pt, CAPTBL_OP_MEMGRANT, src, dst, round_up_to_page(sz) / PAGE_SIZE, flags);
 }
 
 vaddr_t
@@ -1633,6 +2305,31 @@ cos_thd_mod(struct cos_compinfo *ci, thdcap_t tc, void *tlsaddr)
 	return call_cap_op(ci->captbl_cap, CAPTBL_OP_THDTLSSET, tc, (word_t)tlsaddr, 0, 0);
 }
 
+int
+cos_thd_migrate(struct cos_compinfo *ci, thdcap_t tc, cpuid_t core)
+{
+	return call_cap_op(ci->captbl_cap, CAPTBL_OP_THDMIGRATE, tc, core, 0, 0);
+}
+
+int
+cos_arcv_migrate(struct cos_compinfo *ci, arcvcap_t rcv, thdcap_t thd, tcap_t tc, arcvcap_t sched, cpuid_t core)
+{
+	return call_cap_op(ci->captbl_cap, CAPTBL_OP_ARCVMIGRATE, rcv, thd | (tc << 16), sched, core);
+}
+
+int
+cos_thd_invstk_extend(struct cos_compinfo *ci, thdcap_t tc)
+{
+	struct cos_compinfo *ci_resources = __compinfo_metacap(ci);
+	vaddr_t              kmem;
+
+	assert(ci_resources && tc);
+	kmem = __kmem_bump_alloc(ci_resources);
+	if (!kmem) return -ENOMEM;
+
+	return call_cap_op(ci->captbl_cap, CAPTBL_OP_THD_INVSTK_ACTIVATE, tc, ci_resources->mi.pgtbl_cap, kmem, 0);
+}
+
 /* FIXME: problems when we got to 64 bit systems with the return value */
 int
 cos_introspect(struct cos_compinfo *ci, capid_t cap, unsigned long op)
@@ -1680,6 +2377,14 @@ cos_tcap_delegate(asndcap_t dst, tcap_t src, tcap_res_t res, tcap_prio_t prio, t
 	return call_cap_op(src, CAPTBL_OP_TCAP_DELEGATE, dst, res, prio_higher, prio_lower);
 }
 
+int
+cos_tcap_delegate_bulk(tcap_t src, struct cos_tcap_deleg_batch *b, int n)
+{
+	assert(b && n > 0 && n <= COS_TCAP_DELEG_BULK_MAX);
+
+	return call_cap_op(src, CAPTBL_OP_TCAP_DELEGATE_BULK, (word_t)b->ds, n, 0, 0);
+}
+
 int
 cos_tcap_merge(tcap_t dst, tcap_t rm)
 {
@@ -1692,12 +2397,230 @@ cos_hw_attach(hwcap_t hwc, hwid_t hwid, arcvcap_t arcv)
 	return call_cap_op(hwc, CAPTBL_OP_HW_ATTACH, hwid, arcv, 0, 0);
 }
 
+int
+cos_hw_msi_bind(hwcap_t hwc, hwid_t hwid, arcvcap_t arcv)
+{
+	return call_cap_op(hwc, CAPTBL_OP_HW_MSI_BIND, hwid, arcv, 0, 0);
+}
+
+pgtblcap_t
+cos_iommu_pgtbl_alloc(struct cos_compinfo *ci)
+{
+	return cos_pgtbl_alloc(__compinfo_metacap(ci), PGTBL_TYPE_IOMMU);
+}
+
+int
+cos_iommu_map(struct cos_compinfo *ci, pgtblcap_t iopt, vaddr_t addr, size_t sz)
+{
+	unsigned long npages = sz / PAGE_SIZE, n;
+	word_t        lvl;
+	int           ret;
+
+	assert(ci && iopt);
+	assert(addr % PAGE_SIZE == 0 && sz % PAGE_SIZE == 0);
+
+	for (lvl = 0; lvl < COS_PGTBL_DEPTH - 1; lvl++) {
+		if (!__bump_mem_expand_range(__compinfo_metacap(ci), iopt, addr, sz, lvl | PGTBL_LVL_FLAG_IOMMU)) return -ENOMEM;
+	}
+	for (; npages > 0; npages -= n, addr += n * PAGE_SIZE) {
+		n   = npages > COS_PGTBL_CPY_N_MAX ? COS_PGTBL_CPY_N_MAX : npages;
+		ret = call_cap_op(ci->pgtbl_cap, CAPTBL_OP_CPY_N, addr, (n << 16) | iopt, addr, COS_PAGE_READABLE | COS_PAGE_WRITABLE);
+		if (ret) return ret;
+	}
+
+	return 0;
+}
+
+int
+cos_iommu_bind(hwcap_t hwc, u16_t bdf, pgtblcap_t iopt)
+{
+	return call_cap_op(hwc, CAPTBL_OP_HW_IOMMU_BIND, bdf, iopt, 0, 0);
+}
+
+int
+cos_iommu_unbind(hwcap_t hwc, u16_t bdf)
+{
+	return call_cap_op(hwc, CAPTBL_OP_HW_IOMMU_UNBIND, bdf, 0, 0, 0);
+}
+
 int
 cos_hw_detach(hwcap_t hwc, hwid_t hwid)
 {
 	return call_cap_op(hwc, CAPTBL_OP_HW_DETACH, hwid, 0, 0, 0);
 }
 
+int
+cos_hw_irq_coalesce(hwcap_t hwc, hwid_t hwid, u32_t count_thresh, u32_t usec_thresh)
+{
+	return call_cap_op(hwc, CAPTBL_OP_HW_IRQ_COALESCE, hwid, count_thresh, usec_thresh, 0);
+}
+
+int
+cos_hw_irq_poll(hwcap_t hwc, hwid_t hwid, int polling)
+{
+	return call_cap_op(hwc, CAPTBL_OP_HW_IRQ_POLL, hwid, polling, 0, 0);
+}
+
+int
+cos_hw_irq_rearm(hwcap_t hwc, hwid_t hwid)
+{
+	return call_cap_op(hwc, CAPTBL_OP_HW_IRQ_REARM, hwid, 0, 0, 0);
+}
+
+int
+cos_hw_irq_stats(hwcap_t hwc, hwid_t hwid, unsigned long *delivered, unsigned long *suppressed)
+{
+	int d, s;
+
+	d = call_cap_op(hwc, CAPTBL_OP_HW_IRQ_STATS, hwid, HW_IRQ_GET_DELIVERED, 0, 0);
+	if (d < 0) return d;
+	s = call_cap_op(hwc, CAPTBL_OP_HW_IRQ_STATS, hwid, HW_IRQ_GET_SUPPRESSED, 0, 0);
+	if (s < 0) return s;
+	*delivered  = d;
+	*suppressed = s;
+
+	return 0;
+}
+
+struct cos_trace_ring *
+cos_hw_trace_ring_map(struct cos_compinfo *ci, hwcap_t hwc, cpuid_t cpu)
+{
+	struct cos_compinfo *meta = __compinfo_metacap(ci);
+	vaddr_t              ring, kmem;
+	int                  i;
+
+	ring = __page_bump_valloc(ci, COS_TRACE_RING_PAGES * PAGE_SIZE, PAGE_SIZE);
+	if (!ring) return NULL;
+
+	for (i = 0; i < COS_TRACE_RING_PAGES; i++) {
+		kmem = __kmem_bump_alloc(meta);
+		if (!kmem) return NULL;
+		if (call_cap_op(hwc, CAPTBL_OP_HW_TRACE_MAP, cpu << 16 | i, meta->mi.pgtbl_cap << 16 | ci->pgtbl_cap,
+		                kmem, ring + i * PAGE_SIZE)) {
+			return NULL;
+		}
+	}
+
+	return (struct cos_trace_ring *)ring;
+}
+
+u32_t
+cos_hw_trace_mask(hwcap_t hwc, u32_t mask)
+{
+	return (u32_t)call_cap_op(hwc, CAPTBL_OP_HW_TRACE_MASK, mask, 0, 0, 0);
+}
+
+int
+cos_hw_syscall_stats(hwcap_t hwc, struct cos_syscall_stats *stats, size_t sz)
+{
+	return call_cap_op(hwc, CAPTBL_OP_HW_SYSCALL_STATS, (word_t)stats, sz, 0, 0);
+}
+
+int
+cos_hw_topology(hwcap_t hwc, struct cos_topology *topo, size_t sz)
+{
+	return call_cap_op(hwc, CAPTBL_OP_HW_TOPOLOGY, (word_t)topo, sz, 0, 0);
+}
+
+struct cos_thd_acct *
+cos_hw_thd_acct_map(struct cos_compinfo *ci, hwcap_t hwc)
+{
+	struct cos_compinfo *meta = __compinfo_metacap(ci);
+	vaddr_t              tbl, kmem;
+	int                  i;
+
+	tbl = __page_bump_valloc(ci, COS_THD_ACCT_PAGES * PAGE_SIZE, PAGE_SIZE);
+	if (!tbl) return NULL;
+
+	for (i = 0; i < (int)COS_THD_ACCT_PAGES; i++) {
+		kmem = __kmem_bump_alloc(meta);
+		if (!kmem) return NULL;
+		if (call_cap_op(hwc, CAPTBL_OP_HW_ACCT_MAP, i, meta->mi.pgtbl_cap << 16 | ci->pgtbl_cap, kmem,
+		                tbl + i * PAGE_SIZE)) {
+			return NULL;
+		}
+	}
+
+	return (struct cos_thd_acct *)tbl;
+}
+
+struct cos_time_page *
+cos_hw_time_map(struct cos_compinfo *ci, hwcap_t hwc)
+{
+	struct cos_compinfo *meta = __compinfo_metacap(ci);
+	vaddr_t              page, kmem;
+
+	page = __page_bump_valloc(ci, PAGE_SIZE, PAGE_SIZE);
+	if (!page) return NULL;
+	kmem = __kmem_bump_alloc(meta);
+	if (!kmem) return NULL;
+	if (call_cap_op(hwc, CAPTBL_OP_HW_TIME_MAP, meta->mi.pgtbl_cap << 16 | ci->pgtbl_cap, kmem, page, 0)) {
+		return NULL;
+	}
+
+	return (struct cos_time_page *)page;
+}
+
+int
+cos_hw_numa_introspect(hwcap_t hwc, unsigned long op, unsigned long arg1, unsigned long arg2)
+{
+	return call_cap_op(hwc, CAPTBL_OP_HW_NUMA, op, arg1, arg2, 0);
+}
+
+int
+cos_hw_pgflt_attach(hwcap_t hwc, thdcap_t handler)
+{
+	return call_cap_op(hwc, CAPTBL_OP_HW_PGFLT, HW_PGFLT_ATTACH, handler, 0, 0);
+}
+
+int
+cos_hw_pgflt_info(hwcap_t hwc, struct cos_pgflt *f)
+{
+	return call_cap_op(hwc, CAPTBL_OP_HW_PGFLT, HW_PGFLT_INFO, (word_t)f, 0, 0);
+}
+
+int
+cos_hw_pgflt_resume(hwcap_t hwc)
+{
+	return call_cap_op(hwc, CAPTBL_OP_HW_PGFLT, HW_PGFLT_RESUME, 0, 0, 0);
+}
+
+int
+cos_hw_pgflt_abort(hwcap_t hwc, word_t retval)
+{
+	return call_cap_op(hwc, CAPTBL_OP_HW_PGFLT, HW_PGFLT_ABORT, retval, 0, 0);
+}
+
+unsigned long
+cos_hw_pgflt_pgtbl_id(hwcap_t hwc, pgtblcap_t pt)
+{
+	return (unsigned int)call_cap_op(hwc, CAPTBL_OP_HW_PGFLT, HW_PGFLT_PGTBL_ID, pt, 0, 0);
+}
+
+int
+cos_hw_pmu_ncounters(hwcap_t hwc)
+{
+	return call_cap_op(hwc, CAPTBL_OP_HW_PMU, HW_PMU_NCOUNTERS, 0, 0, 0);
+}
+
+int
+cos_hw_pmu_program(hwcap_t hwc, unsigned long ctr, unsigned long evt)
+{
+	return call_cap_op(hwc, CAPTBL_OP_HW_PMU, HW_PMU_PROGRAM, ctr, evt, 0);
+}
+
+int
+cos_hw_pmu_disable(hwcap_t hwc)
+{
+	return call_cap_op(hwc, CAPTBL_OP_HW_PMU, HW_PMU_DISABLE, 0, 0, 0);
+}
+
+int
+cos_hw_pmu_sample(hwcap_t hwc, unsigned long period)
+{
+	return call_cap_op(hwc, CAPTBL_OP_HW_PMU, HW_PMU_SAMPLE, period, 0, 0);
+}
+
 int
 cos_hw_cycles_per_usec(hwcap_t hwc)
 {
@@ -1720,12 +2643,24 @@ cos_hw_l1flush(hwcap_t hwc)
 	return call_cap_op(hwc, CAPTBL_OP_HW_L1FLUSH, 0, 0, 0, 0);
 }
 
+int
+cos_hw_l1flush_range(hwcap_t hwc, vaddr_t addr, unsigned long sz)
+{
+	return call_cap_op(hwc, CAPTBL_OP_HW_L1FLUSH, addr, sz, 0, 0);
+}
+
 int
 cos_hw_tlbflush(hwcap_t hwc)
 {
 	return call_cap_op(hwc, CAPTBL_OP_HW_TLBFLUSH, 0, 0, 0, 0);
 }
 
+int
+cos_hw_tlbflush_range(hwcap_t hwc, vaddr_t addr, unsigned long sz)
+{
+	return call_cap_op(hwc, CAPTBL_OP_HW_TLBFLUSH, addr, sz, 0, 0);
+}
+
 int
 cos_hw_tlbstall(hwcap_t hwc)
 {
@@ -62,10 +62,38 @@ typedef capid_t vm_lapiccap_t;
 typedef capid_t vm_shared_mem_t;
 typedef capid_t vm_vmcb_t;
 
-/* Memory source information */
-struct cos_meminfo {
+/*
+ * A contiguous range of untyped memory in a single NUMA node, and the
+ * user/kernel memory bump-allocated out of it.
+ */
+struct cos_mempool {
+	int        node;
 	vaddr_t    untyped_ptr, umem_ptr, kmem_ptr;
 	vaddr_t    untyped_frontier, umem_frontier, kmem_frontier;
+};
+
+#define COS_MEMPOOLS_MAX (NUMA_NODES_MAX * 2)
+
+/*
+ * The untyped memory a core took from the pools to allocate its pages
+ * from without the mem_lock, COS_MEMPART_SZ at a time (see
+ * cos_meminfo_partition). The pages are [frontier - COS_MEMPART_SZ,
+ * frontier), up to ptr.
+ */
+struct cos_mempart {
+	vaddr_t ptr, frontier;
+} CACHE_ALIGNED;
+
+#define COS_MEMPART_SZ (64 * PAGE_SIZE)
+
+/* Memory source information */
+struct cos_meminfo {
+	/* One pool until cos_meminfo_numa_init splits the untyped memory between the nodes */
+	int                npools;
+	struct cos_mempool pools[COS_MEMPOOLS_MAX];
+	int                partitioned;
+	struct cos_mempart parts[NUM_CPU];
+	u8_t               cpu_node[NUM_CPU];
 	pgtblcap_t pgtbl_cap;
 
 	capid_t	   second_lvl_pgtbl_cap;
@@ -101,7 +129,9 @@ struct cos_compinfo {
 
 #define PGTBL_TYPE_DEF (0)
 #define PGTBL_TYPE_EPT (1)
+#define PGTBL_TYPE_IOMMU (2)
 #define PGTBL_LVL_FLAG_VM (1UL << 31)
+#define PGTBL_LVL_FLAG_IOMMU (1UL << 30)
 
 void cos_compinfo_init(struct cos_compinfo *ci, pgtblcap_t pgtbl_cap, captblcap_t captbl_cap, compcap_t comp_cap,
                        vaddr_t heap_ptr, capid_t cap_frontier, struct cos_compinfo *ci_resources);/*
@@ -111,6 +141,26 @@ void cos_compinfo_init(struct cos_compinfo *ci, pgtblcap_t pgtbl_cap, captblcap_
  */
 void cos_meminfo_init(struct cos_meminfo *mi, vaddr_t untyped_ptr, unsigned long untyped_sz, pgtblcap_t pgtbl_cap);
 void cos_meminfo_alloc(struct cos_compinfo *ci, vaddr_t untyped_ptr, unsigned long untyped_sz);
+/*
+ * Split the (not yet allocated) untyped memory of ci into per-NUMA-node
+ * pools, using the topology the kernel reports through hwc.  After
+ * this, allocations are served from the node of the allocating core
+ * (falling back on the other nodes), or from the node passed to the
+ * *_node allocation functions.  Returns the number of pools, or a
+ * negative error with the memory left unsplit.
+ */
+int  cos_meminfo_numa_init(struct cos_compinfo *ci, hwcap_t hwc);
+/*
+ * Partition the memory of ci (a component with real memory) between
+ * the cores: each core then allocates the kernel and user memory of
+ * its local node from its own part of the untyped memory, and only
+ * takes the mem_lock to take a new part from the pools. Once the
+ * pools are exhausted, the cores take the pages left in the others'
+ * parts.
+ */
+int  cos_meminfo_partition(struct cos_compinfo *ci);
+/* The NUMA node of the current core, as seen by ci's memory allocator */
+int  cos_numa_node_curr(struct cos_compinfo *ci);
 /* expand *only* the pgtbl-internal nodes */
 vaddr_t cos_pgtbl_intern_alloc(struct cos_compinfo *ci, pgtblcap_t cipgtbl, vaddr_t mem_ptr, unsigned long mem_sz);
 /*
@@ -155,8 +205,18 @@ vaddr_t cos_vm_kernel_page_create(struct cos_compinfo *ci);
 thdcap_t  cos_initthd_alloc(struct cos_compinfo *ci, compcap_t comp);
 
 sinvcap_t cos_sinv_alloc(struct cos_compinfo *srcci, compcap_t dstcomp, vaddr_t entry, invtoken_t token);
+sinvcap_t cos_sinv_alloc_at(struct cos_compinfo *srcci, capid_t cap, compcap_t dstcomp, vaddr_t entry, invtoken_t token);
 arcvcap_t cos_arcv_alloc(struct cos_compinfo *ci, thdcap_t thdcap, tcap_t tcapcap, compcap_t compcap, arcvcap_t enotif);
 asndcap_t cos_asnd_alloc(struct cos_compinfo *ci, arcvcap_t arcvcap, captblcap_t ctcap);
+/*
+ * An asnd that sends at most ipimax IPIs (to a rcv on another core)
+ * per window of ipiwin microseconds. The notifications beyond those
+ * are enqueued for the rcv's core without interrupting it, and are
+ * processed with its next IPI or timer interrupt. ipimax is 16 bits,
+ * and so is ipiwin on 32-bit systems; ipimax = 0 means no limit.
+ */
+asndcap_t cos_asnd_alloc_ipilimit(struct cos_compinfo *ci, arcvcap_t arcvcap, captblcap_t ctcap, microsec_t ipiwin,
+                                  u32_t ipimax);
 
 capid_t cos_vm_vmcs_alloc(struct cos_compinfo *ci, vaddr_t kmem);
 capid_t cos_vm_msr_bitmap_alloc(struct cos_compinfo *ci, vaddr_t kmem);
@@ -164,10 +224,27 @@ capid_t cos_vm_lapic_alloc(struct cos_compinfo *ci, vaddr_t kmem);
 capid_t cos_vm_shared_region_alloc(struct cos_compinfo *ci, vaddr_t kmem);
 capid_t cos_vm_lapic_access_alloc(struct cos_compinfo *ci, vaddr_t kmem);
 capid_t cos_vm_vmcb_alloc(struct cos_compinfo *ci, vm_vmcscap_t vmcs_cap, vm_msrbitmapcap_t msr_bitmap_cap, vm_lapicaccesscap_t lapic_access_cap, vm_lapiccap_t lapic_cap, vm_shared_mem_t shared_mem_cap, thdcap_t handler_cap, word_t vpid);
+/* Send the posted-interrupt notification to the core of the vmcb's vcpu */
+int cos_vm_vcpu_notify(vm_vmcb_t vmcb);
+/*
+ * Dirty-page tracking of a VM: set a bit in bitmap (in a single page,
+ * COS_EPT_DIRTY_WORDS(npages) words) for each of the npages
+ * guest-physical pages at gpa written since the last call, and clear
+ * their dirty bits.  A page mapped with a 2MB EPT entry is reported
+ * with the 511 others.  The writes of the running vcpus after the call
+ * are in the next one.  Returns the number of dirty pages, or < 0.
+ */
+int cos_vm_mem_dirty(struct cos_compinfo *vmci, vaddr_t gpa, unsigned long npages, unsigned long *bitmap);
 
 void *cos_page_bump_alloc(struct cos_compinfo *ci);
 void *cos_page_bump_allocn(struct cos_compinfo *ci, size_t sz);
 void *cos_page_bump_allocn_aligned(struct cos_compinfo *ci, size_t sz, size_t align);
+/* As above, but preferring memory of the NUMA node (or COS_NUMA_NODE_LOCAL) */
+void *cos_page_bump_allocn_node(struct cos_compinfo *ci, size_t sz, int node);
+/* sz bytes of physically contiguous memory, mapped with SUPER_PAGE_SIZE pages where supported */
+void *cos_superpage_bump_allocn(struct cos_compinfo *ci, size_t sz);
+/* Reserve sz bytes of addresses in ci (and their page-tables), nothing mapped */
+vaddr_t cos_page_bump_valloc(struct cos_compinfo *ci, size_t sz, size_t align);
 
 capid_t cos_cap_cpy(struct cos_compinfo *dstci, struct cos_compinfo *srcci, cap_t srcctype, capid_t srccap);
 int     cos_cap_cpy_at(struct cos_compinfo *dstci, capid_t dstcap, struct cos_compinfo *srcci, capid_t srccap);
@@ -185,6 +262,31 @@ sched_tok_t cos_sched_sync(void);
  */
 int cos_switch(thdcap_t c, tcap_t t, tcap_prio_t p, tcap_time_t r, arcvcap_t rcv, sched_tok_t stok);
 int cos_thd_mod(struct cos_compinfo *ci, thdcap_t c, void *tls_addr); /* set tls addr of thd in captbl */
+/*
+ * Move a thread that isn't running, and isn't bound to a rcv end-point,
+ * from the calling core to core; only core can dispatch it afterwards.
+ * -EBUSY: the thread is bound to, or is notified by, a rcv end-point.
+ * -EAGAIN: a scheduler event for the thread is yet to be received.
+ * -EINVAL: any other error
+ */
+int cos_thd_migrate(struct cos_compinfo *ci, thdcap_t c, cpuid_t core);
+/*
+ * Move the rcv end-point rcv, with its thread thd and tcap tc, from the
+ * calling core to core, where the end-point sched becomes its
+ * scheduler. tc loses its budget, to be delegated by the scheduler on
+ * core, and the asnds to rcv keep working.
+ * -EBUSY: thd is running, schedules other end-points, or tc is shared.
+ * -EAGAIN: a scheduler event for thd is yet to be received.
+ * -EINVAL: any other error
+ */
+int cos_arcv_migrate(struct cos_compinfo *ci, arcvcap_t rcv, thdcap_t thd, tcap_t tc, arcvcap_t sched, cpuid_t core);
+/*
+ * Give the thread a page of kernel memory for its invocation stack
+ * past the few entries kept in the thread, for deep chains of
+ * invocations.  Only the thread's core can extend it.
+ * -EEXIST: the thread already has its extension.
+ */
+int cos_thd_invstk_extend(struct cos_compinfo *ci, thdcap_t c);
 
 /*
  * returns 0 on success and errno on failure (the rcv thread will not be sent a notification):
@@ -196,21 +298,81 @@ int cos_thd_mod(struct cos_compinfo *ci, thdcap_t c, void *tls_addr); /* set tls
 int cos_sched_asnd(asndcap_t snd, tcap_time_t timeout, arcvcap_t srcv, sched_tok_t stok);
 /* returns 0 on success and -EINVAL on failure */
 int cos_asnd(asndcap_t snd, int yield);
+/*
+ * Send on each of the n asnd end-points in b->ss in a single system
+ * call: each remote core is sent a single IPI for all of its sends,
+ * and we switch (at most once) to the highest priority local receiver
+ * if it is higher than ours.  Returns 0 or a negative errno for the
+ * whole batch; the error of each send is in its ret field.
+ */
+struct cos_asnd_batch {
+	struct cos_asnd_snd ss[COS_ASND_BULK_MAX];
+} __attribute__((aligned(PAGE_SIZE / 4)));
+int cos_asnd_bulk(struct cos_asnd_batch *b, int n, tcap_time_t timeout);
 /* returns non-zero if there are still pending events (i.e. there have been pending snds) */
 int cos_rcv(arcvcap_t rcv, rcv_flags_t flags, int *rcvd);
 /* returns the same value as cos_rcv, but also information about scheduling events */
 int cos_sched_rcv(arcvcap_t rcv, rcv_flags_t flags, tcap_time_t timeout, int *rcvd, thdid_t *thdid, int *blocked, cycles_t *cycles, tcap_time_t *thd_timeout);
+/*
+ * Scheduling events delivered as a batch (RCV_EVT_BATCH): the kernel
+ * writes up to COS_SCHED_EVT_BATCH_MAX events into evts, so the
+ * alignment keeps the array within a single page.
+ */
+struct cos_sched_evt_batch {
+	struct cos_sched_evt evts[COS_SCHED_EVT_BATCH_MAX];
+	int                  nevts;
+} __attribute__((aligned(PAGE_SIZE / 2)));
+/* as cos_sched_rcv, but all of the scheduling events available are returned in b */
+int cos_sched_rcv_batch(arcvcap_t rcv, rcv_flags_t flags, tcap_time_t timeout, int *rcvd, struct cos_sched_evt_batch *b);
 
 int cos_introspect(struct cos_compinfo *ci, capid_t cap, unsigned long op);
 
+/*
+ * Batched capability operations: queue resource-table operations
+ * (captbl and pgtbl operations, e.g. sinv, thread, and component
+ * activations) and issue them to the kernel in a single system call.
+ * The batch must not straddle a page boundary, so allocate it page
+ * aligned (e.g. COS_CAPOP_BATCH_DECLARE or cos_page_bump_alloc).
+ * Operations execute in order, and execution stops at the first
+ * failure. cos_capop_batch_flush returns 0 on success, or the error
+ * of the failing operation, whose index is then in err_idx (-1 if no
+ * operation failed).
+ */
+struct cos_capop_batch {
+	struct cos_capop ops[COS_CAPOP_BATCH_MAX];
+	int              nops;
+	int              err_idx;
+};
+#define COS_CAPOP_BATCH_DECLARE(name) struct cos_capop_batch name __attribute__((aligned(PAGE_SIZE)))
+
+void cos_capop_batch_init(struct cos_capop_batch *b);
+/* Queue an operation, flushing the batch first if it is full. */
+int  cos_capop_batch_add(struct cos_capop_batch *b, capid_t cap, syscall_op_t op, word_t a1, word_t a2, word_t a3, word_t a4);
+int  cos_capop_batch_flush(struct cos_capop_batch *b);
+/* As cos_sinv_alloc, but the activation is only performed when b is flushed. */
+sinvcap_t cos_sinv_alloc_batch(struct cos_compinfo *srcci, struct cos_capop_batch *b, compcap_t dstcomp, vaddr_t entry, invtoken_t token);
+sinvcap_t cos_sinv_alloc_at_batch(struct cos_compinfo *srcci, struct cos_capop_batch *b, capid_t cap, compcap_t dstcomp, vaddr_t entry, invtoken_t token);
+
 vaddr_t cos_mem_alias(struct cos_compinfo *dstci, struct cos_compinfo *srcci, vaddr_t src, unsigned long perm_flags);
 vaddr_t cos_mem_aliasn(struct cos_compinfo *dstci, struct cos_compinfo *srcci, vaddr_t src, size_t sz, unsigned long perm_flags);
 vaddr_t cos_mem_aliasn_aligned(struct cos_compinfo *dstci, struct cos_compinfo *srcci, vaddr_t src, size_t sz, size_t align, unsigned long perm_flags);
+/* Alias the superpages at src (from cos_superpage_bump_allocn) as superpages in dstci */
+vaddr_t cos_mem_alias_superpagen(struct cos_compinfo *dstci, struct cos_compinfo *srcci, vaddr_t src, size_t sz, unsigned long perm_flags);
+/* The same, at an address aligned on `align` (a multiple of SUPER_PAGE_SIZE) */
+vaddr_t cos_mem_alias_superpagen_aligned(struct cos_compinfo *dstci, struct cos_compinfo *srcci, vaddr_t src, size_t sz, size_t align, unsigned long perm_flags);
 int     cos_mem_alias_at(struct cos_compinfo *dstci, vaddr_t dst, struct cos_compinfo *srcci, vaddr_t src, unsigned long perm_flags);
 int     cos_mem_alias_atn(struct cos_compinfo *dstci, vaddr_t dst, struct cos_compinfo *srcci, vaddr_t src, size_t sz, unsigned long perm_flags);
+int     cos_mem_alias_superpagen_at(struct cos_compinfo *dstci, vaddr_t dst, struct cos_compinfo *srcci, vaddr_t src, size_t sz, unsigned long perm_flags);
 vaddr_t cos_mem_move(struct cos_compinfo *dstci, struct cos_compinfo *srcci, vaddr_t src);
 int     cos_mem_move_at(struct cos_compinfo *dstci, vaddr_t dst, struct cos_compinfo *srcci, vaddr_t src);
 int     cos_mem_remove(pgtblcap_t pt, vaddr_t addr);
+/*
+ * Grant the sz bytes at page-aligned src in pt to the server of this
+ * thread's next synchronous invocation, mapped at dst in its page-table
+ * (which must have the page-table pages for it) until it returns.  A
+ * zero sz cancels a grant that hasn't been used yet.
+ */
+int     cos_mem_grant(pgtblcap_t pt, vaddr_t src, vaddr_t dst, size_t sz, cos_grant_flags_t flags);
 
 /* Tcap operations */
 tcap_t cos_tcap_alloc(struct cos_compinfo *ci);
@@ -226,20 +388,120 @@ int cos_tcap_transfer(tcap_t src, arcvcap_t dst, tcap_res_t res, tcap_prio_t pri
  * -EINVAL: any other error
  */
 int cos_tcap_delegate(asndcap_t dst, tcap_t src, tcap_res_t res, tcap_prio_t prio, tcap_deleg_flags_t flags);
+/*
+ * Delegate from src to each of the n rcv end-points in b->ds (as with
+ * cos_tcap_transfer) in a single system call.  Returns the number of
+ * delegations made or a negative errno; the error of the delegation
+ * that stopped the batch is in its ret field.
+ */
+struct cos_tcap_deleg_batch {
+	struct cos_tcap_deleg ds[COS_TCAP_DELEG_BULK_MAX];
+} __attribute__((aligned(PAGE_SIZE / 2)));
+int cos_tcap_delegate_bulk(tcap_t src, struct cos_tcap_deleg_batch *b, int n);
 int cos_tcap_merge(tcap_t dst, tcap_t rm);
 
 /* Hardware (interrupts) operations */
 hwcap_t cos_hw_alloc(struct cos_compinfo *ci, u32_t bitmap);
 int     cos_hw_attach(hwcap_t hwc, hwid_t hwid, arcvcap_t rcvcap);
 int     cos_hw_detach(hwcap_t hwc, hwid_t hwid);
+/*
+ * Attach an MSI vector (HW_ID17-HW_ID31) to rcvcap, delivered on the
+ * receiver's core.  Returns the destination to program in the
+ * device's MSI(-X) message for that core (see pci_msix_vec_set), or
+ * < 0 on error.  Detach with cos_hw_detach.
+ */
+int     cos_hw_msi_bind(hwcap_t hwc, hwid_t hwid, arcvcap_t rcvcap);
+/*
+ * DMA remapping: a device bound to an IOMMU page-table can only
+ * access the memory mapped in it.  cos_iommu_map aliases sz bytes of
+ * ci's memory at addr to the same addresses in iopt, so the driver
+ * programs its own virtual addresses in the device.  Unmap with
+ * cos_mem_remove on iopt.  bdf is the PCI bus << 8 | dev << 3 | func.
+ */
+pgtblcap_t cos_iommu_pgtbl_alloc(struct cos_compinfo *ci);
+int        cos_iommu_map(struct cos_compinfo *ci, pgtblcap_t iopt, vaddr_t addr, size_t sz);
+int        cos_iommu_bind(hwcap_t hwc, u16_t bdf, pgtblcap_t iopt);
+int        cos_iommu_unbind(hwcap_t hwc, u16_t bdf);
+/*
+ * Interrupt moderation on an attached line: deliver every
+ * count_thresh-th interrupt, or the first after usec_thresh since the
+ * last delivery (0 or 1 for both: deliver all).  In polling mode, the
+ * line stays masked after each delivery until the handler has drained
+ * the device and calls cos_hw_irq_rearm.
+ */
+int     cos_hw_irq_coalesce(hwcap_t hwc, hwid_t hwid, u32_t count_thresh, u32_t usec_thresh);
+int     cos_hw_irq_poll(hwcap_t hwc, hwid_t hwid, int polling);
+int     cos_hw_irq_rearm(hwcap_t hwc, hwid_t hwid);
+int     cos_hw_irq_stats(hwcap_t hwc, hwid_t hwid, unsigned long *delivered, unsigned long *suppressed);
+/*
+ * Map cpu's kernel event trace ring read-only into ci (backed by
+ * ci's kernel memory), and set the mask of traced event types (see
+ * COS_TRACE_MASK), which returns the previous one.
+ */
+struct cos_trace_ring *cos_hw_trace_ring_map(struct cos_compinfo *ci, hwcap_t hwc, cpuid_t cpu);
+u32_t                  cos_hw_trace_mask(hwcap_t hwc, u32_t mask);
+/*
+ * Map the kernel's thread execution accounting table read-only into
+ * ci (backed by ci's kernel memory); it is indexed by thread id.
+ */
+struct cos_thd_acct *cos_hw_thd_acct_map(struct cos_compinfo *ci, hwcap_t hwc);
+/*
+ * Map the kernel's clock page (struct cos_time_page) read-only into
+ * ci (backed by ci's kernel memory); it is mapped only once, and
+ * aliased into other components.
+ */
+struct cos_time_page *cos_hw_time_map(struct cos_compinfo *ci, hwcap_t hwc);
+/*
+ * Copy the system call statistics of all cores into stats (sz bytes,
+ * space for NUM_CPU entries).  Returns NUM_CPU, or -ENOENT if the
+ * kernel isn't built with COS_SYSCALL_STATS.
+ */
+int cos_hw_syscall_stats(hwcap_t hwc, struct cos_syscall_stats *stats, size_t sz);
+/*
+ * Copy the processor topology (struct cos_topology) into topo (sz
+ * bytes).  Returns 0, or -EINVAL if sz is too small.
+ */
+int cos_hw_topology(hwcap_t hwc, struct cos_topology *topo, size_t sz);
 void   *cos_hw_map(struct cos_compinfo *ci, hwcap_t hwc, paddr_t pa, unsigned int len);
 int     cos_hw_cycles_per_usec(hwcap_t hwc);
 int     cos_hw_cycles_thresh(hwcap_t hwc);
 int     cos_hw_tlb_lockdown(hwcap_t hwc, unsigned long entryid, unsigned long vaddr, unsigned long paddr);
 int     cos_hw_l1flush(hwcap_t hwc);
 int     cos_hw_tlbflush(hwcap_t hwc);
+/*
+ * Flush only the cache lines (to memory, through the L2 on ARM) or the
+ * TLB entries of [addr, addr + sz) in the current page-table.
+ */
+int     cos_hw_l1flush_range(hwcap_t hwc, vaddr_t addr, unsigned long sz);
+int     cos_hw_tlbflush_range(hwcap_t hwc, vaddr_t addr, unsigned long sz);
 int     cos_hw_tlbstall(hwcap_t hwc);
 int     cos_hw_tlbstall_recount(hwcap_t hwc);
+/* NUMA_GET_* queries, see cos_types.h */
+int     cos_hw_numa_introspect(hwcap_t hwc, unsigned long op, unsigned long arg1, unsigned long arg2);
+/*
+ * Resolve the page faults of user-level on this core with the handler
+ * thread, which is switched to on a fault, reads it with
+ * cos_hw_pgflt_info, and switches back to the faulting thread with
+ * cos_hw_pgflt_resume, or returns it to the component that invoked
+ * the faulting one with cos_hw_pgflt_abort, with retval as the
+ * invocation's return value (-ENOENT if it faulted in its own
+ * component). A fault's pgtbl is that of cos_hw_pgflt_pgtbl_id.
+ */
+int     cos_hw_pgflt_attach(hwcap_t hwc, thdcap_t handler);
+int     cos_hw_pgflt_info(hwcap_t hwc, struct cos_pgflt *f);
+int     cos_hw_pgflt_resume(hwcap_t hwc);
+int     cos_hw_pgflt_abort(hwcap_t hwc, word_t retval);
+unsigned long cos_hw_pgflt_pgtbl_id(hwcap_t hwc, pgtblcap_t pt);
+/*
+ * Program the performance counters of the invoking thread, which it
+ * then reads with rdpmc (see kernel/include/pmu.h). cos_hw_pmu_sample
+ * records samples of this core's execution, every period cycles, in
+ * its trace ring (see COS_TRACE_SAMPLE), and stops with a period of 0.
+ */
+int     cos_hw_pmu_ncounters(hwcap_t hwc);
+int     cos_hw_pmu_program(hwcap_t hwc, unsigned long ctr, unsigned long evt);
+int     cos_hw_pmu_disable(hwcap_t hwc);
+int     cos_hw_pmu_sample(hwcap_t hwc, unsigned long period);
 void    cos_hw_shutdown(hwcap_t hwc);
 
 
@@ -0,0 +1,142 @@
+#include <ktrace.h>
+#include <llprint.h>
+#include <ps_plat.h>
+
+int
+ktrace_init(struct ktrace *t, struct cos_compinfo *ci, hwcap_t hwc, cpuid_t cpu)
+{
+	*t = (struct ktrace) { .ring = cos_hw_trace_ring_map(ci, hwc, cpu) };
+	if (!t->ring) return -ENOMEM;
+
+	return 0;
+}
+
+int
+ktrace_drain(struct ktrace *t, struct cos_trace_evt *evts, int max)
+{
+	struct cos_trace_ring *r = t->ring;
+	u64_t                  head, bad;
+	int                    n, i;
+
+	head = ps_load(&r->hdr.head);
+	/* events already overwritten */
+	if (head - t->tail > COS_TRACE_RING_NEVTS) {
+		t->lost += head - COS_TRACE_RING_NEVTS - t->tail;
+		t->tail  = head - COS_TRACE_RING_NEVTS;
+	}
+	n = (head - t->tail < (u64_t)max) ? (int)(head - t->tail) : max;
+	for (i = 0; i < n; i++) evts[i] = r->evts[(t->tail + i) % COS_TRACE_RING_NEVTS];
+
+	/*
+	 * Event k's slot is rewritten while head == k + NEVTS, so the
+	 * copies of the events below head - NEVTS + 1 can be torn.
+	 */
+	ps_mem_fence();
+	head = ps_load(&r->hdr.head);
+	bad  = 0;
+	if (head >= t->tail + COS_TRACE_RING_NEVTS) bad = head - COS_TRACE_RING_NEVTS - t->tail + 1;
+	if (bad > (u64_t)n) bad = n;
+	if (bad) {
+		for (i = 0; i < n - (int)bad; i++) evts[i] = evts[i + bad];
+	}
+	t->lost += bad;
+	t->tail += n;
+
+	return n - (int)bad;
+}
+
+static const char *ktrace_names[COS_TRACE_NTYPES] = {
+	[COS_TRACE_THD_SWITCH]    = "switch",
+	[COS_TRACE_SINV]          = "sinv",
+	[COS_TRACE_SRET]          = "sret",
+	[COS_TRACE_ASND]          = "asnd",
+	[COS_TRACE_ARCV]          = "arcv",
+	[COS_TRACE_TIMER]         = "timer",
+	[COS_TRACE_IPI]           = "ipi",
+	[COS_TRACE_SAMPLE]        = "sample",
+	[COS_TRACE_SAMPLE_CALLER] = "caller",
+};
+
+void
+ktrace_print(struct ktrace *t)
+{
+	struct cos_trace_evt evts[32];
+	int                  n, i;
+
+	while ((n = ktrace_drain(t, evts, 32)) > 0) {
+		for (i = 0; i < n; i++) {
+			struct cos_trace_evt *e = &evts[i];
+
+			printc("ktrace %u %llu %s %u %u\n", t->ring->hdr.cpu, e->tsc,
+			       e->type < COS_TRACE_NTYPES ? ktrace_names[e->type] : "?", e->thd, e->arg);
+		}
+	}
+	if (t->lost) printc("ktrace %u lost %lu\n", t->ring->hdr.cpu, t->lost);
+}
+
+static const char *ktrace_cap_names[COS_SYSCALL_STATS_NTYPES] = {
+	[CAP_SINV]   = "sinv",
+	[CAP_SRET]   = "sret",
+	[CAP_ASND]   = "asnd",
+	[CAP_ARCV]   = "arcv",
+	[CAP_THD]    = "thd",
+	[CAP_COMP]   = "comp",
+	[CAP_CAPTBL] = "captbl",
+	[CAP_PGTBL]  = "pgtbl",
+	[CAP_TCAP]   = "tcap",
+	[CAP_HW]     = "hw",
+	[CAP_ULK]    = "ulk",
+};
+
+static struct cos_syscall_stats ktrace_stats[NUM_CPU], ktrace_stats_prev;
+
+/* the statistics are all counters, so treat them as an array of them */
+#define KTRACE_STATS_NCNTS (sizeof(struct cos_syscall_stats) / sizeof(u64_t))
+
+int
+ktrace_syscall_stats_print(hwcap_t hwc)
+{
+	struct cos_syscall_stats tot = { 0 };
+	u64_t                   *t = (u64_t *)&tot, *p = (u64_t *)&ktrace_stats_prev;
+	u64_t                    ncalls = 0;
+	int                      ret, c, i;
+
+	ret = cos_hw_syscall_stats(hwc, ktrace_stats, sizeof(ktrace_stats));
+	if (ret < 0) return ret;
+
+	for (c = 0; c < NUM_CPU; c++) {
+		u64_t *s = (u64_t *)&ktrace_stats[c];
+
+		for (i = 0; i < (int)KTRACE_STATS_NCNTS; i++) t[i] += s[i];
+	}
+	/* report the calls since the last sample */
+	for (i = 0; i < (int)KTRACE_STATS_NCNTS; i++) {
+		u64_t n = t[i];
+
+		t[i] -= p[i];
+		p[i]  = n;
+	}
+	for (i = 0; i < COS_SYSCALL_STATS_NBUCKETS; i++) ncalls += tot.hist[i];
+	if (!ncalls) return 0;
+
+	/* invocation returns don't look up a capability */
+	tot.types[CAP_SRET] += tot.misc[COS_SYSCALL_STAT_SRET];
+	printc("syscalls %llu:", ncalls);
+	for (i = 0; i < COS_SYSCALL_STATS_NTYPES; i++) {
+		if (!tot.types[i]) continue;
+		printc(" %llu%% %s,", (tot.types[i] * 100) / ncalls, ktrace_cap_names[i] ? ktrace_cap_names[i] : "?");
+	}
+	printc(" %llu%% slowpath, %llu not found\n", (tot.misc[COS_SYSCALL_STAT_SLOWPATH] * 100) / ncalls,
+	       tot.misc[COS_SYSCALL_STAT_NOCAP]);
+	printc("syscall slowpath ops:");
+	for (i = 0; i < COS_SYSCALL_STATS_NOPS; i++) {
+		if (tot.ops[i]) printc(" %d:%llu", i, tot.ops[i]);
+	}
+	printc("\nsyscall cycles (log2):");
+	for (i = 0; i < COS_SYSCALL_STATS_NBUCKETS; i++) {
+		if (tot.hist[i]) printc(" %d:%llu", i, tot.hist[i]);
+	}
+	printc("\n");
+
+	return 0;
+}
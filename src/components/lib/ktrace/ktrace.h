@@ -0,0 +1,35 @@
+#ifndef KTRACE_H
+#define KTRACE_H
+
+#include <cos_types.h>
+#include <cos_kernel_api.h>
+
+/*
+ * Reader for a core's kernel event trace ring.  The kernel overwrites
+ * the oldest events, so a reader that falls behind loses events; they
+ * are counted in lost.
+ */
+struct ktrace {
+	struct cos_trace_ring *ring;
+	u64_t                  tail; /* the next event to read */
+	unsigned long          lost;
+};
+
+int  ktrace_init(struct ktrace *t, struct cos_compinfo *ci, hwcap_t hwc, cpuid_t cpu);
+/*
+ * Copy up to max of the new events, oldest first, into evts (e.g. in
+ * memory shared with the consumer), in the kernel's binary format.
+ * Returns the number of events copied.
+ */
+int  ktrace_drain(struct ktrace *t, struct cos_trace_evt *evts, int max);
+/* Drain all new events to the serial console, one compact line each */
+void ktrace_print(struct ktrace *t);
+/*
+ * Print the system calls (over all cores) since the previous call, as
+ * the share of each capability type and of the resource-table
+ * operations, and the histogram of their durations.  Returns -ENOENT
+ * if the kernel doesn't keep the statistics.
+ */
+int  ktrace_syscall_stats_print(hwcap_t hwc);
+
+#endif /* KTRACE_H */
@@ -0,0 +1,83 @@
+/*
+ * Redistribution of this file is permitted under the BSD two clause license.
+ *
+ * Copyright 2020, The George Washington University
+ */
+
+#include <bits/c++config.h>
+#include <cstdlib>
+#include <new>
+
+/***
+ * `operator new` and `operator delete` for the C++ components, on the
+ * per-thread spans of the `arena` allocator (a dependency of `libcxx`),
+ * rather than on musl's malloc, whose large allocations would be
+ * `mmap`ed, and never `munmap`ed. These replace the weak definitions
+ * of `libsupc++`, so the allocations don't loop through the (unused)
+ * `new_handler`.
+ *
+ * The components are compiled without exceptions, so an allocation
+ * that fails can't throw `std::bad_alloc`: it aborts, as would
+ * `libsupc++`'s, but for the `nothrow` versions, that return `NULL`.
+ */
+
+static inline void *
+cxx_alloc(std::size_t sz)
+{
+	void *p;
+
+	/* malloc (0) might return NULL, that new mustn't */
+	p = malloc(sz ? sz : 1);
+	if (__builtin_expect(!p, 0)) std::abort();
+
+	return p;
+}
+
+void *
+operator new(std::size_t sz) _GLIBCXX_THROW(std::bad_alloc)
+{
+	return cxx_alloc(sz);
+}
+
+void *
+operator new[](std::size_t sz) _GLIBCXX_THROW(std::bad_alloc)
+{
+	return cxx_alloc(sz);
+}
+
+void *
+operator new(std::size_t sz, const std::nothrow_t &) _GLIBCXX_USE_NOEXCEPT
+{
+	return malloc(sz ? sz : 1);
+}
+
+void *
+operator new[](std::size_t sz, const std::nothrow_t &) _GLIBCXX_USE_NOEXCEPT
+{
+	return malloc(sz ? sz : 1);
+}
+
+/* free (NULL) is a no-op */
+void
+operator delete(void *p) _GLIBCXX_USE_NOEXCEPT
+{
+	free(p);
+}
+
+void
+operator delete[](void *p) _GLIBCXX_USE_NOEXCEPT
+{
+	free(p);
+}
+
+void
+operator delete(void *p, const std::nothrow_t &) _GLIBCXX_USE_NOEXCEPT
+{
+	free(p);
+}
+
+void
+operator delete[](void *p, const std::nothrow_t &) _GLIBCXX_USE_NOEXCEPT
+{
+	free(p);
+}
@@ -22,6 +22,8 @@
 #define MEMP_NUM_TCP_PCB_LISTEN 128
 #define IP_REASSEMBLY 0
 #define IP_FRAG 0
+/* The netmgr inputs packets in pbufs that reference its shmem objects */
+#define LWIP_SUPPORT_CUSTOM_PBUF 1
 
 #define SYS_LIGHTWEIGHT_PROT           0
 //#define LWIP_WND_SCALE                  1
@@ -34,6 +36,10 @@
    order. Define to 0 if your device is low on memory. */
 #define TCP_QUEUE_OOSEQ         1
 
+/* Full Ethernet frames, and enough send buffer for a 64KB multi-buffer write */
+#define TCP_MSS                 1460
+#define TCP_SND_BUF             (44 * TCP_MSS)
+
 /* TCP sender buffer space (pbufs). This must be at least = 2 *
    TCP_SND_BUF/TCP_MSS for things to work. */
 #define TCP_SND_QUEUELEN       4096 //(64 * TCP_SND_BUF/TCP_MSS)
@@ -0,0 +1,225 @@
+#include <string.h>
+#include <errno.h>
+#include <cos_component.h>
+#include <ps.h>
+#include "cos_memcached.h"
+#include "cos_memcached_exp.h"
+
+/***
+ * CLOCK eviction, as a second-chance FIFO per core. The items stored
+ * by the requests processed on a core are appended to that core's
+ * ring, and the core's evicting thread (cos_mc_clock_evict) is the
+ * only one to take them off its head: an item referenced since it was
+ * appended is given a second chance at the tail, others are unlinked.
+ *
+ * The reference "bits" are bytes, indexed by the hash of the keys, so
+ * a GET only stores to one of them, without a lock or a lookup of the
+ * item; the collisions only give the items more chances. The rings
+ * hold the items' pointers, which can be stale by the time the hand
+ * gets to them (the item replaced or deleted since), thus are
+ * checked under the item's lock before it's unlinked. The slab pages
+ * are never reassigned (`no_slab_reassign`), so the pointers always
+ * point to item memory.
+ */
+
+struct cos_mc_clock_slot {
+	item  *it;
+	u32_t  hv;
+	u32_t  sz;
+};
+
+struct cos_mc_clock {
+	unsigned long            tail;
+	unsigned long            bytes;
+	unsigned long            hand;
+	int                      evicting;
+	struct cos_mc_clock_slot slots[COS_MC_CLOCK_SZ];
+} CACHE_ALIGNED;
+
+static struct cos_mc_clock clocks[NUM_CPU];
+static u8_t                clock_refs[COS_MC_CLOCK_REFS];
+static unsigned long       clock_high, clock_low;
+static int                 clock_on;
+
+/*
+ * Evict the items of each core once the bytes of those stored on it
+ * exceed high percent of its share of the memory limit, down to low
+ * percent. The shares are of the items' own sizes, so the percentages
+ * have to leave room for the rounding of the slab classes.
+ */
+void
+cos_mc_clock_init(int high, int low)
+{
+	clock_high = settings.maxbytes / NUM_CPU / 100 * high;
+	clock_low  = settings.maxbytes / NUM_CPU / 100 * low;
+	clock_on   = 1;
+}
+
+static int
+clock_push(struct cos_mc_clock *c, item *it, u32_t hv, u32_t sz)
+{
+	struct cos_mc_clock_slot *s;
+	unsigned long             t;
+
+	do {
+		t = ps_load(&c->tail);
+		if (t - ps_load(&c->hand) >= COS_MC_CLOCK_SZ) return -ENOSPC;
+	} while (!ps_cas(&c->tail, t, t + 1));
+
+	s     = &c->slots[t & (COS_MC_CLOCK_SZ - 1)];
+	s->hv = hv;
+	s->sz = sz;
+	__atomic_store_n(&s->it, it, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+static void
+clock_insert(const char *key, size_t nkey)
+{
+	item *it;
+	u32_t hv, sz = 0;
+
+	hv = hash(key, nkey);
+	item_lock(hv);
+	it = assoc_find(key, nkey, hv);
+	if (it) sz = ITEM_ntotal(it);
+	item_unlock(hv);
+	/* Untracked items are left to memcached's own eviction */
+	if (!it || clock_push(&clocks[cos_coreid()], it, hv, sz)) return;
+
+	ps_faa(&clocks[cos_coreid()].bytes, sz);
+}
+
+static inline void
+clock_ref(const char *key, size_t nkey)
+{
+	u8_t *ref = &clock_refs[hash(key, nkey) & (COS_MC_CLOCK_REFS - 1)];
+
+	/* Don't dirty the cache-line if it's already set */
+	if (!*ref) *ref = 1;
+}
+
+/* The next token of the line [*p, eol), or NULL; *p moves past it */
+static const char *
+clock_token(const char **p, const char *eol, size_t *len)
+{
+	const char *t = *p;
+
+	while (t < eol && *t == ' ') t++;
+	*p = t;
+	while (*p < eol && **p != ' ' && **p != '\r') (*p)++;
+	*len = *p - t;
+
+	return *len ? t : NULL;
+}
+
+static int
+clock_is_storage(const char *cmd, size_t n)
+{
+	return (n == 3 && (!memcmp(cmd, "set", 3) || !memcmp(cmd, "add", 3) || !memcmp(cmd, "cas", 3)))
+	       || (n == 6 && !memcmp(cmd, "append", 6))
+	       || (n == 7 && (!memcmp(cmd, "replace", 7) || !memcmp(cmd, "prepend", 7)));
+}
+
+/*
+ * Reference the keys of the GETs of the text commands in r, and track
+ * the items of their storage commands, once processed. The binary
+ * protocol isn't scanned.
+ */
+void
+cos_mc_clock_scan(const char *r, size_t len)
+{
+	const char   *end = r + len, *eol, *p, *cmd, *key, *tok = NULL;
+	size_t        ncmd, nkey, ntok;
+	unsigned long nbytes;
+	int           i;
+
+	if (!clock_on) return;
+
+	while (r < end && (eol = memchr(r, '\n', end - r))) {
+		p   = r;
+		r   = eol + 1;
+		cmd = clock_token(&p, eol, &ncmd);
+		if (!cmd) continue;
+
+		if ((ncmd == 3 && !memcmp(cmd, "get", 3)) || (ncmd == 4 && !memcmp(cmd, "gets", 4))) {
+			while ((key = clock_token(&p, eol, &nkey))) clock_ref(key, nkey);
+			continue;
+		}
+		if (!clock_is_storage(cmd, ncmd)) continue;
+
+		/* <key> <flags> <exptime> <bytes>, then the data block */
+		key = clock_token(&p, eol, &nkey);
+		for (i = 0; i < 3; i++) tok = clock_token(&p, eol, &ntok);
+		if (!key || !tok) return;
+		for (nbytes = 0; ntok > 0 && *tok >= '0' && *tok <= '9'; tok++, ntok--) {
+			nbytes = nbytes * 10 + (*tok - '0');
+		}
+		if (nbytes + 2 > (unsigned long)(end - r)) return;
+		r += nbytes + 2;
+
+		if (nkey <= KEY_MAX_LENGTH) clock_insert(key, nkey);
+	}
+}
+
+/* Unlink it if it's still the linked item of its key */
+static int
+clock_unlink(item *it, u32_t hv)
+{
+	int ret = 0;
+
+	item_lock(hv);
+	if ((it->it_flags & ITEM_LINKED) && it->nkey <= KEY_MAX_LENGTH && hash(ITEM_key(it), it->nkey) == hv
+	    && assoc_find(ITEM_key(it), it->nkey, hv) == it) {
+		do_item_unlink(it, hv);
+		ret = 1;
+	}
+	item_unlock(hv);
+
+	return ret;
+}
+
+/*
+ * Move the hand of core's ring over at most COS_MC_CLOCK_BATCH items,
+ * if the core is over its share. Only the core's evicting thread
+ * calls this. Returns the number of items evicted.
+ */
+int
+cos_mc_clock_evict(coreid_t core)
+{
+	struct cos_mc_clock      *c = &clocks[core];
+	struct cos_mc_clock_slot *s;
+	item                     *it;
+	u8_t                     *ref;
+	u32_t                     hv, sz;
+	int                       n, evicted = 0;
+
+	if (!clock_on) return 0;
+	if (!c->evicting && ps_load(&c->bytes) <= clock_high) return 0;
+	c->evicting = 1;
+
+	for (n = 0; n < COS_MC_CLOCK_BATCH && ps_load(&c->bytes) > clock_low; n++) {
+		if (c->hand == ps_load(&c->tail)) break;
+		s  = &c->slots[c->hand & (COS_MC_CLOCK_SZ - 1)];
+		/* Reserved, but not yet filled */
+		it = __atomic_load_n(&s->it, __ATOMIC_ACQUIRE);
+		if (!it) break;
+		hv    = s->hv;
+		sz    = s->sz;
+		s->it = NULL;
+		__atomic_store_n(&c->hand, c->hand + 1, __ATOMIC_RELEASE);
+
+		ref = &clock_refs[hv & (COS_MC_CLOCK_REFS - 1)];
+		if (*ref && (it->it_flags & ITEM_LINKED)) {
+			*ref = 0;
+			if (!clock_push(c, it, hv, sz)) continue;
+		} else if (clock_unlink(it, hv)) {
+			evicted++;
+		}
+		ps_faa(&c->bytes, -(long)sz);
+	}
+	if (ps_load(&c->bytes) <= clock_low) c->evicting = 0;
+
+	return evicted;
+}
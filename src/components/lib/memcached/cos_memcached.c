@@ -1,4 +1,6 @@
 #include <string.h>
+#include <errno.h>
+#include <stdio.h>
 #include <cos_component.h>
 #include "cos_adapter/cos_mc_adapter.h"
 #include "cos_memcached.h"
@@ -27,32 +29,88 @@ cos_free_fd(int fd)
 	return;
 }
 
+/* The scattered reply buffers of the requests being processed, by thread */
+static struct cos_mc_wbuf *thd_wbufs[COS_MC_THD_MAX];
+
+/* The request is consumed by the reads, the next one wouldblock */
 ssize_t
 cos_tcp_read(conn *c, void *buf, size_t count)
 {
+	size_t len;
+
 	assert (c != NULL);
 
-	memcpy(buf, c->cos_r_buf, c->cos_r_sz);
+	if (c->cos_r_sz == 0) {
+		errno = EAGAIN;
+		return -1;
+	}
+	len = c->cos_r_sz < count ? c->cos_r_sz : count;
+	memcpy(buf, c->cos_r_buf, len);
+	c->cos_r_buf += len;
+	c->cos_r_sz  -= len;
+
+	return len;
+}
+
+/*
+ * Copy the iovecs into the scattered reply buffers, moving to the next
+ * buffer as each is full. Returns the bytes copied, which are fewer
+ * than those of the iovecs if there's no next buffer (and memcached
+ * sends the rest again), or -1 with ENOBUFS if none is.
+ */
+static ssize_t
+cos_sendmsg_scatter(struct cos_mc_wbuf *w, struct msghdr *msg)
+{
+	ssize_t sent_len = 0;
+	size_t  off, len;
+
+	for (size_t i = 0; i < msg->msg_iovlen; i++) {
+		for (off = 0; off < msg->msg_iov[i].iov_len; off += len) {
+			if (w->len == w->sz && w->next(w)) goto done;
+			len = msg->msg_iov[i].iov_len - off;
+			if (len > (size_t)(w->sz - w->len)) len = w->sz - w->len;
+			memcpy(w->buf + w->len, (char *)msg->msg_iov[i].iov_base + off, len);
+			w->len   += len;
+			sent_len += len;
+		}
+	}
+done:
+	if (sent_len == 0 && msg->msg_iovlen > 0) {
+		errno = ENOBUFS;
+		return -1;
+	}
 
-	return c->cos_r_sz;
+	return sent_len;
 }
 
-/* Both TCP and UDP conn will write data back to c->cos_w_buf */
+/*
+ * Both TCP and UDP conn will write data back to c->cos_w_buf, or to
+ * the scattered reply buffers (see cos_mc_process_command_v). A reply
+ * that doesn't fit in c->cos_w_buf (e.g. a GET of a large value) fails
+ * with EMSGSIZE, before any of it is copied, instead of overflowing
+ * into the next shmem buffer.
+ */
 ssize_t
 cos_sendmsg(void *c, struct msghdr *msg, int flags)
 {
 	conn *_c = (conn *)c;
-	/* TODO: copy shm data from Memcached to shmem */
 	assert (c != NULL);
 	ssize_t sent_len = 0;
 
+	if (thd_wbufs[cos_thdid()]) return cos_sendmsg_scatter(thd_wbufs[cos_thdid()], msg);
+
+	for (ssize_t i = 0; i < msg->msg_iovlen; i++) sent_len += msg->msg_iov[i].iov_len;
+	if (sent_len > _c->cos_w_sz) {
+		_c->cos_w_sz = 0;
+		errno = EMSGSIZE;
+		return -1;
+	}
+
+	sent_len = 0;
 	for (ssize_t i = 0; i < msg->msg_iovlen; i++) {
 		memcpy(_c->cos_w_buf + sent_len, msg->msg_iov[i].iov_base, msg->msg_iov[i].iov_len);
 		sent_len += msg->msg_iov[i].iov_len;
 	}
-
-	/* sent data size cannot exceed buffer size */
-	assert(sent_len < _c->cos_w_sz);
 	_c->cos_w_sz = sent_len;
 
 	return sent_len;
@@ -61,9 +119,12 @@ cos_sendmsg(void *c, struct msghdr *msg, int flags)
 ssize_t
 cos_tcp_write(conn *c, void *buf, size_t count)
 {
-	/* TODO: hack it if necessary */
+	struct iovec  iov = { .iov_base = buf, .iov_len = count };
+	struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1 };
+
 	assert (c != NULL);
-	return 0;
+
+	return cos_sendmsg(c, &msg, 0);
 }
 
 /* UDP connection uses this to copy packet data to its buffer */
@@ -154,6 +215,17 @@ cos_mc_new_conn(int proto)
 	return fd;
 }
 
+/* The commands of UDP requests follow their frame header */
+static inline void
+cos_mc_clock_scan_conn(conn *c, char *r_buf, u16_t r_buf_len)
+{
+	if (!IS_UDP(c->transport)) {
+		cos_mc_clock_scan(r_buf, r_buf_len);
+	} else if (r_buf_len > UDP_HEADER_SIZE) {
+		cos_mc_clock_scan(r_buf + UDP_HEADER_SIZE, r_buf_len - UDP_HEADER_SIZE);
+	}
+}
+
 u16_t
 cos_mc_process_command(int fd, char *r_buf, u16_t r_buf_len, char *w_buf, u16_t w_buf_len)
 {
@@ -166,11 +238,111 @@ cos_mc_process_command(int fd, char *r_buf, u16_t r_buf_len, char *w_buf, u16_t
 	c->cos_w_sz	= w_buf_len;
 
 	cos_mc_event_handler(fd, c);
+	cos_mc_clock_scan_conn(c, r_buf, r_buf_len);
 
 	return c->cos_w_sz;
 }
 
+/*
+ * The GET requests of the calling thread's worker, and those that
+ * missed. The counters are only updated by the worker, and read
+ * without its stats lock, so they can be a request behind.
+ */
+u16_t
+cos_mc_process_command_v(int fd, char *r_buf, u16_t r_buf_len, struct cos_mc_wbuf *w)
+{
+	conn *c;
+	thdid_t tid = cos_thdid();
+
+	assert(tid < COS_MC_THD_MAX);
+	c = cos_mc_get_conn(fd);
+
+	c->cos_r_buf	= r_buf;
+	c->cos_r_sz	= r_buf_len;
+	c->cos_w_buf	= w->buf;
+	c->cos_w_sz	= w->sz;
+
+	thd_wbufs[tid] = w;
+	cos_mc_event_handler(fd, c);
+	thd_wbufs[tid] = NULL;
+	cos_mc_clock_scan_conn(c, r_buf, r_buf_len);
+
+	return w->len;
+}
+
 void
+cos_mc_thd_stats(u64_t *gets, u64_t *misses)
+{
+	LIBEVENT_THREAD *me = get_worker_thread(cos_thdid());
+
+	*gets   = me->stats.get_cmds;
+	*misses = me->stats.get_misses;
+}
+
+/*
+ * The snapshot is loaded by batches of SET commands, with noreply,
+ * each processed as a single UDP request of the fd's connection, so
+ * there are no replies to write, and a batch costs one request.
+ */
+#define COS_MC_SNAP_BATCH 32768
+
+static char snap_batch[COS_MC_SNAP_BATCH];
+static char snap_reply[64];
+
+/*
+ * Load the items of a snapshot into the cache, with the UDP connection
+ * `fd` of the calling thread. Returns the number of the items loaded,
+ * or -EINVAL if the snapshot is invalid. Items too large for a batch
+ * are skipped. Only one thread can load at a time.
+ */
+int
+cos_mc_snap_load(int fd, const char *snap, size_t sz)
+{
+	struct cos_mc_snap_hdr  *h = (struct cos_mc_snap_hdr *)snap;
+	struct cos_mc_snap_item *it;
+	size_t off, itsz;
+	int    len, n, nloaded = 0;
+	u32_t  i;
+
+	if (sz < sizeof(*h) || h->magic != COS_MC_SNAP_MAGIC) return -EINVAL;
+
+	/* The frame header of a single-datagram UDP request */
+	memcpy(snap_batch, "\0\0\0\0\0\1\0\0", 8);
+	len = 8;
+	n   = 0;
+	off = sizeof(*h);
+	for (i = 0; i < h->nitems; i++) {
+		if (off + sizeof(*it) > sz) return -EINVAL;
+		it   = (struct cos_mc_snap_item *)(snap + off);
+		itsz = (sizeof(*it) + it->nkey + it->nbytes + 7) & ~7UL;
+		if (off + itsz > sz || it->nkey == 0 || it->nkey > KEY_MAX_LENGTH) return -EINVAL;
+		off += itsz;
+
+		/* The command line is at most 64 bytes more than the key */
+		if (len + it->nkey + 64 + it->nbytes + 2 > COS_MC_SNAP_BATCH) {
+			if (n > 0) cos_mc_process_command(fd, snap_batch, len, snap_reply, sizeof(snap_reply));
+			len = 8;
+			n   = 0;
+		}
+		if (8 + it->nkey + 64 + it->nbytes + 2 > COS_MC_SNAP_BATCH) continue;
+
+		memcpy(snap_batch + len, "set ", 4);
+		memcpy(snap_batch + len + 4, it->data, it->nkey);
+		len += 4 + it->nkey;
+		len += snprintf(snap_batch + len, 64, " %u %u %u noreply\r\n", it->flags, it->exptime, it->nbytes);
+		memcpy(snap_batch + len, it->data + it->nkey, it->nbytes);
+		len += it->nbytes;
+		memcpy(snap_batch + len, "\r\n", 2);
+		len += 2;
+		n++;
+		nloaded++;
+	}
+	if (n > 0) cos_mc_process_command(fd, snap_batch, len, snap_reply, sizeof(snap_reply));
+
+	return nloaded;
+}
+
+int
 mc_test(void)
 {
 	conn *c;
@@ -185,4 +357,6 @@ mc_test(void)
 	client_query = "\0\0\0\0\0\1\0\0get GWU_SYS\r\n";
 
 	cos_mc_event_handler(fd, cos_mc_get_conn(fd));
+
+	return fd;
 }
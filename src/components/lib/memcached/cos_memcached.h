@@ -7,7 +7,63 @@ int cos_mc_new_conn(int proto);
 int cos_mc_init(int argc, char **argv);
 u16_t cos_mc_process_command(int fd, char *r_buf, u16_t r_buf_len, char *w_buf, u16_t w_buf_len);
 
-void mc_test(void);
+/*
+ * Replies larger than a buffer (e.g. of TCP connections) are
+ * scattered across buffers: once `buf` is full, `next` is called to
+ * hand it over (e.g. to send it) and set up the next buffer, and
+ * returns 0, or -1 if there's none. Returns the length written into
+ * the last buffer.
+ */
+#define COS_MC_THD_MAX 512
+
+struct cos_mc_wbuf {
+	char  *buf;
+	u16_t  sz, len;
+	int  (*next)(struct cos_mc_wbuf *w);
+};
+
+u16_t cos_mc_process_command_v(int fd, char *r_buf, u16_t r_buf_len, struct cos_mc_wbuf *w);
+void cos_mc_thd_stats(u64_t *gets, u64_t *misses);
+
+/*
+ * A snapshot of items, to warm up the cache without the network: a
+ * header, then the items, each with its key and value, padded to 8
+ * bytes.
+ */
+#define COS_MC_SNAP_MAGIC 0x4e534d43 /* "CMSN" */
+
+struct cos_mc_snap_hdr {
+	u32_t magic;
+	u32_t nitems;
+};
+
+struct cos_mc_snap_item {
+	u32_t flags;
+	u32_t exptime;
+	u32_t nbytes;
+	u16_t nkey;
+	u16_t pad;
+	char  data[]; /* the key, then the value */
+};
+
+int cos_mc_snap_load(int fd, const char *snap, size_t sz);
+
+/*
+ * CLOCK eviction (cos_mc_clock.c): the items stored on each core are
+ * evicted by that core's thread, in batches, once they are over high
+ * percent of the core's share of the memory limit, down to low
+ * percent. GETs only set a reference byte of their keys.
+ */
+#define COS_MC_CLOCK_SZ    (1 << 16) /* the items tracked per core */
+#define COS_MC_CLOCK_REFS  (1 << 20) /* the reference bytes */
+#define COS_MC_CLOCK_BATCH 256       /* the items looked at per call */
+
+void cos_mc_clock_init(int high, int low);
+void cos_mc_clock_scan(const char *r, size_t len);
+int  cos_mc_clock_evict(coreid_t core);
+
+/* Returns the fd of the udp connection of the test, for more tests */
+int mc_test(void);
 
 
 #endif /* COS_MEMCACHED_H */
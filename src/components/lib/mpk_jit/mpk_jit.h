@@ -1,73 +1,60 @@
 #include <cos_types.h>
 #include <cos_debug.h>
-
-static int
-mpk_jit_search(u8_t *src, u8_t *pat, size_t len, size_t max)
+#include <string.h>
+
+/*
+ * The offsets of the immediates to patch in a callgate, from its
+ * start, emitted by the assembler in the 32 bytes before each
+ * callgate (see COS_CALLGATE_RELOCS in cos_asm_stubs.h).
+ */
+struct mpk_jit_relocs {
+	u16_t magic;
+	u16_t cli_tok[2]; /* the load and the check of the client's token */
+	u16_t srv_tok[2]; /* ...and of the server's */
+	u16_t cap_no;
+	u16_t inv_tok;
+	u16_t srv_pkru, cli_pkru;
+	u16_t srv_fn;
+	u16_t _pad[6];
+};
+
+/* Must match COS_CALLGATE_RELOCS_MAGIC in cos_asm_stubs.h */
+#define MPK_JIT_RELOCS_MAGIC 0xca11
+
+/* The PKRU value that disables W/R for all pkeys except `pkey` (see COS_ULINV_PKRU) */
+static inline u32_t
+mpk_jit_pkru(u32_t pkey)
 {
-	unsigned int i, j;
-
-	/* naive pattern search */
-	for (i = 0; i < max; i++) {
-		for (j = 0; j < len; j++) {
-			if (src[i + j] != pat[j]) break;
-		}
- 
-		if (j == len) return i;
-	}
-
-	return -1;
+	return ~(0b11 << (2 * pkey)) & ~0b11;
 }
 
-static int 
-mpk_jit_replace(u8_t *src, u8_t *orig, u8_t *replace, size_t len, size_t src_len)
+static inline void
+mpk_jit_patch64(u8_t *callgate, u16_t off, u64_t v)
 {
-	unsigned int i;
-	int pos;
-
-	pos = mpk_jit_search(src, orig, len, src_len);
-	if (pos == -1) return 0;
-
-	for (i = 0; i < len; i++) {
-		src[pos + i] = replace[i];
-	}
-	
-	return pos;
+	memcpy(callgate + off, &v, sizeof(u64_t));
 }
 
-#define JIT_TOK_PLACEHOLDER   0xDEADBEEFDEADBEEFUL
-#define JIT_INV_PLACEHOLDER   0x0123456789ABCDEFUL
-#define JIT_MPK_PLACEHOLDER   0xFFFFFFFEU
-#define JIT_SRVFN_PLACEHOLDER 0x1212121212121212UL
-
-/* FIXME: automate this value */
-#define JIT_CALLGATE_LEN_BYTES 550
+static inline void
+mpk_jit_patch32(u8_t *callgate, u16_t off, u32_t v)
+{
+	memcpy(callgate + off, &v, sizeof(u32_t));
+}
 
 static void
 mpk_jit_jitcallgate(vaddr_t callgate, vaddr_t server_fn, prot_domain_t client_protdom, prot_domain_t server_protdom, u64_t cli_tok, u64_t srv_tok, invtoken_t inv_tok, sinvcap_t cap_no)
 {
-	u64_t tok_placeholder = JIT_TOK_PLACEHOLDER;
-	u64_t inv_placeholder = JIT_INV_PLACEHOLDER;
-	u32_t mpk_placeholder = JIT_MPK_PLACEHOLDER;
-	u64_t srvfn_placeholder = JIT_SRVFN_PLACEHOLDER;
-
-	u32_t cli_pkey = (u32_t)PROTDOM_MPK_KEY(client_protdom);
-	u32_t srv_pkey = (u32_t)PROTDOM_MPK_KEY(server_protdom);
-
-	/* 
-	 * FIXME: 
-	 *      1) Error handling. There are a few ways this could go wrong
-	 *         if one of these values is in the compiled binary already.
-	 *      2) Statically determine these offsets to avoid searching which
-	 *         could caused the errors in (1).
-     */
-	if (!mpk_jit_replace((u8_t *)callgate, (u8_t *)&tok_placeholder, (u8_t *)&cli_tok, sizeof(u64_t), JIT_CALLGATE_LEN_BYTES)) BUG();
-	if (!mpk_jit_replace((u8_t *)callgate, (u8_t *)&tok_placeholder, (u8_t *)&cli_tok, sizeof(u64_t), JIT_CALLGATE_LEN_BYTES)) BUG();
-	if (!mpk_jit_replace((u8_t *)callgate, (u8_t *)&tok_placeholder, (u8_t *)&srv_tok, sizeof(u64_t), JIT_CALLGATE_LEN_BYTES)) BUG();
-	if (!mpk_jit_replace((u8_t *)callgate, (u8_t *)&tok_placeholder, (u8_t *)&srv_tok, sizeof(u64_t), JIT_CALLGATE_LEN_BYTES)) BUG();
-	if (!mpk_jit_replace((u8_t *)callgate, (u8_t *)&inv_placeholder, (u8_t *)&cap_no,  sizeof(u64_t), JIT_CALLGATE_LEN_BYTES)) BUG();
-	if (!mpk_jit_replace((u8_t *)callgate, (u8_t *)&inv_placeholder, (u8_t *)&inv_tok, sizeof(u64_t), JIT_CALLGATE_LEN_BYTES)) BUG();
-	if (!mpk_jit_replace((u8_t *)callgate, (u8_t *)&mpk_placeholder, (u8_t *)&srv_pkey, sizeof(u32_t), JIT_CALLGATE_LEN_BYTES)) BUG();
-	if (!mpk_jit_replace((u8_t *)callgate, (u8_t *)&mpk_placeholder, (u8_t *)&cli_pkey, sizeof(u32_t), JIT_CALLGATE_LEN_BYTES)) BUG();
-	if (!mpk_jit_replace((u8_t *)callgate, (u8_t *)&srvfn_placeholder, (u8_t *)&server_fn, sizeof(u64_t), JIT_CALLGATE_LEN_BYTES)) BUG();
-
-}
\ No newline at end of file
+	struct mpk_jit_relocs *r  = (struct mpk_jit_relocs *)callgate - 1;
+	u8_t                  *cg = (u8_t *)callgate;
+
+	if (r->magic != MPK_JIT_RELOCS_MAGIC) BUG();
+
+	mpk_jit_patch64(cg, r->cli_tok[0], cli_tok);
+	mpk_jit_patch64(cg, r->cli_tok[1], cli_tok);
+	mpk_jit_patch64(cg, r->srv_tok[0], srv_tok);
+	mpk_jit_patch64(cg, r->srv_tok[1], srv_tok);
+	mpk_jit_patch64(cg, r->cap_no, (u64_t)cap_no);
+	mpk_jit_patch64(cg, r->inv_tok, (u64_t)inv_tok);
+	mpk_jit_patch32(cg, r->srv_pkru, mpk_jit_pkru((u32_t)PROTDOM_MPK_KEY(server_protdom)));
+	mpk_jit_patch32(cg, r->cli_pkru, mpk_jit_pkru((u32_t)PROTDOM_MPK_KEY(client_protdom)));
+	mpk_jit_patch64(cg, r->srv_fn, (u64_t)server_fn);
+}
@@ -0,0 +1,158 @@
+#include <cos_types.h>
+#include <net_cksum.h>
+
+u64_t
+net_cksum_partial_scalar(const void *buf, size_t len)
+{
+	const u8_t *p   = buf;
+	u64_t       sum = 0, w;
+	u32_t       w32;
+	u16_t       w16 = 0;
+
+	/* Each 64-bit word adds its two halves, so the sum can't overflow */
+	for (; len >= 8; len -= 8, p += 8) {
+		__builtin_memcpy(&w, p, 8);
+		sum += (w & 0xffffffff) + (w >> 32);
+	}
+	if (len >= 4) {
+		__builtin_memcpy(&w32, p, 4);
+		sum += w32;
+		p   += 4;
+		len -= 4;
+	}
+	if (len >= 2) {
+		__builtin_memcpy(&w16, p, 2);
+		sum += w16;
+		p   += 2;
+		len -= 2;
+	}
+	/* An odd last byte is the first of a 16-bit word, padded with 0 */
+	if (len) {
+		w16 = 0;
+		*(u8_t *)&w16 = *p;
+		sum += w16;
+	}
+
+	return sum;
+}
+
+#if defined(__x86_64__) && defined(__SSE2__)
+/*
+ * The vector kernels are GCC vector extensions, so they need neither
+ * the intrinsics headers, nor the whole library to be compiled for
+ * AVX2. The 64-bit lanes add the two 32-bit halves of their words.
+ */
+typedef u64_t net_v2u64 __attribute__((vector_size(16)));
+typedef u64_t net_v4u64 __attribute__((vector_size(32)));
+
+u64_t
+net_cksum_partial_sse2(const void *buf, size_t len)
+{
+	const u8_t *p = buf;
+	net_v2u64   a = { 0 }, b = { 0 }, v, w;
+	const net_v2u64 lo = { 0xffffffff, 0xffffffff };
+
+	/* Two accumulators, so the additions of consecutive words overlap */
+	for (; len >= 32; len -= 32, p += 32) {
+		__builtin_memcpy(&v, p, 16);
+		__builtin_memcpy(&w, p + 16, 16);
+		a += (v & lo) + (v >> 32);
+		b += (w & lo) + (w >> 32);
+	}
+	a += b;
+
+	return a[0] + a[1] + net_cksum_partial_scalar(p, len);
+}
+
+__attribute__((target("avx2"))) u64_t
+net_cksum_partial_avx2(const void *buf, size_t len)
+{
+	const u8_t *p = buf;
+	net_v4u64   a = { 0 }, b = { 0 }, v, w;
+	const net_v4u64 lo = { 0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff };
+
+	for (; len >= 64; len -= 64, p += 64) {
+		__builtin_memcpy(&v, p, 32);
+		__builtin_memcpy(&w, p + 32, 32);
+		a += (v & lo) + (v >> 32);
+		b += (w & lo) + (w >> 32);
+	}
+	a += b;
+
+	return a[0] + a[1] + a[2] + a[3] + net_cksum_partial_sse2(p, len);
+}
+
+/* AVX2 needs the processor's support, and the OS saving the AVX state */
+static int
+net_cksum_avx2_supported(void)
+{
+	u32_t a, b, c, d, xcr0_lo, xcr0_hi;
+
+	asm volatile("cpuid" : "=a"(a), "=b"(b), "=c"(c), "=d"(d) : "a"(0), "c"(0));
+	if (a < 7) return 0;
+	asm volatile("cpuid" : "=a"(a), "=b"(b), "=c"(c), "=d"(d) : "a"(1), "c"(0));
+	if (!(c & (1 << 27))) return 0; /* OSXSAVE */
+	asm volatile("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+	if ((xcr0_lo & 0x6) != 0x6) return 0; /* the SSE and AVX state */
+	asm volatile("cpuid" : "=a"(a), "=b"(b), "=c"(c), "=d"(d) : "a"(7), "c"(0));
+
+	return (b & (1 << 5)) != 0;
+}
+#else
+u64_t
+net_cksum_partial_sse2(const void *buf, size_t len)
+{
+	return net_cksum_partial_scalar(buf, len);
+}
+
+u64_t
+net_cksum_partial_avx2(const void *buf, size_t len)
+{
+	return net_cksum_partial_scalar(buf, len);
+}
+
+static int
+net_cksum_avx2_supported(void)
+{
+	return 0;
+}
+#endif
+
+static u64_t net_cksum_partial_resolve(const void *buf, size_t len);
+
+static u64_t      (*net_cksum_fn)(const void *buf, size_t len) = net_cksum_partial_resolve;
+static const char *net_cksum_name;
+
+/* The first call selects the kernel; racing threads select the same one */
+static u64_t
+net_cksum_partial_resolve(const void *buf, size_t len)
+{
+#if defined(__x86_64__) && defined(__SSE2__)
+	if (net_cksum_avx2_supported()) {
+		net_cksum_name = "avx2";
+		net_cksum_fn   = net_cksum_partial_avx2;
+	} else {
+		net_cksum_name = "sse2";
+		net_cksum_fn   = net_cksum_partial_sse2;
+	}
+#else
+	net_cksum_name = "scalar";
+	net_cksum_fn   = net_cksum_partial_scalar;
+#endif
+
+	return net_cksum_fn(buf, len);
+}
+
+u64_t
+net_cksum_partial(const void *buf, size_t len)
+{
+	return net_cksum_fn(buf, len);
+}
+
+const char *
+net_cksum_kernel(void)
+{
+	if (!net_cksum_name) net_cksum_partial_resolve(NULL, 0);
+
+	return net_cksum_name;
+}
@@ -0,0 +1,40 @@
+#ifndef NET_CKSUM_H
+#define NET_CKSUM_H
+
+#include <cos_types.h>
+#include <stddef.h>
+
+/***
+ * The Internet checksum (RFC 1071) of buffers, with 64-bit
+ * accumulation. The buffer is summed as 32-bit (or wider) words in
+ * memory order, not as 16-bit words in network order: the one's
+ * complement sum is byte order independent, so folding the result
+ * down to 16 bits gives the same checksum, with a fraction of the
+ * additions. `net_cksum_partial` uses the widest kernel the processor
+ * supports, checked with CPUID on its first use.
+ */
+
+/* The sum of the buffer, to fold with other sums with `net_cksum_fold` */
+u64_t net_cksum_partial(const void *buf, size_t len);
+
+/* The kernels, that return the same sum */
+u64_t net_cksum_partial_scalar(const void *buf, size_t len);
+u64_t net_cksum_partial_sse2(const void *buf, size_t len);
+u64_t net_cksum_partial_avx2(const void *buf, size_t len);
+
+/* The name of the kernel used by `net_cksum_partial` */
+const char *net_cksum_kernel(void);
+
+/* Fold a sum into the 16-bit one's complement sum (not complemented) */
+static inline u16_t
+net_cksum_fold(u64_t sum)
+{
+	sum = (sum & 0xffffffff) + (sum >> 32);
+	sum = (sum & 0xffffffff) + (sum >> 32);
+	sum = (sum & 0xffff) + (sum >> 16);
+	sum = (sum & 0xffff) + (sum >> 16);
+
+	return (u16_t)sum;
+}
+
+#endif /* NET_CKSUM_H */
@@ -72,6 +72,40 @@ struct udp_hdr
 	u16_t checksum;
 } __attribute__((packed));
 
+struct tcp_hdr
+{
+	struct tcp_udp_port port;
+	u32_t seq;
+	u32_t ack;
+	u8_t  data_off; /* the header length in 32-bit words, in the upper 4 bits */
+	u8_t  flags;
+	u16_t window;
+	u16_t checksum;
+	u16_t urg_ptr;
+} __attribute__((packed));
+
+#define TCP_FLAG_FIN 0x01
+#define TCP_FLAG_SYN 0x02
+#define TCP_FLAG_RST 0x04
+#define TCP_FLAG_PSH 0x08
+#define TCP_FLAG_ACK 0x10
+#define TCP_FLAG_URG 0x20
+
+struct icmp_hdr
+{
+	u8_t  type;
+	u8_t  code;
+	u16_t checksum;
+	u16_t id;
+	u16_t seq;
+} __attribute__((packed));
+
+#define ICMP_ECHO_REPLY   0
+#define ICMP_ECHO_REQUEST 8
+
+#define ETH_TYPE_IPV4 0x0800
+#define ETH_TYPE_ARP  0x0806
+
 #define ICMP_PROTO 1
 #define UDP_PROTO 17
 #define TCP_PROTO 6
@@ -79,10 +113,15 @@ struct udp_hdr
 #define ETH_STD_LEN sizeof(struct eth_hdr)
 #define IP_STD_LEN sizeof(struct ip_hdr)
 #define UDP_STD_LEN sizeof(struct udp_hdr)
+#define TCP_STD_LEN sizeof(struct tcp_hdr)
+#define ICMP_STD_LEN sizeof(struct icmp_hdr)
 
 #define IPv4 4
 
 /* enable IP and UDP offload by default */
 #define ENABLE_OFFLOAD 0
 
+/* enable TCP segmentation offload, and multi-buffer packets, if the NIC supports them */
+#define ENABLE_TSO 1
+
 #endif
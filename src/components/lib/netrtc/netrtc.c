@@ -0,0 +1,108 @@
+#include <cos_component.h>
+#include <llprint.h>
+#include <netshmem.h>
+#include <cos_time.h>
+#include "netrtc.h"
+
+static struct netrtc_stats netrtc_core_stats[NUM_CPU];
+
+void
+netrtc_thd_init(void)
+{
+	if (!netshmem_get_shm()) netshmem_create();
+	udp_stack_shmem_map(netshmem_get_shm_id());
+}
+
+struct netrtc_stats *
+netrtc_stats(coreid_t core)
+{
+	return &netrtc_core_stats[core];
+}
+
+void
+netrtc_stats_print(coreid_t core)
+{
+	struct netrtc_stats *s = &netrtc_core_stats[core];
+
+	printc("netrtc core %d: %lu batches, %lu rx, %lu tx, %lu dropped, %llu usec processing\n", core, s->batches,
+	       s->rx, s->tx, s->dropped, (unsigned long long)(s->cycles / time_cyc_per_usec()));
+}
+
+/* The headers were read by the stack, thus the beginning of the payload with them */
+static inline void
+netrtc_prefetch(char *data, u16_t len)
+{
+	int l;
+
+	for (l = 1; l < NETRTC_PREFETCH_LINES && l * CACHE_LINE < len; l++) __builtin_prefetch(data + l * CACHE_LINE);
+}
+
+/* Drop the packets without a reply, and return the number of replies left */
+static int
+netrtc_replies(struct udp_stack_pkt *pkts, int n, shm_bm_t shm)
+{
+	int i, nr;
+
+	for (i = 0, nr = 0; i < n; i++) {
+		if (unlikely(pkts[i].data_len == 0)) {
+			netshmem_pkt_buf_free(shm_bm_borrow_net_pkt_buf(shm, pkts[i].objid));
+			continue;
+		}
+		pkts[nr++] = pkts[i];
+	}
+
+	return nr;
+}
+
+void
+netrtc_run(u32_t ip, u16_t port, netrtc_process_fn process_batch, void *arg)
+{
+	struct netrtc_stats     *s = &netrtc_core_stats[cos_coreid()];
+	struct udp_stack_pkt     pkts[NETRTC_BATCH];
+	char                    *data[NETRTC_BATCH];
+	struct netshmem_pkt_buf *obj;
+	shm_bm_t                 shm = netshmem_get_shm();
+	cycles_t                 start;
+	int                      ret, i, n, nb, nr;
+
+	assert(shm);
+	ret = udp_stack_udp_bind(ip, port);
+	assert(ret == 0);
+
+	while (1) {
+		n = udp_stack_shmem_read_n(pkts, NETRTC_BATCH);
+		if (unlikely(n <= 0)) continue;
+		s->batches++;
+		s->rx += n;
+
+		/* The invalid packets are dropped, and the payloads of the others prefetched */
+		for (i = 0, nb = 0; i < n; i++) {
+			obj = shm_bm_borrow_net_pkt_buf(shm, pkts[i].objid);
+			if (unlikely(pkts[i].data_len == 0)) {
+				netshmem_pkt_buf_free(obj);
+				continue;
+			}
+			pkts[nb] = pkts[i];
+			data[nb] = obj->data + pkts[i].data_offset;
+			netrtc_prefetch(data[nb], pkts[nb].data_len);
+			nb++;
+		}
+
+		if (likely(nb > 0)) {
+			start = time_now();
+			process_batch(pkts, data, nb, arg);
+			s->cycles += time_now() - start;
+
+			nr = netrtc_replies(pkts, nb, shm);
+			if (nr > 0) udp_stack_shmem_write_n(pkts, nr);
+			s->tx += nr;
+		} else {
+			nr = 0;
+		}
+		s->dropped += n - nr;
+
+		if (NETRTC_STATS_ORD && (s->batches & ((1UL << NETRTC_STATS_ORD) - 1)) == 0) {
+			netrtc_stats_print(cos_coreid());
+		}
+	}
+}
@@ -0,0 +1,51 @@
+#ifndef NETRTC_H
+#define NETRTC_H
+
+#include <cos_types.h>
+#include <arpa/inet.h>
+#include <simple_udp_stack.h>
+
+/***
+ * Run-to-completion servers on the simple udp stack (without lwip).
+ * The thread of each of the server's cores binds its own session to
+ * the server's port, and loops: it reads a batch of up to
+ * NETRTC_BATCH packets with one invocation of the nic, prefetches
+ * their payloads, gives them to the server's `process_batch`, and
+ * sends the replies with one more invocation. The nic spreads the
+ * flows of the port across the sessions, so a server scales with the
+ * cores it's given (`cores` in the composition). See doc.md.
+ */
+#define NETRTC_BATCH UDP_STACK_BATCH_MAX
+/* The cache-lines of each payload prefetched before the batch is processed */
+#define NETRTC_PREFETCH_LINES 4
+/* Print the stats of the core every 2^NETRTC_STATS_ORD batches, if not 0 */
+#define NETRTC_STATS_ORD 0
+
+/*
+ * Process the `n` packets, of payloads `data[i]`, of the thread's
+ * shmem. Each packet is answered with pkts[i], once the batch is
+ * processed: its data_offset and data_len can be changed, e.g. to
+ * write the reply over the request, or its objid set to another
+ * buffer (the packet's own buffer is then the server's to free). A
+ * data_len of 0 drops it, and frees the buffer of its objid.
+ */
+typedef void (*netrtc_process_fn)(struct udp_stack_pkt *pkts, char **data, int n, void *arg);
+
+/* The stats of a core */
+struct netrtc_stats {
+	unsigned long batches;
+	unsigned long rx;      /* the packets received */
+	unsigned long tx;      /* the replies sent */
+	unsigned long dropped; /* the packets invalid, or without a reply */
+	cycles_t      cycles;  /* spent in process_batch */
+} CACHE_ALIGNED;
+
+/* Set up the calling thread's shmem (if it has none) with the stack; from cos_parallel_init */
+void netrtc_thd_init(void);
+/* Bind the calling thread to `port` (in host order) at `ip`, and serve its packets, never returning */
+void netrtc_run(u32_t ip, u16_t port, netrtc_process_fn process_batch, void *arg);
+
+struct netrtc_stats *netrtc_stats(coreid_t core);
+void netrtc_stats_print(coreid_t core);
+
+#endif /* NETRTC_H */
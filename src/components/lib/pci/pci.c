@@ -239,3 +239,131 @@ pci_dev_count(void)
 
 	return dev_num;
 }
+
+int
+pci_cap_find(struct pci_dev *dev, u8_t id)
+{
+	u32_t reg;
+	u8_t  off;
+	int   n;
+
+	if (!(pci_config_read(dev->bus, dev->dev, dev->func, PCI_CMD_STATUS) & PCI_STATUS_CAP_LIST)) return 0;
+
+	off = pci_config_read(dev->bus, dev->dev, dev->func, PCI_CAP_PTR) & 0xFC;
+	/* bound the walk, in case the list is malformed */
+	for (n = 0; off && n < 48; n++) {
+		reg = pci_config_read(dev->bus, dev->dev, dev->func, off);
+		if ((reg & 0xFF) == id) return off;
+		off = (reg >> 8) & 0xFC;
+	}
+
+	return 0;
+}
+
+static void
+pci_intx_disable(struct pci_dev *dev)
+{
+	u32_t cmd = pci_config_read(dev->bus, dev->dev, dev->func, PCI_CMD_STATUS);
+
+	/* only write back the command register: the status bits are write-1-to-clear */
+	pci_config_write(dev->bus, dev->dev, dev->func, PCI_CMD_STATUS, (cmd & 0xFFFF) | PCI_CMD_INTX_DISABLE);
+}
+
+int
+pci_msi_enable(struct pci_dev *dev, u32_t dest, u8_t vec)
+{
+	int   cap = pci_cap_find(dev, PCI_CAP_ID_MSI);
+	u32_t ctrl;
+
+	if (!cap) return -1;
+
+	ctrl = pci_config_read(dev->bus, dev->dev, dev->func, cap);
+	pci_config_write(dev->bus, dev->dev, dev->func, cap + 4, PCI_MSI_ADDR(dest));
+	if (ctrl & PCI_MSI_CTRL_64BIT) {
+		pci_config_write(dev->bus, dev->dev, dev->func, cap + 8, 0);
+		pci_config_write(dev->bus, dev->dev, dev->func, cap + 12, PCI_MSI_DATA(vec));
+	} else {
+		pci_config_write(dev->bus, dev->dev, dev->func, cap + 8, PCI_MSI_DATA(vec));
+	}
+	/* a single message */
+	ctrl &= ~PCI_MSI_CTRL_MME_MASK;
+	pci_config_write(dev->bus, dev->dev, dev->func, cap, ctrl | PCI_MSI_CTRL_ENABLE);
+	pci_intx_disable(dev);
+
+	return 0;
+}
+
+int
+pci_msix_init(struct pci_dev *dev, struct pci_msix *msix)
+{
+	int   cap = pci_cap_find(dev, PCI_CAP_ID_MSIX);
+	u32_t reg;
+
+	if (!cap) return -1;
+
+	msix->cap = (u8_t)cap;
+	reg = pci_config_read(dev->bus, dev->dev, dev->func, cap);
+	msix->nvec = PCI_MSIX_CTRL_NVEC(reg);
+	/* the low 3 bits are the bar, the rest the (8-byte aligned) offset in it */
+	reg = pci_config_read(dev->bus, dev->dev, dev->func, cap + 4);
+	msix->table_bar = reg & 0x7;
+	msix->table_off = reg & ~0x7;
+	reg = pci_config_read(dev->bus, dev->dev, dev->func, cap + 8);
+	msix->pba_bar = reg & 0x7;
+	msix->pba_off = reg & ~0x7;
+	msix->table   = NULL;
+
+	if (msix->table_bar >= PCI_BAR_NUM || msix->pba_bar >= PCI_BAR_NUM) return -1;
+
+	return 0;
+}
+
+void
+pci_msix_table_set(struct pci_msix *msix, void *bar_vaddr)
+{
+	msix->table = (volatile u32_t *)((char *)bar_vaddr + msix->table_off);
+}
+
+int
+pci_msix_vec_mask(struct pci_msix *msix, u16_t entry, int masked)
+{
+	volatile u32_t *e;
+
+	assert(msix->table);
+	if (entry >= msix->nvec) return -1;
+
+	e = &msix->table[entry * PCI_MSIX_ENTRY_DWORDS];
+	if (masked) e[3] |= PCI_MSIX_ENTRY_MASKED;
+	else        e[3] &= ~PCI_MSIX_ENTRY_MASKED;
+
+	return 0;
+}
+
+int
+pci_msix_vec_set(struct pci_msix *msix, u16_t entry, u32_t dest, u8_t vec)
+{
+	volatile u32_t *e;
+
+	assert(msix->table);
+	if (entry >= msix->nvec) return -1;
+
+	e = &msix->table[entry * PCI_MSIX_ENTRY_DWORDS];
+	/* don't let the device send a half-written message */
+	e[3] |= PCI_MSIX_ENTRY_MASKED;
+	e[0]  = PCI_MSI_ADDR(dest);
+	e[1]  = 0;
+	e[2]  = PCI_MSI_DATA(vec);
+	e[3] &= ~PCI_MSIX_ENTRY_MASKED;
+
+	return 0;
+}
+
+void
+pci_msix_enable(struct pci_dev *dev, struct pci_msix *msix)
+{
+	u32_t ctrl = pci_config_read(dev->bus, dev->dev, dev->func, msix->cap);
+
+	ctrl &= ~PCI_MSIX_CTRL_FUNC_MASK;
+	pci_config_write(dev->bus, dev->dev, dev->func, msix->cap, ctrl | PCI_MSIX_CTRL_ENABLE);
+	pci_intx_disable(dev);
+}
@@ -12,6 +12,30 @@
 #define PCI_BAR_NUM        6
 #define PCI_BITMASK_32     0xFFFFFFFF
 
+/* Command (low 16 bits) and status (high 16 bits) register */
+#define PCI_CMD_STATUS       0x04
+#define PCI_CMD_INTX_DISABLE (1 << 10)
+#define PCI_STATUS_CAP_LIST  (1 << 20)
+#define PCI_CAP_PTR          0x34
+#define PCI_CAP_ID_MSI       0x05
+#define PCI_CAP_ID_MSIX      0x11
+
+/* Message control, in the high 16 bits of the first dword of the MSI(-X) capability */
+#define PCI_MSI_CTRL_ENABLE     (1 << 16)
+#define PCI_MSI_CTRL_64BIT      (1 << 23)
+#define PCI_MSI_CTRL_MME_MASK   (0x7 << 20)
+#define PCI_MSIX_CTRL_NVEC(v)   ((((v) >> 16) & 0x7FF) + 1)
+#define PCI_MSIX_CTRL_FUNC_MASK (1 << 30)
+#define PCI_MSIX_CTRL_ENABLE    (1U << 31)
+
+/* A MSI(-X) message to the destination (see cos_hw_msi_bind) raising the vector, edge-triggered */
+#define PCI_MSI_ADDR(dest) (0xFEE00000 | ((u32_t)(dest) << 12))
+#define PCI_MSI_DATA(vec)  ((u32_t)(vec))
+
+/* MSI-X vector table entry: address (low, high), data, and vector control */
+#define PCI_MSIX_ENTRY_DWORDS 4
+#define PCI_MSIX_ENTRY_MASKED 0x1
+
 enum {
 	PCI_TYPE_DEVICE = 0,
 	PCI_TYPE_PCI_TO_PCI_BRIDGE = 1,
@@ -95,6 +119,14 @@ struct pci_dev {
 	void *drvdata;
 } __attribute__((packed));
 
+struct pci_msix {
+	u8_t  cap;              /* offset of the capability in the config space */
+	u16_t nvec;             /* number of entries in the vector table */
+	u8_t  table_bar, pba_bar;
+	u32_t table_off, pba_off;
+	volatile u32_t *table;  /* the vector table, once its bar is mapped */
+};
+
 /**
  * scans through the pci bus and fills the provided array
  * @param devices array of `struct pci_dev`
@@ -128,4 +160,62 @@ int pci_dev_count(void);
 
 u32_t pci_config_read(u32_t bus, u32_t dev, u32_t func, u32_t reg);
 void pci_config_write(u32_t bus, u32_t dev, u32_t func, u32_t reg, u32_t v);
+
+/**
+ * walks the capability list of the device
+ * @param dev the device
+ * @param id the capability id (e.g. PCI_CAP_ID_MSIX)
+ * @return the offset of the capability in the config space, 0 if the device doesn't have it
+ */
+int pci_cap_find(struct pci_dev *dev, u8_t id);
+
+/**
+ * enables a single MSI vector on the device, and disables its legacy interrupt line
+ * @param dev the device
+ * @param dest the destination of the message, from cos_hw_msi_bind
+ * @param vec the vector bound with cos_hw_msi_bind
+ * @return 0 on success, -1 if the device doesn't support MSI
+ */
+int pci_msi_enable(struct pci_dev *dev, u32_t dest, u8_t vec);
+
+/**
+ * parses the MSI-X capability of the device: the number of vectors,
+ * and the bar and offset of the vector table. The caller maps
+ * `dev->bar[msix->table_bar]`, and passes it to pci_msix_table_set.
+ * @param dev the device
+ * @param msix the capability to fill
+ * @return 0 on success, -1 if the device doesn't support MSI-X
+ */
+int pci_msix_init(struct pci_dev *dev, struct pci_msix *msix);
+
+/**
+ * @param msix the parsed capability
+ * @param bar_vaddr where the bar holding the vector table is mapped
+ */
+void pci_msix_table_set(struct pci_msix *msix, void *bar_vaddr);
+
+/**
+ * programs (and unmasks) an entry of the vector table, e.g. that of a
+ * rx queue, to raise vec on the core with the destination dest
+ * @param msix the capability, with its table mapped
+ * @param entry the index in the vector table
+ * @param dest the destination of the message, from cos_hw_msi_bind
+ * @param vec the vector bound with cos_hw_msi_bind
+ * @return 0 on success, -1 if the entry is out of the table
+ */
+int pci_msix_vec_set(struct pci_msix *msix, u16_t entry, u32_t dest, u8_t vec);
+
+/**
+ * masks or unmasks an entry of the vector table
+ * @return 0 on success, -1 if the entry is out of the table
+ */
+int pci_msix_vec_mask(struct pci_msix *msix, u16_t entry, int masked);
+
+/**
+ * enables MSI-X on the device (with the entries programmed with
+ * pci_msix_vec_set), and disables its legacy interrupt line
+ * @param dev the device
+ * @param msix the parsed capability
+ */
+void pci_msix_enable(struct pci_dev *dev, struct pci_msix *msix);
 #endif /* PCI_H */
\ No newline at end of file
@@ -0,0 +1,129 @@
+#include <cos_component.h>
+#include <llprint.h>
+#include <ps.h>
+#include <pgo.h>
+
+#if defined(COS_PGO_GENERATE)
+
+/* The bytes of the .gcda files per line */
+#define PGO_LINE_BYTES 64
+
+/* See gcov.h in gcc's headers, and the components' linker scripts */
+struct gcov_info;
+extern void __gcov_info_to_gcda(const struct gcov_info *info, void (*filename_fn)(const char *, void *),
+                                void (*dump_fn)(const void *, unsigned, void *),
+                                void *(*allocate_fn)(unsigned, void *), void *arg);
+extern const struct gcov_info *const __gcov_info_start[];
+extern const struct gcov_info *const __gcov_info_end[];
+
+struct pgo_line {
+	unsigned char buf[PGO_LINE_BYTES];
+	unsigned      len;
+};
+
+static unsigned long pgo_first, pgo_dumped;
+
+/*
+ * The gcov_info of each object refers to this, to merge its counters
+ * into the existing .gcda at exit. The profiles are instead merged on
+ * the host (with `gcov-tool merge`), if at all.
+ */
+void __attribute__((no_profile_instrument_function))
+__gcov_merge_add(long long *counters, unsigned n)
+{
+}
+
+static void __attribute__((no_profile_instrument_function))
+pgo_line_flush(struct pgo_line *l)
+{
+	static const char hex[] = "0123456789abcdef";
+	char              str[PGO_LINE_BYTES * 2 + 1];
+	unsigned          i;
+
+	if (l->len == 0) return;
+	for (i = 0; i < l->len; i++) {
+		str[i * 2]     = hex[l->buf[i] >> 4];
+		str[i * 2 + 1] = hex[l->buf[i] & 0xf];
+	}
+	str[l->len * 2] = '\0';
+	printc("pgo %lu data %s\n", (unsigned long)cos_compid(), str);
+	l->len = 0;
+}
+
+static void __attribute__((no_profile_instrument_function))
+pgo_filename(const char *f, void *arg)
+{
+	printc("pgo %lu file %s\n", (unsigned long)cos_compid(), f);
+}
+
+static void __attribute__((no_profile_instrument_function))
+pgo_data(const void *d, unsigned n, void *arg)
+{
+	struct pgo_line     *l = arg;
+	const unsigned char *c = d;
+	unsigned             i;
+
+	for (i = 0; i < n; i++) {
+		if (l->len == PGO_LINE_BYTES) pgo_line_flush(l);
+		l->buf[l->len++] = c[i];
+	}
+}
+
+/* Only the merging of the value profiles allocates, and they aren't collected */
+static void * __attribute__((no_profile_instrument_function))
+pgo_allocate(unsigned sz, void *arg)
+{
+	return NULL;
+}
+
+/*
+ * Print the .gcda file of each of the component's objects. The
+ * counters are read as the other threads update them, so the profile
+ * is only a snapshot of approximately when this is called. Not to be
+ * called concurrently.
+ */
+void __attribute__((no_profile_instrument_function))
+pgo_dump(void)
+{
+	const struct gcov_info *const *info;
+	struct pgo_line                l = { .len = 0 };
+
+	info = __gcov_info_start;
+	/* Hide that the bounds are distinct objects from the compiler */
+	__asm__("" : "+r"(info));
+	for (; info < __gcov_info_end; info++) {
+		__gcov_info_to_gcda(*info, pgo_filename, pgo_data, pgo_allocate, &l);
+		pgo_line_flush(&l);
+	}
+	printc("pgo %lu end\n", (unsigned long)cos_compid());
+}
+
+/*
+ * Dump the profile once, on the first call at least `after` cycles
+ * after the first call, e.g. from a loop of the component, once its
+ * workload has warmed up.
+ */
+void __attribute__((no_profile_instrument_function))
+pgo_dump_once(cycles_t now, cycles_t after)
+{
+	if (likely(ps_load(&pgo_dumped))) return;
+	if (!ps_load(&pgo_first)) ps_cas(&pgo_first, 0, (unsigned long)now);
+	if (now - ps_load(&pgo_first) < after) return;
+	if (!ps_cas(&pgo_dumped, 0, 1)) return;
+
+	pgo_dump();
+}
+
+#elif defined(COS_PGO)
+
+void
+pgo_dump(void)
+{
+}
+
+void
+pgo_dump_once(cycles_t now, cycles_t after)
+{
+}
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef PGO_H
+#define PGO_H
+
+#include <cos_types.h>
+
+/***
+ * The profiles of the profile-guided builds of components (`pgo` in
+ * the composition). A component built with `pgo = "generate"` counts
+ * the edges taken in its code, and in that of its libraries, and
+ * `pgo_dump` prints the counters on the serial line. Built with
+ * `pgo = "use"`, the component's code is laid out with them. See
+ * doc.md.
+ *
+ * They are no-ops in the other builds, so the components can call
+ * them regardless of how they are built. The `pgo = "use"` builds
+ * still call them, as their code has to be that of the profiles.
+ */
+
+/* For pgo_dump_once, a default delay for the workload to warm up */
+#define PGO_DUMP_DELAY_USEC (30 * 1000 * 1000)
+
+#ifdef COS_PGO
+void pgo_dump(void);
+void pgo_dump_once(cycles_t now, cycles_t after);
+#else
+/* Without evaluating the arguments, e.g. reading the time on a hot path */
+#define pgo_dump()                do { } while (0)
+#define pgo_dump_once(now, after) do { } while (0)
+#endif
+
+#endif /* PGO_H */
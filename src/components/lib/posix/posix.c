@@ -1,27 +1,77 @@
 #include <cos_component.h>
 #include <llprint.h>
+#include <errno.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <time.h>
 #include "posix.h"
 
 cos_syscall_t cos_syscalls[SYSCALLS_NUM];
 
+/*
+ * The hottest emulated system calls are called directly, rather than
+ * through the table, if the component links their implementations
+ * (in posix_sched), and doesn't override them with others.
+ */
+CWEAKSYMB int   cos_futex(int *uaddr, int op, int val, const struct timespec *timeout, int *uaddr2, int val3);
+CWEAKSYMB int   cos_clock_gettime(clockid_t clock_id, struct timespec *ts);
+CWEAKSYMB pid_t cos_gettid(void);
+CWEAKSYMB int   cos_sched_yield(void);
+
+static int syscalls_direct = 1;
+
+static cos_syscall_t
+syscall_direct_fn(int syscall_num)
+{
+	switch (syscall_num) {
+	case __NR_futex:         return (cos_syscall_t)(void *)cos_futex;
+	case __NR_clock_gettime: return (cos_syscall_t)(void *)cos_clock_gettime;
+	case __NR_gettid:        return (cos_syscall_t)(void *)cos_gettid;
+	case __NR_sched_yield:   return (cos_syscall_t)(void *)cos_sched_yield;
+	default:                 return NULL;
+	}
+}
+
 long
 cos_syscall_handler(int syscall_num, long a, long b, long c, long d, long e, long f)
 {
-	assert(syscall_num <= SYSCALLS_NUM);
+	if (likely(syscalls_direct)) {
+		switch (syscall_num) {
+		case __NR_futex:
+			if (cos_futex) return cos_futex((int *)a, (int)b, (int)c, (const struct timespec *)d, (int *)e, (int)f);
+			break;
+		case __NR_clock_gettime:
+			if (cos_clock_gettime) return cos_clock_gettime((clockid_t)a, (struct timespec *)b);
+			break;
+		case __NR_gettid:
+			if (cos_gettid) return cos_gettid();
+			break;
+		case __NR_sched_yield:
+			if (cos_sched_yield) return cos_sched_yield();
+			break;
+		}
+	}
 
-	if (!cos_syscalls[syscall_num]){
+	if (unlikely((unsigned int)syscall_num >= SYSCALLS_NUM || !cos_syscalls[syscall_num])) {
 		printc("ERROR: Component %ld calling unimplemented system call %d\n", cos_spd_id(), syscall_num);
 		assert(0);
-		return 0;
-	} else {
-		return cos_syscalls[syscall_num](a, b, c, d, e, f);
+		return -ENOSYS;
 	}
+
+	return cos_syscalls[syscall_num](a, b, c, d, e, f);
 }
 
 void
 libc_syscall_override(cos_syscall_t fn, int syscall_num)
 {
-	printc("Overriding syscall %d\n", syscall_num);
+	cos_syscall_t direct;
+
+	assert(syscall_num >= 0 && syscall_num < SYSCALLS_NUM);
+
+	/* Another implementation of a direct call must go through the table */
+	direct = syscall_direct_fn(syscall_num);
+	if (direct && direct != fn) syscalls_direct = 0;
+
 	cos_syscalls[syscall_num] = fn;
 }
 
@@ -1,7 +1,9 @@
+#define _GNU_SOURCE /* MREMAP_MAYMOVE */
 #include <errno.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <syscall.h>
 #include <time.h>
 
@@ -15,7 +17,6 @@
 #include <posix.h>
 #include <ps_list.h>
 #include <memmgr.h>
-#include <contigmem.h>
 
 static struct ps_lock stdout_lock;
 
@@ -81,11 +82,143 @@ cos_brk(void *addr)
 	return 0;
 }
 
+/***
+ * The anonymous mappings are heap pages of the memmgr, that munmap
+ * releases. The ranges of our address space they leave are kept in
+ * `va_free`, sorted and coalesced, and reused by the next mappings
+ * that fit in them (mapped there with memmgr_heap_page_allocn_at),
+ * once the TLBs are quiescent: the kernel doesn't map a removed page
+ * before then. A range that doesn't fit in `va_free` is lost, as
+ * are the ranges the memmgr can't map again.
+ */
+#define VA_FREE_MAX 256
+/*
+ * The mappings of at least as many pages (and without MAP_POPULATE)
+ * are lazy: their pages are only mapped once they are accessed.
+ */
+#define MMAP_LAZY_PAGES 64
+
+struct va_range {
+	vaddr_t  start;
+	size_t   len;
+	cycles_t released;
+};
+
+static struct va_range va_free[VA_FREE_MAX];
+static int             va_free_n;
+static struct ps_lock  va_lock;
+
+static void
+va_range_del(int i)
+{
+	memmove(&va_free[i], &va_free[i + 1], (va_free_n - i - 1) * sizeof(struct va_range));
+	va_free_n--;
+}
+
+/* Insert a range at `i`, if there is room for it */
+static void
+va_range_insert(int i, vaddr_t start, size_t len, cycles_t released)
+{
+	if (va_free_n == VA_FREE_MAX) return;
+
+	memmove(&va_free[i + 1], &va_free[i], (va_free_n - i) * sizeof(struct va_range));
+	va_free[i] = (struct va_range) { .start = start, .len = len, .released = released };
+	va_free_n++;
+}
+
+static void
+va_range_add(vaddr_t start, size_t len, cycles_t released)
+{
+	struct va_range *r;
+	int i;
+
+	ps_lock_take(&va_lock);
+	for (i = 0; i < va_free_n && va_free[i].start < start; i++) ;
+
+	/* Coalesce with the previous and the next ranges: the merged range is quiescent once both are */
+	if (i > 0 && va_free[i - 1].start + va_free[i - 1].len == start) {
+		r = &va_free[i - 1];
+		r->len += len;
+		if (released > r->released) r->released = released;
+		if (i < va_free_n && r->start + r->len == va_free[i].start) {
+			r->len += va_free[i].len;
+			if (va_free[i].released > r->released) r->released = va_free[i].released;
+			va_range_del(i);
+		}
+	} else if (i < va_free_n && start + len == va_free[i].start) {
+		r = &va_free[i];
+		r->start  = start;
+		r->len   += len;
+		if (released > r->released) r->released = released;
+	} else {
+		va_range_insert(i, start, len, released);
+	}
+	ps_lock_release(&va_lock);
+}
+
+/* Take `len` bytes of the first quiescent range they fit in, or return 0 */
+static vaddr_t
+va_range_take(size_t len, cycles_t *released)
+{
+	struct va_range *r;
+	cycles_t now = ps_tsc();
+	vaddr_t  start = 0;
+	int i;
+
+	ps_lock_take(&va_lock);
+	for (i = 0; i < va_free_n; i++) {
+		r = &va_free[i];
+		if (r->len < len || !QUIESCENCE_CHECK(now, r->released, TLB_QUIESCENCE_CYCLES)) continue;
+
+		start      = r->start;
+		*released  = r->released;
+		r->start  += len;
+		r->len    -= len;
+		if (!r->len) va_range_del(i);
+		break;
+	}
+	ps_lock_release(&va_lock);
+
+	return start;
+}
+
+/* Take the range at `start`, if it is free; returns 0 if it isn't */
+static int
+va_range_take_at(vaddr_t start, size_t len, cycles_t *released)
+{
+	struct va_range *r;
+	vaddr_t end;
+	int i, ret = 0;
+
+	ps_lock_take(&va_lock);
+	for (i = 0; i < va_free_n; i++) {
+		r   = &va_free[i];
+		end = r->start + r->len;
+		if (start < r->start || start + len > end) continue;
+
+		*released = r->released;
+		if (start == r->start) {
+			r->start += len;
+			r->len   -= len;
+			if (!r->len) va_range_del(i);
+		} else {
+			r->len = start - r->start;
+			if (start + len < end) va_range_insert(i + 1, start + len, end - start - len, r->released);
+		}
+		ret = 1;
+		break;
+	}
+	ps_lock_release(&va_lock);
+
+	return ret;
+}
+
 void *
 cos_mmap(void *addr, size_t length, int prot, int flags, int fd, off_t offset)
 {
-	void *ret=0;
-	printc("mmap sz:%lu\n", length/1024/1024);
+	unsigned long npages;
+	cycles_t      released;
+	vaddr_t       va;
 
 	if (addr != NULL) {
 		printc("parameter void *addr is not supported!\n");
@@ -97,28 +230,48 @@ cos_mmap(void *addr, size_t length, int prot, int flags, int fd, off_t offset)
 		errno = ENOTSUP;
 		return MAP_FAILED;
 	}
-
-	addr = (void *)contigmem_alloc((length / PAGE_SIZE));
-	if (!addr){
-		ret = (void *) -1;
-	} else {
-		ret = addr;
+	if (length == 0) {
+		errno = EINVAL;
+		return MAP_FAILED;
 	}
 
-	if (ret == (void *)-1) {  /* return value comes from man page */
-		printc("mmap() failed!\n");
+	npages = round_up_to_page(length) / PAGE_SIZE;
+	if (npages >= MMAP_LAZY_PAGES && !(flags & MAP_POPULATE)) {
+		va = memmgr_heap_page_allocn_lazy(npages);
+		goto done;
+	}
+	va = va_range_take(npages * PAGE_SIZE, &released);
+	if (va && memmgr_heap_page_allocn_at(va, npages) != va) {
+		va_range_add(va, npages * PAGE_SIZE, released);
+		va = 0;
+	}
+	if (!va) va = memmgr_heap_page_allocn(npages);
+done:
+	if (!va) {
 		/* This is a best guess about what went wrong */
 		errno = ENOMEM;
+		return MAP_FAILED;
 	}
-	return ret;
+
+	return (void *)va;
 }
 
 int
 cos_munmap(void *start, size_t length)
 {
-	printc("munmap not implemented\n");
-	errno = ENOSYS;
-	return -1;
+	unsigned long npages = round_up_to_page(length) / PAGE_SIZE;
+
+	if ((vaddr_t)start % PAGE_SIZE || !npages) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (memmgr_heap_page_release((vaddr_t)start, npages)) {
+		errno = EINVAL;
+		return -1;
+	}
+	va_range_add((vaddr_t)start, npages * PAGE_SIZE, ps_tsc());
+
+	return 0;
 }
 
 int
@@ -131,9 +284,40 @@ cos_madvise(void *start, size_t length, int advice)
 void *
 cos_mremap(void *old_address, size_t old_size, size_t new_size, int flags)
 {
-	printc("mremap not implemented\n");
-	errno = ENOSYS;
-	return (void*) -1;
+	vaddr_t  old = (vaddr_t)old_address, end;
+	size_t   old_len = round_up_to_page(old_size), new_len = round_up_to_page(new_size);
+	cycles_t released;
+	void    *new;
+	int      taken;
+
+	if (old % PAGE_SIZE || !old_len || !new_len || (flags & ~MREMAP_MAYMOVE)) {
+		errno = EINVAL;
+		return MAP_FAILED;
+	}
+	if (new_len == old_len) return old_address;
+
+	/* Shrink: release the end */
+	if (new_len < old_len) {
+		if (cos_munmap((void *)(old + new_len), old_len - new_len)) return MAP_FAILED;
+		return old_address;
+	}
+
+	/* Grow in place, if the pages after ours are free */
+	end   = old + old_len;
+	taken = va_range_take_at(end, new_len - old_len, &released);
+	if (memmgr_heap_page_allocn_at(end, (new_len - old_len) / PAGE_SIZE) == end) return old_address;
+	if (taken) va_range_add(end, new_len - old_len, released);
+
+	if (!(flags & MREMAP_MAYMOVE)) {
+		errno = ENOMEM;
+		return MAP_FAILED;
+	}
+	new = cos_mmap(NULL, new_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (new == MAP_FAILED) return MAP_FAILED;
+	memcpy(new, old_address, old_len);
+	cos_munmap(old_address, old_len);
+
+	return new;
 }
 
 int
@@ -148,6 +332,7 @@ void
 libc_posixcap_initialization_handler()
 {
 	ps_lock_init(&stdout_lock);
+	ps_lock_init(&va_lock);
 	libc_syscall_override((cos_syscall_t)(void*)cos_write, __NR_write);
 	libc_syscall_override((cos_syscall_t)(void*)cos_writev, __NR_writev);
 	libc_syscall_override((cos_syscall_t)(void*)cos_ioctl, __NR_ioctl);
@@ -0,0 +1,818 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <syscall.h>
+
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+
+#include <cos_component.h>
+#include <llprint.h>
+#include <posix.h>
+#include <ps_list.h>
+#include <netmgr.h>
+#include <netshmem.h>
+
+/***
+ * Sockets, and epoll, emulated over the netmgr, so that ported
+ * software doesn't need to be rewritten against its API. The TCP
+ * sockets are the netmgr's connections (`netmgr_conn_*`), whose calls
+ * don't block, and a thread waiting in accept, recv, send, or
+ * epoll_wait, polls the events of all of its connections (with
+ * `netmgr_poll`), and records them on their sockets. The data is
+ * copied once, between the caller's buffers and the thread's netshmem
+ * buffers, and the netmgr doesn't copy them further. The writes are
+ * batched: a sendmsg, or a sendmmsg, of many buffers is a single
+ * `netmgr_conn_writev`.
+ *
+ * As the netmgr's connections, a socket is only used by the thread
+ * that created, or accepted it. UDP sockets use the netmgr's
+ * per-thread UDP API, so a thread has one, its receives block, and it
+ * can't be in an epoll instance. epoll is level-triggered (EPOLLET is
+ * treated as such, which the programs written for it tolerate), and
+ * its timeouts are either 0, or unbounded.
+ */
+
+#define POSIX_NET_FD_BASE   64
+#define POSIX_NET_MAX_FDS   1024
+#define POSIX_NET_MAX_THDS  64
+#define POSIX_NET_MAX_CONNS 1024
+/* The data of a buffer written, leaving the netmgr's headroom, and the nic's tailroom */
+#define POSIX_NET_BUF_SZ    (PKT_BUF_SIZE - NETSHMEM_HEADROOM - NETSHMEM_TAILROOM)
+
+typedef enum {
+	POSIX_NET_FREE = 0,
+	POSIX_NET_TCP,
+	POSIX_NET_UDP,
+	POSIX_NET_EPOLL,
+} posix_net_type_t;
+
+struct posix_sock {
+	unsigned long      type;
+	thdid_t            thd;
+	/* The netmgr connection, or -1 */
+	int                conn;
+	int                listening, nonblock;
+	struct sockaddr_in addr, peer;
+
+	/* Recorded from the events of the connection */
+	int                readable, hup, wblocked;
+
+	/* The data received, and not read yet */
+	struct netshmem_pkt_buf *rx_obj;
+	u16_t              rx_off, rx_len;
+
+	/* The epoll instance the socket is in, and its registration */
+	int                epfd;
+	struct epoll_event ev;
+	struct ps_list     list;
+
+	/* For an epoll instance, its sockets */
+	struct ps_list_head members;
+};
+
+struct posix_net_thd {
+	int                  init;
+	/* The events polled, and the descriptors of the buffers written, shared with the netmgr */
+	shm_bm_objid_t       evs_id, bufs_id;
+	struct netmgr_event *evs;
+	struct netmgr_buf   *bufs;
+	/* The socket (fd + 1) of each connection of the thread */
+	short                socks[POSIX_NET_MAX_CONNS];
+};
+
+static struct posix_sock    posix_socks[POSIX_NET_MAX_FDS];
+static struct posix_net_thd posix_net_thds[POSIX_NET_MAX_THDS];
+
+static struct posix_net_thd *
+posix_net_thd(void)
+{
+	struct posix_net_thd *t;
+	thdid_t thd = cos_thdid();
+
+	assert(thd < POSIX_NET_MAX_THDS);
+	t = &posix_net_thds[thd];
+	if (unlikely(!t->init)) {
+		/* The thread's buffers, unless the component made them already */
+		if (!netshmem_get_shm()) {
+			netshmem_create();
+			netmgr_shmem_map(netshmem_get_shm_id());
+		}
+		t->evs  = (struct netmgr_event *)netshmem_pkt_buf_alloc(&t->evs_id);
+		t->bufs = (struct netmgr_buf *)netshmem_pkt_buf_alloc(&t->bufs_id);
+		assert(t->evs && t->bufs);
+		t->init = 1;
+	}
+
+	return t;
+}
+
+static struct posix_sock *
+posix_sock_get(int fd, posix_net_type_t type)
+{
+	struct posix_sock *s;
+
+	if (fd < POSIX_NET_FD_BASE || fd >= POSIX_NET_FD_BASE + POSIX_NET_MAX_FDS) return NULL;
+	s = &posix_socks[fd - POSIX_NET_FD_BASE];
+	if (s->type != type || s->thd != cos_thdid()) return NULL;
+
+	return s;
+}
+
+static int
+posix_sock_alloc(posix_net_type_t type)
+{
+	struct posix_sock *s;
+	int i;
+
+	for (i = 0; i < POSIX_NET_MAX_FDS; i++) {
+		s = &posix_socks[i];
+		if (s->type != POSIX_NET_FREE || !ps_cas(&s->type, POSIX_NET_FREE, POSIX_NET_FREE + 1)) continue;
+
+		*s = (struct posix_sock) { .type = type, .thd = cos_thdid(), .conn = -1, .epfd = -1 };
+		ps_list_init(s, list);
+		ps_list_head_init(&s->members);
+
+		return i + POSIX_NET_FD_BASE;
+	}
+
+	return -EMFILE;
+}
+
+static inline int
+posix_sock_fd(struct posix_sock *s)
+{
+	return s - posix_socks + POSIX_NET_FD_BASE;
+}
+
+static void
+posix_sock_conn_set(struct posix_net_thd *t, struct posix_sock *s, int conn)
+{
+	s->conn = conn;
+	t->socks[conn] = posix_sock_fd(s) - POSIX_NET_FD_BASE + 1;
+}
+
+/*
+ * Record the events of the thread's connections on their sockets,
+ * waiting for some if `block`. Returns the number of events.
+ */
+static int
+posix_net_poll(struct posix_net_thd *t, int block)
+{
+	struct netmgr_event e;
+	struct posix_sock  *s;
+	int i, n;
+
+	n = netmgr_poll(t->evs_id, NETMGR_POLL_MAX, block);
+	for (i = 0; i < n; i++) {
+		e = t->evs[i]; /* shared with the netmgr */
+		if (e.conn < 0 || e.conn >= POSIX_NET_MAX_CONNS || !t->socks[e.conn]) continue;
+		s = &posix_socks[t->socks[e.conn] - 1];
+
+		if (e.events & NETMGR_EV_IN)  s->readable = 1;
+		if (e.events & NETMGR_EV_HUP) s->hup = 1;
+		if (e.events & NETMGR_EV_OUT) s->wblocked = 0;
+	}
+
+	return n;
+}
+
+static void
+posix_net_addr_out(const struct sockaddr_in *a, struct sockaddr *addr, socklen_t *len)
+{
+	if (!addr || !len) return;
+	memcpy(addr, a, *len < sizeof(*a) ? *len : sizeof(*a));
+	*len = sizeof(*a);
+}
+
+int
+cos_socket(int domain, int type, int protocol)
+{
+	int fd;
+
+	if (domain != AF_INET) return -EAFNOSUPPORT;
+	switch (type & ~(SOCK_NONBLOCK | SOCK_CLOEXEC)) {
+	case SOCK_STREAM: fd = posix_sock_alloc(POSIX_NET_TCP); break;
+	case SOCK_DGRAM:  fd = posix_sock_alloc(POSIX_NET_UDP); break;
+	default:          return -EPROTONOSUPPORT;
+	}
+	if (fd < 0) return fd;
+
+	posix_net_thd();
+	posix_socks[fd - POSIX_NET_FD_BASE].nonblock = (type & SOCK_NONBLOCK) != 0;
+
+	return fd;
+}
+
+int
+cos_bind(int fd, const struct sockaddr *addr, socklen_t len)
+{
+	struct posix_sock *s = posix_sock_get(fd, POSIX_NET_TCP);
+	const struct sockaddr_in *a = (const struct sockaddr_in *)addr;
+
+	if (!s) s = posix_sock_get(fd, POSIX_NET_UDP);
+	if (!s) return -EBADF;
+	if (len < sizeof(*a) || a->sin_family != AF_INET) return -EINVAL;
+	s->addr = *a;
+
+	/* The netmgr binds UDP immediately, and TCP with the listen */
+	if (s->type == POSIX_NET_UDP) return netmgr_udp_bind(a->sin_addr.s_addr, ntohs(a->sin_port));
+
+	return 0;
+}
+
+int
+cos_listen(int fd, int backlog)
+{
+	struct posix_sock *s = posix_sock_get(fd, POSIX_NET_TCP);
+	int conn;
+
+	if (!s) return -EBADF;
+	if (s->conn >= 0) return -EINVAL;
+
+	conn = netmgr_conn_listen(s->addr.sin_addr.s_addr, ntohs(s->addr.sin_port), backlog > 255 ? 255 : backlog);
+	if (conn < 0) return conn;
+	if (conn >= POSIX_NET_MAX_CONNS) return -ENFILE;
+	posix_sock_conn_set(posix_net_thd(), s, conn);
+	s->listening = 1;
+
+	return 0;
+}
+
+int
+cos_accept4(int fd, struct sockaddr *addr, socklen_t *len, int flags)
+{
+	struct posix_net_thd *t = posix_net_thd();
+	struct posix_sock    *s = posix_sock_get(fd, POSIX_NET_TCP), *n;
+	u32_t ip;
+	u16_t port;
+	int   conn, nfd;
+
+	if (!s) return -EBADF;
+	if (!s->listening) return -EINVAL;
+
+	while ((conn = netmgr_conn_accept(s->conn, &ip, &port)) == -EAGAIN) {
+		s->readable = 0;
+		if (s->nonblock) return -EAGAIN;
+		posix_net_poll(t, 1);
+	}
+	if (conn < 0) return conn;
+
+	nfd = conn < POSIX_NET_MAX_CONNS ? posix_sock_alloc(POSIX_NET_TCP) : -ENFILE;
+	if (nfd < 0) {
+		netmgr_conn_close(conn);
+		return nfd;
+	}
+	n = &posix_socks[nfd - POSIX_NET_FD_BASE];
+	posix_sock_conn_set(t, n, conn);
+	n->nonblock = (flags & SOCK_NONBLOCK) != 0;
+	n->addr     = s->addr;
+	n->peer     = (struct sockaddr_in) {
+		.sin_family = AF_INET,
+		.sin_port   = htons(port),
+		.sin_addr   = { .s_addr = ip },
+	};
+	/* The data received before the accept is reported with the next poll */
+	n->readable = 1;
+	posix_net_addr_out(&n->peer, addr, len);
+
+	return nfd;
+}
+
+int
+cos_accept(int fd, struct sockaddr *addr, socklen_t *len)
+{
+	return cos_accept4(fd, addr, len, 0);
+}
+
+/* Read the next data of the connection into the socket's buffer, if there is some */
+static int
+posix_tcp_fill(struct posix_sock *s)
+{
+	shm_bm_objid_t objid;
+	u16_t off, len;
+
+	objid = netmgr_conn_read(s->conn, &off, &len);
+	if (!objid) {
+		s->readable = 0;
+		return 0;
+	}
+	/* The netmgr hands us the buffer */
+	s->rx_obj = shm_bm_transfer_net_pkt_buf(netshmem_get_shm(), objid);
+	s->rx_off = off;
+	s->rx_len = len;
+
+	return 1;
+}
+
+/* Copy the data received into the iovecs, without blocking. Returns the bytes copied. */
+static size_t
+posix_tcp_read(struct posix_sock *s, const struct iovec *iov, size_t iovcnt)
+{
+	size_t i = 0, off = 0, n, total = 0;
+
+	while (i < iovcnt) {
+		if (off == iov[i].iov_len) {
+			i++;
+			off = 0;
+			continue;
+		}
+		if (!s->rx_obj && !posix_tcp_fill(s)) break;
+
+		n = iov[i].iov_len - off;
+		if (n > s->rx_len) n = s->rx_len;
+		memcpy((char *)iov[i].iov_base + off, s->rx_obj->data + s->rx_off, n);
+		off       += n;
+		total     += n;
+		s->rx_off += n;
+		s->rx_len -= n;
+		if (s->rx_len == 0) {
+			netshmem_pkt_buf_free(s->rx_obj);
+			s->rx_obj = NULL;
+		}
+	}
+
+	return total;
+}
+
+static ssize_t
+posix_tcp_recvmsg(struct posix_net_thd *t, struct posix_sock *s, struct msghdr *msg, int flags)
+{
+	size_t i, len = 0, r;
+
+	for (i = 0; i < msg->msg_iovlen; i++) len += msg->msg_iov[i].iov_len;
+	if (len == 0) return 0;
+
+	while ((r = posix_tcp_read(s, msg->msg_iov, msg->msg_iovlen)) == 0) {
+		/* The end of the stream */
+		if (s->hup) break;
+		if (s->nonblock || (flags & MSG_DONTWAIT)) return -EAGAIN;
+		posix_net_poll(t, 1);
+	}
+	posix_net_addr_out(&s->peer, msg->msg_name, &msg->msg_namelen);
+
+	return r;
+}
+
+static ssize_t
+posix_udp_recvmsg(struct posix_sock *s, struct msghdr *msg)
+{
+	struct netshmem_pkt_buf *obj;
+	struct sockaddr_in       from;
+	shm_bm_objid_t           objid;
+	u16_t  off, len, port;
+	u32_t  ip;
+	size_t i, n, total = 0;
+
+	objid = netmgr_udp_shmem_read(&off, &len, &ip, &port);
+	obj   = shm_bm_transfer_net_pkt_buf(netshmem_get_shm(), objid);
+
+	for (i = 0; i < msg->msg_iovlen && total < len; i++) {
+		n = msg->msg_iov[i].iov_len;
+		if (n > len - total) n = len - total;
+		memcpy(msg->msg_iov[i].iov_base, obj->data + off + total, n);
+		total += n;
+	}
+	if (total < len) msg->msg_flags |= MSG_TRUNC;
+	netshmem_pkt_buf_free(obj);
+
+	from = (struct sockaddr_in) { .sin_family = AF_INET, .sin_port = htons(port), .sin_addr = { .s_addr = ip } };
+	posix_net_addr_out(&from, msg->msg_name, &msg->msg_namelen);
+
+	return total;
+}
+
+ssize_t
+cos_recvmsg(int fd, struct msghdr *msg, int flags)
+{
+	struct posix_sock *s;
+
+	if (flags & MSG_PEEK) return -EOPNOTSUPP;
+	msg->msg_flags = 0;
+	if ((s = posix_sock_get(fd, POSIX_NET_TCP))) return posix_tcp_recvmsg(posix_net_thd(), s, msg, flags);
+	if ((s = posix_sock_get(fd, POSIX_NET_UDP))) return posix_udp_recvmsg(s, msg);
+
+	return -EBADF;
+}
+
+ssize_t
+cos_recvfrom(int fd, void *buf, size_t len, int flags, struct sockaddr *addr, socklen_t *addrlen)
+{
+	struct iovec  iov = { .iov_base = buf, .iov_len = len };
+	struct msghdr msg = { .msg_name = addr, .msg_namelen = addrlen ? *addrlen : 0, .msg_iov = &iov, .msg_iovlen = 1 };
+	ssize_t ret;
+
+	ret = cos_recvmsg(fd, &msg, flags);
+	if (addrlen) *addrlen = msg.msg_namelen;
+
+	return ret;
+}
+
+/*
+ * Receive up to `vlen` messages: the first as recvmsg, and the others
+ * only if they are already there (the UDP receives block, so they
+ * receive one).
+ */
+int
+cos_recvmmsg(int fd, struct mmsghdr *msgs, unsigned int vlen, int flags, struct timespec *timeout)
+{
+	unsigned int i;
+	ssize_t ret;
+
+	for (i = 0; i < vlen; i++) {
+		ret = cos_recvmsg(fd, &msgs[i].msg_hdr, i == 0 ? flags : flags | MSG_DONTWAIT);
+		if (ret <= 0) break;
+		msgs[i].msg_len = ret;
+		if (posix_sock_get(fd, POSIX_NET_UDP)) {
+			i++;
+			break;
+		}
+	}
+	if (i == 0) return ret;
+
+	return i;
+}
+
+/* A position in the data of messages */
+struct posix_net_cur {
+	struct mmsghdr *msgs;
+	unsigned int    vlen, m;
+	size_t          iov, off;
+};
+
+/*
+ * Copy up to `len` bytes at the cursor to `dst` (if not NULL), moving
+ * it, and adding them to the `msg_len` of their messages if `sent`.
+ * Returns the bytes copied.
+ */
+static size_t
+posix_net_cur_copy(struct posix_net_cur *c, char *dst, size_t len, int sent)
+{
+	const struct msghdr *h;
+	size_t done = 0, n;
+
+	while (done < len && c->m < c->vlen) {
+		h = &c->msgs[c->m].msg_hdr;
+		if (c->iov == h->msg_iovlen) {
+			c->m++;
+			c->iov = c->off = 0;
+			continue;
+		}
+		n = h->msg_iov[c->iov].iov_len - c->off;
+		if (n > len - done) n = len - done;
+		if (dst) memcpy(dst + done, (char *)h->msg_iov[c->iov].iov_base + c->off, n);
+		if (sent) c->msgs[c->m].msg_len += n;
+		done   += n;
+		c->off += n;
+		if (c->off == h->msg_iov[c->iov].iov_len) {
+			c->iov++;
+			c->off = 0;
+		}
+	}
+
+	return done;
+}
+
+/*
+ * Write the data of the messages, copied in the thread's buffers, up to
+ * NETMGR_WRITE_MAX buffers per netmgr_conn_writev. Blocks while lwip
+ * has no room, unless the socket doesn't block. Returns the bytes
+ * written.
+ */
+static ssize_t
+posix_tcp_send(struct posix_net_thd *t, struct posix_sock *s, struct mmsghdr *msgs, unsigned int vlen, int flags)
+{
+	struct netshmem_pkt_buf *objs[NETMGR_WRITE_MAX];
+	struct posix_net_cur     c = { .msgs = msgs, .vlen = vlen }, b;
+	shm_bm_objid_t           objid;
+	size_t                   len, batch, total = 0;
+	int                      i, n, w;
+
+	if (s->conn < 0 || s->listening) return -ENOTCONN;
+	for (i = 0; i < (int)vlen; i++) msgs[i].msg_len = 0;
+
+	while (1) {
+		/* Fill a batch of buffers, from a copy of the cursor */
+		b     = c;
+		batch = 0;
+		for (n = 0; n < NETMGR_WRITE_MAX; n++) {
+			objs[n] = netshmem_pkt_buf_alloc(&objid);
+			if (!objs[n]) break;
+			len = posix_net_cur_copy(&b, netshmem_get_data_buf(objs[n]), POSIX_NET_BUF_SZ, 0);
+			if (len == 0) {
+				netshmem_pkt_buf_free(objs[n]);
+				break;
+			}
+			t->bufs[n] = (struct netmgr_buf) { .objid = objid, .data_offset = netshmem_get_data_offset(), .data_len = len };
+			batch += len;
+		}
+		if (batch == 0) {
+			if (n == 0 && b.m < vlen && total == 0) return -ENOBUFS;
+			break;
+		}
+
+		/* The netmgr takes its own references to the buffers */
+		w = netmgr_conn_writev(s->conn, t->bufs_id, n);
+		for (i = 0; i < n; i++) netshmem_pkt_buf_free(objs[i]);
+		if (w < 0) return total ? (ssize_t)total : w;
+		posix_net_cur_copy(&c, NULL, w, 1);
+		total += w;
+		if ((size_t)w == batch) continue;
+
+		/* lwip had no room: the netmgr reports NETMGR_EV_OUT once it has */
+		s->wblocked = 1;
+		if (s->nonblock || (flags & MSG_DONTWAIT)) break;
+		while (s->wblocked && !s->hup) posix_net_poll(t, 1);
+	}
+	if (total == 0 && s->wblocked) return -EAGAIN;
+
+	return total;
+}
+
+static ssize_t
+posix_udp_sendmsg(struct posix_sock *s, struct msghdr *msg)
+{
+	struct mmsghdr            m = { .msg_hdr = *msg };
+	struct posix_net_cur      c = { .msgs = &m, .vlen = 1 };
+	const struct sockaddr_in *to = msg->msg_name;
+	struct netshmem_pkt_buf  *obj;
+	shm_bm_objid_t            objid;
+	size_t i, len = 0;
+
+	if (!to || msg->msg_namelen < sizeof(*to)) return -EDESTADDRREQ;
+	for (i = 0; i < msg->msg_iovlen; i++) len += msg->msg_iov[i].iov_len;
+	if (len > POSIX_NET_BUF_SZ) return -EMSGSIZE;
+
+	obj = netshmem_pkt_buf_alloc(&objid);
+	if (!obj) return -ENOBUFS;
+	posix_net_cur_copy(&c, netshmem_get_data_buf(obj), len, 0);
+	netmgr_udp_shmem_write(objid, netshmem_get_data_offset(), len, to->sin_addr.s_addr, ntohs(to->sin_port));
+	netshmem_pkt_buf_free(obj);
+
+	return len;
+}
+
+ssize_t
+cos_sendmsg(int fd, const struct msghdr *msg, int flags)
+{
+	struct mmsghdr     m = { .msg_hdr = *msg };
+	struct posix_sock *s;
+
+	if ((s = posix_sock_get(fd, POSIX_NET_TCP))) return posix_tcp_send(posix_net_thd(), s, &m, 1, flags);
+	if ((s = posix_sock_get(fd, POSIX_NET_UDP))) return posix_udp_sendmsg(s, &m.msg_hdr);
+
+	return -EBADF;
+}
+
+ssize_t
+cos_sendto(int fd, const void *buf, size_t len, int flags, const struct sockaddr *addr, socklen_t addrlen)
+{
+	struct iovec  iov = { .iov_base = (void *)buf, .iov_len = len };
+	struct msghdr msg = { .msg_name = (void *)addr, .msg_namelen = addrlen, .msg_iov = &iov, .msg_iovlen = 1 };
+
+	return cos_sendmsg(fd, &msg, flags);
+}
+
+/*
+ * Send the messages: on TCP, the data of all of them is written in
+ * batches of NETMGR_WRITE_MAX buffers. Returns the number of messages
+ * sent.
+ */
+int
+cos_sendmmsg(int fd, struct mmsghdr *msgs, unsigned int vlen, int flags)
+{
+	struct posix_sock *s;
+	unsigned int i;
+	size_t j, len;
+	ssize_t ret;
+
+	if ((s = posix_sock_get(fd, POSIX_NET_UDP))) {
+		for (i = 0; i < vlen; i++) {
+			ret = posix_udp_sendmsg(s, &msgs[i].msg_hdr);
+			if (ret < 0) return i ? (int)i : ret;
+			msgs[i].msg_len = ret;
+		}
+		return vlen;
+	}
+	if (!(s = posix_sock_get(fd, POSIX_NET_TCP))) return -EBADF;
+
+	ret = posix_tcp_send(posix_net_thd(), s, msgs, vlen, flags);
+	for (i = 0; i < vlen; i++) {
+		for (j = 0, len = 0; j < msgs[i].msg_hdr.msg_iovlen; j++) len += msgs[i].msg_hdr.msg_iov[j].iov_len;
+		if (msgs[i].msg_len < len) break;
+	}
+	if (i == 0 && ret < 0) return ret;
+
+	return i;
+}
+
+int
+cos_epoll_create1(int flags)
+{
+	return posix_sock_alloc(POSIX_NET_EPOLL);
+}
+
+int
+cos_epoll_create(int size)
+{
+	if (size <= 0) return -EINVAL;
+
+	return cos_epoll_create1(0);
+}
+
+int
+cos_epoll_ctl(int epfd, int op, int fd, struct epoll_event *ev)
+{
+	struct posix_sock *ep = posix_sock_get(epfd, POSIX_NET_EPOLL);
+	struct posix_sock *s  = posix_sock_get(fd, POSIX_NET_TCP);
+
+	if (!ep) return -EBADF;
+	if (!s) return posix_sock_get(fd, POSIX_NET_UDP) ? -EPERM : -EBADF;
+
+	switch (op) {
+	case EPOLL_CTL_ADD:
+		if (s->epfd >= 0) return -EEXIST;
+		s->epfd = epfd;
+		s->ev   = *ev;
+		ps_list_head_append(&ep->members, s, list);
+		break;
+	case EPOLL_CTL_MOD:
+		if (s->epfd != epfd) return -ENOENT;
+		s->ev = *ev;
+		break;
+	case EPOLL_CTL_DEL:
+		if (s->epfd != epfd) return -ENOENT;
+		ps_list_rem(s, list);
+		s->epfd = -1;
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+static u32_t
+posix_sock_revents(struct posix_sock *s)
+{
+	u32_t r = 0;
+
+	if (s->conn < 0) return EPOLLHUP;
+	if (s->readable || s->rx_obj || s->hup) r |= EPOLLIN;
+	if (!s->listening && !s->wblocked)      r |= EPOLLOUT;
+	if (s->hup)                             r |= EPOLLHUP | EPOLLRDHUP;
+
+	return r;
+}
+
+int
+cos_epoll_wait(int epfd, struct epoll_event *events, int maxevents, int timeout)
+{
+	struct posix_net_thd *t  = posix_net_thd();
+	struct posix_sock    *ep = posix_sock_get(epfd, POSIX_NET_EPOLL), *s, *tmp;
+	struct ps_list_head   reported;
+	u32_t r;
+	int   n = 0;
+
+	if (!ep) return -EBADF;
+	if (maxevents <= 0) return -EINVAL;
+
+	while (1) {
+		/* Record all of the events that arrived */
+		while (posix_net_poll(t, 0) == NETMGR_POLL_MAX) ;
+
+		/* The sockets reported go to the end of the list, so that the others get their turn */
+		ps_list_head_init(&reported);
+		ps_list_foreach_del(&ep->members, s, tmp, list) {
+			if (n == maxevents) break;
+			r = posix_sock_revents(s) & (s->ev.events | EPOLLHUP | EPOLLERR);
+			if (!r) continue;
+
+			events[n++] = (struct epoll_event) { .events = r, .data = s->ev.data };
+			if (s->ev.events & EPOLLONESHOT) s->ev.events = 0;
+			ps_list_rem(s, list);
+			ps_list_head_append(&reported, s, list);
+		}
+		ps_list_foreach_del(&reported, s, tmp, list) {
+			ps_list_rem(s, list);
+			ps_list_head_append(&ep->members, s, list);
+		}
+		if (n > 0 || timeout == 0) return n;
+
+		posix_net_poll(t, 1);
+	}
+}
+
+int
+cos_epoll_pwait(int epfd, struct epoll_event *events, int maxevents, int timeout, const void *sigmask)
+{
+	return cos_epoll_wait(epfd, events, maxevents, timeout);
+}
+
+int
+cos_close(int fd)
+{
+	struct posix_sock *s, *m, *tmp;
+
+	if (!(s = posix_sock_get(fd, POSIX_NET_TCP)) && !(s = posix_sock_get(fd, POSIX_NET_UDP)) &&
+	    !(s = posix_sock_get(fd, POSIX_NET_EPOLL))) {
+		return -EBADF;
+	}
+
+	if (s->type == POSIX_NET_EPOLL) {
+		ps_list_foreach_del(&s->members, m, tmp, list) {
+			ps_list_rem(m, list);
+			m->epfd = -1;
+		}
+	}
+	if (s->epfd >= 0) ps_list_rem(s, list);
+	if (s->rx_obj) netshmem_pkt_buf_free(s->rx_obj);
+	if (s->conn >= 0) {
+		posix_net_thds[s->thd].socks[s->conn] = 0;
+		netmgr_conn_close(s->conn);
+	}
+	/* The netmgr can't unbind UDP: the thread's binding remains */
+	ps_store(&s->type, POSIX_NET_FREE);
+
+	return 0;
+}
+
+int
+cos_fcntl(int fd, int cmd, long arg)
+{
+	struct posix_sock *s = posix_sock_get(fd, POSIX_NET_TCP);
+
+	if (!s) s = posix_sock_get(fd, POSIX_NET_UDP);
+	if (!s) return -EBADF;
+
+	switch (cmd) {
+	case F_GETFL: return O_RDWR | (s->nonblock ? O_NONBLOCK : 0);
+	case F_SETFL: s->nonblock = (arg & O_NONBLOCK) != 0; return 0;
+	case F_GETFD:
+	case F_SETFD: return 0;
+	default:      return -EINVAL;
+	}
+}
+
+/* The netmgr's connections have their options set (e.g. TCP_NODELAY), so they are ignored */
+int
+cos_setsockopt(int fd, int level, int name, const void *val, socklen_t len)
+{
+	if (!posix_sock_get(fd, POSIX_NET_TCP) && !posix_sock_get(fd, POSIX_NET_UDP)) return -EBADF;
+
+	return 0;
+}
+
+int
+cos_getsockname(int fd, struct sockaddr *addr, socklen_t *len)
+{
+	struct posix_sock *s = posix_sock_get(fd, POSIX_NET_TCP);
+
+	if (!s) s = posix_sock_get(fd, POSIX_NET_UDP);
+	if (!s) return -EBADF;
+	posix_net_addr_out(&s->addr, addr, len);
+
+	return 0;
+}
+
+int
+cos_getpeername(int fd, struct sockaddr *addr, socklen_t *len)
+{
+	struct posix_sock *s = posix_sock_get(fd, POSIX_NET_TCP);
+
+	if (!s) return -EBADF;
+	if (s->conn < 0 || s->listening) return -ENOTCONN;
+	posix_net_addr_out(&s->peer, addr, len);
+
+	return 0;
+}
+
+void
+libc_posixnet_initialization_handler()
+{
+	libc_syscall_override((cos_syscall_t)(void*)cos_socket, __NR_socket);
+	libc_syscall_override((cos_syscall_t)(void*)cos_bind, __NR_bind);
+	libc_syscall_override((cos_syscall_t)(void*)cos_listen, __NR_listen);
+	libc_syscall_override((cos_syscall_t)(void*)cos_accept, __NR_accept);
+	libc_syscall_override((cos_syscall_t)(void*)cos_accept4, __NR_accept4);
+	libc_syscall_override((cos_syscall_t)(void*)cos_recvfrom, __NR_recvfrom);
+	libc_syscall_override((cos_syscall_t)(void*)cos_recvmsg, __NR_recvmsg);
+	libc_syscall_override((cos_syscall_t)(void*)cos_recvmmsg, __NR_recvmmsg);
+	libc_syscall_override((cos_syscall_t)(void*)cos_sendto, __NR_sendto);
+	libc_syscall_override((cos_syscall_t)(void*)cos_sendmsg, __NR_sendmsg);
+	libc_syscall_override((cos_syscall_t)(void*)cos_sendmmsg, __NR_sendmmsg);
+	libc_syscall_override((cos_syscall_t)(void*)cos_epoll_create, __NR_epoll_create);
+	libc_syscall_override((cos_syscall_t)(void*)cos_epoll_create1, __NR_epoll_create1);
+	libc_syscall_override((cos_syscall_t)(void*)cos_epoll_ctl, __NR_epoll_ctl);
+	libc_syscall_override((cos_syscall_t)(void*)cos_epoll_wait, __NR_epoll_wait);
+	libc_syscall_override((cos_syscall_t)(void*)cos_epoll_pwait, __NR_epoll_pwait);
+	libc_syscall_override((cos_syscall_t)(void*)cos_close, __NR_close);
+	libc_syscall_override((cos_syscall_t)(void*)cos_fcntl, __NR_fcntl);
+	libc_syscall_override((cos_syscall_t)(void*)cos_setsockopt, __NR_setsockopt);
+	libc_syscall_override((cos_syscall_t)(void*)cos_getsockname, __NR_getsockname);
+	libc_syscall_override((cos_syscall_t)(void*)cos_getpeername, __NR_getpeername);
+}
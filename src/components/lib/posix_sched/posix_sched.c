@@ -2,6 +2,7 @@
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <syscall.h>
 #include <time.h>
 
@@ -15,6 +16,9 @@
 #include <posix.h>
 #include <ps_list.h>
 #include <sched.h>
+#include <memmgr.h>
+#include <sync_lock.h>
+#include <cos_time.h>
 
 static volatile int* null_ptr = NULL;
 #define ABORT() do {int i = *null_ptr;} while(0)
@@ -35,6 +39,15 @@ cos_gettid(void)
 	return (pid_t) cos_thdid();
 }
 
+int
+cos_sched_yield(void)
+{
+	/* The schedulers yield to the threads of the same priority */
+	sched_thd_yield_to(cos_thdid());
+
+	return 0;
+}
+
 int
 cos_tkill(int tid, int sig)
 {
@@ -148,89 +161,602 @@ cos_clone(int (*func)(void *), void *stack, int flags, void *arg, pid_t *ptid, v
 #define FUTEX_UNLOCK_PI		7
 #define FUTEX_TRYLOCK_PI	8
 #define FUTEX_WAIT_BITSET	9
+#define FUTEX_WAKE_BITSET	10
 
 #define FUTEX_PRIVATE 128
 
 #define FUTEX_CLOCK_REALTIME 256
 
-struct futex_data
-{
-	int *uaddr;
+#define FUTEX_CMD_MASK ~(FUTEX_PRIVATE | FUTEX_CLOCK_REALTIME)
+
+/* The PI futex word: the owner's tid, and if there may be waiters */
+#define FUTEX_WAITERS  0x80000000
+#define FUTEX_TID_MASK 0x3fffffff
+
+#define FUTEX_BITSET_MATCH_ANY 0xffffffff
+
+/***
+ * The futexes are in a hash table of buckets, each with its own lock
+ * protecting the waiters of the futexes that hash to it, so threads
+ * only contend on the futexes they share (and their collisions).
+ * Waiters are woken explicitly (across cores, through the scheduler),
+ * so `FUTEX_WAKE` wakes at most the requested number of threads, and
+ * `FUTEX_REQUEUE` moves waiters between futexes without waking them
+ * (avoiding the thundering herd of condition-variable broadcasts).
+ *
+ * PI futexes hold the owner's tid, and are waited for on the bucket's
+ * blockpoint with the owner as the dependency, so that the owner
+ * inherits the priority of the waiters (see `sync_blkpt_wait_dep`).
+ */
+#define FUTEX_BUCKETS_ORDER 6
+#define FUTEX_BUCKETS       (1 << FUTEX_BUCKETS_ORDER)
+/* The number of waiters woken per acquisition of a bucket's lock */
+#define FUTEX_WAKE_BATCH    16
+
+struct futex_bucket {
+	struct sync_lock    lock;
 	struct ps_list_head waiters;
-};
+	struct sync_blkpt   pi;
+} CACHE_ALIGNED;
 
-struct futex_waiter
-{
+struct futex_waiter {
 	thdid_t thdid;
+	int *uaddr;		/* changes if the waiter is requeued */
+	u32_t bitset;
+	int woken;		/* set when removed by a waker */
 	struct ps_list list;
 };
 
-#define FUTEX_COUNT 20
-struct futex_data futexes[FUTEX_COUNT];
+static struct futex_bucket futexes[FUTEX_BUCKETS];
 
-struct futex_data *
-lookup_futex(int *uaddr)
+/* The futex words are 32 bits, thus not `ps_cas`-able */
+static inline int
+futex_cas(int *uaddr, int old, int new)
+{
+	return __sync_bool_compare_and_swap(uaddr, old, new);
+}
+
+static inline struct futex_bucket *
+futex_bucket(int *uaddr)
+{
+	/* Fibonacci hashing of the word address */
+	unsigned long h = ((unsigned long)uaddr >> 2) * 0x9E3779B97F4A7C15ULL;
+
+	return &futexes[h >> (sizeof(unsigned long) * 8 - FUTEX_BUCKETS_ORDER)];
+}
+
+/* Lock the two buckets in a consistent order, to avoid deadlock */
+static void
+futex_lock_two(struct futex_bucket *b1, struct futex_bucket *b2)
+{
+	if (b1 > b2) {
+		struct futex_bucket *t = b1;
+
+		b1 = b2;
+		b2 = t;
+	}
+	sync_lock_take(&b1->lock);
+	if (b1 != b2) sync_lock_take(&b2->lock);
+}
+
+static void
+futex_unlock_two(struct futex_bucket *b1, struct futex_bucket *b2)
+{
+	if (b1 != b2) sync_lock_release(&b2->lock);
+	sync_lock_release(&b1->lock);
+}
+
+/*
+ * Remove up to `n` waiters on `uaddr` (matching `bitset`) from the
+ * bucket, and save their tids in `thds` to wake them once the lock is
+ * released (they cannot be accessed once `woken` is set).
+ */
+static int
+futex_dequeue(struct futex_bucket *b, int *uaddr, u32_t bitset, int n, thdid_t *thds)
+{
+	struct futex_waiter *w, *t;
+	int i = 0;
+
+	ps_list_foreach_del(&b->waiters, w, t, list) {
+		if (i == n) break;
+		if (w->uaddr != uaddr || !(w->bitset & bitset)) continue;
+
+		ps_list_rem(w, list);
+		thds[i++] = w->thdid;
+		ps_store(&w->woken, 1);
+	}
+
+	return i;
+}
+
+static inline int
+futex_batch(int n)
+{
+	return n < FUTEX_WAKE_BATCH ? n : FUTEX_WAKE_BATCH;
+}
+
+static void
+futex_wakeup(thdid_t *thds, int n)
 {
-	int last_free = -1;
 	int i;
 
-	for (i = 0; i < FUTEX_COUNT; i++) {
-		if (futexes[i].uaddr == uaddr) {
-			return &futexes[i];
-		} else if (futexes[i].uaddr == 0) {
-			last_free = i;
+	for (i = 0; i < n; i++) sched_thd_wakeup(thds[i]);
+}
+
+static int
+futex_wait(int *uaddr, int val, u32_t bitset, cycles_t timeout)
+{
+	struct futex_bucket *b = futex_bucket(uaddr);
+	struct futex_waiter w = {
+		.thdid = cos_thdid(),
+		.uaddr = uaddr,
+		.bitset = bitset,
+		.woken = 0,
+	};
+
+	if (bitset == 0) return -EINVAL;
+
+	sync_lock_take(&b->lock);
+	/* Wakers update the futex before taking the lock, so we can't miss their wakeup */
+	if (ps_load(uaddr) != val) {
+		sync_lock_release(&b->lock);
+		return -EAGAIN;
+	}
+	ps_list_init(&w, list);
+	ps_list_head_append(&b->waiters, &w, list);
+	sync_lock_release(&b->lock);
+
+	while (!ps_load(&w.woken)) {
+		if (timeout == 0) {
+			sched_thd_block(0);
+			continue;
+		}
+		if (cycles_greater_than(timeout, time_now())) {
+			sched_thd_block_timeout(0, timeout);
+			continue;
+		}
+
+		/* Timed out: remove ourself, unless a waker just did so */
+		while (1) {
+			b = futex_bucket(ps_load(&w.uaddr));
+			sync_lock_take(&b->lock);
+			if (b == futex_bucket(w.uaddr)) break;
+			/* requeued in the mean time */
+			sync_lock_release(&b->lock);
+		}
+		if (!w.woken) {
+			ps_list_rem(&w, list);
+			sync_lock_release(&b->lock);
+			return -ETIMEDOUT;
 		}
+		sync_lock_release(&b->lock);
 	}
-	if (last_free >= 0) {
-		futexes[last_free] = (struct futex_data) {
-			.uaddr = uaddr
-		};
-		ps_list_head_init(&futexes[last_free].waiters);
-		return &futexes[last_free];
+
+	return 0;
+}
+
+static int
+futex_wake(int *uaddr, int n, u32_t bitset)
+{
+	struct futex_bucket *b = futex_bucket(uaddr);
+	thdid_t thds[FUTEX_WAKE_BATCH];
+	int woken = 0, batch;
+
+	if (bitset == 0) return -EINVAL;
+
+	while (woken < n) {
+		sync_lock_take(&b->lock);
+		batch = futex_dequeue(b, uaddr, bitset, futex_batch(n - woken), thds);
+		sync_lock_release(&b->lock);
+		futex_wakeup(thds, batch);
+
+		woken += batch;
+		if (batch < FUTEX_WAKE_BATCH) break;
 	}
-	printc("Out of futex ids!");
-	assert(0);
+
+	return woken;
+}
+
+/*
+ * Wake `nwake` waiters on `uaddr`, and move up to `nrequeue` of the
+ * others to wait on `uaddr2`. If `cmp`, only if `*uaddr == val3`.
+ */
+static int
+futex_requeue(int *uaddr, int nwake, int nrequeue, int *uaddr2, int cmp, int val3)
+{
+	struct futex_bucket *b1 = futex_bucket(uaddr), *b2 = futex_bucket(uaddr2);
+	struct futex_waiter *w, *t;
+	thdid_t thds[FUTEX_WAKE_BATCH];
+	int woken, requeued = 0;
+
+	if (nwake < 0 || nrequeue < 0) return -EINVAL;
+
+	futex_lock_two(b1, b2);
+	if (cmp && ps_load(uaddr) != val3) {
+		futex_unlock_two(b1, b2);
+		return -EAGAIN;
+	}
+	woken = futex_dequeue(b1, uaddr, FUTEX_BITSET_MATCH_ANY, futex_batch(nwake), thds);
+	ps_list_foreach_del(&b1->waiters, w, t, list) {
+		if (requeued == nrequeue) break;
+		if (w->uaddr != uaddr) continue;
+
+		ps_store(&w->uaddr, uaddr2);
+		if (b1 != b2) {
+			ps_list_rem(w, list);
+			ps_list_head_append(&b2->waiters, w, list);
+		}
+		requeued++;
+	}
+	futex_unlock_two(b1, b2);
+	futex_wakeup(thds, woken);
+	if (woken < nwake && woken == FUTEX_WAKE_BATCH) woken += futex_wake(uaddr, nwake - woken, FUTEX_BITSET_MATCH_ANY);
+
+	return woken + requeued;
+}
+
+/* Decode and execute the operation of `FUTEX_WAKE_OP` on `*uaddr` */
+static int
+futex_atomic_op(int *uaddr, int encoded, int *oldval)
+{
+	int op     = (encoded >> 28) & 7;
+	int oparg  = (encoded << 8) >> 20;
+	int old, new;
+
+	if ((encoded >> 28) & 8) oparg = 1 << oparg; /* FUTEX_OP_OPARG_SHIFT */
+
+	do {
+		old = ps_load(uaddr);
+		switch (op) {
+		case 0: new = oparg;        break; /* FUTEX_OP_SET */
+		case 1: new = old + oparg;  break; /* FUTEX_OP_ADD */
+		case 2: new = old | oparg;  break; /* FUTEX_OP_OR */
+		case 3: new = old & ~oparg; break; /* FUTEX_OP_ANDN */
+		case 4: new = old ^ oparg;  break; /* FUTEX_OP_XOR */
+		default: return -ENOSYS;
+		}
+	} while (!futex_cas(uaddr, old, new));
+	*oldval = old;
+
+	return 0;
+}
+
+static int
+futex_atomic_cmp(int encoded, int oldval)
+{
+	int cmp    = (encoded >> 24) & 15;
+	int cmparg = (encoded << 20) >> 20;
+
+	switch (cmp) {
+	case 0: return oldval == cmparg; /* FUTEX_OP_CMP_EQ */
+	case 1: return oldval != cmparg; /* FUTEX_OP_CMP_NE */
+	case 2: return oldval <  cmparg; /* FUTEX_OP_CMP_LT */
+	case 3: return oldval <= cmparg; /* FUTEX_OP_CMP_LE */
+	case 4: return oldval >  cmparg; /* FUTEX_OP_CMP_GT */
+	case 5: return oldval >= cmparg; /* FUTEX_OP_CMP_GE */
+	default: return -ENOSYS;
+	}
+}
+
+static int
+futex_wake_op(int *uaddr, int nwake, int nwake2, int *uaddr2, int encoded)
+{
+	struct futex_bucket *b1 = futex_bucket(uaddr), *b2 = futex_bucket(uaddr2);
+	thdid_t thds[FUTEX_WAKE_BATCH], thds2[FUTEX_WAKE_BATCH];
+	int woken, woken2 = 0, oldval, ret;
+
+	futex_lock_two(b1, b2);
+	ret = futex_atomic_op(uaddr2, encoded, &oldval);
+	if (ret) {
+		futex_unlock_two(b1, b2);
+		return ret;
+	}
+	woken = futex_dequeue(b1, uaddr, FUTEX_BITSET_MATCH_ANY, futex_batch(nwake), thds);
+	ret   = futex_atomic_cmp(encoded, oldval);
+	if (ret > 0) woken2 = futex_dequeue(b2, uaddr2, FUTEX_BITSET_MATCH_ANY, futex_batch(nwake2), thds2);
+	futex_unlock_two(b1, b2);
+	futex_wakeup(thds, woken);
+	futex_wakeup(thds2, woken2);
+	/* The waiters beyond the first batch are woken after the operation */
+	if (woken < nwake && woken == FUTEX_WAKE_BATCH) woken += futex_wake(uaddr, nwake - woken, FUTEX_BITSET_MATCH_ANY);
+	if (woken2 < nwake2 && woken2 == FUTEX_WAKE_BATCH) woken2 += futex_wake(uaddr2, nwake2 - woken2, FUTEX_BITSET_MATCH_ANY);
+
+	return ret < 0 ? ret : woken + woken2;
+}
+
+/*
+ * Take the PI futex for the current thread, or return `1` if it is
+ * owned. Keep the waiters bit, as other threads can still be waiting.
+ */
+static inline int
+futex_pi_try_take(int *uaddr, int *owner)
+{
+	int v = ps_load(uaddr);
+
+	*owner = v & FUTEX_TID_MASK;
+	if (*owner != 0) return 1;
+
+	return !futex_cas(uaddr, v, (v & FUTEX_WAITERS) | (int)cos_thdid());
+}
+
+static int
+futex_lock_pi(int *uaddr, int try, cycles_t timeout)
+{
+	struct futex_bucket *b = futex_bucket(uaddr);
+	struct sync_blkpt_checkpoint chkpt;
+	int v, owner;
+
+	while (1) {
+		sync_blkpt_checkpoint(&b->pi, &chkpt);
+
+		if (!futex_pi_try_take(uaddr, &owner)) return 0;
+		if (owner == 0) continue;
+		if (owner == (int)cos_thdid()) return -EDEADLK;
+		if (try) return -EBUSY;
+		/* Timeouts are only approximated: we recheck after each wakeup */
+		if (timeout && !cycles_greater_than(timeout, time_now())) return -ETIMEDOUT;
+
+		/* Make the owner unlock through the kernel, thus wake us */
+		v = ps_load(uaddr);
+		if ((v & FUTEX_TID_MASK) != owner) continue;
+		if (!(v & FUTEX_WAITERS) && !futex_cas(uaddr, v, v | FUTEX_WAITERS)) continue;
+		if (sync_blkpt_blocking(&b->pi, 0, &chkpt)) continue;
+		if ((ps_load(uaddr) & FUTEX_TID_MASK) != owner) continue;
+
+		/* The owner inherits our priority while we wait */
+		sync_blkpt_wait_dep(&b->pi, 0, &chkpt, owner);
+	}
+}
+
+static int
+futex_unlock_pi(int *uaddr)
+{
+	struct futex_bucket *b = futex_bucket(uaddr);
+
+	if ((ps_load(uaddr) & FUTEX_TID_MASK) != (int)cos_thdid()) return -EPERM;
+	/* The waiters race to take the futex, in priority order */
+	ps_store(uaddr, 0);
+	sync_blkpt_trigger(&b->pi, 0);
+
+	return 0;
 }
 
-/* TODO: Cleanup empty futexes */
-static struct ps_lock futex_lock;
+/***
+ * The clocks are read without invocations, as with a vDSO: from the
+ * kernel's clock page (see `struct cos_time_page`), and for the
+ * threads' CPU time, the kernel's accounting table (`struct
+ * cos_thd_acct`), both mapped on the first read. The monotonic clock
+ * is the time since boot, and without the clock page (or before the
+ * kernel calibrated it), it is computed with the scheduler's cycles
+ * per microsecond (as `time_now_usec`), and the wall-clock time is
+ * unknown (the epoch).
+ */
+#define NSEC_PER_SEC 1000000000ULL
+
+static struct cos_time_page *clock_page;
+static struct cos_thd_acct  *clock_acct;
+static int                   clock_mapped;
+
+static void
+clock_map(void)
+{
+	if (likely(ps_load(&clock_mapped))) return;
+
+	/* Racing threads map the pages again, at another address */
+	clock_page = (struct cos_time_page *)memmgr_time_map();
+	clock_acct = (struct cos_thd_acct *)memmgr_thd_acct_map();
+	ps_store(&clock_mapped, 1);
+}
+
+/* Copy the clock page, or return -1 if the clock isn't calibrated */
+static int
+clock_snapshot(struct cos_time_page *snap)
+{
+	struct cos_time_page *p;
+	u32_t                 seq;
+
+	clock_map();
+	p = clock_page;
+	if (!p) return -1;
+
+	/* seqlock read side: retry if the kernel updated the page while we copied it */
+	do {
+		seq = ps_load(&p->seq);
+		ps_mem_fence();
+		*snap = *p;
+		ps_mem_fence();
+	} while ((seq & 1) || seq != ps_load(&p->seq));
+
+	return snap->mult ? 0 : -1;
+}
+
+static u64_t
+clock_cyc2ns(struct cos_time_page *t, int calibrated, cycles_t cyc)
+{
+	if (!calibrated) return time_cyc2usec(cyc) * 1000;
+
+	return cos_time_cyc2ns(cyc, t->mult, t->shift);
+}
+
+/* The cycles the invoking thread executed, or -1 without accounting */
+static s64_t
+clock_thd_cycles(void)
+{
+	struct cos_thd_acct *a, acct;
+	thdid_t              tid = cos_thdid();
+	u32_t                seq;
+	cycles_t             now;
+
+	clock_map();
+	if (!clock_acct || tid > MAX_NUM_THREADS) return -1;
+	a = &clock_acct[tid];
+
+	do {
+		seq = ps_load(&a->seq);
+		ps_mem_fence();
+		acct = *a;
+		ps_mem_fence();
+	} while ((seq & 1) || seq != ps_load(&a->seq));
+	now = time_now();
+
+	/* We're running: add the cycles since the kernel last accounted them */
+	return acct.cycles + (now > acct.since ? now - acct.since : 0);
+}
+
+/* The time of the clock, in nanoseconds, or -EINVAL for the unsupported clocks */
+static int
+clock_ns(clockid_t clock_id, u64_t *ns)
+{
+	struct cos_time_page t;
+	int                  calibrated = clock_snapshot(&t) == 0;
+	s64_t                cyc;
+
+	switch (clock_id) {
+	case CLOCK_REALTIME:
+	case CLOCK_REALTIME_COARSE:
+		*ns = clock_cyc2ns(&t, calibrated, time_now()) + (calibrated ? t.realtime_ns : 0);
+		break;
+	case CLOCK_MONOTONIC:
+	case CLOCK_MONOTONIC_RAW:
+	case CLOCK_MONOTONIC_COARSE:
+	case CLOCK_BOOTTIME:
+		*ns = clock_cyc2ns(&t, calibrated, time_now());
+		break;
+	case CLOCK_THREAD_CPUTIME_ID:
+		cyc = clock_thd_cycles();
+		if (cyc < 0) return -EINVAL;
+		*ns = clock_cyc2ns(&t, calibrated, cyc);
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+/* When t expires, in cycles: t is relative, or a time of clock_id if absolute */
+static inline cycles_t
+futex_timeout(const struct timespec *t, int absolute, clockid_t clock_id)
+{
+	u64_t now, until;
+
+	if (!t) return 0;
+	if (!absolute) return time_now() + time_usec2cyc(time_to_microsec(t));
+
+	until = (u64_t)t->tv_sec * NSEC_PER_SEC + t->tv_nsec;
+	if (clock_ns(clock_id, &now) || until <= now) return time_now();
+
+	return time_now() + time_usec2cyc((until - now) / 1000);
+}
 
 int
 cos_futex(int *uaddr, int op, int val,
           const struct timespec *timeout, /* or: uint32_t val2 */
 		  int *uaddr2, int val3)
 {
-	printc("futex not implemented\n");
-	errno = ENOSYS;
-	return -1;
+	int val2 = (int)(long)timeout;
+	int ret;
+
+	switch (op & FUTEX_CMD_MASK) {
+	case FUTEX_WAIT:
+		ret = futex_wait(uaddr, val, FUTEX_BITSET_MATCH_ANY, futex_timeout(timeout, 0, CLOCK_MONOTONIC));
+		break;
+	case FUTEX_WAIT_BITSET:
+		ret = futex_wait(uaddr, val, val3,
+		                 futex_timeout(timeout, 1, op & FUTEX_CLOCK_REALTIME ? CLOCK_REALTIME : CLOCK_MONOTONIC));
+		break;
+	case FUTEX_WAKE:
+		ret = futex_wake(uaddr, val, FUTEX_BITSET_MATCH_ANY);
+		break;
+	case FUTEX_WAKE_BITSET:
+		ret = futex_wake(uaddr, val, val3);
+		break;
+	case FUTEX_REQUEUE:
+		ret = futex_requeue(uaddr, val, val2, uaddr2, 0, 0);
+		break;
+	case FUTEX_CMP_REQUEUE:
+		ret = futex_requeue(uaddr, val, val2, uaddr2, 1, val3);
+		break;
+	case FUTEX_WAKE_OP:
+		ret = futex_wake_op(uaddr, val, val2, uaddr2, val3);
+		break;
+	case FUTEX_LOCK_PI:
+		/* As Linux, the timeout is of CLOCK_REALTIME */
+		ret = futex_lock_pi(uaddr, 0, futex_timeout(timeout, 1, CLOCK_REALTIME));
+		break;
+	case FUTEX_TRYLOCK_PI:
+		ret = futex_lock_pi(uaddr, 1, 0);
+		break;
+	case FUTEX_UNLOCK_PI:
+		ret = futex_unlock_pi(uaddr);
+		break;
+	default:
+		printc("futex op %d not implemented\n", op);
+		ret = -ENOSYS;
+	}
+
+	if (ret < 0) {
+		errno = -ret;
+		return -1;
+	}
+
+	return ret;
 }
 
 int
 cos_clock_gettime(clockid_t clock_id, struct timespec *ts)
 {
-	switch (clock_id)
-	{
-	case CLOCK_REALTIME:
-		/* code */
-		ts->tv_sec = 3600; //one hour after 1970-01-01, just a hack.
-		break;
-	
-	default:
-		break;
+	u64_t ns;
+	int   ret;
+
+	ret = clock_ns(clock_id, &ns);
+	if (ret) {
+		errno = -ret;
+		return -1;
 	}
+	ts->tv_sec  = ns / NSEC_PER_SEC;
+	ts->tv_nsec = ns % NSEC_PER_SEC;
 
 	return 0;
 }
 
-/* TODO: init tls when creating components */
+/*
+ * Each thread's TLS, PER_THD_TLS_MEM_SZ bytes with the thread pointer
+ * at their top, pointing to itself. The initial thread of each core
+ * uses static memory, and the others' is allocated as they start,
+ * then reused (zeroed) by the later threads with the same id.
+ */
 #define PER_THD_TLS_MEM_SZ 8192
-static char tls_space[NUM_CPU][PER_THD_TLS_MEM_SZ] = {0};
+static char  tls_space[NUM_CPU][PER_THD_TLS_MEM_SZ] = {0};
+static int   tls_core_used[NUM_CPU];
+static char *tls_thds[MAX_NUM_THREADS + 1];
 
+static char *
+tls_alloc(unsigned int cpuid)
+{
+	thdid_t tid = cos_thdid();
+
+	if (!tls_core_used[cpuid]) {
+		tls_core_used[cpuid] = 1;
+		return tls_space[cpuid];
+	}
+	assert(tid <= MAX_NUM_THREADS);
+	if (tls_thds[tid]) {
+		memset(tls_thds[tid], 0, PER_THD_TLS_MEM_SZ);
+	} else {
+		tls_thds[tid] = (char *)memmgr_heap_page_allocn(PER_THD_TLS_MEM_SZ / PAGE_SIZE);
+		if (!tls_thds[tid]) BUG();
+	}
+
+	return tls_thds[tid];
+}
+
+/* Called as each thread starts, serialized with the others */
 void
 libc_tls_init(unsigned int cpuid)
 {
 	/* NOTE: GCC uses tls space similar to a stack, memory is accessed from high address to low address */
-	vaddr_t* tls_addr	= (vaddr_t *)((char *)&tls_space[cpuid] + PER_THD_TLS_MEM_SZ - sizeof(vaddr_t));
+	vaddr_t* tls_addr	= (vaddr_t *)(tls_alloc(cpuid) + PER_THD_TLS_MEM_SZ - sizeof(vaddr_t));
 	*tls_addr		= (vaddr_t)tls_addr;
 
 	sched_set_tls((void*)tls_addr);
@@ -239,10 +765,16 @@ libc_tls_init(unsigned int cpuid)
 void
 libc_posixsched_initialization_handler()
 {
-	ps_lock_init(&futex_lock);
+	int i;
+
+	for (i = 0; i < FUTEX_BUCKETS; i++) {
+		if (sync_lock_init(&futexes[i].lock) || sync_blkpt_init(&futexes[i].pi)) BUG();
+		ps_list_head_init(&futexes[i].waiters);
+	}
 	libc_syscall_override((cos_syscall_t)(void*)cos_nanosleep, __NR_nanosleep);
 	libc_syscall_override((cos_syscall_t)(void*)cos_rt_sigprocmask, __NR_rt_sigprocmask);
 	libc_syscall_override((cos_syscall_t)(void*)cos_gettid, __NR_gettid);
+	libc_syscall_override((cos_syscall_t)(void*)cos_sched_yield, __NR_sched_yield);
 	libc_syscall_override((cos_syscall_t)(void*)cos_tkill, __NR_tkill);
 	libc_syscall_override((cos_syscall_t)(void*)cos_set_thread_area, __NR_set_thread_area);
 	libc_syscall_override((cos_syscall_t)(void*)cos_set_tid_address, __NR_set_tid_address);
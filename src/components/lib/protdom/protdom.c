@@ -37,7 +37,7 @@
 #define PROTDOM_VAS_NUM_NAMES 		256
 #define PROTDOM_MPK_NUM_NAMES 		14
 #define PROTDOM_MPK_FIRST_COMP		2
-#define PROTDOM_ASID_NUM_NAMES 		4096
+#define PROTDOM_ASID_NUM_NAMES 		2048
 
 #define PROTDOM_NS_STATE_RESERVED 	1
 #define PROTDOM_NS_STATE_ALLOCATED 	1 << 1
@@ -107,6 +107,8 @@ protdom_ns_asids_init(struct protdom_ns_asid *asids)
 		/* set reserved = 1, allocated = 0 */
 		asids->names[i].state = PROTDOM_NS_STATE_RESERVED;
 	}
+	/* ASID 0 asks the kernel to pick a PCID from its own pool */
+	asids->names[0].state = 0;
 
 	asids->parent = NULL;
 
@@ -180,6 +182,8 @@ protdom_ns_asid_alloc(struct protdom_ns_asid *asids)
 	prot_domain_t pd;
 
 	asid = protdom_asid_available_name(asids);
+	/* out of names: let the kernel allocate the ASID */
+	if (asid < 0) return PROTDOM_INIT(0, 0);
 	asids->names[asid].state |= PROTDOM_NS_STATE_ALLOCATED;
 
 	return PROTDOM_INIT(asid, 0);
@@ -5,7 +5,8 @@
 #define PROTDOM_VAS_NAME_SZ 	(1ULL << 39)
 #define PROTDOM_VAS_NUM_NAMES 	256
 #define PROTDOM_MPK_NUM_NAMES 	14
-#define PROTDOM_ASID_NUM_NAMES 	4096
+/* the upper half of the 4096 PCIDs is the kernel's pool */
+#define PROTDOM_ASID_NUM_NAMES 	2048
 
 #define PROTDOM_NS_STATE_RESERVED 	1
 #define PROTDOM_NS_STATE_ALLOCATED 1 << 1
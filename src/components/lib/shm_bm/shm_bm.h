@@ -6,6 +6,7 @@
 #include <limits.h>
 #include <consts.h>
 #include <string.h>
+#include <bitmap.h>
 
 /**
  * This library provides a slab-like memory allocator interface to allocate fixed-size
@@ -27,39 +28,55 @@
 typedef void *        shm_bm_t;
 typedef unsigned int  shm_bm_objid_t;
 
-#define SHM_BM_REFC(shm, nobj) ((unsigned char *)((unsigned char *)shm + SHM_BM_BITS_TO_WORDS(nobj) * sizeof (word_t)))
-#define SHM_BM_DATA(shm, nobj) ((unsigned char *)(SHM_BM_REFC(shm, nobj) + (unsigned int)nobj))
+/*
+ * The free objects are cached in a magazine per core, in the shared
+ * memory, refilled from the bitmap, and drained to it, in batches, so
+ * the allocations and frees of a core usually only touch its own
+ * cache lines. A thread uses the magazine of its core only if no other
+ * thread is using it (as the threads of a core can preempt each other,
+ * in any of the components sharing the memory), and the bitmap
+ * otherwise. The allocations that find the bitmap empty take the
+ * objects in the magazines of the other cores.
+ */
+#define SHM_BM_MAG_SZ    28
+#define SHM_BM_MAG_BATCH (SHM_BM_MAG_SZ / 2)
+
+struct shm_bm_mag {
+	unsigned long  busy;
+	unsigned long  n;
+	shm_bm_objid_t ids[SHM_BM_MAG_SZ];
+} __attribute__((aligned(CACHE_LINE)));
+
+/*
+ * The layout: the bitmap, the magazines, the refcnts, and the data,
+ * each starting on a cache line. The refcnts of the objects of a word
+ * of the bitmap, that are allocated together, share a cache line, and
+ * not the others'.
+ */
+#define SHM_BM_BITMAP_SZ(nobj) round_up_to_pow2(SHM_BM_BITS_TO_WORDS(nobj) * sizeof (word_t), CACHE_LINE)
+#define SHM_BM_MAGS(shm, nobj) ((struct shm_bm_mag *)((unsigned char *)shm + SHM_BM_BITMAP_SZ(nobj)))
+#define SHM_BM_REFC(shm, nobj) ((unsigned char *)(SHM_BM_MAGS(shm, nobj) + NUM_CPU))
+#define SHM_BM_DATA(shm, nobj) ((unsigned char *)(SHM_BM_REFC(shm, nobj) + round_up_to_pow2((unsigned int)nobj, CACHE_LINE)))
 
 static inline void
 __shm_bm_set_contig(word_t *bm, int offset)
 {
-	int i, n, ind;
+	int n, ind;
 
 	ind = offset / SHM_BM_BITMAP_BLOCK;
 	offset %= SHM_BM_BITMAP_BLOCK;
 
-	for (i = 0; i < ind; i++) {
-		bm[i] = ~0x0ul;
-	}
+	memset(bm, 0xff, ind * sizeof(word_t));
 
 	n = SHM_BM_BITMAP_BLOCK - offset;
 	bm[ind] = ~((1ul << n) - 1); // set most sig n bits of bm[ind]
 }
 
-/* Find the first nonzero word in the inputted bitmap */
+/* Find the first nonzero word in the inputted bitmap, 256 bits at a time; -1 if all bits are zero */
 static inline int
 __shm_bm_next_free_word(word_t *bm, unsigned long nwords)
 {
-	/* the index of the word in the bitmap where the first set bit is found */
-	int idx;
-
-	for (idx = 0; idx < (int) nwords; idx++) {
-		if (*bm != 0) return idx;
-		bm++;
-	}
-
-	/* all bits set to zero */
-	return -1;
+	return bitmap_long_nonzero(bm, (int)nwords);
 }
 
 static inline size_t
@@ -67,8 +84,8 @@ __shm_bm_size(size_t objsz, unsigned int nobj)
 {
 	size_t bitmap_sz, refcnt_sz, data_sz;
 
-	bitmap_sz = SHM_BM_BITS_TO_WORDS(nobj) * sizeof(word_t);
-	refcnt_sz = nobj;
+	bitmap_sz = SHM_BM_BITMAP_SZ(nobj) + NUM_CPU * sizeof(struct shm_bm_mag);
+	refcnt_sz = round_up_to_pow2(nobj, CACHE_LINE);
 	data_sz   = nobj * objsz;
 
 	return bitmap_sz + refcnt_sz + data_sz;
@@ -90,11 +107,12 @@ __shm_bm_init(shm_bm_t shm, size_t objsz, unsigned int nobj)
 	__shm_bm_set_contig((word_t *)shm, nobj);
 }
 
-static inline void * 
-__shm_bm_alloc(shm_bm_t shm, shm_bm_objid_t *objid, size_t objsz, unsigned int nobj)
+/* Allocate an object from the bitmap; returns its id, or -1 if there is none */
+static inline int
+__shm_bm_bitmap_alloc(shm_bm_t shm, unsigned int nobj)
 {
-	int     freebit, idx , offset, lz;
-	word_t  word; 
+	int     idx, offset, lz;
+	word_t  word;
 	word_t *bm;
 
 	/* 
@@ -106,18 +124,153 @@ __shm_bm_alloc(shm_bm_t shm, shm_bm_objid_t *objid, size_t objsz, unsigned int n
 	bm = (word_t *)shm;
 	do {
 		idx = __shm_bm_next_free_word(bm, SHM_BM_BITS_TO_WORDS(nobj));
-		if (unlikely(idx == -1)) return NULL;
+		if (unlikely(idx == -1)) return -1;
 		word   = bm[idx];
 		lz     = __builtin_clzl(word); 
 		offset = SHM_BM_BITMAP_BLOCK - lz - 1;
 	} while (!cos_cas(bm + idx, word, word & ~(1ul << offset)));
 
-	freebit = lz + (idx * SHM_BM_BITMAP_BLOCK);
+	return lz + (idx * SHM_BM_BITMAP_BLOCK);
+}
+
+/* Mark the object as free in the bitmap */
+static inline void
+__shm_bm_bitmap_release(shm_bm_t shm, shm_bm_objid_t objid)
+{
+	unsigned int bm_idx, bm_offset;
+	word_t      *bm, word;
+
+	bm         = (word_t *)shm;
+	bm_idx     = objid / SHM_BM_BITMAP_BLOCK;
+	bm_offset  = SHM_BM_BITMAP_BLOCK - objid % SHM_BM_BITMAP_BLOCK - 1;
+	/* The word is shared with concurrent allocations, that clear other bits */
+	do {
+		word = bm[bm_idx];
+	} while (!cos_cas(bm + bm_idx, word, word | (1ul << bm_offset)));
+}
+
+/*
+ * Mark the `n` objects (at most a word's bits) as free in the bitmap,
+ * with one update of each word of theirs: the objects released
+ * together were usually allocated together, from the same word.
+ */
+static inline void
+__shm_bm_bitmap_release_n(shm_bm_t shm, const shm_bm_objid_t *objids, int n)
+{
+	unsigned long done = 0;
+	unsigned int  bm_idx;
+	word_t       *bm = (word_t *)shm, word, bits;
+	int           i, j;
+
+	for (i = 0; i < n; i++) {
+		if (done & (1ul << i)) continue;
+		bm_idx = objids[i] / SHM_BM_BITMAP_BLOCK;
+		bits   = 0;
+		for (j = i; j < n; j++) {
+			if (objids[j] / SHM_BM_BITMAP_BLOCK != bm_idx) continue;
+			bits |= 1ul << (SHM_BM_BITMAP_BLOCK - objids[j] % SHM_BM_BITMAP_BLOCK - 1);
+			done |= 1ul << j;
+		}
+		do {
+			word = bm[bm_idx];
+		} while (!cos_cas(bm + bm_idx, word, word | bits));
+	}
+}
+
+/* The magazine of `core`, if no other thread is using it */
+static inline struct shm_bm_mag *
+__shm_bm_mag_get(shm_bm_t shm, unsigned int nobj, int core)
+{
+	struct shm_bm_mag *m = SHM_BM_MAGS(shm, nobj) + core;
+
+	if (*(volatile unsigned long *)&m->busy || !cos_cas(&m->busy, 0, 1)) return NULL;
+
+	return m;
+}
+
+static inline void
+__shm_bm_mag_put(struct shm_bm_mag *m)
+{
+	/* The stores are ordered on x86, so only the compiler must not reorder them */
+	asm volatile("" ::: "memory");
+	m->busy = 0;
+}
+
+/* Move up to SHM_BM_MAG_BATCH objects of a word of the bitmap into the (empty) magazine */
+static inline void
+__shm_bm_mag_refill(shm_bm_t shm, struct shm_bm_mag *m, unsigned int nobj)
+{
+	word_t *bm = (word_t *)shm, word, take, rest;
+	int     idx, b, k;
+
+	do {
+		idx = __shm_bm_next_free_word(bm, SHM_BM_BITS_TO_WORDS(nobj));
+		if (unlikely(idx == -1)) return;
+		word = bm[idx];
+		/* The first objects of the word are its most significant bits */
+		take = 0;
+		rest = word;
+		for (k = 0; k < SHM_BM_MAG_BATCH && rest; k++) {
+			b     = SHM_BM_BITMAP_BLOCK - 1 - __builtin_clzl(rest);
+			take |= 1ul << b;
+			rest &= ~(1ul << b);
+		}
+	} while (!cos_cas(bm + idx, word, word & ~take));
+
+	/* The last objects first, so the first are allocated first */
+	while (take) {
+		b     = __builtin_ctzl(take);
+		take &= take - 1;
+		m->ids[m->n++] = idx * SHM_BM_BITMAP_BLOCK + (SHM_BM_BITMAP_BLOCK - 1 - b);
+	}
+}
+
+/* Move the older half of the (full) magazine's objects to the bitmap */
+static inline void
+__shm_bm_mag_drain(shm_bm_t shm, struct shm_bm_mag *m)
+{
+	__shm_bm_bitmap_release_n(shm, m->ids, SHM_BM_MAG_BATCH);
+	memmove(m->ids, m->ids + SHM_BM_MAG_BATCH, (m->n - SHM_BM_MAG_BATCH) * sizeof(shm_bm_objid_t));
+	m->n -= SHM_BM_MAG_BATCH;
+}
+
+/* Take an object of the magazine of any core; returns its id, or -1 */
+static inline int
+__shm_bm_mag_steal(shm_bm_t shm, unsigned int nobj)
+{
+	struct shm_bm_mag *m;
+	int                core, id = -1;
+
+	for (core = 0; core < NUM_CPU && id < 0; core++) {
+		m = __shm_bm_mag_get(shm, nobj, core);
+		if (!m) continue;
+		if (m->n) id = m->ids[--m->n];
+		__shm_bm_mag_put(m);
+	}
+
+	return id;
+}
 
-	cos_faab(SHM_BM_REFC(shm, nobj) + freebit, 1);
+static inline void * 
+__shm_bm_alloc(shm_bm_t shm, shm_bm_objid_t *objid, size_t objsz, unsigned int nobj)
+{
+	struct shm_bm_mag *m;
+	int                id = -1;
+
+	m = __shm_bm_mag_get(shm, nobj, cos_cpuid());
+	if (likely(m)) {
+		if (unlikely(!m->n)) __shm_bm_mag_refill(shm, m, nobj);
+		if (likely(m->n)) id = m->ids[--m->n];
+		__shm_bm_mag_put(m);
+	}
+	if (unlikely(id < 0)) id = __shm_bm_bitmap_alloc(shm, nobj);
+	if (unlikely(id < 0)) id = __shm_bm_mag_steal(shm, nobj);
+	if (unlikely(id < 0)) return NULL;
+
+	cos_faab(SHM_BM_REFC(shm, nobj) + id, 1);
 
-	*objid = (shm_bm_objid_t)freebit;
-	return SHM_BM_DATA(shm, nobj) + (freebit * objsz);
+	*objid = (shm_bm_objid_t)id;
+	return SHM_BM_DATA(shm, nobj) + (id * objsz);
 }
 
 static inline void *   
@@ -144,43 +297,194 @@ __shm_bm_take_norefcnt(shm_bm_t shm, shm_bm_objid_t objid, size_t objsz, unsigne
 	return SHM_BM_DATA(shm, nobj) + (objid * objsz);
 }
 
-static void
-__shm_bm_ptr_free(void *ptr, size_t objsz, unsigned int nobj)
+/* Free the object, whose last reference was dropped, into our core's magazine */
+static inline void
+__shm_bm_release(shm_bm_t shm, shm_bm_objid_t objid, unsigned int nobj)
 {
-	void        *shm;
-	unsigned int obj_idx, bm_idx, bm_offset;
-	word_t      *bm;
+	struct shm_bm_mag *m;
 
-	/* Mask out bits less significant than the alignment to get pointer to head of shm */
-	shm = (void *)((word_t)ptr & ~(SHM_BM_ALIGN - 1));
-	obj_idx = ((unsigned char *)ptr - SHM_BM_DATA(shm, nobj)) / objsz;
-	if (obj_idx >= nobj) return;
-	
-	if (cos_faab(SHM_BM_REFC(shm, nobj) + obj_idx, -1) > 1) { 
+	if (unlikely(objid >= nobj)) return;
+
+	m = __shm_bm_mag_get(shm, nobj, cos_cpuid());
+	if (unlikely(!m)) {
+		__shm_bm_bitmap_release(shm, objid);
 		return;
 	}
+	if (unlikely(m->n == SHM_BM_MAG_SZ)) __shm_bm_mag_drain(shm, m);
+	m->ids[m->n++] = objid;
+	__shm_bm_mag_put(m);
+}
+
+/* Mask out bits less significant than the alignment to get pointer to head of shm */
+#define SHM_BM_HEAD(ptr) ((shm_bm_t)((word_t)(ptr) & ~(word_t)(SHM_BM_ALIGN - 1)))
+
+/*
+ * Drop a reference to the object, of the region at `shm`. Returns 1
+ * if it was the last, in which case the object stays allocated, for
+ * the caller to reuse it (__shm_bm_reuse), or to release it
+ * (__shm_bm_release).
+ */
+static inline int
+__shm_bm_ptr_put_in(shm_bm_t shm, void *ptr, size_t objsz, unsigned int nobj)
+{
+	unsigned int obj_idx;
+
+	obj_idx = ((unsigned char *)ptr - SHM_BM_DATA(shm, nobj)) / objsz;
+	if (obj_idx >= nobj) return 0;
+
+	return cos_faab(SHM_BM_REFC(shm, nobj) + obj_idx, -1) == 1;
+}
+
+static inline int
+__shm_bm_ptr_put(void *ptr, size_t objsz, unsigned int nobj)
+{
+	return __shm_bm_ptr_put_in(SHM_BM_HEAD(ptr), ptr, objsz, nobj);
+}
+
+/* Allocate the object whose last reference the caller dropped with __shm_bm_ptr_put */
+static inline void *
+__shm_bm_reuse(shm_bm_t shm, shm_bm_objid_t objid, size_t objsz, unsigned int nobj)
+{
+	if (unlikely(objid >= nobj)) return NULL;
+
+	cos_faab(SHM_BM_REFC(shm, nobj) + objid, 1);
+
+	return SHM_BM_DATA(shm, nobj) + (objid * objsz);
+}
+
+static inline void
+__shm_bm_ptr_free_in(shm_bm_t shm, void *ptr, size_t objsz, unsigned int nobj)
+{
+	if (!__shm_bm_ptr_put_in(shm, ptr, objsz, nobj)) return;
+
 	/* droping the last reference, must set obj to free in bitmap */
-	bm         = (word_t *)shm;
-	bm_idx     = obj_idx / SHM_BM_BITMAP_BLOCK;
-	bm_offset  = SHM_BM_BITMAP_BLOCK - obj_idx % SHM_BM_BITMAP_BLOCK - 1;
-	bm[bm_idx] = bm[bm_idx] | (1ul << bm_offset);
+	__shm_bm_release(shm, ((unsigned char *)ptr - SHM_BM_DATA(shm, nobj)) / objsz, nobj);
 }
 
-static shm_bm_objid_t
-__shm_bm_get_objid(void *ptr, size_t objsz, unsigned int nobj)
+static void
+__shm_bm_ptr_free(void *ptr, size_t objsz, unsigned int nobj)
+{
+	__shm_bm_ptr_free_in(SHM_BM_HEAD(ptr), ptr, objsz, nobj);
+}
+
+/* The number of references to the object; it is free if `0` */
+static inline unsigned int
+__shm_bm_refcnt(shm_bm_t shm, shm_bm_objid_t objid, unsigned int nobj)
+{
+	if (unlikely(objid >= nobj)) return 0;
+
+	return *(volatile unsigned char *)(SHM_BM_REFC(shm, nobj) + objid);
+}
+
+static inline shm_bm_objid_t
+__shm_bm_get_objid_in(shm_bm_t shm, void *ptr, size_t objsz, unsigned int nobj)
 {
-	void        *shm;
-	unsigned int obj_idx, bm_idx, bm_offset;
-	word_t      *bm;
+	unsigned int obj_idx;
 
-	/* Mask out bits less significant than the alignment to get pointer to head of shm */
-	shm = (void *)((word_t)ptr & ~(SHM_BM_ALIGN - 1));
 	obj_idx = ((unsigned char *)ptr - SHM_BM_DATA(shm, nobj)) / objsz;
 	assert (obj_idx <= nobj);
 
 	return obj_idx;
 }
 
+static shm_bm_objid_t
+__shm_bm_get_objid(void *ptr, size_t objsz, unsigned int nobj)
+{
+	return __shm_bm_get_objid_in(SHM_BM_HEAD(ptr), ptr, objsz, nobj);
+}
+
+/*
+ * The batched operations, on the objects of a burst (e.g. of packets
+ * handed from a component to the next). The refcnts of the objects
+ * are prefetched in a first pass, so their misses overlap rather than
+ * stall each object in turn, and the objects whose last reference is
+ * dropped are released together: with one use of the core's magazine,
+ * or, if it is busy, with one update of each word of the bitmap.
+ */
+
+/* Take (or only check, if !`ref`) the `n` objects; objs[i] is NULL if objids[i] is invalid */
+static inline int
+__shm_bm_take_n(shm_bm_t shm, const shm_bm_objid_t *objids, void **objs, int n, size_t objsz, unsigned int nobj,
+                int ref)
+{
+	unsigned char *refc = SHM_BM_REFC(shm, nobj);
+	int            i, taken = 0;
+
+	for (i = 0; i < n; i++) {
+		if (unlikely(objids[i] >= nobj)) continue;
+		/* Only prefetch the cache-line for writing if we write it */
+		if (ref) __builtin_prefetch(refc + objids[i], 1);
+		else     __builtin_prefetch(refc + objids[i]);
+	}
+	for (i = 0; i < n; i++) {
+		objs[i] = NULL;
+		/* obj has not been allocated */
+		if (unlikely(objids[i] >= nobj || refc[objids[i]] == 0)) continue;
+		if (ref) cos_faab(refc + objids[i], 1);
+		objs[i] = SHM_BM_DATA(shm, nobj) + (objids[i] * objsz);
+		taken++;
+	}
+
+	return taken;
+}
+
+/* Free the objects, whose last reference was dropped, into our core's magazine */
+static inline void
+__shm_bm_release_n(shm_bm_t shm, const shm_bm_objid_t *objids, int n, unsigned int nobj)
+{
+	struct shm_bm_mag *m;
+	int                i;
+
+	m = __shm_bm_mag_get(shm, nobj, cos_cpuid());
+	if (unlikely(!m)) {
+		__shm_bm_bitmap_release_n(shm, objids, n);
+		return;
+	}
+	for (i = 0; i < n; i++) {
+		if (unlikely(m->n == SHM_BM_MAG_SZ)) __shm_bm_mag_drain(shm, m);
+		m->ids[m->n++] = objids[i];
+	}
+	__shm_bm_mag_put(m);
+}
+
+/* Drop a reference to each of the `n` objects of the region at `shm`; the NULL ones are skipped */
+static inline void
+__shm_bm_ptr_free_n_in(shm_bm_t shm, void **objs, int n, size_t objsz, unsigned int nobj)
+{
+	unsigned char *refc = SHM_BM_REFC(shm, nobj);
+	shm_bm_objid_t freed[SHM_BM_MAG_SZ];
+	unsigned int   obj_idx;
+	int            i, nfreed = 0;
+
+	for (i = 0; i < n; i++) {
+		if (!objs[i]) continue;
+		obj_idx = ((unsigned char *)objs[i] - SHM_BM_DATA(shm, nobj)) / objsz;
+		if (likely(obj_idx < nobj)) __builtin_prefetch(refc + obj_idx, 1);
+	}
+	for (i = 0; i < n; i++) {
+		if (!objs[i]) continue;
+		obj_idx = ((unsigned char *)objs[i] - SHM_BM_DATA(shm, nobj)) / objsz;
+		if (unlikely(obj_idx >= nobj) || cos_faab(refc + obj_idx, -1) != 1) continue;
+
+		freed[nfreed++] = obj_idx;
+		if (nfreed == SHM_BM_MAG_SZ) {
+			__shm_bm_release_n(shm, freed, nfreed, nobj);
+			nfreed = 0;
+		}
+	}
+	if (nfreed) __shm_bm_release_n(shm, freed, nfreed, nobj);
+}
+
+/* The objects must all be of the region of the first that isn't NULL */
+static inline void
+__shm_bm_ptr_free_n(void **objs, int n, size_t objsz, unsigned int nobj)
+{
+	int i;
+
+	for (i = 0; i < n && !objs[i]; i++) ;
+	if (i < n) __shm_bm_ptr_free_n_in(SHM_BM_HEAD(objs[i]), objs + i, n - i, objsz, nobj);
+}
+
 
 #define __SHM_BM_DEFINE_FCNS(name)                                                          \
     static inline size_t   shm_bm_size_##name(void);                                        \
@@ -190,7 +494,18 @@ __shm_bm_get_objid(void *ptr, size_t objsz, unsigned int nobj)
     static inline void *   shm_bm_take_##name(shm_bm_t shm, shm_bm_objid_t objid);          \
     static inline void *   shm_bm_borrow_##name(shm_bm_t shm, shm_bm_objid_t objid);        \
     static inline void *   shm_bm_transfer_##name(shm_bm_t shm, shm_bm_objid_t objid);      \
-    static inline void     shm_bm_free_##name(void *ptr);                                                                                         
+    static inline void     shm_bm_free_##name(void *ptr);                                   \
+    static inline int      shm_bm_put_##name(void *ptr);                                    \
+    static inline void *   shm_bm_reuse_##name(shm_bm_t shm, shm_bm_objid_t objid);         \
+    static inline void     shm_bm_release_##name(shm_bm_t shm, shm_bm_objid_t objid);       \
+    static inline unsigned int shm_bm_refcnt_##name(shm_bm_t shm, shm_bm_objid_t objid);  \
+    static inline size_t   shm_bm_objsz_##name(void);                                       \
+    static inline void     shm_bm_free_in_##name(shm_bm_t shm, void *ptr);                  \
+    static inline int      shm_bm_put_in_##name(shm_bm_t shm, void *ptr);                   \
+    static inline shm_bm_objid_t shm_bm_get_objid_in_##name(shm_bm_t shm, void *ptr);      \
+    static inline int      shm_bm_take_n_##name(shm_bm_t shm, const shm_bm_objid_t *objids, void **objs, int n); \
+    static inline int      shm_bm_transfer_n_##name(shm_bm_t shm, const shm_bm_objid_t *objids, void **objs, int n); \
+    static inline void     shm_bm_free_n_##name(void **objs, int n);
 
 #define __SHM_BM_CREATE_FCNS(name, objsz, nobjs)                                            \
     static inline size_t                                                                    \
@@ -233,14 +548,251 @@ __shm_bm_get_objid(void *ptr, size_t objsz, unsigned int nobj)
     {                                                                                       \
         __shm_bm_ptr_free(ptr, objsz, nobjs);                                               \
     }                                                                                       \
+    static inline int                                                                       \
+    shm_bm_put_##name(void *ptr)                                                            \
+    {                                                                                       \
+        return __shm_bm_ptr_put(ptr, objsz, nobjs);                                         \
+    }                                                                                       \
+    static inline void *                                                                    \
+    shm_bm_reuse_##name(shm_bm_t shm, shm_bm_objid_t objid)                                 \
+    {                                                                                       \
+        return __shm_bm_reuse(shm, objid, objsz, nobjs);                                    \
+    }                                                                                       \
+    static inline void                                                                      \
+    shm_bm_release_##name(shm_bm_t shm, shm_bm_objid_t objid)                               \
+    {                                                                                       \
+        __shm_bm_release(shm, objid, nobjs);                                                \
+    }                                                                                       \
     static inline shm_bm_objid_t                                                            \
     shm_bm_get_objid_##name(void *ptr)                                                      \
     {                                                                                       \
         return __shm_bm_get_objid(ptr, objsz, nobjs);                                              \
+    }                                                                                       \
+    static inline unsigned int                                                              \
+    shm_bm_refcnt_##name(shm_bm_t shm, shm_bm_objid_t objid)                                \
+    {                                                                                       \
+        return __shm_bm_refcnt(shm, objid, nobjs);                                          \
+    }                                                                                       \
+    static inline size_t                                                                    \
+    shm_bm_objsz_##name(void)                                                               \
+    {                                                                                       \
+        return objsz;                                                                       \
+    }                                                                                       \
+    static inline void                                                                      \
+    shm_bm_free_in_##name(shm_bm_t shm, void *ptr)                                          \
+    {                                                                                       \
+        __shm_bm_ptr_free_in(shm, ptr, objsz, nobjs);                                       \
+    }                                                                                       \
+    static inline int                                                                       \
+    shm_bm_put_in_##name(shm_bm_t shm, void *ptr)                                           \
+    {                                                                                       \
+        return __shm_bm_ptr_put_in(shm, ptr, objsz, nobjs);                                 \
+    }                                                                                       \
+    static inline shm_bm_objid_t                                                            \
+    shm_bm_get_objid_in_##name(shm_bm_t shm, void *ptr)                                     \
+    {                                                                                       \
+        return __shm_bm_get_objid_in(shm, ptr, objsz, nobjs);                               \
+    }                                                                                       \
+    static inline int                                                                       \
+    shm_bm_take_n_##name(shm_bm_t shm, const shm_bm_objid_t *objids, void **objs, int n)    \
+    {                                                                                       \
+        return __shm_bm_take_n(shm, objids, objs, n, objsz, nobjs, 1);                      \
+    }                                                                                       \
+    static inline int                                                                       \
+    shm_bm_transfer_n_##name(shm_bm_t shm, const shm_bm_objid_t *objids, void **objs, int n) \
+    {                                                                                       \
+        return __shm_bm_take_n(shm, objids, objs, n, objsz, nobjs, 0);                      \
+    }                                                                                       \
+    static inline void                                                                      \
+    shm_bm_free_n_##name(void **objs, int n)                                                \
+    {                                                                                       \
+        __shm_bm_ptr_free_n(objs, n, objsz, nobjs);                                         \
     }
 
 #define SHM_BM_INTERFACE_CREATE(name, objsz, nobjs)                                         \
     __SHM_BM_DEFINE_FCNS(name)                                                              \
     __SHM_BM_CREATE_FCNS(name, objsz, nobjs) 
 
+/*
+ * Regions of several size classes: a region holds the region of each
+ * class, of a single-class interface (SHM_BM_INTERFACE_CREATE), at
+ * the start of the page after the previous class' region, so the
+ * operations on the objects of a class are those of its interface,
+ * specialized for its size. The classes are an X-macro list of the
+ * single-class interfaces, by increasing object size, whose entries
+ * are given the name of the multi-class interface:
+ *
+ *     #define NET_PKT_CLASSES(X, n) X(n, 0, net_pkt_s) X(n, 1, net_pkt_m) X(n, 2, net_pkt_l)
+ *     SHM_BM_MC_INTERFACE_CREATE(net_pkt, NET_PKT_CLASSES)
+ *
+ * The whole region must fit in SHM_BM_ALIGN, so the head of the region
+ * of an object is its address, masked. The id of an object is its
+ * class (from SHM_BM_MC_CLS_SHIFT) and its id in its class.
+ */
+#define SHM_BM_MC_CLS_SHIFT      24
+#define SHM_BM_MC_OBJID(cls, id) (((shm_bm_objid_t)(cls) << SHM_BM_MC_CLS_SHIFT) | (shm_bm_objid_t)(id))
+#define SHM_BM_MC_CLS(objid)     ((unsigned int)(objid) >> SHM_BM_MC_CLS_SHIFT)
+#define SHM_BM_MC_ID(objid)      ((objid) & ((1U << SHM_BM_MC_CLS_SHIFT) - 1))
+
+#define __SHM_BM_MC_SUB(n, shm, i) ((shm_bm_t)((unsigned char *)(shm) + __shm_bm_mc_off_##n(i)))
+
+#define __SHM_BM_MC_SZ(n, i, c)     round_up_to_page(shm_bm_size_##c()),
+#define __SHM_BM_MC_INIT(n, i, c)   shm_bm_init_##c(__SHM_BM_MC_SUB(n, shm, i));
+#define __SHM_BM_MC_CLS_OF(n, i, c) if (off < __shm_bm_mc_off_##n((i) + 1)) return i;
+#define __SHM_BM_MC_ALLOC(n, i, c)                                                          \
+    if (sz <= shm_bm_objsz_##c()) {                                                         \
+        o = shm_bm_alloc_##c(__SHM_BM_MC_SUB(n, shm, i), &id);                              \
+        if (o) {                                                                            \
+            *objid = SHM_BM_MC_OBJID(i, id);                                                \
+            return o;                                                                       \
+        }                                                                                   \
+    }
+#define __SHM_BM_MC_TAKE(n, i, c)     case i: return shm_bm_take_##c(__SHM_BM_MC_SUB(n, shm, i), SHM_BM_MC_ID(objid));
+#define __SHM_BM_MC_BORROW(n, i, c)   case i: return shm_bm_borrow_##c(__SHM_BM_MC_SUB(n, shm, i), SHM_BM_MC_ID(objid));
+#define __SHM_BM_MC_REUSE(n, i, c)    case i: return shm_bm_reuse_##c(__SHM_BM_MC_SUB(n, shm, i), SHM_BM_MC_ID(objid));
+#define __SHM_BM_MC_RELEASE(n, i, c)  case i: shm_bm_release_##c(__SHM_BM_MC_SUB(n, shm, i), SHM_BM_MC_ID(objid)); return;
+#define __SHM_BM_MC_REFCNT(n, i, c)   case i: return shm_bm_refcnt_##c(__SHM_BM_MC_SUB(n, shm, i), SHM_BM_MC_ID(objid));
+#define __SHM_BM_MC_OBJSZ(n, i, c)    case i: return shm_bm_objsz_##c();
+#define __SHM_BM_MC_FREE(n, i, c)     case i: shm_bm_free_in_##c(__SHM_BM_MC_SUB(n, shm, i), ptr); return;
+#define __SHM_BM_MC_PUT(n, i, c)      case i: return shm_bm_put_in_##c(__SHM_BM_MC_SUB(n, shm, i), ptr);
+#define __SHM_BM_MC_GET_OBJID(n, i, c)                                                      \
+    case i: return SHM_BM_MC_OBJID(i, shm_bm_get_objid_in_##c(__SHM_BM_MC_SUB(n, shm, i), ptr));
+
+#define SHM_BM_MC_INTERFACE_CREATE(name, classes)                                           \
+    /* The offset of the region of class `cls`, or the size of the regions before it */     \
+    static inline size_t                                                                    \
+    __shm_bm_mc_off_##name(unsigned int cls)                                                \
+    {                                                                                       \
+        size_t       szs[] = { classes(__SHM_BM_MC_SZ, name) }, off = 0;                    \
+        unsigned int i;                                                                     \
+                                                                                            \
+        for (i = 0; i < cls && i < sizeof(szs) / sizeof(szs[0]); i++) off += szs[i];        \
+        return off;                                                                         \
+    }                                                                                       \
+    static inline int                                                                       \
+    __shm_bm_mc_cls_of_##name(void *ptr)                                                    \
+    {                                                                                       \
+        size_t off = (unsigned char *)ptr - (unsigned char *)SHM_BM_HEAD(ptr);              \
+                                                                                            \
+        classes(__SHM_BM_MC_CLS_OF, name)                                                   \
+        return -1;                                                                          \
+    }                                                                                       \
+    static inline size_t                                                                    \
+    shm_bm_size_##name(void)                                                                \
+    {                                                                                       \
+        return __shm_bm_mc_off_##name(~0U);                                                 \
+    }                                                                                       \
+    static inline shm_bm_t                                                                  \
+    shm_bm_create_##name(void *mem, size_t memsz)                                           \
+    {                                                                                       \
+        if ((word_t)mem % SHM_BM_ALIGN != 0) return 0;                                      \
+        if (memsz < shm_bm_size_##name() || shm_bm_size_##name() > SHM_BM_ALIGN) return 0;  \
+        return (shm_bm_t)mem;                                                               \
+    }                                                                                       \
+    static inline void                                                                      \
+    shm_bm_init_##name(shm_bm_t shm)                                                        \
+    {                                                                                       \
+        classes(__SHM_BM_MC_INIT, name)                                                     \
+    }                                                                                       \
+    /* An object of the smallest class of at least `sz` bytes with a free object */         \
+    static inline void *                                                                    \
+    shm_bm_alloc_##name(shm_bm_t shm, size_t sz, shm_bm_objid_t *objid)                     \
+    {                                                                                       \
+        shm_bm_objid_t id;                                                                  \
+        void          *o;                                                                   \
+                                                                                            \
+        classes(__SHM_BM_MC_ALLOC, name)                                                    \
+        return NULL;                                                                        \
+    }                                                                                       \
+    static inline void *                                                                    \
+    shm_bm_take_##name(shm_bm_t shm, shm_bm_objid_t objid)                                  \
+    {                                                                                       \
+        switch (SHM_BM_MC_CLS(objid)) { classes(__SHM_BM_MC_TAKE, name) }                   \
+        return NULL;                                                                        \
+    }                                                                                       \
+    static inline void *                                                                    \
+    shm_bm_borrow_##name(shm_bm_t shm, shm_bm_objid_t objid)                                \
+    {                                                                                       \
+        switch (SHM_BM_MC_CLS(objid)) { classes(__SHM_BM_MC_BORROW, name) }                 \
+        return NULL;                                                                        \
+    }                                                                                       \
+    static inline void *                                                                    \
+    shm_bm_transfer_##name(shm_bm_t shm, shm_bm_objid_t objid)                              \
+    {                                                                                       \
+        return shm_bm_borrow_##name(shm, objid);                                            \
+    }                                                                                       \
+    static inline void *                                                                    \
+    shm_bm_reuse_##name(shm_bm_t shm, shm_bm_objid_t objid)                                 \
+    {                                                                                       \
+        switch (SHM_BM_MC_CLS(objid)) { classes(__SHM_BM_MC_REUSE, name) }                  \
+        return NULL;                                                                        \
+    }                                                                                       \
+    static inline void                                                                      \
+    shm_bm_release_##name(shm_bm_t shm, shm_bm_objid_t objid)                               \
+    {                                                                                       \
+        switch (SHM_BM_MC_CLS(objid)) { classes(__SHM_BM_MC_RELEASE, name) }                \
+    }                                                                                       \
+    static inline unsigned int                                                              \
+    shm_bm_refcnt_##name(shm_bm_t shm, shm_bm_objid_t objid)                                \
+    {                                                                                       \
+        switch (SHM_BM_MC_CLS(objid)) { classes(__SHM_BM_MC_REFCNT, name) }                 \
+        return 0;                                                                           \
+    }                                                                                       \
+    /* The size of the objects of the class of `objid` */                                   \
+    static inline size_t                                                                    \
+    shm_bm_objsz_##name(shm_bm_objid_t objid)                                               \
+    {                                                                                       \
+        switch (SHM_BM_MC_CLS(objid)) { classes(__SHM_BM_MC_OBJSZ, name) }                  \
+        return 0;                                                                           \
+    }                                                                                       \
+    static inline void                                                                      \
+    shm_bm_free_##name(void *ptr)                                                           \
+    {                                                                                       \
+        shm_bm_t shm = SHM_BM_HEAD(ptr);                                                    \
+                                                                                            \
+        switch (__shm_bm_mc_cls_of_##name(ptr)) { classes(__SHM_BM_MC_FREE, name) }         \
+    }                                                                                       \
+    static inline int                                                                       \
+    shm_bm_put_##name(void *ptr)                                                            \
+    {                                                                                       \
+        shm_bm_t shm = SHM_BM_HEAD(ptr);                                                    \
+                                                                                            \
+        switch (__shm_bm_mc_cls_of_##name(ptr)) { classes(__SHM_BM_MC_PUT, name) }          \
+        return 0;                                                                           \
+    }                                                                                       \
+    static inline shm_bm_objid_t                                                            \
+    shm_bm_get_objid_##name(void *ptr)                                                      \
+    {                                                                                       \
+        shm_bm_t shm = SHM_BM_HEAD(ptr);                                                    \
+                                                                                            \
+        switch (__shm_bm_mc_cls_of_##name(ptr)) { classes(__SHM_BM_MC_GET_OBJID, name) }    \
+        return 0;                                                                           \
+    }                                                                                       \
+    /* The batched operations dispatch each object to its class */                          \
+    static inline int                                                                       \
+    shm_bm_take_n_##name(shm_bm_t shm, const shm_bm_objid_t *objids, void **objs, int n)    \
+    {                                                                                       \
+        int i, taken = 0;                                                                   \
+                                                                                            \
+        for (i = 0; i < n; i++) taken += (objs[i] = shm_bm_take_##name(shm, objids[i])) != NULL; \
+        return taken;                                                                       \
+    }                                                                                       \
+    static inline int                                                                       \
+    shm_bm_transfer_n_##name(shm_bm_t shm, const shm_bm_objid_t *objids, void **objs, int n) \
+    {                                                                                       \
+        int i, taken = 0;                                                                   \
+                                                                                            \
+        for (i = 0; i < n; i++) taken += (objs[i] = shm_bm_borrow_##name(shm, objids[i])) != NULL; \
+        return taken;                                                                       \
+    }                                                                                       \
+    static inline void                                                                      \
+    shm_bm_free_n_##name(void **objs, int n)                                                \
+    {                                                                                       \
+        int i;                                                                              \
+                                                                                            \
+        for (i = 0; i < n; i++) {                                                           \
+            if (objs[i]) shm_bm_free_##name(objs[i]);                                       \
+        }                                                                                   \
+    }
+
 #endif
\ No newline at end of file
@@ -0,0 +1,74 @@
+#ifndef SHM_BM_HPP
+#define SHM_BM_HPP
+
+/***
+ * The shared memory allocator for C++ components:
+ * `composite::shm_bm<T, N>` is a region of `N` objects of type `T`, whose methods are those of
+ * the interface `SHM_BM_INTERFACE_CREATE(name, sizeof(T), N)` would
+ * generate, with the object size and count as template parameters,
+ * so the compiler specializes them as much, without a macro for each
+ * type of object. The class is the region's pointer, and the methods
+ * return typed objects.
+ *
+ * *Example*:
+ * ```c++
+ * typedef composite::shm_bm<struct testobj, 2048> testobj_shm;
+ *
+ * testobj_shm shm = testobj_shm::create(mem, testobj_shm::size());
+ * shm.init();
+ * struct testobj *o = shm.alloc(&id);
+ * ```
+ */
+
+extern "C" {
+#include <shm_bm.h>
+}
+
+namespace composite {
+
+template<typename T, unsigned int N>
+class shm_bm {
+	shm_bm_t shm;
+
+public:
+	static constexpr size_t       objsz = sizeof(T);
+	static constexpr unsigned int nobj  = N;
+
+	constexpr shm_bm() : shm(nullptr) {}
+	explicit constexpr shm_bm(shm_bm_t shm) : shm(shm) {}
+
+	static size_t size() { return __shm_bm_size(objsz, nobj); }
+	/* The region must be aligned on SHM_BM_ALIGN; the result is `false` otherwise */
+	static shm_bm create(void *mem, size_t memsz) { return shm_bm(__shm_bm_create(mem, memsz, objsz, nobj)); }
+
+	void init() { __shm_bm_init(shm, objsz, nobj); }
+
+	T *alloc(shm_bm_objid_t *id)  { return static_cast<T *>(__shm_bm_alloc(shm, id, objsz, nobj)); }
+	T *take(shm_bm_objid_t id)    { return static_cast<T *>(__shm_bm_take(shm, id, objsz, nobj)); }
+	T *borrow(shm_bm_objid_t id)  { return static_cast<T *>(__shm_bm_take_norefcnt(shm, id, objsz, nobj)); }
+	T *transfer(shm_bm_objid_t id) { return borrow(id); }
+	T *reuse(shm_bm_objid_t id)   { return static_cast<T *>(__shm_bm_reuse(shm, id, objsz, nobj)); }
+	void release(shm_bm_objid_t id) { __shm_bm_release(shm, id, nobj); }
+	unsigned int refcnt(shm_bm_objid_t id) { return __shm_bm_refcnt(shm, id, nobj); }
+
+	void free(T *o) { __shm_bm_ptr_free_in(shm, o, objsz, nobj); }
+	int  put(T *o)  { return __shm_bm_ptr_put_in(shm, o, objsz, nobj); }
+	shm_bm_objid_t objid(T *o) { return __shm_bm_get_objid_in(shm, o, objsz, nobj); }
+
+	int take_n(const shm_bm_objid_t *ids, T **objs, int n)
+	{
+		return __shm_bm_take_n(shm, ids, reinterpret_cast<void **>(objs), n, objsz, nobj, 1);
+	}
+	int transfer_n(const shm_bm_objid_t *ids, T **objs, int n)
+	{
+		return __shm_bm_take_n(shm, ids, reinterpret_cast<void **>(objs), n, objsz, nobj, 0);
+	}
+	void free_n(T **objs, int n) { __shm_bm_ptr_free_n_in(shm, reinterpret_cast<void **>(objs), n, objsz, nobj); }
+
+	shm_bm_t get() const { return shm; }
+	explicit operator bool() const { return shm != nullptr; }
+};
+
+}
+
+#endif /* SHM_BM_HPP */
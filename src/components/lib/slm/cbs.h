@@ -0,0 +1,84 @@
+#ifndef CBS_H
+#define CBS_H
+
+#include <slm.h>
+
+/***
+ * Constant Bandwidth Server (Abeni and Buttazzo) budget accounting,
+ * for use by deadline-driven policies (see `edf.c`). A server is given
+ * `budget` of execution every `period`, and has a current deadline,
+ * and the budget remaining until then. Exhausting the budget
+ * replenishes it, but postpones the deadline by a period, so under
+ * EDF a server never receives more than budget/period of the core,
+ * regardless of the behavior of its thread. Times are in cycles,
+ * except for the bandwidth which is computed in microseconds to avoid
+ * overflow.
+ */
+struct slm_cbs {
+	cycles_t   budget, period; /* a zero budget denotes no server */
+	microsec_t budget_us, period_us;
+	cycles_t   remaining;
+	cycles_t   deadline;
+};
+
+static inline int
+slm_cbs_active(struct slm_cbs *s)
+{
+	return s->budget != 0;
+}
+
+static inline void
+slm_cbs_init(struct slm_cbs *s, microsec_t budget, microsec_t period)
+{
+	*s = (struct slm_cbs) {
+		.budget_us = budget,
+		.period_us = period,
+		.budget    = slm_usec2cyc(budget),
+		.period    = slm_usec2cyc(period),
+	};
+	s->remaining = s->budget;
+	s->deadline  = slm_now() + s->period;
+}
+
+/*
+ * The server's thread wakes at `now`. The current deadline and budget
+ * are kept only if using the budget by the deadline wouldn't exceed the
+ * server's bandwidth. Return 1 if the budget was replenished.
+ */
+static inline int
+slm_cbs_wakeup(struct slm_cbs *s, cycles_t now)
+{
+	if (cycles_greater_than(s->deadline, now) &&
+	    slm_cyc2usec(s->remaining) * s->period_us < slm_cyc2usec(s->deadline - now) * s->budget_us) {
+		return 0;
+	}
+	s->deadline  = now + s->period;
+	s->remaining = s->budget;
+
+	return 1;
+}
+
+/*
+ * Charge the server for `exec` cycles of execution. Return the number
+ * of times the budget was exhausted, thus replenished.
+ */
+static inline unsigned long
+slm_cbs_charge(struct slm_cbs *s, cycles_t exec)
+{
+	unsigned long n;
+	cycles_t      over;
+
+	if (exec < s->remaining) {
+		s->remaining -= exec;
+
+		return 0;
+	}
+	over          = exec - s->remaining;
+	n             = 1 + over / s->budget;
+	s->remaining  = s->budget - over % s->budget;
+	s->deadline  += n * s->period;
+
+	return n;
+}
+
+#endif	/* CBS_H */
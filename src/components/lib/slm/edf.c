@@ -0,0 +1,317 @@
+#include <slm.h>
+#include <edf.h>
+#include <slm_api.h>
+#include <cos_types.h>
+#include <cos_component.h>
+#include <heap.h>
+
+/***
+ * Earliest-deadline-first scheduling, with optional Constant
+ * Bandwidth Servers. Threads configured with `SCHEDP_WINDOW` (and
+ * optionally a shorter `SCHEDP_DEADLINE`) are scheduled by their
+ * absolute deadline, set on each wakeup. Adding a `SCHEDP_BUDGET`
+ * makes the thread a CBS server (`cbs.h`) whose deadlines follow its
+ * budget consumption: the budget is enforced with a timeout on
+ * dispatch, or, for threads with their own tcap, by transferring each
+ * replenishment to the tcap.
+ *
+ * Threads with a fixed priority (`SCHEDP_PRIO`, used by the IPI and
+ * initialization threads) are scheduled before the deadline threads,
+ * and the `SCHEDP_INIT` threads after them.
+ */
+
+#define SLM_EDF_PRIO_SYSTEM_MAX  255
+#define SLM_EDF_PRIO_DEADLINE    (SLM_EDF_PRIO_SYSTEM_MAX + 1)
+#define SLM_EDF_PRIO_BACKGROUND  (SLM_EDF_PRIO_SYSTEM_MAX + 2)
+
+static int
+__slm_edf_compare_min(void *a, void *b)
+{
+	struct slm_sched_thd *x = slm_thd_sched_policy((struct slm_thd *)a);
+	struct slm_sched_thd *y = slm_thd_sched_policy((struct slm_thd *)b);
+
+	if (x->class != y->class) return x->class < y->class;
+	if (x->key != y->key) {
+		if (x->class == SLM_EDF_DEADLINE) return !cycles_greater_than(x->key, y->key);
+		return x->key < y->key;
+	}
+
+	return x->seq <= y->seq;
+}
+
+static void
+__slm_edf_update_idx(void *e, int pos)
+{ slm_thd_sched_policy((struct slm_thd *)e)->idx = pos; }
+
+DECLARE_HEAP(edf, __slm_edf_compare_min, __slm_edf_update_idx);
+
+struct runqueue {
+	struct heap     h;
+	void           *data[MAX_NUM_THREADS + 1];
+	u64_t           seq;
+	/* The last thread dispatched, and when, to charge its execution */
+	struct slm_thd *running;
+	cycles_t        dispatched;
+} CACHE_ALIGNED;
+
+static struct runqueue runqueues[NUM_CPU];
+
+static inline struct runqueue *
+runqueue(void)
+{
+	return &runqueues[cos_cpuid()];
+}
+
+static void
+edf_enqueue(struct runqueue *rq, struct slm_thd *t)
+{
+	struct slm_sched_thd *p = slm_thd_sched_policy(t);
+
+	assert(p->idx == -1);
+	p->seq = rq->seq++;
+	edf_heap_add(&rq->h, t);
+}
+
+static void
+edf_dequeue(struct runqueue *rq, struct slm_thd *t)
+{
+	struct slm_sched_thd *p = slm_thd_sched_policy(t);
+
+	if (p->idx == -1) return;
+	edf_heap_remove(&rq->h, p->idx);
+	p->idx = -1;
+}
+
+/* Give a thread with its own tcap a replenishment, so that the kernel enforces the budget */
+static void
+edf_tcap_replenish(struct slm_thd *t)
+{
+	struct slm_sched_thd *p = slm_thd_sched_policy(t);
+	int                   ret;
+
+	if (!(t->properties & SLM_THD_PROPERTY_OWN_TCAP)) return;
+
+	ret = cos_tcap_transfer(slm_global()->sched_thd.tc, t->rcv, p->cbs.budget, t->priority);
+	assert(ret == 0);
+}
+
+/* The deadline of a thread's next job, or its server's */
+static void
+edf_deadline_update(struct runqueue *rq, struct slm_thd *t, cycles_t now)
+{
+	struct slm_sched_thd *p = slm_thd_sched_policy(t);
+
+	if (p->class != SLM_EDF_DEADLINE) return;
+	if (slm_cbs_active(&p->cbs)) {
+		if (slm_cbs_wakeup(&p->cbs, now)) edf_tcap_replenish(t);
+		p->key = p->cbs.deadline;
+	} else {
+		p->key = now + (p->rel_deadline ? p->rel_deadline : p->window);
+	}
+}
+
+/* Charge the previously dispatched thread for its execution */
+static void
+edf_charge(struct runqueue *rq, cycles_t now)
+{
+	struct slm_thd       *t = rq->running;
+	struct slm_sched_thd *p;
+
+	if (!t) return;
+	rq->running = NULL;
+	p           = slm_thd_sched_policy(t);
+	if (p->class != SLM_EDF_DEADLINE || !slm_cbs_active(&p->cbs)) return;
+	if (!slm_cbs_charge(&p->cbs, now - rq->dispatched)) return;
+
+	/* Exhausted: replenished, with a postponed deadline */
+	edf_tcap_replenish(t);
+	p->key = p->cbs.deadline;
+	if (p->idx != -1) edf_heap_adjust(&rq->h, p->idx);
+}
+
+/* Execution is charged on dispatch, so we don't rely on kernel events */
+void
+slm_sched_edf_execution(struct slm_thd *t, cycles_t cycles)
+{ return; }
+
+struct slm_thd *
+slm_sched_edf_schedule(void)
+{
+	struct runqueue      *rq  = runqueue();
+	cycles_t              now = slm_now();
+	struct slm_thd       *t;
+	struct slm_sched_thd *p;
+
+	edf_charge(rq, now);
+
+	t = heap_peek(&rq->h);
+	if (!t) return NULL;
+	p = slm_thd_sched_policy(t);
+
+	/* Round-robin between threads of the same priority */
+	if (p->class != SLM_EDF_DEADLINE) {
+		p->seq = rq->seq++;
+		edf_heap_adjust(&rq->h, p->idx);
+	}
+
+	rq->running    = t;
+	rq->dispatched = now;
+	if (p->class == SLM_EDF_DEADLINE && slm_cbs_active(&p->cbs)) slm_timeout_earlier(now + p->cbs.remaining);
+
+	return t;
+}
+
+int
+slm_sched_edf_block(struct slm_thd *t)
+{
+	edf_dequeue(runqueue(), t);
+
+	return 0;
+}
+
+int
+slm_sched_edf_wakeup(struct slm_thd *t)
+{
+	struct runqueue *rq = runqueue();
+
+	edf_deadline_update(rq, t, slm_now());
+	edf_enqueue(rq, t);
+
+	return 0;
+}
+
+void
+slm_sched_edf_yield(struct slm_thd *t, struct slm_thd *yield_to)
+{
+	struct runqueue *rq = runqueue();
+
+	/* A deadline thread keeps its deadline, others go behind their peers */
+	edf_dequeue(rq, t);
+	edf_enqueue(rq, t);
+}
+
+int
+slm_sched_edf_thd_init(struct slm_thd *t)
+{
+	struct slm_sched_thd *p = slm_thd_sched_policy(t);
+
+	*p = (struct slm_sched_thd) {
+		.idx   = -1,
+		.class = SLM_EDF_BACKGROUND,
+	};
+	t->priority = SLM_EDF_PRIO_BACKGROUND;
+
+	return 0;
+}
+
+void
+slm_sched_edf_thd_deinit(struct slm_thd *t)
+{
+	struct runqueue *rq = runqueue();
+
+	edf_dequeue(rq, t);
+	if (rq->running == t) rq->running = NULL;
+}
+
+static int
+edf_update(struct slm_thd *t, sched_param_type_t type, unsigned int v)
+{
+	struct slm_sched_thd *p = slm_thd_sched_policy(t);
+
+	switch (type) {
+	case SCHEDP_INIT_PROTO:
+		p->class    = SLM_EDF_SYSTEM;
+		p->key      = 0;
+		t->priority = 0;
+		break;
+	case SCHEDP_INIT:
+		p->class    = SLM_EDF_BACKGROUND;
+		p->key      = 0;
+		t->priority = SLM_EDF_PRIO_BACKGROUND;
+		break;
+	case SCHEDP_PRIO:
+		if (v < TCAP_PRIO_MAX || v > SLM_EDF_PRIO_SYSTEM_MAX) return -EINVAL;
+		p->class    = SLM_EDF_SYSTEM;
+		p->key      = v;
+		t->priority = v;
+		break;
+	case SCHEDP_WINDOW:
+		if (v == 0) return -EINVAL;
+		p->window = slm_usec2cyc(v);
+		break;
+	case SCHEDP_DEADLINE:
+		if (v == 0) return -EINVAL;
+		p->rel_deadline = slm_usec2cyc(v);
+		if (!p->window) p->window = p->rel_deadline;
+		break;
+	case SCHEDP_BUDGET:
+		if (v == 0) return -EINVAL;
+		p->cbs.budget_us = v;
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	/* The budget is only used once the window is known */
+	if ((type == SCHEDP_WINDOW || type == SCHEDP_DEADLINE || type == SCHEDP_BUDGET) && p->window) {
+		p->class    = SLM_EDF_DEADLINE;
+		t->priority = SLM_EDF_PRIO_DEADLINE;
+		if (p->cbs.budget_us) {
+			microsec_t period = slm_cyc2usec(p->window);
+
+			if (p->cbs.budget_us > period) return -EINVAL;
+			slm_cbs_init(&p->cbs, p->cbs.budget_us, period);
+		}
+		/* a new server's budget is also given to its tcap here */
+		edf_deadline_update(runqueue(), t, slm_now());
+	}
+
+	return 0;
+}
+
+int
+slm_sched_edf_thd_update(struct slm_thd *t, sched_param_type_t type, unsigned int v)
+{
+	struct runqueue *rq = runqueue();
+	int              queued, ret;
+
+	queued = slm_thd_sched_policy(t)->idx != -1;
+	edf_dequeue(rq, t);
+	ret = edf_update(t, type, v);
+	/* As in fprr, a new thread is added to the runqueue by its parameters */
+	if (queued || slm_state_is_runnable(t->state)) edf_enqueue(rq, t);
+
+	return ret;
+}
+
+unsigned long
+slm_sched_edf_nrunnable(void)
+{
+	return heap_size(&runqueue()->h);
+}
+
+/* The heap's leaves tend to have the latest deadlines */
+struct slm_thd *
+slm_sched_edf_candidate(slm_sched_filter_fn_t filter, void *data)
+{
+	struct runqueue *rq = runqueue();
+	struct slm_thd  *t;
+	int              i;
+
+	for (i = heap_size(&rq->h); i > 0; i--) {
+		t = rq->h.data[i];
+		if (slm_thd_sched_policy(t)->class == SLM_EDF_SYSTEM) continue;
+		if (filter(t, data)) return t;
+	}
+
+	return NULL;
+}
+
+void
+slm_sched_edf_init(void)
+{
+	struct runqueue *rq = runqueue();
+
+	memset(rq, 0, sizeof(struct runqueue));
+	heap_init(&rq->h, MAX_NUM_THREADS);
+}
@@ -0,0 +1,25 @@
+#ifndef EDF_H
+#define EDF_H
+
+#include <slm.h>
+#include <cbs.h>
+
+typedef enum {
+	SLM_EDF_SYSTEM = 0, /* fixed priority threads, e.g. for IPIs and initialization */
+	SLM_EDF_DEADLINE,   /* scheduled by earliest deadline */
+	SLM_EDF_BACKGROUND, /* FIFO, when nothing else is runnable */
+} slm_edf_class_t;
+
+struct slm_sched_thd {
+	int             idx;          /* in the runqueue heap, or -1 */
+	slm_edf_class_t class;
+	u64_t           key;          /* the priority, or absolute deadline */
+	u64_t           seq;          /* FIFO order for equal keys */
+	cycles_t        rel_deadline; /* zero for an implicit deadline of the window */
+	cycles_t        window;
+	struct slm_cbs  cbs;
+};
+
+SLM_MODULES_POLICY_PROTOTYPES(edf)
+
+#endif	/* EDF_H */
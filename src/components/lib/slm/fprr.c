@@ -6,17 +6,64 @@
 
 #define ENABLE_DEBUG_INFO 0
 
-#define SLM_FPRR_NPRIOS         32
+#define SLM_FPRR_NPRIOS         256
 #define SLM_FPRR_PRIO_HIGHEST   TCAP_PRIO_MAX
 #define SLM_FPRR_PRIO_LOWEST    (SLM_FPRR_NPRIOS - 1)
 
 #define SLM_FPRR_PERIOD_US_MIN  10000
 
+#define SLM_FPRR_WORD_BITS      (sizeof(unsigned long) * 8)
+#define SLM_FPRR_BM_WORDS       ((SLM_FPRR_NPRIOS + SLM_FPRR_WORD_BITS - 1) / SLM_FPRR_WORD_BITS)
+
+/*
+ * Bit p of prio_bm is set iff prio[p] is non-empty, and bit w of
+ * summary iff prio_bm[w] is non-zero, so the highest (numerically
+ * lowest) populated priority is found with two bit-scans for up to
+ * SLM_FPRR_WORD_BITS^2 priorities.
+ */
 struct runqueue {
+	unsigned long       nrunnable;
+	unsigned long       summary;
+	unsigned long       prio_bm[SLM_FPRR_BM_WORDS];
 	struct ps_list_head prio[SLM_FPRR_NPRIOS];
 } CACHE_ALIGNED;
 struct runqueue threads[NUM_CPU];
 
+static inline void
+runqueue_append(struct runqueue *rq, tcap_prio_t prio, struct slm_sched_thd *p)
+{
+	ps_list_head_append_d(&rq->prio[prio], p);
+	rq->nrunnable++;
+	rq->prio_bm[prio / SLM_FPRR_WORD_BITS] |= 1UL << (prio % SLM_FPRR_WORD_BITS);
+	rq->summary                           |= 1UL << (prio / SLM_FPRR_WORD_BITS);
+}
+
+/* Remove p, if it is queued, from prio */
+static inline void
+runqueue_remove(struct runqueue *rq, tcap_prio_t prio, struct slm_sched_thd *p)
+{
+	unsigned long w = prio / SLM_FPRR_WORD_BITS;
+
+	if (ps_list_singleton_d(p)) return;
+	ps_list_rem_d(p);
+	rq->nrunnable--;
+	if (!ps_list_head_empty(&rq->prio[prio])) return;
+	rq->prio_bm[w] &= ~(1UL << (prio % SLM_FPRR_WORD_BITS));
+	if (!rq->prio_bm[w]) rq->summary &= ~(1UL << w);
+}
+
+/* The highest populated priority, or -1 if there are no runnable threads */
+static inline int
+runqueue_highest(struct runqueue *rq)
+{
+	unsigned long w;
+
+	if (!rq->summary) return -1;
+	w = __builtin_ctzl(rq->summary);
+
+	return w * SLM_FPRR_WORD_BITS + __builtin_ctzl(rq->prio_bm[w]);
+}
+
 /* No RR based on execution, yet */
 void
 slm_sched_fprr_execution(struct slm_thd *t, cycles_t cycles)
@@ -55,29 +102,24 @@ slm_sched_fprr_schedule(void)
 {
 	int i;
 	struct slm_sched_thd *t;
-	struct ps_list_head *prios = threads[cos_cpuid()].prio;
+	struct runqueue *rq = &threads[cos_cpuid()];
 
 #if ENABLE_DEBUG_INFO
 	debug_dump_info();
 #endif
 
-	for (i = 0 ; i < SLM_FPRR_NPRIOS ; i++) {
-		if (ps_list_head_empty(&prios[i])) continue;
-		t = ps_list_head_first_d(&prios[i], struct slm_sched_thd);
-
-		/*
-		 * We want to move the selected thread to the back of the list.
-		 * Otherwise fprr won't be truly round robin
-		 */
-		ps_list_rem_d(t);
-		ps_list_head_append_d(&prios[i], t);
-
-//		printc("Schedule -> %ld\n", slm_thd_from_sched(t)->tid);
-		return slm_thd_from_sched(t);
-	}
-//	printc("Schedule -> idle\n");
+	i = runqueue_highest(rq);
+	if (i < 0) return NULL;
+	t = ps_list_head_first_d(&rq->prio[i], struct slm_sched_thd);
 
-	return NULL;
+	/*
+	 * We want to move the selected thread to the back of the list.
+	 * Otherwise fprr won't be truly round robin
+	 */
+	ps_list_rem_d(t);
+	ps_list_head_append_d(&rq->prio[i], t);
+
+	return slm_thd_from_sched(t);
 }
 
 int
@@ -85,7 +127,7 @@ slm_sched_fprr_block(struct slm_thd *t)
 {
 	struct slm_sched_thd *p = slm_thd_sched_policy(t);
 
-	ps_list_rem_d(p);
+	runqueue_remove(&threads[cos_cpuid()], t->priority, p);
 
 	return 0;
 }
@@ -97,7 +139,7 @@ slm_sched_fprr_wakeup(struct slm_thd *t)
 
 	assert(ps_list_singleton_d(p));
 
-	ps_list_head_append_d(&threads[cos_cpuid()].prio[t->priority - 1], p);
+	runqueue_append(&threads[cos_cpuid()], t->priority, p);
 
 	return 0;
 }
@@ -105,10 +147,11 @@ slm_sched_fprr_wakeup(struct slm_thd *t)
 void
 slm_sched_fprr_yield(struct slm_thd *t, struct slm_thd *yield_to)
 {
-	struct slm_sched_thd *p = slm_thd_sched_policy(t);
+	struct slm_sched_thd *p  = slm_thd_sched_policy(t);
+	struct runqueue      *rq = &threads[cos_cpuid()];
 
-	ps_list_rem_d(p);
-	ps_list_head_append_d(&threads[cos_cpuid()].prio[t->priority], p);
+	runqueue_remove(rq, t->priority, p);
+	runqueue_append(rq, t->priority, p);
 }
 
 int
@@ -123,17 +166,18 @@ slm_sched_fprr_thd_init(struct slm_thd *t)
 void
 slm_sched_fprr_thd_deinit(struct slm_thd *t)
 {
-	ps_list_rem_d(slm_thd_sched_policy(t));
+	runqueue_remove(&threads[cos_cpuid()], t->priority, slm_thd_sched_policy(t));
 }
 
 static void
 update_queue(struct slm_thd *t, tcap_prio_t prio)
 {
-	struct slm_sched_thd *p = slm_thd_sched_policy(t);
+	struct slm_sched_thd *p  = slm_thd_sched_policy(t);
+	struct runqueue      *rq = &threads[cos_cpuid()];
 
+	runqueue_remove(rq, t->priority, p); /* if we're already on a list, and we're updating priority */
 	t->priority = prio;
-	ps_list_rem_d(p); /* if we're already on a list, and we're updating priority */
-	ps_list_head_append_d(&threads[cos_cpuid()].prio[prio], p);
+	runqueue_append(rq, prio, p);
 
 	return;
 }
@@ -167,6 +211,42 @@ slm_sched_fprr_thd_update(struct slm_thd *t, sched_param_type_t type, unsigned i
 	}
 }
 
+unsigned long
+slm_sched_fprr_nrunnable(void)
+{
+	return threads[cos_cpuid()].nrunnable;
+}
+
+/*
+ * Search from the lowest priority, so that balancing moves the
+ * threads that least need to run here.  The initialization (priority
+ * 0) threads are never returned.
+ */
+struct slm_thd *
+slm_sched_fprr_candidate(slm_sched_filter_fn_t filter, void *data)
+{
+	struct runqueue      *rq = &threads[cos_cpuid()];
+	struct slm_sched_thd *p;
+	unsigned long         w, b, bm;
+	int                   prio;
+
+	for (w = SLM_FPRR_BM_WORDS; w-- > 0; ) {
+		for (bm = rq->prio_bm[w]; bm; bm &= ~(1UL << b)) {
+			b    = SLM_FPRR_WORD_BITS - 1 - __builtin_clzl(bm);
+			prio = w * SLM_FPRR_WORD_BITS + b;
+			if (prio == 0) break;
+
+			ps_list_foreach_d(&rq->prio[prio], p) {
+				struct slm_thd *t = slm_thd_from_sched(p);
+
+				if (filter(t, data)) return t;
+			}
+		}
+	}
+
+	return NULL;
+}
+
 void
 slm_sched_fprr_init(void)
 {
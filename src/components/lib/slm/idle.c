@@ -1,9 +1,162 @@
 #include <cos_debug.h>
+#include <slm.h>
+#include <pgo.h>
 
 /* Override this to do initialization before idle computation */
 CWEAKSYMB void slm_idle_comp_initialization(void) { return; }
+
+/***
+ * Adaptive idle: each idle period, spin for a budget learned from the
+ * recent lengths of idle periods (so that the common, short, idle
+ * periods end with the core hot), then wait in a low-power state
+ * until an interrupt, or a remote core enqueues an IPI event for us.
+ * The low-power wait uses `umonitor`/`umwait` on the IPI ring when the
+ * processor supports them (they don't require privilege), and
+ * otherwise we only spin.
+ *
+ * The idle thread is preempted when work arrives, so an idle period's
+ * end is detected as a gap in the idle thread's execution.
+ */
+
+#define SLM_IDLE_PREEMPT_US 5 /* gaps in idle execution longer than this are preemptions */
+
+struct slm_idle_core {
+	struct slm_idle_stats stats;
+	cycles_t              period_start; /* the start of this idle period */
+	cycles_t              last;         /* when we last observed our execution... */
+	cycles_t              expected;     /* ...and how long the following spin or wait should take */
+	int                   halted;
+	int                   init;
+} CACHE_ALIGNED;
+
+static struct slm_idle_core   idle_cores[NUM_CPU];
+static struct slm_idle_config idle_config = {
+	.spin_min   = 1,
+	.spin_max   = 50,
+	.halt_slice = 100,
+	.halt       = 1,
+};
+static int idle_waitpkg = -1; /* are umonitor/umwait supported? */
+
+void
+slm_idle_config(struct slm_idle_config *c)
+{
+	assert(c->spin_min <= c->spin_max && c->halt_slice > 0);
+	idle_config = *c;
+}
+
+void
+slm_idle_stats(cpuid_t core, struct slm_idle_stats *s)
+{
+	assert(core >= 0 && core < NUM_CPU);
+	*s = idle_cores[core].stats;
+}
+
+static inline void
+idle_relax(void)
+{
+#if defined(__x86_64__) || defined(__x86__)
+	__asm__ __volatile__("pause" : : : "memory");
+#elif defined(__arm__)
+	__asm__ __volatile__("yield" : : : "memory");
+#endif
+}
+
+static int
+idle_waitpkg_supported(void)
+{
+#if defined(__x86_64__) || defined(__x86__)
+	u32_t a = 7, b, c = 0, d;
+
+	__asm__ __volatile__("cpuid" : "+a"(a), "=b"(b), "+c"(c), "=d"(d));
+
+	return !!(c & (1 << 5));
+#else
+	return 0;
+#endif
+}
+
+/* Wait in C0.2 until `deadline`, an interrupt, or a write to `addr` */
+static inline void
+idle_wait(volatile void *addr, cycles_t deadline)
+{
+#if defined(__x86_64__) || defined(__x86__)
+	/* umonitor %[er]ax */
+	__asm__ __volatile__(".byte 0xf3, 0x0f, 0xae, 0xf0" : : "a"(addr) : "memory");
+	/* umwait %ecx, with the deadline in edx:eax */
+	__asm__ __volatile__(".byte 0xf2, 0x0f, 0xae, 0xf1"
+	                     : : "c"(0), "a"((u32_t)deadline), "d"((u32_t)(deadline >> 32)) : "memory", "cc");
+#endif
+}
+
+/* The idle period ended when we last executed: learn the spin budget */
+static void
+idle_period_end(struct slm_idle_core *c, cycles_t end)
+{
+	struct slm_idle_stats *s   = &c->stats;
+	cycles_t               len = end - c->period_start;
+	cycles_t               min = slm_usec2cyc(idle_config.spin_min);
+	cycles_t               max = slm_usec2cyc(idle_config.spin_max);
+
+	if (c->halted) s->halt_wakeups++;
+	else           s->spin_wakeups++;
+
+	/* Moving average of the 8 last periods */
+	s->idle_avg = s->idle_avg - s->idle_avg / 8 + len / 8;
+	if (s->idle_avg > max) s->budget = min;
+	else                   s->budget = s->idle_avg + s->idle_avg / 2;
+	if (s->budget < min) s->budget = min;
+	if (s->budget > max) s->budget = max;
+}
+
+static cycles_t
+idle_observe(struct slm_idle_core *c)
+{
+	cycles_t now = slm_now();
+	cycles_t d   = now - c->last;
+
+	if (d > c->expected + slm_usec2cyc(SLM_IDLE_PREEMPT_US)) {
+		idle_period_end(c, c->last);
+		c->period_start = now;
+	} else if (c->halted) {
+		c->stats.halt += d;
+	} else {
+		c->stats.spin += d;
+	}
+
+	return now;
+}
+
 /* Override this to do repetitive computation in idle */
-CWEAKSYMB void slm_idle_iteration(void) { return; }
+CWEAKSYMB void
+slm_idle_iteration(void)
+{
+	struct slm_idle_core   *c   = &idle_cores[cos_cpuid()];
+	struct slm_ipi_percore *ipi = slm_ipi_percore_get(cos_cpuid());
+	cycles_t                now;
+
+	if (unlikely(!c->init)) {
+		if (idle_waitpkg < 0) idle_waitpkg = idle_waitpkg_supported();
+		c->init         = 1;
+		c->last         = c->period_start = slm_now();
+		c->stats.budget = slm_usec2cyc(idle_config.spin_min);
+	}
+	now = idle_observe(c);
+	c->last = now;
+
+	/* Spin through the budget, or if a wakeup is imminent */
+	if (!idle_waitpkg || !idle_config.halt || !slm_ipi_event_empty(cos_cpuid()) ||
+	    cycles_greater_than(c->period_start + c->stats.budget, now)) {
+		c->halted   = 0;
+		c->expected = 0;
+		idle_relax();
+
+		return;
+	}
+	c->halted   = 1;
+	c->expected = slm_usec2cyc(idle_config.halt_slice);
+	idle_wait(&ipi->ring.p_tail, now + c->expected);
+}
 
 void
 slm_idle(void *d)
@@ -12,6 +165,7 @@ slm_idle(void *d)
 
 	while (1) {
 		slm_idle_iteration();
+		pgo_dump_once(slm_now(), slm_usec2cyc(PGO_DUMP_DELAY_USEC));
 	}
 
 	BUG();
@@ -3,28 +3,30 @@
 #include <slm.h>
 #include <quantum.h>
 #include <slm_api.h>
-#include <heap.h>
+#include <dheap.h>
 
 /***
  * Quantum-based time management. Wooo. Periodic timer FTW.
+ *
+ * The timeouts are the keys of a 4-ary heap (dheap.h), so the heap
+ * operations don't load the threads' structures. On tickless cores
+ * (`slm_tickless`), the timer is only armed for the first timeout.
  */
-static int
-__slm_timeout_compare_min(void *a, void *b)
-{
-	/* FIXME: logic for wraparound in either timeout_cycs */
-	return slm_thd_timer_policy((struct slm_thd *)a)->abs_wakeup <= slm_thd_timer_policy((struct slm_thd *)b)->abs_wakeup;
-}
 
-static void
+/* The expired threads woken up at a time */
+#define QUANTUM_EXPIRE_BATCH 16
+
+/* FIXME: logic for wraparound in either timeout_cycs */
+static inline void
 __slm_timeout_update_idx(void *e, int pos)
-{ slm_thd_timer_policy((struct slm_thd *)e)->timeout_idx = pos; }
+{ slm_thd_timer_policy((struct slm_thd *)e)->timeout_idx = pos ? pos : -1; }
 
-DECLARE_HEAP(timer, __slm_timeout_compare_min, __slm_timeout_update_idx);
+DECLARE_DHEAP(timer, __slm_timeout_update_idx);
 struct timer_global {
-	struct heap	h;
-	void		*data[MAX_NUM_THREADS];
-	cycles_t	period;
-	cycles_t	current_timeout;
+	struct dheap_ent ents[DHEAP_ENTS(MAX_NUM_THREADS)] CACHE_ALIGNED;
+	struct dheap	 h;
+	cycles_t	 period;
+	cycles_t	 current_timeout;
 } CACHE_ALIGNED;
 
 static struct timer_global __timer_globals[NUM_CPU];
@@ -38,29 +40,29 @@ timer_global(void) {
 static void
 quantum_wakeup_expired(cycles_t now)
 {
-	struct timer_global *g = timer_global();
-
-	while (heap_size(&g->h) > 0) {
-		struct slm_thd *tp, *th;
-		struct slm_timer_thd *tt;
-
-		/* Should we wake up the closest-timeout thread? */
-		tp = heap_peek(&g->h);
-		assert(tp);
-		tt = slm_thd_timer_policy(tp);
-		assert(tt && tt->timeout_idx > 0);
-
-		/* No more threads to wake! */
-		if (cycles_greater_than(tt->abs_wakeup, now)) break;
-
-		/* Dequeue thread with closest wakeup */
-		th = timer_heap_highest(&g->h);
-		assert(th == tp);
+	struct timer_global  *g = timer_global();
+	struct slm_thd       *expired[QUANTUM_EXPIRE_BATCH];
+	struct slm_timer_thd *tt;
+	int                   n, i;
+
+	/* Dequeue all of the threads whose timeouts have passed */
+	do {
+		n = timer_dheap_pop_until(&g->h, now, (void **)expired, QUANTUM_EXPIRE_BATCH);
+		for (i = 0; i < n; i++) {
+			tt = slm_thd_timer_policy(expired[i]);
+			assert(tt->timeout_idx == -1);
+			tt->abs_wakeup = now;
+			slm_thd_wakeup(expired[i], 1);
+		}
+	} while (n == QUANTUM_EXPIRE_BATCH);
+}
 
-		tt->timeout_idx = -1;
-		tt->abs_wakeup  = now;
-		slm_thd_wakeup(th, 1);
-	}
+/* Tickless cores only arm the timer for the first timeout */
+static void
+quantum_tickless_arm(struct timer_global *g)
+{
+	if (!dheap_empty(&g->h)) slm_timeout_set(dheap_peek_key(&g->h));
+	else                     slm_timeout_clear();
 }
 
 /* The timer expired */
@@ -71,6 +73,21 @@ slm_timer_quantum_expire(cycles_t now)
 	cycles_t             offset;
 	cycles_t             next_timeout;
 
+	if (slm_tickless()) {
+		quantum_wakeup_expired(now);
+		quantum_tickless_arm(g);
+
+		return;
+	}
+
+	/* The scheduling policy made the timer expire early (slm_timeout_earlier) */
+	if (now < g->current_timeout) {
+		slm_timeout_set(g->current_timeout);
+		quantum_wakeup_expired(now);
+
+		return;
+	}
+
 	/*
 	 * Note that we might miss specific quantum if we are in a
 	 * virtualized environment. Thus we might be multiple periods
@@ -102,10 +119,11 @@ slm_timer_quantum_add(struct slm_thd *t, cycles_t absolute_timeout)
 	struct timer_global *g = timer_global();
 
 	assert(tt && tt->timeout_idx == -1);
-	assert(heap_size(&g->h) < MAX_NUM_THREADS);
+	assert(dheap_size(&g->h) < MAX_NUM_THREADS);
 
 	tt->abs_wakeup = absolute_timeout;
-	timer_heap_add(&g->h, t);
+	timer_dheap_add(&g->h, absolute_timeout, t);
+	if (slm_tickless()) slm_timeout_earlier(absolute_timeout);
 
 	return 0;
 }
@@ -118,11 +136,10 @@ slm_timer_quantum_cancel(struct slm_thd *t)
 
 	if (tt->timeout_idx == -1) return 0;
 
-	assert(heap_size(&g->h));
-	assert(tt->timeout_idx > 0);
+	assert(dheap_size(&g->h));
+	assert(tt->timeout_idx >= DHEAP_ROOT);
 
-	timer_heap_remove(&g->h, tt->timeout_idx);
-	tt->timeout_idx = -1;
+	timer_dheap_remove(&g->h, tt->timeout_idx);
 
 	return 0;
 }
@@ -154,7 +171,12 @@ slm_policy_timer_init(microsec_t period)
 
 	memset(g, 0, sizeof(struct timer_global));
 	g->period = slm_usec2cyc(period);
-	heap_init(&g->h, MAX_NUM_THREADS);
+	dheap_init(&g->h, g->ents, MAX_NUM_THREADS);
+	if (slm_tickless()) {
+		slm_timeout_clear();
+
+		return;
+	}
 
 	next_timeout = slm_now() + g->period;
 	g->current_timeout = next_timeout;
@@ -2,12 +2,14 @@
 #define QUANTUM_H
 
 #include <slm.h>
+#include <slm_policy_timer.h>
 
 SLM_MODULES_TIMER_PROTOTYPES(quantum)
 
 struct slm_timer_thd {
-	int      timeout_idx;	/* where are we in the heap? */
-	cycles_t abs_wakeup;
+	int                     timeout_idx;	/* where are we in the heap? */
+	cycles_t                abs_wakeup;
+	struct slm_timer_period period;
 };
 
 #endif	/* QUANTUM_H */
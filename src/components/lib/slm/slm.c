@@ -3,6 +3,7 @@
 #include <ps_list.h>
 
 struct slm_global __slm_global[NUM_CPU];
+struct slm_running __slm_running[NUM_CPU];
 struct slm_ipi_percore slm_ipi_percore_data[NUM_CPU];
 
 CK_RING_PROTOTYPE(slm_ipi_ringbuf, slm_ipi_event);
@@ -71,8 +72,11 @@ slm_thd_init_internal(struct slm_thd *t, thdcap_t thd, thdid_t tid)
 		.cpuid = cos_cpuid(),
 		.properties = 0
 	};
+	memset(t->affinity, 0xff, sizeof(t->affinity));
 	ps_list_init(t, thd_list);
 	ps_list_init(t, graveyard_list);
+	ps_list_head_init(&t->dependents);
+	ps_list_init(t, dependent_list);
 
 	return 0;
 }
@@ -97,12 +101,132 @@ slm_thd_init(struct slm_thd *t, thdcap_t thd, thdid_t tid)
 	return 0;
 }
 
+int
+slm_thd_depend(struct slm_thd *t, struct slm_thd *dep)
+{
+	assert(t->cpuid == cos_cpuid());
+	if (!dep || dep == t || dep->cpuid != t->cpuid || !slm_thd_normal(dep)) return -EINVAL;
+	if (t->state != SLM_THD_RUNNABLE || !slm_state_is_runnable(dep->state)) return -EAGAIN;
+	if (t->donated || dep->donated) return -EAGAIN;
+
+	slm_thd_donate(t, dep);
+	ps_list_head_append(&dep->dependents, t, dependent_list);
+	slm_trace(SLM_TRACE_DEPEND, t->tid, dep->tid);
+
+	return 0;
+}
+
+/* Revoke `t`'s donation to the thread it waits for, if it has one */
+static inline int
+slm_thd_depend_revoke(struct slm_thd *t)
+{
+	if (likely(ps_list_singleton(t, dependent_list))) return 0;
+	ps_list_rem(t, dependent_list);
+	slm_thd_donate(t, NULL);
+
+	return 1;
+}
+
+/*
+ * The threads waiting for `t` (that `t` can no longer execute for)
+ * block, and are woken by the event they wait for.
+ */
+static void
+slm_thd_dependents_block(struct slm_thd *t)
+{
+	struct slm_thd *d;
+
+	while (!ps_list_head_empty(&t->dependents)) {
+		d = ps_list_head_first(&t->dependents, struct slm_thd, dependent_list);
+		slm_thd_depend_revoke(d);
+		assert(d->state == SLM_THD_RUNNABLE);
+		d->state = SLM_THD_BLOCKED;
+		slm_sched_block(d);
+	}
+}
+
 void
 slm_thd_deinit(struct slm_thd *t)
 {
+	slm_thd_dependents_block(t);
+	slm_thd_depend_revoke(t);
 	slm_sched_thd_deinit(t);
 	slm_timer_thd_deinit(t);
 	t->state = SLM_THD_DYING;
+#ifdef SLM_HIST_ENABLED
+	if (slm_global()->hist_curr == t) slm_global()->hist_curr = NULL;
+#endif
+	slm_thd_deinit_internal(t);
+}
+
+void
+slm_thd_reap(slm_thd_reap_fn_t fn)
+{
+	struct slm_global *g = slm_global();
+	struct slm_thd    *t, *tn;
+
+	ps_list_foreach_del(&g->graveyard_head, t, tn, graveyard_list) {
+		/*
+		 * Only the thread executing on this core can still be
+		 * executing the exit path. The scheduler thread's
+		 * event retrieval skips dying threads, so once none
+		 * of its events are pending, no more are added.
+		 */
+		if (t->tid == cos_thdid() || !ps_list_singleton(t, thd_list)) continue;
+		ps_list_rem(t, graveyard_list);
+		fn(t);
+	}
+}
+
+static struct cos_thd_acct *slm_acct_tbl;
+
+int
+slm_acct_init(struct cos_compinfo *ci, hwcap_t hw)
+{
+	slm_acct_tbl = cos_hw_thd_acct_map(ci, hw);
+	if (!slm_acct_tbl) return -ENOMEM;
+
+	return 0;
+}
+
+int
+slm_thd_acct(struct slm_thd *t, struct cos_thd_acct *acct)
+{
+	struct cos_thd_acct *a;
+	u32_t                seq;
+
+	if (!slm_acct_tbl || t->tid > MAX_NUM_THREADS) return -EINVAL;
+	a = &slm_acct_tbl[t->tid];
+
+	/* seqlock read side: retry if the kernel updated the entry while we copied it */
+	do {
+		seq = ps_load(&a->seq);
+		ps_mem_fence();
+		*acct = *a;
+		ps_mem_fence();
+	} while ((seq & 1) || seq != ps_load(&a->seq));
+
+	return 0;
+}
+
+int
+slm_thd_util(struct slm_thd *t)
+{
+	struct cos_thd_acct acct;
+	cycles_t            now = slm_now(), prev = t->util_tsc, elapsed, exec;
+
+	if (slm_thd_acct(t, &acct)) return -1;
+
+	exec           = acct.cycles - t->util_cycles;
+	t->util_tsc    = now;
+	t->util_cycles = acct.cycles;
+	/* the first sample has no interval to measure */
+	if (!prev || now == prev) return 0;
+	elapsed = now - prev;
+	/* the kernel accounts execution when a thread is switched away from */
+	if (exec > elapsed) exec = elapsed;
+
+	return (int)((exec * 1000) / elapsed);
 }
 
 /*
@@ -128,6 +252,7 @@ slm_cs_enter_contention(struct slm_cs *cs, slm_cs_cached_t cached, struct slm_th
 	struct slm_global *g = slm_global();
 	int ret;
 
+	g->cs_stats.contended_enter++;
 	/* Set contention if it isn't yet set */
 	if (!contended) {
 		if (__slm_cs_cas(cs, cached, owner, 1)) return 1;
@@ -182,10 +307,15 @@ slm_cs_enter_contention(struct slm_cs *cs, slm_cs_cached_t cached, struct slm_th
 int
 slm_cs_exit_contention(struct slm_cs *cs, struct slm_thd *curr, slm_cs_cached_t cached, sched_tok_t tok)
 {
-	struct slm_thd *s = &slm_global()->sched_thd;
+	struct slm_global *g = slm_global();
+	struct slm_thd *s = &g->sched_thd;
 	int ret;
 
-	if (__slm_cs_cas(cs, cached, NULL, 0)) return 1;
+	if (__slm_cs_cas(cs, cached, NULL, 0)) {
+		g->cs_stats.retries++;
+		return 1;
+	}
+	g->cs_stats.contended_exit++;
 	/*
 	 * We simplify here by simply switching to the scheduler
 	 * thread to let it resolve the situation. Use our priority
@@ -197,6 +327,60 @@ slm_cs_exit_contention(struct slm_cs *cs, struct slm_thd *curr, slm_cs_cached_t
 	return 0;
 }
 
+void
+slm_cs_stats(cpuid_t core, struct slm_cs_stats *s)
+{
+	assert(core >= 0 && core < NUM_CPU);
+	*s = __slm_global[core].cs_stats;
+}
+
+int
+slm_thd_hist(struct slm_thd *t, struct slm_hist *h)
+{
+#ifdef SLM_HIST_ENABLED
+	*h = t->hist.hist;
+
+	return 0;
+#else
+	return -ENOENT;
+#endif
+}
+
+int
+slm_trace_drain(struct cos_trace_evt *evts, int max, unsigned long *lost)
+{
+#ifdef SLM_TRACE_ENABLED
+	struct slm_trace_ring *r = &slm_global()->trace;
+	int                    n, i;
+
+	/* events already overwritten */
+	if (r->head - r->tail > SLM_TRACE_NEVTS) {
+		r->lost += r->head - SLM_TRACE_NEVTS - r->tail;
+		r->tail  = r->head - SLM_TRACE_NEVTS;
+	}
+	n = (r->head - r->tail < (u64_t)max) ? (int)(r->head - r->tail) : max;
+	for (i = 0; i < n; i++) evts[i] = r->evts[(r->tail + i) & (SLM_TRACE_NEVTS - 1)];
+	r->tail += n;
+	*lost    = r->lost;
+
+	return n;
+#else
+	return -ENOENT;
+#endif
+}
+
+int
+slm_thd_running(thdid_t tid)
+{
+	cpuid_t i;
+
+	for (i = 0; i < NUM_CPU; i++) {
+		if (i != cos_cpuid() && ps_load(&__slm_running[i].tid) == tid) return 1;
+	}
+
+	return 0;
+}
+
 /***
  * Thread blocking and waking.
  */
@@ -218,6 +402,8 @@ slm_thd_wakeup_blked(struct slm_thd *t)
 
 	assert(t->state == SLM_THD_BLOCKED);
 	t->state = SLM_THD_RUNNABLE;
+	slm_hist_wakeup(t);
+	slm_trace(SLM_TRACE_WAKEUP, t->tid, cos_thdid());
 	slm_sched_wakeup(t);
 	t->properties &= ~SLM_THD_PROPERTY_SUSPENDED;
 
@@ -255,7 +441,9 @@ slm_thd_block(struct slm_thd *t)
 	}
 
 	assert(t->state == SLM_THD_RUNNABLE);
+	slm_thd_dependents_block(t);
 	t->state = SLM_THD_BLOCKED;
+	slm_trace(SLM_TRACE_BLOCK, t->tid, 0);
 	slm_sched_block(t);
 
 	return 0;
@@ -338,6 +526,8 @@ slm_thd_sched_wakeup(struct slm_thd *t)
 
 	assert(t->state == SLM_THD_BLOCKED);
 	t->state = SLM_THD_RUNNABLE;
+	slm_hist_wakeup(t);
+	slm_trace(SLM_TRACE_WAKEUP, t->tid, cos_thdid());
 	slm_sched_wakeup(t);
 
 	return 0;
@@ -358,10 +548,13 @@ slm_thd_wakeup(struct slm_thd *t, int redundant)
 		int ret = slm_ipi_event_enqueue(&event, t->cpuid);
 		/* Check if the enqueuing of the event is successful. */
 		assert(ret);
+		slm_trace(SLM_TRACE_WAKEUP_REMOTE, t->tid, t->cpuid);
 		cos_asnd(ipi_data->ipi_thd.asnd, 1);
 		return 0;
 	}
 
+	/* The event a dependent thread waited for: it executes again */
+	if (unlikely(slm_thd_depend_revoke(t))) return 0;
 	if (t->state == SLM_THD_WOKEN) return 1;
 	if (unlikely(t->state == SLM_THD_RUNNABLE || (redundant && t->state == SLM_THD_WOKEN))) {
 		/*
@@ -385,6 +578,63 @@ slm_thd_wakeup(struct slm_thd *t, int redundant)
 	return slm_thd_wakeup_blked(t);
 }
 
+void
+slm_thd_affinity_set(struct slm_thd *t, cpuid_t core, int allowed)
+{
+	unsigned long bits = sizeof(unsigned long) * 8;
+
+	assert(core >= 0 && core < NUM_CPU);
+	if (allowed) t->affinity[core / bits] |= 1UL << (core % bits);
+	else         t->affinity[core / bits] &= ~(1UL << (core % bits));
+}
+
+int
+slm_thd_migrate(struct slm_thd *t, cpuid_t core)
+{
+	struct slm_ipi_percore *ipi_data;
+	struct slm_ipi_event    event = { .tid = t->tid, .type = SLM_IPI_MIGRATE };
+	int                     ret;
+
+	assert(t->cpuid == cos_cpuid());
+	if (core < 0 || core >= NUM_CPU || core == t->cpuid || !slm_thd_affinity(t, core)) return -EINVAL;
+	if (t->state != SLM_THD_RUNNABLE || t->properties || t->donated || t->tid == cos_thdid()) return -EINVAL;
+	if (!ps_list_head_empty(&t->dependents)) return -EINVAL;
+	/* the scheduler hasn't processed the thread's kernel events yet */
+	if (!ps_list_singleton(t, thd_list)) return -EAGAIN;
+
+	ret = cos_thd_migrate(&cos_defcompinfo_curr_get()->ci, t->thd, core);
+	if (ret) return ret;
+
+	/* The thread isn't blocked, so has no timeout; its runqueue is per-core */
+	slm_timer_cancel(t);
+	slm_timer_thd_deinit(t);
+	slm_sched_block(t);
+	t->migrated_at = slm_now();
+	t->cpuid       = core;
+
+	ipi_data = slm_ipi_percore_get(core);
+	ret      = slm_ipi_event_enqueue(&event, core);
+	assert(ret);
+	cos_asnd(ipi_data->ipi_thd.asnd, 1);
+
+	return 0;
+}
+
+/*
+ * Called on the thread's new core, in the critical section, when
+ * processing its SLM_IPI_MIGRATE event.
+ */
+void
+slm_thd_migrate_in(struct slm_thd *t)
+{
+	assert(t->cpuid == cos_cpuid());
+	slm_timer_thd_init(t);
+	slm_sched_wakeup(t);
+}
+
+CWEAKSYMB void slm_balance(cycles_t now) { return; }
+CWEAKSYMB void slm_deferred_process(void) { return; }
+
 void
 slm_thd_wakeup_cs(struct slm_thd *curr, struct slm_thd *t)
 {
@@ -460,6 +710,9 @@ slm_get_cycs_per_usec(void)
 	return (unsigned long)g->cyc_per_usec;
 }
 
+/* Per-core destination of the batched kernel scheduler events */
+static struct cos_sched_evt_batch slm_evt_batch[NUM_CPU];
+
 static void
 slm_sched_loop_intern(int non_block)
 {
@@ -475,8 +728,8 @@ slm_sched_loop_intern(int non_block)
 		int pending, ret;
 
 		do {
-			thdid_t        tid;
-			int            blocked, rcvd;
+			struct cos_sched_evt_batch *b = &slm_evt_batch[cos_coreid()];
+			int            blocked, rcvd, i;
 			cycles_t       cycles;
 			tcap_time_t    thd_timeout;
 
@@ -487,49 +740,52 @@ slm_sched_loop_intern(int non_block)
 			 * suspending), and generally executing (thus
 			 * consuming cycles of computation). This is a
 			 * rcv, so it may suspend the calling thread
-			 * if `non_block` is `0`.
+			 * if `non_block` is `0`. All of the events
+			 * available are retrieved in a single batch.
 			 *
 			 * Important that this is *not* in the CS due
 			 * to the potential blocking.
 			 */
-			pending = cos_sched_rcv(us->rcv, rfl, g->timeout_next, &rcvd, &tid, &blocked, &cycles, &thd_timeout);
-			if (!tid) goto pending_events;
-			/*
-			 * FIXME: kernel should pass an untyped
-			 * pointer back here that we can use instead
-			 * of the tid. This is the only place where
-			 * slm requires the thread id -> thread
-			 * mapping ;-(
-			 */
-			t = slm_thd_lookup(tid);
-			assert(t);
-			/* don't report the idle thread or a freed thread */
-			if (unlikely(t == &g->idle_thd || slm_state_is_dead(t->state))) goto pending_events;
-
-			/*
-			 * Failure to take the CS because 1. another
-			 * thread is holding it and 2. switching to
-			 * that thread cannot succeed because
-			 * scheduler has pending events which will
-			 * prevent the switch to the CS holder. This
-			 * can cause the event just received to be
-			 * dropped. Thus, to avoid dropping events,
-			 * add the events to the scheduler event list
-			 * and processing all the pending events after
-			 * the scheduler can successfully take the
-			 * lock.
-			 *
-			 * TODO: Better would be to update the kernel
-			 * to enable a flag that ignores pending
-			 * events on a dispatch request. This would
-			 * allow the scheduler thread to switch to the
-			 * CS holder, and switch back when the CS
-			 * holder releases the CS (thus allowing the
-			 * events to be processed at that point.
-			 */
-			slm_thd_event_enqueue(t, blocked, cycles, thd_timeout);
+			pending = cos_sched_rcv_batch(us->rcv, rfl, g->timeout_next, &rcvd, b);
+
+			for (i = 0; i < b->nevts; i++) {
+				struct cos_sched_evt *e = &b->evts[i];
+
+				/*
+				 * FIXME: kernel should pass an untyped
+				 * pointer back here that we can use instead
+				 * of the tid. This is the only place where
+				 * slm requires the thread id -> thread
+				 * mapping ;-(
+				 */
+				t = slm_thd_lookup(e->tid);
+				/* don't report the idle thread or a freed thread */
+				if (unlikely(!t || t == &g->idle_thd || slm_state_is_dead(t->state))) continue;
+
+				/*
+				 * Failure to take the CS because 1. another
+				 * thread is holding it and 2. switching to
+				 * that thread cannot succeed because
+				 * scheduler has pending events which will
+				 * prevent the switch to the CS holder. This
+				 * can cause the event just received to be
+				 * dropped. Thus, to avoid dropping events,
+				 * add the events to the scheduler event list
+				 * and processing all the pending events after
+				 * the scheduler can successfully take the
+				 * lock.
+				 *
+				 * TODO: Better would be to update the kernel
+				 * to enable a flag that ignores pending
+				 * events on a dispatch request. This would
+				 * allow the scheduler thread to switch to the
+				 * CS holder, and switch back when the CS
+				 * holder releases the CS (thus allowing the
+				 * events to be processed at that point.
+				 */
+				slm_thd_event_enqueue(t, e->blocked, e->cycles, e->timeout);
+			}
 
-pending_events:
 			/* No events? make a scheduling decision */
 			if (ps_list_head_empty(&g->event_head)) break;
 
@@ -566,6 +822,7 @@ pending_events:
 		} while (pending > 0);
 
 		if (slm_cs_enter_sched()) continue;
+		slm_balance(slm_now());
 		/* If switch returns an inconsistency, we retry anyway */
 		ret = slm_cs_exit_reschedule(us, SLM_CS_CHECK_TIMEOUT);
 		if (ret && ret != -EAGAIN && ret != -EBUSY) BUG();
@@ -628,6 +885,7 @@ slm_init(thdcap_t thd, thdid_t tid)
 
 	g->cyc_per_usec = cos_hw_cycles_per_usec(BOOT_CAPTBL_SELF_INITHW_BASE);
 	g->lock.owner_contention = 0;
+	g->cs_stats = (struct slm_cs_stats) { 0 };
 
 	slm_sched_init();
 	slm_timer_init();
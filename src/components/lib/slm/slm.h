@@ -5,6 +5,8 @@
 #include <cos_defkernel_api.h>
 #include <ps.h>
 #include <ck_ring.h>
+#include <slm_hist.h>
+#include <slm_trace.h>
 
 /*
  * Simple state machine for each thread
@@ -37,8 +39,14 @@ struct slm_ipi_thd {
 	thdid_t   tid;
 };
 
+typedef enum {
+	SLM_IPI_WAKEUP = 0,
+	SLM_IPI_MIGRATE, /* the thread was migrated to the receiving core */
+} slm_ipi_event_type_t;
+
 struct slm_ipi_event {
-	thdid_t tid;
+	thdid_t              tid;
+	slm_ipi_event_type_t type;
 };
 
 struct slm_ipi_percore {
@@ -47,6 +55,8 @@ struct slm_ipi_percore {
 	struct slm_ipi_event ringbuf[PAGE_SIZE / sizeof(struct slm_ipi_event)];
 } CACHE_ALIGNED;
 
+#define SLM_AFFINITY_WORDS ((NUM_CPU + (sizeof(unsigned long) * 8) - 1) / (sizeof(unsigned long) * 8))
+
 struct slm_thd {
 	/*
 	 * rcv_suspended: Tracks the kernel state of the AEP threads for whether they're
@@ -104,6 +114,30 @@ struct slm_thd {
 	struct event_info event_info;
 	struct ps_list    thd_list;       /* list of events for the scheduler */
 	struct ps_list    graveyard_list; /* list of threads that have terminated that require deallocation */
+
+	/* The previous accounting sample, see `slm_thd_util` */
+	cycles_t util_cycles, util_tsc;
+
+	/* The cores the thread can be migrated to, and when it last was */
+	unsigned long affinity[SLM_AFFINITY_WORDS];
+	cycles_t      migrated_at;
+
+	/*
+	 * The thread executing on this thread's scheduling context
+	 * (its priority and tcap), or `NULL`. See `slm_thd_donate`.
+	 */
+	struct slm_thd *donated;
+	/*
+	 * The threads donating to this thread while they wait for it
+	 * (e.g. to release a lock), and our membership in such a list.
+	 * See `slm_thd_depend`.
+	 */
+	struct ps_list_head dependents;
+	struct ps_list      dependent_list;
+
+#ifdef SLM_HIST_ENABLED
+	struct slm_thd_hist hist; /* see `slm_thd_hist` */
+#endif
 };
 
 typedef enum {
@@ -122,6 +156,9 @@ slm_now(void)
 
 unsigned long slm_get_cycs_per_usec(void);
 
+/* Used by the balancing module to select candidates for migration */
+typedef int (*slm_sched_filter_fn_t)(struct slm_thd *t, void *data);
+
 #include <slm_private.h>
 
 /***
@@ -155,6 +192,61 @@ void slm_idle(void *);
 void slm_idle_comp_initialization(void);
 void slm_idle_iteration(void);
 
+/*
+ * The default `slm_idle_iteration` spins for a budget (between
+ * `spin_min` and `spin_max`) learned from the recent idle period
+ * lengths, then waits in a low-power state for up to `halt_slice`
+ * at a time, where the processor supports it. The statistics report
+ * the time spent in each, and in which each idle period ended, to
+ * evaluate the latency and power tradeoff.
+ */
+struct slm_idle_config {
+	microsec_t spin_min, spin_max;
+	microsec_t halt_slice;
+	int        halt; /* 0 to only spin */
+};
+
+struct slm_idle_stats {
+	cycles_t      spin, halt;
+	unsigned long spin_wakeups, halt_wakeups;
+	cycles_t      budget;   /* the current spin budget... */
+	cycles_t      idle_avg; /* ...learned from the average idle period */
+};
+
+void slm_idle_config(struct slm_idle_config *c);
+void slm_idle_stats(cpuid_t core, struct slm_idle_stats *s);
+
+/*
+ * Statistics for the scheduler critical section on a core (see
+ * `struct slm_cs_stats`), to evaluate how often its slowpaths are
+ * taken.
+ */
+void slm_cs_stats(cpuid_t core, struct slm_cs_stats *s);
+
+/*
+ * Copy the thread's wakeup latency and run-length histograms (see
+ * `slm_hist.h`) into `h`. Returns `-ENOENT` if the slm is compiled
+ * without `SLM_HIST_ENABLED`.
+ */
+int slm_thd_hist(struct slm_thd *t, struct slm_hist *h);
+
+/*
+ * Copy up to `max` of the core's scheduling events (see
+ * `slm_trace.h`) not yet copied, oldest first, into `evts`, and return
+ * the number copied, and in `lost` the number overwritten before they
+ * could be. Must be called in the critical section. Returns `-ENOENT`
+ * if the slm is compiled without `SLM_TRACE_ENABLED`.
+ */
+int slm_trace_drain(struct cos_trace_evt *evts, int max, unsigned long *lost);
+
+/*
+ * Is the thread `tid` running on another core? This is only a hint:
+ * it is the thread last dispatched by the core's scheduler, so it
+ * misses switches that don't go through the scheduler (e.g.
+ * interrupts). Can be called outside of the critical section.
+ */
+int slm_thd_running(thdid_t tid);
+
 
 
 /**
@@ -189,6 +281,32 @@ int slm_thd_commit_updates(struct slm_thd *t);
 int  slm_thd_init(struct slm_thd *t, thdcap_t thd, thdid_t tid);
 void slm_thd_deinit(struct slm_thd *t);
 
+/*
+ * Deinitialized threads are kept in the core's graveyard until they
+ * can no longer execute (they have switched away for the last time),
+ * and have no pending scheduler events. `slm_thd_reap` removes those
+ * threads from the graveyard, passing each to `fn` to free its
+ * memory. The resource module's `slm_thd_lookup` must not find a
+ * thread once it is freed. Must be called in the critical section.
+ */
+typedef void (*slm_thd_reap_fn_t)(struct slm_thd *t);
+void slm_thd_reap(slm_thd_reap_fn_t fn);
+
+/*
+ * Execution accounting of threads, read from the kernel's accounting
+ * table (see `struct cos_thd_acct`) without making system calls.
+ * `slm_acct_init` maps the table, and must be called once, on a
+ * single core, before the other functions are used.
+ *
+ * - `slm_thd_acct` copies a consistent snapshot of @t's accounting
+ *   into @acct.
+ * - `slm_thd_util` returns the per-mille of the time since its
+ *   previous call (for @t) that @t executed, or -1 without accounting.
+ */
+int slm_acct_init(struct cos_compinfo *ci, hwcap_t hw);
+int slm_thd_acct(struct slm_thd *t, struct cos_thd_acct *acct);
+int slm_thd_util(struct slm_thd *t);
+
 /* forward declarations, not part of the public API. */
 int slm_cs_enter_contention(struct slm_cs *cs, slm_cs_cached_t cached, struct slm_thd *curr, struct slm_thd *owner, int contended, sched_tok_t tok);
 int slm_cs_exit_contention(struct slm_cs *cs, struct slm_thd *curr, slm_cs_cached_t cached, sched_tok_t tok);
@@ -236,6 +354,15 @@ slm_cs_enter(struct slm_thd *current, slm_cs_flags_t flags)
 	cs = &(slm_global()->lock);
 
 	while (1) {
+		/* success! common case: a single CAS on the free critical section */
+		if (likely(!__slm_cs_cas(cs, 0, current, 0))) return 0;
+
+		/*
+		 * The scheduler token is only needed to switch to the
+		 * owner, so we only synchronize with the kernel when
+		 * contended. It must be read before the critical
+		 * section to validate our view of it.
+		 */
 		tok    = cos_sched_sync();
 		cached = __slm_cs_data(cs, &owner, &contended);
 
@@ -251,8 +378,8 @@ slm_cs_enter(struct slm_thd *current, slm_cs_flags_t flags)
 			continue;
 		}
 
-		/* success! common case */
-		if (likely(!__slm_cs_cas(cs, cached, current, 0))) return 0;
+		/* The owner released the critical section before we looked */
+		slm_global()->cs_stats.retries++;
 		if (flags & SLM_CS_NOSPIN) return 1;
 	}
 }
@@ -269,31 +396,35 @@ slm_cs_enter(struct slm_thd *current, slm_cs_flags_t flags)
 static inline void
 slm_cs_exit(struct slm_thd *switchto, slm_cs_flags_t flags)
 {
-	int ret = 1;
 	struct slm_cs *cs = &(slm_global()->lock);
 
-	while (ret != 0) {
+	while (1) {
 		int             contention;
 		sched_tok_t     tok;
 		slm_cs_cached_t cached;
 		struct slm_thd *current;
 
-		tok    = cos_sched_sync();
 		cached = __slm_cs_data(cs, &current, &contention);
-		/* Another thread attempted to enter the critical section */
-		if (unlikely(contention)) {
-			if (!slm_cs_exit_contention(cs, current, cached, tok)) return;
+		/* The common case: release lock, no-one waiting for it */
+		if (likely(!contention)) {
+			if (likely(!__slm_cs_cas(cs, cached, NULL, 0))) return;
+			/* Another thread set the contention bit since */
+			slm_global()->cs_stats.retries++;
+			if (flags & SLM_CS_NOSPIN) return;
 
-			continue; /* we couldn't update the CS variable, try again */
+			continue;
 		}
 
-		/* The common case: release lock, no-one waiting for it */
-		ret = __slm_cs_cas(cs, cached, NULL, 0);
-		if (flags & SLM_CS_NOSPIN) return;
-		if (flags & SLM_CS_SCHEDEVT && ret == -EBUSY) return;
+		/*
+		 * Another thread attempted to enter the critical
+		 * section: only now do we need the scheduler token to
+		 * switch to the scheduler thread.
+		 */
+		tok    = cos_sched_sync();
+		cached = __slm_cs_data(cs, &current, &contention);
+		if (!slm_cs_exit_contention(cs, current, cached, tok)) return;
+		/* we couldn't update the CS variable, try again */
 	}
-
-	return;
 }
 
 static inline int slm_cs_exit_reschedule(struct slm_thd *curr, slm_cs_flags_t flags);
@@ -334,6 +465,82 @@ slm_switch_to(struct slm_thd *curr, struct slm_thd *to, sched_tok_t tok, int inh
 int slm_thd_block(struct slm_thd *t);
 int slm_thd_wakeup(struct slm_thd *t, int redundant);
 
+/***
+ * Scheduling context donation. After `slm_thd_donate(t, to)`,
+ * activating `t` (by a scheduling decision or `slm_switch_to`)
+ * instead dispatches `to`, at `t`'s priority, and with its tcap if it
+ * has its own. `to` is usually blocked in the policies, and only
+ * executes on the contexts donated to it; this is what IPC servers
+ * use to execute at their clients' priorities and budgets. Donations
+ * can be chained (a server calling another server), and `to == NULL`
+ * revokes the donation. The critical section must be taken.
+ */
+static inline void
+slm_thd_donate(struct slm_thd *t, struct slm_thd *to)
+{
+	assert(t != to);
+	t->donated = to;
+}
+
+/***
+ * Priority inheritance for blocking synchronization. Instead of
+ * blocking while it waits for `dep` (the owner of a lock, or a writer,
+ * see `slm_blkpt_block`), a thread can donate its scheduling context
+ * to it, so that `dep` executes at (at least) the waiter's
+ * priority. The donation is revoked when the thread is woken, and the
+ * thread is blocked if `dep` blocks or exits. This is only possible
+ * if `dep` is a runnable thread on our core, and neither thread
+ * already has a donation. The critical section must be taken.
+ *
+ * Return 0 if the thread donates to `dep` (and so is left runnable),
+ * and `!0` if it should block instead.
+ */
+int slm_thd_depend(struct slm_thd *t, struct slm_thd *dep);
+
+/***
+ * Thread migration between cores. Threads can migrate to all cores
+ * by default, and `slm_thd_affinity_set` restricts (or re-allows)
+ * cores. A load-balancing module (see `ws.h`) uses `slm_thd_migrate`
+ * with the critical section of `t`'s core taken. Only runnable
+ * threads that aren't executing, and have no properties (thus no
+ * tcap or receive end-point, which are per-core) nor donated
+ * scheduling context, nor dependents, can be migrated.
+ * The thread is removed from the local policies, and added to those
+ * of `core` when it processes the IPI event with
+ * `slm_thd_migrate_in`.
+ *
+ * Return 0 on success, -EINVAL if the thread or core are
+ * inappropriate, and -EAGAIN if the thread has unprocessed kernel
+ * events.
+ */
+int  slm_thd_migrate(struct slm_thd *t, cpuid_t core);
+void slm_thd_migrate_in(struct slm_thd *t);
+void slm_thd_affinity_set(struct slm_thd *t, cpuid_t core, int allowed);
+
+static inline int
+slm_thd_affinity(struct slm_thd *t, cpuid_t core)
+{
+	unsigned long bits = sizeof(unsigned long) * 8;
+
+	return !!(t->affinity[core / bits] & (1UL << (core % bits)));
+}
+
+/*
+ * Called by the scheduler thread on each scheduling pass, with the
+ * critical section taken. By default it does nothing; a balancing
+ * module is composed with `SLM_MODULES_COMPOSE_BALANCE_FNS`.
+ */
+void slm_balance(cycles_t now);
+
+/*
+ * Called before each scheduling decision (see
+ * `slm_cs_exit_reschedule`), with the critical section taken. By
+ * default it does nothing; the scheduler component can define it to
+ * process the scheduling events its clients deferred, e.g. their lazy
+ * wakeups.
+ */
+void slm_deferred_process(void);
+
 /***
  * The `slm` time API. Unfortunately, three times are used in the
  * system:
@@ -381,7 +588,54 @@ slm_timeout_set(cycles_t timeout)
 static inline void
 slm_timeout_clear(void)
 {
-	slm_global()->timer_set = 0;
+	struct slm_global *g = slm_global();
+
+	/* No timeout on the next dispatches, so the kernel disarms the timer */
+	g->timeout_next = TCAP_TIME_NIL;
+	g->timer_set    = 0;
+}
+
+/*
+ * Used by scheduling policies (with the critical section taken) to
+ * enforce an execution budget: the next dispatch's timeout is moved
+ * earlier, and the timer policy then sees an expiration before its own
+ * timeout, which it must simply re-arm.
+ */
+static inline void
+slm_timeout_earlier(cycles_t timeout)
+{
+	struct slm_global *g = slm_global();
+
+	if (g->timer_set && !cycles_greater_than(g->timer_next, timeout)) return;
+	slm_timeout_set(timeout);
+}
+
+/*
+ * A core dedicated to a thread that never blocks (e.g. polling a
+ * device) doesn't need the periodic tick of the timer policy, nor its
+ * interrupts. `slm_tickless_set`, before `slm_init` on the core, makes
+ * the timer policy arm the timer only for the threads' timeouts (and
+ * the scheduling policy's budgets), and balancing leaves the core
+ * alone. There is thus no round-robin among the core's threads.
+ */
+static inline void
+slm_tickless_set(void)
+{
+	slm_global()->tickless = 1;
+}
+
+static inline int
+slm_core_tickless(cpuid_t core)
+{
+	extern struct slm_global __slm_global[NUM_CPU];
+
+	return ps_load(&__slm_global[core].tickless);
+}
+
+static inline int
+slm_tickless(void)
+{
+	return slm_global()->tickless;
 }
 
 #define SLM_IPI_THD_PRIO 20
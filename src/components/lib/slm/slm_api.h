@@ -132,6 +132,16 @@ struct slm_thd *slm_sched_schedule(void);
  * thread t has elapsed.
  */
 void slm_sched_execution(struct slm_thd *t, cycles_t cycles);
+/**
+ * The number of threads in the core's runqueues, for load balancing.
+ */
+unsigned long slm_sched_nrunnable(void);
+/**
+ * Return a runnable thread for which `filter` returns non-zero, or
+ * `NULL`. Policies should search the threads least harmed by being
+ * migrated first (e.g. the lowest priority).
+ */
+struct slm_thd *slm_sched_candidate(slm_sched_filter_fn_t filter, void *data);
 
 /***
  * Resource APIs.
@@ -207,6 +217,10 @@ typedef void (*thd_fn_t)(void *);
  	{ return slm_sched_##schedpol##_schedule(); }			\
 	void slm_sched_execution(struct slm_thd *t, cycles_t c)		\
 	{ slm_sched_##schedpol##_execution(t, c); }			\
+	unsigned long slm_sched_nrunnable(void)				\
+	{ return slm_sched_##schedpol##_nrunnable(); }			\
+	struct slm_thd *slm_sched_candidate(slm_sched_filter_fn_t f, void *d) \
+	{ return slm_sched_##schedpol##_candidate(f, d); }		\
 									\
 	struct slm_thd *slm_thd_lookup(thdid_t id)			\
 	{ return slm_thd_##respol##_lookup(id); }
@@ -220,8 +234,26 @@ typedef void (*thd_fn_t)(void *);
 	int slm_sched_##schedpol##_thd_init(struct slm_thd *t);		\
 	void slm_sched_##schedpol##_thd_deinit(struct slm_thd *t);	\
 	int slm_sched_##schedpol##_thd_update(struct slm_thd *t, sched_param_type_t type, unsigned int v); \
+	unsigned long slm_sched_##schedpol##_nrunnable(void);		\
+	struct slm_thd *slm_sched_##schedpol##_candidate(slm_sched_filter_fn_t filter, void *data); \
 	void slm_sched_##schedpol##_init(void);
 
+/*
+ * An optional load balancing module (e.g. `ws.h`) replaces the
+ * default, empty, `slm_balance`:
+ *
+ * ```c
+ * #include <ws.h>
+ * SLM_MODULES_COMPOSE_BALANCE_FNS(ws);
+ * ```
+ */
+#define SLM_MODULES_COMPOSE_BALANCE_FNS(balpol)			\
+	void slm_balance(cycles_t now)					\
+	{ slm_balance_##balpol##_balance(now); }
+
+#define SLM_MODULES_BALANCE_PROTOTYPES(balpol)				\
+	void slm_balance_##balpol##_balance(cycles_t now);
+
 #define SLM_MODULES_TIMER_PROTOTYPES(timerpol)				\
 	void slm_timer_##timerpol##_expire(cycles_t now);		\
 	int slm_timer_##timerpol##_add(struct slm_thd *t, cycles_t absolute_timeout); \
@@ -1,16 +1,70 @@
 #include <slm.h>
+#include <slm_api.h>
 #include <slm_blkpt.h>
 #include <stacklist.h>
+#include <string.h>
 
+/***
+ * Blockpoints are recycled: a freed blockpoint is cached by the
+ * freeing core (up to `BLKPT_CACHE_SZ` of them), or put on the global
+ * free list, and reused by the next allocations. An id holds the
+ * index of its blockpoint, and the generation of the blockpoint when
+ * it was allocated, bumped each time it is freed, so the stale ids of
+ * freed blockpoints are rejected, rather than aliasing reallocated
+ * blockpoints (until the generation wraps, after 2^12 reuses).
+ *
+ * The allocations from the core's cache don't take the critical
+ * section. The first `NBLKPTS` blockpoints are static, and the next
+ * ones are allocated by leaves of `BLKPT_LEAF_NUM` with
+ * `slm_blkpt_mem_alloc`, and never released.
+ */
+
+#ifndef NBLKPTS
 #define NBLKPTS 40960
+#endif
+#ifndef BLKPT_CACHE_SZ
+#define BLKPT_CACHE_SZ 16
+#endif
+
+/* An id is the generation above the index + 1, so that it is never SCHED_BLKPT_NULL */
+#define BLKPT_IDX_BITS     20
+#define BLKPT_IDX_MAX      ((1UL << BLKPT_IDX_BITS) - 1)
+#define BLKPT_GEN_MASK     ((1UL << (sizeof(sched_blkpt_id_t) * 8 - BLKPT_IDX_BITS)) - 1)
+#define BLKPT_ID(idx, gen) ((sched_blkpt_id_t)((((unsigned long)(gen) & BLKPT_GEN_MASK) << BLKPT_IDX_BITS) | ((idx) + 1)))
+#define BLKPT_IDX(id)      (((unsigned long)(id) & BLKPT_IDX_MAX) - 1)
+
+#define BLKPT_LEAF_BITS 12
+#define BLKPT_LEAF_NUM  (1UL << BLKPT_LEAF_BITS)
+#define BLKPT_LEAF_MASK (BLKPT_LEAF_NUM - 1)
+#define BLKPT_LEAVES    ((BLKPT_IDX_MAX - NBLKPTS + BLKPT_LEAF_NUM - 1) / BLKPT_LEAF_NUM)
+
+COS_STATIC_ASSERT(NBLKPTS < BLKPT_IDX_MAX, "The static blockpoints must fit in the ids");
+
 struct blkpt_mem {
+	/* SCHED_BLKPT_NULL while the blockpoint is free */
 	sched_blkpt_id_t      id;
+	/* the generation of its next allocation */
+	u32_t                 gen;
+	/* the index + 1 of the next blockpoint on the free list, or 0 */
+	u32_t                 next;
 	sched_blkpt_epoch_t   epoch;
 	struct stacklist_head blocked;
 	struct ps_lock lock;
 };
-static struct blkpt_mem __blkpts[NBLKPTS];
-static int __blkpt_offset = 1;
+static struct blkpt_mem  __blkpts[NBLKPTS];
+static struct blkpt_mem *__blkpt_leaves[BLKPT_LEAVES];
+/* The number of blockpoints ever allocated */
+static unsigned long     __blkpt_offset = 0;
+
+/* The global free list, only accessed in the critical section, with its lock */
+static struct ps_lock    __blkpt_free_lock;
+static u32_t             __blkpt_free_head = 0;
+
+/* The indexes + 1 of the free blockpoints cached by each core, or 0 */
+struct blkpt_cache {
+	unsigned long slots[BLKPT_CACHE_SZ];
+} CACHE_ALIGNED;
+static struct blkpt_cache __blkpt_caches[NUM_CPU];
 
 #define BLKPT_EPOCH_BLKED_BITS ((sizeof(sched_blkpt_epoch_t) * 8)
 #define BLKPT_EPOCH_DIFF       (BLKPT_EPOCH_BLKED_BITS - 2)/2)
@@ -19,7 +73,7 @@ static int __blkpt_offset = 1;
  * Is cmp > e? This is more complicated than it seems it should be
  * only because of wrap-around. We have to consider the case that we
  * have, and that we haven't wrapped around.
- * 
+ *
  * @return: true if cmp >= e (cmp is newer than e), false otherwise
  */
 static int
@@ -29,77 +83,238 @@ blkpt_epoch_is_higher(sched_blkpt_epoch_t e, sched_blkpt_epoch_t cmp)
 	return cmp >= e;
 }
 
+/* The memory of the blockpoint at `idx`, or NULL if its leaf isn't allocated */
+static inline struct blkpt_mem *
+blkpt_mem(unsigned long idx)
+{
+	struct blkpt_mem *leaf;
+
+	if (idx < NBLKPTS) return &__blkpts[idx];
+	if (idx >= BLKPT_IDX_MAX) return NULL;
+	idx -= NBLKPTS;
+	leaf = (struct blkpt_mem *)ps_load((unsigned long *)&__blkpt_leaves[idx >> BLKPT_LEAF_BITS]);
+	if (!leaf) return NULL;
+
+	return &leaf[idx & BLKPT_LEAF_MASK];
+}
+
+/* The blockpoint of `id`, or NULL if it was freed, or never allocated */
 static struct blkpt_mem *
 blkpt_get(sched_blkpt_id_t id)
 {
-	if (id - 1 == NBLKPTS) return NULL;
+	struct blkpt_mem *m;
+
+	if (id == SCHED_BLKPT_NULL) return NULL;
+	m = blkpt_mem(BLKPT_IDX(id));
+	if (!m || ps_load(&m->id) != id) return NULL;
 
-	return &__blkpts[id-1];
+	return m;
+}
+
+/* Make sure that the leaf of the blockpoint at `idx` is allocated */
+static int
+blkpt_expand(unsigned long idx)
+{
+	struct blkpt_mem **leaf;
+	unsigned long      sz = round_up_to_page(BLKPT_LEAF_NUM * sizeof(struct blkpt_mem));
+	void              *mem;
+
+	if (idx < NBLKPTS) return 0;
+	leaf = &__blkpt_leaves[(idx - NBLKPTS) >> BLKPT_LEAF_BITS];
+	if (ps_load((unsigned long *)leaf)) return 0;
+	mem = slm_blkpt_mem_alloc(sz / PAGE_SIZE);
+	if (!mem) return -1;
+	/* A zeroed blockpoint is free */
+	memset(mem, 0, sz);
+	/* If another core added the leaf first, we lose our pages */
+	ps_cas((unsigned long *)leaf, 0, (unsigned long)mem);
+
+	return 0;
+}
+
+/* Take a blockpoint cached by this core, without the critical section */
+static inline long
+blkpt_cache_get(void)
+{
+	struct blkpt_cache *c = &__blkpt_caches[cos_cpuid()];
+	unsigned long       v;
+	int                 i;
+
+	for (i = 0; i < BLKPT_CACHE_SZ; i++) {
+		v = ps_load(&c->slots[i]);
+		if (v && ps_cas(&c->slots[i], v, 0)) return (long)v - 1;
+	}
+
+	return -1;
+}
+
+static inline int
+blkpt_cache_put(unsigned long idx)
+{
+	struct blkpt_cache *c = &__blkpt_caches[cos_cpuid()];
+	int                 i;
+
+	for (i = 0; i < BLKPT_CACHE_SZ; i++) {
+		if (!ps_load(&c->slots[i]) && ps_cas(&c->slots[i], 0, idx + 1)) return 0;
+	}
+
+	return -1;
+}
+
+/* Take a blockpoint from the free list, or a new one, in the critical section */
+static long
+blkpt_take(void)
+{
+	unsigned long idx;
+
+	ps_lock_take(&__blkpt_free_lock);
+	if (__blkpt_free_head) {
+		idx               = __blkpt_free_head - 1;
+		__blkpt_free_head = blkpt_mem(idx)->next;
+		ps_lock_release(&__blkpt_free_lock);
+
+		return (long)idx;
+	}
+	ps_lock_release(&__blkpt_free_lock);
+
+	if (ps_load(&__blkpt_offset) >= BLKPT_IDX_MAX) return -1;
+	idx = ps_faa(&__blkpt_offset, 1);
+	if (idx >= BLKPT_IDX_MAX || blkpt_expand(idx)) return -1;
+
+	return (long)idx;
 }
 
 sched_blkpt_id_t
 slm_blkpt_alloc(struct slm_thd *current)
 {
+	struct blkpt_mem *m;
 	sched_blkpt_id_t id;
+	long idx;
+
+	idx = blkpt_cache_get();
+	if (idx < 0) {
+		slm_cs_enter(current, SLM_CS_NONE);
+		idx = blkpt_take();
+		slm_cs_exit(NULL, SLM_CS_NONE);
+		if (idx < 0) return SCHED_BLKPT_NULL;
+	}
+
+	/*
+	 * A free blockpoint has no blocked threads, and its epoch is
+	 * reset, but isn't reinitialized: the stale users still take its
+	 * lock to check its id.
+	 */
+	m  = blkpt_mem(idx);
+	id = BLKPT_ID(idx, m->gen);
+	ps_mem_fence();
+	ps_store(&m->id, id);
+
+	return id;
+}
+
+int
+slm_blkpt_free(sched_blkpt_id_t id, struct slm_thd *current)
+{
 	struct blkpt_mem *m;
-	sched_blkpt_id_t ret = SCHED_BLKPT_NULL;
+	struct stacklist *sl;
+	unsigned long idx = BLKPT_IDX(id);
+	int ret = 0;
 
 	slm_cs_enter(current, SLM_CS_NONE);
 
-	id = (sched_blkpt_id_t)__blkpt_offset;
-	m  = blkpt_get(id);
-	if (!m) ERR_THROW(SCHED_BLKPT_NULL, unlock);
-
-	m->id    = id;
-	ret      = id;
+	m = blkpt_get(id);
+	if (!m) ERR_THROW(-1, unlock);
+	ps_lock_take(&m->lock);
+	/* Another thread freed it first */
+	if (ps_load(&m->id) != id) {
+		ps_lock_release(&m->lock);
+		ERR_THROW(-1, unlock);
+	}
+	/* From now on, the id is stale */
+	ps_store(&m->id, SCHED_BLKPT_NULL);
+	m->gen   = (m->gen + 1) & BLKPT_GEN_MASK;
 	m->epoch = 0;
-	stacklist_init(&m->blocked);
-	ps_lock_init(&m->lock);
-	__blkpt_offset++;
+	/* The threads still blocked on it would never be woken */
+	while ((sl = stacklist_dequeue(&m->blocked)) != NULL) {
+		slm_thd_wakeup(sl->data, 0);
+	}
+	ps_lock_release(&m->lock);
+
+	if (blkpt_cache_put(idx)) {
+		ps_lock_take(&__blkpt_free_lock);
+		m->next           = __blkpt_free_head;
+		__blkpt_free_head = idx + 1;
+		ps_lock_release(&__blkpt_free_lock);
+	}
+	slm_cs_exit_reschedule(current, SLM_CS_NONE);
+
+	return 0;
 unlock:
 	slm_cs_exit(NULL, SLM_CS_NONE);
 
 	return ret;
 }
 
-int
-slm_blkpt_free(sched_blkpt_id_t id)
+/*
+ * Advance the blockpoint's epoch to `epoch`. Returns `0` if it is
+ * outdated, thus the event was already triggered.
+ */
+static int
+blkpt_epoch_advance(struct blkpt_mem *m, sched_blkpt_epoch_t epoch)
 {
-	/* alloc only for now */
-	return 0;
+	while (1) {
+		sched_blkpt_epoch_t pre = ps_load(&m->epoch);
+
+		if (!blkpt_epoch_is_higher(pre, epoch)) return 0;
+		if (ps_cas(&m->epoch, pre, epoch)) return 1;
+	}
 }
 
 int
 slm_blkpt_trigger(sched_blkpt_id_t blkpt, struct slm_thd *current, sched_blkpt_epoch_t epoch, int single)
 {
-	thdid_t tid;
 	struct blkpt_mem *m;
 	int ret = 0;
-	struct stacklist *sl;
-	struct slm_thd *t;
-
-	slm_cs_enter(current, SLM_CS_NONE);
+	struct stacklist *sl, *n;
 
 	m = blkpt_get(blkpt);
-	if (!m) ERR_THROW(-1, unlock);
-	ps_lock_take(&m->lock);
-	/* is the new epoch more recent than the existing? */
-	while (1) {
-		sched_blkpt_epoch_t pre = ps_load(&m->epoch);
+	if (!m) return -1;
+	/*
+	 * Is the new epoch more recent than the existing? Single
+	 * wakeups are for waiters that count their own events (e.g. the
+	 * resources handed off by a semaphore), so one racing with a
+	 * more recent trigger still wakes a thread.
+	 */
+	if (!blkpt_epoch_advance(m, epoch) && !single) return 0;
+	/*
+	 * Lock-free path without blocked threads: blocking threads add
+	 * themselves to the list *before* they re-check the epoch, so
+	 * they will see the new one, and not block.
+	 */
+	if (!ps_load(&m->blocked.head)) return 0;
 
-		if (!blkpt_epoch_is_higher(pre, epoch)) {
-			ps_lock_release(&m->lock);
-			ERR_THROW(0, unlock); 
-		}
-		if (ps_cas(&m->epoch, pre, epoch)) break;
+	slm_cs_enter(current, SLM_CS_NONE);
+	ps_lock_take(&m->lock);
+	/* freed since we found it? */
+	if (ps_load(&m->id) != blkpt) {
+		ps_lock_release(&m->lock);
+		ERR_THROW(-1, unlock);
 	}
+	slm_trace(SLM_TRACE_BLKPT_TRIGGER, current->tid, blkpt);
 
-	while ((sl = stacklist_dequeue(&m->blocked)) != NULL) {
-		t = sl->data;
-		slm_thd_wakeup(t, 0); /* ignore retval: process next thread */
-		if (single) break;
+	if (single) {
+		sl = stacklist_dequeue(&m->blocked);
+		if (sl) slm_thd_wakeup(sl->data, 0);
+		ps_lock_release(&m->lock);
+	} else {
+		/* Detach all of the blocked threads, and wake them without the lock */
+		sl = stacklist_dequeue_all(&m->blocked);
+		ps_lock_release(&m->lock);
+		for (; sl; sl = n) {
+			n = stacklist_next(sl);
+			slm_thd_wakeup(sl->data, 0); /* ignore retval: process next thread */
+		}
 	}
-	ps_lock_release(&m->lock);
 	/* most likely we switch to a woken thread here */
 	slm_cs_exit_reschedule(current, SLM_CS_NONE);
 
@@ -110,6 +325,41 @@ unlock:
 	return ret;
 }
 
+int
+slm_blkpt_morph(sched_blkpt_id_t from, sched_blkpt_id_t to, struct slm_thd *current, sched_blkpt_epoch_t epoch)
+{
+	struct blkpt_mem *f, *t, *first, *second;
+	struct stacklist *sl, *n;
+	int ret = 0;
+
+	f = blkpt_get(from);
+	t = blkpt_get(to);
+	if (!f || !t || f == t) return -1;
+	/* The threads that are blocking see the event, as with a trigger */
+	if (!blkpt_epoch_advance(f, epoch)) return 0;
+	if (!ps_load(&f->blocked.head)) return 0;
+
+	/* Take the locks in a global order, as blocking threads take them one at a time */
+	first  = f < t ? f : t;
+	second = f < t ? t : f;
+	slm_cs_enter(current, SLM_CS_NONE);
+	ps_lock_take(&first->lock);
+	ps_lock_take(&second->lock);
+	if (ps_load(&f->id) != from || ps_load(&t->id) != to) ERR_THROW(-1, release);
+
+	/* The threads stay blocked, now waiting for the events of `to` */
+	for (sl = stacklist_dequeue_all(&f->blocked); sl; sl = n) {
+		n = sl->next;
+		stacklist_add(&t->blocked, sl, sl->data);
+	}
+release:
+	ps_lock_release(&second->lock);
+	ps_lock_release(&first->lock);
+	slm_cs_exit(NULL, SLM_CS_NONE);
+
+	return ret;
+}
+
 int
 slm_blkpt_block(sched_blkpt_id_t blkpt, struct slm_thd *current, sched_blkpt_epoch_t epoch, thdid_t dependency)
 {
@@ -127,6 +377,10 @@ slm_blkpt_block(sched_blkpt_id_t blkpt, struct slm_thd *current, sched_blkpt_epo
 	}
 
 	ps_lock_take(&m->lock);
+	if (ps_load(&m->id) != blkpt) {
+		ps_lock_release(&m->lock);
+		ERR_THROW(-1, unlock);
+	}
 	/* Outdated event? don't block! */
 	pre = ps_load(&m->epoch);
 	if (!blkpt_epoch_is_higher(pre, epoch)) {
@@ -136,6 +390,7 @@ slm_blkpt_block(sched_blkpt_id_t blkpt, struct slm_thd *current, sched_blkpt_epo
 
 	/* Block! */
 	stacklist_add(&m->blocked, &sl, current);
+	slm_trace(SLM_TRACE_BLKPT_BLOCK, current->tid, blkpt);
 
 	/* To solve a risk condition when a stacklist_dequeue happens before the stacklist_add. */
 	if (!blkpt_epoch_is_higher(ps_load(&m->epoch), pre)) {
@@ -151,6 +406,17 @@ slm_blkpt_block(sched_blkpt_id_t blkpt, struct slm_thd *current, sched_blkpt_epo
 		ERR_THROW(0, unlock);
 	}
 
+	/*
+	 * Rather than blocking, execute the thread we wait for (on our
+	 * scheduling context) if we can: priority inheritance.
+	 */
+	if (dependency && !slm_thd_depend(current, slm_thd_lookup(dependency))) {
+		ps_lock_release(&m->lock);
+		slm_cs_exit_reschedule(current, SLM_CS_NONE);
+		assert(stacklist_is_removed(&sl));
+
+		return 0;
+	}
 	if (slm_thd_block(current)) {
 		ps_lock_release(&m->lock);
 		ERR_THROW(0, unlock);
@@ -7,9 +7,33 @@ typedef u32_t sched_blkpt_id_t;
 #define SCHED_BLKPT_NULL 0
 typedef word_t sched_blkpt_epoch_t;
 
+/*
+ * Blockpoints are recycled once freed, and their ids are tagged with
+ * a generation, so that the blockpoint of a stale id isn't found:
+ * `slm_blkpt_trigger` and `slm_blkpt_block` return -1, as for an id
+ * never allocated. Freeing a blockpoint wakes up the threads blocked
+ * on it.
+ */
 sched_blkpt_id_t slm_blkpt_alloc(struct slm_thd *current);
-int slm_blkpt_free(sched_blkpt_id_t id);
+int slm_blkpt_free(sched_blkpt_id_t id, struct slm_thd *current);
 int slm_blkpt_trigger(sched_blkpt_id_t blkpt, struct slm_thd *current, sched_blkpt_epoch_t epoch, int single);
+/*
+ * Wait morphing: trigger the event `epoch` on `from`, but rather than
+ * waking its blocked threads, move them to `to`, where they stay
+ * blocked until its next trigger. Returns -1 if either id is stale,
+ * and 0 otherwise.
+ */
+int slm_blkpt_morph(sched_blkpt_id_t from, sched_blkpt_id_t to, struct slm_thd *current, sched_blkpt_epoch_t epoch);
 int slm_blkpt_block(sched_blkpt_id_t blkpt, struct slm_thd *current, sched_blkpt_epoch_t epoch, thdid_t dependency);
 
+/*
+ * The scheduler must define this to allocate the memory of the
+ * blockpoints beyond the static ones (`NBLKPTS`), or return NULL to
+ * not grow past them.
+ *
+ * - @npages - the number of pages to allocate
+ * - @return - the pages, or NULL
+ */
+void *slm_blkpt_mem_alloc(unsigned long npages);
+
 #endif	/* SLM_BLKPT_H */
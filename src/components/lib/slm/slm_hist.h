@@ -0,0 +1,36 @@
+#ifndef SLM_HIST_H
+#define SLM_HIST_H
+
+#include <cos_types.h>
+
+/***
+ * Per-thread scheduling latency instrumentation, enabled with
+ * `SLM_HIST_ENABLED` in `cos_config.h`. Each thread keeps log-bucketed
+ * histograms of its wakeup-to-dispatch latency, and of the length of
+ * each of its executions (from its dispatch to the next dispatch on
+ * its core). Bucket `i` counts the samples of `[2^i, 2^(i+1))`
+ * cycles, and the last bucket all longer samples.
+ */
+
+#define SLM_HIST_BUCKETS 32
+
+struct slm_hist {
+	u32_t wait[SLM_HIST_BUCKETS];
+	u32_t run[SLM_HIST_BUCKETS];
+};
+
+struct slm_thd_hist {
+	struct slm_hist hist;
+	cycles_t        woken; /* when the thread was last woken, or 0 once dispatched */
+};
+
+static inline void
+slm_hist_add(u32_t *buckets, cycles_t c)
+{
+	int b = c ? 63 - __builtin_clzll((unsigned long long)c) : 0;
+
+	if (b >= SLM_HIST_BUCKETS) b = SLM_HIST_BUCKETS - 1;
+	buckets[b]++;
+}
+
+#endif /* SLM_HIST_H */
@@ -1,5 +1,53 @@
 #ifndef SLM_POLICY_TIMER_H
 #define SLM_POLICY_TIMER_H
 
+/***
+ * The periodic releases of a thread, kept by the timer policies in
+ * their `struct slm_timer_thd`. Each release is a period after the
+ * previous one, rather than after the thread asked for it, so the
+ * releases don't drift with the thread's execution and wakeup
+ * latency. A thread that overran one or more releases skips them,
+ * rather than executing back to back to catch up. Only the thread
+ * itself uses its releases, thus these need no critical section.
+ */
+struct slm_timer_period {
+	cycles_t period;	/* 0 if the thread isn't periodic */
+	cycles_t release;	/* the last release */
+};
+
+static inline void
+slm_timer_period_init(struct slm_timer_period *p)
+{
+	*p = (struct slm_timer_period) { 0 };
+}
+
+/* The first release is now, so the next is a period from now */
+static inline void
+slm_timer_period_set(struct slm_timer_period *p, cycles_t period, cycles_t now)
+{
+	*p = (struct slm_timer_period) {
+		.period  = period,
+		.release = now,
+	};
+}
+
+/*
+ * Advance to the next release after `now`, and return the number of
+ * releases skipped on the way.
+ */
+static inline unsigned long
+slm_timer_period_next(struct slm_timer_period *p, cycles_t now)
+{
+	unsigned long missed;
+
+	assert(p->period);
+	p->release += p->period;
+	if (cycles_greater_than(p->release, now)) return 0;
+
+	missed      = (now - p->release) / p->period + 1;
+	p->release += missed * p->period;
+
+	return missed;
+}
 
 #endif /* SLM_POLICY_TIMER_H */
@@ -11,6 +11,19 @@ struct slm_cs {
 	unsigned long owner_contention;
 };
 
+/*
+ * The uncontended critical section is a single CAS to enter, and a
+ * load and CAS to exit. These count the entries and exits that took
+ * the slowpaths (switching to the owner, or to the scheduler thread),
+ * and the CASes lost to a concurrent update. They are updated outside
+ * of the critical section, so they are approximate.
+ */
+struct slm_cs_stats {
+	unsigned long contended_enter;
+	unsigned long contended_exit;
+	unsigned long retries;
+};
+
 static inline int
 slm_state_is_runnable(slm_thd_state_t s)
 { return s == SLM_THD_RUNNABLE || s == SLM_THD_WOKEN; }
@@ -58,7 +71,8 @@ __slm_cs_cas(struct slm_cs *cs, slm_cs_cached_t cached, struct slm_thd *thd, int
 }
 
 struct slm_global {
-	struct slm_cs lock;
+	struct slm_cs       lock;
+	struct slm_cs_stats cs_stats;
 
 	struct slm_thd sched_thd;
 	struct slm_thd idle_thd;
@@ -67,9 +81,18 @@ struct slm_global {
 	int         timer_set; 	  /* is the timer set? */
 	cycles_t    timer_next;	  /* ...what is it set to? */
 	tcap_time_t timeout_next; /* ...and what is the tcap representation? */
+	int         tickless;     /* only timeouts, no periodic tick? see slm_tickless_set */
 
 	struct ps_list_head event_head;     /* all pending events for sched end-point */
 	struct ps_list_head graveyard_head; /* all deinitialized threads */
+
+#ifdef SLM_HIST_ENABLED
+	struct slm_thd *hist_curr; /* the thread last dispatched, and when */
+	cycles_t        hist_at;
+#endif
+#ifdef SLM_TRACE_ENABLED
+	struct slm_trace_ring trace;
+#endif
 } CACHE_ALIGNED;
 
 /*
@@ -101,6 +124,83 @@ slm_thd_normal(struct slm_thd *t)
  */
 struct slm_thd *slm_thd_special(void);
 
+/*
+ * Instrumentation hooks (see `slm_hist.h`) on wakeup, and on dispatch
+ * (before resolving donations, so that the dispatched thread is
+ * accounted). The run-length of the previously dispatched thread ends
+ * at the next dispatch, which is when the slm regains control.
+ */
+#ifdef SLM_HIST_ENABLED
+static inline void
+slm_hist_wakeup(struct slm_thd *t)
+{
+	t->hist.woken = slm_now();
+}
+
+static inline void
+slm_hist_dispatch(struct slm_thd *t)
+{
+	struct slm_global *g   = slm_global();
+	cycles_t           now = slm_now();
+
+	if (g->hist_curr == t) return;
+	if (g->hist_curr) slm_hist_add(g->hist_curr->hist.hist.run, now - g->hist_at);
+	if (t->hist.woken) {
+		slm_hist_add(t->hist.hist.wait, now - t->hist.woken);
+		t->hist.woken = 0;
+	}
+	g->hist_curr = slm_thd_normal(t) ? t : NULL;
+	g->hist_at   = now;
+}
+#else
+static inline void slm_hist_wakeup(struct slm_thd *t) { return; }
+static inline void slm_hist_dispatch(struct slm_thd *t) { return; }
+#endif
+
+/*
+ * Record a scheduling event (see `slm_trace.h`) in the core's ring.
+ * Only called in the critical section, so the core's events are
+ * recorded one at a time.
+ */
+#ifdef SLM_TRACE_ENABLED
+static inline void
+slm_trace(slm_trace_t type, thdid_t tid, u32_t arg)
+{
+	struct slm_trace_ring *r = &slm_global()->trace;
+
+	r->evts[r->head & (SLM_TRACE_NEVTS - 1)] = (struct cos_trace_evt) {
+		.tsc  = slm_now(),
+		.type = type,
+		.thd  = tid,
+		.arg  = arg,
+	};
+	r->head++;
+}
+#else
+static inline void slm_trace(slm_trace_t type, thdid_t tid, u32_t arg) { return; }
+#endif
+
+/*
+ * The thread each core last dispatched: a hint of which threads are
+ * running, read from other cores (see `slm_thd_running`).
+ */
+struct slm_running {
+	thdid_t tid;
+} CACHE_ALIGNED;
+
+static inline void
+slm_running_dispatch(struct slm_thd *t)
+{
+	extern struct slm_running __slm_running[NUM_CPU];
+	struct slm_running *r = &__slm_running[cos_coreid()];
+
+	/* Avoid invalidating the line in the readers' caches */
+	if (r->tid != t->tid) r->tid = t->tid;
+}
+
+/* The maximum length of a chain of donated scheduling contexts */
+#define SLM_DONATION_DEPTH 4
+
 static inline int
 slm_thd_activate(struct slm_thd *curr, struct slm_thd *t, sched_tok_t tok, int inherit_prio)
 {
@@ -111,9 +211,27 @@ slm_thd_activate(struct slm_thd *curr, struct slm_thd *t, sched_tok_t tok, int i
 	tcap_time_t             timeout;
 	int                     ret = 0;
 
+	slm_hist_dispatch(t);
+	slm_trace(SLM_TRACE_SWITCH, t->tid, curr->tid);
 	timeout = g->timeout_next;
 	prio = inherit_prio ? curr->priority : t->priority;
 
+	/* Dispatch the thread executing on t's donated scheduling context */
+	if (unlikely(t->donated)) {
+		struct slm_thd *exec = t;
+		int             i;
+
+		for (i = 0; exec->donated && i < SLM_DONATION_DEPTH; i++) exec = exec->donated;
+		/* We are the thread that should execute on t's context */
+		if (exec == curr) return 0;
+		/* ...with t's budget, if it has its own */
+		if (t->properties & SLM_THD_PROPERTY_OWN_TCAP) {
+			return cos_switch(exec->thd, t->tc, prio, timeout, g->sched_thd.rcv, tok);
+		}
+		t = exec;
+	}
+	slm_running_dispatch(t);
+
 	if (unlikely(t->properties & (SLM_THD_PROPERTY_SEND | SLM_THD_PROPERTY_OWN_TCAP | SLM_THD_PROPERTY_SPECIAL))) {
 		if (t == &g->sched_thd) {
 			timeout = TCAP_TIME_NIL;
@@ -187,6 +305,7 @@ try_again:
 	}
 
 	/* Make a policy decision! */
+	slm_deferred_process();
 	t = slm_sched_schedule();
 	if (unlikely(!t)) t = &g->idle_thd;
 
@@ -0,0 +1,50 @@
+#ifndef SLM_TRACE_H
+#define SLM_TRACE_H
+
+#include <cos_types.h>
+
+/***
+ * Scheduling event tracing, enabled with `SLM_TRACE_ENABLED` in
+ * `cos_config.h`. Each core's scheduler records its events in a ring
+ * of the kernel trace rings' format (`struct cos_trace_evt`, with
+ * timestamps of the same clock), so the two can be merged into
+ * per-thread timelines (see tools/trace_chrome.py). As the kernel's,
+ * the ring overwrites its oldest events, and a reader that falls
+ * behind loses them.
+ *
+ * `thd` is the thread the event is about, and `arg`:
+ *
+ * - `SLM_TRACE_SWITCH`: the thread dispatched, from thread `arg`.
+ * - `SLM_TRACE_BLOCK`: the thread blocks.
+ * - `SLM_TRACE_WAKEUP`: the thread is woken by thread `arg`.
+ * - `SLM_TRACE_WAKEUP_REMOTE`: the thread is woken by an IPI to core
+ *   `arg`, as it executes there.
+ * - `SLM_TRACE_DEPEND`: the thread waits for thread `arg` (e.g. the
+ *   owner of a lock), that it donates its priority to.
+ * - `SLM_TRACE_BLKPT_BLOCK`: the thread waits on blockpoint `arg`
+ *   (e.g. a contended lock take).
+ * - `SLM_TRACE_BLKPT_TRIGGER`: the thread wakes the threads blocked on
+ *   blockpoint `arg` (e.g. a contended lock release).
+ */
+
+typedef enum {
+	SLM_TRACE_SWITCH = 0,
+	SLM_TRACE_BLOCK,
+	SLM_TRACE_WAKEUP,
+	SLM_TRACE_WAKEUP_REMOTE,
+	SLM_TRACE_DEPEND,
+	SLM_TRACE_BLKPT_BLOCK,
+	SLM_TRACE_BLKPT_TRIGGER,
+	SLM_TRACE_NTYPES
+} slm_trace_t;
+
+#define SLM_TRACE_NEVTS 4096 /* a power of two */
+
+struct slm_trace_ring {
+	u64_t                head; /* the next event written */
+	u64_t                tail; /* the next event read */
+	unsigned long        lost;
+	struct cos_trace_evt evts[SLM_TRACE_NEVTS];
+};
+
+#endif /* SLM_TRACE_H */
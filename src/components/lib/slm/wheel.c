@@ -0,0 +1,167 @@
+#include <cos_types.h>
+#include <cos_component.h>
+#include <slm.h>
+#include <wheel.h>
+#include <slm_api.h>
+
+/***
+ * Quantum-based time management, as in `quantum.c`, but with the
+ * timeouts in a hierarchical timing wheel (`twheel.h`) rather than a
+ * heap: adding and canceling timeouts is O(1), with no bound on the
+ * number of timeouts, and cycle wraparound is handled. A wheel tick
+ * is the largest power-of-two number of cycles within the period.
+ * On tickless cores (`slm_tickless`), the timer is only armed for the
+ * tick of the next expiry.
+ */
+struct timer_global {
+	struct twheel w;
+	unsigned int  shift;
+	cycles_t      period;
+	cycles_t      current_timeout;
+} CACHE_ALIGNED;
+
+static struct timer_global __timer_globals[NUM_CPU];
+
+static inline struct timer_global *
+timer_global(void) {
+	return &__timer_globals[cos_coreid()];
+}
+
+/* The first tick at, or after, the timeout, so we never wake early */
+static inline twheel_tick_t
+wheel_tick(struct timer_global *g, cycles_t c)
+{
+	return (c + (1ULL << g->shift) - 1) >> g->shift;
+}
+
+static void
+wheel_wakeup(struct twheel_timer *timer, void *data)
+{
+	struct slm_timer_thd *tt = ps_container(timer, struct slm_timer_thd, timer);
+
+	tt->abs_wakeup = *(cycles_t *)data;
+	slm_thd_wakeup(slm_thd_from_timer(tt), 1);
+}
+
+/* Tickless cores only arm the timer for the tick of the next expiry */
+static void
+wheel_tickless_arm(struct timer_global *g)
+{
+	if (g->w.ntimers) slm_timeout_set(twheel_next(&g->w) << g->shift);
+	else              slm_timeout_clear();
+}
+
+/* The timer expired */
+void
+slm_timer_wheel_expire(cycles_t now)
+{
+	struct timer_global *g = timer_global();
+	cycles_t             offset;
+	cycles_t             next_timeout;
+
+	if (slm_tickless()) {
+		twheel_advance(&g->w, now >> g->shift, wheel_wakeup, &now);
+		wheel_tickless_arm(g);
+
+		return;
+	}
+
+	/* See slm_timer_quantum_expire */
+	if (now < g->current_timeout) {
+		slm_timeout_set(g->current_timeout);
+		twheel_advance(&g->w, now >> g->shift, wheel_wakeup, &now);
+
+		return;
+	}
+
+	offset = (now - g->current_timeout) % g->period;
+ 	assert(g->period > offset);
+	next_timeout = now + (g->period - offset);
+	assert(next_timeout > now);
+
+	slm_timeout_set(next_timeout);
+	g->current_timeout = next_timeout;
+
+	/* ticks up to, and including, the one starting at or before now */
+	twheel_advance(&g->w, now >> g->shift, wheel_wakeup, &now);
+}
+
+int
+slm_timer_wheel_add(struct slm_thd *t, cycles_t absolute_timeout)
+{
+	struct slm_timer_thd *tt = slm_thd_timer_policy(t);
+	struct timer_global  *g  = timer_global();
+
+	assert(tt && !twheel_timer_pending(&tt->timer));
+
+	tt->abs_wakeup = absolute_timeout;
+	if (slm_tickless()) {
+		cycles_t now = slm_now();
+
+		/* Without ticks, the wheel is only advanced on expirations */
+		twheel_advance(&g->w, now >> g->shift, wheel_wakeup, &now);
+	}
+	twheel_add(&g->w, &tt->timer, wheel_tick(g, absolute_timeout));
+	if (slm_tickless()) slm_timeout_earlier(wheel_tick(g, absolute_timeout) << g->shift);
+
+	return 0;
+}
+
+int
+slm_timer_wheel_cancel(struct slm_thd *t)
+{
+	struct slm_timer_thd *tt = slm_thd_timer_policy(t);
+
+	twheel_cancel(&timer_global()->w, &tt->timer);
+
+	return 0;
+}
+
+int
+slm_timer_wheel_thd_init(struct slm_thd *t)
+{
+	struct slm_timer_thd *tt = slm_thd_timer_policy(t);
+
+	twheel_timer_init(&tt->timer);
+	tt->abs_wakeup = 0;
+	slm_timer_period_init(&tt->period);
+
+	return 0;
+}
+
+void
+slm_timer_wheel_thd_deinit(struct slm_thd *t)
+{
+	return;
+}
+
+static void
+slm_policy_timer_init(microsec_t period)
+{
+	struct timer_global *g = timer_global();
+	cycles_t next_timeout, now = slm_now();
+
+	memset(g, 0, sizeof(struct timer_global));
+	g->period = slm_usec2cyc(period);
+	assert(g->period > 1);
+	g->shift  = 63 - __builtin_clzll(g->period);
+	twheel_init(&g->w, now >> g->shift);
+	if (slm_tickless()) {
+		slm_timeout_clear();
+
+		return;
+	}
+
+	next_timeout = now + g->period;
+	g->current_timeout = next_timeout;
+	slm_timeout_set(next_timeout);
+}
+
+int
+slm_timer_wheel_init(void)
+{
+	/* 10ms */
+	slm_policy_timer_init(10000);
+
+	return 0;
+}
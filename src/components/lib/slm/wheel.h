@@ -0,0 +1,16 @@
+#ifndef WHEEL_H
+#define WHEEL_H
+
+#include <slm.h>
+#include <twheel.h>
+#include <slm_policy_timer.h>
+
+SLM_MODULES_TIMER_PROTOTYPES(wheel)
+
+struct slm_timer_thd {
+	struct twheel_timer     timer;
+	cycles_t                abs_wakeup;
+	struct slm_timer_period period;
+};
+
+#endif	/* WHEEL_H */
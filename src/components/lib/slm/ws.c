@@ -0,0 +1,96 @@
+#include <slm.h>
+#include <slm_api.h>
+#include <ws.h>
+#include <cos_component.h>
+
+struct ws_core {
+	unsigned long nrunnable; /* published on each balancing pass */
+	unsigned long steal_to;  /* the core that requested a thread, plus one, or 0 */
+	cycles_t      next;      /* the next balancing pass */
+} CACHE_ALIGNED;
+
+static struct ws_core ws_cores[NUM_CPU];
+
+static struct slm_ws_config ws_config = {
+	.mode      = SLM_WS_PUSH | SLM_WS_STEAL,
+	.period    = 10000,
+	.imbalance = 2,
+	.residency = 50000,
+};
+
+struct ws_filter {
+	cpuid_t  core;
+	cycles_t before; /* only threads migrated before this */
+};
+
+void
+slm_ws_config(struct slm_ws_config *c)
+{
+	assert(c->imbalance > 0);
+	ws_config = *c;
+}
+
+static int
+ws_migratable(struct slm_thd *t, void *d)
+{
+	struct ws_filter *f = d;
+
+	if (t->properties || t->state != SLM_THD_RUNNABLE) return 0;
+
+	return slm_thd_affinity(t, f->core) && !cycles_greater_than(t->migrated_at, f->before);
+}
+
+static int
+ws_give(cpuid_t core, cycles_t now)
+{
+	struct ws_filter f = { .core = core, .before = now - slm_usec2cyc(ws_config.residency) };
+	struct slm_thd  *t;
+
+	t = slm_sched_candidate(ws_migratable, &f);
+	if (!t) return -ENOENT;
+
+	return slm_thd_migrate(t, core);
+}
+
+void
+slm_balance_ws_balance(cycles_t now)
+{
+	struct ws_core *c = &ws_cores[cos_cpuid()];
+	unsigned long   load, l, min = ~0UL, max = 0;
+	unsigned long   thief;
+	cpuid_t         i, least = -1, most = -1;
+
+	/* Dedicated cores neither give, nor take threads */
+	if (slm_tickless() || cycles_greater_than(c->next, now)) return;
+	c->next = now + slm_usec2cyc(ws_config.period);
+
+	load = slm_sched_nrunnable();
+	c->nrunnable = load;
+
+	/* An idle core asked us for a thread */
+	thief = ps_load(&c->steal_to);
+	if (thief && ps_cas(&c->steal_to, thief, 0) && load > 1) {
+		if (!ws_give(thief - 1, now)) return;
+	}
+
+	for (i = 0; i < NUM_CPU; i++) {
+		if (i == cos_cpuid() || slm_core_tickless(i)) continue;
+		l = ps_load(&ws_cores[i].nrunnable);
+		if (l < min) {
+			min   = l;
+			least = i;
+		}
+		if (l > max) {
+			max  = l;
+			most = i;
+		}
+	}
+	if (least < 0) return;
+
+	if ((ws_config.mode & SLM_WS_PUSH) && load >= min + ws_config.imbalance) {
+		ws_give(least, now);
+	} else if ((ws_config.mode & SLM_WS_STEAL) && load == 0 && max >= ws_config.imbalance) {
+		/* the busiest core gives us a thread on its next pass */
+		ps_cas(&ws_cores[most].steal_to, 0, cos_cpuid() + 1);
+	}
+}
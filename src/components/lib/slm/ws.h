@@ -0,0 +1,31 @@
+#ifndef WS_H
+#define WS_H
+
+#include <slm.h>
+
+/*
+ * Work-stealing and -pushing load balancer. Each core, on its
+ * scheduling passes, publishes its number of runnable threads, and
+ * every `period` either pushes a thread to the least loaded core, or,
+ * if it is idle, asks the most loaded core for a thread. Only loads
+ * that differ by `imbalance` or more are balanced, and threads only
+ * move again after `residency` on a core, so that the cost of the
+ * migration (of cache state) is amortized.
+ */
+typedef enum {
+	SLM_WS_PUSH  = 1,
+	SLM_WS_STEAL = 2,
+} slm_ws_mode_t;
+
+struct slm_ws_config {
+	unsigned int  mode; /* of slm_ws_mode_t */
+	microsec_t    period;
+	unsigned long imbalance;
+	microsec_t    residency;
+};
+
+void slm_ws_config(struct slm_ws_config *c);
+
+SLM_MODULES_BALANCE_PROTOTYPES(ws)
+
+#endif	/* WS_H */
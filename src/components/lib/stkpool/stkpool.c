@@ -0,0 +1,106 @@
+#include <errno.h>
+#include <cos_component.h>
+#include <cos_debug.h>
+#include <ps.h>
+#include <memmgr.h>
+#include <stkpool.h>
+
+/***
+ * The free stacks of each core are a lock-free stack, linked by their
+ * lowest word. The stacks are aligned on (at least) `COS_STACK_SZ`, so
+ * the low bits of the head are a version, incremented by each update,
+ * for the pops preempted between reading the head and its next stack
+ * to fail their `cas` if the head was popped and pushed back. The
+ * stacks are never released to the memmgr, so reading the next stack
+ * of a head that was popped is safe.
+ */
+
+#define STKPOOL_VERS_MASK ((unsigned long)COS_STACK_SZ - 1)
+
+struct stkpool_core {
+	unsigned long free[STKPOOL_NCLS];
+} CACHE_ALIGNED;
+
+/* The top of each thread's stack, read by `custom_acquire_stack` */
+unsigned long stkpool_tops[MAX_NUM_THREADS];
+
+static unsigned char       stkpool_cls[MAX_NUM_THREADS];
+static struct stkpool_core stkpool_cores[NUM_CPU];
+
+CWEAKSYMB const stkpool_cls_t stkpool_default_cls = STKPOOL_SMALL;
+
+static inline unsigned long
+stkpool_sz(stkpool_cls_t cls)
+{
+	return cls == STKPOOL_LARGE ? STKPOOL_LARGE_SZ : COS_STACK_SZ;
+}
+
+static unsigned long
+stkpool_pop(unsigned long *head)
+{
+	unsigned long old, stk, next;
+
+	do {
+		old = ps_load(head);
+		stk = old & ~STKPOOL_VERS_MASK;
+		if (!stk) return 0;
+		next = *(unsigned long *)stk;
+	} while (!ps_cas(head, old, next | ((old + 1) & STKPOOL_VERS_MASK)));
+
+	return stk;
+}
+
+static void
+stkpool_push(unsigned long *head, unsigned long stk)
+{
+	unsigned long old;
+
+	do {
+		old                   = ps_load(head);
+		*(unsigned long *)stk = old & ~STKPOOL_VERS_MASK;
+	} while (!ps_cas(head, old, stk | ((old + 1) & STKPOOL_VERS_MASK)));
+}
+
+int
+stkpool_thd_cls(thdid_t tid, stkpool_cls_t cls)
+{
+	assert(tid < MAX_NUM_THREADS && cls < STKPOOL_NCLS);
+	if (stkpool_tops[tid]) return -EBUSY;
+	/* Stored off by one, so zero is the default */
+	stkpool_cls[tid] = cls + 1;
+
+	return 0;
+}
+
+void
+stkpool_thd_alloc(thdid_t tid, coreid_t core)
+{
+	stkpool_cls_t cls;
+	unsigned long stk, sz;
+
+	assert(tid < MAX_NUM_THREADS && core < NUM_CPU);
+	cls = stkpool_cls[tid] ? (stkpool_cls_t)(stkpool_cls[tid] - 1) : stkpool_default_cls;
+	sz  = stkpool_sz(cls);
+
+	stk = stkpool_pop(&stkpool_cores[core].free[cls]);
+	if (!stk) stk = memmgr_heap_page_allocn_aligned(sz / PAGE_SIZE, sz);
+	assert(stk);
+
+	stkpool_tops[tid] = stk + sz;
+}
+
+void
+stkpool_thd_free(thdid_t tid)
+{
+	stkpool_cls_t cls;
+	unsigned long top;
+
+	assert(tid < MAX_NUM_THREADS);
+	top = stkpool_tops[tid];
+	if (!top) return;
+	cls = stkpool_cls[tid] ? (stkpool_cls_t)(stkpool_cls[tid] - 1) : stkpool_default_cls;
+
+	stkpool_tops[tid] = 0;
+	stkpool_cls[tid]  = 0;
+	stkpool_push(&stkpool_cores[cos_coreid()].free[cls], top - stkpool_sz(cls));
+}
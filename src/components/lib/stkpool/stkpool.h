@@ -0,0 +1,56 @@
+#ifndef STKPOOL_H
+#define STKPOOL_H
+
+#include <cos_types.h>
+#include <consts.h>
+
+/***
+ * Thread stacks allocated from the memmgr, on the first entry of each
+ * thread into the component, rather than a static stack for each
+ * possible thread. A component that adds `stkpool` to its
+ * LIBRARY_DEPENDENCIES gets its `custom_acquire_stack` (see
+ * `cos_asm_upcall_simple_stacks.h`), so both the upcalls and the
+ * invocations of the component find their thread's stack in a table.
+ *
+ * There are two classes of stacks: the small ones, of `COS_STACK_SZ`,
+ * and the large ones, of `STKPOOL_LARGE_SZ`, aligned on their size.
+ * The thread id and core id, at the top of the stack, are found by
+ * masking the stack pointer with `COS_STACK_SZ`, so on a large stack,
+ * `cos_thdid` is valid only in its top `COS_STACK_SZ` bytes (e.g. in
+ * the code close to the thread's entry).
+ *
+ * The stacks of the threads that exit are kept on per-core free lists,
+ * for the next threads created on the core.
+ */
+
+#define STKPOOL_LARGE_ORDER 15
+#define STKPOOL_LARGE_SZ    (1 << STKPOOL_LARGE_ORDER)
+
+typedef enum {
+	STKPOOL_SMALL = 0,
+	STKPOOL_LARGE,
+	STKPOOL_NCLS
+} stkpool_cls_t;
+
+/*
+ * The class of the stacks of the threads without one set by
+ * `stkpool_thd_cls`, e.g. for their initial thread: a component
+ * defines it to `STKPOOL_LARGE` to use large stacks by default.
+ */
+extern const stkpool_cls_t stkpool_default_cls;
+
+/*
+ * Set the class of the stack of `tid`, before its first entry in the
+ * component. Returns `-EBUSY` if it already has its stack.
+ */
+int  stkpool_thd_cls(thdid_t tid, stkpool_cls_t cls);
+/*
+ * Return the stack of `tid`, that exited, to the free list of the
+ * current core.
+ */
+void stkpool_thd_free(thdid_t tid);
+
+/* Allocate the stack of `tid`, on its first entry; see stkpool_asm.S */
+void stkpool_thd_alloc(thdid_t tid, coreid_t core);
+
+#endif /* STKPOOL_H */
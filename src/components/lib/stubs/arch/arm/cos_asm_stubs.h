@@ -75,6 +75,7 @@ __cosrt_s_##name:				\
 	svc #0x00;				\
 	.ltorg;
 
+#define cos_asm_stub_direct cos_asm_stub
 #endif
 
 #ifdef COS_UCAP_STUBS
@@ -138,6 +139,7 @@ __cosrt_ucap_##name:				\
 .text /* start out in the text segment, and always return there */
 
 #define cos_asm_stub_indirect cos_asm_stub
+#define cos_asm_stub_direct cos_asm_stub
 
 #endif
 
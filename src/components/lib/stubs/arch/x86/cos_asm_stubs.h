@@ -69,6 +69,8 @@ __cosrt_s_##name:				\
 	COS_ASM_RET_STACK			\
 						\
 	sysenter;
+
+#define cos_asm_stub_direct(name) cos_asm_stub(name)
 #endif
 
 #ifdef COS_UCAP_STUBS
@@ -126,6 +128,7 @@ __cosrt_ucap_##name:                           \
 .text /* start out in the text segment, and always return there */
 
 #define cos_asm_stub_indirect(name) cos_asm_stub(name)
+#define cos_asm_stub_direct(name) cos_asm_stub(name)
 #endif
 
 .text
@@ -4,10 +4,134 @@
 #include <cos_asm_simple_stacks.h>
 
 /* clang-format off */
+#ifdef COS_AINV_STUBS
+/*
+ * The stubs for the asynchronous invocations of an interface (see
+ * ainv.h), compiled with COS_AINV_IF set to the interface's name, and
+ * linked in addition to the regular stubs. The functions of the
+ * interface are numbered in the order of stubs.S, both in the
+ * server's descriptions of them, and in the client's stubs.
+ */
+#define __COS_AINV_STR(s)    #s
+#define COS_AINV_STR(s)      __COS_AINV_STR(s)
+#define __COS_AINV_CAT(a, b) a##b
+#define COS_AINV_CAT(a, b)   __COS_AINV_CAT(a, b)
+/* The interface's function with the suffix, e.g. pong_ainv_attach */
+#define COS_AINV_FN(suffix)  COS_AINV_CAT(COS_AINV_IF, suffix)
+/* The regular stub of an invocation, with its name expanded first */
+#define COS_AINV_SINV(name)  cos_asm_stub(name)
+#endif
+
 #ifdef COS_SERVER_STUBS
 #include "../../../kernel/include/asm_ipc_defs.h"
 //#include <consts.h>
 
+#ifdef COS_STUB_TRACE
+#include <cos_trace.h>
+
+/*
+ * The traced stubs (see cos_trace.h) call the server's function
+ * through __cosrt_trace_call, with the function in %r10 and its
+ * descriptor in %r11. The descriptors are in .invtrace, and the
+ * histograms in .bss.
+ */
+#define COS_ASM_SERVER_CALL(fn, name)				\
+	movabs	$fn, %r10;					\
+	movabs	$__cosrt_trace_##name, %r11;			\
+	call	__cosrt_trace_call;
+
+#define COS_ASM_SERVER_TRACE(name)				\
+.section .invtrace, "aw", @progbits;				\
+.align 16;							\
+__cosrt_trace_##name:						\
+	.quad	__cosrt_trace_name_##name;			\
+	.quad	__cosrt_trace_cores_##name;			\
+.section .rodata;						\
+__cosrt_trace_name_##name:					\
+	.asciz	#name;						\
+.section .bss;							\
+.align 64;							\
+__cosrt_trace_cores_##name:					\
+	.zero	COS_TRACE_FN_SZ;				\
+.text;
+
+/*
+ * Call the function with the arguments in registers, and record the
+ * cycles it took in the histogram of the core that it returned on.
+ * The function's return value is returned. Each traced interface's
+ * stubs define it, so that it is weak.
+ */
+.text
+.weak  __cosrt_trace_call
+.type  __cosrt_trace_call, @function
+.align 16
+__cosrt_trace_call:
+	pushq	%rbx
+	pushq	%r12
+	pushq	%r13
+	pushq	%r14
+	pushq	%r15
+	movq	%r10, %rbx
+	movq	%r11, %r12
+	/* rdtsc clobbers the third argument */
+	movq	%rdx, %r13
+	rdtsc
+	shlq	$32, %rdx
+	orq	%rdx, %rax
+	movq	%rax, %r15
+	movq	%r13, %rdx
+	callq	*%rbx
+	movq	%rax, %r13
+	/* the end, and the core id (see the callgates) */
+	rdtscp
+	shlq	$32, %rdx
+	orq	%rdx, %rax
+	movq	%rax, %r14
+	subq	%r15, %rax
+	andq	$0xfff, %rcx
+	cmpq	$NUM_CPU, %rcx
+	jae	3f
+	imulq	$COS_TRACE_CORE_SZ, %rcx
+	movq	8(%r12), %rdx
+	addq	%rcx, %rdx
+	cmpq	$0, COS_TRACE_N(%rdx)
+	jne	1f
+	movq	%r15, COS_TRACE_FIRST(%rdx)
+1:
+	incq	COS_TRACE_N(%rdx)
+	addq	%rax, COS_TRACE_TOTAL(%rdx)
+	movq	%r14, COS_TRACE_LAST(%rdx)
+	cmpq	COS_TRACE_MAX(%rdx), %rax
+	jbe	2f
+	movq	%rax, COS_TRACE_MAX(%rdx)
+2:
+	/* 4 buckets per power of two: 4 * (msb - 1) + the 2 bits below the msb */
+	cmpq	$4, %rax
+	jb	4f
+	bsrq	%rax, %rcx
+	subq	$2, %rcx
+	movq	%rax, %r8
+	shrq	%cl, %r8
+	andq	$3, %r8
+	leaq	4(%r8, %rcx, 4), %rax
+	cmpq	$(COS_TRACE_NBUCKETS - 1), %rax
+	jbe	4f
+	movq	$(COS_TRACE_NBUCKETS - 1), %rax
+4:
+	incl	COS_TRACE_HIST(%rdx, %rax, 4)
+3:
+	movq	%r13, %rax
+	popq	%r15
+	popq	%r14
+	popq	%r13
+	popq	%r12
+	popq	%rbx
+	retq
+#else
+#define COS_ASM_SERVER_CALL(fn, name) call fn;
+#define COS_ASM_SERVER_TRACE(name)
+#endif
+
 /*
  * This is the default, simple stub that is a slightly faster path.
  * Calls the server's function directly, instead of indirecting
@@ -32,7 +156,7 @@ __cosrt_s_##name:						\
 	mov %rax, %rdx;						\
 	/* ABI mandate a 16-byte alignment stack pointer*/	\
 	and $~0xf, %rsp;					\
-	call name ;						\
+	COS_ASM_SERVER_CALL(name, name)				\
  	/* addl $16, %esp; */					\
 	mov %rax, %r8;						\
 	mov $RET_CAP, %rax;					\
@@ -54,9 +178,10 @@ __cosrt_alts_##name: 						\
 	pushq	%rcx;						\
 	movq    %r8, %rcx;					\
 	movq    %r9, %rdx;					\
-	callq   name;						\
+	COS_ASM_SERVER_CALL(name, name)				\
 	popq	%rcx;						\
 	retq ;							\
+	COS_ASM_SERVER_TRACE(name)
 								
 /*
  * This stub enables three return values (%ecx, %esi, %edi), AND
@@ -81,7 +206,7 @@ __cosrt_s_##name:						\
 	mov %rdi, %r12;						\
 	mov %rbx, %rdi;						\
 	mov %r12, %rdx;						\
-	call __cosrt_s_cstub_##name ;				\
+	COS_ASM_SERVER_CALL(__cosrt_s_cstub_##name, name)	\
 	pop %rdi;						\
 	pop %rsi;						\
 	mov %rax, %r8;						\
@@ -107,12 +232,57 @@ __cosrt_alts_##name: 						\
 	movq	%rsp, %r8;					\
 	pushq	$0;						\
 	movq	%rsp, %r9;					\
-	callq   __cosrt_s_cstub_##name;				\
+	COS_ASM_SERVER_CALL(__cosrt_s_cstub_##name, name)	\
 	popq	%rdi;						\
 	popq	%rsi;						\
 	popq	%rcx;						\
-	retq ;							
+	retq ;							\
+	COS_ASM_SERVER_TRACE(name)
 						
+/* The server side of the client's specialized stub is the default one */
+#define cos_asm_stub_direct(name) cos_asm_stub(name)
+
+#ifdef COS_AINV_STUBS
+/*
+ * The server describes each of its functions (struct ainv_op) in
+ * .ainvops, with the function that its workers call with the
+ * request's 4 arguments, and pointers for 2 more return values: the
+ * server's function for cos_asm_stub, and its C stub for
+ * cos_asm_stub_indirect. The <if>_ainv_attach and <if>_ainv_sq
+ * invocations are implemented by the ainv library, for all of the
+ * server's asynchronous interfaces.
+ */
+.section .rodata
+__cosrt_ainv_if:
+	.asciz	COS_AINV_STR(COS_AINV_IF)
+.text
+.globl COS_AINV_FN(_ainv_attach)
+.type  COS_AINV_FN(_ainv_attach), @function
+.align 16
+COS_AINV_FN(_ainv_attach):
+	movabs	$__cosrt_ainv_if, %rdx
+	jmp	ainv_server_attach
+.globl COS_AINV_FN(_ainv_sq)
+.type  COS_AINV_FN(_ainv_sq), @function
+.align 16
+COS_AINV_FN(_ainv_sq):
+	jmp	ainv_server_sq
+
+COS_AINV_SINV(COS_AINV_FN(_ainv_attach))
+COS_AINV_SINV(COS_AINV_FN(_ainv_sq))
+
+#define COS_AINV_OP(fn)						\
+.section .ainvops, "aw", @progbits;				\
+.align 16;							\
+	.quad	__cosrt_ainv_if;				\
+	.quad	fn;						\
+.text;
+
+#undef cos_asm_stub
+#undef cos_asm_stub_indirect
+#define cos_asm_stub(name) COS_AINV_OP(name)
+#define cos_asm_stub_indirect(name) COS_AINV_OP(__cosrt_s_cstub_##name)
+#endif
 
 #endif
 #ifdef COS_UCAP_STUBS
@@ -153,9 +323,9 @@ __cosrt_alts_##name: 						\
  * 	- save callee saved registers to the client stack
  * 	- save the parameters in rcx and rdx; we will need these 
  * 		for scratch registers
- * 	- load the client AUTH token into r15; this value is JITed
+ * 	- load the client AUTH token into r15; this value is patched
  * 		at boot time
- * 	- get the tid off the stack
+ * 	- get the tid and cpuid off the stack
  * 	- use the tid to index into the user-level kernel memory
  * 		and get a pointer to this thread's user-level 
  * 		invocation stack
@@ -167,7 +337,7 @@ __cosrt_alts_##name: 						\
  * 	- put the invocation token into rbp, just like in 
  * 		a normal sinv
  * 	- check the client AUTH token to verify we got without
- * 		tampering
+ * 		tampering, faulting (ud2) otherwise
  * 	- save the return address into rcx; we are switching stacks
  * 		and cant using the stack for control flow
  * 	- jump to the server side of the callgate. this:
@@ -185,80 +355,118 @@ __cosrt_alts_##name: 						\
  * 	- put the return value back into rax
  * 	- pop callee saved regs
  *
+ * The values that are specific to the (client, server, function) of
+ * the callgate (AUTH tokens, sinvcap, invocation token, PKRU values,
+ * and server function) are immediates that the booter patches (see
+ * mpk_jit.h). Their offsets from __cosrt_fast_callgate_* are in the
+ * 32 bytes before it (COS_CALLGATE_RELOCS), so patching a callgate
+ * is a store at each of those offsets.
  */
 
 #define UL_KERNEL_MPK_KEY 0x01
+/* Must match MPK_JIT_RELOCS_MAGIC in mpk_jit.h */
+#define COS_CALLGATE_RELOCS_MAGIC 0xca11
 
-#define cos_asm_stub(name)					\
-.text;								\
-.weak name;							\
-.globl __cosrt_extern_##name;					\
-.type  name, @function;						\
-.type  __cosrt_extern_##name, @function;			\
-.align 16 ;							\
-name:								\
-__cosrt_extern_##name:						\
-	movabs $__cosrt_ucap_##name, %rax ;			\
-	callq *INVFN(%rax) ;					\
-	retq ;							\
+#define COS_CALLGATE_RELOCS(name)				\
 .global  __cosrt_fast_callgate_##name;				\
 .type  __cosrt_fast_callgate_##name, @function;			\
-.align 16 ;							\
-__cosrt_fast_callgate_##name:					\
-	/* callee saved */					\
-	pushq	%rbp;						\
-	pushq	%r13; /* tid | cpuid << 16 */			\
-	pushq	%r14; /* struct ulk_invstk ptr  */		\
-	pushq	%r15; /* auth tok */				\
+.align 32 ;							\
+	.short	COS_CALLGATE_RELOCS_MAGIC;			\
+	.short	.L__cosrt_cg_clitok_ld_##name - 8 - __cosrt_fast_callgate_##name;	\
+	.short	.L__cosrt_cg_clitok_chk_##name - 8 - __cosrt_fast_callgate_##name;	\
+	.short	.L__cosrt_cg_srvtok_ld_##name - 8 - __cosrt_fast_callgate_##name;	\
+	.short	.L__cosrt_cg_srvtok_chk_##name - 8 - __cosrt_fast_callgate_##name;	\
+	.short	.L__cosrt_cg_capno_##name - 8 - __cosrt_fast_callgate_##name;	\
+	.short	.L__cosrt_cg_invtok_##name - 8 - __cosrt_fast_callgate_##name;	\
+	.short	.L__cosrt_cg_srvpkru_##name - 4 - __cosrt_fast_callgate_##name;	\
+	.short	.L__cosrt_cg_clipkru_##name - 4 - __cosrt_fast_callgate_##name;	\
+	.short	.L__cosrt_cg_srvfn_##name - 8 - __cosrt_fast_callgate_##name;	\
+	.fill	6, 2, 0;					\
+__cosrt_fast_callgate_##name:
+
+/*
+ * The body of the callgate, between the saving and restoring of the
+ * callee saved registers: the labels follow the patched immediates.
+ */
+#define COS_CALLGATE_INVOKE(name)				\
 	movq    %rcx, %r8;					\
 	movq    %rdx, %r9;					\
-	movq    $0xdeadbeefdeadbeef, %r15; 			\
-	/* thread ID and cpu ID */				\
-	rdtscp ;						\
-	movq    %rcx, %rax;                 \
-	andq    $0xFFF, %rax;                \
+	movabs  $0, %r15;					\
+.L__cosrt_cg_clitok_ld_##name:					\
+	/* thread ID and cpu ID, at the top of the stack */	\
 	movq    %rsp, %rdx;					\
 	andq    $0xfffffffffffe0000, %rdx;			\
+	movzwq  COS_SIMPLE_STACK_CPUID_OFF(%rdx), %rax;		\
 	movzwq  COS_SIMPLE_STACK_THDID_OFF(%rdx), %r13;		\
 	shl	$16, %rax;					\
 	or	%rax, %r13;					\
 	COS_ULINV_GET_INVSTK					\
 	COS_ULINV_SWITCH_DOMAIN(UL_KERNEL_MPK_KEY)		\
-	COS_ULINV_PUSH_INVSTK					\
-	COS_ULINV_SWITCH_DOMAIN(0xfffffffe)			\
+	COS_ULINV_PUSH_INVSTK(.L__cosrt_cg_capno_##name)		\
+	COS_ULINV_SWITCH_PKRU_AT(.L__cosrt_cg_srvpkru_##name)	\
 	/* invocation token */					\
-	movabs  $0x0123456789abcdef, %rbp;			\
+	movabs  $0, %rbp;					\
+.L__cosrt_cg_invtok_##name:					\
 	/* check client token */				\
-	movq    $0xdeadbeefdeadbeef, %rax;			\
+	movabs  $0, %rax;					\
+.L__cosrt_cg_clitok_chk_##name:					\
 	cmp     %rax, %r15;					\
-	/* TODO: jne     bad */					\
-	movabs	$0x1212121212121212, %rax;			\
+	jne     callgate_bad_##name;				\
+	movabs	$0, %rax;					\
+.L__cosrt_cg_srvfn_##name:					\
 	movabs	$srv_call_ret_##name, %rcx;			\
 	jmpq   *%rax;						\
 srv_call_ret_##name:						\
 	movq	%rax, %r8;					\
 	/* save server authentication token */			\
-	movq    $0xdeadbeefdeadbeef, %r15;			\
+	movabs  $0, %r15;					\
+.L__cosrt_cg_srvtok_ld_##name:					\
 	/* thread ID */						\
 	movq    %rsp, %rdx;					\
 	andq    $0xfffffffffffe0000, %rdx;			\
 	movzwq  COS_SIMPLE_STACK_THDID_OFF(%rdx), %r13;		\
 	COS_ULINV_GET_INVSTK					\
-	COS_ULINV_SWITCH_DOMAIN(0x01)				\
+	COS_ULINV_SWITCH_DOMAIN(UL_KERNEL_MPK_KEY)		\
 	COS_ULINV_POP_INVSTK					\
-	COS_ULINV_SWITCH_DOMAIN(0xfffffffe)			\
+	COS_ULINV_SWITCH_PKRU_AT(.L__cosrt_cg_clipkru_##name)	\
 	/* check server token */				\
-	movq    $0xdeadbeefdeadbeef, %rax;			\
+	movabs  $0, %rax;					\
+.L__cosrt_cg_srvtok_chk_##name:					\
 	cmp     %rax, %r15;					\
-	/* TODO: jne     bad */					\
-	movq    %r8, %rax;					\
+	jne     callgate_bad_##name;				\
+	movq    %r8, %rax;
+
+#define cos_asm_stub(name)					\
+.text;								\
+.weak name;							\
+.globl __cosrt_extern_##name;					\
+.type  name, @function;						\
+.type  __cosrt_extern_##name, @function;			\
+.align 16 ;							\
+name:								\
+__cosrt_extern_##name:						\
+	movabs $__cosrt_ucap_##name, %rax ;			\
+	callq *INVFN(%rax) ;					\
+	retq ;							\
+	cos_asm_callgate(name)
+
+#define cos_asm_callgate(name)					\
+	COS_CALLGATE_RELOCS(name)				\
+	/* callee saved */					\
+	pushq	%rbp;						\
+	pushq	%r13; /* tid | cpuid << 16 */			\
+	pushq	%r14; /* struct ulk_invstk ptr  */		\
+	pushq	%r15; /* auth tok */				\
+	COS_CALLGATE_INVOKE(name)				\
 	/* callee saved */					\
 	popq	%r15;						\
 	popq	%r14;						\
 	popq	%r13;						\
 	popq	%rbp;						\
 	retq;							\
-								\
+	/* entered mid-callgate: auth tokens do not match */	\
+callgate_bad_##name:						\
+	ud2;							\
 								\
 .section .ucap, "a", @progbits ;				\
 .globl __cosrt_ucap_##name ;					\
@@ -269,6 +477,88 @@ __cosrt_ucap_##name:						\
 .text /* start out in the text segment, and always return there */
 
 
+/*
+ * The specialized stub for the hot functions of an interface that
+ * take at most 4 word arguments in registers, and return a single
+ * value (i.e. whose server uses cos_asm_stub). The client's symbol
+ * does the invocation itself, instead of indirecting through the
+ * ucap's C stub (cos_sinv in __cosrt_c_cosrtdefault):
+ *
+ * - when the server is in another address space, the composer
+ *   allocates the sinv's capability statically, and writes it
+ *   (already shifted) in the immediate at __cosrt_capimm_*, so the
+ *   arguments are moved from the C ABI's registers to the kernel's
+ *   (see call_cap_asm), and the sinv is made without touching the
+ *   ucap;
+ * - otherwise, the immediate is 0: when the booter set a user-level
+ *   callgate (the server shares our address space), tail-call into
+ *   it with the arguments untouched, so that the server's function
+ *   returns directly to our caller, else make the sinv with the
+ *   capability in the ucap.
+ *
+ * __cosrt_direct_* marks the specialization for the composer, that
+ * checks that no client C stub (which would be bypassed) is defined
+ * for the function, and that the server's stub returns a single
+ * value.
+ */
+#define UCAP_CAPNO 8
+#define UCAP_ALTFN 16
+
+#define cos_asm_stub_direct(name)				\
+.text;								\
+.weak name;							\
+.globl __cosrt_extern_##name;					\
+.globl __cosrt_direct_##name;					\
+.globl __cosrt_capimm_##name;					\
+.type  name, @function;						\
+.type  __cosrt_extern_##name, @function;			\
+.type  __cosrt_direct_##name, @function;			\
+.align 16 ;							\
+name:								\
+__cosrt_extern_##name:						\
+__cosrt_direct_##name:						\
+	movabs	$0, %r11;					\
+.set __cosrt_capimm_##name, . - 8;				\
+	testq	%r11, %r11;					\
+	jz	3f;						\
+4:								\
+	/* callee saved, and clobbered by the kernel */		\
+	pushq	%rbx;						\
+	pushq	%r12;						\
+	movq	%rdi, %rbx;					\
+	movq	%rdx, %rdi;					\
+	movq	%rcx, %rdx;					\
+	movq	%r11, %rax;					\
+	/* frame ctx, restored by the two pops on return */	\
+	leaq	-16(%rsp), %rcx;				\
+	subq	$16, %rsp;					\
+	movq	%rbp, (%rcx);					\
+	leaq	16(%rcx), %rbp;					\
+	movq	%rbp, 8(%rcx);					\
+	movq	%rcx, %rbp;					\
+	movabs	$2f, %r8;					\
+	syscall;						\
+	/* the fault path returns here, and falls through */	\
+.align 8;							\
+2:								\
+	popq	%rbp;						\
+	popq	%rsp;						\
+	popq	%r12;						\
+	popq	%rbx;						\
+	retq ;							\
+3:								\
+	movabs $__cosrt_ucap_##name, %rax ;			\
+	movq	UCAP_ALTFN(%rax), %r10;				\
+	testq	%r10, %r10;					\
+	jz	1f;						\
+	jmpq	*%r10;						\
+1:								\
+	movq	UCAP_CAPNO(%rax), %r11;				\
+	addq	$1, %r11;					\
+	shlq	$COS_CAPABILITY_OFFSET, %r11;			\
+	jmp	4b;						\
+	cos_asm_callgate(name)
+
 #define cos_asm_stub_indirect(name)				\
 .text;								\
 .weak name;							\
@@ -281,10 +571,7 @@ __cosrt_extern_##name:						\
 	movabs $__cosrt_ucap_##name, %rax ;			\
 	callq *INVFN(%rax) ;					\
 	retq ;							\
-.global  __cosrt_fast_callgate_##name;				\
-.type  __cosrt_fast_callgate_##name, @function;			\
-.align 16 ;							\
-__cosrt_fast_callgate_##name:					\
+	COS_CALLGATE_RELOCS(name)				\
 	/* callee saved */					\
 	pushq	%rbp;						\
 	pushq	%rbx;						\
@@ -295,48 +582,7 @@ __cosrt_fast_callgate_##name:					\
 	/* save the two return ptrs in perserved regs */	\
  	movq	%r8, %r12;					\
  	movq	%r9, %rbx;					\
-	movq    %rcx, %r8;					\
-	movq    %rdx, %r9;					\
-	movq    $0xdeadbeefdeadbeef, %r15; 			\
-	/* thread ID and cpu ID */				\
-	rdtscp ;						\
-	movq    %rcx, %rdx;                 \
-	andq    $0xFFF, %rax;                \
-	movq    %rsp, %rdx;					\
-	andq    $0xfffffffffffe0000, %rdx;			\
-	movzwq  COS_SIMPLE_STACK_THDID_OFF(%rdx), %r13;		\
-	shl	$16, %rax;					\
-	or	%rax, %r13;					\
-	COS_ULINV_GET_INVSTK					\
-	COS_ULINV_SWITCH_DOMAIN(UL_KERNEL_MPK_KEY)		\
-	COS_ULINV_PUSH_INVSTK					\
-	COS_ULINV_SWITCH_DOMAIN(0xfffffffe)			\
-	/* invocation token */					\
-	movabs  $0x0123456789abcdef, %rbp;			\
-	/* check client token */				\
-	movq    $0xdeadbeefdeadbeef, %rax;			\
-	cmp     %rax, %r15;					\
-	/* TODO: jne     bad */					\
-	movabs	$0x1212121212121212, %rax;			\
-	movabs	$srv_call_ret_##name, %rcx;			\
-	jmpq   	*%rax;						\
-srv_call_ret_##name:						\
-	movq	%rax, %r8;					\
-	/* save server authentication token */			\
-	movq    $0xdeadbeefdeadbeef, %r15;			\
-	/* thread ID */						\
-	movq    %rsp, %rdx;					\
-	andq    $0xfffffffffffe0000, %rdx;			\
-	movzwq  COS_SIMPLE_STACK_THDID_OFF(%rdx), %r13;		\
-	COS_ULINV_GET_INVSTK					\
-	COS_ULINV_SWITCH_DOMAIN(0x01)				\
-	COS_ULINV_POP_INVSTK					\
-	COS_ULINV_SWITCH_DOMAIN(0xfffffffe)			\
-	/* check server token */				\
-	movq    $0xdeadbeefdeadbeef, %rax;			\
-	cmp     %rax, %r15;					\
-	/* TODO: jne     bad */					\
-	movq    %r8, %rax;					\
+	COS_CALLGATE_INVOKE(name)				\
 	movq	%rsi, (%r12);					\
 	movq	%rdi, (%rbx);					\
 	/* callee saved */					\
@@ -347,7 +593,9 @@ srv_call_ret_##name:						\
 	popq	%rbx;						\
 	popq	%rbp;						\
 	retq;							\
-								\
+	/* entered mid-callgate: auth tokens do not match */	\
+callgate_bad_##name:						\
+	ud2;							\
 								\
 .section .ucap, "a", @progbits ;				\
 .globl __cosrt_ucap_##name ;					\
@@ -357,6 +605,41 @@ __cosrt_ucap_##name:						\
 	.endr ;							\
 .text /* start out in the text segment, and always return there */			\
 
+#ifdef COS_AINV_STUBS
+/*
+ * The client's <fn>_async(struct ainv *a, p0, p1, p2, p3) submits a
+ * request for the function, with its number, to the server with
+ * ainv_call(a, op, p0, p1, p2, p3), and returns its tag. The ucaps of
+ * the <if>_ainv_attach and <if>_ainv_sq invocations are also defined,
+ * so that the composer creates their capabilities.
+ */
+COS_AINV_SINV(COS_AINV_FN(_ainv_attach))
+COS_AINV_SINV(COS_AINV_FN(_ainv_sq))
+
+.set __cosrt_ainv_op, 0
+
+#define COS_AINV_ASYNC(name)					\
+.text;								\
+.globl name##_async;						\
+.type  name##_async, @function;					\
+.align 16;							\
+name##_async:							\
+	movq	%r8, %r9;					\
+	movq	%rcx, %r8;					\
+	movq	%rdx, %rcx;					\
+	movq	%rsi, %rdx;					\
+	movq	$__cosrt_ainv_op, %rsi;				\
+	jmp	ainv_call;					\
+.set __cosrt_ainv_op, __cosrt_ainv_op + 1;
+
+#undef cos_asm_stub
+#undef cos_asm_stub_indirect
+#undef cos_asm_stub_direct
+#define cos_asm_stub(name) COS_AINV_ASYNC(name)
+#define cos_asm_stub_indirect(name) COS_AINV_ASYNC(name)
+#define cos_asm_stub_direct(name) COS_AINV_ASYNC(name)
+#endif
+
 #endif
 
 .text
@@ -1,7 +1,12 @@
 #ifndef COS_ASM_STUB_H
 #define COS_ASM_STUB_H
 
-#if defined(__x86__)
+#if defined(COS_AINV_STUBS) && !defined(__x86_64__)
+/* Asynchronous invocations (see ainv.h) are only supported on x86_64 */
+#define cos_asm_stub(name)
+#define cos_asm_stub_indirect(name)
+#define cos_asm_stub_direct(name)
+#elif defined(__x86__)
 #include "arch/x86/cos_asm_stubs.h"
 #elif defined(__x86_64__)
 #include "arch/x86_64/cos_asm_stubs.h"
@@ -0,0 +1,117 @@
+#ifndef COS_TRACE_H
+#define COS_TRACE_H
+
+/*
+ * Tracing of the invocations of a server's interface functions. A
+ * server whose export of an interface is declared `trace = true` in
+ * the composition script is linked with the interface's traced server
+ * stubs, that time each invocation of each function from the stub's
+ * entry to its return (so excluding the kernel's invocation path),
+ * and aggregate the latencies in a histogram of the function, for
+ * each core. Other servers are linked with the regular stubs, so
+ * tracing costs nothing when it isn't enabled.
+ *
+ * The histograms have 4 buckets per power of two of cycles (so a
+ * bucket's values are within 25% of each other), and are only
+ * updated on their core, so recording takes no atomic
+ * instructions. `cos_trace_report` prints them, as JSON lines
+ * beginning with `{"invtrace":`.
+ *
+ * Only the x86_64 stubs are traced: on the other architectures, the
+ * traced stubs are the regular ones.
+ *
+ * This file is included by the assembly stubs, for the layout of the
+ * histograms.
+ */
+
+#include <cos_config.h>
+
+#define COS_TRACE_NBUCKETS 128 /* up to 2^33 cycles */
+#define COS_TRACE_N        0
+#define COS_TRACE_TOTAL    8
+#define COS_TRACE_MAX      16
+#define COS_TRACE_FIRST    24
+#define COS_TRACE_LAST     32
+#define COS_TRACE_HIST     64
+#define COS_TRACE_CORE_SZ  (COS_TRACE_HIST + 4 * COS_TRACE_NBUCKETS)
+#define COS_TRACE_FN_SZ    (NUM_CPU * COS_TRACE_CORE_SZ)
+
+#ifndef __ASSEMBLER__
+
+#include <cos_component.h>
+#include <llprint.h>
+
+/* A function's invocations on a core; see the offsets above */
+struct cos_trace_core {
+	u64_t n;
+	u64_t total;
+	u64_t max;
+	u64_t first, last; /* the first invocation's start, and the last's end */
+	u64_t pad[3];
+	u32_t hist[COS_TRACE_NBUCKETS];
+} __attribute__((aligned(64)));
+
+/* The stubs emit one for each traced function, in the .invtrace section */
+struct cos_trace_fn {
+	const char            *name;
+	struct cos_trace_core *cores; /* [NUM_CPU] */
+};
+
+/* Delimit the .invtrace section, see the linker scripts */
+extern struct cos_trace_fn __cosrt_trace_start[], __cosrt_trace_end[];
+
+/* The smallest latency that falls in the bucket */
+static inline u64_t
+cos_trace_bucket_min(int b)
+{
+	if (b < 4) return b;
+
+	return (u64_t)(4 + b % 4) << (b / 4 - 1);
+}
+
+/* The bucket of the ptile (in millionths) of the latencies */
+static inline u64_t
+cos_trace_ptile(struct cos_trace_core *c, u64_t ptile)
+{
+	u64_t rank = (c->n * ptile + 999999) / 1000000, seen = 0;
+	int   b;
+
+	for (b = 0; b < COS_TRACE_NBUCKETS; b++) {
+		seen += c->hist[b];
+		if (seen >= rank && seen > 0) return cos_trace_bucket_min(b);
+	}
+
+	return cos_trace_bucket_min(COS_TRACE_NBUCKETS - 1);
+}
+
+/*
+ * Print the latencies of each traced function on each core it was
+ * invoked on. The percentiles are the smallest latency of their
+ * bucket, and `span` is the cycles from the first invocation to the
+ * end of the last, so `n / span` is the rate of invocations.
+ */
+static inline void
+cos_trace_report(void)
+{
+	struct cos_trace_fn   *f;
+	struct cos_trace_core *c;
+	int                    i;
+
+	for (f = __cosrt_trace_start; f < __cosrt_trace_end; f++) {
+		for (i = 0; i < NUM_CPU; i++) {
+			c = &f->cores[i];
+			if (c->n == 0) continue;
+
+			/* printc's buffer is small, so the line is printed in parts */
+			printc("{\"invtrace\":\"%s\",\"comp\":%lu,\"core\":%d,\"n\":%llu,\"span\":%llu,", f->name,
+			       (unsigned long)cos_compid(), i, c->n, c->last - c->first);
+			printc("\"unit\":\"cycles\",\"avg\":%llu,\"p50\":%llu,\"p90\":%llu,\"p99\":%llu,\"max\":%llu}\n",
+			       c->total / c->n, cos_trace_ptile(c, 500000), cos_trace_ptile(c, 900000),
+			       cos_trace_ptile(c, 990000), c->max);
+		}
+	}
+}
+
+#endif /* __ASSEMBLER__ */
+
+#endif /* COS_TRACE_H */
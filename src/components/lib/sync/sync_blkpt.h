@@ -117,8 +117,17 @@
 
 struct sync_blkpt {
 	sched_blkpt_id_t  id;
+	/* the adaptive spin budget, see `sync_blkpt_spin` */
+	u32_t spin;
 	/* most significant bit specifies blocked thds */
 	sched_blkpt_epoch_t epoch_blocked;
+	/*
+	 * The blockpoint of the wait-set this is in, also triggered
+	 * with this one (see `sync_wait_any`). It is a pointer in the
+	 * waiting component, so blockpoints in memory shared with
+	 * other components can't be added to a wait-set.
+	 */
+	struct sync_blkpt *any;
 };
 
 struct sync_blkpt_checkpoint {
@@ -145,7 +154,9 @@ sync_blkpt_init_w_id(struct sync_blkpt *blkpt, sched_blkpt_id_t id)
 {
 	*blkpt = (struct sync_blkpt){
 		.id = id,
-		.epoch_blocked = 0
+		.epoch_blocked = 0,
+		.spin = 0,
+		.any = NULL
 	};
 
 	return;
@@ -266,7 +277,7 @@ __sync_blkpt_atomic_wait(sched_blkpt_epoch_t *ec, sched_blkpt_epoch_t chkpt, syn
  * - @flags - Flags to modify the blockpoint's behavior.
  */
 static inline void
-sync_blkpt_id_activate(struct sync_blkpt *blkpt, sched_blkpt_id_t id, int blocked, sync_blkpt_flags_t flags)
+__sync_blkpt_id_activate(struct sync_blkpt *blkpt, sched_blkpt_id_t id, int blocked, sync_blkpt_flags_t flags)
 {
 	/*
 	 * Note that the flags should likely be passed in statically,
@@ -297,6 +308,16 @@ sync_blkpt_id_activate(struct sync_blkpt *blkpt, sched_blkpt_id_t id, int blocke
 	sched_blkpt_trigger(id, SYNC_BLKPT_EPOCH(saved + 1), 0);
 }
 
+static inline void
+sync_blkpt_id_activate(struct sync_blkpt *blkpt, sched_blkpt_id_t id, int blocked, sync_blkpt_flags_t flags)
+{
+	struct sync_blkpt *any = ps_load(&blkpt->any);
+
+	/* A thread might wait for this event along with others */
+	if (unlikely(any)) __sync_blkpt_id_activate(any, any->id, 0, flags);
+	__sync_blkpt_id_activate(blkpt, id, blocked, flags);
+}
+
 /**
  * Trigger an event on the blockpoint. This will *only* attempt to
  * wake up threads if they have been previously
@@ -333,8 +354,39 @@ sync_blkpt_wake(struct sync_blkpt *blkpt, sync_blkpt_flags_t flags)
 	sync_blkpt_id_wake(blkpt, blkpt->id, flags);
 }
 
-/* Wake only a single, specified thread (tracked manually in the data-structure) */
-/* void sync_blkpt_trigger_one(struct sync_blkpt *blkpt, sync_blkpt_flags_t flags, cos_thdid_t thdid); */
+/**
+ * Wake a single blocked thread, for data-structures that count their
+ * waiters, and hand a resource (e.g. a lock, or a semaphore's count)
+ * to one of them, rather than waking all of them to contend for it,
+ * and re-block. As several threads might wait at the time of the
+ * event, they must recheck the data-structure when they wake up, and
+ * the thread that doesn't get the resource waits again.
+ *
+ * Every event increments the epoch (keeping the blocked bit), so
+ * that the threads that are about to block see it, and concurrent
+ * wakeups each wake a thread.
+ */
+static inline void
+sync_blkpt_id_wake_one(struct sync_blkpt *blkpt, sched_blkpt_id_t id, sync_blkpt_flags_t flags)
+{
+	struct sync_blkpt  *any = ps_load(&blkpt->any);
+	sched_blkpt_epoch_t saved;
+
+	if (unlikely(any)) __sync_blkpt_id_activate(any, any->id, 0, flags);
+	if (flags == SYNC_BLKPT_UNIPROC) {
+		saved = ps_load(&blkpt->epoch_blocked);
+		blkpt->epoch_blocked = saved + 1;
+	} else {
+		saved = ps_faa(&blkpt->epoch_blocked, 1);
+	}
+	sched_blkpt_trigger(id, SYNC_BLKPT_EPOCH(saved + 1), 1);
+}
+
+static inline void
+sync_blkpt_wake_one(struct sync_blkpt *blkpt, sync_blkpt_flags_t flags)
+{
+	sync_blkpt_id_wake_one(blkpt, blkpt->id, flags);
+}
 
 /**
  * Checkpoint the state of the current event counter. This checkpoint
@@ -395,23 +447,98 @@ sync_blkpt_blocking(struct sync_blkpt *blkpt, sync_blkpt_flags_t flags, struct s
  * - @chkpt  - the previously taken checkpoint
  */
 static inline void
-sync_blkpt_id_wait(struct sync_blkpt *blkpt, sched_blkpt_id_t id, sync_blkpt_flags_t flags, struct sync_blkpt_checkpoint *chkpt)
+sync_blkpt_id_wait_dep(struct sync_blkpt *blkpt, sched_blkpt_id_t id, sync_blkpt_flags_t flags, struct sync_blkpt_checkpoint *chkpt, thdid_t dep)
 {
-	if (unlikely(sched_blkpt_block(id, SYNC_BLKPT_EPOCH(chkpt->epoch_blocked), 0))) {
+	if (unlikely(sched_blkpt_block(id, SYNC_BLKPT_EPOCH(chkpt->epoch_blocked), dep))) {
 		BUG(); 		/* we are using a blkpt id that doesn't exist! */
 	}
 }
 
+static inline void
+sync_blkpt_id_wait(struct sync_blkpt *blkpt, sched_blkpt_id_t id, sync_blkpt_flags_t flags, struct sync_blkpt_checkpoint *chkpt)
+{
+	sync_blkpt_id_wait_dep(blkpt, id, flags, chkpt, 0);
+}
+
 static inline void
 sync_blkpt_wait(struct sync_blkpt *blkpt, sync_blkpt_flags_t flags, struct sync_blkpt_checkpoint *chkpt)
 {
 	sync_blkpt_id_wait(blkpt, blkpt->id, flags, chkpt);
 }
 
+/**
+ * Wait for an event that the thread `dep` will generate (e.g. it owns
+ * the lock we wait for). The scheduler can use this execution
+ * dependency for priority inheritance: the `slm` executes `dep` on
+ * our scheduling context while we wait (see `slm_thd_depend`). `dep
+ * == 0` is the same as `sync_blkpt_wait`.
+ */
+static inline void
+sync_blkpt_wait_dep(struct sync_blkpt *blkpt, sync_blkpt_flags_t flags, struct sync_blkpt_checkpoint *chkpt, thdid_t dep)
+{
+	sync_blkpt_id_wait_dep(blkpt, blkpt->id, flags, chkpt, dep);
+}
+
 /*
- * Create an execution dependency on the specified thread for,
- * e.g. priority inheritance.
+ * Adaptive spinning. Blocking is an invocation of the scheduler and
+ * (at least) a thread switch, which is far more expensive than waiting
+ * for a thread on another core that will change the data-structure
+ * within a few hundred cycles (e.g. release a lock). Before blocking,
+ * users can spin until `ready` returns `!0`, for a budget learned from
+ * the previous spins on the blockpoint: it moves toward the number
+ * of iterations it took for successful spins, and decays when spins
+ * fail. Spins are limited to `SYNC_BLKPT_SPIN_MAX` iterations (`0`
+ * disables spinning), and there is no spinning on a single core, as
+ * nothing can change while we spin.
+ */
+#ifndef SYNC_BLKPT_SPIN_MAX
+#define SYNC_BLKPT_SPIN_MAX 1024
+#endif
+#define SYNC_BLKPT_SPIN_MIN 16
+
+typedef int (*sync_blkpt_ready_fn_t)(void *data);
+
+static inline void
+sync_blkpt_relax(void)
+{
+#if defined(__x86_64__) || defined(__x86__)
+	__asm__ __volatile__("pause" : : : "memory");
+#elif defined(__arm__)
+	__asm__ __volatile__("yield" : : : "memory");
+#endif
+}
+
+/**
+ * Spin until `ready(data)` (which is inlined if passed as a constant),
+ * or the spin budget is exhausted.
+ *
+ * - @blkpt  - the blockpoint we would otherwise block on
+ * - @ready  - the function to check if we can stop waiting
+ * - @data   - `ready`'s argument
+ * - @return - `1` if `ready` returned `!0`, and `0` if we should block.
  */
-/* void sync_blkpt_wait_dep(struct sync_blkpt *blkpt, sync_blkpt_flags_t flags, struct sync_blkpt_checkpoint *chkpt, cos_thdid_t thdid); */
+static inline int
+sync_blkpt_spin(struct sync_blkpt *blkpt, sync_blkpt_ready_fn_t ready, void *data)
+{
+#if NUM_CPU > 1
+	int budget = ps_load(&blkpt->spin);
+	int max, i;
+
+	/* The budget can be in shared memory, so don't trust it */
+	if (budget > SYNC_BLKPT_SPIN_MAX) budget = SYNC_BLKPT_SPIN_MAX;
+	max = budget * 2 + SYNC_BLKPT_SPIN_MIN;
+	if (max > SYNC_BLKPT_SPIN_MAX) max = SYNC_BLKPT_SPIN_MAX;
+
+	for (i = 0; i < max; i++) {
+		if (ready(data)) {
+			blkpt->spin = budget + (i - budget) / 8;
+			return 1;
+		}
+		sync_blkpt_relax();
+	}
+	blkpt->spin = budget - budget / 4;
+#endif
+	return 0;
+}
 
 #endif /* SYNC_BLKPT_H */
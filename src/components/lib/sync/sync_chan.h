@@ -14,6 +14,10 @@
  * are blocked when the ring is full/empty. This assumes a
  * power-of-two ring size to avoid the overheads of division for
  * wraparound.
+ *
+ * Superseded by the channels of `lib/chan`, whose `CHAN_TYPE_PROTOTYPES`
+ * and `CHAN_STATIC_ALLOC` provide the same typed, static channels, as
+ * well as those shared between components: new code should use those.
  */
 
 #include <cos_component.h>
@@ -136,6 +140,15 @@ __sync_chan_consume(struct sync_chan *c, void *d, u32_t wraparound_mask, u32_t s
 	return 0;
 }
 
+/* Can the spinning sender (receiver) stop waiting? */
+static inline int
+__sync_chan_ready_send(void *c)
+{ return !__sync_chan_full(c, ((struct sync_chan *)c)->wraparound_mask); }
+
+static inline int
+__sync_chan_ready_recv(void *c)
+{ return !__sync_chan_empty(c, ((struct sync_chan *)c)->wraparound_mask); }
+
 /**
  * The next two functions pass all of the variables in via arguments,
  * so that we can use them for constant propagation along with
@@ -153,6 +166,7 @@ __sync_chan_send(struct sync_chan *c, void *item, u32_t wraparound_mask, u32_t i
 			sync_blkpt_trigger(&c->empty, 0);
 			break;
 		}
+		if (sync_blkpt_spin(&c->full, __sync_chan_ready_send, c)) continue;
 		if (sync_blkpt_blocking(&c->full, 0, &chkpt)) continue;
 		if (!__sync_chan_full(c, wraparound_mask)) continue;
 		sync_blkpt_wait(&c->full, 0, &chkpt);
@@ -173,6 +187,7 @@ __sync_chan_recv(struct sync_chan *c, void *item, u32_t wraparound_mask, u32_t i
 			sync_blkpt_trigger(&c->full, 0);
 			break;
 		}
+		if (sync_blkpt_spin(&c->empty, __sync_chan_ready_recv, c)) continue;
 		if (sync_blkpt_blocking(&c->empty, 0, &chkpt)) continue;
 		if (!__sync_chan_empty(c, wraparound_mask)) continue;
 		sync_blkpt_wait(&c->empty, 0, &chkpt);
@@ -0,0 +1,159 @@
+#ifndef SYNC_COND_H
+#define SYNC_COND_H
+
+/***
+ * Condition variables, used with a `sync_lock`. Waiting releases the
+ * lock and blocks on the condition's blockpoint, and re-takes the
+ * lock after a signal or broadcast. As usual, waiters must re-check
+ * their predicate in a loop, as wakeups can be spurious:
+ *
+ *     sync_lock_take(&l);
+ *     while (!predicate) sync_cond_wait(&c, &l);
+ *     ...
+ *     sync_lock_release(&l);
+ *
+ * Signals and broadcasts must be made holding the lock. This orders
+ * them with the waiters' checkpoints of the epoch (taken holding the
+ * lock), so that no wakeup is lost between the release of the lock
+ * and the block, and every event gets a higher epoch than the last
+ * one, which the scheduler needs to not ignore it.
+ *
+ * Broadcasts use wait morphing: rather than waking all of the
+ * waiters, only for them to contend for the lock the broadcaster
+ * holds, they are moved (by the scheduler) to wait on the lock's
+ * blockpoint, and counted as its waiters, so that each release of
+ * the lock hands it off to one of them.
+ */
+
+#include <cos_component.h>
+#include <sync_lock.h>
+
+struct sync_cond {
+	sched_blkpt_id_t    id;
+	sched_blkpt_epoch_t epoch;
+	/*
+	 * The number of threads waiting, so that signals are free
+	 * without them, and the generation of broadcasts above it.
+	 */
+	unsigned long       waiters;
+	/* the lock of the waits, for the broadcasts */
+	struct sync_lock   *lock;
+};
+
+#define SYNC_COND_GEN_SHIFT  (sizeof(unsigned long) * 4)
+#define SYNC_COND_WAITERS(w) ((w) & ((1UL << SYNC_COND_GEN_SHIFT) - 1))
+#define SYNC_COND_GEN(w)     ((w) >> SYNC_COND_GEN_SHIFT)
+
+/**
+ * Initialize a condition variable (in memory passed in).
+ *
+ * - @c - the condition variable
+ * - @return - `0` on successful initialization,
+ *             `!0` if the backing blockpoint cannot be allocated
+ */
+static inline int
+sync_cond_init(struct sync_cond *c)
+{
+	c->id = sched_blkpt_alloc();
+	if (c->id == SCHED_BLKPT_NULL) return -1;
+	c->epoch   = 0;
+	c->waiters = 0;
+	c->lock    = NULL;
+
+	return 0;
+}
+
+/**
+ * Teardown the condition variable, which must not have waiters.
+ *
+ * - @c - the condition variable
+ * - @return - `0` on success, and
+ *             `!0` if threads wait on it.
+ */
+static inline int
+sync_cond_teardown(struct sync_cond *c)
+{
+	if (SYNC_COND_WAITERS(ps_load(&c->waiters))) return 1;
+
+	return sched_blkpt_free(c->id);
+}
+
+/**
+ * Release the lock, wait for a signal or broadcast, and re-take the
+ * lock.
+ *
+ * @precondition - we hold the lock.
+ *
+ * - @c - the condition variable
+ * - @l - the lock protecting the condition
+ */
+static inline void
+sync_cond_wait(struct sync_cond *c, struct sync_lock *l)
+{
+	sched_blkpt_epoch_t epoch = c->epoch;
+	unsigned long w;
+
+	c->lock = l;
+	/* Woken waiters leave concurrently, without the lock */
+	w = ps_faa(&c->waiters, 1);
+	sync_lock_release(l);
+	/* Returns immediately if there was an event since our checkpoint */
+	if (unlikely(sched_blkpt_block(c->id, epoch, 0))) BUG();
+
+	while (1) {
+		unsigned long cur = ps_load(&c->waiters);
+
+		/* A broadcast made us a waiter of the lock, that it will be handed off to */
+		if (SYNC_COND_GEN(cur) != SYNC_COND_GEN(w)) {
+			__sync_lock_handoff_wait(l);
+			return;
+		}
+		if (ps_cas(&c->waiters, cur, cur - 1)) break;
+	}
+	sync_lock_take(l);
+}
+
+/**
+ * Wake one of the threads waiting on the condition, if any.
+ *
+ * @precondition - we hold the lock passed to the waits.
+ *
+ * - @c - the condition variable
+ */
+static inline void
+sync_cond_signal(struct sync_cond *c)
+{
+	if (likely(!SYNC_COND_WAITERS(ps_load(&c->waiters)))) return;
+
+	c->epoch++;
+	sched_blkpt_trigger(c->id, c->epoch, 1);
+}
+
+/**
+ * Move all of the threads waiting on the condition to wait for the
+ * lock (wait morphing), which is handed off to them in turn as it is
+ * released.
+ *
+ * @precondition - we hold the lock passed to the waits.
+ *
+ * - @c - the condition variable
+ */
+static inline void
+sync_cond_broadcast(struct sync_cond *c)
+{
+	unsigned long w;
+
+	while (1) {
+		w = ps_load(&c->waiters);
+		if (likely(!SYNC_COND_WAITERS(w))) return;
+		/* A new generation, without waiters */
+		if (ps_cas(&c->waiters, w, (SYNC_COND_GEN(w) + 1) << SYNC_COND_GEN_SHIFT)) break;
+	}
+
+	/* We hold the lock, so its next release hands it off to one of them */
+	__sync_lock_waiters_add(c->lock, SYNC_COND_WAITERS(w));
+	c->epoch++;
+	sched_blkpt_morph(c->id, c->lock->blkpt.id, c->epoch);
+}
+
+#endif /* SYNC_COND_H */
@@ -3,12 +3,21 @@
 
 /***
  * Simple blocking lock. Uses blockpoints to enable the blocking and
- * waking of contending threads.
+ * waking of contending threads. Contending threads first spin (see
+ * `sync_blkpt_spin`) while the owner is running on another core, as
+ * it will likely release the lock soon, and block otherwise. Blocked
+ * threads specify the owner as their dependency, for priority
+ * inheritance.
+ *
+ * The lock's word holds the owner, and the number of waiters above
+ * it. A release with waiters hands the lock off to one of them
+ * (setting the owner to `SYNC_LOCK_HANDOFF`, which only a waiter can
+ * take), and wakes only one thread, rather than all of them to
+ * contend for the lock, and re-block.
  *
  * **TODO**:
  *
- * - Add dependency specification for PI.
- * - Add optional adaptive spinning and non-preemptivity -- generally, multicore awareness
+ * - Add optional non-preemptivity.
  * - Thorough testing.
  */
 
@@ -20,10 +29,13 @@ struct sync_lock {
 	struct sync_blkpt blkpt;
 };
 
-#define SYNC_LOCK_OWNER_BLKED_BITS (sizeof(unsigned long) * 8)
-#define SYNC_LOCK_BLKED_MASK       (1UL << (SYNC_LOCK_OWNER_BLKED_BITS - 2))
-#define SYNC_LOCK_BLKED(e)         ((e) &  SYNC_LOCK_BLKED_MASK)
-#define SYNC_LOCK_OWNER(e)         ((e) & ~SYNC_LOCK_BLKED_MASK)
+#define SYNC_LOCK_OWNER_BITS  (sizeof(unsigned long) * 4)
+#define SYNC_LOCK_OWNER_MASK  ((1UL << SYNC_LOCK_OWNER_BITS) - 1)
+#define SYNC_LOCK_OWNER(e)    ((e) & SYNC_LOCK_OWNER_MASK)
+#define SYNC_LOCK_WAITER      (1UL << SYNC_LOCK_OWNER_BITS)
+#define SYNC_LOCK_WAITERS(e)  ((e) >> SYNC_LOCK_OWNER_BITS)
+/* The owner of a lock released to its waiters, until one of them takes it */
+#define SYNC_LOCK_HANDOFF     SYNC_LOCK_OWNER_MASK
 
 
 /**
@@ -62,6 +74,36 @@ sync_lock_teardown(struct sync_lock *l)
 	return sync_blkpt_teardown(&l->blkpt);
 }
 
+static inline int
+__sync_lock_free(void *l)
+{
+	return ps_load(&((struct sync_lock *)l)->owner_blked) == 0;
+}
+
+/*
+ * Wait for the lock to be handed off to us, as one of its waiters
+ * (that are counted in the lock). Several waiters can wake up for a
+ * handoff, but only one takes it, and the others wait again.
+ */
+static inline void
+__sync_lock_handoff_wait(struct sync_lock *l)
+{
+	struct sync_blkpt_checkpoint chkpt;
+
+	while (1) {
+		unsigned long o_w;
+
+		sync_blkpt_checkpoint(&l->blkpt, &chkpt);
+		o_w = ps_load(&l->owner_blked);
+		if (SYNC_LOCK_OWNER(o_w) == SYNC_LOCK_HANDOFF) {
+			if (ps_cas(&l->owner_blked, o_w, (o_w & ~SYNC_LOCK_OWNER_MASK) | cos_thdid())) return;
+			continue;
+		}
+		/* Returns immediately if the lock was released since the checkpoint */
+		sync_blkpt_wait_dep(&l->blkpt, 0, &chkpt, SYNC_LOCK_OWNER(o_w));
+	}
+}
+
 /**
  * Take the lock.
  *
@@ -73,29 +115,28 @@ sync_lock_teardown(struct sync_lock *l)
 static inline void
 sync_lock_take(struct sync_lock *l)
 {
-#if 1
-	ps_lock_take((struct ps_lock *)&l->owner_blked);
-#else
-	struct sync_blkpt_checkpoint chkpt;
-
 	while (1) {
 		unsigned long owner_blked;
 
-		sync_blkpt_checkpoint(&l->blkpt, &chkpt);
-
-		owner_blked = ps_load(&l->owner_blked);
 		/* Can we take the lock? */
 		if (ps_cas(&l->owner_blked, 0, (unsigned long)cos_thdid())) {
 			return;	/* success! */
 		}
+		owner_blked = ps_load(&l->owner_blked);
+		if (!owner_blked) continue;
+
+		/* Spin for the release if the owner is running on another core */
+		if (SYNC_LOCK_OWNER(owner_blked) != SYNC_LOCK_HANDOFF && sched_thd_running(SYNC_LOCK_OWNER(owner_blked)) &&
+		    sync_blkpt_spin(&l->blkpt, __sync_lock_free, l)) continue;
+
+		/* slowpath: we're blocking! Count ourself as a waiter, or try again */
+		if (!ps_cas(&l->owner_blked, owner_blked, owner_blked + SYNC_LOCK_WAITER)) continue;
 
-		/* slowpath: we're blocking! Set the blocked bit, or try again */
-		if (!ps_cas(&l->owner_blked, owner_blked, owner_blked | SYNC_LOCK_BLKED_MASK)) continue;
+		/* The lock will be handed off to a waiter on release */
+		__sync_lock_handoff_wait(l);
 
-		/* We can't take the lock, have set the block bit, and await release */
-		sync_blkpt_wait(&l->blkpt, 0, &chkpt);
+		return;
 	}
-#endif
 }
 
 /**
@@ -109,15 +150,11 @@ sync_lock_take(struct sync_lock *l)
 static inline int
 sync_lock_try_take(struct sync_lock *l)
 {
-#if 1
-	return l->owner_blked;
-#else
 	if (ps_cas(&l->owner_blked, 0, (unsigned long)cos_thdid())) {
 		return 0;	/* success! */
 	} else {
 		return 1;
 	}
-#endif
 }
 
 /**
@@ -130,28 +167,37 @@ sync_lock_try_take(struct sync_lock *l)
 static inline void
 sync_lock_release(struct sync_lock *l)
 {
-#if 1
-	ps_lock_release((struct ps_lock *)&l->owner_blked);	
-#else
 	while (1) {
-		unsigned long o_b = ps_load(&l->owner_blked);
-		int blked = unlikely(SYNC_LOCK_BLKED(o_b) == SYNC_LOCK_BLKED_MASK);
-
-		assert(SYNC_LOCK_OWNER(o_b) == cos_thdid());
-		/*
-		 * If this doesn't work, then someone must have set
-		 * blocked in the mean time. Try again! Blocked can
-		 * only be set once, so this is a bounded loop (can
-		 * fire two times, max).
-		 */
-		if (unlikely(!ps_cas(&l->owner_blked, o_b, 0))) continue;
+		unsigned long o_w = ps_load(&l->owner_blked);
+
+		assert(SYNC_LOCK_OWNER(o_w) == cos_thdid());
+		if (likely(!SYNC_LOCK_WAITERS(o_w))) {
+			/*
+			 * If this doesn't work, then a thread must
+			 * have become a waiter in the mean time. Try
+			 * again!
+			 */
+			if (unlikely(!ps_cas(&l->owner_blked, o_w, 0))) continue;
+
+			return;
+		}
 
-		/* if there are blocked threads, wake 'em up! */
-		if (unlikely(blked)) sync_blkpt_wake(&l->blkpt, 0);
+		/* Hand the lock off to one of the waiters, and wake only one of them */
+		if (!ps_cas(&l->owner_blked, o_w, o_w - SYNC_LOCK_WAITER - SYNC_LOCK_OWNER(o_w) + SYNC_LOCK_HANDOFF)) continue;
+		sync_blkpt_wake_one(&l->blkpt, 0);
 
 		return;
 	}
-#endif
+}
+
+/*
+ * Add `n` waiters to the lock we hold, that will wait for handoffs
+ * with `__sync_lock_handoff_wait` (see `sync_cond_broadcast`).
+ */
+static inline void
+__sync_lock_waiters_add(struct sync_lock *l, unsigned long n)
+{
+	ps_faa(&l->owner_blked, n * SYNC_LOCK_WAITER);
 }
 
 #endif /* SYNC_LOCK_H */
@@ -0,0 +1,68 @@
+#ifndef SYNC_LOCK_HPP
+#define SYNC_LOCK_HPP
+
+/***
+ * The `sync_lock` for C++ components: a class that wraps the lock,
+ * with inline methods that are the C functions, so it costs nothing
+ * over them, and a scoped guard that releases it on every return.
+ *
+ * The constructor is `constexpr`, and only zeroes the lock, so global
+ * locks are in the BSS, with no static constructor. As exceptions are
+ * disabled, the construction can't fail: `init` allocates the lock's
+ * blockpoint, and returns an error, as `sync_lock_init` does.
+ *
+ * *Example*:
+ * ```c++
+ * static composite::sync_lock lock;
+ *
+ * lock.init();
+ * {
+ *         composite::lock_guard<composite::sync_lock> g(lock);
+ *         ...
+ * }
+ * ```
+ */
+
+extern "C" {
+#include <sync_lock.h>
+}
+
+namespace composite {
+
+class sync_lock {
+	struct ::sync_lock l;
+
+public:
+	constexpr sync_lock() : l() {}
+	sync_lock(const sync_lock &) = delete;
+	sync_lock &operator=(const sync_lock &) = delete;
+
+	int  init()     { return sync_lock_init(&l); }
+	int  teardown() { return sync_lock_teardown(&l); }
+	void take()     { sync_lock_take(&l); }
+	bool try_take() { return sync_lock_try_take(&l) == 0; }
+	void release()  { sync_lock_release(&l); }
+
+	/* The BasicLockable and Lockable requirements, for the standard's guards */
+	void lock()     { take(); }
+	bool try_lock() { return try_take(); }
+	void unlock()   { release(); }
+
+	struct ::sync_lock *get() { return &l; }
+};
+
+/* Hold a lock for the scope of the guard */
+template<typename L>
+class lock_guard {
+	L &l;
+
+public:
+	explicit lock_guard(L &l) : l(l) { l.lock(); }
+	~lock_guard() { l.unlock(); }
+	lock_guard(const lock_guard &) = delete;
+	lock_guard &operator=(const lock_guard &) = delete;
+};
+
+}
+
+#endif /* SYNC_LOCK_HPP */
@@ -0,0 +1,227 @@
+#ifndef SYNC_QLOCK_H
+#define SYNC_QLOCK_H
+
+/***
+ * Queued (MCS) blocking lock. Contending threads enqueue a node (that
+ * they provide, usually on their stack) and wait on a flag in it, in
+ * their own cache-line, so waiters on other cores don't contend on
+ * the lock's cache-line. The release hands the lock directly to the
+ * next node in FIFO order, and wakes *only* that thread, and only if
+ * it has blocked: waiters that are still spinning are woken without
+ * invoking the scheduler, and there is no thundering herd on release,
+ * as with `sync_lock` (that wakes all blocked threads on its
+ * blockpoint when the blocked bit is set).
+ *
+ * Waiters spin while the owner runs on another core (see
+ * `sched_thd_running`), and block otherwise, with the owner as their
+ * dependency (see `sched_thd_block`): the `slm` executes the owner on
+ * the waiter's scheduling context, for priority inheritance.
+ *
+ * The cost of FIFO handoff is that the lock can't be "stolen" by a
+ * running thread while the next waiter is woken, and the node must be
+ * passed to both the take and the release:
+ *
+ *     struct sync_qlock_node n;
+ *
+ *     sync_qlock_take(&l, &n);
+ *     ...
+ *     sync_qlock_release(&l, &n);
+ */
+
+#include <cos_component.h>
+#include <sched.h>
+#include <sync_blkpt.h>
+
+typedef enum {
+	SYNC_QLOCK_WAIT = 0,	/* spinning for the handoff */
+	SYNC_QLOCK_BLKED,	/* blocked (or blocking), and needs a wakeup */
+	SYNC_QLOCK_GRANTED,	/* the lock was handed to us */
+} sync_qlock_state_t;
+
+struct sync_qlock_node {
+	struct sync_qlock_node *next;
+	thdid_t                 thd;
+	unsigned long           state;
+} CACHE_ALIGNED;
+
+struct sync_qlock {
+	struct sync_qlock_node *tail;
+	/* the owner, as a hint for spinning and priority inheritance */
+	thdid_t                 owner;
+};
+
+/* Spin iterations between checks of whether the owner still runs */
+#define SYNC_QLOCK_SPIN_CHECK 64
+
+/**
+ * Initialize a queued lock (in memory passed in). There is no
+ * blockpoint to allocate, as waiters are woken individually.
+ *
+ * - @l - the lock
+ * - @return - `0`
+ */
+static inline int
+sync_qlock_init(struct sync_qlock *l)
+{
+	l->tail  = NULL;
+	l->owner = 0;
+
+	return 0;
+}
+
+/**
+ * Teardown the lock, which must not be taken.
+ *
+ * - @l - the lock
+ * - @return - `0` on success, and
+ *             `!0` if the lock is taken.
+ */
+static inline int
+sync_qlock_teardown(struct sync_qlock *l)
+{
+	return ps_load(&l->tail) != NULL;
+}
+
+static inline struct sync_qlock_node *
+__sync_qlock_swap_tail(struct sync_qlock *l, struct sync_qlock_node *n)
+{
+	struct sync_qlock_node *t;
+
+	do {
+		t = ps_load(&l->tail);
+	} while (!ps_cas((unsigned long *)&l->tail, (unsigned long)t, (unsigned long)n));
+
+	return t;
+}
+
+/*
+ * Wait for the handoff from our predecessor. Return when the node is
+ * granted the lock.
+ */
+static inline void
+__sync_qlock_wait(struct sync_qlock *l, struct sync_qlock_node *n)
+{
+	thdid_t owner;
+	int     i;
+
+	while (1) {
+		owner = ps_load(&l->owner);
+		/* Spin (locally) while the owner is making progress on another core */
+		while (owner && sched_thd_running(owner)) {
+			for (i = 0; i < SYNC_QLOCK_SPIN_CHECK; i++) {
+				if (ps_load(&n->state) == SYNC_QLOCK_GRANTED) return;
+				sync_blkpt_relax();
+			}
+			owner = ps_load(&l->owner);
+		}
+
+		/* Announce that we block, unless the lock was handed to us in the mean time */
+		if (!ps_cas(&n->state, SYNC_QLOCK_WAIT, SYNC_QLOCK_BLKED) &&
+		    ps_load(&n->state) == SYNC_QLOCK_GRANTED) return;
+
+		/*
+		 * The releaser wakes us after granting, so a wakeup
+		 * racing with this is remembered by the scheduler, and
+		 * a spurious return just loops.
+		 */
+		sched_thd_block(owner);
+	}
+}
+
+/**
+ * Take the lock.
+ *
+ * @precondition - we have *not* already taken the lock.
+ *
+ * - @l - the lock
+ * - @n - the node that tracks us in the queue, which must remain
+ *        valid until it is passed to `sync_qlock_release`
+ */
+static inline void
+sync_qlock_take(struct sync_qlock *l, struct sync_qlock_node *n)
+{
+	struct sync_qlock_node *pred;
+
+	n->next  = NULL;
+	n->thd   = cos_thdid();
+	n->state = SYNC_QLOCK_WAIT;
+
+	pred = __sync_qlock_swap_tail(l, n);
+	if (likely(!pred)) {
+		l->owner = n->thd;
+
+		return;
+	}
+	ps_store(&pred->next, n);
+	__sync_qlock_wait(l, n);
+	/* The releaser already set the owner to us */
+	assert(ps_load(&l->owner) == n->thd);
+}
+
+/**
+ * Attempt to take the lock without waiting.
+ *
+ * - @l - the lock
+ * - @n - the node, as for `sync_qlock_take`
+ * - @return - `0` on successful lock acquisition,
+ *             `1` if it is already taken.
+ */
+static inline int
+sync_qlock_try_take(struct sync_qlock *l, struct sync_qlock_node *n)
+{
+	n->next  = NULL;
+	n->thd   = cos_thdid();
+	n->state = SYNC_QLOCK_WAIT;
+
+	if (!ps_cas((unsigned long *)&l->tail, 0, (unsigned long)n)) return 1;
+	l->owner = n->thd;
+
+	return 0;
+}
+
+/**
+ * Release the lock, handing it to the next waiter, if any.
+ *
+ * @precondition: we must have previously taken the lock with `n`.
+ *
+ * - @l - the lock
+ * - @n - the node passed to the take
+ */
+static inline void
+sync_qlock_release(struct sync_qlock *l, struct sync_qlock_node *n)
+{
+	struct sync_qlock_node *next = ps_load(&n->next);
+	struct sync_qlock_node *t;
+	thdid_t                 thd;
+	unsigned long           state;
+	int                     i = 0;
+
+	assert(ps_load(&l->owner) == cos_thdid());
+	if (likely(!next)) {
+		l->owner = 0;
+		if (ps_cas((unsigned long *)&l->tail, (unsigned long)n, 0)) return;
+
+		/*
+		 * A thread enqueued itself, but hasn't linked its node
+		 * yet. It might have been preempted by us, so don't
+		 * spin on it forever: the nodes in the queue can't go
+		 * away while we hold the lock, so yield to the last.
+		 */
+		while (!(next = ps_load(&n->next))) {
+			if (++i % SYNC_QLOCK_SPIN_CHECK == 0 && (t = ps_load(&l->tail)) != n) sched_thd_yield_to(t->thd);
+			sync_blkpt_relax();
+		}
+	}
+
+	/* The node goes away once it is granted the lock: read it first */
+	thd      = next->thd;
+	l->owner = thd;
+	do {
+		state = ps_load(&next->state);
+	} while (!ps_cas(&next->state, state, SYNC_QLOCK_GRANTED));
+
+	/* Only invoke the scheduler if the next thread blocked */
+	if (unlikely(state == SYNC_QLOCK_BLKED)) sched_thd_wakeup(thd);
+}
+
+#endif /* SYNC_QLOCK_H */
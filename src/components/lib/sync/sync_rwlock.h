@@ -0,0 +1,241 @@
+#ifndef SYNC_RWLOCK_H
+#define SYNC_RWLOCK_H
+
+/***
+ * Scalable reader-writer lock. Readers only modify their core's
+ * counter of readers (in its own cache-line), so that concurrent
+ * readers on different cores don't contend on a shared cache-line,
+ * and they only read the shared `writer` word. Writers are mutually
+ * exclusive through `writer` (that holds the writing thread's id),
+ * and then wait for the readers to drain. Readers back off when a
+ * writer arrives, so readers cannot starve a writer.
+ *
+ * Waiting uses the lock's blockpoint: threads spin while it is
+ * likely to be brief (see `sync_blkpt_spin`), and block otherwise.
+ * Threads waiting for a writer specify it as their dependency, for
+ * priority inheritance (see `sync_blkpt_wait_dep`). A writer waiting
+ * for the readers has no single thread to depend on.
+ *
+ * Readers can migrate while holding the lock, as only the sum of the
+ * counters is meaningful.
+ */
+
+#include <cos_component.h>
+#include <sync_blkpt.h>
+
+struct sync_rwlock_readers {
+	unsigned long cnt;
+} CACHE_ALIGNED;
+
+struct sync_rwlock {
+	struct sync_rwlock_readers readers[NUM_CPU];
+	unsigned long writer;
+	struct sync_blkpt blkpt;
+} CACHE_ALIGNED;
+
+/**
+ * Initialize a reader-writer lock (in memory passed in).
+ *
+ * - @l - the lock
+ * - @return - `0` on successful initialization,
+ *             `!0` if the backing blockpoint cannot be allocated
+ */
+static inline int
+sync_rwlock_init(struct sync_rwlock *l)
+{
+	int i;
+
+	for (i = 0; i < NUM_CPU; i++) l->readers[i].cnt = 0;
+	l->writer = 0;
+
+	return sync_blkpt_init(&l->blkpt);
+}
+
+/**
+ * Teardown the lock, which must not be taken.
+ *
+ * - @l - the lock
+ * - @return - `0` on success, and
+ *             `!0` if the lock is taken.
+ */
+static inline int
+sync_rwlock_teardown(struct sync_rwlock *l)
+{
+	if (!ps_cas(&l->writer, 0, ~0)) return 1;
+
+	return sync_blkpt_teardown(&l->blkpt);
+}
+
+static inline unsigned long
+__sync_rwlock_nreaders(struct sync_rwlock *l)
+{
+	unsigned long n = 0;
+	int i;
+
+	/* Counters can wrap when readers migrate, but their sum can't */
+	for (i = 0; i < NUM_CPU; i++) n += ps_load(&l->readers[i].cnt);
+
+	return n;
+}
+
+static inline int
+__sync_rwlock_unowned(void *l)
+{
+	return ps_load(&((struct sync_rwlock *)l)->writer) == 0;
+}
+
+static inline int
+__sync_rwlock_drained(void *l)
+{
+	return __sync_rwlock_nreaders((struct sync_rwlock *)l) == 0;
+}
+
+/*
+ * Try to become a reader: `0` on success, or otherwise the id of the
+ * writer we must wait for.
+ */
+static inline thdid_t
+__sync_rwlock_read_try(struct sync_rwlock *l)
+{
+	struct sync_rwlock_readers *r = &l->readers[cos_cpuid()];
+	unsigned long w;
+
+	/* The atomic add orders our count before the writer's load */
+	ps_faa(&r->cnt, 1);
+	w = ps_load(&l->writer);
+	if (likely(!w)) return 0;
+
+	/* Back off, and wake the writer if it waits for our count */
+	ps_faa(&r->cnt, -1);
+	sync_blkpt_trigger(&l->blkpt, 0);
+
+	return w;
+}
+
+/**
+ * Take the lock for reading. Many readers can hold the lock
+ * concurrently.
+ *
+ * - @l - the lock
+ */
+static inline void
+sync_rwlock_read_take(struct sync_rwlock *l)
+{
+	struct sync_blkpt_checkpoint chkpt;
+
+	while (1) {
+		thdid_t w;
+
+		sync_blkpt_checkpoint(&l->blkpt, &chkpt);
+		w = __sync_rwlock_read_try(l);
+		if (likely(!w)) return;
+
+		if (sched_thd_running(w) && sync_blkpt_spin(&l->blkpt, __sync_rwlock_unowned, l)) continue;
+		if (sync_blkpt_blocking(&l->blkpt, 0, &chkpt)) continue;
+		if (__sync_rwlock_unowned(l)) continue;
+		sync_blkpt_wait_dep(&l->blkpt, 0, &chkpt, w);
+	}
+}
+
+/**
+ * Attempt to take the lock for reading.
+ *
+ * - @l - the lock
+ * - @return - `0` on successful acquisition,
+ *             `1` if a writer holds, or waits for, the lock.
+ */
+static inline int
+sync_rwlock_read_try_take(struct sync_rwlock *l)
+{
+	return __sync_rwlock_read_try(l) != 0;
+}
+
+/**
+ * Release the lock, previously taken for reading.
+ *
+ * - @l - the lock
+ */
+static inline void
+sync_rwlock_read_release(struct sync_rwlock *l)
+{
+	/* Our core's counter: we might not be on the core we took it on */
+	ps_faa(&l->readers[cos_cpuid()].cnt, -1);
+	/* A writer might be waiting for the last reader */
+	if (unlikely(ps_load(&l->writer))) sync_blkpt_trigger(&l->blkpt, 0);
+}
+
+/**
+ * Take the lock for writing, excluding other writers and readers.
+ *
+ * @precondition - we haven't already taken the lock.
+ *
+ * - @l - the lock
+ */
+static inline void
+sync_rwlock_write_take(struct sync_rwlock *l)
+{
+	struct sync_blkpt_checkpoint chkpt;
+	unsigned long w;
+
+	/* Exclude the other writers (and the arriving readers)... */
+	while (1) {
+		sync_blkpt_checkpoint(&l->blkpt, &chkpt);
+		w = ps_load(&l->writer);
+		if (!w && ps_cas(&l->writer, 0, (unsigned long)cos_thdid())) break;
+		if (!w) continue;
+
+		if (sched_thd_running(w) && sync_blkpt_spin(&l->blkpt, __sync_rwlock_unowned, l)) continue;
+		if (sync_blkpt_blocking(&l->blkpt, 0, &chkpt)) continue;
+		if (__sync_rwlock_unowned(l)) continue;
+		sync_blkpt_wait_dep(&l->blkpt, 0, &chkpt, w);
+	}
+
+	/* ...then wait for the readers to release the lock */
+	while (1) {
+		sync_blkpt_checkpoint(&l->blkpt, &chkpt);
+		if (__sync_rwlock_drained(l)) return;
+
+		if (sync_blkpt_spin(&l->blkpt, __sync_rwlock_drained, l)) continue;
+		if (sync_blkpt_blocking(&l->blkpt, 0, &chkpt)) continue;
+		if (__sync_rwlock_drained(l)) continue;
+		sync_blkpt_wait(&l->blkpt, 0, &chkpt);
+	}
+}
+
+/**
+ * Attempt to take the lock for writing.
+ *
+ * - @l - the lock
+ * - @return - `0` on successful acquisition,
+ *             `1` if it is already taken.
+ */
+static inline int
+sync_rwlock_write_try_take(struct sync_rwlock *l)
+{
+	if (!ps_cas(&l->writer, 0, (unsigned long)cos_thdid())) return 1;
+	if (__sync_rwlock_drained(l)) return 0;
+
+	/* Readers hold the lock: let them, and waiting readers, proceed */
+	ps_cas(&l->writer, (unsigned long)cos_thdid(), 0);
+	sync_blkpt_trigger(&l->blkpt, 0);
+
+	return 1;
+}
+
+/**
+ * Release the lock, previously taken for writing.
+ *
+ * - @l - the lock
+ */
+static inline void
+sync_rwlock_write_release(struct sync_rwlock *l)
+{
+	int ret;
+
+	ret = ps_cas(&l->writer, (unsigned long)cos_thdid(), 0);
+	assert(ret);
+	/* Wake both the waiting readers, and writers */
+	sync_blkpt_trigger(&l->blkpt, 0);
+}
+
+#endif /* SYNC_RWLOCK_H */
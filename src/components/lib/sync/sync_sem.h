@@ -3,12 +3,15 @@
 
 /***
  * Counting semaphore. Uses blockpoints to enable the blocking and
- * waking of contending threads for counting resources.
+ * waking of contending threads for counting resources. The count
+ * goes below zero by the number of waiting threads, and a give with
+ * waiters hands its resource off to one of them, waking only one
+ * thread, rather than all of them to contend for it.
  *
  * **TODO**:
  *
  * - Add dependency specification for PI.
- * - Add optional adaptive spinning and non-preemptivity -- generally, multicore awareness
+ * - Add optional non-preemptivity.
  * - Thorough testing.
  */
 
@@ -17,6 +20,8 @@
 
 struct sync_sem {
 	unsigned long     rescnt;
+	/* the resources given to waiters, not yet taken by them */
+	unsigned long     handoffs;
 	struct sync_blkpt blkpt;
 };
 
@@ -35,7 +40,8 @@ struct sync_sem {
 static inline int
 sync_sem_init(struct sync_sem *s, unsigned long resnum)
 {
-	s->rescnt = SYNC_SEM_ZERO + resnum;
+	s->rescnt   = SYNC_SEM_ZERO + resnum;
+	s->handoffs = 0;
 
 	return sync_blkpt_init(&s->blkpt);
 }
@@ -67,17 +73,44 @@ sync_sem_teardown(struct sync_sem *s)
  *
  * - @s - the semaphore
  */
+static inline int
+__sync_sem_available(void *s)
+{
+	return ps_load(&((struct sync_sem *)s)->rescnt) > SYNC_SEM_ZERO;
+}
+
+/* Wait for a give to hand a resource off to us, as one of the waiters */
 static inline void
-sync_sem_take(struct sync_sem *s)
+__sync_sem_handoff_wait(struct sync_sem *s)
 {
 	struct sync_blkpt_checkpoint chkpt;
 
 	while (1) {
-		unsigned long rescnt;
+		unsigned long h;
 
 		sync_blkpt_checkpoint(&s->blkpt, &chkpt);
+		h = ps_load(&s->handoffs);
+		if (h) {
+			if (ps_cas(&s->handoffs, h, h - 1)) return;
+			continue;
+		}
+		/* Returns immediately if a give happened since the checkpoint */
+		sync_blkpt_wait(&s->blkpt, 0, &chkpt);
+	}
+}
+
+static inline void
+sync_sem_take(struct sync_sem *s)
+{
+	while (1) {
+		unsigned long rescnt;
 
 		rescnt = ps_load(&s->rescnt);
+		/*
+		 * Before taking a count we'd block on, spin for a give
+		 * from another core. There is no owner to check.
+		 */
+		if (rescnt <= SYNC_SEM_ZERO && sync_blkpt_spin(&s->blkpt, __sync_sem_available, s)) continue;
 		/*
 		 * Attempt to take a count and return; any changes
 		 * deserve a "retry". Note this will update even when
@@ -88,15 +121,10 @@ sync_sem_take(struct sync_sem *s)
 
 		/* If we don't need to block, return */
 		if (likely(rescnt > SYNC_SEM_ZERO)) return;
+		/* Otherwise, we're counted as a waiter, and a give will hand us its resource */
+		__sync_sem_handoff_wait(s);
 
-		sync_blkpt_wait(&s->blkpt, 0, &chkpt);
-		/*
-		 * When we wakeup, attempt to take the semaphore
-		 * again, so this assumes that when waking, the count
-		 * is reset to 1 even if it is arbitrarily negative
-		 * (assuming we wake all blocked threads in the
-		 * blockpoint).
-		 */
+		return;
 	}
 }
 
@@ -142,27 +170,20 @@ sync_sem_try_take(struct sync_sem *s)
 static inline void
 sync_sem_give(struct sync_sem *s)
 {
+	unsigned long rescnt;
+
 	while (1) {
-		unsigned long rescnt = ps_load(&s->rescnt);
-
-		if (likely(rescnt >= SYNC_SEM_ZERO)) {
-			/* No blocked threads. Just increment the count. */
-			if (!ps_cas(&s->rescnt, rescnt, rescnt + 1)) continue; /* retry */
-		} else {
-			/*
-			 * We have blocked threads. Wake them giving
-			 * one resource for one of them. The rest will
-			 * again take the count below zero, and
-			 * reblock. Not great, but this is the
-			 * solution until we have the ability to wake
-			 * only one thread.
-			 */
-			if (!ps_cas(&s->rescnt, rescnt, SYNC_SEM_ZERO + 1)) continue; /* retry */
-			/* if there are blocked threads, wake 'em up! */
-			sync_blkpt_wake(&s->blkpt, 0);
-		}
+		rescnt = ps_load(&s->rescnt);
+		if (ps_cas(&s->rescnt, rescnt, rescnt + 1)) break;
+	}
 
-		return;
+	if (likely(rescnt >= SYNC_SEM_ZERO)) {
+		/* No blocked threads, only an event for `sync_wait_any` waiters, if any */
+		sync_blkpt_trigger(&s->blkpt, 0);
+	} else {
+		/* Hand the resource off to a waiter, and wake only one of them */
+		ps_faa(&s->handoffs, 1);
+		sync_blkpt_wake_one(&s->blkpt, 0);
 	}
 }
 
@@ -0,0 +1,153 @@
+#ifndef SYNC_SEQLOCK_H
+#define SYNC_SEQLOCK_H
+
+/***
+ * Sequence lock for small, plain-old-data snapshots (e.g. a
+ * timestamp, or a set of statistics) that are read far more often
+ * than written. Readers don't write shared memory at all: they copy
+ * the data, and retry if a writer updated it in the mean time. The
+ * sequence is odd while a write is in progress, and writers are
+ * mutually exclusive through the `writer` word.
+ *
+ * Readers must only copy the data between `sync_seqlock_read_begin`
+ * and `sync_seqlock_read_retry`, and be prepared for the copy to be
+ * inconsistent until the retry check succeeds (e.g. never follow
+ * pointers from the copy). `sync_seqlock_read` does the common case.
+ *
+ * Write sections must be short and must not block. Threads that find
+ * a write in progress spin while the writer is running on another
+ * core, and otherwise yield to it, as it is likely preempted.
+ */
+
+#include <cos_component.h>
+#include <sync_blkpt.h>
+
+struct sync_seqlock {
+	unsigned long seq;
+	unsigned long writer;	/* the thread that owns the write section, or 0 */
+};
+
+/* Order the data accesses with the sequence accesses */
+static inline void
+__sync_seqlock_barrier(void)
+{
+#if defined(__x86_64__) || defined(__x86__)
+	/* loads aren't reordered with loads, nor stores with stores */
+	__asm__ __volatile__("" : : : "memory");
+#else
+	ps_mem_fence();
+#endif
+}
+
+static inline void
+sync_seqlock_init(struct sync_seqlock *l)
+{
+	*l = (struct sync_seqlock) {
+		.seq = 0,
+		.writer = 0
+	};
+}
+
+/* A writer is in its write section: wait for it to finish */
+static inline void
+__sync_seqlock_wait(struct sync_seqlock *l)
+{
+	thdid_t w = ps_load(&l->writer);
+
+	if (w == 0) {
+		sync_blkpt_relax();
+	} else if (sched_thd_running(w)) {
+		while (ps_load(&l->writer) == w) sync_blkpt_relax();
+	} else {
+		sched_thd_yield_to(w);
+	}
+}
+
+/**
+ * Begin a read of the protected data.
+ *
+ * - @l      - the seqlock
+ * - @return - the sequence to pass to `sync_seqlock_read_retry`
+ */
+static inline unsigned long
+sync_seqlock_read_begin(struct sync_seqlock *l)
+{
+	unsigned long s;
+
+	while (unlikely((s = ps_load(&l->seq)) & 1)) __sync_seqlock_wait(l);
+	__sync_seqlock_barrier();
+
+	return s;
+}
+
+/**
+ * Has a writer updated the data since `sync_seqlock_read_begin`?
+ *
+ * - @l      - the seqlock
+ * - @s      - the sequence from `sync_seqlock_read_begin`
+ * - @return - `1` if the data read must be discarded and re-read,
+ *             `0` if it is a consistent snapshot.
+ */
+static inline int
+sync_seqlock_read_retry(struct sync_seqlock *l, unsigned long s)
+{
+	__sync_seqlock_barrier();
+
+	return ps_load(&l->seq) != s;
+}
+
+/**
+ * Read a consistent snapshot of `sz` bytes at `src` into `dst`.
+ */
+static inline void
+sync_seqlock_read(struct sync_seqlock *l, void *dst, const volatile void *src, size_t sz)
+{
+	unsigned long s;
+
+	do {
+		s = sync_seqlock_read_begin(l);
+		memcpy(dst, (const void *)src, sz);
+	} while (unlikely(sync_seqlock_read_retry(l, s)));
+}
+
+/**
+ * Begin the write section, excluding other writers.
+ *
+ * - @l - the seqlock
+ */
+static inline void
+sync_seqlock_write_begin(struct sync_seqlock *l)
+{
+	/* Own the lock first, so that readers find whom to wait for */
+	while (unlikely(!ps_cas(&l->writer, 0, (unsigned long)cos_thdid()))) __sync_seqlock_wait(l);
+	l->seq = l->seq + 1;
+	__sync_seqlock_barrier();
+}
+
+/**
+ * End the write section, publishing the update to readers.
+ *
+ * - @l - the seqlock
+ */
+static inline void
+sync_seqlock_write_end(struct sync_seqlock *l)
+{
+	assert((l->seq & 1) && l->writer == cos_thdid());
+	__sync_seqlock_barrier();
+	l->seq = l->seq + 1;
+	__sync_seqlock_barrier();
+	l->writer = 0;
+}
+
+/**
+ * Write `sz` bytes from `src` to the protected data at `dst`.
+ */
+static inline void
+sync_seqlock_write(struct sync_seqlock *l, volatile void *dst, const void *src, size_t sz)
+{
+	sync_seqlock_write_begin(l);
+	memcpy((void *)dst, src, sz);
+	sync_seqlock_write_end(l);
+}
+
+#endif /* SYNC_SEQLOCK_H */
@@ -0,0 +1,184 @@
+#ifndef SYNC_WAITSET_H
+#define SYNC_WAITSET_H
+
+/***
+ * Waiting for any of a set of events. A wait-set holds the
+ * blockpoints of several objects (e.g. the `empty` blockpoints of
+ * channels to receive from, or the blockpoints of semaphores), each
+ * with a function to check if the object is ready. `sync_wait_any`
+ * returns a ready member, and otherwise blocks on the wait-set's own
+ * blockpoint: a trigger of any member blockpoint also triggers it
+ * (see `sync_blkpt_id_activate`), so a single scheduler blockpoint,
+ * and its epoch, covers all members. This lets event loops wait
+ * locally, without an invocation to an event manager for each event.
+ *
+ * The member returned is only ready when it is checked: the caller
+ * uses the non-blocking operation of the object (e.g.
+ * `sync_sem_try_take`, or `sync_chan_async_recv_<name>`), and waits again
+ * if another thread got there first.
+ *
+ * A blockpoint can be in a single wait-set, and, as it points to the
+ * wait-set, only if it is in the memory of the waiting component.
+ * Only one thread should wait on a wait-set at a time.
+ *
+ *     struct sync_waitset ws;
+ *
+ *     sync_waitset_init(&ws);
+ *     sync_waitset_add(&ws, &sem.blkpt, __sync_sem_available, &sem);
+ *     sync_waitset_add(&ws, &chan.empty, __sync_chan_ready_recv, &chan);
+ *     while (1) {
+ *             switch (sync_wait_any(&ws)) { ... }
+ *     }
+ */
+
+#include <cos_component.h>
+#include <sync_blkpt.h>
+
+#ifndef SYNC_WAITSET_MAX
+#define SYNC_WAITSET_MAX 16
+#endif
+
+struct sync_waitset_member {
+	struct sync_blkpt    *blkpt;
+	sync_blkpt_ready_fn_t ready;
+	void                 *data;
+};
+
+struct sync_waitset {
+	struct sync_blkpt          blkpt;
+	/* the member to check first, so that a busy one doesn't starve the others */
+	int                        next;
+	int                        n;
+	struct sync_waitset_member members[SYNC_WAITSET_MAX];
+};
+
+/**
+ * Initialize an empty wait-set (in memory passed in).
+ *
+ * - @ws - the wait-set
+ * - @return - `0` on successful initialization,
+ *             `!0` if the backing blockpoint cannot be allocated
+ */
+static inline int
+sync_waitset_init(struct sync_waitset *ws)
+{
+	ws->next = 0;
+	ws->n    = 0;
+
+	return sync_blkpt_init(&ws->blkpt);
+}
+
+/**
+ * Add a blockpoint to the wait-set.
+ *
+ * - @ws    - the wait-set
+ * - @blkpt - the blockpoint triggered when the object can be ready
+ * - @ready - returns `!0` if the object is ready (passed `data`)
+ * - @data  - the object
+ * - @return - the index of the member, which `sync_wait_any`
+ *             returns, or `-1` if the wait-set is full, or the
+ *             blockpoint is already in a wait-set.
+ */
+static inline int
+sync_waitset_add(struct sync_waitset *ws, struct sync_blkpt *blkpt, sync_blkpt_ready_fn_t ready, void *data)
+{
+	int i = ws->n;
+
+	if (i == SYNC_WAITSET_MAX) return -1;
+	if (!ps_cas((unsigned long *)&blkpt->any, 0, (unsigned long)&ws->blkpt)) return -1;
+
+	ws->members[i] = (struct sync_waitset_member){
+		.blkpt = blkpt,
+		.ready = ready,
+		.data  = data
+	};
+	ws->n = i + 1;
+
+	return i;
+}
+
+/**
+ * Teardown the wait-set, removing its members from it, and
+ * deallocating its blockpoint. No thread may wait on it.
+ *
+ * - @ws - the wait-set
+ * - @return - `0` on success, `!0` if the blockpoint is out of sync
+ *             with the scheduler.
+ */
+static inline int
+sync_waitset_teardown(struct sync_waitset *ws)
+{
+	int i;
+
+	for (i = 0; i < ws->n; i++) ps_store(&ws->members[i].blkpt->any, NULL);
+	ws->n = 0;
+
+	return sync_blkpt_teardown(&ws->blkpt);
+}
+
+/**
+ * Find a ready member of the wait-set without blocking.
+ *
+ * - @ws - the wait-set
+ * - @return - the index of a ready member, or `-1` if none is ready.
+ */
+static inline int
+sync_waitset_ready(struct sync_waitset *ws)
+{
+	struct sync_waitset_member *m;
+	int i, idx;
+
+	for (i = 0; i < ws->n; i++) {
+		idx = (ws->next + i) % ws->n;
+		m   = &ws->members[idx];
+		if (m->ready(m->data)) {
+			ws->next = (idx + 1) % ws->n;
+
+			return idx;
+		}
+	}
+
+	return -1;
+}
+
+static inline int
+__sync_waitset_any_ready(void *ws)
+{
+	struct sync_waitset *s = ws;
+	int i;
+
+	for (i = 0; i < s->n; i++) {
+		if (s->members[i].ready(s->members[i].data)) return 1;
+	}
+
+	return 0;
+}
+
+/**
+ * Wait until a member of the wait-set is ready.
+ *
+ * - @ws - the wait-set
+ * - @return - the index of the ready member
+ */
+static inline int
+sync_wait_any(struct sync_waitset *ws)
+{
+	struct sync_blkpt_checkpoint chkpt;
+	int idx;
+
+	assert(ws->n > 0);
+	while (1) {
+		/* Any trigger of a member after this makes the wait return */
+		sync_blkpt_checkpoint(&ws->blkpt, &chkpt);
+		idx = sync_waitset_ready(ws);
+		if (idx >= 0) return idx;
+
+		if (sync_blkpt_spin(&ws->blkpt, __sync_waitset_any_ready, ws)) continue;
+		if (sync_blkpt_blocking(&ws->blkpt, 0, &chkpt)) continue;
+		/* A member might have been ready before we set blocked */
+		if (__sync_waitset_any_ready(ws)) continue;
+		sync_blkpt_wait(&ws->blkpt, 0, &chkpt);
+	}
+}
+
+#endif /* SYNC_WAITSET_H */
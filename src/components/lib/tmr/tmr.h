@@ -31,6 +31,7 @@ struct tmr {
 	tmr_id_t id;
 	evt_res_id_t evt_id;
 	unsigned int usecs;
+	unsigned int slack;
 	tmr_flags_t flags;
 };
 
@@ -39,21 +40,24 @@ struct tmr {
  * timer with `time` cycles. The 'type' can be  each of maximum size `item_sz`.
  *
  * - @usecs - The time value. Unit is microseconds.
+ * - @slack - How much later the timer may expire, in microseconds, so
+ *            that its expiry can be merged with other timers'.
  * - @tmr_flags_t flags  - Requested timer type, periodic or one-shot.
  * - @return  - `0` on success, `-errval` where `errval` is one of the above `CHAN_ERR_*` values.
  */
 static inline int
-tmr_init(struct tmr *t, unsigned int usecs, tmr_flags_t flags)
+tmr_init(struct tmr *t, unsigned int usecs, unsigned int slack, tmr_flags_t flags)
 {
 	tmr_id_t id;
 	int ret;
 	
 	if ((flags != TMR_ONESHOT) && (flags != TMR_PERIODIC)) return -TMR_ERR_INVAL_ARG;
-	id = tmrmgr_create(usecs, flags);
+	id = tmrmgr_create(usecs, slack, flags);
 	if (id == 0) return -TMR_ERR_NOMEM;
 	
 	t->id = id;
 	t->usecs = usecs;
+	t->slack = slack;
 	t->flags = flags;
 	t->evt_id = 0;
 	
@@ -149,4 +153,14 @@ tmr_evt_disassociate(struct tmr *t)
 	return 0;
 }
 
+/**
+ * 'tmr_nmerged' returns the number of timer expiries that the manager
+ * merged into the wakeup of another timer.
+ */
+static inline unsigned long
+tmr_nmerged(void)
+{
+	return tmrmgr_nmerged();
+}
+
 #endif /* TMR_H */
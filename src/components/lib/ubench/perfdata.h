@@ -21,6 +21,20 @@
 
 #define PERF_DATA_DEBUG
 
+/*
+ * The samples are recorded in a log-linear histogram (as in
+ * HdrHistogram) of fixed size: each power of two is split in
+ * 2^PERF_HIST_SUB_BITS buckets, so a sample is recorded in O(1), and
+ * the percentiles are within 1/2^PERF_HIST_SUB_BITS (~3%) of the
+ * samples', however many there are. The values below
+ * 2^(PERF_HIST_SUB_BITS + 1) are exact, and those above
+ * 2^PERF_HIST_MAX_BITS (a day of cycles) fall in the last bucket.
+ */
+#define PERF_HIST_SUB_BITS 5
+#define PERF_HIST_MAX_BITS 48
+#define PERF_HIST_SUB_SZ   (1 << PERF_HIST_SUB_BITS)
+#define PERF_HIST_NBUCKETS ((PERF_HIST_MAX_BITS - PERF_HIST_SUB_BITS + 1) * PERF_HIST_SUB_SZ)
+
 enum ptile_id {
 	PTILE_90 = 0,
 	PTILE_95,
@@ -29,21 +43,27 @@ enum ptile_id {
 
 struct perfdata {
 	char      name[PERF_DATA_NAME];
-	cycles_t *values;
+	cycles_t *values;     /* optional, the first array_size samples */
 	int       sz;
 	int	  array_size;
 	cycles_t  min, max, avg, total;
 	cycles_t  sd, var;
 	cycles_t  ptiles[PERF_PTILE_SZ]; /* 90, 95, 99 */
+	u64_t     hist[PERF_HIST_NBUCKETS];
 };
 
+/*
+ * The samples themselves are only kept in result_array, if given, to
+ * print them: the statistics only use the histogram, so size doesn't
+ * limit the number of samples.
+ */
 static void
 perfdata_init(struct perfdata *pd, const char *nm, cycles_t * result_array, int size)
 {
 	memset(pd, 0, sizeof(struct perfdata));
-	memset(result_array, 0, size * sizeof(cycles_t));
+	if (result_array) memset(result_array, 0, size * sizeof(cycles_t));
 	pd->values = result_array;
-	pd->array_size = size;
+	pd->array_size = result_array ? size : 0;
 	strncpy(pd->name, nm, PERF_DATA_NAME-1);
 }
 
@@ -53,23 +73,74 @@ __perfdata_print_values(struct perfdata *pd)
 #ifdef PERF_DATA_DEBUG
 	int i;
 
-	for (i = 0 ; i < pd->sz ; i++) printc("%llu\n", pd->values[i]);
+	for (i = 0 ; i < pd->sz && i < pd->array_size ; i++) printc("%llu\n", pd->values[i]);
 #endif
 }
 
 static inline int
-perfdata_add(struct perfdata *pd, cycles_t val)
+__perfdata_hist_idx(cycles_t val)
+{
+	int msb;
+
+	if (val < 2 * PERF_HIST_SUB_SZ) return (int)val;
+	msb = 63 - __builtin_clzll(val);
+	if (msb >= PERF_HIST_MAX_BITS) return PERF_HIST_NBUCKETS - 1;
+
+	return ((msb - PERF_HIST_SUB_BITS + 1) << PERF_HIST_SUB_BITS)
+	       + (int)((val >> (msb - PERF_HIST_SUB_BITS)) - PERF_HIST_SUB_SZ);
+}
+
+/* The lowest value in the bucket */
+static inline cycles_t
+__perfdata_hist_low(int idx)
+{
+	int shift = (idx >> PERF_HIST_SUB_BITS) - 1;
+
+	if (idx < 2 * PERF_HIST_SUB_SZ) return idx;
+
+	return (cycles_t)(PERF_HIST_SUB_SZ + (idx & (PERF_HIST_SUB_SZ - 1))) << shift;
+}
+
+/* The highest value in the bucket, so percentiles are never under-reported */
+static inline cycles_t
+__perfdata_hist_high(int idx)
 {
-	//if (unlikely(pd->sz >= PERF_VAL_MAX_SZ)) return -ENOSPC;
-	if (unlikely(pd->sz >= pd->array_size)) return -ENOSPC;
+	if (idx < 2 * PERF_HIST_SUB_SZ) return idx;
+
+	return __perfdata_hist_low(idx) + ((cycles_t)1 << ((idx >> PERF_HIST_SUB_BITS) - 1)) - 1;
+}
 
-	pd->values[pd->sz] = val;
+static inline int
+perfdata_add(struct perfdata *pd, cycles_t val)
+{
+	if (pd->sz < pd->array_size) pd->values[pd->sz] = val;
+	if (pd->sz == 0 || val < pd->min) pd->min = val;
+	if (val > pd->max) pd->max = val;
+	pd->hist[__perfdata_hist_idx(val)]++;
 	pd->total += val;
 	pd->sz ++;
 
 	return 0;
 }
 
+/*
+ * Add the samples of src to those of pd, for example to aggregate
+ * the measurements of each core. Only pd's statistics are updated by
+ * perfdata_calc.
+ */
+static void
+perfdata_merge(struct perfdata *pd, struct perfdata *src)
+{
+	int i;
+
+	if (src->sz == 0) return;
+	for (i = 0 ; i < PERF_HIST_NBUCKETS ; i++) pd->hist[i] += src->hist[i];
+	if (pd->sz == 0 || src->min < pd->min) pd->min = src->min;
+	if (src->max > pd->max) pd->max = src->max;
+	pd->total += src->total;
+	pd->sz    += src->sz;
+}
+
 /*
  * From http://stackoverflow.com/questions/3581528/how-is-the-square-root-function-implemented
  * By Argento
@@ -94,104 +165,52 @@ __sqrt_ull(cycles_t n)
 }
 
 /*
- * Code from: https://github.com/liuxinyu95/AlgoXY/blob/algoxy/sorting/merge-sort/src/mergesort.c
- *
- * A in-placed version based on:
- * Jyrki Katajainen, Tomi Pasanen, Jukka Teuhola. ``Practical in-place mergesort''. Nordic Journal of Computing, 1996.
- */
-static void __inplace_merge_sort(cycles_t *, int, int);
-
-static void
-__swap(cycles_t* xs, int i, int j)
-{
-	cycles_t tmp = xs[i];
-
-	xs[i] = xs[j];
-	xs[j] = tmp;
-}
-
-/*
- * merge two sorted subs xs[i, m) and xs[j...n) to working area xs[w...]
- */
-static void
-__workarea_merge(cycles_t* xs, int i, int m, int j, int n, int w)
-{
-	while (i < m && j < n) __swap(xs, w++, xs[i] < xs[j] ? i++ : j++);
-	while (i < m) __swap(xs, w++, i++);
-	while (j < n) __swap(xs, w++, j++);
-}
-
-
-/*
- * sort xs[l, u), and put result to working area w.
- * constraint, len(w) == u - l
+ * The value below which ppm parts per million of the samples are,
+ * e.g. 999900 for the 99.99th percentile.
  */
-static void
-__workarea_sort(cycles_t* xs, int l, int u, int w)
+static cycles_t
+perfdata_ptile(struct perfdata *pd, unsigned int ppm)
 {
-	int m;
-
-	if (u - l > 1) {
-		m = l + (u - l) / 2;
+	u64_t rank, seen = 0;
+	int i;
 
-		__inplace_merge_sort(xs, l, m);
-		__inplace_merge_sort(xs, m, u);
-		__workarea_merge(xs, l, m, m, u, w);
+	if (pd->sz == 0) return 0;
+	rank = ((u64_t)pd->sz * ppm + 999999) / 1000000;
+	if (rank == 0) rank = 1;
+	for (i = 0 ; i < PERF_HIST_NBUCKETS ; i++) {
+		seen += pd->hist[i];
+		if (seen >= rank) break;
 	}
-	else {
-		while (l < u) __swap(xs, l++, w++);
-	}
-}
+	if (i == PERF_HIST_NBUCKETS || __perfdata_hist_high(i) > pd->max) return pd->max;
 
-static void
-__inplace_merge_sort(cycles_t* xs, int l, int u)
-{
-	int m, n, w;
-
-	if (u - l > 1) {
-		m = l + (u - l) / 2;
-		w = l + u - m;
-
-		/* the last half contains sorted elements */
-		__workarea_sort(xs, l, m, w);
-
-		while (w - l > 2) {
-			n = w;
-			w = l + (n - l + 1) / 2;
-
-			/* the first half of the previous working area contains sorted elements */
-			__workarea_sort(xs, w, n, l);
-			__workarea_merge(xs, l, l + n - w, n, u, w);
-		}
-
-		/*switch to insertion sort*/
-		for (n = w; n > l; --n) {
-			for (m = n; m < u && xs[m] < xs[m-1]; ++m) {
-				__swap(xs, m, m - 1);
-			}
-		}
-	}
+	return __perfdata_hist_high(i);
 }
 
 static void
 perfdata_calc(struct perfdata *pd)
 {
-	int i, j;
+	cycles_t mid, d;
+	int i;
 
-	__inplace_merge_sort(pd->values, 0, pd->sz);
+	if (pd->sz == 0) return;
 
-	pd->min = pd->values[0];
-	pd->max = pd->values[pd->sz - 1];
 	pd->avg = pd->total / pd->sz;
 
-	for (i = 0 ; i < pd->sz ; i++) pd->var += (pd->values[i] - pd->avg) * (pd->values[i] - pd->avg);
+	/* The variance is approximated with the middle of the buckets */
+	pd->var = 0;
+	for (i = 0 ; i < PERF_HIST_NBUCKETS ; i++) {
+		if (!pd->hist[i]) continue;
+		mid = __perfdata_hist_low(i) + (__perfdata_hist_high(i) - __perfdata_hist_low(i)) / 2;
+		d   = mid > pd->avg ? mid - pd->avg : pd->avg - mid;
+		pd->var += pd->hist[i] * d * d;
+	}
 	pd->var /= pd->sz;
 
 	pd->sd = __sqrt_ull(pd->var);
 
-	pd->ptiles[PTILE_90] = pd->values[(int)((pd->sz * 90) / 100) - 1];
-	pd->ptiles[PTILE_95] = pd->values[(int)((pd->sz * 95) / 100) - 1];
-	pd->ptiles[PTILE_99] = pd->values[(int)((pd->sz * 99) / 100) - 1];
+	pd->ptiles[PTILE_90] = perfdata_ptile(pd, 900000);
+	pd->ptiles[PTILE_95] = perfdata_ptile(pd, 950000);
+	pd->ptiles[PTILE_99] = perfdata_ptile(pd, 990000);
 }
 
 static int
@@ -229,10 +248,17 @@ perfdata_99ptile(struct perfdata *pd)
 static void
 perfdata_print(struct perfdata *pd)
 {
-	printc("PD: %s - sz:%d,SD:%llu,Mean:%llu,99%%:%llu, Max: %llu\n",
-		pd->name, pd->sz, pd->sd, pd->avg, pd->ptiles[PTILE_99], pd->max);
+	printc("PD: %s - sz:%d,SD:%llu,Mean:%llu,99%%:%llu, 99.9%%:%llu, 99.99%%:%llu, Max: %llu\n",
+		pd->name, pd->sz, pd->sd, pd->avg, pd->ptiles[PTILE_99],
+		perfdata_ptile(pd, 999000), perfdata_ptile(pd, 999900), pd->max);
 }
 
+/*
+ * Print the samples that were kept ("V: <value>"), and the histogram
+ * ("H: <value>\t<count>", with the highest value of each non-empty
+ * bucket). Both can be fed to tools/simple_stats.py and
+ * tools/gen_cdf.py, the histogram with the count column.
+ */
 static void
 perfdata_all(struct perfdata *pd)
 {
@@ -243,7 +269,12 @@ perfdata_all(struct perfdata *pd)
 	printc(">>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>\n\n");
 
 	printc("#Latency\n");
-	for (i = 0 ; i < pd->sz ; i++) printc("V: %llu\n", pd->values[i]);
+	for (i = 0 ; i < pd->sz && i < pd->array_size ; i++) printc("V: %llu\n", pd->values[i]);
+
+	printc("#Histogram\n");
+	for (i = 0 ; i < PERF_HIST_NBUCKETS ; i++) {
+		if (pd->hist[i]) printc("H: %llu\t%llu\n", __perfdata_hist_high(i), pd->hist[i]);
+	}
 
 	printc("<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<\n\n");
 }
@@ -0,0 +1,181 @@
+#ifndef UBENCH_H
+#define UBENCH_H
+
+/***
+ * A harness for the micro-benchmarks, so that their results are
+ * measured and reported uniformly, and can be compared across runs.
+ *
+ * A benchmark is initialized with its name, a description of its
+ * parameters, and its options, then either times a function
+ * (`ubench_run`), or is given the samples it measures itself
+ * (`ubench_sample`) until it's done. The first `warmup` samples are
+ * discarded, then `iterations` samples are measured, or as many as
+ * are taken in `duration` cycles. Samples above `outlier` cycles are
+ * assumed to include an interrupt, and are only counted. The samples
+ * are recorded in a perfdata histogram, so they can be taken for
+ * arbitrarily long runs.
+ *
+ * `ubench_report` prints the results as a JSON line beginning with
+ * `{"ubench":`, on the serial console, and `ubench_end` prints
+ * `{"ubench_end":<compid>}` when a component's benchmarks are done.
+ * tools/run.sh collects these in a report (see `UBENCH_REPORT` in it),
+ * and tools/ubench_compare.py compares a report to a baseline's.
+ */
+
+#include <cos_component.h>
+#include <cos_types.h>
+#include <llprint.h>
+#include <perfdata.h>
+#include <ps.h>
+
+struct ubench_opts {
+	int      warmup;     /* samples discarded before measuring */
+	int      iterations; /* samples measured... */
+	cycles_t duration;   /* ...or the cycles to measure for, if not 0 */
+	cycles_t outlier;    /* samples above are dropped, if not 0 */
+};
+
+#define UBENCH_OPTS(iters) ((struct ubench_opts) { .warmup = 1, .iterations = (iters) })
+
+struct ubench {
+	const char        *name;
+	const char        *params;
+	struct ubench_opts opts;
+	int                warm, dropped;
+	cycles_t           start; /* of the measurement */
+	struct perfdata    pd;
+};
+
+static void
+ubench_init(struct ubench *b, const char *name, const char *params, struct ubench_opts opts)
+{
+	b->name    = name;
+	b->params  = params ? params : "";
+	b->opts    = opts;
+	b->warm    = 0;
+	b->dropped = 0;
+	b->start   = 0;
+	if (opts.warmup == 0) rdtscll(b->start);
+	perfdata_init(&b->pd, name, NULL, 0);
+}
+
+static inline int
+ubench_done(struct ubench *b)
+{
+	cycles_t now;
+
+	if (b->warm < b->opts.warmup) return 0;
+	if (!b->opts.duration) return perfdata_sz(&b->pd) >= b->opts.iterations;
+	rdtscll(now);
+
+	return now - b->start >= b->opts.duration;
+}
+
+/* Record a sample. Returns 1 once the benchmark is done. */
+static inline int
+ubench_sample(struct ubench *b, cycles_t val)
+{
+	if (b->warm < b->opts.warmup) {
+		if (++b->warm == b->opts.warmup) rdtscll(b->start);
+		return ubench_done(b);
+	}
+	if (ubench_done(b)) return 1;
+
+	if (b->opts.outlier && val > b->opts.outlier) b->dropped++;
+	else                                          perfdata_add(&b->pd, val);
+
+	return ubench_done(b);
+}
+
+/* The samples taken, including those discarded */
+static inline u64_t
+ubench_nsamples(struct ubench *b)
+{
+	return b->warm + perfdata_sz(&b->pd) + b->dropped;
+}
+
+/* Time each execution of fn(data) until the benchmark is done */
+static void
+ubench_run(struct ubench *b, void (*fn)(void *), void *data)
+{
+	cycles_t start, end;
+
+	do {
+		rdtscll(start);
+		fn(data);
+		rdtscll(end);
+	} while (!ubench_sample(b, end - start));
+}
+
+/* Add the samples of src to b's, for example to aggregate the cores' */
+static void
+ubench_merge(struct ubench *b, struct ubench *src)
+{
+	perfdata_merge(&b->pd, &src->pd);
+	b->dropped += src->dropped;
+}
+
+/* core is the core measured, or -1 for the aggregate of the cores */
+static void
+__ubench_report(struct ubench *b, int core)
+{
+	struct perfdata *pd = &b->pd;
+
+	perfdata_calc(pd);
+	/* printc's buffer is small, so the line is printed in parts */
+	printc("{\"ubench\":\"%s\",\"params\":\"%s\",\"comp\":%lu,\"core\":%d,",
+	       b->name, b->params, (unsigned long)cos_compid(), core);
+	printc("\"unit\":\"cycles\",\"n\":%d,\"dropped\":%d,\"min\":%llu,\"avg\":%llu,\"sd\":%llu,",
+	       perfdata_sz(pd), b->dropped, perfdata_min(pd), perfdata_avg(pd), perfdata_sd(pd));
+	printc("\"p50\":%llu,\"p90\":%llu,\"p99\":%llu,\"p99.9\":%llu,\"p99.99\":%llu,\"max\":%llu}\n",
+	       perfdata_ptile(pd, 500000), perfdata_90ptile(pd), perfdata_99ptile(pd),
+	       perfdata_ptile(pd, 999000), perfdata_ptile(pd, 999900), perfdata_max(pd));
+}
+
+static void
+ubench_report(struct ubench *b)
+{
+	__ubench_report(b, (int)cos_cpuid());
+}
+
+/* All of the component's benchmarks are done */
+static void
+ubench_end(void)
+{
+	printc("{\"ubench_end\":%lu}\n", (unsigned long)cos_compid());
+}
+
+/***
+ * A benchmark executed on each core, from parallel_main. Each core
+ * measures and reports its own samples, and the last core to finish
+ * also reports the aggregate of all of them.
+ */
+struct ubench_cores {
+	struct ubench core[NUM_CPU];
+	unsigned long ndone;
+};
+
+static void
+ubench_cores_init(struct ubench_cores *bc, const char *name, const char *params, struct ubench_opts opts)
+{
+	int i;
+
+	for (i = 0; i < NUM_CPU; i++) ubench_init(&bc->core[i], name, params, opts);
+	bc->ndone = 0;
+}
+
+static void
+ubench_cores_run(struct ubench_cores *bc, coreid_t cid, int ncores, void (*fn)(void *), void *data)
+{
+	int i;
+
+	ubench_run(&bc->core[cid], fn, data);
+	ubench_report(&bc->core[cid]);
+	if (ps_faa(&bc->ndone, 1) != (unsigned long)ncores - 1) return;
+
+	/* The last core aggregates into core 0's, as all are done */
+	for (i = 1; i < ncores; i++) ubench_merge(&bc->core[0], &bc->core[i]);
+	__ubench_report(&bc->core[0], -1);
+}
+
+#endif /* UBENCH_H */
@@ -0,0 +1,126 @@
+#ifndef UBENCH_PMU_H
+#define UBENCH_PMU_H
+
+/***
+ * Count hardware events (cache and TLB misses, ...) in a measured
+ * region, with the invoking thread's performance counters (see the
+ * pmu interface, which the component must depend on).
+ *
+ * `ubench_pmu_init` programs the counters with the events, then each
+ * `ubench_pmu_begin`/`ubench_pmu_end` pair adds the events counted in
+ * between, and the number of operations executed, to the totals.
+ * The counters are read with rdpmc, so a region costs no invocations.
+ * The instructions retired and cycles are always counted (with the
+ * fixed counters). `ubench_pmu_report` prints the totals as a JSON
+ * line beginning with `{"ubench_pmu":`, next to the `ubench` lines.
+ */
+
+#include <cos_component.h>
+#include <cos_types.h>
+#include <llprint.h>
+#include <pmu.h>
+#include <ubench.h>
+
+#define UBENCH_PMU_MAX    4
+#define UBENCH_PMU_NFIXED 3
+#define UBENCH_PMU_MASK   ((1ULL << 48) - 1) /* the counters' width */
+
+struct ubench_pmu {
+	const char   *name;
+	int           nevts;
+	unsigned long evts[UBENCH_PMU_MAX];
+	u64_t         start[UBENCH_PMU_MAX + UBENCH_PMU_NFIXED];
+	u64_t         total[UBENCH_PMU_MAX + UBENCH_PMU_NFIXED];
+	u64_t         nops;
+};
+
+static inline u64_t
+ubench_rdpmc(u32_t ctr)
+{
+	u32_t lo, hi;
+
+	__asm__ __volatile__("rdpmc" : "=a"(lo), "=d"(hi) : "c"(ctr));
+
+	return ((u64_t)hi << 32) | lo;
+}
+
+/* Counters 0..nevts-1, then the fixed ones (bit 30 selects those) */
+static inline void
+__ubench_pmu_read(struct ubench_pmu *m, u64_t *vals)
+{
+	int i;
+
+	for (i = 0; i < m->nevts; i++) vals[i] = ubench_rdpmc(i);
+	for (i = 0; i < UBENCH_PMU_NFIXED; i++) vals[m->nevts + i] = ubench_rdpmc((1 << 30) | i);
+}
+
+/* Returns 0, or -1 if the counters can't count the events */
+static int
+ubench_pmu_init(struct ubench_pmu *m, const char *name, const unsigned long *evts, int nevts)
+{
+	int i;
+
+	*m = (struct ubench_pmu) { .name = name, .nevts = nevts };
+	/* without counters (e.g. in an emulator), rdpmc would fault */
+	if (pmu_ncounters() <= 0 || nevts > UBENCH_PMU_MAX || nevts > pmu_ncounters()) return -1;
+	for (i = 0; i < nevts; i++) {
+		m->evts[i] = evts[i];
+		if (pmu_program(i, evts[i])) return -1;
+	}
+	/* Only the fixed counters: they count once any counter is programmed */
+	if (nevts == 0 && pmu_program(0, 0)) return -1;
+
+	return 0;
+}
+
+static inline void
+ubench_pmu_begin(struct ubench_pmu *m)
+{
+	__ubench_pmu_read(m, m->start);
+}
+
+/* End the region, in which nops operations were executed */
+static inline void
+ubench_pmu_end(struct ubench_pmu *m, u64_t nops)
+{
+	u64_t end[UBENCH_PMU_MAX + UBENCH_PMU_NFIXED];
+	int   i;
+
+	__ubench_pmu_read(m, end);
+	for (i = 0; i < m->nevts + UBENCH_PMU_NFIXED; i++) m->total[i] += (end[i] - m->start[i]) & UBENCH_PMU_MASK;
+	m->nops += nops;
+}
+
+/* Count the events of all of the benchmark's executions of fn (see ubench_run) */
+static void
+ubench_pmu_run(struct ubench_pmu *m, struct ubench *b, void (*fn)(void *), void *data)
+{
+	ubench_pmu_begin(m);
+	ubench_run(b, fn, data);
+	ubench_pmu_end(m, ubench_nsamples(b));
+}
+
+static void
+ubench_pmu_report(struct ubench_pmu *m)
+{
+	u64_t *fixed = &m->total[m->nevts];
+	int    i;
+
+	/* printc's buffer is small, so the line is printed in parts */
+	printc("{\"ubench_pmu\":\"%s\",\"comp\":%lu,\"core\":%d,\"n\":%llu,", m->name,
+	       (unsigned long)cos_compid(), (int)cos_cpuid(), m->nops);
+	printc("\"instrs\":%llu,\"cycles\":%llu,\"ref_cycles\":%llu,\"events\":{", fixed[0], fixed[1], fixed[2]);
+	for (i = 0; i < m->nevts; i++) {
+		printc("%s\"0x%04lx\":%llu", i ? "," : "", m->evts[i], m->total[i]);
+	}
+	printc("}}\n");
+}
+
+/* Stop counting, so the thread's switches don't switch the counters */
+static void
+ubench_pmu_done(struct ubench_pmu *m)
+{
+	pmu_disable();
+}
+
+#endif /* UBENCH_PMU_H */
@@ -32,6 +32,66 @@ static struct ether_addr gw_mac = {
 	.addr_bytes[5] = 0x09,
 };
 #endif
+
+/*
+ * The MAC addresses of our peers, indexed by the last byte of their
+ * IP (the hosts of a /24 don't collide), so finding the destination of
+ * a packet is one lookup. The peers are learned from the packets we
+ * receive, whose source is who to answer (the host, or its router),
+ * and the others are resolved by the nic, and sent to the gateway
+ * until they are.
+ */
+#define UDP_STACK_NEIGH_SZ 256
+
+struct udp_stack_neigh {
+	u32_t             ip;
+	struct ether_addr mac;
+};
+
+static struct udp_stack_neigh neigh_cache[UDP_STACK_NEIGH_SZ];
+
+static inline struct udp_stack_neigh *
+udp_stack_neigh_slot(u32_t ip)
+{
+	/* The IP is in network order, so its last byte is the last in memory */
+	return &neigh_cache[((u8_t *)&ip)[3] % UDP_STACK_NEIGH_SZ];
+}
+
+static inline void
+udp_stack_neigh_learn(u32_t ip, const struct ether_addr *mac)
+{
+	struct udp_stack_neigh *n = udp_stack_neigh_slot(ip);
+
+	if (likely(n->ip == ip && !memcmp(&n->mac, mac, sizeof(*mac)))) return;
+	n->ip  = ip;
+	n->mac = *mac;
+}
+
+static struct ether_addr
+udp_stack_neigh_resolve(u32_t ip)
+{
+	struct udp_stack_neigh *n = udp_stack_neigh_slot(ip);
+	u64_t mac;
+
+	mac = nic_neigh_lookup(ip);
+	if (!mac) return gw_mac;
+
+	n->ip = ip;
+	memcpy(&n->mac, &mac, sizeof(n->mac));
+
+	return n->mac;
+}
+
+static inline struct ether_addr
+udp_stack_neigh_mac(u32_t ip)
+{
+	struct udp_stack_neigh *n = udp_stack_neigh_slot(ip);
+
+	if (likely(n->ip == ip)) return n->mac;
+
+	return udp_stack_neigh_resolve(ip);
+}
+
 static inline int 
 udp_stack_packet_validate(struct ip_hdr *ip_hdr, u16_t packet_len, u32_t host_ip, u32_t host_port)
 {
@@ -64,54 +124,73 @@ udp_stack_packet_validate(struct ip_hdr *ip_hdr, u16_t packet_len, u32_t host_ip
 	return 0;
 }
 
-static inline void
-udp_stack_eth_hdr_set(struct eth_hdr *eth_hdr, struct ether_addr* src_mac, struct ether_addr* dst_mac)
+/*
+ * The headers of all of the packets we send, built when we bind, as
+ * only the lengths, the remote address and port, and the IP id differ
+ * between packets. The checksums are the sums of the fixed fields
+ * (see `net_cksum.h`), updated with the others for each packet.
+ */
+struct udp_stack_hdrs {
+	struct eth_hdr eth;
+	struct ip_hdr  ip;
+	struct udp_hdr udp;
+} __attribute__((packed));
+
+static struct udp_stack_hdrs hdr_tmpl;
+static u64_t ip_cksum_base, udp_cksum_base;
+
+static void
+udp_stack_hdr_tmpl_init(void)
 {
-	eth_hdr->src_addr = *src_mac;
-	eth_hdr->dst_addr = *dst_mac;
-	eth_hdr->ether_type = 0x0008;
-}
+	struct udp_stack_hdrs *h = &hdr_tmpl;
+
+	memset(h, 0, sizeof(*h));
+	h->eth.src_addr   = nic_mac;
+	h->eth.dst_addr   = gw_mac;
+	h->eth.ether_type = 0x0008;
 
-static inline void
-udp_stack_ip_hdr_set(struct ip_hdr *ip_hdr, u16_t data_len, u32_t src_host, u32_t dst_host)
-{
-	static u16_t ip_id = 0;
 	/* We don't support complex IP options */
-	ip_hdr->ihl = IP_STD_LEN / 4;
-	ip_hdr->version = IPv4;
-	ip_hdr->tos = 0;
-	ip_hdr->total_len = htons(IP_STD_LEN + data_len);
-	ip_hdr->id = ++ip_id;
-	ip_hdr->frag_off = 0;
-	ip_hdr->ttl = 64;
-	ip_hdr->proto = UDP_PROTO;
-	ip_hdr->src_addr = src_host;
-	ip_hdr->dst_addr = dst_host;
-	ip_hdr->checksum = 0;
-}
+	h->ip.ihl      = IP_STD_LEN / 4;
+	h->ip.version  = IPv4;
+	h->ip.ttl      = 64;
+	h->ip.proto    = UDP_PROTO;
+	h->ip.src_addr = host_ip;
 
-static inline void
-udp_stack_udp_hdr_set(struct udp_hdr *udp_hdr, u16_t data_len, u16_t src_port, u16_t dst_port)
-{
-	udp_hdr->port.src_port = src_port;
-	udp_hdr->port.dst_port = dst_port;
-	udp_hdr->len = htons(data_len + 8);
-	udp_hdr->checksum = 0;
-}
+	h->udp.port.src_port = host_port;
 
-static inline void
-udp_stack_ip_csum_set(struct ip_hdr *ip_hdr)
-{
-	if (unlikely(!ENABLE_OFFLOAD))
-		ip_hdr->checksum = udp_stack_ip_csum_calculate(ip_hdr);
+	ip_cksum_base  = net_cksum_partial(&h->ip, IP_STD_LEN);
+	/* The pseudo-header's source and protocol, and the source port */
+	udp_cksum_base = net_cksum_partial(&h->ip.src_addr, sizeof(u32_t)) + htons(UDP_PROTO) + host_port;
 }
 
+/* Patch the per-packet fields of the headers, and their checksums */
 static inline void
-udp_stack_udp_csum_set(struct ip_hdr *ip_hdr)
+udp_stack_hdrs_set(struct udp_stack_hdrs *h, const char *data, u16_t data_len, u32_t remote_ip, u16_t remote_port)
 {
-	struct udp_hdr *udp_hdr = (struct udp_hdr *)((char *)ip_hdr + ip_hdr->ihl * 4);
-	if (unlikely(!ENABLE_OFFLOAD))
-		udp_hdr->checksum = udp_stack_udp_csum_calculate(ip_hdr);
+	static u16_t ip_id = 0;
+	u16_t ip_len  = htons(IP_STD_LEN + UDP_STD_LEN + data_len);
+	u16_t udp_len = htons(UDP_STD_LEN + data_len);
+	u64_t dst     = (remote_ip & 0xffff) + (remote_ip >> 16);
+	u16_t cksum;
+
+	*h = hdr_tmpl;
+	h->ip.total_len      = ip_len;
+	h->ip.id             = ++ip_id;
+	h->eth.dst_addr      = udp_stack_neigh_mac(remote_ip);
+	h->ip.dst_addr       = remote_ip;
+	h->udp.port.dst_port = remote_port;
+	h->udp.len           = udp_len;
+
+	/* With the offload, the NIC computes both checksums */
+	if (ENABLE_OFFLOAD) return;
+
+	h->ip.checksum = ~net_cksum_fold(ip_cksum_base + ip_len + h->ip.id + dst);
+
+	/* The length is both in the pseudo-header, and in the UDP header */
+	cksum = ~net_cksum_fold(udp_cksum_base + dst + 2 * (u64_t)udp_len + remote_port
+	                        + net_cksum_partial(data, data_len));
+	/* Per RFC 768, a computed checksum of zero is transmitted as all ones */
+	h->udp.checksum = cksum ? cksum : 0xffff;
 }
 
 static inline u16_t
@@ -120,18 +199,6 @@ udp_stack_hdr_room(void)
 	return (ETH_STD_LEN + IP_STD_LEN + UDP_STD_LEN);
 }
 
-static inline struct ip_hdr *
-udp_stack_ip_hdr_pos(struct eth_hdr *eth_hdr)
-{
-	return (struct ip_hdr *)((char *)eth_hdr + ETH_STD_LEN);
-}
-
-static inline struct udp_hdr *
-udp_stack_udp_hdr_pos(struct ip_hdr *ip_hdr)
-{
-	return (struct udp_hdr *)((char *)ip_hdr + IP_STD_LEN);
-}
-
 void
 udp_stack_shmem_map(cbuf_t shm_id)
 {
@@ -157,22 +224,31 @@ udp_stack_udp_bind(u32_t ip_addr, u16_t port)
 	nic_mac.addr_bytes[4] = mac_addr[1];
 	nic_mac.addr_bytes[5] = mac_addr[0];
 
+	udp_stack_hdr_tmpl_init();
 	nic_bind_port(ip_addr, htons(port));
 
 	return 0;
 }
 
-shm_bm_objid_t
-udp_stack_shmem_read(u16_t *data_offset, u16_t *data_len, u32_t *remote_addr, u16_t *remote_port)
+/*
+ * The descriptors of the batches of each thread, in its shmem, with
+ * the nic: the threads of several cores each have their own session.
+ */
+struct udp_stack_descs {
+	shm_bm_objid_t       id;
+	struct nic_pkt_desc *descs;
+};
+
+static struct udp_stack_descs nic_descs_thd[NETSHMEM_REGION_SZ];
+
+static int
+udp_stack_rx_parse(shm_bm_objid_t objid, u16_t pkt_len, u16_t *data_offset, u16_t *data_len, u32_t *remote_addr, u16_t *remote_port)
 {
-	shm_bm_objid_t           objid;
 	struct netshmem_pkt_buf *obj;
 	struct ip_hdr *ip_hdr;
 	struct udp_hdr *udp_hdr;
-	u16_t pkt_len;
 	u16_t ip_len;
 
-	objid = nic_get_a_packet(&pkt_len);
 	obj = shm_bm_borrow_net_pkt_buf(netshmem_get_shm(), objid);
 	assert(obj);
 
@@ -180,8 +256,8 @@ udp_stack_shmem_read(u16_t *data_offset, u16_t *data_len, u32_t *remote_addr, u1
 
 	/* try to pass the validation */
 	if (unlikely(udp_stack_packet_validate(ip_hdr, pkt_len, host_ip, host_port))) {
-		data_len = 0;
-		return objid;
+		*data_len = 0;
+		return -1;
 	}
 
 	ip_len = ip_hdr->ihl * 4;
@@ -192,42 +268,111 @@ udp_stack_shmem_read(u16_t *data_offset, u16_t *data_len, u32_t *remote_addr, u1
 	*data_len    = ntohs(udp_hdr->len) - UDP_STD_LEN;
 	*remote_addr = ip_hdr->src_addr;
 	*remote_port = udp_hdr->port.src_port;
+	udp_stack_neigh_learn(ip_hdr->src_addr, &((struct eth_hdr *)obj->data)->src_addr);
 
-	return objid;
+	return 0;
 }
 
-int
-udp_stack_shmem_write(shm_bm_objid_t objid, u16_t data_offset, u16_t data_len, u32_t remote_ip, u16_t remote_port)
+shm_bm_objid_t
+udp_stack_shmem_read(u16_t *data_offset, u16_t *data_len, u32_t *remote_addr, u16_t *remote_port)
 {
-	struct netshmem_pkt_buf *obj;
-	u16_t pkt_offset, pkt_len;
-	struct ip_hdr *ip_hdr;
-	struct udp_hdr *udp_hdr;
+	shm_bm_objid_t objid;
+	u16_t pkt_len;
+
+	objid = nic_get_a_packet(&pkt_len);
+	udp_stack_rx_parse(objid, pkt_len, data_offset, data_len, remote_addr, remote_port);
 
-	char *mac_addr_arr = (char *)&nic_mac;
+	return objid;
+}
 
-	thdid_t thd = cos_thdid();
+/* Set the headers before the data, and return the packet's offset and length */
+static void
+udp_stack_tx_build(shm_bm_objid_t objid, u16_t data_offset, u16_t data_len, u32_t remote_ip, u16_t remote_port,
+                   u16_t *pkt_offset, u16_t *pkt_len)
+{
+	struct netshmem_pkt_buf *obj;
 	char *data;
 
 	obj  = shm_bm_borrow_net_pkt_buf(netshmem_get_shm(), objid);
 	data = obj->data + data_offset;
+	netshmem_trace_stamp(obj, NETSHMEM_TRACE_WRITE);
 
-	/* data now points to Eth hdr */
-	data -= udp_stack_hdr_room();
-
-	ip_hdr = udp_stack_ip_hdr_pos((struct eth_hdr *)data);
-	udp_hdr = udp_stack_udp_hdr_pos(ip_hdr);
+	/* The headers are right before the data */
+	udp_stack_hdrs_set((struct udp_stack_hdrs *)(data - udp_stack_hdr_room()), data, data_len, remote_ip, remote_port);
 
-	udp_stack_udp_hdr_set(udp_hdr, data_len, host_port, remote_port);
-	udp_stack_ip_hdr_set(ip_hdr, data_len + UDP_STD_LEN, host_ip ,remote_ip);
-	udp_stack_ip_csum_set(ip_hdr);
-	udp_stack_udp_csum_set(ip_hdr);
-	udp_stack_eth_hdr_set((struct eth_hdr *)data, &nic_mac, &gw_mac);
+	*pkt_len = udp_stack_hdr_room() + data_len;
+	*pkt_offset = netshmem_get_data_offset() - udp_stack_hdr_room();
+}
 
-	pkt_len = ntohs(ip_hdr->total_len) + ETH_STD_LEN;
-	pkt_offset = netshmem_get_data_offset() - udp_stack_hdr_room();
+int
+udp_stack_shmem_write(shm_bm_objid_t objid, u16_t data_offset, u16_t data_len, u32_t remote_ip, u16_t remote_port)
+{
+	u16_t pkt_offset, pkt_len;
 
+	udp_stack_tx_build(objid, data_offset, data_len, remote_ip, remote_port, &pkt_offset, &pkt_len);
 	nic_send_packet(objid, pkt_offset, pkt_len);
 
 	return 0;
 }
+
+static struct udp_stack_descs *
+udp_stack_descs_get(void)
+{
+	struct udp_stack_descs *d = &nic_descs_thd[cos_thdid()];
+
+	if (likely(d->descs)) return d;
+
+	d->descs = shm_bm_alloc_net_pkt_buf(netshmem_get_shm(), &d->id);
+	if (!d->descs) return NULL;
+
+	return d;
+}
+
+int
+udp_stack_shmem_read_n(struct udp_stack_pkt *pkts, int n)
+{
+	struct udp_stack_descs  *descs = udp_stack_descs_get();
+	struct netshmem_pkt_buf *obj;
+	int                      i, ret;
+
+	if (!descs) return -ENOMEM;
+	if (n > NIC_BATCH_MAX) n = NIC_BATCH_MAX;
+
+	ret = nic_get_packets(descs->id, n);
+	/* Fetch all of the headers at once, rather than one miss per packet as they are parsed */
+	for (i = 0; i < ret; i++) {
+		obj = shm_bm_borrow_net_pkt_buf(netshmem_get_shm(), descs->descs[i].objid);
+		if (likely(obj)) __builtin_prefetch(obj->data + ETH_STD_LEN);
+	}
+	for (i = 0; i < ret; i++) {
+		/* Take our copy of the descriptor, as the nic can write them */
+		struct nic_pkt_desc d = descs->descs[i];
+
+		pkts[i].objid = d.objid;
+		udp_stack_rx_parse(d.objid, d.pkt_len, &pkts[i].data_offset, &pkts[i].data_len,
+		                   &pkts[i].remote_addr, &pkts[i].remote_port);
+	}
+
+	return ret;
+}
+
+int
+udp_stack_shmem_write_n(struct udp_stack_pkt *pkts, int n)
+{
+	struct udp_stack_descs *descs = udp_stack_descs_get();
+	struct nic_pkt_desc    *d;
+	int                     i;
+
+	if (!descs) return -ENOMEM;
+	if (n > NIC_BATCH_MAX) n = NIC_BATCH_MAX;
+
+	for (i = 0; i < n; i++) {
+		d        = &descs->descs[i];
+		d->objid = pkts[i].objid;
+		d->flags = 0;
+		udp_stack_tx_build(pkts[i].objid, pkts[i].data_offset, pkts[i].data_len, pkts[i].remote_addr,
+		                   pkts[i].remote_port, &d->pkt_offset, &d->pkt_len);
+	}
+
+	return nic_send_packets(descs->id, n);
+}
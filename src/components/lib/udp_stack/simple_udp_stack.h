@@ -4,27 +4,21 @@
 #include <cos_types.h>
 #include <shm_bm.h>
 #include <net_stack_types.h>
+#include <net_cksum.h>
 
-/* checksum functions directly picked from DPDK */
+/*
+ * checksum functions directly picked from DPDK, with the sums of the
+ * buffers computed with the kernels of `net_cksum.h`
+ */
 static inline u32_t
 __udp_stack_raw_cksum(const void *buf, size_t len, u32_t sum)
 {
-	/* extend strict-aliasing rules */
-	typedef u16_t __attribute__((__may_alias__)) u16_p;
-	const u16_p *u16_buf = (const u16_p *)buf;
-	const u16_p *end = u16_buf + len / sizeof(*u16_buf);
-
-	for (; u16_buf != end; ++u16_buf)
-		sum += *u16_buf;
-
-	/* if length is odd, keeping it byte order independent */
-	if (unlikely(len % 2)) {
-		u16_t left = 0;
-		*(unsigned char *)&left = *(const unsigned char *)end;
-		sum += left;
-	}
-
-	return sum;
+	u64_t s = (u64_t)sum + net_cksum_partial(buf, len);
+
+	s = (s & 0xffffffff) + (s >> 32);
+	s = (s & 0xffffffff) + (s >> 32);
+
+	return (u32_t)s;
 }
 
 static inline u16_t
@@ -137,4 +131,22 @@ int udp_stack_udp_bind(u32_t ip_addr, u16_t port);
 shm_bm_objid_t udp_stack_shmem_read(u16_t *data_offset, u16_t *data_len, u32_t *remote_addr, u16_t *remote_port);
 int udp_stack_shmem_write(shm_bm_objid_t objid, u16_t data_offset, u16_t data_len, u32_t remote_ip, u16_t remote_port);
 
+/*
+ * The batched versions of read and write, that only cost an
+ * invocation of the nic per batch, of up to UDP_STACK_BATCH_MAX
+ * packets. Invalid packets are read with a `data_len` of `0`.
+ */
+#define UDP_STACK_BATCH_MAX 32
+
+struct udp_stack_pkt {
+	shm_bm_objid_t objid;
+	u16_t          data_offset;
+	u16_t          data_len;
+	u32_t          remote_addr;
+	u16_t          remote_port;
+};
+
+int udp_stack_shmem_read_n(struct udp_stack_pkt *pkts, int n);
+int udp_stack_shmem_write_n(struct udp_stack_pkt *pkts, int n);
+
 #endif /* SIMPLE_UDP_STACK_H */
\ No newline at end of file
@@ -161,19 +161,94 @@ bitmap_unset(u32_t *x, int v)
 	x[idx] = __bitmap_unset(x[idx], off);
 }
 
+/***
+ * The scans of the bitmaps test 256 bits at a time. They use GCC's
+ * vector extensions, that are lowered to the widest registers the
+ * component is compiled for: SSE2 or AVX2 registers, or pairs of
+ * general-purpose registers in the FPU-free components (compiled with
+ * `-mgeneral-regs-only`). So the implementation is chosen at compile
+ * time, without an indirect call, and the scans are still inlined in
+ * the allocation paths.
+ */
+#define BITMAP_VEC_SZ 32
+
+typedef u32_t         bitmap_vec32_t __attribute__((vector_size(BITMAP_VEC_SZ)));
+typedef unsigned long bitmap_vecl_t  __attribute__((vector_size(BITMAP_VEC_SZ)));
+
+#define BITMAP_VEC32_N (int)(BITMAP_VEC_SZ / sizeof(u32_t))
+#define BITMAP_VECL_N  (int)(BITMAP_VEC_SZ / sizeof(unsigned long))
+
+/* The index of the first nonzero u32_t of x[0..n), or -1 */
+static inline int
+bitmap_word_nonzero(const u32_t *x, int n)
+{
+	bitmap_vec32_t v;
+	u32_t          acc;
+	int            i = 0, k;
+
+	for (; i + BITMAP_VEC32_N <= n; i += BITMAP_VEC32_N) {
+		__builtin_memcpy(&v, &x[i], sizeof(v));
+		for (acc = 0, k = 0; k < BITMAP_VEC32_N; k++) acc |= v[k];
+		if (acc) break;
+	}
+	for (; i < n; i++) {
+		if (x[i]) return i;
+	}
+
+	return -1;
+}
+
+/* The index of the first nonzero word of x[0..n), or -1 */
+static inline int
+bitmap_long_nonzero(const unsigned long *x, int n)
+{
+	bitmap_vecl_t v;
+	unsigned long acc;
+	int           i = 0, k;
+
+	for (; i + BITMAP_VECL_N <= n; i += BITMAP_VECL_N) {
+		__builtin_memcpy(&v, &x[i], sizeof(v));
+		for (acc = 0, k = 0; k < BITMAP_VECL_N; k++) acc |= v[k];
+		if (acc) break;
+	}
+	for (; i < n; i++) {
+		if (x[i]) return i;
+	}
+
+	return -1;
+}
+
+/* The index of the first zero word of x[0..n), or -1 */
+static inline int
+bitmap_long_zero(const unsigned long *x, int n)
+{
+	bitmap_vecl_t v, z;
+	unsigned long acc;
+	int           i = 0, k;
+
+	for (; i + BITMAP_VECL_N <= n; i += BITMAP_VECL_N) {
+		__builtin_memcpy(&v, &x[i], sizeof(v));
+		z = (bitmap_vecl_t)(v == 0);
+		for (acc = 0, k = 0; k < BITMAP_VECL_N; k++) acc |= z[k];
+		if (acc) break;
+	}
+	for (; i < n; i++) {
+		if (!x[i]) return i;
+	}
+
+	return -1;
+}
+
 /* find the least significant one set.  max is the maximum number of
  * u32_ts in the bitmap. */
 static inline int
 bitmap_one(u32_t *x, int max)
 {
-	int i, order;
+	int i = bitmap_word_nonzero(x, max);
 
-	for (i = 0; i < max; i++) {
-		if (!x[i]) continue;
-		order = _log32(ls_one(x[i]));
-		return (i * WORD_SIZE) + order;
-	}
-	return -1;
+	if (i < 0) return -1;
+
+	return (i * WORD_SIZE) + __builtin_ctz(x[i]);
 }
 
 /* Start looking for the least significant bit at an offset (in bits)
@@ -183,10 +258,11 @@ bitmap_one_offset(u32_t *x, int off, int max)
 {
 	int subword = off & (WORD_SIZE - 1), words = off / WORD_SIZE, ret;
 
+	if (words >= max) return -1;
 	/* do we have an offset into a word? */
 	if (subword) {
 		u32_t v = x[words] >> subword;
-		if (v) return _log32(ls_one(v)) + off;
+		if (v) return __builtin_ctz(v) + off;
 		words++;
 	}
 	ret = bitmap_one(x + words, max - words);
@@ -194,39 +270,54 @@ bitmap_one_offset(u32_t *x, int off, int max)
 	return ret;
 }
 
+/* The first zero bit at or after off, or the size of the bitmap if there is none */
+static inline int
+bitmap_zero_offset(u32_t *x, int off, int max)
+{
+	int   words = off / WORD_SIZE;
+	u32_t v;
+
+	if (words >= max) return max * WORD_SIZE;
+	/* The bits below the offset are treated as ones */
+	v = ~x[words] & ~((1U << (off & (WORD_SIZE - 1))) - 1);
+	while (!v) {
+		if (++words == max) return max * WORD_SIZE;
+		v = ~x[words];
+	}
+
+	return words * WORD_SIZE + __builtin_ctz(v);
+}
+
 static inline void
 bitmap_set_contig(u32_t *x, int off, int extent, int one)
 {
-	int i;
-
-	/* TODO: could optimize by setting blocks of 8, 16, 32... */
-	for (i = off; i < off + extent; i++) {
-		if (one)
-			bitmap_set(x, i);
-		else
-			bitmap_unset(x, i);
+	int   end = off + extent, i, lo, hi;
+	u32_t mask;
+
+	/* Set the whole words at once, with the partial ones at the ends masked */
+	for (i = off / WORD_SIZE; i * WORD_SIZE < end; i++) {
+		lo   = i * WORD_SIZE < off ? off - i * WORD_SIZE : 0;
+		hi   = (i + 1) * WORD_SIZE > end ? end - i * WORD_SIZE : WORD_SIZE;
+		mask = (hi == WORD_SIZE ? ~0U : (1U << hi) - 1) & ~((1U << lo) - 1);
+		if (one) x[i] |= mask;
+		else     x[i] &= ~mask;
 	}
 }
 
 static inline int
 bitmap_contiguous_ones(u32_t *x, int off, int extent, int max)
 {
-	int i, prev, start;
-
-	prev = start = off;
-	for (i = off; i < (int)(max * sizeof(u32_t) * 8); i++) {
-		prev = i;
-		i    = bitmap_one_offset(x, i, max);
-		/* end of bitmap? */
-		if (i < 0) return -1;
-		/* uncontiguous? */
-		else if (i != prev)
-			start = i;
-		/* found an appropriate extent? */
-		else if (i - start + 1 >= extent)
-			return start;
+	int start = off, end;
+
+	/* Skip from each run of ones to the next */
+	while (1) {
+		start = bitmap_one_offset(x, start, max);
+		if (start < 0) return -1;
+		end = bitmap_zero_offset(x, start, max);
+		if (end - start >= extent) return start;
+		if (end >= max * WORD_SIZE) return -1;
+		start = end;
 	}
-	return -1;
 }
 
 /* find a contiguous extent of ones, and set them to zero */
@@ -249,4 +340,105 @@ bitmap_extent_set_at(u32_t *x, int off, int extent, int max)
 	return 0;
 }
 
+/***
+ * A large bitmap, with summaries: level 0 is the bitmap, and bit `i`
+ * of level `l + 1` is set iff word `i` of level `l` is nonzero. So
+ * finding a set bit reads one word per level, and costs O(log_32 n)
+ * rather than a scan of the bitmap, and setting or clearing a bit
+ * updates the levels above it only when its word becomes nonzero or
+ * zero. It isn't safe to update concurrently (as the rest of this
+ * file), and the memory for its `bitmap_hier_words(nbits)` words is
+ * the caller's.
+ */
+#define BITMAP_HIER_LEVELS 4 /* up to 32^4 bits */
+
+struct bitmap_hier {
+	int    nlevels;
+	u32_t *lvl[BITMAP_HIER_LEVELS];
+	int    nwords[BITMAP_HIER_LEVELS];
+};
+
+static inline int
+bitmap_hier_words(int nbits)
+{
+	int n = (nbits + WORD_SIZE - 1) / WORD_SIZE, tot = n;
+
+	while (n > 1) {
+		n    = (n + WORD_SIZE - 1) / WORD_SIZE;
+		tot += n;
+	}
+
+	return tot;
+}
+
+/* All bits start unset. Returns -1 if the bitmap needs too many levels. */
+static inline int
+bitmap_hier_init(struct bitmap_hier *h, u32_t *mem, int nbits)
+{
+	int n = (nbits + WORD_SIZE - 1) / WORD_SIZE, l = 0;
+
+	while (1) {
+		if (l == BITMAP_HIER_LEVELS) return -1;
+		h->lvl[l]    = mem;
+		h->nwords[l] = n;
+		mem         += n;
+		l++;
+		if (n == 1) break;
+		n = (n + WORD_SIZE - 1) / WORD_SIZE;
+	}
+	h->nlevels = l;
+	for (l = 0; l < h->nlevels; l++) {
+		for (n = 0; n < h->nwords[l]; n++) h->lvl[l][n] = 0;
+	}
+
+	return 0;
+}
+
+static inline int
+bitmap_hier_check(struct bitmap_hier *h, int v)
+{
+	return bitmap_check(h->lvl[0], v);
+}
+
+static inline void
+bitmap_hier_set(struct bitmap_hier *h, int v)
+{
+	int   l;
+	u32_t prev;
+
+	for (l = 0; l < h->nlevels; l++, v /= WORD_SIZE) {
+		prev = h->lvl[l][v / WORD_SIZE];
+		bitmap_set(h->lvl[l], v);
+		/* The summaries above already have the word */
+		if (prev) return;
+	}
+}
+
+static inline void
+bitmap_hier_unset(struct bitmap_hier *h, int v)
+{
+	int l;
+
+	for (l = 0; l < h->nlevels; l++, v /= WORD_SIZE) {
+		bitmap_unset(h->lvl[l], v);
+		if (h->lvl[l][v / WORD_SIZE]) return;
+	}
+}
+
+/* The least significant bit set, or -1 */
+static inline int
+bitmap_hier_one(struct bitmap_hier *h)
+{
+	int   l, i = 0;
+	u32_t w;
+
+	for (l = h->nlevels - 1; l >= 0; l--) {
+		w = h->lvl[l][i];
+		if (!w) return -1;
+		i = i * WORD_SIZE + __builtin_ctz(w);
+	}
+
+	return i;
+}
+
 #endif /* BITMAP_H */
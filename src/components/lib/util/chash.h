@@ -0,0 +1,258 @@
+/**
+ * Redistribution of this file is permitted under the BSD two clause license.
+ *
+ * Copyright 2020, The George Washington University
+ */
+
+#ifndef CHASH_H
+#define CHASH_H
+
+#include <ps.h>
+#include <cos_debug.h>
+#include <errno.h>
+
+/***
+ * A concurrent hash map, for the lookup tables shared by the threads
+ * of all cores: lookups take no locks and make no writes, so they
+ * scale across cores, and insertions and removals are synchronized
+ * only on the slot they change, with a `cas`.
+ *
+ * The table is a flat array of `nslots` (a power of two) slots, with
+ * open addressing (linear probing). Each slot holds its key and value
+ * inline, and a state word that is both its state and its version:
+ *
+ * - *empty* - never used, and the end of the probes of a lookup,
+ * - *writing* - owned by the thread that writes its key or value,
+ * - *live* - holds the value of its key, and
+ * - *dead* - its key was removed.
+ *
+ * A writer moves a slot to *writing* with a `cas`, and out of it by
+ * incrementing its version, so a lookup reads the key and value of a
+ * slot between two reads of the same version, as with a seqlock, and
+ * retries otherwise. A writer owns the slot only for the few stores
+ * of its key and value.
+ *
+ * *Reclamation*: The key of a slot is never changed after it is first
+ * inserted: a removal marks the slot *dead*, and a later insertion of
+ * the same key revives it. So two threads that race to insert the
+ * same key probe the same slots, and meet at that of the key, and a
+ * lookup never reads a slot that is reused for another key. As keys
+ * and values are inline, no memory is freed under the lookups, and no
+ * safe memory reclamation is needed (if the values point to objects,
+ * freeing those remains the caller's, as for any shared pointer). The
+ * cost is that the table must have room for all the keys ever
+ * inserted, which suits the tables of the system: flows, futexes,
+ * and descriptors, whose keys are bounded, and often reinserted.
+ *
+ * *The API*, generated by `CHASH_FNS(name, key_type, val_type,
+ * nslots, hash_fn, eq_fn)`, where `unsigned long hash_fn(const
+ * key_type *)` and `int eq_fn(const key_type *, const key_type *)`
+ * (non-zero if equal):
+ *
+ * - `struct chash_name` - The table, that is empty if zeroed (e.g. in
+ *   the BSS).
+ * - `int chash_name_lookup(struct chash_name *t, const key_type *k,
+ *   val_type *v)` - Return `0` and the value of `k` in `v`, or
+ *   `-ENOENT`.
+ * - `int chash_name_add(t, k, v)` - Insert `k` with the value `v`,
+ *   or return `-EEXIST` (with the current value in `*v`) if it is
+ *   already in the table, or `-ENOSPC` if the table is full.
+ * - `int chash_name_set(t, k, v)` - Insert `k`, or replace its value.
+ * - `int chash_name_remove(t, k, val_type *v)` - Remove `k`, and
+ *   return its last value in `v` (if not `NULL`), or `-ENOENT`.
+ * - `void chash_name_prefetch(t, h)`, and the `*_hash` variants of
+ *   the above that take the key's hash `h = hash_fn(k)`, so a batch of
+ *   lookups can compute their hashes, and prefetch their slots, before
+ *   probing any of them, and overlap their cache misses.
+ *
+ * *Example*:
+ * ```c
+ * CHASH_FNS(futex, word_t, struct futex_data *, 256, futex_hash, futex_eq);
+ * static struct chash_futex futexes;
+ *
+ * struct futex_data *f;
+ * if (chash_futex_lookup(&futexes, &addr, &f)) f = futex_create(addr);
+ * ```
+ *
+ * As with `SS_STATIC_SLAB_FNS`, the functions are `static`, so the
+ * macro is used in the compilation object that uses them.
+ */
+
+typedef word_t chash_state_t;
+
+#define CHASH_EMPTY   0
+#define CHASH_WRITING 1
+#define CHASH_LIVE    2
+#define CHASH_DEAD    3
+#define CHASH_TAG(s)  ((s) & 3)
+/* Leave the writing state for `tag`, with the next version */
+#define CHASH_NEXT(s, tag) ((((s) >> 2) + 1) << 2 | (tag))
+
+/* Own the slot, if its state is still `s` */
+static inline int
+chash_state_take(chash_state_t *state, chash_state_t s)
+{
+	return ps_cas(state, s, (s & ~(chash_state_t)3) | CHASH_WRITING);
+}
+
+/* Publish the writes of the owned slot, as `tag` */
+static inline void
+chash_state_release(chash_state_t *state, int tag)
+{
+	chash_state_t s = *state;
+
+	assert(CHASH_TAG(s) == CHASH_WRITING);
+	ps_mem_fence();
+	*state = CHASH_NEXT(s, tag);
+}
+
+/* Wait for the slot's writer, and return its state */
+static inline chash_state_t
+chash_state_read(chash_state_t *state)
+{
+	chash_state_t s;
+
+	while (CHASH_TAG(s = ps_load(state)) == CHASH_WRITING) ;
+
+	return s;
+}
+
+#define CHASH_FNS(name, key_type, val_type, nslots, hash_fn, eq_fn)	\
+	struct chash_##name##_slot {					\
+		chash_state_t state;					\
+		key_type      key;					\
+		val_type      val;					\
+	};								\
+	struct chash_##name {						\
+		struct chash_##name##_slot slots[nslots];		\
+	};								\
+	static inline struct chash_##name##_slot *			\
+	__chash_##name##_slot(struct chash_##name *t, unsigned long h, unsigned long i) \
+	{								\
+		return &t->slots[(h + i) & ((nslots) - 1)];		\
+	}								\
+	static inline void						\
+	chash_##name##_prefetch(struct chash_##name *t, unsigned long h) \
+	{								\
+		__builtin_prefetch(__chash_##name##_slot(t, h, 0));	\
+	}								\
+	static int							\
+	chash_##name##_lookup_hash(struct chash_##name *t, const key_type *k, unsigned long h, val_type *v) \
+	{								\
+		struct chash_##name##_slot *e;				\
+		chash_state_t s;					\
+		key_type      key;					\
+		val_type      val;					\
+		unsigned long i;					\
+									\
+		for (i = 0; i < (nslots); i++) {			\
+			e = __chash_##name##_slot(t, h, i);		\
+			do {						\
+				s   = chash_state_read(&e->state);	\
+				key = e->key;				\
+				val = e->val;				\
+				ps_mem_fence();				\
+			} while (ps_load(&e->state) != s);		\
+			if (CHASH_TAG(s) == CHASH_EMPTY) return -ENOENT; \
+			if (!eq_fn(&key, k)) continue;			\
+			if (CHASH_TAG(s) == CHASH_DEAD) return -ENOENT;	\
+			*v = val;					\
+									\
+			return 0;					\
+		}							\
+									\
+		return -ENOENT;						\
+	}								\
+	static inline int						\
+	chash_##name##_lookup(struct chash_##name *t, const key_type *k, val_type *v) \
+	{								\
+		return chash_##name##_lookup_hash(t, k, hash_fn(k), v);	\
+	}								\
+	/* Own the slot of `k`, claiming an empty one if it isn't in the table */ \
+	static struct chash_##name##_slot *				\
+	__chash_##name##_take(struct chash_##name *t, const key_type *k, unsigned long h, \
+	                      int claim, chash_state_t *prev)		\
+	{								\
+		struct chash_##name##_slot *e;				\
+		chash_state_t s;					\
+		unsigned long i;					\
+									\
+		for (i = 0; i < (nslots); i++) {			\
+			e = __chash_##name##_slot(t, h, i);		\
+		retry:							\
+			s = chash_state_read(&e->state);		\
+			if (CHASH_TAG(s) == CHASH_EMPTY) {		\
+				if (!claim) return NULL;		\
+				if (!chash_state_take(&e->state, s)) goto retry; \
+				e->key = *k;				\
+				*prev  = s;				\
+									\
+				return e;				\
+			}						\
+			/* The keys of used slots never change */	\
+			if (!eq_fn(&e->key, k)) continue;		\
+			if (!chash_state_take(&e->state, s)) goto retry; \
+			*prev = s;					\
+									\
+			return e;					\
+		}							\
+									\
+		return NULL;						\
+	}								\
+	static int							\
+	chash_##name##_add_hash(struct chash_##name *t, const key_type *k, unsigned long h, val_type *v) \
+	{								\
+		struct chash_##name##_slot *e;				\
+		chash_state_t prev;					\
+									\
+		e = __chash_##name##_take(t, k, h, 1, &prev);		\
+		if (!e) return -ENOSPC;					\
+		if (CHASH_TAG(prev) == CHASH_LIVE) {			\
+			*v = e->val;					\
+			chash_state_release(&e->state, CHASH_LIVE);	\
+									\
+			return -EEXIST;					\
+		}							\
+		e->val = *v;						\
+		chash_state_release(&e->state, CHASH_LIVE);		\
+									\
+		return 0;						\
+	}								\
+	static inline int						\
+	chash_##name##_add(struct chash_##name *t, const key_type *k, val_type *v) \
+	{								\
+		return chash_##name##_add_hash(t, k, hash_fn(k), v);	\
+	}								\
+	static int							\
+	chash_##name##_set(struct chash_##name *t, const key_type *k, val_type v) \
+	{								\
+		struct chash_##name##_slot *e;				\
+		chash_state_t prev;					\
+									\
+		e = __chash_##name##_take(t, k, hash_fn(k), 1, &prev);	\
+		if (!e) return -ENOSPC;					\
+		e->val = v;						\
+		chash_state_release(&e->state, CHASH_LIVE);		\
+									\
+		return 0;						\
+	}								\
+	static int							\
+	chash_##name##_remove(struct chash_##name *t, const key_type *k, val_type *v) \
+	{								\
+		struct chash_##name##_slot *e;				\
+		chash_state_t prev;					\
+									\
+		e = __chash_##name##_take(t, k, hash_fn(k), 0, &prev);	\
+		if (!e) return -ENOENT;					\
+		if (CHASH_TAG(prev) != CHASH_LIVE) {			\
+			chash_state_release(&e->state, CHASH_TAG(prev)); \
+									\
+			return -ENOENT;					\
+		}							\
+		if (v) *v = e->val;					\
+		chash_state_release(&e->state, CHASH_DEAD);		\
+									\
+		return 0;						\
+	}
+
+#endif	/* CHASH_H */
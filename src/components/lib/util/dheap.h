@@ -0,0 +1,188 @@
+#ifndef DHEAP_H
+#define DHEAP_H
+
+#include <cos_types.h>
+#include <cos_debug.h>
+
+/***
+ * A 4-ary min-heap of keys with values, for the timers: the keys
+ * (e.g. timeouts) are inline in the heap's array, next to their
+ * values, so the sifts compare keys without calling through function
+ * pointers, or loading the values' structures. Only the values that
+ * move are told their new position (with `UPDATE_FN(val, pos)`, and
+ * `pos == 0` once removed), so they can be adjusted or removed later.
+ *
+ * The array's entries are 16 bytes, and the root is at `DHEAP_ROOT`,
+ * so that, if the array is cache-aligned, the 4 children of each node
+ * are in one cache line: a sift down loads a cache line per level,
+ * and there are half as many levels as in a binary heap.
+ *
+ * The API, generated by `DECLARE_DHEAP(NAME, UPDATE_FN)`:
+ *
+ * - `dheap_init(h, ents, max_sz)` - `ents` holds `DHEAP_ENTS(max_sz)`
+ *   entries (e.g. `struct dheap_ent ents[DHEAP_ENTS(max)] CACHE_ALIGNED`).
+ * - `NAME_dheap_add(h, key, val)` - Returns `-1` if the heap is full.
+ * - `NAME_dheap_pop(h)` - The value with the smallest key, or `NULL`.
+ * - `NAME_dheap_pop_until(h, key, vals, max)` - Pop up to `max` of the
+ *   values with keys `<= key` into `vals`, and return how many, e.g.
+ *   to expire many timers at once.
+ * - `NAME_dheap_adjust(h, pos, key)` - Change the key of the value at
+ *   `pos`, in O(log n) (in either direction).
+ * - `NAME_dheap_remove(h, pos)` - Remove the value at `pos`.
+ * - `dheap_peek(h)`, `dheap_peek_key(h)`, `dheap_size(h)`.
+ */
+
+struct dheap_ent {
+	u64_t key;
+	void *val;
+};
+
+struct dheap {
+	int               end, max_sz; /* the entry after the last */
+	struct dheap_ent *ents;
+};
+
+#define DHEAP_ROOT 3
+#define DHEAP_ENTS(max_sz) ((max_sz) + DHEAP_ROOT)
+/* The first of the 4 children, and the parent of a node */
+#define DHEAP_CHILD(i)  (4 * ((i) - 2))
+#define DHEAP_PARENT(i) ((i) / 4 + 2)
+
+static inline void
+dheap_init(struct dheap *h, struct dheap_ent *ents, int max_sz)
+{
+	h->end    = DHEAP_ROOT;
+	h->max_sz = max_sz;
+	h->ents   = ents;
+}
+
+static inline int
+dheap_size(struct dheap *h)
+{
+	return h->end - DHEAP_ROOT;
+}
+
+static inline int
+dheap_empty(struct dheap *h)
+{
+	return h->end == DHEAP_ROOT;
+}
+
+static inline void *
+dheap_peek(struct dheap *h)
+{
+	if (dheap_empty(h)) return NULL;
+
+	return h->ents[DHEAP_ROOT].val;
+}
+
+/* Only valid if the heap isn't empty */
+static inline u64_t
+dheap_peek_key(struct dheap *h)
+{
+	assert(!dheap_empty(h));
+
+	return h->ents[DHEAP_ROOT].key;
+}
+
+#define DECLARE_DHEAP(NAME, UPDATE_FN)					\
+	/* Place e at or above i, moving the parents it's smaller than down */ \
+	static inline int						\
+	NAME##_dheap_sift_up(struct dheap *h, int i, struct dheap_ent e) \
+	{								\
+		int p;							\
+									\
+		while (i > DHEAP_ROOT) {				\
+			p = DHEAP_PARENT(i);				\
+			if (h->ents[p].key <= e.key) break;		\
+			h->ents[i] = h->ents[p];			\
+			UPDATE_FN(h->ents[i].val, i);			\
+			i = p;						\
+		}							\
+		h->ents[i] = e;						\
+		UPDATE_FN(e.val, i);					\
+									\
+		return i;						\
+	}								\
+	/* Place e at or below i, moving the children it's larger than up */ \
+	static inline int						\
+	NAME##_dheap_sift_down(struct dheap *h, int i, struct dheap_ent e) \
+	{								\
+		int c, k, last, min;					\
+									\
+		while ((c = DHEAP_CHILD(i)) < h->end) {			\
+			last = c + 4 < h->end ? c + 4 : h->end;		\
+			for (min = c, k = c + 1; k < last; k++) {	\
+				if (h->ents[k].key < h->ents[min].key) min = k; \
+			}						\
+			if (e.key <= h->ents[min].key) break;		\
+			h->ents[i] = h->ents[min];			\
+			UPDATE_FN(h->ents[i].val, i);			\
+			i = min;					\
+		}							\
+		h->ents[i] = e;						\
+		UPDATE_FN(e.val, i);					\
+									\
+		return i;						\
+	}								\
+	static inline int						\
+	NAME##_dheap_add(struct dheap *h, u64_t key, void *val)		\
+	{								\
+		if (dheap_size(h) >= h->max_sz) return -1;		\
+		h->end++;						\
+		NAME##_dheap_sift_up(h, h->end - 1, (struct dheap_ent) { .key = key, .val = val }); \
+									\
+		return 0;						\
+	}								\
+	static inline void						\
+	NAME##_dheap_adjust(struct dheap *h, int i, u64_t key)		\
+	{								\
+		struct dheap_ent e = { .key = key, .val = h->ents[i].val }; \
+									\
+		assert(i >= DHEAP_ROOT && i < h->end);			\
+		if (i > DHEAP_ROOT && key < h->ents[DHEAP_PARENT(i)].key) NAME##_dheap_sift_up(h, i, e); \
+		else                                                      NAME##_dheap_sift_down(h, i, e); \
+	}								\
+	static inline void *						\
+	NAME##_dheap_remove(struct dheap *h, int i)			\
+	{								\
+		void            *val;					\
+		struct dheap_ent last;					\
+									\
+		assert(i >= DHEAP_ROOT && i < h->end);			\
+		val  = h->ents[i].val;					\
+		last = h->ents[--h->end];				\
+		UPDATE_FN(val, 0);					\
+		if (i == h->end) return val;				\
+		/* The last entry replaces the removed one */		\
+		h->ents[i] = last;					\
+		NAME##_dheap_adjust(h, i, last.key);			\
+									\
+		return val;						\
+	}								\
+	static inline void *						\
+	NAME##_dheap_pop(struct dheap *h)				\
+	{								\
+		void *val;						\
+									\
+		if (dheap_empty(h)) return NULL;			\
+		val = h->ents[DHEAP_ROOT].val;				\
+		h->end--;						\
+		UPDATE_FN(val, 0);					\
+		if (!dheap_empty(h)) NAME##_dheap_sift_down(h, DHEAP_ROOT, h->ents[h->end]); \
+									\
+		return val;						\
+	}								\
+	static inline int						\
+	NAME##_dheap_pop_until(struct dheap *h, u64_t key, void **vals, int max) \
+	{								\
+		int n = 0;						\
+									\
+		while (n < max && !dheap_empty(h) && h->ents[DHEAP_ROOT].key <= key) { \
+			vals[n++] = NAME##_dheap_pop(h);		\
+		}							\
+									\
+		return n;						\
+	}
+
+#endif /* DHEAP_H */
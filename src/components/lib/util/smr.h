@@ -0,0 +1,154 @@
+/**
+ * Redistribution of this file is permitted under the BSD two clause license.
+ *
+ * Copyright 2020, The George Washington University
+ */
+
+#ifndef SMR_H
+#define SMR_H
+
+#include <ps.h>
+#include <cos_component.h>
+#include <cos_debug.h>
+
+/***
+ * Safe memory reclamation for the objects that lock-free readers, on
+ * any core, find in shared tables: a removed object is *retired*
+ * rather than freed, and freed in a batch once no reader that could
+ * have found it is still reading.
+ *
+ * The domain has an epoch, and each core counts its readers of the
+ * current epoch's parity. A read section is between `smr_enter` and
+ * `smr_exit`, which increment and decrement that count: an atomic
+ * instruction on a cache line of the core, that no other core writes,
+ * so it is uncontended. The threads of a component can be preempted
+ * in a read section, so unlike a kernel, the component can't infer the
+ * quiescence of a core from its executing some other code.
+ *
+ * The epoch advances from `e` to `e + 1` once the cores have no readers
+ * of the previous epoch (`e - 1`, of the other parity), so an object
+ * retired in epoch `e` is no longer read from epoch `e + 2` on. This
+ * takes no locks, and readers never wait for the reclamation.
+ *
+ * Retired objects are kept on a list of their owner's (e.g. that of
+ * a core's pool of objects), with an `smr_node` embedded in them, and
+ * the owner serializes the accesses to it, as with the rest of its
+ * pool. Each `SMR_BATCH` retirements, or on `smr_poll`, the epoch is
+ * advanced if it can be, and the objects whose grace period is over
+ * are passed to the free function.
+ *
+ * *Example*:
+ * ```c
+ * static struct smr thd_smr;
+ *
+ * // A reader, on any core
+ * tok = smr_enter(&thd_smr);
+ * t = thd_lookup(tid);
+ * if (t) thd_wakeup(t);
+ * smr_exit(&thd_smr, tok);
+ *
+ * // The owner, after removing t from the table
+ * smr_retire(&thd_smr, &pool->retired, &t->smr, thd_free);
+ * ```
+ */
+
+#define SMR_BATCH 32
+
+struct smr_node {
+	struct smr_node *next;
+	unsigned long    epoch; /* in which it was retired */
+};
+
+typedef void (*smr_free_fn_t)(struct smr_node *n);
+
+struct smr_core {
+	unsigned long readers[2]; /* by the parity of their epoch */
+} CACHE_ALIGNED;
+
+/* Zeroed (e.g. in the BSS), it is initialized */
+struct smr {
+	unsigned long   epoch CACHE_ALIGNED;
+	struct smr_core cores[NUM_CPU];
+};
+
+/* The objects retired by an owner, oldest first */
+struct smr_retired {
+	struct smr_node *head, *tail;
+	unsigned long    n;
+};
+
+/* Returns the token to pass to `smr_exit` */
+static inline unsigned long
+smr_enter(struct smr *s)
+{
+	unsigned long core = cos_coreid();
+	unsigned long p    = ps_load(&s->epoch) & 1;
+
+	/* The atomic instruction orders the following reads after it */
+	ps_faa(&s->cores[core].readers[p], 1);
+
+	return core << 1 | p;
+}
+
+static inline void
+smr_exit(struct smr *s, unsigned long tok)
+{
+	ps_faa(&s->cores[tok >> 1].readers[tok & 1], -1);
+}
+
+/* Advance the epoch if no reader is left from the previous one */
+static inline int
+smr_advance(struct smr *s)
+{
+	unsigned long e = ps_load(&s->epoch), n = 0;
+	int           i;
+
+	for (i = 0; i < NUM_CPU; i++) n += ps_load(&s->cores[i].readers[(e + 1) & 1]);
+	if (n) return 0;
+
+	return ps_cas(&s->epoch, e, e + 1);
+}
+
+/* Free the retired objects whose grace period is over, and return how many */
+static inline unsigned long
+smr_poll(struct smr *s, struct smr_retired *r, smr_free_fn_t fn)
+{
+	struct smr_node *n;
+	unsigned long    e, freed = 0;
+
+	if (!r->head) return 0;
+	/* The oldest object needs up to two advances */
+	if (ps_load(&s->epoch) < r->head->epoch + 2 && smr_advance(s)) smr_advance(s);
+	e = ps_load(&s->epoch);
+
+	while (r->head && r->head->epoch + 2 <= e) {
+		n       = r->head;
+		r->head = n->next;
+		r->n--;
+		fn(n);
+		freed++;
+	}
+	if (!r->head) r->tail = NULL;
+
+	return freed;
+}
+
+/*
+ * Retire an object that was removed from the shared tables, so that
+ * no new reader can find it.
+ */
+static inline void
+smr_retire(struct smr *s, struct smr_retired *r, struct smr_node *n, smr_free_fn_t fn)
+{
+	/* The removal must be visible before the epoch is read */
+	ps_mem_fence();
+	n->epoch = ps_load(&s->epoch);
+	n->next  = NULL;
+	if (r->tail) r->tail->next = n;
+	else         r->head       = n;
+	r->tail = n;
+
+	if (++r->n >= SMR_BATCH) smr_poll(s, r, fn);
+}
+
+#endif	/* SMR_H */
@@ -85,6 +85,40 @@ stacklist_dequeue(struct stacklist_head *h)
 	return sl;
 }
 
+/*
+ * Take all of the threads on the list at once, with a single atomic
+ * exchange: unlike the dequeue of a single one, this is safe with
+ * concurrent dequeues, and threads that block again (ABA).
+ */
+static inline struct stacklist *
+stacklist_dequeue_all(struct stacklist_head *h)
+{
+	struct stacklist *sl;
+
+	if (!ps_load(&h->head)) return NULL;
+	while (1) {
+		sl = ps_load(&h->head);
+		if (!sl) return NULL;
+		if (ps_cas((unsigned long *)&h->head, (unsigned long)sl, 0)) break;
+	}
+
+	return sl;
+}
+
+/*
+ * The next thread of a list taken with `stacklist_dequeue_all`,
+ * removing `l` from it (after which its thread can block again).
+ */
+static inline struct stacklist *
+stacklist_next(struct stacklist *l)
+{
+	struct stacklist *n = l->next;
+
+	l->next = NULL;
+
+	return n;
+}
+
 /*
  * A thread that wakes up after blocking using a stacklist should be
  * able to assume that it is no longer on the list. This enables them
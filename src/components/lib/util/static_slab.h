@@ -10,6 +10,7 @@
 
 #include <ps.h>
 #include <cos_debug.h>
+#include <bitmap.h>
 
 /***
  * The second API similarly provides the logic for allocation and
@@ -333,8 +334,13 @@ ss_state_refcnt_add(ss_state_t *state, long amnt)
 	{								\
 		unsigned int i;						\
 		obj_type *c = NULL;					\
+		int off;						\
 									\
+		/* Scan the states for free (zero) ones, many at a time */ \
 		for (i = 0; i < max_num; i++) {				\
+			off = bitmap_long_zero(&heap->states[i], max_num - i); \
+			if (off < 0) return NULL;			\
+			i += off;					\
 			c = __ss_##name##_alloc_at_index(heap, i);	\
 			if (c) return c;				\
 		}							\
@@ -425,4 +431,152 @@ ss_state_refcnt_add(ss_state_t *state, long amnt)
  */
 #define SS_STATIC_SLAB(name, type, max_num) SS_STATIC_SLAB_GLOBAL_ID(name, type, max_num, 1)
 
+/***
+ * A dynamic variant of the global slab, with the same API, for the
+ * tables whose maximum is much larger than their common use: rather
+ * than the BSS for `max_num` objects, it reserves an array of
+ * pointers to chunks of `SS_DYN_CHUNK_NOBJ` objects, each allocated
+ * when an object is first allocated in it. `get` is still
+ * constant-time, with one more load (that of the chunk), and a `get`
+ * in a chunk not yet allocated fails, as does one of a free object.
+ *
+ * The chunks are allocated with `alloc_fn(npages, align)`, which has
+ * the signature of `memmgr_heap_page_allocn_aligned`, and returns
+ * `0` if it cannot allocate. Each chunk is aligned on its (power of
+ * two) size, so the chunk of an object is found by masking its
+ * address. The chunks are never freed, and when two threads race to
+ * allocate the same chunk, the pages of the loser are leaked.
+ *
+ * - `SS_DYNAMIC_SLAB(name, type, max_num)` - ids start at 1, and the
+ *   chunks are allocated from the memmgr, so the component must
+ *   include `memmgr.h`, and depend on the `memmgr` interface.
+ * - `SS_DYNAMIC_SLAB_ALLOC(name, type, max_num, off, alloc_fn)` - For
+ *   the components that cannot use the memmgr (e.g. the capmgr).
+ */
+#define SS_DYN_CHUNK_NOBJ 64
+
+#define SS_DYNAMIC_SLAB_ALLOC(name, type, max_num, off, alloc_fn)	\
+	struct ss_##name##_chunk {					\
+		unsigned int base; /* the index of objs[0] */		\
+		ss_state_t   states[SS_DYN_CHUNK_NOBJ];			\
+		type         objs[SS_DYN_CHUNK_NOBJ];			\
+	};								\
+	static struct ss_##name##_chunk *				\
+	__ss_##name##_chunks[(max_num + SS_DYN_CHUNK_NOBJ - 1) / SS_DYN_CHUNK_NOBJ]; \
+	static inline unsigned long /* the size, and alignment, of a chunk */ \
+	__ss_##name##_chunk_sz(void)					\
+	{								\
+		unsigned long sz = sizeof(struct ss_##name##_chunk);	\
+									\
+		if (sz <= PAGE_SIZE) return PAGE_SIZE;			\
+									\
+		return 1UL << (sizeof(long) * 8 - __builtin_clzl(sz - 1)); \
+	}								\
+	static inline struct ss_##name##_chunk *			\
+	__ss_##name##_chunk_of(type *o)					\
+	{								\
+		return (struct ss_##name##_chunk *)((word_t)o & ~(word_t)(__ss_##name##_chunk_sz() - 1)); \
+	}								\
+	/* The chunk `c`, allocated if it isn't yet */			\
+	static struct ss_##name##_chunk *				\
+	__ss_##name##_chunk_get(unsigned int c)				\
+	{								\
+		struct ss_##name##_chunk *chunk = ps_load(&__ss_##name##_chunks[c]); \
+		unsigned long sz = __ss_##name##_chunk_sz();		\
+									\
+		if (likely(chunk)) return chunk;			\
+		chunk = (struct ss_##name##_chunk *)alloc_fn(sz / PAGE_SIZE, sz); \
+		if (!chunk) return NULL;				\
+		memset(chunk, 0, sizeof(struct ss_##name##_chunk));	\
+		chunk->base = c * SS_DYN_CHUNK_NOBJ;			\
+		if (!ps_cas((unsigned long *)&__ss_##name##_chunks[c], 0, (unsigned long)chunk)) { \
+			chunk = ps_load(&__ss_##name##_chunks[c]);	\
+		}							\
+									\
+		return chunk;						\
+	}								\
+	static type *	/* Not part of the public API */		\
+	__ss_##name##_alloc_at_index(unsigned int idx)			\
+	{								\
+		struct ss_##name##_chunk *chunk;			\
+		unsigned int i = idx % SS_DYN_CHUNK_NOBJ;		\
+									\
+		if (idx >= max_num) return NULL;			\
+		chunk = __ss_##name##_chunk_get(idx / SS_DYN_CHUNK_NOBJ); \
+		if (!chunk) return NULL;				\
+		if (ss_state_alloc(&chunk->states[i])) return NULL;	\
+		memset(&chunk->objs[i], 0, sizeof(type));		\
+									\
+		return &chunk->objs[i];					\
+	}								\
+	static type *							\
+	ss_##name##_alloc_at_id(unsigned int id)			\
+	{								\
+		if (id < off) return NULL;				\
+									\
+		return __ss_##name##_alloc_at_index(id - off);		\
+	}								\
+	static type *							\
+	ss_##name##_alloc(void)						\
+	{								\
+		unsigned int i;						\
+		type *o = NULL;						\
+									\
+		/* Only allocates a chunk once the previous ones are full */ \
+		for (i = 0; i < max_num; i++) {				\
+			o = __ss_##name##_alloc_at_index(i);		\
+			if (o) return o;				\
+		}							\
+									\
+		return NULL;						\
+	}								\
+	static unsigned int						\
+	ss_##name##_id(type *o)						\
+	{								\
+		struct ss_##name##_chunk *chunk = __ss_##name##_chunk_of(o); \
+									\
+		assert(o >= chunk->objs && o <= &chunk->objs[SS_DYN_CHUNK_NOBJ - 1]); \
+									\
+		return chunk->base + (o - chunk->objs) + off;		\
+	}								\
+	static void							\
+	ss_##name##_activate(type *o)					\
+	{								\
+		struct ss_##name##_chunk *chunk = __ss_##name##_chunk_of(o); \
+									\
+		ss_state_activate_with(&chunk->states[o - chunk->objs], SS_STATE_NULLVAL); \
+	}								\
+	static void							\
+	ss_##name##_free(type *o)					\
+	{								\
+		struct ss_##name##_chunk *chunk = __ss_##name##_chunk_of(o); \
+									\
+		ss_state_free(&chunk->states[o - chunk->objs]);		\
+	}								\
+	static type *							\
+	ss_##name##_get(unsigned int id)				\
+	{								\
+		struct ss_##name##_chunk *chunk;			\
+		unsigned int idx, i;					\
+									\
+		if (id < off) return NULL;				\
+		idx = id - off;						\
+		if (idx >= max_num) return NULL;			\
+		chunk = ps_load(&__ss_##name##_chunks[idx / SS_DYN_CHUNK_NOBJ]); \
+		if (!chunk) return NULL;				\
+		i = idx % SS_DYN_CHUNK_NOBJ;				\
+		if (!ss_state_is_allocated(chunk->states[i])) return NULL; \
+									\
+		return &chunk->objs[i];					\
+	}								\
+	int								\
+	ss_##name##_is_allocated(type *o)				\
+	{								\
+		struct ss_##name##_chunk *chunk = __ss_##name##_chunk_of(o); \
+									\
+		return ss_state_is_allocated(chunk->states[o - chunk->objs]); \
+	}
+
+#define SS_DYNAMIC_SLAB(name, type, max_num) SS_DYNAMIC_SLAB_ALLOC(name, type, max_num, 1, memmgr_heap_page_allocn_aligned)
+
 #endif	/* STATIC_SLAB_H */
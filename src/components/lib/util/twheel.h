@@ -0,0 +1,193 @@
+#ifndef TWHEEL_H
+#define TWHEEL_H
+
+/***
+ * A hierarchical timing wheel. Timers expire on "ticks" (that the
+ * user derives from time, e.g. cycles shifted right), and are kept in
+ * one of TWHEEL_SLOTS slots of TWHEEL_LEVELS levels. Level l holds the
+ * timers expiring within TWHEEL_SLOTS^(l+1) ticks, and its slots are
+ * cascaded down to the lower level as the wheel advances. Adding and
+ * canceling timers is O(1), and advancing the wheel is O(1) per tick,
+ * plus the re-insertion of cascaded timers.
+ *
+ * Ticks are compared relative to the current tick, so they can wrap
+ * around. Timers further in the future than the wheel's span are
+ * kept in the last slot they can be, and re-inserted as the wheel
+ * advances.
+ */
+
+#include <cos_component.h>
+#include <cos_debug.h>
+#include <ps_list.h>
+
+#define TWHEEL_BITS   6
+#define TWHEEL_SLOTS  (1 << TWHEEL_BITS)
+#define TWHEEL_MASK   (TWHEEL_SLOTS - 1)
+#define TWHEEL_LEVELS 4
+#define TWHEEL_SPAN   (1ULL << (TWHEEL_BITS * TWHEEL_LEVELS))
+
+typedef u64_t twheel_tick_t;
+
+struct twheel_timer {
+	struct ps_list list;
+	twheel_tick_t  expires;
+};
+
+struct twheel {
+	twheel_tick_t       curr; /* the next tick to expire */
+	unsigned long       ntimers;
+	struct ps_list_head slots[TWHEEL_LEVELS][TWHEEL_SLOTS];
+};
+
+typedef void (*twheel_expire_fn_t)(struct twheel_timer *t, void *data);
+
+static inline void
+twheel_init(struct twheel *w, twheel_tick_t now)
+{
+	int l, s;
+
+	w->curr    = now;
+	w->ntimers = 0;
+	for (l = 0; l < TWHEEL_LEVELS; l++) {
+		for (s = 0; s < TWHEEL_SLOTS; s++) ps_list_head_init(&w->slots[l][s]);
+	}
+}
+
+static inline void
+twheel_timer_init(struct twheel_timer *t)
+{
+	ps_list_init_d(t);
+	t->expires = 0;
+}
+
+static inline int
+twheel_timer_pending(struct twheel_timer *t)
+{
+	return !ps_list_singleton_d(t);
+}
+
+static inline struct ps_list_head *
+__twheel_insert(struct twheel *w, struct twheel_timer *t)
+{
+	twheel_tick_t        when  = t->expires;
+	s64_t                delta = (s64_t)(when - w->curr);
+	struct ps_list_head *h;
+	int                  l;
+
+	/* Already expired timers are expired on the next tick */
+	if (delta < 0) {
+		delta = 0;
+		when  = w->curr;
+	} else if ((u64_t)delta >= TWHEEL_SPAN) {
+		delta = TWHEEL_SPAN - 1;
+		when  = w->curr + delta;
+	}
+	for (l = 0; l < TWHEEL_LEVELS - 1; l++) {
+		if ((u64_t)delta < (1ULL << (TWHEEL_BITS * (l + 1)))) break;
+	}
+	h = &w->slots[l][(when >> (TWHEEL_BITS * l)) & TWHEEL_MASK];
+	ps_list_head_append_d(h, t);
+
+	return h;
+}
+
+static inline void
+twheel_add(struct twheel *w, struct twheel_timer *t, twheel_tick_t expires)
+{
+	assert(!twheel_timer_pending(t));
+
+	t->expires = expires;
+	__twheel_insert(w, t);
+	w->ntimers++;
+}
+
+static inline void
+twheel_cancel(struct twheel *w, struct twheel_timer *t)
+{
+	if (!twheel_timer_pending(t)) return;
+
+	ps_list_rem_d(t);
+	w->ntimers--;
+}
+
+static inline void
+__twheel_cascade(struct twheel *w, int level, int slot)
+{
+	struct ps_list_head *h = &w->slots[level][slot], *n;
+	struct twheel_timer *t;
+
+	/*
+	 * The slot's timers all expire within TWHEEL_SLOTS^level
+	 * ticks (or are beyond the span, and move to the previous top
+	 * slot), so none are re-inserted here.
+	 */
+	while (!ps_list_head_empty(h)) {
+		t = ps_list_head_first_d(h, struct twheel_timer);
+		ps_list_rem_d(t);
+		n = __twheel_insert(w, t);
+		assert(n != h);
+	}
+}
+
+/*
+ * Expire all timers with ticks up to, and including, `now`, calling
+ * `fn` on each after removing it from the wheel (so `fn` can add it
+ * again).
+ */
+static inline void
+twheel_advance(struct twheel *w, twheel_tick_t now, twheel_expire_fn_t fn, void *data)
+{
+	struct ps_list_head *h;
+	struct twheel_timer *t;
+	int                  l;
+
+	while ((s64_t)(now - w->curr) >= 0) {
+		/* Skip the ticks with no timers; otherwise this is per-tick */
+		if (w->ntimers == 0) {
+			w->curr = now + 1;
+			break;
+		}
+		/* Each time a level wraps, the next slot of the level above moves down */
+		for (l = 1; l < TWHEEL_LEVELS && ((w->curr >> (TWHEEL_BITS * (l - 1))) & TWHEEL_MASK) == 0; l++) {
+			__twheel_cascade(w, l, (w->curr >> (TWHEEL_BITS * l)) & TWHEEL_MASK);
+		}
+
+		h = &w->slots[0][w->curr & TWHEEL_MASK];
+		while (!ps_list_head_empty(h)) {
+			t = ps_list_head_first_d(h, struct twheel_timer);
+			ps_list_rem_d(t);
+			w->ntimers--;
+			fn(t, data);
+		}
+		w->curr++;
+	}
+}
+
+/*
+ * The tick at which the wheel must next be advanced: that of the next
+ * expiry if it's within TWHEEL_SLOTS ticks, and otherwise a lower
+ * bound on it (of the next cascade of a slot with timers). Without
+ * timers, this is a span past the current tick.
+ */
+static inline twheel_tick_t
+twheel_next(struct twheel *w)
+{
+	twheel_tick_t next = w->curr + TWHEEL_SPAN, base;
+	int           l, s, shift;
+
+	if (w->ntimers == 0) return next;
+	for (l = 0; l < TWHEEL_LEVELS; l++) {
+		shift = TWHEEL_BITS * l;
+		/* the first slot of the level that hasn't been cascaded */
+		base  = (w->curr + (1ULL << shift) - 1) >> shift;
+		for (s = 0; s < TWHEEL_SLOTS; s++) {
+			if (ps_list_head_empty(&w->slots[l][(base + s) & TWHEEL_MASK])) continue;
+			if ((s64_t)(((base + s) << shift) - next) < 0) next = (base + s) << shift;
+			break;
+		}
+	}
+
+	return next;
+}
+
+#endif /* TWHEEL_H */
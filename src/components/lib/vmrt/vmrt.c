@@ -8,8 +8,10 @@
 #include <cos_component.h>
 #include <cos_kernel_api.h>
 #include <capmgr.h>
+#include <memmgr.h>
 
 #include <sched.h>
+#include <ps.h>
 #include <vmrt.h>
 #include <vmx_msr.h>
 
@@ -33,6 +35,173 @@ vmrt_dump_vcpu(struct vmrt_vm_vcpu *vcpu)
 	printc("\tCR0: %016llx\tCR2: %016llx\tCR4: %016llx\n", regs->cr0, regs->cr2, regs->cr4);
 }
 
+void
+vmrt_dump_exit_stats(struct vmrt_vm_vcpu *vcpu)
+{
+	struct vm_exit_stats *stats = &vcpu->shared_region->exit_stats;
+	/* The forwarded exits are counted by the handler thread */
+	struct vmrt_exit_prof *forwarded = vcpu->prof.reason;
+	u64_t nkernel = 0, nforwarded = 0;
+	int i;
+
+	for (i = 0; i < MAX_VM_EXIT_REASONS; i++) {
+		if (!stats->kernel[i] && !forwarded[i].count) continue;
+		printc("\texit %2d: kernel %llu (%llu cycles/exit), forwarded %llu\n", i, stats->kernel[i],
+		       stats->kernel[i] ? stats->kernel_cycles[i] / stats->kernel[i] : 0, forwarded[i].count);
+		nkernel    += stats->kernel[i];
+		nforwarded += forwarded[i].count;
+	}
+	printc("\tvcpu %u exits: kernel %llu, forwarded %llu\n", vcpu->cpuid, nkernel, nforwarded);
+}
+
+static void
+vmrt_prof_print(const char *name, u64_t key, struct vmrt_exit_prof *p)
+{
+	int i;
+
+	printc("\t%s 0x%llx: %llu exits, %llu cycles/exit, %llu in the handler\n\t\tcycles:",
+	       name, key, p->count, p->cycles / p->count, p->handler_cycles / p->count);
+	for (i = 0; i < VMRT_PROF_NBUCKETS; i++) {
+		if (p->hist[i]) printc(" [2^%d] %u", i, p->hist[i]);
+	}
+	printc("\n");
+}
+
+void
+vmrt_dump_exit_prof(struct vmrt_vm_vcpu *vcpu)
+{
+	struct vmrt_vcpu_prof *prof = &vcpu->prof;
+	int i;
+
+	printc("vcpu %u exits forwarded to the VMM:\n", vcpu->cpuid);
+	for (i = 0; i < MAX_VM_EXIT_REASONS; i++) {
+		if (prof->reason[i].count) vmrt_prof_print("reason", i, &prof->reason[i]);
+	}
+	for (i = 0; i < VMRT_PROF_NKEYS; i++) {
+		if (prof->io[i].used) vmrt_prof_print("port", prof->io[i].key, &prof->io[i].prof);
+	}
+	for (i = 0; i < VMRT_PROF_NKEYS; i++) {
+		struct vmrt_exit_prof_key *k = &prof->msr[i];
+
+		if (k->used) vmrt_prof_print(k->key & VMRT_PROF_MSR_WR ? "wrmsr" : "rdmsr", (u32_t)k->key, &k->prof);
+	}
+	if (prof->io_untracked || prof->msr_untracked) {
+		printc("\tuntracked: %llu port exits, %llu msr exits\n", prof->io_untracked, prof->msr_untracked);
+	}
+	vmrt_dump_exit_stats(vcpu);
+}
+
+void
+vmrt_exit_prof_reset(struct vmrt_vm_vcpu *vcpu)
+{
+	struct vm_exit_stats *stats = &vcpu->shared_region->exit_stats;
+
+	memset(&vcpu->prof, 0, sizeof(vcpu->prof));
+	memset(stats->kernel, 0, sizeof(stats->kernel));
+	memset(stats->kernel_cycles, 0, sizeof(stats->kernel_cycles));
+}
+
+/* The port or msr of the exit, taken before its handler changes the registers */
+static inline u64_t
+vmrt_prof_exit_key(struct vm_vcpu_shared_region *regs, u64_t reason)
+{
+	switch (reason) {
+	case VM_EXIT_REASON_IO_INSTRUCTION:
+		return (regs->qualification >> 16) & 0xFFFF;
+	case VM_EXIT_REASON_RDMSR:
+		return (u32_t)regs->cx;
+	case VM_EXIT_REASON_WRMSR:
+		return (u32_t)regs->cx | VMRT_PROF_MSR_WR;
+	default:
+		return 0;
+	}
+}
+
+static inline void
+vmrt_prof_add(struct vmrt_exit_prof *p, u64_t cycles, u64_t handler_cycles)
+{
+	int b = cycles ? 63 - __builtin_clzll(cycles) : 0;
+
+	p->count++;
+	p->cycles         += cycles;
+	p->handler_cycles += handler_cycles;
+	p->hist[b < VMRT_PROF_NBUCKETS ? b : VMRT_PROF_NBUCKETS - 1]++;
+}
+
+/* Linear probing on the key, NULL once all of the entries are taken by other keys */
+static struct vmrt_exit_prof *
+vmrt_prof_lookup(struct vmrt_exit_prof_key *tbl, u64_t key)
+{
+	int i;
+
+	for (i = 0; i < VMRT_PROF_NKEYS; i++) {
+		struct vmrt_exit_prof_key *k = &tbl[(key + i) % VMRT_PROF_NKEYS];
+
+		if (!k->used) {
+			k->used = 1;
+			k->key  = key;
+		}
+		if (k->key == key) return &k->prof;
+	}
+
+	return NULL;
+}
+
+static void
+vmrt_prof_exit(struct vmrt_vm_vcpu *vcpu, u64_t reason, u64_t key, u64_t cycles, u64_t handler_cycles)
+{
+	struct vmrt_vcpu_prof *prof = &vcpu->prof;
+	struct vmrt_exit_prof *p;
+
+	vmrt_prof_add(&prof->reason[reason], cycles, handler_cycles);
+
+	if (reason == VM_EXIT_REASON_IO_INSTRUCTION) {
+		p = vmrt_prof_lookup(prof->io, key);
+		if (!p) prof->io_untracked++;
+	} else if (reason == VM_EXIT_REASON_RDMSR || reason == VM_EXIT_REASON_WRMSR) {
+		p = vmrt_prof_lookup(prof->msr, key);
+		if (!p) prof->msr_untracked++;
+	} else {
+		return;
+	}
+	if (p) vmrt_prof_add(p, cycles, handler_cycles);
+}
+
+void
+vmrt_vm_vcpu_fastexit_flags(struct vmrt_vm_vcpu *vcpu, u32_t flags)
+{
+	vcpu->shared_region->fastexit.flags = flags;
+}
+
+int
+vmrt_vm_vcpu_fastexit_cpuid(struct vmrt_vm_vcpu *vcpu, u32_t leaf, u32_t subleaf, u32_t flags, u32_t eax, u32_t ebx, u32_t ecx, u32_t edx)
+{
+	struct vm_fastexit_tbl *tbl = &vcpu->shared_region->fastexit;
+	struct vm_fastexit_cpuid *e;
+
+	if (tbl->ncpuid == VM_FASTEXIT_CPUID_MAX) return -1;
+	e = &tbl->cpuid[tbl->ncpuid];
+	*e = (struct vm_fastexit_cpuid) {
+		.leaf = leaf, .subleaf = subleaf, .flags = flags,
+		.eax = eax, .ebx = ebx, .ecx = ecx, .edx = edx,
+	};
+	tbl->ncpuid++;
+
+	return 0;
+}
+
+int
+vmrt_vm_vcpu_fastexit_msr(struct vmrt_vm_vcpu *vcpu, u32_t msr, u32_t flags, u64_t val)
+{
+	struct vm_fastexit_tbl *tbl = &vcpu->shared_region->fastexit;
+
+	if (tbl->nmsr == VM_FASTEXIT_MSR_MAX) return -1;
+	tbl->msr[tbl->nmsr] = (struct vm_fastexit_msr) { .msr = msr, .flags = flags, .val = val };
+	tbl->nmsr++;
+
+	return 0;
+}
+
 void
 vmrt_vmcs_page_create(struct vmrt_vm_vcpu *vcpu)
 {
@@ -108,12 +277,14 @@ vmrt_vm_vcpu_init(struct vmrt_vm_comp *vm, u32_t vcpu_nr)
 	vcpu->coreid = cos_coreid();
 
 	vcpu->next_timer = ~0ULL;
-
+	vcpu->shared_region->timer_deadline = ~0ULL;
 }
 
 void
-vmrt_vm_mem_init(struct vmrt_vm_comp *vm, void *mem)
+vmrt_vm_mem_init(struct vmrt_vm_comp *vm, void *mem, cbuf_t id)
 {
+	/* The guest memory starts at guest-physical address 0 */
+	if (capmgr_vm_mem_map(vm->comp_id, id)) BUG();
 	vm->guest_addr = mem;
 
 	/* Clean the memory for the VM */
@@ -128,6 +299,7 @@ vmrt_vm_create(struct vmrt_vm_comp *vm, char *name, u8_t num_vcpu, u64_t vm_mem_
 	vaddr_t lapic_access_page;
 
 	assert((vm_mem_sz % PAGE_SIZE_4K) == 0);
+	assert(vm_mem_sz <= LAPIC_BASE_ADDR);
 
 	vm_id = capmgr_vm_comp_create(vm_mem_sz);
 	vm->comp_id = vm_id;
@@ -158,6 +330,96 @@ vmrt_vm_create(struct vmrt_vm_comp *vm, char *name, u8_t num_vcpu, u64_t vm_mem_
 	return;
 }
 
+void
+vmrt_vm_snapshot_create(struct vmrt_vm_vcpu *vcpu, struct vmrt_vm_snapshot *snap, void *mem)
+{
+	struct vmrt_vm_comp *vm = vcpu->vm;
+	struct vmrt_vcpu_snapshot *s = &snap->vcpus[vcpu->cpuid];
+
+	assert(vm->num_vpu == 1 && !vcpu->snapshot);
+
+	memcpy(mem, vm->guest_addr, vm->guest_mem_sz);
+	snap->mem     = mem;
+	snap->mem_sz  = vm->guest_mem_sz;
+	snap->num_vpu = vm->num_vpu;
+
+	memcpy(&s->regs, vcpu->shared_region, sizeof(s->regs));
+	memcpy(s->lapic, vcpu->lapic_page, PAGE_SIZE_4K);
+	s->next_timer = vcpu->next_timer;
+
+	/* The kernel saves the rest on the entry that follows, the snapshot is complete at the next exit */
+	vcpu->snapshot = snap;
+	vcpu->shared_region->state.op = VM_STATE_OP_SAVE;
+}
+
+static void
+vmrt_vm_snapshot_complete(struct vmrt_vm_vcpu *vcpu)
+{
+	struct vmrt_vm_snapshot *snap = vcpu->snapshot;
+
+	assert(!vcpu->shared_region->state.op);
+	snap->vcpus[vcpu->cpuid].regs.state = vcpu->shared_region->state;
+	vcpu->snapshot = NULL;
+
+	ps_store(&snap->ready, 1);
+	if (ps_load(&snap->waiter)) sched_thd_wakeup(snap->waiter);
+}
+
+void
+vmrt_vm_snapshot_wait(struct vmrt_vm_snapshot *snap)
+{
+	snap->waiter = cos_thdid();
+	while (!ps_load(&snap->ready)) sched_thd_block(0);
+}
+
+void
+vmrt_vm_create_from(struct vmrt_vm_comp *vm, char *name, struct vmrt_vm_snapshot *snap, void *mem, cbuf_t id)
+{
+	assert(snap->ready);
+
+	vmrt_vm_create(vm, name, snap->num_vpu, snap->mem_sz);
+	vmrt_vm_mem_init(vm, mem, id);
+	memcpy(mem, snap->mem, snap->mem_sz);
+}
+
+void
+vmrt_vm_vcpu_restore(struct vmrt_vm_vcpu *vcpu, struct vmrt_vm_snapshot *snap)
+{
+	struct vmrt_vcpu_snapshot *s = &snap->vcpus[vcpu->cpuid];
+	struct vm_vcpu_shared_region *regs = vcpu->shared_region;
+
+	/* The registers and the fast-exit table, but not the counters and the posted interrupts */
+	memcpy(regs, &s->regs, __builtin_offsetof(struct vm_vcpu_shared_region, exit_stats));
+	regs->state    = s->regs.state;
+	regs->state.op = VM_STATE_OP_LOAD;
+
+	memcpy(vcpu->lapic_page, s->lapic, PAGE_SIZE_4K);
+	vcpu->next_timer = s->next_timer;
+}
+
+int
+vmrt_vm_mem_dirty(struct vmrt_vm_comp *vm, unsigned long *bitmap)
+{
+	unsigned long npages = vm->guest_mem_sz / PAGE_SIZE_4K, off, n;
+	int ret, ndirty = 0;
+
+	if (!vm->dirty_page) {
+		vm->dirty_id = memmgr_shared_page_alloc((vaddr_t *)&vm->dirty_page);
+		assert(vm->dirty_id);
+	}
+
+	/* A page of the bitmap at a time */
+	for (off = 0; off < npages; off += n) {
+		n   = npages - off > COS_EPT_DIRTY_MAX ? COS_EPT_DIRTY_MAX : npages - off;
+		ret = capmgr_vm_mem_dirty(vm->comp_id, vm->dirty_id, off * PAGE_SIZE_4K, n);
+		if (ret < 0) return ret;
+		ndirty += ret;
+		if (bitmap) memcpy(&bitmap[off / (sizeof(unsigned long) * 8)], vm->dirty_page, COS_EPT_DIRTY_WORDS(n) * sizeof(unsigned long));
+	}
+
+	return ndirty;
+}
+
 void
 vmrt_vm_data_copy_to(struct vmrt_vm_comp *vm, char *data, u64_t size, paddr_t gpa)
 {
@@ -190,10 +452,35 @@ ept_misconfig_handler(struct vmrt_vm_vcpu *vcpu)
 	VM_PANIC(vcpu);
 }
 
+CWEAKSYMB void
+snapshot_handler(struct vmrt_vm_vcpu *vcpu)
+{
+	VM_PANIC(vcpu);
+}
+
 CWEAKSYMB void 
 vmcall_handler(struct vmrt_vm_vcpu *vcpu)
 {
-	VM_PANIC(vcpu);
+	struct vm_vcpu_shared_region *regs = vcpu->shared_region;
+	struct vmrt_vm_comp *vm = vcpu->vm;
+	int i;
+
+	if ((u32_t)regs->ax == VMRT_VMCALL_SNAPSHOT) {
+		snapshot_handler(vcpu);
+		return;
+	}
+	if ((u32_t)regs->ax != VMRT_VMCALL_EXIT_PROF) VM_PANIC(vcpu);
+
+	/* The profiles of the other vcpus are updated meanwhile, they are only approximate */
+	for (i = 0; i < vm->num_vpu; i++) {
+		struct vmrt_vm_vcpu *v = vmrt_get_vcpu(vm, i);
+
+		if (!v->shared_region) continue;
+		vmrt_dump_exit_prof(v);
+		if (regs->bx) vmrt_exit_prof_reset(v);
+	}
+	regs->ax = 0;
+	GOTO_NEXT_INST(regs);
 }
 
 CWEAKSYMB void 
@@ -334,6 +621,84 @@ ctrl_register_access_handler(struct vmrt_vm_vcpu *vcpu)
 	}
 }
 
+static inline int
+vmrt_vm_vcpu_intr_pending(struct vmrt_vm_vcpu *vcpu)
+{
+	u64_t curr_tsc;
+
+	/* The requesting virtual interrupt (RVI), and the posted ones, are delivered on the next entry */
+	if ((u8_t)vcpu->shared_region->interrupt_status) return 1;
+	if (ps_load(&vcpu->shared_region->pi_desc.control) & VM_PI_DESC_ON) return 1;
+	rdtscll(curr_tsc);
+
+	return curr_tsc >= vcpu->next_timer;
+}
+
+void
+vmrt_vm_vcpu_kick(struct vmrt_vm_vcpu *vcpu)
+{
+	/* Pairs with the fence in vmrt_vm_vcpu_halt: either it sees the interrupt, or we see it halted */
+	ps_mem_fence();
+	if (ps_load(&vcpu->halted) && cos_thdid() != vcpu->handler_tid) sched_thd_wakeup(vcpu->handler_tid);
+}
+
+void
+vmrt_vm_vcpu_intr_post(struct vmrt_vm_vcpu *vcpu, u8_t vector)
+{
+	struct vm_pi_desc *pi = &vcpu->shared_region->pi_desc;
+
+	__atomic_fetch_or(&pi->pir[vector / 32], 1U << (vector % 32), __ATOMIC_SEQ_CST);
+	/* Only the post that sets ON notifies, the later ones ride on it */
+	if (!(__atomic_fetch_or(&pi->control, VM_PI_DESC_ON, __ATOMIC_SEQ_CST) & VM_PI_DESC_ON)) {
+		cos_vm_vcpu_notify(vcpu->vmcb_cap);
+	}
+	vmrt_vm_vcpu_kick(vcpu);
+}
+
+/*
+ * The guest is idle until its next interrupt: block the handler
+ * thread until the timer deadline, or until an interrupt injection
+ * wakes it, so the core runs other vcpus and threads meanwhile.
+ */
+static void
+vmrt_vm_vcpu_halt(struct vmrt_vm_vcpu *vcpu)
+{
+	GOTO_NEXT_INST(vcpu->shared_region);
+
+	vcpu->halted = 1;
+	ps_mem_fence();
+	if (!vmrt_vm_vcpu_intr_pending(vcpu)) {
+		/* A wakeup that races ahead of the block makes it return immediately */
+		if (vcpu->next_timer == ~0ULL) sched_thd_block(0);
+		else                           sched_thd_block_timeout(0, vcpu->next_timer);
+	}
+	vcpu->halted = 0;
+}
+
+/*
+ * The guest spins on a lock (pause-loop exiting). Yield, to another
+ * vcpu of the VM on this core first, as it might hold the lock, and
+ * otherwise to the next thread in the run-queue.
+ */
+static void
+vmrt_vm_vcpu_pause(struct vmrt_vm_vcpu *vcpu)
+{
+	struct vmrt_vm_comp *vm = vcpu->vm;
+	thdid_t to = vcpu->handler_tid;
+	int i;
+
+	GOTO_NEXT_INST(vcpu->shared_region);
+
+	for (i = 1; i < vm->num_vpu; i++) {
+		struct vmrt_vm_vcpu *v = &vm->vcpus[(vcpu->cpuid + i) % vm->num_vpu];
+
+		if (!v->handler_tid || v->coreid != vcpu->coreid || ps_load(&v->halted)) continue;
+		to = v->handler_tid;
+		break;
+	}
+	sched_thd_yield_to(to);
+}
+
 static inline void
 vmrt_handle_reason(struct vmrt_vm_vcpu *vcpu, u64_t reason)
 {
@@ -348,8 +713,7 @@ vmrt_handle_reason(struct vmrt_vm_vcpu *vcpu, u64_t reason)
 		cpuid_handler(vcpu);
 		break;
 	case VM_EXIT_REASON_HLT:
-		/* TODO: handle hlt exception */
-		VM_PANIC(vcpu);
+		vmrt_vm_vcpu_halt(vcpu);
 		break;
 	case VM_EXIT_REASON_RDTSC:
 		VM_PANIC(vcpu);
@@ -370,8 +734,7 @@ vmrt_handle_reason(struct vmrt_vm_vcpu *vcpu, u64_t reason)
 		wrmsr_handler(vcpu);
 		break;
 	case VM_EXIT_REASON_PAUSE:
-		/* TODO: handle pause exception */
-		GOTO_NEXT_INST(vcpu->shared_region);
+		vmrt_vm_vcpu_pause(vcpu);
 		break;
 	case VM_EXIT_REASON_EPT_MISCONFIG:
 		ept_misconfig_handler(vcpu);
@@ -380,7 +743,7 @@ vmrt_handle_reason(struct vmrt_vm_vcpu *vcpu, u64_t reason)
 		VM_PANIC(vcpu);
 		break;
 	case VM_EXIT_REASON_PREEMPTION_TIMER:
-		VM_PANIC(vcpu);
+		/* The timer deadline, the interrupt is injected below */
 		break;
 	case VM_EXIT_REASON_XSETBV:
 		xsetbv_handler(vcpu);
@@ -407,21 +770,29 @@ vmrt_vm_exception_handler(void *_vcpu)
 {
 	struct vmrt_vm_vcpu *vcpu = (struct vmrt_vm_vcpu *)_vcpu;
 	struct vm_vcpu_shared_region *shared_region;
-	u64_t reason;
-	u64_t curr_tsc;
+	u64_t reason, key;
+	u64_t curr_tsc, handler_tsc;
 
 	shared_region = vcpu->shared_region;
 	while (1)
 	{
+		/* The kernel exits the vcpu at the deadline with the preemption timer */
+		shared_region->timer_deadline = vcpu->next_timer;
 		vmrt_vm_vcpu_resume(vcpu);
 	
+		rdtscll(handler_tsc);
+		if (unlikely(vcpu->snapshot)) vmrt_vm_snapshot_complete(vcpu);
 		reason = shared_region->reason;
+		key    = vmrt_prof_exit_key(shared_region, reason);
 
 		vmrt_handle_reason(vcpu, reason);
 		rdtscll(curr_tsc);
+		vmrt_prof_exit(vcpu, reason, key, curr_tsc - shared_region->exit_stats.exit_tsc, curr_tsc - handler_tsc);
 		if (curr_tsc >= vcpu->next_timer) {
 			/* 236 is Linux's fixed timer interrrupt */
 			lapic_intr_inject(vcpu, 236, 0);
+			/* The TSC deadline timer is one-shot */
+			vcpu->next_timer = ~0ULL;
 		}
 	}
 }
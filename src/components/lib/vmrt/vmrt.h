@@ -6,6 +6,41 @@
 #define VMRT_VM_NAME_SIZE (32)
 #define VMRT_VM_MAX_VCPU (16)
 
+/*
+ * Exit profiling: log2 histograms of the cycles from an exit to the
+ * resume of the vcpu, bucket i counting those in [2^i, 2^(i+1)).
+ */
+#define VMRT_PROF_NBUCKETS 24
+/* The distinct I/O ports and msrs profiled, the others are only counted */
+#define VMRT_PROF_NKEYS    32
+
+struct vmrt_exit_prof {
+	u64_t count;
+	/* From the exit to the resume */
+	u64_t cycles;
+	/* In the handler of the VMM */
+	u64_t handler_cycles;
+	u32_t hist[VMRT_PROF_NBUCKETS];
+};
+
+/* The msr writes are profiled apart from the reads */
+#define VMRT_PROF_MSR_WR   (1ULL << 32)
+
+struct vmrt_exit_prof_key {
+	u64_t key;
+	int used;
+	struct vmrt_exit_prof prof;
+};
+
+struct vmrt_vcpu_prof {
+	struct vmrt_exit_prof reason[MAX_VM_EXIT_REASONS];
+	struct vmrt_exit_prof_key io[VMRT_PROF_NKEYS];
+	struct vmrt_exit_prof_key msr[VMRT_PROF_NKEYS];
+	u64_t io_untracked, msr_untracked;
+};
+
+struct vmrt_vm_snapshot;
+
 struct vmrt_vm_vcpu {
 	struct vm_vcpu_shared_region *shared_region;
 	u64_t next_timer;
@@ -24,6 +59,8 @@ struct vmrt_vm_vcpu {
 	u8_t coreid;
 	struct vmrt_vm_comp *vm;
 	u64_t pending_req;
+	/* The handler thread is blocked on the guest's HLT */
+	int halted;
 
 	u16_t vpid;
 	vm_vmcscap_t vmcs_cap;
@@ -33,6 +70,11 @@ struct vmrt_vm_vcpu {
 	vm_lapicaccesscap_t lapic_access_cap;
 	vm_vmcb_t vmcb_cap;
 	thdid_t handler_tid;
+
+	/* Of the exits forwarded to the handler thread, updated by it */
+	struct vmrt_vcpu_prof prof;
+	/* The snapshot the kernel is saving the state of the vcpu into */
+	struct vmrt_vm_snapshot *snapshot;
 };
 
 struct vmrt_vm_comp {
@@ -48,15 +90,39 @@ struct vmrt_vm_comp {
 	struct vmrt_vm_vcpu vcpus[VMRT_VM_MAX_VCPU];
 
 	int wire_mode;
+
+	/* The shared page the capmgr reports the dirty pages in (vmrt_vm_mem_dirty) */
+	cbuf_t dirty_id;
+	unsigned long *dirty_page;
+};
+
+/*
+ * A snapshot of a VM: its memory, and the state of its vcpus, from
+ * which VMs that start where it was taken are created.
+ */
+struct vmrt_vcpu_snapshot {
+	struct vm_vcpu_shared_region regs;
+	char lapic[PAGE_SIZE_4K];
+	u64_t next_timer;
+};
+
+struct vmrt_vm_snapshot {
+	void *mem;
+	word_t mem_sz;
+	u8_t num_vpu;
+	/* Set once the kernel saved the state of the vcpus */
+	int ready;
+	thdid_t waiter;
+	struct vmrt_vcpu_snapshot vcpus[VMRT_VM_MAX_VCPU];
 };
 
 #define VMRT_GPA2HVA(gpa, vm, offset) { ((gpa - offset) + vm->guest_addr) }
-#define GPA2HVA(gpa, vm) VMRT_GPA2HVA(gpa, vm, PAGE_SIZE_4K)
+#define GPA2HVA(gpa, vm) VMRT_GPA2HVA(gpa, vm, 0)
 
 typedef void vmrt_exception_handler(struct vmrt_vm_vcpu *vcpu);
 
 void vmrt_vm_create(struct vmrt_vm_comp *vm, char *name, u8_t num_vcpu, u64_t vm_mem_sz);
-void vmrt_vm_mem_init(struct vmrt_vm_comp *vm, void *mem);
+void vmrt_vm_mem_init(struct vmrt_vm_comp *vm, void *mem, cbuf_t id);
 void vmrt_vm_vcpu_init(struct vmrt_vm_comp *vm, u32_t vcpu_nr);
 void vmrt_vm_vcpu_resume(struct vmrt_vm_vcpu *vcpu);
 void vmrt_vm_data_copy_to(struct vmrt_vm_comp *vm, char *image, u64_t size, paddr_t gpa);
@@ -65,6 +131,67 @@ void vmrt_vm_vcpu_start(struct vmrt_vm_vcpu *vcpu);
 static inline struct vmrt_vm_vcpu *vmrt_get_vcpu(struct vmrt_vm_comp *vm, u32_t vcpu_nr) { return &vm->vcpus[vcpu_nr]; }
 
 void lapic_intr_inject(struct vmrt_vm_vcpu *vcpu, u8_t vector, int autoeoi);
+/* Wake the vcpu if it is halted, after an interrupt is injected into it */
+void vmrt_vm_vcpu_kick(struct vmrt_vm_vcpu *vcpu);
+/*
+ * Post the interrupt vector into the vcpu's posted-interrupt
+ * descriptor. It is delivered without an exit if the vcpu runs, and
+ * on its next entry otherwise. Any thread, on any core, can post.
+ */
+void vmrt_vm_vcpu_intr_post(struct vmrt_vm_vcpu *vcpu, u8_t vector);
+
+/*
+ * The kernel's fast-exit table of a vcpu: exits served in the kernel
+ * from these values never reach vmrt_vm_exception_handler. It must be
+ * filled before vmrt_vm_vcpu_start.
+ */
+void vmrt_vm_vcpu_fastexit_flags(struct vmrt_vm_vcpu *vcpu, u32_t flags);
+int vmrt_vm_vcpu_fastexit_cpuid(struct vmrt_vm_vcpu *vcpu, u32_t leaf, u32_t subleaf, u32_t flags, u32_t eax, u32_t ebx, u32_t ecx, u32_t edx);
+int vmrt_vm_vcpu_fastexit_msr(struct vmrt_vm_vcpu *vcpu, u32_t msr, u32_t flags, u64_t val);
+void vmrt_dump_exit_stats(struct vmrt_vm_vcpu *vcpu);
+/*
+ * The profile of the exits of the vcpu, per reason, I/O port and msr,
+ * as counts, mean cycles and histograms. The guest dumps the profiles
+ * of all of its vcpus, and resets them if rbx is not 0, with a vmcall
+ * with VMRT_VMCALL_EXIT_PROF in rax.
+ */
+#define VMRT_VMCALL_EXIT_PROF 0x434f5301
+void vmrt_dump_exit_prof(struct vmrt_vm_vcpu *vcpu);
+void vmrt_exit_prof_reset(struct vmrt_vm_vcpu *vcpu);
+
+/*
+ * Snapshots of VMs, and the VMs created from them. The guest asks for
+ * a snapshot of itself with a vmcall with VMRT_VMCALL_SNAPSHOT in rax,
+ * served by the VMM's snapshot_handler.
+ *
+ * vmrt_vm_snapshot_create is called by the handler of the vcpu, while
+ * it is stopped in an exit, and copies the memory of the VM into mem.
+ * The kernel saves the rest of the vcpu's state on its next entry, and
+ * vmrt_vm_snapshot_wait waits for it. Only the VMs with a single vcpu
+ * can be snapshot, as the other vcpus would change the memory.
+ *
+ * vmrt_vm_create_from creates a VM with a copy of the snapshot's
+ * memory, in mem, and vmrt_vm_vcpu_restore sets a vcpu, initialized
+ * but not started, to the snapshot's state, in which it starts.
+ */
+#define VMRT_VMCALL_SNAPSHOT 0x434f5302
+void vmrt_vm_snapshot_create(struct vmrt_vm_vcpu *vcpu, struct vmrt_vm_snapshot *snap, void *mem);
+void vmrt_vm_snapshot_wait(struct vmrt_vm_snapshot *snap);
+void vmrt_vm_create_from(struct vmrt_vm_comp *vm, char *name, struct vmrt_vm_snapshot *snap, void *mem, cbuf_t id);
+void vmrt_vm_vcpu_restore(struct vmrt_vm_vcpu *vcpu, struct vmrt_vm_snapshot *snap);
+
+/*
+ * Dirty-page tracking, for incremental snapshots and the pre-copy
+ * rounds of migrations: vmrt_vm_mem_dirty sets a bit in bitmap
+ * (VMRT_VM_DIRTY_WORDS(vm) words, or NULL to only clear them) for each
+ * page of the guest memory the vcpus wrote since the last call, and
+ * returns their number. The pages mapped with 2MB EPT entries are
+ * reported 512 at a time. The writes of the VMM (e.g. of the virtio
+ * devices) aren't tracked, as they don't go through the EPT. Calls
+ * for a VM are serialized by the caller.
+ */
+#define VMRT_VM_DIRTY_WORDS(vm) COS_EPT_DIRTY_WORDS((vm)->guest_mem_sz / PAGE_SIZE_4K)
+int vmrt_vm_mem_dirty(struct vmrt_vm_comp *vm, unsigned long *bitmap);
 
 #define INCBIN(name, file) \
     __asm__( \
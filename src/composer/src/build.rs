@@ -1,9 +1,17 @@
 use initargs::ArgsKV;
-use passes::{component, deps, exports, AddrSpcName, BuildState, ComponentId, SystemState};
+use passes::{
+    component, deps, exports, AddrSpcName, BuildState, Component, ComponentId, SystemState,
+};
+use std::cell::RefCell;
+use std::collections::HashMap;
 use std::env;
-use std::fs::File;
-use syshelpers::{dir_exists, emit_file, exec_pipeline, reset_dir};
-use tar::Builder;
+use std::fs::{self, File};
+use std::io::{self, Read, Seek, SeekFrom};
+use std::path::Path;
+use syshelpers::{dir_exists, dump_file, emit_file, exec_pipeline, reset_dir};
+use tar::{Builder, Header};
+use xmas_elf::program::Type;
+use xmas_elf::ElfFile;
 
 // Interact with the composite build system to "seal" the components.
 // This requires linking them with all dependencies, and with libc,
@@ -40,6 +48,15 @@ use tar::Builder;
 // - COMP_BASEADDR - the base address of .text for the component
 // - COMP_INITARGS_FILE - the path to the generated initial arguments .c file
 // - COMP_TAR_FILE - the path to an initargs tarball to compile into the component
+// - COMP_NOFPU - set if the component is declared FPU-free (`nofpu = true`)
+// - COMP_TRACED - list of '+'-separated exported interfaces whose
+//   invocations are traced (`trace = true` in `implements`)
+// - COMP_AINV - list of '+'-separated exported interfaces that are
+//   also invoked asynchronously (`async = true` in `implements`)
+// - COMP_AINV_DEPS - list of '+'-separated interface dependencies
+//   whose server's export is asynchronous
+// - COMP_PGO - "generate" or "use" for profile-guided builds (`pgo`),
+//   with the profiles in COMP_PGO_DIR
 //
 // In the end, this should result in a command line for each component
 // along these (artificial) lines:
@@ -50,9 +67,105 @@ use tar::Builder;
 // build directory which is the "sealed" version of the component that
 // is ready for loading.
 
+const PAGE_SIZE: u64 = 4096;
+const TAR_RECORD_SIZE: u64 = 512;
+// "COSIMG", see `struct img_hdr` in elf_loader.h
+const IMG_MAGIC: u64 = 0x474d49534f43;
+// See asm_ipc_defs.h
+const COS_CAPABILITY_OFFSET: u64 = 16;
+
+fn round_up_to_page(v: u64) -> u64 {
+    (v + PAGE_SIZE - 1) & !(PAGE_SIZE - 1)
+}
+
+// Lay out the (sealed, so already linked at its address) ELF object
+// at `obj_path` as the booter maps it, into the image at `img_path`:
+// a header page, the RO segment, then the data segment, each padded
+// to a page. The BSS is only described by its size. The booter can
+// then alias the image's frames into the component rather than
+// copying its segments. The object must have the shape that
+// `elf_load_info` expects.
+//
+// The statically allocated sinv capabilities are written into the
+// immediates of the client stubs (at the given addresses) that the
+// RO segment holds, in the form the kernel expects them in %rax.
+fn prelaid_image_create(
+    obj_path: &String,
+    img_path: &String,
+    capimms: &Vec<(u64, u32)>,
+) -> Result<(), String> {
+    let obj = dump_file(obj_path)?;
+    let elf = ElfFile::new(&obj).map_err(|e| format!("Object {} isn't valid ELF: {}", obj_path, e))?;
+    let segs: Vec<_> = elf
+        .program_iter()
+        .filter(|ph| match ph.get_type() {
+            Ok(Type::Load) => true,
+            _ => false,
+        })
+        .collect();
+    if segs.len() != 2 {
+        return Err(format!(
+            "Object {} has {} loadable segments, rather than RO and RW.",
+            obj_path,
+            segs.len()
+        ));
+    }
+    let (ro, rw) = (segs[0], segs[1]);
+    if ro.file_size() != ro.mem_size()
+        || !ro.flags().is_execute()
+        || ro.flags().is_write()
+        || !rw.flags().is_write()
+        || round_up_to_page(ro.virtual_addr() + ro.mem_size()) != rw.virtual_addr()
+    {
+        return Err(format!(
+            "Object {} doesn't have an RO segment directly followed by an RW segment.",
+            obj_path
+        ));
+    }
+
+    let hdr = [
+        IMG_MAGIC,
+        elf.header.pt2.entry_point(),
+        ro.virtual_addr(),
+        ro.mem_size(),
+        rw.virtual_addr(),
+        rw.file_size(),
+        rw.mem_size() - rw.file_size(),
+        0, // mapped
+    ];
+    let mut img: Vec<u8> = hdr.iter().flat_map(|v| v.to_le_bytes().to_vec()).collect();
+    img.resize(PAGE_SIZE as usize, 0);
+    for seg in [ro, rw].iter() {
+        let (off, sz) = (seg.offset() as usize, seg.file_size() as usize);
+        if off + sz > obj.len() {
+            return Err(format!("Object {} has a truncated segment.", obj_path));
+        }
+        img.extend_from_slice(&obj[off..off + sz]);
+        img.resize(round_up_to_page(img.len() as u64) as usize, 0);
+    }
+    for (addr, capid) in capimms.iter() {
+        if *addr < ro.virtual_addr() || *addr + 8 > ro.virtual_addr() + ro.mem_size() {
+            return Err(format!(
+                "Object {} has a sinv capability immediate at 0x{:x}, outside of its RO segment.",
+                obj_path, addr
+            ));
+        }
+        let off = (PAGE_SIZE + *addr - ro.virtual_addr()) as usize;
+        let imm = ((*capid as u64) + 1) << COS_CAPABILITY_OFFSET;
+        img[off..off + 8].copy_from_slice(&imm.to_le_bytes());
+    }
+
+    emit_file(img_path, &img)
+}
+
 // The key within the initargs for the tarball, the path of the
 // tarball, and the set of paths to the files to include in the
 // tarball and name of them within the tarball.
+//
+// The data of each file is page-aligned within the tarball (with
+// padding files between them), so that if the tarball is itself
+// page-aligned in memory, pre-laid images can be mapped straight out
+// of it.
 fn tarball_create(
     tarball_key: &String,
     tar_path: &String,
@@ -64,11 +177,22 @@ fn tarball_create(
     let key = format!("{}/", tarball_key);
 
     ar.append_dir(&key, &dir_template).unwrap(); // FIXME: error handling
-    contents.iter().for_each(|(p, n)| {
+    contents.iter().enumerate().for_each(|(i, (p, n))| {
         // file path, and name for the tarball
+        let name = format!("{}/{}", tarball_key, n);
+        assert!(name.len() < 100); // longer names take more than one header record
+        let off = ar.get_mut().seek(SeekFrom::Current(0)).unwrap();
+        let pad = (PAGE_SIZE - (off + TAR_RECORD_SIZE) % PAGE_SIZE) % PAGE_SIZE;
+        if pad != 0 {
+            // The padding file's own header record is part of the padding
+            let mut h = Header::new_gnu();
+            h.set_size(pad - TAR_RECORD_SIZE);
+            h.set_mode(0o644);
+            ar.append_data(&mut h, format!("{}/.pad{}", tarball_key, i), io::repeat(0).take(pad - TAR_RECORD_SIZE))
+                .unwrap();
+        }
         let mut f = File::open(p).unwrap(); //  should not fail: we just built this, TODO: fix race
-        ar.append_file(format!("{}/{}", tarball_key, n), &mut f)
-            .unwrap(); // FIXME: error handling
+        ar.append_file(name, &mut f).unwrap(); // FIXME: error handling
     });
     ar.finish().unwrap(); // FIXME: error handling
     Ok(())
@@ -82,7 +206,7 @@ fn constructor_tarball_create(
     let me = component(&s, &id);
     let tar_path = b.comp_file_path(&id, &"initfs_constructor.tar".to_string(), &s)?;
 
-    let tar_files: Vec<(String, String)> = s
+    let tar_files: Vec<(String, String, Vec<(u64, u32)>)> = s
         .get_named()
         .ids()
         .iter()
@@ -93,15 +217,33 @@ fn constructor_tarball_create(
                 return None;
             }
 
+            let capimms = s
+                .get_invs_id(id)
+                .invocations()
+                .iter()
+                .filter(|inv| inv.client == *cid && inv.c_capimm_addr != 0)
+                .map(|inv| (inv.c_capimm_addr, inv.c_capid))
+                .collect::<Vec<(u64, u32)>>();
+
             Some((
                 b.comp_obj_path(&cid, &s).unwrap(),
                 b.comp_obj_file(&cid, &s),
+                capimms,
             ))
         })
         .collect();
     if tar_files.len() == 0 {
         return Ok(None);
     }
+    // The components are loaded from their pre-laid images, under the name of their objects
+    let tar_files = tar_files
+        .into_iter()
+        .map(|(obj, name, capimms)| {
+            let img = format!("{}.img", obj);
+            prelaid_image_create(&obj, &img, &capimms)?;
+            Ok((img, name))
+        })
+        .collect::<Result<Vec<(String, String)>, String>>()?;
 
     tarball_create(&"binaries".to_string(), &tar_path, tar_files)?;
 
@@ -146,6 +288,10 @@ fn constructor_serialize_args(
             String::from("s_altfn_addr"),
             String::from(format!("{}", s.s_altfn_addr)),
         ));
+        sinv.push(ArgsKV::new_key(
+            String::from("c_capid"),
+            String::from(format!("{}", s.c_capid)),
+        ));
 
         // Just an array of each of the maps for each sinv.  Arrays
         // have "_" keys (see initargs.h).
@@ -160,6 +306,14 @@ fn constructor_serialize_args(
             vec![
                 ArgsKV::new_key("img".to_string(), b.comp_obj_file(&id, &s)),
                 ArgsKV::new_key("info".to_string(), format!("{}", info_addr)),
+                ArgsKV::new_key(
+                    "nofpu".to_string(),
+                    String::from(if component(&s, &id).nofpu { "1" } else { "0" }),
+                ),
+                ArgsKV::new_key(
+                    "trustdom".to_string(),
+                    format!("{}", component(&s, &id).trustdom),
+                ),
             ],
         );
         ids.push(cinfo)
@@ -298,6 +452,34 @@ fn comp_gen_make_cmd(
     }
 
     optional_cmds.push_str(&format!("COMP_CONST_H=\"-include {}\" ", header_file));
+    if c.nofpu {
+        optional_cmds.push_str("COMP_NOFPU=1 ");
+    }
+    optional_cmds.push_str(&comp_pgo_make_vars(&c));
+    let traced: Vec<String> = exports
+        .iter()
+        .filter(|e| e.trace)
+        .map(|e| e.interface.clone())
+        .collect();
+    if !traced.is_empty() {
+        optional_cmds.push_str(&format!("COMP_TRACED=\"{}\" ", traced.join("+")));
+    }
+    let ainv: Vec<String> = exports
+        .iter()
+        .filter(|e| e.asynchronous)
+        .map(|e| e.interface.clone())
+        .collect();
+    if !ainv.is_empty() {
+        optional_cmds.push_str(&format!("COMP_AINV=\"{}\" ", ainv.join("+")));
+    }
+    let ainv_deps: Vec<String> = ds
+        .iter()
+        .filter(|d| d.asynchronous)
+        .map(|d| d.interface.clone())
+        .collect();
+    if !ainv_deps.is_empty() {
+        optional_cmds.push_str(&format!("COMP_AINV_DEPS=\"{}\" ", ainv_deps.join("+")));
+    }
 
     let decomp: Vec<&str> = c.source.split(".").collect();
     assert!(decomp.len() == 2);
@@ -317,6 +499,79 @@ fn comp_gen_make_cmd(
     }
 }
 
+// Component objects are cached across compositions (and build names)
+// in the cache directory, keyed on everything that goes into them:
+// the make command line (interfaces, variants, base address, ...),
+// the generated initargs, tarball, and constants, and the sources of
+// the component, of its interfaces, and of its libraries. Unchanged
+// components are then copied out of the cache instead of rebuilt.
+// Remove the cache directory to force a full rebuild.
+const CACHE_DIR: &str = "system_binaries/cos_cache";
+// Only the sources contribute to the key, not what is built from them
+// in the tree (which changes with each component's constants), and
+// the profiles of the `pgo = "use"` builds.
+const SRC_EXTS: [&str; 8] = ["c", "h", "cc", "hh", "S", "s", "ld", "gcda"];
+
+// The profiles of each component with `pgo`, as extracted from the
+// serial log by tools/pgo_extract.py. They are kept across builds.
+const PGO_DIR: &str = "system_binaries/cos_pgo";
+
+fn comp_pgo_dir(c: &Component) -> String {
+    let pwd = env::current_dir().unwrap();
+    format!("{}/{}/{}", pwd.display(), PGO_DIR, c.name.var_name)
+}
+
+// The make variables of a component's profile-guided build, both for
+// it and for the libraries rebuilt for it
+fn comp_pgo_make_vars(c: &Component) -> String {
+    match c.pgo {
+        Some(ref mode) => format!("COMP_PGO={} COMP_PGO_DIR={} ", mode, comp_pgo_dir(c)),
+        None => String::from(""),
+    }
+}
+
+// FNV-1a, so that keys are stable across composer builds
+fn fnv1a(h: u64, bytes: &[u8]) -> u64 {
+    bytes
+        .iter()
+        .fold(h, |h, b| (h ^ *b as u64).wrapping_mul(0x100000001b3))
+}
+
+const FNV_BASIS: u64 = 0xcbf29ce484222325;
+
+// The fingerprint of the source files in `dir`, and in its
+// subdirectories if `recur`. Directories are walked in name order so
+// that the fingerprint doesn't depend on the file system.
+fn src_fingerprint(dir: &Path, recur: bool) -> u64 {
+    let mut ents: Vec<_> = match fs::read_dir(dir) {
+        Ok(es) => es.filter_map(|e| e.ok()).map(|e| e.path()).collect(),
+        Err(_) => return FNV_BASIS,
+    };
+    ents.sort();
+
+    ents.iter().fold(FNV_BASIS, |h, p| {
+        let name = p.file_name().unwrap().to_string_lossy();
+        if p.is_dir() {
+            if !recur || name.starts_with(".") {
+                return h;
+            }
+            let h = fnv1a(h, name.as_bytes());
+            return fnv1a(h, &src_fingerprint(p, recur).to_le_bytes());
+        }
+        let ext = p.extension().map(|e| e.to_string_lossy().to_string());
+        let is_src = name.starts_with("Makefile")
+            || ext.map(|e| SRC_EXTS.contains(&e.as_str())).unwrap_or(false);
+        if !is_src {
+            return h;
+        }
+        let h = fnv1a(h, name.as_bytes());
+        match fs::read(p) {
+            Ok(contents) => fnv1a(h, &contents),
+            Err(_) => h,
+        }
+    })
+}
+
 fn kern_gen_make_cmd(input_constructor: &String, kern_output: &String, _s: &SystemState) -> String {
     format!(
         r#"make -C src KERNEL_OUTPUT="{}" CONSTRUCTOR_COMP="{}" plat"#,
@@ -326,16 +581,124 @@ fn kern_gen_make_cmd(input_constructor: &String, kern_output: &String, _s: &Syst
 
 pub struct DefaultBuilder {
     builddir: String,
+    cachedir: String,
+    // Memoized source fingerprints of directories, shared by many components
+    fingerprints: RefCell<HashMap<(String, bool), u64>>,
 }
 
 impl DefaultBuilder {
     pub fn new() -> Self {
         DefaultBuilder {
             builddir: "/dev/null".to_string(), // must initialize, so error out if you don't
+            cachedir: "/dev/null".to_string(),
+            fingerprints: RefCell::new(HashMap::new()),
+        }
+    }
+
+    fn dir_fingerprint(&self, dir: &String, recur: bool) -> u64 {
+        let key = (dir.clone(), recur);
+        if let Some(h) = self.fingerprints.borrow().get(&key) {
+            return *h;
         }
+        let h = src_fingerprint(Path::new(dir), recur);
+        self.fingerprints.borrow_mut().insert(key, h);
+        h
+    }
+
+    // The path of the cached object for the component built with the
+    // make `cmd`, including the generated `inputs` files, and
+    // depending on the library directories output by its
+    // `dependencies_info`.
+    fn comp_cache_path(
+        &self,
+        id: &ComponentId,
+        s: &SystemState,
+        cmd: &String,
+        inputs: &[&String],
+        libdirs: &String,
+    ) -> String {
+        let c = component(&s, id);
+        let decomp: Vec<&str> = c.source.split(".").collect();
+        let cdir = "src/components".to_string();
+
+        let mut dirs: Vec<(String, bool)> = vec![
+            (cdir.clone(), false),
+            (format!("{}/implementation", cdir), false),
+            (format!("{}/implementation/{}", cdir, decomp[0]), false),
+            (
+                format!("{}/implementation/{}/{}", cdir, decomp[0], decomp[1]),
+                true,
+            ),
+            (format!("{}/include", cdir), true),
+            ("src/kernel/include".to_string(), true),
+        ];
+        let ifs = exports(&s, id)
+            .iter()
+            .map(|e| &e.interface)
+            .chain(deps(&s, id).iter().map(|d| &d.interface));
+        for i in ifs {
+            dirs.push((format!("{}/interface/{}", cdir, i), true));
+        }
+        for l in libdirs.split_whitespace() {
+            dirs.push((l.trim_end_matches('/').to_string(), true));
+        }
+        if c.pgo.as_deref() == Some("use") {
+            dirs.push((comp_pgo_dir(&c), false));
+        }
+        dirs.sort();
+        dirs.dedup();
+
+        // The build directory differs between build names, but
+        // doesn't change the object.
+        let h = fnv1a(FNV_BASIS, cmd.replace(&self.builddir, "").as_bytes());
+        let h = inputs.iter().fold(h, |h, f| {
+            fnv1a(h, &dump_file(f).unwrap_or_else(|_| Vec::new()))
+        });
+        let h = dirs.iter().fold(h, |h, (d, recur)| {
+            fnv1a(h, &self.dir_fingerprint(d, *recur).to_le_bytes())
+        });
+
+        format!(
+            "{}/{}-{:016x}",
+            self.cachedir,
+            self.comp_obj_file(&id, &s),
+            h
+        )
     }
 }
 
+// Copy the cached object into the build, if it is there
+fn comp_cache_get(cached: &String, output: &String) -> bool {
+    Path::new(cached).exists() && fs::copy(cached, output).is_ok()
+}
+
+// ...and cache the object after it is built. Failing to cache isn't
+// an error, just a rebuild next time.
+fn comp_cache_put(output: &String, cached: &String) {
+    if Path::new(output).exists() {
+        let _ = fs::copy(output, cached);
+    }
+}
+
+// Find the libraries the component depends on, and rebuild them with
+// its constants. The component's directories are returned so that they
+// can be part of its cache key.
+fn comp_deps_rebuild(
+    dep_out: &String,
+    header_file_path: &String,
+    c: &Component,
+) -> (String, String, String) {
+    let rebuild_cmd = format!(
+        r#"make -C src REBUILD_DIRS="{}" COMP_CONST_H="-include {}" {}component_rebuild"#,
+        dep_out,
+        header_file_path,
+        comp_pgo_make_vars(c)
+    );
+    let (out, err) = exec_pipeline(vec![rebuild_cmd.clone()]);
+
+    (rebuild_cmd, out, err)
+}
+
 fn compdir_check_build(comp_dir: &String) -> Result<(), String> {
     if !dir_exists(&comp_dir) {
         reset_dir(&comp_dir)?;
@@ -352,6 +715,10 @@ impl BuildState for DefaultBuilder {
 
         reset_dir(&dir)?;
         self.builddir = dir;
+        self.cachedir = format!("{}/{}", pwd.display(), CACHE_DIR);
+        if !dir_exists(&self.cachedir) {
+            reset_dir(&self.cachedir)?;
+        }
 
         Ok(())
     }
@@ -436,13 +803,6 @@ impl BuildState for DefaultBuilder {
             &state,
         );
         let (out1, err1) = exec_pipeline(vec![dep_cmd.clone()]);
-
-        let rebuild_cmd = format!(
-            r#"make -C src REBUILD_DIRS="{}" COMP_CONST_H="-include {}" component_rebuild"#,
-            out1, header_file_path
-        );
-        let (out2, err2) = exec_pipeline(vec![rebuild_cmd.clone()]);
-        //rebuild process ends
         let cmd = comp_gen_make_cmd(
             &output_path,
             p.param_prog(),
@@ -453,12 +813,34 @@ impl BuildState for DefaultBuilder {
             &state,
         );
         let name = state.get_named().ids().get(id).unwrap();
+        let comp_log = self.comp_file_path(&id, &"compilation.log".to_string(), &state)?;
+
+        let mut inputs = vec![p.param_prog(), &header_file_path];
+        if let Some(ref t) = p.param_fs() {
+            inputs.push(t);
+        }
+        let cached = self.comp_cache_path(&id, &state, &cmd, &inputs, &out1);
+        if comp_cache_get(&cached, &output_path) {
+            println!(
+                "Component {} is unchanged, using the cached {}",
+                name, cached
+            );
+            emit_file(
+                &comp_log,
+                format!("Dep Command: {}\nCached object: {}\n", dep_cmd, cached).as_bytes(),
+            )?;
+            return Ok(output_path);
+        }
+
+        //rebuild process starts
+        let (rebuild_cmd, out2, err2) =
+            comp_deps_rebuild(&out1, &header_file_path, component(&state, &id));
+        //rebuild process ends
         println!(
             "Compiling component {} with the following command line:\n\t{}",
             name, cmd
         );
         let (out3, err3) = exec_pipeline(vec![cmd.clone()]);
-        let comp_log = self.comp_file_path(&id, &"compilation.log".to_string(), &state)?;
         emit_file(
             &comp_log,
             format!(
@@ -475,6 +857,7 @@ impl BuildState for DefaultBuilder {
                 &output_path, comp_log
             );
         }
+        comp_cache_put(&output_path, &cached);
 
         Ok(output_path)
     }
@@ -499,28 +882,60 @@ impl BuildState for DefaultBuilder {
             &s,
         );
 
+        let dep_cmd = comp_gen_make_cmd(
+            &binary,
+            &argsfile,
+            &tarfile,
+            &header_file_path,
+            CmdOpts::DEPINFO,
+            &c,
+            &s,
+        );
+        let (dep_out, _) = exec_pipeline(vec![dep_cmd]);
         let name = s.get_named().ids().get(c).unwrap();
+        let comp_log = self.comp_file_path(&c, &"constructor_compilation.log".to_string(), &s)?;
+
+        // The tarball includes the objects of the components it
+        // constructs, so this is only cached if they all are.
+        let mut inputs = vec![&argsfile, &header_file_path];
+        if let Some(ref t) = tarfile {
+            inputs.push(t);
+        }
+        let cached = self.comp_cache_path(&c, &s, &cmd, &inputs, &dep_out);
+        if comp_cache_get(&cached, &binary) {
+            println!(
+                "Constructor {}.{} is unchanged, using the cached {}",
+                name.scope_name, name.var_name, cached
+            );
+            emit_file(&comp_log, format!("Cached object: {}\n", cached).as_bytes())?;
+            return Ok(binary.clone());
+        }
+
+        // Cached components don't rebuild the libraries, so they
+        // might be left with another component's constants.
+        let (rebuild_cmd, rebuild_out, rebuild_err) =
+            comp_deps_rebuild(&dep_out, &header_file_path, component(&s, &c));
         println!(
             "Compiling component {}.{} with the following command line:\n\t{}",
             name.scope_name, name.var_name, cmd
         );
 
         let (out, err) = exec_pipeline(vec![cmd.clone()]);
-        let comp_log = self.comp_file_path(&c, &"constructor_compilation.log".to_string(), &s)?;
         emit_file(
             &comp_log,
             format!(
-                "Command: {}\nConstructor compilation output:{}\nComponent compilation errors:{}",
-                cmd, out, err
+                "Rebuild Command: {}\nCompilation output:{}\nComponent compilation errors:{}\nCommand: {}\nConstructor compilation output:{}\nComponent compilation errors:{}",
+                rebuild_cmd, rebuild_out, rebuild_err, cmd, out, err
             )
             .as_bytes(),
         )?;
-        if err.len() != 0 {
+        if err.len() != 0 || rebuild_err.len() != 0 {
             println!(
                 "Errors in compiling component {}. See {}.",
                 &binary, comp_log
             )
         }
+        comp_cache_put(&binary, &cached);
 
         Ok(binary.clone())
     }
@@ -0,0 +1,245 @@
+use passes::{
+    AddrSpace, AddrSpaces, BuildState, ColocationPass, ComponentName, SystemState, Transition,
+};
+use std::collections::{BTreeMap, HashMap};
+use syshelpers::{dump_file, emit_file};
+
+// Components in a shared address space are isolated with MPK, and
+// there are only PROTDOM_MPK_NUM_NAMES keys for components in each
+// (see protdom.c).
+const MPK_COMPS_PER_VAS: usize = 14;
+// The booter can create at most BOOTER_MAX_NS_VAS shared address
+// spaces, each with its own ASID namespace (see llbooter.c).
+const MAX_SHARED_VAS: usize = 64;
+
+pub struct Colocation {
+    address_spaces: AddrSpaces,
+    proposed: Vec<AddrSpace>,
+}
+
+impl ColocationPass for Colocation {
+    fn address_spaces(&self) -> &AddrSpaces {
+        &self.address_spaces
+    }
+
+    fn proposed(&self) -> &Vec<AddrSpace> {
+        &self.proposed
+    }
+}
+
+// The profile is a list of "client server count" lines with the
+// number of invocations between the named components, for example
+// aggregated from the kernel's invocation statistics or a tracing
+// run. '#' starts a comment. The direction of invocations doesn't
+// matter for co-location, so counts are aggregated per pair.
+fn profile_parse(
+    path: &String,
+    comps: &Vec<ComponentName>,
+) -> Result<BTreeMap<(ComponentName, ComponentName), u64>, String> {
+    let contents = String::from_utf8(dump_file(path)?)
+        .map_err(|_| format!("Error: Invocation profile {} is not text.", path))?;
+    let mut counts = BTreeMap::new();
+
+    for (n, l) in contents.lines().enumerate() {
+        let l = l.split('#').next().unwrap().trim();
+        if l.len() == 0 {
+            continue;
+        }
+        let fields: Vec<&str> = l.split_whitespace().collect();
+        let err = || {
+            format!(
+                "Error: Invocation profile {}:{} must be of the form \"client server count\".",
+                path,
+                n + 1
+            )
+        };
+        if fields.len() != 3 {
+            return Err(err());
+        }
+        let count: u64 = fields[2].parse().map_err(|_| err())?;
+        let name = |f: &str| {
+            let c = ComponentName::new(&f.to_string(), &String::from("global"));
+            if comps.contains(&c) {
+                Ok(c)
+            } else {
+                Err(format!(
+                    "Error: Invocation profile {}:{} references component \"{}\" that is not found in the list of components.",
+                    path,
+                    n + 1,
+                    f
+                ))
+            }
+        };
+        let (cli, srv) = (name(fields[0])?, name(fields[1])?);
+        if cli == srv || count == 0 {
+            continue;
+        }
+        let key = if cli < srv { (cli, srv) } else { (srv, cli) };
+        *counts.entry(key).or_insert(0) += count;
+    }
+
+    Ok(counts)
+}
+
+fn group_find(groups: &HashMap<ComponentName, ComponentName>, c: &ComponentName) -> ComponentName {
+    let mut c = c;
+    while let Some(p) = groups.get(c) {
+        if p == c {
+            break;
+        }
+        c = p;
+    }
+    c.clone()
+}
+
+// Greedily merge the groups of the components with the most frequent
+// invocations between them, as long as the merged group fits in a
+// shared address space's MPK keys. Each pair's invocations are only
+// considered once, so this is Kruskal's algorithm with a bound on the
+// size of the trees. Only groups of at least two components are
+// returned, the ones avoiding the most cross-address space
+// invocations first.
+fn colocation_groups(
+    eligible: &Vec<ComponentName>,
+    counts: &BTreeMap<(ComponentName, ComponentName), u64>,
+    max_groups: usize,
+) -> Vec<(u64, Vec<ComponentName>)> {
+    let mut groups: HashMap<ComponentName, ComponentName> =
+        eligible.iter().map(|c| (c.clone(), c.clone())).collect();
+    let mut sizes: HashMap<ComponentName, usize> =
+        eligible.iter().map(|c| (c.clone(), 1)).collect();
+
+    let mut edges: Vec<(&(ComponentName, ComponentName), &u64)> = counts
+        .iter()
+        .filter(|((a, b), _)| groups.contains_key(a) && groups.contains_key(b))
+        .collect();
+    // Stable sort, so ties are broken by name, deterministically.
+    edges.sort_by(|(_, x), (_, y)| y.cmp(x));
+    for ((a, b), _) in &edges {
+        let (ga, gb) = (group_find(&groups, a), group_find(&groups, b));
+        let sz = sizes[&ga] + sizes[&gb];
+        if ga == gb || sz > MPK_COMPS_PER_VAS {
+            continue;
+        }
+        groups.insert(gb.clone(), ga.clone());
+        sizes.insert(ga, sz);
+    }
+
+    let mut members: BTreeMap<ComponentName, Vec<ComponentName>> = BTreeMap::new();
+    for c in eligible {
+        members
+            .entry(group_find(&groups, c))
+            .or_insert_with(Vec::new)
+            .push(c.clone());
+    }
+    let mut ret: Vec<(u64, Vec<ComponentName>)> = members
+        .into_iter()
+        .filter(|(_, cs)| cs.len() > 1)
+        .map(|(g, cs)| {
+            let saved = edges
+                .iter()
+                .filter(|((a, _), _)| group_find(&groups, a) == g)
+                .filter(|((_, b), _)| group_find(&groups, b) == g)
+                .map(|(_, n)| **n)
+                .sum();
+            (saved, cs)
+        })
+        .collect();
+    ret.sort_by(|(x, _), (y, _)| y.cmp(x));
+    ret.truncate(max_groups);
+
+    ret
+}
+
+fn proposal_render(proposed: &Vec<AddrSpace>) -> String {
+    proposed.iter().fold(String::new(), |s, a| {
+        format!(
+            "{}[[address_spaces]]\nname = \"{}\"\ncomponents = [{}]\n\n",
+            s,
+            a.name,
+            a.components
+                .iter()
+                .map(|c| format!("\"{}\"", c.var_name))
+                .collect::<Vec<String>>()
+                .join(", ")
+        )
+    })
+}
+
+impl Transition for Colocation {
+    fn transition(s: &SystemState, b: &mut dyn BuildState) -> Result<Box<Self>, String> {
+        let spec = s.get_spec();
+        let mut address_spaces = spec.address_spaces().clone();
+        let mut proposed = Vec::new();
+
+        let path = match spec.invocation_profile() {
+            Some(p) => p,
+            None => {
+                return Ok(Box::new(Colocation {
+                    address_spaces,
+                    proposed,
+                }))
+            }
+        };
+        let counts = profile_parse(path, spec.names())?;
+
+        // Only the booter creates shared address spaces, so only the
+        // components it constructs, and that aren't already in an
+        // address space, can be co-located.
+        let placed: Vec<&ComponentName> = address_spaces
+            .values()
+            .map(|a| a.components.iter())
+            .flatten()
+            .collect();
+        let eligible: Vec<ComponentName> = spec
+            .names()
+            .iter()
+            .filter(|c| {
+                let cons = &spec.component_named(c).constructor;
+                cons.var_name != "kernel"
+                    && spec.component_named(cons).constructor.var_name == "kernel"
+                    && !placed.contains(c)
+            })
+            .cloned()
+            .collect();
+
+        let total: u64 = counts.values().sum();
+        let max_groups = MAX_SHARED_VAS.saturating_sub(address_spaces.len());
+        let groups = colocation_groups(&eligible, &counts, max_groups);
+        let saved: u64 = groups.iter().map(|(n, _)| n).sum();
+        for (_, cs) in groups {
+            let mut name = format!("colocated_{}", proposed.len());
+            while address_spaces.contains_key(&name) {
+                name.push('_');
+            }
+            proposed.push(AddrSpace {
+                name,
+                components: cs,
+                parent: None,
+                children: Vec::new(),
+            });
+        }
+
+        let proposal_path = b.file_path(&"address_spaces.toml".to_string())?;
+        emit_file(&proposal_path, proposal_render(&proposed).as_bytes())?;
+        println!(
+            "Co-location: {} shared address space(s) avoid {} of {} profiled invocations between address spaces; {} in {}.",
+            proposed.len(),
+            saved,
+            total,
+            if spec.colocate() { "applied, and written" } else { "proposed" },
+            proposal_path
+        );
+
+        if spec.colocate() {
+            for a in &proposed {
+                address_spaces.insert(a.name.clone(), a.clone());
+            }
+        }
+
+        Ok(Box::new(Colocation {
+            address_spaces,
+            proposed,
+        }))
+    }
+}
@@ -29,12 +29,16 @@ struct ClientSymbol {
     func_addr: u64,
     callgate_addr: u64,
     ucap_addr: u64,
+    capimm_addr: u64,
+    c_stub: bool,
+    direct: bool,
 }
 
 struct ServerSymbol {
     name: String,
     addr: u64,
     altfn_addr: u64,
+    multi_ret: bool,
 }
 
 struct CompObject {
@@ -134,6 +138,17 @@ fn client_callgate_stubs<'a>(symbs: &Vec<Symb<'a>>) -> Vec<Symb<'a>> {
     symbol_prefix_filter(symbs, "__cosrt_fast_callgate_", global_functions)
 }
 
+// The immediates of the specialized stubs holding the sinv capability
+fn client_cap_immediates<'a>(symbs: &Vec<Symb<'a>>) -> Vec<Symb<'a>> {
+    symbol_prefix_filter(symbs, "__cosrt_capimm_", global_variables)
+}
+
+// The functions with a specialized client stub (cos_asm_stub_direct)
+// that makes the invocation itself
+fn client_direct_stubs<'a>(symbs: &Vec<Symb<'a>>) -> Vec<Symb<'a>> {
+    symbol_prefix_filter(symbs, "__cosrt_direct_", global_functions)
+}
+
 fn server_stubs<'a>(symbs: &Vec<Symb<'a>>) -> Vec<Symb<'a>> {
     symbol_prefix_filter(symbs, "__cosrt_s_", global_functions)
 }
@@ -142,6 +157,12 @@ fn server_alt_stubs<'a>(symbs: &Vec<Symb<'a>>) -> Vec<Symb<'a>> {
     symbol_prefix_filter(symbs, "__cosrt_alts_", global_functions)
 }
 
+// The functions returning multiple values through a C server stub
+// (cos_asm_stub_indirect)
+fn server_c_stubs<'a>(symbs: &Vec<Symb<'a>>) -> Vec<Symb<'a>> {
+    symbol_prefix_filter(symbs, "__cosrt_s_cstub_", global_functions)
+}
+
 fn unique_symbol<T>(symbs: &mut Vec<T>) -> Option<T> {
     if symbs.len() != 1 {
         return None;
@@ -212,20 +233,14 @@ fn compute_dependencies<'a>(symbs: &Vec<Symb<'a>>) -> Result<Vec<ClientSymbol>,
     let ucap_symbs = client_caps(symbs);
     let dep_symbs = client_stubs(symbs);
     let callgate_symbs = client_callgate_stubs(symbs);
+    let direct_symbs = client_direct_stubs(symbs);
+    let capimm_symbs = client_cap_immediates(symbs);
 
     Ok(ucap_symbs
         .iter()
         .map(|s| {
-            let stub = dep_symbs
-                .iter()
-                .fold(None, |found, next| {
-                    if next.name() == s.name() {
-                        Some(next.addr())
-                    } else {
-                        found
-                    }
-                })
-                .unwrap_or(defstub.addr());
+            let c_stub = dep_symbs.iter().find(|next| next.name() == s.name());
+            let stub = c_stub.map(|next| next.addr()).unwrap_or(defstub.addr());
             let callgate_stub = callgate_symbs
                 .iter()
                 .fold(None, |found, next| {
@@ -241,6 +256,13 @@ fn compute_dependencies<'a>(symbs: &Vec<Symb<'a>>) -> Result<Vec<ClientSymbol>,
                 func_addr: stub,
                 callgate_addr: callgate_stub,
                 ucap_addr: s.addr(),
+                capimm_addr: capimm_symbs
+                    .iter()
+                    .find(|next| next.name() == s.name())
+                    .map(|next| next.addr())
+                    .unwrap_or(0),
+                c_stub: c_stub.is_some(),
+                direct: direct_symbs.iter().any(|next| next.name() == s.name()),
             }
         })
         .collect())
@@ -248,6 +270,7 @@ fn compute_dependencies<'a>(symbs: &Vec<Symb<'a>>) -> Result<Vec<ClientSymbol>,
 
 fn compute_exports<'a>(symbs: &Vec<Symb<'a>>) -> Result<Vec<ServerSymbol>, String> {
     let alt_symbs = server_alt_stubs(symbs);
+    let cstub_symbs = server_c_stubs(symbs);
 
     Ok(server_stubs(symbs)
         .iter()
@@ -266,6 +289,7 @@ fn compute_exports<'a>(symbs: &Vec<Symb<'a>>) -> Result<Vec<ServerSymbol>, Strin
                 name: String::from(s.name()),
                 addr: s.addr(),
                 altfn_addr: altstub,
+                multi_ret: cstub_symbs.iter().any(|next| next.name() == s.name()),
             }
         })
         .collect())
@@ -297,6 +321,9 @@ fn compute_elfobj(
                 func_addr: d.func_addr,
                 callgate_addr: d.callgate_addr,
                 ucap_addr: d.ucap_addr,
+                capimm_addr: d.capimm_addr,
+                c_stub: d.c_stub,
+                direct: d.direct,
             },
         );
     }
@@ -307,6 +334,7 @@ fn compute_elfobj(
             ServerSymb {
                 func_addr: e.addr,
                 altfn_addr: e.altfn_addr,
+                multi_ret: e.multi_ret,
             },
         );
     }
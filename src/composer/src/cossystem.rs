@@ -5,7 +5,7 @@ use toml;
 use initargs::ArgsKV;
 use passes::{
     AddrSpace, AddrSpaces, AddrSpcName, BuildState, Component, ComponentName, Dependency, Export,
-    Library, SpecificationPass, SystemState, Transition,
+    Library, Placement, SpecificationPass, SystemState, Transition,
 };
 
 #[derive(Debug, Deserialize)]
@@ -26,6 +26,9 @@ pub struct Parameters {
 pub struct InterfaceVariant {
     pub interface: String,
     pub variant: Option<String>,
+    pub trace: Option<bool>, // link the server stubs that trace its invocations
+    #[serde(rename = "async")]
+    pub asynchronous: Option<bool>, // link the stubs for asynchronous invocations, for the server and its clients
 }
 
 #[derive(Debug, Deserialize, Clone)]
@@ -44,6 +47,16 @@ pub struct TomlComponent {
     constants: Option<Vec<ConstantVal>>,
     implements: Option<Vec<InterfaceVariant>>,
     initfs: Option<String>,
+    nofpu: Option<bool>, // the component never uses the FPU
+    trustdom: Option<u8>, // the components it trusts share its trust domain (> 0)
+    memquota: Option<u64>, // the MiB of memory its capmgr lets it allocate
+    thd_pool: Option<u32>, // threads its capmgr pre-creates for it
+    restart: Option<bool>, // its capmgr restarts it from a checkpoint when it faults
+    cores: Option<Vec<u32>>, // the only cores with its initial threads
+    numa_node: Option<u32>, // ...or those of a NUMA node
+    priority: Option<u32>, // of its initial threads, for its scheduler
+    dedicated: Option<bool>, // its cores execute only its threads, without scheduler ticks
+    pgo: Option<String>, // "generate" a profile of it, or "use" that profile to build it
     constructor: String, // the booter
 }
 
@@ -51,6 +64,8 @@ pub struct TomlComponent {
 #[allow(dead_code)]
 pub struct SysInfo {
     description: String, // comment
+    invocation_profile: Option<String>, // "client server count" lines
+    colocate: Option<bool>, // apply, not just propose, the profile's address spaces
 }
 
 #[derive(Debug, Deserialize)]
@@ -333,6 +348,28 @@ impl TomlSpecification {
             }
         }
 
+        for c in self.comps() {
+            if c.dedicated.unwrap_or(false) && c.cores.is_none() {
+                err_accum.push_str(&format!(
+                    "Error: Component {} is dedicated, but has no cores to dedicate.",
+                    c.name
+                ));
+                fail = true;
+            }
+        }
+
+        for c in self.comps() {
+            if let Some(ref pgo) = c.pgo {
+                if pgo != "generate" && pgo != "use" {
+                    err_accum.push_str(&format!(
+                        "Error: Component {} has pgo = \"{}\", instead of \"generate\" or \"use\".",
+                        c.name, pgo
+                    ));
+                    fail = true;
+                }
+            }
+        }
+
         for c in self.comps() {
             if let Some(constants) = &c.constants {
                 for constant in constants {
@@ -377,6 +414,10 @@ impl TomlSpecification {
         }
     }
 
+    pub fn sysinfo(&self) -> &SysInfo {
+        &self.system
+    }
+
     pub fn comps(&self) -> &Vec<TomlComponent> {
         &self.components
     }
@@ -419,6 +460,8 @@ pub struct SystemSpec {
     libs: HashMap<ComponentName, Vec<Library>>,
     exports: HashMap<ComponentName, Vec<Export>>,
     address_spaces: HashMap<AddrSpcName, AddrSpace>,
+    invocation_profile: Option<String>,
+    colocate: bool,
 }
 
 // Helper functions to compute components in an address space, and
@@ -509,6 +552,14 @@ impl Transition for SystemSpec {
                             .clone()
                             .unwrap_or_else(|| String::from("stubs"))
                     }),
+                    // The client's stubs for asynchronous invocations
+                    // are linked if the server's are.
+                    asynchronous: spec
+                        .comp(d.srv.clone())
+                        .and_then(|s| s.implements.as_ref())
+                        .and_then(|is| is.iter().find(|i| i.interface == d.interface))
+                        .and_then(|i| i.asynchronous)
+                        .unwrap_or(false),
                 })
                 .collect();
 
@@ -520,6 +571,8 @@ impl Transition for SystemSpec {
                 .map(|e| Export {
                     interface: e.interface.clone(),
                     variant: e.variant.as_ref().unwrap_or(&"stubs".to_string()).clone(),
+                    trace: e.trace.unwrap_or(false),
+                    asynchronous: e.asynchronous.unwrap_or(false),
                 })
                 .collect();
 
@@ -554,6 +607,18 @@ impl Transition for SystemSpec {
                     })
                     .collect(),
                 fsimg: c.initfs.clone(),
+                nofpu: c.nofpu.unwrap_or(false),
+                trustdom: c.trustdom.unwrap_or(0),
+                memquota: c.memquota,
+                thd_pool: c.thd_pool,
+                restart: c.restart.unwrap_or(false),
+                placement: Placement {
+                    cores: c.cores.clone(),
+                    numa_node: c.numa_node,
+                    priority: c.priority,
+                    dedicated: c.dedicated.unwrap_or(false),
+                },
+                pgo: c.pgo.clone(),
                 constants: c.constants.as_ref().unwrap_or(&Vec::new()).clone(),
             };
             components.insert(ComponentName::new(&c.name, &String::from("global")), comp);
@@ -592,6 +657,25 @@ impl Transition for SystemSpec {
             }
         }
 
+        // The profile is relative to the specification, unless absolute.
+        let invocation_profile = spec.sysinfo().invocation_profile.as_ref().map(|p| {
+            let p = std::path::Path::new(p);
+            if p.is_absolute() {
+                p.to_string_lossy().to_string()
+            } else {
+                std::path::Path::new(&s.get_input())
+                    .parent()
+                    .unwrap_or(std::path::Path::new("."))
+                    .join(p)
+                    .to_string_lossy()
+                    .to_string()
+            }
+        });
+        let colocate = spec.sysinfo().colocate.unwrap_or(false);
+        if colocate && invocation_profile.is_none() {
+            return Err(String::from("Error in system specification:\ncolocate is set, but there is no invocation_profile to derive the address spaces from.\n"));
+        }
+
         let spec = Box::new(SystemSpec {
             ids,
             components,
@@ -599,6 +683,8 @@ impl Transition for SystemSpec {
             libs,
             exports,
             address_spaces,
+            invocation_profile,
+            colocate,
         });
 
         // Check that the address spaces are formed such that there
@@ -658,4 +744,12 @@ impl SpecificationPass for SystemSpec {
     fn address_spaces(&self) -> &HashMap<AddrSpcName, AddrSpace> {
         &self.address_spaces
     }
+
+    fn invocation_profile(&self) -> &Option<String> {
+        &self.invocation_profile
+    }
+
+    fn colocate(&self) -> bool {
+        self.colocate
+    }
 }
@@ -29,6 +29,41 @@ impl VarNamespace {
     }
 }
 
+// The hash of the keys for the index of the maps. This must match
+// kv_hash in initargs.h.
+fn kv_hash(key: &str, seed: u32) -> u32 {
+    let h = key.bytes().fold(2166136261u32 ^ seed, |h, b| {
+        (h ^ (b as u32)).wrapping_mul(16777619)
+    });
+    let h = (h ^ (h >> 16)).wrapping_mul(0x85ebca6b);
+    h ^ (h >> 13)
+}
+
+// Find a perfect hash for the keys of a map: the table size (a power
+// of 2) and seed for which each key hashes to a different slot.
+// There is none if the keys aren't unique (e.g. arrays of "_").
+fn kv_perfect_hash(keys: &Vec<&String>) -> Option<(u32, u32)> {
+    let mut uniq = keys.clone();
+    uniq.sort();
+    uniq.dedup();
+    if keys.len() == 0 || uniq.len() != keys.len() {
+        return None;
+    }
+
+    let min = (keys.len() as u32).next_power_of_two();
+    for hsz in (0..4).map(|i| min << i) {
+        for seed in 0..256 {
+            let mut slots: Vec<u32> = keys.iter().map(|k| kv_hash(k, seed) & (hsz - 1)).collect();
+            slots.sort();
+            slots.dedup();
+            if slots.len() == keys.len() {
+                return Some((hsz, seed));
+            }
+        }
+    }
+    None
+}
+
 impl ArgsKV {
     pub fn new_key(key: String, val: String) -> ArgsKV {
         ArgsKV {
@@ -62,11 +97,18 @@ impl ArgsKV {
             } => {
                 // base case
                 let kv_name = ns.fresh_name();
+                // integers are parsed here, rather than in the component
+                let num = match s.parse::<i64>() {
+                    Ok(n) if s.chars().all(|c| c.is_ascii_digit() || c == '-') => {
+                        format!(", isnum: 1, num: {}L", n)
+                    }
+                    _ => String::from(""),
+                };
                 (
                     format!(
-                        r#"static struct kv_entry {} = {{ key: "{}", vtype: VTYPE_STR, val: {{ str: "{}" }} }};
+                        r#"static struct kv_entry {} = {{ key: "{}", vtype: VTYPE_STR, val: {{ str: "{}" }}{} }};
 "#,
-                        kv_name, k, s
+                        kv_name, k, s, num
                     ),
                     vec![format!("&{}", kv_name)],
                 )
@@ -89,18 +131,41 @@ impl ArgsKV {
 
                         (format!("{}{}", t, t1), exprs)
                     });
+                // The index of the keys, at the slot of their hash;
+                // the expressions are in the reverse order of kvs.
+                let keys: Vec<&String> = kvs.iter().rev().map(|kv| &kv.key).collect();
+                let (index_defs, index) = match kv_perfect_hash(&keys) {
+                    Some((hsz, seed)) => {
+                        let htbl_name = ns.fresh_name();
+                        let mut slots = vec![String::from("NULL"); hsz as usize];
+                        keys.iter().zip(strs.1.iter()).for_each(|(k, e)| {
+                            slots[(kv_hash(k, seed) & (hsz - 1)) as usize] = e.clone();
+                        });
+                        (
+                            format!(
+                                "static struct kv_entry *{}[] = {{{}}};\n",
+                                htbl_name,
+                                slots.join(", ")
+                            ),
+                            format!(", hsz: {}, seed: {}, htbl: {}", hsz, seed, htbl_name),
+                        )
+                    }
+                    None => (String::from(""), String::from("")),
+                };
                 (
                     format!(
                         r#"{}static struct kv_entry *{}[] = {{{}}};
-static struct kv_entry {} = {{ key: "{}", vtype: VTYPE_ARR, val: {{ arr: {{ sz: {}, kvs: {} }} }} }};
+{}static struct kv_entry {} = {{ key: "{}", vtype: VTYPE_ARR, val: {{ arr: {{ sz: {}, kvs: {}{} }} }} }};
 "#,
                         strs.0,
                         arr_name,
                         strs.1.join(", "),
+                        index_defs,
                         arr_val_name,
                         k,
                         kvs.len(),
-                        arr_name
+                        arr_name,
+                        index
                     ),
                     vec![format!("&{}", arr_val_name)],
                 )
@@ -113,7 +178,8 @@ static struct kv_entry {} = {{ key: "{}", vtype: VTYPE_ARR, val: {{ arr: {{ sz:
     pub fn serialize(&self) -> String {
         let mut ns = VarNamespace::new();
 
-        format!("#include <initargs.h>
+        format!("#include <stddef.h>
+#include <initargs.h>
 {}
 struct initargs __initargs_root = {{ type: ARGS_IMPL_KV, d: {{ kv_ent: &__initargs_autogen_0 }} }};", self.serialize_rec(&mut ns).0)
     }
@@ -1,11 +1,44 @@
 use passes::{
-    component, deps, BuildState, ComponentId, InvocationsPass, SInv, SystemState, TransitionIter,
+    component, deps, AddrSpace, BuildState, ComponentId, ComponentName, InvocationsPass, SInv,
+    SystemState, TransitionIter,
 };
 
+const SINV_CAP_SZ: u32 = 4;
+
 pub struct Invocations {
     invs: Vec<SInv>,
 }
 
+fn comp_addrspc<'a>(s: &'a SystemState, name: &ComponentName) -> Option<&'a AddrSpace> {
+    s.get_colocation()
+        .address_spaces()
+        .values()
+        .find(|a| a.components.contains(name))
+}
+
+// Is the server in the client's address space, or in one of its
+// ancestors? If so, the invocation is made at user-level through the
+// client's MPK callgate instead of through the kernel.
+fn addrspc_shared(s: &SystemState, client: &ComponentName, server: &ComponentName) -> bool {
+    let srv = match comp_addrspc(s, server) {
+        Some(a) => a,
+        None => return false,
+    };
+    let mut curr = comp_addrspc(s, client);
+
+    while let Some(a) = curr {
+        if a.name == srv.name {
+            return true;
+        }
+        curr = a
+            .parent
+            .as_ref()
+            .and_then(|p| s.get_colocation().address_spaces().get(p));
+    }
+
+    false
+}
+
 fn sinvs_generate(id: &ComponentId, s: &SystemState) -> Result<Vec<SInv>, String> {
     let mut invs = Vec::new();
     let mut errors = String::from("");
@@ -30,6 +63,19 @@ fn sinvs_generate(id: &ComponentId, s: &SystemState) -> Result<Vec<SInv>, String
                 .unwrap();
             match s.get_objs_id(srv_id).server_symbs().get(sname) {
                 Some(ref srv_symbs) => {
+                    let shared = addrspc_shared(&s, &component(&s, &id).name, &d.server);
+                    if shared && (symbinfo.callgate_addr == 0 || srv_symbs.altfn_addr == 0) {
+                        errors.push_str(&format!(
+                            "Error: Component {} and its server {} share an address space, but the user-level invocation stubs for {} are missing (__cosrt_fast_callgate_{} in the client, __cosrt_alts_{} in the server). The interface's stubs must be defined with cos_asm_stub or cos_asm_stub_indirect.\n",
+                            component(&s, &id).name, d.server, sname, sname, sname));
+                    }
+                    // The specialized stubs only pass the arguments
+                    // and a single return value in registers.
+                    if symbinfo.direct && (symbinfo.c_stub || srv_symbs.multi_ret) {
+                        errors.push_str(&format!(
+                            "Error: The client stub for {} in component {} is specialized (cos_asm_stub_direct), so it must take at most 4 word arguments, and return a single value. It cannot be used with a client C stub (__cosrt_c_{}), nor with a server that returns multiple values (cos_asm_stub_indirect in {}).\n",
+                            sname, component(&s, &id).name, sname, d.server));
+                    }
                     invs.push(SInv {
                         symb_name: sname.clone(),
                         client: id.clone(),
@@ -39,6 +85,9 @@ fn sinvs_generate(id: &ComponentId, s: &SystemState) -> Result<Vec<SInv>, String
                         c_ucap_addr: symbinfo.ucap_addr.clone(),
                         s_fn_addr: srv_symbs.func_addr.clone(),
                         s_altfn_addr: srv_symbs.altfn_addr.clone(),
+                        c_capid: 0,
+                        // The callgate is used in a shared address space
+                        c_capimm_addr: if shared { 0 } else { symbinfo.capimm_addr },
                     });
                     found = true;
                 }
@@ -62,6 +111,16 @@ fn sinvs_generate(id: &ComponentId, s: &SystemState) -> Result<Vec<SInv>, String
         return Err(errors);
     }
 
+    // The sinv capabilities are allocated statically, right after the
+    // client's other static capabilities (sinvs use 64B, 4 id
+    // capabilities), in a deterministic order, so that they can be
+    // encoded in the client's stubs.
+    invs.sort_by(|a, b| a.symb_name.cmp(&b.symb_name));
+    let base = (s.get_restbl().captbl_end(id) + SINV_CAP_SZ - 1) / SINV_CAP_SZ * SINV_CAP_SZ;
+    for (i, inv) in invs.iter_mut().enumerate() {
+        inv.c_capid = base + SINV_CAP_SZ * i as u32;
+    }
+
     Ok(invs)
 }
 
@@ -9,6 +9,7 @@ extern crate ascent;
 
 mod address_assignment;
 mod build;
+mod colocation;
 mod compobject;
 mod cossystem;
 mod initargs;
@@ -25,6 +26,7 @@ mod analysis;
 
 use address_assignment::AddressAssignmentx86_64;
 use build::DefaultBuilder;
+use colocation::Colocation;
 use compobject::{Constructor, ElfObject};
 use cossystem::SystemSpec;
 use initargs::Parameters;
@@ -55,6 +57,7 @@ pub fn exec() -> Result<(), String> {
     build.initialize(&arg2.unwrap(), &sys)?;
 
     sys.add_parsed(SystemSpec::transition(&sys, &mut build)?);
+    sys.add_colocation(Colocation::transition(&sys, &mut build)?);
     sys.add_named(CompTotOrd::transition(&sys, &mut build)?);
     sys.add_address_assign(AddressAssignmentx86_64::transition(&sys, &mut build)?);
     sys.add_properties(CompProperties::transition(&sys, &mut build)?);
@@ -22,6 +22,7 @@ pub struct SystemState {
     spec: String,
 
     parse: Option<Box<dyn SpecificationPass>>,
+    colocation: Option<Box<dyn ColocationPass>>,
     named: Option<Box<dyn OrderedSpecPass>>,
     address_assignment: Option<Box<dyn AddressAssignmentPass>>,
     properties: Option<Box<dyn PropertiesPass>>,
@@ -40,6 +41,7 @@ impl SystemState {
         SystemState {
             spec,
             parse: None,
+            colocation: None,
             named: None,
             address_assignment: None,
             properties: None,
@@ -57,6 +59,10 @@ impl SystemState {
         self.parse = Some(p);
     }
 
+    pub fn add_colocation(&mut self, c: Box<dyn ColocationPass>) {
+        self.colocation = Some(c);
+    }
+
     pub fn add_named(&mut self, n: Box<dyn OrderedSpecPass>) {
         self.named = Some(n);
     }
@@ -105,6 +111,10 @@ impl SystemState {
         &**(self.parse.as_ref().unwrap())
     }
 
+    pub fn get_colocation(&self) -> &dyn ColocationPass {
+        &**(self.colocation.as_ref().unwrap())
+    }
+
     pub fn get_named(&self) -> &dyn OrderedSpecPass {
         &**(self.named.as_ref().unwrap())
     }
@@ -248,6 +258,30 @@ pub struct Component {
     pub params: Vec<ArgsKV>, // initialization parameters
     pub fsimg: Option<String>,
     pub constants: Vec<ConstantVal>,
+    pub nofpu: bool, // FPU-free, so the kernel can skip FPU switching for it
+    pub trustdom: u8, // no speculation barriers with the components in the same trust domain (0 trusts none)
+    pub memquota: Option<u64>, // the MiB of memory its capmgr lets it allocate (no limit if None)
+    pub thd_pool: Option<u32>, // the threads its capmgr pre-creates to quickly hand out (none if None)
+    pub restart: bool, // its capmgr restarts it from its post-initialization checkpoint on a fault
+    pub placement: Placement, // where its initial threads execute, and at which priority
+    pub pgo: Option<String>, // "generate" builds it to profile it, "use" builds it with the profile
+}
+
+// The cores on which a component's scheduler creates its initial
+// threads, and their priority. None for each means no constraint:
+// a thread on each core, at the scheduler's default priority.
+#[derive(Clone, Debug, Default, PartialEq)]
+pub struct Placement {
+    pub cores: Option<Vec<u32>>,
+    pub numa_node: Option<u32>, // the cores of the NUMA node (and of cores, if both)
+    pub priority: Option<u32>,
+    pub dedicated: bool, // no other component's threads, nor scheduler ticks, on its cores
+}
+
+impl Placement {
+    pub fn is_constrained(&self) -> bool {
+        *self != Placement::default()
+    }
 }
 
 // Input/frontend pass taking the specification, and outputing the
@@ -259,6 +293,7 @@ pub struct Dependency {
     pub server: ComponentName,
     pub interface: Interface,
     pub variant: Variant,
+    pub asynchronous: bool, // the server's export is asynchronous, see ainv.h
 }
 
 #[derive(Clone, Debug)]
@@ -275,6 +310,8 @@ pub type AddrSpaces = HashMap<AddrSpcName, AddrSpace>;
 pub struct Export {
     pub interface: Interface,
     pub variant: Variant,
+    pub trace: bool, // its invocations are traced, see cos_trace.h
+    pub asynchronous: bool, // it is also invoked asynchronously, see ainv.h
 }
 
 pub trait SpecificationPass {
@@ -284,6 +321,19 @@ pub trait SpecificationPass {
     fn exports_named(&self, id: &ComponentName) -> &Vec<Export>;
     fn libs_named(&self, id: &ComponentName) -> &Vec<Library>;
     fn address_spaces(&self) -> &AddrSpaces;
+    fn invocation_profile(&self) -> &Option<String>;
+    fn colocate(&self) -> bool;
+}
+
+// Co-location pass. Given a profile of the invocations between
+// components, propose shared address spaces that group components
+// that frequently invoke each other, and (if the specification asks
+// for it) add them to the specification's address spaces.
+pub trait ColocationPass {
+    // The specification's address spaces, and the proposed ones if
+    // they are applied.
+    fn address_spaces(&self) -> &AddrSpaces;
+    fn proposed(&self) -> &Vec<AddrSpace>;
 }
 
 // Integer namespacing pass. Convert the component variable names to
@@ -351,6 +401,8 @@ pub trait PropertiesPass {
     fn service_is_a(&self, id: &ComponentId, t: ServiceType) -> bool;
     fn service_clients(&self, id: &ComponentId, t: ServiceType) -> Option<&Vec<ComponentId>>;
     fn service_dependency(&self, id: &ComponentId, t: ServiceType) -> Option<ComponentId>;
+    // The placement of the component's initial threads, if constrained
+    fn placement(&self, id: &ComponentId) -> Option<&Placement>;
 }
 
 // Each component must be compiled starting
@@ -362,6 +414,9 @@ pub trait AddressAssignmentPass {
 // component.
 pub trait ResPass {
     fn args(&self, id: &ComponentId) -> &Vec<ArgsKV>;
+    // The end of the statically allocated capabilities of the
+    // component, after which its sinvs are allocated
+    fn captbl_end(&self, id: &ComponentId) -> u32;
 }
 
 // The initparam, objects, and synchronous invocation passes are all
@@ -389,11 +444,15 @@ pub struct ClientSymb {
     pub func_addr: VAddr,
     pub callgate_addr: VAddr,
     pub ucap_addr: VAddr,
+    pub capimm_addr: VAddr, // the stub's immediate for the sinv capability, or 0
+    pub c_stub: bool, // the interface provides a client C stub
+    pub direct: bool, // specialized stub: the invocation avoids the C stub
 }
 
 pub struct ServerSymb {
     pub func_addr: VAddr,
     pub altfn_addr: VAddr,
+    pub multi_ret: bool, // returns multiple values through a C stub
 }
 
 pub struct CompSymbs {
@@ -424,6 +483,8 @@ pub struct SInv {
     pub c_ucap_addr: VAddr,
     pub s_fn_addr: VAddr,
     pub s_altfn_addr: VAddr,
+    pub c_capid: u32,         // statically allocated sinv capability in the client
+    pub c_capimm_addr: VAddr, // where to write it in the client's stub, or 0
 }
 
 pub trait InvocationsPass {
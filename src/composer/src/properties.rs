@@ -1,11 +1,69 @@
 use passes::{
-    component, deps, BuildState, ComponentId, Interface, PropertiesPass, ServiceClients,
+    component, deps, BuildState, ComponentId, Interface, Placement, PropertiesPass, ServiceClients,
     ServiceProvider, ServiceType, SystemState, Transition,
 };
 use std::collections::HashMap;
 
 pub struct CompProperties {
     comps: HashMap<ComponentId, (Vec<ServiceClients>, Vec<ServiceProvider>)>,
+    placements: HashMap<ComponentId, Placement>,
+}
+
+// The lowest (numerically highest) fixed priority of the schedulers
+const PRIO_LOWEST: u32 = 255;
+
+// The placement of a component's initial threads is honored by the
+// component that creates them: its scheduler. Only leaf components
+// (that don't schedule or manage others) can be placed, and only
+// schedulers (not the capmgr or booter) honor priorities.
+fn placement_validate(
+    id: &ComponentId,
+    p: &Placement,
+    comps: &HashMap<ComponentId, (Vec<ServiceClients>, Vec<ServiceProvider>)>,
+) -> Result<(), String> {
+    let provides = |c: &ComponentId| comps.get(c).map(|(cs, _)| cs.len() > 0).unwrap_or(false);
+    let (_, parents) = comps.get(id).unwrap();
+
+    if provides(id) {
+        return Err(format!("Error: Component {} has cores, numa_node, or priority properties, but it is a scheduler, capmgr, or constructor for other components. Only the placement of leaf components is supported.", id));
+    }
+    let sched = parents.iter().find_map(|p| match p {
+        ServiceProvider::Scheduler(s) => Some(s),
+        _ => None,
+    });
+    let sched = match sched {
+        Some(s) => s,
+        None => return Err(format!("Error: Component {} has cores, numa_node, or priority properties, but no scheduler (init dependency) to honor them.", id)),
+    };
+    if let Some(cores) = &p.cores {
+        let mut uniq = cores.clone();
+        uniq.sort();
+        uniq.dedup();
+        if cores.is_empty() || uniq.len() != cores.len() {
+            return Err(format!(
+                "Error: Component {}'s cores must be a non-empty list of distinct core ids.",
+                id
+            ));
+        }
+    }
+    if let Some(prio) = p.priority {
+        let sched_clients = &comps.get(sched).unwrap().0;
+        let only_schedules = sched_clients.iter().all(|c| match c {
+            ServiceClients::Scheduler(_) => true,
+            _ => false,
+        });
+        if !only_schedules {
+            return Err(format!("Error: Component {} has a priority, but its scheduler {} is a capmgr or constructor, which don't schedule by priority.", id, sched));
+        }
+        if prio < 1 || prio > PRIO_LOWEST {
+            return Err(format!(
+                "Error: Component {}'s priority {} must be between 1 (highest) and {} (lowest).",
+                id, prio, PRIO_LOWEST
+            ));
+        }
+    }
+
+    Ok(())
 }
 
 // Return if we depend on (yet implement as a library) the given
@@ -122,7 +180,20 @@ impl Transition for CompProperties {
             properties.insert(id.clone(), (props, parents));
         }
 
-        Ok(Box::new(CompProperties { comps: properties }))
+        let mut placements = HashMap::new();
+        for (id, _) in s.get_named().ids().iter() {
+            let p = &component(s, id).placement;
+            if !p.is_constrained() {
+                continue;
+            }
+            placement_validate(id, p, &properties)?;
+            placements.insert(id.clone(), p.clone());
+        }
+
+        Ok(Box::new(CompProperties {
+            comps: properties,
+            placements,
+        }))
     }
 }
 
@@ -178,4 +249,8 @@ impl PropertiesPass for CompProperties {
             None
         }
     }
+
+    fn placement(&self, id: &ComponentId) -> Option<&Placement> {
+        self.placements.get(id)
+    }
 }
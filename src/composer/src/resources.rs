@@ -142,11 +142,53 @@ fn sched_config_clients(s: &SystemState, id: &ComponentId) -> Vec<ArgsKV> {
     init
 }
 
+// The placement of the clients with a constrained placement, for
+// the scheduler to create their initial threads only on their cores.
+fn sched_config_placement(s: &SystemState, id: &ComponentId) -> Vec<ArgsKV> {
+    let mut placement = Vec::new();
+
+    let props: &dyn PropertiesPass = s.get_properties();
+    let clients = match props.service_clients(&id, ServiceType::Scheduler) {
+        Some(cs) => cs,
+        None => return placement,
+    };
+    for c in clients.iter() {
+        let p = match props.placement(c) {
+            Some(p) => p,
+            None => continue,
+        };
+        let mut args = Vec::new();
+        if let Some(cores) = &p.cores {
+            let cores_args = cores
+                .iter()
+                .map(|core| ArgsKV::new_key("_".to_string(), core.to_string()))
+                .collect();
+            args.push(ArgsKV::new_arr("cores".to_string(), cores_args));
+        }
+        if let Some(n) = p.numa_node {
+            args.push(ArgsKV::new_key("numa_node".to_string(), n.to_string()));
+        }
+        if let Some(prio) = p.priority {
+            args.push(ArgsKV::new_key("priority".to_string(), prio.to_string()));
+        }
+        if p.dedicated {
+            args.push(ArgsKV::new_key("dedicated".to_string(), "1".to_string()));
+        }
+        placement.push(ArgsKV::new_arr(c.to_string(), args));
+    }
+
+    placement
+}
+
 fn sched_config(s: &SystemState, id: &ComponentId, cfg: &mut CompConfigState) {
     cfg.args.push(ArgsKV::new_arr(
         "execute".to_string(),
         sched_config_clients(&s, &id),
     ));
+    cfg.args.push(ArgsKV::new_arr(
+        "placement".to_string(),
+        sched_config_placement(&s, &id),
+    ));
 }
 
 fn cap2kvarg(capid: u32, cap: &CapRes) -> ArgsKV {
@@ -172,6 +214,9 @@ fn capmgr_config(s: &SystemState, id: &ComponentId, cfg: &mut CompConfigState) {
     let mut ct_args = Vec::new();
     let mut init_args = Vec::new();
     let mut names_args = Vec::new();
+    let mut quota_args = Vec::new();
+    let mut pool_args = Vec::new();
+    let mut restart_args = Vec::new();
 
     // aggregate records for scheduler and capmgr dependencies
     clients.append(
@@ -219,6 +264,21 @@ fn capmgr_config(s: &SystemState, id: &ComponentId, cfg: &mut CompConfigState) {
             spec_comp.source, spec_comp.name.scope_name, spec_comp.name.var_name
         );
         names_args.push(ArgsKV::new_key(c.to_string(), name));
+
+        // memory quotas, in MiB
+        if let Some(q) = spec_comp.memquota {
+            quota_args.push(ArgsKV::new_key(c.to_string(), q.to_string()));
+        }
+
+        // pre-created threads
+        if let Some(n) = spec_comp.thd_pool {
+            pool_args.push(ArgsKV::new_key(c.to_string(), n.to_string()));
+        }
+
+        // restarted on a fault
+        if spec_comp.restart {
+            restart_args.push(ArgsKV::new_key(c.to_string(), "1".to_string()));
+        }
     }
 
     // Lets provide information to the capability manager about which
@@ -248,6 +308,12 @@ fn capmgr_config(s: &SystemState, id: &ComponentId, cfg: &mut CompConfigState) {
         .push(ArgsKV::new_arr("captbl".to_string(), ct_args));
     cfg.args
         .push(ArgsKV::new_arr("names".to_string(), names_args));
+    cfg.args
+        .push(ArgsKV::new_arr("mem_quota".to_string(), quota_args));
+    cfg.args
+        .push(ArgsKV::new_arr("thd_pool".to_string(), pool_args));
+    cfg.args
+        .push(ArgsKV::new_arr("restart".to_string(), restart_args));
     cfg.args
         .push(ArgsKV::new_arr("addrspc_shared".to_string(), shared_vas));
 }
@@ -315,11 +381,13 @@ fn comp_config_finalize(_s: &SystemState, _id: &ComponentId, cfg: CompConfigStat
 
 pub struct ResAssignPass {
     resources: HashMap<ComponentId, Vec<ArgsKV>>,
+    captbl_ends: HashMap<ComponentId, u32>,
 }
 
 impl Transition for ResAssignPass {
     fn transition(s: &SystemState, _b: &mut dyn BuildState) -> Result<Box<Self>, String> {
         let mut res = HashMap::new();
+        let mut ends = HashMap::new();
 
         for (k, _v) in s.get_named().ids().iter() {
             let mut cfg = CompConfigState::new();
@@ -331,10 +399,14 @@ impl Transition for ResAssignPass {
             constructor_config(&s, &k, &mut cfg);
             sched_config(&s, &k, &mut cfg);
             comp_config(&s, &k, &mut cfg);
+            ends.insert(k.clone(), cfg.ct.get_frontier());
             res.insert(k.clone(), comp_config_finalize(&s, &k, cfg));
         }
 
-        Ok(Box::new(ResAssignPass { resources: res }))
+        Ok(Box::new(ResAssignPass {
+            resources: res,
+            captbl_ends: ends,
+        }))
     }
 }
 
@@ -342,4 +414,8 @@ impl ResPass for ResAssignPass {
     fn args(&self, id: &ComponentId) -> &Vec<ArgsKV> {
         &self.resources.get(&id).unwrap()
     }
+
+    fn captbl_end(&self, id: &ComponentId) -> u32 {
+        *self.captbl_ends.get(&id).unwrap()
+    }
 }
@@ -101,17 +101,19 @@ impl Transition for CompTotOrd {
 
         // Order the address spaces so that they (and their
         // components) can be created parent address spaces first.
+        // These include those the co-location pass adds.
+        let ases = s.get_colocation().address_spaces();
         let mut addrspc_comps = BTreeMap::new();
         let mut offset = 0;
         let mut comps_track_exclusive: HashSet<ComponentName> = comps.values().cloned().collect();
-        for (_, a) in spec.address_spaces() {
+        for (_, a) in ases {
             // a "root" of the AS hierarchy, recurs from there to do a DFS
             if a.parent.is_none() {
                 addrspc_dfs_via_children(
                     &mut offset,
                     &mut addrspc_comps,
                     &a,
-                    &spec.address_spaces(),
+                    ases,
                 );
             }
             // Remove components that are explicitly in address
@@ -0,0 +1,46 @@
+#include "include/acct.h"
+#include "include/cap_ops.h"
+#include "include/pgtbl.h"
+
+struct cos_thd_acct *thd_acct_pages[COS_THD_ACCT_PAGES];
+
+/*
+ * Use the kernel memory at kaddr (in kmem_pt) as page pgidx of the
+ * thread accounting table, mapped read-only at uaddr in ptcap.
+ */
+int
+thd_acct_map(struct captbl *t, unsigned long pgidx, capid_t kmem_pt, vaddr_t kaddr, capid_t ptcap, vaddr_t uaddr)
+{
+	struct cap_pgtbl *   ptc;
+	struct cos_thd_acct *a;
+	unsigned long        kmem, *pte, i;
+	int                  ret;
+
+	if (pgidx >= COS_THD_ACCT_PAGES) return -EINVAL;
+	if (thd_acct_pages[pgidx]) return -EEXIST;
+
+	ptc = (struct cap_pgtbl *)captbl_lkup(t, ptcap);
+	if (!CAP_TYPECHK(ptc, CAP_PGTBL)) return -EINVAL;
+
+	ret = cap_kmem_activate(t, kmem_pt, kaddr, &kmem, &pte);
+	if (ret) return ret;
+	memset((void *)kmem, 0, PAGE_SIZE);
+	a = (struct cos_thd_acct *)kmem;
+	for (i = 0; i < COS_THD_ACCT_PAGE_NENTS; i++) a[i].tid = pgidx * COS_THD_ACCT_PAGE_NENTS + i;
+
+	ret = pgtbl_mapping_add(ptc->pgtbl, uaddr, chal_va2pa((void *)kmem), PGTBL_PRESENT | PGTBL_USER | PGTBL_ACCESSED,
+	                        PAGE_ORDER);
+	if (ret) {
+		kmem_unalloc(pte);
+		return ret;
+	}
+
+	/* publish the initialized page */
+	cos_mem_fence();
+	if (cos_cas((unsigned long *)&thd_acct_pages[pgidx], 0, kmem) != CAS_SUCCESS) {
+		/* the user mapping stays, but the page is never written */
+		return -ECASFAIL;
+	}
+
+	return 0;
+}
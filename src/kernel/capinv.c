@@ -18,26 +18,17 @@
 #include "include/chal/chal_proto.h"
 #include "include/ulk.h"
 #include "include/vm.h"
+#include "include/trace.h"
+#include "include/acct.h"
+#include "include/clock.h"
+#include "include/syscall_stats.h"
 
 
 #define COS_DEFAULT_RET_CAP 0
 
-/*
- * TODO: switch to a dedicated TLB flush thread (in a separate
- * protection domain) to do this.
- */
-void
-tlb_mandatory_flush(void *arg)
-{
-	unsigned long long t;
-	(void)arg;
-
-	rdtscll(t);
-	/* Order is important: get tsc before action. */
-	chal_flush_tlb();
-	/* But commit after. */
-	tlb_quiescence[get_cpuid()].last_mandatory_flush = t;
-}
+#if COS_SYSCALL_STATS
+struct cos_syscall_stats syscall_stats[NUM_CPU] CACHE_ALIGNED;
+#endif
 
 #define MAX_LEN 512
 extern char timer_detector[PAGE_SIZE] PAGE_ALIGNED;
@@ -162,12 +153,16 @@ kmem_deact_pre(struct cap_header *ch, struct captbl *ct, capid_t pgtbl_cap, capi
 	} else {
 		/* currently only captbl and pgtbl pages need to be
 		 * scanned before deactivation. */
-		struct cap_thd *tc = (struct cap_thd *)ch;
+		void *obj;
 
-		if (chal_pa2va((paddr_t)pa) != (void *)(tc->t)) cos_throw(err, -EINVAL);
+		if (ch->type == CAP_ULK) obj = (void *)((struct cap_ulk *)ch)->kern_addr;
+		else                     obj = (void *)((struct cap_thd *)ch)->t;
+		if (chal_pa2va((paddr_t)pa) != obj) cos_throw(err, -EINVAL);
 
-		assert(ch->type == CAP_THD);
+		assert(ch->type == CAP_THD || ch->type == CAP_ULK);
 	}
+	/* the kmem is about to be released: no cached lookups may refer into it */
+	captbl_lkup_cache_invalidate();
 
 	return 0;
 err:
@@ -175,6 +170,35 @@ err:
 	return ret;
 }
 
+/*
+ * As kmem_deact_pre, for a page of kernel memory that isn't the
+ * object of a capability (e.g. a thread's invocation stack
+ * extension), and that needs no scan.
+ */
+int
+kmem_page_deact_pre(void *page, struct captbl *ct, capid_t pgtbl_cap, capid_t cosframe_addr, unsigned long **p_pte,
+                    unsigned long *v)
+{
+	struct cap_pgtbl *cap_pt;
+	word_t            flags;
+
+	assert(ct && page);
+	if (!pgtbl_cap || !cosframe_addr) return -EINVAL;
+
+	cap_pt = (struct cap_pgtbl *)captbl_lkup(ct, pgtbl_cap);
+	if (!CAP_TYPECHK(cap_pt, CAP_PGTBL)) return -EINVAL;
+
+	*p_pte = pgtbl_lkup_pte(cap_pt->pgtbl, cosframe_addr, &flags);
+	if (!*p_pte) return -EINVAL;
+	*v = **p_pte;
+
+	if (!chal_pgtbl_flag_exist(*v, PGTBL_COSKMEM)) return -EINVAL;
+	if (chal_pa2va((paddr_t)(*v & PGTBL_FRAME_MASK)) != page) return -EINVAL;
+	captbl_lkup_cache_invalidate();
+
+	return 0;
+}
+
 /* Updates the pte, deref the frame and zero out the page. */
 int
 kmem_deact_post(unsigned long *pte, unsigned long old_v)
@@ -312,6 +336,52 @@ cap_cpy(struct captbl *t, capid_t cap_to, capid_t capin_to, capid_t cap_from, ca
 	return ret;
 }
 
+/* Copy the mappings of npages contiguous pages from the page-table cap_from */
+static inline int
+cap_cpy_n(struct captbl *t, capid_t cap_to, capid_t capin_to, capid_t cap_from, capid_t capin_from, unsigned long npages, word_t flags)
+{
+	struct cap_header *ctfrom;
+
+	if (unlikely(npages == 0 || npages > COS_PGTBL_CPY_N_MAX)) return -EINVAL;
+	ctfrom = captbl_lkup(t, cap_from);
+	if (unlikely(!ctfrom)) return -ENOENT;
+	if (unlikely(ctfrom->type != CAP_PGTBL)) return -EINVAL;
+
+	return chal_pgtbl_cpy_n(t, cap_to, capin_to, (struct cap_pgtbl *)ctfrom, capin_from, npages, flags);
+}
+
+/*
+ * Report the guest-physical pages of the npages at gpa in the EPT pt
+ * written since the last collection, a bit per page in the bitmap at
+ * uaddr (in a single, writable page of the invoking component), and
+ * clear their dirty bits.  No core runs a vcpu with the stale
+ * translations once this returns (vm_ept_flush), so that each write
+ * after the collection is in the next one.  Returns the number of
+ * dirty pages.
+ */
+static inline int
+cap_ept_dirty(struct comp_info *ci, struct cap_pgtbl *pt, vaddr_t gpa, unsigned long npages, vaddr_t uaddr)
+{
+	unsigned long *bitmap;
+	word_t         flags;
+	int            ret;
+
+	if (unlikely(pt->type != PGTBL_TYPE_EPT || pt->lvl != 0)) return -EINVAL;
+	if (unlikely(npages == 0 || npages > COS_EPT_DIRTY_MAX || gpa % PAGE_SIZE)) return -EINVAL;
+	if (unlikely(uaddr % sizeof(unsigned long))) return -EINVAL;
+	if (unlikely(round_to_page(uaddr) != round_to_page(uaddr + COS_EPT_DIRTY_WORDS(npages) * sizeof(unsigned long) - 1))) return -EINVAL;
+
+	bitmap = (unsigned long *)pgtbl_translate(ci->pgtblinfo.pgtbl, round_to_page(uaddr), &flags);
+	if (unlikely(!bitmap)) return -EFAULT;
+	if (unlikely((flags & (PGTBL_USER | PGTBL_WRITABLE)) != (PGTBL_USER | PGTBL_WRITABLE))) return -EFAULT;
+	bitmap = (unsigned long *)((vaddr_t)bitmap + (uaddr & (PAGE_SIZE - 1)));
+
+	ret = chal_pgtbl_ept_dirty(pt, gpa, npages, bitmap);
+	if (ret > 0) vm_ept_flush();
+
+	return ret;
+}
+
 static inline int
 cap_move(struct captbl *t, capid_t cap_to, capid_t capin_to, capid_t cap_from, capid_t capin_from)
 {
@@ -362,6 +432,7 @@ cap_move(struct captbl *t, capid_t cap_to, capid_t capin_to, capid_t cap_from, c
 		ret = cos_cas(f, old_v, 0);
 		if (ret != CAS_SUCCESS) return -ECASFAIL;
 
+		captbl_lkup_cache_invalidate();
 		ret = cos_cas(moveto, old_v_to, old_v);
 		if (ret != CAS_SUCCESS) {
 			/*
@@ -421,6 +492,8 @@ cap_thd_switch(struct pt_regs *regs, struct thread *curr, struct thread *next, s
 	next_protdom = thd_invstk_protdom_curr(next);
 
 	thd_current_update(next, curr, cos_info);
+	cos_trace(COS_TRACE_THD_SWITCH, curr->tid, next->tid);
+	thd_acct_switch(next->tid);
 
 	/* Not sure of the trade-off here: Branch cost vs. segment register update */
 	if (next->tls != curr->tls) chal_tls_update(next->tls);
@@ -434,6 +507,7 @@ cap_thd_switch(struct pt_regs *regs, struct thread *curr, struct thread *next, s
 	}
 
 	chal_protdom_write(next_protdom);
+	inv_spec_barrier(ci->pgtblinfo.protdom, next_pt->protdom);
 
 	preempt = thd_switch_update(next, &next->regs, 0);
 	/* if switching to the preempted/awoken thread clear cpu local next_thdinfo */
@@ -690,7 +764,7 @@ cap_ipi_process(struct pt_regs *regs)
 	struct thread 		   *thd_curr, *thd_next;
 	struct tcap 		   *tcap_curr, *tcap_next;
 	struct comp_info 	   *ci;
-	int                         i, scan_base;
+	int                         w;
 	unsigned long               ip, sp;
 
 	thd_curr       = thd_next = thd_current(cos_info);
@@ -698,31 +772,40 @@ cap_ipi_process(struct pt_regs *regs)
 	tcap_curr      = tcap_next = tcap_current(cos_info);
 	ci             = thd_invstk_current(thd_curr, &ip, &sp, cos_info);
 	assert(ci && ci->captbl);
+	cos_trace(COS_TRACE_IPI, thd_curr->tid, 0);
 
-	scan_base = receiver_rings->start;
-	receiver_rings->start = (receiver_rings->start + 1) % NUM_CPU;
+	/* Senders that enqueue from here on have to send a new IPI */
+	receiver_rings->ipi_pending = 0;
+	cos_mem_fence();
 
-	/* We need to scan the entire buffer once. */
-	for (i = 0; i < NUM_CPU; i++) {
-		struct thread *rcvthd  = NULL;
-		struct tcap   *rcvtcap = NULL;
+	/* Only scan the rings of the sources that have enqueued. */
+	for (w = 0; w < IPI_SUMMARY_WORDS; w++) {
+		u32_t srcs = cos_ipi_summary_take(receiver_rings, w);
 
-		ring = &receiver_rings->IPI_source[(scan_base + i) % NUM_CPU];
+		for (; srcs; srcs &= srcs - 1) {
+			struct thread *rcvthd  = NULL;
+			struct tcap   *rcvtcap = NULL;
 
-		if (ring->sender == ring->receiver) continue;
-		while ((cos_ipi_ring_dequeue(ring, &data)) != 0) {
-			arcv = cos_ipi_arcv_get(&data);
-			assert(arcv);
+			ring = &receiver_rings->IPI_source[w * 32 + __builtin_ctz(srcs)];
 
-			rcvthd  = arcv->thd;
-			rcvtcap = rcvthd->rcvcap.rcvcap_tcap;
-			assert(rcvthd && rcvtcap);
+			while ((cos_ipi_ring_dequeue(ring, &data)) != 0) {
+				arcv = cos_ipi_arcv_get(&data);
+				assert(arcv);
+				if (unlikely(arcv->cpuid != get_cpuid())) {
+					cos_ipi_forward(arcv->cpuid, &data);
+					continue;
+				}
 
-			/*
-			 * tcap_higher_prio (partial-order qualities) check for "highest" prio so far and the next
-			 * thread in the ring (dequeued item).
-			 */
-			thd_next = asnd_process(rcvthd, thd_next, rcvtcap, tcap_next, &tcap_next, 0, cos_info);
+				rcvthd  = arcv->thd;
+				rcvtcap = rcvthd->rcvcap.rcvcap_tcap;
+				assert(rcvthd && rcvtcap);
+
+				/*
+				 * tcap_higher_prio (partial-order qualities) check for "highest" prio so far and the next
+				 * thread in the ring (dequeued item).
+				 */
+				thd_next = asnd_process(rcvthd, thd_next, rcvtcap, tcap_next, &tcap_next, 0, cos_info);
+			}
 		}
 	}
 
@@ -732,6 +815,22 @@ cap_ipi_process(struct pt_regs *regs)
 	return cap_switch(regs, thd_curr, thd_next, tcap_next, TCAP_TIME_NIL, ci, cos_info);
 }
 
+static inline int
+cap_asnd_ipi(struct cap_asnd *asnd, int cpu, struct thread *thd, struct pt_regs *regs)
+{
+	int ret;
+
+	/* ignore yield flag */
+	assert(!__userregs_get1(regs));
+	cos_trace(COS_TRACE_ASND, thd->tid, cpu);
+
+	ret = cos_cap_send_ipi(cpu, asnd);
+	/* special handling for IPI send */
+	if (likely(ret == 0)) __userregs_set(regs, 0, __userregs_getsp(regs), __userregs_getip(regs));
+
+	return ret;
+}
+
 static int
 cap_asnd_op(struct cap_asnd *asnd, struct thread *thd, struct pt_regs *regs, struct comp_info *ci,
             struct cos_cpu_local_info *cos_info)
@@ -748,24 +847,18 @@ cap_asnd_op(struct cap_asnd *asnd, struct thread *thd, struct pt_regs *regs, str
 
 	assert(asnd->arcv_capid);
 	/* IPI notification to another core */
-	if (asnd->arcv_cpuid != curr_cpu) {
-		/* ignore yield flag */
-		assert(!srcv);
-
-		ret = cos_cap_send_ipi(asnd->arcv_cpuid, asnd);
-		/* special handling for IPI send */
-		if (likely(ret == 0)) __userregs_set(regs, 0, __userregs_getsp(regs), __userregs_getip(regs));
-
-		return ret;
-	}
+	if (asnd->arcv_cpuid != curr_cpu) return cap_asnd_ipi(asnd, asnd->arcv_cpuid, thd, regs);
 
 	arcv = __cap_asnd_to_arcv(asnd);
 	if (unlikely(!arcv)) return -EINVAL;
+	/* the end-point migrated since the asnd's creation (arcv_migrate) */
+	if (unlikely(arcv->cpuid != curr_cpu)) return cap_asnd_ipi(asnd, arcv->cpuid, thd, regs);
 
 	rcv_thd  = arcv->thd;
 	tcap     = tcap_current(cos_info);
 	rcv_tcap = rcv_thd->rcvcap.rcvcap_tcap;
 	assert(rcv_tcap && tcap);
+	cos_trace(COS_TRACE_ASND, thd->tid, rcv_thd->tid);
 
 	if (srcv) {
 		struct cap_arcv *srcv_cap;
@@ -823,6 +916,10 @@ cap_hw_asnd(struct cap_asnd *asnd, struct pt_regs *regs)
 
 	arcv = __cap_asnd_to_arcv(asnd);
 	if (unlikely(!arcv)) return 1;
+	if (unlikely(arcv->cpuid != curr_cpu)) {
+		cos_cap_send_ipi(arcv->cpuid, asnd);
+		return 1;
+	}
 
 	cos_info = cos_cpu_local_info();
 	assert(cos_info);
@@ -843,6 +940,124 @@ cap_hw_asnd(struct cap_asnd *asnd, struct pt_regs *regs)
 	return cap_switch(regs, thd, next, tcap_next, TCAP_TIME_NIL, ci, cos_info);
 }
 
+/*
+ * The page faults of user-level are delivered to a handler thread of
+ * the core, if one is attached (e.g. to populate memory on first
+ * touch). As for the VM exits, the faulting thread is preempted at the
+ * faulting instruction, and the kernel switches to the handler, that
+ * switches back to that thread (HW_PGFLT_RESUME) once it has mapped
+ * the memory. Only the last fault of a core is recorded: a thread
+ * whose fault is overwritten before the handler gets to it is
+ * dispatched again by its scheduler, and faults again.
+ */
+struct pgflt_core {
+	struct thread   *handler;
+	struct thread   *faulted;
+	struct cos_pgflt info;
+} CACHE_ALIGNED;
+
+static struct pgflt_core pgflt_cores[NUM_CPU];
+
+int
+cap_pgflt_deliver(struct pt_regs *regs, vaddr_t addr, unsigned long errcode, vaddr_t ip)
+{
+	struct cos_cpu_local_info *cos_info = cos_cpu_local_info();
+	struct pgflt_core *        pc       = &pgflt_cores[get_cpuid()];
+	struct thread *            thd;
+	struct comp_info *         ci;
+	unsigned long              uip, usp;
+
+	if (!pc->handler || !(errcode & PGTBL_USER)) return -1;
+	thd = thd_current(cos_info);
+	/* The handler's own faults can't be resolved */
+	if (thd == pc->handler || thd->thd_type == THD_TYPE_VM) return -1;
+	ci = thd_invstk_current(thd, &uip, &usp, cos_info);
+	if (unlikely(!ci)) return -1;
+
+	pc->faulted = thd;
+	pc->info    = (struct cos_pgflt) {
+		.addr    = addr,
+		.ip      = ip,
+		.errcode = errcode,
+		.pgtbl   = (unsigned long)ci->pgtblinfo.pgtbl / PAGE_SIZE,
+		.tid     = thd->tid,
+	};
+	thd->state |= THD_STATE_PREEMPTED;
+
+	return cap_thd_switch(regs, thd, pc->handler, ci, cos_info);
+}
+
+static int
+cap_pgflt_attach(struct captbl *ct, capid_t thdcap)
+{
+	struct pgflt_core *pc = &pgflt_cores[get_cpuid()];
+	struct cap_thd *   tc;
+
+	if (!thdcap) {
+		pc->handler = NULL;
+		pc->faulted = NULL;
+
+		return 0;
+	}
+	tc = (struct cap_thd *)captbl_lkup(ct, thdcap);
+	if (!CAP_TYPECHK_CORE(tc, CAP_THD)) return -EINVAL;
+	if (pc->handler) return -EEXIST;
+	pc->handler = tc->t;
+
+	return 0;
+}
+
+static int
+cap_pgflt_resume(struct pt_regs *regs, struct thread *thd, struct comp_info *ci, struct cos_cpu_local_info *cos_info)
+{
+	struct pgflt_core *pc   = &pgflt_cores[get_cpuid()];
+	struct thread *    next = pc->faulted;
+
+	if (thd != pc->handler) return -EINVAL;
+	pc->faulted = NULL;
+	/* If its scheduler dispatched it since, it's the scheduler's to dispatch */
+	if (!next || !(next->state & THD_STATE_PREEMPTED) || next->cpuid != get_cpuid()) {
+		next = thd_rcvcap_sched(tcap_rcvcap_thd(tcap_current(cos_info)));
+	}
+
+	return cap_thd_switch(regs, thd, next, ci, cos_info);
+}
+
+/*
+ * Instead of resuming the faulting thread, unwind the invocation it
+ * faulted in, and switch to it in the component that invoked it, as
+ * if the server returned retval (e.g. so that a restarted server's
+ * clients retry). The faults in a thread's own component have no
+ * invocation to unwind.
+ */
+static int
+cap_pgflt_abort(struct pt_regs *regs, struct thread *thd, unsigned long retval, struct comp_info *ci,
+                struct cos_cpu_local_info *cos_info)
+{
+	struct pgflt_core *  pc   = &pgflt_cores[get_cpuid()];
+	struct thread *      next = pc->faulted;
+	struct invstk_entry *top, *prev;
+
+	if (thd != pc->handler) return -EINVAL;
+	/* If its scheduler dispatched it since, it faults again */
+	if (!next || !(next->state & THD_STATE_PREEMPTED) || next->cpuid != get_cpuid()) return -EAGAIN;
+	if (next->invstk_top == 0) return -ENOENT;
+
+	top = thd_invstk_entry(next, next->invstk_top);
+	if (next->ulk_invstk && next->ulk_invstk->top != top->ulk_stkoff) next->ulk_invstk->top = top->ulk_stkoff;
+	if (unlikely(next->state & THD_STATE_GRANT) && next->grant.state == THD_GRANT_ACTIVE
+	    && next->grant.depth >= next->invstk_top) {
+		thd_grant_revoke(&next->grant);
+		next->state &= ~THD_STATE_GRANT;
+	}
+	next->invstk_top--;
+	prev = thd_invstk_entry(next, next->invstk_top);
+	__userregs_set(&next->regs, retval, prev->sp, prev->ip);
+	pc->faulted = NULL;
+
+	return cap_thd_switch(regs, thd, next, ci, cos_info);
+}
+
 int
 expended_process(struct pt_regs *regs, struct thread *thd_curr, struct comp_info *ci,
                  struct cos_cpu_local_info *cos_info, int timer_intr_context)
@@ -885,6 +1100,23 @@ timer_process(struct pt_regs *regs)
 	assert(thd_curr && thd_curr->cpuid == get_cpuid());
 	comp = thd_invstk_current(thd_curr, &ip, &sp, cos_info);
 	assert(comp);
+	cos_trace(COS_TRACE_TIMER, thd_curr->tid, 0);
+
+	/* The one-shot deadline has fired, so none is programmed anymore */
+	tcap_timers[get_cpuid()].deadline = 0;
+
+	/*
+	 * Nothing is due: the timer was disabled, or moved later, after
+	 * this interrupt was triggered. Re-arm for the real deadline.
+	 */
+	rdtscll(now);
+	cos_ipi_deferred_signal(get_cpuid());
+	if (unlikely(!cos_info->next_timer)) return 1;
+	if (unlikely(cos_info->next_timer > now + TIMER_COALESCE_SLACK)) {
+		tcap_timer_program(cos_info->next_timer);
+
+		return 1;
+	}
 
 	return expended_process(regs, thd_curr, comp, cos_info, 1);
 }
@@ -902,6 +1134,14 @@ cap_arcv_op(struct cap_arcv *arcv, struct thread *thd, struct pt_regs *regs, str
 	int                  all_pending = (!!(rflags & RCV_ALL_PENDING));
 
 	if (unlikely(arcv->thd != thd || arcv->cpuid != get_cpuid())) return -EINVAL;
+	cos_trace(COS_TRACE_ARCV, thd->tid, thd_rcvcap_pending(thd));
+	if (rflags & RCV_EVT_BATCH) {
+		if (thd_rcvcap_evt_batch_set(thd, ci->pgtblinfo.pgtbl, __userregs_get3(regs), __userregs_get4(regs))) {
+			return -EINVAL;
+		}
+	} else if (unlikely(thd->evt_batch.uaddr)) {
+		thd_rcvcap_evt_batch_set(thd, 0, 0, 0);
+	}
 
 	/* deliver pending notifications? */
 	if (thd_rcvcap_pending(thd)) {
@@ -971,6 +1211,51 @@ cap_introspect(struct captbl *ct, capid_t capid, u32_t op, unsigned long *retval
 		return tcap_introspect(((struct cap_tcap *)ch)->tcap, op, retval);
 	case CAP_ARCV:
 		return arcv_introspect(((struct cap_arcv *)ch), op, retval);
+	case CAP_CAPTBL:
+		return captbl_introspect(get_cpuid(), op, retval);
+	default:
+		return -EINVAL;
+	}
+}
+
+static int
+hw_numa_introspect(struct captbl *ct, unsigned long op, unsigned long arg1, unsigned long arg2)
+{
+	switch (op) {
+	case NUMA_GET_NNODES:
+		return chal_numa_nnodes();
+	case NUMA_GET_CPU_NODE:
+		return chal_numa_cpu_node((cpuid_t)arg1);
+	case NUMA_GET_VADDR_NODE:
+	case NUMA_GET_VADDR_EXTENT: {
+		struct cap_pgtbl *ptc = (struct cap_pgtbl *)captbl_lkup(ct, arg1);
+		paddr_t           frame, extent;
+		vaddr_t           order;
+		int               node;
+
+		if (!CAP_TYPECHK(ptc, CAP_PGTBL)) return -EINVAL;
+		if (pgtbl_get_cosframe(ptc->pgtbl, arg2, &frame, &order)) return -EINVAL;
+		/* the cosframe might be a superpage; we want the page at arg2 */
+		frame += arg2 & ((1UL << order) - 1) & PGTBL_FRAME_MASK;
+
+		node = chal_numa_pa_node(frame, &extent);
+		if (op == NUMA_GET_VADDR_NODE) return node;
+
+		if (extent <= frame) return 0;
+
+		return (int)((extent - frame) >> PAGE_ORDER);
+	}
+	case NUMA_GET_NODE_FREE:
+	case NUMA_GET_NODE_USED: {
+		long total, used;
+
+		if ((int)arg1 < 0 || (int)arg1 >= chal_numa_nnodes()) return -EINVAL;
+		total = chal_numa_node_pages(arg1);
+		used  = retypetbl_numa_pages(arg1, RETYPETBL_USER) + retypetbl_numa_pages(arg1, RETYPETBL_KERN);
+		if (op == NUMA_GET_NODE_USED) return used;
+
+		return total > used ? total - used : 0;
+	}
 	default:
 		return -EINVAL;
 	}
@@ -978,30 +1263,241 @@ cap_introspect(struct captbl *ct, capid_t capid, u32_t op, unsigned long *retval
 
 #define ENABLE_KERNEL_PRINT
 
-static int composite_syscall_slowpath(struct pt_regs *regs, int *thd_switch);
+static int composite_syscall_slowpath(struct pt_regs *regs, struct cap_header *ch, struct thread *thd,
+                                      struct comp_info *ci, struct cos_cpu_local_info *cos_info, int *thd_switch);
+static int composite_syscall_ops(struct pt_regs *regs, struct cap_header *ch, struct thread *thd,
+                                 struct comp_info *ci, struct cos_cpu_local_info *cos_info);
 
-COS_SYSCALL __attribute__((section("__ipc_entry"))) int
-composite_syscall_handler(struct pt_regs *regs)
+/*
+ * Execute a batch of capability operations (struct cos_capop) that
+ * lives in a single page of the invoking component.  Each operation
+ * is replayed through the slowpath as if it were its own system call.
+ * Only resource-table operations (on captbl and pgtbl capabilities)
+ * are allowed, as those never switch threads.  Returns the number of
+ * operations that completed successfully; the error of the operation
+ * that stopped the batch is in its ret field.
+ */
+static int
+cap_capop_batch(struct thread *thd, struct comp_info *ci, struct cos_cpu_local_info *cos_info, vaddr_t uaddr,
+                unsigned long nops)
+{
+	struct cos_capop *ops;
+	word_t            flags;
+	unsigned long     i;
+
+	if (unlikely(nops == 0 || nops > COS_CAPOP_BATCH_MAX)) return -EINVAL;
+	if (unlikely(round_to_page(uaddr) != round_to_page(uaddr + nops * sizeof(struct cos_capop) - 1))) return -EINVAL;
+	if (unlikely(uaddr % sizeof(word_t))) return -EINVAL;
+
+	ops = (struct cos_capop *)pgtbl_translate(ci->pgtblinfo.pgtbl, round_to_page(uaddr), &flags);
+	if (unlikely(!ops)) return -EFAULT;
+	if (unlikely((flags & (PGTBL_USER | PGTBL_WRITABLE)) != (PGTBL_USER | PGTBL_WRITABLE))) return -EFAULT;
+	ops = (struct cos_capop *)((vaddr_t)ops + (uaddr & (PAGE_SIZE - 1)));
+
+	for (i = 0; i < nops; i++) {
+		struct cos_capop  *o = &ops[i];
+		struct cap_header *ch;
+		struct pt_regs     r;
+		int                thd_switch = 0;
+		int                ret;
+
+		ch = captbl_lkup(ci->captbl, o->cap);
+		if (unlikely(!ch)) {
+			ret = -ENOENT;
+		} else if (unlikely((ch->type != CAP_CAPTBL && ch->type != CAP_PGTBL) || o->op == CAPTBL_OP_CAPOP_BATCH)) {
+			ret = -EINVAL;
+		} else {
+			__userregs_setcapop(&r, o->cap, o->op, o->args[0], o->args[1], o->args[2], o->args[3]);
+			ret = composite_syscall_slowpath(&r, ch, thd, ci, cos_info, &thd_switch);
+			assert(!thd_switch);
+		}
+		o->ret = ret;
+		if (ret < 0) break;
+	}
+
+	return i;
+}
+
+/*
+ * Copy len bytes at the kernel's src out to the invoking component at
+ * uaddr.  The user buffer can span pages, so each is translated.
+ */
+static int __attribute__((unused))
+cap_copy_out(struct comp_info *ci, vaddr_t uaddr, void *src, unsigned long len)
+{
+	unsigned long off;
+
+	for (off = 0; off < len;) {
+		vaddr_t       va  = uaddr + off;
+		unsigned long n   = PAGE_SIZE - (va & (PAGE_SIZE - 1));
+		word_t        flags;
+		char *        dst;
+
+		if (n > len - off) n = len - off;
+		dst = (char *)pgtbl_translate(ci->pgtblinfo.pgtbl, round_to_page(va), &flags);
+		if (unlikely(!dst)) return -EFAULT;
+		if (unlikely((flags & (PGTBL_USER | PGTBL_WRITABLE)) != (PGTBL_USER | PGTBL_WRITABLE))) return -EFAULT;
+		memcpy(dst + (va & (PAGE_SIZE - 1)), (char *)src + off, n);
+		off += n;
+	}
+
+	return 0;
+}
+
+/*
+ * Replenish a batch of child tcaps (struct cos_tcap_deleg) from src,
+ * in a single system call.  As with CAPTBL_OP_TCAP_TRANSFER, no
+ * thread is dispatched.  The batch lives in a single page of the
+ * invoking component.  Returns the number of delegations made; the
+ * error of the delegation that stopped the batch is in its ret field.
+ */
+static int
+cap_tcap_delegate_bulk(struct comp_info *ci, struct tcap *src, vaddr_t uaddr, unsigned long n)
 {
-	struct cap_header *ch;
-	struct thread *    thd;
-	capid_t            cap;
-	struct comp_info  *ci;
-	unsigned long      ip, sp;
+	struct cos_tcap_deleg *ds;
+	word_t                 flags;
+	unsigned long          i;
+
+	if (unlikely(n == 0 || n > COS_TCAP_DELEG_BULK_MAX)) return -EINVAL;
+	if (unlikely(round_to_page(uaddr) != round_to_page(uaddr + n * sizeof(struct cos_tcap_deleg) - 1))) return -EINVAL;
+	if (unlikely(uaddr % sizeof(word_t))) return -EINVAL;
+
+	ds = (struct cos_tcap_deleg *)pgtbl_translate(ci->pgtblinfo.pgtbl, round_to_page(uaddr), &flags);
+	if (unlikely(!ds)) return -EFAULT;
+	if (unlikely((flags & (PGTBL_USER | PGTBL_WRITABLE)) != (PGTBL_USER | PGTBL_WRITABLE))) return -EFAULT;
+	ds = (struct cos_tcap_deleg *)((vaddr_t)ds + (uaddr & (PAGE_SIZE - 1)));
+
+	for (i = 0; i < n; i++) {
+		struct cos_tcap_deleg *d = &ds[i];
+		struct cap_arcv *      rcv;
+		struct tcap *          tc;
+		long                   ret;
+
+		rcv = (struct cap_arcv *)captbl_lkup(ci->captbl, d->rcv);
+		if (unlikely(!CAP_TYPECHK_CORE(rcv, CAP_ARCV))) {
+			ret = -EINVAL;
+		} else {
+			tc = rcv->thd->rcvcap.rcvcap_tcap;
+			assert(tc);
+			ret = tcap_delegate(tc, src, d->res, d->prio) ? -EINVAL : 0;
+		}
+		d->ret = ret;
+		if (ret < 0) break;
+	}
+
+	return i;
+}
 
+/*
+ * Send on a batch of asnd capabilities (struct cos_asnd_snd) in a
+ * single system call.  The sends to other cores are enqueued in their
+ * IPI rings, and each of those cores is sent (at most) a single IPI
+ * once the batch is enqueued.  The local receivers are all made
+ * pending, and we switch at most once, to the highest priority of
+ * them if it is higher than the current tcap's.  The batch lives in a
+ * single page of the invoking component; each send's error is in its
+ * ret field, and doesn't stop the batch.
+ */
+static int
+cap_asnd_bulk(struct pt_regs *regs, struct thread *thd, struct comp_info *ci, struct cos_cpu_local_info *cos_info,
+              vaddr_t uaddr, unsigned long n, tcap_time_t timeout)
+{
+	struct cos_asnd_snd *ss;
+	struct thread *      next;
+	struct tcap *        tcap_next;
+	u32_t                ipi_cores[IPI_SUMMARY_WORDS] = { 0 };
+	word_t               flags;
+	unsigned long        i;
+	int                  curr_cpu = get_cpuid();
+
+	if (unlikely(n == 0 || n > COS_ASND_BULK_MAX)) return -EINVAL;
+	if (unlikely(round_to_page(uaddr) != round_to_page(uaddr + n * sizeof(struct cos_asnd_snd) - 1))) return -EINVAL;
+	if (unlikely(uaddr % sizeof(word_t))) return -EINVAL;
+
+	ss = (struct cos_asnd_snd *)pgtbl_translate(ci->pgtblinfo.pgtbl, round_to_page(uaddr), &flags);
+	if (unlikely(!ss)) return -EFAULT;
+	if (unlikely((flags & (PGTBL_USER | PGTBL_WRITABLE)) != (PGTBL_USER | PGTBL_WRITABLE))) return -EFAULT;
+	ss = (struct cos_asnd_snd *)((vaddr_t)ss + (uaddr & (PAGE_SIZE - 1)));
+
+	next      = thd;
+	tcap_next = tcap_current(cos_info);
+	assert(tcap_next);
+
+	for (i = 0; i < n; i++) {
+		struct cos_asnd_snd *s    = &ss[i];
+		struct cap_asnd *    asnd = (struct cap_asnd *)captbl_lkup(ci->captbl, s->snd);
+		struct cap_arcv *    arcv;
+		struct thread *      rcv_thd;
+		struct tcap *        rcv_tcap;
+
+		s->ret = -EINVAL;
+		if (unlikely(!CAP_TYPECHK(asnd, CAP_ASND))) continue;
+		assert(asnd->arcv_capid);
+
+		if (asnd->arcv_cpuid != curr_cpu) {
+			s->ret = cos_ipi_ring_enqueue(asnd->arcv_cpuid, asnd);
+			if (likely(!s->ret) && !cos_ipi_ratelimited(asnd)) ipi_cores[asnd->arcv_cpuid / 32] |= 1U << (asnd->arcv_cpuid % 32);
+			cos_trace(COS_TRACE_ASND, thd->tid, asnd->arcv_cpuid);
+			continue;
+		}
+
+		arcv = __cap_asnd_to_arcv(asnd);
+		if (unlikely(!arcv)) continue;
+		if (unlikely(arcv->cpuid != curr_cpu)) {
+			s->ret = cos_ipi_ring_enqueue(arcv->cpuid, asnd);
+			if (likely(!s->ret)) ipi_cores[arcv->cpuid / 32] |= 1U << (arcv->cpuid % 32);
+			continue;
+		}
+		rcv_thd  = arcv->thd;
+		rcv_tcap = rcv_thd->rcvcap.rcvcap_tcap;
+		assert(rcv_tcap);
+		cos_trace(COS_TRACE_ASND, thd->tid, rcv_thd->tid);
+
+		/* the highest priority of the receivers (and us) so far runs next */
+		next   = asnd_process(rcv_thd, next, rcv_tcap, tcap_next, &tcap_next, 0, cos_info);
+		s->ret = 0;
+	}
+
+	for (i = 0; i < IPI_SUMMARY_WORDS; i++) {
+		u32_t cores = ipi_cores[i];
+
+		while (cores) {
+			int b = __builtin_ctz(cores);
+
+			cores &= cores - 1;
+			cos_ipi_signal(i * 32 + b);
+		}
+	}
+
+	return cap_switch(regs, thd, next, tcap_next, timeout, ci, cos_info);
+}
+
+/*
+ * The system call entry.  This is kept to the synchronous invocation
+ * and return fast paths only: the capability is decoded straight
+ * from the registers, resolved with a single captbl walk, and the
+ * invocation stack is pushed or popped.  Every other capability
+ * operation is out-of-line in composite_syscall_ops so that its
+ * stack frame, register pressure and branches stay off of this
+ * path.
+ */
+static inline int
+composite_syscall_entry(struct pt_regs *regs)
+{
 	/*
 	 * We lookup this struct (which is on stack) only once, and
 	 * pass it into other functions to avoid redundant lookups.
 	 */
-	struct cos_cpu_local_info *cos_info   = cos_cpu_local_info();
-	int                        ret        = -ENOENT;
-	int                        thd_switch = 0;
-
-	cap = __userregs_getcap(regs);
-	thd = thd_current(cos_info);
+	struct cos_cpu_local_info *cos_info = cos_cpu_local_info();
+	struct thread *            thd      = thd_current(cos_info);
+	capid_t                    cap      = __userregs_getcap(regs);
+	struct cap_header *        ch;
+	struct comp_info *         ci;
+	unsigned long              ip, sp;
 
 	/* fast path: invocation return (avoiding captbl accesses) */
 	if (cap == COS_DEFAULT_RET_CAP) {
+		syscall_stats_misc(COS_SYSCALL_STAT_SRET);
 		/* No need to lookup captbl */
 		sret_ret(thd, regs, cos_info);
 		return 0;
@@ -1020,18 +1516,52 @@ composite_syscall_handler(struct pt_regs *regs)
 	 * because it's guaranteed by component quiescence period,
 	 * which is at timer tick granularity.
 	 */
-	ch = captbl_lkup(ci->captbl, cap);
-	if (unlikely(!ch)) {
-		printk("cos: cap %d not found!\n", (int)cap);
-		cos_throw(done, 0);
-	}
+	ch = captbl_lkup_cached(ci->captbl, cap, cos_info->cpuid);
 
 	/* fastpath: invocation */
-	if (likely(ch->type == CAP_SINV)) {
+	if (likely(ch && ch->type == CAP_SINV)) {
+		syscall_stats_type(CAP_SINV);
 		sinv_call(thd, (struct cap_sinv *)ch, regs, cos_info);
 		return 0;
 	}
 
+	return composite_syscall_ops(regs, ch, thd, ci, cos_info);
+}
+
+COS_SYSCALL __attribute__((section("__ipc_entry"))) int
+composite_syscall_handler(struct pt_regs *regs)
+{
+#if COS_SYSCALL_STATS
+	cycles_t start = syscall_stats_begin();
+	int      ret   = composite_syscall_entry(regs);
+
+	syscall_stats_end(start);
+
+	return ret;
+#else
+	return composite_syscall_entry(regs);
+#endif
+}
+
+/*
+ * Everything that isn't an invocation or return.  The capability has
+ * already been looked up by the entry path, so it is passed in along
+ * with the current component to avoid redundant lookups.
+ */
+static int __attribute__((noinline))
+composite_syscall_ops(struct pt_regs *regs, struct cap_header *ch, struct thread *thd, struct comp_info *ci,
+                      struct cos_cpu_local_info *cos_info)
+{
+	int ret        = -ENOENT;
+	int thd_switch = 0;
+
+	if (unlikely(!ch)) {
+		syscall_stats_misc(COS_SYSCALL_STAT_NOCAP);
+		printk("cos: cap %d not found!\n", (int)__userregs_getcap(regs));
+		cos_throw(done, 0);
+	}
+	syscall_stats_type(ch->type);
+
 	/*
 	 * Some less common, but still optimized cases:
 	 * thread dispatch, asnd and arcv operations.
@@ -1055,9 +1585,9 @@ composite_syscall_handler(struct pt_regs *regs)
 	}
 
 	/* slowpath restbl (captbl and pgtbl) operations */
-	ret = composite_syscall_slowpath(regs, &thd_switch);
+	ret = composite_syscall_slowpath(regs, ch, thd, ci, cos_info, &thd_switch);
 	if (ret < 0) cos_throw(done, ret);
-	
+
 	if (thd_switch) return ret;
 done:
 	/*
@@ -1075,17 +1605,14 @@ done:
  * slowpath: other capability operations, most of which
  * involve updating the resource tables.
  */
-static int __attribute__((noinline)) composite_syscall_slowpath(struct pt_regs *regs, int *thd_switch)
+static int __attribute__((noinline))
+composite_syscall_slowpath(struct pt_regs *regs, struct cap_header *ch, struct thread *thd, struct comp_info *ci,
+                           struct cos_cpu_local_info *cos_info, int *thd_switch)
 {
-	struct cap_header *        ch;
-	struct captbl *            ct;
-	struct thread *            thd;
-	capid_t                    cap, capin;
-	syscall_op_t               op;
-	int                        ret      = -ENOENT;
-	struct cos_cpu_local_info *cos_info = cos_cpu_local_info();
-	struct comp_info          *ci;
-	unsigned long              ip, sp;
+	struct captbl *ct;
+	capid_t        cap, capin;
+	syscall_op_t   op;
+	int            ret = -ENOENT;
 
 	/*
 	 * These variables are:
@@ -1098,17 +1625,12 @@ static int __attribute__((noinline)) composite_syscall_slowpath(struct pt_regs *
 	 * op:     operation to perform on the capability
 	 */
 
-	thd   = thd_current(cos_info);
 	cap   = __userregs_getcap(regs);
 	capin = __userregs_get1(regs);
-
-	ci = thd_invstk_current(thd, &ip, &sp, cos_info);
-	assert(ci && ci->captbl);
-	ct = ci->captbl;
-
-	ch = captbl_lkup(ct, cap);
-	assert(ch);
-	op = __userregs_getop(regs);
+	ct    = ci->captbl;
+	op    = __userregs_getop(regs);
+	assert(ch && ct);
+	syscall_stats_op(op);
 
 	switch (ch->type) {
 	case CAP_CAPTBL: {
@@ -1137,8 +1659,9 @@ static int __attribute__((noinline)) composite_syscall_slowpath(struct pt_regs *
 				newct = captbl_create((void *)kmem_addr);
 				assert(newct);
 			} else {
-				captbl_init((void *)kmem_addr, 1);
-				captbl_init((void *)(kmem_addr + PAGE_SIZE / 2), 1);
+				int i;
+
+				for (i = 0; i < CAPTBL_PAGE_NLEAVES; i++) captbl_init((void *)(kmem_addr + i * CAPTBL_LEAF_BYTES), 1);
 			}
 
 			ret = captbl_activate(ct, cap, newcaptbl_cap, (struct captbl *)kmem_addr, captbl_lvl);
@@ -1199,21 +1722,19 @@ static int __attribute__((noinline)) composite_syscall_slowpath(struct pt_regs *
 
 			struct thread     *thd;
 			unsigned long     *pte = NULL;
-			struct ulk_invstk *ulstk = NULL;
-			struct cap_ulk    *ulkc;
+			struct cap_ulk    *ulkc = NULL;
+
+			if (ulk_cap) {
+				ulkc = (struct cap_ulk *)captbl_lkup(ct, ulk_cap);
+				if (!CAP_TYPECHK(ulkc, CAP_ULK) || ulkc->frozen_ts) cos_throw(err, -EINVAL);
+			}
 
 			ret = cap_kmem_activate(ct, pgtbl_cap, pgtbl_addr, (unsigned long *)&thd, &pte);
 			if (unlikely(ret)) cos_throw(err, ret);
 			assert(thd && pte);
 
-			if (ulk_cap) {
-				ulkc = (struct cap_ulk *)captbl_lkup(ct, ulk_cap);
-				if (!CAP_TYPECHK(ulkc, CAP_ULK)) cos_throw(err, -EINVAL);
-				ulstk = &((struct ulk_invstk *)(ulkc->kern_addr))[tid % ULK_STACKS_PER_PAGE];
-			}
-			
 			/* ret is returned by the overall function */
-			ret = thd_activate(ct, cap, thd_cap, thd, compcap, init_data, tid, ulstk);
+			ret = thd_activate(ct, cap, thd_cap, thd, compcap, init_data, tid, ulkc);
 			if (ret) kmem_unalloc(pte);
 
 			break;
@@ -1353,6 +1874,35 @@ static int __attribute__((noinline)) composite_syscall_slowpath(struct pt_regs *
 			if (ret) cos_throw(err, -EINVAL);
 			break;
 		}
+		case CAPTBL_OP_THDMIGRATE: {
+			capid_t thd_cap = __userregs_get1(regs);
+			cpuid_t cpu     = __userregs_get2(regs);
+
+			ret = thd_migrate(op_cap->captbl, thd_cap, cpu, thd);
+			break;
+		}
+		case CAPTBL_OP_THD_INVSTK_ACTIVATE: {
+			capid_t            thd_cap = __userregs_get1(regs);
+			capid_t            ptcap   = __userregs_get2(regs);
+			vaddr_t            kaddr   = __userregs_get3(regs);
+			struct invstk_ext *ext;
+			unsigned long     *pte;
+
+			ret = cap_kmem_activate(ct, ptcap, kaddr, (unsigned long *)&ext, &pte);
+			if (ret) cos_throw(err, ret);
+
+			ret = thd_invstk_ext_activate(op_cap->captbl, thd_cap, ext);
+			if (ret) kmem_unalloc(pte);
+			break;
+		}
+		case CAPTBL_OP_THD_INVSTK_DEACTIVATE: {
+			capid_t thd_cap       = __userregs_get1(regs);
+			capid_t pgtbl_cap     = __userregs_get2(regs);
+			capid_t cosframe_addr = __userregs_get3(regs);
+
+			ret = thd_invstk_ext_deactivate(op_cap->captbl, thd_cap, pgtbl_cap, cosframe_addr, thd);
+			break;
+		}
 		case CAPTBL_OP_THDDEACTIVATE_ROOT: {
 			livenessid_t lid           = __userregs_get2(regs);
 			capid_t      pgtbl_cap     = __userregs_get3(regs);
@@ -1410,8 +1960,10 @@ static int __attribute__((noinline)) composite_syscall_slowpath(struct pt_regs *
 		case CAPTBL_OP_ASNDACTIVATE: {
 			capid_t rcv_captbl = __userregs_get2(regs);
 			capid_t rcv_cap    = __userregs_get3(regs);
+			/* The IPI rate limit: the window (in usec) above the maximum number of IPIs in it */
+			word_t  ipilimit   = __userregs_get4(regs);
 
-			ret = asnd_activate(ct, cap, capin, rcv_captbl, rcv_cap);
+			ret = asnd_activate(ct, cap, capin, rcv_captbl, rcv_cap, ipilimit >> 16, ipilimit & 0xFFFF);
 			break;
 		}
 		case CAPTBL_OP_ASNDDEACTIVATE: {
@@ -1435,6 +1987,15 @@ static int __attribute__((noinline)) composite_syscall_slowpath(struct pt_regs *
 			ret = arcv_deactivate(op_cap, capin, lid);
 			break;
 		}
+		case CAPTBL_OP_ARCVMIGRATE: {
+			capid_t thd_cap   = (__userregs_get2(regs) << 16) >> 16;
+			capid_t tcap_cap  = __userregs_get2(regs) >> 16;
+			capid_t sched_cap = __userregs_get3(regs);
+			cpuid_t cpu       = __userregs_get4(regs);
+
+			ret = arcv_migrate(op_cap->captbl, capin, thd_cap, tcap_cap, sched_cap, cpu, thd);
+			break;
+		}
 		case CAPTBL_OP_CPY: {
 			capid_t from_captbl = cap;
 			capid_t from_cap    = __userregs_get1(regs);
@@ -1445,18 +2006,29 @@ static int __attribute__((noinline)) composite_syscall_slowpath(struct pt_regs *
 			break;
 		}
 		case CAPTBL_OP_CONS: {
-			capid_t cons_addr = __userregs_get2(regs);
+			capid_t       cons_addr = __userregs_get2(regs);
+			unsigned long npages    = __userregs_get3(regs);
 
-			ret = cap_cons(ct, cap, capin, cons_addr);
+			/* npages consecutive captbl pages in one call, or just the one */
+			if (npages > 1) {
+				ret = captbl_cons_n(ct, cap, capin, cons_addr, npages);
+			} else {
+				ret = cap_cons(ct, cap, capin, cons_addr);
+			}
 			break;
 		}
 		case CAPTBL_OP_DECONS: {
-			capid_t decons_addr = __userregs_get2(regs);
-			capid_t lvl         = __userregs_get3(regs);
+			capid_t       decons_addr = __userregs_get2(regs);
+			capid_t       lvl         = __userregs_get3(regs);
+			unsigned long npages      = __userregs_get4(regs);
 
 			/* FIXME: adding liveness id here. */
 
-			ret = cap_decons(ct, cap, capin, decons_addr, lvl);
+			if (npages > 1) {
+				ret = captbl_decons_n(ct, cap, capin, decons_addr, lvl, npages);
+			} else {
+				ret = cap_decons(ct, cap, capin, decons_addr, lvl);
+			}
 
 			break;
 		}
@@ -1498,6 +2070,23 @@ static int __attribute__((noinline)) composite_syscall_slowpath(struct pt_regs *
 			ret = hw_deactivate(op_cap, capin, lid);
 			break;
 		}
+		case CAPTBL_OP_ASND_BULK: {
+			vaddr_t       uaddr   = __userregs_get1(regs);
+			unsigned long n       = __userregs_get2(regs);
+			tcap_time_t   timeout = __userregs_get3(regs);
+
+			ret = cap_asnd_bulk(regs, thd, ci, cos_info, uaddr, n, timeout);
+			if (unlikely(ret < 0)) cos_throw(err, ret);
+			*thd_switch = 1;
+			break;
+		}
+		case CAPTBL_OP_CAPOP_BATCH: {
+			vaddr_t       uaddr = __userregs_get1(regs);
+			unsigned long nops  = __userregs_get2(regs);
+
+			ret = cap_capop_batch(thd, ci, cos_info, uaddr, nops);
+			break;
+		}
 		case CAPTBL_OP_ULK_MEMACTIVATE: {
 			capid_t      ulkcap   = __userregs_get1(regs) >> 16;
 			livenessid_t lid      = __userregs_get1(regs) & 0xFFFF;
@@ -1516,6 +2105,15 @@ static int __attribute__((noinline)) composite_syscall_slowpath(struct pt_regs *
 			if (ret) kmem_unalloc(pte);
 			break;
 		}
+		case CAPTBL_OP_ULK_MEMDEACTIVATE: {
+			capid_t      ulkcap        = __userregs_get1(regs) >> 16;
+			livenessid_t lid           = __userregs_get1(regs) & 0xFFFF;
+			capid_t      pgtbl_cap     = __userregs_get2(regs);
+			vaddr_t      cosframe_addr = __userregs_get3(regs);
+
+			ret = ulk_deactivate(op_cap, ulkcap, pgtbl_cap, cosframe_addr, lid);
+			break;
+		}
 		default:
 			goto err;
 		}
@@ -1536,6 +2134,17 @@ static int __attribute__((noinline)) composite_syscall_slowpath(struct pt_regs *
 			ret = cap_cpy(ct, dest_pt, dest_addr, source_pt, source_addr, flags);
 			break;
 		}
+		case CAPTBL_OP_CPY_N: {
+			capid_t       source_pt   = pt;
+			vaddr_t       source_addr = __userregs_get1(regs);
+			capid_t       dest_pt     = __userregs_get2(regs) & 0xFFFF;
+			unsigned long npages      = __userregs_get2(regs) >> 16;
+			vaddr_t       dest_addr   = __userregs_get3(regs);
+			word_t        flags       = __userregs_get4(regs);
+
+			ret = cap_cpy_n(ct, dest_pt, dest_addr, source_pt, source_addr, npages, flags);
+			break;
+		}
 		case CAPTBL_OP_MEMMOVE: {
 			/* Moves a mem frame to another pgtbl. Used to
 			 * grant frames to memory management
@@ -1549,6 +2158,27 @@ static int __attribute__((noinline)) composite_syscall_slowpath(struct pt_regs *
 
 			break;
 		}
+		case CAPTBL_OP_MEMGRANT: {
+			/*
+			 * Grant npages at source_addr in this pgtbl
+			 * to the server of this thread's next sinv,
+			 * at dest_addr in its pgtbl.  The pages are
+			 * unmapped when that sinv returns.
+			 */
+			struct cap_pgtbl *ptc         = (struct cap_pgtbl *)ch;
+			vaddr_t           source_addr = __userregs_get1(regs);
+			vaddr_t           dest_addr   = __userregs_get2(regs);
+			unsigned long     npages      = __userregs_get3(regs);
+			word_t            flags       = __userregs_get4(regs);
+
+			if (ptc->lvl != 0) cos_throw(err, -EINVAL);
+			ret = thd_grant_set(&thd->grant, ptc->pgtbl, source_addr, dest_addr, npages, flags);
+			if (ret) cos_throw(err, ret);
+			if (thd->grant.state == THD_GRANT_PENDING) thd->state |= THD_STATE_GRANT;
+			else thd->state &= ~THD_STATE_GRANT;
+
+			break;
+		}
 		case CAPTBL_OP_CONS: {
 			vaddr_t pte_cap   = __userregs_get1(regs);
 			vaddr_t cons_addr = __userregs_get2(regs);
@@ -1565,6 +2195,15 @@ static int __attribute__((noinline)) composite_syscall_slowpath(struct pt_regs *
 
 			break;
 		}
+		case CAPTBL_OP_EPT_DIRTY: {
+			vaddr_t       gpa    = __userregs_get1(regs);
+			unsigned long npages = __userregs_get2(regs);
+			vaddr_t       uaddr  = __userregs_get3(regs);
+
+			ret = cap_ept_dirty(ci, (struct cap_pgtbl *)ch, gpa, npages, uaddr);
+
+			break;
+		}
 		case CAPTBL_OP_MEMACTIVATE: {
 			/* This takes cosframe as input and constructs mapping in pgtbl. */
 			capid_t frame_cap = __userregs_get1(regs);
@@ -1583,6 +2222,8 @@ static int __attribute__((noinline)) composite_syscall_slowpath(struct pt_regs *
 			if (((struct cap_pgtbl *)ch)->lvl) cos_throw(err, -EINVAL);
 
 			ret = pgtbl_mapping_del(((struct cap_pgtbl *)ch)->pgtbl, addr, lid);
+			/* a device must not reach the page once it can be reused */
+			if (!ret) chal_iommu_pgtbl_flush((struct cap_pgtbl *)ch, 0);
 
 			break;
 		}
@@ -1679,6 +2320,23 @@ static int __attribute__((noinline)) composite_syscall_slowpath(struct pt_regs *
 
 			break;
 		}
+		case CAPTBL_OP_TCAP_DELEGATE_BULK: {
+			vaddr_t          uaddr   = __userregs_get1(regs);
+			unsigned long    n       = __userregs_get2(regs);
+			struct cap_tcap *tcapsrc = (struct cap_tcap *)ch;
+
+			ret = cap_tcap_delegate_bulk(ci, tcapsrc->tcap, uaddr, n);
+			if (unlikely(ret < 0)) cos_throw(err, ret);
+
+			if (tcap_expended(tcap_current(cos_info))) {
+				ret = expended_process(regs, thd, ci, cos_info, 0);
+				if (unlikely(ret < 0)) cos_throw(err, ret);
+
+				*thd_switch = 1;
+			}
+
+			break;
+		}
 		case CAPTBL_OP_TCAP_DELEGATE: {
 			capid_t          asnd_cap    = __userregs_get1(regs);
 			long long        res         = __userregs_get2(regs);
@@ -1765,6 +2423,17 @@ static int __attribute__((noinline)) composite_syscall_slowpath(struct pt_regs *
 			goto err;
 		}
 	}
+	case CAP_VM_VMCB: {
+		switch (op) {
+		case CAPTBL_OP_VM_VCPU_NOTIFY: {
+			ret = vm_vmcb_notify((struct cap_vm_vmcb *)ch);
+			break;
+		}
+		default:
+			goto err;
+		}
+		break;
+	}
 	case CAP_HW: {
 		switch (op) {
 		case CAPTBL_OP_HW_ATTACH: {
@@ -1778,6 +2447,34 @@ static int __attribute__((noinline)) composite_syscall_slowpath(struct pt_regs *
 			ret = hw_attach_rcvcap((struct cap_hw *)ch, hwid, rcvc, rcvcap);
 			break;
 		}
+		case CAPTBL_OP_HW_MSI_BIND: {
+			struct cap_arcv *rcvc;
+			hwid_t           hwid   = __userregs_get1(regs);
+			capid_t          rcvcap = __userregs_get2(regs);
+
+			rcvc = (struct cap_arcv *)captbl_lkup(ci->captbl, rcvcap);
+			if (!CAP_TYPECHK(rcvc, CAP_ARCV)) cos_throw(err, -EINVAL);
+
+			ret = hw_msi_bind((struct cap_hw *)ch, hwid, rcvc, rcvcap);
+			break;
+		}
+		case CAPTBL_OP_HW_IOMMU_BIND: {
+			u16_t             bdf   = __userregs_get1(regs);
+			capid_t           ptcap = __userregs_get2(regs);
+			struct cap_pgtbl *ptc;
+
+			ptc = (struct cap_pgtbl *)captbl_lkup(ci->captbl, ptcap);
+			if (!CAP_TYPECHK(ptc, CAP_PGTBL)) cos_throw(err, -EINVAL);
+
+			ret = chal_iommu_bind(bdf, ptc);
+			break;
+		}
+		case CAPTBL_OP_HW_IOMMU_UNBIND: {
+			u16_t bdf = __userregs_get1(regs);
+
+			ret = chal_iommu_unbind(bdf);
+			break;
+		}
 		case CAPTBL_OP_HW_DETACH: {
 			hwid_t hwid = __userregs_get1(regs);
 
@@ -1831,11 +2528,11 @@ static int __attribute__((noinline)) composite_syscall_slowpath(struct pt_regs *
 			break;
 		}
 		case CAPTBL_OP_HW_L1FLUSH: {
-			ret = chal_l1flush();
+			ret = chal_l1flush(__userregs_get1(regs), __userregs_get2(regs));
 			break;
 		}
 		case CAPTBL_OP_HW_TLBFLUSH: {
-			ret = chal_tlbflush(0);
+			ret = chal_tlbflush(__userregs_get1(regs), __userregs_get2(regs));
 			break;
 		}
 		case CAPTBL_OP_HW_TLBSTALL: {
@@ -1846,6 +2543,153 @@ static int __attribute__((noinline)) composite_syscall_slowpath(struct pt_regs *
 			ret = chal_tlbstall_recount(0);
 			break;
 		}
+		case CAPTBL_OP_HW_NUMA: {
+			ret = hw_numa_introspect(ci->captbl, __userregs_get1(regs), __userregs_get2(regs),
+			                         __userregs_get3(regs));
+			break;
+		}
+		case CAPTBL_OP_HW_IRQ_COALESCE: {
+			hwid_t hwid         = __userregs_get1(regs);
+			u32_t  count_thresh = __userregs_get2(regs);
+			u32_t  usec_thresh  = __userregs_get3(regs);
+
+			ret = hw_irq_coalesce((struct cap_hw *)ch, hwid, count_thresh, usec_thresh);
+			break;
+		}
+		case CAPTBL_OP_HW_IRQ_POLL: {
+			hwid_t hwid    = __userregs_get1(regs);
+			int    polling = __userregs_get2(regs);
+
+			ret = hw_irq_poll((struct cap_hw *)ch, hwid, polling);
+			break;
+		}
+		case CAPTBL_OP_HW_IRQ_REARM: {
+			hwid_t hwid = __userregs_get1(regs);
+
+			ret = hw_irq_rearm((struct cap_hw *)ch, hwid);
+			break;
+		}
+		case CAPTBL_OP_HW_TRACE_MAP: {
+			cpuid_t       cpu     = __userregs_get1(regs) >> 16;
+			unsigned long pgidx   = __userregs_get1(regs) & 0xFFFF;
+			capid_t       kmem_pt = __userregs_get2(regs) >> 16;
+			capid_t       ptcap   = __userregs_get2(regs) & 0xFFFF;
+			vaddr_t       kaddr   = __userregs_get3(regs);
+			vaddr_t       uaddr   = __userregs_get4(regs);
+
+			ret = trace_ring_map(ci->captbl, cpu, pgidx, kmem_pt, kaddr, ptcap, uaddr);
+			break;
+		}
+		case CAPTBL_OP_HW_TRACE_MASK: {
+			ret = (int)trace_mask_set(__userregs_get1(regs));
+			break;
+		}
+		case CAPTBL_OP_HW_SYSCALL_STATS: {
+#if COS_SYSCALL_STATS
+			vaddr_t       uaddr = __userregs_get1(regs);
+			unsigned long len   = __userregs_get2(regs);
+
+			if (len < sizeof(syscall_stats)) cos_throw(err, -EINVAL);
+			ret = cap_copy_out(ci, uaddr, syscall_stats, sizeof(syscall_stats));
+			if (!ret) ret = NUM_CPU;
+#else
+			ret = -ENOENT;
+#endif
+			break;
+		}
+		case CAPTBL_OP_HW_TOPOLOGY: {
+			vaddr_t       uaddr = __userregs_get1(regs);
+			unsigned long len   = __userregs_get2(regs);
+
+			if (len < sizeof(struct cos_topology)) cos_throw(err, -EINVAL);
+			ret = cap_copy_out(ci, uaddr, chal_topology(), sizeof(struct cos_topology));
+			break;
+		}
+		case CAPTBL_OP_HW_ACCT_MAP: {
+			unsigned long pgidx   = __userregs_get1(regs);
+			capid_t       kmem_pt = __userregs_get2(regs) >> 16;
+			capid_t       ptcap   = __userregs_get2(regs) & 0xFFFF;
+			vaddr_t       kaddr   = __userregs_get3(regs);
+			vaddr_t       uaddr   = __userregs_get4(regs);
+
+			ret = thd_acct_map(ci->captbl, pgidx, kmem_pt, kaddr, ptcap, uaddr);
+			break;
+		}
+		case CAPTBL_OP_HW_TIME_MAP: {
+			capid_t kmem_pt = __userregs_get1(regs) >> 16;
+			capid_t ptcap   = __userregs_get1(regs) & 0xFFFF;
+			vaddr_t kaddr   = __userregs_get2(regs);
+			vaddr_t uaddr   = __userregs_get3(regs);
+
+			ret = clock_page_map(ci->captbl, kmem_pt, kaddr, ptcap, uaddr);
+			break;
+		}
+		case CAPTBL_OP_HW_IRQ_STATS: {
+			hwid_t        hwid = __userregs_get1(regs);
+			unsigned long what = __userregs_get2(regs);
+
+			ret = hw_irq_stats((struct cap_hw *)ch, hwid, what);
+			break;
+		}
+		case CAPTBL_OP_HW_PGFLT: {
+			unsigned long what = __userregs_get1(regs);
+			unsigned long arg  = __userregs_get2(regs);
+
+			switch (what) {
+			case HW_PGFLT_ATTACH:
+				ret = cap_pgflt_attach(ci->captbl, arg);
+				break;
+			case HW_PGFLT_INFO: {
+				struct pgflt_core *pc = &pgflt_cores[get_cpuid()];
+
+				if (thd != pc->handler) cos_throw(err, -EINVAL);
+				ret = cap_copy_out(ci, arg, &pc->info, sizeof(struct cos_pgflt));
+				break;
+			}
+			case HW_PGFLT_RESUME:
+				ret = cap_pgflt_resume(regs, thd, ci, cos_info);
+				if (ret >= 0) *thd_switch = 1;
+				break;
+			case HW_PGFLT_ABORT:
+				ret = cap_pgflt_abort(regs, thd, arg, ci, cos_info);
+				if (ret >= 0) *thd_switch = 1;
+				break;
+			case HW_PGFLT_PGTBL_ID: {
+				struct cap_pgtbl *ptc = (struct cap_pgtbl *)captbl_lkup(ci->captbl, arg);
+
+				if (!CAP_TYPECHK(ptc, CAP_PGTBL)) cos_throw(err, -EINVAL);
+				ret = (unsigned long)ptc->pgtbl / PAGE_SIZE;
+				break;
+			}
+			default:
+				cos_throw(err, -EINVAL);
+			}
+			break;
+		}
+		case CAPTBL_OP_HW_PMU: {
+			unsigned long what = __userregs_get1(regs);
+			unsigned long arg  = __userregs_get2(regs);
+			unsigned long evt  = __userregs_get3(regs);
+
+			switch (what) {
+			case HW_PMU_NCOUNTERS:
+				ret = pmu_ngp;
+				break;
+			case HW_PMU_PROGRAM:
+				ret = pmu_program(&thd->pmu, arg, evt);
+				break;
+			case HW_PMU_DISABLE:
+				pmu_disable(&thd->pmu);
+				ret = 0;
+				break;
+			case HW_PMU_SAMPLE:
+				ret = pmu_sample_set(arg);
+				break;
+			default:
+				cos_throw(err, -EINVAL);
+			}
+			break;
+		}
 		default:
 			goto err;
 		}
@@ -2,6 +2,9 @@
 #include "include/captbl.h"
 #include "include/cap_ops.h"
 
+struct captbl_lkup_cache captbl_lkup_caches[NUM_CPU] CACHE_ALIGNED;
+u32_t                    captbl_lkup_epoch;
+
 /*
  * Add the capability table to itself at cap.  This should really only
  * be used at boot time to create the initial bootable components.
@@ -113,13 +116,13 @@ err:
 int
 captbl_cons(struct cap_captbl *target_ct, struct cap_captbl *cons_cap, capid_t cons_addr)
 {
-	int   ret;
+	int   ret, i;
 	u32_t l;
-	void *captbl_mem;
+	char *captbl_mem;
 
 	if (target_ct->h.type != CAP_CAPTBL || target_ct->lvl != 0) cos_throw(err, -EINVAL);
 	if (cons_cap->h.type != CAP_CAPTBL || cons_cap->lvl != 1) cos_throw(err, -EINVAL);
-	captbl_mem = (void *)cons_cap->captbl;
+	captbl_mem = (char *)cons_cap->captbl;
 	l          = cons_cap->refcnt_flags;
 	if ((l & CAP_MEM_FROZEN_FLAG) || (target_ct->refcnt_flags & CAP_MEM_FROZEN_FLAG)) cos_throw(err, -EINVAL);
 	if ((l & CAP_REFCNT_MAX) == CAP_REFCNT_MAX) cos_throw(err, -EOVERFLOW);
@@ -127,26 +130,19 @@ captbl_cons(struct cap_captbl *target_ct, struct cap_captbl *cons_cap, capid_t c
 	/* increment refcnt */
 	if (cos_cas_32((u32_t *)&(cons_cap->refcnt_flags), l, l + 1) != CAS_SUCCESS) cos_throw(err, -ECASFAIL);
 
-	/*
-	 * FIXME: we are expanding the entire page to
-	 * two of the locations. Do we want separate
-	 * calls for them?
-	 */
-	ret = captbl_expand(target_ct->captbl, cons_addr, captbl_maxdepth(), captbl_mem);
-	if (ret) {
-		printk("first captbl_expand @ %d returns %d\n", cons_addr, ret);
-		cos_faa((int *)&cons_cap->refcnt_flags, -1);
-		cos_throw(err, ret);
-	}
-
-	ret = captbl_expand(target_ct->captbl, cons_addr + (PAGE_SIZE / (2 * CAPTBL_LEAFSZ)), captbl_maxdepth(),
-	                    &((char *)captbl_mem)[PAGE_SIZE / 2]);
-	if (ret) {
-		printk("second captbl_expand returns %d\n", ret);
-		/* Rewind. */
-		captbl_expand(target_ct->captbl, cons_addr, captbl_maxdepth(), NULL);
-		cos_faa((int *)&cons_cap->refcnt_flags, -1);
-		cos_throw(err, ret);
+	/* Each of the leaves in the page covers the next span of capids */
+	for (i = 0; i < CAPTBL_PAGE_NLEAVES; i++) {
+		ret = captbl_expand(target_ct->captbl, cons_addr + (i << CAPTBL_LEAF_ORD), captbl_maxdepth(),
+		                    &captbl_mem[i * CAPTBL_LEAF_BYTES]);
+		if (ret) {
+			printk("captbl_expand of leaf %d @ %d returns %d\n", i, cons_addr, ret);
+			/* Rewind. */
+			for (i--; i >= 0; i--) {
+				captbl_expand(target_ct->captbl, cons_addr + (i << CAPTBL_LEAF_ORD), captbl_maxdepth(), NULL);
+			}
+			cos_faa((int *)&cons_cap->refcnt_flags, -1);
+			cos_throw(err, ret);
+		}
 	}
 
 	return 0;
@@ -154,31 +150,26 @@ err:
 	return ret;
 }
 
-
 int
 captbl_decons(struct cap_header *head, struct cap_header *sub, capid_t pruneid, unsigned long lvl)
 {
 	unsigned long *    intern, old_v;
 	u32_t l;
+	int   i;
 	struct cap_captbl *ct = (struct cap_captbl *)head;
 
 	if (lvl <= ct->lvl) return -EINVAL;
-	intern = captbl_lkup_lvl(ct->captbl, pruneid, ct->lvl, lvl);
-	if (!intern) return -ENOENT;
-	old_v = *intern;
-
-	if (old_v == 0) return -ENOENT; /* return an error here? */
-	/* commit; note that 0 is "no entry" in both pgtbl and captbl */
-	if (cos_cas(intern, old_v, 0) != CAS_SUCCESS) return -ECASFAIL;
 
-	/* FIXME: we are removing two half pages for captbl. */
-	intern = captbl_lkup_lvl(ct->captbl, pruneid + (PAGE_SIZE / 2 / CAPTBL_LEAFSZ), ct->lvl, lvl);
-	if (!intern) return -ENOENT;
+	/* Remove all of the leaves of the page */
+	for (i = 0; i < CAPTBL_PAGE_NLEAVES; i++) {
+		intern = captbl_lkup_lvl(ct->captbl, pruneid + (i << CAPTBL_LEAF_ORD), ct->lvl, lvl);
+		if (!intern) return -ENOENT;
+		old_v = *intern;
 
-	old_v = *intern;
-	if (old_v == 0) return -ENOENT; /* return an error here? */
-	/* commit; note that 0 is "no entry" in both pgtbl and captbl */
-	if (cos_cas(intern, old_v, 0) != CAS_SUCCESS) return -ECASFAIL;
+		if (old_v == 0) return -ENOENT; /* return an error here? */
+		/* commit; note that 0 is "no entry" in both pgtbl and captbl */
+		if (cos_cas(intern, old_v, 0) != CAS_SUCCESS) return -ECASFAIL;
+	}
 
 	/* decrement the refcnt */
 	ct = (struct cap_captbl *)sub;
@@ -189,6 +180,58 @@ captbl_decons(struct cap_header *head, struct cap_header *sub, capid_t pruneid,
 	return 0;
 }
 
+/*
+ * Expand the captbl at cap with npages pages at once; the i-th page
+ * is that of the captbl capability at capsub + i *
+ * captbl_idsize(CAP_CAPTBL), and covers the capids from cons_addr + i
+ * * CAPTBL_PAGE_NCAPS.  Either all of the pages are added, or none.
+ */
+int
+captbl_cons_n(struct captbl *t, capid_t cap, capid_t capsub, capid_t cons_addr, unsigned long npages)
+{
+	struct cap_header *ch;
+	unsigned long      i;
+	int                ret = 0;
+
+	if (unlikely(npages == 0 || npages > COS_CAPTBL_CONS_MAX)) return -EINVAL;
+	ch = captbl_lkup(t, cap);
+	if (unlikely(!ch || ch->type != CAP_CAPTBL)) return -EINVAL;
+
+	for (i = 0; i < npages; i++) {
+		ret = cap_cons(t, cap, capsub + i * captbl_idsize(CAP_CAPTBL), cons_addr + i * CAPTBL_PAGE_NCAPS);
+		if (ret) break;
+	}
+	if (!ret) return 0;
+
+	/* Rewind. */
+	while (i-- > 0) {
+		cap_decons(t, cap, capsub + i * captbl_idsize(CAP_CAPTBL), cons_addr + i * CAPTBL_PAGE_NCAPS, 1);
+	}
+
+	return ret;
+}
+
+/* The reverse of captbl_cons_n; stops at the first page that can't be removed. */
+int
+captbl_decons_n(struct captbl *t, capid_t cap, capid_t capsub, capid_t pruneid, unsigned long lvl,
+                unsigned long npages)
+{
+	struct cap_header *ch;
+	unsigned long      i;
+	int                ret;
+
+	if (unlikely(npages == 0 || npages > COS_CAPTBL_CONS_MAX)) return -EINVAL;
+	ch = captbl_lkup(t, cap);
+	if (unlikely(!ch || ch->type != CAP_CAPTBL)) return -EINVAL;
+
+	for (i = 0; i < npages; i++) {
+		ret = cap_decons(t, cap, capsub + i * captbl_idsize(CAP_CAPTBL), pruneid + i * CAPTBL_PAGE_NCAPS, lvl);
+		if (ret) return ret;
+	}
+
+	return 0;
+}
+
 static int
 captbl_leaflvl_scan(struct captbl *ct)
 {
@@ -0,0 +1,132 @@
+#include "include/clock.h"
+#include "include/cap_ops.h"
+#include "include/pgtbl.h"
+
+#define NSEC_PER_SEC 1000000000ULL
+
+/* The clock, copied into the page (once mapped) on each update */
+static struct cos_time_page  clock_state;
+static struct cos_time_page *clock_page;
+static u64_t                 clock_rtc_sec;
+static cycles_t              clock_rtc_tsc;
+/* The updates are made from any core, with interrupts disabled */
+static unsigned long clock_lock;
+
+static void
+clock_lock_take(void)
+{
+	while (cos_cas(&clock_lock, 0, 1) != CAS_SUCCESS)
+		;
+}
+
+static void
+clock_lock_release(void)
+{
+	cos_mem_fence();
+	clock_lock = 0;
+}
+
+/* The seqlock write side, under the lock */
+static void
+clock_publish(void)
+{
+	struct cos_time_page *p = clock_page;
+
+	if (!p) return;
+
+	p->seq++;
+	cos_wmb();
+	p->shift        = clock_state.shift;
+	p->mult         = clock_state.mult;
+	p->realtime_ns  = clock_state.realtime_ns;
+	p->cyc_per_usec = clock_state.cyc_per_usec;
+	cos_wmb();
+	p->seq++;
+}
+
+static void
+clock_realtime_update(void)
+{
+	if (!clock_state.mult || !clock_rtc_sec) return;
+
+	clock_state.realtime_ns = clock_rtc_sec * NSEC_PER_SEC
+	                          - cos_time_cyc2ns(clock_rtc_tsc, clock_state.mult, clock_state.shift);
+}
+
+/*
+ * mult is ns per cycle, as a fixed-point value with shift fractional
+ * bits: the most precise with mult < 2^32, so shift is 32 for clocks
+ * of at least 1GHz.
+ */
+void
+clock_calibrate(u64_t ns, u64_t cycles)
+{
+	u32_t shift = 32;
+	u64_t mult;
+
+	assert(ns > 0 && ns < (1ULL << 32) && cycles > 0);
+
+	do {
+		mult = (ns << shift) / cycles;
+	} while (mult >= (1ULL << 32) && --shift > 0);
+
+	clock_lock_take();
+	clock_state.shift        = shift;
+	clock_state.mult         = mult;
+	clock_state.cyc_per_usec = (u32_t)((cycles * 1000) / ns);
+	clock_realtime_update();
+	clock_publish();
+	clock_lock_release();
+}
+
+void
+clock_realtime(u64_t epoch_sec, cycles_t tsc)
+{
+	clock_lock_take();
+	clock_rtc_sec = epoch_sec;
+	clock_rtc_tsc = tsc;
+	clock_realtime_update();
+	clock_publish();
+	clock_lock_release();
+}
+
+/*
+ * Use the kernel memory at kaddr (in kmem_pt) as the clock's page,
+ * mapped read-only at uaddr in ptcap.  Other components alias the
+ * mapping.
+ */
+int
+clock_page_map(struct captbl *t, capid_t kmem_pt, vaddr_t kaddr, capid_t ptcap, vaddr_t uaddr)
+{
+	struct cap_pgtbl *ptc;
+	unsigned long     kmem, *pte;
+	int               ret;
+
+	if (clock_page) return -EEXIST;
+
+	ptc = (struct cap_pgtbl *)captbl_lkup(t, ptcap);
+	if (!CAP_TYPECHK(ptc, CAP_PGTBL)) return -EINVAL;
+
+	ret = cap_kmem_activate(t, kmem_pt, kaddr, &kmem, &pte);
+	if (ret) return ret;
+	memset((void *)kmem, 0, PAGE_SIZE);
+
+	ret = pgtbl_mapping_add(ptc->pgtbl, uaddr, chal_va2pa((void *)kmem), PGTBL_PRESENT | PGTBL_USER | PGTBL_ACCESSED,
+	                        PAGE_ORDER);
+	if (ret) {
+		kmem_unalloc(pte);
+		return ret;
+	}
+
+	clock_lock_take();
+	if (clock_page) {
+		clock_lock_release();
+		/* the user mapping stays, but the page is never written */
+		return -EEXIST;
+	}
+	clock_page = (struct cos_time_page *)kmem;
+	clock_publish();
+	clock_lock_release();
+
+	return 0;
+}
@@ -0,0 +1,98 @@
+#ifndef ACCT_H
+#define ACCT_H
+
+#include "shared/cos_types.h"
+#include "captbl.h"
+#include "chal/cpuid.h"
+
+/*
+ * The kernel addresses of the thread accounting pages (see struct
+ * cos_thd_acct), each set once it is mapped into the scheduler.
+ * Accounting for a thread whose page isn't mapped is skipped.
+ */
+extern struct cos_thd_acct *thd_acct_pages[COS_THD_ACCT_PAGES];
+
+int thd_acct_map(struct captbl *t, unsigned long pgidx, capid_t kmem_pt, vaddr_t kaddr, capid_t ptcap, vaddr_t uaddr);
+
+static inline struct cos_thd_acct *
+thd_acct(thdid_t tid)
+{
+	struct cos_thd_acct *p = thd_acct_pages[tid / COS_THD_ACCT_PAGE_NENTS];
+
+	if (!p) return NULL;
+
+	return &p[tid % COS_THD_ACCT_PAGE_NENTS];
+}
+
+/* The seqlock write side; each entry has a single writer */
+static inline void
+thd_acct_begin(struct cos_thd_acct *a)
+{
+	a->seq++;
+	cos_wmb();
+}
+
+static inline void
+thd_acct_end(struct cos_thd_acct *a)
+{
+	cos_wmb();
+	a->seq++;
+}
+
+/*
+ * tid executed for cycles, consumed from the tcap of tcap_tid (or 0),
+ * up to the core's last accounting
+ */
+static inline void
+thd_acct_exec(thdid_t tid, thdid_t tcap_tid, cycles_t cycles)
+{
+	struct cos_thd_acct *a = thd_acct(tid);
+
+	if (a) {
+		thd_acct_begin(a);
+		a->cycles += cycles;
+		a->since = cos_cpu_local_info()->cycles;
+		a->cpu   = get_cpuid();
+		if (tcap_tid == tid) a->tcap_cycles += cycles;
+		thd_acct_end(a);
+	}
+	if (!tcap_tid || tcap_tid == tid) return;
+
+	a = thd_acct(tcap_tid);
+	if (!a) return;
+	thd_acct_begin(a);
+	a->tcap_cycles += cycles;
+	thd_acct_end(a);
+}
+
+static inline void
+thd_acct_switch(thdid_t tid)
+{
+	struct cos_thd_acct *a = thd_acct(tid);
+
+	if (!a) return;
+	thd_acct_begin(a);
+	a->switches++;
+	/* its execution is accounted from the core's last accounting */
+	a->since = cos_cpu_local_info()->cycles;
+	a->cpu   = get_cpuid();
+	thd_acct_end(a);
+}
+
+/* A new thread reuses tid: start its accounting from zero */
+static inline void
+thd_acct_reset(thdid_t tid)
+{
+	struct cos_thd_acct *a = thd_acct(tid);
+
+	if (!a) return;
+	thd_acct_begin(a);
+	a->cycles      = 0;
+	a->tcap_cycles = 0;
+	a->switches    = 0;
+	a->since       = 0;
+	a->cpu         = get_cpuid();
+	thd_acct_end(a);
+}
+
+#endif /* ACCT_H */
@@ -31,6 +31,10 @@
 #endif
 #define CAPTBL_LEAFSZ (sizeof(struct cap_min))
 #define CAPTBL_LEAF_ORD 7 /* log(PAGE_SIZE/(2*CAPTBL_LEAFSZ)) */
+/* A second-level captbl page is this many leaves, spanning CAPTBL_PAGE_NCAPS capids */
+#define CAPTBL_LEAF_BYTES ((1 << CAPTBL_LEAF_ORD) * CAPTBL_LEAFSZ)
+#define CAPTBL_PAGE_NLEAVES ((int)(PAGE_SIZE / CAPTBL_LEAF_BYTES))
+#define CAPTBL_PAGE_NCAPS (CAPTBL_PAGE_NLEAVES << CAPTBL_LEAF_ORD)
 
 #ifdef CAP_FREE
 #undef CAP_FREE
@@ -246,7 +250,93 @@ captbl_lkup_lvl(struct captbl *t, capid_t cap, u32_t start_lvl, u32_t end_lvl)
 static inline struct cap_header *
 captbl_lkup(struct captbl *t, capid_t cap)
 {
-	return captbl_lkup_lvl(t, cap, 0, CAPTBL_DEPTH + 1);
+	cap &= __captbl_maxid() - 1; /* Assume: 2s complement math */
+	return __captbl_lkupl(t, cap, NULL);
+}
+
+/*
+ * A small, per-core, direct-mapped cache of resolved capabilities in
+ * front of the trie walk, used by the system call entry.  Entries are
+ * tagged with the captbl and capability id, and with the global
+ * lookup epoch at the time they were filled.  Any operation that can
+ * remove a capability or a captbl node (captbl_del, captbl_prune,
+ * cap_move, and kmem_deact_pre when kernel memory is released) bumps
+ * the epoch, thus invalidating all cached entries on all cores
+ * without cross-core communication.  Only successful lookups are
+ * cached.
+ */
+#define CAPTBL_LKUP_CACHE_ORD 4
+#define CAPTBL_LKUP_CACHE_SZ (1 << CAPTBL_LKUP_CACHE_ORD)
+
+struct captbl_lkup_cache_ent {
+	struct captbl *    ct;
+	capid_t            cap;
+	struct cap_header *h;
+	u32_t              epoch;
+};
+
+struct captbl_lkup_cache {
+	struct captbl_lkup_cache_ent ents[CAPTBL_LKUP_CACHE_SZ];
+	unsigned long                hits, misses;
+} CACHE_ALIGNED;
+
+extern struct captbl_lkup_cache captbl_lkup_caches[NUM_CPU];
+extern u32_t                    captbl_lkup_epoch;
+
+static inline void
+captbl_lkup_cache_invalidate(void)
+{
+	cos_faa((int *)&captbl_lkup_epoch, 1);
+}
+
+/* 64B capabilities are at every 4th id, so fold the higher bits into the index */
+static inline unsigned long
+__captbl_lkup_cache_idx(capid_t cap)
+{
+	return (cap ^ (cap >> 2)) & (CAPTBL_LKUP_CACHE_SZ - 1);
+}
+
+static inline struct cap_header *
+captbl_lkup_cached(struct captbl *t, capid_t cap, cpuid_t cpu)
+{
+	struct captbl_lkup_cache *    c = &captbl_lkup_caches[cpu];
+	struct captbl_lkup_cache_ent *e = &c->ents[__captbl_lkup_cache_idx(cap)];
+	u32_t                         epoch;
+	struct cap_header *           h;
+
+	/* read the epoch *before* the walk so that a racing invalidation is not lost */
+	epoch = *(volatile u32_t *)&captbl_lkup_epoch;
+	if (likely(e->ct == t && e->cap == cap && e->epoch == epoch)) {
+		c->hits++;
+		return e->h;
+	}
+	c->misses++;
+
+	h = captbl_lkup(t, cap);
+	if (likely(h)) {
+		e->ct    = t;
+		e->cap   = cap;
+		e->h     = h;
+		e->epoch = epoch;
+	}
+
+	return h;
+}
+
+static inline int
+captbl_introspect(cpuid_t cpu, unsigned long op, unsigned long *retval)
+{
+	switch (op) {
+	case CAPTBL_GET_LKUP_HITS:
+		*retval = captbl_lkup_caches[cpu].hits;
+		break;
+	case CAPTBL_GET_LKUP_MISSES:
+		*retval = captbl_lkup_caches[cpu].misses;
+		break;
+	default:
+		return -EINVAL;
+	}
+	return 0;
 }
 
 static inline int
@@ -421,6 +511,7 @@ captbl_del(struct captbl *t, capid_t cap, cap_t type, livenessid_t lid)
 	}
 
 	if (CTSTORE(h, (u32_t *)&l, (u32_t *)&o)) cos_throw(err, -EEXIST); /* commit */
+	captbl_lkup_cache_invalidate();
 err:
 	return ret;
 }
@@ -467,6 +558,7 @@ captbl_prune(struct captbl *t, capid_t cap, u32_t depth, int *retval)
 	p   = *intern;
 	new = (unsigned long)CT_DEFINITVAL;
 	if (CTSTORE(intern, (u32_t*)&new, (u32_t *)&p)) cos_throw(err, -EEXIST); /* commit */
+	captbl_lkup_cache_invalidate();
 done:
 	*retval = ret;
 	return (void *)p;
@@ -503,6 +595,10 @@ int captbl_activate_boot(struct captbl *t, unsigned long cap);
 
 int captbl_cons(struct cap_captbl *target_ct, struct cap_captbl *cons_cap, capid_t cons_addr);
 int captbl_decons(struct cap_header *head, struct cap_header *sub, capid_t pruneid, unsigned long lvl);
+/* Bulk versions over npages second-level captbl capabilities at consecutive capids from capsub */
+int captbl_cons_n(struct captbl *t, capid_t cap, capid_t capsub, capid_t cons_addr, unsigned long npages);
+int captbl_decons_n(struct captbl *t, capid_t cap, capid_t capsub, capid_t pruneid, unsigned long lvl,
+                    unsigned long npages);
 int captbl_kmem_scan(struct cap_captbl *cap);
 
 static void
@@ -511,6 +607,7 @@ cap_init(void)
 	assert(sizeof(struct cap_captbl) <= __captbl_cap2bytes(CAP_CAPTBL));
 	assert(((1 << CAPTBL_LEAF_ORD) * CAPTBL_LEAFSZ + CAPTBL_INTERNSZ * (1 << CAPTBL_INTERN_ORD)) == PAGE_SIZE);
 	assert(CAPTBL_EXPAND_SZ == 1 << CAPTBL_LEAF_ORD);
+	assert(CAPTBL_PAGE_NLEAVES * CAPTBL_LEAF_BYTES == PAGE_SIZE);
 }
 
 #endif /* CAPTBL_H */
\ No newline at end of file
@@ -82,6 +82,24 @@ PERCPU_DECL(struct cap_arcv *, cos_timer_arcv);
 int          chal_cyc_usec(void);
 unsigned int chal_cyc_thresh(void);
 
+/* NUMA topology from the firmware (a single node 0 without it) */
+int           chal_numa_nnodes(void);
+int           chal_numa_cpu_node(cpuid_t cpu);
+int           chal_numa_pa_node(paddr_t pa, paddr_t *extent);
+unsigned long chal_numa_node_pages(int node);
+/* The processor topology, complete once all of the cores booted */
+struct cos_topology *chal_topology(void);
+
+/* Mask and unmask an external interrupt line (by its vector) */
+void chal_irq_mask(int irq);
+void chal_irq_unmask(int irq);
+/*
+ * The destination to program in a device's MSI address so that its
+ * message with vector irq is delivered to cpu (the local APIC id on
+ * x86), or < 0 if irq can't be raised by MSI.
+ */
+int chal_irq_msi_dest(int irq, cpuid_t cpu);
+
 int chal_attempt_arcv(struct cap_arcv *arcv);
 int chal_attempt_ainv(struct async_cap *acap);
 
@@ -0,0 +1,17 @@
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include "shared/cos_types.h"
+#include "captbl.h"
+
+/*
+ * The kernel's clock (see struct cos_time_page): the platform
+ * calibrates the TSC against its timer (ns nanoseconds took cycles),
+ * and reads the wall-clock time (at the tsc time stamp), once each,
+ * and the clock is published in the page once it is mapped.
+ */
+void clock_calibrate(u64_t ns, u64_t cycles);
+void clock_realtime(u64_t epoch_sec, cycles_t tsc);
+int  clock_page_map(struct captbl *t, capid_t kmem_pt, vaddr_t kaddr, capid_t ptcap, vaddr_t uaddr);
+
+#endif /* CLOCK_H */
@@ -55,6 +55,8 @@ comp_activate(struct captbl *t, capid_t cap, capid_t capin, capid_t captbl_cap,
 
 	compc = (struct cap_comp *)__cap_capactivate_pre(t, cap, capin, CAP_COMP, &ret);
 	if (!compc) cos_throw(undo_ctc, ret);
+	/* Tag the page-table with a PCID so invocations don't flush the TLB */
+	if (!PROTDOM_ASID(protdom)) protdom |= PROTDOM_INIT(pgtbl_asid_alloc(), 0);
 	compc->entry_addr             = entry_addr;
 	compc->info.pgtblinfo.pgtbl   = ptc->pgtbl;
 	compc->info.pgtblinfo.protdom = protdom;
@@ -80,6 +82,7 @@ comp_deactivate(struct cap_captbl *ct, capid_t capin, livenessid_t lid)
 	struct cap_comp *  compc;
 	struct cap_pgtbl * pgd;
 	struct cap_captbl *ct_top;
+	u16_t              asid;
 
 	compc = (struct cap_comp *)captbl_lkup(ct->captbl, capin);
 	if (compc->h.type != CAP_COMP) return -EINVAL;
@@ -87,10 +90,13 @@ comp_deactivate(struct cap_captbl *ct, capid_t capin, livenessid_t lid)
 	ltbl_expire(&compc->info.liveness);
 	pgd    = compc->pgd;
 	ct_top = compc->ct_top;
+	asid   = PROTDOM_ASID(compc->info.pgtblinfo.protdom);
 
 	ret = cap_capdeactivate(ct, capin, CAP_COMP, lid);
 	if (ret) return ret;
 
+	pgtbl_asid_free(asid);
+
 	/* decrement the refcnt of the pgd, and top level of
 	 * captbl. */
 	cos_faa((int *)&pgd->refcnt_flags, -1);
@@ -197,6 +197,12 @@ ert_definit(struct ert_intern *a, int leaf)
 		                    last_sz, initval, initfn, getfn, isnullfn, setfn, allocfn, setleaffn, getleaffn,  \
 		                    resolvefn);                                                                       \
 	}                                                                                                             \
+	static inline void *name##_lkupl(struct structname *v, unsigned long id, void *accum)                         \
+	{                                                                                                             \
+		return __ert_lookup_leaf((struct ert *)v, id, accum, depth, order, intern_sz, last_order, last_sz,    \
+		                         initval, initfn, getfn, isnullfn, setfn, allocfn, setleaffn, getleaffn,      \
+		                         resolvefn);                                                                  \
+	}                                                                                                             \
 	static inline int name##_expandni(struct structname *v, unsigned long id, u32_t dstart, u32_t dlimit,         \
 	                                  void *accum, void *memctxt, void *data)                                     \
 	{                                                                                                             \
@@ -348,6 +354,47 @@ __ert_lookup(struct ert *v, unsigned long id, u32_t dstart, u32_t dlimit, void *
 	return n;
 }
 
+/*
+ * The maximum depth of the tries __ert_lookup_leaf walks.
+ */
+#define ERT_MAX_DEPTH 4
+#define ERT_WALK_LVL(lvl)                                                  \
+	if (depth >= (lvl)) {                                              \
+		if (unlikely(isnullfn(n, accum, 0))) return NULL;          \
+		n = __ert_walk(n, id, accum, (lvl), ERT_CONST_ARGS);      \
+	}
+
+/*
+ * The lookup of the leaf value of an id (that of __ert_lookup with
+ * dstart = 0, and dlimit = depth + 1), for the hot paths (e.g. the
+ * capability lookups of the system calls). Rather than relying on the
+ * compiler to unroll __ert_lookup's loop, and to remove its depth
+ * checks, each level is explicitly walked, and those above the
+ * (constant) depth are removed as dead code. There is no prefetching
+ * of the next level: its address is the value loaded at this one.
+ */
+static inline CFORCEINLINE void *
+__ert_lookup_leaf(struct ert *v, unsigned long id, void *accum, ERT_CONST_PARAMS)
+{
+	struct ert_intern r, *n;
+
+	assert(v);
+	assert(id < __ert_maxid(ERT_CONST_ARGS));
+	assert(depth >= 1 && depth <= ERT_MAX_DEPTH);
+
+	r.next = v->vect;
+	n      = &r;
+	/* From the root level (depth) down to the leaves (1) */
+	ERT_WALK_LVL(4)
+	ERT_WALK_LVL(3)
+	ERT_WALK_LVL(2)
+	ERT_WALK_LVL(1)
+	if (unlikely(!resolvefn(n, accum, 1, last_order, last_sz))) return NULL;
+
+	return getleaffn(n, accum);
+}
+#undef ERT_WALK_LVL
+
 /*
  * Expand the data-structure starting from level/depth dstart, and up
  * to and including some depth limit (dlimit).  This will call the
@@ -14,6 +14,10 @@ PERCPU_EXTERN(fpu_disabled);
 PERCPU_DECL(struct thread *, fpu_last_used);
 PERCPU_EXTERN(fpu_last_used);
 
+/* FPU enabled on behalf of fpu_last_used while another thread runs in an FPU-free component */
+PERCPU_DECL(int, fpu_deferred);
+PERCPU_EXTERN(fpu_deferred);
+
 enum
 {
 	FPU_DISABLE = 0,
@@ -25,6 +29,8 @@ static inline int  fpu_init(void);
 static inline int  fpu_disabled_exception_handler(void);
 static inline void fpu_thread_init(struct thread *thd);
 static inline int  fpu_switch(struct thread *next);
+static inline void fpu_inv_update(prot_domain_t protdom);
+static inline void fpu_thread_release(struct thread *thd);
 static inline void fpu_save(struct thread *);
 static inline void fpu_restore(struct thread *);
 
@@ -33,6 +39,7 @@ static inline void fpu_enable(void);
 static inline void fpu_disable(void);
 static inline int  fpu_is_disabled(void);
 static inline int  fpu_thread_uses_fp(struct thread *thd);
+static inline int  fpu_thread_nofpu(struct thread *thd);
 
 /* packed low level (assemmbly) functions */
 static inline void          fxsave(struct thread *);
@@ -95,6 +102,7 @@ fpu_init(void)
 	fpu_set(FPU_DISABLE);
 	*PERCPU_GET(fpu_disabled)  = 1;
 	*PERCPU_GET(fpu_last_used) = NULL;
+	*PERCPU_GET(fpu_deferred)  = 0;
 
 #if FPU_SUPPORT_FXSR > 0
 	int fxsr = fpu_check_fxsr();
@@ -168,7 +176,8 @@ fpu_set(int status)
 static inline int
 fpu_disabled_exception_handler(void)
 {
-	struct thread *curr_thd;
+	struct thread **last_used = PERCPU_GET(fpu_last_used);
+	struct thread  *curr_thd;
 	curr_thd = cos_get_curr_thd();
 	assert(curr_thd != NULL);
 
@@ -176,7 +185,13 @@ fpu_disabled_exception_handler(void)
 	if(!fpu_is_disabled()) return 0;
 
 	curr_thd->fpu.status = 1;
-	fpu_switch(curr_thd);
+	fpu_enable();
+	/* the registers still hold our state if no one else used the fpu since */
+	if (*last_used == curr_thd) return 1;
+
+	if (*last_used) fpu_save(*last_used);
+	fpu_restore(curr_thd);
+	*last_used = curr_thd;
 
 	return 1;
 }
@@ -185,8 +200,10 @@ static inline void
 fpu_thread_init(struct thread *thd)
 {
 	memset(&thd->fpu, 0, sizeof(struct cos_fpu));
+#if FPU_SUPPORT_XSAVES
 	/* Have to set bit 63 of xcomp_bv to 1, or it will cause a #GP */
 	thd->fpu.xcomp_bv |= ((u64_t)1 << 63);
+#endif
 	thd->fpu.cwd = 0x37f;
 #if FPU_SUPPORT_SSE > 0
 	/* 
@@ -198,43 +215,72 @@ fpu_thread_init(struct thread *thd)
 	return;
 }
 
+/*
+ * The fpu state is switched lazily: it stays in the registers until
+ * another thread uses the fpu, and only then is it saved to
+ * fpu_last_used, and next's restored, on the #NM
+ * (fpu_disabled_exception_handler). A switch only has to make sure
+ * that the fpu is enabled for its owner and disabled for everyone
+ * else.
+ */
 static inline int
 fpu_switch(struct thread *next)
 {
 	struct thread **last_used = PERCPU_GET(fpu_last_used);
-	/* if next thread doesn't use fpu, then we just disable the fpu */
-	if (!fpu_thread_uses_fp(next)) {
-		fpu_disable();
+	int            *deferred  = PERCPU_GET(fpu_deferred);
+
+	if (*last_used == next) {
+		*deferred = 0;
+		fpu_enable();
 		return 0;
 	}
 
-	fpu_enable();
 	/*
-	 * next thread uses fpu
-	 * if no thread used fpu before, then we set next thread as the fpu_last_used
+	 * An FPU-free component never touches the fpu registers, so
+	 * we skip all fpu work (including the cr0 write) until the
+	 * thread invokes out of it (fpu_inv_update).
 	 */
-	if (unlikely(*last_used == NULL)) goto store;
-
-	/*
-	 * next thread uses fpu
-	 * fpu_last_used exists
-	 * if fpu_last_used == next, then we simply re-enable the fpu for the thread
-	 */
-	if (*last_used == next) return 0;
+	if (fpu_thread_nofpu(next)) {
+		*deferred = !fpu_is_disabled();
+		return 0;
+	}
 
-	/*
-	 * next thread uses fpu
-	 * fpu_last_used exists
-	 * if fpu_last_used != next, then we save current fpu states to fpu_last_used, restore next thread's fpu state
-	 */
-	fpu_save(*last_used);
-store:
-	fpu_restore(next);
-	*last_used = next;
+	*deferred = 0;
+	fpu_disable();
 
 	return 0;
 }
 
+/* Invocation into, or return to, the component with protdom */
+static inline void
+fpu_inv_update(prot_domain_t protdom)
+{
+	int *deferred = PERCPU_GET(fpu_deferred);
+
+	if (likely(!*deferred) || PROTDOM_NOFPU(protdom)) return;
+
+	*deferred = 0;
+	fpu_disable();
+}
+
+/*
+ * thd (not the current thread) is leaving this core, so write back
+ * its fpu state if the registers still hold it.
+ */
+static inline void
+fpu_thread_release(struct thread *thd)
+{
+	struct thread **last_used = PERCPU_GET(fpu_last_used);
+
+	if (*last_used != thd) return;
+
+	fpu_enable();
+	fpu_save(thd);
+	*last_used                = NULL;
+	*PERCPU_GET(fpu_deferred) = 0;
+	fpu_disable();
+}
+
 static inline void
 fpu_enable(void)
 {
@@ -252,6 +298,16 @@ fpu_thread_uses_fp(struct thread *thd)
 	return thd->fpu.status;
 }
 
+/* Is thd (the current thread) executing in a component declared FPU-free? */
+static inline int
+fpu_thread_nofpu(struct thread *thd)
+{
+	/* user-level invocations switch components behind the kernel's back */
+	if (thd->ulk_invstk) return 0;
+
+	return PROTDOM_NOFPU(thd_invstk_entry(thd, curr_invstk_top(cos_cpu_local_info()))->comp_info.pgtblinfo.protdom);
+}
+
 static inline void
 fxsave(struct thread *thd)
 {
@@ -296,11 +352,40 @@ xrestors(struct thread *thd)
 #endif
 }
 
+static inline void
+xsaveopt(struct thread *thd)
+{
+#ifdef __x86_64__
+	asm volatile("xsaveopt64 %0" : "=m"(thd->fpu): "a"(0x7), "d"(0):"memory");
+#else
+	asm volatile("xsaveopt %0" : "=m"(thd->fpu): "a"(0x7), "d"(0):"memory");
+#endif
+}
+
+static inline void
+xrestor(struct thread *thd)
+{
+#ifdef __x86_64__
+	asm volatile("xrstor64 %0" : :"m"(thd->fpu), "a"(0x7), "d"(0):"memory");
+#else
+	asm volatile("xrstor %0" : :"m"(thd->fpu), "a"(0x7), "d"(0):"memory");
+#endif
+}
+
+/*
+ * Both xsaves (compacted) and xsaveopt skip the state components
+ * that are in their initial configuration, or that weren't modified
+ * since the xrstor(s) from the same area. As the lazy switch always
+ * saves the thread whose state was last restored, only the dirty
+ * state is written back.
+ */
 static inline void
 fpu_save(struct thread *thd)
 {
 #if FPU_SUPPORT_XSAVES
 	xsaves(thd);
+#elif FPU_SUPPORT_XSAVEOPT
+	xsaveopt(thd);
 #else
 	fxsave(thd);
 #endif
@@ -311,6 +396,8 @@ fpu_restore(struct thread *thd)
 {
 #if FPU_SUPPORT_XSAVES
 	xrestors(thd);
+#elif FPU_SUPPORT_XSAVEOPT
+	xrestor(thd);
 #else
 	fxrstor(thd);
 #endif
@@ -341,6 +428,16 @@ fpu_switch(struct thread *next)
 	return 0;
 }
 static inline void
+fpu_inv_update(prot_domain_t protdom)
+{
+	return;
+}
+static inline void
+fpu_thread_release(struct thread *thd)
+{
+	return;
+}
+static inline void
 fpu_enable(void)
 {
 	return;
@@ -350,6 +447,11 @@ fpu_thread_uses_fp(struct thread *thd)
 {
 	return 0;
 }
+static inline int
+fpu_thread_nofpu(struct thread *thd)
+{
+	return 0;
+}
 static inline void
 fxsave(struct thread *thd)
 {
@@ -0,0 +1,119 @@
+#ifndef GRANT_H
+#define GRANT_H
+
+#include "shared/cos_types.h"
+#include "pgtbl.h"
+
+typedef enum {
+	THD_GRANT_NONE = 0,
+	THD_GRANT_PENDING, /* mapped into the server on the next sinv */
+	THD_GRANT_ACTIVE,  /* mapped, until the sret from invstk depth */
+} thd_grant_state_t;
+
+/*
+ * A thread's page grant (CAPTBL_OP_MEMGRANT).  The frames granted are
+ * tracked so that the revoke only removes the mappings that the grant
+ * made, even if the server has changed its page-table in the meantime.
+ */
+struct thd_grant {
+	thd_grant_state_t state;
+	u16_t             depth;
+	u16_t             npages;
+	word_t            flags; /* of the server's mappings */
+	pgtbl_t           src, dst;
+	vaddr_t           src_addr, dst_addr;
+	paddr_t           frames[COS_GRANT_MAX_PAGES];
+};
+
+static inline int
+thd_grant_set(struct thd_grant *g, pgtbl_t src, vaddr_t src_addr, vaddr_t dst_addr, unsigned long npages,
+              cos_grant_flags_t flags)
+{
+	if (unlikely(g->state == THD_GRANT_ACTIVE)) return -EBUSY;
+	/* zero pages cancels a pending grant */
+	if (npages == 0) {
+		g->state = THD_GRANT_NONE;
+		return 0;
+	}
+	if (unlikely(npages > COS_GRANT_MAX_PAGES)) return -EINVAL;
+	if (unlikely((src_addr | dst_addr) & (PAGE_SIZE - 1))) return -EINVAL;
+
+	g->src      = src;
+	g->src_addr = src_addr;
+	g->dst_addr = dst_addr;
+	g->npages   = npages;
+	g->flags    = PGTBL_PRESENT | PGTBL_USER | PGTBL_ACCESSED;
+	if (flags & COS_GRANT_WRITE) g->flags |= PGTBL_WRITABLE | PGTBL_MODIFIED;
+	g->state = THD_GRANT_PENDING;
+
+	return 0;
+}
+
+/*
+ * Map the pending grant into dst, the page-table of the server at
+ * invocation stack depth.  The grant is consumed whether or not this
+ * succeeds.  The server's entries weren't present, so no TLB holds
+ * them.
+ */
+static inline int
+thd_grant_map(struct thd_grant *g, pgtbl_t dst, u16_t depth)
+{
+	word_t        flags, req;
+	unsigned long i;
+	void         *kaddr;
+	int           ret = -EINVAL;
+
+	assert(g->state == THD_GRANT_PENDING);
+	g->state = THD_GRANT_NONE;
+	if (unlikely(dst == g->src)) return -EINVAL;
+
+	/* only user pages the granting page-table can itself access that way */
+	req = PGTBL_PRESENT | PGTBL_USER | (g->flags & PGTBL_WRITABLE);
+	for (i = 0; i < g->npages; i++) {
+		kaddr = (void *)pgtbl_translate(g->src, g->src_addr + i * PAGE_SIZE, &flags);
+		if (unlikely(!kaddr || (flags & req) != req)) {
+			ret = -EFAULT;
+			goto undo;
+		}
+		g->frames[i] = chal_va2pa(kaddr);
+
+		ret = pgtbl_mapping_add(dst, g->dst_addr + i * PAGE_SIZE, g->frames[i], g->flags, PAGE_ORDER);
+		if (unlikely(ret)) goto undo;
+	}
+	g->dst   = dst;
+	g->depth = depth;
+	g->state = THD_GRANT_ACTIVE;
+
+	return 0;
+undo:
+	while (i-- > 0) pgtbl_mapping_revoke(dst, g->dst_addr + i * PAGE_SIZE, g->frames[i]);
+
+	return ret;
+}
+
+/*
+ * Remove the active grant.  On a return from the server, its
+ * page-table is the current one, so only the granted pages are
+ * invalidated and, with PCIDs, the TLB entries of every other address
+ * space are kept.  Other cores running the server may cache the pages
+ * until their next flush; the frames can't be retyped until TLB
+ * quiescence, so this only extends the server's access to the
+ * caller's own memory.
+ */
+static inline void
+thd_grant_revoke(struct thd_grant *g)
+{
+	unsigned long i;
+	int           curr = pgtbl_current() == g->dst;
+
+	assert(g->state == THD_GRANT_ACTIVE);
+	for (i = 0; i < g->npages; i++) {
+		/* the server might have removed the mapping itself */
+		pgtbl_mapping_revoke(g->dst, g->dst_addr + i * PAGE_SIZE, g->frames[i]);
+	}
+	if (likely(curr)) chal_tlb_range_inval(g->dst_addr, g->npages * PAGE_SIZE);
+	else              chal_flush_tlb();
+	g->state = THD_GRANT_NONE;
+}
+
+#endif /* GRANT_H */
@@ -17,8 +17,29 @@
 #define HW_IRQ_EXTERNAL_MIN 32
 #define HW_IRQ_EXTERNAL_MAX 63
 
+#define HW_IRQ_EXTERNAL_NUM (HW_IRQ_EXTERNAL_MAX - HW_IRQ_EXTERNAL_MIN + 1)
+/* The external vectors past the 8259 lines, only raised by MSI(-X) messages */
+#define HW_IRQ_MSI_MIN HW_ID17
+#define HW_IRQ_MSI_MAX HW_ID31
+
 extern struct cap_asnd hw_asnd_caps[HW_IRQ_TOTAL];
 
+/*
+ * Per-line interrupt moderation.  An interrupt is only delivered to
+ * the attached asnd once count_thresh have arrived, or time_thresh
+ * cycles have passed since the last delivery; the rest are
+ * suppressed.  In polling mode, each delivery masks the line until
+ * the handler has drained its device and rearms it.
+ */
+struct hw_irq_line {
+	u32_t         count_thresh, pending;
+	cycles_t      time_thresh, last;
+	int           polling, masked;
+	unsigned long delivered, suppressed;
+} CACHE_ALIGNED;
+
+extern struct hw_irq_line hw_irq_lines[HW_IRQ_EXTERNAL_NUM];
+
 struct cap_hw {
 	struct cap_header h;
 	u32_t             hw_bitmap;
@@ -28,6 +49,7 @@ static void
 hw_asndcap_init(void)
 {
 	memset(&hw_asnd_caps, 0, sizeof(struct cap_asnd) * HW_IRQ_TOTAL);
+	memset(&hw_irq_lines, 0, sizeof(struct hw_irq_line) * HW_IRQ_EXTERNAL_NUM);
 }
 
 /*
@@ -65,7 +87,27 @@ hw_attach_rcvcap(struct cap_hw *hwc, hwid_t hwid, struct cap_arcv *rcvc, capid_t
 	if (!(hwc->hw_bitmap & (1 << (hwid - HW_IRQ_EXTERNAL_MIN)))) return -EINVAL;
 	if (hw_asnd_caps[hwid].h.type == CAP_ASND) return -EEXIST;
 
-	return asnd_construct(&hw_asnd_caps[hwid], rcvc, rcv_cap);
+	return asnd_construct(&hw_asnd_caps[hwid], rcvc, rcv_cap, 0, 0);
+}
+
+/*
+ * Attach an MSI vector to rcvc, and return the destination for the
+ * device's message so that the vector is raised on the receiver's
+ * core.  This way, each of the queues of a device can interrupt the
+ * core that processes it, without an IPI.
+ */
+static int
+hw_msi_bind(struct cap_hw *hwc, hwid_t hwid, struct cap_arcv *rcvc, capid_t rcv_cap)
+{
+	int dest, ret;
+
+	if (hwid < HW_IRQ_MSI_MIN || hwid > HW_IRQ_MSI_MAX) return -EINVAL;
+	dest = chal_irq_msi_dest(hwid, rcvc->cpuid);
+	if (dest < 0) return dest;
+	ret = hw_attach_rcvcap(hwc, hwid, rcvc, rcv_cap);
+	if (ret) return ret;
+
+	return dest;
 }
 
 static int
@@ -79,8 +121,126 @@ hw_detach_rcvcap(struct cap_hw *hwc, hwid_t hwid)
 	 *        __xx_post perhaps in asnd_deconstruct()
 	 */
 	memset(&hw_asnd_caps[hwid], 0, sizeof(struct cap_asnd));
+	if (hw_irq_lines[hwid - HW_IRQ_EXTERNAL_MIN].masked) chal_irq_unmask(hwid);
+	memset(&hw_irq_lines[hwid - HW_IRQ_EXTERNAL_MIN], 0, sizeof(struct hw_irq_line));
 
 	return 0;
 }
 
+static inline struct hw_irq_line *
+hw_irq_line_get(struct cap_hw *hwc, hwid_t hwid)
+{
+	if (hwid < HW_IRQ_EXTERNAL_MIN || hwid > HW_IRQ_EXTERNAL_MAX) return NULL;
+	if (!(hwc->hw_bitmap & (1 << (hwid - HW_IRQ_EXTERNAL_MIN)))) return NULL;
+
+	return &hw_irq_lines[hwid - HW_IRQ_EXTERNAL_MIN];
+}
+
+/*
+ * Interrupt context: should this interrupt on hwid be delivered to
+ * its asnd, or is it coalesced?  Lines are only delivered on a single
+ * core, so no synchronization is needed.
+ */
+static inline int
+hw_irq_deliver(hwid_t hwid)
+{
+	struct hw_irq_line *l;
+	cycles_t            now;
+
+	if (hwid < HW_IRQ_EXTERNAL_MIN || hwid > HW_IRQ_EXTERNAL_MAX) return 1;
+	l = &hw_irq_lines[hwid - HW_IRQ_EXTERNAL_MIN];
+
+	/* Common case: no moderation on the line */
+	if (likely(l->count_thresh <= 1 && !l->polling)) {
+		l->delivered++;
+		return 1;
+	}
+	if (unlikely(l->masked)) goto suppress;
+
+	l->pending++;
+	if (l->pending < l->count_thresh) {
+		now = tsc();
+		if (!l->time_thresh || now - l->last < l->time_thresh) goto suppress;
+		l->last = now;
+	} else if (l->time_thresh) {
+		l->last = tsc();
+	}
+	l->pending = 0;
+	l->delivered++;
+
+	/* The handler polls the device until it rearms the line */
+	if (l->polling) {
+		l->masked = 1;
+		chal_irq_mask(hwid);
+	}
+
+	return 1;
+suppress:
+	l->suppressed++;
+
+	return 0;
+}
+
+static int
+hw_irq_coalesce(struct cap_hw *hwc, hwid_t hwid, u32_t count_thresh, u32_t usec_thresh)
+{
+	struct hw_irq_line *l = hw_irq_line_get(hwc, hwid);
+
+	if (!l) return -EINVAL;
+	l->count_thresh = count_thresh;
+	l->time_thresh  = (cycles_t)usec_thresh * chal_cyc_usec();
+	l->pending      = 0;
+	l->last         = tsc();
+
+	return 0;
+}
+
+static int
+hw_irq_poll(struct cap_hw *hwc, hwid_t hwid, int polling)
+{
+	struct hw_irq_line *l = hw_irq_line_get(hwc, hwid);
+
+	if (!l) return -EINVAL;
+	l->polling = polling;
+	if (!polling && l->masked) {
+		l->masked = 0;
+		chal_irq_unmask(hwid);
+	}
+
+	return 0;
+}
+
+/* The polling handler drained its device: take interrupts again */
+static int
+hw_irq_rearm(struct cap_hw *hwc, hwid_t hwid)
+{
+	struct hw_irq_line *l = hw_irq_line_get(hwc, hwid);
+
+	if (!l) return -EINVAL;
+	if (!l->masked) return 0;
+	l->masked = 0;
+	chal_irq_unmask(hwid);
+
+	return 0;
+}
+
+static int
+hw_irq_stats(struct cap_hw *hwc, hwid_t hwid, unsigned long op)
+{
+	struct hw_irq_line *l = hw_irq_line_get(hwc, hwid);
+
+	if (!l) return -EINVAL;
+
+	switch (op) {
+	case HW_IRQ_GET_DELIVERED:
+		return (int)l->delivered;
+	case HW_IRQ_GET_SUPPRESSED:
+		return (int)l->suppressed;
+	case HW_IRQ_GET_MASKED:
+		return l->masked;
+	default:
+		return -EINVAL;
+	}
+}
+
 #endif /* HW_H */
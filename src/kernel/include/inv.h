@@ -15,6 +15,7 @@
 #include "component.h"
 #include "thd.h"
 #include "chal/call_convention.h"
+#include "trace.h"
 
 struct cap_sinv {
 	struct cap_header h;
@@ -33,6 +34,9 @@ struct cap_asnd {
 	cpuid_t           cpuid, arcv_cpuid;
 	u32_t             arcv_capid, arcv_epoch; /* identify receiver */
 	struct comp_info  comp_info;
+	/* IPI rate limit (none if ipi_max == 0), see cos_ipi_ratelimited */
+	u16_t             ipi_max, ipi_cnt;
+	u32_t             ipi_win, ipi_win_start;
 } __attribute__((packed));
 
 struct cap_arcv {
@@ -92,9 +96,18 @@ sret_deactivate(struct cap_captbl *t, capid_t capin, livenessid_t lid)
 	return cap_capdeactivate(t, capin, CAP_SRET, lid);
 }
 
+/*
+ * The windows of the IPI rate limits are in units of
+ * 2^ASND_IPI_WIN_ORD cycles, so that they, and their start, fit in
+ * 32 bits.
+ */
+#define ASND_IPI_WIN_ORD 10
+
 static int
-asnd_construct(struct cap_asnd *asndc, struct cap_arcv *arcvc, capid_t rcv_cap)
+asnd_construct(struct cap_asnd *asndc, struct cap_arcv *arcvc, capid_t rcv_cap, u32_t ipiwin, u32_t ipimax)
 {
+	u64_t win = ((u64_t)ipiwin * chal_cyc_usec()) >> ASND_IPI_WIN_ORD;
+
 	/* FIXME: Add synchronization with __xx_pre and __xx_post */
 
 	/* copy data from the arcv capability */
@@ -105,12 +118,17 @@ asnd_construct(struct cap_asnd *asndc, struct cap_arcv *arcvc, capid_t rcv_cap)
 	/* ...and initialize our own data */
 	asndc->cpuid          = get_cpuid();
 	asndc->arcv_capid     = rcv_cap;
+	asndc->ipi_max        = ipimax;
+	asndc->ipi_cnt        = 0;
+	asndc->ipi_win        = win > ~0U ? ~0U : (u32_t)win;
+	asndc->ipi_win_start  = 0;
 
 	return 0;
 }
 
 static int
-asnd_activate(struct captbl *t, capid_t cap, capid_t capin, capid_t rcv_captbl, capid_t rcv_cap)
+asnd_activate(struct captbl *t, capid_t cap, capid_t capin, capid_t rcv_captbl, capid_t rcv_cap, u32_t ipiwin,
+              u32_t ipimax)
 {
 	struct cap_captbl *rcv_ct;
 	struct cap_asnd *  asndc;
@@ -126,7 +144,7 @@ asnd_activate(struct captbl *t, capid_t cap, capid_t capin, capid_t rcv_captbl,
 	asndc = (struct cap_asnd *)__cap_capactivate_pre(t, cap, capin, CAP_ASND, &ret);
 	if (!asndc) return ret;
 
-	ret = asnd_construct(asndc, arcvc, rcv_cap);
+	ret = asnd_construct(asndc, arcvc, rcv_cap, ipiwin, ipimax);
 	__cap_capactivate_post(&asndc->h, CAP_ASND);
 
 	return ret;
@@ -142,6 +160,7 @@ int cap_ipi_process(struct pt_regs *regs);
 
 /* send to a receive end-point within an interrupt */
 int cap_hw_asnd(struct cap_asnd *asnd, struct pt_regs *regs);
+int cap_pgflt_deliver(struct pt_regs *regs, vaddr_t addr, unsigned long errcode, vaddr_t ip);
 
 static void
 __arcv_setup(struct cap_arcv *arcv, struct thread *thd, struct tcap *tcap, struct thread *notif)
@@ -248,6 +267,66 @@ arcv_deactivate(struct cap_captbl *t, capid_t capin, livenessid_t lid)
 	return cap_capdeactivate(t, capin, CAP_ARCV, lid);
 }
 
+/*
+ * Move the rcv end-point behind capin, with its thread and tcap (that
+ * must be bound only to it), to cpu, where sched_cap's end-point
+ * becomes its scheduler: a cheap way to balance load across cores.
+ * As with thd_migrate, this is done on the end-point's core, while
+ * its thread isn't running, and the capabilities passed here are the
+ * ones that can then be used on cpu (copies of them keep naming this
+ * core). The tcap loses its budget (see tcap_migrate). The asnds to
+ * the end-point still target this core, which forwards their
+ * notifications to cpu.
+ */
+static int
+arcv_migrate(struct captbl *t, capid_t capin, capid_t thd_cap, capid_t tcap_cap, capid_t sched_cap, cpuid_t cpu,
+             struct thread *current)
+{
+	struct cos_cpu_local_info *cli = cos_cpu_local_info();
+	struct cap_arcv *          arcvc, *schedc;
+	struct cap_thd *           thdc;
+	struct cap_tcap *          tcapc;
+	struct thread *            thd, *sched;
+	struct tcap *              tcap;
+
+	if (unlikely(cpu < 0 || cpu >= NUM_CPU || cpu == get_cpuid())) return -EINVAL;
+
+	arcvc = (struct cap_arcv *)captbl_lkup(t, capin);
+	if (unlikely(!CAP_TYPECHK_CORE(arcvc, CAP_ARCV))) return -EINVAL;
+	thdc = (struct cap_thd *)captbl_lkup(t, thd_cap);
+	if (unlikely(!CAP_TYPECHK_CORE(thdc, CAP_THD))) return -EINVAL;
+	tcapc = (struct cap_tcap *)captbl_lkup(t, tcap_cap);
+	if (unlikely(!CAP_TYPECHK_CORE(tcapc, CAP_TCAP))) return -EINVAL;
+	/* the destination's scheduler */
+	schedc = (struct cap_arcv *)captbl_lkup(t, sched_cap);
+	if (unlikely(!CAP_TYPECHK(schedc, CAP_ARCV) || schedc->cpuid != cpu)) return -EINVAL;
+
+	thd   = arcvc->thd;
+	tcap  = tcapc->tcap;
+	sched = schedc->thd;
+	if (unlikely(thdc->t != thd || thd_rcvcap_tcap(thd) != tcap)) return -EINVAL;
+	if (unlikely(schedc->depth + 1 >= ARCV_NOTIF_DEPTH)) return -EINVAL;
+	/* the schedulers, and shared tcaps, stay with their other threads */
+	if (thd == current || thd_rcvcap_isreferenced(thd)) return -EBUSY;
+	if (tcap->arcv_ep != thd || tcap_ref(tcap) != 2) return -EBUSY;
+	if (!list_empty(&thd->event_list)) return -EAGAIN;
+
+	if (tcap_migrate(tcap, cpu)) return -EINVAL;
+
+	thd_rcvcap_release(thd->rcvcap.rcvcap_thd_notif);
+	thd->rcvcap.rcvcap_thd_notif = sched;
+	thd_scheduler_set(thd, sched);
+	/* sched is on cpu, whose kernel might be updating the count as well */
+	cos_faa((int *)&sched->rcvcap.refcnt, 1);
+
+	arcvc->depth = schedc->depth + 1;
+	arcvc->cpuid = cpu;
+	tcapc->cpuid = cpu;
+	__thd_migrate(cli, thdc, thd, cpu);
+
+	return 0;
+}
+
 static inline int
 arcv_introspect(struct cap_arcv *r, unsigned long op, unsigned long *retval)
 {
@@ -275,36 +354,83 @@ arcv_introspect(struct cap_arcv *r, unsigned long op, unsigned long *retval)
  * on context switches.
  */
 
+/*
+ * Execution moves from the component with protection domain from, to
+ * that with to. Unless both are in the same trust domain (trustdom in
+ * the composition script), the component we move to mustn't be able
+ * to use the branch predictors, as trained by the other, against it
+ * (and vice versa): the mitigations are only paid across domains.
+ */
+static inline void
+inv_spec_barrier(prot_domain_t from, prot_domain_t to)
+{
+	if (likely(from == to)) return;
+	if (PROTDOM_TRUSTDOM(from) && PROTDOM_TRUSTDOM(from) == PROTDOM_TRUSTDOM(to)) return;
+
+	chal_spec_barrier();
+}
+
+/*
+ * Move from the page-table of the component we're leaving to that of
+ * the one we're invoking (or returning to), and to its protection
+ * domain.  Components that share a page-table (e.g. separated only by
+ * MPK) need no CR3 write: the page-table of the component we're
+ * leaving is always the loaded one.
+ */
+static inline void
+inv_protdom_switch(struct pgtbl_info *from, struct pgtbl_info *to, prot_domain_t protdom)
+{
+	if (unlikely(from->pgtbl != to->pgtbl)) pgtbl_update(to);
+	chal_protdom_update(protdom);
+	fpu_inv_update(to->protdom);
+	inv_spec_barrier(from->protdom, to->protdom);
+}
+
 static inline void
 sinv_call(struct thread *thd, struct cap_sinv *sinvc, struct pt_regs *regs, struct cos_cpu_local_info *cos_info)
 {
 	unsigned long ip, sp;
+	int           alive;
 
 	ip = __userregs_getip(regs);
 	sp = __userregs_getsp(regs);
 
 	/*
-	 * Note that we want this liveness lookup to proceed in
-	 * parallel to the thread operations so we avoid stores in
-	 * this path (to avoid serialization in the store buffer), and
-	 * optimize the static branch prediction.
+	 * We want the liveness lookup to proceed in parallel to the
+	 * invocation stack push, so its result is only branched on
+	 * after the push (that is undone for a dead server): both
+	 * loads are issued together, and the common case takes no
+	 * branch between them.
 	 */
-	if (unlikely(!ltbl_isalive(&(sinvc->comp_info.liveness)))) {
+	alive = ltbl_isalive(&(sinvc->comp_info.liveness));
+	if (unlikely(thd_invstk_push(thd, &sinvc->comp_info, ip, sp, cos_info))) {
+		__userregs_set(regs, -1, sp, ip);
+		return;
+	}
+	if (unlikely(!alive)) {
+		curr_invstk_dec(cos_info);
 		printk("cos: sinv comp (liveness %d) doesn't exist!\n", sinvc->comp_info.liveness.id);
 		// FIXME: add fault handling here.
-		__userregs_set(regs, -EFAULT, __userregs_getsp(regs), __userregs_getip(regs));
+		__userregs_set(regs, -EFAULT, sp, ip);
 		return;
 	}
 
-	if (unlikely(thd_invstk_push(thd, &sinvc->comp_info, ip, sp, cos_info))) {
-		__userregs_set(regs, -1, sp, ip);
-		return;
+	/* a pending page grant is mapped into the server for this invocation */
+	if (unlikely(thd->state & THD_STATE_GRANT) && thd->grant.state == THD_GRANT_PENDING) {
+		int ret = thd_grant_map(&thd->grant, sinvc->comp_info.pgtblinfo.pgtbl, curr_invstk_top(cos_info));
+
+		if (unlikely(ret)) {
+			thd->state &= ~THD_STATE_GRANT;
+			curr_invstk_dec(cos_info);
+			__userregs_set(regs, ret, sp, ip);
+			return;
+		}
 	}
 
-	pgtbl_update(&sinvc->comp_info.pgtblinfo);
-	chal_protdom_write(sinvc->comp_info.pgtblinfo.protdom);
+	cos_trace(COS_TRACE_SINV, thd->tid, sinvc->token);
+	inv_protdom_switch(&thd_invstk_entry(thd, curr_invstk_top(cos_info) - 1)->comp_info.pgtblinfo,
+	                   &sinvc->comp_info.pgtblinfo, sinvc->comp_info.pgtblinfo.protdom);
 
-	/* TODO: test this before pgtbl update...pre- vs. post-serialization */
 	__userregs_sinvupdate(regs);
 	__userregs_setinv(regs, thd->tid | (get_cpuid() << 16), sinvc->token,
 			  sinvc->entry_addr);
@@ -315,25 +441,37 @@ sinv_call(struct thread *thd, struct cap_sinv *sinvc, struct pt_regs *regs, stru
 static inline void
 sret_ret(struct thread *thd, struct pt_regs *regs, struct cos_cpu_local_info *cos_info)
 {
-	struct comp_info *ci;
-	unsigned long     ip, sp;
-	prot_domain_t     protdom;
-
-	ci = thd_invstk_pop(thd, &ip, &sp, &protdom, cos_info);
+	struct comp_info  *ci;
+	struct pgtbl_info *srv_pt;
+	unsigned long      ip, sp;
+	prot_domain_t      protdom;
+	int                alive;
+
+	/* the server's page-table, the loaded one, is only needed once popped */
+	srv_pt = &thd_invstk_entry(thd, curr_invstk_top(cos_info))->comp_info.pgtblinfo;
+	ci     = thd_invstk_pop(thd, &ip, &sp, &protdom, cos_info);
 	if (unlikely(!ci)) {
 		__userregs_set(regs, 0xDEADDEAD, 0, 0);
 		return;
 	}
+	alive = ltbl_isalive(&ci->liveness);
+
+	/* revoke a grant made to the server we're returning from (or one it unwound) */
+	if (unlikely(thd->state & THD_STATE_GRANT) && thd->grant.state == THD_GRANT_ACTIVE
+	    && thd->grant.depth > curr_invstk_top(cos_info)) {
+		thd_grant_revoke(&thd->grant);
+		thd->state &= ~THD_STATE_GRANT;
+	}
 
-	if (unlikely(!ltbl_isalive(&ci->liveness))) {
+	if (unlikely(!alive)) {
 		printk("cos: ret comp (liveness %d) doesn't exist!\n", ci->liveness.id);
 		// FIXME: add fault handling here.
 		__userregs_set(regs, -EFAULT, __userregs_getsp(regs), __userregs_getip(regs));
 		return;
 	}
 
-	pgtbl_update(&ci->pgtblinfo);
-	chal_protdom_write(protdom);
+	cos_trace(COS_TRACE_SRET, thd->tid, 0);
+	inv_protdom_switch(srv_pt, &ci->pgtblinfo, protdom);
 
 	/* Set return sp and ip and function return value in eax */
 	__userregs_set(regs, __userregs_getinvret(regs), sp, ip);
@@ -19,6 +19,8 @@
  */
 #define IPI_RING_SIZE (16)
 #define IPI_RING_MASK (IPI_RING_SIZE - 1);
+/* one bit per source core */
+#define IPI_SUMMARY_WORDS ((NUM_CPU + 31) / 32)
 
 struct ipi_cap_data {
 	capid_t          arcv_capid;
@@ -39,17 +41,54 @@ struct xcore_ring {
  * We make sure that, on the receiving side, the source rings are
  * lined up as we'll scan them upon receiving. This should benefit
  * the pre-fetcher.
+ *
+ * Together, the source rings of a core form its multi-producer
+ * ring: each source only ever enqueues into its own ring, so no
+ * producer synchronizes with another. The receiver only looks at the
+ * rings whose bit is set in the nonempty summary, and a sender
+ * doesn't IPI a core that already has an IPI pending, as that IPI
+ * will process its ring as well.
  */
 struct IPI_receiving_rings {
 	struct xcore_ring IPI_source[NUM_CPU];
-	/* Start core of each scan. Need to prevent starving. */
-	u32_t start;
+	/* The source rings that might be non-empty. */
+	u32_t nonempty[IPI_SUMMARY_WORDS];
+	/* An IPI was sent, and the rings haven't been scanned since. */
+	u32_t ipi_pending;
 	/* padding to prevent false sharing. */
-	char _pad[CACHE_LINE - sizeof(u32_t)];
+	char _pad[CACHE_LINE - sizeof(u32_t) * (IPI_SUMMARY_WORDS + 1)];
 } CACHE_ALIGNED __attribute__((packed));
 
 struct IPI_receiving_rings IPI_cap_dest[NUM_CPU] CACHE_ALIGNED;
 
+static inline void
+cos_ipi_summary_set(struct IPI_receiving_rings *rings, cpuid_t src)
+{
+	u32_t *word = &rings->nonempty[src / 32];
+	u32_t  bit  = 1U << (src % 32);
+	u32_t  v;
+
+	do {
+		v = *(volatile u32_t *)word;
+		if (v & bit) return;
+	} while (cos_cas_32((void *)word, v, v | bit) != CAS_SUCCESS);
+}
+
+/* Atomically read and clear a word of the summary. */
+static inline u32_t
+cos_ipi_summary_take(struct IPI_receiving_rings *rings, int idx)
+{
+	u32_t *word = &rings->nonempty[idx];
+	u32_t  v;
+
+	do {
+		v = *(volatile u32_t *)word;
+		if (!v) return 0;
+	} while (cos_cas_32((void *)word, v, 0) != CAS_SUCCESS);
+
+	return v;
+}
+
 static inline u32_t
 cos_ipi_ring_dequeue(struct xcore_ring *ring, struct ipi_cap_data *ret)
 {
@@ -90,7 +129,7 @@ process_ring(struct xcore_ring *ring)
 }
 
 static inline int
-cos_ipi_ring_enqueue(u32_t dest, struct cap_asnd *asnd)
+__cos_ipi_ring_enqueue(u32_t dest, capid_t arcv_capid, capid_t arcv_epoch, struct comp_info *ci)
 {
 	struct xcore_ring *  ring;
 	u32_t                tail;
@@ -106,17 +145,90 @@ cos_ipi_ring_enqueue(u32_t dest, struct cap_asnd *asnd)
 	data  = &ring->ring[tail];
 	if (unlikely(delta == ring->receiver)) return -EBUSY;
 
-	data->arcv_capid = asnd->arcv_capid;
-	data->arcv_epoch = asnd->arcv_epoch;
-	memcpy(&data->comp_info, &asnd->comp_info, sizeof(struct comp_info));
+	data->arcv_capid = arcv_capid;
+	data->arcv_epoch = arcv_epoch;
+	memcpy(&data->comp_info, ci, sizeof(struct comp_info));
 
 	ring->sender = delta;
 
 	cos_mem_fence();
+	/* Only after the data is visible, so the receiver can't miss it */
+	cos_ipi_summary_set(&IPI_cap_dest[dest], get_cpuid());
 
 	return 0;
 }
 
+static inline int
+cos_ipi_ring_enqueue(u32_t dest, struct cap_asnd *asnd)
+{
+	return __cos_ipi_ring_enqueue(dest, asnd->arcv_capid, asnd->arcv_epoch, &asnd->comp_info);
+}
+
+/*
+ * IPI cpu for the entries enqueued in its rings, unless an IPI is
+ * already pending there.
+ */
+static inline void
+cos_ipi_signal(int cpu)
+{
+	struct IPI_receiving_rings *rings = &IPI_cap_dest[cpu];
+
+	/*
+	 * Coalesce: the receiver clears ipi_pending before it scans the
+	 * rings, so a pending IPI is guaranteed to see our data.
+	 */
+	if (*(volatile u32_t *)&rings->ipi_pending) return;
+	if (cos_cas_32((void *)&rings->ipi_pending, 0, 1) != CAS_SUCCESS) return;
+
+	chal_send_ipi(cpu);
+}
+
+/*
+ * Should the IPI for a notification of asnd be withheld, as it
+ * already sent ipi_max IPIs in the current window? The notification
+ * is still enqueued, and is processed with the next IPI to its core,
+ * or on the core's next timer interrupt (cos_ipi_deferred_signal).
+ * The counts aren't synchronized, so an asnd used on several cores
+ * is only approximately rate limited.
+ */
+static inline int
+cos_ipi_ratelimited(struct cap_asnd *asnd)
+{
+	cycles_t now;
+	u32_t    win;
+
+	if (likely(!asnd->ipi_max)) return 0;
+
+	rdtscll(now);
+	win = (u32_t)(now >> ASND_IPI_WIN_ORD);
+	if (win - asnd->ipi_win_start >= asnd->ipi_win) {
+		asnd->ipi_win_start = win;
+		asnd->ipi_cnt       = 0;
+	}
+	if (asnd->ipi_cnt >= asnd->ipi_max) return 1;
+	asnd->ipi_cnt++;
+
+	return 0;
+}
+
+/*
+ * IPI ourself if notifications were enqueued for this core without
+ * an IPI, so that they are processed once the interrupt returns.
+ */
+static inline void
+cos_ipi_deferred_signal(int cpu)
+{
+	struct IPI_receiving_rings *rings = &IPI_cap_dest[cpu];
+	int                         w;
+
+	for (w = 0; w < IPI_SUMMARY_WORDS; w++) {
+		if (*(volatile u32_t *)&rings->nonempty[w]) {
+			cos_ipi_signal(cpu);
+			return;
+		}
+	}
+}
+
 static int
 cos_cap_send_ipi(int cpu, struct cap_asnd *asnd)
 {
@@ -124,8 +236,24 @@ cos_cap_send_ipi(int cpu, struct cap_asnd *asnd)
 
 	ret = cos_ipi_ring_enqueue(cpu, asnd);
 	if (unlikely(ret)) return ret;
+	if (!cos_ipi_ratelimited(asnd)) cos_ipi_signal(cpu);
 
-	chal_send_ipi(cpu);
+	return 0;
+}
+
+/*
+ * Forward a notification dequeued on this core to the core its rcv
+ * end-point migrated to (arcv_migrate), as asnds keep targeting the
+ * core the end-point was on at their creation.
+ */
+static inline int
+cos_ipi_forward(int cpu, struct ipi_cap_data *data)
+{
+	int ret;
+
+	ret = __cos_ipi_ring_enqueue(cpu, data->arcv_capid, data->arcv_epoch, &data->comp_info);
+	if (unlikely(ret)) return ret;
+	cos_ipi_signal(cpu);
 
 	return 0;
 }
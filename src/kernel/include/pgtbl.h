@@ -46,18 +46,29 @@ struct tlb_quiescence {
 	u64_t last_periodic_flush;
 	/* Updated by tlb flush IPI. */
 	u64_t last_mandatory_flush;
+	/* The shootdown generation this core has flushed up to. */
+	u32_t flushed_gen;
+	/* The shootdown generation this core was last sent an IPI for. */
+	u32_t ipi_gen;
 	/* cacheline size padding. */
-	u8_t __padding[CACHE_LINE - 2 * sizeof(u64_t)];
+	u8_t __padding[CACHE_LINE - 2 * sizeof(u64_t) - 2 * sizeof(u32_t)];
 } __attribute__((aligned(CACHE_LINE), packed));
 
 extern struct tlb_quiescence tlb_quiescence[NUM_CPU] CACHE_ALIGNED;
 
 int            tlb_quiescence_check(u64_t timestamp);
+void           tlb_mandatory_flush(void *arg);
+void           tlb_shootdown_defer(void);
+void           tlb_shootdown_process(void);
+void           tlb_shootdown_request(void);
+u16_t          pgtbl_asid_alloc(void);
+void           pgtbl_asid_free(u16_t asid);
 int            pgtbl_cosframe_add(pgtbl_t pt, vaddr_t addr, paddr_t page, word_t flags, u32_t order);
 int            pgtbl_mapping_add(pgtbl_t pt, vaddr_t addr, paddr_t page, word_t flags, u32_t order);
 int            pgtbl_mapping_mod(pgtbl_t pt, u32_t addr, u32_t flags, u32_t *prevflags);
 int            pgtbl_mapping_del(pgtbl_t pt, vaddr_t addr, u32_t liv_id);
 int            pgtbl_mapping_del_direct(pgtbl_t pt, u32_t addr);
+int            pgtbl_mapping_revoke(pgtbl_t pt, vaddr_t addr, paddr_t page);
 void          *pgtbl_lkup_lvl(pgtbl_t pt, vaddr_t addr, word_t *flags, u32_t start_lvl, u32_t end_lvl);
 int            pgtbl_ispresent(word_t flags);
 unsigned long *pgtbl_lkup(pgtbl_t pt, vaddr_t addr, word_t *flags);
@@ -121,6 +132,8 @@ int            chal_pgtbl_cosframe_add(pgtbl_t pt, vaddr_t addr, paddr_t page, w
 int            chal_pgtbl_mapping_mod(pgtbl_t pt, vaddr_t addr, u32_t flags, u32_t *prevflags);
 int            chal_pgtbl_mapping_del(pgtbl_t pt, vaddr_t addr, u32_t liv_id);
 int            chal_pgtbl_mapping_del_direct(pgtbl_t pt, u32_t addr);
+/* Remove the mapping of page at addr without waiting for TLB quiescence to reuse the entry */
+int            chal_pgtbl_mapping_revoke(pgtbl_t pt, vaddr_t addr, paddr_t page);
 int            chal_pgtbl_mapping_scan(struct cap_pgtbl *pt);
 void          *chal_pgtbl_lkup_lvl(pgtbl_t pt, vaddr_t addr, word_t *flags, u32_t start_lvl, u32_t end_lvl);
 int            chal_pgtbl_ispresent(word_t flags);
@@ -138,11 +151,18 @@ int            chal_pgtbl_pgtblactivate(struct captbl *ct, capid_t cap, capid_t
 int            chal_pgtbl_deact_pre(struct cap_header *ch, u32_t pa);
 /* Page mapping */
 int            chal_pgtbl_cpy(struct captbl *t, capid_t cap_to, capid_t capin_to, struct cap_pgtbl *ctfrom, capid_t capin_from, cap_t cap_type, vaddr_t order);
+int            chal_pgtbl_cpy_n(struct captbl *t, capid_t cap_to, capid_t capin_to, struct cap_pgtbl *ctfrom, capid_t capin_from, unsigned long npages, word_t flags);
 /* Cons & decons functions */
 int            chal_pgtbl_cons(struct cap_captbl *ct, struct cap_captbl *ctsub, capid_t expandid, unsigned long depth);
 int            chal_pgtbl_decons(struct cap_header *head, struct cap_header *sub, capid_t pruneid, unsigned long lvl);
 /* Introspection */
 int            chal_pgtbl_introspect(struct cap_header *ch, vaddr_t addr);
+/* DMA remapping with PGTBL_TYPE_IOMMU page-tables */
+int            chal_iommu_bind(u16_t bdf, struct cap_pgtbl *pt);
+int            chal_iommu_unbind(u16_t bdf);
+void           chal_iommu_pgtbl_flush(struct cap_pgtbl *pt, int map);
+/* Dirty-page tracking in PGTBL_TYPE_EPT page-tables */
+int            chal_pgtbl_ept_dirty(struct cap_pgtbl *pt, vaddr_t gpa, unsigned long npages, unsigned long *bitmap);
 
 #endif /* PGTBL_H */
 
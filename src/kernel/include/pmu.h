@@ -0,0 +1,281 @@
+#ifndef PMU_H
+#define PMU_H
+
+/*
+ * Per-thread performance counters (Intel's architectural performance
+ * monitoring, version 2 or later). A thread that programs counters
+ * (HW_PMU_PROGRAM) owns them, and the counters they've counted, while
+ * it executes: they're saved and restored when it's switched from
+ * and to, and it can read them at user-level with rdpmc, as CR4.PCE
+ * is only set while it executes. Only user-level events are counted.
+ *
+ * The general-purpose counters count the programmed events, and the
+ * fixed counters the instructions retired (0), core cycles (1) and
+ * reference cycles (2). Threads that don't use the counters pay for a
+ * single comparison on a switch.
+ *
+ * The last general-purpose counter isn't virtualized, but reserved
+ * for sampling (HW_PMU_SAMPLE): it counts the core's user-level
+ * cycles, and interrupts every period of them, to record the
+ * interrupted thread's execution in the core's trace ring (see
+ * trace_sample).
+ */
+
+#include "per_cpu.h"
+
+#define PMU_NGP    4 /* general-purpose counters virtualized (at most) */
+#define PMU_NFIXED 3
+
+struct cos_pmu {
+	u64_t evtsel[PMU_NGP]; /* 0 if the counter isn't programmed */
+	u64_t ctr[PMU_NGP];
+	u64_t fixed[PMU_NFIXED];
+	int   enabled;
+};
+
+/* The thread whose counts are in the counters, NULL if none is */
+PERCPU_DECL(struct cos_pmu *, pmu_loaded);
+PERCPU_EXTERN(pmu_loaded);
+
+/* The sampling period, 0 if the core isn't sampling */
+PERCPU_DECL(unsigned long, pmu_sample_period);
+PERCPU_EXTERN(pmu_sample_period);
+
+/* general-purpose counters available, 0 if the counters can't be used */
+extern int pmu_ngp;
+
+#if defined(PMU_ENABLED) && defined(__x86_64__)
+
+#define PMU_MSR_PERFEVTSEL0     0x186
+#define PMU_MSR_PMC0            0x0C1
+#define PMU_MSR_A_PMC0          0x4C1 /* full-width writes */
+#define PMU_MSR_FIXED_CTR0      0x309
+#define PMU_MSR_PERF_CAP        0x345
+#define PMU_MSR_FIXED_CTR_CTRL  0x38D
+#define PMU_MSR_PERF_GLOBAL_STATUS 0x38E
+#define PMU_MSR_PERF_GLOBAL_CTRL 0x38F
+#define PMU_MSR_PERF_GLOBAL_OVF_CTRL 0x390
+
+#define PMU_EVTSEL_USR (1 << 16)
+#define PMU_EVTSEL_INT (1 << 20) /* interrupt on overflow */
+#define PMU_EVTSEL_EN  (1 << 22)
+#define PMU_EVT_CYCLES 0x3c      /* unhalted core cycles */
+#define PMU_CTR_MASK   ((1ULL << 48) - 1)
+/* enable each fixed counter for user-level (ring 3) only */
+#define PMU_FIXED_CTRL_USR 0x222
+#define PMU_CR4_PCE (1 << 8)
+
+/* the counters' msr, as a counter is only written to 32 bits without full-width writes */
+extern u32_t pmu_ctr_msr;
+extern int   pmu_sample_ctr;
+
+static inline u64_t
+pmu_rdmsr(u32_t msr)
+{
+	u32_t lo, hi;
+
+	asm volatile("rdmsr" : "=a"(lo), "=d"(hi) : "c"(msr));
+
+	return ((u64_t)hi << 32) | lo;
+}
+
+static inline void
+pmu_wrmsr(u32_t msr, u64_t val)
+{
+	asm volatile("wrmsr" : : "c"(msr), "a"((u32_t)val), "d"((u32_t)(val >> 32)));
+}
+
+static inline void
+pmu_pce_set(int on)
+{
+	unsigned long cr4;
+
+	asm volatile("movq %%cr4, %0" : "=r"(cr4));
+	cr4 = on ? cr4 | PMU_CR4_PCE : cr4 & ~(unsigned long)PMU_CR4_PCE;
+	asm volatile("movq %0, %%cr4" : : "r"(cr4));
+}
+
+/* Called on each core's initialization */
+static inline void
+pmu_init(void)
+{
+	u32_t a = 0xa, b = 0, c = 0, d = 0;
+	u32_t version, ngp;
+	int   i;
+
+	*PERCPU_GET(pmu_loaded) = NULL;
+
+	asm volatile("cpuid" : "+a"(a), "+b"(b), "+c"(c), "+d"(d));
+	version = a & 0xff;
+	ngp     = (a >> 8) & 0xff;
+	/* the global control and the three fixed counters are in version 2 */
+	if (version < 2 || (d & 0x1f) < PMU_NFIXED || ngp < 2) {
+		pmu_ngp = 0;
+		return;
+	}
+	/* the last counter is for sampling */
+	pmu_ngp = ngp - 1 < PMU_NGP ? ngp - 1 : PMU_NGP;
+	pmu_sample_ctr = ngp - 1;
+	*PERCPU_GET(pmu_sample_period) = 0;
+
+	a = 1;
+	asm volatile("cpuid" : "+a"(a), "=b"(b), "=c"(c), "=d"(d));
+	pmu_ctr_msr = PMU_MSR_PMC0;
+	/* PDCM: IA32_PERF_CAPABILITIES, and its FW_WRITE */
+	if ((c & (1 << 15)) && (pmu_rdmsr(PMU_MSR_PERF_CAP) & (1 << 13))) pmu_ctr_msr = PMU_MSR_A_PMC0;
+
+	/* Counters are started and stopped with their own controls only */
+	pmu_wrmsr(PMU_MSR_FIXED_CTR_CTRL, 0);
+	for (i = 0; i < (int)ngp; i++) pmu_wrmsr(PMU_MSR_PERFEVTSEL0 + i, 0);
+	pmu_wrmsr(PMU_MSR_PERF_GLOBAL_CTRL, ((1ULL << ngp) - 1) | (((1ULL << PMU_NFIXED) - 1) << 32));
+}
+
+/* Count from -period, so that the counter overflows after period cycles */
+static inline void
+pmu_sample_arm(unsigned long period)
+{
+	pmu_wrmsr(pmu_ctr_msr + pmu_sample_ctr, (0 - (u64_t)period) & PMU_CTR_MASK);
+}
+
+/* Sample this core's user-level execution every period cycles, or stop with 0 */
+static inline int
+pmu_sample_set(unsigned long period)
+{
+	u64_t evtsel = PMU_EVT_CYCLES | PMU_EVTSEL_USR | PMU_EVTSEL_INT | PMU_EVTSEL_EN;
+
+	if (!pmu_ngp) return -ENOENT;
+	/* without full-width writes, the counter is written with 32 (sign-extended) bits */
+	if (period >= (1UL << 31)) return -EINVAL;
+
+	pmu_wrmsr(PMU_MSR_PERFEVTSEL0 + pmu_sample_ctr, 0);
+	*PERCPU_GET(pmu_sample_period) = period;
+	if (!period) return 0;
+	pmu_sample_arm(period);
+	pmu_wrmsr(PMU_MSR_PERFEVTSEL0 + pmu_sample_ctr, evtsel);
+
+	return 0;
+}
+
+/*
+ * On a performance counter interrupt: did the sampling counter
+ * overflow? If so, it's re-armed for the next sample.
+ */
+static inline int
+pmu_sample_overflow(void)
+{
+	unsigned long period = *PERCPU_GET(pmu_sample_period);
+	u64_t         ovf    = 1ULL << pmu_sample_ctr;
+
+	if (!period || !(pmu_rdmsr(PMU_MSR_PERF_GLOBAL_STATUS) & ovf)) return 0;
+	pmu_sample_arm(period);
+	pmu_wrmsr(PMU_MSR_PERF_GLOBAL_OVF_CTRL, ovf);
+
+	return 1;
+}
+
+static inline void
+pmu_save(struct cos_pmu *p)
+{
+	int i;
+
+	pmu_wrmsr(PMU_MSR_FIXED_CTR_CTRL, 0);
+	for (i = 0; i < pmu_ngp; i++) {
+		if (!p->evtsel[i]) continue;
+		pmu_wrmsr(PMU_MSR_PERFEVTSEL0 + i, 0);
+		p->ctr[i] = pmu_rdmsr(PMU_MSR_PMC0 + i);
+	}
+	for (i = 0; i < PMU_NFIXED; i++) p->fixed[i] = pmu_rdmsr(PMU_MSR_FIXED_CTR0 + i);
+	pmu_pce_set(0);
+}
+
+static inline void
+pmu_restore(struct cos_pmu *p)
+{
+	int i;
+
+	for (i = 0; i < PMU_NFIXED; i++) pmu_wrmsr(PMU_MSR_FIXED_CTR0 + i, p->fixed[i]);
+	for (i = 0; i < pmu_ngp; i++) {
+		if (!p->evtsel[i]) continue;
+		pmu_wrmsr(pmu_ctr_msr + i, p->ctr[i]);
+		pmu_wrmsr(PMU_MSR_PERFEVTSEL0 + i, p->evtsel[i]);
+	}
+	pmu_wrmsr(PMU_MSR_FIXED_CTR_CTRL, PMU_FIXED_CTRL_USR);
+	pmu_pce_set(1);
+}
+
+#else /* PMU_ENABLED */
+
+static inline void pmu_init(void) { pmu_ngp = 0; }
+static inline int  pmu_sample_set(unsigned long period) { return -ENOENT; }
+static inline int  pmu_sample_overflow(void) { return 0; }
+static inline void pmu_save(struct cos_pmu *p) {}
+static inline void pmu_restore(struct cos_pmu *p) {}
+
+#endif /* PMU_ENABLED */
+
+static inline void
+pmu_thread_init(struct cos_pmu *p)
+{
+	memset(p, 0, sizeof(struct cos_pmu));
+}
+
+static inline void
+pmu_switch(struct cos_pmu *next)
+{
+	struct cos_pmu **loaded = PERCPU_GET(pmu_loaded);
+
+	if (likely(*loaded == next || (!*loaded && !next->enabled))) return;
+
+	if (*loaded) pmu_save(*loaded);
+	*loaded = NULL;
+	if (next->enabled) {
+		pmu_restore(next);
+		*loaded = next;
+	}
+}
+
+/*
+ * The thread of p is leaving this core, or is being freed, so write
+ * back its counts if they're in the counters.
+ */
+static inline void
+pmu_thread_release(struct cos_pmu *p)
+{
+	struct cos_pmu **loaded = PERCPU_GET(pmu_loaded);
+
+	if (*loaded != p) return;
+	pmu_save(p);
+	*loaded = NULL;
+}
+
+/*
+ * Program general-purpose counter ctr of the current thread (whose
+ * counters are p) to count evt (the event in bits 0-7, and its unit
+ * mask in 8-15) from 0, or stop counting with evt 0.
+ */
+static inline int
+pmu_program(struct cos_pmu *p, unsigned long ctr, unsigned long evt)
+{
+	struct cos_pmu **loaded = PERCPU_GET(pmu_loaded);
+
+	if (ctr >= (unsigned long)pmu_ngp || evt > 0xffff) return -EINVAL;
+
+	pmu_thread_release(p);
+	p->evtsel[ctr] = evt ? (evt | PMU_EVTSEL_USR | PMU_EVTSEL_EN) : 0;
+	p->ctr[ctr]    = 0;
+	p->enabled     = 1;
+	pmu_restore(p);
+	*loaded = p;
+
+	return 0;
+}
+
+/* Stop, and clear, all of the current thread's counters */
+static inline void
+pmu_disable(struct cos_pmu *p)
+{
+	pmu_thread_release(p);
+	pmu_thread_init(p);
+}
+
+#endif /* PMU_H */
@@ -152,5 +152,7 @@ int  retypetbl_ref(void *pa, u32_t order);
 int  retypetbl_deref(void *pa, u32_t order);
 int  retypetbl_kern_ref(void *pa, u32_t order);
 int  retypetbl_kern_deref(void *pa, u32_t order);
+/* Typed pages of the type in the NUMA node */
+int  retypetbl_numa_pages(int node, mem_type_t type);
 
 #endif /* RETYPE_TBL_H */
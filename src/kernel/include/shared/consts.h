@@ -21,7 +21,14 @@
 #include "../chal/shared/cos_config.h" 
 #define MAX_PA_LIMIT     (1ULL << 32)
 #define PAGE_ORDER 12
+#if defined(__x86_64__)
+/* 2MB superpages, and 1GB huge pages mapped by the page directory pointer table */
+#define SUPER_PAGE_ORDER COS_PGTBL_ORDER_PTE_2
+#define HUGE_PAGE_ORDER COS_PGTBL_ORDER_PTE_1
+#else
 #define SUPER_PAGE_ORDER 22
+#endif
+#define SUPER_PAGE_SIZE (1UL << SUPER_PAGE_ORDER)
 #define MAX_PA_LIMIT     (1ULL << 32)
 #ifndef __KERNEL__
 #ifndef PAGE_SIZE
@@ -141,7 +148,6 @@
 #define INVTOKEN_OFFSET 3
 #define INVCAP_OFFSET 4
 
-/* FIXME: Info on superpage mappings - this should be passed from kernel to userlevel! */
-#define TEST_SUPERPAGE_FRAME    0x10400000
+/* The untyped memory starts at a SUPER_PAGE_SIZE aligned physical address. */
 
 #endif
\ No newline at end of file
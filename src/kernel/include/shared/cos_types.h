@@ -106,6 +106,7 @@ typedef enum {
 typedef enum {
 	RCV_NON_BLOCKING = 1,
 	RCV_ALL_PENDING  = 1 << 1,
+	RCV_EVT_BATCH    = 1 << 2, /* scheduler events into a user array (struct cos_sched_evt) */
 } rcv_flags_t;
 
 #define BOOT_LIVENESS_ID_BASE 2
@@ -118,12 +119,14 @@ typedef enum {
 	CAPTBL_OP_THDACTIVATE,
 	CAPTBL_OP_THDDEACTIVATE,
 	CAPTBL_OP_THDTLSSET,
+	CAPTBL_OP_THDMIGRATE,
 	CAPTBL_OP_VM_VMCS_ACTIVATE,
 	CAPTBL_OP_VM_MSR_BITMAP_ACTIVATE,
 	CAPTBL_OP_VM_LAPIC_ACCESS_ACTIVATE,
 	CAPTBL_OP_VM_LAPIC_ACTIVATE,
 	CAPTBL_OP_VM_SHARED_MEM_ACTIVATE,
 	CAPTBL_OP_VM_VMCB_ACTIVATE,
+	CAPTBL_OP_VM_VCPU_NOTIFY,
 	CAPTBL_OP_COMPACTIVATE,
 	CAPTBL_OP_COMPDEACTIVATE,
 	CAPTBL_OP_SINVACTIVATE,
@@ -134,6 +137,7 @@ typedef enum {
 	CAPTBL_OP_ASNDDEACTIVATE,
 	CAPTBL_OP_ARCVACTIVATE,
 	CAPTBL_OP_ARCVDEACTIVATE,
+	CAPTBL_OP_ARCVMIGRATE,
 	CAPTBL_OP_MEMACTIVATE,
 	CAPTBL_OP_MEMDEACTIVATE,
 	/* CAPTBL_OP_MAPPING_MOD, */
@@ -151,10 +155,12 @@ typedef enum {
 	CAPTBL_OP_PGTBLDEACTIVATE_ROOT,
 	CAPTBL_OP_THDDEACTIVATE_ROOT,
 	CAPTBL_OP_MEMMOVE,
+	CAPTBL_OP_MEMGRANT,
 	CAPTBL_OP_INTROSPECT,
 	CAPTBL_OP_TCAP_ACTIVATE,
 	CAPTBL_OP_TCAP_TRANSFER,
 	CAPTBL_OP_TCAP_DELEGATE,
+	CAPTBL_OP_TCAP_DELEGATE_BULK,
 	CAPTBL_OP_TCAP_MERGE,
 	CAPTBL_OP_TCAP_WAKEUP,
 
@@ -171,9 +177,32 @@ typedef enum {
 	CAPTBL_OP_HW_TLBFLUSH,
 	CAPTBL_OP_HW_TLBSTALL,
 	CAPTBL_OP_HW_TLBSTALL_RECOUNT,
+	CAPTBL_OP_HW_NUMA,
+	CAPTBL_OP_HW_IRQ_COALESCE,
+	CAPTBL_OP_HW_IRQ_POLL,
+	CAPTBL_OP_HW_IRQ_REARM,
+	CAPTBL_OP_HW_IRQ_STATS,
+	CAPTBL_OP_HW_TRACE_MAP,
+	CAPTBL_OP_HW_TRACE_MASK,
+	CAPTBL_OP_HW_ACCT_MAP,
+	CAPTBL_OP_HW_SYSCALL_STATS,
+	CAPTBL_OP_HW_PGFLT,
+	CAPTBL_OP_HW_PMU,
+	CAPTBL_OP_HW_TIME_MAP,
 
 	CAPTBL_OP_ULK_MEMACTIVATE,
-
+	CAPTBL_OP_ULK_MEMDEACTIVATE,
+
+	CAPTBL_OP_CAPOP_BATCH,
+	CAPTBL_OP_CPY_N,
+	CAPTBL_OP_ASND_BULK,
+	CAPTBL_OP_THD_INVSTK_ACTIVATE,
+	CAPTBL_OP_THD_INVSTK_DEACTIVATE,
+	CAPTBL_OP_HW_MSI_BIND,
+	CAPTBL_OP_HW_IOMMU_BIND,
+	CAPTBL_OP_HW_IOMMU_UNBIND,
+	CAPTBL_OP_HW_TOPOLOGY,
+	CAPTBL_OP_EPT_DIRTY,
 } syscall_op_t;
 
 typedef enum {
@@ -218,6 +247,77 @@ typedef capid_t tcap_t;
 
 #define ARCV_NOTIF_DEPTH 8
 
+/*
+ * A single entry of a batched capability operation
+ * (CAPTBL_OP_CAPOP_BATCH).  The batch is an array of these within a
+ * single, writable page of the invoking component.  Each operation is
+ * executed as if it were its own system call on cap, and its return
+ * value is written back into ret.  Execution stops at the first
+ * operation that fails.
+ */
+struct cos_capop {
+	capid_t cap;
+	word_t  op;
+	word_t  args[4];
+	long    ret;
+};
+
+#define COS_CAPOP_BATCH_MAX 64
+
+/*
+ * One of a batch of delegations from a tcap
+ * (CAPTBL_OP_TCAP_DELEGATE_BULK): res cycles at prio to the tcap of
+ * the rcv end-point rcv.  The kernel sets ret to its result.
+ */
+struct cos_tcap_deleg {
+	capid_t     rcv;
+	tcap_res_t  res;
+	tcap_prio_t prio;
+	long        ret;
+};
+
+#define COS_TCAP_DELEG_BULK_MAX 64
+
+/*
+ * One of a batch of asynchronous sends (CAPTBL_OP_ASND_BULK) on the
+ * asnd capability snd.  The kernel sets ret to its result.
+ */
+struct cos_asnd_snd {
+	capid_t snd;
+	long    ret;
+};
+
+#define COS_ASND_BULK_MAX 64
+
+/*
+ * A page grant (CAPTBL_OP_MEMGRANT) maps up to COS_GRANT_MAX_PAGES
+ * pages of the invoking thread's page-table into the server of its
+ * next synchronous invocation, until that invocation returns.
+ */
+#define COS_GRANT_MAX_PAGES 16
+
+typedef enum {
+	COS_GRANT_READ  = 0,
+	COS_GRANT_WRITE = 1, /* the server may also write the pages */
+} cos_grant_flags_t;
+
+/* Most second-level captbl pages a single CAPTBL_OP_CONS/DECONS adds or removes */
+#define COS_CAPTBL_CONS_MAX 32
+
+/*
+ * Most pages a single CAPTBL_OP_CPY_N maps, to bound the time spent
+ * in the kernel (16MB of pages).
+ */
+#define COS_PGTBL_CPY_N_MAX 4096
+
+/*
+ * Most guest-physical pages a single CAPTBL_OP_EPT_DIRTY reports, a
+ * bit each in a page of the caller (128MB of guest memory).
+ */
+#define COS_EPT_DIRTY_MAX (4096 * 8)
+/* The words of the bitmap of npages */
+#define COS_EPT_DIRTY_WORDS(npages) (((npages) + sizeof(unsigned long) * 8 - 1) / (sizeof(unsigned long) * 8))
+
 #define QUIESCENCE_CHECK(curr, past, quiescence_period) (((curr) - (past)) > (quiescence_period))
 
 /*
@@ -255,10 +355,10 @@ __captbl_cap2sz(cap_t c)
 	case CAP_TCAP:
 		return CAP_SZ_16B;
 	case CAP_HW: /* TODO: 256bits = 32B * 8b */
-	case CAP_ULK:
 		return CAP_SZ_32B;
 	case CAP_SINV:
 	case CAP_COMP:
+	case CAP_ULK:
 	case CAP_ASND:
 	case CAP_ARCV:
 	case CAP_CAPTBL:
@@ -357,6 +457,57 @@ enum
 {
 	/* tcap budget */
 	TCAP_GET_BUDGET,
+	/* timer reprograms on the tcap's core: done, and coalesced/skipped */
+	TCAP_GET_TIMER_PROGRAMMED,
+	TCAP_GET_TIMER_SKIPPED,
+};
+
+enum
+{
+	/* per-core capability lookup cache statistics */
+	CAPTBL_GET_LKUP_HITS,
+	CAPTBL_GET_LKUP_MISSES,
+};
+
+enum
+{
+	/* NUMA topology and per-node memory (in pages), through the HW capability */
+	NUMA_GET_NNODES,
+	NUMA_GET_CPU_NODE,     /* arg: cpuid */
+	NUMA_GET_VADDR_NODE,   /* args: pgtbl cap, vaddr of untyped memory */
+	NUMA_GET_VADDR_EXTENT, /* args: as above; pages from vaddr to the end of its node's range */
+	NUMA_GET_NODE_FREE,    /* arg: node; untyped pages */
+	NUMA_GET_NODE_USED,    /* arg: node; pages typed as user or kernel memory */
+};
+
+/* For memory allocation APIs: the NUMA node of the allocating core */
+#define COS_NUMA_NODE_LOCAL (-1)
+
+enum
+{
+	/* Per-IRQ line interrupt moderation counters, through the HW capability */
+	HW_IRQ_GET_DELIVERED,
+	HW_IRQ_GET_SUPPRESSED,
+	HW_IRQ_GET_MASKED, /* is a polling line currently masked? */
+};
+
+enum
+{
+	/* The page faults of user-level, delivered to a handler thread of each core */
+	HW_PGFLT_ATTACH,   /* arg: thd cap of the core's handler, 0 to detach */
+	HW_PGFLT_INFO,     /* arg: the address of a struct cos_pgflt, for the core's last fault */
+	HW_PGFLT_RESUME,   /* switch to the thread of the core's last fault */
+	HW_PGFLT_PGTBL_ID, /* arg: pgtbl cap; the id of its faults' pgtbl */
+	HW_PGFLT_ABORT,    /* arg: return value; return the faulting thread to its invoker instead */
+};
+
+enum
+{
+	/* The performance counters of the invoking thread, read with rdpmc */
+	HW_PMU_NCOUNTERS, /* the general-purpose counters, 0 if there are none */
+	HW_PMU_PROGRAM,   /* args: counter, event | (umask << 8) to count at user-level, 0 to stop */
+	HW_PMU_DISABLE,   /* stop and clear all of the counters */
+	HW_PMU_SAMPLE,    /* arg: the period (in cycles) to sample this core at, 0 to stop */
 };
 
 enum
@@ -415,6 +566,15 @@ typedef unsigned long      invtoken_t;
 #define THDCLOSURE_INIT
 typedef int                thdclosure_index_t;
 
+/* A page fault delivered to user-level (see HW_PGFLT_INFO) */
+struct cos_pgflt {
+	vaddr_t       addr;
+	vaddr_t       ip;
+	unsigned long errcode; /* the hardware's, e.g. PGTBL_WRITABLE for a write */
+	unsigned long pgtbl;   /* the id of the faulting component's pgtbl (HW_PGFLT_PGTBL_ID) */
+	thdid_t       tid;
+};
+
 /* 
  * This is an attempt decouple hardware specific code from
  * parts of the kernel interface that are hardware agnostic.
@@ -429,12 +589,31 @@ typedef u32_t prot_domain_t;
 	
 /* x86_64 prot_domain_t bits:
  *
- * |000......000|  pcid  |mpk key|
- * |31........16|15.....4|3.....0|
+ * |000...000|trustdom|nofpu|  pcid  |mpk key|
+ * |31.....25|24....17| 16  |15.....4|3.....0|
  */ 
 #define PROTDOM_MPK_KEY(prot_domain) ((prot_domain) & 0xF)
 #define PROTDOM_ASID(prot_domain) (((prot_domain) >> 4) & 0xFFF)
 #define PROTDOM_INIT(asid, mpk_key) ((prot_domain_t)((asid << 4) | mpk_key))
+/* The component never uses the FPU, so the kernel can skip FPU switching for it */
+#define PROTDOM_NOFPU_FLAG (1 << 16)
+#define PROTDOM_NOFPU(prot_domain) ((prot_domain) & PROTDOM_NOFPU_FLAG)
+/* Mutually trusting components share a trust domain; 0 trusts no other component */
+#define PROTDOM_TRUSTDOM_MAX 0xFF
+#define PROTDOM_TRUSTDOM(prot_domain) (((prot_domain) >> 17) & PROTDOM_TRUSTDOM_MAX)
+#define PROTDOM_TRUSTDOM_INIT(trustdom) ((prot_domain_t)((trustdom) & PROTDOM_TRUSTDOM_MAX) << 17)
+
+#else
+
+/* no hardware protection domain tags */
+#define PROTDOM_MPK_KEY(prot_domain) 0
+#define PROTDOM_ASID(prot_domain) 0
+#define PROTDOM_INIT(asid, mpk_key) ((prot_domain_t)0)
+#define PROTDOM_NOFPU_FLAG 0
+#define PROTDOM_NOFPU(prot_domain) 0
+#define PROTDOM_TRUSTDOM_MAX 0
+#define PROTDOM_TRUSTDOM(prot_domain) 0
+#define PROTDOM_TRUSTDOM_INIT(trustdom) ((prot_domain_t)0)
 
 #endif
 
@@ -503,6 +682,179 @@ struct ulk_invstk {
 
 #define ULK_STACKS_PER_PAGE (PAGE_SIZE / sizeof(struct ulk_invstk))
 
+/*
+ * A scheduling event, as delivered in batches by a rcv with
+ * RCV_EVT_BATCH: tid has been executing for cycles, and blocked (with
+ * timeout), or has been woken up.  Up to COS_SCHED_EVT_BATCH_MAX are
+ * delivered at a time, into an array within a single page.
+ */
+struct cos_sched_evt {
+	cycles_t    cycles;
+	tcap_time_t timeout;
+	u16_t       tid;
+	u16_t       blocked;
+};
+
+#define COS_SCHED_EVT_BATCH_MAX 64
+
+/*
+ * Kernel event tracing.  Each core records its events into its own
+ * ring of COS_TRACE_RING_PAGES pages, overwriting the oldest.  The
+ * ring is mapped read-only, at contiguous addresses, into the tracing
+ * component.  Event i is in evts[i % COS_TRACE_RING_NEVTS], and
+ * hdr.head is the number of events ever recorded; it is written
+ * after each event, so a reader can copy events, then re-read head
+ * to find which of them were overwritten in the meantime.
+ *
+ * A sample (HW_PMU_SAMPLE) of the execution of a thread is recorded
+ * as consecutive events, one for each component on its invocation
+ * stack: a COS_TRACE_SAMPLE for the component it executes in,
+ * followed by a COS_TRACE_SAMPLE_CALLER for each of the components
+ * that invoked it, from the last to the first. In these, tsc is
+ * instead the instruction pointer (of the sampled instruction, or of
+ * the invocation in the caller), and arg the component's page-table
+ * id (as HW_PGFLT_PGTBL_ID).
+ */
+typedef enum {
+	COS_TRACE_THD_SWITCH, /* arg: next thread id */
+	COS_TRACE_SINV,       /* arg: sinv token */
+	COS_TRACE_SRET,
+	COS_TRACE_ASND,       /* arg: receiving thread id, or its core for an IPI */
+	COS_TRACE_ARCV,       /* arg: pending events */
+	COS_TRACE_TIMER,
+	COS_TRACE_IPI,
+	COS_TRACE_SAMPLE,        /* tsc: instruction pointer, arg: pgtbl id */
+	COS_TRACE_SAMPLE_CALLER, /* tsc: invocation's instruction pointer, arg: pgtbl id */
+	COS_TRACE_NTYPES
+} cos_trace_type_t;
+
+#define COS_TRACE_MASK(type) (1U << (type))
+#define COS_TRACE_MASK_ALL ((1U << COS_TRACE_NTYPES) - 1)
+
+struct cos_trace_evt {
+	u64_t tsc;
+	u16_t type;
+	u16_t thd; /* the thread running on the core */
+	u32_t arg;
+};
+
+struct cos_trace_hdr {
+	u64_t head;
+	u32_t nevts;
+	u32_t cpu;
+} CACHE_ALIGNED;
+
+#define COS_TRACE_RING_PAGES 4
+#define COS_TRACE_PAGE_NEVTS (PAGE_SIZE / sizeof(struct cos_trace_evt))
+#define COS_TRACE_HDR_NEVTS (sizeof(struct cos_trace_hdr) / sizeof(struct cos_trace_evt))
+#define COS_TRACE_RING_NEVTS (COS_TRACE_RING_PAGES * COS_TRACE_PAGE_NEVTS - COS_TRACE_HDR_NEVTS)
+
+struct cos_trace_ring {
+	struct cos_trace_hdr hdr;
+	struct cos_trace_evt evts[COS_TRACE_RING_NEVTS];
+};
+
+/*
+ * Thread execution accounting, indexed by thread id, in
+ * COS_THD_ACCT_PAGES pages mapped read-only, at contiguous addresses,
+ * into the scheduler.  Only the core a thread runs on updates its
+ * entry, and seq is odd while it does so: a reader copies the entry,
+ * and retries unless seq was the same, even value before and after.
+ * tcap_cycles are the cycles consumed from the tcap whose arcv
+ * endpoint is the thread.  cycles are accounted up to since: a
+ * running thread has executed cycles + (now - since).
+ */
+struct cos_thd_acct {
+	u32_t seq;
+	u16_t tid;
+	u16_t cpu; /* the core the thread last ran on */
+	u64_t cycles;
+	u64_t tcap_cycles;
+	u64_t switches; /* times the thread was switched to */
+	u64_t since;    /* the time stamp of the thread's last accounting, or switch to it */
+};
+
+#define COS_THD_ACCT_PAGE_NENTS (PAGE_SIZE / sizeof(struct cos_thd_acct))
+#define COS_THD_ACCT_PAGES ((MAX_NUM_THREADS + COS_THD_ACCT_PAGE_NENTS) / COS_THD_ACCT_PAGE_NENTS)
+
+/*
+ * The kernel's clock, in a page mapped read-only into components
+ * (CAPTBL_OP_HW_TIME_MAP), to read the time without system calls.
+ * The time since the TSC's origin (boot) is, in nanoseconds,
+ * cos_time_cyc2ns(tsc, mult, shift), with mult and shift calibrated
+ * against the HPET, and the wall-clock time is realtime_ns more (0 if
+ * it isn't known).  As for struct cos_thd_acct, seq is odd while the
+ * kernel updates the page, and mult is 0 until the TSC is calibrated.
+ */
+struct cos_time_page {
+	u32_t seq;
+	u32_t shift;
+	u64_t mult;
+	u64_t realtime_ns;  /* nanoseconds since the epoch at TSC 0 */
+	u32_t cyc_per_usec; /* the rounded frequency, as CAPTBL_OP_HW_CYC_USEC */
+	u32_t pad;
+};
+
+/*
+ * The processor topology, from the firmware (the MADT, SRAT and SLIT)
+ * and the cpuid leaves read by each core at boot, copied out by
+ * CAPTBL_OP_HW_TOPOLOGY.  The cores of a package, of a physical core
+ * (the SMT siblings), or sharing an L2 or L3 cache have the same id
+ * for it: the lowest cpuid among them.  smt is the index of the core
+ * among its siblings.  distance[i][j] is the relative cost of an
+ * access from node i to the memory of node j, 10 being local, as in
+ * the SLIT.
+ */
+struct cos_topology_cpu {
+	u32_t apic_id;
+	u16_t pkg, core, smt;
+	u16_t l2, l3;
+	u16_t node;
+};
+
+struct cos_topology {
+	u32_t                   ncpus, nnodes;
+	struct cos_topology_cpu cpus[NUM_CPU];
+	u8_t                    distance[NUMA_NODES_MAX][NUMA_NODES_MAX];
+};
+
+/*
+ * (cyc * mult) >> shift for shift <= 32 and mult < 2^32, without the
+ * 128-bit product: the high 32 bits of cyc, then the low ones.
+ */
+static inline u64_t
+cos_time_cyc2ns(u64_t cyc, u64_t mult, u32_t shift)
+{
+	return (((cyc >> 32) * mult) << (32 - shift)) + (((cyc & 0xFFFFFFFFULL) * mult) >> shift);
+}
+
+/*
+ * Per-core system call statistics, kept if COS_SYSCALL_STATS is set
+ * in chal_config.h.  CAPTBL_OP_HW_SYSCALL_STATS copies those of all
+ * cores (struct cos_syscall_stats[NUM_CPU]) out to the caller.
+ * Calls are counted by the type of the invoked capability (types),
+ * and those taking the out-of-line resource-table path also by
+ * operation (ops).  hist[i] counts the calls that took [2^i, 2^(i+1))
+ * cycles.
+ */
+typedef enum {
+	COS_SYSCALL_STAT_SRET,     /* the invocation return fast path */
+	COS_SYSCALL_STAT_NOCAP,    /* no capability in the invoked slot */
+	COS_SYSCALL_STAT_SLOWPATH, /* resource-table operations */
+	COS_SYSCALL_STAT_NMISC
+} cos_syscall_stat_t;
+
+#define COS_SYSCALL_STATS_NTYPES 32
+#define COS_SYSCALL_STATS_NOPS 128
+#define COS_SYSCALL_STATS_NBUCKETS 32
+
+struct cos_syscall_stats {
+	u64_t types[COS_SYSCALL_STATS_NTYPES]; /* indexed by cap_t */
+	u64_t ops[COS_SYSCALL_STATS_NOPS];     /* indexed by syscall_op_t */
+	u64_t misc[COS_SYSCALL_STAT_NMISC];
+	u64_t hist[COS_SYSCALL_STATS_NBUCKETS];
+} CACHE_ALIGNED;
+
 struct cos_component_information {
 	struct cos_stack_freelists cos_stacks;
 	unsigned long              cos_this_spd_id;
@@ -605,6 +957,110 @@ typedef unsigned short int cos_channelkey_t; /* 0 == PRIVATE KEY. >= 1 GLOBAL KE
 /* VM shared data structures */
 
 #define MAX_VM_EXIT_REASONS 70
+
+/*
+ * The fast-exit table: exits that the kernel can serve from values
+ * the VMM precomputed, and resume the vcpu without switching to the
+ * VMM's handler thread. Exits that miss in the table are forwarded
+ * to the VMM as before.
+ */
+#define VM_FASTEXIT_CPUID_MAX 32
+#define VM_FASTEXIT_MSR_MAX   64
+
+/* vm_fastexit_tbl.flags */
+#define VM_FASTEXIT_PAUSE  (1 << 0) /* skip PAUSE in the kernel */
+#define VM_FASTEXIT_XSETBV (1 << 1) /* skip XSETBV in the kernel, the guest shares the host's xcr0 */
+
+/* vm_fastexit_cpuid.flags */
+#define VM_FASTEXIT_CPUID_SUBLEAF (1 << 0) /* match the subleaf (ecx) as well */
+
+/* vm_fastexit_msr.flags */
+#define VM_FASTEXIT_MSR_RD        (1 << 0) /* rdmsr returns val */
+#define VM_FASTEXIT_MSR_WR_IGNORE (1 << 1) /* wrmsr is discarded */
+
+struct vm_fastexit_cpuid {
+	u32_t leaf, subleaf, flags;
+	u32_t eax, ebx, ecx, edx;
+};
+
+struct vm_fastexit_msr {
+	u32_t msr, flags;
+	u64_t val;
+};
+
+struct vm_fastexit_tbl {
+	u32_t flags;
+	u32_t ncpuid, nmsr;
+	struct vm_fastexit_cpuid cpuid[VM_FASTEXIT_CPUID_MAX];
+	struct vm_fastexit_msr   msr[VM_FASTEXIT_MSR_MAX];
+};
+
+/*
+ * Per-reason counts of the exits served in the kernel, with the cycles
+ * from the exit to the resume. exit_tsc is the TSC of the last exit,
+ * from which the VMM times (and counts) those forwarded to it.
+ */
+struct vm_exit_stats {
+	u64_t kernel[MAX_VM_EXIT_REASONS];
+	u64_t kernel_cycles[MAX_VM_EXIT_REASONS];
+	u64_t exit_tsc;
+};
+
+/* A guest segment register, as in the VMCS */
+struct vm_seg_state {
+	u64_t base;
+	u32_t limit, ar;
+	u16_t sel;
+};
+
+enum {
+	VM_SEG_ES = 0,
+	VM_SEG_CS,
+	VM_SEG_SS,
+	VM_SEG_DS,
+	VM_SEG_FS,
+	VM_SEG_GS,
+	VM_SEG_LDTR,
+	VM_SEG_TR,
+	VM_SEG_MAX
+};
+
+/*
+ * The state of a vcpu that is neither in its general-purpose registers
+ * nor in the rest of the shared region, to snapshot and restore it. The
+ * VMM requests with op, while the vcpu is stopped in an exit, that the
+ * kernel saves it from the vcpu's VMCS, or loads it into it, on the
+ * next entry. The kernel clears op once done. A vcpu whose first entry
+ * loads the state starts in it, rather than at the BIOS.
+ */
+#define VM_STATE_OP_SAVE 1
+#define VM_STATE_OP_LOAD 2
+
+struct vm_vcpu_state {
+	u32_t op;
+	u32_t interruptibility, activity;
+	struct vm_seg_state seg[VM_SEG_MAX];
+	u64_t gdtr_base, idtr_base;
+	u32_t gdtr_limit, idtr_limit;
+	u64_t cr3, cr0_shadow, cr4_shadow, rflags, dr7, pat;
+	u64_t sysenter_cs, sysenter_esp, sysenter_eip;
+	/* The msrs the kernel switches itself */
+	u64_t gs_base, kernel_gs_base, tsc_aux, star, lstar, cstar, fmask;
+};
+
+/*
+ * The posted-interrupt descriptor of a vcpu (Intel SDM, "Posted-Interrupt
+ * Processing"). The VMM sets the vector in pir, then sets ON, and if
+ * ON was clear, notifies the vcpu's core (cos_vm_vcpu_notify).
+ */
+#define VM_PI_DESC_ON (1 << 0)
+
+struct vm_pi_desc {
+	u32_t pir[8];  /* requested vectors, one bit each */
+	u32_t control; /* VM_PI_DESC_ON: a notification is outstanding */
+	u32_t rsvd[7];
+} __attribute__((aligned(64)));
+
 struct vm_vcpu_shared_region {
 	u64_t cr2;
 
@@ -638,6 +1094,17 @@ struct vm_vcpu_shared_region {
 	u64_t cr4;
 
 	u64_t microcode_version;
+	/* The TSC of the vcpu's next timer interrupt (~0 if none), the kernel exits the vcpu at it */
+	u64_t timer_deadline;
+
+	/* Written by the VMM before the vcpu starts, read by the kernel on each exit */
+	struct vm_fastexit_tbl fastexit;
+	/* Written by the kernel, read by the VMM */
+	struct vm_exit_stats   exit_stats;
+	/* Saved or loaded by the kernel on the VMM's request */
+	struct vm_vcpu_state   state;
+
+	struct vm_pi_desc      pi_desc;
 };
 
 enum {
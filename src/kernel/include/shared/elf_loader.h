@@ -66,6 +66,44 @@ struct elf_contig_mem {
 	elf_memaccess_t access;
 };
 
+/*
+ * The composer also emits components as pre-laid images rather than
+ * ELF objects: a page with this header, then the RO segment at the
+ * next page, then the data segment at the page after it, both
+ * zero-padded to a page. The segments are laid out as they are
+ * mapped, at the component's own addresses, so the image's frames can
+ * be aliased into it rather than copied. The BSS is not stored, only
+ * its size. `mapped` is set by the loader that gives the (writable)
+ * data frames to a component.
+ */
+#define IMG_MAGIC 0x474d49534f43ULL /* "COSIMG" */
+
+struct img_hdr {
+	u64_t magic;
+	u64_t entry;
+	u64_t ro_addr, ro_sz;
+	u64_t rw_addr, data_sz, bss_sz;
+	u64_t mapped;
+};
+
+static inline int
+img_chk_format(void *hdr)
+{
+	return ((struct img_hdr *)hdr)->magic == IMG_MAGIC;
+}
+
+static inline char *
+img_ro(struct img_hdr *hdr)
+{
+	return (char *)hdr + PAGE_SIZE;
+}
+
+static inline char *
+img_data(struct img_hdr *hdr)
+{
+	return img_ro(hdr) + round_up_to_page(hdr->ro_sz);
+}
+
 static inline int
 elf_chk_format(struct elf_hdr *hdr)
 {
@@ -188,7 +226,11 @@ elf64_contig_mem(struct elf64_hdr *hdr, unsigned int nmem, struct elf_contig_mem
 static inline vaddr_t
 elf_entry_addr(struct elf_hdr *hdr)
 {
-	int ret = elf_chk_format(hdr);
+	int ret;
+
+	if (img_chk_format(hdr)) return (vaddr_t)((struct img_hdr *)hdr)->entry;
+
+	ret = elf_chk_format(hdr);
 	if (ret == ELF_HDR_32) {
 		return (vaddr_t)hdr->e_entry;
 	} else if (ret == ELF_HDR_64) {
@@ -233,6 +275,9 @@ elf_contig_mem(struct elf_hdr *hdr, unsigned int nmem, struct elf_contig_mem *me
  * mmap(..., mem, data_sz + bss_sz);
  *
  * Note that separate allocation of RO/RW pages is a straightforward extension.
+ *
+ * Pre-laid images (`img_hdr`) are already in this shape, and their
+ * `ro_src` and `data_src` are page-aligned if the image is.
  */
 static inline int
 elf_load_info(struct elf_hdr *hdr, vaddr_t *ro_addr, size_t *ro_sz, char **ro_src,
@@ -240,6 +285,23 @@ elf_load_info(struct elf_hdr *hdr, vaddr_t *ro_addr, size_t *ro_sz, char **ro_sr
 {
 	struct elf_contig_mem s[2] = {};
 
+	if (img_chk_format(hdr)) {
+		struct img_hdr *img = (struct img_hdr *)hdr;
+
+		if (round_up_to_page(img->ro_addr + img->ro_sz) != img->rw_addr) return -1;
+
+		*ro_addr  = img->ro_addr;
+		*ro_sz    = img->ro_sz;
+		*ro_src   = img_ro(img);
+
+		*rw_addr  = img->rw_addr;
+		*data_sz  = img->data_sz;
+		*data_src = img_data(img);
+		*bss_sz   = img->bss_sz;
+
+		return 0;
+	}
+
 	/* RO + Code */
 	if (elf_contig_mem(hdr, 0, &s[0]) ||
 	    s[0].objsz != s[0].sz || s[0].access != ELF_PH_CODE) return -1;
@@ -0,0 +1,74 @@
+#ifndef SYSCALL_STATS_H
+#define SYSCALL_STATS_H
+
+#include "shared/cos_types.h"
+#include "chal/cpuid.h"
+
+/*
+ * System call statistics (struct cos_syscall_stats).  With
+ * COS_SYSCALL_STATS unset, these compile away entirely.
+ */
+#if COS_SYSCALL_STATS
+extern struct cos_syscall_stats syscall_stats[NUM_CPU];
+
+static inline void
+syscall_stats_type(cap_t type)
+{
+	if (likely(type < COS_SYSCALL_STATS_NTYPES)) syscall_stats[get_cpuid()].types[type]++;
+}
+
+static inline void
+syscall_stats_op(syscall_op_t op)
+{
+	struct cos_syscall_stats *s = &syscall_stats[get_cpuid()];
+
+	s->misc[COS_SYSCALL_STAT_SLOWPATH]++;
+	if (likely(op < COS_SYSCALL_STATS_NOPS)) s->ops[op]++;
+}
+
+static inline void
+syscall_stats_misc(cos_syscall_stat_t stat)
+{
+	syscall_stats[get_cpuid()].misc[stat]++;
+}
+
+static inline cycles_t
+syscall_stats_begin(void)
+{
+	return tsc();
+}
+
+static inline void
+syscall_stats_end(cycles_t start)
+{
+	cycles_t     d = tsc() - start;
+	unsigned int b = d ? 63 - __builtin_clzll(d) : 0;
+
+	if (b >= COS_SYSCALL_STATS_NBUCKETS) b = COS_SYSCALL_STATS_NBUCKETS - 1;
+	syscall_stats[get_cpuid()].hist[b]++;
+}
+#else
+static inline void
+syscall_stats_type(cap_t type)
+{ }
+
+static inline void
+syscall_stats_op(syscall_op_t op)
+{ }
+
+static inline void
+syscall_stats_misc(cos_syscall_stat_t stat)
+{ }
+
+static inline cycles_t
+syscall_stats_begin(void)
+{
+	return 0;
+}
+
+static inline void
+syscall_stats_end(cycles_t start)
+{ }
+#endif
+
+#endif /* SYSCALL_STATS_H */
@@ -23,6 +23,14 @@
 
 #define TCAP_TIMER_DIFF (1 << 9)
 
+/* The deadline the (one-shot) timer hardware is programmed with on each core */
+struct tcap_timer {
+	cycles_t      deadline; /* 0 == disabled */
+	unsigned long programmed, skipped;
+} CACHE_ALIGNED;
+
+extern struct tcap_timer tcap_timers[NUM_CPU];
+
 struct cap_tcap {
 	struct cap_header h;
 	struct tcap *     tcap;
@@ -71,6 +79,20 @@ struct tcap {
 	 */
 	struct tcap_sched_info delegations[TCAP_MAX_DELEGATIONS];
 	struct list_node       active_list;
+
+	/*
+	 * Delegation cache.  deleg_gen changes whenever delegations
+	 * (or ndelegs, curr_sched_off) are modified.  If this tcap's
+	 * delegations are still (deleg_gen == deleg_cached_gen) the
+	 * result of merging in those of the scheduler tcap with uid
+	 * deleg_src_uid at its generation deleg_src_gen, at priority
+	 * deleg_prio, then merging them in again yields the same
+	 * vector (the merge is idempotent), and a delegation from that
+	 * scheduler only has to transfer budget.
+	 */
+	u32_t       deleg_gen, deleg_cached_gen, deleg_src_gen;
+	tcap_uid_t  deleg_src_uid;
+	tcap_prio_t deleg_prio;
 };
 
 void tcap_active_init(struct cos_cpu_local_info *cli);
@@ -78,6 +100,7 @@ int  tcap_activate(struct captbl *ct, capid_t cap, capid_t capin, struct tcap *t
 int  tcap_delegate(struct tcap *tcapdst, struct tcap *tcapsrc, tcap_res_t cycles, tcap_prio_t prio);
 int  tcap_merge(struct tcap *dst, struct tcap *rm);
 void tcap_promote(struct tcap *t, struct thread *thd);
+int  tcap_migrate(struct tcap *t, cpuid_t cpu);
 int
 tcap_wakeup(struct tcap *tc, tcap_prio_t prio, tcap_res_t budget, struct thread *thd, struct cos_cpu_local_info *cli);
 
@@ -171,6 +194,7 @@ tcap_consume(struct tcap *t, tcap_res_t cycles)
 			memcpy(&t->delegations[0], tcap_sched_info(t), sizeof(struct tcap_sched_info));
 			t->curr_sched_off = 0;
 		}
+		t->deleg_gen++;
 	} else {
 		t->budget.cycles -= cycles;
 	}
@@ -194,7 +218,9 @@ static inline void
 tcap_setprio(struct tcap *t, tcap_prio_t p)
 {
 	assert(t);
+	if (tcap_sched_info(t)->prio == p) return;
 	tcap_sched_info(t)->prio = p;
+	t->deleg_gen++;
 }
 
 static inline struct tcap *
@@ -214,7 +240,7 @@ tcap_current_set(struct cos_cpu_local_info *cos_info, struct tcap *t)
 }
 
 /* hack to avoid header file recursion */
-void __thd_exec_add(struct thread *t, cycles_t cycles);
+void __thd_exec_add(struct thread *t, struct tcap *tc, cycles_t cycles);
 
 static inline int
 tcap_budgets_update(struct cos_cpu_local_info *cos_info, struct thread *t, struct tcap *next, cycles_t *now)
@@ -225,12 +251,32 @@ tcap_budgets_update(struct cos_cpu_local_info *cos_info, struct thread *t, struc
 	cycles = *now    = tsc();
 	expended         = cycles - cos_info->cycles;
 	cos_info->cycles = cycles;
-	__thd_exec_add(t, expended);
+	__thd_exec_add(t, curr, expended);
 	tcap_consume(curr, expended);
 
 	return tcap_expended(curr);
 }
 
+/*
+ * Program the timer for @deadline (0 disables it), unless the
+ * programmed deadline is within the coalescing slack of it.
+ */
+static inline void
+tcap_timer_program(cycles_t deadline)
+{
+	struct tcap_timer *t = &tcap_timers[get_cpuid()];
+
+	if (t->deadline == deadline || (t->deadline && deadline && cycles_same(t->deadline, deadline, TIMER_COALESCE_SLACK))) {
+		t->skipped++;
+		return;
+	}
+	t->deadline = deadline;
+	t->programmed++;
+
+	if (deadline) chal_timer_set(deadline);
+	else          chal_timer_disable();
+}
+
 /*
  * Update the current tcap's (@next's) cycle count, set the next
  * oneshot @timeout, and return the cycles @expended if they should be
@@ -246,7 +292,7 @@ tcap_timer_update(struct cos_cpu_local_info *cos_info, struct tcap *next, tcap_t
 	left = tcap_left(next);
 	if (timeout == TCAP_TIME_NIL && TCAP_RES_IS_INF(left)) {
 		cos_info->next_timer = 0;
-		chal_timer_disable();
+		tcap_timer_program(0);
 		return;
 	}
 
@@ -267,11 +313,10 @@ tcap_timer_update(struct cos_cpu_local_info *cos_info, struct tcap *next, tcap_t
 	}
 
 	if (cycles_same(now, timer, TCAP_TIMER_DIFF)) timer = now + TCAP_TIMER_DIFF;
-	if (cycles_same(cos_info->next_timer, timer, TCAP_TIMER_DIFF) && cos_info->next_timer) return;
 
 	assert(timer); /* TODO: wraparound check when timer == 0 */
 	cos_info->next_timer = timer;
-	chal_timer_set(timer);
+	tcap_timer_program(timer);
 }
 
 /*
@@ -317,6 +362,12 @@ tcap_introspect(struct tcap *t, unsigned long op, unsigned long *retval)
 	case TCAP_GET_BUDGET:
 		*retval = t->budget.cycles;
 		break;
+	case TCAP_GET_TIMER_PROGRAMMED:
+		*retval = tcap_timers[t->cpuid].programmed;
+		break;
+	case TCAP_GET_TIMER_SKIPPED:
+		*retval = tcap_timers[t->cpuid].skipped;
+		break;
 	default:
 		return -EINVAL;
 	}
@@ -11,6 +11,7 @@
 #include "component.h"
 #include "cap_ops.h"
 #include "fpu_regs.h"
+#include "pmu.h"
 #include "chal/cpuid.h"
 #include "chal/call_convention.h"
 #include "pgtbl.h"
@@ -18,6 +19,8 @@
 #include "retype_tbl.h"
 #include "tcap.h"
 #include "list.h"
+#include "acct.h"
+#include "grant.h"
 #include <vm_vcpu_context.h>
 struct invstk_entry {
 	struct comp_info comp_info;
@@ -26,8 +29,20 @@ struct invstk_entry {
 	prot_domain_t    protdom;
 } HALF_CACHE_ALIGNED;
 
+/*
+ * Only the bottom THD_INVSTK_INLINE entries of the invocation stack
+ * are in the thread itself.  A thread that is given an extension page
+ * (CAPTBL_OP_THD_INVSTK_ACTIVATE) spills the deeper entries into it,
+ * up to THD_INVSTK_MAXSZ; without one, invocations past the inline
+ * entries fail.
+ */
+#define THD_INVSTK_INLINE 8
+#define THD_INVSTK_EXTSZ  (PAGE_SIZE / sizeof(struct invstk_entry))
+#define THD_INVSTK_MAXSZ  (THD_INVSTK_INLINE + THD_INVSTK_EXTSZ)
 
-#define THD_INVSTK_MAXSZ 16
+struct invstk_ext {
+	struct invstk_entry ents[THD_INVSTK_EXTSZ];
+};
 
 #define THD_TYPE_HOST (0)
 #define THD_TYPE_VM (1)
@@ -47,9 +62,17 @@ struct rcvcap_info {
 	struct thread *rcvcap_thd_notif; /* The parent rcvcap thread for notifications */
 };
 
+/* The user array (a rcv with RCV_EVT_BATCH) the events of a scheduler thread are delivered into */
+struct rcvcap_evt_batch {
+	vaddr_t       uaddr; /* 0 if events are delivered in registers */
+	pgtbl_t       pgtbl;
+	unsigned long max;
+};
+
 typedef enum {
 	THD_STATE_PREEMPTED = 1,
 	THD_STATE_RCVING    = 1 << 1, /* report to parent rcvcap that we're receiving */
+	THD_STATE_GRANT     = 1 << 2, /* thd->grant is pending or active */
 } thd_state_t;
 
 static inline int
@@ -77,20 +100,25 @@ curr_invstk_top(struct cos_cpu_local_info *cos_info)
  * components.
  */
 struct thread {
-	struct cos_fpu fpu; /* fpu has alignment requirement, thus put it first */
-	thdid_t        tid;
-	u16_t          invstk_top;
-	struct pt_regs regs;
-	struct pt_regs fault_regs;
-
-	/* TODO: same cache-line as the tid */
-	struct invstk_entry invstk[THD_INVSTK_MAXSZ];
-
+	/*
+	 * Everything touched on the invocation and dispatch paths
+	 * shares the first cache-line with the tid: the invocation
+	 * stack top, state, the ulk stack, and the rcvcap (and thus
+	 * its tcap).  The registers and the invocation stack follow
+	 * immediately.
+	 */
+	thdid_t             tid;
+	u16_t               invstk_top;
+	thd_state_t         state;
+	cpuid_t             cpuid;
 	struct ulk_invstk  *ulk_invstk;
+	struct rcvcap_info  rcvcap;
+	struct pt_regs      regs;
+	struct invstk_entry invstk[THD_INVSTK_INLINE];
+	struct invstk_ext  *invstk_ext; /* the deeper entries, or NULL */
 
-	thd_state_t    state;
-	word_t          tls;
-	cpuid_t        cpuid;
+	struct pt_regs fault_regs;
+	word_t         tls;
 	unsigned int   refcnt;
 	tcap_res_t     exec; /* execution time */
 	tcap_time_t    timeout;
@@ -98,15 +126,30 @@ struct thread {
 	struct thread *scheduler_thread;
 
 	/* rcv end-point data-structures */
-	struct rcvcap_info rcvcap;
 	struct list        event_head; /* all events for *this* end-point */
 	struct list_node   event_list; /* the list of events for another end-point */
+	struct rcvcap_evt_batch evt_batch;
 
 	u8_t thd_type; /* vm thread or host thread */
 	struct vm_vcpu_context vcpu_ctx;
 	struct thread *exception_handler;
 	void *vm_vcpu_shared_region;
+	struct cap_ulk *ulk_cap; /* the page holding ulk_invstk */
+	struct thd_grant grant;  /* only looked at with THD_STATE_GRANT */
+	struct cos_pmu   pmu;    /* only touched on a switch if enabled (pmu.h) */
+
+	/* only touched on a lazy FPU switch; xsave needs the alignment */
+	struct cos_fpu fpu CACHE_ALIGNED;
 } CACHE_ALIGNED;
+
+static inline struct invstk_entry *
+thd_invstk_entry(struct thread *thd, int idx)
+{
+	if (likely(idx < THD_INVSTK_INLINE)) return &thd->invstk[idx];
+
+	return &thd->invstk_ext->ents[idx - THD_INVSTK_INLINE];
+}
+
 #include "fpu.h"
 /*
  * Thread capability descriptor that is minimal and contains only
@@ -128,25 +171,11 @@ thd_upcall_setup(struct thread *thd, vaddr_t entry_addr, int option, int arg1, i
 }
 
 /*
- * FIXME: We need global thread name space as we use thd_id to access
- * simple stacks. When we have low-level per comp stack free-list, we
- * don't have to use global thread id name space.
- *
- * Update: this is only partially true.  We should really just get rid
- * of this id in the kernel and replace it with a
- * scheduler-configurable variable.  That variable can be the thread
- * id where appropriate, and some other (component-controlled)
- * principal id otherwise.  Given this, the allocator should be in the
- * scheduler, not here.
+ * Thread ids are not allocated here: the creating component passes
+ * the id into thd_activate, and the user-level allocator
+ * (cos_thd_id_alloc) hands them out from per-core batches so that
+ * parallel thread creation doesn't contend on a shared counter.
  */
-extern u32_t free_thd_id;
-static u32_t
-thdid_alloc(void)
-{
-	/* FIXME: thd id address space management. */
-	if (unlikely(free_thd_id >= MAX_NUM_THREADS)) assert(0);
-	return cos_faa((int *)&free_thd_id, 1);
-}
 static void
 thd_rcvcap_take(struct thread *t)
 {
@@ -217,6 +246,7 @@ thd_rcvcap_init(struct thread *t)
 	rc->is_all_pending                     = 0;
 	rc->sched_count                        = 0;
 	rc->rcvcap_thd_notif                   = NULL;
+	t->evt_batch.uaddr                     = 0;
 }
 
 static inline void
@@ -326,6 +356,58 @@ thd_state_evt_deliver(struct thread *t, unsigned long *thd_state, unsigned long
 	return 1;
 }
 
+/* Deliver events in batches into uaddr, in pt, or in registers if uaddr is 0 */
+static inline int
+thd_rcvcap_evt_batch_set(struct thread *t, pgtbl_t pt, vaddr_t uaddr, unsigned long max)
+{
+	struct rcvcap_evt_batch *b = &t->evt_batch;
+
+	if (uaddr) {
+		if (unlikely(max == 0 || max > COS_SCHED_EVT_BATCH_MAX)) return -EINVAL;
+		if (unlikely(uaddr % sizeof(word_t))) return -EINVAL;
+		if (unlikely(round_to_page(uaddr) != round_to_page(uaddr + max * sizeof(struct cos_sched_evt) - 1)))
+			return -EINVAL;
+	}
+	b->uaddr = uaddr;
+	b->pgtbl = pt;
+	b->max   = max;
+
+	return 0;
+}
+
+/*
+ * Dequeue as many events as fit into t's batch array.  The array's
+ * page is translated at delivery, as it might have been unmapped
+ * since the rcv.  Returns the number of events, or -EFAULT.
+ */
+static inline int
+thd_state_evt_batch_deliver(struct thread *t)
+{
+	struct rcvcap_evt_batch *b = &t->evt_batch;
+	struct cos_sched_evt    *evts;
+	struct thread           *e;
+	word_t                   flags;
+	unsigned long            n;
+
+	evts = (struct cos_sched_evt *)pgtbl_translate(b->pgtbl, round_to_page(b->uaddr), &flags);
+	if (unlikely(!evts)) return -EFAULT;
+	if (unlikely((flags & (PGTBL_USER | PGTBL_WRITABLE)) != (PGTBL_USER | PGTBL_WRITABLE))) return -EFAULT;
+	evts = (struct cos_sched_evt *)((vaddr_t)evts + (b->uaddr & (PAGE_SIZE - 1)));
+
+	for (n = 0; n < b->max && (e = thd_rcvcap_evt_dequeue(t)); n++) {
+		evts[n] = (struct cos_sched_evt){
+			.cycles  = e->exec,
+			.timeout = e->timeout,
+			.tid     = e->tid,
+			.blocked = e->state & THD_STATE_RCVING ? !thd_rcvcap_pending(e) : 0,
+		};
+		e->exec    = 0;
+		e->timeout = 0;
+	}
+
+	return n;
+}
+
 static inline struct thread *
 thd_current(struct cos_cpu_local_info *cos_info)
 {
@@ -367,7 +449,7 @@ thd_vm_exec(struct thread *thd)
 }
 
 static int
-thd_activate(struct captbl *t, capid_t cap, capid_t capin, struct thread *thd, capid_t compcap, thdclosure_index_t init_data, thdid_t tid, struct ulk_invstk *ulinvstk)
+thd_activate(struct captbl *t, capid_t cap, capid_t capin, struct thread *thd, capid_t compcap, thdclosure_index_t init_data, thdid_t tid, struct cap_ulk *ulkc)
 {
 	struct cos_cpu_local_info *cli = cos_cpu_local_info();
 	struct cap_thd            *tc;
@@ -393,13 +475,16 @@ thd_activate(struct captbl *t, capid_t cap, capid_t capin, struct thread *thd, c
 	thd->refcnt                           = 1;
 	thd->invstk_top                       = 0;
 	thd->cpuid                            = get_cpuid();
-	thd->ulk_invstk                       = ulinvstk;
+	thd->ulk_invstk                       = ulkc ? ulk_invstk_get(ulkc, tid) : NULL;
+	thd->ulk_cap                          = ulkc;
 	thd->vm_vcpu_shared_region            = NULL;
 	assert(thd->tid <= MAX_NUM_THREADS);
+	thd_acct_reset(tid);
 	thd_scheduler_set(thd, thd_current(cli));
 
 	thd_rcvcap_init(thd);
 	fpu_thread_init(thd); 
+	pmu_thread_init(&thd->pmu);
 	list_head_init(&thd->event_head);
 	list_init(&thd->event_list, thd);
 
@@ -412,6 +497,7 @@ thd_activate(struct captbl *t, capid_t cap, capid_t capin, struct thread *thd, c
 	}
 	tc->t     = thd;
 	tc->cpuid = get_cpuid();
+	if (ulkc) ulk_take(ulkc);
 	__cap_capactivate_post(&tc->h, CAP_THD);
 
 	return 0;
@@ -436,6 +522,10 @@ thd_deactivate(struct captbl *ct, struct cap_captbl *dest_ct, unsigned long capi
 		if (!root) cos_throw(err, -EINVAL);
 		/* last ref cannot be removed if bound to arcv cap */
 		if (thd_bound2rcvcap(thd)) cos_throw(err, -EBUSY);
+		/* its invocation stack extension must be released first */
+		if (thd->invstk_ext) cos_throw(err, -EBUSY);
+		/* another core's counters might still hold its counts */
+		if (thd->pmu.enabled && thd->cpuid != get_cpuid()) cos_throw(err, -EBUSY);
 		/*
 		 * Last reference. Require pgtbl and cos_frame cap to
 		 * release the kmem page.
@@ -463,6 +553,9 @@ thd_deactivate(struct captbl *ct, struct cap_captbl *dest_ct, unsigned long capi
 	/* deactivation success */
 	if (thd->refcnt == 0) {
 		if (cli->next_ti.thd == thd) thd_next_thdinfo_update(cli, 0, 0, 0, 0);
+		if (thd->ulk_cap) ulk_release(thd->ulk_cap);
+		if (thd->grant.state == THD_GRANT_ACTIVE) thd_grant_revoke(&thd->grant);
+		pmu_thread_release(&thd->pmu);
 
 		/* move the kmem for the thread to a location
 		 * in a pagetable as COSFRAME */
@@ -493,11 +586,120 @@ thd_tls_set(struct captbl *ct, capid_t thd_cap, vaddr_t tlsaddr, struct thread *
 	return 0;
 }
 
+/*
+ * Leave this core: the thread's FPU and PMU state are saved in the
+ * thread (not in this core's registers), and its per-core scheduling
+ * state is reset. Its invocation stack is only cached on the core
+ * while it executes, so it is already in the thread.
+ */
+static void
+__thd_migrate(struct cos_cpu_local_info *cli, struct cap_thd *tc, struct thread *thd, cpuid_t cpu)
+{
+	if (cli->next_ti.thd == thd) thd_next_thdinfo_update(cli, 0, 0, 0, 0);
+	fpu_thread_release(thd);
+	pmu_thread_release(&thd->pmu);
+	thd->interrupted_thread = NULL;
+	thd->exec               = 0;
+	thd->timeout            = 0;
+
+	/* the thread's state must be visible before the destination can dispatch it */
+	cos_mem_fence();
+	tc->cpuid  = cpu;
+	thd->cpuid = cpu;
+}
+
+/*
+ * Move the thread behind thd_cap to run on cpu.  This must be done on
+ * the core the thread is on, while it isn't running, so nothing else
+ * can touch the thread; after this, only the destination core can
+ * dispatch it, using the same capability.  Threads bound to a rcvcap
+ * move with it (arcv_migrate), and any scheduler event for the thread
+ * must be delivered first.
+ */
+static int
+thd_migrate(struct captbl *ct, capid_t thd_cap, cpuid_t cpu, struct thread *current)
+{
+	struct cos_cpu_local_info *cli = cos_cpu_local_info();
+	struct cap_thd *           tc;
+	struct thread *            thd;
+
+	tc = (struct cap_thd *)captbl_lkup(ct, thd_cap);
+	if (!tc || tc->h.type != CAP_THD || get_cpuid() != tc->cpuid) return -EINVAL;
+	thd = tc->t;
+	assert(thd);
+	if (cpu < 0 || cpu >= NUM_CPU || thd->cpuid != get_cpuid() || thd == current) return -EINVAL;
+	if (cpu == get_cpuid()) return 0;
+	if (thd_bound2rcvcap(thd) || thd->rcvcap.refcnt) return -EBUSY;
+	if (!list_empty(&thd->event_list)) return -EAGAIN;
+
+	__thd_migrate(cli, tc, thd, cpu);
+
+	return 0;
+}
+
+/*
+ * Give the thread the kernel memory at ext for the entries of its
+ * invocation stack past THD_INVSTK_INLINE.
+ */
+static int
+thd_invstk_ext_activate(struct captbl *ct, capid_t thd_cap, struct invstk_ext *ext)
+{
+	struct cap_thd *tc;
+	struct thread * thd;
+
+	tc = (struct cap_thd *)captbl_lkup(ct, thd_cap);
+	if (!tc || tc->h.type != CAP_THD || get_cpuid() != tc->cpuid) return -EINVAL;
+	thd = tc->t;
+	assert(thd);
+	if (thd->invstk_ext) return -EEXIST;
+
+	thd->invstk_ext = ext;
+
+	return 0;
+}
+
+/*
+ * Release the thread's invocation stack extension to the cos frame at
+ * cosframe_addr in pgtbl_cap.  The thread cannot be in an invocation
+ * that uses it.
+ */
+static int
+thd_invstk_ext_deactivate(struct captbl *ct, capid_t thd_cap, capid_t pgtbl_cap, capid_t cosframe_addr,
+                          struct thread *current)
+{
+	struct cos_cpu_local_info *cli = cos_cpu_local_info();
+	struct cap_thd *           tc;
+	struct thread *            thd;
+	struct invstk_ext *        ext;
+	unsigned long              old_v = 0, *pte = NULL;
+	int                        top, ret;
+
+	tc = (struct cap_thd *)captbl_lkup(ct, thd_cap);
+	if (!tc || tc->h.type != CAP_THD || get_cpuid() != tc->cpuid) return -EINVAL;
+	thd = tc->t;
+	assert(thd);
+	ext = thd->invstk_ext;
+	if (!ext) return -ENOENT;
+
+	/* the current thread's stack top is only cached in the cpu local info */
+	top = thd == current ? curr_invstk_top(cli) : thd->invstk_top;
+	if (top >= THD_INVSTK_INLINE) return -EBUSY;
+
+	ret = kmem_page_deact_pre(ext, ct, pgtbl_cap, cosframe_addr, &pte, &old_v);
+	if (ret) return ret;
+	thd->invstk_ext = NULL;
+	ret = kmem_deact_post(pte, old_v);
+	if (ret) thd->invstk_ext = ext;
+
+	return ret;
+}
+
 static void
 thd_init(void)
 {
 	/* Make sure all members of a struct thread is in a page */
 	assert(sizeof(struct thread) < PAGE_SIZE);
+	assert(__builtin_offsetof(struct thread, rcvcap.rcvcap_tcap) < CACHE_LINE);
 	assert(sizeof(struct cap_thd) <= __captbl_cap2bytes(CAP_THD));
 	// assert(offsetof(struct thread, regs) == 4); /* see THD_REGS in entry.S */
 }
@@ -509,7 +711,7 @@ thd_current_pgtbl(struct thread *thd)
 
 	/* don't use the cached invstk_top here. We need the stack
 	 * pointer of the specified thread. */
-	curr_entry = &thd->invstk[thd->invstk_top];
+	curr_entry = thd_invstk_entry(thd, thd->invstk_top);
 	return curr_entry->comp_info.pgtblinfo.pgtbl;
 }
 
@@ -518,11 +720,12 @@ thd_invstk_push(struct thread *thd, struct comp_info *ci, unsigned long ip, unsi
                 struct cos_cpu_local_info *cos_info)
 {
 	struct invstk_entry *top, *prev;
+	int                  depth = curr_invstk_top(cos_info) + 1;
 
-	if (unlikely(curr_invstk_top(cos_info) >= THD_INVSTK_MAXSZ)) return -1;
+	if (unlikely(depth >= THD_INVSTK_INLINE) && (!thd->invstk_ext || depth >= (int)THD_INVSTK_MAXSZ)) return -1;
 
-	prev = &thd->invstk[curr_invstk_top(cos_info)];
-	top  = &thd->invstk[curr_invstk_top(cos_info) + 1];
+	prev = thd_invstk_entry(thd, depth - 1);
+	top  = thd_invstk_entry(thd, depth);
 	curr_invstk_inc(cos_info);
 	prev->ip      = ip;
 	prev->sp      = sp;
@@ -543,8 +746,18 @@ thd_invstk_pop(struct thread *thd, unsigned long *ip, unsigned long *sp, prot_do
 	struct comp_info    *ci;
 
 	if (unlikely(curr_invstk_top(cos_info) == 0)) return NULL;
+	/*
+	 * Any user-level invocations made since the sinv must have
+	 * returned by now.  If they haven't (e.g. the server was
+	 * unwound), drop them so that the ul-invstk stays consistent
+	 * with the kernel's for ulinvstk_current.
+	 */
+	ulk_invstk = thd->ulk_invstk;
+	curr       = thd_invstk_entry(thd, curr_invstk_top(cos_info));
+	if (likely(ulk_invstk) && unlikely(ulk_invstk->top != curr->ulk_stkoff)) ulk_invstk->top = curr->ulk_stkoff;
+
 	curr_invstk_dec(cos_info);
-	curr = &thd->invstk[curr_invstk_top(cos_info)];
+	curr = thd_invstk_entry(thd, curr_invstk_top(cos_info));
 
 	ci       = &curr->comp_info;
 	*ip      = curr->ip;
@@ -557,13 +770,13 @@ thd_invstk_pop(struct thread *thd, unsigned long *ip, unsigned long *sp, prot_do
 static inline void
 thd_invstk_protdom_update(struct thread *thd,struct cos_cpu_local_info *cos_info, prot_domain_t protdom)
 {
-	thd->invstk[curr_invstk_top(cos_info)].protdom = protdom; 
+	thd_invstk_entry(thd, curr_invstk_top(cos_info))->protdom = protdom;
 }
 
 static inline prot_domain_t
 thd_invstk_protdom_curr(struct thread *thd)
 {
-	return thd->invstk[thd->invstk_top].protdom; 
+	return thd_invstk_entry(thd, thd->invstk_top)->protdom;
 }
 
 /* defined in ulinv.c */
@@ -577,7 +790,7 @@ thd_invstk_current(struct thread *curr_thd, unsigned long *ip, unsigned long *sp
 	struct ulk_invstk   *ulk_invstk;
 	struct comp_info    *ci;
 
-	curr = &curr_thd->invstk[curr_invstk_top(cos_info)];
+	curr = thd_invstk_entry(curr_thd, curr_invstk_top(cos_info));
 	ulk_invstk = curr_thd->ulk_invstk;
 
 	/* this thread makes no userlevel-invs */
@@ -593,8 +806,8 @@ thd_invstk_current(struct thread *curr_thd, unsigned long *ip, unsigned long *sp
 	 */
 	if (ulk_invstk->top > curr->ulk_stkoff) {
 		ci = ulinvstk_current(ulk_invstk, &curr->comp_info, curr->ulk_stkoff);
-		curr->protdom = ci->pgtblinfo.protdom;
 		if (unlikely(!ci)) return NULL;
+		curr->protdom = ci->pgtblinfo.protdom;
 	} else {
 		ci = &curr->comp_info;
 	}
@@ -621,7 +834,7 @@ thd_invstk_curr_comp(struct thread *thd, struct pgtbl_info **next_pt, struct cos
 	struct ulk_invstk   *ulk_invstk;
 	struct comp_info    *ci;
 
-	curr = &thd->invstk[thd->invstk_top];
+	curr = thd_invstk_entry(thd, thd->invstk_top);
 	ulk_invstk = thd->ulk_invstk;
 
 	/* current pagetable is always on the kernel invstk */
@@ -659,8 +872,14 @@ thd_rcvcap_pending_deliver(struct thread *thd, struct pt_regs *regs)
 {
 	unsigned long thd_state = 0, cycles = 0, timeout = 0, pending = 0;
 	int           all_pending = thd_rcvcap_all_pending_get(thd);
+	int           nevts;
 
-	thd_state_evt_deliver(thd, &thd_state, &cycles, &timeout);
+	/* thd_state is the number of events in the batch */
+	if (thd->evt_batch.uaddr && (nevts = thd_state_evt_batch_deliver(thd)) >= 0) {
+		thd_state = nevts;
+	} else {
+		thd_state_evt_deliver(thd, &thd_state, &cycles, &timeout);
+	}
 	if (all_pending) {
 		pending = thd_rcvcap_all_pending(thd);
 	} else {
@@ -676,6 +895,7 @@ thd_switch_update(struct thread *thd, struct pt_regs *regs, int issame)
 	int preempt = 0;
 
 	fpu_switch(thd);
+	pmu_switch(&thd->pmu);
 	if (thd->state & THD_STATE_PREEMPTED) {
 		assert(!(thd->state & THD_STATE_RCVING));
 		thd->state &= ~THD_STATE_PREEMPTED;
@@ -0,0 +1,33 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "shared/cos_types.h"
+#include "captbl.h"
+
+/*
+ * The kernel side of a core's trace ring (see struct
+ * cos_trace_ring): the kernel addresses of its pages, which needn't
+ * be contiguous.  Only the owning core writes it.
+ */
+struct trace_ring {
+	struct cos_trace_evt *pages[COS_TRACE_RING_PAGES];
+	struct cos_trace_hdr *hdr;
+	int                   npages;
+} CACHE_ALIGNED;
+
+extern u32_t trace_mask;
+
+void  trace_record(cos_trace_type_t type, unsigned long thd, unsigned long arg);
+void  trace_sample(struct pt_regs *regs);
+int   trace_ring_map(struct captbl *t, cpuid_t cpu, unsigned long pgidx, capid_t kmem_pt, vaddr_t kaddr,
+                     capid_t ptcap, vaddr_t uaddr);
+u32_t trace_mask_set(u32_t mask);
+
+/* Disabled tracing costs a single load and predicted branch */
+static inline void
+cos_trace(cos_trace_type_t type, unsigned long thd, unsigned long arg)
+{
+	if (unlikely(trace_mask & COS_TRACE_MASK(type))) trace_record(type, thd, arg);
+}
+
+#endif /* TRACE_H */
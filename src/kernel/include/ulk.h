@@ -7,10 +7,19 @@
 
 #define ULK_PGTBL_FLAG (1ul << 59)
 
+/*
+ * A page of user-level invocation stacks.  It is mapped at uaddr in
+ * the ulk page-table (accessible only with the ulk MPK key), and
+ * threads reference their stack in it, thus refcnt.
+ */
 struct cap_ulk {
     struct cap_header     h;
     struct liveness_data  liveness;
     vaddr_t               kern_addr;
+    pgtbl_t               pgtbl;
+    vaddr_t               uaddr;
+    u32_t                 refcnt;
+    u64_t                 frozen_ts; /* when the user mapping was removed, 0 if mapped */
 } __attribute__((packed));
 
 static int
@@ -30,6 +39,10 @@ ulk_activate(struct captbl *t, capid_t ctcap, capid_t ulkcapid, livenessid_t lid
 
     ltbl_get(lid, &ulkcap->liveness);
     ulkcap->kern_addr = kaddr;
+    ulkcap->pgtbl     = ptcap->pgtbl;
+    ulkcap->uaddr     = uaddr;
+    ulkcap->refcnt    = 0;
+    ulkcap->frozen_ts = 0;
     memset((void *)kaddr, 0, PAGE_SIZE);
 
     __cap_capactivate_post(&ulkcap->h, CAP_ULK);
@@ -37,12 +50,62 @@ ulk_activate(struct captbl *t, capid_t ctcap, capid_t ulkcapid, livenessid_t lid
     return ret;
 }
 
+static inline struct ulk_invstk *
+ulk_invstk_get(struct cap_ulk *ulkcap, thdid_t tid)
+{
+    return &((struct ulk_invstk *)(ulkcap->kern_addr))[tid % ULK_STACKS_PER_PAGE];
+}
+
+static inline void
+ulk_take(struct cap_ulk *ulkcap)
+{
+    cos_faa((int *)&ulkcap->refcnt, 1);
+}
+
+static inline void
+ulk_release(struct cap_ulk *ulkcap)
+{
+    cos_faa((int *)&ulkcap->refcnt, -1);
+}
+
+/*
+ * Deactivation is two-phase as the page is mapped at user-level: the
+ * first call removes the user mapping (no thread can still be using
+ * the stacks), and returns -EQUIESCENCE.  Once the TLBs are quiescent,
+ * a retry releases the kernel memory to the cos frame at
+ * cosframe_addr in ptcap.
+ */
 static int
 ulk_deactivate(struct cap_captbl *ct, capid_t ulkcap, capid_t ptcap, capid_t cosframe_addr, livenessid_t lid)
 {
-    /* TODO */
-    assert(0);
-    return 0;
+    struct cap_ulk *ulkc;
+    unsigned long  *pte, old_v = 0, *uaddr_pte;
+    word_t          flags;
+    u64_t           ts;
+    int             ret;
+
+    ulkc = (struct cap_ulk *)captbl_lkup(ct->captbl, ulkcap);
+    if (!CAP_TYPECHK(ulkc, CAP_ULK)) return -EINVAL;
+    if (ulkc->refcnt) return -EBUSY;
+
+    if (!ulkc->frozen_ts) {
+        uaddr_pte = pgtbl_lkup_pte(ulkc->pgtbl, ulkc->uaddr, &flags);
+        if (!uaddr_pte) return -EINVAL;
+        old_v = *uaddr_pte;
+        if (cos_cas(uaddr_pte, old_v, 0) != CAS_SUCCESS) return -ECASFAIL;
+        rdtscll(ts);
+        ulkc->frozen_ts = ts;
+
+        return -EQUIESCENCE;
+    }
+    if (!tlb_quiescence_check(ulkc->frozen_ts)) return -EQUIESCENCE;
+
+    ret = kmem_deact_pre(&ulkc->h, ct->captbl, ptcap, cosframe_addr, &pte, &old_v);
+    if (ret) return ret;
+    ret = cap_capdeactivate(ct, ulkcap, CAP_ULK, lid);
+    if (ret) return ret;
+
+    return kmem_deact_post(pte, old_v);
 }
 
 #endif
\ No newline at end of file
@@ -163,6 +163,21 @@ done:
 	return ret;
 }
 
+/*
+ * Notify the vcpu of the vmcb of the interrupts posted in its
+ * descriptor. The vcpu runs on the core of its handler thread.
+ */
+static int
+vm_vmcb_notify(struct cap_vm_vmcb *vmcb)
+{
+	struct thread *handler = vmcb->handler_thd->t;
+
+	if (unlikely(!handler)) return -EINVAL;
+	vm_vcpu_notify(handler->cpuid);
+
+	return 0;
+}
+
 static void
 vm_cap_init(void)
 {
@@ -6,7 +6,7 @@ ltbl_init(void)
 	int i;
 
 	for (i = 0; i < LTBL_ENTS; i++) {
-		__liveness_tbl[i].epoch           = 0;
-		__liveness_tbl[i].deact_timestamp = 0;
+		__liveness_epochs[i]   = 0;
+		__liveness_deact_ts[i] = 0;
 	}
 }
@@ -18,6 +18,138 @@ tlb_quiescence_check(u64_t timestamp)
 	return chal_tlb_quiescence_check(timestamp);
 }
 
+/*
+ * Deferred TLB shootdown.  Unmapping doesn't flush any TLBs, it only
+ * starts a new shootdown generation.  The unmapped entries carry
+ * their liveness id, so their reuse waits until every core has
+ * flushed after the unmap (tlb_quiescence_check).  A core catches up
+ * with all pending generations with a single flush on its next timer
+ * tick, or when a core waiting for quiescence sends it an IPI, which
+ * happens at most once per core per generation.
+ */
+u32_t tlb_shootdown_gen CACHE_ALIGNED;
+
+void
+tlb_mandatory_flush(void *arg)
+{
+	unsigned long long t;
+	(void)arg;
+
+	rdtscll(t);
+	/* Order is important: get tsc before action. */
+	chal_flush_tlb();
+	/* But commit after. */
+	tlb_quiescence[get_cpuid()].last_mandatory_flush = t;
+}
+
+void
+tlb_shootdown_defer(void)
+{
+	cos_faa((int *)&tlb_shootdown_gen, 1);
+}
+
+void
+tlb_shootdown_process(void)
+{
+	struct tlb_quiescence *q   = &tlb_quiescence[get_cpuid()];
+	u32_t                  gen = *(volatile u32_t *)&tlb_shootdown_gen;
+
+	if (likely(q->flushed_gen == gen)) return;
+
+	tlb_mandatory_flush(NULL);
+	q->flushed_gen = gen;
+}
+
+void
+tlb_shootdown_request(void)
+{
+	u32_t gen = *(volatile u32_t *)&tlb_shootdown_gen;
+	int   i, lagging = 0;
+
+	for (i = 0; i < NUM_CPU_COS; i++) {
+		if (tlb_quiescence[i].flushed_gen != gen) lagging = 1;
+	}
+	/* Nothing deferred is pending, so whatever we wait on needs a new generation */
+	if (!lagging) gen = cos_faa((int *)&tlb_shootdown_gen, 1) + 1;
+
+	tlb_shootdown_process();
+	for (i = 0; i < NUM_CPU_COS; i++) {
+		struct tlb_quiescence *q    = &tlb_quiescence[i];
+		u32_t                  sent = q->ipi_gen;
+
+		if (i == get_cpuid() || q->flushed_gen == gen || sent == gen) continue;
+		if (cos_cas_32((void *)&q->ipi_gen, sent, gen) != CAS_SUCCESS) continue;
+		chal_send_ipi(i);
+	}
+}
+
+/*
+ * Kernel pool of ASIDs (x86 PCIDs) for components activated without
+ * one (ASID 0).  The lower half of the ASID space is left to the
+ * user-level protection domain namespaces.  Reuse is safe without any
+ * flush here: the per-core ASID -> page-table cache in
+ * chal_pgtbl_update flushes the first time a recycled ASID is loaded
+ * with a different page-table.
+ */
+#if NUM_ASID_MAX > 0
+#define PGTBL_ASID_POOL_BASE ((NUM_ASID_MAX + 1) / 2)
+#define PGTBL_ASID_POOL_WORDS ((NUM_ASID_MAX + 1 - PGTBL_ASID_POOL_BASE) / 32)
+
+static u32_t pgtbl_asid_pool[PGTBL_ASID_POOL_WORDS] CACHE_ALIGNED;
+static u32_t pgtbl_asid_hint;
+
+u16_t
+pgtbl_asid_alloc(void)
+{
+	u32_t i, start = pgtbl_asid_hint;
+
+	for (i = 0; i < PGTBL_ASID_POOL_WORDS; i++) {
+		u32_t w = (start + i) % PGTBL_ASID_POOL_WORDS;
+		u32_t v;
+
+		while ((v = *(volatile u32_t *)&pgtbl_asid_pool[w]) != ~0U) {
+			u32_t bit = __builtin_ctz(~v);
+
+			if (cos_cas_32((void *)&pgtbl_asid_pool[w], v, v | (1U << bit)) != CAS_SUCCESS) continue;
+			pgtbl_asid_hint = w;
+
+			return PGTBL_ASID_POOL_BASE + w * 32 + bit;
+		}
+	}
+
+	/* Exhausted: share ASID 0, whose switches simply flush */
+	return 0;
+}
+
+void
+pgtbl_asid_free(u16_t asid)
+{
+	u32_t w, bit, v;
+
+	if (asid < PGTBL_ASID_POOL_BASE || asid > NUM_ASID_MAX) return;
+	w   = (asid - PGTBL_ASID_POOL_BASE) / 32;
+	bit = (asid - PGTBL_ASID_POOL_BASE) % 32;
+
+	do {
+		v = *(volatile u32_t *)&pgtbl_asid_pool[w];
+		/* a user-provided ASID in the pool range */
+		if (!(v & (1U << bit))) return;
+	} while (cos_cas_32((void *)&pgtbl_asid_pool[w], v, v & ~(1U << bit)) != CAS_SUCCESS);
+}
+#else
+u16_t
+pgtbl_asid_alloc(void)
+{
+	return 0;
+}
+
+void
+pgtbl_asid_free(u16_t asid)
+{
+	(void)asid;
+}
+#endif
+
 int
 cap_memactivate(struct captbl *ct, struct cap_pgtbl *pt, capid_t frame_cap, capid_t dest_pt, vaddr_t vaddr, vaddr_t order)
 {
@@ -58,7 +190,12 @@ pgtbl_mapping_mod(pgtbl_t pt, u32_t addr, u32_t flags, u32_t *prevflags)
 int
 pgtbl_mapping_del(pgtbl_t pt, vaddr_t addr, u32_t liv_id)
 {
-	return chal_pgtbl_mapping_del(pt, addr, liv_id);
+	int ret;
+
+	ret = chal_pgtbl_mapping_del(pt, addr, liv_id);
+	if (!ret) tlb_shootdown_defer();
+
+	return ret;
 }
 
 /* 
@@ -71,6 +208,12 @@ pgtbl_mapping_del_direct(pgtbl_t pt, u32_t addr)
 	return chal_pgtbl_mapping_del_direct(pt, addr);
 }
 
+int
+pgtbl_mapping_revoke(pgtbl_t pt, vaddr_t addr, paddr_t page)
+{
+	return chal_pgtbl_mapping_revoke(pt, addr, page);
+}
+
 int
 pgtbl_mapping_scan(struct cap_pgtbl *pt)
 {
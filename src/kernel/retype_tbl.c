@@ -25,6 +25,13 @@ struct page_record {
 struct retype_info     retype_tbl[NUM_CPU] CACHE_ALIGNED;
 struct retype_info_glb glb_retype_tbl[N_RETYPE_SLOTS] CACHE_ALIGNED;
 
+/* Count of typed pages in each NUMA node, for introspection */
+struct retype_numa_info {
+	int  user, kern;
+	char __pad[CACHE_LINE - 2 * sizeof(int)];
+};
+struct retype_numa_info retype_numa_tbl[NUMA_NODES_MAX] CACHE_ALIGNED;
+
 /* The start positions of the tables - also architecture-specific */
 const int pos2base[] = {0, N_MEM_SETS};
 
@@ -166,6 +173,22 @@ atomic_type_swap(void* ptr, int old_type, int new_type, int clear)
 	return retypetbl_cas((u32_t*)ptr, old_temp.refcnt_atom.v, temp.refcnt_atom.v);
 }
 
+static inline void
+retypetbl_numa_account(void *pa, mem_type_t type, int npages)
+{
+	struct retype_numa_info *n = &retype_numa_tbl[chal_numa_pa_node((paddr_t)pa, NULL)];
+
+	cos_faa(type == RETYPETBL_USER ? &n->user : &n->kern, npages);
+}
+
+int
+retypetbl_numa_pages(int node, mem_type_t type)
+{
+	if (node < 0 || node >= NUMA_NODES_MAX) return -EINVAL;
+
+	return type == RETYPETBL_USER ? retype_numa_tbl[node].user : retype_numa_tbl[node].kern;
+}
+
 static inline int
 mod_mem_type(void *pa, u32_t order, const mem_type_t type)
 {
@@ -247,6 +270,7 @@ mod_mem_type(void *pa, u32_t order, const mem_type_t type)
 	/* Now commit the change to the global entry. */
 	ret = atomic_type_swap(walk[POS(order)].p_glb, RETYPETBL_RETYPING, type, 1);
 	assert(ret == CAS_SUCCESS);
+	retypetbl_numa_account(pa, type, 1 << (order - MIN_PAGE_ORDER));
 
 	return 0;
 err:
@@ -343,6 +367,7 @@ retypetbl_retype2frame(void *pa, u32_t order)
 		retype_info->refcnt_atom.v = 0;
 	}
 	assert(atomic_type_swap(glb_retype_info, RETYPETBL_RETYPING, RETYPETBL_UNTYPED, 0) == CAS_SUCCESS);
+	retypetbl_numa_account(pa, old_type, -(1 << (order - MIN_PAGE_ORDER)));
 
 	return 0;
 err:
@@ -372,6 +397,7 @@ retype_tbl_init(void)
 	assert(sizeof(glb_retype_tbl) % CACHE_LINE == 0);
 	assert((unsigned long)retype_tbl % CACHE_LINE == 0);
 	assert((unsigned long)glb_retype_tbl % CACHE_LINE == 0);
+	assert(sizeof(struct retype_numa_info) == CACHE_LINE);
 
 	assert(sizeof(union refcnt_atom) == sizeof(u32_t));
 	assert(RETYPE_ENT_TYPE_SZ + RETYPE_ENT_REFCNT_SZ == 32);
@@ -392,6 +418,7 @@ retype_tbl_init(void)
 		glb_retype_tbl[i].info.kernel_ref = 0;
 	}
 
+	memset(retype_numa_tbl, 0, sizeof(retype_numa_tbl));
 	cos_mem_fence();
 
 	return;
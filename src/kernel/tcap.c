@@ -13,12 +13,16 @@
 #include "include/thd.h"
 #include "include/shared/cos_types.h"
 #include "include/chal/defs.h"
+#include "include/acct.h"
+
+struct tcap_timer tcap_timers[NUM_CPU] CACHE_ALIGNED;
 
 /* This is jacked.  Only in here to avoid a header file circular dependency. */
 void
-__thd_exec_add(struct thread *t, cycles_t cycles)
+__thd_exec_add(struct thread *t, struct tcap *tc, cycles_t cycles)
 {
 	t->exec += cycles;
+	thd_acct_exec(t->tid, tc->arcv_ep ? tc->arcv_ep->tid : 0, cycles);
 }
 
 /*** TCap Operations ***/
@@ -44,6 +48,9 @@ __tcap_init(struct tcap *t)
 	t->arcv_ep                 = NULL;
 	t->perm_prio               = 0;
 	tcap_setprio(t, 0);
+	/* the tcap's memory might be reused: never match a stale cache entry */
+	t->deleg_gen++;
+	t->deleg_cached_gen = t->deleg_gen - 1;
 	list_init(&t->active_list, t);
 }
 
@@ -63,6 +70,7 @@ tcap_delete(struct tcap *tcap)
 	memset(&tcap->budget, 0, sizeof(struct tcap_budget));
 	memset(tcap->delegations, 0, sizeof(struct tcap_sched_info) * TCAP_MAX_DELEGATIONS);
 	tcap->ndelegs = tcap->cpuid = tcap->curr_sched_off = tcap->perm_prio = 0;
+	tcap->deleg_gen++;
 	if (cli->next_ti.tc == tcap) thd_next_thdinfo_update(cli, 0, 0, 0, 0);
 
 	return 0;
@@ -132,6 +140,37 @@ tcap_promote(struct tcap *t, struct thread *thd)
 	t->arcv_ep = thd;
 }
 
+/*
+ * Move the tcap to cpu, with the rcv end-point it is bound to (see
+ * arcv_migrate). Its budget, and its delegations, are from this
+ * core's schedulers, so it loses them, and the destination's
+ * scheduler delegates to it as to a new tcap. It keeps its uid, as
+ * the uids are unique across cores (see boot_comp.c).
+ */
+int
+tcap_migrate(struct tcap *t, cpuid_t cpu)
+{
+	struct cos_cpu_local_info *cli = cos_cpu_local_info();
+
+	assert(t);
+	if (unlikely(t->cpuid != get_cpuid() || tcap_current(cli) == t)) return -EINVAL;
+
+	if (cli->next_ti.tc == t) thd_next_thdinfo_update(cli, 0, 0, 0, 0);
+	if (tcap_is_active(t)) tcap_active_rem(t);
+	memset(&t->budget, 0, sizeof(struct tcap_budget));
+	memset(&t->delegations[1], 0, sizeof(struct tcap_sched_info) * (TCAP_MAX_DELEGATIONS - 1));
+	t->ndelegs        = 1;
+	t->curr_sched_off = 0;
+	tcap_setprio(t, 0);
+	t->deleg_gen++;
+	t->deleg_cached_gen = t->deleg_gen - 1;
+
+	cos_mem_fence();
+	t->cpuid = cpu;
+
+	return 0;
+}
+
 int
 tcap_delegate(struct tcap *dst, struct tcap *src, tcap_res_t cycles, tcap_prio_t prio)
 {
@@ -153,12 +192,23 @@ tcap_delegate(struct tcap *dst, struct tcap *src, tcap_res_t cycles, tcap_prio_t
 	d = tcap_sched_info(dst)->tcap_uid;
 	s = tcap_sched_info(src)->tcap_uid;
 	if (unlikely(dst == src)) {
-		tcap_sched_info(dst)->prio = prio;
-		dst->perm_prio             = prio;
+		tcap_setprio(dst, prio);
+		dst->perm_prio = prio;
 		return 0;
 	}
 	if (!prio) prio = tcap_sched_info(src)->prio;
 
+	/*
+	 * Fast path: a parent scheduler repeatedly replenishing its
+	 * child, with neither of their delegations having changed
+	 * since, only needs to move the budget.
+	 */
+	if (likely(dst->deleg_cached_gen == dst->deleg_gen && dst->deleg_src_uid == s
+	           && dst->deleg_src_gen == src->deleg_gen && dst->deleg_prio == prio)) {
+		if (__tcap_budget_xfer(dst, src, cycles)) return -EINVAL;
+		return 0;
+	}
+
 	for (i = 0, j = 0, ndelegs = 0; i < dst->ndelegs || j < src->ndelegs; ndelegs++) {
 		struct tcap_sched_info *n, t;
 
@@ -199,6 +249,11 @@ tcap_delegate(struct tcap *dst, struct tcap *src, tcap_res_t cycles, tcap_prio_t
 	dst->curr_sched_off        = si;
 	dst->perm_prio             = prio;
 	tcap_sched_info(dst)->prio = prio;
+	dst->deleg_gen++;
+	dst->deleg_cached_gen = dst->deleg_gen;
+	dst->deleg_src_uid    = s;
+	dst->deleg_src_gen    = src->deleg_gen;
+	dst->deleg_prio       = prio;
 	/*
 	 * TODO: Logic to differentiate between scheduler and non-scheduler tcaps!
 	 *       non-scheduler tcaps to have curr_sched_off set to their schedulers and no dedicated uids.
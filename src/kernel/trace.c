@@ -0,0 +1,125 @@
+#include "include/trace.h"
+#include "include/cap_ops.h"
+#include "include/pgtbl.h"
+#include "include/chal/cpuid.h"
+#include "include/thd.h"
+
+struct trace_ring trace_rings[NUM_CPU] CACHE_ALIGNED;
+u32_t             trace_mask CACHE_ALIGNED;
+
+/* A component's page-table id, as the HW_PGFLT_PGTBL_ID of its page-table */
+static inline u32_t
+trace_pgtbl_id(struct invstk_entry *e)
+{
+	return (u32_t)((unsigned long)e->comp_info.pgtblinfo.pgtbl / PAGE_SIZE);
+}
+
+static inline void
+__trace_record(struct trace_ring *r, u64_t tsc, cos_trace_type_t type, unsigned long thd, unsigned long arg)
+{
+	struct cos_trace_evt *e;
+	u64_t                 head;
+	unsigned long         slot;
+
+	head = r->hdr->head;
+	slot = COS_TRACE_HDR_NEVTS + (unsigned long)(head % COS_TRACE_RING_NEVTS);
+	e    = &r->pages[slot / COS_TRACE_PAGE_NEVTS][slot % COS_TRACE_PAGE_NEVTS];
+
+	*e = (struct cos_trace_evt){
+		.tsc  = tsc,
+		.type = type,
+		.thd  = thd,
+		.arg  = arg,
+	};
+	/* publish the event only after it is written */
+	cos_mem_fence();
+	r->hdr->head = head + 1;
+}
+
+void
+trace_record(cos_trace_type_t type, unsigned long thd, unsigned long arg)
+{
+	struct trace_ring *r = &trace_rings[get_cpuid()];
+
+	/* tracing can be enabled before all of the cores' rings are mapped */
+	if (unlikely(r->npages != COS_TRACE_RING_PAGES)) return;
+
+	__trace_record(r, tsc(), type, thd, arg);
+}
+
+/*
+ * Record a sample of the execution interrupted with regs (by the
+ * sampling counter's overflow): the components on the current
+ * thread's invocation stack, and where each executes (see
+ * COS_TRACE_SAMPLE). Only user-level execution is sampled.
+ */
+void
+trace_sample(struct pt_regs *regs)
+{
+	struct trace_ring         *r   = &trace_rings[get_cpuid()];
+	struct cos_cpu_local_info *cli = cos_cpu_local_info();
+	struct thread             *thd = thd_current(cli);
+	int                        top = curr_invstk_top(cli), i;
+
+	if (unlikely(r->npages != COS_TRACE_RING_PAGES) || (regs->cs & 3) != 3) return;
+
+	__trace_record(r, regs->ip, COS_TRACE_SAMPLE, thd->tid, trace_pgtbl_id(thd_invstk_entry(thd, top)));
+	for (i = top - 1; i >= 0; i--) {
+		__trace_record(r, thd_invstk_entry(thd, i)->ip, COS_TRACE_SAMPLE_CALLER, thd->tid, trace_pgtbl_id(thd_invstk_entry(thd, i)));
+	}
+}
+
+/*
+ * Use the kernel memory at kaddr (in kmem_pt) as page pgidx of cpu's
+ * ring, mapped read-only at uaddr in ptcap.  The ring records once
+ * all of its pages are mapped.
+ */
+int
+trace_ring_map(struct captbl *t, cpuid_t cpu, unsigned long pgidx, capid_t kmem_pt, vaddr_t kaddr, capid_t ptcap,
+               vaddr_t uaddr)
+{
+	struct trace_ring *r;
+	struct cap_pgtbl * ptc;
+	unsigned long      kmem, *pte;
+	int                ret;
+
+	if (cpu >= NUM_CPU || pgidx >= COS_TRACE_RING_PAGES) return -EINVAL;
+	r = &trace_rings[cpu];
+	if (r->pages[pgidx]) return -EEXIST;
+
+	ptc = (struct cap_pgtbl *)captbl_lkup(t, ptcap);
+	if (!CAP_TYPECHK(ptc, CAP_PGTBL)) return -EINVAL;
+
+	ret = cap_kmem_activate(t, kmem_pt, kaddr, &kmem, &pte);
+	if (ret) return ret;
+	memset((void *)kmem, 0, PAGE_SIZE);
+	ret = pgtbl_mapping_add(ptc->pgtbl, uaddr, chal_va2pa((void *)kmem), PGTBL_PRESENT | PGTBL_USER | PGTBL_ACCESSED,
+	                        PAGE_ORDER);
+	if (ret) {
+		kmem_unalloc(pte);
+		return ret;
+	}
+
+	if (cos_cas((unsigned long *)&r->pages[pgidx], 0, kmem) != CAS_SUCCESS) {
+		/* the user mapping stays, but the page is never written */
+		return -ECASFAIL;
+	}
+	if (pgidx == 0) {
+		r->hdr        = (struct cos_trace_hdr *)kmem;
+		r->hdr->nevts = COS_TRACE_RING_NEVTS;
+		r->hdr->cpu   = cpu;
+	}
+	cos_faa(&r->npages, 1);
+
+	return 0;
+}
+
+u32_t
+trace_mask_set(u32_t mask)
+{
+	u32_t old = trace_mask;
+
+	trace_mask = mask & COS_TRACE_MASK_ALL;
+
+	return old;
+}
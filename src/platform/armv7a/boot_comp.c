@@ -16,6 +16,7 @@
 extern u8_t *boot_comp_pgd;
 
 struct cap_asnd hw_asnd_caps[HW_IRQ_TOTAL];
+struct hw_irq_line hw_irq_lines[HW_IRQ_EXTERNAL_NUM];
 void *thd_mem[NUM_CPU], *tcap_mem[NUM_CPU];
 struct captbl *glb_boot_ct;
 
@@ -50,7 +51,7 @@ kern_boot_thd(struct captbl *ct, void *thd_mem, void *tcap_mem, const cpuid_t cp
 	tc->perm_prio     = 0;
 	tcap_setprio(tc, 0);                              /* Chronos gets preempted by no one! */
 	list_enqueue(&cos_info->tcaps, &tc->active_list); /* Chronos on the TCap active list */
-	cos_info->tcap_uid  = 1;
+	cos_info->tcap_uid  = ((tcap_uid_t)cpu_id << 48) | 1;
 	cos_info->cycles    = tsc();
 	cos_info->curr_tcap = tc;
 	thd_next_thdinfo_update(cos_info, 0, 0, 0, 0);
@@ -138,6 +138,17 @@
 #define CAV7_GTMR_GTCNTRL CAV7_SFR(CAV7_GTMR_BASE, 0x0000)
 #define CAV7_GTMR_GTCNTRH CAV7_SFR(CAV7_GTMR_BASE, 0x0004)
 #define CAV7_GTMR_GTCTLR CAV7_SFR(CAV7_GTMR_BASE, 0x0008)
+#define CAV7_GTMR_GTCTLR_AUTOINC (1U << 3U)
+#define CAV7_GTMR_GTCTLR_IRQEN (1U << 2U)
+#define CAV7_GTMR_GTCTLR_COMPEN (1U << 1U)
+#define CAV7_GTMR_GTCTLR_TIMEN (1U << 0U)
+/* Interrupt status register - write 1 to clear */
+#define CAV7_GTMR_GTISR CAV7_SFR(CAV7_GTMR_BASE, 0x000C)
+/* Comparator registers, banked per core */
+#define CAV7_GTMR_GTCOMPL CAV7_SFR(CAV7_GTMR_BASE, 0x0010)
+#define CAV7_GTMR_GTCOMPH CAV7_SFR(CAV7_GTMR_BASE, 0x0014)
+/* The comparator's private peripheral interrupt */
+#define CAV7_GTMR_IRQ 27
 
 #define CAV7_L2C_BASE 0xF8F02000
 /* Cache ID register */
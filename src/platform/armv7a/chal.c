@@ -4,8 +4,8 @@
 #include "mem_layout.h"
 #include "chal_cpu.h"
 #include "irq.h"
+#include <pgtbl.h>
 
-u32_t        free_thd_id = 1;
 asid_t       free_asid   = 1; /* reserve 0 for synchronization if necessary! */
 char         timer_detector[PAGE_SIZE] PAGE_ALIGNED;
 extern void *cos_kmem, *cos_kmem_base;
@@ -66,6 +66,82 @@ chal_cyc_usec(void)
 	return CYC_PER_USEC;
 }
 
+/* No SRAT-like description here: everything is in node 0 */
+int
+chal_numa_nnodes(void)
+{
+	return 1;
+}
+
+int
+chal_numa_cpu_node(cpuid_t cpu)
+{
+	return 0;
+}
+
+int
+chal_numa_pa_node(paddr_t pa, paddr_t *extent)
+{
+	if (extent) *extent = COS_MEM_BOUND;
+
+	return 0;
+}
+
+unsigned long
+chal_numa_node_pages(int node)
+{
+	return node ? 0 : COS_MAX_MEMORY;
+}
+
+struct cos_topology *
+chal_topology(void)
+{
+	static struct cos_topology topo = { .ncpus = 1, .nnodes = 1, .distance = { { 10 } } };
+
+	return &topo;
+}
+
+/* TODO: mask the line in the interrupt distributor; for now, polling just suppresses delivery */
+void
+chal_irq_mask(int irq)
+{ }
+
+void
+chal_irq_unmask(int irq)
+{ }
+
+/* TODO: GICv2 has no message-signaled interrupts */
+int
+chal_irq_msi_dest(int irq, cpuid_t cpu)
+{
+	return -EINVAL;
+}
+
+/* No DMA remapping on this platform */
+int
+chal_iommu_bind(u16_t bdf, struct cap_pgtbl *pt)
+{
+	return -ENOENT;
+}
+
+int
+chal_iommu_unbind(u16_t bdf)
+{
+	return -ENOENT;
+}
+
+void
+chal_iommu_pgtbl_flush(struct cap_pgtbl *pt, int map)
+{
+}
+
+/* No EPT on this platform */
+int
+chal_pgtbl_ept_dirty(struct cap_pgtbl *pt, vaddr_t gpa, unsigned long npages, unsigned long *bitmap)
+{
+	return -EINVAL;
+}
+
 void
 _exit(int code)
 {
@@ -80,6 +80,19 @@ cos_mem_fence(void)
 	__asm__ __volatile__("dmb" ::: "memory");
 }
 
+/* order prior stores before later ones */
+static inline void
+cos_wmb(void)
+{
+	__asm__ __volatile__("dmb st" ::: "memory");
+}
+
+/*
+ * Count system calls per capability type and operation, and
+ * histogram their durations (see struct cos_syscall_stats).
+ */
+#define COS_SYSCALL_STATS 0
+
 /* 256 entries. can be increased if necessary */
 #define COS_THD_INIT_REGION_SIZE (1 << 8)
 // Static entries are after the dynamic allocated entries
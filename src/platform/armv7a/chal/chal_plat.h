@@ -1,11 +1,13 @@
 #ifndef CHAL_PLAT_H
 #define CHAL_PLAT_H
 
-/* This flushes all levels of cache of the current logical CPU. */
+/* This cleans and invalidates the L1 data cache of the current logical CPU (by set/way). */
+void Xil_L1DCacheFlush(void);
+
 static inline void
 chal_flush_cache(void)
 {
-	asm volatile("wbinvd" : : : "memory");
+	Xil_L1DCacheFlush();
 }
 
 static inline void
@@ -16,10 +18,16 @@ static inline void
 chal_remote_tlb_flush(int target_cpu)
 {
 }
-/* This won't flush global TLB (pinned with PGE) entries. */
+/* This won't flush global TLB (locked down) entries. */
 static inline void
 chal_flush_tlb(void)
 {
+	/* TLBIALL */
+	__asm__ __volatile__("dsb \n\t"
+	                     "mcr p15, 0, %0, c8, c7, 0 \n\t"
+	                     "dsb \n\t"
+	                     "isb \n\t"
+	                     :: "r"(0) : "memory");
 }
 
 static inline void *
@@ -36,10 +44,10 @@ chal_va2pa(void *address)
 
 
 int chal_tlb_lockdown(unsigned long entryid, unsigned long vaddr, unsigned long paddr);
-int chal_tlbflush(int a);
+int chal_tlbflush(vaddr_t addr, unsigned long sz);
 int chal_tlbstall(void);
 int chal_tlbstall_recount(int a);
 
-int chal_l1flush(void);
+int chal_l1flush(vaddr_t addr, unsigned long sz);
 
 #endif /* CHAL_PLAT_H */
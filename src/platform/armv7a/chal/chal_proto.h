@@ -50,7 +50,18 @@ chal_pgtbl_update(struct pgtbl_info *ptinfo)
 	 * but wasn't successful with any of those. 
 	 * Not sure what I did wrong.. Now this woks
 	 */
-	paddr_t ttbr0 = chal_va2pa(ptinfo->pgtbl) | 0x4a;
+	paddr_t       ttbr0 = chal_va2pa(ptinfo->pgtbl) | 0x4a;
+	unsigned long cur_ttbr0, cur_asid;
+
+	/*
+	 * The TLB entries are tagged with the ASID in CONTEXTIDR, so
+	 * switching back to the loaded page-table (and ASID) is a no-op:
+	 * avoid the barriers and the TTBR1 cycling below.
+	 */
+	__asm__ __volatile__("mrc p15, 0, %0, c2, c0, 0 \n\t"
+	                     "mrc p15, 0, %1, c13, c0, 1 \n\t"
+	                     : "=r"(cur_ttbr0), "=r"(cur_asid));
+	if (cur_ttbr0 == ttbr0 && cur_asid == ptinfo->asid) return;
 
 	/* asm volatile("mcr p15, 0, r0, c8, c7, 0"); was using TLBIALL */
 	
@@ -85,6 +96,48 @@ chal_pgtbl_update(struct pgtbl_info *ptinfo)
 	                     :: "r"(TTBR1_CONTENT), "r"(ptinfo->asid), "r"(ttbr0));
 }
 
+/* Invalidate the TLB entries of a page for all ASIDs (TLBIMVAA) */
+static inline void
+chal_tlb_page_inval(vaddr_t addr)
+{
+	__asm__ __volatile__("dsb \n\t"
+	                     "mcr p15, 0, %0, c8, c7, 3 \n\t"
+	                     "dsb \n\t"
+	                     "isb \n\t"
+	                     :: "r"(addr & ~(PAGE_SIZE - 1)) : "memory");
+}
+
+/*
+ * Invalidate the TLB entries of a range of pages for all ASIDs, with a
+ * single set of barriers.  Past CHAL_TLB_RANGE_MAX pages, a TLBIALL is
+ * cheaper than walking the range.
+ */
+#define CHAL_TLB_RANGE_MAX 32
+
+static inline void
+chal_tlb_range_inval(vaddr_t addr, unsigned long sz)
+{
+	vaddr_t end = addr + sz;
+
+	if (sz > CHAL_TLB_RANGE_MAX * PAGE_SIZE) {
+		chal_flush_tlb();
+		return;
+	}
+	__asm__ __volatile__("dsb" ::: "memory");
+	for (addr &= ~(PAGE_SIZE - 1); addr < end; addr += PAGE_SIZE) {
+		__asm__ __volatile__("mcr p15, 0, %0, c8, c7, 3" :: "r"(addr));
+	}
+	__asm__ __volatile__("dsb \n\t"
+	                     "isb \n\t"
+	                     ::: "memory");
+}
+
+/* No speculative-execution mitigations on the Cortex-A9 */
+static inline void
+chal_spec_barrier(void)
+{
+}
+
 extern asid_t free_asid;
 static inline asid_t
 chal_asid_alloc(void)
@@ -60,6 +60,8 @@
 
 
 #define NUM_CPU 1
+/* Most NUMA nodes we track memory for; this platform has just the one */
+#define NUMA_NODES_MAX 1
 
 #define CPU_TIMER_FREQ 100 // set in your linux .config
 
@@ -73,6 +75,8 @@
 // After how many seconds should schedulers print out their information?
 #define SCHED_PRINTOUT_PERIOD 100000
 #define COMPONENT_ASSERTIONS 1 // activate assertions in components?
+// #define SLM_HIST_ENABLED // keep scheduling latency histograms in slm-based schedulers?
+// #define SLM_TRACE_ENABLED // record scheduling events in slm-based schedulers (see slm_trace.h)?
 
 #define FPU_ENABLED 1
 #define FPU_SUPPORT_SSE 1
@@ -530,6 +530,28 @@ chal_pgtbl_mapping_del_direct(pgtbl_t pt, u32_t addr)
 	return 0;
 }
 
+/*
+ * Remove a page grant's mapping of page at addr, without marking the
+ * entry for quiescence (see the x86 version).
+ */
+int
+chal_pgtbl_mapping_revoke(pgtbl_t pt, vaddr_t addr, paddr_t page)
+{
+	struct ert_intern *pte;
+	u32_t              orig_v;
+
+	assert(pt);
+	assert((PGTBL_FLAG_MASK & addr) == 0);
+
+	pte = (struct ert_intern *)__chal_pgtbl_lkup(pt, addr);
+	if (!pte) return -ENOENT;
+	orig_v = (u32_t)(pte->next);
+	if (!(orig_v & CAV7_4K_PAGE_PRESENT) || (orig_v & PGTBL_FRAME_MASK) != page) return -ENOENT;
+	if (__pgtbl_update_leaf(pte, (void *)0, orig_v)) return -ECASFAIL;
+
+	return retypetbl_deref((void *)page, PAGE_ORDER);
+}
+
 int
 chal_pgtbl_mapping_scan(struct cap_pgtbl *pt)
 {
@@ -786,6 +808,21 @@ chal_pgtbl_cpy(struct captbl *t, capid_t cap_to, capid_t capin_to, struct cap_pg
 	return pgtbl_mapping_add(((struct cap_pgtbl *)ctto)->pgtbl, capin_to, old_v & PGTBL_FRAME_MASK, flags, order);
 }
 
+/* Copy the mappings of npages contiguous pages, as npages chal_pgtbl_cpy calls */
+int
+chal_pgtbl_cpy_n(struct captbl *t, capid_t cap_to, capid_t capin_to, struct cap_pgtbl *ctfrom, capid_t capin_from, unsigned long npages, word_t flags_in)
+{
+	unsigned long i;
+	int           ret;
+
+	for (i = 0; i < npages; i++, capin_to += PAGE_SIZE, capin_from += PAGE_SIZE) {
+		ret = chal_pgtbl_cpy(t, cap_to, capin_to, ctfrom, capin_from, CAP_PGTBL, PAGE_ORDER);
+		if (ret) return ret;
+	}
+
+	return 0;
+}
+
 /* FIXME: we need to ensure TLB quiescence for pgtbl cons/decons!
  * ct - main table capability
  * ctsub - sub table capability
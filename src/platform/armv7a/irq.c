@@ -170,6 +170,8 @@ __cos_cav7_int_init(void)
 
 /* Private timer and watchdog block base */
 #define CAV7_PTWD_BASE 0xF8F00600
+/* Global timer base */
+#define CAV7_GTMR_BASE 0xF8F00200
 
 /* Macro definitions for timers and interrupt controllers */
 #define CAV7_SFR(base, offset) (*((volatile unsigned long *)((unsigned long)((base) + (offset)))))
@@ -201,6 +203,11 @@ __cos_cav7_int_init(void)
 /* Watchdog disable register */
 #define CAV7_PTWD_WDDR CAV7_SFR(CAV7_PTWD_BASE, 0x0034)
 
+/* Global timer interrupt status register - write 1 to clear */
+#define CAV7_GTMR_GTISR CAV7_SFR(CAV7_GTMR_BASE, 0x000C)
+/* The global timer comparator's private peripheral interrupt */
+#define CAV7_GTMR_IRQ 27
+
 extern int timer_process(struct pt_regs *regs);
 
 void
@@ -219,10 +226,10 @@ __cos_cav7_irq_handler(struct pt_regs *regs)
 	/* Spurious interrupt does not need this at all */
 	if (int_id == 1023) return;
 	/* Only the booting processor will receive timer interrupts */
-	/* Is is an timer interrupt? (we know that it is at 29) */
-	if (int_id == 29) {
-		/* Clear the interrupt flag */
-		CAV7_PTWD_PTISR = 0;
+	/* Is is an timer interrupt? (the global timer's comparator) */
+	if (int_id == CAV7_GTMR_IRQ) {
+		/* Clear the interrupt flag - write 1! */
+		CAV7_GTMR_GTISR = 1;
 		/* printk("tptsc\n"); */
 		timer_process(regs);
 		/* Send interrupt to all other processors to notify them about this */
@@ -58,10 +58,54 @@ Xil_L1DCacheFlush(void)
 	   __cos_cav7_sctlr_set(CtrlReg); */
 }
 
+/* Line size of both the L1 D-cache and the PL310 L2 */
+#define CAV7_CACHE_LINE 32
+/* Beyond this, a range flush takes longer than we want to spend in the kernel */
+#define CAV7_CACHE_RANGE_MAX (256 * 1024)
+
+/*
+ * Clean and invalidate [addr, addr + sz) to the point of coherency:
+ * the L1 lines by MVA, then the L2 lines by the physical address of
+ * each page.  This costs in proportion to the range, where the
+ * set/way flush walks the whole L1 and leaves the L2 untouched.
+ * Pages that aren't mapped (PAR.F set) are skipped.
+ */
+static void
+l2cache_range_flush(vaddr_t addr, unsigned long sz)
+{
+	vaddr_t       pg, s, e, end = addr + sz;
+	unsigned long par;
+
+	for (pg = addr & ~(PAGE_SIZE - 1); pg < end; pg += PAGE_SIZE) {
+		__cos_cav7_ats1cpr_set(pg);
+		par = __cos_cav7_par_get();
+		if (par & 1) continue;
+
+		s = (pg < addr ? addr : pg) & ~(CAV7_CACHE_LINE - 1);
+		e = pg + PAGE_SIZE < end ? pg + PAGE_SIZE : end;
+		/* DCCIMVAC: the L1 has to be written back into the L2 first... */
+		for (; s < e; s += CAV7_CACHE_LINE) __asm__ __volatile__("mcr p15, 0, %0, c7, c14, 1" :: "r"(s));
+		__asm__ __volatile__("dsb" ::: "memory");
+
+		/* ...then the L2 into memory */
+		s = (pg < addr ? addr : pg) & ~(CAV7_CACHE_LINE - 1);
+		for (; s < e; s += CAV7_CACHE_LINE) CAV7_L2C_CLEAN_INV_PA = (par & ~(PAGE_SIZE - 1)) | (s & (PAGE_SIZE - 1));
+	}
+	CAV7_L2C_CACHE_SYNC = 0;
+	while (CAV7_L2C_CACHE_SYNC & 1)
+		;
+}
+
+/* sz == 0 flushes the whole L1 D-cache */
 int
-chal_l1flush(void)
+chal_l1flush(vaddr_t addr, unsigned long sz)
 {
-	Xil_L1DCacheFlush();
+	if (sz == 0) {
+		Xil_L1DCacheFlush();
+		return 0;
+	}
+	if (sz > CAV7_CACHE_RANGE_MAX || addr + sz < addr) return -EINVAL;
+	l2cache_range_flush(addr, sz);
 
 	return 0;
 }
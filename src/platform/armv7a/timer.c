@@ -2,39 +2,44 @@
 
 
 #define CHAL_CYC_THRESH (CYC_PER_USEC * 100)
+
+/*
+ * Timeouts are absolute deadlines on the global timer's comparator,
+ * the counter that rdtscll reads.  Unlike a countdown on the private
+ * timer, this needs no read of the current time and no conversion to
+ * a relative value, and the deadline doesn't drift with the time it
+ * takes to program it.  (The Cortex-A9 has no ARM generic timer.)
+ */
 void
 chal_timer_set(cycles_t cycles)
 {
 	cycles_t now;
+
 	rdtscll(now);
-	if (now < cycles) {
-		cycles -= now;
-	} else {
-		/* in the past? set to fire one tick from now! */
-		cycles  = CHAL_CYC_THRESH;
-	}
-	chal_timer_disable();
-	/* Writing this will also write the counter register as well */
-	CAV7_PTWD_PTLR = cycles / 2;
-	/* CAV7_PTWD_PTCNTR = cycles/2; */
+	/* in the past? set to fire one tick from now! */
+	if (cycles <= now) cycles = now + CHAL_CYC_THRESH;
+	/* the global timer counts at half the rate of rdtscll */
+	cycles >>= 1;
+
+	/* The comparator must be disabled while it is updated; the counter keeps running */
+	CAV7_GTMR_GTCTLR  = CAV7_GTMR_GTCTLR_TIMEN;
+	CAV7_GTMR_GTCOMPL = (unsigned long)cycles;
+	CAV7_GTMR_GTCOMPH = (unsigned long)(cycles >> 32);
 	/* Clear the interrupt flag - write 1! */
-	CAV7_PTWD_PTISR = 1;
-	/* Ack all timer interrupts */
-	CAV7_GICC_EOIR = 29;
+	CAV7_GTMR_GTISR = 1;
 	/* Enable the interrupt */
-	CAV7_GICD_ISENABLER(0) = 1 << 29;
-	/* Start the timer */
-	CAV7_PTWD_PTCTLR = CAV7_PTWD_PTCTLR_PRESC(0) | CAV7_PTWD_PTCTLR_IRQEN | CAV7_PTWD_PTCTLR_TIMEN;
+	CAV7_GICD_ISENABLER(0) = 1 << CAV7_GTMR_IRQ;
+	CAV7_GTMR_GTCTLR       = CAV7_GTMR_GTCTLR_IRQEN | CAV7_GTMR_GTCTLR_COMPEN | CAV7_GTMR_GTCTLR_TIMEN;
 }
 
 void
 chal_timer_disable(void)
 {
-	/* Disable the interrupt */
-	CAV7_GICD_ICENABLER(0) = 1 << 29;
-	CAV7_PTWD_PTCTLR       = 0;
+	/* Disable the interrupt, but keep the counter (our cycle counter) running */
+	CAV7_GICD_ICENABLER(0) = 1 << CAV7_GTMR_IRQ;
+	CAV7_GTMR_GTCTLR       = CAV7_GTMR_GTCTLR_TIMEN;
 	/* Clear the interrupt flag - write 1! */
-	CAV7_PTWD_PTISR = 1;
+	CAV7_GTMR_GTISR = 1;
 }
 
 unsigned int
@@ -59,7 +64,7 @@ timer_init(void)
 	/* We are initializing the global timer here */
 	CAV7_GTMR_GTCNTRL = 0;
 	CAV7_GTMR_GTCNTRH = 0;
-	CAV7_GTMR_GTCTLR  = 1;
+	CAV7_GTMR_GTCTLR  = CAV7_GTMR_GTCTLR_TIMEN;
 	printk("global timer init\n");
 	pmc_ready();
 }
@@ -1,4 +1,5 @@
 #include "cav7_consts.h"
+#include "chal/chal_proto.h"
 
 int
 chal_tlb_lockdown(unsigned long entryid, unsigned long vaddr, unsigned long paddr)
@@ -36,10 +37,16 @@ chal_tlb_lockdown(unsigned long entryid, unsigned long vaddr, unsigned long padd
 	return 0;
 }
 
+/* sz == 0 flushes the whole TLB, otherwise only the range's pages (for all ASIDs) */
 int
-chal_tlbflush(int a)
+chal_tlbflush(vaddr_t addr, unsigned long sz)
 {
-	__cos_cav7_tlbiall_set(a);
+	if (sz == 0) {
+		__cos_cav7_tlbiall_set(0);
+		return 0;
+	}
+	if (addr + sz < addr) return -EINVAL;
+	chal_tlb_range_inval(addr, sz);
 
 	return 0;
 }
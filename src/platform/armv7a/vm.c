@@ -9,7 +9,8 @@
 #include "chal_pgtbl.h"
 
 struct tlb_quiescence tlb_quiescence[NUM_CPU] CACHE_ALIGNED;
-struct liveness_entry __liveness_tbl[LTBL_ENTS] CACHE_ALIGNED;
+u64_t __liveness_epochs[LTBL_ENTS] CACHE_ALIGNED;
+u64_t __liveness_deact_ts[LTBL_ENTS] CACHE_ALIGNED;
 
 #define KERN_INIT_PGD_IDX (COS_MEM_KERN_START_VA >> PGD_SHIFT)
 
@@ -19,8 +19,6 @@ extern u8_t *boot_comp_pgd;
 void *thd_mem[NUM_CPU], *tcap_mem[NUM_CPU];
 struct captbl *glb_boot_ct;
 
-thdid_t tid;
-
 /* FIXME:  loops to create threads/tcaps/rcv caps per core. */
 static void
 kern_boot_thd(struct captbl *ct, void *thd_mem, void *tcap_mem, const cpuid_t cpu_id)
@@ -39,7 +37,8 @@ kern_boot_thd(struct captbl *ct, void *thd_mem, void *tcap_mem, const cpuid_t cp
 	cos_info->cpuid          = cpu_id;
 	cos_info->invstk_top     = 0;
 	cos_info->overflow_check = 0xDEADBEEF;
-	ret = thd_activate(ct, BOOT_CAPTBL_SELF_CT, BOOT_CAPTBL_SELF_INITTHD_BASE_CPU(cpu_id), thd_mem, BOOT_CAPTBL_SELF_COMP, 0, tid++, NULL);
+	/* The boot threads' ids are their cores', as the APs boot in parallel */
+	ret = thd_activate(ct, BOOT_CAPTBL_SELF_CT, BOOT_CAPTBL_SELF_INITTHD_BASE_CPU(cpu_id), thd_mem, BOOT_CAPTBL_SELF_COMP, 0, (thdid_t)cpu_id, NULL);
 	assert(!ret);
 
 	/* on x86 we store coreid in MSR_TSC_AUX for user-level access */
@@ -53,7 +52,8 @@ kern_boot_thd(struct captbl *ct, void *thd_mem, void *tcap_mem, const cpuid_t cp
 	tc->perm_prio     = 0;
 	tcap_setprio(tc, 0);                              /* Chronos gets preempted by no one! */
 	list_enqueue(&cos_info->tcaps, &tc->active_list); /* Chronos on the TCap active list */
-	cos_info->tcap_uid  = 1;
+	/* The cores' uids don't overlap, so a tcap keeps its uid when it migrates (tcap_migrate) */
+	cos_info->tcap_uid  = ((tcap_uid_t)cpu_id << 48) | 1;
 	cos_info->cycles    = tsc();
 	cos_info->curr_tcap = tc;
 	thd_next_thdinfo_update(cos_info, 0, 0, 0, 0);
@@ -169,6 +169,16 @@ boot_pgtbl_mappings_add(struct captbl *ct, capid_t pgdcap, capid_t ptecap, const
 	pgtbl = (pgtbl_t)pgd_cap->pgtbl;
 
 	printk("\tMapping in %s (@ [0x%p, 0x%p))\n", label, user_vaddr, user_vaddr + range);
+	/*
+	 * The untyped memory is most of the mappings, and is physically
+	 * contiguous, so it is mapped in batches of leaf tables.
+	 */
+	if (!uvm) {
+		if (chal_pgtbl_cosframes_add(pgtbl, user_vaddr, chal_va2pa(kern_vaddr), round_up_to_page(range) / PAGE_SIZE,
+		                             X86_PGTBL_COSFRAME)) assert(0);
+
+		return 0;
+	}
 	/* Map in the actual memory. */
 	for (i = 0; i < round_up_to_page(range) / PAGE_SIZE; i++) {
 		u8_t *  p     = kern_vaddr + i * PAGE_SIZE;
@@ -176,8 +186,7 @@ boot_pgtbl_mappings_add(struct captbl *ct, capid_t pgdcap, capid_t ptecap, const
 		unsigned long   mapat = (unsigned long)user_vaddr + i * PAGE_SIZE;
 		word_t flags = 0;
 
-		if (uvm && pgtbl_mapping_add(pgtbl, mapat, pf, X86_PGTBL_USER_DEF, PAGE_ORDER)) assert(0);
-		if (!uvm && pgtbl_cosframe_add(pgtbl, mapat, pf, X86_PGTBL_COSFRAME, PAGE_ORDER)) assert(0);
+		if (pgtbl_mapping_add(pgtbl, mapat, pf, X86_PGTBL_USER_DEF, PAGE_ORDER)) assert(0);
 		assert(pf == (*(unsigned long*)chal_pgtbl_lkup_lvl((pgtbl_t)(pgtbl), mapat, &flags, 0, PGTBL_DEPTH) & 
 				PGTBL_ENTRY_ADDR_MASK));
 	}
@@ -323,6 +332,19 @@ kern_boot_comp(const cpuid_t cpu_id)
 	boot_pgtbl_expand(glb_boot_ct, BOOT_CAPTBL_SELF_UNTYPED_PT, BOOT_CAPTBL_KM_PTE, "untyped memory",
 			  BOOT_MEM_KM_BASE, mem_utmem_end() - mem_boot_end());
 
+#if defined(__x86_64__)
+	/*
+	 * Start the untyped memory on a superpage boundary so that user
+	 * level can map physically contiguous, aligned runs of it as
+	 * superpages.  The padding is lost to the kernel heap.
+	 */
+	{
+		unsigned long pad = round_up_to_pow2(mem_utmem_start(), SUPER_PAGE_SIZE) - (unsigned long)mem_utmem_start();
+
+		if (pad && glb_memlayout.kern_boot_heap + pad <= mem_kmem_end()) mem_boot_alloc(pad / PAGE_SIZE);
+	}
+#endif
+
 	ret = boot_pgtbl_mappings_add(glb_boot_ct, BOOT_CAPTBL_SELF_UNTYPED_PT, BOOT_CAPTBL_KM_PTE, "untyped memory",
                                       mem_utmem_start(), BOOT_MEM_KM_BASE,
                                       mem_utmem_end() - mem_utmem_start(), 0);
@@ -3,8 +3,8 @@
 #include "kernel.h"
 #include "mem_layout.h"
 #include "chal_cpu.h"
+#include "chal/chal_proto.h"
 
-u32_t        free_thd_id;
 char         timer_detector[PAGE_SIZE] PAGE_ALIGNED;
 extern void *cos_kmem, *cos_kmem_base;
 u32_t        chal_msr_mhz = 0;
@@ -12,6 +12,38 @@ u32_t        chal_msr_mhz = 0;
 paddr_t chal_kernel_mem_pa;
 
 struct cpu_tlb_asid_map tlb_asid_map[NUM_CPU];
+int                     chal_invpcid_avail;
+int                     chal_ibpb_avail;
+
+#define INVPCID_ALL_NONGLOBAL 3
+
+void
+chal_flush_tlb(void)
+{
+	unsigned long cr3;
+#if defined(__x86_64__)
+	struct {
+		u64_t pcid;
+		u64_t addr;
+	} desc = { 0, 0 };
+	int i;
+
+	if (likely(chal_invpcid_avail)) {
+		asm volatile("invpcid %0, %1" : : "m"(desc), "r"((unsigned long)INVPCID_ALL_NONGLOBAL) : "memory");
+		return;
+	}
+	/*
+	 * Reloading cr3 only flushes the current PCID, so make the next
+	 * switch to any other page-table flush as well.
+	 */
+	for (i = 0; i <= NUM_ASID_MAX; i++) tlb_asid_map[get_cpuid()].mapped_pt[i] = NULL;
+#endif
+	asm volatile("mov %%cr3, %0\n\t"
+	             "mov %0, %%cr3"
+	             : "=r"(cr3)
+	             :
+	             : "memory");
+}
 
 void *
 chal_alloc_kern_mem(int order)
@@ -51,16 +83,22 @@ chal_tlb_lockdown(unsigned long entryid, unsigned long vaddr, unsigned long padd
 }
 
 int
-chal_l1flush(void)
+chal_l1flush(vaddr_t addr, unsigned long sz)
 {
 	/* TODO */
 	return 0;
 }
 
 int
-chal_tlbflush(int a)
+chal_tlbflush(vaddr_t addr, unsigned long sz)
 {
-	/* TODO */
+	if (sz == 0) {
+		chal_flush_tlb();
+		return 0;
+	}
+	if (addr + sz < addr) return -EINVAL;
+	chal_tlb_range_inval(addr, sz);
+
 	return 0;
 }
 
@@ -151,7 +189,5 @@ chal_init(void)
 		chal_msr_mhz = a * 100;
 	}
 
-	free_thd_id = 1;
-
 	chal_kernel_mem_pa = chal_va2pa(mem_kmem_start());
 }
@@ -122,6 +122,17 @@ __userregs_get4(struct pt_regs *regs)
 	return regs->dx;
 }
 
+/* Populate the registers of a synthetic system call (e.g. for batched capability operations) */
+static inline void
+__userregs_setcapop(struct pt_regs *regs, capid_t cap, word_t op, word_t a1, word_t a2, word_t a3, word_t a4)
+{
+	regs->ax = ((cap + 1) << COS_CAPABILITY_OFFSET) | (op & ((1 << COS_CAPABILITY_OFFSET) - 1));
+	regs->bx = a1;
+	regs->si = a2;
+	regs->di = a3;
+	regs->dx = a4;
+}
+
 static inline void
 copy_gp_regs(struct pt_regs *from, struct pt_regs *to)
 {
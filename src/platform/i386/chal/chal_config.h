@@ -46,6 +46,8 @@ typedef enum {
 	HW_ID30,
 	HW_ID31,
 	HW_LAPIC_SPURIOUS,
+	HW_LAPIC_PMI         = 252, /* performance counter overflow, for sampling */
+	HW_LAPIC_VM_POSTED   = 253, /* posted-interrupt notification for vcpus */
 	HW_LAPIC_IPI_ASND    = 254, /* ipi interrupt for asnd */
 	HW_LAPIC_TIMER = 255, /* Local APIC TSC-DEADLINE mode - Timer interrupts */
 } hwid_t;
@@ -81,6 +83,19 @@ cos_mem_fence(void)
 	__asm__ __volatile__("mfence" ::: "memory");
 }
 
+/* x86 doesn't reorder stores with other stores */
+static inline void
+cos_wmb(void)
+{
+	__asm__ __volatile__("" ::: "memory");
+}
+
+/*
+ * Count system calls per capability type and operation, and
+ * histogram their durations (see struct cos_syscall_stats).
+ */
+#define COS_SYSCALL_STATS 0
+
 /* 256 entries. can be increased if necessary */
 #define COS_THD_INIT_REGION_SIZE (1 << 8)
 // Static entries are after the dynamic allocated entries
@@ -2,10 +2,10 @@
 #define CHAL_PLAT_H
 
 int chal_tlb_lockdown(unsigned long entryid, unsigned long vaddr, unsigned long paddr);
-int chal_l1flush(void);
+int chal_l1flush(vaddr_t addr, unsigned long sz);
 int chal_tlbstall(void);
 int chal_tlbstall_recount(int a);
-int chal_tlbflush(int a);
+int chal_tlbflush(vaddr_t addr, unsigned long sz);
 
 /* This flushes all levels of cache of the current logical CPU. */
 static inline void
@@ -22,11 +22,11 @@ static inline void
 chal_remote_tlb_flush(int target_cpu)
 {
 }
-/* This won't flush global TLB (pinned with PGE) entries. */
-static inline void
-chal_flush_tlb(void)
-{
-}
+/*
+ * This won't flush global TLB (pinned with PGE) entries, but does
+ * flush the entries of all address spaces (PCIDs) on this core.
+ */
+void chal_flush_tlb(void);
 
 static inline void *
 chal_pa2va(paddr_t address)
@@ -8,8 +8,10 @@
 
 #define PGTBL_TYPE_DEF (0)
 #define PGTBL_TYPE_EPT (1)
+#define PGTBL_TYPE_IOMMU (2) /* VT-d second-level page-table, for DMA (see iommu.c) */
 #define PGTBL_FLAG_EPT (0x80000000UL)
-#define PGTBL_FLAG_EPT_MASK (~PGTBL_FLAG_EPT)
+#define PGTBL_FLAG_IOMMU (0x40000000UL)
+#define PGTBL_FLAG_TYPE_MASK (~(PGTBL_FLAG_EPT | PGTBL_FLAG_IOMMU))
 
 #if defined(__x86_64__)
 #define PGTBL_ENTRY_ADDR_MASK 0xfffffffffffff000
@@ -102,6 +104,15 @@ chal_protdom_write(prot_domain_t protdom)
 	wrpkru(pkru_state(protdom));
 }
 
+/* As chal_protdom_write, but rdpkru is much cheaper than wrpkru, so skip an unchanged write */
+static inline void
+chal_protdom_update(prot_domain_t protdom)
+{
+	u32_t pkru = pkru_state(protdom);
+
+	if (rdpkru() != pkru) wrpkru(pkru);
+}
+
 static inline prot_domain_t
 chal_protdom_read(void)
 {
@@ -138,6 +149,10 @@ static inline void
 chal_protdom_write(prot_domain_t protdom)
 {
 }
+static inline void
+chal_protdom_update(prot_domain_t protdom)
+{
+}
 static inline prot_domain_t
 chal_protdom_read(void)
 {
@@ -145,9 +160,52 @@ chal_protdom_read(void)
 }
 #endif /* MPK_ENABLED */
 
+#if defined(SPEC_MITIGATION_ENABLED) && defined(__x86_64__)
+#define MSR_IA32_PRED_CMD 0x49
+#define PRED_CMD_IBPB (1 << 0)
+
+extern int chal_ibpb_avail;
+
+/*
+ * Overwrite the return stack buffer with 32 entries that point to
+ * speculation traps, so that the rets in the next component can't be
+ * steered by the calls of the previous one.
+ */
+static inline void
+chal_rsb_fill(void)
+{
+	unsigned long loops;
+
+	asm volatile("mov $16, %0\n\t"
+	             "1: call 2f\n\t"
+	             "3: pause; lfence; jmp 3b\n\t"
+	             "2: call 4f\n\t"
+	             "5: pause; lfence; jmp 5b\n\t"
+	             "4: dec %0\n\t"
+	             "jnz 1b\n\t"
+	             "add $(32 * 8), %%rsp"
+	             : "=r"(loops)
+	             :
+	             : "memory");
+}
+
+/* Isolate the indirect branch prediction, and return prediction, of the components before and after */
+static inline void
+chal_spec_barrier(void)
+{
+	if (likely(chal_ibpb_avail)) asm volatile("wrmsr" : : "c"(MSR_IA32_PRED_CMD), "a"(PRED_CMD_IBPB), "d"(0) : "memory");
+	chal_rsb_fill();
+}
+#else  /* !SPEC_MITIGATION_ENABLED */
+static inline void
+chal_spec_barrier(void)
+{
+}
+#endif /* SPEC_MITIGATION_ENABLED */
+
 
 struct cpu_tlb_asid_map {
-	pgtbl_t mapped_pt[NUM_ASID_MAX];
+	pgtbl_t mapped_pt[NUM_ASID_MAX + 1];
 } CACHE_ALIGNED;
 
 extern struct cpu_tlb_asid_map tlb_asid_map[NUM_CPU];
@@ -176,15 +234,44 @@ chal_pgtbl_update(struct pgtbl_info *pt)
 	unsigned long cr3 = (unsigned long)pt->pgtbl | asid;
 
 	/* fastpath: don't need to invalidate tlb entries; otherwise flush tlb on switch */
-	if (likely(chal_cached_pt_curr(asid) == pt->pgtbl)) {
+	if (likely(chal_cached_pt_curr(pt->protdom) == pt->pgtbl)) {
 		cr3 |= CR3_NO_FLUSH;
 	} else {
-		chal_cached_pt_update(pt->pgtbl, asid);
+		chal_cached_pt_update(pt->pgtbl, pt->protdom);
 	}
 
 	asm volatile("mov %0, %%cr3" : : "r"(cr3));
 }
 
+/*
+ * Invalidate the TLB entry of a page in the current page table.  With
+ * PCIDs this leaves the entries of other address spaces intact.
+ */
+static inline void
+chal_tlb_page_inval(vaddr_t addr)
+{
+	asm volatile("invlpg (%0)" : : "r"(addr) : "memory");
+}
+
+/*
+ * Invalidate the TLB entries of a range of pages in the current page
+ * table.  Past CHAL_TLB_RANGE_MAX pages, a flush is cheaper than
+ * walking the range.
+ */
+#define CHAL_TLB_RANGE_MAX 32
+
+static inline void
+chal_tlb_range_inval(vaddr_t addr, unsigned long sz)
+{
+	vaddr_t end = addr + sz;
+
+	if (sz > CHAL_TLB_RANGE_MAX * PAGE_SIZE) {
+		chal_flush_tlb();
+		return;
+	}
+	for (addr &= ~(PAGE_SIZE - 1); addr < end; addr += PAGE_SIZE) chal_tlb_page_inval(addr);
+}
+
 /* Check current page table */
 static inline pgtbl_t
 chal_pgtbl_read(void)
@@ -77,6 +77,13 @@
 
 #define CPU_TIMER_FREQ 100 // set in your linux .config
 
+/*
+ * Tickless timer: a new deadline within this many cycles of the
+ * programmed one is coalesced into it rather than reprogramming the
+ * timer. Larger values trade timer precision for fewer reprograms.
+ */
+#define TIMER_COALESCE_SLACK (1 << 9)
+
 #define RUNTIME 3 // seconds
 
 /* The kernel quiescence period = WCET in Kernel + WCET of a CAS. */
@@ -87,9 +94,19 @@
 // After how many seconds should schedulers print out their information?
 #define SCHED_PRINTOUT_PERIOD 100000
 #define COMPONENT_ASSERTIONS 1 // activate assertions in components?
+// #define SLM_HIST_ENABLED // keep scheduling latency histograms in slm-based schedulers?
+// #define SLM_TRACE_ENABLED // record scheduling events in slm-based schedulers (see slm_trace.h)?
 
 /* Optional CPU features */
 // #define MPK_ENABLED
+/*
+ * Spectre v2 mitigations (IBPB and RSB fill) on the invocations and
+ * thread switches between components of different trust domains
+ * (`trustdom` in the composition script), on x86_64
+ */
+// #define SPEC_MITIGATION_ENABLED
+/* Per-thread performance counters (HW_PMU_*), on x86_64 */
+#define PMU_ENABLED
 
 #define FPU_ENABLED 1
 #define FPU_SUPPORT_SSE 1
@@ -109,6 +126,8 @@
 /* NUM_CPU_SOCKETS defined in cpu_ghz.h. The information is used for
  * intelligent IPI distribution. */
 #define NUM_CORE_PER_SOCKET (NUM_CPU / NUM_CPU_SOCKETS)
+/* Most NUMA nodes (ACPI SRAT proximity domains) we track memory for */
+#define NUMA_NODES_MAX 8
 
 // cos kernel settings
 #define COS_PRINT_MEASUREMENTS 1
@@ -190,6 +209,8 @@
 #define COS_PAGE_PKEY2 (1ul << 61)
 #define COS_PAGE_PKEY3 (1ul << 62)
 #define COS_PAGE_XDISABLE (1ul << 63)
+/* Copy flag: alias the entire superpage mapped at the source address */
+#define COS_PAGE_SUPER (1ul << 7)
 
 #elif defined(__i386__)
 #define COS_PGTBL_DEPTH 2
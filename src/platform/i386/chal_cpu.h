@@ -158,6 +158,8 @@ chal_cpu_pgtbl_activate(pgtbl_t pgtbl)
 #endif
 
 extern void sysenter_entry(void);
+extern int  chal_invpcid_avail;
+extern int  chal_ibpb_avail;
 
 static inline void
 writemsr(u32_t reg, u32_t low, u32_t high)
@@ -222,6 +224,26 @@ chal_cpu_init(void)
 	}
 
 
+	/* INVPCID lets the TLB shootdown flush all PCIDs at once */
+	a = 0x7;
+	c = 0;
+	chal_cpuid(&a, &b, &c, &d);
+	chal_invpcid_avail = (cr4 & CR4_PCIDE) && (b & (1 << 10));
+	/* IBPB, as part of Intel's IBRS (SPEC_CTRL) support... */
+	chal_ibpb_avail = !!(d & (1 << 26));
+	/* ...or on its own on AMD */
+	a = 0x80000000;
+	chal_cpuid(&a, &b, &c, &d);
+	if (a >= 0x80000008) {
+		a = 0x80000008;
+		c = 0;
+		chal_cpuid(&a, &b, &c, &d);
+		if (b & (1 << 12)) chal_ibpb_avail = 1;
+	}
+#ifdef SPEC_MITIGATION_ENABLED
+	if (!chal_ibpb_avail) printk("WARNING: IBPB is not supported, only filling the RSB across trust domains.\n");
+#endif
+
 	/* CR4_OSXSAVE has to be set to enable xgetbv/xsetbv */
 	chal_cpu_cr4_set(cr4 | CR4_PSE | CR4_PGE | CR4_OSXSAVE);
 
@@ -295,6 +317,7 @@ chal_cpu_init(void)
 #endif
 
 	fpu_init();
+	pmu_init();
 	chal_cpu_eflags_init();
 	vm_env_init();
 }
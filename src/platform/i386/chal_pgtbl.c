@@ -84,6 +84,129 @@ chal_vm_pgtbl_def_flag(void)
 	return x86_EPT_VM_DEF;
 }
 
+/*
+ * A device can read the pages a component aliases in a DMA
+ * page-table, and write them only if the component can.  The read and
+ * write bits of VT-d are those of present and writable on x86.
+ */
+static inline unsigned long
+chal_iommu_pgtbl_flag(unsigned long orig, unsigned long new)
+{
+	return chal_pgtbl_flag_update(orig, new) & (x86_IOMMU_READ | x86_IOMMU_WRITE);
+}
+
+/*
+ * User frames are reference counted at page granularity, so a
+ * superpage mapping holds a reference to each of its pages.
+ */
+static int
+__pgtbl_frames_ref(paddr_t page, u32_t order)
+{
+	unsigned long i, npages = 1UL << (order - PAGE_ORDER);
+	int           ret;
+
+	for (i = 0; i < npages; i++) {
+		ret = retypetbl_ref((void *)(page + i * PAGE_SIZE), PAGE_ORDER);
+		if (unlikely(ret)) {
+			while (i-- > 0) retypetbl_deref((void *)(page + i * PAGE_SIZE), PAGE_ORDER);
+			return ret;
+		}
+	}
+
+	return 0;
+}
+
+static int
+__pgtbl_frames_deref(paddr_t page, u32_t order)
+{
+	unsigned long i, npages = 1UL << (order - PAGE_ORDER);
+	int           ret;
+
+	for (i = 0; i < npages; i++) {
+		ret = retypetbl_deref((void *)(page + i * PAGE_SIZE), PAGE_ORDER);
+		if (unlikely(ret)) return ret;
+	}
+
+	return 0;
+}
+
+#if defined(__x86_64__)
+/* The order of the memory mapped by an entry at lvl (1 being the root) */
+static inline u32_t
+__pgtbl_lvl2order(u32_t lvl)
+{
+	return PAGE_ORDER + PGTBL_ENTRY_ORDER * (PGTBL_DEPTH - lvl);
+}
+
+/* The level of the entries mapping pages of order, or 0 if there are no such mappings */
+static inline u32_t
+__pgtbl_order2lvl(u32_t order)
+{
+	switch (order) {
+	case PAGE_ORDER:       return PGTBL_DEPTH;
+	case SUPER_PAGE_ORDER: return PGTBL_DEPTH - 1;
+	case HUGE_PAGE_ORDER:  return PGTBL_DEPTH - 2;
+	default:               return 0;
+	}
+}
+
+/*
+ * Walk the page-table towards the entry for addr at end_lvl, but
+ * stop at a non-present internal entry, or a superpage mapping.
+ * Returns the entry we stopped at, and its level in *lvl.
+ */
+static unsigned long *
+__pgtbl_lkup_leaf(pgtbl_t pt, vaddr_t addr, u32_t end_lvl, u32_t *lvl)
+{
+	unsigned long *page   = chal_pa2va((unsigned long)pt & PGTBL_ENTRY_ADDR_MASK);
+	unsigned long *intern = NULL;
+	u32_t          i;
+
+	assert(end_lvl > 0 && end_lvl <= PGTBL_DEPTH);
+
+	for (i = 0; i < end_lvl; i++) {
+		addr   = addr & (0xffffffffffff >> (PGTBL_ENTRY_ORDER * i));
+		intern = page + (addr >> (PAGE_ORDER + PGTBL_ENTRY_ORDER * (PGTBL_DEPTH - 1 - i)));
+		if (i + 1 == end_lvl) break;
+		if (!(*intern & X86_PGTBL_PRESENT) || (i > 0 && (*intern & X86_PGTBL_SUPER))) break;
+		page = chal_pa2va((*intern) & PGTBL_ENTRY_ADDR_MASK);
+	}
+	*lvl = i + 1;
+
+	return intern;
+}
+
+/*
+ * Find the physically contiguous, superpage-aligned run of cos
+ * frames starting at frame_addr that backs a superpage of order.
+ */
+static int
+__pgtbl_cosframes_contig(pgtbl_t pt, vaddr_t frame_addr, u32_t order, unsigned long *first)
+{
+	unsigned long  i, npages = 1UL << (order - PAGE_ORDER), *pte, v;
+	paddr_t        base = 0;
+	u32_t          lvl;
+
+	if (unlikely(frame_addr & ((1UL << order) - 1))) return -EINVAL;
+
+	for (i = 0; i < npages; i++) {
+		pte = __pgtbl_lkup_leaf(pt, frame_addr + i * PAGE_SIZE, PGTBL_DEPTH, &lvl);
+		if (unlikely(lvl != PGTBL_DEPTH)) return -EINVAL;
+		v = *pte;
+		if (!(v & X86_PGTBL_COSFRAME) || (v & X86_PGTBL_COSKMEM)) return -EPERM;
+		if (i == 0) {
+			base   = v & PGTBL_FRAME_MASK;
+			*first = v;
+			if (base & ((1UL << order) - 1)) return -EINVAL;
+		} else if ((v & PGTBL_FRAME_MASK) != base + i * PAGE_SIZE) {
+			return -EINVAL;
+		}
+	}
+
+	return 0;
+}
+#endif
+
 int
 chal_pgtbl_kmem_act(pgtbl_t pt, vaddr_t addr, unsigned long *kern_addr, unsigned long **pte_ret)
 {
@@ -171,13 +294,8 @@ chal_tlb_quiescence_check(u64_t timestamp)
 			}
 		}
 	}
-	if (quiescent == 0) {
-		printk("from cpu %d, t %llu: cpu %d last mandatory flush: %llu\n", get_cpuid(), timestamp, i,
-		       tlb_quiescence[i].last_mandatory_flush);
-		for (i = 0; i < NUM_CPU_COS; i++) {
-			printk("cpu %d: flush %llu\n", i, tlb_quiescence[i].last_mandatory_flush);
-		}
-	}
+	/* Get the lagging cores to flush, so that a retry can succeed */
+	if (quiescent == 0) tlb_shootdown_request();
 
 	return quiescent;
 }
@@ -195,14 +313,24 @@ chal_cap_memactivate(struct captbl *ct, struct cap_pgtbl *pt, capid_t frame_cap,
 	dest_pt_h = captbl_lkup(ct, dest_pt);
 	if (dest_pt_h->type != CAP_PGTBL) return -EINVAL;
 	if (((struct cap_pgtbl *)dest_pt_h)->lvl) return -EINVAL;
+	/* Devices only get to access memory that is mapped by a component (see chal_pgtbl_cpy) */
+	if (((struct cap_pgtbl *)dest_pt_h)->type == PGTBL_TYPE_IOMMU) return -EINVAL;
 
-	/* What is the order needed for this? */
-	/* We will probably activate a part of a superpage */
 #if defined(__x86_64__)
-	pte = pgtbl_lkup_lvl(pt->pgtbl, frame_cap, &flags, 0, 1);
+	/* Superpages are backed by a physically contiguous run of frames */
+	if (order != PAGE_ORDER) {
+		if (!__pgtbl_order2lvl(order)) return -EINVAL;
+		ret = __pgtbl_cosframes_contig(pt->pgtbl, frame_cap, order, &orig_v);
+		if (ret) return ret;
+	} else {
+		pte = pgtbl_lkup_lvl(pt->pgtbl, frame_cap, &flags, 0, PGTBL_DEPTH);
+		if (!pte) return -EINVAL;
+		orig_v = *pte;
+	}
 #elif defined(__i386__)	
+	/* What is the order needed for this? */
+	/* We will probably activate a part of a superpage */
 	pte = pgtbl_lkup_pgd(pt->pgtbl, frame_cap, &flags);
-#endif
 	if (!pte) return -EINVAL;
 	orig_v = *pte;
 
@@ -214,14 +342,11 @@ chal_cap_memactivate(struct captbl *ct, struct cap_pgtbl *pt, capid_t frame_cap,
 		}
 	} else {
 		if (order != PAGE_ORDER) return -EPERM;
-	#if defined(__x86_64__)
-		pte = pgtbl_lkup_lvl(pt->pgtbl, frame_cap, &flags, 0, PGTBL_DEPTH);
-	#elif defined(__i386__)	
 		pte = pgtbl_lkup_pte(pt->pgtbl, frame_cap, &flags);
-	#endif
 		if (!pte) return -EINVAL;
 		orig_v = *pte;
 	}
+#endif
 
 	if (!(orig_v & X86_PGTBL_COSFRAME) || (orig_v & X86_PGTBL_COSKMEM)) return -EPERM;
 
@@ -245,10 +370,12 @@ chal_pgtbl_activate(struct captbl *t, unsigned long cap, unsigned long capin, pg
 
 	pt->refcnt_flags = 1;
 	pt->parent       = NULL; /* new cap has no parent. only copied cap has. */
-	pt->lvl          = lvl & PGTBL_FLAG_EPT_MASK;
+	pt->lvl          = lvl & PGTBL_FLAG_TYPE_MASK;
 
 	if (unlikely(lvl & PGTBL_FLAG_EPT)) {
 		pt->type = PGTBL_TYPE_EPT;
+	} else if (unlikely(lvl & PGTBL_FLAG_IOMMU)) {
+		pt->type = PGTBL_TYPE_IOMMU;
 	} else {
 		pt->type = PGTBL_TYPE_DEF;
 	}
@@ -335,6 +462,9 @@ chal_pgtbl_lkup_lvl(pgtbl_t pt, vaddr_t addr, word_t *flags, u32_t start_lvl, u3
 		/* high 16 bits doesn't involve indexing, so we mask them */
 		addr = addr & (0xffffffffffff >> (PGTBL_ENTRY_ORDER * i));
 		intern = page + (addr >> (PAGE_ORDER + PGTBL_ENTRY_ORDER * (PGTBL_DEPTH - 1 - i))); 
+		if (i + 1 == end_lvl) break;
+		/* Don't walk through non-present entries, or into the memory of a superpage */
+		if (!(*intern & X86_PGTBL_PRESENT) || (i > 0 && (*intern & X86_PGTBL_SUPER))) return NULL;
 		page = chal_pa2va((*intern) & PGTBL_ENTRY_ADDR_MASK);
 	}
 
@@ -353,28 +483,38 @@ chal_pgtbl_mapping_add(pgtbl_t pt, vaddr_t addr, paddr_t page, word_t flags, u32
 	struct ert_intern *pte = 0;
 	unsigned long      orig_v;
 	u32_t              accum = 0;
-	/* this temp_flag should not be used */
-	word_t             temp_flag = 0;
 
 	assert(pt);
 	assert((PGTBL_FLAG_MASK & page) == 0);
 	assert((PGTBL_FRAME_MASK & flags) == 0);
+
+#if defined(__x86_64__)
+	u32_t lvl, leaf_lvl;
+
+	/* 2MB and 1GB superpages are leaves at the page directory levels */
+	lvl = __pgtbl_order2lvl(order);
+	if (unlikely(!lvl)) return -EINVAL;
+	if (unlikely((addr | page) & ((1UL << order) - 1))) return -EINVAL;
+
+	pte = (struct ert_intern *)__pgtbl_lkup_leaf(pt, addr, lvl, &leaf_lvl);
+	if (!pte) return -ENOENT;
+	orig_v = (unsigned long)(pte->next);
+	if (leaf_lvl != lvl) return (orig_v & X86_PGTBL_PRESENT) ? -EEXIST : -ENOENT;
+	if (order != PAGE_ORDER) flags |= X86_PGTBL_SUPER;
+	else flags &= ~X86_PGTBL_SUPER;
+#elif defined(__i386__)
 	/* 
 	 * FIXME:the current ertrie implementation cannot stop upon detection of superpage.
 	 * We have to do this manually, get the PGD first, to make sure that we will not
 	 * dereference the super page as a second-level pointer. Performance bummer.
 	 */
-	assert(order == PAGE_ORDER);
+	if (unlikely(order != PAGE_ORDER)) return -EINVAL;
 
-#if defined(__x86_64__)
-	pte = (struct ert_intern *)chal_pgtbl_lkup_lvl((pgtbl_t)((unsigned long)pt | X86_PGTBL_PRESENT), addr, &temp_flag, 0, PGTBL_DEPTH);
-#elif defined(__i386__)
 	pte = (struct ert_intern *)__pgtbl_lkupan((pgtbl_t)((u32_t)pt | X86_PGTBL_PRESENT), addr >> PGTBL_PAGEIDX_SHIFT,
 						PGTBL_DEPTH, &accum);
-#endif
-
 	if (!pte) return -ENOENT;
 	orig_v = (unsigned long)(pte->next);
+#endif
 	if (orig_v & X86_PGTBL_PRESENT) return -EEXIST;
 	if (orig_v & X86_PGTBL_COSFRAME) return -EPERM;
 
@@ -382,13 +522,13 @@ chal_pgtbl_mapping_add(pgtbl_t pt, vaddr_t addr, paddr_t page, word_t flags, u32
 	ret = pgtbl_quie_check(orig_v);
 	if (ret) return ret;
 
-	/* ref cnt on the frame - always user frame. */
-	ret = retypetbl_ref((void *)page, order);
+	/* ref cnt on the frame(s) - always user frame. */
+	ret = __pgtbl_frames_ref(page, order);
 	if (ret) return ret;
 
 	ret = __pgtbl_update_leaf(pte, (void *)(page | flags), orig_v);
 	/* restore the refcnt if necessary */
-	if (ret) retypetbl_deref((void *)page, order);
+	if (ret) __pgtbl_frames_deref(page, order);
 
 	return ret;
 }
@@ -424,6 +564,49 @@ chal_pgtbl_cosframe_add(pgtbl_t pt, vaddr_t addr, paddr_t page, word_t flags, u3
 	return __pgtbl_update_leaf(pte, (void *)(page | flags), 0);
 }
 
+/*
+ * Add the cosframes of `npages` contiguous physical pages, at
+ * contiguous addresses. This is only used at boot, before the other
+ * cores execute, thus the entries are written directly, and the page
+ * table is only walked once for each leaf table (2MB on x86_64),
+ * rather than once per page.
+ */
+int
+chal_pgtbl_cosframes_add(pgtbl_t pt, vaddr_t addr, paddr_t page, unsigned long npages, word_t flags)
+{
+#if defined(__x86_64__)
+	unsigned long *pte = NULL;
+	word_t         temp_flags = 0;
+	unsigned long  i;
+
+	assert(pt);
+	assert((PGTBL_FLAG_MASK & page) == 0 && (PGTBL_FLAG_MASK & addr) == 0);
+	assert((PGTBL_FRAME_MASK & flags) == 0);
+
+	for (i = 0; i < npages; i++, addr += PAGE_SIZE, page += PAGE_SIZE) {
+		/* The entries of a leaf table are contiguous */
+		if (!pte || (addr & ((PAGE_SIZE << PGTBL_ENTRY_ORDER) - 1)) == 0) {
+			pte = chal_pgtbl_lkup_lvl((pgtbl_t)((unsigned long)pt | X86_PGTBL_PRESENT), addr, &temp_flags, 0, PGTBL_DEPTH);
+			if (!pte) return -ENOENT;
+		}
+		assert(*pte == 0);
+		*pte++ = page | flags;
+	}
+
+	return 0;
+#elif defined(__i386__)
+	unsigned long i;
+	int           ret;
+
+	for (i = 0; i < npages; i++) {
+		ret = chal_pgtbl_cosframe_add(pt, addr + i * PAGE_SIZE, page + i * PAGE_SIZE, flags, PAGE_ORDER);
+		if (ret) return ret;
+	}
+
+	return 0;
+#endif
+}
+
 /* This function updates flags of an existing mapping. */
 int
 chal_pgtbl_mapping_mod(pgtbl_t pt, vaddr_t addr, u32_t flags, u32_t *prevflags)
@@ -476,6 +659,21 @@ chal_pgtbl_mapping_del(pgtbl_t pt, vaddr_t addr, u32_t liv_id)
 	ret = ltbl_timestamp_update(liv_id);
 	if (unlikely(ret)) goto done;
 
+#if defined(__x86_64__)
+	u32_t lvl;
+
+	/* Stop at the leaf, which might be a superpage */
+	pte = (struct ert_intern *)__pgtbl_lkup_leaf(pt, addr, PGTBL_DEPTH, &lvl);
+	orig_v = (unsigned long)(pte->next);
+	if (!(orig_v & X86_PGTBL_PRESENT)) return -EEXIST;
+	if (orig_v & X86_PGTBL_COSFRAME) return -EPERM;
+	if (lvl != PGTBL_DEPTH) {
+		if (lvl == 1 || !(orig_v & X86_PGTBL_USER)) return -EPERM;
+		order = __pgtbl_lvl2order(lvl);
+		/* Superpages are removed as a whole */
+		if (addr & ((1UL << order) - 1)) return -EINVAL;
+	} else order = PAGE_ORDER;
+#elif defined(__i386__)
 	/* Get the PGD to see if we are deleting a superpage */
 	pte = (struct ert_intern *)__pgtbl_lkupan((pgtbl_t)((unsigned long)pt | X86_PGTBL_PRESENT), addr >> PGTBL_PAGEIDX_SHIFT,
                                                   1, &accum);
@@ -491,12 +689,17 @@ chal_pgtbl_mapping_del(pgtbl_t pt, vaddr_t addr, u32_t liv_id)
 		if (orig_v & X86_PGTBL_COSFRAME) return -EPERM;
 		order = PAGE_ORDER;
 	} else order = SUPER_PAGE_ORDER;
+#endif
 
 	ret = __pgtbl_update_leaf(pte, (void *)(unsigned long)((liv_id << PGTBL_PAGEIDX_SHIFT) | X86_PGTBL_QUIESCENCE), orig_v);
 	if (ret) cos_throw(done, ret);
 
-	/* decrement ref cnt on the frame. */
+	/* decrement ref cnt on the frame(s). */
+#if defined(__x86_64__)
+	ret = __pgtbl_frames_deref(orig_v & PGTBL_FRAME_MASK, order);
+#elif defined(__i386__)
 	ret = retypetbl_deref((void *)(orig_v & PGTBL_FRAME_MASK), order);
+#endif
 	if (ret) cos_throw(done, ret);
 
 done:
@@ -518,6 +721,44 @@ chal_pgtbl_mapping_del_direct(pgtbl_t pt, u32_t addr)
 	return __pgtbl_expandn(pt, addr >> PGTBL_PAGEIDX_SHIFT, PGTBL_DEPTH + 1, &accum, &pte, NULL);
 }
 
+/*
+ * Remove a page grant's mapping of page at addr.  Unlike
+ * chal_pgtbl_mapping_del, the entry isn't marked for quiescence: the
+ * revoking core invalidates its TLB itself, and the frame's own
+ * retype quiescence (see retypetbl_deref) covers the other cores, so
+ * the server's address can be granted again immediately.
+ */
+int
+chal_pgtbl_mapping_revoke(pgtbl_t pt, vaddr_t addr, paddr_t page)
+{
+	struct ert_intern *pte;
+	unsigned long      orig_v;
+	u32_t              accum = 0;
+
+	assert(pt);
+	assert((PGTBL_FLAG_MASK & addr) == 0);
+
+#if defined(__x86_64__)
+	u32_t lvl;
+
+	pte = (struct ert_intern *)__pgtbl_lkup_leaf(pt, addr, PGTBL_DEPTH, &lvl);
+	if (!pte || lvl != PGTBL_DEPTH) return -ENOENT;
+#elif defined(__i386__)
+	/* don't descend into a superpage */
+	pte = (struct ert_intern *)__pgtbl_lkupan((pgtbl_t)((unsigned long)pt | X86_PGTBL_PRESENT), addr >> PGTBL_PAGEIDX_SHIFT,
+	                                          1, &accum);
+	if (!pte || ((unsigned long)(pte->next) & X86_PGTBL_SUPER)) return -ENOENT;
+	pte = (struct ert_intern *)__pgtbl_lkupan((pgtbl_t)((unsigned long)pt | X86_PGTBL_PRESENT), addr >> PGTBL_PAGEIDX_SHIFT,
+	                                          PGTBL_DEPTH, &accum);
+	if (!pte) return -ENOENT;
+#endif
+	orig_v = (unsigned long)(pte->next);
+	if (!(orig_v & X86_PGTBL_PRESENT) || (orig_v & PGTBL_FRAME_MASK) != page) return -ENOENT;
+	if (__pgtbl_update_leaf(pte, (void *)0, orig_v)) return -ECASFAIL;
+
+	return __pgtbl_frames_deref(page, PAGE_ORDER);
+}
+
 int
 chal_pgtbl_mapping_scan(struct cap_pgtbl *pt)
 {
@@ -561,8 +802,21 @@ chal_pgtbl_lkup(pgtbl_t pt, vaddr_t addr, word_t *flags)
 {
 	void *ret;
 
-	ret = __pgtbl_lkupan((pgtbl_t)((unsigned long)pt | X86_PGTBL_PRESENT), addr >> PGTBL_PAGEIDX_SHIFT, PGTBL_DEPTH + 1,
-	                     flags);
+#if defined(__x86_64__)
+	unsigned long *pte, v;
+	u32_t          lvl;
+
+	/* The ertrie walk would descend into superpages, so walk to the leaf */
+	pte = __pgtbl_lkup_leaf(pt, addr, PGTBL_DEPTH, &lvl);
+	v   = *pte;
+	*flags = v & PGTBL_FLAG_MASK;
+	if (!pgtbl_ispresent(*flags) || (lvl != PGTBL_DEPTH && (lvl == 1 || !(v & X86_PGTBL_PRESENT)))) return NULL;
+	if (lvl == PGTBL_DEPTH) return chal_pa2va(v & PGTBL_FRAME_MASK);
+
+	/* The page within the superpage */
+	return chal_pa2va((v & PGTBL_FRAME_MASK) + (addr & ((1UL << __pgtbl_lvl2order(lvl)) - 1) & PGTBL_FRAME_MASK));
+#endif
+	ret = __pgtbl_lkupl((pgtbl_t)((unsigned long)pt | X86_PGTBL_PRESENT), addr >> PGTBL_PAGEIDX_SHIFT, flags);
 	if (!pgtbl_ispresent(*flags)) return NULL;
 	return ret;
 }
@@ -570,6 +824,9 @@ chal_pgtbl_lkup(pgtbl_t pt, vaddr_t addr, word_t *flags)
 unsigned long *
 chal_pgtbl_lkup_pte(pgtbl_t pt, vaddr_t addr, word_t *flags)
 {
+#if defined(__x86_64__)
+	return chal_pgtbl_lkup_lvl(pt, addr, flags, 0, PGTBL_DEPTH);
+#endif
 	return __pgtbl_lkupan((pgtbl_t)((unsigned long)pt | X86_PGTBL_PRESENT), addr >> PGTBL_PAGEIDX_SHIFT, PGTBL_DEPTH,
 	                      flags);
 }
@@ -670,7 +927,7 @@ chal_pgtbl_pgtblactivate(struct captbl *ct, capid_t cap, capid_t pt_entry, capid
 	int            ret;
 	capid_t        lvl       = pgtbl_lvl; 
 
-	pgtbl_lvl &= PGTBL_FLAG_EPT_MASK;
+	pgtbl_lvl &= PGTBL_FLAG_TYPE_MASK;
 	ret = cap_kmem_activate(ct, pgtbl_cap, kmem_cap, (unsigned long *)&kmem_addr, &pte);
 	if (unlikely(ret)) return ret;
 	assert(kmem_addr && pte);
@@ -683,7 +940,8 @@ chal_pgtbl_pgtblactivate(struct captbl *ct, capid_t cap, capid_t pt_entry, capid
 		curr_pt = cap_pt->pgtbl;
 		assert(curr_pt);
 
-		if (!(lvl & PGTBL_FLAG_EPT)) {
+		/* Only the page-tables for the CPU share the kernel's mappings */
+		if (!(lvl & (PGTBL_FLAG_EPT | PGTBL_FLAG_IOMMU))) {
 			new_pt = pgtbl_create((void *)kmem_addr, curr_pt);
 		} else {
 			pgtbl_init_pte((void *)kmem_addr);
@@ -710,6 +968,7 @@ chal_pgtbl_cpy(struct captbl *t, capid_t cap_to, capid_t capin_to, struct cap_pg
 	struct cap_header	*ctto;
 	unsigned long		*f, old_v;
 	word_t			     flags;
+	int                  ret;
 
 	ctto = captbl_lkup(t, cap_to);
 	if (unlikely(!ctto)) return -ENOENT;
@@ -717,23 +976,145 @@ chal_pgtbl_cpy(struct captbl *t, capid_t cap_to, capid_t capin_to, struct cap_pg
 	if (unlikely(((struct cap_pgtbl *)ctto)->refcnt_flags & CAP_MEM_FROZEN_FLAG)) return -EINVAL;
 
 #if defined(__x86_64__)
-	f = pgtbl_lkup_lvl(((struct cap_pgtbl *)ctfrom)->pgtbl, capin_from, &flags, 0, PGTBL_DEPTH);
+	u32_t lvl, order = PAGE_ORDER;
+	int   super = flags_in & COS_PAGE_SUPER;
+
+	flags_in &= ~COS_PAGE_SUPER;
+	/* DMA page-tables only map pages (chal_pgtbl_mapping_del removes user superpages) */
+	if (super && ((struct cap_pgtbl *)ctto)->type == PGTBL_TYPE_IOMMU) return -EINVAL;
+	f = __pgtbl_lkup_leaf(((struct cap_pgtbl *)ctfrom)->pgtbl, capin_from, PGTBL_DEPTH, &lvl);
+	if (!f) return -ENOENT;
+	old_v = *f;
+	flags = old_v & PGTBL_FLAG_MASK;
+	if (lvl != PGTBL_DEPTH) {
+		if (lvl == 1 || !(old_v & X86_PGTBL_PRESENT)) return -ENOENT;
+		if (super) {
+			/* Alias the entire superpage */
+			order = __pgtbl_lvl2order(lvl);
+			if (capin_from & ((1UL << order) - 1)) return -EINVAL;
+		} else {
+			/* Alias only the page within the superpage */
+			old_v += capin_from & ((1UL << __pgtbl_lvl2order(lvl)) - 1) & PGTBL_FRAME_MASK;
+		}
+		flags &= ~X86_PGTBL_SUPER;
+	} else if (super) {
+		return -EINVAL;
+	}
 #elif defined(__i386__)	
 	f = pgtbl_lkup_pte(((struct cap_pgtbl *)ctfrom)->pgtbl, capin_from, &flags);
-#endif
 	if (!f) return -ENOENT;
 	old_v = *f;
+#endif
 
 	/* Cannot copy frame, or kernel entry. */
 	if (chal_pgtbl_flag_exist(old_v, PGTBL_COSFRAME) || !chal_pgtbl_flag_exist(old_v, PGTBL_USER)) return -EPERM;
 
 	if (unlikely((((struct cap_pgtbl *)ctto)->type) == PGTBL_TYPE_EPT)) {
 		flags = chal_vm_pgtbl_def_flag();
+	} else if (unlikely((((struct cap_pgtbl *)ctto)->type) == PGTBL_TYPE_IOMMU)) {
+		flags = chal_iommu_pgtbl_flag(flags, flags_in);
 	} else {
 		/* sanitize the input flags */
 		flags = chal_pgtbl_flag_update(flags, flags_in);
 	}
+#if defined(__x86_64__)
+	ret = pgtbl_mapping_add(((struct cap_pgtbl *)ctto)->pgtbl, capin_to, old_v & PGTBL_FRAME_MASK, flags, order);
+	if (!ret) chal_iommu_pgtbl_flush((struct cap_pgtbl *)ctto, 1);
+
+	return ret;
+#elif defined(__i386__)
 	return pgtbl_mapping_add(((struct cap_pgtbl *)ctto)->pgtbl, capin_to, old_v & PGTBL_FRAME_MASK, flags, PAGE_ORDER);
+#endif
+}
+
+/*
+ * Copy the mappings of npages contiguous pages at capin_from to
+ * capin_to, as npages chal_pgtbl_cpy calls, but in one: the
+ * capability and the destination's freezing are checked once, and the
+ * last-level page-table pages of the source and destination are
+ * looked up once per page-table page, rather than walked per page.
+ * The intermediate page-tables of the destination must be present.
+ * On an error, the pages before the failed one are mapped.
+ */
+int
+chal_pgtbl_cpy_n(struct captbl *t, capid_t cap_to, capid_t capin_to, struct cap_pgtbl *ctfrom, capid_t capin_from, unsigned long npages, word_t flags_in)
+{
+	struct cap_header *ctto;
+	unsigned long      i;
+	int                ret;
+
+	ctto = captbl_lkup(t, cap_to);
+	if (unlikely(!ctto)) return -ENOENT;
+	if (unlikely(ctto->type != CAP_PGTBL)) return -EINVAL;
+	if (unlikely(((struct cap_pgtbl *)ctto)->refcnt_flags & CAP_MEM_FROZEN_FLAG)) return -EINVAL;
+	if (unlikely((capin_to | capin_from) & (PAGE_SIZE - 1))) return -EINVAL;
+
+#if defined(__x86_64__)
+	unsigned long *src = NULL, *dst = NULL, old_v, orig_v;
+	pgtbl_t        from = ctfrom->pgtbl, to = ((struct cap_pgtbl *)ctto)->pgtbl;
+	int            ept  = ((struct cap_pgtbl *)ctto)->type == PGTBL_TYPE_EPT;
+	int            iommu = ((struct cap_pgtbl *)ctto)->type == PGTBL_TYPE_IOMMU;
+	word_t         flags;
+	u32_t          lvl;
+
+	if (unlikely(flags_in & COS_PAGE_SUPER)) return -EINVAL;
+
+	for (i = 0; i < npages; i++, capin_to += PAGE_SIZE, capin_from += PAGE_SIZE) {
+		/* Look up the leaf tables at their first entry we use */
+		if (!src || !(capin_from & (SUPER_PAGE_SIZE - 1))) {
+			src = __pgtbl_lkup_leaf(from, capin_from, PGTBL_DEPTH, &lvl);
+			if (unlikely(!src)) return -ENOENT;
+			if (unlikely(lvl != PGTBL_DEPTH)) {
+				/* A page within a source superpage */
+				src = NULL;
+				ret = chal_pgtbl_cpy(t, cap_to, capin_to, ctfrom, capin_from, CAP_PGTBL, flags_in);
+				if (ret) return ret;
+				dst = NULL;
+				continue;
+			}
+		} else {
+			src++;
+		}
+		if (!dst || !(capin_to & (SUPER_PAGE_SIZE - 1))) {
+			dst = __pgtbl_lkup_leaf(to, capin_to, PGTBL_DEPTH, &lvl);
+			if (unlikely(!dst)) return -ENOENT;
+			if (unlikely(lvl != PGTBL_DEPTH)) return (*dst & X86_PGTBL_PRESENT) ? -EEXIST : -ENOENT;
+		} else {
+			dst++;
+		}
+
+		old_v = *src;
+		/* Cannot copy frame, or kernel entry. */
+		if (chal_pgtbl_flag_exist(old_v, PGTBL_COSFRAME) || !chal_pgtbl_flag_exist(old_v, PGTBL_USER)) return -EPERM;
+		if (unlikely(ept))        flags = chal_vm_pgtbl_def_flag();
+		else if (unlikely(iommu)) flags = chal_iommu_pgtbl_flag(old_v & PGTBL_FLAG_MASK, flags_in);
+		else                      flags = chal_pgtbl_flag_update(old_v & PGTBL_FLAG_MASK, flags_in);
+		flags &= ~X86_PGTBL_SUPER;
+
+		orig_v = *dst;
+		if (orig_v & X86_PGTBL_PRESENT) return -EEXIST;
+		if (orig_v & X86_PGTBL_COSFRAME) return -EPERM;
+		ret = pgtbl_quie_check(orig_v);
+		if (ret) return ret;
+
+		/* ref cnt on the frame - always user frame. */
+		ret = retypetbl_ref((void *)(old_v & PGTBL_FRAME_MASK), PAGE_ORDER);
+		if (ret) return ret;
+		ret = __pgtbl_update_leaf((struct ert_intern *)dst, (void *)((old_v & PGTBL_FRAME_MASK) | flags), orig_v);
+		if (ret) {
+			retypetbl_deref((void *)(old_v & PGTBL_FRAME_MASK), PAGE_ORDER);
+			return ret;
+		}
+	}
+	if (unlikely(iommu)) chal_iommu_pgtbl_flush((struct cap_pgtbl *)ctto, 1);
+#elif defined(__i386__)
+	for (i = 0; i < npages; i++, capin_to += PAGE_SIZE, capin_from += PAGE_SIZE) {
+		ret = chal_pgtbl_cpy(t, cap_to, capin_to, ctfrom, capin_from, CAP_PGTBL, flags_in);
+		if (ret) return ret;
+	}
+#endif
+
+	return 0;
 }
 
 /* 
@@ -757,6 +1138,9 @@ chal_pgtbl_cons(struct cap_captbl *ct, struct cap_captbl *ctsub, capid_t expandi
 	if (!intern) return -ENOENT;
 	old_pte = *intern;
 	if (pgtbl_ispresent(old_pte)) return -EPERM;
+	/* A removed superpage might still be in some TLB */
+	ret = pgtbl_quie_check(old_pte);
+	if (ret) return ret;
 	old_v = refcnt_flags = ((struct cap_pgtbl *)ctsub)->refcnt_flags;
 	if (refcnt_flags & CAP_MEM_FROZEN_FLAG) return -EINVAL;
 	if ((refcnt_flags & CAP_REFCNT_MAX) == CAP_REFCNT_MAX) return -EOVERFLOW;
@@ -773,6 +1157,8 @@ chal_pgtbl_cons(struct cap_captbl *ct, struct cap_captbl *ctsub, capid_t expandi
 		new_pte |= X86_PGTBL_INTERN_DEF;
 	} else if (type == PGTBL_TYPE_EPT) {
 		new_pte |= x86_EPT_INTERN_DEF;
+	} else if (type == PGTBL_TYPE_IOMMU) {
+		new_pte |= x86_IOMMU_INTERN_DEF;
 	} else {
 		/* Some error has occured in this cap! */
 		assert(0);
@@ -827,10 +1213,15 @@ chal_pgtbl_introspect(struct cap_header *ch, vaddr_t addr)
 	int            ret = 0;
 #if defined(__x86_64__)
 	unsigned long		*f, old_v;
+	u32_t			 lvl;
 
-	f = pgtbl_lkup_lvl(((struct cap_pgtbl *)ch)->pgtbl, addr, &flags, 0, PGTBL_DEPTH);
+	f = __pgtbl_lkup_leaf(((struct cap_pgtbl *)ch)->pgtbl, addr, PGTBL_DEPTH, &lvl);
 	old_v = *f;
-	return old_v;
+	if (lvl == PGTBL_DEPTH) return old_v;
+	if (lvl == 1 || !(old_v & X86_PGTBL_PRESENT)) return 0;
+
+	/* Report the page within the superpage, so callers can compute physical addresses */
+	return old_v + (addr & ((1UL << __pgtbl_lvl2order(lvl)) - 1) & PGTBL_FRAME_MASK);
 #endif
 	/* Is this a pte or a pgd? */
 	pte = pgtbl_lkup_pgd(((struct cap_pgtbl *)ch)->pgtbl, addr, &flags);
@@ -846,6 +1237,47 @@ chal_pgtbl_introspect(struct cap_header *ch, vaddr_t addr)
 	return ret;
 }
 
+/*
+ * Collect and clear the dirty bits of the EPT entries mapping the
+ * npages guest-physical pages at gpa, a bit per page in bitmap.  The
+ * processor sets the bit of an entry on the first write through it
+ * (the accessed and dirty flags are enabled in the EPTP), thus a 2MB
+ * entry reports all of its pages.  The caller flushes the EPT
+ * translations cached with the bit set.  Returns the number of dirty
+ * pages.
+ */
+int
+chal_pgtbl_ept_dirty(struct cap_pgtbl *pt, vaddr_t gpa, unsigned long npages, unsigned long *bitmap)
+{
+#if defined(__x86_64__)
+	unsigned long i, j, n, *pte, v;
+	u32_t         lvl;
+	int           ndirty = 0;
+
+	memset(bitmap, 0, COS_EPT_DIRTY_WORDS(npages) * sizeof(unsigned long));
+	for (i = 0; i < npages; i += n) {
+		pte = __pgtbl_lkup_leaf(pt->pgtbl, gpa + i * PAGE_SIZE, PGTBL_DEPTH, &lvl);
+		/* The pages from this one to the end of the entry */
+		n = 1UL << (__pgtbl_lvl2order(lvl) - PAGE_ORDER);
+		n = n - (((gpa >> PAGE_ORDER) + i) & (n - 1));
+		if (n > npages - i) n = npages - i;
+
+		do {
+			v = *pte;
+			if (!(v & X86_PGTBL_PRESENT) || !(v & x86_EPT_DIRTY)) break;
+		} while (cos_cas(pte, v, v & ~x86_EPT_DIRTY) != CAS_SUCCESS);
+		if (!(v & X86_PGTBL_PRESENT) || !(v & x86_EPT_DIRTY)) continue;
+
+		for (j = i; j < i + n; j++) bitmap[j / (sizeof(unsigned long) * 8)] |= 1UL << (j % (sizeof(unsigned long) * 8));
+		ndirty += n;
+	}
+
+	return ndirty;
+#else
+	return -EINVAL;
+#endif
+}
+
 int 
 chal_pgtbl_deact_pre(struct cap_header *ch, u32_t pa)
 {
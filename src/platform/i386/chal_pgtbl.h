@@ -50,6 +50,14 @@ typedef enum {
 	x86_EPT_VM_DEF			= x86_EPT_READ_ACCESS | x86_EPT_WRITE_ACCCESS | x86_EPT_INST_FETCHABLE | x86_EPT_USR_INST_FETCHABLE | x86_EPT_MEM_WB | x86_EPT_IGNORE_PAT_MEM_TYPE,
 } ept_pgtbl_flags_x86_t;
 
+/* The VT-d second-level entries share the EPT format, minus the memory type */
+typedef enum {
+	x86_IOMMU_READ       = 1,
+	x86_IOMMU_WRITE      = 1 << 1,
+
+	x86_IOMMU_INTERN_DEF = x86_IOMMU_READ | x86_IOMMU_WRITE,
+} iommu_pgtbl_flags_x86_t;
+
 /**
  * Use the passed in page, but make sure that we only use the passed
  * in page once.
@@ -227,5 +235,8 @@ pgtbl_check_pgd_absent(pgtbl_t pt, u32_t addr)
 {
 	return __pgtbl_isnull(pgtbl_get_pgd(pt, (u32_t)addr), 0, 0);
 }
+/* Add the cosframes of contiguous physical pages at contiguous addresses, at boot */
+int chal_pgtbl_cosframes_add(pgtbl_t pt, vaddr_t addr, paddr_t page, unsigned long npages, word_t flags);
+
 #endif /* CHAL_PGTBL_H */
 
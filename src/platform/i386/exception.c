@@ -124,12 +124,24 @@ page_fault_handler(struct pt_regs *regs)
 	struct cos_cpu_local_info *ci    = cos_cpu_local_info();
 	struct thread * curr             = thd_current(ci);
 	thdid_t                    thdid = curr->tid;
+	int                        ret;
 
-	print_pt_regs(regs);
 	fault_addr = chal_cpu_fault_vaddr(regs);
 	errcode    = chal_cpu_fault_errcode(regs);
 	ip        = chal_cpu_fault_ip(regs);
 
+	/* A fault that user-level resolves, e.g. memory mapped on first touch */
+	ret = cap_pgflt_deliver(regs, fault_addr, errcode, ip);
+	if (ret >= 0) return ret;
+
+	print_pt_regs(regs);
+
+	if (curr->ulk_invstk) {
+		printk("Thd %d: %lu user-level invocations deep (%lu at last sinv), protection domain 0x%x%s\n", thdid,
+		       curr->ulk_invstk->top, thd_invstk_entry(curr, curr->invstk_top)->ulk_stkoff, chal_protdom_read(),
+		       errcode & (1 << 5) ? ", protection-key fault" : "");
+	}
+
 	die("FAULT: Page Fault in thd %d (%s %s %s %s %s) @ 0x%p, ip 0x%p, tls 0x%p\n", thdid,
 	    errcode & PGTBL_PRESENT ? "present" : "not-present",
 	    errcode & PGTBL_WRITABLE ? "write-fault" : "read-fault", errcode & PGTBL_USER ? "user-mode" : "system",
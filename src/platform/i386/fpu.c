@@ -2,3 +2,4 @@
 
 PERCPU_VAR(fpu_disabled);
 PERCPU_VAR(fpu_last_used);
+PERCPU_VAR(fpu_deferred);
@@ -5,6 +5,7 @@
 #include "isr.h"
 #include "kernel.h"
 #include "chal/cpuid.h"
+#include "clock.h"
 
 /*
  * These addressess are specified as offsets from the base HPET
@@ -55,7 +56,8 @@
 
 #define HPET_INT_ENABLE(n) (*hpet_interrupt = (0x1 << n)) /* Clears the INT n for level-triggered mode. */
 
-struct cap_asnd hw_asnd_caps[HW_IRQ_TOTAL];
+struct cap_asnd    hw_asnd_caps[HW_IRQ_TOTAL];
+struct hw_irq_line hw_irq_lines[HW_IRQ_EXTERNAL_NUM];
 
 static volatile u32_t *hpet_capabilities;
 static volatile u64_t *hpet_config;
@@ -95,6 +97,7 @@ static int           timer_calibration_init   = 1;
 static unsigned long timer_cycles_per_hpetcyc = TIMER_ERROR_BOUND_FACTOR;
 static unsigned long cycles_per_tick;
 static unsigned long hpetcyc_per_tick;
+static unsigned long fempto_per_hpetcyc;
 #define ULONG_MAX 4294967295UL
 extern u32_t chal_msr_mhz;
 
@@ -165,6 +168,8 @@ timer_calibration(void)
 
 		/* Possibly significant rounding error here.  Bound by the factor */
 		timer_cycles_per_hpetcyc = (TIMER_ERROR_BOUND_FACTOR * cycles_per_tick) / hpetcyc_per_tick;
+		/* The clock's calibration is that of all the ticks */
+		clock_calibrate(((u64_t)TIMER_CALIBRATION_ITER * hpetcyc_per_tick * fempto_per_hpetcyc) / 1000000, tot);
 
 		timer_disable(TIMER_PERIODIC);
 		timer_disable(TIMER_PERIODIC);
@@ -278,10 +283,11 @@ void
 timer_init(void)
 {
 	unsigned long pico_per_hpetcyc;
+	cycles_t      rtc_tsc;
 
 	assert(hpet_capabilities);
-	pico_per_hpetcyc = hpet_capabilities[1]
-	                   / FEMPTO_PER_PICO; /* bits 32-63 are # of femptoseconds per HPET clock tick */
+	fempto_per_hpetcyc = hpet_capabilities[1]; /* bits 32-63 are # of femptoseconds per HPET clock tick */
+	pico_per_hpetcyc   = fempto_per_hpetcyc / FEMPTO_PER_PICO;
 	assert(pico_per_hpetcyc > 0);
 	hpetcyc_per_tick = (TIMER_DEFAULT_US_INTERARRIVAL * PICO_PER_MICRO) / pico_per_hpetcyc;
 
@@ -293,9 +299,12 @@ timer_init(void)
 	 * Set the timer as specified.  This assumes that the cycle
 	 * specification is in hpet cycles (not cpu cycles).
 	 */
+	clock_realtime(rtc_epoch(&rtc_tsc), rtc_tsc);
+
 	if (chal_msr_mhz && !lapic_timer_calibrated()) {
 		cycles_per_tick          = chal_msr_mhz * TIMER_DEFAULT_US_INTERARRIVAL;
 		timer_cycles_per_hpetcyc = cycles_per_tick / hpetcyc_per_tick;
+		clock_calibrate(TIMER_DEFAULT_US_INTERARRIVAL * 1000, cycles_per_tick);
 		printk("\tTimer calibrated using using MSR frequency value\n");
 		timer_calibration_init = 0;
 
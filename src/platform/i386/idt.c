@@ -81,12 +81,36 @@ hw_handler(struct pt_regs *regs)
 	 * TODO: ack here? or
 	 *       after user-level interrupt(rcv event) processing?
 	 */
-	ack_irq(regs->orig_ax);
+	/* MSI vectors are raised through the local APIC, the rest through the 8259s */
+	if (regs->orig_ax >= HW_IRQ_MSI_MIN) lapic_ack();
+	else                                 ack_irq(regs->orig_ax);
+	if (!hw_irq_deliver(regs->orig_ax)) return preempt;
 	preempt = cap_hw_asnd(&hw_asnd_caps[regs->orig_ax], regs);
 
 	return preempt;
 }
 
+/* External lines are the remapped 8259 lines: vectors 32-39 on the master, 40-47 on the slave */
+void
+chal_irq_mask(int irq)
+{
+	u16_t port = irq < 40 ? PIC1_DATA : PIC2_DATA;
+	int   line = (irq - 32) & 7;
+
+	if (irq < 32 || irq >= 48) return;
+	outb(port, inb(port) | (1 << line));
+}
+
+void
+chal_irq_unmask(int irq)
+{
+	u16_t port = irq < 40 ? PIC1_DATA : PIC2_DATA;
+	int   line = (irq - 32) & 7;
+
+	if (irq < 32 || irq >= 48) return;
+	outb(port, inb(port) & ~(1 << line));
+}
+
 #if 0
 static inline void
 remap_irq_table(void)
@@ -173,6 +197,8 @@ idt_init(const cpuid_t cpu_id)
 	idt_set_gate(HW_ID30, (unsigned long)handler_hw_61, 0x08, 0x8E);
 	idt_set_gate(HW_ID31, (unsigned long)handler_hw_62, 0x08, 0x8E);
 	idt_set_gate(HW_LAPIC_SPURIOUS, (unsigned long)lapic_spurious_irq, 0x08, 0x8E);
+	idt_set_gate(HW_LAPIC_VM_POSTED, (unsigned long)lapic_vm_posted_irq, 0x08, 0x8E);
+	idt_set_gate(HW_LAPIC_PMI, (unsigned long)lapic_pmi_irq, 0x08, 0x8E);
 	idt_set_gate(HW_LAPIC_IPI_ASND, (unsigned long)lapic_ipi_asnd_irq, 0x08, 0x8E);
 	idt_set_gate(HW_LAPIC_TIMER, (unsigned long)lapic_timer_irq, 0x08, 0x8E);
 
@@ -0,0 +1,371 @@
+/*
+ * DMA remapping with Intel VT-d.
+ *
+ * The DMA of a device is translated by a page-table of type
+ * PGTBL_TYPE_IOMMU, that a driver component allocates and populates
+ * with the same capability operations as its own page-table: it
+ * aliases (CAPTBL_OP_CPY_N) its memory at the same virtual addresses,
+ * so the I/O virtual addresses it programs in the device are its own
+ * virtual addresses, and the device can only access that memory.  The
+ * second-level page-table format of VT-d is that of EPT, so these
+ * page-tables are 4-level x86-64 page-tables with the read and write
+ * bits in place of present and writable.
+ *
+ * All the remapping units of the DMAR table share one root table.
+ * Translation is only enabled once the first device is bound:
+ * afterwards, devices that aren't bound can't DMA.
+ */
+
+#include "kernel.h"
+#include "chal/chal_proto.h"
+#include "chal_pgtbl.h"
+#include <pgtbl.h>
+
+#if defined(__x86_64__)
+
+#define IOMMU_UNITS_MAX   8
+#define IOMMU_BUSES_MAX   16 /* buses with bound devices, each with a context table */
+#define IOMMU_DEVS_MAX    64 /* bound devices, each with its domain id */
+
+/* Register offsets */
+#define IOMMU_REG_CAP     0x08
+#define IOMMU_REG_ECAP    0x10
+#define IOMMU_REG_GCMD    0x18
+#define IOMMU_REG_GSTS    0x1C
+#define IOMMU_REG_RTADDR  0x20
+#define IOMMU_REG_CCMD    0x28
+
+#define IOMMU_CAP_ND(c)     (4 + 2 * ((c) & 0x7)) /* bits of domain ids */
+#define IOMMU_CAP_CM        (1ULL << 7)           /* caching mode: not-present entries are cached */
+#define IOMMU_CAP_SAGAW_4LV (1ULL << 10)          /* 48-bit, 4-level page-tables */
+#define IOMMU_ECAP_C        (1ULL << 0)           /* page walks snoop the caches */
+#define IOMMU_ECAP_IRO(e)   ((((e) >> 8) & 0x3FF) * 16)
+
+#define IOMMU_GCMD_TE       (1U << 31)
+#define IOMMU_GCMD_SRTP     (1U << 30)
+/* The status bits that are written back in the command register */
+#define IOMMU_GSTS_PERSIST  0x96FFFFFFU
+
+#define IOMMU_CCMD_ICC      (1ULL << 63)
+#define IOMMU_CCMD_GLOBAL   (1ULL << 61)
+#define IOMMU_IOTLB_IVT     (1ULL << 63)
+#define IOMMU_IOTLB_GLOBAL  (1ULL << 60)
+#define IOMMU_IOTLB_DRAIN   ((1ULL << 49) | (1ULL << 48))
+
+#define IOMMU_ENTRY_PRESENT 1ULL
+#define IOMMU_CTX_AW_4LV    2ULL
+#define IOMMU_CTX_DID(d)    ((u64_t)(d) << 8)
+
+/* The DMA remapping reporting table (8.1 in the VT-d spec) */
+#define DMAR_ENTRIES_OFF    48
+#define DMAR_DRHD           0
+
+struct dmar_head {
+	u16_t type;
+	u16_t len;
+} __attribute__((packed));
+
+struct dmar_drhd {
+	struct dmar_head header;
+	u8_t             flags;
+	u8_t             _reserved;
+	u16_t            segment;
+	u64_t            regs;
+} __attribute__((packed));
+
+struct iommu_unit {
+	volatile u8_t *regs;
+	u64_t          cap, ecap;
+};
+
+struct iommu_dev {
+	u16_t             bdf;
+	struct cap_pgtbl *pt; /* NULL if the slot is free */
+};
+
+static struct iommu_unit iommu_units[IOMMU_UNITS_MAX];
+static int               iommu_nunits, iommu_enabled, iommu_coherent = 1, iommu_caching;
+static u32_t             iommu_ndoms = ~0U;
+static unsigned long     iommu_lock;
+
+static struct iommu_dev iommu_devs[IOMMU_DEVS_MAX];
+/* One entry (two words) per bus in the root table, and per device and function in a context table */
+static u64_t iommu_root[PAGE_SIZE / sizeof(u64_t)] PAGE_ALIGNED;
+static u64_t iommu_ctx[IOMMU_BUSES_MAX][PAGE_SIZE / sizeof(u64_t)] PAGE_ALIGNED;
+static int   iommu_nctx;
+
+static inline u64_t
+iommu_rd64(struct iommu_unit *u, u32_t off)
+{
+	return *(volatile u64_t *)(u->regs + off);
+}
+
+static inline void
+iommu_wr64(struct iommu_unit *u, u32_t off, u64_t v)
+{
+	*(volatile u64_t *)(u->regs + off) = v;
+}
+
+static inline u32_t
+iommu_rd32(struct iommu_unit *u, u32_t off)
+{
+	return *(volatile u32_t *)(u->regs + off);
+}
+
+static inline void
+iommu_wr32(struct iommu_unit *u, u32_t off, u32_t v)
+{
+	*(volatile u32_t *)(u->regs + off) = v;
+}
+
+static void
+iommu_take(void)
+{
+	while (cos_cas(&iommu_lock, 0, 1) != CAS_SUCCESS) __asm__ __volatile__("pause" ::: "memory");
+}
+
+static void
+iommu_release(void)
+{
+	cos_mem_fence();
+	iommu_lock = 0;
+}
+
+/* Without snooping, the units read the tables from memory */
+static inline void
+iommu_wb(void)
+{
+	if (!iommu_coherent) chal_flush_cache();
+}
+
+static void
+iommu_gcmd(struct iommu_unit *u, u32_t cmd)
+{
+	u32_t sts = iommu_rd32(u, IOMMU_REG_GSTS) & IOMMU_GSTS_PERSIST;
+
+	iommu_wr32(u, IOMMU_REG_GCMD, sts | cmd);
+	while (!(iommu_rd32(u, IOMMU_REG_GSTS) & cmd))
+		;
+}
+
+/* Register-based global invalidations of the context-caches and IOTLBs of all units */
+static void
+iommu_ctx_inval(void)
+{
+	int i;
+
+	for (i = 0; i < iommu_nunits; i++) {
+		iommu_wr64(&iommu_units[i], IOMMU_REG_CCMD, IOMMU_CCMD_ICC | IOMMU_CCMD_GLOBAL);
+		while (iommu_rd64(&iommu_units[i], IOMMU_REG_CCMD) & IOMMU_CCMD_ICC)
+			;
+	}
+}
+
+static void
+iommu_iotlb_inval(void)
+{
+	struct iommu_unit *u;
+	u32_t              off;
+	int                i;
+
+	for (i = 0; i < iommu_nunits; i++) {
+		u   = &iommu_units[i];
+		off = IOMMU_ECAP_IRO(u->ecap) + 8;
+		iommu_wr64(u, off, IOMMU_IOTLB_IVT | IOMMU_IOTLB_GLOBAL | IOMMU_IOTLB_DRAIN);
+		while (iommu_rd64(u, off) & IOMMU_IOTLB_IVT)
+			;
+	}
+}
+
+static void
+iommu_enable(void)
+{
+	int i;
+
+	iommu_wb();
+	for (i = 0; i < iommu_nunits; i++) {
+		iommu_wr64(&iommu_units[i], IOMMU_REG_RTADDR, (u64_t)chal_va2pa(iommu_root));
+		iommu_gcmd(&iommu_units[i], IOMMU_GCMD_SRTP);
+	}
+	iommu_ctx_inval();
+	iommu_iotlb_inval();
+	for (i = 0; i < iommu_nunits; i++) iommu_gcmd(&iommu_units[i], IOMMU_GCMD_TE);
+	iommu_enabled = 1;
+	printk("IOMMU: DMA remapping enabled\n");
+}
+
+static u64_t *
+iommu_ctx_entry(u16_t bdf, int alloc)
+{
+	u8_t   bus = bdf >> 8;
+	u64_t *ctx;
+
+	if (!(iommu_root[bus * 2] & IOMMU_ENTRY_PRESENT)) {
+		if (!alloc || iommu_nctx == IOMMU_BUSES_MAX) return NULL;
+		ctx                 = iommu_ctx[iommu_nctx++];
+		iommu_root[bus * 2] = (u64_t)chal_va2pa(ctx) | IOMMU_ENTRY_PRESENT;
+	}
+	ctx = chal_pa2va((paddr_t)(iommu_root[bus * 2] & PGTBL_ENTRY_ADDR_MASK));
+
+	return &ctx[(bdf & 0xFF) * 2];
+}
+
+/*
+ * Translate the DMA of the device bdf (bus << 8 | device << 3 |
+ * function) with the top-level page-table pt.  The page-table can't
+ * be deactivated while a device is bound to it.
+ */
+int
+chal_iommu_bind(u16_t bdf, struct cap_pgtbl *pt)
+{
+	u64_t *ce;
+	u32_t  refcnt;
+	int    i, ret = 0;
+
+	if (!iommu_nunits) return -ENOENT;
+	if (pt->type != PGTBL_TYPE_IOMMU || pt->lvl) return -EINVAL;
+
+	iommu_take();
+	for (i = 0; i < IOMMU_DEVS_MAX && iommu_devs[i].pt; i++)
+		;
+	/* domain id 0 is reserved in caching mode */
+	if (i == IOMMU_DEVS_MAX || (u32_t)i + 1 >= iommu_ndoms) cos_throw(done, -ENOMEM);
+	ce = iommu_ctx_entry(bdf, 1);
+	if (!ce) cos_throw(done, -ENOMEM);
+	if (ce[0] & IOMMU_ENTRY_PRESENT) cos_throw(done, -EEXIST);
+
+	refcnt = pt->refcnt_flags;
+	if (refcnt & CAP_MEM_FROZEN_FLAG) cos_throw(done, -EINVAL);
+	if ((refcnt & CAP_REFCNT_MAX) == CAP_REFCNT_MAX) cos_throw(done, -EOVERFLOW);
+	cos_faa((int *)&pt->refcnt_flags, 1);
+	iommu_devs[i] = (struct iommu_dev){ .bdf = bdf, .pt = pt };
+
+	ce[1] = IOMMU_CTX_AW_4LV | IOMMU_CTX_DID(i + 1);
+	cos_mem_fence();
+	ce[0] = ((u64_t)pt->pgtbl & PGTBL_ENTRY_ADDR_MASK) | IOMMU_ENTRY_PRESENT;
+
+	if (!iommu_enabled) {
+		iommu_enable();
+	} else {
+		iommu_wb();
+		iommu_ctx_inval();
+		iommu_iotlb_inval();
+	}
+done:
+	iommu_release();
+
+	return ret;
+}
+
+int
+chal_iommu_unbind(u16_t bdf)
+{
+	u64_t *ce;
+	int    i, ret = 0;
+
+	if (!iommu_nunits) return -ENOENT;
+
+	iommu_take();
+	for (i = 0; i < IOMMU_DEVS_MAX && !(iommu_devs[i].pt && iommu_devs[i].bdf == bdf); i++)
+		;
+	if (i == IOMMU_DEVS_MAX) cos_throw(done, -ENOENT);
+	ce = iommu_ctx_entry(bdf, 0);
+	assert(ce);
+
+	ce[0] = 0;
+	ce[1] = 0;
+	iommu_wb();
+	iommu_ctx_inval();
+	iommu_iotlb_inval();
+
+	cos_faa((int *)&iommu_devs[i].pt->refcnt_flags, -1);
+	iommu_devs[i].pt = NULL;
+done:
+	iommu_release();
+
+	return ret;
+}
+
+/*
+ * A mapping was removed from (map == 0) or added to (map) the
+ * page-table pt: the device must not access a removed page once the
+ * system call returns, as the frame might be reused.  Added mappings
+ * only need an invalidation if not-present entries are cached.
+ */
+void
+chal_iommu_pgtbl_flush(struct cap_pgtbl *pt, int map)
+{
+	if (likely(pt->type != PGTBL_TYPE_IOMMU) || !iommu_enabled) return;
+	if (map && !iommu_caching && iommu_coherent) return;
+
+	iommu_take();
+	iommu_wb();
+	iommu_iotlb_inval();
+	iommu_release();
+}
+
+void
+iommu_init(void *dmar)
+{
+	struct dmar_head *h;
+	struct dmar_drhd *d;
+	struct iommu_unit *u;
+	u32_t             len = *(u32_t *)((u8_t *)dmar + 4);
+	u32_t             off;
+
+	printk("IOMMU initialization\n");
+	for (off = DMAR_ENTRIES_OFF; off + sizeof(struct dmar_head) <= len; off += h->len) {
+		h = (struct dmar_head *)((u8_t *)dmar + off);
+		if (!h->len) break;
+		if (h->type != DMAR_DRHD) continue;
+		if (iommu_nunits == IOMMU_UNITS_MAX) {
+			printk("\tDMAR: more than %d remapping units, ignoring the rest\n", IOMMU_UNITS_MAX);
+			break;
+		}
+
+		d       = (struct dmar_drhd *)h;
+		u       = &iommu_units[iommu_nunits];
+		u->regs = device_map_mem((paddr_t)d->regs, PGTBL_NOCACHE);
+		assert(u->regs);
+		u->cap  = iommu_rd64(u, IOMMU_REG_CAP);
+		u->ecap = iommu_rd64(u, IOMMU_REG_ECAP);
+		printk("\tDMAR: remapping unit @ %p, segment %d, cap %llx, ecap %llx\n", (void *)d->regs, d->segment, u->cap, u->ecap);
+
+		if (!(u->cap & IOMMU_CAP_SAGAW_4LV)) {
+			printk("\tDMAR: no support for 4-level page-tables, not using it\n");
+			continue;
+		}
+		if (!(u->ecap & IOMMU_ECAP_C)) iommu_coherent = 0;
+		if (u->cap & IOMMU_CAP_CM) iommu_caching = 1;
+		if ((1U << IOMMU_CAP_ND(u->cap)) < iommu_ndoms) iommu_ndoms = 1U << IOMMU_CAP_ND(u->cap);
+		iommu_nunits++;
+	}
+	if (!iommu_nunits) printk("\tNo usable remapping unit, DMA is not remapped.\n");
+}
+
+#else /* VT-d needs 4-level page-tables */
+
+int
+chal_iommu_bind(u16_t bdf, struct cap_pgtbl *pt)
+{
+	return -ENOENT;
+}
+
+int
+chal_iommu_unbind(u16_t bdf)
+{
+	return -ENOENT;
+}
+
+void
+chal_iommu_pgtbl_flush(struct cap_pgtbl *pt, int map)
+{
+}
+
+void
+iommu_init(void *dmar)
+{
+	printk("IOMMU: DMA remapping is only supported on x86-64\n");
+}
+
+#endif
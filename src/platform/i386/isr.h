@@ -82,6 +82,8 @@ extern void handler_hw_60(struct pt_regs *);
 extern void handler_hw_61(struct pt_regs *);
 extern void handler_hw_62(struct pt_regs *);
 extern void lapic_spurious_irq(struct pt_regs *);
+extern void lapic_vm_posted_irq(struct pt_regs *);
+extern void lapic_pmi_irq(struct pt_regs *);
 extern void lapic_ipi_asnd_irq(struct pt_regs *);
 extern void lapic_timer_irq(struct pt_regs *);
 
@@ -174,12 +174,15 @@ kmain(unsigned long mboot_addr, unsigned long mboot_magic)
 
 	acpi_init();
 	lapic_init();
+	topology_cpu_init(INIT_CORE);
 	timer_init();
 	boot_state_transition(INIT_UT_MEM, INIT_KMEM);
 
 	kern_boot_comp(INIT_CORE);
 
 	smp_init(cores_ready);
+	/* with the cpuid leaves of all of the cores */
+	topology_init();
 	cores_ready[INIT_CORE] = 1;
 
 	kern_boot_upcall();
@@ -202,10 +205,15 @@ smp_kmain(void)
 	chal_cpu_init();
 	kern_boot_comp(cpu_id);
 	lapic_init();
+	topology_cpu_init(cpu_id);
 
 	printk("New CPU %d Booted\n", cpu_id);
 	cores_ready[cpu_id] = 1;
-	/* waiting for all cored booted */
+	/*
+	 * The APs boot in parallel, and upcall as soon as the init core
+	 * does, which must upcall first: the boot component's init core
+	 * is the first to upcall into it.
+	 */
 	while(cores_ready[INIT_CORE] == 0);
 
 	kern_boot_upcall();
@@ -53,6 +53,7 @@ void  timer_init(void);
 u64_t timer_find_hpet(void *timer);
 void  timer_thd_init(struct thread *t);
 void *timer_initialize_hpet(void *timer);
+u64_t rtc_epoch(cycles_t *stamp);
 
 void  tss_init(const cpuid_t cpu_id);
 void  idt_init(const cpuid_t cpu_id);
@@ -67,6 +68,10 @@ void  acpi_set_rsdt_page(u32_t);
 void  kern_paging_map_init(void *pa);
 
 void *acpi_find_apic(void);
+void *acpi_find_dmar(void);
+void  topology_cpu_init(const cpuid_t cpu_id);
+void  topology_init(void);
+void  iommu_init(void *dmar);
 void  acpi_shutdown(void);
 
 int   lapic_find_localaddr(void *l);
@@ -77,6 +82,8 @@ u32_t lapic_get_ccr(void);
 void  lapic_timer_calibration(u32_t ratio);
 int   lapic_timer_calibrated(void);
 void  lapic_asnd_ipi_send(const cpuid_t cpu_id);
+void  lapic_vm_posted_ipi_send(const cpuid_t cpu_id);
+void  lapic_ack(void);
 
 void smp_init(volatile int *cores_ready);
 
@@ -1,6 +1,7 @@
 #include "kernel.h"
 #include "chal_cpu.h"
 #include "isr.h"
+#include <trace.h>
 
 #define APIC_DEFAULT_PHYS 0xfee00000
 #define APIC_HDR_LEN_OFF 0x04
@@ -77,7 +78,9 @@ volatile int apicids[NUM_CPU];
 #define LAPIC_ICR_INIT           0x500     /* INIT */
 #define LAPIC_ICR_SIPI           0x600     /* Startup IPI */
 #define LAPIC_ICR_FIXED          0x000     /* fixed IPI */
+#define LAPIC_ICR_ALL_EXCL_SELF  (3 << 18) /* destination shorthand: all, excluding self */
 #define LAPIC_IPI_ASND_VEC       HW_LAPIC_IPI_ASND /* interrupt vec for asnd ipi */
+#define LAPIC_VM_POSTED_VEC      HW_LAPIC_VM_POSTED /* interrupt vec for posted-interrupt notifications */
 
 #define IA32_MSR_TSC_DEADLINE 0x000006e0
 
@@ -136,6 +139,16 @@ lapic_ack(void)
 	lapic_write_reg(LAPIC_EOI_REG, 0);
 }
 
+/* MSIs are sent in physical destination mode, to the apicid in bits 19:12 of the address */
+int
+chal_irq_msi_dest(int irq, cpuid_t cpu)
+{
+	if (irq < HW_IRQ_MSI_MIN || irq > HW_IRQ_MSI_MAX) return -EINVAL;
+	if (cpu < 0 || cpu >= NUM_CPU) return -EINVAL;
+
+	return apicids[cpu];
+}
+
 static u32_t
 lapic_read_reg(u32_t off)
 {
@@ -284,6 +297,7 @@ lapic_init(void)
 	/* lapic_write_reg(LAPIC_LINT0, LAPIC_INT_MASKED); */
 	/* lapic_write_reg(LAPIC_LINT1, LAPIC_INT_MASKED); */
 	/* if ((version >> 16) >= 4) lapic_write_reg(LAPIC_PCINT, LAPIC_INT_MASKED); */
+	lapic_write_reg(LAPIC_PCINT, HW_LAPIC_PMI);
 	lapic_timer_init();
 
 	lapic_write_reg(LAPIC_ESR, 0);
@@ -443,17 +457,57 @@ lapic_asnd_ipi_send(const cpuid_t cpu_id)
 	return;
 }
 
+void
+lapic_vm_posted_ipi_send(const cpuid_t cpu_id)
+{
+	assert(ncpus > 1 && cpu_id >= 0 && cpu_id < ncpus);
+
+	lapic_ipi_send(apicids[cpu_id], LAPIC_ICR_FIXED | LAPIC_VM_POSTED_VEC);
+
+	return;
+}
+
 int
 lapic_spurious_handler(struct pt_regs *regs)
 {
 	return 1;
 }
 
+/*
+ * A posted-interrupt notification is processed by the hardware if
+ * the core runs the vcpu. Otherwise it arrives here, and the posted
+ * interrupts are moved into the vcpu's virtual lapic on its next
+ * entry (vmx_resume).
+ */
+int
+lapic_vm_posted_handler(struct pt_regs *regs)
+{
+	lapic_ack();
+
+	return 1;
+}
+
+/*
+ * The sampling counter overflowed (see pmu.h). The lapic masks the
+ * interrupt as it delivers it, so it's unmasked for the next one.
+ */
+int
+lapic_pmi_handler(struct pt_regs *regs)
+{
+	if (pmu_sample_overflow()) trace_sample(regs);
+	lapic_write_reg(LAPIC_PCINT, HW_LAPIC_PMI);
+	lapic_ack();
+
+	return 1;
+}
+
 int
 lapic_ipi_asnd_handler(struct pt_regs *regs)
 {
 	int preempt = 1;
 
+	/* The IPI might be (or include) a TLB shootdown */
+	tlb_shootdown_process();
 	preempt = cap_ipi_process(regs);
 
 	lapic_ack();
@@ -468,6 +522,7 @@ lapic_timer_handler(struct pt_regs *regs)
 
 	lapic_ack();
 
+	tlb_shootdown_process();
 	preempt = timer_process(regs);
 
 	return preempt;
@@ -491,64 +546,73 @@ delay_us(u32_t us)
 }
 
 /* The SMP boot patchcode from loader.S */
-extern char smppatchstart, smppatchend, smpstack, stack;
+extern char smppatchstart, smppatchend, stack;
+
+/*
+ * The core of each APIC id, or 0xFF for the processors we don't use:
+ * the APs are started together, and each finds its core (and thus its
+ * stack) with its APIC id (see smp_entry_64 in loader.S).
+ */
+u8_t smp_apicid_cpu[256];
 
 void
 smp_boot_all_ap(volatile int *cores_ready)
 {
-	int i;
+	int i, j;
 	u32_t ret;
-	char **stackpatch;
+	u16_t *warm_reset_vec;
 
 	/*
-	 * Set up the processor boot-up code.  Use SMC to create the
-	 * smp loader code with the stack address inlined into it at
-	 * an address that real-mode 16-bit code can execute
+	 * Set up the processor boot-up code at an address that
+	 * real-mode 16-bit code can execute
 	 */
 	memcpy((char *)chal_pa2va(SMP_BOOT_PATCH_ADDR), &smppatchstart, &smppatchend - &smppatchstart);
-	stackpatch  = (char **)chal_pa2va(SMP_BOOT_PATCH_ADDR + (&smpstack - &smppatchstart));
 
+	memset(smp_apicid_cpu, 0xFF, sizeof(smp_apicid_cpu));
 	for (i = 1; i < ncpus; i++) {
 		struct cos_cpu_local_info *cli;
-		int 	j;
-		u16_t   *warm_reset_vec;
-
-		/* init shutdown code */
-		outb(CMOS_PORT, 0xF);
-		outb(CMOS_PORT+1, 0x0A);
-		/* Warm reset vector */
-		warm_reset_vec = (u16_t *)chal_pa2va((0x40 << 4 | 0x67));
-		warm_reset_vec[0] = 0;
-		warm_reset_vec[1] = SMP_BOOT_PATCH_ADDR >> 4;
-
-		ret = lapic_read_reg(LAPIC_ESR);
-		if (ret) printk("SMP Bootup: LAPIC error status register is %x\n", ret);
-		lapic_write_reg(LAPIC_ESR, 0);
-		lapic_read_reg(LAPIC_ESR);
-
-		printk("\nBooting AP %d with apic_id %d\n", i, apicids[i]);
-		/* Application Processor (AP) startup sequence: */
-		/* ...make sure that we pass this core's stack */
-		*stackpatch = (char *)((unsigned long)&stack + ((PAGE_SIZE * i) + (PAGE_SIZE - STK_INFO_OFF)));
-		/* ...initialize the coreid of the new processor */
-		cli         = (struct cos_cpu_local_info *)*stackpatch;
-		cli->cpuid  = i; /* the rest is initialized during the bootup process */
-
-		/* Now the IPI coordination process to boot the AP: first send init ipi... */
-		lapic_ipi_send(apicids[i], LAPIC_ICR_LEVEL | LAPIC_ICR_ASSERT | LAPIC_ICR_INIT);
+
+		assert(apicids[i] < 0xFF);
+		smp_apicid_cpu[apicids[i]] = i;
+		/* ...initialize the coreid of the new processor, at the top of its stack */
+		cli        = (struct cos_cpu_local_info *)((unsigned long)&stack + ((PAGE_SIZE * i) + (PAGE_SIZE - STK_INFO_OFF)));
+		cli->cpuid = i; /* the rest is initialized during the bootup process */
+	}
+
+	/* init shutdown code */
+	outb(CMOS_PORT, 0xF);
+	outb(CMOS_PORT+1, 0x0A);
+	/* Warm reset vector */
+	warm_reset_vec = (u16_t *)chal_pa2va((0x40 << 4 | 0x67));
+	warm_reset_vec[0] = 0;
+	warm_reset_vec[1] = SMP_BOOT_PATCH_ADDR >> 4;
+
+	ret = lapic_read_reg(LAPIC_ESR);
+	if (ret) printk("SMP Bootup: LAPIC error status register is %x\n", ret);
+	lapic_write_reg(LAPIC_ESR, 0);
+	lapic_read_reg(LAPIC_ESR);
+
+	printk("\nBooting %d APs\n", ncpus - 1);
+	/*
+	 * Application Processors (APs) startup sequence, broadcast to
+	 * all of them, so that they boot in parallel: first send init
+	 * ipi...
+	 */
+	lapic_ipi_send(0, LAPIC_ICR_ALL_EXCL_SELF | LAPIC_ICR_LEVEL | LAPIC_ICR_ASSERT | LAPIC_ICR_INIT);
+	delay_us(200);
+	/* ...deassert it... */
+	lapic_ipi_send(0, LAPIC_ICR_ALL_EXCL_SELF | LAPIC_ICR_LEVEL | LAPIC_ICR_INIT);
+	/* ...wait for 10 ms... */
+	delay_us(10000);
+	for (j = 0; j < 2; j++) {
+		/* ...send startup IPIs... */
+		assert(!(SMP_BOOT_PATCH_ADDR >> 12 & ~0xFF)); /* some address validation */
+		lapic_ipi_send(0, LAPIC_ICR_ALL_EXCL_SELF | LAPIC_ICR_SIPI | (SMP_BOOT_PATCH_ADDR >> 12));
+		/* ...wait for 200 us... */
 		delay_us(200);
-		/* ...deassert it... */
-		lapic_ipi_send(apicids[i], LAPIC_ICR_LEVEL | LAPIC_ICR_INIT);
-		/* ...wait for 10 ms... */
-		delay_us(10000);
-		for (j = 0; j < 2; j++) {
-			/* ...send startup IPIs... */
-			assert(!(SMP_BOOT_PATCH_ADDR >> 12 & ~0xFF)); /* some address validation */
-			lapic_ipi_send(apicids[i], LAPIC_ICR_SIPI | (SMP_BOOT_PATCH_ADDR >> 12));
-			/* ...wait for 200 us... */
-			delay_us(200);
-		}
-		/* waiting for AP's booting */
+	}
+	/* waiting for APs' booting */
+	for (i = 1; i < ncpus; i++) {
 		while(*(volatile int *)(cores_ready + i) == 0) ;
 	}
 	ret = lapic_read_reg(LAPIC_ESR);
@@ -161,6 +161,388 @@ acpi_find_apic(void)
 	return acpi_find_resource_flags("APIC", PGTBL_NOCACHE);
 }
 
+void *
+acpi_find_dmar(void)
+{
+	return acpi_find_resource("DMAR");
+}
+
+/*
+ * The System Resource Affinity Table (5.2.16 in the ACPI spec) maps
+ * processors and physical memory ranges to proximity domains.  We
+ * give each domain a dense node id in the order we find it.
+ */
+#define SRAT_ENTRIES_OFF   48
+#define SRAT_LAPIC         0
+#define SRAT_MEM           1
+#define SRAT_X2APIC        2
+#define SRAT_ENABLED       0x1
+#define NUMA_MEM_RANGES_MAX (NUMA_NODES_MAX * 2)
+
+struct srat_head {
+	u8_t type;
+	u8_t len;
+} __attribute__((packed));
+
+struct srat_lapic {
+	struct srat_head header;
+	u8_t             domain_lo;
+	u8_t             apic_id;
+	u32_t            flags;
+	u8_t             sapic_eid;
+	u8_t             domain_hi[3];
+	u32_t            clock_domain;
+} __attribute__((packed));
+
+struct srat_mem {
+	struct srat_head header;
+	u32_t            domain;
+	u16_t            _reserved0;
+	u32_t            base_lo, base_hi;
+	u32_t            len_lo, len_hi;
+	u32_t            _reserved1;
+	u32_t            flags;
+	u64_t            _reserved2;
+} __attribute__((packed));
+
+struct srat_x2apic {
+	struct srat_head header;
+	u16_t            _reserved0;
+	u32_t            domain;
+	u32_t            x2apic_id;
+	u32_t            flags;
+	u32_t            clock_domain;
+	u32_t            _reserved1;
+} __attribute__((packed));
+
+struct numa_mem_range {
+	paddr_t base, end;
+	int     node;
+};
+
+extern volatile int ncpus;
+extern volatile int apicids[NUM_CPU];
+
+static struct numa_mem_range numa_ranges[NUMA_MEM_RANGES_MAX];
+static int                   numa_nranges;
+static u32_t                 numa_domains[NUMA_NODES_MAX];
+static int                   numa_nnodes;
+static int                   numa_cpu_nodes[NUM_CPU];
+static u8_t                  numa_distance[NUMA_NODES_MAX][NUMA_NODES_MAX];
+
+static int
+acpi_numa_domain2node(u32_t domain)
+{
+	int i;
+
+	for (i = 0; i < numa_nnodes; i++) {
+		if (numa_domains[i] == domain) return i;
+	}
+	if (numa_nnodes == NUMA_NODES_MAX) {
+		printk("\tSRAT: more than %d proximity domains, folding domain %d into node 0\n", NUMA_NODES_MAX, domain);
+		return 0;
+	}
+	numa_domains[numa_nnodes] = domain;
+
+	return numa_nnodes++;
+}
+
+static void
+acpi_numa_cpu(u32_t apic_id, u32_t domain)
+{
+	int i;
+
+	for (i = 0; i < ncpus; i++) {
+		if ((u32_t)apicids[i] == apic_id) numa_cpu_nodes[i] = acpi_numa_domain2node(domain);
+	}
+}
+
+static void
+acpi_numa_init(void)
+{
+	unsigned char    *srat = acpi_find_resource("SRAT");
+	struct srat_head *h, *end;
+
+	if (!srat) {
+		printk("\tNo SRAT found, using a single NUMA node.\n");
+		goto single;
+	}
+
+	h   = (struct srat_head *)(srat + SRAT_ENTRIES_OFF);
+	end = (struct srat_head *)(srat + ((struct acpi_header *)srat)->len);
+	for (; h < end && h->len >= sizeof(struct srat_head); h = (struct srat_head *)((char *)h + h->len)) {
+		switch (h->type) {
+		case SRAT_LAPIC: {
+			struct srat_lapic *l = (struct srat_lapic *)h;
+
+			if (!(l->flags & SRAT_ENABLED)) break;
+			acpi_numa_cpu(l->apic_id, l->domain_lo | (l->domain_hi[0] << 8) | (l->domain_hi[1] << 16)
+			                            | ((u32_t)l->domain_hi[2] << 24));
+			break;
+		}
+		case SRAT_X2APIC: {
+			struct srat_x2apic *x = (struct srat_x2apic *)h;
+
+			if (!(x->flags & SRAT_ENABLED)) break;
+			acpi_numa_cpu(x->x2apic_id, x->domain);
+			break;
+		}
+		case SRAT_MEM: {
+			struct srat_mem       *m = (struct srat_mem *)h;
+			struct numa_mem_range *r;
+
+			if (!(m->flags & SRAT_ENABLED)) break;
+			if (numa_nranges == NUMA_MEM_RANGES_MAX) {
+				printk("\tSRAT: too many memory ranges, ignoring the rest\n");
+				break;
+			}
+			r       = &numa_ranges[numa_nranges++];
+			r->base = (paddr_t)(((u64_t)m->base_hi << 32) | m->base_lo);
+			r->end  = r->base + (paddr_t)(((u64_t)m->len_hi << 32) | m->len_lo);
+			r->node = acpi_numa_domain2node(m->domain);
+			printk("\tSRAT: memory [%p, %p) in node %d\n", (void *)r->base, (void *)r->end, r->node);
+			break;
+		}
+		default:
+			break;
+		}
+	}
+
+	if (numa_nranges) {
+		int i;
+
+		printk("\tSRAT: %d NUMA nodes\n", numa_nnodes);
+		for (i = 0; i < ncpus; i++) printk("\tSRAT: core %d in node %d\n", i, numa_cpu_nodes[i]);
+
+		return;
+	}
+	printk("\tSRAT lists no memory, using a single NUMA node.\n");
+single:
+	numa_nnodes    = 1;
+	numa_nranges   = 1;
+	numa_ranges[0] = (struct numa_mem_range){ .base = 0, .end = (paddr_t)~0UL, .node = 0 };
+	memset(numa_cpu_nodes, 0, sizeof(numa_cpu_nodes));
+}
+
+/*
+ * The System Locality Information Table (5.2.17) has the relative
+ * distance between each pair of proximity domains, 10 being local.
+ */
+#define SLIT_LOCALITIES_OFF 36
+#define SLIT_ENTRIES_OFF    44
+#define NUMA_DIST_LOCAL     10
+#define NUMA_DIST_REMOTE    20
+
+static void
+acpi_slit_init(void)
+{
+	unsigned char *slit = acpi_find_resource("SLIT");
+	u64_t          n;
+	int            i, j;
+
+	for (i = 0; i < NUMA_NODES_MAX; i++) {
+		for (j = 0; j < NUMA_NODES_MAX; j++) numa_distance[i][j] = i == j ? NUMA_DIST_LOCAL : NUMA_DIST_REMOTE;
+	}
+	if (!slit) return;
+
+	memcpy(&n, slit + SLIT_LOCALITIES_OFF, sizeof(n));
+	if (n > 0xFF || SLIT_ENTRIES_OFF + n * n > ((struct acpi_header *)slit)->len) {
+		printk("\tSLIT: malformed, ignoring it\n");
+		return;
+	}
+	for (i = 0; i < numa_nnodes; i++) {
+		for (j = 0; j < numa_nnodes; j++) {
+			if (numa_domains[i] >= n || numa_domains[j] >= n) continue;
+			numa_distance[i][j] = slit[SLIT_ENTRIES_OFF + numa_domains[i] * n + numa_domains[j]];
+		}
+	}
+	printk("\tSLIT: %d localities\n", (int)n);
+}
+
+int
+chal_numa_nnodes(void)
+{
+	return numa_nnodes;
+}
+
+int
+chal_numa_cpu_node(cpuid_t cpu)
+{
+	if (cpu < 0 || cpu >= NUM_CPU) return -EINVAL;
+
+	return numa_cpu_nodes[cpu];
+}
+
+/*
+ * The node of the physical address.  *extent is set to the end of the
+ * contiguous range of memory in that node that the address is in (or
+ * to the next range if the address lands in a hole in the SRAT), but
+ * never past the end of untyped memory.
+ */
+int
+chal_numa_pa_node(paddr_t pa, paddr_t *extent)
+{
+	paddr_t next = chal_va2pa(mem_utmem_end());
+	int     i;
+
+	for (i = 0; i < numa_nranges; i++) {
+		struct numa_mem_range *r = &numa_ranges[i];
+
+		if (pa >= r->base && pa < r->end) {
+			if (extent) *extent = r->end < next ? r->end : next;
+			return r->node;
+		}
+		if (r->base > pa && r->base < next) next = r->base;
+	}
+	if (extent) *extent = next;
+
+	return 0;
+}
+
+/* How many pages of the untyped memory are in the node? */
+unsigned long
+chal_numa_node_pages(int node)
+{
+	paddr_t       ut_start = chal_va2pa(mem_utmem_start()), ut_end = chal_va2pa(mem_utmem_end());
+	unsigned long pages    = 0;
+	int           i;
+
+	for (i = 0; i < numa_nranges; i++) {
+		struct numa_mem_range *r = &numa_ranges[i];
+		paddr_t                s = r->base > ut_start ? r->base : ut_start;
+		paddr_t                e = r->end < ut_end ? r->end : ut_end;
+
+		if (r->node != node || s >= e) continue;
+		pages += (e - s) >> PAGE_ORDER;
+	}
+
+	return pages;
+}
+
+/*
+ * Each core reads its APIC id, and the widths of the low bits of the
+ * ids that differ between the processors of its physical core, of its
+ * package, and of those sharing its L2 and L3 caches (cpuid leaves
+ * 0xB and 4, 8.9 in volume 3 of Intel's manual), on itself at boot.
+ * The exported table is built from them once all of the cores booted.
+ */
+struct topo_cpu {
+	u32_t apic_id;
+	u8_t  smt_shift, pkg_shift, l2_shift, l3_shift;
+};
+
+static struct topo_cpu     topo_cpus[NUM_CPU];
+static struct cos_topology topo;
+
+/* As chal_cpuid, whose header's port accessors conflict with ours */
+static inline void
+topo_cpuid(u32_t *a, u32_t *b, u32_t *c, u32_t *d)
+{
+	asm volatile("cpuid" : "+a"(*a), "+b"(*b), "+c"(*c), "+d"(*d));
+}
+
+/* The bits to number n processors */
+static u8_t
+topo_order(u32_t n)
+{
+	u8_t order = 0;
+
+	while ((1UL << order) < n) order++;
+
+	return order;
+}
+
+void
+topology_cpu_init(const cpuid_t cpu_id)
+{
+	struct topo_cpu *c = &topo_cpus[cpu_id];
+	u32_t            a, b, cx, d, max, lvl;
+	u32_t            i;
+
+	a = b = cx = d = 0;
+	topo_cpuid(&a, &b, &cx, &d);
+	max = a;
+
+	a = 1;
+	b = cx = d = 0;
+	topo_cpuid(&a, &b, &cx, &d);
+	c->apic_id = b >> 24;
+	/* Without leaf 0xB, the logical processors of the package (if HTT) are taken to be cores */
+	c->smt_shift = 0;
+	c->pkg_shift = (d & (1 << 28)) ? topo_order((b >> 16) & 0xFF) : 0;
+	for (i = 0; max >= 0xB; i++) {
+		a  = 0xB;
+		cx = i;
+		b = d = 0;
+		topo_cpuid(&a, &b, &cx, &d);
+		lvl = (cx >> 8) & 0xFF;
+		if (lvl == 0 || (b & 0xFFFF) == 0) break;
+		/* the x2APIC id */
+		c->apic_id = d;
+		if (lvl == 1) c->smt_shift = a & 0x1F;
+		if (lvl == 2) c->pkg_shift = a & 0x1F;
+	}
+
+	/* Unless leaf 4 (Intel only) describes them, the L2 is the core's, and the L3 the package's */
+	c->l2_shift = c->smt_shift;
+	c->l3_shift = c->pkg_shift;
+	for (i = 0; max >= 4; i++) {
+		a  = 4;
+		cx = i;
+		b = d = 0;
+		topo_cpuid(&a, &b, &cx, &d);
+		if ((a & 0x1F) == 0) break;
+		lvl = (a >> 5) & 0x7;
+		if (lvl == 2) c->l2_shift = topo_order(((a >> 14) & 0xFFF) + 1);
+		if (lvl == 3) c->l3_shift = topo_order(((a >> 14) & 0xFFF) + 1);
+	}
+}
+
+static inline int
+topo_same(struct topo_cpu *c, struct topo_cpu *o, u8_t shift)
+{
+	return (c->apic_id >> shift) == (o->apic_id >> shift);
+}
+
+void
+topology_init(void)
+{
+	int i, j;
+
+	topo.ncpus  = ncpus;
+	topo.nnodes = numa_nnodes ? numa_nnodes : 1;
+	for (i = 0; i < ncpus; i++) {
+		struct topo_cpu         *c = &topo_cpus[i];
+		struct cos_topology_cpu *t = &topo.cpus[i];
+
+		t->apic_id = c->apic_id;
+		t->node    = numa_cpu_nodes[i];
+		t->pkg = t->core = t->l2 = t->l3 = i;
+		t->smt = 0;
+		/* The id of each group is the lowest cpuid in it */
+		for (j = i - 1; j >= 0; j--) {
+			struct topo_cpu *o = &topo_cpus[j];
+
+			if (topo_same(c, o, c->pkg_shift)) t->pkg = j;
+			if (topo_same(c, o, c->l3_shift)) t->l3 = j;
+			if (topo_same(c, o, c->l2_shift)) t->l2 = j;
+			if (topo_same(c, o, c->smt_shift)) {
+				t->core = j;
+				t->smt++;
+			}
+		}
+		printk("\tTopology: core %d (apic %d): package %d, physical core %d (thread %d), L2 %d, L3 %d, node %d\n",
+		       i, t->apic_id, t->pkg, t->core, t->smt, t->l2, t->l3, t->node);
+	}
+	memcpy(topo.distance, numa_distance, sizeof(topo.distance));
+}
+
+struct cos_topology *
+chal_topology(void)
+{
+	return &topo;
+}
+
 /*
  * Thanks to kaworu @ https://forum.osdev.org/viewtopic.php?t=16990
  * for shutdown code. For this structures layout, see 5.2.9 Fixed ACPI
@@ -341,6 +723,7 @@ acpi_init(void)
 	u32_t page;
 	void *timer;
 	void *apic;
+	void *dmar;
 	int lapic_err = 1;
 	void *hpet = NULL;
 	unsigned long j = kernel_mapped_offset;
@@ -373,8 +756,16 @@ acpi_init(void)
 		lapic_err = lapic_find_localaddr(apic);
 	}
 	assert(!lapic_err);
+	/* after the MADT walk, so that we know the apicid of each core */
+	acpi_numa_init();
+	acpi_slit_init();
 
 	acpi_shutdown_init();
 
+	dmar = acpi_find_dmar();
+	if (dmar) {
+		iommu_init(dmar);
+	}
+
 	return;
 }
@@ -0,0 +1,9 @@
+#include "thd.h"
+
+PERCPU_VAR(pmu_loaded);
+PERCPU_VAR(pmu_sample_period);
+int pmu_ngp;
+#if defined(PMU_ENABLED) && defined(__x86_64__)
+u32_t pmu_ctr_msr;
+int   pmu_sample_ctr;
+#endif
@@ -0,0 +1,98 @@
+#include "kernel.h"
+#include "chal/shared/cos_io.h"
+
+/*
+ * The CMOS real-time clock, read once at boot for the wall-clock time
+ * (see clock_realtime).  Its registers are read through an index
+ * port, and the time is in BCD unless status register B says
+ * otherwise.
+ */
+
+#define RTC_INDEX  0x70
+#define RTC_DATA   0x71
+#define RTC_NMI_DISABLE 0x80
+
+enum rtc_regs
+{
+	RTC_SEC    = 0x00,
+	RTC_MIN    = 0x02,
+	RTC_HOUR   = 0x04,
+	RTC_DAY    = 0x07,
+	RTC_MONTH  = 0x08,
+	RTC_YEAR   = 0x09,
+	RTC_STAT_A = 0x0A,
+	RTC_STAT_B = 0x0B,
+};
+
+#define RTC_A_UPDATING 0x80 /* the registers are being updated */
+#define RTC_B_24H      0x02
+#define RTC_B_BINARY   0x04
+#define RTC_HOUR_PM    0x80
+
+static u8_t
+rtc_reg(u8_t reg)
+{
+	outb(RTC_INDEX, RTC_NMI_DISABLE | reg);
+
+	return inb(RTC_DATA);
+}
+
+static u32_t
+rtc_bcd(u8_t v)
+{
+	return (v & 0xF) + (v >> 4) * 10;
+}
+
+/* The days from 1970-01-01 to the date (in the proleptic Gregorian calendar) */
+static u64_t
+rtc_days(u32_t year, u32_t month, u32_t day)
+{
+	u32_t era, yoe, doy, doe;
+
+	if (month <= 2) year--;
+	era = year / 400;
+	yoe = year - era * 400;
+	doy = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+	doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+
+	return (u64_t)era * 146097 + doe - 719468;
+}
+
+/*
+ * The seconds since the epoch, and the TSC when they were read.  The
+ * registers are read outside of an update, and again if the time
+ * changed meanwhile.  The RTC keeps the local time, taken to be UTC.
+ */
+u64_t
+rtc_epoch(cycles_t *stamp)
+{
+	u8_t  sec, min, hour, day, month, year, b;
+	u32_t h;
+
+	do {
+		while (rtc_reg(RTC_STAT_A) & RTC_A_UPDATING)
+			;
+		*stamp = tsc();
+		sec   = rtc_reg(RTC_SEC);
+		min   = rtc_reg(RTC_MIN);
+		hour  = rtc_reg(RTC_HOUR);
+		day   = rtc_reg(RTC_DAY);
+		month = rtc_reg(RTC_MONTH);
+		year  = rtc_reg(RTC_YEAR);
+	} while (sec != rtc_reg(RTC_SEC) || min != rtc_reg(RTC_MIN) || hour != rtc_reg(RTC_HOUR));
+
+	b = rtc_reg(RTC_STAT_B);
+	h = hour & ~RTC_HOUR_PM;
+	if (!(b & RTC_B_BINARY)) {
+		sec   = rtc_bcd(sec);
+		min   = rtc_bcd(min);
+		h     = rtc_bcd(h);
+		day   = rtc_bcd(day);
+		month = rtc_bcd(month);
+		year  = rtc_bcd(year);
+	}
+	/* 12-hour clocks count 12, 1, ..., 11 */
+	if (!(b & RTC_B_24H)) h = (h % 12) + ((hour & RTC_HOUR_PM) ? 12 : 0);
+
+	return (rtc_days(2000 + year, month, day) * 24 + h) * 3600 + (u64_t)min * 60 + sec;
+}
@@ -0,0 +1 @@
+../i386/iommu.c
\ No newline at end of file
@@ -0,0 +1 @@
+../i386/pmu.c
\ No newline at end of file
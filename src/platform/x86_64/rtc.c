@@ -0,0 +1 @@
+../i386/rtc.c
\ No newline at end of file
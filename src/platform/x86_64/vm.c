@@ -12,7 +12,8 @@
 #define LARGE_BSS __attribute__((section(".largebss,\"aw\",@nobits#")))
 
 struct tlb_quiescence tlb_quiescence[NUM_CPU] CACHE_ALIGNED LARGE_BSS;
-struct liveness_entry __liveness_tbl[LTBL_ENTS] CACHE_ALIGNED LARGE_BSS;
+u64_t __liveness_epochs[LTBL_ENTS] CACHE_ALIGNED LARGE_BSS;
+u64_t __liveness_deact_ts[LTBL_ENTS] CACHE_ALIGNED LARGE_BSS;
 
 #define KERN_INIT_PGD_IDX ((COS_MEM_KERN_START_VA & COS_MEM_KERN_HIGH_ADDR_VA_PGD_MASK) >> PGD_SHIFT)
 u64_t boot_comp_pgd[PAGE_SIZE / sizeof(u64_t)] PAGE_ALIGNED = {0};
@@ -19,3 +19,6 @@ struct cap_vm_vmcb;
 void vm_env_init(void);
 void vm_thd_init(struct thread *thd, void *vm_pgd, struct cap_vm_vmcb *vmcb);
 void vm_thd_exec(struct thread *thd);
+void vm_vcpu_notify(int cpu);
+/* No vcpu uses the EPT translations cached before the call (CAPTBL_OP_EPT_DIRTY) */
+void vm_ept_flush(void);
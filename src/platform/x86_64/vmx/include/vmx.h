@@ -110,6 +110,11 @@
 #define PRIMARY_VM_EXIT_CONTROLS		0x0000400C
 #define VM_ENTRY_CONTROLS			0x00004012
 #define VM_ENTRY_INTERRUPTION_INFORMATION_FIELD	0x00004016
+#define POSTED_INTR_NOTIFICATION_VECTOR		0x00000002
+#define POSTED_INTR_DESC_ADDR			0x00002016
+#define PLE_GAP					0x00004020
+#define PLE_WINDOW				0x00004022
+#define VMX_PREEMPTION_TIMER_VALUE		0x0000482E
 
 #define EXIT_REASON				0x00004402
 #define EXIT_INSTRUCTION_LENGTH			0x0000440C
@@ -123,6 +128,8 @@
 #define VAPIC_ACCESS_ADDRESS			0x00002012
 
 #define EXTERNAL_INTERRUPT_EXITING		BIT(0)
+#define ACTIVATE_PREEMPTION_TIMER		BIT(6)
+#define PROCESS_POSTED_INTERRUPTS		BIT(7)
 
 #define HLT_EXITING				BIT(7)
 #define INVLPG_EXITING				BIT(9)
@@ -147,6 +154,14 @@
 #define ENABLE_XSAVES_XRSTORS			BIT(20)
 #define ENABLE_USER_WAIT_AND_PAUSE		BIT(26)
 
+/* Pause-loop exiting, in TSC cycles (the defaults of KVM) */
+#define VMX_PLE_GAP				128
+#define VMX_PLE_WINDOW				4096
+
+/* The VMX-preemption timer is 32 bits, its rate is the TSC's shifted by IA32_VMX_MISC[4:0] */
+#define VMX_PREEMPTION_TIMER_MAX		0xFFFFFFFFULL
+#define VMX_PREEMPTION_TIMER_RATE_MASK		0x1F
+
 #define HOST_ADDRESS_SPACE_SIZE			BIT(9)
 #define ACKNOWLEDGE_INTERRUPT_ON_EXIT		BIT(15)
 #define EXIT_SAVE_IA32_PAT			BIT(18)
@@ -178,6 +193,19 @@ vmwrite(u32_t encoding, u64_t value)
 	__asm__ volatile ("vmwrite %%rax, %%rdx ": :"a" (value), "d"(encoding): "cc");
 }
 
+#define INVEPT_ALL_CONTEXT			2
+
+/* Invalidate the EPT translations cached by this core, for all of the EPTPs */
+static inline void
+invept_all(void)
+{
+	struct {
+		u64_t eptp, rsvd;
+	} desc = { 0, 0 };
+
+	__asm__ volatile ("invept (%%rax), %%rdx" : : "a"(&desc), "d"((u64_t)INVEPT_ALL_CONTEXT) : "memory", "cc");
+}
+
 static inline u32_t
 vmx_get_revision_id(void)
 {
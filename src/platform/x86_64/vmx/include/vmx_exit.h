@@ -5,4 +5,6 @@ struct thread;
 
 void vmx_exit_handler_asm(void);
 void vmx_resume(struct thread *thd);
+void vmx_launch_restored(struct thread *thd);
+void vmx_timer_arm(struct vm_vcpu_shared_region *shared_region);
 void vmx_exit_handler(struct vm_vcpu_shared_region *regs);
@@ -20,6 +20,13 @@
 #define IA32_VMX_TRUE_ENTRY_CTLS	0x00000490
 #define IA32_VMX_PROCBASED_CTLS3	0x00000492
 
+/* IA32_VMX_EPT_VPID_CAP bits */
+#define VMX_EPT_2MB_PAGE		(1ULL << 16)
+#define VMX_EPT_1GB_PAGE		(1ULL << 17)
+#define VMX_EPT_INVEPT			(1ULL << 20)
+#define VMX_EPT_AD_FLAGS		(1ULL << 21)
+#define VMX_EPT_INVEPT_ALL		(1ULL << 26)
+
 #define IA32_PAT			0x00000277
 #define IA32_FS_BASE			0xC0000100
 #define IA32_GS_BASE			0xC0000101
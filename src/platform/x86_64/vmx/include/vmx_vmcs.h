@@ -80,6 +80,10 @@ void vmx_thd_init(struct thread *thd, void *vm_pgd, struct cap_vm_vmcb *vmcb);
 void vmx_host_state_init(void);
 void vmx_guest_state_init(void);
 void vmx_thd_start_or_resume(struct thread *thd);
+void vmx_vcpu_notify(int cpu);
+void vmx_ept_flush(void);
+void vmx_ept_enter(void);
+void vmx_ept_exit(void);
 
 #else
 	struct vmx_vmcs {};
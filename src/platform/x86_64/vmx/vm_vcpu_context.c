@@ -24,10 +24,24 @@ vm_thd_exec(struct thread *thd)
 	vmx_thd_start_or_resume(thd);
 }
 
+void
+vm_vcpu_notify(int cpu)
+{
+	vmx_vcpu_notify(cpu);
+}
+
+void
+vm_ept_flush(void)
+{
+	vmx_ept_flush();
+}
+
 #else
 
 void vm_env_init(void) {}
 void vm_thd_init(struct thread *thd, void *vm_pgd, struct cap_vm_vmcb *vmcb) {}
 void vm_thd_exec(struct thread *thd) {}
+void vm_vcpu_notify(int cpu) {}
+void vm_ept_flush(void) {}
 
 #endif
\ No newline at end of file
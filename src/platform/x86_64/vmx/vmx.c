@@ -11,6 +11,7 @@
 #include <vmx_vmcs.h>
 
 extern u64_t get_idt_base(void);
+extern void lapic_vm_posted_ipi_send(const cpuid_t cpu_id);
 extern u64_t get_tss_base(cpuid_t cpu_id);
 
 static inline u64_t get_fs_base(void) { return msr_get(IA32_FS_BASE); }
@@ -22,6 +23,7 @@ u64_t cr4_fixed1_bits = 0;
 u64_t cr4_fixed0_bits = 0;
 u64_t cr0_fixed1_bits = 0;
 u64_t cr0_fixed0_bits = 0;
+u32_t vmx_preemption_timer_shift = 0;
 
 /* Note: this page is just used for enabling cpu vm capability, it doesn't relate to vcpu VMCS pages */
 static char vm_env_page[PAGE_SIZE_4K] __attribute__((aligned(PAGE_SIZE_4K)));
@@ -30,6 +32,12 @@ void
 vmx_env_init(void)
 {
 	assert(sizeof(struct vm_vcpu_shared_region) < PAGE_SIZE_4K);
+	/* Guest memory is mapped with 2MB EPT entries where it is aligned */
+	assert(msr_get(IA32_VMX_EPT_VPID_CAP) & VMX_EPT_2MB_PAGE);
+	/* The EPTP enables the accessed and dirty flags, that the dirty-page tracking flushes with INVEPT */
+	assert(msr_get(IA32_VMX_EPT_VPID_CAP) & VMX_EPT_AD_FLAGS);
+	assert((msr_get(IA32_VMX_EPT_VPID_CAP) & (VMX_EPT_INVEPT | VMX_EPT_INVEPT_ALL)) == (VMX_EPT_INVEPT | VMX_EPT_INVEPT_ALL));
+	vmx_preemption_timer_shift = msr_get(IA32_VMX_MISC) & VMX_PREEMPTION_TIMER_RATE_MASK;
 	memset(&vm_env_page, 0, PAGE_SIZE_4K);
 	vmx_on(&vm_env_page);
 }
@@ -188,7 +196,8 @@ vmx_pinbased_ctl_init(void)
 {
 	u32_t pinbased_execution_ctl = 0;
 
-	pinbased_execution_ctl |= EXTERNAL_INTERRUPT_EXITING ;
+	/* The preemption timer exits the vcpu at its timer deadline, rather than at the next host tick */
+	pinbased_execution_ctl |= EXTERNAL_INTERRUPT_EXITING | PROCESS_POSTED_INTERRUPTS | ACTIVATE_PREEMPTION_TIMER;
 	pinbased_execution_ctl = fix_reserved_ctrl_bits(IA32_VMX_PINBASED_CTLS, pinbased_execution_ctl);
 	vmwrite(PIN_BASED_VM_EXECUTION_CONTROLS, pinbased_execution_ctl);
 }
@@ -199,9 +208,17 @@ vmx_procbased_ctl_init(void)
 	u32_t primary_procbased_ctls = 0;
 	u32_t second_procbased_ctls = 0;
 
-	primary_procbased_ctls =  MWAIT_EXITING | RDPMC_EXITING | USE_TPR_SHADOW 
+	/*
+	 * HLT exits, thus an idle vcpu blocks in the VMM instead of
+	 * holding its core. PAUSE only exits in spin loops (pause-loop
+	 * exiting below), not on each PAUSE. RDTSC(P) doesn't exit, and
+	 * without offsetting the guest reads the host's TSC, the same on
+	 * all of the cores: the timer deadlines and the paravirtual clock
+	 * are in host cycles.
+	 */
+	primary_procbased_ctls =  HLT_EXITING | MWAIT_EXITING | RDPMC_EXITING | USE_TPR_SHADOW 
 				| UNCONDITIONAL_IO_EXITING | USE_MSR_BITMAPS
-				| PAUSE_EXITING | ACTIVATE_SECONDARY_CONTROLS;
+				| ACTIVATE_SECONDARY_CONTROLS;
 	primary_procbased_ctls = fix_reserved_ctrl_bits(IA32_VMX_TRUE_PROCBASED_CTLS, primary_procbased_ctls);
 	vmwrite(PRI_PROC_BASED_VM_EXECUTION_CONTROLS, primary_procbased_ctls);
 
@@ -212,6 +229,10 @@ vmx_procbased_ctl_init(void)
 				| ENABLE_USER_WAIT_AND_PAUSE;
 	second_procbased_ctls = fix_reserved_ctrl_bits(IA32_VMX_PROCBASED_CTLS2, second_procbased_ctls);
 	vmwrite(SEC_PROC_BASED_VM_EXECUTION_CONTROLS, second_procbased_ctls);
+
+	/* A loop of PAUSEs at most PLE_GAP cycles apart exits once it spins longer than PLE_WINDOW cycles */
+	vmwrite(PLE_GAP, VMX_PLE_GAP);
+	vmwrite(PLE_WINDOW, VMX_PLE_WINDOW);
 }
 
 void
@@ -299,6 +320,10 @@ vmx_thd_state_init(struct thread *thd)
 	/* Will never change the microcode later */
 	shared_region->microcode_version = get_microcode();
 
+	/* Interrupts posted by the VMM are delivered without an exit while the vcpu runs */
+	vmwrite(POSTED_INTR_NOTIFICATION_VECTOR, HW_LAPIC_VM_POSTED);
+	vmwrite(POSTED_INTR_DESC_ADDR, chal_va2pa(&shared_region->pi_desc));
+
 	thd->vcpu_ctx.vmcs.host_tsc_aux = msr_get(IA32_TSC_AUX);
 	thd->vcpu_ctx.vmcs.host_star = msr_get(IA32_STAR);
 	thd->vcpu_ctx.vmcs.host_lstar = msr_get(IA32_LSTAR);
@@ -372,6 +397,7 @@ vmx_launch(void)
 	u8_t cf, zf;
 
 	VMX_DEBUG("VMLAUNCH!\n");
+	vmx_ept_enter();
 	__asm__ volatile("vmlaunch; pushfq; popq %0;" :"=m"(flag)::"memory", "cc");
 
 	cf = !!(flag & _CARRY);
@@ -384,10 +410,88 @@ vmx_launch(void)
 	assert(0);
 }
 
+void
+vmx_vcpu_notify(int cpu)
+{
+	/*
+	 * The vcpu runs on the same core as its handler thread. If
+	 * that is this core, the vcpu isn't running, and its next
+	 * entry picks up the posted interrupts.
+	 */
+	if (cpu == get_cpuid()) return;
+	lapic_vm_posted_ipi_send(cpu);
+}
+
+/*
+ * The dirty bits the EPT dirty-page tracking clears (CAPTBL_OP_EPT_DIRTY)
+ * are not set again by the writes through the translations a core
+ * cached with the bit set.  Each collection thus starts a new EPT
+ * generation, and the cores flush the translations they cached before
+ * their next vcpu entry in it.
+ */
+static int vmx_ept_gen;
+
+struct vmx_ept_core {
+	/* The generation of the last flush of the core */
+	int flushed;
+	/* A vcpu runs on the core, and might use stale translations */
+	int in_guest;
+} CACHE_ALIGNED;
+
+static struct vmx_ept_core vmx_ept_cores[NUM_CPU];
+
+void
+vmx_ept_enter(void)
+{
+	struct vmx_ept_core *c = &vmx_ept_cores[get_cpuid()];
+	int                  gen;
+
+	/* Ordered with the increment of the generation in vmx_ept_flush */
+	c->in_guest = 1;
+	cos_mem_fence();
+	gen = *(volatile int *)&vmx_ept_gen;
+	if (unlikely(c->flushed != gen)) {
+		invept_all();
+		c->flushed = gen;
+	}
+}
+
+void
+vmx_ept_exit(void)
+{
+	vmx_ept_cores[get_cpuid()].in_guest = 0;
+}
+
+/*
+ * Start a new EPT generation, and wait for the vcpus running on the
+ * other cores to leave the guest (the IPI forces an exit) or to flush,
+ * so that no write misses the dirty bits once this returns.  The
+ * other cores flush on their next entry.
+ */
+void
+vmx_ept_flush(void)
+{
+	struct vmx_ept_core *c;
+	int                  gen, cpu, self = get_cpuid();
+
+	gen = cos_faa(&vmx_ept_gen, 1) + 1;
+	for (cpu = 0; cpu < NUM_CPU; cpu++) {
+		if (cpu != self && *(volatile int *)&vmx_ept_cores[cpu].in_guest) chal_send_ipi(cpu);
+	}
+	for (cpu = 0; cpu < NUM_CPU; cpu++) {
+		if (cpu == self) continue;
+		c = &vmx_ept_cores[cpu];
+		while (*(volatile int *)&c->in_guest && *(volatile int *)&c->flushed - gen < 0) {
+			__asm__ volatile("pause" : : : "memory");
+		}
+	}
+}
+
 void
 vmx_thd_start_or_resume(struct thread *thd)
 {
 	struct vmx_vmcs *vmcs = get_vmcs(&thd->vcpu_ctx);
+	struct vm_vcpu_shared_region *shared_region = thd->vm_vcpu_shared_region;
 
 	assert(thd->thd_type == THD_TYPE_VM);
 	
@@ -406,7 +510,10 @@ vmx_thd_start_or_resume(struct thread *thd)
 	vmx_thd_state_init(thd);
 
 	thd->vcpu_ctx.state = VM_THD_STATE_RUNNING;
+	vmx_timer_arm(shared_region);
 
 	VMX_DEBUG("VMCS initialization done, begin to run the VM thread\n");
+	/* A vcpu restored from a snapshot starts in its saved state, rather than at the BIOS */
+	if (shared_region->state.op == VM_STATE_OP_LOAD) vmx_launch_restored(thd);
 	vmx_launch();
 }
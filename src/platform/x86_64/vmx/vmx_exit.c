@@ -26,18 +26,177 @@ extern u64_t cr4_fixed1_bits;
 extern u64_t cr4_fixed0_bits;
 extern u64_t cr0_fixed1_bits;
 extern u64_t cr0_fixed0_bits;
+extern u32_t vmx_preemption_timer_shift;
 
+#define VAPIC_IRR 0x200
+
+/*
+ * Move the interrupts posted while the vcpu wasn't running into the
+ * IRR of its virtual lapic, and raise the requesting vector (RVI) so
+ * that the entry delivers them. Posts while the vcpu runs are
+ * processed by the hardware on the notification vector.
+ */
+static inline void
+vmx_posted_intr_sync(struct thread *thd, struct vm_vcpu_shared_region *shared_region)
+{
+	struct vm_pi_desc *pi = &shared_region->pi_desc;
+	u8_t *irr = (u8_t *)thd->vcpu_ctx.vmcs.vapic + VAPIC_IRR;
+	u8_t rvi = (u8_t)shared_region->interrupt_status;
+	int i;
+
+	if (likely(!(__atomic_load_n(&pi->control, __ATOMIC_ACQUIRE) & VM_PI_DESC_ON))) return;
+	__atomic_fetch_and(&pi->control, ~VM_PI_DESC_ON, __ATOMIC_SEQ_CST);
+
+	for (i = 0; i < 8; i++) {
+		u32_t pir = __atomic_exchange_n(&pi->pir[i], 0, __ATOMIC_SEQ_CST);
+		u8_t  vec;
+
+		if (!pir) continue;
+		/* The lapic's registers are 32 bits, on 16 byte strides */
+		*(volatile u32_t *)(irr + i * 16) |= pir;
+		vec = i * 32 + 31 - __builtin_clz(pir);
+		if (vec > rvi) rvi = vec;
+	}
+	shared_region->interrupt_status = (shared_region->interrupt_status & 0xff00) | rvi;
+}
+
+/* The segment registers' fields are in the same order in each group of the VMCS */
+#define VMX_SEG_FIELD(field, seg) ((field) + 2 * (seg))
+
+static void
+vmx_state_save(struct thread *thd, struct vm_vcpu_state *state)
+{
+	int i;
+
+	for (i = 0; i < VM_SEG_MAX; i++) {
+		struct vm_seg_state *seg = &state->seg[i];
+
+		seg->sel   = vmread(VMX_SEG_FIELD(GUEST_ES, i));
+		seg->base  = vmread(VMX_SEG_FIELD(GUEST_ES_BASE, i));
+		seg->limit = vmread(VMX_SEG_FIELD(GUEST_ES_LIMIT, i));
+		seg->ar    = vmread(VMX_SEG_FIELD(GUEST_ES_ACCESS_RIGHTS, i));
+	}
+	state->gdtr_base        = vmread(GUEST_GDTR_BASE);
+	state->gdtr_limit       = vmread(GUEST_GDTR_LIMIT);
+	state->idtr_base        = vmread(GUEST_IDTR_BASE);
+	state->idtr_limit       = vmread(GUEST_IDTR_LIMIT);
+	state->cr3              = vmread(GUEST_CR3);
+	state->cr0_shadow       = vmread(CR0_READ_SHADOW);
+	state->cr4_shadow       = vmread(CR4_READ_SHADOW);
+	state->rflags           = vmread(GUEST_RFLAG);
+	state->dr7              = vmread(GUEST_DR7);
+	state->pat              = vmread(GUEST_IA32_PAT);
+	state->sysenter_cs      = vmread(GUEST_IA32_SYSENTER_CS);
+	state->sysenter_esp     = vmread(GUEST_IA32_SYSENTER_ESP);
+	state->sysenter_eip     = vmread(GUEST_IA32_SYSENTER_EIP);
+	state->interruptibility = vmread(GUEST_INTERRUPTIBILITY_STATE);
+	state->activity         = vmread(GUEST_ACTIVITY_STATE);
+
+	state->gs_base          = thd->vcpu_ctx.vmcs.guest_msr_gs_base;
+	state->kernel_gs_base   = thd->vcpu_ctx.vmcs.guest_msr_gskernel_base;
+	state->tsc_aux          = thd->vcpu_ctx.vmcs.guest_tsc_aux;
+	state->star             = thd->vcpu_ctx.vmcs.guest_star;
+	state->lstar            = thd->vcpu_ctx.vmcs.guest_lstar;
+	state->cstar            = thd->vcpu_ctx.vmcs.guest_cstar;
+	state->fmask            = thd->vcpu_ctx.vmcs.guest_fmask;
+}
+
+static void
+vmx_state_load(struct thread *thd, struct vm_vcpu_state *state)
+{
+	int i;
+
+	for (i = 0; i < VM_SEG_MAX; i++) {
+		struct vm_seg_state *seg = &state->seg[i];
+
+		vmwrite(VMX_SEG_FIELD(GUEST_ES, i), seg->sel);
+		vmwrite(VMX_SEG_FIELD(GUEST_ES_BASE, i), seg->base);
+		vmwrite(VMX_SEG_FIELD(GUEST_ES_LIMIT, i), seg->limit);
+		vmwrite(VMX_SEG_FIELD(GUEST_ES_ACCESS_RIGHTS, i), seg->ar);
+	}
+	vmwrite(GUEST_GDTR_BASE, state->gdtr_base);
+	vmwrite(GUEST_GDTR_LIMIT, state->gdtr_limit);
+	vmwrite(GUEST_IDTR_BASE, state->idtr_base);
+	vmwrite(GUEST_IDTR_LIMIT, state->idtr_limit);
+	vmwrite(GUEST_CR3, state->cr3);
+	vmwrite(CR0_READ_SHADOW, state->cr0_shadow);
+	vmwrite(CR4_READ_SHADOW, state->cr4_shadow);
+	vmwrite(GUEST_RFLAG, state->rflags);
+	vmwrite(GUEST_DR7, state->dr7);
+	vmwrite(GUEST_IA32_PAT, state->pat);
+	vmwrite(GUEST_IA32_SYSENTER_CS, state->sysenter_cs);
+	vmwrite(GUEST_IA32_SYSENTER_ESP, state->sysenter_esp);
+	vmwrite(GUEST_IA32_SYSENTER_EIP, state->sysenter_eip);
+	vmwrite(GUEST_INTERRUPTIBILITY_STATE, state->interruptibility);
+	vmwrite(GUEST_ACTIVITY_STATE, state->activity);
+
+	thd->vcpu_ctx.vmcs.guest_msr_gs_base       = state->gs_base;
+	thd->vcpu_ctx.vmcs.guest_msr_gskernel_base = state->kernel_gs_base;
+	thd->vcpu_ctx.vmcs.guest_tsc_aux           = state->tsc_aux;
+	thd->vcpu_ctx.vmcs.guest_star              = state->star;
+	thd->vcpu_ctx.vmcs.guest_lstar             = state->lstar;
+	thd->vcpu_ctx.vmcs.guest_cstar             = state->cstar;
+	thd->vcpu_ctx.vmcs.guest_fmask             = state->fmask;
+}
+
+/*
+ * Exit the vcpu at its timer deadline with the preemption timer. Past
+ * the timer's range, it exits early and is re-armed (vmx_fastexit).
+ */
 void
-vmx_resume(struct thread *thd)
+vmx_timer_arm(struct vm_vcpu_shared_region *shared_region)
+{
+	u64_t now, deadline = shared_region->timer_deadline, ticks = VMX_PREEMPTION_TIMER_MAX;
+
+	rdtscll(now);
+	if (deadline != ~0ULL) {
+		ticks = deadline > now ? (deadline - now) >> vmx_preemption_timer_shift : 0;
+		if (ticks > VMX_PREEMPTION_TIMER_MAX) ticks = VMX_PREEMPTION_TIMER_MAX;
+	}
+	vmwrite(VMX_PREEMPTION_TIMER_VALUE, ticks);
+}
+
+/* Load the GPs of the vcpu from the shared region, and enter it */
+#define VMX_ENTER(shared_region, insn)			\
+	__asm__ __volatile__(				\
+				"movq %%rax, %%rsp\n\t"	\
+				"popq %%rax\n\t"		\
+				"movq %%rax, %%cr2\n\t"	\
+				"popq %%r15\n\t"		\
+				"popq %%r14\n\t"		\
+				"popq %%r13\n\t"		\
+				"popq %%r12\n\t"		\
+				"popq %%r11\n\t"		\
+				"popq %%r10\n\t"		\
+				"popq %%r9\n\t"		\
+				"popq %%r8\n\t"		\
+				"popq %%rbx\n\t"		\
+				"popq %%rcx\n\t"		\
+				"popq %%rdx\n\t"		\
+				"popq %%rsi\n\t"		\
+				"popq %%rdi\n\t"		\
+				"popq %%rbp\n\t"		\
+				"popq %%rax\n\t"		\
+				insn "\n\t"			\
+				: 					\
+				: "a"(shared_region)			\
+				:)
+
+static void
+vmx_enter(struct thread *thd, int launch)
 {
 	struct vm_vcpu_shared_region *shared_region;
 	u64_t val;
 
-	if (unlikely(thd->vcpu_ctx.state == VM_THD_STATE_STOPPED)) return;
-	vmx_assert(thd->vcpu_ctx.state == VM_THD_STATE_RUNNING);
-
 	shared_region = thd->vm_vcpu_shared_region;
 
+	/* Snapshot or restore the vcpu, as requested by the VMM */
+	if (unlikely(shared_region->state.op)) {
+		if (shared_region->state.op == VM_STATE_OP_SAVE) vmx_state_save(thd, &shared_region->state);
+		else                                             vmx_state_load(thd, &shared_region->state);
+		shared_region->state.op = 0;
+	}
+
 	/* User level VMM is responsible to set vcpu's state like ip and sp, or a VM-exit will happen, the kernel should be safe */
 	vmwrite(GUEST_RIP, shared_region->ip);
 	vmwrite(GUEST_RSP, shared_region->sp);
@@ -61,6 +220,9 @@ vmx_resume(struct thread *thd)
 		vmwrite(VM_ENTRY_CONTROLS, vm_entry_ctls);
 	}
 
+	vmx_posted_intr_sync(thd, shared_region);
+	vmx_timer_arm(shared_region);
+
 	/* Used for VMM manages virtual lapic interrupts */
 	if (shared_region->interrupt_status) {
 		vmwrite(GUEST_INTERRUPT_STATUS, shared_region->interrupt_status);
@@ -83,35 +245,35 @@ vmx_resume(struct thread *thd)
 	msr_set(IA32_CSTAR, thd->vcpu_ctx.vmcs.guest_cstar);
 	msr_set(IA32_FMASK, thd->vcpu_ctx.vmcs.guest_fmask);
 
+	/* Flush the EPT translations cached before a dirty-page collection */
+	vmx_ept_enter();
+
 	/* Restore GPs for vcpu */
-	__asm__ __volatile__(
-				"movq %%rax, %%rsp\n\t"		\
-				"popq %%rax\n\t"		\
-				"movq %%rax, %%cr2\n\t"		\
-				"popq %%r15\n\t"		\
-				"popq %%r14\n\t"		\
-				"popq %%r13\n\t"		\
-				"popq %%r12\n\t"		\
-				"popq %%r11\n\t"		\
-				"popq %%r10\n\t"		\
-				"popq %%r9\n\t"			\
-				"popq %%r8\n\t"			\
-				"popq %%rbx\n\t"		\
-				"popq %%rcx\n\t"		\
-				"popq %%rdx\n\t"		\
-				"popq %%rsi\n\t"		\
-				"popq %%rdi\n\t"		\
-				"popq %%rbp\n\t"		\
-				"popq %%rax\n\t"		\
-				"vmresume\n\t"			\
-				: 
-				: "a"(shared_region)
-				:);
+	if (launch) VMX_ENTER(shared_region, "vmlaunch");
+	else        VMX_ENTER(shared_region, "vmresume");
 
 	/* TODO: what if somehow vmresume fails? */
 	vmx_assert(0);
 }
 
+void
+vmx_resume(struct thread *thd)
+{
+	if (unlikely(thd->vcpu_ctx.state == VM_THD_STATE_STOPPED)) return;
+	vmx_assert(thd->vcpu_ctx.state == VM_THD_STATE_RUNNING);
+
+	vmx_enter(thd, 0);
+}
+
+/* The first entry of a vcpu restored from a snapshot, in its state and with its GPs */
+void
+vmx_launch_restored(struct thread *thd)
+{
+	vmx_assert(thd->vcpu_ctx.state == VM_THD_STATE_RUNNING);
+
+	vmx_enter(thd, 1);
+}
+
 static int 
 timer_process(struct pt_regs *regs, struct thread *thd_curr)
 {
@@ -122,11 +284,101 @@ timer_process(struct pt_regs *regs, struct thread *thd_curr)
 
 	cos_info = cos_cpu_local_info();
 	vmx_assert(cos_info);	
-	comp = &thd_curr->invstk[thd_curr->invstk_top].comp_info;
+	comp = &thd_invstk_entry(thd_curr, thd_curr->invstk_top)->comp_info;
 	vmx_assert(comp);
 	return expended_process(regs, thd_curr, comp, cos_info, 0);
 }
 
+static inline int
+fastexit_cpuid(struct vm_vcpu_shared_region *shared_region, struct vm_fastexit_tbl *tbl)
+{
+	u32_t leaf = (u32_t)shared_region->ax, subleaf = (u32_t)shared_region->cx;
+	u32_t i, n = tbl->ncpuid;
+
+	if (n > VM_FASTEXIT_CPUID_MAX) n = VM_FASTEXIT_CPUID_MAX;
+	for (i = 0; i < n; i++) {
+		struct vm_fastexit_cpuid *e = &tbl->cpuid[i];
+
+		if (e->leaf != leaf) continue;
+		if ((e->flags & VM_FASTEXIT_CPUID_SUBLEAF) && e->subleaf != subleaf) continue;
+
+		shared_region->ax = e->eax;
+		shared_region->bx = e->ebx;
+		shared_region->cx = e->ecx;
+		shared_region->dx = e->edx;
+
+		return 1;
+	}
+
+	return 0;
+}
+
+static inline int
+fastexit_msr(struct vm_vcpu_shared_region *shared_region, struct vm_fastexit_tbl *tbl, int write)
+{
+	u32_t msr = (u32_t)shared_region->cx;
+	u32_t i, n = tbl->nmsr;
+
+	if (n > VM_FASTEXIT_MSR_MAX) n = VM_FASTEXIT_MSR_MAX;
+	for (i = 0; i < n; i++) {
+		struct vm_fastexit_msr *e = &tbl->msr[i];
+
+		if (e->msr != msr) continue;
+		if (write) return (e->flags & VM_FASTEXIT_MSR_WR_IGNORE) != 0;
+		if (!(e->flags & VM_FASTEXIT_MSR_RD)) return 0;
+
+		shared_region->ax = (u32_t)e->val;
+		shared_region->dx = (u32_t)(e->val >> 32);
+
+		return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * Serve the exit from the VMM's fast-exit table. Returns 1 if the
+ * exit is handled, and the vcpu can resume at the next instruction
+ * with the state in the shared region, and 0 if it must be forwarded
+ * to the VMM.
+ */
+static int
+vmx_fastexit(struct vm_vcpu_shared_region *shared_region, u8_t reason_nr)
+{
+	struct vm_fastexit_tbl *tbl = &shared_region->fastexit;
+	int handled = 0;
+	u64_t now;
+
+	switch (reason_nr) {
+	case VM_EXIT_REASON_PREEMPTION_TIMER:
+		/* Short of the deadline, the timer was capped to its range: re-armed on the entry */
+		rdtscll(now);
+		return now < shared_region->timer_deadline;
+	case VM_EXIT_REASON_CPUID:
+		handled = fastexit_cpuid(shared_region, tbl);
+		break;
+	case VM_EXIT_REASON_RDMSR:
+		handled = fastexit_msr(shared_region, tbl, 0);
+		break;
+	case VM_EXIT_REASON_WRMSR:
+		handled = fastexit_msr(shared_region, tbl, 1);
+		break;
+	case VM_EXIT_REASON_PAUSE:
+		handled = (tbl->flags & VM_FASTEXIT_PAUSE) != 0;
+		break;
+	case VM_EXIT_REASON_XSETBV:
+		handled = (tbl->flags & VM_FASTEXIT_XSETBV) != 0;
+		break;
+	default:
+		break;
+	}
+	if (!handled) return 0;
+
+	shared_region->ip += shared_region->inst_length;
+
+	return 1;
+}
+
 void
 vmx_exit_handler(struct vm_vcpu_shared_region *regs)
 {
@@ -136,6 +388,10 @@ vmx_exit_handler(struct vm_vcpu_shared_region *regs)
 	struct cos_cpu_local_info *cos_info;
 	struct thread *thd_curr, *thd_exception_handler, *next;
 	struct vm_vcpu_shared_region *shared_region;
+	u64_t exit_tsc, resume_tsc;
+
+	rdtscll(exit_tsc);
+	vmx_ept_exit();
 	cos_info = cos_cpu_local_info();
 	thd_curr = thd_current(cos_info);
 
@@ -180,8 +436,9 @@ vmx_exit_handler(struct vm_vcpu_shared_region *regs)
 	vmx_assert(reason_nr < MAX_VM_EXIT_REASONS);
 	VMX_DEBUG("VM thd: %u on core: %u get VM-exit (reason: ) on handler: %u\n", thd_curr->tid, cos_info->cpuid, reason_nr, thd_exception_handler->tid);
 
-	/* Share GPs with VMM */
-	memcpy(shared_region, regs, sizeof(struct vm_vcpu_shared_region));
+	/* Share GPs with VMM: only those are on the stack, the rest of the region is the VMM's */
+	memcpy(shared_region, regs, __builtin_offsetof(struct vm_vcpu_shared_region, reason));
+	shared_region->exit_stats.exit_tsc = exit_tsc;
 
 	shared_region->reason = reason_nr;
 	shared_region->ip = vmread(GUEST_RIP);
@@ -200,6 +457,16 @@ vmx_exit_handler(struct vm_vcpu_shared_region *regs)
 	/* Save fs for vcpu, this will be restoed later in the thread switch path, thus safe */
 	thd_curr->tls = msr_get(IA32_FS_BASE);
 
+	/* Hot exits the VMM has precomputed resume the vcpu directly, without the two switches through its handler thread */
+	if (vmx_fastexit(shared_region, reason_nr)) {
+		shared_region->exit_stats.kernel[reason_nr]++;
+		rdtscll(resume_tsc);
+		shared_region->exit_stats.kernel_cycles[reason_nr] += resume_tsc - exit_tsc;
+		vmx_resume(thd_curr);
+		/* Should never come here */
+		vmx_assert(0);
+	}
+
 	/* TODO: different external interrupts should be handled by different host interrrut handlers, currently it only has timer interrupt */
 	if (reason_nr == VM_EXIT_REASON_EXTERNAL_INTERRUPT) {
 		lapic_ack();
@@ -6,7 +6,7 @@ import math
 import string
 
 if (len(sys.argv) < 4):
-    print "Usage: ./gen_cdf.py <file> <col> <incriment>"
+    print "Usage: ./gen_cdf.py <file> <col> <incriment> [<count col>]"
     sys.exit(1)
     
 f = open(sys.argv[1], 'r')
@@ -15,6 +15,11 @@ col = string.atoi(sys.argv[2])
 
 incr = string.atof(sys.argv[3])
 
+# histograms (e.g. perfdata's "H:" lines) give the count of each value
+count_col = 0
+if (len(sys.argv) > 4):
+    count_col = string.atoi(sys.argv[4])
+
 lines = f.readlines()
 
 times = []
@@ -22,7 +27,10 @@ times = []
 for line in lines:
     line = string.rstrip(line)
     data = re.split("\t", line)
-    times.append((float)(data[col-1]))
+    if count_col > 0:
+        times.append(((float)(data[col-1]), (float)(data[count_col-1])))
+    else:
+        times.append(((float)(data[col-1]), 1.0))
 
 # find the average
 sum = 0
@@ -34,7 +42,7 @@ times.sort();
 #print times
 
 first = 1
-for time in times:
+for time, n in times:
     if first == 1:
         min = time
         first = 0
@@ -48,13 +56,15 @@ for time in times:
 count = 0
 #step = 0.2
 step = incr
-how_many = len(times)
+how_many = math.fsum([n for time, n in times])
+idx = 0
 
-for val in range(0, ((max)*(1/step))+1):
+for val in range(0, int((max)*(1/step))+1):
     curr = min+float(val*step)
 
-    while count < len(times) and times[count] <= curr:
-        count = count + 1
+    while idx < len(times) and times[idx][0] <= curr:
+        count = count + times[idx][1]
+        idx = idx + 1
 
     percent = float(count)/float(how_many)
     
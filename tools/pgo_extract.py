@@ -0,0 +1,47 @@
+#!/usr/bin/python
+
+# Write the .gcda files of the profiles dumped by the components built
+# with `pgo = "generate"` (see src/components/lib/pgo/doc.md), from
+# the log of the serial line, as "pgo <compid> file|data|end" lines.
+#
+# Each .gcda is written to the path it was compiled for, in the
+# component's profile directory (system_binaries/cos_pgo/<name>/), so
+# that the component's `pgo = "use"` build finds it. Only complete
+# dumps are written, and a later dump of a component replaces the
+# earlier ones: to accumulate the profiles of several runs, extract
+# each into a copy of the directory, and merge them with
+# `gcov-tool merge`.
+
+import os
+import re
+import sys
+
+if (len(sys.argv) < 2):
+    print("Usage: ./pgo_extract.py <log>")
+    sys.exit(1)
+
+log = open(sys.argv[1], 'r', errors='replace').readlines()
+
+# The files of the dump in progress of each component
+dumps = {}
+done  = {}
+for line in log:
+    m = re.search(r"pgo (\d+) (file|data|end) ?(\S*)", line)
+    if not m:
+        continue
+    comp, kind, arg = m.groups()
+    files = dumps.setdefault(comp, [])
+    if kind == "file":
+        files.append((arg, bytearray()))
+    elif kind == "data" and files:
+        files[-1][1].extend(bytes.fromhex(arg))
+    elif kind == "end":
+        done[comp] = files
+        dumps[comp] = []
+
+for comp, files in sorted(done.items()):
+    for path, data in files:
+        os.makedirs(os.path.dirname(path), exist_ok=True)
+        with open(path, 'wb') as f:
+            f.write(data)
+    print("Component %s: %d profiles" % (comp, len(files)))
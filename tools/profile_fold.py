@@ -0,0 +1,78 @@
+#!/usr/bin/python
+
+# Fold the stacks sampled by the profiler component
+# (no_interface.profiler) into the "folded" format of flame graphs:
+# one "frame;frame;... count" line per stack, outermost frame first,
+# with each frame as component`function.
+#
+# The profiler prints the component ids of each frame's page-table
+# (several, if components share an address space) and its address.
+# The ids are named with the capmgr's "Creating component" lines in
+# the same log, and the addresses symbolized with the components'
+# objects in the composer's build directory.
+
+import re
+import sys
+import glob
+import subprocess
+
+if (len(sys.argv) < 3):
+    print("Usage: ./profile_fold.py <log> <composer build dir, e.g. system_binaries/cos_build-<system>>")
+    sys.exit(1)
+
+log      = open(sys.argv[1], 'r').readlines()
+builddir = sys.argv[2]
+
+names = {}
+for line in log:
+    m = re.search(r"Creating component (\S+): id (\d+)", line)
+    if m:
+        names[m.group(2)] = m.group(1)
+
+# The sorted (address, size, function) symbols of a component's object
+symtabs = {}
+def symbols(name):
+    if name in symtabs:
+        return symtabs[name]
+    syms  = []
+    # the object of component <name> is <scope>.<variant>/<source>.<name>
+    paths = glob.glob("%s/*/*.%s" % (builddir, name))
+    if paths:
+        out = subprocess.check_output(["nm", "-n", "-S", "-C", paths[0]]).decode()
+        for l in out.splitlines():
+            f = l.split(None, 3)
+            if len(f) == 4 and f[2] in "tTwW":
+                syms.append((int(f[0], 16), int(f[1], 16), f[3]))
+    symtabs[name] = syms
+    return syms
+
+def lookup(name, ip):
+    for addr, sz, fn in symbols(name):
+        if addr > ip:
+            break
+        if ip < addr + sz:
+            return fn
+    return None
+
+# The first of the frame's components with a function at the address
+def frame(f):
+    ids, ip = f.split("@")
+    ip      = int(ip, 16)
+    # the page-tables the profiler couldn't resolve are pgtbl<id>
+    cands   = [names.get(i, i if i.startswith("pgtbl") else "comp" + i) for i in ids.split("|")]
+    for c in cands:
+        fn = lookup(c, ip)
+        if fn:
+            return "%s`%s" % (c, fn)
+    return "%s`0x%x" % ("|".join(cands), ip)
+
+stacks = {}
+for line in log:
+    m = re.search(r"^\s*profile (\d+) (\d+) (\S+)", line)
+    if not m:
+        continue
+    s = ";".join([frame(f) for f in m.group(3).split(";")])
+    stacks[s] = stacks.get(s, 0) + int(m.group(2))
+
+for s in sorted(stacks):
+    print("%s %d" % (s, stacks[s]))
@@ -2,9 +2,36 @@
 
 if [ $# -lt 2 ]; then
   echo "Usage: $0 <.../cos.iso > <arch: [x86_64|i386]> [debug]"
+  echo "       $0 report <arch: [x86_64|i386]> [<report file>]"
   exit 1
 fi 
 
+# The compositions of the micro-benchmarks (lib/ubench) in the report
+ubench_compositions="bench_lock bench_sem bench_sched_yield bench_syncipc bench_sync_chan bench_tmr bench_xcore_matrix"
+# The seconds each of them can take
+ubench_timeout=${UBENCH_TIMEOUT:-300}
+# The times each of them is run, for tools/ubench_compare.py to take
+# the median of the runs
+ubench_runs=${UBENCH_RUNS:-1}
+
+# Compose and run each of the micro-benchmarks, and collect their
+# results (the JSON lines they print) in a single report.
+if [ "$1" == "report" ]
+then
+	report=${3:-ubench_report.jsonl}
+	: > ${report}
+	for b in ${ubench_compositions}
+	do
+		./cos compose composition_scripts/${b}.toml ${b} || exit 1
+		for r in $(seq ${ubench_runs})
+		do
+			UBENCH_REPORT=${report} $0 system_binaries/cos_build-${b}/cos.iso $2
+		done
+	done
+	echo "Benchmark report: $(wc -l < ${report}) results in ${report}"
+	exit 0
+fi
+
 num_sockets=1
 num_cores=16
 num_threads=1
@@ -52,10 +79,35 @@ fi
 
 if [ "${arch}" == "x86_64" ]
 then
-	qemu-system-x86_64 ${kvm_flag} -cpu max -smp ${vcpus},cores=${num_cores},threads=${num_threads},sockets=${num_sockets} -m ${mem_size} -cdrom $1 -no-reboot -nographic -s ${debug_flag} -nic none ${nic_flag}
+	qemu="qemu-system-x86_64 ${kvm_flag} -cpu max -smp ${vcpus},cores=${num_cores},threads=${num_threads},sockets=${num_sockets} -m ${mem_size} -cdrom $1 -no-reboot -nographic -s ${debug_flag} -nic none ${nic_flag}"
 elif [ "${arch}" == "i386" ]
 then
-	qemu-system-i386 ${kvm_flag} -cpu max -smp ${vcpus},cores=${num_cores},threads=${num_threads},sockets=${num_sockets} -m ${mem_size} -cdrom $1 -no-reboot -nographic -s ${debug_flag} ${nic_flag}
+	qemu="qemu-system-i386 ${kvm_flag} -cpu max -smp ${vcpus},cores=${num_cores},threads=${num_threads},sockets=${num_sockets} -m ${mem_size} -cdrom $1 -no-reboot -nographic -s ${debug_flag} ${nic_flag}"
 else
 	echo "Unsupported arch!"
+	exit 1
 fi
+
+if [ -z "${UBENCH_REPORT}" ]
+then
+	${qemu}
+	exit $?
+fi
+
+# Append the benchmarks' results to the report, and stop once the
+# benchmarks are done (or time out).
+coproc QEMU { exec timeout ${ubench_timeout} ${qemu} 2>&1; }
+while IFS= read -r line <&"${QEMU[0]}"
+do
+	line=${line%$'\r'}
+	echo "${line}"
+	case "${line}" in
+		'{"ubench_end"'* )
+			kill ${QEMU_PID}
+			break
+			;;
+		'{"ubench"'* | '{"ubench_pmu"'* )
+			echo "${line}" >> ${UBENCH_REPORT}
+			;;
+	esac
+done
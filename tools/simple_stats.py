@@ -6,22 +6,31 @@ import math
 import string
 
 if (len(sys.argv) < 3):
-    print "Usage: ./simple_stats.py <file> <col> <output_type>"
+    print "Usage: ./simple_stats.py <file> <col> <output_type> [<count col>]"
     sys.exit(1)
     
 f = open(sys.argv[1], 'r')
 
 col = string.atoi(sys.argv[2])
 comp_output = sys.argv[3]
+# histograms (e.g. perfdata's "H:" lines) give the count of each value
+count_col = 0
+if (len(sys.argv) > 4):
+    count_col = string.atoi(sys.argv[4])
 
 lines = f.readlines()
 
 times = []
+counts = []
 
 for line in lines:
     line = string.rstrip(line)
     data = re.split("\t", line)
     times.append(data[col-1])
+    if count_col > 0:
+        counts.append(string.atof(data[count_col-1]))
+    else:
+        counts.append(1.0)
 
 #print times
 
@@ -31,15 +40,15 @@ min = 2000000
 max = -1
 t = 0.0
 
-for time in times:
+for time, count in zip(times, counts):
     t = string.atof(time)
     if t > max:
         max = t
     if t < min:
         min = t
-    sum = sum + t
+    sum = sum + t * count
 
-len_times = (float)(len(times))
+len_times = math.fsum(counts)
 
 if len_times == 0:
     average = 0
@@ -48,11 +57,11 @@ else:
 
 # find the standard deviation
 stddev = 0
-for time in times:
+for time, count in zip(times, counts):
     if len_times == 0:
         stddev = 0
     else:
-        stddev = stddev + math.pow((string.atof(time)-(sum/len_times)), 2)
+        stddev = stddev + count * math.pow((string.atof(time)-(sum/len_times)), 2)
         
 if len_times == 1:
     stddev = 0
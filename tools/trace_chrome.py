@@ -0,0 +1,180 @@
+#!/usr/bin/python
+
+# Convert the kernel trace rings' events (`ktrace` lines, see
+# ktrace_print) and the slm schedulers' events (`slmtrace` lines, see
+# sched_trace_print) in a serial log into the Chrome trace-event JSON
+# format, to open in chrome://tracing or ui.perfetto.dev.
+#
+# Usage: ./trace_chrome.py <log> [<out.json>] [<cycles per usec>]
+#
+# The trace has a track for each core, with the thread it executes
+# and the kernel's events on it, and a track for each thread, with
+# its states: running (on which core), blocked (and on what: a
+# blockpoint, e.g. a contended lock, or the thread it donates its
+# priority to), and runnable (woken, or preempted, but not yet
+# dispatched). Arrows link each wakeup to the woken thread's next
+# dispatch, so the latency of lock convoys and priority inversions
+# shows as runnable time. The cycles per microsecond are those the
+# schedulers print, unless given.
+
+from __future__ import print_function
+
+import json
+import re
+import sys
+
+LINE = re.compile(r"(ktrace|slmtrace) (\d+) (\d+) (\w+) (\d+) (\d+)")
+FREQ = re.compile(r"slmtrace \d+ cyc_per_usec (\d+)")
+LOST = re.compile(r"(ktrace|slmtrace) (\d+) lost (\d+)")
+
+CORES   = 0 # the pid of the cores' tracks...
+THREADS = 1 # ...and of the threads'
+
+class Thread:
+    def __init__(self, tid):
+        self.tid     = tid
+        self.state   = None # the open slice: (name, start, args)
+        self.pending = None # why the thread stops running, once it's switched out
+        self.flow    = None # the wakeup to link to its next dispatch
+
+def main():
+    if len(sys.argv) < 2:
+        print("Usage: %s <log> [<out.json>] [<cycles per usec>]" % sys.argv[0])
+        sys.exit(2)
+    out  = sys.argv[2] if len(sys.argv) > 2 else "trace.json"
+    freq = float(sys.argv[3]) if len(sys.argv) > 3 else None
+
+    evts = []
+    lost = {}
+    for line in open(sys.argv[1]):
+        m = FREQ.search(line)
+        if m:
+            if freq is None: freq = float(m.group(1))
+            continue
+        m = LOST.search(line)
+        if m:
+            if int(m.group(3)): lost["%s %s" % (m.group(1), m.group(2))] = int(m.group(3))
+            continue
+        m = LINE.search(line)
+        if m:
+            src, core, tsc, typ, thd, arg = m.groups()
+            evts.append((int(tsc), src, int(core), typ, int(thd), int(arg)))
+    if not evts:
+        print("No ktrace or slmtrace events in %s" % sys.argv[1])
+        sys.exit(1)
+    if freq is None:
+        freq = 1000.0
+        print("Warning: no cycles per usec in the log, assuming %d" % freq, file=sys.stderr)
+
+    evts.sort(key=lambda e: e[0])
+    t0 = evts[0][0]
+    # The kernel's switches are the more precise, when the core has them
+    kswitch = set(e[2] for e in evts if e[1] == "ktrace" and e[3] == "switch")
+
+    trace   = []
+    threads = {}
+    running = {} # core -> (tid, start)
+    flows   = [0]
+
+    def us(tsc):
+        return (tsc - t0) / freq
+
+    def thread(tid):
+        if tid not in threads:
+            threads[tid] = Thread(tid)
+            trace.append({"ph": "M", "name": "thread_name", "pid": THREADS, "tid": tid,
+                          "args": {"name": "thd %d" % tid}})
+        return threads[tid]
+
+    def close(t, tsc):
+        if t.state is None: return
+        name, start, args = t.state
+        trace.append({"ph": "X", "name": name, "pid": THREADS, "tid": t.tid,
+                      "ts": us(start), "dur": us(tsc) - us(start), "args": args})
+        t.state = None
+
+    def instant(pid, tid, tsc, name, args):
+        trace.append({"ph": "i", "s": "t", "name": name, "pid": pid, "tid": tid,
+                      "ts": us(tsc), "args": args})
+
+    def switch(core, tsc, prev, nxt):
+        if core in running:
+            tid, start = running[core]
+            trace.append({"ph": "X", "name": "thd %d" % tid, "pid": CORES, "tid": core,
+                          "ts": us(start), "dur": us(tsc) - us(start), "args": {}})
+            prev = tid
+        running[core] = (nxt, tsc)
+
+        p = thread(prev)
+        if p.state and p.state[0] == "run":
+            close(p, tsc)
+            p.state   = (p.pending or "runnable (preempted)", tsc, {})
+            p.pending = None
+        n = thread(nxt)
+        close(n, tsc)
+        n.state   = ("run", tsc, {"core": core})
+        n.pending = None
+        if n.flow is not None:
+            trace.append({"ph": "f", "bp": "e", "name": "wakeup", "cat": "wakeup", "id": n.flow[1],
+                          "pid": THREADS, "tid": n.tid, "ts": us(tsc)})
+            n.flow = None
+
+    for tsc, src, core, typ, thd, arg in evts:
+        if typ == "switch":
+            if (src == "ktrace") == (core in kswitch):
+                # ktrace: from thd to arg; slmtrace: to thd from arg
+                if src == "ktrace": switch(core, tsc, thd, arg)
+                else:               switch(core, tsc, arg, thd)
+        elif src == "ktrace":
+            instant(CORES, core, tsc, typ, {"thd": thd, "arg": arg})
+        elif typ == "block":
+            t = thread(thd)
+            if t.pending is None: t.pending = "blocked"
+        elif typ == "blkpt_block":
+            thread(thd).pending = "blocked on blkpt %d" % arg
+        elif typ == "depend":
+            thread(thd).pending = "donating to thd %d" % arg
+            instant(THREADS, thd, tsc, "depend", {"on": arg})
+        elif typ == "blkpt_trigger":
+            instant(THREADS, thd, tsc, "trigger blkpt %d" % arg, {})
+        elif typ == "wakeup_remote":
+            # core arg's IPI thread wakes it up later: link its dispatch to us
+            waker = running.get(core, (0, 0))[0]
+            instant(THREADS, waker, tsc, "ipi wakeup", {"thd": thd, "core": arg})
+            flows[0] += 1
+            thread(thd).flow = ("remote", flows[0])
+            trace.append({"ph": "s", "name": "wakeup", "cat": "wakeup", "id": flows[0],
+                          "pid": THREADS, "tid": waker, "ts": us(tsc)})
+        elif typ == "wakeup":
+            t = thread(thd)
+            if t.state and t.state[0] != "run":
+                close(t, tsc)
+                t.state = ("runnable", tsc, {})
+            t.pending = None
+            if t.flow is None or t.flow[0] != "remote":
+                flows[0] += 1
+                t.flow = ("local", flows[0])
+                trace.append({"ph": "s", "name": "wakeup", "cat": "wakeup", "id": flows[0],
+                              "pid": THREADS, "tid": thread(arg).tid, "ts": us(tsc)})
+
+    end = evts[-1][0]
+    for core, (tid, start) in running.items():
+        trace.append({"ph": "X", "name": "thd %d" % tid, "pid": CORES, "tid": core,
+                      "ts": us(start), "dur": us(end) - us(start), "args": {}})
+    for t in threads.values(): close(t, end)
+
+    trace.append({"ph": "M", "name": "process_name", "pid": CORES, "args": {"name": "cores"}})
+    trace.append({"ph": "M", "name": "process_name", "pid": THREADS, "args": {"name": "threads"}})
+    for core in set(e[2] for e in evts):
+        trace.append({"ph": "M", "name": "thread_name", "pid": CORES, "tid": core,
+                      "args": {"name": "core %d" % core}})
+
+    with open(out, "w") as f:
+        json.dump({"traceEvents": trace, "displayTimeUnit": "ns",
+                   "otherData": {"cyc_per_usec": freq, "lost": lost}}, f)
+    print("%d events, over %.1f us, into %s" % (len(evts), us(end), out))
+    for k, v in sorted(lost.items()):
+        print("Warning: %s lost %d events" % (k, v), file=sys.stderr)
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,96 @@
+#!/usr/bin/python
+
+# Compare a report of the micro-benchmarks (tools/run.sh report) to a
+# baseline report, and exit with 1 if any of their metrics regressed.
+#
+# Usage: ./ubench_compare.py <baseline.jsonl> <report.jsonl> [<k>]
+#
+# The metrics are the median (p50) cycles of each `ubench` line, and
+# the instructions, cycles, and events per iteration of each
+# `ubench_pmu` line. A report can hold several runs of each benchmark
+# (UBENCH_RUNS in tools/run.sh): each metric is then the median of the
+# runs, and its noise their median absolute deviation (MAD). A metric
+# regresses if it grows beyond the baseline by more than both its
+# minimal threshold (5% for cycles, 1% for counts, that should be
+# stable across runs), and k (3 by default) times the MAD of the runs.
+
+from __future__ import print_function
+
+import json
+import sys
+
+# The minimal relative change that is reported, by the metric's kind
+REL_CYCLES = 0.05
+REL_COUNTS = 0.01
+# The MAD of a normal distribution, in standard deviations
+MAD_SCALE = 1.4826
+
+def median(vals):
+    vals = sorted(vals)
+    n    = len(vals)
+    if n % 2: return float(vals[n // 2])
+    return (vals[n // 2 - 1] + vals[n // 2]) / 2.0
+
+def mad(vals):
+    m = median(vals)
+    return MAD_SCALE * median([abs(v - m) for v in vals])
+
+# The metrics of a report, as {(benchmark, metric): ([values], rel)}
+def load(path):
+    metrics = {}
+
+    def add(key, val, rel):
+        metrics.setdefault(key, ([], rel))[0].append(float(val))
+
+    for line in open(path):
+        try:
+            r = json.loads(line)
+        except ValueError:
+            # another core's output interleaved with the line
+            continue
+        if "ubench" in r:
+            bench = "%s(%s)@%d" % (r["ubench"], r["params"], r["core"])
+            add((bench, "p50"), r["p50"], REL_CYCLES)
+        elif "ubench_pmu" in r and r["n"] > 0:
+            bench = "%s@%d" % (r["ubench_pmu"], r["core"])
+            n     = float(r["n"])
+            add((bench, "instrs/iter"), r["instrs"] / n, REL_COUNTS)
+            add((bench, "cycles/iter"), r["cycles"] / n, REL_CYCLES)
+            for e, v in r["events"].items():
+                add((bench, e + "/iter"), v / n, REL_COUNTS)
+    return metrics
+
+def main():
+    if len(sys.argv) < 3:
+        print("Usage: %s <baseline.jsonl> <report.jsonl> [<k>]" % sys.argv[0])
+        sys.exit(2)
+    base = load(sys.argv[1])
+    cur  = load(sys.argv[2])
+    k    = float(sys.argv[3]) if len(sys.argv) > 3 else 3.0
+
+    regressions = 0
+    for key in sorted(set(base) | set(cur)):
+        name = "%s %s" % key
+        if key not in cur:
+            print("missing     %s" % name)
+            continue
+        if key not in base:
+            print("new         %s: %.1f" % (name, median(cur[key][0])))
+            continue
+        bvals, rel = base[key]
+        cvals      = cur[key][0]
+        b, c       = median(bvals), median(cvals)
+        noise      = max(mad(bvals), mad(cvals))
+        threshold  = max(rel * b, k * noise)
+        change     = (c - b) / b * 100 if b else 0.0
+        if c - b > threshold:
+            regressions += 1
+            print("REGRESSION  %s: %.1f -> %.1f (%+.1f%%)" % (name, b, c, change))
+        elif b - c > threshold:
+            print("improvement %s: %.1f -> %.1f (%+.1f%%)" % (name, b, c, change))
+
+    print("%d metrics, %d regressions" % (len(cur), regressions))
+    sys.exit(1 if regressions else 0)
+
+if __name__ == "__main__":
+    main()